@@ -17,12 +17,14 @@
 #include "block/block.h"
 #include "qemu/queue.h"
 #include "qemu/sockets.h"
+#include "trace.h"
 
 struct AioHandler
 {
     GPollFD pfd;
     IOHandler *io_read;
     IOHandler *io_write;
+    AioPollFn *io_poll;
     int deleted;
     int pollfds_idx;
     void *opaque;
@@ -80,6 +82,9 @@ void aio_set_fd_handler(AioContext *ctx,
             g_source_add_poll(&ctx->source, &node->pfd);
         }
         /* Update handler with latest information */
+        if (node->opaque != opaque) {
+            node->io_poll = NULL;
+        }
         node->io_read = io_read;
         node->io_write = io_write;
         node->opaque = opaque;
@@ -100,6 +105,22 @@ void aio_set_event_notifier(AioContext *ctx,
                        (IOHandler *)io_read, NULL, notifier);
 }
 
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll)
+{
+    AioHandler *node = find_aio_handler(ctx, fd);
+
+    assert(node);
+    node->io_poll = io_poll;
+    aio_notify(ctx);
+}
+
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll)
+{
+    aio_set_fd_poll(ctx, event_notifier_get_fd(notifier), io_poll);
+}
+
 bool aio_prepare(AioContext *ctx)
 {
     return false;
@@ -124,10 +145,20 @@ bool aio_pending(AioContext *ctx)
     return false;
 }
 
+/* Run an fd handler, accounting the time it takes */
+static void aio_dispatch_handler(AioContext *ctx, IOHandler *cb, void *opaque)
+{
+    int64_t start = get_clock();
+
+    cb(opaque);
+    aio_latency_account(&ctx->stats.handlers, get_clock() - start);
+}
+
 bool aio_dispatch(AioContext *ctx)
 {
     AioHandler *node;
     bool progress = false;
+    int64_t start = get_clock();
 
     /*
      * If there are callbacks left that have been queued, we need to call them.
@@ -155,7 +186,7 @@ bool aio_dispatch(AioContext *ctx)
         if (!node->deleted &&
             (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) &&
             node->io_read) {
-            node->io_read(node->opaque);
+            aio_dispatch_handler(ctx, node->io_read, node->opaque);
 
             /* aio_notify() does not count as progress */
             if (node->opaque != &ctx->notifier) {
@@ -165,7 +196,7 @@ bool aio_dispatch(AioContext *ctx)
         if (!node->deleted &&
             (revents & (G_IO_OUT | G_IO_ERR)) &&
             node->io_write) {
-            node->io_write(node->opaque);
+            aio_dispatch_handler(ctx, node->io_write, node->opaque);
             progress = true;
         }
 
@@ -183,18 +214,91 @@ bool aio_dispatch(AioContext *ctx)
     /* Run our timers */
     progress |= timerlistgroup_run_timers(&ctx->tlg);
 
+    aio_latency_account(&ctx->stats.dispatch, get_clock() - start);
     return progress;
 }
 
+/* Returns true if polling found something to do; @progress is set if a
+ * handler other than aio_notify()'s did actual work.
+ */
+static bool run_poll_handlers_once(AioContext *ctx, bool *progress)
+{
+    AioHandler *node;
+    bool found = false;
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->io_poll && node->io_poll(node->opaque)) {
+            found = true;
+            if (node->opaque != &ctx->notifier) {
+                *progress = true;
+            }
+        }
+    }
+    return found;
+}
+
+/* Busy poll for up to ctx->poll_ns, but not beyond the next timer.  If
+ * something was found, *timeout is set to 0 so that ppoll() does not
+ * block.
+ */
+static void try_poll_mode(AioContext *ctx, int64_t *timeout, bool *progress)
+{
+    int64_t max_ns, end;
+
+    max_ns = *timeout < 0 ? ctx->poll_ns : MIN(ctx->poll_ns, *timeout);
+    if (max_ns == 0) {
+        return;
+    }
+
+    ctx->walking_handlers++;
+    end = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + max_ns;
+    do {
+        if (run_poll_handlers_once(ctx, progress)) {
+            *timeout = 0;
+            break;
+        }
+    } while (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < end);
+    ctx->walking_handlers--;
+}
+
+/* Adjust the polling time based on how long the last blocking
+ * aio_poll() call waited.
+ */
+static void adjust_poll_time(AioContext *ctx, int64_t block_ns)
+{
+    int64_t old = ctx->poll_ns;
+
+    if (block_ns <= ctx->poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+        return;
+    } else if (block_ns > ctx->poll_max_ns) {
+        /* We'd have to poll for too long, poll less */
+        ctx->poll_ns = ctx->poll_shrink ? ctx->poll_ns / ctx->poll_shrink : 0;
+        trace_poll_shrink(ctx, old, ctx->poll_ns);
+    } else if (ctx->poll_ns < ctx->poll_max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t grow = ctx->poll_grow ? ctx->poll_grow : 2;
+
+        ctx->poll_ns = ctx->poll_ns ? ctx->poll_ns * grow : 4000;
+        if (ctx->poll_ns > ctx->poll_max_ns) {
+            ctx->poll_ns = ctx->poll_max_ns;
+        }
+        trace_poll_grow(ctx, old, ctx->poll_ns);
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandler *node;
     bool was_dispatching;
     int ret;
     bool progress;
+    int64_t timeout;
+    int64_t start = 0;
 
     was_dispatching = ctx->dispatching;
     progress = false;
+    ctx->stats.polls++;
 
     /* aio_notify can avoid the expensive event_notifier_set if
      * everything (file descriptors, bottom halves, timers) will
@@ -208,6 +312,12 @@ bool aio_poll(AioContext *ctx, bool blocking)
      */
     aio_set_dispatching(ctx, !blocking);
 
+    timeout = blocking ? aio_compute_timeout(ctx) : 0;
+    if (ctx->poll_max_ns && timeout != 0) {
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        try_poll_mode(ctx, &timeout, &progress);
+    }
+
     ctx->walking_handlers++;
 
     g_array_set_size(ctx->pollfds, 0);
@@ -230,10 +340,15 @@ bool aio_poll(AioContext *ctx, bool blocking)
     /* wait until next event */
     ret = qemu_poll_ns((GPollFD *)ctx->pollfds->data,
                          ctx->pollfds->len,
-                         blocking ? aio_compute_timeout(ctx) : 0);
+                         timeout);
+
+    if (start) {
+        adjust_poll_time(ctx, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+    }
 
     /* if we have any readable fds, dispatch event */
     if (ret > 0) {
+        ctx->stats.wakeups++;
         QLIST_FOREACH(node, &ctx->aio_handlers, node) {
             if (node->pollfds_idx != -1) {
                 GPollFD *pfd = &g_array_index(ctx->pollfds, GPollFD,
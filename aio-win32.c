@@ -144,6 +144,17 @@ void aio_set_event_notifier(AioContext *ctx,
     aio_notify(ctx);
 }
 
+/* Busy polling is not implemented on Windows, aio_poll() always blocks */
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll)
+{
+}
+
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll)
+{
+}
+
 bool aio_prepare(AioContext *ctx)
 {
     static struct timeval tv0;
@@ -283,6 +294,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     int count;
     int timeout;
 
+    ctx->stats.polls++;
     have_select_revents = aio_prepare(ctx);
     if (have_select_revents) {
         blocking = false;
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <zlib.h>
 #ifndef _WIN32
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -40,6 +41,7 @@
 #include "hw/audio/audio.h"
 #include "sysemu/kvm.h"
 #include "migration/migration.h"
+#include "migration/postcopy-ram.h"
 #include "hw/i386/smbios.h"
 #include "exec/address-spaces.h"
 #include "hw/audio/pcspk.h"
@@ -47,11 +49,15 @@
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
 #include "qmp-commands.h"
+#include "qapi/qmp/qerror.h"
 #include "trace.h"
 #include "exec/cpu-all.h"
 #include "exec/ram_addr.h"
 #include "hw/acpi/acpi.h"
 #include "qemu/host-utils.h"
+#include "qemu/iov.h"
+#include "qemu/sockets.h"
+#include "sysemu/hostmem.h"
 
 #ifdef DEBUG_ARCH_INIT
 #define DPRINTF(fmt, ...) \
@@ -112,6 +118,9 @@ const uint32_t arch_type = QEMU_ARCH;
 static bool mig_throttle_on;
 static int dirty_rate_high_cnt;
 static void check_guest_throttling(void);
+static void cpu_throttle_step(void);
+static void cpu_throttle_stop(void);
+static void cpu_throttle_period_start(void);
 
 static uint64_t bitmap_sync_count;
 
@@ -126,6 +135,8 @@ static uint64_t bitmap_sync_count;
 #define RAM_SAVE_FLAG_CONTINUE 0x20
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
+#define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+#define RAM_SAVE_FLAG_MULTIFD_PAGE     0x200
 
 static struct defconfig_file {
     const char *filename;
@@ -304,9 +315,54 @@ uint64_t xbzrle_mig_pages_overflow(void)
     return acct_info.xbzrle_overflows;
 }
 
+XBZRLEBlockStatsList *xbzrle_mig_block_stats(void)
+{
+    XBZRLEBlockStatsList *head = NULL, **tail = &head;
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        XBZRLEBlockStatsList *entry;
+        XBZRLEBlockStats *stats;
+
+        if (!block->xbzrle_lookups) {
+            continue;
+        }
+
+        stats = g_malloc0(sizeof(*stats));
+        stats->id = g_strdup(block->idstr);
+        stats->cache_lookups = block->xbzrle_lookups;
+        stats->cache_miss = block->xbzrle_cache_miss;
+        stats->cache_miss_rate = (double)block->xbzrle_cache_miss /
+                                 block->xbzrle_lookups;
+        stats->overflow = block->xbzrle_overflows;
+        stats->overflow_rate = (double)block->xbzrle_overflows /
+                               block->xbzrle_lookups;
+
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = stats;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
+
+/* This is the last block that we have visited serching for dirty pages
+ */
+static RAMBlock *last_seen_block;
+/* This is the last block from where we have sent data */
+static RAMBlock *last_sent_block;
+static ram_addr_t last_offset;
+static unsigned long *migration_bitmap;
+static uint64_t migration_dirty_pages;
+static uint32_t last_version;
+static bool ram_bulk_stage;
+
+/* The block name is only sent when it differs from the previous page's */
 static size_t save_block_hdr(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
-                             int cont, int flag)
+                             int flag)
 {
+    int cont = (block == last_sent_block) ? RAM_SAVE_FLAG_CONTINUE : 0;
     size_t size;
 
     qemu_put_be64(f, offset | cont | flag);
@@ -318,19 +374,45 @@ static size_t save_block_hdr(QEMUFile *f, RAMBlock *block, ram_addr_t offset,
                         strlen(block->idstr));
         size += 1 + strlen(block->idstr);
     }
+    last_sent_block = block;
     return size;
 }
 
-/* This is the last block that we have visited serching for dirty pages
+/* Pages the destination asked for while in postcopy, sent before anything
+ * else; filled by the return path thread, drained by the migration thread.
  */
-static RAMBlock *last_seen_block;
-/* This is the last block from where we have sent data */
-static RAMBlock *last_sent_block;
-static ram_addr_t last_offset;
-static unsigned long *migration_bitmap;
-static uint64_t migration_dirty_pages;
-static uint32_t last_version;
-static bool ram_bulk_stage;
+typedef struct RAMSrcPageRequest {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    ram_addr_t len;
+
+    QSIMPLEQ_ENTRY(RAMSrcPageRequest) next_req;
+} RAMSrcPageRequest;
+
+static QemuMutex src_page_req_mutex;
+static QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests =
+    QSIMPLEQ_HEAD_INITIALIZER(src_page_requests);
+static uint64_t postcopy_requests;
+
+/* Guest memory the guest reported free, filled by the main loop while
+ * free_page_hints_open and applied to the migration bitmap by the
+ * migration thread.  Hints are only taken before the first bitmap sync
+ * after setup: a later sync may already hold a write the guest made to a
+ * page after reporting it.
+ */
+typedef struct RAMFreePageHint {
+    ram_addr_t start;
+    ram_addr_t len;
+
+    QSIMPLEQ_ENTRY(RAMFreePageHint) next_hint;
+} RAMFreePageHint;
+
+static QemuMutex free_page_hint_mutex;
+static QSIMPLEQ_HEAD(, RAMFreePageHint) free_page_hints =
+    QSIMPLEQ_HEAD_INITIALIZER(free_page_hints);
+static bool free_page_hints_open;
+/* The bulk stage can no longer assume that every page is dirty */
+static bool free_page_hints_applied;
 
 /* Update the xbzrle cache to reflect a page that's been sent as all 0.
  * The important thing is that a stale (not-yet-0'd) page be replaced
@@ -353,13 +435,15 @@ static void xbzrle_cache_zero_page(ram_addr_t current_addr)
 
 static int save_xbzrle_page(QEMUFile *f, uint8_t **current_data,
                             ram_addr_t current_addr, RAMBlock *block,
-                            ram_addr_t offset, int cont, bool last_stage)
+                            ram_addr_t offset, bool last_stage)
 {
     int encoded_len = 0, bytes_sent = -1;
     uint8_t *prev_cached_page;
 
+    block->xbzrle_lookups++;
     if (!cache_is_cached(XBZRLE.cache, current_addr)) {
         acct_info.xbzrle_cache_miss++;
+        block->xbzrle_cache_miss++;
         if (!last_stage) {
             if (cache_insert(XBZRLE.cache, current_addr, *current_data) == -1) {
                 return -1;
@@ -387,6 +471,7 @@ static int save_xbzrle_page(QEMUFile *f, uint8_t **current_data,
     } else if (encoded_len == -1) {
         DPRINTF("Overflow\n");
         acct_info.xbzrle_overflows++;
+        block->xbzrle_overflows++;
         /* update data in the cache */
         if (!last_stage) {
             memcpy(prev_cached_page, *current_data, TARGET_PAGE_SIZE);
@@ -401,7 +486,7 @@ static int save_xbzrle_page(QEMUFile *f, uint8_t **current_data,
     }
 
     /* Send XBZRLE based compressed page */
-    bytes_sent = save_block_hdr(f, block, offset, cont, RAM_SAVE_FLAG_XBZRLE);
+    bytes_sent = save_block_hdr(f, block, offset, RAM_SAVE_FLAG_XBZRLE);
     qemu_put_byte(f, ENCODING_FLAG_XBZRLE);
     qemu_put_be16(f, encoded_len);
     qemu_put_buffer(f, XBZRLE.encoded_buf, encoded_len);
@@ -423,7 +508,7 @@ ram_addr_t migration_bitmap_find_and_reset_dirty(MemoryRegion *mr,
 
     unsigned long next;
 
-    if (ram_bulk_stage && nr > base) {
+    if (ram_bulk_stage && !free_page_hints_applied && nr > base) {
         next = nr + 1;
     } else {
         next = find_next_bit(migration_bitmap, size, nr);
@@ -498,16 +583,11 @@ static void migration_bitmap_sync_init(void)
     num_dirty_pages_period = 0;
 }
 
-static void migration_bitmap_sync(void)
-{
-    RAMBlock *block;
-    uint64_t num_dirty_pages_init = migration_dirty_pages;
-    MigrationState *s = migrate_get_current();
-    int64_t end_time;
-    int64_t bytes_xfer_now;
-    static uint64_t xbzrle_cache_miss_prev;
-    static uint64_t iterations_prev;
+static void ram_apply_free_page_hints(bool close);
 
+static void migration_bitmap_sync_prepare(void)
+{
+    ram_apply_free_page_hints(true);
     bitmap_sync_count++;
 
     if (!bytes_xfer_prev) {
@@ -519,11 +599,16 @@ static void migration_bitmap_sync(void)
     }
 
     trace_migration_bitmap_sync_start();
-    address_space_sync_dirty_bitmap(&address_space_memory);
+}
+
+static void migration_bitmap_sync_account(uint64_t num_dirty_pages_init)
+{
+    MigrationState *s = migrate_get_current();
+    int64_t end_time;
+    int64_t bytes_xfer_now;
+    static uint64_t xbzrle_cache_miss_prev;
+    static uint64_t iterations_prev;
 
-    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        migration_bitmap_sync_range(block->mr->ram_addr, block->length);
-    }
     trace_migration_bitmap_sync_end(migration_dirty_pages
                                     - num_dirty_pages_init);
     num_dirty_pages_period += migration_dirty_pages - num_dirty_pages_init;
@@ -539,17 +624,20 @@ static void migration_bitmap_sync(void)
                we turn on the throttle down logic */
             bytes_xfer_now = ram_bytes_transferred();
             if (s->dirty_pages_rate &&
-               (num_dirty_pages_period * TARGET_PAGE_SIZE >
-                   (bytes_xfer_now - bytes_xfer_prev)/2) &&
-               (dirty_rate_high_cnt++ > 4)) {
-                    trace_migration_throttle();
-                    mig_throttle_on = true;
-                    dirty_rate_high_cnt = 0;
-             }
-             bytes_xfer_prev = bytes_xfer_now;
-        } else {
-             mig_throttle_on = false;
+                (num_dirty_pages_period * TARGET_PAGE_SIZE >
+                 (bytes_xfer_now - bytes_xfer_prev) / 2) &&
+                (dirty_rate_high_cnt++ > 4)) {
+                trace_migration_throttle();
+                mig_throttle_on = true;
+                cpu_throttle_step();
+                dirty_rate_high_cnt = 0;
+            }
+            bytes_xfer_prev = bytes_xfer_now;
+        } else if (mig_throttle_on) {
+            mig_throttle_on = false;
+            cpu_throttle_stop();
         }
+        cpu_throttle_period_start();
         if (migrate_use_xbzrle()) {
             if (iterations_prev != 0) {
                 acct_info.xbzrle_cache_miss_rate =
@@ -570,197 +658,1492 @@ static void migration_bitmap_sync(void)
 }
 
 /*
- * ram_save_page: Send the given page to the stream
- *
- * Returns: Number of bytes written.
+ * With skip-memdev-ram, the RAM of memory backends is left out of the
+ * migration bitmap: the destination maps it from an image instead.
  */
-static int ram_save_page(QEMUFile *f, RAMBlock* block, ram_addr_t offset,
-                         bool last_stage)
+static bool ram_block_skipped(RAMBlock *block)
 {
-    int bytes_sent;
-    int cont;
-    ram_addr_t current_addr;
-    MemoryRegion *mr = block->mr;
-    uint8_t *p;
-    int ret;
-    bool send_async = true;
-
-    cont = (block == last_sent_block) ? RAM_SAVE_FLAG_CONTINUE : 0;
-
-    p = memory_region_get_ram_ptr(mr) + offset;
+    return migrate_skip_memdev_ram() &&
+           object_dynamic_cast(memory_region_owner(block->mr),
+                               TYPE_MEMORY_BACKEND);
+}
 
-    /* In doubt sent page as normal */
-    bytes_sent = -1;
-    ret = ram_control_save_page(f, block->offset,
-                           offset, TARGET_PAGE_SIZE, &bytes_sent);
+static void migration_bitmap_sync(void)
+{
+    RAMBlock *block;
+    uint64_t num_dirty_pages_init = migration_dirty_pages;
 
-    XBZRLE_cache_lock();
+    migration_bitmap_sync_prepare();
+    address_space_sync_dirty_bitmap(&address_space_memory);
 
-    current_addr = block->offset + offset;
-    if (ret != RAM_SAVE_CONTROL_NOT_SUPP) {
-        if (ret != RAM_SAVE_CONTROL_DELAYED) {
-            if (bytes_sent > 0) {
-                acct_info.norm_pages++;
-            } else if (bytes_sent == 0) {
-                acct_info.dup_pages++;
-            }
-        }
-    } else if (is_zero_range(p, TARGET_PAGE_SIZE)) {
-        acct_info.dup_pages++;
-        bytes_sent = save_block_hdr(f, block, offset, cont,
-                                    RAM_SAVE_FLAG_COMPRESS);
-        qemu_put_byte(f, 0);
-        bytes_sent++;
-        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
-         * page would be stale
-         */
-        xbzrle_cache_zero_page(current_addr);
-    } else if (!ram_bulk_stage && migrate_use_xbzrle()) {
-        bytes_sent = save_xbzrle_page(f, &p, current_addr, block,
-                                      offset, cont, last_stage);
-        if (!last_stage) {
-            /* Can't send this cached data async, since the cache page
-             * might get updated before it gets to the wire
-             */
-            send_async = false;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (!ram_block_skipped(block)) {
+            migration_bitmap_sync_range(block->mr->ram_addr, block->length);
         }
     }
+    migration_bitmap_sync_account(num_dirty_pages_init);
+}
 
-    /* XBZRLE overflow or normal page */
-    if (bytes_sent == -1) {
-        bytes_sent = save_block_hdr(f, block, offset, cont, RAM_SAVE_FLAG_PAGE);
-        if (send_async) {
-            qemu_put_buffer_async(f, p, TARGET_PAGE_SIZE);
-        } else {
-            qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
-        }
-        bytes_sent += TARGET_PAGE_SIZE;
-        acct_info.norm_pages++;
-    }
+/*
+ * Most RAM merged into the migration bitmap per iothread lock hold by
+ * migration_bitmap_sync_incremental().  A multiple of BITS_PER_LONG
+ * pages, so that migration_bitmap_sync_range() stays on its word at a
+ * time path.
+ */
+#define MIGRATION_SYNC_CHUNK (256 * 1024 * 1024)
 
-    XBZRLE_cache_unlock();
+/* Needs iothread lock! */
+static RAMBlock *ram_find_block_by_index(int idx)
+{
+    RAMBlock *block;
 
-    return bytes_sent;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (idx-- == 0) {
+            return block;
+        }
+    }
+    return NULL;
 }
 
 /*
- * ram_find_and_save_block: Finds a page to send and sends it to f
+ * Like migration_bitmap_sync(), but called without the iothread lock.
+ * Each RAM block has its dirty log synced on its own, and is merged into
+ * the migration bitmap MIGRATION_SYNC_CHUNK at a time, with the lock
+ * dropped in between.  The guest then stalls for one block's log or one
+ * chunk at most, instead of for a pass over all of its memory.
  *
- * Returns:  The number of bytes written.
- *           0 means no dirty pages
+ * Pages dirtied behind our back while the lock is dropped are left in
+ * the dirty log and picked up by the next sync.  If the set of RAM blocks
+ * changes under us, we just fall back to a full sync.
  */
-
-static int ram_find_and_save_block(QEMUFile *f, bool last_stage)
+static void migration_bitmap_sync_incremental(void)
 {
-    RAMBlock *block = last_seen_block;
-    ram_addr_t offset = last_offset;
-    bool complete_round = false;
-    int bytes_sent = 0;
-    MemoryRegion *mr;
+    RAMBlock *block;
+    uint64_t num_dirty_pages_init = migration_dirty_pages;
+    uint32_t version;
+    ram_addr_t offset, len;
+    int idx;
 
-    if (!block)
-        block = QTAILQ_FIRST(&ram_list.blocks);
+    qemu_mutex_lock_iothread();
+    migration_bitmap_sync_prepare();
+    version = ram_list.version;
 
-    while (true) {
-        mr = block->mr;
-        offset = migration_bitmap_find_and_reset_dirty(mr, offset);
-        if (complete_round && block == last_seen_block &&
-            offset >= last_offset) {
-            break;
+    for (idx = 0; (block = ram_find_block_by_index(idx)) != NULL; idx++) {
+        if (ram_block_skipped(block)) {
+            continue;
         }
-        if (offset >= block->length) {
-            offset = 0;
-            block = QTAILQ_NEXT(block, next);
-            if (!block) {
-                block = QTAILQ_FIRST(&ram_list.blocks);
-                complete_round = true;
-                ram_bulk_stage = false;
+        memory_region_sync_dirty_bitmap(block->mr);
+
+        for (offset = 0; offset < block->length; offset += len) {
+            if (offset) {
+                qemu_mutex_unlock_iothread();
+                qemu_mutex_lock_iothread();
+                if (ram_list.version != version) {
+                    goto full_sync;
+                }
             }
-        } else {
-            bytes_sent = ram_save_page(f, block, offset, last_stage);
+            len = MIN(block->length - offset, MIGRATION_SYNC_CHUNK);
+            migration_bitmap_sync_range(block->mr->ram_addr + offset, len);
+        }
+        trace_migration_bitmap_sync_block(block->idstr, block->length);
 
-            /* if page is unmodified, continue to the next */
-            if (bytes_sent > 0) {
-                last_sent_block = block;
-                break;
-            }
+        qemu_mutex_unlock_iothread();
+        qemu_mutex_lock_iothread();
+        if (ram_list.version != version) {
+            goto full_sync;
         }
     }
-    last_seen_block = block;
-    last_offset = offset;
 
-    return bytes_sent;
+    migration_bitmap_sync_account(num_dirty_pages_init);
+    qemu_mutex_unlock_iothread();
+    return;
+
+full_sync:
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (ram_block_skipped(block)) {
+            continue;
+        }
+        memory_region_sync_dirty_bitmap(block->mr);
+        migration_bitmap_sync_range(block->mr->ram_addr, block->length);
+    }
+    migration_bitmap_sync_account(num_dirty_pages_init);
+    qemu_mutex_unlock_iothread();
 }
 
-static uint64_t bytes_transferred;
+/*
+ * Dirty rate measurement, for calc-dirty-rate.
+ *
+ * This samples the migration dirty log over a time window, without
+ * sending anything anywhere.  It borrows the log from migration, so the
+ * two can't run at the same time.
+ */
 
-void acct_update_position(QEMUFile *f, size_t size, bool zero)
+typedef struct DirtyRateBlock {
+    char *idstr;
+    uint64_t pages;
+} DirtyRateBlock;
+
+static struct {
+    DirtyRateStatus status;
+    QEMUTimer *timer;
+    int64_t start_time;         /* ms, QEMU_CLOCK_REALTIME */
+    int64_t calc_time;          /* s, as requested */
+    int64_t elapsed;            /* ms, as measured */
+    DirtyRateBlock *blocks;     /* result of the last measurement */
+    int nb_blocks;
+} dirty_rate;
+
+/* Count and clear the migration dirty bits of a range */
+static uint64_t dirty_rate_count_range(ram_addr_t start, ram_addr_t length)
 {
-    uint64_t pages = size / TARGET_PAGE_SIZE;
-    if (zero) {
-        acct_info.dup_pages += pages;
+    ram_addr_t addr;
+    unsigned long page = BIT_WORD(start >> TARGET_PAGE_BITS);
+    uint64_t count = 0;
+
+    /* start address is aligned at the start of a word? */
+    if (((page * BITS_PER_LONG) << TARGET_PAGE_BITS) == start) {
+        int k;
+        int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
+        unsigned long *src = ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION];
+
+        for (k = page; k < page + nr; k++) {
+            if (src[k]) {
+                count += ctpopl(src[k]);
+                src[k] = 0;
+            }
+        }
     } else {
-        acct_info.norm_pages += pages;
-        bytes_transferred += size;
-        qemu_update_position(f, size);
+        for (addr = 0; addr < length; addr += TARGET_PAGE_SIZE) {
+            if (cpu_physical_memory_get_dirty(start + addr,
+                                              TARGET_PAGE_SIZE,
+                                              DIRTY_MEMORY_MIGRATION)) {
+                cpu_physical_memory_reset_dirty(start + addr,
+                                                TARGET_PAGE_SIZE,
+                                                DIRTY_MEMORY_MIGRATION);
+                count++;
+            }
+        }
     }
-}
 
-static ram_addr_t ram_save_remaining(void)
-{
-    return migration_dirty_pages;
+    return count;
 }
 
-uint64_t ram_bytes_remaining(void)
+static void dirty_rate_free_blocks(void)
 {
-    return ram_save_remaining() * TARGET_PAGE_SIZE;
-}
+    int i;
 
-uint64_t ram_bytes_transferred(void)
-{
-    return bytes_transferred;
+    for (i = 0; i < dirty_rate.nb_blocks; i++) {
+        g_free(dirty_rate.blocks[i].idstr);
+    }
+    g_free(dirty_rate.blocks);
+    dirty_rate.blocks = NULL;
+    dirty_rate.nb_blocks = 0;
 }
 
-uint64_t ram_bytes_total(void)
+static void dirty_rate_finish(void *opaque)
 {
-    RAMBlock *block;
     uint64_t total = 0;
+    RAMBlock *block;
+    int i = 0;
 
-    QTAILQ_FOREACH(block, &ram_list.blocks, next)
-        total += block->length;
+    dirty_rate.elapsed = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                         dirty_rate.start_time;
+    dirty_rate.elapsed = MAX(dirty_rate.elapsed, 1);
 
-    return total;
+    dirty_rate_free_blocks();
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        dirty_rate.nb_blocks++;
+    }
+    dirty_rate.blocks = g_new0(DirtyRateBlock, dirty_rate.nb_blocks);
+
+    address_space_sync_dirty_bitmap(&address_space_memory);
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        dirty_rate.blocks[i].idstr = g_strdup(block->idstr);
+        dirty_rate.blocks[i].pages =
+            dirty_rate_count_range(block->mr->ram_addr, block->length);
+        total += dirty_rate.blocks[i].pages;
+        i++;
+    }
+    memory_global_dirty_log_stop();
+
+    dirty_rate.status = DIRTY_RATE_STATUS_MEASURED;
+    trace_dirty_rate_finish(dirty_rate.elapsed, total);
 }
 
-void free_xbzrle_decoded_buf(void)
+bool dirty_rate_measuring(void)
 {
-    g_free(xbzrle_decoded_buf);
-    xbzrle_decoded_buf = NULL;
+    return dirty_rate.status == DIRTY_RATE_STATUS_MEASURING;
 }
 
-static void migration_end(void)
+void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
 {
-    if (migration_bitmap) {
-        memory_global_dirty_log_stop();
-        g_free(migration_bitmap);
-        migration_bitmap = NULL;
-    }
+    RAMBlock *block;
 
-    XBZRLE_cache_lock();
-    if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
-        g_free(XBZRLE.encoded_buf);
-        g_free(XBZRLE.current_buf);
-        XBZRLE.cache = NULL;
-        XBZRLE.encoded_buf = NULL;
-        XBZRLE.current_buf = NULL;
+    if (dirty_rate_measuring()) {
+        error_setg(errp, "A dirty rate measurement is already in progress");
+        return;
+    }
+    if (migration_is_active(migrate_get_current())) {
+        error_set(errp, QERR_MIGRATION_ACTIVE);
+        return;
+    }
+    if (calc_time < 1 || calc_time > 60) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "calc-time",
+                  "an integer between 1 and 60");
+        return;
+    }
+
+    /* Start from a clean log: pages dirtied before now don't count */
+    memory_global_dirty_log_start();
+    address_space_sync_dirty_bitmap(&address_space_memory);
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        dirty_rate_count_range(block->mr->ram_addr, block->length);
+    }
+
+    if (!dirty_rate.timer) {
+        dirty_rate.timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                        dirty_rate_finish, NULL);
+    }
+    dirty_rate.start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    dirty_rate.calc_time = calc_time;
+    dirty_rate.status = DIRTY_RATE_STATUS_MEASURING;
+    timer_mod(dirty_rate.timer, dirty_rate.start_time + calc_time * 1000);
+    trace_dirty_rate_start(calc_time);
+}
+
+DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
+{
+    DirtyRateInfo *info = g_malloc0(sizeof(*info));
+    RamBlockDirtyInfoList **tail = &info->blocks;
+    uint64_t total = 0;
+    int i;
+
+    info->status = dirty_rate.status;
+    if (dirty_rate.status == DIRTY_RATE_STATUS_UNSTARTED) {
+        return info;
+    }
+
+    info->has_start_time = true;
+    info->start_time = dirty_rate.start_time;
+    info->calc_time = dirty_rate.calc_time;
+    if (dirty_rate.status == DIRTY_RATE_STATUS_MEASURING) {
+        return info;
+    }
+
+    for (i = 0; i < dirty_rate.nb_blocks; i++) {
+        RamBlockDirtyInfoList *entry = g_malloc0(sizeof(*entry));
+        uint64_t pages = dirty_rate.blocks[i].pages;
+
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->id = g_strdup(dirty_rate.blocks[i].idstr);
+        entry->value->dirty_pages = pages;
+        entry->value->dirty_rate = pages * 1000 / dirty_rate.elapsed;
+        *tail = entry;
+        tail = &entry->next;
+        total += pages;
+    }
+    info->has_blocks = info->blocks != NULL;
+    info->has_dirty_rate = true;
+    info->dirty_rate = total * 1000 / dirty_rate.elapsed;
+
+    return info;
+}
+
+/*
+ * Multi-threaded compression of RAM pages, for the 'compress' capability.
+ *
+ * The migration thread hands each non-zero page to an idle compression
+ * thread, and writes out the result of the previous page that thread
+ * compressed.  All results are written out at the end of each iteration,
+ * so a page is never in flight twice.
+ */
+
+typedef enum {
+    COMP_IDLE,
+    COMP_BUSY,                  /* compressing a page */
+    COMP_DONE,                  /* result waiting to be written out */
+} CompressState;
+
+typedef struct CompressParam {
+    QemuThread thread;
+    QemuMutex mutex;            /* protects block, offset and quit */
+    QemuCond cond;
+    bool quit;
+    RAMBlock *block;            /* page to compress, NULL if none */
+    ram_addr_t offset;
+
+    CompressState state;        /* protected by comp_done_lock */
+
+    /* Owned by the thread while COMP_BUSY, by the migration thread else */
+    RAMBlock *out_block;
+    ram_addr_t out_offset;
+    uint8_t *out;
+    uLongf out_len;             /* 0 if compression failed */
+} CompressParam;
+
+static CompressParam *comp_param;
+static int comp_thread_count;
+static QemuMutex comp_done_lock;
+static QemuCond comp_done_cond;
+
+static void *do_data_compress(void *opaque)
+{
+    CompressParam *param = opaque;
+
+    qemu_mutex_lock(&param->mutex);
+    while (!param->quit) {
+        if (param->block) {
+            RAMBlock *block = param->block;
+            ram_addr_t offset = param->offset;
+            uLongf out_len = compressBound(TARGET_PAGE_SIZE);
+
+            param->block = NULL;
+            qemu_mutex_unlock(&param->mutex);
+
+            /* The guest may write the page meanwhile; it is dirty again
+             * then, and will be sent once more.
+             */
+            if (compress2(param->out, &out_len,
+                          memory_region_get_ram_ptr(block->mr) + offset,
+                          TARGET_PAGE_SIZE,
+                          migrate_compress_level()) != Z_OK) {
+                out_len = 0;
+            }
+
+            qemu_mutex_lock(&comp_done_lock);
+            param->out_len = out_len;
+            param->state = COMP_DONE;
+            qemu_cond_signal(&comp_done_cond);
+            qemu_mutex_unlock(&comp_done_lock);
+
+            qemu_mutex_lock(&param->mutex);
+        } else {
+            qemu_cond_wait(&param->cond, &param->mutex);
+        }
+    }
+    qemu_mutex_unlock(&param->mutex);
+
+    return NULL;
+}
+
+static void compress_threads_save_setup(void)
+{
+    int i;
+
+    if (!migrate_use_compression()) {
+        return;
+    }
+
+    comp_thread_count = migrate_compress_threads();
+    comp_param = g_new0(CompressParam, comp_thread_count);
+    for (i = 0; i < comp_thread_count; i++) {
+        comp_param[i].out = g_malloc(compressBound(TARGET_PAGE_SIZE));
+        qemu_mutex_init(&comp_param[i].mutex);
+        qemu_cond_init(&comp_param[i].cond);
+        qemu_thread_create(&comp_param[i].thread, "compress",
+                           do_data_compress, comp_param + i,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void compress_threads_save_cleanup(void)
+{
+    int i;
+
+    if (!comp_param) {
+        return;
+    }
+
+    for (i = 0; i < comp_thread_count; i++) {
+        qemu_mutex_lock(&comp_param[i].mutex);
+        comp_param[i].quit = true;
+        qemu_cond_signal(&comp_param[i].cond);
+        qemu_mutex_unlock(&comp_param[i].mutex);
+
+        qemu_thread_join(&comp_param[i].thread);
+        qemu_mutex_destroy(&comp_param[i].mutex);
+        qemu_cond_destroy(&comp_param[i].cond);
+        g_free(comp_param[i].out);
+    }
+    g_free(comp_param);
+    comp_param = NULL;
+    comp_thread_count = 0;
+}
+
+/* Write out the result of a compression thread that isn't busy */
+static void compress_flush_param(QEMUFile *f, CompressParam *param,
+                                 uint64_t *bytes_transferred)
+{
+    size_t bytes_sent;
+
+    if (param->out_len) {
+        bytes_sent = save_block_hdr(f, param->out_block, param->out_offset,
+                                    RAM_SAVE_FLAG_COMPRESS_PAGE);
+        qemu_put_be32(f, param->out_len);
+        qemu_put_buffer(f, param->out, param->out_len);
+        bytes_sent += 4 + param->out_len;
+    } else {
+        /* Couldn't compress it, send it as is */
+        bytes_sent = save_block_hdr(f, param->out_block, param->out_offset,
+                                    RAM_SAVE_FLAG_PAGE);
+        qemu_put_buffer(f, memory_region_get_ram_ptr(param->out_block->mr) +
+                        param->out_offset, TARGET_PAGE_SIZE);
+        bytes_sent += TARGET_PAGE_SIZE;
+    }
+    acct_info.norm_pages++;
+    *bytes_transferred += bytes_sent;
+}
+
+/* Wait for all compression threads and write out their results */
+static void flush_compressed_data(QEMUFile *f, uint64_t *bytes_transferred)
+{
+    int i;
+
+    for (i = 0; i < comp_thread_count; i++) {
+        CompressParam *param = &comp_param[i];
+        CompressState state;
+
+        qemu_mutex_lock(&comp_done_lock);
+        while (param->state == COMP_BUSY) {
+            qemu_cond_wait(&comp_done_cond, &comp_done_lock);
+        }
+        state = param->state;
+        param->state = COMP_IDLE;
+        qemu_mutex_unlock(&comp_done_lock);
+
+        if (state == COMP_DONE) {
+            compress_flush_param(f, param, bytes_transferred);
+        }
+    }
+}
+
+static void compress_page_with_multi_thread(QEMUFile *f, RAMBlock *block,
+                                            ram_addr_t offset,
+                                            uint64_t *bytes_transferred)
+{
+    CompressParam *param = NULL;
+    CompressState state;
+    int i;
+
+    qemu_mutex_lock(&comp_done_lock);
+    for (;;) {
+        for (i = 0; i < comp_thread_count; i++) {
+            if (comp_param[i].state != COMP_BUSY) {
+                param = &comp_param[i];
+                break;
+            }
+        }
+        if (param) {
+            break;
+        }
+        qemu_cond_wait(&comp_done_cond, &comp_done_lock);
+    }
+    state = param->state;
+    param->state = COMP_BUSY;
+    qemu_mutex_unlock(&comp_done_lock);
+
+    /* The thread doesn't touch its output until it gets the next page */
+    if (state == COMP_DONE) {
+        compress_flush_param(f, param, bytes_transferred);
+    }
+
+    param->out_block = block;
+    param->out_offset = offset;
+
+    qemu_mutex_lock(&param->mutex);
+    param->block = block;
+    param->offset = offset;
+    qemu_cond_signal(&param->cond);
+    qemu_mutex_unlock(&param->mutex);
+}
+
+/*
+ * Extra connections for RAM pages, for the 'multifd' capability.
+ *
+ * The migration thread batches pages up and hands each batch to an idle
+ * channel thread, which writes the raw pages to its own socket.  The main
+ * stream carries a RAM_SAVE_FLAG_MULTIFD_PAGE header naming the channel
+ * for each page, so the destination reads every channel's pages in the
+ * order they were queued.  Batches are handed out at the end of each
+ * iteration, and the destination waits for them before loading on.
+ */
+
+#define MULTIFD_PAGES_PER_PACKET 64
+
+typedef struct MultiFDSendParams {
+    QemuThread thread;
+    int fd;
+    QemuMutex mutex;            /* protects num and quit */
+    QemuCond cond;
+    bool quit;
+    int num;                    /* pages to send, 0 if none */
+
+    bool busy;                  /* protected by multifd_send_lock */
+
+    /* Owned by the thread while busy, by the migration thread else */
+    struct iovec iov[MULTIFD_PAGES_PER_PACKET];
+} MultiFDSendParams;
+
+static MultiFDSendParams *multifd_send;
+static int multifd_send_count;
+static QemuMutex multifd_send_lock;
+static QemuCond multifd_send_cond;
+static bool multifd_send_error;  /* protected by multifd_send_lock */
+
+/* Pages not handed to a channel yet */
+static struct {
+    RAMBlock *block[MULTIFD_PAGES_PER_PACKET];
+    ram_addr_t offset[MULTIFD_PAGES_PER_PACKET];
+    int num;
+} multifd_pages;
+
+static void *multifd_send_thread(void *opaque)
+{
+    MultiFDSendParams *p = opaque;
+
+    qemu_mutex_lock(&p->mutex);
+    while (!p->quit) {
+        if (p->num) {
+            int num = p->num;
+            size_t size = num * TARGET_PAGE_SIZE;
+            ssize_t ret;
+
+            p->num = 0;
+            qemu_mutex_unlock(&p->mutex);
+
+            ret = iov_send(p->fd, p->iov, num, 0, size);
+
+            qemu_mutex_lock(&multifd_send_lock);
+            if (ret != (ssize_t)size) {
+                multifd_send_error = true;
+            }
+            p->busy = false;
+            qemu_cond_signal(&multifd_send_cond);
+            qemu_mutex_unlock(&multifd_send_lock);
+
+            qemu_mutex_lock(&p->mutex);
+        } else {
+            qemu_cond_wait(&p->cond, &p->mutex);
+        }
+    }
+    qemu_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+/* Start a sending thread on each of the @count connected @fds */
+void multifd_save_setup(const int *fds, int count)
+{
+    int i;
+
+    multifd_send_count = count;
+    multifd_send = g_new0(MultiFDSendParams, count);
+    multifd_send_error = false;
+    multifd_pages.num = 0;
+    for (i = 0; i < count; i++) {
+        MultiFDSendParams *p = &multifd_send[i];
+
+        p->fd = fds[i];
+        qemu_set_block(p->fd);
+        qemu_mutex_init(&p->mutex);
+        qemu_cond_init(&p->cond);
+        qemu_thread_create(&p->thread, "multifd_send", multifd_send_thread,
+                           p, QEMU_THREAD_JOINABLE);
+    }
+}
+
+/* Make the channel threads give up on whatever they are sending */
+void multifd_save_shutdown(void)
+{
+    int i;
+
+    for (i = 0; i < multifd_send_count; i++) {
+        shutdown(multifd_send[i].fd, SHUT_RDWR);
+    }
+}
+
+void multifd_save_cleanup(void)
+{
+    int i;
+
+    if (!multifd_send) {
+        return;
+    }
+
+    for (i = 0; i < multifd_send_count; i++) {
+        MultiFDSendParams *p = &multifd_send[i];
+
+        /* The thread finishes the batch it has before it quits */
+        qemu_mutex_lock(&p->mutex);
+        p->quit = true;
+        qemu_cond_signal(&p->cond);
+        qemu_mutex_unlock(&p->mutex);
+
+        qemu_thread_join(&p->thread);
+        qemu_mutex_destroy(&p->mutex);
+        qemu_cond_destroy(&p->cond);
+        closesocket(p->fd);
+    }
+    g_free(multifd_send);
+    multifd_send = NULL;
+    multifd_send_count = 0;
+}
+
+/* Hand the pending batch of pages to the first idle channel */
+static void multifd_flush_pages(QEMUFile *f, uint64_t *bytes_transferred)
+{
+    MultiFDSendParams *p = NULL;
+    int i;
+
+    if (!multifd_pages.num) {
+        return;
+    }
+
+    qemu_mutex_lock(&multifd_send_lock);
+    while (!multifd_send_error) {
+        for (i = 0; i < multifd_send_count; i++) {
+            if (!multifd_send[i].busy) {
+                p = &multifd_send[i];
+                break;
+            }
+        }
+        if (p) {
+            p->busy = true;
+            break;
+        }
+        qemu_cond_wait(&multifd_send_cond, &multifd_send_lock);
+    }
+    qemu_mutex_unlock(&multifd_send_lock);
+
+    if (!p) {
+        qemu_file_set_error(f, -EIO);
+        multifd_pages.num = 0;
+        return;
+    }
+
+    for (i = 0; i < multifd_pages.num; i++) {
+        RAMBlock *block = multifd_pages.block[i];
+        ram_addr_t offset = multifd_pages.offset[i];
+
+        *bytes_transferred += save_block_hdr(f, block, offset,
+                                             RAM_SAVE_FLAG_MULTIFD_PAGE);
+        qemu_put_byte(f, p - multifd_send);
+        *bytes_transferred += 1 + TARGET_PAGE_SIZE;
+
+        p->iov[i].iov_base = memory_region_get_ram_ptr(block->mr) + offset;
+        p->iov[i].iov_len = TARGET_PAGE_SIZE;
+    }
+    /* The destination only reads from a channel once it has the headers */
+    qemu_fflush(f);
+    qemu_file_credit_transfer(f, multifd_pages.num * TARGET_PAGE_SIZE);
+
+    qemu_mutex_lock(&p->mutex);
+    p->num = multifd_pages.num;
+    qemu_cond_signal(&p->cond);
+    qemu_mutex_unlock(&p->mutex);
+
+    multifd_pages.num = 0;
+}
+
+static void multifd_queue_page(QEMUFile *f, RAMBlock *block,
+                               ram_addr_t offset, uint64_t *bytes_transferred)
+{
+    multifd_pages.block[multifd_pages.num] = block;
+    multifd_pages.offset[multifd_pages.num] = offset;
+    multifd_pages.num++;
+
+    if (multifd_pages.num == MULTIFD_PAGES_PER_PACKET) {
+        multifd_flush_pages(f, bytes_transferred);
+    }
+}
+
+/* Hand out the pending pages and wait until all channels have sent theirs */
+static void multifd_send_sync(QEMUFile *f, uint64_t *bytes_transferred)
+{
+    int i;
+
+    if (!multifd_send) {
+        return;
+    }
+
+    multifd_flush_pages(f, bytes_transferred);
+
+    qemu_mutex_lock(&multifd_send_lock);
+    for (i = 0; i < multifd_send_count; i++) {
+        while (multifd_send[i].busy) {
+            qemu_cond_wait(&multifd_send_cond, &multifd_send_lock);
+        }
+    }
+    if (multifd_send_error) {
+        qemu_file_set_error(f, -EIO);
+    }
+    qemu_mutex_unlock(&multifd_send_lock);
+}
+
+/*
+ * mapped-ram: each RAM block gets a fixed region of the migration file,
+ * right after its entry in the block list that ram_save_setup() sends:
+ *
+ *   be64 bitmap_offset, be64 pages_offset
+ *   ... padding ...
+ *   bitmap_offset: one bit per page, in little-endian 64-bit words,
+ *                  set if the page is present in the file
+ *   pages_offset:  the block's pages at their offset in the block,
+ *                  aligned to MAPPED_RAM_ALIGN
+ *
+ * and the stream carries on after the pages.  Pages are written with
+ * pwrite() instead of going through the stream, so a page that is
+ * dirtied again overwrites its old copy, and the destination can read
+ * the pages back in large chunks, from several threads.  Pages that are
+ * not present are zero.
+ */
+#define MAPPED_RAM_ALIGN (1024 * 1024)
+
+/* Threads reading one RAM block back, and the least each of them reads */
+#define MAPPED_RAM_LOAD_THREADS 8
+#define MAPPED_RAM_LOAD_CHUNK (64 * 1024 * 1024)
+
+static int mapped_ram_fd = -1;
+
+static bool mapped_ram_file_ok(QEMUFile *f)
+{
+    struct stat st;
+    int fd = qemu_get_fd(f);
+
+    return fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static void mapped_ram_setup_block(QEMUFile *f, RAMBlock *block)
+{
+    uint64_t pages = block->length >> TARGET_PAGE_BITS;
+    int64_t offset;
+
+    offset = qemu_file_fd_tell(f);
+    if (offset < 0) {
+        qemu_file_set_error(f, offset);
+        return;
+    }
+
+    /* Skip the two offsets that we are about to write */
+    block->bitmap_offset = QEMU_ALIGN_UP(offset + 16, sizeof(uint64_t));
+    block->pages_offset = QEMU_ALIGN_UP(block->bitmap_offset +
+                                        DIV_ROUND_UP(pages, 64) * 8,
+                                        MAPPED_RAM_ALIGN);
+    block->file_bmap = bitmap_new(pages);
+
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+    qemu_file_fd_seek(f, block->pages_offset + block->length);
+}
+
+static int ram_save_page_mapped(QEMUFile *f, RAMBlock *block,
+                                ram_addr_t offset,
+                                uint64_t *bytes_transferred)
+{
+    static const uint8_t zero_page[TARGET_PAGE_SIZE];
+    unsigned long nr = offset >> TARGET_PAGE_BITS;
+    uint8_t *p = memory_region_get_ram_ptr(block->mr) + offset;
+    ssize_t ret;
+
+    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+        acct_info.dup_pages++;
+        if (!test_and_clear_bit(nr, block->file_bmap)) {
+            return 0;
+        }
+        /* Keep the region an exact image of the block */
+        p = (uint8_t *)zero_page;
+    } else {
+        set_bit(nr, block->file_bmap);
+        acct_info.norm_pages++;
+    }
+
+    ret = pwrite(mapped_ram_fd, p, TARGET_PAGE_SIZE,
+                 block->pages_offset + offset);
+    if (ret != TARGET_PAGE_SIZE) {
+        qemu_file_set_error(f, ret < 0 ? -errno : -EIO);
+        return 0;
+    }
+    qemu_file_credit_transfer(f, TARGET_PAGE_SIZE);
+    *bytes_transferred += TARGET_PAGE_SIZE;
+    return 1;
+}
+
+static void mapped_ram_save_bitmaps(QEMUFile *f)
+{
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        uint64_t pages = block->length >> TARGET_PAGE_BITS;
+        size_t i, words = DIV_ROUND_UP(pages, 64);
+        uint64_t *le;
+        unsigned long nr;
+
+        if (!block->file_bmap) {
+            continue;
+        }
+        le = g_new0(uint64_t, words);
+        for (nr = find_first_bit(block->file_bmap, pages); nr < pages;
+             nr = find_next_bit(block->file_bmap, pages, nr + 1)) {
+            le[nr / 64] |= 1ULL << (nr % 64);
+        }
+        for (i = 0; i < words; i++) {
+            cpu_to_le64s(&le[i]);
+        }
+        if (pwrite(mapped_ram_fd, le, words * 8, block->bitmap_offset) !=
+            words * 8) {
+            qemu_file_set_error(f, -EIO);
+        }
+        g_free(le);
+    }
+}
+
+static void mapped_ram_cleanup(void)
+{
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+    }
+    mapped_ram_fd = -1;
+}
+
+typedef struct MappedRamLoad {
+    QemuThread thread;
+    int fd;
+    uint8_t *host;
+    unsigned long *bmap;
+    uint64_t pages_offset;
+    unsigned long start, end;   /* pages */
+    int ret;
+} MappedRamLoad;
+
+static void *mapped_ram_load_thread(void *opaque)
+{
+    MappedRamLoad *l = opaque;
+    unsigned long first, last;
+    size_t size, done;
+    ssize_t len;
+
+    for (first = find_next_bit(l->bmap, l->end, l->start); first < l->end;
+         first = find_next_bit(l->bmap, l->end, last)) {
+        last = find_next_zero_bit(l->bmap, l->end, first);
+        size = (last - first) << TARGET_PAGE_BITS;
+
+        for (done = 0; done < size; done += len) {
+            len = pread(l->fd, l->host + (first << TARGET_PAGE_BITS) + done,
+                        size - done,
+                        l->pages_offset + (first << TARGET_PAGE_BITS) + done);
+            if (len <= 0) {
+                l->ret = len < 0 ? -errno : -EIO;
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int mapped_ram_load_block(QEMUFile *f, RAMBlock *block,
+                                 uint64_t bitmap_offset, uint64_t pages_offset)
+{
+    uint64_t pages = block->length >> TARGET_PAGE_BITS;
+    size_t i, words = DIV_ROUND_UP(pages, 64);
+    MappedRamLoad loads[MAPPED_RAM_LOAD_THREADS];
+    unsigned long *bmap;
+    unsigned long chunk;
+    uint64_t *le;
+    int fd = qemu_get_fd(f);
+    int n, nthreads, ret = 0;
+
+    if (!mapped_ram_file_ok(f)) {
+        error_report("mapped-ram needs a migration from a file");
+        return -EINVAL;
+    }
+
+    le = g_new(uint64_t, words);
+    if (pread(fd, le, words * 8, bitmap_offset) != words * 8) {
+        error_report("cannot read the page bitmap of RAM block %s",
+                     block->idstr);
+        g_free(le);
+        return -EIO;
+    }
+    bmap = bitmap_new(pages);
+    for (i = 0; i < words; i++) {
+        uint64_t w = le64_to_cpu(le[i]);
+
+        while (w) {
+            set_bit(i * 64 + ctz64(w), bmap);
+            w &= w - 1;
+        }
+    }
+    g_free(le);
+
+    /* Split the block in chunks of whole bitmap words, one per thread */
+    nthreads = MIN(MAPPED_RAM_LOAD_THREADS,
+                   DIV_ROUND_UP(block->length, MAPPED_RAM_LOAD_CHUNK));
+    chunk = QEMU_ALIGN_UP(DIV_ROUND_UP(pages, nthreads), BITS_PER_LONG);
+    for (n = 0; n < nthreads; n++) {
+        loads[n] = (MappedRamLoad) {
+            .fd = fd,
+            .host = memory_region_get_ram_ptr(block->mr),
+            .bmap = bmap,
+            .pages_offset = pages_offset,
+            .start = MIN(n * chunk, pages),
+            .end = MIN((n + 1) * chunk, pages),
+        };
+        qemu_thread_create(&loads[n].thread, "mapped-ram-load",
+                           mapped_ram_load_thread, &loads[n],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (n = 0; n < nthreads; n++) {
+        qemu_thread_join(&loads[n].thread);
+        if (loads[n].ret && !ret) {
+            ret = loads[n].ret;
+            error_report("cannot read RAM block %s: %s", block->idstr,
+                         strerror(-ret));
+        }
+    }
+    g_free(bmap);
+
+    return ret;
+}
+
+/*
+ * ram_save_page: Send the given page to the stream
+ *
+ * With compression, the page may only be written out later on.
+ *
+ * Returns: Number of pages sent, 0 if the page needn't be sent.
+ *          The bytes written are added to @bytes_transferred.
+ */
+static int ram_save_page(QEMUFile *f, RAMBlock* block, ram_addr_t offset,
+                         bool last_stage, uint64_t *bytes_transferred)
+{
+    int bytes_sent;
+    ram_addr_t current_addr;
+    MemoryRegion *mr = block->mr;
+    uint8_t *p;
+    int ret;
+    bool send_async = true;
+    bool in_postcopy = migration_in_postcopy(migrate_get_current());
+
+    if (mapped_ram_fd >= 0) {
+        return ram_save_page_mapped(f, block, offset, bytes_transferred);
+    }
+
+    p = memory_region_get_ram_ptr(mr) + offset;
+
+    /* In doubt sent page as normal */
+    bytes_sent = -1;
+    ret = ram_control_save_page(f, block->offset,
+                           offset, TARGET_PAGE_SIZE, &bytes_sent);
+
+    XBZRLE_cache_lock();
+
+    current_addr = block->offset + offset;
+    if (ret != RAM_SAVE_CONTROL_NOT_SUPP) {
+        if (ret != RAM_SAVE_CONTROL_DELAYED) {
+            if (bytes_sent > 0) {
+                acct_info.norm_pages++;
+            } else if (bytes_sent == 0) {
+                acct_info.dup_pages++;
+            }
+        }
+    } else if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+        acct_info.dup_pages++;
+        bytes_sent = save_block_hdr(f, block, offset, RAM_SAVE_FLAG_COMPRESS);
+        qemu_put_byte(f, 0);
+        bytes_sent++;
+        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
+         * page would be stale
+         */
+        xbzrle_cache_zero_page(current_addr);
+    } else if (comp_param && !in_postcopy) {
+        /* The destination places whole pages once it runs */
+        XBZRLE_cache_unlock();
+        compress_page_with_multi_thread(f, block, offset, bytes_transferred);
+        return 1;
+    } else if (multifd_send && !in_postcopy) {
+        XBZRLE_cache_unlock();
+        multifd_queue_page(f, block, offset, bytes_transferred);
+        acct_info.norm_pages++;
+        return 1;
+    } else if (!ram_bulk_stage && migrate_use_xbzrle() && !in_postcopy) {
+        /* The destination places whole pages once it runs: no XBZRLE */
+        bytes_sent = save_xbzrle_page(f, &p, current_addr, block,
+                                      offset, last_stage);
+        if (!last_stage) {
+            /* Can't send this cached data async, since the cache page
+             * might get updated before it gets to the wire
+             */
+            send_async = false;
+        }
+    }
+
+    /* XBZRLE overflow or normal page */
+    if (bytes_sent == -1) {
+        bytes_sent = save_block_hdr(f, block, offset, RAM_SAVE_FLAG_PAGE);
+        if (send_async) {
+            qemu_put_buffer_async(f, p, TARGET_PAGE_SIZE);
+        } else {
+            qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
+        }
+        bytes_sent += TARGET_PAGE_SIZE;
+        acct_info.norm_pages++;
+    }
+
+    XBZRLE_cache_unlock();
+
+    if (bytes_sent <= 0) {
+        return 0;
+    }
+    *bytes_transferred += bytes_sent;
+    return 1;
+}
+
+/*
+ * ram_get_queued_page: Pops the next page the destination asked for
+ *
+ * Pages that have been sent since they were requested are skipped.
+ *
+ * Returns: the block of the page, with its offset in @offset, or NULL if
+ *          there is nothing left to send in the queue.
+ */
+static RAMBlock *ram_get_queued_page(ram_addr_t *offset)
+{
+    RAMSrcPageRequest *entry;
+    RAMBlock *block = NULL;
+
+    qemu_mutex_lock(&src_page_req_mutex);
+    while (!block && (entry = QSIMPLEQ_FIRST(&src_page_requests))) {
+        unsigned long nr = (entry->rb->mr->ram_addr + entry->offset) >>
+                           TARGET_PAGE_BITS;
+
+        if (test_and_clear_bit(nr, migration_bitmap)) {
+            migration_dirty_pages--;
+            block = entry->rb;
+            *offset = entry->offset;
+        }
+
+        if (entry->len > TARGET_PAGE_SIZE) {
+            entry->offset += TARGET_PAGE_SIZE;
+            entry->len -= TARGET_PAGE_SIZE;
+        } else {
+            QSIMPLEQ_REMOVE_HEAD(&src_page_requests, next_req);
+            g_free(entry);
+        }
+    }
+    qemu_mutex_unlock(&src_page_req_mutex);
+
+    return block;
+}
+
+/*
+ * ram_save_queue_pages: Queue pages the destination faulted on
+ *
+ * Called from the return path thread.  @rbname is the RAMBlock id and
+ * @start/@len are in bytes within it.
+ *
+ * Returns: 0 on success, negative on a bad request
+ */
+int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
+{
+    RAMSrcPageRequest *new_entry;
+    RAMBlock *block;
+
+    trace_ram_save_queue_pages(rbname, start, len);
+    atomic_inc(&postcopy_requests);
+
+    /* The block list can't change while the source is stopped */
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (!strcmp(rbname, block->idstr)) {
+            break;
+        }
+    }
+    if (!block) {
+        error_report("%s: RAMBlock %s not found", __func__, rbname);
+        return -EINVAL;
+    }
+    if ((start | len) & ~TARGET_PAGE_MASK || !len ||
+        start + len > block->length) {
+        error_report("%s: request 0x" RAM_ADDR_FMT "/0x" RAM_ADDR_FMT
+                     " out of range for %s (0x" RAM_ADDR_FMT ")", __func__,
+                     start, len, rbname, block->length);
+        return -EINVAL;
+    }
+
+    new_entry = g_new0(RAMSrcPageRequest, 1);
+    new_entry->rb = block;
+    new_entry->offset = start;
+    new_entry->len = len;
+
+    qemu_mutex_lock(&src_page_req_mutex);
+    QSIMPLEQ_INSERT_TAIL(&src_page_requests, new_entry, next_req);
+    qemu_mutex_unlock(&src_page_req_mutex);
+
+    return 0;
+}
+
+static void ram_flush_queued_pages(void)
+{
+    RAMSrcPageRequest *entry;
+
+    qemu_mutex_lock(&src_page_req_mutex);
+    while ((entry = QSIMPLEQ_FIRST(&src_page_requests))) {
+        QSIMPLEQ_REMOVE_HEAD(&src_page_requests, next_req);
+        g_free(entry);
+    }
+    qemu_mutex_unlock(&src_page_req_mutex);
+}
+
+/*
+ * ram_free_page_hint: Note that the guest considers @len bytes at @host free
+ *
+ * Called from the main loop, with the iothread lock held, by devices that
+ * receive free page hints from the guest.  Pages in the range are not
+ * sent by the first pass of a migration unless the guest dirties them.
+ */
+void ram_free_page_hint(void *host, size_t len)
+{
+    RAMFreePageHint *hint;
+    ram_addr_t start, last;
+
+    if (!len || !qemu_ram_addr_from_host(host, &start) ||
+        !qemu_ram_addr_from_host((uint8_t *)host + len - 1, &last) ||
+        last - start != len - 1) {
+        return;
+    }
+
+    /* Only whole target pages can be skipped */
+    last = QEMU_ALIGN_DOWN(start + len, TARGET_PAGE_SIZE);
+    start = QEMU_ALIGN_UP(start, TARGET_PAGE_SIZE);
+    if (start >= last) {
+        return;
+    }
+
+    qemu_mutex_lock(&free_page_hint_mutex);
+    if (free_page_hints_open) {
+        hint = g_new0(RAMFreePageHint, 1);
+        hint->start = start;
+        hint->len = last - start;
+        QSIMPLEQ_INSERT_TAIL(&free_page_hints, hint, next_hint);
+    }
+    qemu_mutex_unlock(&free_page_hint_mutex);
+}
+
+/* Called from the migration thread; @close stops taking new hints */
+static void ram_apply_free_page_hints(bool close)
+{
+    RAMFreePageHint *hint;
+    uint64_t pages = 0;
+
+    qemu_mutex_lock(&free_page_hint_mutex);
+    while ((hint = QSIMPLEQ_FIRST(&free_page_hints))) {
+        unsigned long end = (hint->start + hint->len) >> TARGET_PAGE_BITS;
+        unsigned long nr = hint->start >> TARGET_PAGE_BITS;
+
+        for (nr = find_next_bit(migration_bitmap, end, nr); nr < end;
+             nr = find_next_bit(migration_bitmap, end, nr + 1)) {
+            clear_bit(nr, migration_bitmap);
+            migration_dirty_pages--;
+            pages++;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&free_page_hints, next_hint);
+        g_free(hint);
+    }
+    if (close) {
+        free_page_hints_open = false;
+    }
+    qemu_mutex_unlock(&free_page_hint_mutex);
+
+    if (pages) {
+        free_page_hints_applied = true;
+        trace_ram_free_page_hints_applied(pages);
+    }
+}
+
+static void ram_flush_free_page_hints(void)
+{
+    RAMFreePageHint *hint;
+
+    qemu_mutex_lock(&free_page_hint_mutex);
+    while ((hint = QSIMPLEQ_FIRST(&free_page_hints))) {
+        QSIMPLEQ_REMOVE_HEAD(&free_page_hints, next_hint);
+        g_free(hint);
+    }
+    free_page_hints_open = false;
+    qemu_mutex_unlock(&free_page_hint_mutex);
+}
+
+uint64_t ram_postcopy_requests(void)
+{
+    return atomic_read(&postcopy_requests);
+}
+
+/*
+ * ram_find_and_save_block: Finds a page to send and sends it to f
+ *
+ * In postcopy, pages the destination is waiting for go first.
+ *
+ * Returns:  The number of pages written.
+ *           0 means no dirty pages
+ */
+
+static int ram_find_and_save_block(QEMUFile *f, bool last_stage,
+                                   uint64_t *bytes_transferred)
+{
+    RAMBlock *block = last_seen_block;
+    ram_addr_t offset = last_offset;
+    bool complete_round = false;
+    int pages = 0;
+    MemoryRegion *mr;
+
+    if (migration_in_postcopy(migrate_get_current())) {
+        RAMBlock *req_block;
+        ram_addr_t req_offset;
+
+        /* The background scan carries on from where it was afterwards */
+        req_block = ram_get_queued_page(&req_offset);
+        if (req_block) {
+            pages = ram_save_page(f, req_block, req_offset, last_stage,
+                                  bytes_transferred);
+            if (pages > 0) {
+                return pages;
+            }
+        }
+    }
+
+    if (!block)
+        block = QTAILQ_FIRST(&ram_list.blocks);
+
+    while (true) {
+        mr = block->mr;
+        offset = migration_bitmap_find_and_reset_dirty(mr, offset);
+        if (complete_round && block == last_seen_block &&
+            offset >= last_offset) {
+            break;
+        }
+        if (offset >= block->length) {
+            offset = 0;
+            block = QTAILQ_NEXT(block, next);
+            if (!block) {
+                block = QTAILQ_FIRST(&ram_list.blocks);
+                complete_round = true;
+                ram_bulk_stage = false;
+            }
+        } else {
+            pages = ram_save_page(f, block, offset, last_stage,
+                                  bytes_transferred);
+
+            /* if page is unmodified, continue to the next */
+            if (pages > 0) {
+                break;
+            }
+        }
+    }
+    last_seen_block = block;
+    last_offset = offset;
+
+    return pages;
+}
+
+static uint64_t bytes_transferred;
+
+void acct_update_position(QEMUFile *f, size_t size, bool zero)
+{
+    uint64_t pages = size / TARGET_PAGE_SIZE;
+    if (zero) {
+        acct_info.dup_pages += pages;
+    } else {
+        acct_info.norm_pages += pages;
+        bytes_transferred += size;
+        qemu_update_position(f, size);
+    }
+}
+
+static ram_addr_t ram_save_remaining(void)
+{
+    return migration_dirty_pages;
+}
+
+uint64_t ram_bytes_remaining(void)
+{
+    return ram_save_remaining() * TARGET_PAGE_SIZE;
+}
+
+uint64_t ram_bytes_transferred(void)
+{
+    return bytes_transferred;
+}
+
+uint64_t ram_bytes_total(void)
+{
+    RAMBlock *block;
+    uint64_t total = 0;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next)
+        total += block->length;
+
+    return total;
+}
+
+void free_xbzrle_decoded_buf(void)
+{
+    g_free(xbzrle_decoded_buf);
+    xbzrle_decoded_buf = NULL;
+}
+
+static void migration_end(void)
+{
+    if (migration_bitmap) {
+        memory_global_dirty_log_stop();
+        g_free(migration_bitmap);
+        migration_bitmap = NULL;
+    }
+
+    XBZRLE_cache_lock();
+    if (XBZRLE.cache) {
+        cache_fini(XBZRLE.cache);
+        g_free(XBZRLE.encoded_buf);
+        g_free(XBZRLE.current_buf);
+        XBZRLE.cache = NULL;
+        XBZRLE.encoded_buf = NULL;
+        XBZRLE.current_buf = NULL;
     }
     XBZRLE_cache_unlock();
+
+    compress_threads_save_cleanup();
+    ram_flush_queued_pages();
+    ram_flush_free_page_hints();
+    mapped_ram_cleanup();
+
+    mig_throttle_on = false;
+    cpu_throttle_stop();
+}
+
+static void ram_migration_cancel(void *opaque)
+{
+    migration_end();
+}
+
+/*
+ * ram_postcopy_send_discard_bitmap: Tell the destination which pages to drop
+ *
+ * Called with the source stopped, right before the switch to postcopy.
+ * Every page still dirty here was either never sent or has been modified
+ * since; the destination drops them so that touching them faults and they
+ * are requested.
+ *
+ * Returns: 0 on success, negative on stream error
+ */
+int ram_postcopy_send_discard_bitmap(MigrationState *ms)
+{
+    uint64_t start_list[MAX_DISCARDS_PER_COMMAND];
+    uint64_t length_list[MAX_DISCARDS_PER_COMMAND];
+    RAMBlock *block;
+
+    trace_ram_postcopy_send_discard_bitmap();
+    qemu_mutex_lock_ramlist();
+    migration_bitmap_sync();
+
+    /* From now on, pages can be sent out of order: the bitmap is exact */
+    ram_bulk_stage = false;
+    last_sent_block = NULL;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        unsigned long base = block->mr->ram_addr >> TARGET_PAGE_BITS;
+        unsigned long end = base + (block->length >> TARGET_PAGE_BITS);
+        unsigned long cur = base;
+        uint16_t nr = 0;
+
+        while (cur < end) {
+            unsigned long one = find_next_bit(migration_bitmap, end, cur);
+            unsigned long zero;
+
+            if (one >= end) {
+                break;
+            }
+            zero = find_next_zero_bit(migration_bitmap, end, one + 1);
+
+            start_list[nr] = (uint64_t)(one - base) << TARGET_PAGE_BITS;
+            length_list[nr] = (uint64_t)(zero - one) << TARGET_PAGE_BITS;
+            if (++nr == MAX_DISCARDS_PER_COMMAND) {
+                qemu_savevm_send_postcopy_ram_discard(ms->file, block->idstr,
+                                                      nr, start_list,
+                                                      length_list);
+                nr = 0;
+            }
+            cur = zero;
+        }
+        if (nr) {
+            qemu_savevm_send_postcopy_ram_discard(ms->file, block->idstr, nr,
+                                                  start_list, length_list);
+        }
+    }
+    qemu_mutex_unlock_ramlist();
+
+    return qemu_file_get_error(ms->file);
 }
 
-static void ram_migration_cancel(void *opaque)
+/*
+ * ram_discard_range: Drop [start, start + length) of RAMBlock @block_name
+ *
+ * Destination side of ram_postcopy_send_discard_bitmap().
+ */
+int ram_discard_range(MigrationIncomingState *mis, const char *block_name,
+                      uint64_t start, uint64_t length)
 {
-    migration_end();
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (!strcmp(block_name, block->idstr)) {
+            break;
+        }
+    }
+    if (!block) {
+        error_report("ram_discard_range: Failed to find block '%s'",
+                     block_name);
+        return -EINVAL;
+    }
+    if ((start | length) & ~TARGET_PAGE_MASK ||
+        start + length < start || start + length > block->length) {
+        error_report("ram_discard_range: Overrun block '%s' (0x%" PRIx64
+                     "/0x%" PRIx64 "/0x" RAM_ADDR_FMT ")",
+                     block_name, start, length, block->length);
+        return -EINVAL;
+    }
+
+    return postcopy_ram_discard_range(mis,
+                                      memory_region_get_ram_ptr(block->mr) +
+                                      start, length);
+}
+
+/*
+ * ram_block_name_from_host: Find the RAMBlock that contains @host
+ *
+ * Returns: the block id, with the offset of @host in the block in @offset,
+ *          or NULL if @host isn't guest RAM.
+ */
+const char *ram_block_name_from_host(void *host, ram_addr_t *offset)
+{
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        uint8_t *start = memory_region_get_ram_ptr(block->mr);
+
+        if ((uint8_t *)host >= start &&
+            (uint8_t *)host < start + block->length) {
+            *offset = (uint8_t *)host - start;
+            return block->idstr;
+        }
+    }
+
+    return NULL;
+}
+
+static bool ram_can_postcopy(void *opaque)
+{
+    return migrate_postcopy_ram();
 }
 
 static void reset_ram_globals(void)
@@ -779,6 +2162,30 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     RAMBlock *block;
     int64_t ram_bitmap_pages; /* Size of bitmap in pages, including gaps */
 
+    /* Both need the migration dirty log for themselves */
+    if (dirty_rate_measuring()) {
+        error_report("A dirty rate measurement is in progress");
+        return -EBUSY;
+    }
+
+    if (migrate_skip_memdev_ram() && migrate_postcopy_ram()) {
+        error_report("skip-memdev-ram is not compatible with postcopy-ram");
+        return -EINVAL;
+    }
+
+    if (migrate_use_mapped_ram()) {
+        if (migrate_postcopy_ram() || migrate_use_compression() ||
+            migrate_use_multifd() || migrate_use_xbzrle()) {
+            error_report("mapped-ram is not compatible with postcopy-ram, "
+                         "compress, multifd or xbzrle");
+            return -EINVAL;
+        }
+        if (!mapped_ram_file_ok(f)) {
+            error_report("mapped-ram needs a migration to a file");
+            return -EINVAL;
+        }
+    }
+
     mig_throttle_on = false;
     dirty_rate_high_cnt = 0;
     bitmap_sync_count = 0;
@@ -814,10 +2221,14 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         acct_clear();
     }
 
+    compress_threads_save_setup();
+
     qemu_mutex_lock_iothread();
     qemu_mutex_lock_ramlist();
     bytes_transferred = 0;
+    postcopy_requests = 0;
     reset_ram_globals();
+    cpu_throttle_stop();
 
     ram_bitmap_pages = last_ram_offset() >> TARGET_PAGE_BITS;
     migration_bitmap = bitmap_new(ram_bitmap_pages);
@@ -832,19 +2243,39 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         uint64_t block_pages;
 
         block_pages = block->length >> TARGET_PAGE_BITS;
-        migration_dirty_pages += block_pages;
+        if (ram_block_skipped(block)) {
+            bitmap_clear(migration_bitmap,
+                         block->mr->ram_addr >> TARGET_PAGE_BITS, block_pages);
+        } else {
+            migration_dirty_pages += block_pages;
+        }
+
+        block->xbzrle_lookups = 0;
+        block->xbzrle_cache_miss = 0;
+        block->xbzrle_overflows = 0;
     }
 
     memory_global_dirty_log_start();
     migration_bitmap_sync();
+
+    free_page_hints_applied = false;
+    qemu_mutex_lock(&free_page_hint_mutex);
+    free_page_hints_open = true;
+    qemu_mutex_unlock(&free_page_hint_mutex);
     qemu_mutex_unlock_iothread();
 
     qemu_put_be64(f, ram_bytes_total() | RAM_SAVE_FLAG_MEM_SIZE);
 
+    if (migrate_use_mapped_ram()) {
+        mapped_ram_fd = qemu_get_fd(f);
+    }
     QTAILQ_FOREACH(block, &ram_list.blocks, next) {
         qemu_put_byte(f, strlen(block->idstr));
         qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
         qemu_put_be64(f, block->length);
+        if (mapped_ram_fd >= 0) {
+            mapped_ram_setup_block(f, block);
+        }
     }
 
     qemu_mutex_unlock_ramlist();
@@ -862,7 +2293,7 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     int ret;
     int i;
     int64_t t0;
-    int total_sent = 0;
+    int pages_sent = 0;
 
     qemu_mutex_lock_ramlist();
 
@@ -871,18 +2302,19 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     }
 
     ram_control_before_iterate(f, RAM_CONTROL_ROUND);
+    ram_apply_free_page_hints(false);
 
     t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     i = 0;
     while ((ret = qemu_file_rate_limit(f)) == 0) {
-        int bytes_sent;
+        int pages;
 
-        bytes_sent = ram_find_and_save_block(f, false);
+        pages = ram_find_and_save_block(f, false, &bytes_transferred);
         /* no more blocks to sent */
-        if (bytes_sent == 0) {
+        if (pages == 0) {
             break;
         }
-        total_sent += bytes_sent;
+        pages_sent += pages;
         acct_info.iterations++;
         check_guest_throttling();
         /* we want to check in the 1st loop, just in case it was the 1st time
@@ -900,158 +2332,532 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
         }
         i++;
     }
+    flush_compressed_data(f, &bytes_transferred);
+    multifd_flush_pages(f, &bytes_transferred);
+
+    qemu_mutex_unlock_ramlist();
+
+    /*
+     * Must occur before EOS (or any QEMUFile operation)
+     * because of RDMA protocol.
+     */
+    ram_control_after_iterate(f, RAM_CONTROL_ROUND);
+
+    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
+    bytes_transferred += 8;
+
+    ret = qemu_file_get_error(f);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return pages_sent;
+}
+
+static int ram_save_complete(QEMUFile *f, void *opaque)
+{
+    qemu_mutex_lock_ramlist();
+    migration_bitmap_sync();
+
+    ram_control_before_iterate(f, RAM_CONTROL_FINISH);
+
+    /* try transferring iterative blocks of memory */
+
+    /* flush all remaining blocks regardless of rate limiting */
+    while (true) {
+        int pages;
+
+        pages = ram_find_and_save_block(f, true, &bytes_transferred);
+        /* no more blocks to sent */
+        if (pages == 0) {
+            break;
+        }
+    }
+    flush_compressed_data(f, &bytes_transferred);
+    multifd_send_sync(f, &bytes_transferred);
+    if (mapped_ram_fd >= 0) {
+        mapped_ram_save_bitmaps(f);
+    }
+
+    ram_control_after_iterate(f, RAM_CONTROL_FINISH);
+    migration_end();
+
+    qemu_mutex_unlock_ramlist();
+    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
+    qemu_file_zerocopy_flush(f);
+
+    return 0;
+}
+
+static uint64_t ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size)
+{
+    uint64_t remaining_size;
+
+    remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
+
+    if (remaining_size < max_size) {
+        /* Let each round's zero copy sends complete before the next one */
+        qemu_file_zerocopy_flush(f);
+        migration_bitmap_sync_incremental();
+        remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
+    }
+    return remaining_size;
+}
+
+static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
+{
+    unsigned int xh_len;
+    int xh_flags;
+
+    if (!xbzrle_decoded_buf) {
+        xbzrle_decoded_buf = g_malloc(TARGET_PAGE_SIZE);
+    }
+
+    /* extract RLE header */
+    xh_flags = qemu_get_byte(f);
+    xh_len = qemu_get_be16(f);
+
+    if (xh_flags != ENCODING_FLAG_XBZRLE) {
+        error_report("Failed to load XBZRLE page - wrong compression!");
+        return -1;
+    }
+
+    if (xh_len > TARGET_PAGE_SIZE) {
+        error_report("Failed to load XBZRLE page - len overflow!");
+        return -1;
+    }
+    /* load data and decode */
+    qemu_get_buffer(f, xbzrle_decoded_buf, xh_len);
+
+    /* decode RLE */
+    if (xbzrle_decode_buffer(xbzrle_decoded_buf, xh_len, host,
+                             TARGET_PAGE_SIZE) == -1) {
+        error_report("Failed to load XBZRLE page - decode error!");
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void *host_from_stream_offset(QEMUFile *f,
+                                            ram_addr_t offset,
+                                            int flags)
+{
+    static RAMBlock *block = NULL;
+    char id[256];
+    uint8_t len;
+
+    if (flags & RAM_SAVE_FLAG_CONTINUE) {
+        if (!block || block->length <= offset) {
+            error_report("Ack, bad migration stream!");
+            return NULL;
+        }
+
+        return memory_region_get_ram_ptr(block->mr) + offset;
+    }
+
+    len = qemu_get_byte(f);
+    qemu_get_buffer(f, (uint8_t *)id, len);
+    id[len] = 0;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (!strncmp(id, block->idstr, sizeof(id)) && block->length > offset) {
+            return memory_region_get_ram_ptr(block->mr) + offset;
+        }
+    }
+
+    error_report("Can't find block %s!", id);
+    return NULL;
+}
+
+/*
+ * If a page (or a whole RDMA chunk) has been
+ * determined to be zero, then zap it.
+ */
+void ram_handle_compressed(void *host, uint8_t ch, uint64_t size)
+{
+    if (ch != 0 || !is_zero_range(host, size)) {
+        memset(host, ch, size);
+    }
+}
+
+/*
+ * Multi-threaded decompression of RAM_SAVE_FLAG_COMPRESS_PAGE pages.
+ *
+ * The incoming coroutine reads the compressed data into an idle thread's
+ * buffer and moves on to the next page; the thread inflates it straight
+ * into guest RAM.
+ */
+
+typedef struct DecompressParam {
+    QemuThread thread;
+    QemuMutex mutex;            /* protects des, len and quit */
+    QemuCond cond;
+    bool quit;
+    void *des;                  /* where to inflate to, NULL if none */
+    uint8_t *compbuf;
+    int len;
+
+    bool busy;                  /* protected by decomp_done_lock */
+} DecompressParam;
+
+static DecompressParam *decomp_param;
+static int decomp_thread_count;
+static QemuMutex decomp_done_lock;
+static QemuCond decomp_done_cond;
+static bool decomp_error;       /* protected by decomp_done_lock */
+
+/* Returns false if the data didn't inflate to exactly one page */
+static bool decompress_page(void *des, uint8_t *compbuf, int len)
+{
+    uLongf pagesize = TARGET_PAGE_SIZE;
+
+    return uncompress(des, &pagesize, compbuf, len) == Z_OK &&
+           pagesize == TARGET_PAGE_SIZE;
+}
+
+static void *do_data_decompress(void *opaque)
+{
+    DecompressParam *param = opaque;
+
+    qemu_mutex_lock(&param->mutex);
+    while (!param->quit) {
+        if (param->des) {
+            void *des = param->des;
+            bool ok;
+
+            param->des = NULL;
+            qemu_mutex_unlock(&param->mutex);
+
+            ok = decompress_page(des, param->compbuf, param->len);
+
+            qemu_mutex_lock(&decomp_done_lock);
+            if (!ok) {
+                decomp_error = true;
+            }
+            param->busy = false;
+            qemu_cond_signal(&decomp_done_cond);
+            qemu_mutex_unlock(&decomp_done_lock);
+
+            qemu_mutex_lock(&param->mutex);
+        } else {
+            qemu_cond_wait(&param->cond, &param->mutex);
+        }
+    }
+    qemu_mutex_unlock(&param->mutex);
+
+    return NULL;
+}
+
+void migrate_decompress_threads_create(void)
+{
+    int i;
+
+    decomp_thread_count = migrate_decompress_threads();
+    decomp_param = g_new0(DecompressParam, decomp_thread_count);
+    decomp_error = false;
+    for (i = 0; i < decomp_thread_count; i++) {
+        decomp_param[i].compbuf = g_malloc(compressBound(TARGET_PAGE_SIZE));
+        qemu_mutex_init(&decomp_param[i].mutex);
+        qemu_cond_init(&decomp_param[i].cond);
+        qemu_thread_create(&decomp_param[i].thread, "decompress",
+                           do_data_decompress, decomp_param + i,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+void migrate_decompress_threads_join(void)
+{
+    int i;
+
+    if (!decomp_param) {
+        return;
+    }
+
+    for (i = 0; i < decomp_thread_count; i++) {
+        qemu_mutex_lock(&decomp_param[i].mutex);
+        decomp_param[i].quit = true;
+        qemu_cond_signal(&decomp_param[i].cond);
+        qemu_mutex_unlock(&decomp_param[i].mutex);
+
+        qemu_thread_join(&decomp_param[i].thread);
+        qemu_mutex_destroy(&decomp_param[i].mutex);
+        qemu_cond_destroy(&decomp_param[i].cond);
+        g_free(decomp_param[i].compbuf);
+    }
+    g_free(decomp_param);
+    decomp_param = NULL;
+    decomp_thread_count = 0;
+}
+
+/* Read a compressed page of @len bytes from @f and inflate it to @host */
+static int decompress_data_with_multi_threads(QEMUFile *f, void *host,
+                                              int len)
+{
+    DecompressParam *param = NULL;
+    int i;
+
+    if (!decomp_param) {
+        /* Not an incoming migration, e.g. loadvm: do it inline */
+        uint8_t *compbuf = g_malloc(len);
+        bool ok;
+
+        qemu_get_buffer(f, compbuf, len);
+        ok = decompress_page(host, compbuf, len);
+        g_free(compbuf);
+        return ok ? 0 : -EINVAL;
+    }
+
+    qemu_mutex_lock(&decomp_done_lock);
+    for (;;) {
+        for (i = 0; i < decomp_thread_count; i++) {
+            if (!decomp_param[i].busy) {
+                param = &decomp_param[i];
+                break;
+            }
+        }
+        if (param) {
+            break;
+        }
+        qemu_cond_wait(&decomp_done_cond, &decomp_done_lock);
+    }
+    param->busy = true;
+    qemu_mutex_unlock(&decomp_done_lock);
+
+    /* The thread doesn't touch compbuf until it is handed the page */
+    qemu_get_buffer(f, param->compbuf, len);
+
+    qemu_mutex_lock(&param->mutex);
+    param->des = host;
+    param->len = len;
+    qemu_cond_signal(&param->cond);
+    qemu_mutex_unlock(&param->mutex);
+
+    return 0;
+}
+
+/* Wait until all pages handed to the decompression threads are in RAM */
+static int wait_for_decompress_done(void)
+{
+    int i, ret = 0;
+
+    if (!decomp_param) {
+        return 0;
+    }
+
+    qemu_mutex_lock(&decomp_done_lock);
+    for (i = 0; i < decomp_thread_count; i++) {
+        while (decomp_param[i].busy) {
+            qemu_cond_wait(&decomp_done_cond, &decomp_done_lock);
+        }
+    }
+    if (decomp_error) {
+        ret = -EINVAL;
+    }
+    qemu_mutex_unlock(&decomp_done_lock);
 
-    qemu_mutex_unlock_ramlist();
+    return ret;
+}
 
-    /*
-     * Must occur before EOS (or any QEMUFile operation)
-     * because of RDMA protocol.
-     */
-    ram_control_after_iterate(f, RAM_CONTROL_ROUND);
+/*
+ * Receiving end of the multifd channels: ram_load() collects the pages
+ * announced for each channel and hands them over in batches, the channel
+ * thread reads them straight into guest RAM.
+ */
 
-    bytes_transferred += total_sent;
+typedef struct MultiFDRecvParams {
+    QemuThread thread;
+    int fd;
+    bool running;
+    QemuMutex mutex;            /* protects num and quit */
+    QemuCond cond;
+    bool quit;
+    int num;                    /* pages to receive, 0 if none */
 
-    /*
-     * Do not count these 8 bytes into total_sent, so that we can
-     * return 0 if no page had been dirtied.
-     */
-    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
-    bytes_transferred += 8;
+    bool busy;                  /* protected by multifd_recv_lock */
 
-    ret = qemu_file_get_error(f);
-    if (ret < 0) {
-        return ret;
-    }
+    /* Owned by the thread while busy, by ram_load else */
+    struct iovec iov[MULTIFD_PAGES_PER_PACKET];
 
-    return total_sent;
-}
+    /* Announced pages not handed to the thread yet */
+    struct iovec pending[MULTIFD_PAGES_PER_PACKET];
+    int pending_num;
+} MultiFDRecvParams;
 
-static int ram_save_complete(QEMUFile *f, void *opaque)
+static MultiFDRecvParams *multifd_recv;
+static int multifd_recv_count;
+static QemuMutex multifd_recv_lock;
+static QemuCond multifd_recv_cond;
+static bool multifd_recv_error;  /* protected by multifd_recv_lock */
+
+static void *multifd_recv_thread(void *opaque)
 {
-    qemu_mutex_lock_ramlist();
-    migration_bitmap_sync();
+    MultiFDRecvParams *p = opaque;
 
-    ram_control_before_iterate(f, RAM_CONTROL_FINISH);
+    qemu_mutex_lock(&p->mutex);
+    while (!p->quit) {
+        if (p->num) {
+            int num = p->num;
+            size_t size = num * TARGET_PAGE_SIZE;
+            ssize_t ret;
 
-    /* try transferring iterative blocks of memory */
+            p->num = 0;
+            qemu_mutex_unlock(&p->mutex);
 
-    /* flush all remaining blocks regardless of rate limiting */
-    while (true) {
-        int bytes_sent;
+            ret = iov_recv(p->fd, p->iov, num, 0, size);
 
-        bytes_sent = ram_find_and_save_block(f, true);
-        /* no more blocks to sent */
-        if (bytes_sent == 0) {
-            break;
+            qemu_mutex_lock(&multifd_recv_lock);
+            if (ret != (ssize_t)size) {
+                multifd_recv_error = true;
+            }
+            p->busy = false;
+            qemu_cond_signal(&multifd_recv_cond);
+            qemu_mutex_unlock(&multifd_recv_lock);
+
+            qemu_mutex_lock(&p->mutex);
+        } else {
+            qemu_cond_wait(&p->cond, &p->mutex);
         }
-        bytes_transferred += bytes_sent;
     }
+    qemu_mutex_unlock(&p->mutex);
 
-    ram_control_after_iterate(f, RAM_CONTROL_FINISH);
-    migration_end();
+    return NULL;
+}
 
-    qemu_mutex_unlock_ramlist();
-    qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
+/* Start a receiving thread on the channel @id, connected on @fd */
+int multifd_load_add_channel(int fd, uint32_t id)
+{
+    MultiFDRecvParams *p;
+
+    if (!multifd_recv) {
+        multifd_recv_count = migrate_multifd_channels();
+        multifd_recv = g_new0(MultiFDRecvParams, multifd_recv_count);
+        multifd_recv_error = false;
+    }
+    if (id >= multifd_recv_count || multifd_recv[id].running) {
+        return -EINVAL;
+    }
+
+    p = &multifd_recv[id];
+    p->fd = fd;
+    qemu_mutex_init(&p->mutex);
+    qemu_cond_init(&p->cond);
+    qemu_thread_create(&p->thread, "multifd_recv", multifd_recv_thread, p,
+                       QEMU_THREAD_JOINABLE);
+    p->running = true;
 
     return 0;
 }
 
-static uint64_t ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size)
+void multifd_load_cleanup(void)
 {
-    uint64_t remaining_size;
+    int i;
 
-    remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
+    if (!multifd_recv) {
+        return;
+    }
 
-    if (remaining_size < max_size) {
-        qemu_mutex_lock_iothread();
-        migration_bitmap_sync();
-        qemu_mutex_unlock_iothread();
-        remaining_size = ram_save_remaining() * TARGET_PAGE_SIZE;
+    for (i = 0; i < multifd_recv_count; i++) {
+        MultiFDRecvParams *p = &multifd_recv[i];
+
+        if (!p->running) {
+            continue;
+        }
+
+        /* Unblock a thread still waiting for pages that won't come */
+        shutdown(p->fd, SHUT_RDWR);
+
+        qemu_mutex_lock(&p->mutex);
+        p->quit = true;
+        qemu_cond_signal(&p->cond);
+        qemu_mutex_unlock(&p->mutex);
+
+        qemu_thread_join(&p->thread);
+        qemu_mutex_destroy(&p->mutex);
+        qemu_cond_destroy(&p->cond);
+        closesocket(p->fd);
     }
-    return remaining_size;
+    g_free(multifd_recv);
+    multifd_recv = NULL;
+    multifd_recv_count = 0;
 }
 
-static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
+/* Hand the pages announced for @p over to its thread */
+static void multifd_recv_flush(MultiFDRecvParams *p)
 {
-    unsigned int xh_len;
-    int xh_flags;
+    if (!p->pending_num) {
+        return;
+    }
 
-    if (!xbzrle_decoded_buf) {
-        xbzrle_decoded_buf = g_malloc(TARGET_PAGE_SIZE);
+    qemu_mutex_lock(&multifd_recv_lock);
+    while (p->busy) {
+        qemu_cond_wait(&multifd_recv_cond, &multifd_recv_lock);
     }
+    p->busy = true;
+    qemu_mutex_unlock(&multifd_recv_lock);
 
-    /* extract RLE header */
-    xh_flags = qemu_get_byte(f);
-    xh_len = qemu_get_be16(f);
+    memcpy(p->iov, p->pending, p->pending_num * sizeof(p->iov[0]));
 
-    if (xh_flags != ENCODING_FLAG_XBZRLE) {
-        error_report("Failed to load XBZRLE page - wrong compression!");
-        return -1;
-    }
+    qemu_mutex_lock(&p->mutex);
+    p->num = p->pending_num;
+    qemu_cond_signal(&p->cond);
+    qemu_mutex_unlock(&p->mutex);
 
-    if (xh_len > TARGET_PAGE_SIZE) {
-        error_report("Failed to load XBZRLE page - len overflow!");
-        return -1;
+    p->pending_num = 0;
+}
+
+static int multifd_recv_page(int channel, void *host)
+{
+    MultiFDRecvParams *p;
+
+    if (channel >= multifd_recv_count || !multifd_recv[channel].running) {
+        return -EINVAL;
     }
-    /* load data and decode */
-    qemu_get_buffer(f, xbzrle_decoded_buf, xh_len);
 
-    /* decode RLE */
-    if (xbzrle_decode_buffer(xbzrle_decoded_buf, xh_len, host,
-                             TARGET_PAGE_SIZE) == -1) {
-        error_report("Failed to load XBZRLE page - decode error!");
-        return -1;
+    p = &multifd_recv[channel];
+    p->pending[p->pending_num].iov_base = host;
+    p->pending[p->pending_num].iov_len = TARGET_PAGE_SIZE;
+    p->pending_num++;
+    if (p->pending_num == MULTIFD_PAGES_PER_PACKET) {
+        multifd_recv_flush(p);
     }
 
     return 0;
 }
 
-static inline void *host_from_stream_offset(QEMUFile *f,
-                                            ram_addr_t offset,
-                                            int flags)
+/* Wait until all announced pages are in RAM */
+static int multifd_recv_sync(void)
 {
-    static RAMBlock *block = NULL;
-    char id[256];
-    uint8_t len;
-
-    if (flags & RAM_SAVE_FLAG_CONTINUE) {
-        if (!block || block->length <= offset) {
-            error_report("Ack, bad migration stream!");
-            return NULL;
-        }
+    int i, ret = 0;
 
-        return memory_region_get_ram_ptr(block->mr) + offset;
+    for (i = 0; i < multifd_recv_count; i++) {
+        multifd_recv_flush(&multifd_recv[i]);
     }
 
-    len = qemu_get_byte(f);
-    qemu_get_buffer(f, (uint8_t *)id, len);
-    id[len] = 0;
-
-    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
-        if (!strncmp(id, block->idstr, sizeof(id)) && block->length > offset) {
-            return memory_region_get_ram_ptr(block->mr) + offset;
+    qemu_mutex_lock(&multifd_recv_lock);
+    for (i = 0; i < multifd_recv_count; i++) {
+        while (multifd_recv[i].busy) {
+            qemu_cond_wait(&multifd_recv_cond, &multifd_recv_lock);
         }
     }
-
-    error_report("Can't find block %s!", id);
-    return NULL;
-}
-
-/*
- * If a page (or a whole RDMA chunk) has been
- * determined to be zero, then zap it.
- */
-void ram_handle_compressed(void *host, uint8_t ch, uint64_t size)
-{
-    if (ch != 0 || !is_zero_range(host, size)) {
-        memset(host, ch, size);
+    if (multifd_recv_error) {
+        ret = -EIO;
     }
+    qemu_mutex_unlock(&multifd_recv_lock);
+
+    return ret;
 }
 
 static int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
+    MigrationIncomingState *mis = migration_incoming_get_current();
     int flags = 0, ret = 0;
     static uint64_t seq_iter;
+    bool decompressing = false;
+    bool multifd_pending = false;
+    /* Once listening, pages must be placed atomically into guest RAM */
+    bool postcopy = mis->postcopy_state == POSTCOPY_INCOMING_LISTENING ||
+                    mis->postcopy_state == POSTCOPY_INCOMING_RUNNING;
 
     seq_iter++;
 
@@ -1063,6 +2869,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
         ram_addr_t addr, total_ram_bytes;
         void *host;
         uint8_t ch;
+        int len;
 
         addr = qemu_get_be64(f);
         flags = addr & ~TARGET_PAGE_MASK;
@@ -1101,6 +2908,17 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                     ret = -EINVAL;
                 }
 
+                if (!ret && migrate_use_mapped_ram()) {
+                    uint64_t bitmap_offset = qemu_get_be64(f);
+                    uint64_t pages_offset = qemu_get_be64(f);
+
+                    ret = mapped_ram_load_block(f, block, bitmap_offset,
+                                                pages_offset);
+                    if (!ret) {
+                        ret = qemu_file_fd_seek(f, pages_offset + length);
+                    }
+                }
+
                 total_ram_bytes -= length;
             }
             break;
@@ -1113,7 +2931,16 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
             }
 
             ch = qemu_get_byte(f);
-            ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            if (!postcopy) {
+                ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
+            } else if (ch == 0) {
+                ret = postcopy_place_page_zero(mis, host);
+            } else {
+                void *page = postcopy_get_tmp_page(mis);
+
+                memset(page, ch, TARGET_PAGE_SIZE);
+                ret = postcopy_place_page(mis, host, page);
+            }
             break;
         case RAM_SAVE_FLAG_PAGE:
             host = host_from_stream_offset(f, addr, flags);
@@ -1123,7 +2950,65 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 break;
             }
 
-            qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            if (!postcopy) {
+                qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
+            } else {
+                void *page = postcopy_get_tmp_page(mis);
+
+                qemu_get_buffer(f, page, TARGET_PAGE_SIZE);
+                ret = postcopy_place_page(mis, host, page);
+            }
+            break;
+        case RAM_SAVE_FLAG_COMPRESS_PAGE:
+            host = host_from_stream_offset(f, addr, flags);
+            if (!host) {
+                error_report("Illegal RAM offset " RAM_ADDR_FMT, addr);
+                ret = -EINVAL;
+                break;
+            }
+            if (postcopy) {
+                error_report("Compressed page at " RAM_ADDR_FMT " in postcopy",
+                             addr);
+                ret = -EINVAL;
+                break;
+            }
+
+            len = qemu_get_be32(f);
+            if (len <= 0 || len > compressBound(TARGET_PAGE_SIZE)) {
+                error_report("Invalid compressed data length: %d", len);
+                ret = -EINVAL;
+                break;
+            }
+            ret = decompress_data_with_multi_threads(f, host, len);
+            if (ret < 0) {
+                error_report("Failed to decompress page at " RAM_ADDR_FMT,
+                             addr);
+                break;
+            }
+            decompressing = true;
+            break;
+        case RAM_SAVE_FLAG_MULTIFD_PAGE:
+            host = host_from_stream_offset(f, addr, flags);
+            if (!host) {
+                error_report("Illegal RAM offset " RAM_ADDR_FMT, addr);
+                ret = -EINVAL;
+                break;
+            }
+            if (postcopy) {
+                error_report("Multifd page at " RAM_ADDR_FMT " in postcopy",
+                             addr);
+                ret = -EINVAL;
+                break;
+            }
+
+            ch = qemu_get_byte(f);
+            ret = multifd_recv_page(ch, host);
+            if (ret < 0) {
+                error_report("Page at " RAM_ADDR_FMT " on unknown multifd "
+                             "channel %d", addr, ch);
+                break;
+            }
+            multifd_pending = true;
             break;
         case RAM_SAVE_FLAG_XBZRLE:
             host = host_from_stream_offset(f, addr, flags);
@@ -1132,6 +3017,12 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 ret = -EINVAL;
                 break;
             }
+            if (postcopy) {
+                error_report("XBZRLE page at " RAM_ADDR_FMT " in postcopy",
+                             addr);
+                ret = -EINVAL;
+                break;
+            }
 
             if (load_xbzrle(f, addr, host) < 0) {
                 error_report("Failed to decompress XBZRLE page at "
@@ -1157,6 +3048,22 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
         }
     }
 
+    /* The pages must all be in RAM before the next section is loaded */
+    if (decompressing) {
+        int decomp_ret = wait_for_decompress_done();
+
+        if (!ret) {
+            ret = decomp_ret;
+        }
+    }
+    if (multifd_pending) {
+        int multifd_ret = multifd_recv_sync();
+
+        if (!ret) {
+            ret = multifd_ret;
+        }
+    }
+
     DPRINTF("Completed load of VM with exit code %d seq iteration "
             "%" PRIu64 "\n", ret, seq_iter);
     return ret;
@@ -1169,11 +3076,22 @@ static SaveVMHandlers savevm_ram_handlers = {
     .save_live_pending = ram_save_pending,
     .load_state = ram_load,
     .cancel = ram_migration_cancel,
+    .can_postcopy = ram_can_postcopy,
 };
 
 void ram_mig_init(void)
 {
     qemu_mutex_init(&XBZRLE.lock);
+    qemu_mutex_init(&src_page_req_mutex);
+    qemu_mutex_init(&free_page_hint_mutex);
+    qemu_mutex_init(&comp_done_lock);
+    qemu_cond_init(&comp_done_cond);
+    qemu_mutex_init(&decomp_done_lock);
+    qemu_cond_init(&decomp_done_cond);
+    qemu_mutex_init(&multifd_send_lock);
+    qemu_cond_init(&multifd_send_cond);
+    qemu_mutex_init(&multifd_recv_lock);
+    qemu_cond_init(&multifd_recv_cond);
     register_savevm_live(NULL, "ram", 0, 4, &savevm_ram_handlers, NULL);
 }
 
@@ -1377,51 +3295,168 @@ TargetInfo *qmp_query_target(Error **errp)
     return info;
 }
 
-/* Stub function that's gets run on the vcpu when its brought out of the
-   VM to run inside qemu via async_run_on_cpu()*/
-static void mig_sleep_cpu(void *opq)
+/* Auto-converge throttling, in percent of a vCPU's time */
+#define CPU_THROTTLE_PCT_INITIAL 20
+#define CPU_THROTTLE_PCT_STEP    10
+#define CPU_THROTTLE_PCT_MAX     99
+
+/* How long a throttled vCPU gets to run between two sleeps */
+#define CPU_THROTTLE_TIMESLICE_NS (10 * 1000 * 1000)
+
+/* Needs iothread lock! */
+static void cpu_throttle_set(CPUState *cpu, int percentage)
 {
-    qemu_mutex_unlock_iothread();
-    g_usleep(30*1000);
-    qemu_mutex_lock_iothread();
+    cpu->throttle_percentage = percentage;
+    trace_migration_cpu_throttle(cpu->cpu_index, percentage);
 }
 
-/* To reduce the dirty rate explicitly disallow the VCPUs from spending
-   much time in the VM. The migration thread will try to catchup.
-   Workload will experience a performance drop.
-*/
-static void mig_throttle_guest_down(void)
+/*
+ * How much @cpu may have dirtied over the current period, in units that
+ * only mean something relative to the other vCPUs.  TCG counts the pages
+ * each vCPU dirties.  KVM has no per-vCPU dirty accounting, so use the CPU
+ * time the vCPU thread consumed instead: a vCPU that did not run did not
+ * dirty anything.
+ */
+static uint64_t cpu_throttle_activity(CPUState *cpu)
+{
+    int64_t now;
+
+    if (!kvm_enabled()) {
+        return cpu->dirty_pages;
+    }
+    now = qemu_thread_get_cpu_time_ns(cpu->thread);
+    return now > cpu->throttle_cpu_time ? now - cpu->throttle_cpu_time : 0;
+}
+
+/* Needs iothread lock! */
+static void cpu_throttle_period_start(void)
 {
     CPUState *cpu;
 
-    qemu_mutex_lock_iothread();
     CPU_FOREACH(cpu) {
-        async_run_on_cpu(cpu, mig_sleep_cpu, NULL);
+        cpu->dirty_pages = 0;
+        if (kvm_enabled()) {
+            cpu->throttle_cpu_time = qemu_thread_get_cpu_time_ns(cpu->thread);
+        }
+    }
+}
+
+/*
+ * Throttle harder the vCPUs that were at least their fair share of the
+ * activity over the last period, CPU_THROTTLE_PCT_STEP more each time.
+ * If nothing could be measured, every vCPU is taken as a suspect.
+ *
+ * Needs iothread lock!
+ */
+static void cpu_throttle_step(void)
+{
+    CPUState *cpu;
+    uint64_t *activity;
+    uint64_t total = 0;
+    int nr_cpus = 0, i = 0;
+
+    CPU_FOREACH(cpu) {
+        nr_cpus++;
+    }
+    activity = g_new(uint64_t, nr_cpus);
+    CPU_FOREACH(cpu) {
+        activity[i] = cpu_throttle_activity(cpu);
+        total += activity[i++];
+    }
+
+    i = 0;
+    CPU_FOREACH(cpu) {
+        uint64_t mine = activity[i++];
+
+        if (total && mine * nr_cpus < total) {
+            continue;
+        }
+        if (!cpu->throttle_percentage) {
+            cpu_throttle_set(cpu, CPU_THROTTLE_PCT_INITIAL);
+        } else {
+            cpu_throttle_set(cpu, MIN(cpu->throttle_percentage +
+                                      CPU_THROTTLE_PCT_STEP,
+                                      CPU_THROTTLE_PCT_MAX));
+        }
+    }
+    g_free(activity);
+}
+
+/* Needs iothread lock! */
+static void cpu_throttle_stop(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->throttle_percentage) {
+            cpu_throttle_set(cpu, 0);
+        }
+    }
+}
+
+CpuThrottleInfoList *migration_cpu_throttle_info(void)
+{
+    CpuThrottleInfoList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CpuThrottleInfoList *entry;
+
+        if (!cpu->throttle_percentage) {
+            continue;
+        }
+
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->cpu_index = cpu->cpu_index;
+        entry->value->percentage = cpu->throttle_percentage;
+        *tail = entry;
+        tail = &entry->next;
     }
+
+    return head;
+}
+
+/* Stub function that's gets run on the vcpu when its brought out of the
+   VM to run inside qemu via async_run_on_cpu()*/
+static void mig_sleep_cpu(void *opq)
+{
+    CPUState *cpu = opq;
+    double pct = cpu->throttle_percentage / 100.0;
+    int64_t sleep_ns = pct / (1 - pct) * CPU_THROTTLE_TIMESLICE_NS;
+
     qemu_mutex_unlock_iothread();
+    g_usleep(sleep_ns / 1000);
+    qemu_mutex_lock_iothread();
+    cpu->throttle_pending = false;
+    cpu->throttle_woken = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 }
 
+/* To reduce the dirty rate explicitly disallow the VCPUs that dirty
+   memory from spending more than 100 - throttle_percentage percent of
+   their time in the VM: after each CPU_THROTTLE_TIMESLICE_NS they run,
+   they sleep in proportion.  The migration thread will try to catchup.
+   Their workload will experience a performance drop, the other vCPUs'
+   won't.
+*/
 static void check_guest_throttling(void)
 {
-    static int64_t t0;
-    int64_t        t1;
+    CPUState *cpu;
+    int64_t now;
 
     if (!mig_throttle_on) {
         return;
     }
 
-    if (!t0)  {
-        t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-        return;
-    }
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
-    t1 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-
-    /* If it has been more than 40 ms since the last time the guest
-     * was throttled then do it again.
-     */
-    if (40 < (t1-t0)/1000000) {
-        mig_throttle_guest_down();
-        t0 = t1;
+    qemu_mutex_lock_iothread();
+    CPU_FOREACH(cpu) {
+        if (cpu->throttle_percentage && !cpu->throttle_pending &&
+            now - cpu->throttle_woken >= CPU_THROTTLE_TIMESLICE_NS) {
+            cpu->throttle_pending = true;
+            async_run_on_cpu(cpu, mig_sleep_cpu, cpu);
+        }
     }
+    qemu_mutex_unlock_iothread();
 }
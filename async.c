@@ -79,6 +79,7 @@ int aio_bh_poll(AioContext *ctx)
             if (!bh->idle)
                 ret = 1;
             bh->idle = 0;
+            ctx->stats.bhs++;
             bh->cb(bh->opaque);
         }
     }
@@ -218,6 +219,7 @@ aio_ctx_dispatch(GSource     *source,
     AioContext *ctx = (AioContext *) source;
 
     assert(callback == NULL);
+    ctx->stats.wakeups++;
     aio_dispatch(ctx);
     return true;
 }
@@ -257,6 +259,22 @@ ThreadPool *aio_get_thread_pool(AioContext *ctx)
     return ctx->thread_pool;
 }
 
+void aio_latency_account(AioLatencyStats *stats, int64_t ns)
+{
+    int64_t limit = 1000;
+    int i;
+
+    for (i = 0; i < AIO_STATS_BINS - 1 && ns >= limit; i++) {
+        limit *= 10;
+    }
+    stats->hist[i]++;
+    stats->count++;
+    stats->total_ns += ns;
+    if (ns > stats->max_ns) {
+        stats->max_ns = ns;
+    }
+}
+
 void aio_set_dispatching(AioContext *ctx, bool dispatching)
 {
     ctx->dispatching = dispatching;
@@ -274,10 +292,48 @@ void aio_notify(AioContext *ctx)
     /* Write e.g. bh->scheduled before reading ctx->dispatching.  */
     smp_mb();
     if (!ctx->dispatching) {
+        atomic_set(&ctx->notified, true);
         event_notifier_set(&ctx->notifier);
     }
 }
 
+static void aio_context_notifier_read(EventNotifier *e)
+{
+    AioContext *ctx = container_of(e, AioContext, notifier);
+
+    /* Clear the flag first so that a concurrent aio_notify() is not lost */
+    atomic_set(&ctx->notified, false);
+    event_notifier_test_and_clear(e);
+}
+
+static bool aio_context_notifier_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    AioContext *ctx = container_of(e, AioContext, notifier);
+
+    return atomic_read(&ctx->notified);
+}
+
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink,
+                                 Error **errp)
+{
+    if (max_ns < 0 || grow < 0 || shrink < 0) {
+        error_setg(errp, "polling parameters must not be negative");
+        return;
+    }
+
+    /* No thread synchronization here, it doesn't matter if an incorrect
+     * value is used once.
+     */
+    ctx->poll_max_ns = max_ns;
+    ctx->poll_ns = 0;
+    ctx->poll_grow = grow;
+    ctx->poll_shrink = shrink;
+
+    aio_notify(ctx);
+}
+
 static void aio_timerlist_notify(void *opaque)
 {
     aio_notify(opaque);
@@ -300,9 +356,9 @@ AioContext *aio_context_new(Error **errp)
         error_setg_errno(errp, -ret, "Failed to initialize event notifier");
         return NULL;
     }
-    aio_set_event_notifier(ctx, &ctx->notifier,
-                           (EventNotifierHandler *)
-                           event_notifier_test_and_clear);
+    aio_set_event_notifier(ctx, &ctx->notifier, aio_context_notifier_read);
+    aio_set_event_notifier_poll(ctx, &ctx->notifier,
+                                aio_context_notifier_poll);
     ctx->pollfds = g_array_new(FALSE, FALSE, sizeof(GPollFD));
     ctx->thread_pool = NULL;
     qemu_mutex_init(&ctx->bh_lock);
@@ -66,6 +66,10 @@ static struct {
         int hertz;
         int64_t ticks;
     } period;
+    union {
+        int hertz;
+        int64_t ticks;
+    } idle_period;
     int plive;
     int log_to_monitor;
     int try_poll_in;
@@ -96,6 +100,7 @@ static struct {
     },
 
     .period = { .hertz = 100 },
+    .idle_period = { .hertz = 10 },
     .plive = 0,
     .log_to_monitor = 0,
     .try_poll_in = 1,
@@ -1121,11 +1126,38 @@ static int audio_is_timer_needed (void)
     return 0;
 }
 
+/*
+ * Once the enabled voices have played nothing but silence for a second,
+ * and nothing is being recorded, run the timer at the idle period instead:
+ * devices still get their callbacks, just in larger chunks.  The period
+ * is kept under half the duration of every hardware buffer so that they
+ * cannot run dry.
+ */
+static int64_t audio_timer_period (AudioState *s, int64_t now)
+{
+    HWVoiceOut *hw = NULL;
+    int64_t ticks = conf.idle_period.ticks;
+
+    if (ticks <= conf.period.ticks ||
+        now - s->silent_since < get_ticks_per_sec () ||
+        audio_pcm_hw_find_any_enabled_in (NULL)) {
+        return conf.period.ticks;
+    }
+
+    while ((hw = audio_pcm_hw_find_any_enabled_out (hw))) {
+        ticks = audio_MIN (ticks, (int64_t) muldiv64 (hw->samples / 2,
+                                                      get_ticks_per_sec (),
+                                                      hw->info.freq));
+    }
+    return audio_MAX (ticks, conf.period.ticks);
+}
+
 static void audio_reset_timer (AudioState *s)
 {
     if (audio_is_timer_needed ()) {
-        timer_mod (s->ts,
-            qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + conf.period.ticks);
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+        timer_mod (s->ts, now + audio_timer_period (s, now));
     }
     else {
         timer_del (s->ts);
@@ -1200,6 +1232,7 @@ void AUD_set_active_out (SWVoiceOut *sw, int on)
             hw->pending_disable = 0;
             if (!hw->enabled) {
                 hw->enabled = 1;
+                s->silent_since = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
                 if (s->vm_running) {
                     hw->pcm_ops->ctl_out (hw, VOICE_ENABLE, conf.try_poll_out);
                     audio_reset_timer (s);
@@ -1357,10 +1390,12 @@ static void audio_capture_mix_and_clear (HWVoiceOut *hw, int rpos, int samples)
     mixeng_clear (hw->mix_buf, samples - n);
 }
 
-static void audio_run_out (AudioState *s)
+/* Returns 0 if any voice played something other than silence */
+static int audio_run_out (AudioState *s)
 {
     HWVoiceOut *hw = NULL;
     SWVoiceOut *sw;
+    int silent = 1;
 
     while ((hw = audio_pcm_hw_find_any_enabled_out (hw))) {
         int played;
@@ -1403,6 +1438,13 @@ static void audio_run_out (AudioState *s)
             continue;
         }
 
+        if (silent) {
+            int n = audio_MIN (live, hw->samples - hw->rpos);
+
+            silent = mixeng_is_silent (hw->mix_buf + hw->rpos, n) &&
+                mixeng_is_silent (hw->mix_buf, live - n);
+        }
+
         prev_rpos = hw->rpos;
         played = hw->pcm_ops->run_out (hw, live);
         if (audio_bug (AUDIO_FUNC, hw->rpos >= hw->samples)) {
@@ -1463,6 +1505,7 @@ static void audio_run_out (AudioState *s)
             }
         }
     }
+    return silent;
 }
 
 static void audio_run_in (AudioState *s)
@@ -1545,7 +1588,9 @@ void audio_run (const char *msg)
 {
     AudioState *s = &glob_audio_state;
 
-    audio_run_out (s);
+    if (!audio_run_out (s)) {
+        s->silent_since = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    }
     audio_run_in (s);
     audio_run_capture (s);
 #ifdef DEBUG_POLL
@@ -1648,6 +1693,13 @@ static struct audio_option audio_options[] = {
         .valp  = &conf.period.hertz,
         .descr = "Timer period in HZ (0 - use lowest possible)"
     },
+    {
+        .name  = "TIMER_IDLE_PERIOD",
+        .tag   = AUD_OPT_INT,
+        .valp  = &conf.idle_period.hertz,
+        .descr = "Timer period in HZ while only silence is played "
+                 "(0 - same as TIMER_PERIOD)"
+    },
     {
         .name  = "PLIVE",
         .tag   = AUD_OPT_BOOL,
@@ -1762,6 +1814,7 @@ static void audio_vm_change_state_handler (void *opaque, int running,
     int op = running ? VOICE_ENABLE : VOICE_DISABLE;
 
     s->vm_running = running;
+    s->silent_since = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
     while ((hwo = audio_pcm_hw_find_any_enabled_out (hwo))) {
         hwo->pcm_ops->ctl_out (hwo, op, conf.try_poll_out);
     }
@@ -1908,6 +1961,13 @@ static void audio_init (void)
             muldiv64 (1, get_ticks_per_sec (), conf.period.hertz);
     }
 
+    if (conf.idle_period.hertz <= 0) {
+        conf.idle_period.ticks = conf.period.ticks;
+    } else {
+        conf.idle_period.ticks =
+            muldiv64 (1, get_ticks_per_sec (), conf.idle_period.hertz);
+    }
+
     e = qemu_add_vm_change_state_handler (audio_vm_change_state_handler, s);
     if (!e) {
         dolog ("warning: Could not register change state handler\n"
@@ -200,6 +200,7 @@ struct AudioState {
     int nb_hw_voices_out;
     int nb_hw_voices_in;
     int vm_running;
+    int64_t silent_since;
 };
 
 extern struct audio_driver no_audio_driver;
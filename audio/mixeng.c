@@ -346,6 +346,17 @@ void mixeng_clear (struct st_sample *buf, int len)
     memset (buf, 0, len * sizeof (struct st_sample));
 }
 
+int mixeng_is_silent (const struct st_sample *buf, int len)
+{
+    while (len--) {
+        if (buf->l || buf->r) {
+            return 0;
+        }
+        buf += 1;
+    }
+    return 1;
+}
+
 void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
 {
     if (vol->mute) {
@@ -353,6 +364,17 @@ void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
         return;
     }
 
+    /* Nominal volume is the common case and leaves the samples alone */
+#ifdef FLOAT_MIXENG
+    if (vol->l == 1.0 && vol->r == 1.0) {
+        return;
+    }
+#else
+    if (vol->l == 1ULL << 32 && vol->r == 1ULL << 32) {
+        return;
+    }
+#endif
+
     while (len--) {
 #ifdef FLOAT_MIXENG
         buf->l = buf->l * vol->l;
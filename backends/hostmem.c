@@ -62,6 +62,37 @@ out:
     error_propagate(errp, local_err);
 }
 
+static void
+host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v, void *opaque,
+                                         const char *name, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_uint32(v, &backend->prealloc_threads, name, errp);
+}
+
+static void
+host_memory_backend_set_prealloc_threads(Object *obj, Visitor *v, void *opaque,
+                                         const char *name, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, &value, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    if (!value) {
+        error_setg(&local_err, "Property '%s.%s' doesn't take value '%"
+                   PRIu32 "'", object_get_typename(obj), name, value);
+        goto out;
+    }
+    backend->prealloc_threads = value;
+out:
+    error_propagate(errp, local_err);
+}
+
 static void
 host_memory_backend_get_host_nodes(Object *obj, Visitor *v, void *opaque,
                                    const char *name, Error **errp)
@@ -222,7 +253,7 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
         void *ptr = memory_region_get_ram_ptr(&backend->mr);
         uint64_t sz = memory_region_size(&backend->mr);
 
-        os_mem_prealloc(fd, ptr, sz);
+        os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads);
         backend->prealloc = true;
     }
 }
@@ -236,6 +267,7 @@ static void host_memory_backend_init(Object *obj)
     backend->dump = qemu_opt_get_bool(qemu_get_machine_opts(),
                                       "dump-guest-core", true);
     backend->prealloc = mem_prealloc;
+    backend->prealloc_threads = smp_cpus;
 
     object_property_add_bool(obj, "merge",
                         host_memory_backend_get_merge,
@@ -246,6 +278,10 @@ static void host_memory_backend_init(Object *obj)
     object_property_add_bool(obj, "prealloc",
                         host_memory_backend_get_prealloc,
                         host_memory_backend_set_prealloc, NULL);
+    object_property_add(obj, "prealloc-threads", "int",
+                        host_memory_backend_get_prealloc_threads,
+                        host_memory_backend_set_prealloc_threads,
+                        NULL, NULL, NULL);
     object_property_add(obj, "size", "int",
                         host_memory_backend_get_size,
                         host_memory_backend_set_size, NULL, NULL, NULL);
@@ -330,11 +366,51 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz);
+            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
+                            backend->prealloc_threads);
         }
     }
 }
 
+/* Bind @backend to @host_node, unless it was given host-nodes explicitly.
+ * Memory that is already allocated is migrated there.
+ */
+void host_memory_backend_bind_host_node(HostMemoryBackend *backend,
+                                        unsigned int host_node, Error **errp)
+{
+#ifdef CONFIG_NUMA
+    void *ptr;
+    uint64_t sz;
+
+    if (!bitmap_empty(backend->host_nodes, MAX_NODES)) {
+        return;
+    }
+    if (host_node >= MAX_NODES) {
+        error_setg(errp, "host NUMA node %u is bigger than %d", host_node,
+                   MAX_NODES - 1);
+        return;
+    }
+
+    bitmap_set(backend->host_nodes, host_node, 1);
+    backend->policy = HOST_MEM_POLICY_BIND;
+    if (!memory_region_size(&backend->mr)) {
+        /* Applied when the memory is allocated */
+        return;
+    }
+
+    ptr = memory_region_get_ram_ptr(&backend->mr);
+    sz = memory_region_size(&backend->mr);
+    /* maxnode + 1, see host_memory_backend_memory_complete() */
+    if (mbind(ptr, sz, backend->policy, backend->host_nodes, host_node + 2,
+              MPOL_MF_MOVE)) {
+        error_setg_errno(errp, errno,
+                         "cannot bind memory to host NUMA node %u", host_node);
+    }
+#else
+    error_setg(errp, "NUMA node binding are not supported by this QEMU");
+#endif
+}
+
 static void
 host_memory_backend_class_init(ObjectClass *oc, void *data)
 {
@@ -20,6 +20,7 @@
 #include "hw/hw.h"
 #include "qemu/queue.h"
 #include "qemu/timer.h"
+#include "qemu/hbitmap.h"
 #include "migration/block.h"
 #include "migration/migration.h"
 #include "sysemu/blockdev.h"
@@ -35,6 +36,10 @@
 
 #define MAX_IS_ALLOCATED_SEARCH 65536
 
+/* Reads kept in flight per device in the bulk phase, if the bandwidth
+ * limit alone would allow fewer */
+#define BULK_READS_PER_DEVICE   4
+
 //#define DEBUG_BLK_MIGRATION
 
 #ifdef DEBUG_BLK_MIGRATION
@@ -85,6 +90,7 @@ typedef struct BlkMigState {
     int shared_base;
     QSIMPLEQ_HEAD(bmds_list, BlkMigDevState) bmds_list;
     int64_t total_sector_sum;
+    int nr_devices;
     bool zero_blocks;
 
     /* Protected by lock.  */
@@ -96,6 +102,7 @@ typedef struct BlkMigState {
     int transferred;
     int prev_progress;
     int bulk_completed;
+    BlkMigDevState *bulk_cursor;    /* next device to read in bulk phase */
 
     /* Lock must be taken _inside_ the iothread lock.  */
     QemuMutex lock;
@@ -117,9 +124,23 @@ static void blk_mig_unlock(void)
  * or the VM will stall.
  */
 
-static void blk_send(QEMUFile *f, BlkMigBlock * blk)
+static void blk_send_header(QEMUFile *f, BlkMigDevState *bmds,
+                            int64_t sector, uint64_t flags)
 {
     int len;
+
+    /* sector number and flags */
+    qemu_put_be64(f, (sector << BDRV_SECTOR_BITS)
+                     | flags);
+
+    /* device name */
+    len = strlen(bdrv_get_device_name(bmds->bs));
+    qemu_put_byte(f, len);
+    qemu_put_buffer(f, (uint8_t *)bdrv_get_device_name(bmds->bs), len);
+}
+
+static void blk_send(QEMUFile *f, BlkMigBlock * blk)
+{
     uint64_t flags = BLK_MIG_FLAG_DEVICE_BLOCK;
 
     if (block_mig_state.zero_blocks &&
@@ -127,14 +148,7 @@ static void blk_send(QEMUFile *f, BlkMigBlock * blk)
         flags |= BLK_MIG_FLAG_ZERO_BLOCK;
     }
 
-    /* sector number and flags */
-    qemu_put_be64(f, (blk->sector << BDRV_SECTOR_BITS)
-                     | flags);
-
-    /* device name */
-    len = strlen(bdrv_get_device_name(blk->bmds->bs));
-    qemu_put_byte(f, len);
-    qemu_put_buffer(f, (uint8_t *)bdrv_get_device_name(blk->bmds->bs), len);
+    blk_send_header(f, blk->bmds, blk->sector, flags);
 
     /* if a block is zero we need to flush here since the network
      * bandwidth is now a lot higher than the storage device bandwidth.
@@ -181,6 +195,29 @@ uint64_t blk_mig_bytes_total(void)
     return sum << BDRV_SECTOR_BITS;
 }
 
+BlockMigrationDeviceInfoList *blk_mig_device_info(void)
+{
+    BlockMigrationDeviceInfoList *head = NULL, **tail = &head;
+    BlkMigDevState *bmds;
+
+    blk_mig_lock();
+    QSIMPLEQ_FOREACH(bmds, &block_mig_state.bmds_list, entry) {
+        BlockMigrationDeviceInfoList *entry;
+
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->device = g_strdup(bdrv_get_device_name(bmds->bs));
+        entry->value->transferred =
+            bmds->completed_sectors << BDRV_SECTOR_BITS;
+        entry->value->total = bmds->total_sectors << BDRV_SECTOR_BITS;
+        *tail = entry;
+        tail = &entry->next;
+    }
+    blk_mig_unlock();
+
+    return head;
+}
+
 
 /* Called with migration lock held.  */
 
@@ -258,6 +295,8 @@ static int mig_save_device_bulk(QEMUFile *f, BlkMigDevState *bmds)
     BlockDriverState *bs = bmds->bs;
     BlkMigBlock *blk;
     int nr_sectors;
+    int64_t status;
+    int pnum;
 
     if (bmds->shared_base) {
         qemu_mutex_lock_iothread();
@@ -285,6 +324,27 @@ static int mig_save_device_bulk(QEMUFile *f, BlkMigDevState *bmds)
         nr_sectors = total_sectors - cur_sector;
     }
 
+    /* A chunk that reads as zeroes can be sent as a zero block without
+     * reading it, if the destination understands zero blocks */
+    if (block_mig_state.zero_blocks) {
+        qemu_mutex_lock_iothread();
+        status = bdrv_get_block_status_above(bs, NULL, cur_sector,
+                                             nr_sectors, &pnum);
+        if (status >= 0 && (status & BDRV_BLOCK_ZERO) &&
+            pnum >= nr_sectors) {
+            bdrv_reset_dirty_bitmap(bs, bmds->dirty_bitmap, cur_sector,
+                                    nr_sectors);
+            qemu_mutex_unlock_iothread();
+
+            blk_send_header(f, bmds, cur_sector,
+                            BLK_MIG_FLAG_DEVICE_BLOCK |
+                            BLK_MIG_FLAG_ZERO_BLOCK);
+            bmds->cur_sector = cur_sector + nr_sectors;
+            return (bmds->cur_sector >= total_sectors);
+        }
+        qemu_mutex_unlock_iothread();
+    }
+
     blk = g_new(BlkMigBlock, 1);
     blk->buf = g_malloc(BLOCK_SIZE);
     blk->bmds = bmds;
@@ -303,7 +363,7 @@ static int mig_save_device_bulk(QEMUFile *f, BlkMigDevState *bmds)
     blk->aiocb = bdrv_aio_readv(bs, cur_sector, &blk->qiov,
                                 nr_sectors, blk_mig_read_cb, blk);
 
-    bdrv_reset_dirty(bs, cur_sector, nr_sectors);
+    bdrv_reset_dirty_bitmap(bs, bmds->dirty_bitmap, cur_sector, nr_sectors);
     qemu_mutex_unlock_iothread();
 
     bmds->cur_sector = cur_sector + nr_sectors;
@@ -319,7 +379,7 @@ static int set_dirty_tracking(void)
 
     QSIMPLEQ_FOREACH(bmds, &block_mig_state.bmds_list, entry) {
         bmds->dirty_bitmap = bdrv_create_dirty_bitmap(bmds->bs, BLOCK_SIZE,
-                                                      NULL);
+                                                      NULL, NULL);
         if (!bmds->dirty_bitmap) {
             ret = -errno;
             goto fail;
@@ -355,8 +415,10 @@ static void init_blk_migration(QEMUFile *f)
     block_mig_state.read_done = 0;
     block_mig_state.transferred = 0;
     block_mig_state.total_sector_sum = 0;
+    block_mig_state.nr_devices = 0;
     block_mig_state.prev_progress = -1;
     block_mig_state.bulk_completed = 0;
+    block_mig_state.bulk_cursor = NULL;
     block_mig_state.zero_blocks = migrate_zero_blocks();
 
     for (bs = bdrv_next(NULL); bs; bs = bdrv_next(bs)) {
@@ -381,6 +443,7 @@ static void init_blk_migration(QEMUFile *f)
         bdrv_ref(bs);
 
         block_mig_state.total_sector_sum += sectors;
+        block_mig_state.nr_devices++;
 
         if (bmds->shared_base) {
             DPRINTF("Start migration for %s with shared base image\n",
@@ -398,24 +461,37 @@ static void init_blk_migration(QEMUFile *f)
 static int blk_mig_save_bulked_block(QEMUFile *f)
 {
     int64_t completed_sector_sum = 0;
-    BlkMigDevState *bmds;
+    BlkMigDevState *bmds, *first;
     int progress;
     int ret = 0;
 
-    QSIMPLEQ_FOREACH(bmds, &block_mig_state.bmds_list, entry) {
+    /* Take the devices in turn rather than one after the other, so that
+     * all of them have reads in flight at the same time.
+     */
+    first = block_mig_state.bulk_cursor ?:
+            QSIMPLEQ_FIRST(&block_mig_state.bmds_list);
+    bmds = first;
+    while (bmds) {
         if (bmds->bulk_completed == 0) {
             if (mig_save_device_bulk(f, bmds) == 1) {
                 /* completed bulk section for this device */
                 bmds->bulk_completed = 1;
             }
-            completed_sector_sum += bmds->completed_sectors;
+            block_mig_state.bulk_cursor = QSIMPLEQ_NEXT(bmds, entry);
             ret = 1;
             break;
-        } else {
-            completed_sector_sum += bmds->completed_sectors;
+        }
+        bmds = QSIMPLEQ_NEXT(bmds, entry) ?:
+               QSIMPLEQ_FIRST(&block_mig_state.bmds_list);
+        if (bmds == first) {
+            break;
         }
     }
 
+    QSIMPLEQ_FOREACH(bmds, &block_mig_state.bmds_list, entry) {
+        completed_sector_sum += bmds->completed_sectors;
+    }
+
     if (block_mig_state.total_sector_sum != 0) {
         progress = completed_sector_sum * 100 /
                    block_mig_state.total_sector_sum;
@@ -496,7 +572,8 @@ static int mig_save_device_dirty(QEMUFile *f, BlkMigDevState *bmds,
                 g_free(blk);
             }
 
-            bdrv_reset_dirty(bmds->bs, sector, nr_sectors);
+            bdrv_reset_dirty_bitmap(bmds->bs, bmds->dirty_bitmap, sector,
+                                    nr_sectors);
             break;
         }
         sector += BDRV_SECTORS_PER_DIRTY_CHUNK;
@@ -653,6 +730,7 @@ static int block_save_iterate(QEMUFile *f, void *opaque)
 {
     int ret;
     int64_t last_ftell = qemu_ftell(f);
+    int64_t window;
 
     DPRINTF("Enter save live iterate submitted %d transferred %d\n",
             block_mig_state.submitted, block_mig_state.transferred);
@@ -664,11 +742,14 @@ static int block_save_iterate(QEMUFile *f, void *opaque)
 
     blk_mig_reset_dirty_cursor();
 
-    /* control the rate of transfer */
+    /* control the rate of transfer; flush_blks() enforces the bandwidth
+     * limit, this only bounds how much is read ahead of it */
+    window = MAX(qemu_file_get_rate_limit(f),
+                 (int64_t)block_mig_state.nr_devices * BULK_READS_PER_DEVICE *
+                 BLOCK_SIZE);
     blk_mig_lock();
     while ((block_mig_state.submitted +
-            block_mig_state.read_done) * BLOCK_SIZE <
-           qemu_file_get_rate_limit(f)) {
+            block_mig_state.read_done) * BLOCK_SIZE < window) {
         blk_mig_unlock();
         if (block_mig_state.bulk_completed == 0) {
             /* first finish the bulk phase */
@@ -873,6 +954,574 @@ static SaveVMHandlers savevm_block_handlers = {
     .is_active = block_is_active,
 };
 
+/*
+ * Named dirty bitmaps ("dirty-bitmaps" section)
+ *
+ * Every named bitmap is sent in parts of DIRTY_BITMAP_CHUNK_SECTORS; a
+ * private tracker bitmap with one bit per part records the parts written
+ * since they were sent, so that they are sent again.  This is independent
+ * of the "block" section: the bitmaps can move along with the images, or
+ * on their own when the images are on shared storage.
+ *
+ * The destination collects the parts in bitmaps that are not attached to
+ * the devices, so that the writes of the "block" section do not show up
+ * in them, and installs them when the source says a bitmap is complete.
+ */
+
+#define DIRTY_BITMAP_MIG_FLAG_EOS       0x01
+#define DIRTY_BITMAP_MIG_FLAG_START     0x02
+#define DIRTY_BITMAP_MIG_FLAG_CHUNK     0x04
+#define DIRTY_BITMAP_MIG_FLAG_ZERO      0x08
+#define DIRTY_BITMAP_MIG_FLAG_COMPLETE  0x10
+#define DIRTY_BITMAP_MIG_FLAG_DROP      0x20
+
+/* 1 GiB of disk per part; a part of a bitmap must be a multiple of 8 bits,
+ * which limits the granularity to 128 MiB */
+#define DIRTY_BITMAP_CHUNK_SECTORS      (1 << 21)
+#define DIRTY_BITMAP_MAX_GRANULARITY \
+    (DIRTY_BITMAP_CHUNK_SECTORS / 8 * BDRV_SECTOR_SIZE)
+
+typedef struct DirtyBitmapMigDevState {
+    BlockDriverState *bs;
+    int64_t total_sectors;
+    char **names;
+    BdrvDirtyBitmap *tracker;   /* parts written since they were sent */
+    int64_t cur_sector;         /* next part to send in the bulk phase */
+    int64_t cur_dirty;
+    QSIMPLEQ_ENTRY(DirtyBitmapMigDevState) entry;
+} DirtyBitmapMigDevState;
+
+typedef struct DirtyBitmapLoadState {
+    BlockDriverState *bs;
+    char *name;
+    uint32_t granularity;
+    bool persistent;
+    HBitmap *bitmap;
+    QSIMPLEQ_ENTRY(DirtyBitmapLoadState) entry;
+} DirtyBitmapLoadState;
+
+typedef struct DirtyBitmapMigState {
+    /* Source.  All accesses with the iothread lock taken.  */
+    QSIMPLEQ_HEAD(dbms_list, DirtyBitmapMigDevState) dbms_list;
+    bool bulk_completed;
+
+    /* Destination.  */
+    QSIMPLEQ_HEAD(load_list, DirtyBitmapLoadState) load_list;
+} DirtyBitmapMigState;
+
+static DirtyBitmapMigState dirty_bitmap_mig_state;
+
+static void dirty_bitmap_put_name(QEMUFile *f, const char *name)
+{
+    int len = strlen(name);
+
+    qemu_put_byte(f, len);
+    qemu_put_buffer(f, (const uint8_t *)name, len);
+}
+
+static void dirty_bitmap_get_name(QEMUFile *f, char *name)
+{
+    int len = qemu_get_byte(f);
+
+    qemu_get_buffer(f, (uint8_t *)name, len);
+    name[len] = '\0';
+}
+
+static void dirty_bitmap_put_header(QEMUFile *f, DirtyBitmapMigDevState *dbms,
+                                    const char *name, int flags)
+{
+    qemu_put_byte(f, flags);
+    dirty_bitmap_put_name(f, bdrv_get_device_name(dbms->bs));
+    dirty_bitmap_put_name(f, name);
+}
+
+/* Called with iothread lock taken.  */
+
+static void dirty_bitmap_mig_cleanup(void)
+{
+    DirtyBitmapMigDevState *dbms;
+
+    while ((dbms = QSIMPLEQ_FIRST(&dirty_bitmap_mig_state.dbms_list))) {
+        QSIMPLEQ_REMOVE_HEAD(&dirty_bitmap_mig_state.dbms_list, entry);
+        if (dbms->tracker) {
+            bdrv_release_dirty_bitmap(dbms->bs, dbms->tracker);
+        }
+        bdrv_unref(dbms->bs);
+        g_strfreev(dbms->names);
+        g_free(dbms);
+    }
+}
+
+/* Called with iothread lock taken.  */
+
+static int init_dirty_bitmap_migration(void)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+    DirtyBitmapMigDevState *dbms;
+    GPtrArray *names;
+    const char *name;
+
+    dirty_bitmap_mig_state.bulk_completed = false;
+
+    for (bs = bdrv_next(NULL); bs; bs = bdrv_next(bs)) {
+        if (!bdrv_get_device_name(bs)[0]) {
+            continue;
+        }
+
+        names = g_ptr_array_new();
+        for (bitmap = bdrv_dirty_bitmap_next(bs, NULL); bitmap;
+             bitmap = bdrv_dirty_bitmap_next(bs, bitmap)) {
+            name = bdrv_dirty_bitmap_name(bitmap);
+            if (!name) {
+                continue;
+            }
+            if (bdrv_dirty_bitmap_frozen(bitmap)) {
+                error_report("Dirty bitmap %s of %s is in use by a backup",
+                             name, bdrv_get_device_name(bs));
+                g_ptr_array_free(names, true);
+                return -EBUSY;
+            }
+            if (strlen(name) > 255 ||
+                bdrv_dirty_bitmap_granularity(bitmap) >
+                DIRTY_BITMAP_MAX_GRANULARITY) {
+                error_report("Dirty bitmap %s of %s cannot be migrated",
+                             name, bdrv_get_device_name(bs));
+                g_ptr_array_free(names, true);
+                return -EINVAL;
+            }
+            g_ptr_array_add(names, g_strdup(name));
+        }
+        if (!names->len) {
+            g_ptr_array_free(names, true);
+            continue;
+        }
+        g_ptr_array_add(names, NULL);
+
+        dbms = g_new0(DirtyBitmapMigDevState, 1);
+        dbms->bs = bs;
+        dbms->total_sectors = bdrv_nb_sectors(bs);
+        dbms->names = (char **)g_ptr_array_free(names, false);
+        bdrv_ref(bs);
+        QSIMPLEQ_INSERT_TAIL(&dirty_bitmap_mig_state.dbms_list, dbms, entry);
+
+        dbms->tracker = bdrv_create_dirty_bitmap(bs,
+                            DIRTY_BITMAP_CHUNK_SECTORS * BDRV_SECTOR_SIZE,
+                            NULL, NULL);
+        if (!dbms->tracker) {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+/* Send part @sector of every bitmap of @dbms.  Called with iothread lock
+ * taken.
+ */
+
+static int dirty_bitmap_send_chunk(QEMUFile *f, DirtyBitmapMigDevState *dbms,
+                                   int64_t sector)
+{
+    int64_t nr_sectors = MIN(DIRTY_BITMAP_CHUNK_SECTORS,
+                             dbms->total_sectors - sector);
+    BdrvDirtyBitmap *bitmap;
+    uint64_t size;
+    uint8_t *buf;
+    char **name;
+    int flags;
+
+    bdrv_reset_dirty_bitmap(dbms->bs, dbms->tracker, sector, nr_sectors);
+
+    for (name = dbms->names; *name; name++) {
+        bitmap = bdrv_find_dirty_bitmap(dbms->bs, *name);
+        if (!bitmap) {
+            /* removed during migration */
+            continue;
+        }
+        if (bdrv_dirty_bitmap_frozen(bitmap)) {
+            /* what is left in the bitmap is only part of its contents */
+            error_report("Dirty bitmap %s of %s is in use by a backup",
+                         *name, bdrv_get_device_name(dbms->bs));
+            return -EBUSY;
+        }
+
+        size = bdrv_dirty_bitmap_serialization_size_part(bitmap, sector,
+                                                         nr_sectors);
+        /* padded for buffer_is_zero */
+        buf = g_malloc0(ROUND_UP(size, 4 * sizeof(long)));
+        bdrv_dirty_bitmap_serialize_part(bitmap, buf, sector, nr_sectors);
+
+        flags = DIRTY_BITMAP_MIG_FLAG_CHUNK;
+        if (buffer_is_zero(buf, ROUND_UP(size, 4 * sizeof(long)))) {
+            flags |= DIRTY_BITMAP_MIG_FLAG_ZERO;
+        }
+        dirty_bitmap_put_header(f, dbms, *name, flags);
+        qemu_put_be64(f, sector);
+        qemu_put_be64(f, nr_sectors);
+        if (!(flags & DIRTY_BITMAP_MIG_FLAG_ZERO)) {
+            qemu_put_be64(f, size);
+            qemu_put_buffer(f, buf, size);
+        }
+        g_free(buf);
+    }
+
+    return qemu_file_get_error(f);
+}
+
+/* Send the next part, first in bulk order and then the parts written since
+ * they were sent.  Returns 1 if there is nothing left to send.  Called with
+ * iothread lock taken.
+ */
+
+static int dirty_bitmap_save_next(QEMUFile *f)
+{
+    DirtyBitmapMigDevState *dbms;
+    int64_t sector;
+
+    QSIMPLEQ_FOREACH(dbms, &dirty_bitmap_mig_state.dbms_list, entry) {
+        if (!dirty_bitmap_mig_state.bulk_completed) {
+            if (dbms->cur_sector < dbms->total_sectors) {
+                sector = dbms->cur_sector;
+                dbms->cur_sector += DIRTY_BITMAP_CHUNK_SECTORS;
+                return dirty_bitmap_send_chunk(f, dbms, sector);
+            }
+            continue;
+        }
+
+        for (sector = dbms->cur_dirty; sector < dbms->total_sectors;
+             sector += DIRTY_BITMAP_CHUNK_SECTORS) {
+            if (bdrv_get_dirty(dbms->bs, dbms->tracker, sector)) {
+                dbms->cur_dirty = sector + DIRTY_BITMAP_CHUNK_SECTORS;
+                return dirty_bitmap_send_chunk(f, dbms, sector);
+            }
+        }
+        dbms->cur_dirty = dbms->total_sectors;
+    }
+
+    if (!dirty_bitmap_mig_state.bulk_completed) {
+        dirty_bitmap_mig_state.bulk_completed = true;
+        return 0;
+    }
+    return 1;
+}
+
+static void dirty_bitmap_reset_dirty_cursor(void)
+{
+    DirtyBitmapMigDevState *dbms;
+
+    QSIMPLEQ_FOREACH(dbms, &dirty_bitmap_mig_state.dbms_list, entry) {
+        dbms->cur_dirty = 0;
+    }
+}
+
+static void dirty_bitmap_migration_cancel(void *opaque)
+{
+    dirty_bitmap_mig_cleanup();
+}
+
+static int dirty_bitmap_save_setup(QEMUFile *f, void *opaque)
+{
+    DirtyBitmapMigDevState *dbms;
+    BdrvDirtyBitmap *bitmap;
+    char **name;
+    int ret;
+
+    qemu_mutex_lock_iothread();
+    ret = init_dirty_bitmap_migration();
+    if (ret) {
+        dirty_bitmap_mig_cleanup();
+        qemu_mutex_unlock_iothread();
+        return ret;
+    }
+
+    QSIMPLEQ_FOREACH(dbms, &dirty_bitmap_mig_state.dbms_list, entry) {
+        for (name = dbms->names; *name; name++) {
+            bitmap = bdrv_find_dirty_bitmap(dbms->bs, *name);
+            dirty_bitmap_put_header(f, dbms, *name,
+                                    DIRTY_BITMAP_MIG_FLAG_START);
+            qemu_put_be64(f, dbms->total_sectors);
+            qemu_put_be32(f, bdrv_dirty_bitmap_granularity(bitmap));
+            qemu_put_byte(f, bdrv_dirty_bitmap_is_persistent(bitmap));
+        }
+    }
+    qemu_mutex_unlock_iothread();
+
+    qemu_put_byte(f, DIRTY_BITMAP_MIG_FLAG_EOS);
+    return 0;
+}
+
+static int dirty_bitmap_save_iterate(QEMUFile *f, void *opaque)
+{
+    int64_t last_ftell = qemu_ftell(f);
+    int ret = 0;
+
+    qemu_mutex_lock_iothread();
+    dirty_bitmap_reset_dirty_cursor();
+    while (!qemu_file_rate_limit(f)) {
+        ret = dirty_bitmap_save_next(f);
+        if (ret) {
+            break;
+        }
+    }
+    qemu_mutex_unlock_iothread();
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    qemu_put_byte(f, DIRTY_BITMAP_MIG_FLAG_EOS);
+    return qemu_ftell(f) - last_ftell;
+}
+
+/* Called with iothread lock taken.  */
+
+static int dirty_bitmap_save_complete(QEMUFile *f, void *opaque)
+{
+    DirtyBitmapMigDevState *dbms;
+    char **name;
+    int ret;
+
+    dirty_bitmap_reset_dirty_cursor();
+    do {
+        ret = dirty_bitmap_save_next(f);
+        if (ret < 0) {
+            return ret;
+        }
+    } while (ret == 0);
+
+    QSIMPLEQ_FOREACH(dbms, &dirty_bitmap_mig_state.dbms_list, entry) {
+        for (name = dbms->names; *name; name++) {
+            dirty_bitmap_put_header(f, dbms, *name,
+                                    bdrv_find_dirty_bitmap(dbms->bs, *name) ?
+                                    DIRTY_BITMAP_MIG_FLAG_COMPLETE :
+                                    DIRTY_BITMAP_MIG_FLAG_DROP);
+        }
+    }
+    qemu_put_byte(f, DIRTY_BITMAP_MIG_FLAG_EOS);
+
+    dirty_bitmap_mig_cleanup();
+    return 0;
+}
+
+static uint64_t dirty_bitmap_save_pending(QEMUFile *f, void *opaque,
+                                          uint64_t max_size)
+{
+    DirtyBitmapMigDevState *dbms;
+    BdrvDirtyBitmap *bitmap;
+    uint64_t sectors, bytes_per_chunk, pending = 0;
+    char **name;
+
+    qemu_mutex_lock_iothread();
+    QSIMPLEQ_FOREACH(dbms, &dirty_bitmap_mig_state.dbms_list, entry) {
+        bytes_per_chunk = 0;
+        for (name = dbms->names; *name; name++) {
+            bitmap = bdrv_find_dirty_bitmap(dbms->bs, *name);
+            if (bitmap) {
+                bytes_per_chunk += DIRTY_BITMAP_CHUNK_SECTORS /
+                    (bdrv_dirty_bitmap_granularity(bitmap) >>
+                     BDRV_SECTOR_BITS) / 8;
+            }
+        }
+        sectors = bdrv_get_dirty_count(dbms->bs, dbms->tracker);
+        if (!dirty_bitmap_mig_state.bulk_completed) {
+            sectors += MAX(dbms->total_sectors - dbms->cur_sector, 0);
+        }
+        pending += DIV_ROUND_UP(sectors, DIRTY_BITMAP_CHUNK_SECTORS) *
+                   bytes_per_chunk;
+    }
+    qemu_mutex_unlock_iothread();
+
+    return pending;
+}
+
+static DirtyBitmapLoadState *dirty_bitmap_find_load(BlockDriverState *bs,
+                                                   const char *name)
+{
+    DirtyBitmapLoadState *dbls;
+
+    QSIMPLEQ_FOREACH(dbls, &dirty_bitmap_mig_state.load_list, entry) {
+        if (dbls->bs == bs && !strcmp(dbls->name, name)) {
+            return dbls;
+        }
+    }
+    return NULL;
+}
+
+static void dirty_bitmap_free_load(DirtyBitmapLoadState *dbls)
+{
+    QSIMPLEQ_REMOVE(&dirty_bitmap_mig_state.load_list, dbls,
+                    DirtyBitmapLoadState, entry);
+    hbitmap_free(dbls->bitmap);
+    g_free(dbls->name);
+    g_free(dbls);
+}
+
+static int dirty_bitmap_load_complete(DirtyBitmapLoadState *dbls)
+{
+    BdrvDirtyBitmap *bitmap;
+    Error *local_err = NULL;
+
+    bitmap = bdrv_find_dirty_bitmap(dbls->bs, dbls->name);
+    if (bitmap && bdrv_dirty_bitmap_frozen(bitmap)) {
+        error_report("Dirty bitmap %s of %s is in use by a backup",
+                     dbls->name, bdrv_get_device_name(dbls->bs));
+        return -EBUSY;
+    }
+    if (bitmap && bdrv_dirty_bitmap_granularity(bitmap) !=
+                  dbls->granularity) {
+        bdrv_release_dirty_bitmap(dbls->bs, bitmap);
+        bitmap = NULL;
+    }
+    if (!bitmap) {
+        bitmap = bdrv_create_dirty_bitmap(dbls->bs, dbls->granularity,
+                                          dbls->name, &local_err);
+        if (!bitmap) {
+            error_report("%s", error_get_pretty(local_err));
+            error_free(local_err);
+            return -EINVAL;
+        }
+    }
+
+    bdrv_dirty_bitmap_set_persistent(bitmap, dbls->persistent &&
+                                     bdrv_can_store_dirty_bitmaps(dbls->bs));
+    bdrv_dirty_bitmap_set_contents(bitmap, dbls->bitmap);
+    dbls->bitmap = NULL;
+    dirty_bitmap_free_load(dbls);
+    return 0;
+}
+
+static int dirty_bitmap_load(QEMUFile *f, void *opaque, int version_id)
+{
+    char device_name[256], name[256];
+    DirtyBitmapLoadState *dbls;
+    BlockDriverState *bs;
+    int64_t total_sectors, sector, nr_sectors;
+    uint64_t size;
+    uint8_t *buf;
+    int flags;
+    int ret;
+
+    if (version_id != 1) {
+        return -EINVAL;
+    }
+
+    for (;;) {
+        flags = qemu_get_byte(f);
+        if (flags & DIRTY_BITMAP_MIG_FLAG_EOS) {
+            break;
+        }
+
+        dirty_bitmap_get_name(f, device_name);
+        dirty_bitmap_get_name(f, name);
+        ret = qemu_file_get_error(f);
+        if (ret) {
+            return ret;
+        }
+
+        bs = bdrv_find(device_name);
+        if (!bs) {
+            error_report("Error unknown block device %s", device_name);
+            return -EINVAL;
+        }
+        dbls = dirty_bitmap_find_load(bs, name);
+
+        if (flags & DIRTY_BITMAP_MIG_FLAG_START) {
+            total_sectors = qemu_get_be64(f);
+            if (total_sectors != bdrv_nb_sectors(bs)) {
+                error_report("Dirty bitmap %s: block device %s has a "
+                             "different size", name, device_name);
+                return -EINVAL;
+            }
+            if (dbls) {
+                dirty_bitmap_free_load(dbls);
+            }
+            dbls = g_new0(DirtyBitmapLoadState, 1);
+            dbls->bs = bs;
+            dbls->name = g_strdup(name);
+            dbls->granularity = qemu_get_be32(f);
+            dbls->persistent = qemu_get_byte(f);
+            if (dbls->granularity < BDRV_SECTOR_SIZE ||
+                dbls->granularity > DIRTY_BITMAP_MAX_GRANULARITY ||
+                (dbls->granularity & (dbls->granularity - 1))) {
+                error_report("Dirty bitmap %s: invalid granularity %" PRIu32,
+                             name, dbls->granularity);
+                g_free(dbls->name);
+                g_free(dbls);
+                return -EINVAL;
+            }
+            dbls->bitmap = hbitmap_alloc(total_sectors,
+                                         ctz32(dbls->granularity) -
+                                         BDRV_SECTOR_BITS);
+            QSIMPLEQ_INSERT_TAIL(&dirty_bitmap_mig_state.load_list, dbls,
+                                 entry);
+        } else if (!dbls) {
+            error_report("Dirty bitmap %s of %s was not started",
+                         name, device_name);
+            return -EINVAL;
+        } else if (flags & DIRTY_BITMAP_MIG_FLAG_CHUNK) {
+            sector = qemu_get_be64(f);
+            nr_sectors = qemu_get_be64(f);
+            if (sector < 0 || nr_sectors <= 0 ||
+                sector % DIRTY_BITMAP_CHUNK_SECTORS ||
+                nr_sectors > DIRTY_BITMAP_CHUNK_SECTORS ||
+                sector + nr_sectors > bdrv_nb_sectors(bs) ||
+                (nr_sectors < DIRTY_BITMAP_CHUNK_SECTORS &&
+                 sector + nr_sectors != bdrv_nb_sectors(bs))) {
+                error_report("Dirty bitmap %s: invalid range", name);
+                return -EINVAL;
+            }
+            if (flags & DIRTY_BITMAP_MIG_FLAG_ZERO) {
+                hbitmap_reset(dbls->bitmap, sector, nr_sectors);
+            } else {
+                size = qemu_get_be64(f);
+                if (size != hbitmap_serialization_size_part(dbls->bitmap,
+                                                            sector,
+                                                            nr_sectors)) {
+                    error_report("Dirty bitmap %s: invalid size", name);
+                    return -EINVAL;
+                }
+                buf = g_malloc(size);
+                qemu_get_buffer(f, buf, size);
+                hbitmap_deserialize_part(dbls->bitmap, buf, sector,
+                                         nr_sectors);
+                g_free(buf);
+            }
+        } else if (flags & DIRTY_BITMAP_MIG_FLAG_COMPLETE) {
+            ret = dirty_bitmap_load_complete(dbls);
+            if (ret) {
+                return ret;
+            }
+        } else if (flags & DIRTY_BITMAP_MIG_FLAG_DROP) {
+            dirty_bitmap_free_load(dbls);
+        } else {
+            error_report("Unknown dirty bitmap migration flags: %#x", flags);
+            return -EINVAL;
+        }
+
+        ret = qemu_file_get_error(f);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return qemu_file_get_error(f);
+}
+
+static bool dirty_bitmap_is_active(void *opaque)
+{
+    return migrate_dirty_bitmaps();
+}
+
+static SaveVMHandlers savevm_dirty_bitmap_handlers = {
+    .save_live_setup = dirty_bitmap_save_setup,
+    .save_live_iterate = dirty_bitmap_save_iterate,
+    .save_live_complete = dirty_bitmap_save_complete,
+    .save_live_pending = dirty_bitmap_save_pending,
+    .load_state = dirty_bitmap_load,
+    .cancel = dirty_bitmap_migration_cancel,
+    .is_active = dirty_bitmap_is_active,
+};
+
 void blk_mig_init(void)
 {
     QSIMPLEQ_INIT(&block_mig_state.bmds_list);
@@ -881,4 +1530,10 @@ void blk_mig_init(void)
 
     register_savevm_live(NULL, "block", 0, 1, &savevm_block_handlers,
                          &block_mig_state);
+
+    QSIMPLEQ_INIT(&dirty_bitmap_mig_state.dbms_list);
+    QSIMPLEQ_INIT(&dirty_bitmap_mig_state.load_list);
+    register_savevm_live(NULL, "dirty-bitmaps", 0, 1,
+                         &savevm_dirty_bitmap_handlers,
+                         &dirty_bitmap_mig_state);
 }
@@ -26,6 +26,7 @@
 #include "trace.h"
 #include "block/block_int.h"
 #include "block/blockjob.h"
+#include "block/throttle-groups.h"
 #include "qemu/module.h"
 #include "qapi/qmp/qjson.h"
 #include "sysemu/block-backend.h"
@@ -35,6 +36,7 @@
 #include "block/qapi.h"
 #include "qmp-commands.h"
 #include "qemu/timer.h"
+#include "qemu/atomic.h"
 #include "qapi-event.h"
 
 #ifdef CONFIG_BSD
@@ -53,6 +55,9 @@
 
 struct BdrvDirtyBitmap {
     HBitmap *bitmap;
+    char *name;                 /* NULL for bitmaps private to a block job */
+    bool persistent;            /* stored in the image on close */
+    bool frozen;                /* contents taken by an incremental backup */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -87,6 +92,7 @@ static BlockAIOCB *bdrv_co_aio_rw_vector(BlockDriverState *bs,
 static void coroutine_fn bdrv_co_do_rw(void *opaque);
 static int coroutine_fn bdrv_co_do_write_zeroes(BlockDriverState *bs,
     int64_t sector_num, int nb_sectors, BdrvRequestFlags flags);
+static void bdrv_release_named_dirty_bitmaps(BlockDriverState *bs);
 
 static QTAILQ_HEAD(, BlockDriverState) bdrv_states =
     QTAILQ_HEAD_INITIALIZER(bdrv_states);
@@ -126,7 +132,7 @@ void bdrv_set_io_limits(BlockDriverState *bs,
 {
     int i;
 
-    throttle_config(&bs->throttle_state, cfg);
+    throttle_group_config(bs, cfg);
 
     for (i = 0; i < 2; i++) {
         qemu_co_enter_next(&bs->throttled_reqs[i]);
@@ -159,32 +165,34 @@ void bdrv_io_limits_disable(BlockDriverState *bs)
 
     bdrv_start_throttled_reqs(bs);
 
-    throttle_destroy(&bs->throttle_state);
+    throttle_group_unregister_bs(bs);
 }
 
-static void bdrv_throttle_read_timer_cb(void *opaque)
+/* should be called before bdrv_set_io_limits if a limit is set */
+void bdrv_io_limits_enable(BlockDriverState *bs, const char *group)
 {
-    BlockDriverState *bs = opaque;
-    qemu_co_enter_next(&bs->throttled_reqs[0]);
+    assert(!bs->io_limits_enabled);
+    throttle_group_register_bs(bs, group);
+    bs->io_limits_enabled = true;
 }
 
-static void bdrv_throttle_write_timer_cb(void *opaque)
+/* Move @bs to throttling group @group, keeping the limits of the new
+ * group.  Does nothing if @bs is already a member of @group. */
+void bdrv_io_limits_update_group(BlockDriverState *bs, const char *group)
 {
-    BlockDriverState *bs = opaque;
-    qemu_co_enter_next(&bs->throttled_reqs[1]);
-}
+    /* this bs is not part of any group */
+    if (!bs->throttle_state) {
+        return;
+    }
 
-/* should be called before bdrv_set_io_limits if a limit is set */
-void bdrv_io_limits_enable(BlockDriverState *bs)
-{
-    assert(!bs->io_limits_enabled);
-    throttle_init(&bs->throttle_state,
-                  bdrv_get_aio_context(bs),
-                  QEMU_CLOCK_VIRTUAL,
-                  bdrv_throttle_read_timer_cb,
-                  bdrv_throttle_write_timer_cb,
-                  bs);
-    bs->io_limits_enabled = true;
+    /* this bs is a part of the same group than the one we want */
+    if (!g_strcmp0(throttle_group_get_name(bs), group)) {
+        return;
+    }
+
+    /* need to change the group this bs belong to */
+    bdrv_io_limits_disable(bs);
+    bdrv_io_limits_enable(bs, group);
 }
 
 /* This function makes an IO wait if needed
@@ -196,26 +204,7 @@ static void bdrv_io_limits_intercept(BlockDriverState *bs,
                                      unsigned int bytes,
                                      bool is_write)
 {
-    /* does this io must wait */
-    bool must_wait = throttle_schedule_timer(&bs->throttle_state, is_write);
-
-    /* if must wait or any request of this type throttled queue the IO */
-    if (must_wait ||
-        !qemu_co_queue_empty(&bs->throttled_reqs[is_write])) {
-        qemu_co_queue_wait(&bs->throttled_reqs[is_write]);
-    }
-
-    /* the IO will be executed, do the accounting */
-    throttle_account(&bs->throttle_state, is_write, bytes);
-
-
-    /* if the next request must wait -> do nothing */
-    if (throttle_schedule_timer(&bs->throttle_state, is_write)) {
-        return;
-    }
-
-    /* else queue next request for execution */
-    qemu_co_queue_next(&bs->throttled_reqs[is_write]);
+    throttle_group_co_io_limits_intercept(bs, bytes, is_write);
 }
 
 size_t bdrv_opt_mem_align(BlockDriverState *bs)
@@ -351,8 +340,10 @@ BlockDriverState *bdrv_new(void)
         QLIST_INIT(&bs->op_blockers[i]);
     }
     bdrv_iostatus_disable(bs);
+    block_acct_init(&bs->stats);
     notifier_list_init(&bs->close_notifiers);
     notifier_with_return_list_init(&bs->before_write_notifiers);
+    notifier_with_return_list_init(&bs->after_write_notifiers);
     qemu_co_queue_init(&bs->throttled_reqs[0]);
     qemu_co_queue_init(&bs->throttled_reqs[1]);
     bs->refcnt = 1;
@@ -1832,6 +1823,7 @@ void bdrv_close(BlockDriverState *bs)
             bdrv_unref(backing_hd);
         }
         bs->drv->bdrv_close(bs);
+        bdrv_release_named_dirty_bitmaps(bs);
         g_free(bs->opaque);
         bs->opaque = NULL;
         bs->drv = NULL;
@@ -1901,6 +1893,9 @@ static bool bdrv_requests_pending(BlockDriverState *bs)
     if (bs->backing_hd && bdrv_requests_pending(bs->backing_hd)) {
         return true;
     }
+    if (atomic_read(&bs->mq_in_flight)) {
+        return true;
+    }
     return false;
 }
 
@@ -1927,9 +1922,15 @@ static bool bdrv_drain_one(BlockDriverState *bs)
  */
 void bdrv_drain(BlockDriverState *bs)
 {
+    /* Queue threads fall back to the home context, which we hold.  The
+     * barrier pairs with the one in bdrv_aio_mq_rw().
+     */
+    atomic_inc(&bs->mq_quiesce);
+    smp_mb();
     while (bdrv_drain_one(bs)) {
         /* Keep iterating */
     }
+    atomic_dec(&bs->mq_quiesce);
 }
 
 /*
@@ -1950,6 +1951,11 @@ void bdrv_drain_all(void)
     bool busy = true;
     BlockDriverState *bs;
 
+    QTAILQ_FOREACH(bs, &bdrv_states, device_list) {
+        atomic_inc(&bs->mq_quiesce);
+    }
+    smp_mb();
+
     while (busy) {
         busy = false;
 
@@ -1961,6 +1967,10 @@ void bdrv_drain_all(void)
             aio_context_release(aio_context);
         }
     }
+
+    QTAILQ_FOREACH(bs, &bdrv_states, device_list) {
+        atomic_dec(&bs->mq_quiesce);
+    }
 }
 
 /* make a BlockDriverState anonymous by removing from bdrv_state and
@@ -2004,12 +2014,18 @@ static void bdrv_move_feature_fields(BlockDriverState *bs_dest,
     bs_dest->enable_write_cache = bs_src->enable_write_cache;
 
     /* i/o throttled req */
-    memcpy(&bs_dest->throttle_state,
-           &bs_src->throttle_state,
-           sizeof(ThrottleState));
+    bs_dest->throttle_state     = bs_src->throttle_state;
+    bs_dest->io_limits_enabled  = bs_src->io_limits_enabled;
+    bs_dest->pending_reqs[0]    = bs_src->pending_reqs[0];
+    bs_dest->pending_reqs[1]    = bs_src->pending_reqs[1];
     bs_dest->throttled_reqs[0]  = bs_src->throttled_reqs[0];
     bs_dest->throttled_reqs[1]  = bs_src->throttled_reqs[1];
-    bs_dest->io_limits_enabled  = bs_src->io_limits_enabled;
+    memcpy(&bs_dest->round_robin,
+           &bs_src->round_robin,
+           sizeof(bs_dest->round_robin));
+    memcpy(&bs_dest->throttle_timers,
+           &bs_src->throttle_timers,
+           sizeof(ThrottleTimers));
 
     /* r/w error */
     bs_dest->on_read_error      = bs_src->on_read_error;
@@ -2068,7 +2084,8 @@ void bdrv_swap(BlockDriverState *bs_new, BlockDriverState *bs_old)
     assert(QLIST_EMPTY(&bs_new->dirty_bitmaps));
     assert(bs_new->job == NULL);
     assert(bs_new->io_limits_enabled == false);
-    assert(!throttle_have_timer(&bs_new->throttle_state));
+    assert(!bs_new->throttle_state);
+    assert(!throttle_timers_are_initialized(&bs_new->throttle_timers));
 
     tmp = *bs_new;
     *bs_new = *bs_old;
@@ -2085,7 +2102,8 @@ void bdrv_swap(BlockDriverState *bs_new, BlockDriverState *bs_old)
     /* Check a few fields that should remain attached to the device */
     assert(bs_new->job == NULL);
     assert(bs_new->io_limits_enabled == false);
-    assert(!throttle_have_timer(&bs_new->throttle_state));
+    assert(!bs_new->throttle_state);
+    assert(!throttle_timers_are_initialized(&bs_new->throttle_timers));
 
     /* insert the nodes back into the graph node list if needed */
     if (bs_new->node_name[0] != '\0') {
@@ -2131,6 +2149,7 @@ static void bdrv_delete(BlockDriverState *bs)
     /* remove from list, if necessary */
     bdrv_make_anon(bs);
 
+    block_acct_cleanup(&bs->stats);
     g_free(bs);
 }
 
@@ -2141,7 +2160,8 @@ static void bdrv_delete(BlockDriverState *bs)
  * free of errors) or -errno when an internal error occurred. The results of the
  * check are stored in res.
  */
-int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix)
+int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix,
+               BlockDriverCheckStatusCB *status_cb)
 {
     if (bs->drv == NULL) {
         return -ENOMEDIUM;
@@ -2151,7 +2171,7 @@ int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix)
     }
 
     memset(res, 0, sizeof(*res));
-    return bs->drv->bdrv_check(bs, res, fix);
+    return bs->drv->bdrv_check(bs, res, fix, status_cb);
 }
 
 #define COMMIT_BUF_SECTORS 2048
@@ -3257,6 +3277,7 @@ static int coroutine_fn bdrv_aligned_pwritev(BlockDriverState *bs,
     assert(req->overlap_offset <= offset);
     assert(offset + bytes <= req->overlap_offset + req->overlap_bytes);
 
+    req->qiov = qiov;
     ret = notifier_with_return_list_notify(&bs->before_write_notifiers, req);
 
     if (!ret && bs->detect_zeroes != BLOCKDEV_DETECT_ZEROES_OPTIONS_OFF &&
@@ -3285,6 +3306,11 @@ static int coroutine_fn bdrv_aligned_pwritev(BlockDriverState *bs,
 
     bdrv_set_dirty(bs, sector_num, nb_sectors);
 
+    if (ret == 0) {
+        ret = notifier_with_return_list_notify(&bs->after_write_notifiers,
+                                               req);
+    }
+
     block_acct_highest_sector(&bs->stats, sector_num, nb_sectors);
 
     if (bs->growable && ret >= 0) {
@@ -4004,28 +4030,58 @@ static int64_t coroutine_fn bdrv_co_get_block_status(BlockDriverState *bs,
     return ret;
 }
 
-/* Coroutine wrapper for bdrv_get_block_status() */
+/*
+ * Like bdrv_co_get_block_status(), but look through the backing chain of
+ * @bs down to, and excluding, @base.  The status is that of the first image
+ * in which the sectors are allocated or known to read as zero.
+ */
+static int64_t coroutine_fn bdrv_co_get_block_status_above(
+    BlockDriverState *bs, BlockDriverState *base,
+    int64_t sector_num, int nb_sectors, int *pnum)
+{
+    BlockDriverState *p;
+    int64_t ret = 0;
+
+    assert(bs != base);
+    for (p = bs; p != base; p = p->backing_hd) {
+        ret = bdrv_co_get_block_status(p, sector_num, nb_sectors, pnum);
+        if (ret < 0 || (ret & (BDRV_BLOCK_ALLOCATED | BDRV_BLOCK_ZERO))) {
+            break;
+        }
+        /* [sector_num, *pnum] is unallocated in p, but a lower image may
+         * have only part of it allocated.
+         */
+        nb_sectors = MIN(nb_sectors, *pnum);
+    }
+    return ret;
+}
+
+/* Coroutine wrapper for bdrv_get_block_status_above() */
 static void coroutine_fn bdrv_get_block_status_co_entry(void *opaque)
 {
     BdrvCoGetBlockStatusData *data = opaque;
-    BlockDriverState *bs = data->bs;
 
-    data->ret = bdrv_co_get_block_status(bs, data->sector_num, data->nb_sectors,
-                                         data->pnum);
+    data->ret = bdrv_co_get_block_status_above(data->bs, data->base,
+                                               data->sector_num,
+                                               data->nb_sectors,
+                                               data->pnum);
     data->done = true;
 }
 
 /*
- * Synchronous wrapper around bdrv_co_get_block_status().
+ * Synchronous wrapper around bdrv_co_get_block_status_above().
  *
- * See bdrv_co_get_block_status() for details.
+ * See bdrv_co_get_block_status_above() for details.
  */
-int64_t bdrv_get_block_status(BlockDriverState *bs, int64_t sector_num,
-                              int nb_sectors, int *pnum)
+int64_t bdrv_get_block_status_above(BlockDriverState *bs,
+                                    BlockDriverState *base,
+                                    int64_t sector_num,
+                                    int nb_sectors, int *pnum)
 {
     Coroutine *co;
     BdrvCoGetBlockStatusData data = {
         .bs = bs,
+        .base = base,
         .sector_num = sector_num,
         .nb_sectors = nb_sectors,
         .pnum = pnum,
@@ -4047,6 +4103,13 @@ int64_t bdrv_get_block_status(BlockDriverState *bs, int64_t sector_num,
     return data.ret;
 }
 
+int64_t bdrv_get_block_status(BlockDriverState *bs, int64_t sector_num,
+                              int nb_sectors, int *pnum)
+{
+    return bdrv_get_block_status_above(bs, bs->backing_hd,
+                                       sector_num, nb_sectors, pnum);
+}
+
 int coroutine_fn bdrv_is_allocated(BlockDriverState *bs, int64_t sector_num,
                                    int nb_sectors, int *pnum)
 {
@@ -4124,20 +4187,67 @@ void bdrv_get_backing_filename(BlockDriverState *bs,
     pstrcpy(filename, filename_size, bs->backing_file);
 }
 
+typedef struct WriteCompressedCo {
+    BlockDriverState *bs;
+    int64_t sector_num;
+    const uint8_t *buf;
+    int nb_sectors;
+    int ret;
+} WriteCompressedCo;
+
+static void coroutine_fn bdrv_write_compressed_co_entry(void *opaque)
+{
+    WriteCompressedCo *wco = opaque;
+    BlockDriver *drv = wco->bs->drv;
+
+    wco->ret = drv->bdrv_co_write_compressed(wco->bs, wco->sector_num,
+                                             wco->buf, wco->nb_sectors);
+}
+
 int bdrv_write_compressed(BlockDriverState *bs, int64_t sector_num,
                           const uint8_t *buf, int nb_sectors)
 {
     BlockDriver *drv = bs->drv;
+    Coroutine *co;
+    WriteCompressedCo wco = {
+        .bs = bs,
+        .sector_num = sector_num,
+        .buf = buf,
+        .nb_sectors = nb_sectors,
+        .ret = NOT_DONE,
+    };
+
     if (!drv)
         return -ENOMEDIUM;
-    if (!drv->bdrv_write_compressed)
+    if (!drv->bdrv_write_compressed && !drv->bdrv_co_write_compressed)
         return -ENOTSUP;
     if (bdrv_check_request(bs, sector_num, nb_sectors))
         return -EIO;
 
     assert(QLIST_EMPTY(&bs->dirty_bitmaps));
 
-    return drv->bdrv_write_compressed(bs, sector_num, buf, nb_sectors);
+    if (!drv->bdrv_co_write_compressed) {
+        return drv->bdrv_write_compressed(bs, sector_num, buf, nb_sectors);
+    }
+
+    if (qemu_in_coroutine()) {
+        /* Fast-path if already in coroutine context */
+        bdrv_write_compressed_co_entry(&wco);
+    } else {
+        AioContext *aio_context = bdrv_get_aio_context(bs);
+
+        co = qemu_coroutine_create(bdrv_write_compressed_co_entry);
+        qemu_coroutine_enter(co, &wco);
+        while (wco.ret == NOT_DONE) {
+            aio_poll(aio_context, true);
+        }
+    }
+    return wco.ret;
+}
+
+bool bdrv_can_write_compressed_parallel(BlockDriverState *bs)
+{
+    return bs->drv && bs->drv->bdrv_co_write_compressed;
 }
 
 int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
@@ -4160,6 +4270,15 @@ ImageInfoSpecific *bdrv_get_specific_info(BlockDriverState *bs)
     return NULL;
 }
 
+BlockStatsSpecific *bdrv_get_specific_stats(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+    if (drv && drv->bdrv_get_specific_stats) {
+        return drv->bdrv_get_specific_stats(bs);
+    }
+    return NULL;
+}
+
 int bdrv_save_vmstate(BlockDriverState *bs, const uint8_t *buf,
                       int64_t pos, int size)
 {
@@ -4370,6 +4489,149 @@ BlockAIOCB *bdrv_aio_writev(BlockDriverState *bs, int64_t sector_num,
                                  cb, opaque, true);
 }
 
+int bdrv_add_aio_queue(BlockDriverState *bs, AioContext *ctx, Error **errp)
+{
+    BlockDriver *drv = bs->drv;
+    int ret;
+
+    if (!drv) {
+        error_setg(errp, "No medium inserted");
+        return -ENOMEDIUM;
+    }
+    if (!drv->bdrv_add_aio_queue) {
+        error_setg(errp, "Block format '%s' used by device '%s' does not "
+                   "support multiqueue submission", drv->format_name,
+                   bdrv_get_device_name(bs));
+        return -ENOTSUP;
+    }
+    assert(!atomic_read(&bs->mq_in_flight));
+    ret = drv->bdrv_add_aio_queue(bs, ctx, errp);
+    if (ret == 0) {
+        bs->mq_queues++;
+    }
+    return ret;
+}
+
+void bdrv_del_aio_queue(BlockDriverState *bs, AioContext *ctx)
+{
+    assert(bs->mq_queues > 0);
+    assert(!atomic_read(&bs->mq_in_flight));
+    if (bs->drv && bs->drv->bdrv_del_aio_queue) {
+        bs->drv->bdrv_del_aio_queue(bs, ctx);
+    }
+    bs->mq_queues--;
+}
+
+bool bdrv_aio_mq_usable(BlockDriverState *bs)
+{
+    if (!bs->drv || !bs->drv->bdrv_aio_mq_rw || !bs->mq_queues ||
+        atomic_read(&bs->mq_quiesce)) {
+        return false;
+    }
+    if (bs->io_limits_enabled || bs->copy_on_read ||
+        !bs->enable_write_cache || !QLIST_EMPTY(&bs->dirty_bitmaps) ||
+        !QLIST_EMPTY(&bs->before_write_notifiers.notifiers) ||
+        !QLIST_EMPTY(&bs->after_write_notifiers.notifiers)) {
+        return false;
+    }
+    return !bs->file || bdrv_aio_mq_usable(bs->file);
+}
+
+typedef struct BdrvMQRequest {
+    BlockDriverState *bs;
+    BlockCompletionFunc *cb;
+    void *opaque;
+} BdrvMQRequest;
+
+static void bdrv_aio_mq_dec_in_flight(BlockDriverState *bs)
+{
+    if (atomic_fetch_dec(&bs->mq_in_flight) == 1) {
+        /* wake up bdrv_drain() in the home context */
+        aio_notify(bdrv_get_aio_context(bs));
+    }
+}
+
+static void bdrv_aio_mq_cb(void *opaque, int ret)
+{
+    BdrvMQRequest *req = opaque;
+    BlockDriverState *bs = req->bs;
+
+    req->cb(req->opaque, ret);
+    g_free(req);
+    bdrv_aio_mq_dec_in_flight(bs);
+}
+
+/* Requests submitted here bypass request tracking, which is why
+ * bdrv_aio_mq_usable() rules out everything that depends on it.  They are
+ * counted in mq_in_flight so that bdrv_drain() still waits for them.
+ * Returns NULL, without calling @cb, if the request cannot be submitted
+ * from @ctx; the caller should then retry from the home context.
+ */
+static BlockAIOCB *bdrv_aio_mq_rw(BlockDriverState *bs, AioContext *ctx,
+                                  int64_t sector_num, QEMUIOVector *qiov,
+                                  int nb_sectors, BlockCompletionFunc *cb,
+                                  void *opaque, bool is_write)
+{
+    BdrvMQRequest *req;
+    BlockAIOCB *acb;
+
+    trace_bdrv_aio_mq_rw(bs, ctx, sector_num, nb_sectors, is_write, opaque);
+
+    if (ctx == bdrv_get_aio_context(bs)) {
+        return bdrv_co_aio_rw_vector(bs, sector_num, qiov, nb_sectors, 0,
+                                     cb, opaque, is_write);
+    }
+
+    if (!bdrv_aio_mq_usable(bs) ||
+        bdrv_check_request(bs, sector_num, nb_sectors) ||
+        (is_write && bs->read_only)) {
+        return NULL;
+    }
+
+    /* Count the request before looking at mq_quiesce again.  Paired with
+     * bdrv_drain(), which raises mq_quiesce before it reads mq_in_flight:
+     * either the drain waits for this request, or we see mq_quiesce and
+     * back out.
+     */
+    atomic_inc(&bs->mq_in_flight);
+    smp_mb();
+    if (atomic_read(&bs->mq_quiesce)) {
+        bdrv_aio_mq_dec_in_flight(bs);
+        return NULL;
+    }
+
+    req = g_new(BdrvMQRequest, 1);
+    req->bs = bs;
+    req->cb = cb;
+    req->opaque = opaque;
+
+    acb = bs->drv->bdrv_aio_mq_rw(bs, ctx, sector_num, qiov, nb_sectors,
+                                  bdrv_aio_mq_cb, req, is_write);
+    if (!acb) {
+        g_free(req);
+        bdrv_aio_mq_dec_in_flight(bs);
+    }
+    return acb;
+}
+
+BlockAIOCB *bdrv_aio_readv_mq(BlockDriverState *bs, AioContext *ctx,
+                              int64_t sector_num, QEMUIOVector *qiov,
+                              int nb_sectors, BlockCompletionFunc *cb,
+                              void *opaque)
+{
+    return bdrv_aio_mq_rw(bs, ctx, sector_num, qiov, nb_sectors,
+                          cb, opaque, false);
+}
+
+BlockAIOCB *bdrv_aio_writev_mq(BlockDriverState *bs, AioContext *ctx,
+                               int64_t sector_num, QEMUIOVector *qiov,
+                               int nb_sectors, BlockCompletionFunc *cb,
+                               void *opaque)
+{
+    return bdrv_aio_mq_rw(bs, ctx, sector_num, qiov, nb_sectors,
+                          cb, opaque, true);
+}
+
 BlockAIOCB *bdrv_aio_write_zeroes(BlockDriverState *bs,
         int64_t sector_num, int nb_sectors, BdrvRequestFlags flags,
         BlockCompletionFunc *cb, void *opaque)
@@ -5292,13 +5554,18 @@ bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
 }
 
 BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs, int granularity,
-                                          Error **errp)
+                                          const char *name, Error **errp)
 {
     int64_t bitmap_size;
     BdrvDirtyBitmap *bitmap;
 
     assert((granularity & (granularity - 1)) == 0);
 
+    if (name && bdrv_find_dirty_bitmap(bs, name)) {
+        error_setg(errp, "Bitmap already exists: %s", name);
+        return NULL;
+    }
+
     granularity >>= BDRV_SECTOR_BITS;
     assert(granularity);
     bitmap_size = bdrv_nb_sectors(bs);
@@ -5309,23 +5576,207 @@ BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs, int granularity,
     }
     bitmap = g_new0(BdrvDirtyBitmap, 1);
     bitmap->bitmap = hbitmap_alloc(bitmap_size, ffs(granularity) - 1);
+    bitmap->name = g_strdup(name);
     QLIST_INSERT_HEAD(&bs->dirty_bitmaps, bitmap, list);
     return bitmap;
 }
 
+BdrvDirtyBitmap *bdrv_find_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name)
+{
+    BdrvDirtyBitmap *bm;
+
+    QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
+        if (bm->name && !strcmp(name, bm->name)) {
+            return bm;
+        }
+    }
+    return NULL;
+}
+
 void bdrv_release_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
 {
     BdrvDirtyBitmap *bm, *next;
     QLIST_FOREACH_SAFE(bm, &bs->dirty_bitmaps, list, next) {
         if (bm == bitmap) {
+            assert(!bitmap->frozen);
             QLIST_REMOVE(bitmap, list);
             hbitmap_free(bitmap->bitmap);
+            g_free(bitmap->name);
             g_free(bitmap);
             return;
         }
     }
 }
 
+/* Drop the named bitmaps when the image is closed; the format driver's
+ * bdrv_close has already stored the persistent ones.
+ */
+static void bdrv_release_named_dirty_bitmaps(BlockDriverState *bs)
+{
+    BdrvDirtyBitmap *bm, *next;
+
+    QLIST_FOREACH_SAFE(bm, &bs->dirty_bitmaps, list, next) {
+        if (bm->name) {
+            bdrv_release_dirty_bitmap(bs, bm);
+        }
+    }
+}
+
+/* Iterate over the dirty bitmaps of @bs, starting with @bitmap == NULL */
+BdrvDirtyBitmap *bdrv_dirty_bitmap_next(BlockDriverState *bs,
+                                        BdrvDirtyBitmap *bitmap)
+{
+    return bitmap ? QLIST_NEXT(bitmap, list) : QLIST_FIRST(&bs->dirty_bitmaps);
+}
+
+const char *bdrv_dirty_bitmap_name(BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->name;
+}
+
+uint32_t bdrv_dirty_bitmap_granularity(BdrvDirtyBitmap *bitmap)
+{
+    return BDRV_SECTOR_SIZE << hbitmap_granularity(bitmap->bitmap);
+}
+
+bool bdrv_dirty_bitmap_is_persistent(BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->persistent;
+}
+
+void bdrv_dirty_bitmap_set_persistent(BdrvDirtyBitmap *bitmap,
+                                      bool persistent)
+{
+    assert(bitmap->name);
+    bitmap->persistent = persistent;
+}
+
+bool bdrv_dirty_bitmap_frozen(BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->frozen;
+}
+
+bool bdrv_can_store_dirty_bitmaps(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    return drv && drv->bdrv_can_store_dirty_bitmaps && !bs->read_only &&
+           drv->bdrv_can_store_dirty_bitmaps(bs);
+}
+
+/* Clear @bitmap.  If @out is not NULL, the old contents are returned there
+ * instead of being freed, so that bdrv_undo_clear_dirty_bitmap can restore
+ * them.
+ */
+void bdrv_clear_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                             HBitmap **out)
+{
+    int granularity = hbitmap_granularity(bitmap->bitmap);
+
+    assert(!bitmap->frozen);
+    if (out) {
+        *out = bitmap->bitmap;
+    } else {
+        hbitmap_free(bitmap->bitmap);
+    }
+    bitmap->bitmap = hbitmap_alloc(bdrv_nb_sectors(bs), granularity);
+}
+
+static void bdrv_dirty_bitmap_merge(BdrvDirtyBitmap *bitmap,
+                                    HBitmap *contents)
+{
+    HBitmapIter hbi;
+    int64_t sector;
+
+    hbitmap_iter_init(&hbi, contents, 0);
+    while ((sector = hbitmap_iter_next(&hbi)) >= 0) {
+        hbitmap_set(bitmap->bitmap, sector,
+                    1 << hbitmap_granularity(contents));
+    }
+}
+
+/* Undo a bdrv_clear_dirty_bitmap that returned @backup; writes tracked
+ * since the clear are kept.
+ */
+void bdrv_undo_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *backup)
+{
+    bdrv_dirty_bitmap_merge(bitmap, backup);
+    hbitmap_free(backup);
+}
+
+/* Take the current contents of @bitmap, leaving it empty so that it keeps
+ * tracking writes from now on.  Until bdrv_dirty_bitmap_thaw, the bitmap
+ * cannot be cleared, released or frozen again.
+ */
+HBitmap *bdrv_dirty_bitmap_freeze(BlockDriverState *bs,
+                                  BdrvDirtyBitmap *bitmap)
+{
+    HBitmap *contents = bitmap->bitmap;
+
+    assert(!bitmap->frozen);
+    bitmap->bitmap = hbitmap_alloc(bdrv_nb_sectors(bs),
+                                   hbitmap_granularity(contents));
+    bitmap->frozen = true;
+    return contents;
+}
+
+/* Finish a bdrv_dirty_bitmap_freeze.  If the user of @contents failed,
+ * @merge adds them back to @bitmap so that nothing is lost.
+ */
+void bdrv_dirty_bitmap_thaw(BdrvDirtyBitmap *bitmap, HBitmap *contents,
+                            bool merge)
+{
+    assert(bitmap->frozen);
+    if (merge) {
+        bdrv_dirty_bitmap_merge(bitmap, contents);
+    }
+    hbitmap_free(contents);
+    bitmap->frozen = false;
+}
+
+uint64_t bdrv_dirty_bitmap_serialization_size(BdrvDirtyBitmap *bitmap)
+{
+    return hbitmap_serialization_size(bitmap->bitmap);
+}
+
+void bdrv_dirty_bitmap_serialize(BdrvDirtyBitmap *bitmap, uint8_t *buf)
+{
+    hbitmap_serialize(bitmap->bitmap, buf);
+}
+
+void bdrv_dirty_bitmap_deserialize(BdrvDirtyBitmap *bitmap,
+                                   const uint8_t *buf)
+{
+    hbitmap_deserialize(bitmap->bitmap, buf);
+}
+
+uint64_t bdrv_dirty_bitmap_serialization_size_part(BdrvDirtyBitmap *bitmap,
+                                                   int64_t sector,
+                                                   int64_t nr_sectors)
+{
+    return hbitmap_serialization_size_part(bitmap->bitmap, sector, nr_sectors);
+}
+
+void bdrv_dirty_bitmap_serialize_part(BdrvDirtyBitmap *bitmap, uint8_t *buf,
+                                      int64_t sector, int64_t nr_sectors)
+{
+    hbitmap_serialize_part(bitmap->bitmap, buf, sector, nr_sectors);
+}
+
+/* Replace the contents of @bitmap with @contents, which must have the same
+ * size and granularity, and which @bitmap takes over.
+ */
+void bdrv_dirty_bitmap_set_contents(BdrvDirtyBitmap *bitmap,
+                                    HBitmap *contents)
+{
+    assert(!bitmap->frozen);
+    assert(hbitmap_granularity(contents) ==
+           hbitmap_granularity(bitmap->bitmap));
+    hbitmap_free(bitmap->bitmap);
+    bitmap->bitmap = contents;
+}
+
 BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
 {
     BdrvDirtyBitmap *bm;
@@ -5338,6 +5789,10 @@ BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
         info->count = bdrv_get_dirty_count(bs, bm);
         info->granularity =
             ((int64_t) BDRV_SECTOR_SIZE << hbitmap_granularity(bm->bitmap));
+        info->has_name = !!bm->name;
+        info->name = g_strdup(bm->name);
+        info->persistent = bm->persistent;
+        info->frozen = bm->frozen;
         entry->value = info;
         *plist = entry;
         plist = &entry->next;
@@ -5378,6 +5833,12 @@ void bdrv_reset_dirty(BlockDriverState *bs, int64_t cur_sector, int nr_sectors)
     }
 }
 
+void bdrv_reset_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                             int64_t cur_sector, int nr_sectors)
+{
+    hbitmap_reset(bitmap->bitmap, cur_sector, nr_sectors);
+}
+
 int64_t bdrv_get_dirty_count(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
 {
     return hbitmap_count(bitmap->bitmap);
@@ -5675,7 +6136,7 @@ void bdrv_detach_aio_context(BlockDriverState *bs)
     }
 
     if (bs->io_limits_enabled) {
-        throttle_detach_aio_context(&bs->throttle_state);
+        throttle_timers_detach_aio_context(&bs->throttle_timers);
     }
     if (bs->drv->bdrv_detach_aio_context) {
         bs->drv->bdrv_detach_aio_context(bs);
@@ -5711,7 +6172,7 @@ void bdrv_attach_aio_context(BlockDriverState *bs,
         bs->drv->bdrv_attach_aio_context(bs, new_context);
     }
     if (bs->io_limits_enabled) {
-        throttle_attach_aio_context(&bs->throttle_state, new_context);
+        throttle_timers_attach_aio_context(&bs->throttle_timers, new_context);
     }
 
     QLIST_FOREACH(ban, &bs->aio_notifiers, list) {
@@ -5776,6 +6237,12 @@ void bdrv_add_before_write_notifier(BlockDriverState *bs,
     notifier_with_return_list_add(&bs->before_write_notifiers, notifier);
 }
 
+void bdrv_add_after_write_notifier(BlockDriverState *bs,
+                                   NotifierWithReturn *notifier)
+{
+    notifier_with_return_list_add(&bs->after_write_notifiers, notifier);
+}
+
 int bdrv_amend_options(BlockDriverState *bs, QemuOpts *opts,
                        BlockDriverAmendStatusCB *status_cb)
 {
@@ -5906,6 +6373,36 @@ void bdrv_flush_io_queue(BlockDriverState *bs)
     }
 }
 
+void bdrv_register_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (drv && drv->bdrv_register_buf) {
+        drv->bdrv_register_buf(bs, host, size);
+    }
+    if (bs->file) {
+        bdrv_register_buf(bs->file, host, size);
+    }
+    if (bs->backing_hd) {
+        bdrv_register_buf(bs->backing_hd, host, size);
+    }
+}
+
+void bdrv_unregister_buf(BlockDriverState *bs, void *host)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (drv && drv->bdrv_unregister_buf) {
+        drv->bdrv_unregister_buf(bs, host);
+    }
+    if (bs->file) {
+        bdrv_unregister_buf(bs->file, host);
+    }
+    if (bs->backing_hd) {
+        bdrv_unregister_buf(bs->backing_hd, host);
+    }
+}
+
 static bool append_open_options(QDict *d, BlockDriverState *bs)
 {
     const QDictEntry *entry;
@@ -25,6 +25,11 @@
 #include "block/accounting.h"
 #include "block/block_int.h"
 
+void block_acct_init(BlockAcctStats *stats)
+{
+    qemu_mutex_init(&stats->lock);
+}
+
 void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
                       int64_t bytes, enum BlockAcctType type)
 {
@@ -35,20 +40,193 @@ void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
     cookie->type = type;
 }
 
+static void block_acct_histogram_account(BlockLatencyHistogram *hist,
+                                         uint64_t latency_ns)
+{
+    int lo = 0, hi = hist->nbins - 1;
+
+    /* find the first boundary above latency_ns */
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+
+        if (latency_ns < hist->boundaries[mid]) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    hist->bins[lo]++;
+}
+
+static void block_acct_window_account(BlockAcctTimedStats *ts,
+                                      enum BlockAcctType type,
+                                      int64_t now_ns, uint64_t latency_ns)
+{
+    int64_t epoch = now_ns / ts->interval_ns;
+    BlockAcctWindow *w = &ts->windows[epoch & 1];
+
+    if (w->epoch != epoch) {
+        /* starting a new period */
+        memset(w, 0, sizeof(*w));
+        w->epoch = epoch;
+    }
+
+    w->nr_ops[type]++;
+    w->total_ns[type] += latency_ns;
+    if (!w->min_ns[type] || latency_ns < w->min_ns[type]) {
+        w->min_ns[type] = latency_ns;
+    }
+    if (latency_ns > w->max_ns[type]) {
+        w->max_ns[type] = latency_ns;
+    }
+}
+
 void block_acct_done(BlockAcctStats *stats, BlockAcctCookie *cookie)
 {
+    BlockLatencyHistogram *hist;
+    BlockAcctIntervals *intervals;
+    int64_t now = get_clock();
+    uint64_t latency_ns = now - cookie->start_time_ns;
+    int i;
+
     assert(cookie->type < BLOCK_MAX_IOTYPE);
 
+    qemu_mutex_lock(&stats->lock);
     stats->nr_bytes[cookie->type] += cookie->bytes;
     stats->nr_ops[cookie->type]++;
-    stats->total_time_ns[cookie->type] += get_clock() - cookie->start_time_ns;
+    stats->total_time_ns[cookie->type] += latency_ns;
+    stats->last_access_time_ns = now;
+
+    hist = stats->histogram[cookie->type];
+    if (hist) {
+        block_acct_histogram_account(hist, latency_ns);
+    }
+    intervals = stats->intervals;
+    if (intervals) {
+        for (i = 0; i < intervals->n; i++) {
+            block_acct_window_account(&intervals->stats[i], cookie->type,
+                                      now, latency_ns);
+        }
+    }
+    qemu_mutex_unlock(&stats->lock);
+}
+
+void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie)
+{
+    assert(cookie->type < BLOCK_MAX_IOTYPE);
+
+    qemu_mutex_lock(&stats->lock);
+    stats->failed_ops[cookie->type]++;
+    stats->last_access_time_ns = get_clock();
+    qemu_mutex_unlock(&stats->lock);
+}
+
+void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    /* Rejected before any I/O was issued, so this does not count as an
+     * access for the idle time.
+     */
+    qemu_mutex_lock(&stats->lock);
+    stats->invalid_ops[type]++;
+    qemu_mutex_unlock(&stats->lock);
 }
 
 
 void block_acct_highest_sector(BlockAcctStats *stats, int64_t sector_num,
                                unsigned int nb_sectors)
 {
+    qemu_mutex_lock(&stats->lock);
     if (stats->wr_highest_sector < sector_num + nb_sectors - 1) {
         stats->wr_highest_sector = sector_num + nb_sectors - 1;
     }
+    qemu_mutex_unlock(&stats->lock);
+}
+
+/* Context: QEMU global mutex held.  n == 0 disables the histogram. */
+void block_acct_set_histogram(BlockAcctStats *stats, enum BlockAcctType type,
+                              const uint64_t *boundaries, int n)
+{
+    BlockLatencyHistogram *old, *hist = NULL;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    if (n) {
+        hist = g_malloc0(sizeof(*hist) + (2 * n + 1) * sizeof(uint64_t));
+        hist->nbins = n + 1;
+        hist->boundaries = hist->data;
+        hist->bins = hist->data + n;
+        memcpy(hist->boundaries, boundaries, n * sizeof(uint64_t));
+    }
+
+    qemu_mutex_lock(&stats->lock);
+    old = stats->histogram[type];
+    stats->histogram[type] = hist;
+    qemu_mutex_unlock(&stats->lock);
+    g_free(old);
+}
+
+/* Context: QEMU global mutex held.  n == 0 disables the timed stats. */
+void block_acct_set_intervals(BlockAcctStats *stats,
+                              const uint32_t *intervals_sec, int n)
+{
+    BlockAcctIntervals *old, *intervals = NULL;
+    int i;
+
+    assert(n <= BLOCK_ACCT_MAX_INTERVALS);
+
+    if (n) {
+        intervals = g_new0(BlockAcctIntervals, 1);
+        intervals->n = n;
+        for (i = 0; i < n; i++) {
+            assert(intervals_sec[i] > 0);
+            intervals->stats[i].interval_ns =
+                (int64_t)intervals_sec[i] * 1000000000LL;
+            intervals->stats[i].windows[0].epoch = -1;
+            intervals->stats[i].windows[1].epoch = -1;
+        }
+    }
+
+    qemu_mutex_lock(&stats->lock);
+    old = stats->intervals;
+    stats->intervals = intervals;
+    qemu_mutex_unlock(&stats->lock);
+    g_free(old);
+}
+
+void block_acct_cleanup(BlockAcctStats *stats)
+{
+    int i;
+
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        block_acct_set_histogram(stats, i, NULL, 0);
+    }
+    block_acct_set_intervals(stats, NULL, 0);
+    qemu_mutex_destroy(&stats->lock);
+}
+
+/* Time since the last completed or failed request, or -1 if there was
+ * none yet.  Context: stats->lock held.
+ */
+int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
+{
+    int64_t last = stats->last_access_time_ns;
+
+    return last ? get_clock() - last : -1;
+}
+
+/* Copy the last complete period of @ts to @w, or zeroes if no request
+ * completed during it.  Context: lock of the owning BlockAcctStats held.
+ */
+void block_acct_timed_stats_get(BlockAcctTimedStats *ts, BlockAcctWindow *w)
+{
+    int64_t epoch = get_clock() / ts->interval_ns - 1;
+    BlockAcctWindow *last = &ts->windows[epoch & 1];
+
+    memset(w, 0, sizeof(*w));
+    w->epoch = epoch;
+    if (last->epoch == epoch) {
+        *w = *last;
+    }
 }
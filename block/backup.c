@@ -38,6 +38,8 @@ typedef struct BackupBlockJob {
     BlockJob common;
     BlockDriverState *target;
     MirrorSyncMode sync_mode;
+    BdrvDirtyBitmap *sync_bitmap;
+    HBitmap *sync_contents;     /* frozen contents of sync_bitmap */
     RateLimit limit;
     BlockdevOnError on_source_error;
     BlockdevOnError on_target_error;
@@ -236,12 +238,77 @@ static void backup_complete(BlockJob *job, void *opaque)
     BackupBlockJob *s = container_of(job, BackupBlockJob, common);
     BackupCompleteData *data = opaque;
 
+    if (s->sync_bitmap) {
+        /* An incomplete incremental backup is useless, so the next one must
+         * copy these clusters again.
+         */
+        bdrv_dirty_bitmap_thaw(s->sync_bitmap, s->sync_contents,
+                               data->ret < 0 ||
+                               block_job_is_cancelled(job));
+    }
+
     bdrv_unref(s->target);
 
     block_job_completed(job, data->ret);
     g_free(data);
 }
 
+/* Copy the clusters that contain at least one bit of the frozen bitmap */
+static int coroutine_fn backup_run_incremental(BackupBlockJob *job)
+{
+    BlockDriverState *bs = job->common.bs;
+    int64_t end = job->common.len / BDRV_SECTOR_SIZE;
+    int64_t next = 0, sector, cluster;
+    HBitmapIter hbi;
+    bool error_is_read;
+    int ret = 0;
+
+    hbitmap_iter_init(&hbi, job->sync_contents, 0);
+    while ((sector = hbitmap_iter_next(&hbi)) >= 0) {
+        /* a bit coarser than a backup cluster covers several of them */
+        sector = MAX(sector, next);
+        if (sector >= end) {
+            break;
+        }
+        cluster = sector / BACKUP_SECTORS_PER_CLUSTER;
+
+        if (block_job_is_cancelled(&job->common)) {
+            break;
+        }
+        if (job->common.speed) {
+            uint64_t delay_ns = ratelimit_calculate_delay(
+                    &job->limit, job->sectors_read);
+            job->sectors_read = 0;
+            block_job_sleep_ns(&job->common, QEMU_CLOCK_REALTIME, delay_ns);
+        } else {
+            block_job_sleep_ns(&job->common, QEMU_CLOCK_REALTIME, 0);
+        }
+        if (block_job_is_cancelled(&job->common)) {
+            break;
+        }
+
+        ret = backup_do_cow(bs, cluster * BACKUP_SECTORS_PER_CLUSTER,
+                            BACKUP_SECTORS_PER_CLUSTER, &error_is_read);
+        if (ret < 0) {
+            /* Depending on error action, fail now or retry cluster */
+            BlockErrorAction action =
+                backup_error_action(job, error_is_read, -ret);
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                break;
+            }
+            next = cluster * BACKUP_SECTORS_PER_CLUSTER;
+        } else {
+            next = (cluster + 1) * BACKUP_SECTORS_PER_CLUSTER;
+        }
+        if (next >= end) {
+            break;
+        }
+        hbitmap_iter_init(&hbi, job->sync_contents, next);
+    }
+
+    return ret;
+}
+
 static void coroutine_fn backup_run(void *opaque)
 {
     BackupBlockJob *job = opaque;
@@ -278,6 +345,8 @@ static void coroutine_fn backup_run(void *opaque)
             qemu_coroutine_yield();
             job->common.busy = true;
         }
+    } else if (job->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
+        ret = backup_run_incremental(job);
     } else {
         /* Both FULL and TOP SYNC_MODE's require copying.. */
         for (; start < end; start++) {
@@ -368,6 +437,7 @@ static void coroutine_fn backup_run(void *opaque)
 
 void backup_start(BlockDriverState *bs, BlockDriverState *target,
                   int64_t speed, MirrorSyncMode sync_mode,
+                  BdrvDirtyBitmap *sync_bitmap,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   BlockCompletionFunc *cb, void *opaque,
@@ -403,6 +473,12 @@ void backup_start(BlockDriverState *bs, BlockDriverState *target,
     job->on_target_error = on_target_error;
     job->target = target;
     job->sync_mode = sync_mode;
+    if (sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
+        assert(sync_bitmap);
+        /* From now on the bitmap collects the changes for the next backup */
+        job->sync_bitmap = sync_bitmap;
+        job->sync_contents = bdrv_dirty_bitmap_freeze(bs, sync_bitmap);
+    }
     job->common.len = len;
     job->common.co = qemu_coroutine_create(backup_run);
     qemu_coroutine_enter(job->common.co, job);
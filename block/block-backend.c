@@ -458,6 +458,39 @@ BlockAIOCB *blk_aio_writev(BlockBackend *blk, int64_t sector_num,
     return bdrv_aio_writev(blk->bs, sector_num, iov, nb_sectors, cb, opaque);
 }
 
+int blk_add_aio_queue(BlockBackend *blk, AioContext *ctx, Error **errp)
+{
+    return bdrv_add_aio_queue(blk->bs, ctx, errp);
+}
+
+void blk_del_aio_queue(BlockBackend *blk, AioContext *ctx)
+{
+    bdrv_del_aio_queue(blk->bs, ctx);
+}
+
+bool blk_aio_mq_usable(BlockBackend *blk)
+{
+    return bdrv_aio_mq_usable(blk->bs);
+}
+
+BlockAIOCB *blk_aio_readv_mq(BlockBackend *blk, AioContext *ctx,
+                             int64_t sector_num, QEMUIOVector *iov,
+                             int nb_sectors, BlockCompletionFunc *cb,
+                             void *opaque)
+{
+    return bdrv_aio_readv_mq(blk->bs, ctx, sector_num, iov, nb_sectors,
+                             cb, opaque);
+}
+
+BlockAIOCB *blk_aio_writev_mq(BlockBackend *blk, AioContext *ctx,
+                              int64_t sector_num, QEMUIOVector *iov,
+                              int nb_sectors, BlockCompletionFunc *cb,
+                              void *opaque)
+{
+    return bdrv_aio_writev_mq(blk->bs, ctx, sector_num, iov, nb_sectors,
+                              cb, opaque);
+}
+
 BlockAIOCB *blk_aio_flush(BlockBackend *blk,
                           BlockCompletionFunc *cb, void *opaque)
 {
@@ -507,6 +540,11 @@ int blk_flush_all(void)
     return bdrv_flush_all();
 }
 
+void blk_drain(BlockBackend *blk)
+{
+    bdrv_drain(blk->bs);
+}
+
 void blk_drain_all(void)
 {
     bdrv_drain_all();
@@ -619,6 +657,16 @@ void blk_io_unplug(BlockBackend *blk)
     bdrv_io_unplug(blk->bs);
 }
 
+void blk_register_buf(BlockBackend *blk, void *host, size_t size)
+{
+    bdrv_register_buf(blk->bs, host, size);
+}
+
+void blk_unregister_buf(BlockBackend *blk, void *host)
+{
+    bdrv_unregister_buf(blk->bs, host);
+}
+
 BlockAcctStats *blk_get_stats(BlockBackend *blk)
 {
     return bdrv_get_stats(blk->bs);
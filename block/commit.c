@@ -100,7 +100,7 @@ static void coroutine_fn commit_run(void *opaque)
     CommitCompleteData *data;
     BlockDriverState *top = s->top;
     BlockDriverState *base = s->base;
-    int64_t sector_num, end;
+    int64_t sector_num, end, status;
     int ret = 0;
     int n = 0;
     void *buf = NULL;
@@ -141,11 +141,15 @@ wait:
         if (block_job_is_cancelled(&s->common)) {
             break;
         }
-        /* Copy if allocated above the base */
-        ret = bdrv_is_allocated_above(top, base, sector_num,
-                                      COMMIT_BUFFER_SIZE / BDRV_SECTOR_SIZE,
-                                      &n);
-        copy = (ret == 1);
+        /* Copy if allocated above the base, or if it reads as zeroes
+         * there; zeroes are written without reading them.
+         */
+        status = bdrv_get_block_status_above(top, base, sector_num,
+                                             COMMIT_BUFFER_SIZE /
+                                             BDRV_SECTOR_SIZE, &n);
+        ret = status < 0 ? status : 0;
+        copy = status >= 0 &&
+               (status & (BDRV_BLOCK_ALLOCATED | BDRV_BLOCK_ZERO));
         trace_commit_one_iteration(s, sector_num, n, ret);
         if (copy) {
             if (s->common.speed) {
@@ -154,8 +158,13 @@ wait:
                     goto wait;
                 }
             }
-            ret = commit_populate(top, base, sector_num, n, buf);
-            bytes_written += n * BDRV_SECTOR_SIZE;
+            if (status & BDRV_BLOCK_ZERO) {
+                ret = bdrv_write_zeroes(base, sector_num, n,
+                                        BDRV_REQ_MAY_UNMAP);
+            } else {
+                ret = commit_populate(top, base, sector_num, n, buf);
+                bytes_written += n * BDRV_SECTOR_SIZE;
+            }
         }
         if (ret < 0) {
             if (s->on_error == BLOCKDEV_ON_ERROR_STOP ||
@@ -59,10 +59,11 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
                    CURLPROTO_FTP | CURLPROTO_FTPS | \
                    CURLPROTO_TFTP)
 
-#define CURL_NUM_STATES 8
+#define CURL_NUM_STATES 16
 #define CURL_NUM_ACB    8
 #define SECTOR_SIZE     512
 #define READ_AHEAD_DEFAULT (256 * 1024)
+#define READ_AHEAD_MAX_DEFAULT (4 * 1024 * 1024)
 #define CURL_TIMEOUT_DEFAULT 5
 #define CURL_TIMEOUT_MAX 10000
 
@@ -72,6 +73,7 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
 
 #define CURL_BLOCK_OPT_URL       "url"
 #define CURL_BLOCK_OPT_READAHEAD "readahead"
+#define CURL_BLOCK_OPT_READAHEAD_MAX "readahead-max"
 #define CURL_BLOCK_OPT_SSLVERIFY "sslverify"
 #define CURL_BLOCK_OPT_TIMEOUT "timeout"
 #define CURL_BLOCK_OPT_COOKIE    "cookie"
@@ -112,6 +114,9 @@ typedef struct BDRVCURLState {
     CURLState states[CURL_NUM_STATES];
     char *url;
     size_t readahead_size;
+    size_t readahead_max;
+    size_t cur_readahead;   /* grows while the guest reads sequentially */
+    size_t next_start;      /* end of the last range requested */
     bool sslverify;
     uint64_t timeout;
     char *cookie;
@@ -493,6 +498,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_SIZE,
             .help = "Readahead size",
         },
+        {
+            .name = CURL_BLOCK_OPT_READAHEAD_MAX,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum readahead size for sequential reads",
+        },
         {
             .name = CURL_BLOCK_OPT_SSLVERIFY,
             .type = QEMU_OPT_BOOL,
@@ -545,6 +555,22 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
         goto out_noclean;
     }
 
+    s->readahead_max = qemu_opt_get_size(opts, CURL_BLOCK_OPT_READAHEAD_MAX,
+                                         MAX(READ_AHEAD_MAX_DEFAULT,
+                                             s->readahead_size));
+    if ((s->readahead_max & 0x1ff) != 0) {
+        error_setg(errp, "readahead-max %zd is not a multiple of 512",
+                   s->readahead_max);
+        goto out_noclean;
+    }
+    if (s->readahead_max < s->readahead_size) {
+        error_setg(errp, "readahead-max %zd is smaller than readahead %zd",
+                   s->readahead_max, s->readahead_size);
+        goto out_noclean;
+    }
+    s->cur_readahead = s->readahead_size;
+    s->next_start = 0;
+
     s->timeout = qemu_opt_get_number(opts, CURL_BLOCK_OPT_TIMEOUT,
                                      CURL_TIMEOUT_DEFAULT);
     if (s->timeout > CURL_TIMEOUT_MAX) {
@@ -660,11 +686,22 @@ static void curl_readv_bh_cb(void *p)
     acb->start = 0;
     acb->end = (acb->nb_sectors * SECTOR_SIZE);
 
+    /* A miss right where the previous range ended means the guest is
+     * streaming through the image (e.g. booting an ISO): fetch bigger
+     * ranges so that it takes fewer round trips.  Any other miss goes
+     * back to the configured readahead. */
+    if (start == s->next_start) {
+        s->cur_readahead = MIN(s->cur_readahead * 2, s->readahead_max);
+    } else {
+        s->cur_readahead = s->readahead_size;
+    }
+
     state->buf_off = 0;
     g_free(state->orig_buf);
     state->buf_start = start;
-    state->buf_len = acb->end + s->readahead_size;
+    state->buf_len = acb->end + s->cur_readahead;
     end = MIN(start + state->buf_len, s->len) - 1;
+    s->next_start = end + 1;
     state->orig_buf = g_try_malloc(state->buf_len);
     if (state->buf_len && state->orig_buf == NULL) {
         curl_clean_state(state);
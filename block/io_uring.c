@@ -0,0 +1,473 @@
+/*
+ * Linux io_uring support.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+
+#include <liburing.h>
+#include <linux/falloc.h>
+
+/*
+ * Submission queue size (per-device).  The kernel sizes the completion
+ * queue at twice this, and buffers further completions internally on
+ * kernels with IORING_FEAT_NODROP.
+ */
+#define MAX_ENTRIES 128
+
+/* The kernel refuses to register a fixed buffer larger than this */
+#define FIXED_BUF_MAX_SIZE (1ULL << 30)
+
+typedef struct LuringAIOCB {
+    BlockAIOCB common;
+    int fd;
+    int type;
+    off_t offset;
+    size_t nbytes;
+    QEMUIOVector *qiov;
+    int buf_index;          /* fixed buffer covering qiov, or -1 */
+    ssize_t ret;
+
+    /* a short read is resubmitted for the remaining bytes with this iovec */
+    QEMUIOVector resubmit_qiov;
+    size_t total_read;
+} LuringAIOCB;
+
+typedef struct LuringState {
+    struct io_uring ring;
+
+    /* number of SQEs prepared but not yet handed to the kernel */
+    unsigned int pending;
+    int plugged;
+
+    /* submitted requests that have not completed yet */
+    unsigned int in_flight;
+
+    QEMUBH *completion_bh;
+
+    /* fixed buffers registered with the ring */
+    struct iovec *fixed_bufs;
+    int nb_fixed_bufs;
+
+    bool has_fallocate;
+} LuringState;
+
+static const AIOCBInfo luring_aiocb_info = {
+    .aiocb_size         = sizeof(LuringAIOCB),
+};
+
+static int luring_flush_submissions(LuringState *s)
+{
+    int ret;
+
+    if (!s->pending) {
+        return 0;
+    }
+
+    do {
+        ret = io_uring_submit(&s->ring);
+    } while (ret == -EINTR);
+
+    if (ret > 0) {
+        s->pending -= MIN(ret, s->pending);
+    }
+    return ret;
+}
+
+static void luring_prep_sqe(LuringAIOCB *acb, struct io_uring_sqe *sqe)
+{
+    QEMUIOVector *qiov = acb->qiov;
+    off_t offset = acb->offset;
+
+    if (acb->total_read) {
+        qiov = &acb->resubmit_qiov;
+        offset += acb->total_read;
+    }
+
+    switch (acb->type) {
+    case QEMU_AIO_WRITE:
+        if (acb->buf_index >= 0) {
+            io_uring_prep_write_fixed(sqe, acb->fd, qiov->iov[0].iov_base,
+                                      qiov->iov[0].iov_len, offset,
+                                      acb->buf_index);
+        } else {
+            io_uring_prep_writev(sqe, acb->fd, qiov->iov, qiov->niov, offset);
+        }
+        break;
+    case QEMU_AIO_READ:
+        if (acb->buf_index >= 0 && !acb->total_read) {
+            io_uring_prep_read_fixed(sqe, acb->fd, qiov->iov[0].iov_base,
+                                     qiov->iov[0].iov_len, offset,
+                                     acb->buf_index);
+        } else {
+            io_uring_prep_readv(sqe, acb->fd, qiov->iov, qiov->niov, offset);
+        }
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqe, acb->fd, IORING_FSYNC_DATASYNC);
+        break;
+    case QEMU_AIO_DISCARD:
+        io_uring_prep_fallocate(sqe, acb->fd,
+                                FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                offset, acb->nbytes);
+        break;
+    default:
+        abort();
+    }
+    io_uring_sqe_set_data(sqe, acb);
+}
+
+/* Queue @acb on the submission ring.  It is handed to the kernel right away
+ * unless the queue is plugged, in which case luring_io_unplug() submits the
+ * whole batch with a single io_uring_enter().
+ */
+static int luring_enqueue(LuringState *s, LuringAIOCB *acb)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+    int ret;
+
+    if (!sqe) {
+        /* the ring is full of plugged requests, make room */
+        ret = luring_flush_submissions(s);
+        if (ret < 0) {
+            return ret;
+        }
+        sqe = io_uring_get_sqe(&s->ring);
+        if (!sqe) {
+            return -EAGAIN;
+        }
+    }
+
+    luring_prep_sqe(acb, sqe);
+    s->pending++;
+    s->in_flight++;
+
+    /* If the kernel refuses the batch (e.g. -EBUSY while the completion
+     * queue overflows), the entries stay in the ring and go out with the
+     * next submission.
+     */
+    if (!s->plugged) {
+        luring_flush_submissions(s);
+    }
+    return 0;
+}
+
+/* Returns true if the read was resubmitted for its remaining bytes */
+static bool luring_resubmit_short_read(LuringState *s, LuringAIOCB *acb,
+                                       int nread)
+{
+    size_t remaining;
+
+    acb->total_read += nread;
+    remaining = acb->nbytes - acb->total_read;
+
+    if (!acb->resubmit_qiov.iov) {
+        qemu_iovec_init(&acb->resubmit_qiov, acb->qiov->niov);
+    } else {
+        qemu_iovec_reset(&acb->resubmit_qiov);
+    }
+    qemu_iovec_concat(&acb->resubmit_qiov, acb->qiov, acb->total_read,
+                      remaining);
+
+    return luring_enqueue(s, acb) == 0;
+}
+
+/*
+ * Completes an AIO request (calls the callback and frees the ACB).
+ */
+static void luring_process_completion(LuringState *s, LuringAIOCB *acb,
+                                      int ret)
+{
+    s->in_flight--;
+
+    switch (acb->type) {
+    case QEMU_AIO_READ:
+        if (ret >= 0 && acb->total_read + ret < acb->nbytes) {
+            if (ret > 0) {
+                /* buffered reads may stop short of the request */
+                if (luring_resubmit_short_read(s, acb, ret)) {
+                    return;
+                }
+                ret = -EIO;
+                break;
+            }
+            /* Short reads mean EOF, pad with zeros. */
+            qemu_iovec_memset(acb->qiov, acb->total_read, 0,
+                              acb->nbytes - acb->total_read);
+        }
+        if (ret >= 0) {
+            ret = 0;
+        }
+        break;
+    case QEMU_AIO_WRITE:
+        if (ret >= 0) {
+            ret = ret == acb->nbytes ? 0 : -EINVAL;
+        }
+        break;
+    case QEMU_AIO_DISCARD:
+        if (ret == -ENODEV || ret == -ENOSYS || ret == -EOPNOTSUPP ||
+            ret == -ENOTTY) {
+            ret = -ENOTSUP;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (acb->resubmit_qiov.iov) {
+        qemu_iovec_destroy(&acb->resubmit_qiov);
+    }
+    acb->ret = ret;
+    acb->common.cb(acb->common.opaque, ret);
+    qemu_aio_unref(acb);
+}
+
+/* Reap the completion queue.  Returns true if anything completed.
+ *
+ * Request callbacks may run a nested event loop; the BH is kept scheduled
+ * while completions are processed so that the nested loop picks up the
+ * remaining entries instead of leaving them until we return.
+ */
+static bool luring_process_completions(LuringState *s)
+{
+    struct io_uring_cqe *cqe;
+    bool progress = false;
+
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0) {
+        LuringAIOCB *acb = io_uring_cqe_get_data(cqe);
+        int ret = cqe->res;
+
+        io_uring_cqe_seen(&s->ring, cqe);
+        luring_process_completion(s, acb, ret);
+        progress = true;
+    }
+
+    qemu_bh_cancel(s->completion_bh);
+
+    /* Retry entries the kernel refused earlier, now that there is room */
+    if (!s->plugged) {
+        luring_flush_submissions(s);
+    }
+    return progress;
+}
+
+static void luring_completion_bh(void *opaque)
+{
+    luring_process_completions(opaque);
+}
+
+static void luring_completion_cb(void *opaque)
+{
+    luring_process_completions(opaque);
+}
+
+/* Polling callback: the completion queue lives in shared memory, so it can
+ * be reaped without a system call while requests are in flight.
+ */
+static bool luring_poll_cb(void *opaque)
+{
+    LuringState *s = opaque;
+
+    if (!s->in_flight) {
+        return false;
+    }
+    return luring_process_completions(s);
+}
+
+void luring_io_plug(BlockDriverState *bs, void *aio_ctx)
+{
+    LuringState *s = aio_ctx;
+
+    s->plugged++;
+}
+
+int luring_io_unplug(BlockDriverState *bs, void *aio_ctx, bool unplug)
+{
+    LuringState *s = aio_ctx;
+
+    assert(s->plugged > 0 || !unplug);
+
+    if (unplug && --s->plugged > 0) {
+        return 0;
+    }
+    return luring_flush_submissions(s);
+}
+
+static int luring_find_fixed_buf(LuringState *s, QEMUIOVector *qiov)
+{
+    uintptr_t base, end;
+    int i;
+
+    if (qiov->niov != 1) {
+        return -1;
+    }
+
+    base = (uintptr_t)qiov->iov[0].iov_base;
+    end = base + qiov->iov[0].iov_len;
+    for (i = 0; i < s->nb_fixed_bufs; i++) {
+        uintptr_t buf = (uintptr_t)s->fixed_bufs[i].iov_base;
+
+        if (base >= buf && end <= buf + s->fixed_bufs[i].iov_len) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool luring_can_discard(void *aio_ctx)
+{
+    LuringState *s = aio_ctx;
+
+    return s->has_fallocate;
+}
+
+BlockAIOCB *luring_submit(BlockDriverState *bs, void *aio_ctx, int fd,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockCompletionFunc *cb, void *opaque, int type)
+{
+    LuringState *s = aio_ctx;
+    LuringAIOCB *acb;
+
+    acb = qemu_aio_get(&luring_aiocb_info, bs, cb, opaque);
+    acb->fd = fd;
+    acb->type = type & QEMU_AIO_TYPE_MASK;
+    acb->offset = sector_num * BDRV_SECTOR_SIZE;
+    acb->nbytes = (size_t)nb_sectors * BDRV_SECTOR_SIZE;
+    acb->qiov = qiov;
+    acb->buf_index = -1;
+    acb->ret = -EINPROGRESS;
+    acb->total_read = 0;
+    memset(&acb->resubmit_qiov, 0, sizeof(acb->resubmit_qiov));
+
+    switch (acb->type) {
+    case QEMU_AIO_READ:
+    case QEMU_AIO_WRITE:
+        assert(qiov->size == acb->nbytes);
+        acb->buf_index = luring_find_fixed_buf(s, qiov);
+        break;
+    case QEMU_AIO_FLUSH:
+        break;
+    case QEMU_AIO_DISCARD:
+        assert(s->has_fallocate);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        goto out_free_aiocb;
+    }
+
+    if (luring_enqueue(s, acb) < 0) {
+        goto out_free_aiocb;
+    }
+    return &acb->common;
+
+out_free_aiocb:
+    qemu_aio_unref(acb);
+    return NULL;
+}
+
+/* Replace the fixed buffer table with @bufs.  Regions larger than the
+ * kernel accepts are split into several buffers.  Registration is only an
+ * optimization: if it fails, requests keep using the plain vectored ops.
+ */
+int luring_register_bufs(void *aio_ctx, const struct iovec *bufs, int nb_bufs)
+{
+    LuringState *s = aio_ctx;
+    struct iovec *table = NULL;
+    int i, n = 0, ret;
+
+    if (s->nb_fixed_bufs) {
+        io_uring_unregister_buffers(&s->ring);
+        g_free(s->fixed_bufs);
+        s->fixed_bufs = NULL;
+        s->nb_fixed_bufs = 0;
+    }
+
+    for (i = 0; i < nb_bufs; i++) {
+        uint8_t *base = bufs[i].iov_base;
+        size_t len = bufs[i].iov_len;
+
+        while (len) {
+            size_t chunk = MIN(len, FIXED_BUF_MAX_SIZE);
+
+            table = g_renew(struct iovec, table, n + 1);
+            table[n].iov_base = base;
+            table[n].iov_len = chunk;
+            n++;
+            base += chunk;
+            len -= chunk;
+        }
+    }
+
+    if (!n) {
+        return 0;
+    }
+
+    ret = io_uring_register_buffers(&s->ring, table, n);
+    if (ret < 0) {
+        g_free(table);
+        return ret;
+    }
+
+    s->fixed_bufs = table;
+    s->nb_fixed_bufs = n;
+    return 0;
+}
+
+void luring_detach_aio_context(void *s_, AioContext *old_context)
+{
+    LuringState *s = s_;
+
+    aio_set_fd_handler(old_context, s->ring.ring_fd, NULL, NULL, NULL);
+    qemu_bh_delete(s->completion_bh);
+}
+
+void luring_attach_aio_context(void *s_, AioContext *new_context)
+{
+    LuringState *s = s_;
+
+    s->completion_bh = aio_bh_new(new_context, luring_completion_bh, s);
+    aio_set_fd_handler(new_context, s->ring.ring_fd,
+                       luring_completion_cb, NULL, s);
+    aio_set_fd_poll(new_context, s->ring.ring_fd, luring_poll_cb);
+}
+
+void *luring_init(void)
+{
+    LuringState *s;
+    struct io_uring_probe *probe;
+    int ret;
+
+    s = g_malloc0(sizeof(*s));
+    ret = io_uring_queue_init(MAX_ENTRIES, &s->ring, 0);
+    if (ret < 0) {
+        g_free(s);
+        errno = -ret;
+        return NULL;
+    }
+
+    probe = io_uring_get_probe_ring(&s->ring);
+    if (probe) {
+        s->has_fallocate = io_uring_opcode_supported(probe,
+                                                     IORING_OP_FALLOCATE);
+        io_uring_free_probe(probe);
+    }
+
+    return s;
+}
+
+void luring_cleanup(void *s_)
+{
+    LuringState *s = s_;
+
+    io_uring_queue_exit(&s->ring);
+    g_free(s->fixed_bufs);
+    g_free(s);
+}
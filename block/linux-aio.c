@@ -12,6 +12,7 @@
 #include "qemu/queue.h"
 #include "block/raw-aio.h"
 #include "qemu/event_notifier.h"
+#include "qemu/atomic.h"
 
 #include <libaio.h>
 
@@ -27,6 +28,27 @@
 
 #define MAX_QUEUED_IO  128
 
+/* The io_context_t returned by io_setup() points to the completion ring,
+ * which the kernel maps into our address space.  Its layout is ABI, see
+ * struct aio_ring in Linux's fs/aio.c.
+ */
+#define AIO_RING_MAGIC                  0xa10a10a1
+#define AIO_RING_INCOMPAT_FEATURES      0
+
+struct aio_ring {
+    unsigned id;     /* kernel internal index number */
+    unsigned nr;     /* number of io_events */
+    unsigned head;   /* written to by userland or by the kernel */
+    unsigned tail;
+
+    unsigned magic;
+    unsigned compat_features;
+    unsigned incompat_features;
+    unsigned header_length;  /* size of aio_ring */
+
+    struct io_event io_events[0];
+};
+
 struct qemu_laiocb {
     BlockAIOCB common;
     struct qemu_laio_state *ctx;
@@ -57,6 +79,12 @@ struct qemu_laio_state {
     struct io_event events[MAX_EVENTS];
     int event_idx;
     int event_max;
+
+    /* completion ring, or NULL if it has to be read with io_getevents() */
+    struct aio_ring *ring;
+
+    /* submitted requests that have not completed yet */
+    unsigned int in_flight;
 };
 
 static inline ssize_t io_event_ret(struct io_event *ev)
@@ -86,11 +114,55 @@ static void qemu_laio_process_completion(struct qemu_laio_state *s,
             }
         }
     }
+    s->in_flight--;
     laiocb->common.cb(laiocb->common.opaque, ret);
 
     qemu_aio_unref(laiocb);
 }
 
+/* Copy up to @max completions from the ring and hand the slots back to
+ * the kernel.  No system call is needed.
+ */
+static int qemu_laio_read_ring(struct aio_ring *ring, struct io_event *events,
+                               int max)
+{
+    unsigned int head = atomic_read(&ring->head);
+    unsigned int tail = atomic_read(&ring->tail);
+    int n = 0;
+
+    /* Read tail before the events it covers, pairs with the write
+     * barrier in the kernel's aio_complete().
+     */
+    smp_rmb();
+
+    while (head != tail && n < max) {
+        events[n++] = ring->io_events[head];
+        if (++head == ring->nr) {
+            head = 0;
+        }
+    }
+
+    /* Finish reading the events before the kernel may reuse the slots */
+    smp_mb();
+    atomic_set(&ring->head, head);
+    return n;
+}
+
+static int qemu_laio_get_events(struct qemu_laio_state *s)
+{
+    int ret;
+
+    if (s->ring) {
+        return qemu_laio_read_ring(s->ring, s->events, MAX_EVENTS);
+    }
+
+    do {
+        struct timespec ts = { 0 };
+        ret = io_getevents(s->ctx, MAX_EVENTS, MAX_EVENTS, s->events, &ts);
+    } while (ret == -EINTR);
+    return ret;
+}
+
 /* The completion BH fetches completed I/O requests and invokes their
  * callbacks.
  *
@@ -108,12 +180,7 @@ static void qemu_laio_completion_bh(void *opaque)
 
     /* Fetch more completion events when empty */
     if (s->event_idx == s->event_max) {
-        do {
-            struct timespec ts = { 0 };
-            s->event_max = io_getevents(s->ctx, MAX_EVENTS, MAX_EVENTS,
-                                        s->events, &ts);
-        } while (s->event_max == -EINTR);
-
+        s->event_max = qemu_laio_get_events(s);
         s->event_idx = 0;
         if (s->event_max <= 0) {
             s->event_max = 0;
@@ -146,6 +213,22 @@ static void qemu_laio_completion_cb(EventNotifier *e)
     }
 }
 
+/* Polling callback: reap completions directly while requests are in
+ * flight, so that they are processed without an eventfd wakeup.
+ */
+static bool qemu_laio_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
+
+    if (!s->in_flight || s->event_idx != s->event_max) {
+        return false;
+    }
+
+    qemu_laio_completion_bh(s);
+    return s->event_max > 0;
+}
+
 static void laio_cancel(BlockAIOCB *blockacb)
 {
     struct qemu_laiocb *laiocb = (struct qemu_laiocb *)blockacb;
@@ -162,6 +245,7 @@ static void laio_cancel(BlockAIOCB *blockacb)
         return;
     }
 
+    laiocb->ctx->in_flight--;
     laiocb->common.cb(laiocb->common.opaque, laiocb->ret);
 }
 
@@ -280,7 +364,9 @@ BlockAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
         if (io_submit(s->ctx, 1, &iocbs) < 0) {
             goto out_free_aiocb;
         }
+        s->in_flight++;
     } else {
+        s->in_flight++;
         ioq_enqueue(s, iocbs);
     }
     return &laiocb->common;
@@ -304,6 +390,7 @@ void laio_attach_aio_context(void *s_, AioContext *new_context)
 
     s->completion_bh = aio_bh_new(new_context, qemu_laio_completion_bh, s);
     aio_set_event_notifier(new_context, &s->e, qemu_laio_completion_cb);
+    aio_set_event_notifier_poll(new_context, &s->e, qemu_laio_poll_cb);
 }
 
 void *laio_init(void)
@@ -319,6 +406,14 @@ void *laio_init(void)
         goto out_close_efd;
     }
 
+    /* Reap completions from userspace if we understand the ring format */
+    s->ring = (struct aio_ring *)s->ctx;
+    if (s->ring->magic != AIO_RING_MAGIC ||
+        s->ring->incompat_features != AIO_RING_INCOMPAT_FEATURES ||
+        s->ring->nr == 0) {
+        s->ring = NULL;
+    }
+
     ioq_init(&s->io_q);
 
     return s;
@@ -18,7 +18,8 @@
 #include "qemu/bitmap.h"
 
 #define SLICE_TIME    100000000ULL /* ns */
-#define MAX_IN_FLIGHT 16
+#define MIN_IN_FLIGHT 16
+#define MAX_IN_FLIGHT 64
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -39,6 +40,7 @@ typedef struct MirrorBlockJob {
     /* Used to block operations on the drive-mirror-replace target */
     Error *replace_blocker;
     bool is_none_mode;
+    MirrorCopyMode copy_mode;
     BlockdevOnError on_source_error, on_target_error;
     bool synced;
     bool should_complete;
@@ -55,8 +57,16 @@ typedef struct MirrorBlockJob {
 
     unsigned long *in_flight_bitmap;
     int in_flight;
+    int max_in_flight;
+    int64_t last_dirty_count;
     int sectors_in_flight;
     int ret;
+
+    /* Guest writes being copied to the target in write-blocking mode */
+    NotifierWithReturn after_write;
+    int active_in_flight;
+    /* The coroutine is yielded in mirror_wait_for_io */
+    bool waiting_for_io;
 } MirrorBlockJob;
 
 typedef struct MirrorOp {
@@ -111,15 +121,24 @@ static void mirror_iteration_done(MirrorOp *op, int ret)
     qemu_iovec_destroy(&op->qiov);
     g_slice_free(MirrorOp, op);
 
-    /* Enter coroutine when it is not sleeping.  The coroutine sleeps to
+    /* Enter coroutine when it is waiting for I/O.  The coroutine sleeps to
      * rate-limit itself.  The coroutine will eventually resume since there is
-     * a sleep timeout so don't wake it early.
+     * a sleep timeout so don't wake it early.  It may also be waiting inside
+     * the block layer, which must not be disturbed either.
      */
-    if (s->common.busy) {
+    if (s->waiting_for_io) {
         qemu_coroutine_enter(s->common.co, NULL);
     }
 }
 
+static void coroutine_fn mirror_wait_for_io(MirrorBlockJob *s)
+{
+    assert(!s->waiting_for_io);
+    s->waiting_for_io = true;
+    qemu_coroutine_yield();
+    s->waiting_for_io = false;
+}
+
 static void mirror_write_complete(void *opaque, int ret)
 {
     MirrorOp *op = opaque;
@@ -163,8 +182,10 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     BlockDriverState *source = s->common.bs;
     int nb_sectors, sectors_per_chunk, nb_chunks;
     int64_t end, sector_num, next_chunk, next_sector, hbitmap_next_sector;
+    int64_t status;
     uint64_t delay_ns = 0;
     MirrorOp *op;
+    int pnum;
 
     s->sector_num = hbitmap_iter_next(&s->hbi);
     if (s->sector_num < 0) {
@@ -201,15 +222,17 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* Wait for I/O to this cluster (from a previous iteration) to be done.  */
     while (test_bit(next_chunk, s->in_flight_bitmap)) {
         trace_mirror_yield_in_flight(s, sector_num, s->in_flight);
-        qemu_coroutine_yield();
+        mirror_wait_for_io(s);
     }
 
     do {
         int added_sectors, added_chunks;
 
+        /* A guest write may have copied the first chunk to the target
+         * while we waited, in which case there is nothing to do.
+         */
         if (!bdrv_get_dirty(source, s->dirty_bitmap, next_sector) ||
             test_bit(next_chunk, s->in_flight_bitmap)) {
-            assert(nb_sectors > 0);
             break;
         }
 
@@ -233,16 +256,22 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
         added_chunks = (added_sectors + sectors_per_chunk - 1) / sectors_per_chunk;
 
         /* When doing COW, it may happen that there is not enough space for
-         * a full cluster.  Wait if that is the case.
+         * a full cluster.  Wait if that is the case, then look at the chunk
+         * again.
          */
-        while (nb_chunks == 0 && s->buf_free_count < added_chunks) {
+        if (nb_chunks == 0 && s->buf_free_count < added_chunks) {
             trace_mirror_yield_buf_busy(s, nb_chunks, s->in_flight);
-            qemu_coroutine_yield();
+            mirror_wait_for_io(s);
+            continue;
         }
         if (s->buf_free_count < nb_chunks + added_chunks) {
             trace_mirror_break_buf_busy(s, nb_chunks, s->in_flight);
             break;
         }
+        if (find_next_bit(s->in_flight_bitmap, next_chunk + added_chunks,
+                          next_chunk) < next_chunk + added_chunks) {
+            break;
+        }
 
         /* We have enough free space to copy these sectors.  */
         bitmap_set(s->in_flight_bitmap, next_chunk, added_chunks);
@@ -256,6 +285,10 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
         }
     } while (delay_ns == 0 && next_sector < end);
 
+    if (nb_sectors == 0) {
+        return delay_ns;
+    }
+
     /* Allocate a MirrorOp that is used as an AIO callback.  */
     op = g_slice_new(MirrorOp);
     op->s = s;
@@ -286,11 +319,25 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
         next_sector += sectors_per_chunk;
     }
 
-    bdrv_reset_dirty(source, sector_num, nb_sectors);
+    bdrv_reset_dirty_bitmap(source, s->dirty_bitmap, sector_num, nb_sectors);
 
     /* Copy the dirty cluster.  */
     s->in_flight++;
     s->sectors_in_flight += nb_sectors;
+
+    /* Zeroes need not be read and written out; the buffers are unused then.
+     * The dirty bits are already clear, so a guest write that races with
+     * the lookup is copied again later.
+     */
+    status = bdrv_get_block_status_above(source, s->base, sector_num,
+                                         nb_sectors, &pnum);
+    if (status >= 0 && (status & BDRV_BLOCK_ZERO) && pnum >= nb_sectors) {
+        trace_mirror_write_zeroes(s, sector_num, nb_sectors);
+        bdrv_aio_write_zeroes(s->target, sector_num, nb_sectors,
+                              BDRV_REQ_MAY_UNMAP, mirror_write_complete, op);
+        return delay_ns;
+    }
+
     trace_mirror_one_iteration(s, sector_num, nb_sectors);
     bdrv_aio_readv(source, sector_num, &op->qiov, nb_sectors,
                    mirror_read_complete, op);
@@ -316,11 +363,97 @@ static void mirror_free_init(MirrorBlockJob *s)
 
 static void mirror_drain(MirrorBlockJob *s)
 {
-    while (s->in_flight > 0) {
-        qemu_coroutine_yield();
+    while (s->in_flight > 0 || s->active_in_flight > 0) {
+        mirror_wait_for_io(s);
     }
 }
 
+/* In write-blocking mode, once the job is ready, guest writes that cover
+ * whole chunks are copied to the target before they complete.  The target
+ * then keeps up with the guest however fast it writes, instead of relying
+ * on mirror_iteration to catch up with the dirty bitmap.  Partially written
+ * chunks, and chunks that mirror_iteration is copying, stay dirty.
+ */
+static int coroutine_fn mirror_after_write_notify(NotifierWithReturn *notifier,
+                                                  void *opaque)
+{
+    MirrorBlockJob *s = container_of(notifier, MirrorBlockJob, after_write);
+    BdrvTrackedRequest *req = opaque;
+    BlockDriverState *source = s->common.bs;
+    int64_t sectors_per_chunk = s->granularity >> BDRV_SECTOR_BITS;
+    int64_t end = s->bdev_length / BDRV_SECTOR_SIZE;
+    int64_t sector_num, nb_sectors, first_chunk, end_chunk;
+    int64_t clean_start, clean_end;
+    int ret;
+
+    if (!s->synced || ((req->offset | req->bytes) & (BDRV_SECTOR_SIZE - 1)) ||
+        (req->qiov && req->qiov->size != req->bytes)) {
+        return 0;
+    }
+
+    sector_num = req->offset >> BDRV_SECTOR_BITS;
+    nb_sectors = req->bytes >> BDRV_SECTOR_BITS;
+    first_chunk = DIV_ROUND_UP(sector_num, sectors_per_chunk);
+    if (sector_num + nb_sectors >= end) {
+        end_chunk = DIV_ROUND_UP(end, sectors_per_chunk);
+    } else {
+        end_chunk = (sector_num + nb_sectors) / sectors_per_chunk;
+    }
+    if (first_chunk >= end_chunk ||
+        find_next_bit(s->in_flight_bitmap, end_chunk,
+                      first_chunk) < end_chunk) {
+        return 0;
+    }
+
+    /* The source already has the new data, so the chunks can be marked
+     * clean now.  Writes that hit them before the copy is done find them
+     * in flight and leave them dirty.
+     */
+    clean_start = first_chunk * sectors_per_chunk;
+    clean_end = MIN(end_chunk * sectors_per_chunk, end);
+    bitmap_set(s->in_flight_bitmap, first_chunk, end_chunk - first_chunk);
+    bdrv_reset_dirty_bitmap(source, s->dirty_bitmap, clean_start,
+                            clean_end - clean_start);
+    s->active_in_flight++;
+
+    trace_mirror_active_write(s, sector_num, nb_sectors);
+    if (req->qiov) {
+        ret = bdrv_co_writev(s->target, sector_num, nb_sectors, req->qiov);
+    } else {
+        ret = bdrv_co_write_zeroes(s->target, sector_num, nb_sectors, 0);
+    }
+    if (ret < 0) {
+        bdrv_set_dirty(source, clean_start, clean_end - clean_start);
+        if (mirror_error_action(s, false, -ret) == BLOCK_ERROR_ACTION_REPORT &&
+            s->ret >= 0) {
+            s->ret = ret;
+        }
+    }
+
+    bitmap_clear(s->in_flight_bitmap, first_chunk, end_chunk - first_chunk);
+    s->active_in_flight--;
+    if (s->waiting_for_io) {
+        qemu_coroutine_enter(s->common.co, NULL);
+    }
+
+    /* The guest write itself succeeded */
+    return 0;
+}
+
+/* Let more requests run in parallel while the dirty count does not go
+ * down, so that a target that could take more I/O is not outrun by a busy
+ * guest; go back to the minimum when the target reports errors.
+ */
+static void mirror_adjust_in_flight(MirrorBlockJob *s, int64_t cnt)
+{
+    if (s->common.iostatus != BLOCK_DEVICE_IO_STATUS_OK) {
+        s->max_in_flight = MIN_IN_FLIGHT;
+    } else if (cnt > 0 && cnt >= s->last_dirty_count) {
+        s->max_in_flight = MIN(s->max_in_flight * 2, MAX_IN_FLIGHT);
+    }
+    s->last_dirty_count = cnt;
+}
+
 typedef struct {
     int ret;
 } MirrorExitData;
@@ -428,6 +561,11 @@ static void coroutine_fn mirror_run(void *opaque)
     sectors_per_chunk = s->granularity >> BDRV_SECTOR_BITS;
     mirror_free_init(s);
 
+    if (s->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING) {
+        s->after_write.notify = mirror_after_write_notify;
+        bdrv_add_after_write_notifier(bs, &s->after_write);
+    }
+
     if (!s->is_none_mode) {
         /* First part, loop on the sectors and initialize the dirty bitmap.  */
         BlockDriverState *base = s->base;
@@ -477,10 +615,10 @@ static void coroutine_fn mirror_run(void *opaque)
          */
         if (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - last_pause_ns < SLICE_TIME &&
             s->common.iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight == MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, s->in_flight, s->buf_free_count, cnt);
-                qemu_coroutine_yield();
+                mirror_wait_for_io(s);
                 continue;
             } else if (cnt != 0) {
                 delay_ns = mirror_iteration(s);
@@ -548,18 +686,22 @@ static void coroutine_fn mirror_run(void *opaque)
             s->common.cancelled = false;
             break;
         }
+        mirror_adjust_in_flight(s, cnt);
         last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     }
 
 immediate_exit:
+    if (s->after_write.notify) {
+        notifier_with_return_remove(&s->after_write);
+    }
     if (s->in_flight > 0) {
         /* We get here only if something went wrong.  Either the job failed,
          * or it was cancelled prematurely so that we do not guarantee that
          * the target is a copy of the source.
          */
         assert(ret < 0 || (!s->synced && block_job_is_cancelled(&s->common)));
-        mirror_drain(s);
     }
+    mirror_drain(s);
 
     assert(s->in_flight == 0);
     qemu_vfree(s->buf);
@@ -654,6 +796,7 @@ static void mirror_start_job(BlockDriverState *bs, BlockDriverState *target,
                              const char *replaces,
                              int64_t speed, int64_t granularity,
                              int64_t buf_size,
+                             MirrorCopyMode copy_mode,
                              BlockdevOnError on_source_error,
                              BlockdevOnError on_target_error,
                              BlockCompletionFunc *cb,
@@ -695,11 +838,13 @@ static void mirror_start_job(BlockDriverState *bs, BlockDriverState *target,
     s->on_target_error = on_target_error;
     s->target = target;
     s->is_none_mode = is_none_mode;
+    s->copy_mode = copy_mode;
+    s->max_in_flight = MIN_IN_FLIGHT;
     s->base = base;
     s->granularity = granularity;
     s->buf_size = MAX(buf_size, granularity);
 
-    s->dirty_bitmap = bdrv_create_dirty_bitmap(bs, granularity, errp);
+    s->dirty_bitmap = bdrv_create_dirty_bitmap(bs, granularity, NULL, errp);
     if (!s->dirty_bitmap) {
         return;
     }
@@ -714,7 +859,8 @@ static void mirror_start_job(BlockDriverState *bs, BlockDriverState *target,
 void mirror_start(BlockDriverState *bs, BlockDriverState *target,
                   const char *replaces,
                   int64_t speed, int64_t granularity, int64_t buf_size,
-                  MirrorSyncMode mode, BlockdevOnError on_source_error,
+                  MirrorSyncMode mode, MirrorCopyMode copy_mode,
+                  BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   BlockCompletionFunc *cb,
                   void *opaque, Error **errp)
@@ -725,7 +871,7 @@ void mirror_start(BlockDriverState *bs, BlockDriverState *target,
     is_none_mode = mode == MIRROR_SYNC_MODE_NONE;
     base = mode == MIRROR_SYNC_MODE_TOP ? bs->backing_hd : NULL;
     mirror_start_job(bs, target, replaces,
-                     speed, granularity, buf_size,
+                     speed, granularity, buf_size, copy_mode,
                      on_source_error, on_target_error, cb, opaque, errp,
                      &mirror_job_driver, is_none_mode, base);
 }
@@ -774,6 +920,7 @@ void commit_active_start(BlockDriverState *bs, BlockDriverState *base,
 
     bdrv_ref(base);
     mirror_start_job(bs, base, NULL, speed, 0, 0,
+                     MIRROR_COPY_MODE_BACKGROUND,
                      on_error, on_error, cb, opaque, &local_err,
                      &commit_active_job_driver, false, base);
     if (local_err) {
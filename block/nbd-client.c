@@ -28,17 +28,21 @@
 
 #include "nbd-client.h"
 #include "qemu/sockets.h"
+#include "qemu/error-report.h"
 
 #define HANDLE_TO_INDEX(bs, handle) ((handle) ^ ((uint64_t)(intptr_t)bs))
 #define INDEX_TO_HANDLE(bs, index)  ((index)  ^ ((uint64_t)(intptr_t)bs))
 
+/* Interval between two reconnection attempts */
+#define NBD_RECONNECT_INTERVAL_MS 1000
+
 static void nbd_recv_coroutines_enter_all(NbdClientSession *s)
 {
     int i;
 
-    for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        if (s->recv_coroutine[i]) {
-            qemu_coroutine_enter(s->recv_coroutine[i], NULL);
+    for (i = 0; i < s->max_requests; i++) {
+        if (s->requests[i].receiving) {
+            qemu_coroutine_enter(s->requests[i].coroutine, NULL);
         }
     }
 }
@@ -47,6 +51,10 @@ static void nbd_teardown_connection(NbdClientSession *client)
 {
     /* finish any pending coroutines */
     shutdown(client->sock, 2);
+    client->connection_gen++;
+    if (client->send_coroutine) {
+        qemu_coroutine_enter(client->send_coroutine, NULL);
+    }
     nbd_recv_coroutines_enter_all(client);
 
     nbd_client_session_detach_aio_context(client);
@@ -54,6 +62,86 @@ static void nbd_teardown_connection(NbdClientSession *client)
     client->sock = -1;
 }
 
+static void nbd_reconnect_attempt(void *opaque)
+{
+    NbdClientSession *s = opaque;
+    Error *local_err = NULL;
+    uint32_t nbdflags;
+    off_t size;
+    size_t blocksize;
+    int sock, ret;
+
+    sock = s->connect(s->bs, &local_err);
+    if (sock >= 0) {
+        qemu_set_block(sock);
+        ret = nbd_receive_negotiate(sock, s->export_name, &nbdflags, &size,
+                                    &blocksize);
+        if (ret < 0 || size != s->size) {
+            closesocket(sock);
+            sock = -1;
+        }
+    } else {
+        error_free(local_err);
+    }
+
+    if (sock < 0) {
+        if (qemu_clock_get_ms(QEMU_CLOCK_REALTIME) < s->reconnect_deadline) {
+            timer_mod(s->reconnect_timer,
+                      qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                      NBD_RECONNECT_INTERVAL_MS);
+            return;
+        }
+        error_report("NBD server for '%s' did not come back, giving up",
+                     bdrv_get_device_name(s->bs));
+    }
+
+    timer_free(s->reconnect_timer);
+    s->reconnect_timer = NULL;
+    s->reconnecting = false;
+
+    if (sock >= 0) {
+        logout("Reconnected to NBD server\n");
+        qemu_set_nonblock(sock);
+        s->sock = sock;
+        s->nbdflags = nbdflags;
+        s->reply.handle = 0;
+        nbd_client_session_attach_aio_context(s, bdrv_get_aio_context(s->bs));
+    }
+
+    /* Requests that were waiting are sent again, or fail if sock is -1 */
+    while (qemu_co_enter_next(&s->reconnect_waiters)) {
+        /* nothing */
+    }
+}
+
+static void nbd_reconnect_timer_init(NbdClientSession *s,
+                                     AioContext *aio_context)
+{
+    s->reconnect_timer = aio_timer_new(aio_context, QEMU_CLOCK_REALTIME,
+                                       SCALE_MS, nbd_reconnect_attempt, s);
+    timer_mod(s->reconnect_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+}
+
+static void nbd_connection_lost(NbdClientSession *s)
+{
+    if (!s->reconnect_delay) {
+        nbd_teardown_connection(s);
+        return;
+    }
+
+    error_report("Lost connection to NBD server for '%s', reconnecting",
+                 bdrv_get_device_name(s->bs));
+
+    /* Set this first, so that the coroutines woken up by the teardown
+     * wait for the new connection instead of failing.
+     */
+    s->reconnecting = true;
+    s->reconnect_deadline = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                            s->reconnect_delay * 1000;
+    nbd_teardown_connection(s);
+    nbd_reconnect_timer_init(s, bdrv_get_aio_context(s->bs));
+}
+
 static void nbd_reply_ready(void *opaque)
 {
     NbdClientSession *s = opaque;
@@ -79,17 +167,17 @@ static void nbd_reply_ready(void *opaque)
      * handler acts as a synchronization point and ensures that only
      * one coroutine is called until the reply finishes.  */
     i = HANDLE_TO_INDEX(s, s->reply.handle);
-    if (i >= MAX_NBD_REQUESTS) {
+    if (i >= s->max_requests) {
         goto fail;
     }
 
-    if (s->recv_coroutine[i]) {
-        qemu_coroutine_enter(s->recv_coroutine[i], NULL);
+    if (s->requests[i].receiving) {
+        qemu_coroutine_enter(s->requests[i].coroutine, NULL);
         return;
     }
 
 fail:
-    nbd_teardown_connection(s);
+    nbd_connection_lost(s);
 }
 
 static void nbd_restart_write(void *opaque)
@@ -104,9 +192,16 @@ static int nbd_co_send_request(NbdClientSession *s,
     QEMUIOVector *qiov, int offset)
 {
     AioContext *aio_context;
+    unsigned gen;
     int rc, ret;
 
     qemu_co_mutex_lock(&s->send_mutex);
+    if (s->sock == -1) {
+        /* The connection was lost while we waited for the mutex */
+        qemu_co_mutex_unlock(&s->send_mutex);
+        return -EIO;
+    }
+    gen = s->connection_gen;
     s->send_coroutine = qemu_coroutine_self();
     aio_context = bdrv_get_aio_context(s->bs);
     aio_set_fd_handler(aio_context, s->sock,
@@ -129,8 +224,14 @@ static int nbd_co_send_request(NbdClientSession *s,
     } else {
         rc = nbd_send_request(s->sock, request);
     }
-    aio_set_fd_handler(aio_context, s->sock, nbd_reply_ready, NULL, s);
     s->send_coroutine = NULL;
+    if (s->sock != -1) {
+        aio_set_fd_handler(aio_context, s->sock, nbd_reply_ready, NULL, s);
+        /* Unless the connection is already being torn down */
+        if (rc < 0 && gen == s->connection_gen) {
+            nbd_connection_lost(s);
+        }
+    }
     qemu_co_mutex_unlock(&s->send_mutex);
     return rc;
 }
@@ -139,10 +240,13 @@ static void nbd_co_receive_reply(NbdClientSession *s,
     struct nbd_request *request, struct nbd_reply *reply,
     QEMUIOVector *qiov, int offset)
 {
+    int i = HANDLE_TO_INDEX(s, request->handle);
+    unsigned gen = s->connection_gen;
     int ret;
 
     /* Wait until we're woken up by the read handler.  TODO: perhaps
      * peek at the next reply and avoid yielding if it's ours?  */
+    s->requests[i].receiving = true;
     qemu_coroutine_yield();
     *reply = s->reply;
     if (reply->handle != request->handle) {
@@ -153,12 +257,19 @@ static void nbd_co_receive_reply(NbdClientSession *s,
                                 offset, request->len);
             if (ret != request->len) {
                 reply->error = EIO;
+                s->requests[i].receiving = false;
+                s->reply.handle = 0;
+                if (gen == s->connection_gen) {
+                    nbd_connection_lost(s);
+                }
+                return;
             }
         }
 
         /* Tell the read handler to read another header.  */
         s->reply.handle = 0;
     }
+    s->requests[i].receiving = false;
 }
 
 static void nbd_coroutine_start(NbdClientSession *s,
@@ -168,20 +279,20 @@ static void nbd_coroutine_start(NbdClientSession *s,
 
     /* Poor man semaphore.  The free_sema is locked when no other request
      * can be accepted, and unlocked after receiving one reply.  */
-    if (s->in_flight >= MAX_NBD_REQUESTS - 1) {
+    if (s->in_flight >= s->max_requests - 1) {
         qemu_co_mutex_lock(&s->free_sema);
-        assert(s->in_flight < MAX_NBD_REQUESTS);
+        assert(s->in_flight < s->max_requests);
     }
     s->in_flight++;
 
-    for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        if (s->recv_coroutine[i] == NULL) {
-            s->recv_coroutine[i] = qemu_coroutine_self();
+    for (i = 0; i < s->max_requests; i++) {
+        if (s->requests[i].coroutine == NULL) {
+            s->requests[i].coroutine = qemu_coroutine_self();
             break;
         }
     }
 
-    assert(i < MAX_NBD_REQUESTS);
+    assert(i < s->max_requests);
     request->handle = INDEX_TO_HANDLE(s, i);
 }
 
@@ -189,33 +300,62 @@ static void nbd_coroutine_end(NbdClientSession *s,
     struct nbd_request *request)
 {
     int i = HANDLE_TO_INDEX(s, request->handle);
-    s->recv_coroutine[i] = NULL;
-    if (s->in_flight-- == MAX_NBD_REQUESTS) {
+    s->requests[i].coroutine = NULL;
+    if (s->in_flight-- == s->max_requests) {
         qemu_co_mutex_unlock(&s->free_sema);
     }
 }
 
-static int nbd_co_readv_1(NbdClientSession *client, int64_t sector_num,
-                          int nb_sectors, QEMUIOVector *qiov,
+/* Send a request and wait for its reply.  If the connection is lost and
+ * comes back within the reconnect delay, the request is sent again on the
+ * new connection; the NBD commands the driver uses can all be repeated.
+ */
+static int nbd_co_request(NbdClientSession *s, struct nbd_request *request,
+                          QEMUIOVector *write_qiov, QEMUIOVector *read_qiov,
                           int offset)
 {
-    struct nbd_request request = { .type = NBD_CMD_READ };
     struct nbd_reply reply;
+    unsigned gen;
     ssize_t ret;
 
-    request.from = sector_num * 512;
-    request.len = nb_sectors * 512;
+    nbd_coroutine_start(s, request);
+    for (;;) {
+        while (s->reconnecting) {
+            qemu_co_queue_wait(&s->reconnect_waiters);
+        }
+        if (s->sock == -1) {
+            reply.error = EIO;
+            break;
+        }
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(client, &request, NULL, 0);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, qiov, offset);
+        gen = s->connection_gen;
+        ret = nbd_co_send_request(s, request, write_qiov, offset);
+        if (ret < 0) {
+            reply.error = -ret;
+        } else {
+            nbd_co_receive_reply(s, request, &reply, read_qiov, offset);
+        }
+        if (reply.error == 0 || !s->reconnect_delay ||
+            gen == s->connection_gen) {
+            break;
+        }
+        logout("Replaying request %" PRIu64 " after reconnection\n",
+               request->handle);
     }
-    nbd_coroutine_end(client, &request);
+    nbd_coroutine_end(s, request);
     return -reply.error;
+}
+
+static int nbd_co_readv_1(NbdClientSession *client, int64_t sector_num,
+                          int nb_sectors, QEMUIOVector *qiov,
+                          int offset)
+{
+    struct nbd_request request = { .type = NBD_CMD_READ };
+
+    request.from = sector_num * 512;
+    request.len = nb_sectors * 512;
 
+    return nbd_co_request(client, &request, NULL, qiov, offset);
 }
 
 static int nbd_co_writev_1(NbdClientSession *client, int64_t sector_num,
@@ -223,8 +363,6 @@ static int nbd_co_writev_1(NbdClientSession *client, int64_t sector_num,
                            int offset)
 {
     struct nbd_request request = { .type = NBD_CMD_WRITE };
-    struct nbd_reply reply;
-    ssize_t ret;
 
     if (!bdrv_enable_write_cache(client->bs) &&
         (client->nbdflags & NBD_FLAG_SEND_FUA)) {
@@ -234,15 +372,7 @@ static int nbd_co_writev_1(NbdClientSession *client, int64_t sector_num,
     request.from = sector_num * 512;
     request.len = nb_sectors * 512;
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(client, &request, qiov, offset);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL, 0);
-    }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
+    return nbd_co_request(client, &request, qiov, NULL, offset);
 }
 
 /* qemu-nbd has a limit of slightly less than 1M per request.  Try to
@@ -288,8 +418,6 @@ int nbd_client_session_co_writev(NbdClientSession *client, int64_t sector_num,
 int nbd_client_session_co_flush(NbdClientSession *client)
 {
     struct nbd_request request = { .type = NBD_CMD_FLUSH };
-    struct nbd_reply reply;
-    ssize_t ret;
 
     if (!(client->nbdflags & NBD_FLAG_SEND_FLUSH)) {
         return 0;
@@ -302,23 +430,13 @@ int nbd_client_session_co_flush(NbdClientSession *client)
     request.from = 0;
     request.len = 0;
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(client, &request, NULL, 0);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL, 0);
-    }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
+    return nbd_co_request(client, &request, NULL, NULL, 0);
 }
 
 int nbd_client_session_co_discard(NbdClientSession *client, int64_t sector_num,
     int nb_sectors)
 {
     struct nbd_request request = { .type = NBD_CMD_TRIM };
-    struct nbd_reply reply;
-    ssize_t ret;
 
     if (!(client->nbdflags & NBD_FLAG_SEND_TRIM)) {
         return 0;
@@ -326,29 +444,31 @@ int nbd_client_session_co_discard(NbdClientSession *client, int64_t sector_num,
     request.from = sector_num * 512;
     request.len = nb_sectors * 512;
 
-    nbd_coroutine_start(client, &request);
-    ret = nbd_co_send_request(client, &request, NULL, 0);
-    if (ret < 0) {
-        reply.error = -ret;
-    } else {
-        nbd_co_receive_reply(client, &request, &reply, NULL, 0);
-    }
-    nbd_coroutine_end(client, &request);
-    return -reply.error;
-
+    return nbd_co_request(client, &request, NULL, NULL, 0);
 }
 
 void nbd_client_session_detach_aio_context(NbdClientSession *client)
 {
-    aio_set_fd_handler(bdrv_get_aio_context(client->bs), client->sock,
-                       NULL, NULL, NULL);
+    if (client->reconnect_timer) {
+        timer_del(client->reconnect_timer);
+        timer_free(client->reconnect_timer);
+        client->reconnect_timer = NULL;
+    }
+    if (client->sock != -1) {
+        aio_set_fd_handler(bdrv_get_aio_context(client->bs), client->sock,
+                           NULL, NULL, NULL);
+    }
 }
 
 void nbd_client_session_attach_aio_context(NbdClientSession *client,
                                            AioContext *new_context)
 {
-    aio_set_fd_handler(new_context, client->sock,
-                       nbd_reply_ready, NULL, client);
+    if (client->reconnecting) {
+        nbd_reconnect_timer_init(client, new_context);
+    } else if (client->sock != -1) {
+        aio_set_fd_handler(new_context, client->sock,
+                           nbd_reply_ready, NULL, client);
+    }
 }
 
 void nbd_client_session_close(NbdClientSession *client)
@@ -362,13 +482,28 @@ void nbd_client_session_close(NbdClientSession *client)
     if (!client->bs) {
         return;
     }
-    if (client->sock == -1) {
-        return;
+
+    if (client->reconnect_timer) {
+        timer_del(client->reconnect_timer);
+        timer_free(client->reconnect_timer);
+        client->reconnect_timer = NULL;
     }
+    client->reconnecting = false;
 
-    nbd_send_request(client->sock, &request);
+    if (client->sock != -1) {
+        nbd_send_request(client->sock, &request);
+        nbd_teardown_connection(client);
+    }
 
-    nbd_teardown_connection(client);
+    /* Fail requests that were waiting for a reconnection */
+    while (qemu_co_enter_next(&client->reconnect_waiters)) {
+        /* nothing */
+    }
+
+    g_free(client->requests);
+    client->requests = NULL;
+    g_free(client->export_name);
+    client->export_name = NULL;
     client->bs = NULL;
 }
 
@@ -391,6 +526,12 @@ int nbd_client_session_init(NbdClientSession *client, BlockDriverState *bs,
 
     qemu_co_mutex_init(&client->send_mutex);
     qemu_co_mutex_init(&client->free_sema);
+    qemu_co_queue_init(&client->reconnect_waiters);
+    if (!client->max_requests) {
+        client->max_requests = MAX_NBD_REQUESTS;
+    }
+    client->requests = g_new0(NbdClientRequest, client->max_requests);
+    client->export_name = g_strdup(export);
     client->bs = bs;
     client->sock = sock;
 
@@ -15,6 +15,12 @@
 #endif
 
 #define MAX_NBD_REQUESTS    16
+#define NBD_MAX_REQUESTS_LIMIT 1024
+
+typedef struct NbdClientRequest {
+    Coroutine *coroutine;
+    bool receiving;             /* waiting in nbd_co_receive_reply() */
+} NbdClientRequest;
 
 typedef struct NbdClientSession {
     int sock;
@@ -27,12 +33,28 @@ typedef struct NbdClientSession {
     Coroutine *send_coroutine;
     int in_flight;
 
-    Coroutine *recv_coroutine[MAX_NBD_REQUESTS];
+    /* Requests that may be in flight; set before nbd_client_session_init() */
+    int max_requests;
+    NbdClientRequest *requests;
     struct nbd_reply reply;
 
     bool is_unix;
 
     BlockDriverState *bs;
+
+    /* Reconnection.  If reconnect_delay is non-zero, a lost connection is
+     * re-established for up to reconnect_delay seconds, and requests that
+     * were in flight are sent again on the new connection.  connect()
+     * returns a connected socket or a negative errno.
+     */
+    int (*connect)(BlockDriverState *bs, Error **errp);
+    char *export_name;
+    int64_t reconnect_delay;
+    int64_t reconnect_deadline;
+    QEMUTimer *reconnect_timer;
+    CoQueue reconnect_waiters;
+    bool reconnecting;
+    unsigned connection_gen;    /* incremented when the connection is lost */
 } NbdClientSession;
 
 int nbd_client_session_init(NbdClientSession *client, BlockDriverState *bs,
@@ -46,6 +46,25 @@ typedef struct BDRVNBDState {
     QemuOpts *socket_opts;
 } BDRVNBDState;
 
+static QemuOptsList runtime_opts = {
+    .name = "nbd",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = "requests",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of requests in flight",
+        },
+        {
+            .name = "reconnect-delay",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Seconds to try reconnecting to the server after the "
+                    "connection is lost (0 to fail requests at once)",
+        },
+        { /* end of list */ }
+    },
+};
+
 static int nbd_parse_uri(const char *filename, QDict *options)
 {
     URI *uri;
@@ -253,8 +272,34 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     BDRVNBDState *s = bs->opaque;
     char *export = NULL;
     int result, sock;
+    QemuOpts *opts;
+    int64_t requests, reconnect_delay;
     Error *local_err = NULL;
 
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    qemu_opts_absorb_qdict(opts, options, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    requests = qemu_opt_get_number(opts, "requests", MAX_NBD_REQUESTS);
+    reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
+    qemu_opts_del(opts);
+
+    if (requests < 1 || requests > NBD_MAX_REQUESTS_LIMIT) {
+        error_setg(errp, "requests must be between 1 and %d",
+                   NBD_MAX_REQUESTS_LIMIT);
+        return -EINVAL;
+    }
+    if (reconnect_delay < 0) {
+        error_setg(errp, "reconnect-delay must not be negative");
+        return -EINVAL;
+    }
+    s->client.max_requests = requests;
+    s->client.reconnect_delay = reconnect_delay;
+    s->client.connect = nbd_establish_connection;
+
     /* Pop the config into our state object. Exit if invalid. */
     nbd_config(s, options, &export, &local_err);
     if (local_err) {
@@ -262,8 +307,8 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         return -EINVAL;
     }
 
-    /* establish TCP connection, return error if it fails
-     * TODO: Configurable retry-until-timeout behaviour.
+    /* establish TCP connection, return error if it fails.  Only an
+     * established connection is retried, see reconnect-delay.
      */
     sock = nbd_establish_connection(bs, errp);
     if (sock < 0) {
@@ -347,6 +392,9 @@ static void nbd_refresh_filename(BlockDriverState *bs)
     const char *host   = qdict_get_try_str(bs->options, "host");
     const char *port   = qdict_get_try_str(bs->options, "port");
     const char *export = qdict_get_try_str(bs->options, "export");
+    const char *requests = qdict_get_try_str(bs->options, "requests");
+    const char *reconnect_delay = qdict_get_try_str(bs->options,
+                                                    "reconnect-delay");
 
     qdict_put_obj(opts, "driver", QOBJECT(qstring_from_str("nbd")));
 
@@ -381,6 +429,13 @@ static void nbd_refresh_filename(BlockDriverState *bs)
     if (export) {
         qdict_put_obj(opts, "export", QOBJECT(qstring_from_str(export)));
     }
+    if (requests) {
+        qdict_put_obj(opts, "requests", QOBJECT(qstring_from_str(requests)));
+    }
+    if (reconnect_delay) {
+        qdict_put_obj(opts, "reconnect-delay",
+                      QOBJECT(qstring_from_str(reconnect_delay)));
+    }
 
     bs->full_open_options = opts;
 }
@@ -24,6 +24,7 @@
 
 #include "block/qapi.h"
 #include "block/block_int.h"
+#include "block/throttle-groups.h"
 #include "qmp-commands.h"
 #include "qapi-visit.h"
 #include "qapi/qmp-output-visitor.h"
@@ -55,7 +56,7 @@ BlockDeviceInfo *bdrv_block_device_info(BlockDriverState *bs)
 
     if (bs->io_limits_enabled) {
         ThrottleConfig cfg;
-        throttle_get_config(&bs->throttle_state, &cfg);
+        throttle_group_get_config(bs, &cfg);
         info->bps     = cfg.buckets[THROTTLE_BPS_TOTAL].avg;
         info->bps_rd  = cfg.buckets[THROTTLE_BPS_READ].avg;
         info->bps_wr  = cfg.buckets[THROTTLE_BPS_WRITE].avg;
@@ -80,6 +81,44 @@ BlockDeviceInfo *bdrv_block_device_info(BlockDriverState *bs)
 
         info->has_iops_size = cfg.op_size;
         info->iops_size = cfg.op_size;
+
+        info->has_bps_max_length =
+            cfg.buckets[THROTTLE_BPS_TOTAL].burst_length > 1;
+        info->bps_max_length = cfg.buckets[THROTTLE_BPS_TOTAL].burst_length;
+        info->has_bps_rd_max_length =
+            cfg.buckets[THROTTLE_BPS_READ].burst_length > 1;
+        info->bps_rd_max_length = cfg.buckets[THROTTLE_BPS_READ].burst_length;
+        info->has_bps_wr_max_length =
+            cfg.buckets[THROTTLE_BPS_WRITE].burst_length > 1;
+        info->bps_wr_max_length = cfg.buckets[THROTTLE_BPS_WRITE].burst_length;
+
+        info->has_iops_max_length =
+            cfg.buckets[THROTTLE_OPS_TOTAL].burst_length > 1;
+        info->iops_max_length = cfg.buckets[THROTTLE_OPS_TOTAL].burst_length;
+        info->has_iops_rd_max_length =
+            cfg.buckets[THROTTLE_OPS_READ].burst_length > 1;
+        info->iops_rd_max_length = cfg.buckets[THROTTLE_OPS_READ].burst_length;
+        info->has_iops_wr_max_length =
+            cfg.buckets[THROTTLE_OPS_WRITE].burst_length > 1;
+        info->iops_wr_max_length = cfg.buckets[THROTTLE_OPS_WRITE].burst_length;
+
+        info->has_throttle_levels = true;
+        info->throttle_levels = g_new0(BlockThrottleLevels, 1);
+        info->throttle_levels->bps =
+            cfg.buckets[THROTTLE_BPS_TOTAL].level;
+        info->throttle_levels->bps_rd =
+            cfg.buckets[THROTTLE_BPS_READ].level;
+        info->throttle_levels->bps_wr =
+            cfg.buckets[THROTTLE_BPS_WRITE].level;
+        info->throttle_levels->iops =
+            cfg.buckets[THROTTLE_OPS_TOTAL].level;
+        info->throttle_levels->iops_rd =
+            cfg.buckets[THROTTLE_OPS_READ].level;
+        info->throttle_levels->iops_wr =
+            cfg.buckets[THROTTLE_OPS_WRITE].level;
+
+        info->has_group = true;
+        info->group = g_strdup(throttle_group_get_name(bs));
     }
 
     return info;
@@ -300,9 +339,81 @@ static void bdrv_query_info(BlockBackend *blk, BlockInfo **p_info,
     qapi_free_BlockInfo(info);
 }
 
-static BlockStats *bdrv_query_stats(const BlockDriverState *bs)
+static uint64List *uint64_list_from_array(const uint64_t *array, int n)
+{
+    uint64List *list = NULL, **next = &list;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        *next = g_new0(uint64List, 1);
+        (*next)->value = array[i];
+        next = &(*next)->next;
+    }
+    return list;
+}
+
+static BlockLatencyHistogramInfo *
+bdrv_query_latency_histogram(BlockAcctStats *stats, enum BlockAcctType type)
+{
+    BlockLatencyHistogram *hist = stats->histogram[type];
+    BlockLatencyHistogramInfo *info;
+
+    if (!hist) {
+        return NULL;
+    }
+
+    info = g_new0(BlockLatencyHistogramInfo, 1);
+    info->boundaries = uint64_list_from_array(hist->boundaries,
+                                              hist->nbins - 1);
+    info->bins = uint64_list_from_array(hist->bins, hist->nbins);
+    return info;
+}
+
+static BlockDeviceTimedStatsList *bdrv_query_timed_stats(BlockAcctStats *stats)
+{
+    BlockAcctIntervals *intervals = stats->intervals;
+    BlockDeviceTimedStatsList *list = NULL, **next = &list;
+    BlockAcctWindow w;
+    int i;
+
+    for (i = 0; intervals && i < intervals->n; i++) {
+        BlockDeviceTimedStats *ts = g_new0(BlockDeviceTimedStats, 1);
+
+        block_acct_timed_stats_get(&intervals->stats[i], &w);
+        ts->interval_length = intervals->stats[i].interval_ns / 1000000000LL;
+        ts->rd_operations = w.nr_ops[BLOCK_ACCT_READ];
+        ts->wr_operations = w.nr_ops[BLOCK_ACCT_WRITE];
+        ts->flush_operations = w.nr_ops[BLOCK_ACCT_FLUSH];
+        ts->min_rd_latency_ns = w.min_ns[BLOCK_ACCT_READ];
+        ts->max_rd_latency_ns = w.max_ns[BLOCK_ACCT_READ];
+        ts->min_wr_latency_ns = w.min_ns[BLOCK_ACCT_WRITE];
+        ts->max_wr_latency_ns = w.max_ns[BLOCK_ACCT_WRITE];
+        ts->min_flush_latency_ns = w.min_ns[BLOCK_ACCT_FLUSH];
+        ts->max_flush_latency_ns = w.max_ns[BLOCK_ACCT_FLUSH];
+        if (w.nr_ops[BLOCK_ACCT_READ]) {
+            ts->avg_rd_latency_ns =
+                w.total_ns[BLOCK_ACCT_READ] / w.nr_ops[BLOCK_ACCT_READ];
+        }
+        if (w.nr_ops[BLOCK_ACCT_WRITE]) {
+            ts->avg_wr_latency_ns =
+                w.total_ns[BLOCK_ACCT_WRITE] / w.nr_ops[BLOCK_ACCT_WRITE];
+        }
+        if (w.nr_ops[BLOCK_ACCT_FLUSH]) {
+            ts->avg_flush_latency_ns =
+                w.total_ns[BLOCK_ACCT_FLUSH] / w.nr_ops[BLOCK_ACCT_FLUSH];
+        }
+
+        *next = g_new0(BlockDeviceTimedStatsList, 1);
+        (*next)->value = ts;
+        next = &(*next)->next;
+    }
+    return list;
+}
+
+static BlockStats *bdrv_query_stats(BlockDriverState *bs)
 {
     BlockStats *s;
+    int64_t idle_time_ns;
 
     s = g_malloc0(sizeof(*s));
 
@@ -312,6 +423,7 @@ static BlockStats *bdrv_query_stats(const BlockDriverState *bs)
     }
 
     s->stats = g_malloc0(sizeof(*s->stats));
+    qemu_mutex_lock(&bs->stats.lock);
     s->stats->rd_bytes = bs->stats.nr_bytes[BLOCK_ACCT_READ];
     s->stats->wr_bytes = bs->stats.nr_bytes[BLOCK_ACCT_WRITE];
     s->stats->rd_operations = bs->stats.nr_ops[BLOCK_ACCT_READ];
@@ -322,6 +434,37 @@ static BlockStats *bdrv_query_stats(const BlockDriverState *bs)
     s->stats->wr_total_time_ns = bs->stats.total_time_ns[BLOCK_ACCT_WRITE];
     s->stats->rd_total_time_ns = bs->stats.total_time_ns[BLOCK_ACCT_READ];
     s->stats->flush_total_time_ns = bs->stats.total_time_ns[BLOCK_ACCT_FLUSH];
+    s->stats->failed_rd_operations = bs->stats.failed_ops[BLOCK_ACCT_READ];
+    s->stats->failed_wr_operations = bs->stats.failed_ops[BLOCK_ACCT_WRITE];
+    s->stats->failed_flush_operations =
+        bs->stats.failed_ops[BLOCK_ACCT_FLUSH];
+    s->stats->invalid_rd_operations = bs->stats.invalid_ops[BLOCK_ACCT_READ];
+    s->stats->invalid_wr_operations = bs->stats.invalid_ops[BLOCK_ACCT_WRITE];
+    s->stats->invalid_flush_operations =
+        bs->stats.invalid_ops[BLOCK_ACCT_FLUSH];
+
+    idle_time_ns = block_acct_idle_time_ns(&bs->stats);
+    if (idle_time_ns >= 0) {
+        s->stats->has_idle_time_ns = true;
+        s->stats->idle_time_ns = idle_time_ns;
+    }
+
+    s->stats->timed_stats = bdrv_query_timed_stats(&bs->stats);
+
+    s->stats->rd_latency_histogram =
+        bdrv_query_latency_histogram(&bs->stats, BLOCK_ACCT_READ);
+    s->stats->has_rd_latency_histogram = !!s->stats->rd_latency_histogram;
+    s->stats->wr_latency_histogram =
+        bdrv_query_latency_histogram(&bs->stats, BLOCK_ACCT_WRITE);
+    s->stats->has_wr_latency_histogram = !!s->stats->wr_latency_histogram;
+    s->stats->flush_latency_histogram =
+        bdrv_query_latency_histogram(&bs->stats, BLOCK_ACCT_FLUSH);
+    s->stats->has_flush_latency_histogram =
+        !!s->stats->flush_latency_histogram;
+    qemu_mutex_unlock(&bs->stats.lock);
+
+    s->driver_specific = bdrv_get_specific_stats(bs);
+    s->has_driver_specific = s->driver_specific != NULL;
 
     if (bs->file) {
         s->has_parent = true;
@@ -0,0 +1,406 @@
+/*
+ * Persistent dirty bitmaps for the QCOW version 2 format
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Persistent dirty bitmaps are only kept in the image while it is not open
+ * for writing.  Opening the image read-write loads them into memory and
+ * removes them from the image; closing it stores them again.  A crash thus
+ * loses the bitmaps instead of leaving stale ones behind, and the next
+ * backup has to be a full one.
+ *
+ * The bitmaps are described by the dirty bitmaps header extension, which
+ * points to a directory of Qcow2BitmapDirEntry records, each followed by
+ * the bitmap name padded to a multiple of 8 bytes.  The data of each
+ * bitmap is in its own run of clusters, in the format of hbitmap_serialize.
+ *
+ * The QCOW2_AUTOCLEAR_DIRTY_BITMAPS bit is set together with the header
+ * extension.  Versions of QEMU that do not know about dirty bitmaps clear
+ * it when they open the image for writing, which tells us that the stored
+ * bitmaps no longer cover all writes.
+ */
+
+#include "qemu-common.h"
+#include "block/block_int.h"
+#include "block/qcow2.h"
+#include "qemu/error-report.h"
+
+/* Upper limit for the directory, to avoid huge allocations on bad images */
+#define QCOW2_MAX_BITMAP_DIRECTORY_SIZE (1024 * 1024)
+#define QCOW2_MAX_BITMAP_NAME_SIZE 1023
+
+typedef struct Qcow2BitmapDirEntry {
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint32_t granularity;
+    uint16_t name_size;
+    uint16_t reserved;
+    /* name follows */
+} QEMU_PACKED Qcow2BitmapDirEntry;
+
+static size_t bitmap_dir_entry_size(size_t name_size)
+{
+    return sizeof(Qcow2BitmapDirEntry) + ((name_size + 7) & ~7);
+}
+
+bool qcow2_can_store_dirty_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    /* version 2 images have no autoclear bits */
+    return s->qcow_version >= 3;
+}
+
+void qcow2_free_bitmap_extents(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    g_free(s->bitmap_extents);
+    s->bitmap_extents = NULL;
+}
+
+/* Forget the stored bitmaps and free their clusters */
+static int qcow2_drop_stored_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint32_t nb_bitmaps = s->nb_bitmaps;
+    uint64_t directory_offset = s->bitmap_directory_offset;
+    uint64_t directory_size = s->bitmap_directory_size;
+    Qcow2BitmapExtent *extents = s->bitmap_extents;
+    bool owned = s->autoclear_features & QCOW2_AUTOCLEAR_DIRTY_BITMAPS;
+    uint32_t i;
+    int ret;
+
+    s->nb_bitmaps = 0;
+    s->bitmap_directory_offset = 0;
+    s->bitmap_directory_size = 0;
+    s->bitmap_extents = NULL;
+    s->autoclear_features &= ~QCOW2_AUTOCLEAR_DIRTY_BITMAPS;
+
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        g_free(extents);
+        return ret;
+    }
+
+    /* Without the autoclear bit, another program has written to the image
+     * and may have freed and reused the clusters already; leaking them is
+     * the safe option then.
+     */
+    if (owned && extents) {
+        for (i = 0; i < nb_bitmaps; i++) {
+            qcow2_free_clusters(bs, extents[i].offset, extents[i].size,
+                                QCOW2_DISCARD_OTHER);
+        }
+        qcow2_free_clusters(bs, directory_offset, directory_size,
+                            QCOW2_DISCARD_OTHER);
+    }
+    g_free(extents);
+    return 0;
+}
+
+static bool bitmap_extent_valid(BlockDriverState *bs, uint64_t offset,
+                                uint64_t size)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    return !offset_into_cluster(s, offset) && size > 0 &&
+           offset + size > offset &&
+           offset + size <= bdrv_getlength(bs->file);
+}
+
+static int qcow2_load_one_bitmap(BlockDriverState *bs,
+                                 Qcow2BitmapDirEntry *entry, const char *name)
+{
+    BdrvDirtyBitmap *bitmap;
+    uint8_t *buf;
+    int ret;
+
+    if (bdrv_find_dirty_bitmap(bs, name)) {
+        /* still in memory, e.g. across qcow2_invalidate_cache */
+        return 0;
+    }
+
+    bitmap = bdrv_create_dirty_bitmap(bs, entry->granularity, name, NULL);
+    if (!bitmap) {
+        return -EINVAL;
+    }
+    if (bdrv_dirty_bitmap_serialization_size(bitmap) != entry->data_size) {
+        /* the image was resized by a program that does not know bitmaps */
+        error_report("Dropping dirty bitmap '%s' of '%s': size mismatch",
+                     name, bs->filename);
+        bdrv_release_dirty_bitmap(bs, bitmap);
+        return 0;
+    }
+
+    buf = g_try_malloc(entry->data_size);
+    if (!buf) {
+        bdrv_release_dirty_bitmap(bs, bitmap);
+        return -ENOMEM;
+    }
+    ret = bdrv_pread(bs->file, entry->data_offset, buf, entry->data_size);
+    if (ret < 0) {
+        g_free(buf);
+        bdrv_release_dirty_bitmap(bs, bitmap);
+        return ret;
+    }
+
+    bdrv_dirty_bitmap_deserialize(bitmap, buf);
+    bdrv_dirty_bitmap_set_persistent(bitmap, true);
+    g_free(buf);
+    return 0;
+}
+
+int qcow2_load_dirty_bitmaps(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint8_t *dir = NULL;
+    uint64_t pos;
+    uint32_t i;
+    int ret;
+
+    if (!s->nb_bitmaps) {
+        return 0;
+    }
+
+    if (!(s->autoclear_features & QCOW2_AUTOCLEAR_DIRTY_BITMAPS)) {
+        error_report("Dropping stale dirty bitmaps of '%s'",
+                     bs->filename);
+        goto drop;
+    }
+
+    if (s->bitmap_directory_size > QCOW2_MAX_BITMAP_DIRECTORY_SIZE ||
+        s->nb_bitmaps > s->bitmap_directory_size /
+                        sizeof(Qcow2BitmapDirEntry) ||
+        !bitmap_extent_valid(bs, s->bitmap_directory_offset,
+                             s->bitmap_directory_size)) {
+        error_setg(errp, "Invalid dirty bitmap directory");
+        return -EINVAL;
+    }
+
+    dir = g_malloc(s->bitmap_directory_size);
+    ret = bdrv_pread(bs->file, s->bitmap_directory_offset, dir,
+                     s->bitmap_directory_size);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read dirty bitmap directory");
+        goto fail;
+    }
+
+    s->bitmap_extents = g_new0(Qcow2BitmapExtent, s->nb_bitmaps);
+    for (i = 0, pos = 0; i < s->nb_bitmaps; i++) {
+        Qcow2BitmapDirEntry entry;
+        char *name;
+
+        if (s->bitmap_directory_size - pos < sizeof(entry)) {
+            goto invalid;
+        }
+        memcpy(&entry, dir + pos, sizeof(entry));
+        be64_to_cpus(&entry.data_offset);
+        be64_to_cpus(&entry.data_size);
+        be32_to_cpus(&entry.granularity);
+        be16_to_cpus(&entry.name_size);
+
+        if (entry.name_size == 0 ||
+            entry.name_size > QCOW2_MAX_BITMAP_NAME_SIZE ||
+            s->bitmap_directory_size - pos <
+                bitmap_dir_entry_size(entry.name_size) ||
+            entry.granularity < BDRV_SECTOR_SIZE ||
+            (entry.granularity & (entry.granularity - 1)) ||
+            !bitmap_extent_valid(bs, entry.data_offset, entry.data_size)) {
+            goto invalid;
+        }
+
+        s->bitmap_extents[i].offset = entry.data_offset;
+        s->bitmap_extents[i].size = entry.data_size;
+
+        name = g_strndup((char *)dir + pos + sizeof(entry), entry.name_size);
+        ret = qcow2_load_one_bitmap(bs, &entry, name);
+        g_free(name);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not load dirty bitmap");
+            goto fail;
+        }
+
+        pos += bitmap_dir_entry_size(entry.name_size);
+    }
+    g_free(dir);
+    dir = NULL;
+
+    if (bs->read_only) {
+        /* nothing can change, so the stored bitmaps stay valid */
+        return 0;
+    }
+
+drop:
+    ret = qcow2_drop_stored_bitmaps(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not update qcow2 header");
+    }
+    return ret;
+
+invalid:
+    error_setg(errp, "Invalid dirty bitmap directory entry");
+    ret = -EINVAL;
+fail:
+    g_free(dir);
+    qcow2_free_bitmap_extents(bs);
+    return ret;
+}
+
+/* Allocate clusters for @size bytes of @buf and write them */
+static int64_t qcow2_write_bitmap_data(BlockDriverState *bs, const void *buf,
+                                       uint64_t size)
+{
+    int64_t offset;
+    int ret;
+
+    offset = qcow2_alloc_clusters(bs, size);
+    if (offset < 0) {
+        return offset;
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, offset, size);
+    if (ret >= 0) {
+        ret = bdrv_pwrite(bs->file, offset, buf, size);
+    }
+    if (ret < 0) {
+        qcow2_free_clusters(bs, offset, size, QCOW2_DISCARD_ALWAYS);
+        return ret;
+    }
+    return offset;
+}
+
+int qcow2_store_dirty_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap;
+    Qcow2BitmapExtent *extents = NULL;
+    uint8_t *dir = NULL, *buf;
+    uint64_t dir_size = 0;
+    uint32_t nb_bitmaps = 0, i;
+    int64_t offset;
+    int ret;
+
+    /* bitmaps of a read-only image never left it */
+    if (bs->read_only || !qcow2_can_store_dirty_bitmaps(bs)) {
+        return 0;
+    }
+    if (s->nb_bitmaps) {
+        /* opened read-only and reopened read-write since then */
+        ret = qcow2_drop_stored_bitmaps(bs);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    for (bitmap = bdrv_dirty_bitmap_next(bs, NULL); bitmap;
+         bitmap = bdrv_dirty_bitmap_next(bs, bitmap)) {
+        const char *name = bdrv_dirty_bitmap_name(bitmap);
+        size_t name_size;
+        Qcow2BitmapDirEntry *entry;
+        uint64_t size;
+
+        if (!bdrv_dirty_bitmap_is_persistent(bitmap)) {
+            continue;
+        }
+        name_size = MIN(strlen(name), QCOW2_MAX_BITMAP_NAME_SIZE);
+
+        size = bdrv_dirty_bitmap_serialization_size(bitmap);
+        buf = g_try_malloc(size);
+        if (!buf) {
+            ret = -ENOMEM;
+            goto fail;
+        }
+        bdrv_dirty_bitmap_serialize(bitmap, buf);
+        offset = qcow2_write_bitmap_data(bs, buf, size);
+        g_free(buf);
+        if (offset < 0) {
+            ret = offset;
+            goto fail;
+        }
+
+        extents = g_renew(Qcow2BitmapExtent, extents, nb_bitmaps + 1);
+        extents[nb_bitmaps].offset = offset;
+        extents[nb_bitmaps].size = size;
+        nb_bitmaps++;
+
+        dir = g_realloc(dir, dir_size + bitmap_dir_entry_size(name_size));
+        memset(dir + dir_size, 0, bitmap_dir_entry_size(name_size));
+        entry = (Qcow2BitmapDirEntry *)(dir + dir_size);
+        entry->data_offset = cpu_to_be64(offset);
+        entry->data_size = cpu_to_be64(size);
+        entry->granularity = cpu_to_be32(bdrv_dirty_bitmap_granularity(bitmap));
+        entry->name_size = cpu_to_be16(name_size);
+        memcpy(entry + 1, name, name_size);
+        dir_size += bitmap_dir_entry_size(name_size);
+    }
+
+    if (!nb_bitmaps) {
+        return 0;
+    }
+
+    offset = qcow2_write_bitmap_data(bs, dir, dir_size);
+    if (offset < 0) {
+        ret = offset;
+        goto fail;
+    }
+
+    /* The clusters must be allocated on disk before the header points
+     * to them.
+     */
+    ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (ret < 0) {
+        goto fail_dir;
+    }
+    ret = bdrv_flush(bs->file);
+    if (ret < 0) {
+        goto fail_dir;
+    }
+
+    s->nb_bitmaps = nb_bitmaps;
+    s->bitmap_directory_offset = offset;
+    s->bitmap_directory_size = dir_size;
+    s->autoclear_features |= QCOW2_AUTOCLEAR_DIRTY_BITMAPS;
+    ret = qcow2_update_header(bs);
+    if (ret < 0) {
+        s->nb_bitmaps = 0;
+        s->bitmap_directory_offset = 0;
+        s->bitmap_directory_size = 0;
+        s->autoclear_features &= ~QCOW2_AUTOCLEAR_DIRTY_BITMAPS;
+        goto fail_dir;
+    }
+
+    g_free(s->bitmap_extents);
+    s->bitmap_extents = extents;
+    g_free(dir);
+    return 0;
+
+fail_dir:
+    qcow2_free_clusters(bs, offset, dir_size, QCOW2_DISCARD_ALWAYS);
+fail:
+    for (i = 0; i < nb_bitmaps; i++) {
+        qcow2_free_clusters(bs, extents[i].offset, extents[i].size,
+                            QCOW2_DISCARD_ALWAYS);
+    }
+    g_free(extents);
+    g_free(dir);
+    return ret;
+}
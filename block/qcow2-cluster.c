@@ -27,6 +27,7 @@
 #include "qemu-common.h"
 #include "block/block_int.h"
 #include "block/qcow2.h"
+#include "qemu/host-utils.h"
 #include "trace.h"
 
 int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
@@ -138,20 +139,25 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
 /*
  * l2_load
  *
- * Loads a L2 table into memory. If the table is in the cache, the cache
- * is used; otherwise the L2 table is loaded from the image file.
+ * Loads the slice of the L2 table at @l2_offset that covers the guest
+ * offset @offset into memory. If the slice is in the cache, the cache is
+ * used; otherwise it is loaded from the image file.
  *
- * Returns a pointer to the L2 table on success, or NULL if the read from
- * the image file failed.
+ * Index the returned slice with offset_to_l2_slice_index().
+ *
+ * Returns 0 on success, -errno if the read from the image file failed.
  */
 
-static int l2_load(BlockDriverState *bs, uint64_t l2_offset,
-    uint64_t **l2_table)
+static int l2_load(BlockDriverState *bs, uint64_t offset,
+    uint64_t l2_offset, uint64_t **l2_table)
 {
     BDRVQcowState *s = bs->opaque;
+    int start_of_slice = l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
     int ret;
 
-    ret = qcow2_cache_get(bs, s->l2_table_cache, l2_offset, (void**) l2_table);
+    ret = qcow2_cache_get(bs, s->l2_table_cache, l2_offset + start_of_slice,
+                          (void**) l2_table);
 
     return ret;
 }
@@ -199,14 +205,17 @@ int qcow2_write_l1_entry(BlockDriverState *bs, int l1_index)
  * table) copy the contents of the old L2 table into the newly allocated one.
  * Otherwise the new table is initialized with zeros.
  *
+ * The table is filled one L2 cache slice at a time and written out before
+ * the L1 entry is updated; use l2_load() to access it afterwards.
  */
 
-static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
+static int l2_allocate(BlockDriverState *bs, int l1_index)
 {
     BDRVQcowState *s = bs->opaque;
     uint64_t old_l2_offset;
     uint64_t *l2_table = NULL;
     int64_t l2_offset;
+    unsigned int slice, slice_size2, n_slices;
     int ret;
 
     old_l2_offset = s->l1_table[l1_index];
@@ -215,7 +224,7 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
 
     /* allocate a new l2 entry */
 
-    l2_offset = qcow2_alloc_clusters(bs, s->l2_size * sizeof(uint64_t));
+    l2_offset = qcow2_alloc_clusters(bs, s->cluster_size);
     if (l2_offset < 0) {
         ret = l2_offset;
         goto fail;
@@ -226,34 +235,46 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
         goto fail;
     }
 
-    /* allocate a new entry in the l2 cache */
+    /* allocate new entries in the l2 cache, one for each slice */
 
-    trace_qcow2_l2_allocate_get_empty(bs, l1_index);
-    ret = qcow2_cache_get_empty(bs, s->l2_table_cache, l2_offset, (void**) table);
-    if (ret < 0) {
-        goto fail;
-    }
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
+    n_slices = s->cluster_size / slice_size2;
 
-    l2_table = *table;
-
-    if ((old_l2_offset & L1E_OFFSET_MASK) == 0) {
-        /* if there was no old l2 table, clear the new table */
-        memset(l2_table, 0, s->l2_size * sizeof(uint64_t));
-    } else {
-        uint64_t* old_table;
-
-        /* if there was an old l2 table, read it from the disk */
-        BLKDBG_EVENT(bs->file, BLKDBG_L2_ALLOC_COW_READ);
-        ret = qcow2_cache_get(bs, s->l2_table_cache,
-            old_l2_offset & L1E_OFFSET_MASK,
-            (void**) &old_table);
+    trace_qcow2_l2_allocate_get_empty(bs, l1_index);
+    for (slice = 0; slice < n_slices; slice++) {
+        ret = qcow2_cache_get_empty(bs, s->l2_table_cache,
+                                    l2_offset + slice * slice_size2,
+                                    (void**) &l2_table);
         if (ret < 0) {
             goto fail;
         }
 
-        memcpy(l2_table, old_table, s->cluster_size);
+        if ((old_l2_offset & L1E_OFFSET_MASK) == 0) {
+            /* if there was no old l2 table, clear the new slice */
+            memset(l2_table, 0, slice_size2);
+        } else {
+            uint64_t *old_table;
+            uint64_t old_slice_offset =
+                (old_l2_offset & L1E_OFFSET_MASK) + slice * slice_size2;
+
+            /* if there was an old l2 table, read its slice from the disk */
+            BLKDBG_EVENT(bs->file, BLKDBG_L2_ALLOC_COW_READ);
+            ret = qcow2_cache_get(bs, s->l2_table_cache, old_slice_offset,
+                                  (void**) &old_table);
+            if (ret < 0) {
+                goto fail;
+            }
+
+            memcpy(l2_table, old_table, slice_size2);
 
-        ret = qcow2_cache_put(bs, s->l2_table_cache, (void**) &old_table);
+            ret = qcow2_cache_put(bs, s->l2_table_cache, (void**) &old_table);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+
+        qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
+        ret = qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
         if (ret < 0) {
             goto fail;
         }
@@ -263,7 +284,6 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
     BLKDBG_EVENT(bs->file, BLKDBG_L2_ALLOC_WRITE);
 
     trace_qcow2_l2_allocate_write_l2(bs, l1_index);
-    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret < 0) {
         goto fail;
@@ -277,18 +297,17 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
         goto fail;
     }
 
-    *table = l2_table;
     trace_qcow2_l2_allocate_done(bs, l1_index, 0);
     return 0;
 
 fail:
     trace_qcow2_l2_allocate_done(bs, l1_index, ret);
     if (l2_table != NULL) {
-        qcow2_cache_put(bs, s->l2_table_cache, (void**) table);
+        qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
     }
     s->l1_table[l1_index] = old_l2_offset;
     if (l2_offset > 0) {
-        qcow2_free_clusters(bs, l2_offset, s->l2_size * sizeof(uint64_t),
+        qcow2_free_clusters(bs, l2_offset, s->cluster_size,
                             QCOW2_DISCARD_ALWAYS);
     }
     return ret;
@@ -301,12 +320,12 @@ fail:
  * as contiguous. (This allows it, for example, to stop at the first compressed
  * cluster which may require a different handling)
  */
-static int count_contiguous_clusters(uint64_t nb_clusters, int cluster_size,
-        uint64_t *l2_table, uint64_t stop_flags)
+static int count_contiguous_clusters(BDRVQcowState *s, uint64_t nb_clusters,
+        uint64_t *l2_table, int l2_index, uint64_t stop_flags)
 {
     int i;
     uint64_t mask = stop_flags | L2E_OFFSET_MASK | QCOW_OFLAG_COMPRESSED;
-    uint64_t first_entry = be64_to_cpu(l2_table[0]);
+    uint64_t first_entry = get_l2_entry(s, l2_table, l2_index);
     uint64_t offset = first_entry & mask;
 
     if (!offset)
@@ -315,8 +334,8 @@ static int count_contiguous_clusters(uint64_t nb_clusters, int cluster_size,
     assert(qcow2_get_cluster_type(first_entry) != QCOW2_CLUSTER_COMPRESSED);
 
     for (i = 0; i < nb_clusters; i++) {
-        uint64_t l2_entry = be64_to_cpu(l2_table[i]) & mask;
-        if (offset + (uint64_t) i * cluster_size != l2_entry) {
+        uint64_t l2_entry = get_l2_entry(s, l2_table, l2_index + i) & mask;
+        if (offset + (uint64_t) i * s->cluster_size != l2_entry) {
             break;
         }
     }
@@ -324,12 +343,14 @@ static int count_contiguous_clusters(uint64_t nb_clusters, int cluster_size,
 	return i;
 }
 
-static int count_contiguous_free_clusters(uint64_t nb_clusters, uint64_t *l2_table)
+static int count_contiguous_free_clusters(BDRVQcowState *s,
+        uint64_t nb_clusters, uint64_t *l2_table, int l2_index)
 {
     int i;
 
     for (i = 0; i < nb_clusters; i++) {
-        int type = qcow2_get_cluster_type(be64_to_cpu(l2_table[i]));
+        int type = qcow2_get_cluster_type(get_l2_entry(s, l2_table,
+                                                       l2_index + i));
 
         if (type != QCOW2_CLUSTER_UNALLOCATED) {
             break;
@@ -339,6 +360,45 @@ static int count_contiguous_free_clusters(uint64_t nb_clusters, uint64_t *l2_tab
     return i;
 }
 
+/*
+ * Counts the subclusters, starting with subcluster @sc_index of the cluster
+ * at @l2_index and looking at no more than @nb_clusters clusters, that are of
+ * type @expected_type.  For QCOW2_CLUSTER_NORMAL, the clusters must also be
+ * contiguous in the image file.  Only for images with extended L2 entries.
+ */
+static int count_contiguous_subclusters(BDRVQcowState *s, int nb_clusters,
+        unsigned int sc_index, uint64_t *l2_table, int l2_index,
+        int expected_type)
+{
+    uint64_t host_offset = get_l2_entry(s, l2_table, l2_index)
+                         & L2E_OFFSET_MASK;
+    int i, j, count = 0;
+
+    assert(has_subclusters(s));
+
+    for (i = 0; i < nb_clusters; i++) {
+        uint64_t l2_entry = get_l2_entry(s, l2_table, l2_index + i);
+        uint64_t l2_bitmap = get_l2_bitmap(s, l2_table, l2_index + i);
+
+        if (expected_type == QCOW2_CLUSTER_NORMAL &&
+            (l2_entry & L2E_OFFSET_MASK) !=
+            host_offset + ((uint64_t) i << s->cluster_bits)) {
+            break;
+        }
+
+        for (j = (i == 0 ? sc_index : 0); j < s->subclusters_per_cluster; j++) {
+            if (qcow2_get_subcluster_type(s, l2_entry, l2_bitmap, j)
+                != expected_type)
+            {
+                return count;
+            }
+            count++;
+        }
+    }
+
+    return count;
+}
+
 /* The crypt function is compatible with the linux cryptoloop
    algorithm for < 4 GB images. NOTE: out_buf == in_buf is
    supported */
@@ -364,67 +424,60 @@ void qcow2_encrypt_sectors(BDRVQcowState *s, int64_t sector_num,
     }
 }
 
-static int coroutine_fn copy_sectors(BlockDriverState *bs,
-                                     uint64_t start_sect,
-                                     uint64_t cluster_offset,
-                                     int n_start, int n_end)
+static int coroutine_fn do_perform_cow_read(BlockDriverState *bs,
+                                            uint64_t src_cluster_offset,
+                                            uint64_t offset_in_cluster,
+                                            uint8_t *buffer, int nb_sectors)
 {
-    BDRVQcowState *s = bs->opaque;
     QEMUIOVector qiov;
-    struct iovec iov;
-    int n, ret;
+    struct iovec iov = {
+        .iov_base   = buffer,
+        .iov_len    = nb_sectors * BDRV_SECTOR_SIZE,
+    };
 
-    n = n_end - n_start;
-    if (n <= 0) {
+    if (nb_sectors == 0) {
         return 0;
     }
 
-    iov.iov_len = n * BDRV_SECTOR_SIZE;
-    iov.iov_base = qemu_try_blockalign(bs, iov.iov_len);
-    if (iov.iov_base == NULL) {
-        return -ENOMEM;
-    }
-
     qemu_iovec_init_external(&qiov, &iov, 1);
 
     BLKDBG_EVENT(bs->file, BLKDBG_COW_READ);
 
     if (!bs->drv) {
-        ret = -ENOMEDIUM;
-        goto out;
+        return -ENOMEDIUM;
     }
 
     /* Call .bdrv_co_readv() directly instead of using the public block-layer
      * interface.  This avoids double I/O throttling and request tracking,
      * which can lead to deadlock when block layer copy-on-read is enabled.
      */
-    ret = bs->drv->bdrv_co_readv(bs, start_sect + n_start, n, &qiov);
-    if (ret < 0) {
-        goto out;
-    }
+    return bs->drv->bdrv_co_readv(bs, (src_cluster_offset + offset_in_cluster)
+                                      >> BDRV_SECTOR_BITS,
+                                  nb_sectors, &qiov);
+}
 
-    if (s->crypt_method) {
-        qcow2_encrypt_sectors(s, start_sect + n_start,
-                        iov.iov_base, iov.iov_base, n, 1,
-                        &s->aes_encrypt_key);
+static int coroutine_fn do_perform_cow_write(BlockDriverState *bs,
+                                             uint64_t cluster_offset,
+                                             uint64_t offset_in_cluster,
+                                             QEMUIOVector *qiov)
+{
+    int ret;
+
+    if (qiov->size == 0) {
+        return 0;
     }
 
     ret = qcow2_pre_write_overlap_check(bs, 0,
-            cluster_offset + n_start * BDRV_SECTOR_SIZE, n * BDRV_SECTOR_SIZE);
+            cluster_offset + offset_in_cluster, qiov->size);
     if (ret < 0) {
-        goto out;
+        return ret;
     }
 
     BLKDBG_EVENT(bs->file, BLKDBG_COW_WRITE);
-    ret = bdrv_co_writev(bs->file, (cluster_offset >> 9) + n_start, n, &qiov);
-    if (ret < 0) {
-        goto out;
-    }
-
-    ret = 0;
-out:
-    qemu_vfree(iov.iov_base);
-    return ret;
+    return bdrv_co_writev(bs->file,
+                          (cluster_offset + offset_in_cluster)
+                          >> BDRV_SECTOR_BITS,
+                          qiov->size >> BDRV_SECTOR_BITS, qiov);
 }
 
 
@@ -446,8 +499,9 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
     int *num, uint64_t *cluster_offset)
 {
     BDRVQcowState *s = bs->opaque;
-    unsigned int l2_index;
+    unsigned int l2_index, sc_index;
     uint64_t l1_index, l2_offset, *l2_table;
+    uint64_t l2_entry, l2_bitmap;
     int l1_bits, c;
     unsigned int index_in_cluster, nb_clusters;
     uint64_t nb_available, nb_needed;
@@ -495,64 +549,94 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
         return -EIO;
     }
 
-    /* load the l2 table in memory */
+    /* load the l2 slice in memory */
 
-    ret = l2_load(bs, l2_offset, &l2_table);
+    ret = l2_load(bs, offset, l2_offset, &l2_table);
     if (ret < 0) {
         return ret;
     }
 
     /* find the cluster offset for the given disk offset */
 
-    l2_index = (offset >> s->cluster_bits) & (s->l2_size - 1);
-    *cluster_offset = be64_to_cpu(l2_table[l2_index]);
+    l2_index = offset_to_l2_slice_index(s, offset);
+    sc_index = offset_to_sc_index(s, offset);
+    l2_entry = get_l2_entry(s, l2_table, l2_index);
+    l2_bitmap = get_l2_bitmap(s, l2_table, l2_index);
+    *cluster_offset = l2_entry;
     nb_clusters = size_to_clusters(s, nb_needed << 9);
+    /* stop at the end of the slice */
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
 
-    ret = qcow2_get_cluster_type(*cluster_offset);
+    /* From here on, c counts subclusters starting at sc_index (which are just
+     * clusters without extended L2 entries) */
+    ret = qcow2_get_subcluster_type(s, l2_entry, l2_bitmap, sc_index);
     switch (ret) {
     case QCOW2_CLUSTER_COMPRESSED:
         /* Compressed clusters can only be processed one by one */
-        c = 1;
+        c = s->subclusters_per_cluster - sc_index;
         *cluster_offset &= L2E_COMPRESSED_OFFSET_SIZE_MASK;
         break;
     case QCOW2_CLUSTER_ZERO:
         if (s->qcow_version < 3) {
             qcow2_signal_corruption(bs, true, -1, -1, "Zero cluster entry found"
                                     " in pre-v3 image (L2 offset: %#" PRIx64
-                                    ", L2 index: %#x)", l2_offset, l2_index);
+                                    ", L2 index: %#x)", l2_offset,
+                                    offset_to_l2_index(s, offset));
             ret = -EIO;
             goto fail;
         }
-        c = count_contiguous_clusters(nb_clusters, s->cluster_size,
-                &l2_table[l2_index], QCOW_OFLAG_ZERO);
+        if (has_subclusters(s)) {
+            c = count_contiguous_subclusters(s, nb_clusters, sc_index,
+                                             l2_table, l2_index, ret);
+        } else {
+            c = count_contiguous_clusters(s, nb_clusters, l2_table, l2_index,
+                                          QCOW_OFLAG_ZERO);
+        }
         *cluster_offset = 0;
         break;
     case QCOW2_CLUSTER_UNALLOCATED:
         /* how many empty clusters ? */
-        c = count_contiguous_free_clusters(nb_clusters, &l2_table[l2_index]);
+        if (has_subclusters(s)) {
+            c = count_contiguous_subclusters(s, nb_clusters, sc_index,
+                                             l2_table, l2_index, ret);
+        } else {
+            c = count_contiguous_free_clusters(s, nb_clusters, l2_table,
+                                               l2_index);
+        }
         *cluster_offset = 0;
         break;
     case QCOW2_CLUSTER_NORMAL:
         /* how many allocated clusters ? */
-        c = count_contiguous_clusters(nb_clusters, s->cluster_size,
-                &l2_table[l2_index], QCOW_OFLAG_ZERO);
+        if (has_subclusters(s)) {
+            c = count_contiguous_subclusters(s, nb_clusters, sc_index,
+                                             l2_table, l2_index, ret);
+        } else {
+            c = count_contiguous_clusters(s, nb_clusters, l2_table, l2_index,
+                                          QCOW_OFLAG_ZERO);
+        }
         *cluster_offset &= L2E_OFFSET_MASK;
         if (offset_into_cluster(s, *cluster_offset)) {
             qcow2_signal_corruption(bs, true, -1, -1, "Data cluster offset %#"
                                     PRIx64 " unaligned (L2 offset: %#" PRIx64
                                     ", L2 index: %#x)", *cluster_offset,
-                                    l2_offset, l2_index);
+                                    l2_offset, offset_to_l2_index(s, offset));
             ret = -EIO;
             goto fail;
         }
         break;
+    case -EIO:
+        qcow2_signal_corruption(bs, true, -1, -1, "Invalid cluster entry "
+                                "%#" PRIx64 " (L2 offset: %#" PRIx64
+                                ", L2 index: %#x)", l2_entry, l2_offset,
+                                offset_to_l2_index(s, offset));
+        goto fail;
     default:
         abort();
     }
 
     qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
 
-    nb_available = (c * s->cluster_sectors);
+    nb_available = (sc_index + c) * s->subcluster_sectors;
 
 out:
     if (nb_available > nb_needed)
@@ -571,10 +655,10 @@ fail:
  * get_cluster_table
  *
  * for a given disk offset, load (and allocate if needed)
- * the l2 table.
+ * the slice of the l2 table that covers it.
  *
- * the l2 table offset in the qcow2 file and the cluster index
- * in the l2 table are given to the caller.
+ * the l2 slice and the cluster index in the slice are given to the
+ * caller.
  *
  * Returns 0 on success, -errno in failure case
  */
@@ -609,29 +693,31 @@ static int get_cluster_table(BlockDriverState *bs, uint64_t offset,
 
     /* seek the l2 table of the given l2 offset */
 
-    if (s->l1_table[l1_index] & QCOW_OFLAG_COPIED) {
-        /* load the l2 table in memory */
-        ret = l2_load(bs, l2_offset, &l2_table);
-        if (ret < 0) {
-            return ret;
-        }
-    } else {
+    if (!(s->l1_table[l1_index] & QCOW_OFLAG_COPIED)) {
         /* First allocate a new L2 table (and do COW if needed) */
-        ret = l2_allocate(bs, l1_index, &l2_table);
+        ret = l2_allocate(bs, l1_index);
         if (ret < 0) {
             return ret;
         }
 
         /* Then decrease the refcount of the old table */
         if (l2_offset) {
-            qcow2_free_clusters(bs, l2_offset, s->l2_size * sizeof(uint64_t),
+            qcow2_free_clusters(bs, l2_offset, s->cluster_size,
                                 QCOW2_DISCARD_OTHER);
         }
+
+        l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    }
+
+    /* load the l2 slice in memory */
+    ret = l2_load(bs, offset, l2_offset, &l2_table);
+    if (ret < 0) {
+        return ret;
     }
 
     /* find the cluster offset for the given disk offset */
 
-    l2_index = (offset >> s->cluster_bits) & (s->l2_size - 1);
+    l2_index = offset_to_l2_slice_index(s, offset);
 
     *new_l2_table = l2_table;
     *new_l2_index = l2_index;
@@ -669,7 +755,7 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
     /* Compression can't overwrite anything. Fail if the cluster was already
      * allocated. */
-    cluster_offset = be64_to_cpu(l2_table[l2_index]);
+    cluster_offset = get_l2_entry(s, l2_table, l2_index);
     if (cluster_offset & L2E_OFFSET_MASK) {
         qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
         return 0;
@@ -693,7 +779,11 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
     BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE_COMPRESSED);
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
-    l2_table[l2_index] = cpu_to_be64(cluster_offset);
+    set_l2_entry(s, l2_table, l2_index, cluster_offset);
+    if (has_subclusters(s)) {
+        /* the bitmap is not used for compressed clusters */
+        set_l2_bitmap(s, l2_table, l2_index, 0);
+    }
     ret = qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
     if (ret < 0) {
         return 0;
@@ -702,33 +792,97 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
     return cluster_offset;
 }
 
-static int perform_cow(BlockDriverState *bs, QCowL2Meta *m, Qcow2COWRegion *r)
+/*
+ * Copies the COW regions of @m from the guest view of the image to the newly
+ * allocated clusters.  If m->data_qiov is set, the guest data that lies
+ * between the two regions is written together with them in a single request.
+ */
+static int perform_cow(BlockDriverState *bs, QCowL2Meta *m)
 {
     BDRVQcowState *s = bs->opaque;
+    Qcow2COWRegion *start = &m->cow_start;
+    Qcow2COWRegion *end = &m->cow_end;
+    size_t start_bytes = start->nb_sectors * BDRV_SECTOR_SIZE;
+    size_t end_bytes = end->nb_sectors * BDRV_SECTOR_SIZE;
+    uint8_t *start_buffer, *end_buffer;
+    QEMUIOVector qiov;
     int ret;
 
-    if (r->nb_sectors == 0) {
+    if (start->nb_sectors == 0 && end->nb_sectors == 0) {
+        assert(m->data_qiov == NULL);
         return 0;
     }
 
+    /* One buffer for both COW regions */
+    start_buffer = qemu_try_blockalign(bs, start_bytes + end_bytes);
+    if (start_buffer == NULL) {
+        return -ENOMEM;
+    }
+    end_buffer = start_buffer + start_bytes;
+
+    qemu_iovec_init(&qiov, 2 + (m->data_qiov ? m->data_qiov->niov : 0));
+
     qemu_co_mutex_unlock(&s->lock);
-    ret = copy_sectors(bs, m->offset / BDRV_SECTOR_SIZE, m->alloc_offset,
-                       r->offset / BDRV_SECTOR_SIZE,
-                       r->offset / BDRV_SECTOR_SIZE + r->nb_sectors);
-    qemu_co_mutex_lock(&s->lock);
 
+    /* First read the existing data of both COW regions */
+    ret = do_perform_cow_read(bs, m->offset, start->offset, start_buffer,
+                              start->nb_sectors);
     if (ret < 0) {
-        return ret;
+        goto fail;
     }
 
+    ret = do_perform_cow_read(bs, m->offset, end->offset, end_buffer,
+                              end->nb_sectors);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    if (s->crypt_method) {
+        qcow2_encrypt_sectors(s, (m->offset + start->offset)
+                                 >> BDRV_SECTOR_BITS,
+                              start_buffer, start_buffer, start->nb_sectors,
+                              1, &s->aes_encrypt_key);
+        qcow2_encrypt_sectors(s, (m->offset + end->offset)
+                                 >> BDRV_SECTOR_BITS,
+                              end_buffer, end_buffer, end->nb_sectors,
+                              1, &s->aes_encrypt_key);
+    }
+
+    /* Then write everything, in one request if the guest data is merged */
+    if (m->data_qiov) {
+        qemu_iovec_add(&qiov, start_buffer, start_bytes);
+        qemu_iovec_concat(&qiov, m->data_qiov, 0, m->data_qiov->size);
+        qemu_iovec_add(&qiov, end_buffer, end_bytes);
+
+        BLKDBG_EVENT(bs->file, BLKDBG_WRITE_AIO);
+        ret = do_perform_cow_write(bs, m->alloc_offset, start->offset, &qiov);
+    } else {
+        qemu_iovec_add(&qiov, start_buffer, start_bytes);
+        ret = do_perform_cow_write(bs, m->alloc_offset, start->offset, &qiov);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        qemu_iovec_reset(&qiov);
+        qemu_iovec_add(&qiov, end_buffer, end_bytes);
+        ret = do_perform_cow_write(bs, m->alloc_offset, end->offset, &qiov);
+    }
+
+fail:
+    qemu_co_mutex_lock(&s->lock);
+
     /*
      * Before we update the L2 table to actually point to the new cluster, we
      * need to be sure that the refcounts have been increased and COW was
      * handled.
      */
-    qcow2_cache_depends_on_flush(s->l2_table_cache);
+    if (ret == 0) {
+        qcow2_cache_depends_on_flush(s->l2_table_cache);
+    }
 
-    return 0;
+    qemu_vfree(start_buffer);
+    qemu_iovec_destroy(&qiov);
+    return ret;
 }
 
 int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
@@ -748,12 +902,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
     }
 
     /* copy content of unmodified sectors */
-    ret = perform_cow(bs, m, &m->cow_start);
-    if (ret < 0) {
-        goto err;
-    }
-
-    ret = perform_cow(bs, m, &m->cow_end);
+    ret = perform_cow(bs, m);
     if (ret < 0) {
         goto err;
     }
@@ -773,19 +922,43 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
     }
     qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
 
-    assert(l2_index + m->nb_clusters <= s->l2_size);
+    assert(l2_index + m->nb_clusters <= s->l2_slice_size);
     for (i = 0; i < m->nb_clusters; i++) {
+        uint64_t old_entry = get_l2_entry(s, l2_table, l2_index + i);
+
         /* if two concurrent writes happen to the same unallocated cluster
 	 * each write allocates separate cluster and writes data concurrently.
 	 * The first one to complete updates l2 table with pointer to its
 	 * cluster the second one has to do RMW (which is done above by
 	 * copy_sectors()), update l2 table with its cluster pointer and free
 	 * old cluster. This is what this loop does */
-        if(l2_table[l2_index + i] != 0)
-            old_cluster[j++] = l2_table[l2_index + i];
+        if (old_entry != 0 && !m->keep_old_clusters) {
+            old_cluster[j++] = old_entry;
+        }
 
-        l2_table[l2_index + i] = cpu_to_be64((cluster_offset +
-                    (i << s->cluster_bits)) | QCOW_OFLAG_COPIED);
+        set_l2_entry(s, l2_table, l2_index + i,
+                     (cluster_offset + (i << s->cluster_bits))
+                     | QCOW_OFLAG_COPIED);
+
+        if (has_subclusters(s)) {
+            /* Mark the subclusters that were written (guest data and COW)
+             * as allocated; the others keep their old state */
+            uint64_t l2_bitmap = get_l2_bitmap(s, l2_table, l2_index + i);
+            uint64_t written_from = MAX(m->cow_start.offset,
+                                        (uint64_t) i << s->cluster_bits);
+            uint64_t written_to = MIN(l2meta_cow_end(m) - m->offset,
+                                      (uint64_t) (i + 1) << s->cluster_bits);
+            int first_sc = offset_to_sc_index(s, written_from);
+            int last_sc = offset_to_sc_index(s, written_to - 1);
+
+            assert(written_from < written_to);
+            if (old_entry & QCOW_OFLAG_COMPRESSED) {
+                l2_bitmap = 0;
+            }
+            l2_bitmap |= QCOW_OFLAG_SUB_ALLOC_RANGE(first_sc, last_sc + 1);
+            l2_bitmap &= ~QCOW_OFLAG_SUB_ZERO_RANGE(first_sc, last_sc + 1);
+            set_l2_bitmap(s, l2_table, l2_index + i, l2_bitmap);
+        }
      }
 
 
@@ -803,7 +976,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
      */
     if (j != 0) {
         for (i = 0; i < j; i++) {
-            qcow2_free_any_clusters(bs, be64_to_cpu(old_cluster[i]), 1,
+            qcow2_free_any_clusters(bs, old_cluster[i], 1,
                                     QCOW2_DISCARD_NEVER);
         }
     }
@@ -825,7 +998,7 @@ static int count_cow_clusters(BDRVQcowState *s, int nb_clusters,
     int i;
 
     for (i = 0; i < nb_clusters; i++) {
-        uint64_t l2_entry = be64_to_cpu(l2_table[l2_index + i]);
+        uint64_t l2_entry = get_l2_entry(s, l2_table, l2_index + i);
         int cluster_type = qcow2_get_cluster_type(l2_entry);
 
         switch(cluster_type) {
@@ -848,6 +1021,131 @@ out:
     return i;
 }
 
+/*
+ * Creates a QCowL2Meta for a write of @bytes at @guest_offset to the clusters
+ * starting at @host_cluster_offset, and adds it to the list of in-flight
+ * allocations.  The write must not go beyond the L2 slice @l2_table.
+ *
+ * Without extended L2 entries, the whole clusters are copied on write.  With
+ * them, only the subclusters that the write touches partially are, plus any
+ * allocated subclusters of an old host cluster that is being replaced.
+ *
+ * If @keep_old is true, the write goes to unallocated subclusters of clusters
+ * that are already allocated at @host_cluster_offset.
+ */
+static void calculate_l2_meta(BlockDriverState *bs,
+                              uint64_t host_cluster_offset,
+                              uint64_t guest_offset, uint64_t bytes,
+                              uint64_t *l2_table, QCowL2Meta **m,
+                              bool keep_old)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t start = offset_into_cluster(s, guest_offset);
+    uint64_t end = start + bytes;
+    int nb_clusters = size_to_clusters(s, end);
+    uint64_t cow_start_from = 0;
+    uint64_t cow_end_to = (uint64_t) nb_clusters << s->cluster_bits;
+    QCowL2Meta *old_m = *m;
+
+    assert(bytes > 0);
+
+    if (has_subclusters(s)) {
+        int l2_index = offset_to_l2_slice_index(s, guest_offset);
+        uint64_t last_cluster = (uint64_t) (nb_clusters - 1) << s->cluster_bits;
+        unsigned int first_sc = offset_to_sc_index(s, guest_offset);
+        unsigned int last_sc = offset_to_sc_index(s, guest_offset + bytes - 1);
+        uint64_t entry, bitmap;
+        uint32_t alloc;
+
+        assert(l2_index + nb_clusters <= s->l2_slice_size);
+
+        /* Head of the first cluster */
+        entry = get_l2_entry(s, l2_table, l2_index);
+        bitmap = get_l2_bitmap(s, l2_table, l2_index);
+        alloc = bitmap & QCOW_L2_BITMAP_ALL_ALLOC;
+        if (entry & QCOW_OFLAG_COMPRESSED) {
+            cow_start_from = 0;
+        } else if (keep_old && (bitmap & QCOW_OFLAG_SUB_ALLOC(first_sc))) {
+            cow_start_from = start;
+        } else if (!keep_old && (entry & L2E_OFFSET_MASK)) {
+            cow_start_from = (uint64_t) MIN(first_sc, ctz32(alloc))
+                             << s->subcluster_bits;
+        } else {
+            cow_start_from = (uint64_t) first_sc << s->subcluster_bits;
+        }
+
+        /* Tail of the last cluster */
+        entry = get_l2_entry(s, l2_table, l2_index + nb_clusters - 1);
+        bitmap = get_l2_bitmap(s, l2_table, l2_index + nb_clusters - 1);
+        alloc = bitmap & QCOW_L2_BITMAP_ALL_ALLOC;
+        if (entry & QCOW_OFLAG_COMPRESSED) {
+            cow_end_to = last_cluster + s->cluster_size;
+        } else if (keep_old && (bitmap & QCOW_OFLAG_SUB_ALLOC(last_sc))) {
+            cow_end_to = end;
+        } else if (!keep_old && (entry & L2E_OFFSET_MASK) && alloc) {
+            cow_end_to = last_cluster +
+                ((uint64_t) (MAX(last_sc, 31 - clz32(alloc)) + 1)
+                 << s->subcluster_bits);
+        } else {
+            cow_end_to = last_cluster +
+                ((uint64_t) (last_sc + 1) << s->subcluster_bits);
+        }
+    }
+
+    *m = g_malloc0(sizeof(**m));
+
+    **m = (QCowL2Meta) {
+        .next           = old_m,
+
+        .alloc_offset   = host_cluster_offset,
+        .offset         = start_of_cluster(s, guest_offset),
+        .nb_clusters    = nb_clusters,
+        .nb_available   = end >> BDRV_SECTOR_BITS,
+
+        .keep_old_clusters = keep_old,
+
+        .cow_start = {
+            .offset     = cow_start_from,
+            .nb_sectors = (start - cow_start_from) >> BDRV_SECTOR_BITS,
+        },
+        .cow_end = {
+            .offset     = end,
+            .nb_sectors = (cow_end_to - end) >> BDRV_SECTOR_BITS,
+        },
+    };
+    qemu_co_queue_init(&(*m)->dependent_requests);
+    QLIST_INSERT_HEAD(&s->cluster_allocs, *m, next_in_flight);
+}
+
+/*
+ * Returns true if any subcluster that a write of @bytes at @guest_offset
+ * touches is not allocated yet.  The write must not go beyond the L2 slice
+ * @l2_table.
+ */
+static bool needs_subcluster_alloc(BDRVQcowState *s, uint64_t guest_offset,
+                                   uint64_t bytes, uint64_t *l2_table)
+{
+    int l2_index = offset_to_l2_slice_index(s, guest_offset);
+    uint64_t start = offset_into_cluster(s, guest_offset);
+    uint64_t end = start + bytes;
+    int nb_clusters = size_to_clusters(s, end);
+    int i;
+
+    for (i = 0; i < nb_clusters; i++) {
+        uint64_t from = MAX(start, (uint64_t) i << s->cluster_bits);
+        uint64_t to = MIN(end, (uint64_t) (i + 1) << s->cluster_bits);
+        int first_sc = offset_to_sc_index(s, from);
+        int last_sc = offset_to_sc_index(s, to - 1);
+        uint64_t range = QCOW_OFLAG_SUB_ALLOC_RANGE(first_sc, last_sc + 1);
+
+        if ((get_l2_bitmap(s, l2_table, l2_index + i) & range) != range) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /*
  * Check if there already is an AIO write request in flight which allocates
  * the same cluster. In this case we need to wait until the previous
@@ -873,8 +1171,11 @@ static int handle_dependencies(BlockDriverState *bs, uint64_t guest_offset,
 
         uint64_t start = guest_offset;
         uint64_t end = start + bytes;
-        uint64_t old_start = l2meta_cow_start(old_alloc);
-        uint64_t old_end = l2meta_cow_end(old_alloc);
+        /* Whole clusters, because with extended L2 entries the COW regions
+         * may not cover the clusters that the allocation links */
+        uint64_t old_start = start_of_cluster(s, l2meta_cow_start(old_alloc));
+        uint64_t old_end = align_offset(l2meta_cow_end(old_alloc),
+                                        s->cluster_size);
 
         if (end <= old_start || start >= old_end) {
             /* No intersection */
@@ -953,14 +1254,14 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
                                 == offset_into_cluster(s, *host_offset));
 
     /*
-     * Calculate the number of clusters to look for. We stop at L2 table
+     * Calculate the number of clusters to look for. We stop at L2 slice
      * boundaries to keep things simple.
      */
     nb_clusters =
         size_to_clusters(s, offset_into_cluster(s, guest_offset) + *bytes);
 
-    l2_index = offset_to_l2_index(s, guest_offset);
-    nb_clusters = MIN(nb_clusters, s->l2_size - l2_index);
+    l2_index = offset_to_l2_slice_index(s, guest_offset);
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
 
     /* Find L2 entry for the first involved cluster */
     ret = get_cluster_table(bs, guest_offset, &l2_table, &l2_index);
@@ -968,7 +1269,7 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
         return ret;
     }
 
-    cluster_offset = be64_to_cpu(l2_table[l2_index]);
+    cluster_offset = get_l2_entry(s, l2_table, l2_index);
 
     /* Check how many clusters are already allocated and don't need COW */
     if (qcow2_get_cluster_type(cluster_offset) == QCOW2_CLUSTER_NORMAL
@@ -995,8 +1296,7 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
 
         /* We keep all QCOW_OFLAG_COPIED clusters */
         keep_clusters =
-            count_contiguous_clusters(nb_clusters, s->cluster_size,
-                                      &l2_table[l2_index],
+            count_contiguous_clusters(s, nb_clusters, l2_table, l2_index,
                                       QCOW_OFLAG_COPIED | QCOW_OFLAG_ZERO);
         assert(keep_clusters <= nb_clusters);
 
@@ -1004,6 +1304,14 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
                  keep_clusters * s->cluster_size
                  - offset_into_cluster(s, guest_offset));
 
+        /* Writes to subclusters that aren't allocated yet go to the same
+         * host clusters, but must update the L2 bitmap afterwards */
+        if (has_subclusters(s) &&
+            needs_subcluster_alloc(s, guest_offset, *bytes, l2_table)) {
+            calculate_l2_meta(bs, cluster_offset & L2E_OFFSET_MASK,
+                              guest_offset, *bytes, l2_table, m, true);
+        }
+
         ret = 1;
     } else {
         ret = 0;
@@ -1101,7 +1409,7 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     uint64_t *l2_table;
     uint64_t entry;
     unsigned int nb_clusters;
-    int ret;
+    int ret, pret;
 
     uint64_t alloc_cluster_offset;
 
@@ -1110,14 +1418,14 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     assert(*bytes > 0);
 
     /*
-     * Calculate the number of clusters to look for. We stop at L2 table
+     * Calculate the number of clusters to look for. We stop at L2 slice
      * boundaries to keep things simple.
      */
     nb_clusters =
         size_to_clusters(s, offset_into_cluster(s, guest_offset) + *bytes);
 
-    l2_index = offset_to_l2_index(s, guest_offset);
-    nb_clusters = MIN(nb_clusters, s->l2_size - l2_index);
+    l2_index = offset_to_l2_slice_index(s, guest_offset);
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
 
     /* Find L2 entry for the first involved cluster */
     ret = get_cluster_table(bs, guest_offset, &l2_table, &l2_index);
@@ -1125,7 +1433,7 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
         return ret;
     }
 
-    entry = be64_to_cpu(l2_table[l2_index]);
+    entry = get_l2_entry(s, l2_table, l2_index);
 
     /* For the moment, overwrite compressed clusters one by one */
     if (entry & QCOW_OFLAG_COMPRESSED) {
@@ -1139,12 +1447,8 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
      * wrong with our code. */
     assert(nb_clusters > 0);
 
-    ret = qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
-    if (ret < 0) {
-        return ret;
-    }
-
-    /* Allocate, if necessary at a given offset in the image file */
+    /* Allocate, if necessary at a given offset in the image file.  The L2
+     * slice stays referenced: calculate_l2_meta() needs the old entries. */
     alloc_cluster_offset = start_of_cluster(s, *host_offset);
     ret = do_alloc_cluster_offset(bs, guest_offset, &alloc_cluster_offset,
                                   &nb_clusters);
@@ -1155,7 +1459,8 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     /* Can't extend contiguous allocation */
     if (nb_clusters == 0) {
         *bytes = 0;
-        return 0;
+        ret = 0;
+        goto out;
     }
 
     /* !*host_offset would overwrite the image header and is reserved for "no
@@ -1170,59 +1475,29 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     }
 
     /*
-     * Save info needed for meta data update.
-     *
-     * requested_sectors: Number of sectors from the start of the first
-     * newly allocated cluster to the end of the (possibly shortened
-     * before) write request.
-     *
-     * avail_sectors: Number of sectors from the start of the first
-     * newly allocated to the end of the last newly allocated cluster.
-     *
-     * nb_sectors: The number of sectors from the start of the first
-     * newly allocated cluster to the end of the area that the write
-     * request actually writes to (excluding COW at the end)
+     * Save info needed for meta data update. The write covers the newly
+     * allocated clusters up to the end of the (possibly shortened before)
+     * write request.
      */
-    int requested_sectors =
-        (*bytes + offset_into_cluster(s, guest_offset))
-        >> BDRV_SECTOR_BITS;
-    int avail_sectors = nb_clusters
-                        << (s->cluster_bits - BDRV_SECTOR_BITS);
-    int alloc_n_start = offset_into_cluster(s, guest_offset)
-                        >> BDRV_SECTOR_BITS;
-    int nb_sectors = MIN(requested_sectors, avail_sectors);
-    QCowL2Meta *old_m = *m;
-
-    *m = g_malloc0(sizeof(**m));
-
-    **m = (QCowL2Meta) {
-        .next           = old_m,
-
-        .alloc_offset   = alloc_cluster_offset,
-        .offset         = start_of_cluster(s, guest_offset),
-        .nb_clusters    = nb_clusters,
-        .nb_available   = nb_sectors,
+    *bytes = MIN(*bytes, ((uint64_t) nb_clusters << s->cluster_bits)
+                         - offset_into_cluster(s, guest_offset));
+    assert(*bytes != 0);
 
-        .cow_start = {
-            .offset     = 0,
-            .nb_sectors = alloc_n_start,
-        },
-        .cow_end = {
-            .offset     = nb_sectors * BDRV_SECTOR_SIZE,
-            .nb_sectors = avail_sectors - nb_sectors,
-        },
-    };
-    qemu_co_queue_init(&(*m)->dependent_requests);
-    QLIST_INSERT_HEAD(&s->cluster_allocs, *m, next_in_flight);
+    calculate_l2_meta(bs, alloc_cluster_offset, guest_offset, *bytes,
+                      l2_table, m, false);
 
     *host_offset = alloc_cluster_offset + offset_into_cluster(s, guest_offset);
-    *bytes = MIN(*bytes, (nb_sectors * BDRV_SECTOR_SIZE)
-                         - offset_into_cluster(s, guest_offset));
-    assert(*bytes != 0);
+    ret = 1;
 
-    return 1;
+out:
+    pret = qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
+    if (pret < 0) {
+        return pret;
+    }
+    return ret;
 
 fail:
+    qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
     if (*m && (*m)->nb_clusters > 0) {
         QLIST_REMOVE(*m, next_in_flight);
     }
@@ -1410,7 +1685,7 @@ int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset)
 
 /*
  * This discards as many clusters of nb_clusters as possible at once (i.e.
- * all clusters in the same L2 table) and returns the number of discarded
+ * all clusters in the same L2 slice) and returns the number of discarded
  * clusters.
  */
 static int discard_single_l2(BlockDriverState *bs, uint64_t offset,
@@ -1427,13 +1702,15 @@ static int discard_single_l2(BlockDriverState *bs, uint64_t offset,
         return ret;
     }
 
-    /* Limit nb_clusters to one L2 table */
-    nb_clusters = MIN(nb_clusters, s->l2_size - l2_index);
+    /* Limit nb_clusters to one L2 slice */
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
 
     for (i = 0; i < nb_clusters; i++) {
-        uint64_t old_l2_entry;
+        uint64_t old_l2_entry, old_l2_bitmap, new_l2_bitmap;
 
-        old_l2_entry = be64_to_cpu(l2_table[l2_index + i]);
+        old_l2_entry = get_l2_entry(s, l2_table, l2_index + i);
+        old_l2_bitmap = get_l2_bitmap(s, l2_table, l2_index + i);
+        new_l2_bitmap = full_discard ? 0 : QCOW_L2_BITMAP_ALL_ZEROES;
 
         /*
          * If full_discard is false, make sure that a discarded area reads back
@@ -1447,7 +1724,21 @@ static int discard_single_l2(BlockDriverState *bs, uint64_t offset,
          *
          * If full_discard is true, the sector should not read back as zeroes,
          * but rather fall through to the backing file.
+         *
+         * With extended L2 entries, unallocated clusters may have zero
+         * subclusters, so only their bitmap may need an update.
          */
+        if (has_subclusters(s) &&
+            qcow2_get_cluster_type(old_l2_entry) == QCOW2_CLUSTER_UNALLOCATED)
+        {
+            if (old_l2_bitmap != new_l2_bitmap &&
+                (full_discard || bs->backing_hd)) {
+                qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
+                set_l2_bitmap(s, l2_table, l2_index + i, new_l2_bitmap);
+            }
+            continue;
+        }
+
         switch (qcow2_get_cluster_type(old_l2_entry)) {
             case QCOW2_CLUSTER_UNALLOCATED:
                 if (full_discard || !bs->backing_hd) {
@@ -1471,10 +1762,13 @@ static int discard_single_l2(BlockDriverState *bs, uint64_t offset,
 
         /* First remove L2 entries */
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
-        if (!full_discard && s->qcow_version >= 3) {
-            l2_table[l2_index + i] = cpu_to_be64(QCOW_OFLAG_ZERO);
+        if (has_subclusters(s)) {
+            set_l2_entry(s, l2_table, l2_index + i, 0);
+            set_l2_bitmap(s, l2_table, l2_index + i, new_l2_bitmap);
+        } else if (!full_discard && s->qcow_version >= 3) {
+            set_l2_entry(s, l2_table, l2_index + i, QCOW_OFLAG_ZERO);
         } else {
-            l2_table[l2_index + i] = cpu_to_be64(0);
+            set_l2_entry(s, l2_table, l2_index + i, 0);
         }
 
         /* Then decrease the refcount */
@@ -1532,7 +1826,7 @@ fail:
 
 /*
  * This zeroes as many clusters of nb_clusters as possible at once (i.e.
- * all clusters in the same L2 table) and returns the number of zeroed
+ * all clusters in the same L2 slice) and returns the number of zeroed
  * clusters.
  */
 static int zero_single_l2(BlockDriverState *bs, uint64_t offset,
@@ -1549,21 +1843,31 @@ static int zero_single_l2(BlockDriverState *bs, uint64_t offset,
         return ret;
     }
 
-    /* Limit nb_clusters to one L2 table */
-    nb_clusters = MIN(nb_clusters, s->l2_size - l2_index);
+    /* Limit nb_clusters to one L2 slice */
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
 
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_offset;
 
-        old_offset = be64_to_cpu(l2_table[l2_index + i]);
+        old_offset = get_l2_entry(s, l2_table, l2_index + i);
 
         /* Update L2 entries */
         qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
-        if (old_offset & QCOW_OFLAG_COMPRESSED) {
-            l2_table[l2_index + i] = cpu_to_be64(QCOW_OFLAG_ZERO);
+        if (has_subclusters(s)) {
+            /* The host cluster (if any) stays allocated for later writes */
+            if (old_offset & QCOW_OFLAG_COMPRESSED) {
+                set_l2_entry(s, l2_table, l2_index + i, 0);
+                qcow2_free_any_clusters(bs, old_offset, 1,
+                                        QCOW2_DISCARD_REQUEST);
+            }
+            set_l2_bitmap(s, l2_table, l2_index + i,
+                          QCOW_L2_BITMAP_ALL_ZEROES);
+        } else if (old_offset & QCOW_OFLAG_COMPRESSED) {
+            set_l2_entry(s, l2_table, l2_index + i, QCOW_OFLAG_ZERO);
             qcow2_free_any_clusters(bs, old_offset, 1, QCOW2_DISCARD_REQUEST);
         } else {
-            l2_table[l2_index + i] |= cpu_to_be64(QCOW_OFLAG_ZERO);
+            set_l2_entry(s, l2_table, l2_index + i,
+                         old_offset | QCOW_OFLAG_ZERO);
         }
     }
 
@@ -1625,6 +1929,7 @@ static int expand_zero_clusters_in_l1(BlockDriverState *bs, uint64_t *l1_table,
     BDRVQcowState *s = bs->opaque;
     bool is_active_l1 = (l1_table == s->l1_table);
     uint64_t *l2_table = NULL;
+    unsigned int slice, slice_entries, slice_size2, n_slices;
     int ret;
     int i, j;
 
@@ -1637,9 +1942,16 @@ static int expand_zero_clusters_in_l1(BlockDriverState *bs, uint64_t *l1_table,
         }
     }
 
+    if (is_active_l1) {
+        slice_entries = s->l2_slice_size;
+    } else {
+        slice_entries = s->l2_size;
+    }
+    slice_size2 = slice_entries * sizeof(uint64_t);
+    n_slices = s->cluster_size / slice_size2;
+
     for (i = 0; i < l1_size; i++) {
         uint64_t l2_offset = l1_table[i] & L1E_OFFSET_MASK;
-        bool l2_dirty = false;
         int l2_refcount;
 
         if (!l2_offset) {
@@ -1651,116 +1963,125 @@ static int expand_zero_clusters_in_l1(BlockDriverState *bs, uint64_t *l1_table,
             continue;
         }
 
-        if (is_active_l1) {
-            /* get active L2 tables from cache */
-            ret = qcow2_cache_get(bs, s->l2_table_cache, l2_offset,
-                    (void **)&l2_table);
-        } else {
-            /* load inactive L2 tables from disk */
-            ret = bdrv_read(bs->file, l2_offset / BDRV_SECTOR_SIZE,
-                    (void *)l2_table, s->cluster_sectors);
-        }
-        if (ret < 0) {
-            goto fail;
-        }
-
         l2_refcount = qcow2_get_refcount(bs, l2_offset >> s->cluster_bits);
         if (l2_refcount < 0) {
             ret = l2_refcount;
             goto fail;
         }
 
-        for (j = 0; j < s->l2_size; j++) {
-            uint64_t l2_entry = be64_to_cpu(l2_table[j]);
-            int64_t offset = l2_entry & L2E_OFFSET_MASK;
-            int cluster_type = qcow2_get_cluster_type(l2_entry);
-            bool preallocated = offset != 0;
+        /* active L2 tables are accessed through the cache one slice at a
+         * time, inactive ones are read from disk as a whole */
+        for (slice = 0; slice < n_slices; slice++) {
+            bool l2_dirty = false;
 
-            if (cluster_type != QCOW2_CLUSTER_ZERO) {
-                continue;
+            if (is_active_l1) {
+                /* get active L2 tables from cache */
+                ret = qcow2_cache_get(bs, s->l2_table_cache,
+                        l2_offset + slice * slice_size2, (void **)&l2_table);
+            } else {
+                /* load inactive L2 tables from disk */
+                ret = bdrv_read(bs->file, l2_offset / BDRV_SECTOR_SIZE,
+                        (void *)l2_table, s->cluster_sectors);
+            }
+            if (ret < 0) {
+                goto fail;
             }
 
-            if (!preallocated) {
-                if (!bs->backing_hd) {
-                    /* not backed; therefore we can simply deallocate the
-                     * cluster */
-                    l2_table[j] = 0;
-                    l2_dirty = true;
+            for (j = 0; j < slice_entries; j++) {
+                uint64_t l2_entry = be64_to_cpu(l2_table[j]);
+                int64_t offset = l2_entry & L2E_OFFSET_MASK;
+                int cluster_type = qcow2_get_cluster_type(l2_entry);
+                bool preallocated = offset != 0;
+
+                if (cluster_type != QCOW2_CLUSTER_ZERO) {
                     continue;
                 }
 
-                offset = qcow2_alloc_clusters(bs, s->cluster_size);
-                if (offset < 0) {
-                    ret = offset;
-                    goto fail;
-                }
+                if (!preallocated) {
+                    if (!bs->backing_hd) {
+                        /* not backed; therefore we can simply deallocate the
+                         * cluster */
+                        l2_table[j] = 0;
+                        l2_dirty = true;
+                        continue;
+                    }
 
-                if (l2_refcount > 1) {
-                    /* For shared L2 tables, set the refcount accordingly (it is
-                     * already 1 and needs to be l2_refcount) */
-                    ret = qcow2_update_cluster_refcount(bs,
-                            offset >> s->cluster_bits, l2_refcount - 1,
-                            QCOW2_DISCARD_OTHER);
-                    if (ret < 0) {
-                        qcow2_free_clusters(bs, offset, s->cluster_size,
-                                            QCOW2_DISCARD_OTHER);
+                    offset = qcow2_alloc_clusters(bs, s->cluster_size);
+                    if (offset < 0) {
+                        ret = offset;
                         goto fail;
                     }
+
+                    if (l2_refcount > 1) {
+                        /* For shared L2 tables, set the refcount accordingly
+                         * (it is already 1 and needs to be l2_refcount) */
+                        ret = qcow2_update_cluster_refcount(bs,
+                                offset >> s->cluster_bits, l2_refcount - 1,
+                                QCOW2_DISCARD_OTHER);
+                        if (ret < 0) {
+                            qcow2_free_clusters(bs, offset, s->cluster_size,
+                                                QCOW2_DISCARD_OTHER);
+                            goto fail;
+                        }
+                    }
                 }
-            }
 
-            ret = qcow2_pre_write_overlap_check(bs, 0, offset, s->cluster_size);
-            if (ret < 0) {
-                if (!preallocated) {
-                    qcow2_free_clusters(bs, offset, s->cluster_size,
-                                        QCOW2_DISCARD_ALWAYS);
+                ret = qcow2_pre_write_overlap_check(bs, 0, offset,
+                                                    s->cluster_size);
+                if (ret < 0) {
+                    if (!preallocated) {
+                        qcow2_free_clusters(bs, offset, s->cluster_size,
+                                            QCOW2_DISCARD_ALWAYS);
+                    }
+                    goto fail;
                 }
-                goto fail;
-            }
 
-            ret = bdrv_write_zeroes(bs->file, offset / BDRV_SECTOR_SIZE,
-                                    s->cluster_sectors, 0);
-            if (ret < 0) {
-                if (!preallocated) {
-                    qcow2_free_clusters(bs, offset, s->cluster_size,
-                                        QCOW2_DISCARD_ALWAYS);
+                ret = bdrv_write_zeroes(bs->file, offset / BDRV_SECTOR_SIZE,
+                                        s->cluster_sectors, 0);
+                if (ret < 0) {
+                    if (!preallocated) {
+                        qcow2_free_clusters(bs, offset, s->cluster_size,
+                                            QCOW2_DISCARD_ALWAYS);
+                    }
+                    goto fail;
                 }
-                goto fail;
-            }
 
-            if (l2_refcount == 1) {
-                l2_table[j] = cpu_to_be64(offset | QCOW_OFLAG_COPIED);
-            } else {
-                l2_table[j] = cpu_to_be64(offset);
+                if (l2_refcount == 1) {
+                    l2_table[j] = cpu_to_be64(offset | QCOW_OFLAG_COPIED);
+                } else {
+                    l2_table[j] = cpu_to_be64(offset);
+                }
+                l2_dirty = true;
             }
-            l2_dirty = true;
-        }
 
-        if (is_active_l1) {
-            if (l2_dirty) {
-                qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
-                qcow2_cache_depends_on_flush(s->l2_table_cache);
-            }
-            ret = qcow2_cache_put(bs, s->l2_table_cache, (void **)&l2_table);
-            if (ret < 0) {
-                l2_table = NULL;
-                goto fail;
-            }
-        } else {
-            if (l2_dirty) {
-                ret = qcow2_pre_write_overlap_check(bs,
-                        QCOW2_OL_INACTIVE_L2 | QCOW2_OL_ACTIVE_L2, l2_offset,
-                        s->cluster_size);
+            if (is_active_l1) {
+                if (l2_dirty) {
+                    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
+                    qcow2_cache_depends_on_flush(s->l2_table_cache);
+                }
+                ret = qcow2_cache_put(bs, s->l2_table_cache,
+                                      (void **)&l2_table);
                 if (ret < 0) {
+                    l2_table = NULL;
                     goto fail;
                 }
+            } else {
+                if (l2_dirty) {
+                    ret = qcow2_pre_write_overlap_check(bs,
+                            QCOW2_OL_INACTIVE_L2 | QCOW2_OL_ACTIVE_L2,
+                            l2_offset, s->cluster_size);
+                    if (ret < 0) {
+                        goto fail;
+                    }
 
-                ret = bdrv_write(bs->file, l2_offset / BDRV_SECTOR_SIZE,
-                        (void *)l2_table, s->cluster_sectors);
-                if (ret < 0) {
-                    goto fail;
+                    ret = bdrv_write(bs->file, l2_offset / BDRV_SECTOR_SIZE,
+                            (void *)l2_table, s->cluster_sectors);
+                    if (ret < 0) {
+                        goto fail;
+                    }
                 }
             }
+
         }
 
         (*visited_l1_entries)++;
@@ -1802,6 +2123,9 @@ int qcow2_expand_zero_clusters(BlockDriverState *bs,
     int ret;
     int i, j;
 
+    /* Extended L2 entries need version 3 anyway */
+    assert(!has_subclusters(s));
+
     if (status_cb) {
         l1_entries = s->l1_size;
         for (i = 0; i < s->nb_snapshots; i++) {
@@ -879,12 +879,16 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     uint64_t *l1_table, *l2_table, l2_offset, offset, l1_size2;
     bool l1_allocated = false;
     int64_t old_offset, old_l2_offset;
+    unsigned int slice, slice_size2, n_slices;
     int i, j, l1_modified = 0, nb_csectors, refcount;
+    int64_t run_start = 0, run_len = 0;
     int ret;
 
     l2_table = NULL;
     l1_table = NULL;
     l1_size2 = l1_size * sizeof(uint64_t);
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
+    n_slices = s->cluster_size / slice_size2;
 
     s->cache_discards = true;
 
@@ -926,20 +930,21 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                 goto fail;
             }
 
-            ret = qcow2_cache_get(bs, s->l2_table_cache, l2_offset,
-                (void**) &l2_table);
-            if (ret < 0) {
-                goto fail;
-            }
+            for (slice = 0; slice < n_slices; slice++) {
+                ret = qcow2_cache_get(bs, s->l2_table_cache,
+                    l2_offset + slice * slice_size2, (void**) &l2_table);
+                if (ret < 0) {
+                    goto fail;
+                }
 
-            for(j = 0; j < s->l2_size; j++) {
-                uint64_t cluster_index;
+                for (j = 0; j < s->l2_slice_size; j++) {
+                    uint64_t cluster_index;
 
-                offset = be64_to_cpu(l2_table[j]);
-                old_offset = offset;
-                offset &= ~QCOW_OFLAG_COPIED;
+                    offset = get_l2_entry(s, l2_table, j);
+                    old_offset = offset;
+                    offset &= ~QCOW_OFLAG_COPIED;
 
-                switch (qcow2_get_cluster_type(offset)) {
+                    switch (qcow2_get_cluster_type(offset)) {
                     case QCOW2_CLUSTER_COMPRESSED:
                         nb_csectors = ((offset >> s->csize_shift) &
                                        s->csize_mask) + 1;
@@ -958,29 +963,53 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
 
                     case QCOW2_CLUSTER_NORMAL:
                     case QCOW2_CLUSTER_ZERO:
-                        if (offset_into_cluster(s, offset & L2E_OFFSET_MASK)) {
-                            qcow2_signal_corruption(bs, true, -1, -1, "Data "
-                                                    "cluster offset %#llx "
-                                                    "unaligned (L2 offset: %#"
-                                                    PRIx64 ", L2 index: %#x)",
-                                                    offset & L2E_OFFSET_MASK,
-                                                    l2_offset, j);
+                        if (offset_into_cluster(s,
+                                                offset & L2E_OFFSET_MASK)) {
+                            qcow2_signal_corruption(bs, true, -1, -1,
+                                "Data cluster offset %#llx unaligned "
+                                "(L2 offset: %#" PRIx64 ", L2 index: %#x)",
+                                offset & L2E_OFFSET_MASK, l2_offset,
+                                slice * s->l2_slice_size + j);
                             ret = -EIO;
                             goto fail;
                         }
 
-                        cluster_index = (offset & L2E_OFFSET_MASK) >> s->cluster_bits;
+                        cluster_index =
+                            (offset & L2E_OFFSET_MASK) >> s->cluster_bits;
                         if (!cluster_index) {
                             /* unallocated */
                             refcount = 0;
                             break;
                         }
-                        if (addend != 0) {
+                        if (addend > 0) {
+                            /* Collect contiguous clusters into one
+                             * update_refcount() call instead of a
+                             * refcount update and lookup per cluster.
+                             * The cluster is referenced from two L1
+                             * tables now, so its refcount is at least 2.
+                             */
+                            if (run_len &&
+                                cluster_index == run_start + run_len) {
+                                run_len++;
+                            } else {
+                                ret = update_refcount(bs,
+                                    run_start << s->cluster_bits,
+                                    run_len << s->cluster_bits, addend,
+                                    QCOW2_DISCARD_SNAPSHOT);
+                                if (ret < 0) {
+                                    goto fail;
+                                }
+                                run_start = cluster_index;
+                                run_len = 1;
+                            }
+                            refcount = 2;
+                        } else if (addend != 0) {
                             refcount = qcow2_update_cluster_refcount(bs,
                                     cluster_index, addend,
                                     QCOW2_DISCARD_SNAPSHOT);
                         } else {
-                            refcount = qcow2_get_refcount(bs, cluster_index);
+                            refcount = qcow2_get_refcount(bs,
+                                                          cluster_index);
                         }
 
                         if (refcount < 0) {
@@ -995,24 +1024,36 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
 
                     default:
                         abort();
-                }
+                    }
 
-                if (refcount == 1) {
-                    offset |= QCOW_OFLAG_COPIED;
-                }
-                if (offset != old_offset) {
-                    if (addend > 0) {
-                        qcow2_cache_set_dependency(bs, s->l2_table_cache,
-                            s->refcount_block_cache);
+                    if (refcount == 1) {
+                        offset |= QCOW_OFLAG_COPIED;
+                    }
+                    if (offset != old_offset) {
+                        if (addend > 0) {
+                            qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                s->refcount_block_cache);
+                        }
+                        set_l2_entry(s, l2_table, j, offset);
+                        qcow2_cache_entry_mark_dirty(s->l2_table_cache,
+                                                     l2_table);
                     }
-                    l2_table[j] = cpu_to_be64(offset);
-                    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
                 }
-            }
 
-            ret = qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
-            if (ret < 0) {
-                goto fail;
+                /* Flush the last run before the L2 slice may be evicted */
+                ret = update_refcount(bs, run_start << s->cluster_bits,
+                                      run_len << s->cluster_bits, addend,
+                                      QCOW2_DISCARD_SNAPSHOT);
+                if (ret < 0) {
+                    goto fail;
+                }
+                run_len = 0;
+
+                ret = qcow2_cache_put(bs, s->l2_table_cache,
+                                      (void**) &l2_table);
+                if (ret < 0) {
+                    goto fail;
+                }
             }
 
 
@@ -1129,6 +1170,73 @@ enum {
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
 };
 
+/* Number of L2 tables check_refcounts_l1() keeps in flight at once */
+#define CHECK_L2_READ_BATCH 64
+
+/* Progress of the L1/L2 scan, counted in L1 entries */
+typedef struct Qcow2CheckProgress {
+    BlockDriverCheckStatusCB *status_cb;
+    int64_t done;
+    int64_t total;
+} Qcow2CheckProgress;
+
+typedef struct CheckL2Read {
+    QEMUIOVector qiov;
+    struct iovec iov;
+    int ret;
+    int *in_flight;
+} CheckL2Read;
+
+static void check_l2_read_cb(void *opaque, int ret)
+{
+    CheckL2Read *req = opaque;
+
+    req->ret = ret;
+    (*req->in_flight)--;
+}
+
+/*
+ * Reads the L2 tables at @l2_offsets[0..@count) into consecutive clusters of
+ * @buf, with all requests in flight at the same time.  The result of each
+ * read is stored in @reqs[i].ret.
+ */
+static void read_l2_tables(BlockDriverState *bs, CheckL2Read *reqs,
+                           const uint64_t *l2_offsets, uint8_t *buf,
+                           int count)
+{
+    BDRVQcowState *s = bs->opaque;
+    AioContext *aio_context = bdrv_get_aio_context(bs);
+    int i, in_flight = 0;
+
+    for (i = 0; i < count; i++) {
+        CheckL2Read *req = &reqs[i];
+
+        req->iov.iov_base = buf + i * s->cluster_size;
+        req->iov.iov_len = s->cluster_size;
+
+        /* aio_poll() must not be called in coroutine context */
+        if (qemu_in_coroutine()) {
+            req->ret = bdrv_pread(bs->file, l2_offsets[i], req->iov.iov_base,
+                                  s->cluster_size);
+            continue;
+        }
+
+        qemu_iovec_init_external(&req->qiov, &req->iov, 1);
+        req->in_flight = &in_flight;
+        in_flight++;
+        if (!bdrv_aio_readv(bs->file, l2_offsets[i] >> BDRV_SECTOR_BITS,
+                            &req->qiov, s->cluster_sectors,
+                            check_l2_read_cb, req)) {
+            req->ret = -EIO;
+            in_flight--;
+        }
+    }
+
+    while (in_flight > 0) {
+        aio_poll(aio_context, true);
+    }
+}
+
 /*
  * Increases the refcount in the given refcount table for the all clusters
  * referenced in the L2 table. While doing so, performs some checks on L2
@@ -1138,28 +1246,17 @@ enum {
  * error occurred.
  */
 static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
-    uint16_t **refcount_table, int64_t *refcount_table_size, int64_t l2_offset,
-    int flags)
+    uint16_t **refcount_table, int64_t *refcount_table_size,
+    uint64_t *l2_table, int flags)
 {
     BDRVQcowState *s = bs->opaque;
-    uint64_t *l2_table, l2_entry;
+    uint64_t l2_entry;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, ret;
-
-    /* Read L2 table from disk */
-    l2_size = s->l2_size * sizeof(uint64_t);
-    l2_table = g_malloc(l2_size);
-
-    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        goto fail;
-    }
+    int i, nb_csectors, ret;
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
-        l2_entry = be64_to_cpu(l2_table[i]);
+        l2_entry = get_l2_entry(s, l2_table, i);
 
         switch (qcow2_get_cluster_type(l2_entry)) {
         case QCOW2_CLUSTER_COMPRESSED:
@@ -1179,7 +1276,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
             ret = inc_refcounts(bs, res, refcount_table, refcount_table_size,
                                 l2_entry & ~511, nb_csectors * 512);
             if (ret < 0) {
-                goto fail;
+                return ret;
             }
 
             if (flags & CHECK_FRAG_INFO) {
@@ -1218,7 +1315,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
             ret = inc_refcounts(bs, res, refcount_table, refcount_table_size,
                                 offset, s->cluster_size);
             if (ret < 0) {
-                goto fail;
+                return ret;
             }
 
             /* Correct offsets are cluster aligned */
@@ -1238,12 +1335,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
-    g_free(l2_table);
     return 0;
-
-fail:
-    g_free(l2_table);
-    return ret;
 }
 
 /*
@@ -1251,6 +1343,9 @@ fail:
  * clusters in the given refcount table. While doing so, performs some checks
  * on L1 and L2 entries.
  *
+ * The L2 tables are read in batches of CHECK_L2_READ_BATCH concurrent
+ * requests; progress is reported in L1 entries through @progress.
+ *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
@@ -1259,11 +1354,14 @@ static int check_refcounts_l1(BlockDriverState *bs,
                               uint16_t **refcount_table,
                               int64_t *refcount_table_size,
                               int64_t l1_table_offset, int l1_size,
-                              int flags)
+                              int flags, Qcow2CheckProgress *progress)
 {
     BDRVQcowState *s = bs->opaque;
     uint64_t *l1_table = NULL, l2_offset, l1_size2;
-    int i, ret;
+    uint64_t l2_offsets[CHECK_L2_READ_BATCH];
+    CheckL2Read reqs[CHECK_L2_READ_BATCH];
+    uint8_t *l2_buf = NULL;
+    int i, j, batch, ret;
 
     l1_size2 = l1_size * sizeof(uint64_t);
 
@@ -1292,12 +1390,36 @@ static int check_refcounts_l1(BlockDriverState *bs,
             be64_to_cpus(&l1_table[i]);
     }
 
+    if (l1_size > 0) {
+        l2_buf = g_try_malloc(CHECK_L2_READ_BATCH * s->cluster_size);
+        if (l2_buf == NULL) {
+            ret = -ENOMEM;
+            res->check_errors++;
+            goto fail;
+        }
+    }
+
     /* Do the actual checks */
-    for(i = 0; i < l1_size; i++) {
-        l2_offset = l1_table[i];
-        if (l2_offset) {
+    for (i = 0; i < l1_size; i = j) {
+        int batch_start = i;
+
+        /* Read the next batch of L2 tables all at once */
+        for (j = i, batch = 0; j < l1_size && batch < CHECK_L2_READ_BATCH;
+             j++)
+        {
+            if (l1_table[j]) {
+                l2_offsets[batch++] = l1_table[j] & L1E_OFFSET_MASK;
+            }
+        }
+        read_l2_tables(bs, reqs, l2_offsets, l2_buf, batch);
+
+        for (batch = 0; i < j; i++) {
+            if (!l1_table[i]) {
+                continue;
+            }
+
             /* Mark L2 table as used */
-            l2_offset &= L1E_OFFSET_MASK;
+            l2_offset = l2_offsets[batch];
             ret = inc_refcounts(bs, res, refcount_table, refcount_table_size,
                                 l2_offset, s->cluster_size);
             if (ret < 0) {
@@ -1311,18 +1433,36 @@ static int check_refcounts_l1(BlockDriverState *bs,
                 res->corruptions++;
             }
 
+            if (reqs[batch].ret < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                ret = reqs[batch].ret;
+                goto fail;
+            }
+
             /* Process and check L2 entries */
             ret = check_refcounts_l2(bs, res, refcount_table,
-                                     refcount_table_size, l2_offset, flags);
+                                     refcount_table_size,
+                                     (uint64_t *)(l2_buf +
+                                                  batch * s->cluster_size),
+                                     flags);
             if (ret < 0) {
                 goto fail;
             }
+            batch++;
+        }
+
+        if (progress && progress->status_cb) {
+            progress->done += j - batch_start;
+            progress->status_cb(bs, progress->done, progress->total);
         }
     }
+    g_free(l2_buf);
     g_free(l1_table);
     return 0;
 
 fail:
+    g_free(l2_buf);
     g_free(l1_table);
     return ret;
 }
@@ -1379,8 +1519,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
             }
         }
 
-        ret = bdrv_pread(bs->file, l2_offset, l2_table,
-                         s->l2_size * sizeof(uint64_t));
+        ret = bdrv_pread(bs->file, l2_offset, l2_table, s->cluster_size);
         if (ret < 0) {
             fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
                     strerror(-ret));
@@ -1389,7 +1528,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
         }
 
         for (j = 0; j < s->l2_size; j++) {
-            uint64_t l2_entry = be64_to_cpu(l2_table[j]);
+            uint64_t l2_entry = get_l2_entry(s, l2_table, j);
             uint64_t data_offset = l2_entry & L2E_OFFSET_MASK;
             int cluster_type = qcow2_get_cluster_type(l2_entry);
 
@@ -1408,9 +1547,9 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
                                                     "ERROR",
                             l2_entry, refcount);
                     if (fix & BDRV_FIX_ERRORS) {
-                        l2_table[j] = cpu_to_be64(refcount == 1
-                                    ? l2_entry |  QCOW_OFLAG_COPIED
-                                    : l2_entry & ~QCOW_OFLAG_COPIED);
+                        set_l2_entry(s, l2_table, j, refcount == 1
+                                     ? l2_entry |  QCOW_OFLAG_COPIED
+                                     : l2_entry & ~QCOW_OFLAG_COPIED);
                         l2_dirty = true;
                         res->corruptions_fixed++;
                     } else {
@@ -1559,17 +1698,26 @@ resize_fail:
 }
 
 /*
- * Calculates an in-memory refcount table.
+ * Calculates an in-memory refcount table, except for the refcount blocks
+ * themselves which are accounted for by check_refblocks().
  */
 static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
-                               BdrvCheckMode fix, bool *rebuild,
-                               uint16_t **refcount_table, int64_t *nb_clusters)
+                               uint16_t **refcount_table, int64_t *nb_clusters,
+                               BlockDriverCheckStatusCB *status_cb)
 {
     BDRVQcowState *s = bs->opaque;
+    Qcow2CheckProgress progress = {
+        .status_cb  = status_cb,
+        .total      = s->l1_size,
+    };
     int64_t i;
     QCowSnapshot *sn;
     int ret;
 
+    for (i = 0; i < s->nb_snapshots; i++) {
+        progress.total += s->snapshots[i].l1_size;
+    }
+
     if (!*refcount_table) {
         *refcount_table = g_try_new0(uint16_t, *nb_clusters);
         if (*nb_clusters && *refcount_table == NULL) {
@@ -1587,7 +1735,8 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
 
     /* current L1 table */
     ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
-                             s->l1_table_offset, s->l1_size, CHECK_FRAG_INFO);
+                             s->l1_table_offset, s->l1_size, CHECK_FRAG_INFO,
+                             &progress);
     if (ret < 0) {
         return ret;
     }
@@ -1596,7 +1745,8 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     for (i = 0; i < s->nb_snapshots; i++) {
         sn = s->snapshots + i;
         ret = check_refcounts_l1(bs, res, refcount_table, nb_clusters,
-                                 sn->l1_table_offset, sn->l1_size, 0);
+                                 sn->l1_table_offset, sn->l1_size, 0,
+                                 &progress);
         if (ret < 0) {
             return ret;
         }
@@ -1607,6 +1757,24 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         return ret;
     }
 
+    /* dirty bitmaps, if still stored in the image */
+    if (s->bitmap_extents) {
+        ret = inc_refcounts(bs, res, refcount_table, nb_clusters,
+                            s->bitmap_directory_offset,
+                            s->bitmap_directory_size);
+        if (ret < 0) {
+            return ret;
+        }
+        for (i = 0; i < s->nb_bitmaps; i++) {
+            ret = inc_refcounts(bs, res, refcount_table, nb_clusters,
+                                s->bitmap_extents[i].offset,
+                                s->bitmap_extents[i].size);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+
     /* refcount data */
     ret = inc_refcounts(bs, res, refcount_table, nb_clusters,
                         s->refcount_table_offset,
@@ -1615,7 +1783,45 @@ static int calculate_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
         return ret;
     }
 
-    return check_refblocks(bs, res, fix, rebuild, refcount_table, nb_clusters);
+    return 0;
+}
+
+/*
+ * Copies the refcount block with the given reftable index into @refblock (in
+ * big endian, as stored on disk).  Refblocks that are not allocated read as
+ * all zeroes.  Returns -errno if the refblock cannot be used; the caller is
+ * expected to fall back to qcow2_get_refcount(), which reports the error.
+ */
+static int read_refblock_copy(BlockDriverState *bs, uint64_t refblock_index,
+                              uint16_t *refblock)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t refblock_offset;
+    void *cached;
+    int ret;
+
+    if (refblock_index >= s->refcount_table_size) {
+        memset(refblock, 0, s->cluster_size);
+        return 0;
+    }
+
+    refblock_offset = s->refcount_table[refblock_index] & REFT_OFFSET_MASK;
+    if (!refblock_offset) {
+        memset(refblock, 0, s->cluster_size);
+        return 0;
+    }
+
+    if (offset_into_cluster(s, refblock_offset)) {
+        return -EIO;
+    }
+
+    ret = load_refcount_block(bs, refblock_offset, &cached);
+    if (ret < 0) {
+        return ret;
+    }
+
+    memcpy(refblock, cached, s->cluster_size);
+    return qcow2_cache_put(bs, s->refcount_block_cache, &cached);
 }
 
 /*
@@ -1628,11 +1834,30 @@ static void compare_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                               uint16_t *refcount_table, int64_t nb_clusters)
 {
     BDRVQcowState *s = bs->opaque;
-    int64_t i;
+    int64_t i, refblock_index = -1;
     int refcount1, refcount2, ret;
+    uint16_t *refblock;
+    bool refblock_valid = false;
+
+    /* Look at the on-disk refcounts one refblock at a time rather than going
+     * through the refblock cache for every single cluster.  Fixing a
+     * mismatch only changes the refcount of the cluster being looked at, so
+     * the copy stays valid for the rest of the refblock. */
+    refblock = g_try_malloc(s->cluster_size);
 
     for (i = 0, *highest_cluster = 0; i < nb_clusters; i++) {
-        refcount1 = qcow2_get_refcount(bs, i);
+        if (refblock && (i >> s->refcount_block_bits) != refblock_index) {
+            refblock_index = i >> s->refcount_block_bits;
+            refblock_valid =
+                read_refblock_copy(bs, refblock_index, refblock) == 0;
+        }
+
+        if (refblock_valid) {
+            refcount1 = be16_to_cpu(
+                refblock[i & (s->refcount_block_size - 1)]);
+        } else {
+            refcount1 = qcow2_get_refcount(bs, i);
+        }
         if (refcount1 < 0) {
             fprintf(stderr, "Can't get refcount for cluster %" PRId64 ": %s\n",
                 i, strerror(-refcount1));
@@ -1681,6 +1906,8 @@ static void compare_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
             }
         }
     }
+
+    g_free(refblock);
 }
 
 /*
@@ -1767,13 +1994,56 @@ static int64_t alloc_clusters_imrt(BlockDriverState *bs,
     return cluster << s->cluster_bits;
 }
 
+/*
+ * Drops the references the old refcount structure (as still described by
+ * s->refcount_table) holds in the in-memory refcount table, mirroring what
+ * calculate_refcounts() and check_refblocks() accounted for.  Refblocks at or
+ * beyond @old_nb_clusters were never accounted for.
+ */
+static void unref_old_refcount_structure(BlockDriverState *bs,
+                                         uint16_t *refcount_table,
+                                         int64_t old_nb_clusters)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t start, last, cluster;
+    int64_t i;
+
+    for (i = 0; i < s->refcount_table_size; i++) {
+        uint64_t offset = s->refcount_table[i];
+
+        cluster = offset >> s->cluster_bits;
+        if (!offset || offset_into_cluster(s, offset) ||
+            cluster >= old_nb_clusters || !refcount_table[cluster])
+        {
+            continue;
+        }
+        refcount_table[cluster]--;
+    }
+
+    if (s->refcount_table_size) {
+        start = s->refcount_table_offset >> s->cluster_bits;
+        last = (s->refcount_table_offset +
+                s->refcount_table_size * sizeof(uint64_t) - 1)
+               >> s->cluster_bits;
+        for (cluster = start;
+             cluster <= last && cluster < old_nb_clusters; cluster++)
+        {
+            if (refcount_table[cluster]) {
+                refcount_table[cluster]--;
+            }
+        }
+    }
+}
+
 /*
  * Creates a new refcount structure based solely on the in-memory information
  * given through *refcount_table. All necessary allocations will be reflected
  * in that array.
  *
  * On success, the old refcount structure is leaked (it will be covered by the
- * new refcount structure).
+ * new refcount structure), but it is no longer accounted for in
+ * *refcount_table, so a leak-fixing compare_refcounts() frees it without
+ * another scan of the L1/L2 tables.
  */
 static int rebuild_refcount_structure(BlockDriverState *bs,
                                       BdrvCheckResult *res,
@@ -1783,6 +2053,7 @@ static int rebuild_refcount_structure(BlockDriverState *bs,
     BDRVQcowState *s = bs->opaque;
     int64_t first_free_cluster = 0, reftable_offset = -1, cluster = 0;
     int64_t refblock_offset, refblock_start, refblock_index;
+    int64_t old_nb_clusters = *nb_clusters;
     uint32_t reftable_size = 0;
     uint64_t *on_disk_reftable = NULL;
     uint16_t *on_disk_refblock;
@@ -1951,6 +2222,8 @@ write_refblocks:
     for (refblock_index = 0; refblock_index < reftable_size; refblock_index++) {
         be64_to_cpus(&on_disk_reftable[refblock_index]);
     }
+    unref_old_refcount_structure(bs, *refcount_table, old_nb_clusters);
+    g_free(s->refcount_table);
     s->refcount_table = on_disk_reftable;
     s->refcount_table_offset = reftable_offset;
     s->refcount_table_size = reftable_size;
@@ -1969,11 +2242,13 @@ fail:
  * detected as corrupted, and -errno when an internal error occurred.
  */
 int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
-                          BdrvCheckMode fix)
+                          BdrvCheckMode fix,
+                          BlockDriverCheckStatusCB *status_cb)
 {
     BDRVQcowState *s = bs->opaque;
     BdrvCheckResult pre_compare_res;
     int64_t size, highest_cluster, nb_clusters;
+    int data_corruptions;
     uint16_t *refcount_table = NULL;
     bool rebuild = false;
     int ret;
@@ -1993,8 +2268,17 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
     res->bfi.total_clusters =
         size_to_clusters(s, bs->total_sectors * BDRV_SECTOR_SIZE);
 
-    ret = calculate_refcounts(bs, res, fix, &rebuild, &refcount_table,
-                              &nb_clusters);
+    ret = calculate_refcounts(bs, res, &refcount_table, &nb_clusters,
+                              status_cb);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    /* Everything check_refblocks() finds wrong is fixed by a rebuild, unlike
+     * the corruptions found in the L1/L2 tables so far */
+    data_corruptions = res->corruptions;
+    ret = check_refblocks(bs, res, fix, &rebuild, &refcount_table,
+                          &nb_clusters);
     if (ret < 0) {
         goto fail;
     }
@@ -2017,18 +2301,11 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
             goto fail;
         }
 
-        res->corruptions = 0;
+        /* The in-memory refcount table now describes the new refcount
+         * structure, so there is no need to scan all L1/L2 tables again */
+        res->corruptions = data_corruptions;
         res->leaks = 0;
-
-        /* Because the old reftable has been exchanged for a new one the
-         * references have to be recalculated */
         rebuild = false;
-        memset(refcount_table, 0, nb_clusters * sizeof(uint16_t));
-        ret = calculate_refcounts(bs, res, 0, &rebuild, &refcount_table,
-                                  &nb_clusters);
-        if (ret < 0) {
-            goto fail;
-        }
 
         if (fix & BDRV_FIX_LEAKS) {
             /* The old refcount structures are now leaked, fix it; the result
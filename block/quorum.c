@@ -30,6 +30,7 @@
 #define QUORUM_OPT_BLKVERIFY      "blkverify"
 #define QUORUM_OPT_REWRITE        "rewrite-corrupted"
 #define QUORUM_OPT_READ_PATTERN   "read-pattern"
+#define QUORUM_OPT_HEDGED_READS   "hedged-reads"
 
 /* This union holds a vote hash value */
 typedef union QuorumVoteValue {
@@ -62,6 +63,15 @@ typedef struct QuorumVotes {
     bool (*compare)(QuorumVoteValue *a, QuorumVoteValue *b);
 } QuorumVotes;
 
+/* Smoothed read latency of one child, estimated like the TCP round trip
+ * time (RFC 6298): srtt_ns is a moving average and rttvar_ns the moving
+ * mean deviation from it.  srtt_ns == 0 means no read has completed yet.
+ */
+typedef struct QuorumChildLatency {
+    int64_t srtt_ns;
+    int64_t rttvar_ns;
+} QuorumChildLatency;
+
 /* the following structure holds the state of one quorum instance */
 typedef struct BDRVQuorumState {
     BlockDriverState **bs; /* children BlockDriverStates */
@@ -82,6 +92,10 @@ typedef struct BDRVQuorumState {
                             */
 
     QuorumReadPattern read_pattern;
+    QuorumChildLatency *latency; /* per child, for the latency pattern */
+    bool hedged_reads;     /* true if a slow read in the latency pattern
+                            * is also sent to the next fastest child.
+                            */
 } BDRVQuorumState;
 
 typedef struct QuorumAIOCB QuorumAIOCB;
@@ -97,6 +111,7 @@ typedef struct QuorumChildRequest {
     uint8_t *buf;
     int ret;
     QuorumAIOCB *parent;
+    int64_t start_ns;           /* when the read was sent, latency pattern */
 } QuorumChildRequest;
 
 /* Quorum will use the following structure to track progress of each read/write
@@ -126,6 +141,11 @@ struct QuorumAIOCB {
     bool is_read;
     int vote_ret;
     int child_iter;             /* which child to read in fifo pattern */
+
+    /* latency pattern only */
+    int inflight;               /* number of child reads not completed */
+    bool done;                  /* the caller's callback has been invoked */
+    QEMUTimer *hedge_timer;
 };
 
 static bool quorum_vote(QuorumAIOCB *acb);
@@ -204,6 +224,9 @@ static QuorumAIOCB *quorum_aio_get(BDRVQuorumState *s,
     QLIST_INIT(&acb->votes.vote_list);
     acb->is_read = false;
     acb->vote_ret = 0;
+    acb->inflight = 0;
+    acb->done = false;
+    acb->hedge_timer = NULL;
 
     for (i = 0; i < s->num_children; i++) {
         acb->qcrs[i].buf = NULL;
@@ -675,6 +698,139 @@ static BlockAIOCB *read_fifo_child(QuorumAIOCB *acb)
     return &acb->common;
 }
 
+static void quorum_update_latency(QuorumChildLatency *l, int64_t ns)
+{
+    if (!l->srtt_ns) {
+        l->srtt_ns = ns;
+        l->rttvar_ns = ns / 2;
+    } else {
+        l->rttvar_ns += (llabs(l->srtt_ns - ns) - l->rttvar_ns) / 4;
+        l->srtt_ns += (ns - l->srtt_ns) / 8;
+    }
+}
+
+/* Pick the fastest child that has not been read from yet, or -1 */
+static int quorum_pick_child(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->common.bs->opaque;
+    int i, best = -1;
+
+    for (i = 0; i < s->num_children; i++) {
+        if (acb->qcrs[i].buf) {
+            continue;
+        }
+        if (best < 0 || s->latency[i].srtt_ns < s->latency[best].srtt_ns) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static void quorum_latency_free(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->common.bs->opaque;
+    int i;
+
+    for (i = 0; i < s->num_children; i++) {
+        if (acb->qcrs[i].buf) {
+            qemu_vfree(acb->qcrs[i].buf);
+            qemu_iovec_destroy(&acb->qcrs[i].qiov);
+        }
+    }
+    if (acb->hedge_timer) {
+        timer_del(acb->hedge_timer);
+        timer_free(acb->hedge_timer);
+    }
+
+    g_free(acb->qcrs);
+    qemu_aio_unref(acb);
+}
+
+static void read_latency_child(QuorumAIOCB *acb, int i);
+
+static void quorum_latency_aio_cb(void *opaque, int ret)
+{
+    QuorumChildRequest *sacb = opaque;
+    QuorumAIOCB *acb = sacb->parent;
+    BDRVQuorumState *s = acb->common.bs->opaque;
+    int i = sacb - acb->qcrs;
+
+    acb->inflight--;
+    if (ret == 0) {
+        quorum_update_latency(&s->latency[i],
+                              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                              sacb->start_ns);
+    } else {
+        quorum_report_bad(acb, s->bs[i]->node_name, ret);
+    }
+
+    if (!acb->done) {
+        if (ret == 0) {
+            quorum_copy_qiov(acb->qiov, &sacb->qiov);
+        } else if (acb->inflight) {
+            /* a hedged read is still running, wait for it */
+            return;
+        } else {
+            int next = quorum_pick_child(acb);
+
+            if (next >= 0) {
+                read_latency_child(acb, next);
+                return;
+            }
+        }
+        acb->done = true;
+        acb->common.cb(acb->common.opaque, ret);
+    }
+
+    /* the slower of two hedged reads keeps acb alive until it completes */
+    if (!acb->inflight) {
+        quorum_latency_free(acb);
+    }
+}
+
+static void quorum_hedge_timer_cb(void *opaque)
+{
+    QuorumAIOCB *acb = opaque;
+    int i;
+
+    if (acb->done) {
+        return;
+    }
+
+    i = quorum_pick_child(acb);
+    if (i >= 0) {
+        read_latency_child(acb, i);
+    }
+}
+
+static void read_latency_child(QuorumAIOCB *acb, int i)
+{
+    BDRVQuorumState *s = acb->common.bs->opaque;
+    QuorumChildLatency *l = &s->latency[i];
+
+    acb->qcrs[i].buf = qemu_blockalign(s->bs[i], acb->qiov->size);
+    qemu_iovec_init(&acb->qcrs[i].qiov, acb->qiov->niov);
+    qemu_iovec_clone(&acb->qcrs[i].qiov, acb->qiov, acb->qcrs[i].buf);
+    acb->qcrs[i].start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    acb->inflight++;
+
+    /* Hedge only the first read, and only once the child's latency is
+     * known: srtt + 4 * rttvar is the usual retransmission timeout, i.e. a
+     * delay that reads on a healthy child rarely exceed.
+     */
+    if (s->hedged_reads && !acb->hedge_timer && l->srtt_ns) {
+        acb->hedge_timer = aio_timer_new(bdrv_get_aio_context(acb->common.bs),
+                                         QEMU_CLOCK_REALTIME, SCALE_NS,
+                                         quorum_hedge_timer_cb, acb);
+        timer_mod(acb->hedge_timer,
+                  acb->qcrs[i].start_ns + l->srtt_ns + 4 * l->rttvar_ns);
+    }
+
+    bdrv_aio_readv(s->bs[i], acb->sector_num, &acb->qcrs[i].qiov,
+                   acb->nb_sectors, quorum_latency_aio_cb, &acb->qcrs[i]);
+}
+
 static BlockAIOCB *quorum_aio_readv(BlockDriverState *bs,
                                     int64_t sector_num,
                                     QEMUIOVector *qiov,
@@ -692,6 +848,11 @@ static BlockAIOCB *quorum_aio_readv(BlockDriverState *bs,
         return read_quorum_children(acb);
     }
 
+    if (s->read_pattern == QUORUM_READ_PATTERN_LATENCY) {
+        read_latency_child(acb, quorum_pick_child(acb));
+        return &acb->common;
+    }
+
     acb->child_iter = 0;
     return read_fifo_child(acb);
 }
@@ -838,7 +999,14 @@ static QemuOptsList quorum_runtime_opts = {
         {
             .name = QUORUM_OPT_READ_PATTERN,
             .type = QEMU_OPT_STRING,
-            .help = "Allowed pattern: quorum, fifo. Quorum is default",
+            .help = "Allowed pattern: quorum, fifo, latency. "
+                    "Quorum is default",
+        },
+        {
+            .name = QUORUM_OPT_HEDGED_READS,
+            .type = QEMU_OPT_BOOL,
+            .help = "Also read from a second child when a latency read "
+                    "is slow",
         },
         { /* end of list */ }
     },
@@ -905,10 +1073,12 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
     s->threshold = qemu_opt_get_number(opts, QUORUM_OPT_VOTE_THRESHOLD, 0);
     ret = parse_read_pattern(qemu_opt_get(opts, QUORUM_OPT_READ_PATTERN));
     if (ret < 0) {
-        error_setg(&local_err, "Please set read-pattern as fifo or quorum");
+        error_setg(&local_err,
+                   "Please set read-pattern as fifo, latency or quorum");
         goto exit;
     }
     s->read_pattern = ret;
+    s->hedged_reads = qemu_opt_get_bool(opts, QUORUM_OPT_HEDGED_READS, false);
 
     if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
         /* and validate it against s->num_children */
@@ -938,6 +1108,7 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* allocate the children BlockDriverState array */
     s->bs = g_new0(BlockDriverState *, s->num_children);
+    s->latency = g_new0(QuorumChildLatency, s->num_children);
     opened = g_new0(bool, s->num_children);
 
     for (i = 0, lentry = qlist_first(list); lentry;
@@ -986,6 +1157,7 @@ close_exit:
         bdrv_unref(s->bs[i]);
     }
     g_free(s->bs);
+    g_free(s->latency);
     g_free(opened);
 exit:
     qemu_opts_del(opts);
@@ -1008,6 +1180,7 @@ static void quorum_close(BlockDriverState *bs)
     }
 
     g_free(s->bs);
+    g_free(s->latency);
 }
 
 static void quorum_detach_aio_context(BlockDriverState *bs)
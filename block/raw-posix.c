@@ -124,6 +124,43 @@
 
 #define MAX_BLOCKSIZE	4096
 
+/* Extra submission context, see bdrv_add_aio_queue() */
+/*
+ * Misaligned requests with O_DIRECT are copied through an aligned bounce
+ * buffer.  Rather than allocating and freeing one for every request, freed
+ * bounce buffers are kept in power-of-two size classes from 4k to 1M, at
+ * most RAW_BOUNCE_POOL_DEPTH of each, with one pool per AioContext the image
+ * is used from.  The pool is accessed from the thread pool workers.
+ */
+#define RAW_BOUNCE_MIN_SHIFT    12
+#define RAW_BOUNCE_MAX_SHIFT    20
+#define RAW_BOUNCE_CLASSES      (RAW_BOUNCE_MAX_SHIFT - RAW_BOUNCE_MIN_SHIFT + 1)
+#define RAW_BOUNCE_POOL_DEPTH   4
+#define RAW_BOUNCE_ALIGN        (1 << RAW_BOUNCE_MIN_SHIFT)
+
+typedef struct RawBouncePool {
+    QemuMutex lock;
+    void *bufs[RAW_BOUNCE_CLASSES][RAW_BOUNCE_POOL_DEPTH];
+    int nb_bufs[RAW_BOUNCE_CLASSES];
+
+    /* Statistics, protected by lock */
+    uint64_t bounced_requests;
+    uint64_t bounced_bytes;
+    uint64_t pool_hits;
+} RawBouncePool;
+
+typedef struct RawAioQueue {
+    AioContext *ctx;
+    RawBouncePool bounce_pool;
+#ifdef CONFIG_LINUX_AIO
+    void *aio_ctx;
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    void *io_uring;
+#endif
+    QLIST_ENTRY(RawAioQueue) next;
+} RawAioQueue;
+
 typedef struct BDRVRawState {
     int fd;
     int type;
@@ -141,6 +178,14 @@ typedef struct BDRVRawState {
     int use_aio;
     void *aio_ctx;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    bool use_io_uring;
+    void *io_uring;
+    /* buffers from bdrv_register_buf(), if fixed-buffers=on */
+    bool fixed_buffers;
+    struct iovec *fixed_bufs;
+    int nb_fixed_bufs;
+#endif
 #ifdef CONFIG_XFS
     bool is_xfs:1;
 #endif
@@ -148,6 +193,10 @@ typedef struct BDRVRawState {
     bool has_write_zeroes:1;
     bool discard_zeroes:1;
     bool needs_alignment;
+    QLIST_HEAD(, RawAioQueue) aio_queues;
+
+    /* bounce buffers for requests from the BDS's own AioContext */
+    RawBouncePool bounce_pool;
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -156,10 +205,15 @@ typedef struct BDRVRawReopenState {
 #ifdef CONFIG_LINUX_AIO
     int use_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    bool use_io_uring;
+    void *io_uring;     /* new ring, installed by raw_reopen_commit() */
+#endif
 } BDRVRawReopenState;
 
 static int fd_open(BlockDriverState *bs);
 static int64_t raw_getlength(BlockDriverState *bs);
+static void raw_bounce_pool_init(RawBouncePool *pool);
 
 typedef struct RawPosixAIOData {
     BlockDriverState *bs;
@@ -173,6 +227,7 @@ typedef struct RawPosixAIOData {
 #define aio_ioctl_cmd   aio_nbytes /* for QEMU_AIO_IOCTL */
     off_t aio_offset;
     int aio_type;
+    RawBouncePool *bounce_pool;
 } RawPosixAIOData;
 
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
@@ -313,25 +368,39 @@ static void raw_parse_flags(int bdrv_flags, int *open_flags)
 
 static void raw_detach_aio_context(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
 
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_detach_aio_context(s->aio_ctx, bdrv_get_aio_context(bs));
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->io_uring) {
+        luring_detach_aio_context(s->io_uring, bdrv_get_aio_context(bs));
+    }
+#endif
 }
 
 static void raw_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
 
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_attach_aio_context(s->aio_ctx, new_context);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->io_uring) {
+        luring_attach_aio_context(s->io_uring, new_context);
+    }
+#endif
 }
 
 #ifdef CONFIG_LINUX_AIO
@@ -366,6 +435,34 @@ error:
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+/* Unlike linux-aio, io_uring does not need O_DIRECT to be asynchronous, so
+ * it is used regardless of the cache mode.  Like the linux-aio context
+ * above, the ring stays around once it has been created, and is attached to
+ * the event loop for as long as it exists.
+ */
+static int raw_set_io_uring(BlockDriverState *bs, bool *use_io_uring,
+                            int bdrv_flags)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (!(bdrv_flags & BDRV_O_IO_URING)) {
+        *use_io_uring = false;
+        return 0;
+    }
+
+    if (s->io_uring == NULL) {
+        s->io_uring = luring_init();
+        if (!s->io_uring) {
+            return -1;
+        }
+        luring_register_bufs(s->io_uring, s->fixed_bufs, s->nb_fixed_bufs);
+    }
+    *use_io_uring = true;
+    return 0;
+}
+#endif
+
 static void raw_parse_filename(const char *filename, QDict *options,
                                Error **errp)
 {
@@ -386,6 +483,13 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "File name of the image",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "with aio=io_uring, pin guest RAM as fixed buffers",
+        },
+#endif
         { /* end of list */ }
     },
 };
@@ -400,6 +504,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     int fd, ret;
     struct stat st;
 
+    raw_bounce_pool_init(&s->bounce_pool);
+
     opts = qemu_opts_create(&raw_runtime_opts, NULL, 0, &error_abort);
     qemu_opts_absorb_qdict(opts, options, &local_err);
     if (local_err) {
@@ -409,6 +515,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 
     filename = qemu_opt_get(opts, "filename");
+#ifdef CONFIG_LINUX_IO_URING
+    s->fixed_buffers = qemu_opt_get_bool(opts, "fixed-buffers", false);
+#endif
 
     ret = raw_normalize_devicepath(&filename);
     if (ret != 0) {
@@ -438,6 +547,14 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (raw_set_io_uring(bs, &s->use_io_uring, bdrv_flags)) {
+        qemu_close(fd);
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not set up io_uring");
+        goto fail;
+    }
+#endif
 
     s->has_discard = true;
     s->has_write_zeroes = true;
@@ -529,6 +646,7 @@ static int raw_reopen_prepare(BDRVReopenState *state,
 
     state->opaque = g_new0(BDRVRawReopenState, 1);
     raw_s = state->opaque;
+    raw_s->fd = -1;
 
 #ifdef CONFIG_LINUX_AIO
     raw_s->use_aio = s->use_aio;
@@ -542,14 +660,27 @@ static int raw_reopen_prepare(BDRVReopenState *state,
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* Create the ring now so that a failure fails the reopen, but leave
+     * the BDS alone until raw_reopen_commit() */
+    raw_s->use_io_uring = !!(state->flags & BDRV_O_IO_URING);
+    if (raw_s->use_io_uring && !s->io_uring) {
+        raw_s->io_uring = luring_init();
+        if (!raw_s->io_uring) {
+            error_setg_errno(errp, errno, "Could not set up io_uring");
+            return -1;
+        }
+        luring_register_bufs(raw_s->io_uring, s->fixed_bufs,
+                             s->nb_fixed_bufs);
+    }
+#endif
+
     if (s->type == FTYPE_FD || s->type == FTYPE_CD) {
         raw_s->open_flags |= O_NONBLOCK;
     }
 
     raw_parse_flags(state->flags, &raw_s->open_flags);
 
-    raw_s->fd = -1;
-
     int fcntl_flags = O_APPEND | O_NONBLOCK;
 #ifdef O_NOATIME
     fcntl_flags |= O_NOATIME;
@@ -621,6 +752,14 @@ static void raw_reopen_commit(BDRVReopenState *state)
 #ifdef CONFIG_LINUX_AIO
     s->use_aio = raw_s->use_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (raw_s->io_uring) {
+        s->io_uring = raw_s->io_uring;
+        luring_attach_aio_context(s->io_uring,
+                                  bdrv_get_aio_context(state->bs));
+    }
+    s->use_io_uring = raw_s->use_io_uring;
+#endif
 
     g_free(state->opaque);
     state->opaque = NULL;
@@ -640,6 +779,11 @@ static void raw_reopen_abort(BDRVReopenState *state)
         qemu_close(raw_s->fd);
         raw_s->fd = -1;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (raw_s->io_uring) {
+        luring_cleanup(raw_s->io_uring);
+    }
+#endif
     g_free(state->opaque);
     state->opaque = NULL;
 }
@@ -778,6 +922,86 @@ static ssize_t handle_aiocb_rw_linear(RawPosixAIOData *aiocb, char *buf)
     return offset;
 }
 
+static void raw_bounce_pool_init(RawBouncePool *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+    qemu_mutex_init(&pool->lock);
+}
+
+static void raw_bounce_pool_destroy(RawBouncePool *pool)
+{
+    int i, j;
+
+    for (i = 0; i < RAW_BOUNCE_CLASSES; i++) {
+        for (j = 0; j < pool->nb_bufs[i]; j++) {
+            qemu_vfree(pool->bufs[i][j]);
+        }
+        pool->nb_bufs[i] = 0;
+    }
+    qemu_mutex_destroy(&pool->lock);
+}
+
+/* Returns the size class for a bounce buffer of @size bytes, or -1 if such
+ * buffers are not pooled */
+static int raw_bounce_class(BlockDriverState *bs, size_t size)
+{
+    int shift;
+
+    if (size > (1 << RAW_BOUNCE_MAX_SHIFT) ||
+        bdrv_opt_mem_align(bs) > RAW_BOUNCE_ALIGN) {
+        return -1;
+    }
+
+    shift = RAW_BOUNCE_MIN_SHIFT;
+    while ((1 << shift) < size) {
+        shift++;
+    }
+    return shift - RAW_BOUNCE_MIN_SHIFT;
+}
+
+static void *raw_bounce_get(RawBouncePool *pool, BlockDriverState *bs,
+                            size_t size)
+{
+    int cls = raw_bounce_class(bs, size);
+    void *buf = NULL;
+
+    qemu_mutex_lock(&pool->lock);
+    pool->bounced_requests++;
+    pool->bounced_bytes += size;
+    if (cls >= 0 && pool->nb_bufs[cls] > 0) {
+        buf = pool->bufs[cls][--pool->nb_bufs[cls]];
+        pool->pool_hits++;
+    }
+    qemu_mutex_unlock(&pool->lock);
+
+    trace_paio_bounce(bs, size, cls, buf != NULL);
+    if (buf) {
+        return buf;
+    } else if (cls >= 0) {
+        return qemu_try_memalign(RAW_BOUNCE_ALIGN,
+                                 1 << (cls + RAW_BOUNCE_MIN_SHIFT));
+    } else {
+        return qemu_try_blockalign(bs, size);
+    }
+}
+
+static void raw_bounce_put(RawBouncePool *pool, BlockDriverState *bs,
+                           void *buf, size_t size)
+{
+    int cls = raw_bounce_class(bs, size);
+
+    if (cls >= 0) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->nb_bufs[cls] < RAW_BOUNCE_POOL_DEPTH) {
+            pool->bufs[cls][pool->nb_bufs[cls]++] = buf;
+            buf = NULL;
+        }
+        qemu_mutex_unlock(&pool->lock);
+    }
+
+    qemu_vfree(buf);
+}
+
 static ssize_t handle_aiocb_rw(RawPosixAIOData *aiocb)
 {
     ssize_t nbytes;
@@ -817,7 +1041,7 @@ static ssize_t handle_aiocb_rw(RawPosixAIOData *aiocb)
      * Ok, we have to do it the hard way, copy all segments into
      * a single aligned buffer.
      */
-    buf = qemu_try_blockalign(aiocb->bs, aiocb->aio_nbytes);
+    buf = raw_bounce_get(aiocb->bounce_pool, aiocb->bs, aiocb->aio_nbytes);
     if (buf == NULL) {
         return -ENOMEM;
     }
@@ -851,7 +1075,7 @@ static ssize_t handle_aiocb_rw(RawPosixAIOData *aiocb)
         }
         assert(count == 0);
     }
-    qemu_vfree(buf);
+    raw_bounce_put(aiocb->bounce_pool, aiocb->bs, buf, aiocb->aio_nbytes);
 
     return nbytes;
 }
@@ -1029,12 +1253,14 @@ static int paio_submit_co(BlockDriverState *bs, int fd,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         int type)
 {
+    BDRVRawState *s = bs->opaque;
     RawPosixAIOData *acb = g_slice_new(RawPosixAIOData);
     ThreadPool *pool;
 
     acb->bs = bs;
     acb->aio_type = type;
     acb->aio_fildes = fd;
+    acb->bounce_pool = &s->bounce_pool;
 
     acb->aio_nbytes = nb_sectors * BDRV_SECTOR_SIZE;
     acb->aio_offset = sector_num * BDRV_SECTOR_SIZE;
@@ -1050,16 +1276,31 @@ static int paio_submit_co(BlockDriverState *bs, int fd,
     return thread_pool_submit_co(pool, aio_worker, acb);
 }
 
-static BlockAIOCB *paio_submit(BlockDriverState *bs, int fd,
-        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+static RawAioQueue *raw_find_aio_queue(BDRVRawState *s, AioContext *ctx)
+{
+    RawAioQueue *q;
+
+    QLIST_FOREACH(q, &s->aio_queues, next) {
+        if (q->ctx == ctx) {
+            return q;
+        }
+    }
+    return NULL;
+}
+
+static BlockAIOCB *paio_submit_ctx(BlockDriverState *bs, AioContext *ctx,
+        int fd, int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockCompletionFunc *cb, void *opaque, int type)
 {
+    BDRVRawState *s = bs->opaque;
     RawPosixAIOData *acb = g_slice_new(RawPosixAIOData);
+    RawAioQueue *q = raw_find_aio_queue(s, ctx);
     ThreadPool *pool;
 
     acb->bs = bs;
     acb->aio_type = type;
     acb->aio_fildes = fd;
+    acb->bounce_pool = q ? &q->bounce_pool : &s->bounce_pool;
 
     acb->aio_nbytes = nb_sectors * BDRV_SECTOR_SIZE;
     acb->aio_offset = sector_num * BDRV_SECTOR_SIZE;
@@ -1071,10 +1312,18 @@ static BlockAIOCB *paio_submit(BlockDriverState *bs, int fd,
     }
 
     trace_paio_submit(acb, opaque, sector_num, nb_sectors, type);
-    pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    pool = aio_get_thread_pool(ctx);
     return thread_pool_submit_aio(pool, aio_worker, acb, cb, opaque);
 }
 
+static BlockAIOCB *paio_submit(BlockDriverState *bs, int fd,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockCompletionFunc *cb, void *opaque, int type)
+{
+    return paio_submit_ctx(bs, bdrv_get_aio_context(bs), fd, sector_num,
+                           qiov, nb_sectors, cb, opaque, type);
+}
+
 static BlockAIOCB *raw_aio_submit(BlockDriverState *bs,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockCompletionFunc *cb, void *opaque, int type)
@@ -1101,38 +1350,235 @@ static BlockAIOCB *raw_aio_submit(BlockDriverState *bs,
         }
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring && !(type & QEMU_AIO_MISALIGNED)) {
+        return luring_submit(bs, s->io_uring, s->fd, sector_num, qiov,
+                             nb_sectors, cb, opaque, type);
+    }
+#endif
+
     return paio_submit(bs, s->fd, sector_num, qiov, nb_sectors,
                        cb, opaque, type);
 }
 
-static void raw_aio_plug(BlockDriverState *bs)
+static int raw_add_aio_queue(BlockDriverState *bs, AioContext *ctx,
+                             Error **errp)
 {
+    BDRVRawState *s = bs->opaque;
+    RawAioQueue *q;
+
+    if (raw_find_aio_queue(s, ctx)) {
+        error_setg(errp, "AioContext already attached to '%s'",
+                   bs->filename);
+        return -EEXIST;
+    }
+
+    q = g_new0(RawAioQueue, 1);
+    q->ctx = ctx;
 #ifdef CONFIG_LINUX_AIO
+    if (s->use_aio) {
+        /* each queue gets its own io_context, so that submission and
+         * completion never touch another thread's ring */
+        q->aio_ctx = laio_init();
+        if (!q->aio_ctx) {
+            error_setg_errno(errp, errno, "Could not set up linux-aio queue");
+            g_free(q);
+            return -errno;
+        }
+        laio_attach_aio_context(q->aio_ctx, ctx);
+    }
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring) {
+        q->io_uring = luring_init();
+        if (!q->io_uring) {
+            error_setg_errno(errp, errno, "Could not set up io_uring queue");
+#ifdef CONFIG_LINUX_AIO
+            assert(!q->aio_ctx);
+#endif
+            g_free(q);
+            return -errno;
+        }
+        luring_register_bufs(q->io_uring, s->fixed_bufs, s->nb_fixed_bufs);
+        luring_attach_aio_context(q->io_uring, ctx);
+    }
+#endif
+    raw_bounce_pool_init(&q->bounce_pool);
+    QLIST_INSERT_HEAD(&s->aio_queues, q, next);
+    return 0;
+}
+
+static void raw_free_aio_queue(RawAioQueue *q)
+{
+#ifdef CONFIG_LINUX_AIO
+    if (q->aio_ctx) {
+        laio_detach_aio_context(q->aio_ctx, q->ctx);
+        laio_cleanup(q->aio_ctx);
+    }
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (q->io_uring) {
+        luring_detach_aio_context(q->io_uring, q->ctx);
+        luring_cleanup(q->io_uring);
+    }
+#endif
+    QLIST_REMOVE(q, next);
+    raw_bounce_pool_destroy(&q->bounce_pool);
+    g_free(q);
+}
+
+static void raw_del_aio_queue(BlockDriverState *bs, AioContext *ctx)
+{
+    BDRVRawState *s = bs->opaque;
+    RawAioQueue *q = raw_find_aio_queue(s, ctx);
+
+    if (q) {
+        raw_free_aio_queue(q);
+    }
+}
+
+/* The queue list is only modified while no request is in flight, so
+ * lookups from the queue threads need no lock.
+ */
+static BlockAIOCB *raw_aio_mq_rw(BlockDriverState *bs, AioContext *ctx,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockCompletionFunc *cb, void *opaque, bool is_write)
+{
+    BDRVRawState *s = bs->opaque;
+    RawAioQueue *q = raw_find_aio_queue(s, ctx);
+    int type = is_write ? QEMU_AIO_WRITE : QEMU_AIO_READ;
+
+    if (!q || fd_open(bs) < 0) {
+        return NULL;
+    }
+
+    if (s->needs_alignment) {
+        if (!bdrv_qiov_is_aligned(bs, qiov)) {
+            type |= QEMU_AIO_MISALIGNED;
+#ifdef CONFIG_LINUX_AIO
+        } else if (q->aio_ctx) {
+            return laio_submit(bs, q->aio_ctx, s->fd, sector_num, qiov,
+                               nb_sectors, cb, opaque, type);
+#endif
+        }
+    }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (q->io_uring && !(type & QEMU_AIO_MISALIGNED)) {
+        return luring_submit(bs, q->io_uring, s->fd, sector_num, qiov,
+                             nb_sectors, cb, opaque, type);
+    }
+#endif
+
+    return paio_submit_ctx(bs, ctx, s->fd, sector_num, qiov, nb_sectors,
+                           cb, opaque, type);
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static void raw_update_fixed_bufs(BDRVRawState *s)
+{
+    RawAioQueue *q;
+
+    if (s->io_uring) {
+        luring_register_bufs(s->io_uring, s->fixed_bufs, s->nb_fixed_bufs);
+    }
+    QLIST_FOREACH(q, &s->aio_queues, next) {
+        if (q->io_uring) {
+            luring_register_bufs(q->io_uring, s->fixed_bufs,
+                                 s->nb_fixed_bufs);
+        }
+    }
+}
+#endif
+
+/* Registered buffers are pinned in host memory, so they are only used if
+ * the user asked for them with fixed-buffers=on.
+ */
+static void raw_register_buf(BlockDriverState *bs, void *host, size_t size)
+{
+#ifdef CONFIG_LINUX_IO_URING
     BDRVRawState *s = bs->opaque;
+
+    if (!s->fixed_buffers) {
+        return;
+    }
+
+    s->fixed_bufs = g_renew(struct iovec, s->fixed_bufs,
+                            s->nb_fixed_bufs + 1);
+    s->fixed_bufs[s->nb_fixed_bufs].iov_base = host;
+    s->fixed_bufs[s->nb_fixed_bufs].iov_len = size;
+    s->nb_fixed_bufs++;
+    raw_update_fixed_bufs(s);
+#endif
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < s->nb_fixed_bufs; i++) {
+        if (s->fixed_bufs[i].iov_base == host) {
+            memmove(&s->fixed_bufs[i], &s->fixed_bufs[i + 1],
+                    (s->nb_fixed_bufs - i - 1) * sizeof(struct iovec));
+            s->nb_fixed_bufs--;
+            raw_update_fixed_bufs(s);
+            return;
+        }
+    }
+#endif
+}
+
+static void raw_aio_plug(BlockDriverState *bs)
+{
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
+    BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_plug(bs, s->aio_ctx);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring) {
+        luring_io_plug(bs, s->io_uring);
+    }
+#endif
 }
 
 static void raw_aio_unplug(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_unplug(bs, s->aio_ctx, true);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring) {
+        luring_io_unplug(bs, s->io_uring, true);
+    }
+#endif
 }
 
 static void raw_aio_flush_io_queue(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_unplug(bs, s->aio_ctx, false);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring) {
+        luring_io_unplug(bs, s->io_uring, false);
+    }
+#endif
 }
 
 static BlockAIOCB *raw_aio_readv(BlockDriverState *bs,
@@ -1159,6 +1605,13 @@ static BlockAIOCB *raw_aio_flush(BlockDriverState *bs,
     if (fd_open(bs) < 0)
         return NULL;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_io_uring) {
+        return luring_submit(bs, s->io_uring, s->fd, 0, NULL, 0,
+                             cb, opaque, QEMU_AIO_FLUSH);
+    }
+#endif
+
     return paio_submit(bs, s->fd, 0, NULL, 0, cb, opaque, QEMU_AIO_FLUSH);
 }
 
@@ -1166,12 +1619,22 @@ static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+    while (!QLIST_EMPTY(&s->aio_queues)) {
+        raw_free_aio_queue(QLIST_FIRST(&s->aio_queues));
+    }
     raw_detach_aio_context(bs);
+    raw_bounce_pool_destroy(&s->bounce_pool);
 
 #ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_cleanup(s->aio_ctx);
     }
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->io_uring) {
+        luring_cleanup(s->io_uring);
+    }
+    g_free(s->fixed_bufs);
 #endif
     if (s->fd >= 0) {
         qemu_close(s->fd);
@@ -1632,6 +2095,20 @@ static coroutine_fn BlockAIOCB *raw_aio_discard(BlockDriverState *bs,
 {
     BDRVRawState *s = bs->opaque;
 
+#ifdef CONFIG_LINUX_IO_URING
+    bool use_io_uring = s->use_io_uring && s->has_discard &&
+                        luring_can_discard(s->io_uring);
+
+#ifdef CONFIG_XFS
+    /* XFS gets its own ioctl in handle_aiocb_discard() */
+    use_io_uring = use_io_uring && !s->is_xfs;
+#endif
+    if (use_io_uring) {
+        return luring_submit(bs, s->io_uring, s->fd, sector_num, NULL,
+                             nb_sectors, cb, opaque, QEMU_AIO_DISCARD);
+    }
+#endif
+
     return paio_submit(bs, s->fd, sector_num, NULL, nb_sectors,
                        cb, opaque, QEMU_AIO_DISCARD);
 }
@@ -1661,6 +2138,38 @@ static int raw_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+static void raw_bounce_pool_get_stats(RawBouncePool *pool,
+                                      BlockStatsSpecificFile *stats)
+{
+    qemu_mutex_lock(&pool->lock);
+    stats->bounced_requests += pool->bounced_requests;
+    stats->bounced_bytes += pool->bounced_bytes;
+    stats->bounce_pool_hits += pool->pool_hits;
+    qemu_mutex_unlock(&pool->lock);
+}
+
+static BlockStatsSpecific *raw_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    BlockStatsSpecific *spec_stats = g_new(BlockStatsSpecific, 1);
+    BlockStatsSpecificFile *file_stats = g_new0(BlockStatsSpecificFile, 1);
+    RawAioQueue *q;
+
+    raw_bounce_pool_get_stats(&s->bounce_pool, file_stats);
+    QLIST_FOREACH(q, &s->aio_queues, next) {
+        raw_bounce_pool_get_stats(&q->bounce_pool, file_stats);
+    }
+
+    *spec_stats = (BlockStatsSpecific){
+        .kind  = BLOCK_STATS_SPECIFIC_KIND_FILE,
+        {
+            .file = file_stats,
+        },
+    };
+
+    return spec_stats;
+}
+
 static QemuOptsList raw_create_opts = {
     .name = "raw-create-opts",
     .head = QTAILQ_HEAD_INITIALIZER(raw_create_opts.head),
@@ -1709,15 +2218,21 @@ static BlockDriver bdrv_file = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_flush_io_queue = raw_aio_flush_io_queue,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_truncate = raw_truncate,
     .bdrv_getlength = raw_getlength,
     .bdrv_get_info = raw_get_info,
+    .bdrv_get_specific_stats = raw_get_specific_stats,
     .bdrv_get_allocated_file_size
                         = raw_get_allocated_file_size,
 
     .bdrv_detach_aio_context = raw_detach_aio_context,
     .bdrv_attach_aio_context = raw_attach_aio_context,
+    .bdrv_add_aio_queue = raw_add_aio_queue,
+    .bdrv_del_aio_queue = raw_del_aio_queue,
+    .bdrv_aio_mq_rw = raw_aio_mq_rw,
 
     .create_opts = &raw_create_opts,
 };
@@ -2111,15 +2626,21 @@ static BlockDriver bdrv_host_device = {
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
     .bdrv_flush_io_queue = raw_aio_flush_io_queue,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength	= raw_getlength,
     .bdrv_get_info = raw_get_info,
+    .bdrv_get_specific_stats = raw_get_specific_stats,
     .bdrv_get_allocated_file_size
                         = raw_get_allocated_file_size,
 
     .bdrv_detach_aio_context = raw_detach_aio_context,
     .bdrv_attach_aio_context = raw_attach_aio_context,
+    .bdrv_add_aio_queue = raw_add_aio_queue,
+    .bdrv_del_aio_queue = raw_del_aio_queue,
+    .bdrv_aio_mq_rw = raw_aio_mq_rw,
 
     /* generic scsi device */
 #ifdef __linux__
@@ -137,6 +137,30 @@ static BlockAIOCB *raw_aio_ioctl(BlockDriverState *bs,
     return bdrv_aio_ioctl(bs->file, req, buf, cb, opaque);
 }
 
+static int raw_add_aio_queue(BlockDriverState *bs, AioContext *ctx,
+                             Error **errp)
+{
+    return bdrv_add_aio_queue(bs->file, ctx, errp);
+}
+
+static void raw_del_aio_queue(BlockDriverState *bs, AioContext *ctx)
+{
+    bdrv_del_aio_queue(bs->file, ctx);
+}
+
+static BlockAIOCB *raw_aio_mq_rw(BlockDriverState *bs, AioContext *ctx,
+                                 int64_t sector_num, QEMUIOVector *qiov,
+                                 int nb_sectors, BlockCompletionFunc *cb,
+                                 void *opaque, bool is_write)
+{
+    if (is_write) {
+        return bdrv_aio_writev_mq(bs->file, ctx, sector_num, qiov,
+                                  nb_sectors, cb, opaque);
+    }
+    return bdrv_aio_readv_mq(bs->file, ctx, sector_num, qiov, nb_sectors,
+                             cb, opaque);
+}
+
 static int raw_has_zero_init(BlockDriverState *bs)
 {
     return bdrv_has_zero_init(bs->file);
@@ -196,6 +220,9 @@ static BlockDriver bdrv_raw = {
     .bdrv_lock_medium     = &raw_lock_medium,
     .bdrv_ioctl           = &raw_ioctl,
     .bdrv_aio_ioctl       = &raw_aio_ioctl,
+    .bdrv_add_aio_queue   = &raw_add_aio_queue,
+    .bdrv_del_aio_queue   = &raw_del_aio_queue,
+    .bdrv_aio_mq_rw       = &raw_aio_mq_rw,
     .create_opts          = &raw_create_opts,
     .bdrv_has_zero_init   = &raw_has_zero_init
 };
@@ -16,6 +16,7 @@
 #include "qemu-common.h"
 #include "qemu/error-report.h"
 #include "block/block_int.h"
+#include "qemu/thread.h"
 
 #include <rbd/librbd.h>
 
@@ -51,6 +52,14 @@
 #undef LIBRBD_SUPPORTS_DISCARD
 #endif
 
+/* rbd_aio_readv/rbd_aio_writev take the guest iovec directly, so
+ * that requests need no bounce buffer */
+#ifdef LIBRBD_SUPPORTS_IOVEC
+#define LIBRBD_USE_IOVEC 1
+#else
+#define LIBRBD_USE_IOVEC 0
+#endif
+
 #define OBJ_MAX_SIZE (1UL << OBJ_DEFAULT_OBJ_ORDER)
 
 #define RBD_MAX_CONF_NAME_SIZE 128
@@ -69,7 +78,6 @@ typedef enum {
 
 typedef struct RBDAIOCB {
     BlockAIOCB common;
-    QEMUBH *bh;
     int64_t ret;
     QEMUIOVector *qiov;
     char *bounce;
@@ -88,6 +96,7 @@ typedef struct RADOSCB {
     int64_t size;
     char *buf;
     int64_t ret;
+    QSIMPLEQ_ENTRY(RADOSCB) next;
 } RADOSCB;
 
 #define RBD_FD_READ 0
@@ -99,6 +108,11 @@ typedef struct BDRVRBDState {
     rbd_image_t image;
     char name[RBD_MAX_IMAGE_NAME_SIZE];
     char *snap;
+
+    /* Requests completed by librbd threads, waiting for completion_bh */
+    QemuMutex completion_lock;
+    QSIMPLEQ_HEAD(, RADOSCB) completed;
+    QEMUBH *completion_bh;
 } BDRVRBDState;
 
 static int qemu_rbd_next_tok(char *dst, int dst_len,
@@ -365,6 +379,16 @@ static int qemu_rbd_create(const char *filename, QemuOpts *opts, Error **errp)
     return ret;
 }
 
+static void qemu_rbd_memset(RADOSCB *rcb, int64_t offs)
+{
+    if (LIBRBD_USE_IOVEC) {
+        RBDAIOCB *acb = rcb->acb;
+        qemu_iovec_memset(acb->qiov, offs, 0, acb->qiov->size - offs);
+    } else {
+        memset(rcb->buf + offs, 0, rcb->size - offs);
+    }
+}
+
 /*
  * This aio completion is being called from rbd_finish_bh() and runs in qemu
  * BH context.
@@ -385,11 +409,11 @@ static void qemu_rbd_complete_aio(RADOSCB *rcb)
         }
     } else {
         if (r < 0) {
-            memset(rcb->buf, 0, rcb->size);
+            qemu_rbd_memset(rcb, 0);
             acb->ret = r;
             acb->error = 1;
         } else if (r < rcb->size) {
-            memset(rcb->buf + r, 0, rcb->size - r);
+            qemu_rbd_memset(rcb, r);
             if (!acb->error) {
                 acb->ret = rcb->size;
             }
@@ -400,7 +424,7 @@ static void qemu_rbd_complete_aio(RADOSCB *rcb)
 
     g_free(rcb);
 
-    if (acb->cmd == RBD_AIO_READ) {
+    if (!LIBRBD_USE_IOVEC && acb->cmd == RBD_AIO_READ) {
         qemu_iovec_from_buf(acb->qiov, 0, acb->bounce, acb->qiov->size);
     }
     qemu_vfree(acb->bounce);
@@ -424,6 +448,43 @@ static QemuOptsList runtime_opts = {
     },
 };
 
+/*
+ * Complete all the requests that librbd has finished so far.  Runs in
+ * the AioContext of the BlockDriverState.
+ */
+static void rbd_finish_bh(void *opaque)
+{
+    BDRVRBDState *s = opaque;
+    QSIMPLEQ_HEAD(, RADOSCB) completed;
+    RADOSCB *rcb;
+
+    QSIMPLEQ_INIT(&completed);
+    qemu_mutex_lock(&s->completion_lock);
+    QSIMPLEQ_CONCAT(&completed, &s->completed);
+    qemu_mutex_unlock(&s->completion_lock);
+
+    while ((rcb = QSIMPLEQ_FIRST(&completed)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&completed, next);
+        qemu_rbd_complete_aio(rcb);
+    }
+}
+
+static void qemu_rbd_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    qemu_bh_delete(s->completion_bh);
+    s->completion_bh = NULL;
+}
+
+static void qemu_rbd_attach_aio_context(BlockDriverState *bs,
+                                        AioContext *new_context)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    s->completion_bh = aio_bh_new(new_context, rbd_finish_bh, s);
+}
+
 static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
                          Error **errp)
 {
@@ -511,6 +572,10 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
         goto failed_open;
     }
 
+    qemu_mutex_init(&s->completion_lock);
+    QSIMPLEQ_INIT(&s->completed);
+    qemu_rbd_attach_aio_context(bs, bdrv_get_aio_context(bs));
+
     bs->read_only = (s->snap != NULL);
 
     qemu_opts_del(opts);
@@ -531,6 +596,8 @@ static void qemu_rbd_close(BlockDriverState *bs)
     BDRVRBDState *s = bs->opaque;
 
     rbd_close(s->image);
+    qemu_rbd_detach_aio_context(bs);
+    qemu_mutex_destroy(&s->completion_lock);
     rados_ioctx_destroy(s->io_ctx);
     g_free(s->snap);
     rados_shutdown(s->cluster);
@@ -540,31 +607,28 @@ static const AIOCBInfo rbd_aiocb_info = {
     .aiocb_size = sizeof(RBDAIOCB),
 };
 
-static void rbd_finish_bh(void *opaque)
-{
-    RADOSCB *rcb = opaque;
-    qemu_bh_delete(rcb->acb->bh);
-    qemu_rbd_complete_aio(rcb);
-}
-
 /*
  * This is the callback function for rbd_aio_read and _write
  *
  * Note: this function is being called from a non qemu thread so
  * we need to be careful about what we do here. Generally we only
- * schedule a BH, and do the rest of the io completion handling
- * from rbd_finish_bh() which runs in a qemu context.
+ * queue the request and kick the BH, and do the rest of the io
+ * completion handling from rbd_finish_bh() which runs in a qemu
+ * context.  A single BH serves all requests of the image, so a burst
+ * of completions is handled in one go.
  */
 static void rbd_finish_aiocb(rbd_completion_t c, RADOSCB *rcb)
 {
-    RBDAIOCB *acb = rcb->acb;
+    BDRVRBDState *s = rcb->s;
 
     rcb->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
 
-    acb->bh = aio_bh_new(bdrv_get_aio_context(acb->common.bs),
-                         rbd_finish_bh, rcb);
-    qemu_bh_schedule(acb->bh);
+    qemu_mutex_lock(&s->completion_lock);
+    QSIMPLEQ_INSERT_TAIL(&s->completed, rcb, next);
+    qemu_mutex_unlock(&s->completion_lock);
+
+    qemu_bh_schedule(s->completion_bh);
 }
 
 static int rbd_aio_discard_wrapper(rbd_image_t image,
@@ -609,7 +673,7 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
     acb = qemu_aio_get(&rbd_aiocb_info, bs, cb, opaque);
     acb->cmd = cmd;
     acb->qiov = qiov;
-    if (cmd == RBD_AIO_DISCARD || cmd == RBD_AIO_FLUSH) {
+    if (cmd == RBD_AIO_DISCARD || cmd == RBD_AIO_FLUSH || LIBRBD_USE_IOVEC) {
         acb->bounce = NULL;
     } else {
         acb->bounce = qemu_try_blockalign(bs, qiov->size);
@@ -620,10 +684,9 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
     acb->ret = 0;
     acb->error = 0;
     acb->s = s;
-    acb->bh = NULL;
     acb->status = -EINPROGRESS;
 
-    if (cmd == RBD_AIO_WRITE) {
+    if (!LIBRBD_USE_IOVEC && cmd == RBD_AIO_WRITE) {
         qemu_iovec_to_buf(acb->qiov, 0, acb->bounce, qiov->size);
     }
 
@@ -645,10 +708,18 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
 
     switch (cmd) {
     case RBD_AIO_WRITE:
+#ifdef LIBRBD_SUPPORTS_IOVEC
+        r = rbd_aio_writev(s->image, qiov->iov, qiov->niov, off, c);
+#else
         r = rbd_aio_write(s->image, off, size, buf, c);
+#endif
         break;
     case RBD_AIO_READ:
+#ifdef LIBRBD_SUPPORTS_IOVEC
+        r = rbd_aio_readv(s->image, qiov->iov, qiov->niov, off, c);
+#else
         r = rbd_aio_read(s->image, off, size, buf, c);
+#endif
         break;
     case RBD_AIO_DISCARD:
         r = rbd_aio_discard_wrapper(s->image, off, size, c);
@@ -951,6 +1022,9 @@ static BlockDriver bdrv_rbd = {
 #ifdef LIBRBD_SUPPORTS_INVALIDATE
     .bdrv_invalidate_cache  = qemu_rbd_invalidate_cache,
 #endif
+
+    .bdrv_detach_aio_context = qemu_rbd_detach_aio_context,
+    .bdrv_attach_aio_context = qemu_rbd_attach_aio_context,
 };
 
 static void bdrv_rbd_init(void)
@@ -291,7 +291,7 @@ static void vdi_header_print(VdiHeader *header)
 #endif
 
 static int vdi_check(BlockDriverState *bs, BdrvCheckResult *res,
-                     BdrvCheckMode fix)
+                     BdrvCheckMode fix, BlockDriverCheckStatusCB *status_cb)
 {
     /* TODO: additional checks possible. */
     BDRVVdiState *s = (BDRVVdiState *)bs->opaque;
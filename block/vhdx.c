@@ -1080,6 +1080,11 @@ static int vhdx_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 }
 
 
+/*
+ * Reads do not take s->lock: the BAT lookup does not yield, and
+ * vhdx_co_writev() only updates the in-memory BAT once the data of a
+ * newly allocated block has been written.
+ */
 static coroutine_fn int vhdx_co_readv(BlockDriverState *bs, int64_t sector_num,
                                       int nb_sectors, QEMUIOVector *qiov)
 {
@@ -1091,8 +1096,6 @@ static coroutine_fn int vhdx_co_readv(BlockDriverState *bs, int64_t sector_num,
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
-    qemu_co_mutex_lock(&s->lock);
-
     while (nb_sectors > 0) {
         /* We are a differencing file, so we need to inspect the sector bitmap
          * to see if we have the data or not */
@@ -1116,11 +1119,9 @@ static coroutine_fn int vhdx_co_readv(BlockDriverState *bs, int64_t sector_num,
                 qemu_iovec_memset(&hd_qiov, 0, 0, sinfo.bytes_avail);
                 break;
             case PAYLOAD_BLOCK_FULLY_PRESENT:
-                qemu_co_mutex_unlock(&s->lock);
                 ret = bdrv_co_readv(bs->file,
                                     sinfo.file_offset >> BDRV_SECTOR_BITS,
                                     sinfo.sectors_avail, &hd_qiov);
-                qemu_co_mutex_lock(&s->lock);
                 if (ret < 0) {
                     goto exit;
                 }
@@ -1140,7 +1141,6 @@ static coroutine_fn int vhdx_co_readv(BlockDriverState *bs, int64_t sector_num,
     }
     ret = 0;
 exit:
-    qemu_co_mutex_unlock(&s->lock);
     qemu_iovec_destroy(&hd_qiov);
     return ret;
 }
@@ -1208,7 +1208,7 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
     struct iovec iov2 = { 0 };
     int sectors_to_write;
     int bat_state;
-    uint64_t bat_prior_offset = 0;
+    uint64_t block_offset = 0;
     bool bat_update = false;
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
@@ -1282,17 +1282,14 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
             case PAYLOAD_BLOCK_NOT_PRESENT: /* fall through */
             case PAYLOAD_BLOCK_UNMAPPED:    /* fall through */
             case PAYLOAD_BLOCK_UNDEFINED:   /* fall through */
-                bat_prior_offset = sinfo.file_offset;
                 ret = vhdx_allocate_block(bs, s, &sinfo.file_offset);
                 if (ret < 0) {
                     goto exit;
                 }
-                /* once we support differencing files, this may also be
-                 * partially present */
-                /* update block state to the newly specified state */
-                vhdx_update_bat_table_entry(bs, s, &sinfo, &bat_entry,
-                                            &bat_entry_offset,
-                                            PAYLOAD_BLOCK_FULLY_PRESENT);
+                /* the BAT entry is updated once the data is written, so
+                 * that reads (which don't take s->lock) never see the
+                 * block before its contents */
+                block_offset = sinfo.file_offset;
                 bat_update = true;
                 /* since we just allocated a block, file_offset is the
                  * beginning of the payload block. It needs to be the
@@ -1306,21 +1303,27 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
                  * there is a problem */
                 if (sinfo.file_offset < (1024 * 1024)) {
                     ret = -EFAULT;
-                    goto error_bat_restore;
+                    goto exit;
                 }
 
                 if (!use_zero_buffers) {
                     qemu_iovec_concat(&hd_qiov, qiov,  bytes_done,
                                       sinfo.bytes_avail);
                 }
-                /* block exists, so we can just overwrite it */
-                qemu_co_mutex_unlock(&s->lock);
+                /* block exists, so we can just overwrite it; a newly
+                 * allocated block keeps the lock until its BAT entry is
+                 * updated, so that nobody else allocates it too */
+                if (!bat_update) {
+                    qemu_co_mutex_unlock(&s->lock);
+                }
                 ret = bdrv_co_writev(bs->file,
                                     sinfo.file_offset >> BDRV_SECTOR_BITS,
                                     sectors_to_write, &hd_qiov);
-                qemu_co_mutex_lock(&s->lock);
+                if (!bat_update) {
+                    qemu_co_mutex_lock(&s->lock);
+                }
                 if (ret < 0) {
-                    goto error_bat_restore;
+                    goto exit;
                 }
                 break;
             case PAYLOAD_BLOCK_PARTIALLY_PRESENT:
@@ -1333,6 +1336,13 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
             }
 
             if (bat_update) {
+                /* once we support differencing files, this may also be
+                 * partially present */
+                /* update block state to the newly specified state */
+                sinfo.file_offset = block_offset;
+                vhdx_update_bat_table_entry(bs, s, &sinfo, &bat_entry,
+                                            &bat_entry_offset,
+                                            PAYLOAD_BLOCK_FULLY_PRESENT);
                 /* this will update the BAT entry into the log journal, and
                  * then flush the log journal out to disk */
                 ret =  vhdx_log_write_and_flush(bs, s, &bat_entry,
@@ -1350,16 +1360,6 @@ static coroutine_fn int vhdx_co_writev(BlockDriverState *bs, int64_t sector_num,
         }
     }
 
-    goto exit;
-
-error_bat_restore:
-    if (bat_update) {
-        /* keep metadata in sync, and restore the bat entry state
-         * if error. */
-        sinfo.file_offset = bat_prior_offset;
-        vhdx_update_bat_table_entry(bs, s, &sinfo, &bat_entry,
-                                    &bat_entry_offset, bat_state);
-    }
 exit:
     qemu_vfree(iov1.iov_base);
     qemu_vfree(iov2.iov_base);
@@ -1894,7 +1894,7 @@ exit:
  * for us to do here
  */
 static int vhdx_check(BlockDriverState *bs, BdrvCheckResult *result,
-                       BdrvCheckMode fix)
+                       BdrvCheckMode fix, BlockDriverCheckStatusCB *status_cb)
 {
     BDRVVHDXState *s = bs->opaque;
 
@@ -81,7 +81,9 @@ typedef struct {
     uint16_t compressAlgorithm;
 } QEMU_PACKED VMDK4Header;
 
-#define L2_CACHE_SIZE 16
+/* Number of L2 tables cached per extent.  Slots are allocated on first
+ * use, so extents that are barely touched stay cheap. */
+#define L2_CACHE_SIZE 128
 
 typedef struct VmdkExtent {
     BlockDriverState *file;
@@ -101,9 +103,10 @@ typedef struct VmdkExtent {
     uint32_t l1_entry_sectors;
 
     unsigned int l2_size;
-    uint32_t *l2_cache;
+    uint32_t *l2_cache[L2_CACHE_SIZE];
     uint32_t l2_cache_offsets[L2_CACHE_SIZE];
-    uint32_t l2_cache_counts[L2_CACHE_SIZE];
+    uint64_t l2_cache_lru[L2_CACHE_SIZE];  /* l2_cache_clock at last use */
+    uint64_t l2_cache_clock;
 
     int64_t cluster_sectors;
     int64_t next_cluster_sector;
@@ -111,6 +114,8 @@ typedef struct VmdkExtent {
 } VmdkExtent;
 
 typedef struct BDRVVmdkState {
+    /* Protects the L2 caches, cluster allocation, L2 updates and the CID.
+     * Data I/O to clusters that are already allocated runs without it. */
     CoMutex lock;
     uint64_t desc_offset;
     bool cid_updated;
@@ -129,6 +134,7 @@ typedef struct VmdkMetaData {
     unsigned int l2_index;
     unsigned int l2_offset;
     int valid;
+    bool new_allocation;
     uint32_t *l2_cache_entry;
 } VmdkMetaData;
 
@@ -208,14 +214,16 @@ static int vmdk_probe(const uint8_t *buf, int buf_size, const char *filename)
 
 static void vmdk_free_extents(BlockDriverState *bs)
 {
-    int i;
+    int i, j;
     BDRVVmdkState *s = bs->opaque;
     VmdkExtent *e;
 
     for (i = 0; i < s->num_extents; i++) {
         e = &s->extents[i];
         g_free(e->l1_table);
-        g_free(e->l2_cache);
+        for (j = 0; j < L2_CACHE_SIZE; j++) {
+            g_free(e->l2_cache[j]);
+        }
         g_free(e->l1_backup_table);
         g_free(e->type);
         if (e->file != bs->file) {
@@ -494,8 +502,6 @@ static int vmdk_init_tables(BlockDriverState *bs, VmdkExtent *extent,
         }
     }
 
-    extent->l2_cache =
-        g_new(uint32_t, extent->l2_size * L2_CACHE_SIZE);
     return 0;
  fail_l1b:
     g_free(extent->l1_backup_table);
@@ -1109,14 +1115,16 @@ static int get_cluster_offset(BlockDriverState *bs,
                               uint64_t skip_end_sector)
 {
     unsigned int l1_index, l2_offset, l2_index;
-    int min_index, i, j;
-    uint32_t min_count, *l2_table;
+    int min_index, i;
+    uint64_t min_lru;
+    uint32_t *l2_table;
     bool zeroed = false;
     int64_t ret;
     int64_t cluster_sector;
 
     if (m_data) {
         m_data->valid = 0;
+        m_data->new_allocation = false;
     }
     if (extent->flat) {
         *cluster_offset = extent->flat_start_offset;
@@ -1134,26 +1142,28 @@ static int get_cluster_offset(BlockDriverState *bs,
     }
     for (i = 0; i < L2_CACHE_SIZE; i++) {
         if (l2_offset == extent->l2_cache_offsets[i]) {
-            /* increment the hit count */
-            if (++extent->l2_cache_counts[i] == 0xffffffff) {
-                for (j = 0; j < L2_CACHE_SIZE; j++) {
-                    extent->l2_cache_counts[j] >>= 1;
-                }
-            }
-            l2_table = extent->l2_cache + (i * extent->l2_size);
+            extent->l2_cache_lru[i] = ++extent->l2_cache_clock;
+            l2_table = extent->l2_cache[i];
             goto found;
         }
     }
-    /* not found: load a new entry in the least used one */
+    /* not found: load a new entry in a free slot, or the least recently
+     * used one */
     min_index = 0;
-    min_count = 0xffffffff;
+    min_lru = UINT64_MAX;
     for (i = 0; i < L2_CACHE_SIZE; i++) {
-        if (extent->l2_cache_counts[i] < min_count) {
-            min_count = extent->l2_cache_counts[i];
+        if (!extent->l2_cache[i]) {
+            extent->l2_cache[i] = g_new(uint32_t, extent->l2_size);
+            min_index = i;
+            break;
+        }
+        if (extent->l2_cache_lru[i] < min_lru) {
+            min_lru = extent->l2_cache_lru[i];
             min_index = i;
         }
     }
-    l2_table = extent->l2_cache + (min_index * extent->l2_size);
+    l2_table = extent->l2_cache[min_index];
+    extent->l2_cache_offsets[min_index] = 0;
     if (bdrv_pread(
                 extent->file,
                 (int64_t)l2_offset * 512,
@@ -1164,7 +1174,7 @@ static int get_cluster_offset(BlockDriverState *bs,
     }
 
     extent->l2_cache_offsets[min_index] = l2_offset;
-    extent->l2_cache_counts[min_index] = 1;
+    extent->l2_cache_lru[min_index] = ++extent->l2_cache_clock;
  found:
     l2_index = ((offset >> 9) / extent->cluster_sectors) % extent->l2_size;
     cluster_sector = le32_to_cpu(l2_table[l2_index]);
@@ -1187,6 +1197,9 @@ static int get_cluster_offset(BlockDriverState *bs,
 
         cluster_sector = extent->next_cluster_sector;
         extent->next_cluster_sector += extent->cluster_sectors;
+        if (m_data) {
+            m_data->new_allocation = true;
+        }
 
         /* First of all we write grain itself, to avoid race condition
          * that may to corrupt the image.
@@ -1268,36 +1281,44 @@ static int64_t coroutine_fn vmdk_co_get_block_status(BlockDriverState *bs,
     return ret;
 }
 
-static int vmdk_write_extent(VmdkExtent *extent, int64_t cluster_offset,
-                            int64_t offset_in_cluster, const uint8_t *buf,
-                            int nb_sectors, int64_t sector_num)
+static int coroutine_fn vmdk_write_extent(VmdkExtent *extent,
+                                          int64_t cluster_offset,
+                                          int64_t offset_in_cluster,
+                                          QEMUIOVector *qiov,
+                                          int nb_sectors, int64_t sector_num)
 {
     int ret;
     VmdkGrainMarker *data = NULL;
     uLongf buf_len;
-    const uint8_t *write_buf = buf;
-    int write_len = nb_sectors * 512;
+    uint8_t *buf = NULL;
+    int write_len;
 
-    if (extent->compressed) {
-        if (!extent->has_marker) {
-            ret = -EINVAL;
-            goto out;
-        }
-        buf_len = (extent->cluster_sectors << 9) * 2;
-        data = g_malloc(buf_len + sizeof(VmdkGrainMarker));
-        if (compress(data->data, &buf_len, buf, nb_sectors << 9) != Z_OK ||
-                buf_len == 0) {
-            ret = -EINVAL;
-            goto out;
-        }
-        data->lba = sector_num;
-        data->size = buf_len;
-        write_buf = (uint8_t *)data;
-        write_len = buf_len + sizeof(VmdkGrainMarker);
+    if (!extent->compressed) {
+        return bdrv_co_writev(extent->file,
+                              (cluster_offset + offset_in_cluster) >>
+                                  BDRV_SECTOR_BITS,
+                              nb_sectors, qiov);
     }
+
+    if (!extent->has_marker) {
+        ret = -EINVAL;
+        goto out;
+    }
+    buf = g_malloc(nb_sectors << 9);
+    qemu_iovec_to_buf(qiov, 0, buf, nb_sectors << 9);
+    buf_len = (extent->cluster_sectors << 9) * 2;
+    data = g_malloc(buf_len + sizeof(VmdkGrainMarker));
+    if (compress(data->data, &buf_len, buf, nb_sectors << 9) != Z_OK ||
+            buf_len == 0) {
+        ret = -EINVAL;
+        goto out;
+    }
+    data->lba = sector_num;
+    data->size = buf_len;
+    write_len = buf_len + sizeof(VmdkGrainMarker);
     ret = bdrv_pwrite(extent->file,
                         cluster_offset + offset_in_cluster,
-                        write_buf,
+                        data,
                         write_len);
     if (ret != write_len) {
         ret = ret < 0 ? ret : -EIO;
@@ -1306,12 +1327,15 @@ static int vmdk_write_extent(VmdkExtent *extent, int64_t cluster_offset,
     ret = 0;
  out:
     g_free(data);
+    g_free(buf);
     return ret;
 }
 
-static int vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
-                            int64_t offset_in_cluster, uint8_t *buf,
-                            int nb_sectors)
+static int coroutine_fn vmdk_read_extent(VmdkExtent *extent,
+                                         int64_t cluster_offset,
+                                         int64_t offset_in_cluster,
+                                         QEMUIOVector *qiov,
+                                         int nb_sectors)
 {
     int ret;
     int cluster_bytes, buf_bytes;
@@ -1323,14 +1347,10 @@ static int vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
 
 
     if (!extent->compressed) {
-        ret = bdrv_pread(extent->file,
-                          cluster_offset + offset_in_cluster,
-                          buf, nb_sectors * 512);
-        if (ret == nb_sectors * 512) {
-            return 0;
-        } else {
-            return -EIO;
-        }
+        return bdrv_co_readv(extent->file,
+                             (cluster_offset + offset_in_cluster) >>
+                                 BDRV_SECTOR_BITS,
+                             nb_sectors, qiov);
     }
     cluster_bytes = extent->cluster_sectors * 512;
     /* Read two clusters in case GrainMarker + compressed data > one cluster */
@@ -1366,7 +1386,8 @@ static int vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
         ret = -EINVAL;
         goto out;
     }
-    memcpy(buf, uncomp_buf + offset_in_cluster, nb_sectors * 512);
+    qemu_iovec_from_buf(qiov, 0, uncomp_buf + offset_in_cluster,
+                        nb_sectors * 512);
     ret = 0;
 
  out:
@@ -1375,8 +1396,13 @@ static int vmdk_read_extent(VmdkExtent *extent, int64_t cluster_offset,
     return ret;
 }
 
-static int vmdk_read(BlockDriverState *bs, int64_t sector_num,
-                    uint8_t *buf, int nb_sectors)
+/*
+ * Only the L2 lookup runs under s->lock; the data of allocated clusters
+ * and of the backing file is read without it, so that requests proceed
+ * in parallel.
+ */
+static coroutine_fn int vmdk_co_readv(BlockDriverState *bs, int64_t sector_num,
+                                      int nb_sectors, QEMUIOVector *qiov)
 {
     BDRVVmdkState *s = bs->opaque;
     int ret;
@@ -1384,15 +1410,22 @@ static int vmdk_read(BlockDriverState *bs, int64_t sector_num,
     uint64_t extent_begin_sector, extent_relative_sector_num;
     VmdkExtent *extent = NULL;
     uint64_t cluster_offset;
+    uint64_t bytes_done = 0;
+    QEMUIOVector local_qiov;
+
+    qemu_iovec_init(&local_qiov, qiov->niov);
 
     while (nb_sectors > 0) {
         extent = find_extent(s, sector_num, extent);
         if (!extent) {
-            return -EIO;
+            ret = -EIO;
+            goto fail;
         }
+        qemu_co_mutex_lock(&s->lock);
         ret = get_cluster_offset(bs, extent, NULL,
                                  sector_num << 9, false, &cluster_offset,
                                  0, 0);
+        qemu_co_mutex_unlock(&s->lock);
         extent_begin_sector = extent->end_sector - extent->sectors;
         extent_relative_sector_num = sector_num - extent_begin_sector;
         index_in_cluster = extent_relative_sector_num % extent->cluster_sectors;
@@ -1400,58 +1433,65 @@ static int vmdk_read(BlockDriverState *bs, int64_t sector_num,
         if (n > nb_sectors) {
             n = nb_sectors;
         }
+
+        qemu_iovec_reset(&local_qiov);
+        qemu_iovec_concat(&local_qiov, qiov, bytes_done, n * 512);
+
         if (ret != VMDK_OK) {
             /* if not allocated, try to read from parent image, if exist */
             if (bs->backing_hd && ret != VMDK_ZEROED) {
-                if (!vmdk_is_cid_valid(bs)) {
-                    return -EINVAL;
+                qemu_co_mutex_lock(&s->lock);
+                ret = vmdk_is_cid_valid(bs);
+                qemu_co_mutex_unlock(&s->lock);
+                if (!ret) {
+                    ret = -EINVAL;
+                    goto fail;
                 }
-                ret = bdrv_read(bs->backing_hd, sector_num, buf, n);
+                ret = bdrv_co_readv(bs->backing_hd, sector_num, n,
+                                    &local_qiov);
                 if (ret < 0) {
-                    return ret;
+                    goto fail;
                 }
             } else {
-                memset(buf, 0, 512 * n);
+                qemu_iovec_memset(&local_qiov, 0, 0, n * 512);
             }
         } else {
             ret = vmdk_read_extent(extent,
                             cluster_offset, index_in_cluster * 512,
-                            buf, n);
+                            &local_qiov, n);
             if (ret) {
-                return ret;
+                goto fail;
             }
         }
         nb_sectors -= n;
         sector_num += n;
-        buf += n * 512;
+        bytes_done += n * 512;
     }
-    return 0;
-}
+    ret = 0;
 
-static coroutine_fn int vmdk_co_read(BlockDriverState *bs, int64_t sector_num,
-                                     uint8_t *buf, int nb_sectors)
-{
-    int ret;
-    BDRVVmdkState *s = bs->opaque;
-    qemu_co_mutex_lock(&s->lock);
-    ret = vmdk_read(bs, sector_num, buf, nb_sectors);
-    qemu_co_mutex_unlock(&s->lock);
+fail:
+    qemu_iovec_destroy(&local_qiov);
     return ret;
 }
 
 /**
- * vmdk_write:
- * @zeroed:       buf is ignored (data is zero), use zeroed_grain GTE feature
+ * vmdk_pwritev:
+ * @zeroed:       qiov is ignored (data is zero), use zeroed_grain GTE feature
  *                if possible, otherwise return -ENOTSUP.
  * @zero_dry_run: used for zeroed == true only, don't update L2 table, just try
  *                with each cluster. By dry run we can find if the zero write
  *                is possible without modifying image data.
  *
+ * s->lock is held while looking up and allocating clusters; a write
+ * that allocates a cluster keeps it until the L2 table points to the
+ * new data, so that no other request can allocate the same cluster.
+ * Overwrites of allocated clusters drop it before writing the data.
+ *
  * Returns: error code with 0 for success.
  */
-static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
-                      const uint8_t *buf, int nb_sectors,
-                      bool zeroed, bool zero_dry_run)
+static int coroutine_fn vmdk_pwritev(BlockDriverState *bs, int64_t sector_num,
+                                     QEMUIOVector *qiov, int nb_sectors,
+                                     bool zeroed, bool zero_dry_run)
 {
     BDRVVmdkState *s = bs->opaque;
     VmdkExtent *extent = NULL;
@@ -1459,7 +1499,9 @@ static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
     int64_t index_in_cluster, n;
     uint64_t extent_begin_sector, extent_relative_sector_num;
     uint64_t cluster_offset;
+    uint64_t bytes_done = 0;
     VmdkMetaData m_data;
+    QEMUIOVector local_qiov;
 
     if (sector_num > bs->total_sectors) {
         error_report("Wrong offset: sector_num=0x%" PRIx64
@@ -1468,10 +1510,13 @@ static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
         return -EIO;
     }
 
+    qemu_iovec_init(&local_qiov, zeroed ? 1 : qiov->niov);
+
     while (nb_sectors > 0) {
         extent = find_extent(s, sector_num, extent);
         if (!extent) {
-            return -EIO;
+            ret = -EIO;
+            goto fail;
         }
         extent_begin_sector = extent->end_sector - extent->sectors;
         extent_relative_sector_num = sector_num - extent_begin_sector;
@@ -1480,6 +1525,8 @@ static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
         if (n > nb_sectors) {
             n = nb_sectors;
         }
+
+        qemu_co_mutex_lock(&s->lock);
         ret = get_cluster_offset(bs, extent, &m_data, sector_num << 9,
                                  !(extent->compressed || zeroed),
                                  &cluster_offset,
@@ -1489,7 +1536,9 @@ static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
                 /* Refuse write to allocated cluster for streamOptimized */
                 error_report("Could not write to allocated cluster"
                               " for streamOptimized");
-                return -EIO;
+                qemu_co_mutex_unlock(&s->lock);
+                ret = -EIO;
+                goto fail;
             } else {
                 /* allocate */
                 ret = get_cluster_offset(bs, extent, &m_data, sector_num << 9,
@@ -1497,10 +1546,12 @@ static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
             }
         }
         if (ret == VMDK_ERROR) {
-            return -EINVAL;
+            qemu_co_mutex_unlock(&s->lock);
+            ret = -EINVAL;
+            goto fail;
         }
         if (zeroed) {
-            /* Do zeroed write, buf is ignored */
+            /* Do zeroed write, qiov is ignored */
             if (extent->has_zero_grain &&
                     index_in_cluster == 0 &&
                     n >= extent->cluster_sectors) {
@@ -1509,54 +1560,88 @@ static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
                     /* update L2 tables */
                     if (vmdk_L2update(extent, &m_data, VMDK_GTE_ZEROED)
                             != VMDK_OK) {
-                        return -EIO;
+                        qemu_co_mutex_unlock(&s->lock);
+                        ret = -EIO;
+                        goto fail;
                     }
                 }
+                qemu_co_mutex_unlock(&s->lock);
             } else {
-                return -ENOTSUP;
+                qemu_co_mutex_unlock(&s->lock);
+                ret = -ENOTSUP;
+                goto fail;
             }
         } else {
+            if (!m_data.new_allocation) {
+                qemu_co_mutex_unlock(&s->lock);
+            }
+
+            qemu_iovec_reset(&local_qiov);
+            qemu_iovec_concat(&local_qiov, qiov, bytes_done, n * 512);
             ret = vmdk_write_extent(extent,
                             cluster_offset, index_in_cluster * 512,
-                            buf, n, sector_num);
-            if (ret) {
-                return ret;
-            }
-            if (m_data.valid) {
+                            &local_qiov, n, sector_num);
+
+            if (m_data.new_allocation) {
                 /* update L2 tables */
-                if (vmdk_L2update(extent, &m_data,
-                                  cluster_offset >> BDRV_SECTOR_BITS)
+                if (!ret && vmdk_L2update(extent, &m_data,
+                                          cluster_offset >> BDRV_SECTOR_BITS)
                         != VMDK_OK) {
-                    return -EIO;
+                    ret = -EIO;
                 }
+                qemu_co_mutex_unlock(&s->lock);
+            }
+            if (ret) {
+                goto fail;
             }
         }
         nb_sectors -= n;
         sector_num += n;
-        buf += n * 512;
+        bytes_done += n * 512;
 
         /* update CID on the first write every time the virtual disk is
          * opened */
         if (!s->cid_updated) {
-            ret = vmdk_write_cid(bs, time(NULL));
-            if (ret < 0) {
-                return ret;
+            qemu_co_mutex_lock(&s->lock);
+            if (!s->cid_updated) {
+                ret = vmdk_write_cid(bs, time(NULL));
+                if (ret < 0) {
+                    qemu_co_mutex_unlock(&s->lock);
+                    goto fail;
+                }
+                s->cid_updated = true;
             }
-            s->cid_updated = true;
+            qemu_co_mutex_unlock(&s->lock);
         }
     }
-    return 0;
+    ret = 0;
+
+fail:
+    qemu_iovec_destroy(&local_qiov);
+    return ret;
 }
 
-static coroutine_fn int vmdk_co_write(BlockDriverState *bs, int64_t sector_num,
-                                      const uint8_t *buf, int nb_sectors)
+static coroutine_fn int vmdk_co_writev(BlockDriverState *bs,
+                                       int64_t sector_num,
+                                       int nb_sectors, QEMUIOVector *qiov)
 {
+    return vmdk_pwritev(bs, sector_num, qiov, nb_sectors, false, false);
+}
+
+typedef struct VmdkWriteCompressedCo {
+    BlockDriverState *bs;
+    int64_t sector_num;
+    QEMUIOVector *qiov;
+    int nb_sectors;
     int ret;
-    BDRVVmdkState *s = bs->opaque;
-    qemu_co_mutex_lock(&s->lock);
-    ret = vmdk_write(bs, sector_num, buf, nb_sectors, false, false);
-    qemu_co_mutex_unlock(&s->lock);
-    return ret;
+} VmdkWriteCompressedCo;
+
+static void coroutine_fn vmdk_co_write_compressed(void *opaque)
+{
+    VmdkWriteCompressedCo *co = opaque;
+
+    co->ret = vmdk_pwritev(co->bs, co->sector_num, co->qiov, co->nb_sectors,
+                           false, false);
 }
 
 static int vmdk_write_compressed(BlockDriverState *bs,
@@ -1565,11 +1650,38 @@ static int vmdk_write_compressed(BlockDriverState *bs,
                                  int nb_sectors)
 {
     BDRVVmdkState *s = bs->opaque;
-    if (s->num_extents == 1 && s->extents[0].compressed) {
-        return vmdk_write(bs, sector_num, buf, nb_sectors, false, false);
-    } else {
+    QEMUIOVector qiov;
+    struct iovec iov;
+    VmdkWriteCompressedCo co = {
+        .bs         = bs,
+        .sector_num = sector_num,
+        .qiov       = &qiov,
+        .nb_sectors = nb_sectors,
+        .ret        = -EINPROGRESS,
+    };
+
+    if (s->num_extents != 1 || !s->extents[0].compressed) {
         return -ENOTSUP;
     }
+
+    iov = (struct iovec) {
+        .iov_base   = (uint8_t *) buf,
+        .iov_len    = nb_sectors * BDRV_SECTOR_SIZE,
+    };
+    qemu_iovec_init_external(&qiov, &iov, 1);
+
+    if (qemu_in_coroutine()) {
+        vmdk_co_write_compressed(&co);
+    } else {
+        AioContext *aio_context = bdrv_get_aio_context(bs);
+        Coroutine *c = qemu_coroutine_create(vmdk_co_write_compressed);
+
+        qemu_coroutine_enter(c, &co);
+        while (co.ret == -EINPROGRESS) {
+            aio_poll(aio_context, true);
+        }
+    }
+    return co.ret;
 }
 
 static int coroutine_fn vmdk_co_write_zeroes(BlockDriverState *bs,
@@ -1578,15 +1690,13 @@ static int coroutine_fn vmdk_co_write_zeroes(BlockDriverState *bs,
                                              BdrvRequestFlags flags)
 {
     int ret;
-    BDRVVmdkState *s = bs->opaque;
-    qemu_co_mutex_lock(&s->lock);
+
     /* write zeroes could fail if sectors not aligned to cluster, test it with
      * dry_run == true before really updating image */
-    ret = vmdk_write(bs, sector_num, NULL, nb_sectors, true, true);
+    ret = vmdk_pwritev(bs, sector_num, NULL, nb_sectors, true, true);
     if (!ret) {
-        ret = vmdk_write(bs, sector_num, NULL, nb_sectors, true, false);
+        ret = vmdk_pwritev(bs, sector_num, NULL, nb_sectors, true, false);
     }
-    qemu_co_mutex_unlock(&s->lock);
     return ret;
 }
 
@@ -2060,7 +2170,7 @@ static ImageInfo *vmdk_get_extent_info(VmdkExtent *extent)
 }
 
 static int vmdk_check(BlockDriverState *bs, BdrvCheckResult *result,
-                      BdrvCheckMode fix)
+                      BdrvCheckMode fix, BlockDriverCheckStatusCB *status_cb)
 {
     BDRVVmdkState *s = bs->opaque;
     VmdkExtent *extent = NULL;
@@ -2234,8 +2344,8 @@ static BlockDriver bdrv_vmdk = {
     .bdrv_open                    = vmdk_open,
     .bdrv_check                   = vmdk_check,
     .bdrv_reopen_prepare          = vmdk_reopen_prepare,
-    .bdrv_read                    = vmdk_co_read,
-    .bdrv_write                   = vmdk_co_write,
+    .bdrv_co_readv                = vmdk_co_readv,
+    .bdrv_co_writev               = vmdk_co_writev,
     .bdrv_write_compressed        = vmdk_write_compressed,
     .bdrv_co_write_zeroes         = vmdk_co_write_zeroes,
     .bdrv_close                   = vmdk_close,
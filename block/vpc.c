@@ -431,39 +431,51 @@ static int rewrite_footer(BlockDriverState* bs)
 }
 
 /*
- * Allocates a new block. This involves writing a new footer and updating
- * the Block Allocation Table to use the space at the old end of the image
- * file (overwriting the old footer)
+ * Allocates a new block and writes the first data to it. This involves
+ * writing a new footer and updating the Block Allocation Table to use the
+ * space at the old end of the image file (overwriting the old footer)
  *
- * Returns the sectors' offset in the image file on success and < 0 on error
+ * The in-memory BAT is only updated once the data is on disk, so that
+ * concurrent readers, which do not take s->lock, never see the block
+ * before its contents.  Must be called with s->lock held.
+ *
+ * Returns 0 on success and < 0 on error
  */
-static int64_t alloc_block(BlockDriverState* bs, int64_t sector_num)
+static int coroutine_fn alloc_block(BlockDriverState *bs, int64_t sector_num,
+                                    QEMUIOVector *qiov, int nb_sectors)
 {
     BDRVVPCState *s = bs->opaque;
-    int64_t bat_offset;
+    int64_t bat_offset, bitmap_offset, data_offset;
     uint32_t index, bat_value;
     int ret;
     uint8_t bitmap[s->bitmap_size];
 
     // Check if sector_num is valid
     if ((sector_num < 0) || (sector_num > bs->total_sectors))
-        return -1;
+        return -EINVAL;
 
-    // Write entry into in-memory BAT
     index = (sector_num * 512) / s->block_size;
     if (s->pagetable[index] != 0xFFFFFFFF)
-        return -1;
+        return -EINVAL;
 
-    s->pagetable[index] = s->free_data_block_offset / 512;
+    bitmap_offset = s->free_data_block_offset;
+    data_offset = bitmap_offset + s->bitmap_size +
+                  (sector_num * 512) % s->block_size;
 
     // Initialize the block's bitmap
     memset(bitmap, 0xff, s->bitmap_size);
-    ret = bdrv_pwrite_sync(bs->file, s->free_data_block_offset, bitmap,
+    ret = bdrv_pwrite_sync(bs->file, bitmap_offset, bitmap,
         s->bitmap_size);
     if (ret < 0) {
         return ret;
     }
 
+    ret = bdrv_co_writev(bs->file, data_offset >> BDRV_SECTOR_BITS,
+                         nb_sectors, qiov);
+    if (ret < 0) {
+        return ret;
+    }
+
     // Write new footer (the old one will be overwritten)
     s->free_data_block_offset += s->block_size + s->bitmap_size;
     ret = rewrite_footer(bs);
@@ -472,16 +484,18 @@ static int64_t alloc_block(BlockDriverState* bs, int64_t sector_num)
 
     // Write BAT entry to disk
     bat_offset = s->bat_offset + (4 * index);
-    bat_value = cpu_to_be32(s->pagetable[index]);
+    bat_value = cpu_to_be32(bitmap_offset / 512);
     ret = bdrv_pwrite_sync(bs->file, bat_offset, &bat_value, 4);
     if (ret < 0)
         goto fail;
 
-    return get_sector_offset(bs, sector_num, 0);
+    /* Write entry into in-memory BAT */
+    s->pagetable[index] = bitmap_offset / 512;
+    return 0;
 
 fail:
     s->free_data_block_offset -= (s->block_size + s->bitmap_size);
-    return -1;
+    return ret;
 }
 
 static int vpc_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
@@ -497,18 +511,27 @@ static int vpc_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
-static int vpc_read(BlockDriverState *bs, int64_t sector_num,
-                    uint8_t *buf, int nb_sectors)
+/*
+ * Reads do not take s->lock: looking up the BAT does not yield, and
+ * alloc_block() only makes a block visible once its data is written.
+ */
+static coroutine_fn int vpc_co_readv(BlockDriverState *bs, int64_t sector_num,
+                                     int nb_sectors, QEMUIOVector *qiov)
 {
     BDRVVPCState *s = bs->opaque;
     int ret;
     int64_t offset;
     int64_t sectors, sectors_per_block;
+    uint64_t bytes_done = 0;
     VHDFooter *footer = (VHDFooter *) s->footer_buf;
+    QEMUIOVector local_qiov;
 
     if (be32_to_cpu(footer->type) == VHD_FIXED) {
-        return bdrv_read(bs->file, sector_num, buf, nb_sectors);
+        return bdrv_co_readv(bs->file, sector_num, nb_sectors, qiov);
     }
+
+    qemu_iovec_init(&local_qiov, qiov->niov);
+
     while (nb_sectors > 0) {
         offset = get_sector_offset(bs, sector_num, 0);
 
@@ -518,82 +541,86 @@ static int vpc_read(BlockDriverState *bs, int64_t sector_num,
             sectors = nb_sectors;
         }
 
+        qemu_iovec_reset(&local_qiov);
+        qemu_iovec_concat(&local_qiov, qiov, bytes_done,
+                          sectors * BDRV_SECTOR_SIZE);
+
         if (offset == -1) {
-            memset(buf, 0, sectors * BDRV_SECTOR_SIZE);
+            qemu_iovec_memset(&local_qiov, 0, 0, sectors * BDRV_SECTOR_SIZE);
         } else {
-            ret = bdrv_pread(bs->file, offset, buf,
-                sectors * BDRV_SECTOR_SIZE);
-            if (ret != sectors * BDRV_SECTOR_SIZE) {
-                return -1;
+            ret = bdrv_co_readv(bs->file, offset >> BDRV_SECTOR_BITS,
+                                sectors, &local_qiov);
+            if (ret < 0) {
+                goto fail;
             }
         }
 
         nb_sectors -= sectors;
         sector_num += sectors;
-        buf += sectors * BDRV_SECTOR_SIZE;
+        bytes_done += sectors * BDRV_SECTOR_SIZE;
     }
-    return 0;
-}
+    ret = 0;
 
-static coroutine_fn int vpc_co_read(BlockDriverState *bs, int64_t sector_num,
-                                    uint8_t *buf, int nb_sectors)
-{
-    int ret;
-    BDRVVPCState *s = bs->opaque;
-    qemu_co_mutex_lock(&s->lock);
-    ret = vpc_read(bs, sector_num, buf, nb_sectors);
-    qemu_co_mutex_unlock(&s->lock);
+fail:
+    qemu_iovec_destroy(&local_qiov);
     return ret;
 }
 
-static int vpc_write(BlockDriverState *bs, int64_t sector_num,
-    const uint8_t *buf, int nb_sectors)
+/*
+ * s->lock is taken to look up (and possibly initialize the bitmap of)
+ * the block, and held across the whole allocation of a new block.
+ * Overwrites of allocated blocks write their data without it.
+ */
+static coroutine_fn int vpc_co_writev(BlockDriverState *bs, int64_t sector_num,
+                                      int nb_sectors, QEMUIOVector *qiov)
 {
     BDRVVPCState *s = bs->opaque;
     int64_t offset;
     int64_t sectors, sectors_per_block;
+    uint64_t bytes_done = 0;
     int ret;
     VHDFooter *footer =  (VHDFooter *) s->footer_buf;
+    QEMUIOVector local_qiov;
 
     if (be32_to_cpu(footer->type) == VHD_FIXED) {
-        return bdrv_write(bs->file, sector_num, buf, nb_sectors);
+        return bdrv_co_writev(bs->file, sector_num, nb_sectors, qiov);
     }
-    while (nb_sectors > 0) {
-        offset = get_sector_offset(bs, sector_num, 1);
 
+    qemu_iovec_init(&local_qiov, qiov->niov);
+
+    while (nb_sectors > 0) {
         sectors_per_block = s->block_size >> BDRV_SECTOR_BITS;
         sectors = sectors_per_block - (sector_num % sectors_per_block);
         if (sectors > nb_sectors) {
             sectors = nb_sectors;
         }
 
+        qemu_iovec_reset(&local_qiov);
+        qemu_iovec_concat(&local_qiov, qiov, bytes_done,
+                          sectors * BDRV_SECTOR_SIZE);
+
+        qemu_co_mutex_lock(&s->lock);
+        offset = get_sector_offset(bs, sector_num, 1);
         if (offset == -1) {
-            offset = alloc_block(bs, sector_num);
-            if (offset < 0)
-                return -1;
+            ret = alloc_block(bs, sector_num, &local_qiov, sectors);
+            qemu_co_mutex_unlock(&s->lock);
+        } else {
+            qemu_co_mutex_unlock(&s->lock);
+            ret = bdrv_co_writev(bs->file, offset >> BDRV_SECTOR_BITS,
+                                 sectors, &local_qiov);
         }
-
-        ret = bdrv_pwrite(bs->file, offset, buf, sectors * BDRV_SECTOR_SIZE);
-        if (ret != sectors * BDRV_SECTOR_SIZE) {
-            return -1;
+        if (ret < 0) {
+            goto fail;
         }
 
         nb_sectors -= sectors;
         sector_num += sectors;
-        buf += sectors * BDRV_SECTOR_SIZE;
+        bytes_done += sectors * BDRV_SECTOR_SIZE;
     }
+    ret = 0;
 
-    return 0;
-}
-
-static coroutine_fn int vpc_co_write(BlockDriverState *bs, int64_t sector_num,
-                                     const uint8_t *buf, int nb_sectors)
-{
-    int ret;
-    BDRVVPCState *s = bs->opaque;
-    qemu_co_mutex_lock(&s->lock);
-    ret = vpc_write(bs, sector_num, buf, nb_sectors);
-    qemu_co_mutex_unlock(&s->lock);
+fail:
+    qemu_iovec_destroy(&local_qiov);
     return ret;
 }
 
@@ -912,8 +939,8 @@ static BlockDriver bdrv_vpc = {
     .bdrv_reopen_prepare    = vpc_reopen_prepare,
     .bdrv_create            = vpc_create,
 
-    .bdrv_read              = vpc_co_read,
-    .bdrv_write             = vpc_co_write,
+    .bdrv_co_readv          = vpc_co_readv,
+    .bdrv_co_writev         = vpc_co_writev,
 
     .bdrv_get_info          = vpc_get_info,
 
@@ -332,13 +332,27 @@ static bool check_throttle_config(ThrottleConfig *cfg, Error **errp)
     }
 
     if (!throttle_is_valid(cfg)) {
-        error_setg(errp, "bps/iops/maxs values must be 0 or greater");
+        error_setg(errp, "bps/iops/maxs values must be 0 or greater, and"
+                         " a burst length longer than one second needs the"
+                         " corresponding max value");
         return false;
     }
 
     return true;
 }
 
+static bool set_throttle_burst_length(ThrottleConfig *cfg, BucketType type,
+                                      int64_t length, Error **errp)
+{
+    if (length < 0 || length > UINT_MAX) {
+        error_setg(errp, "burst length must be between 0 and %u seconds",
+                   UINT_MAX);
+        return false;
+    }
+    cfg->buckets[type].burst_length = length;
+    return true;
+}
+
 typedef enum { MEDIA_DISK, MEDIA_CDROM } DriveMediaType;
 
 /* Takes the ownership of bs_opts */
@@ -358,6 +372,7 @@ static BlockBackend *blockdev_init(const char *file, QDict *bs_opts,
     Error *error = NULL;
     QemuOpts *opts;
     const char *id;
+    const char *throttling_group;
     bool has_driver_specific_opts;
     BlockdevDetectZeroesOptions detect_zeroes;
     BlockDriver *drv = NULL;
@@ -405,12 +420,18 @@ static BlockBackend *blockdev_init(const char *file, QDict *bs_opts,
         bdrv_flags |= BDRV_O_NO_FLUSH;
     }
 
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     if ((buf = qemu_opt_get(opts, "aio")) != NULL) {
-        if (!strcmp(buf, "native")) {
-            bdrv_flags |= BDRV_O_NATIVE_AIO;
-        } else if (!strcmp(buf, "threads")) {
+        if (!strcmp(buf, "threads")) {
             /* this is the default */
+#ifdef CONFIG_LINUX_AIO
+        } else if (!strcmp(buf, "native")) {
+            bdrv_flags |= BDRV_O_NATIVE_AIO;
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+        } else if (!strcmp(buf, "io_uring")) {
+            bdrv_flags |= BDRV_O_IO_URING;
+#endif
         } else {
            error_setg(errp, "invalid aio option");
            goto early_err;
@@ -461,8 +482,32 @@ static BlockBackend *blockdev_init(const char *file, QDict *bs_opts,
     cfg.buckets[THROTTLE_OPS_WRITE].max =
         qemu_opt_get_number(opts, "throttling.iops-write-max", 0);
 
+    if (!set_throttle_burst_length(&cfg, THROTTLE_BPS_TOTAL,
+            qemu_opt_get_number(opts, "throttling.bps-total-max-length", 0),
+            &error) ||
+        !set_throttle_burst_length(&cfg, THROTTLE_BPS_READ,
+            qemu_opt_get_number(opts, "throttling.bps-read-max-length", 0),
+            &error) ||
+        !set_throttle_burst_length(&cfg, THROTTLE_BPS_WRITE,
+            qemu_opt_get_number(opts, "throttling.bps-write-max-length", 0),
+            &error) ||
+        !set_throttle_burst_length(&cfg, THROTTLE_OPS_TOTAL,
+            qemu_opt_get_number(opts, "throttling.iops-total-max-length", 0),
+            &error) ||
+        !set_throttle_burst_length(&cfg, THROTTLE_OPS_READ,
+            qemu_opt_get_number(opts, "throttling.iops-read-max-length", 0),
+            &error) ||
+        !set_throttle_burst_length(&cfg, THROTTLE_OPS_WRITE,
+            qemu_opt_get_number(opts, "throttling.iops-write-max-length", 0),
+            &error)) {
+        error_propagate(errp, error);
+        goto early_err;
+    }
+
     cfg.op_size = qemu_opt_get_number(opts, "throttling.iops-size", 0);
 
+    throttling_group = qemu_opt_get(opts, "throttling.group");
+
     if (!check_throttle_config(&cfg, &error)) {
         error_propagate(errp, error);
         goto early_err;
@@ -518,7 +563,10 @@ static BlockBackend *blockdev_init(const char *file, QDict *bs_opts,
 
     /* disk I/O throttling */
     if (throttle_enabled(&cfg)) {
-        bdrv_io_limits_enable(bs);
+        if (!throttling_group) {
+            throttling_group = blk_name(blk);
+        }
+        bdrv_io_limits_enable(bs, throttling_group);
         bdrv_set_io_limits(bs, &cfg);
     }
 
@@ -719,6 +767,14 @@ DriveInfo *drive_new(QemuOpts *all_opts, BlockInterfaceType block_default_type)
         { "bps_rd_max",     "throttling.bps-read-max" },
         { "bps_wr_max",     "throttling.bps-write-max" },
 
+        { "iops_max_length",    "throttling.iops-total-max-length" },
+        { "iops_rd_max_length", "throttling.iops-read-max-length" },
+        { "iops_wr_max_length", "throttling.iops-write-max-length" },
+
+        { "bps_max_length",     "throttling.bps-total-max-length" },
+        { "bps_rd_max_length",  "throttling.bps-read-max-length" },
+        { "bps_wr_max_length",  "throttling.bps-write-max-length" },
+
         { "iops_size",      "throttling.iops-size" },
 
         { "readonly",       "read-only" },
@@ -1468,6 +1524,7 @@ static void drive_backup_prepare(BlkTransactionState *common, Error **errp)
     qmp_drive_backup(backup->device, backup->target,
                      backup->has_format, backup->format,
                      backup->sync,
+                     backup->has_bitmap, backup->bitmap,
                      backup->has_mode, backup->mode,
                      backup->has_speed, backup->speed,
                      backup->has_on_source_error, backup->on_source_error,
@@ -1495,6 +1552,122 @@ static void drive_backup_abort(BlkTransactionState *common)
     }
 }
 
+static BdrvDirtyBitmap *block_dirty_bitmap_lookup(const char *device,
+                                                  const char *name,
+                                                  BlockDriverState **pbs,
+                                                  Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return NULL;
+    }
+
+    bitmap = bdrv_find_dirty_bitmap(bs, name);
+    if (!bitmap) {
+        error_setg(errp, "Dirty bitmap '%s' not found", name);
+        return NULL;
+    }
+    if (bdrv_dirty_bitmap_frozen(bitmap)) {
+        error_setg(errp, "Dirty bitmap '%s' is in use by a backup", name);
+        return NULL;
+    }
+
+    *pbs = bs;
+    return bitmap;
+}
+
+typedef struct BlockDirtyBitmapState {
+    BlkTransactionState common;
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+    HBitmap *backup;
+} BlockDirtyBitmapState;
+
+static void block_dirty_bitmap_add_prepare(BlkTransactionState *common,
+                                           Error **errp)
+{
+    BlockDirtyBitmapState *state = DO_UPCAST(BlockDirtyBitmapState,
+                                             common, common);
+    BlockDirtyBitmapAdd *action;
+    Error *local_err = NULL;
+
+    action = common->action->block_dirty_bitmap_add;
+    qmp_block_dirty_bitmap_add(action->device, action->name,
+                               action->has_granularity, action->granularity,
+                               action->has_persistent, action->persistent,
+                               &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    state->bs = bdrv_find(action->device);
+    state->bitmap = bdrv_find_dirty_bitmap(state->bs, action->name);
+}
+
+static void block_dirty_bitmap_add_abort(BlkTransactionState *common)
+{
+    BlockDirtyBitmapState *state = DO_UPCAST(BlockDirtyBitmapState,
+                                             common, common);
+
+    /* Only release the bitmap if prepare created it */
+    if (state->bitmap) {
+        bdrv_release_dirty_bitmap(state->bs, state->bitmap);
+    }
+}
+
+static void block_dirty_bitmap_clear_prepare(BlkTransactionState *common,
+                                             Error **errp)
+{
+    BlockDirtyBitmapState *state = DO_UPCAST(BlockDirtyBitmapState,
+                                             common, common);
+    BlockDirtyBitmap *action;
+    AioContext *aio_context;
+
+    action = common->action->block_dirty_bitmap_clear;
+    state->bitmap = block_dirty_bitmap_lookup(action->device, action->name,
+                                              &state->bs, errp);
+    if (!state->bitmap) {
+        return;
+    }
+
+    aio_context = bdrv_get_aio_context(state->bs);
+    aio_context_acquire(aio_context);
+    bdrv_clear_dirty_bitmap(state->bs, state->bitmap, &state->backup);
+    aio_context_release(aio_context);
+}
+
+static void block_dirty_bitmap_clear_abort(BlkTransactionState *common)
+{
+    BlockDirtyBitmapState *state = DO_UPCAST(BlockDirtyBitmapState,
+                                             common, common);
+    AioContext *aio_context;
+
+    if (!state->backup) {
+        return;
+    }
+
+    aio_context = bdrv_get_aio_context(state->bs);
+    aio_context_acquire(aio_context);
+    bdrv_undo_clear_dirty_bitmap(state->bitmap, state->backup);
+    aio_context_release(aio_context);
+    state->backup = NULL;
+}
+
+static void block_dirty_bitmap_clear_clean(BlkTransactionState *common)
+{
+    BlockDirtyBitmapState *state = DO_UPCAST(BlockDirtyBitmapState,
+                                             common, common);
+
+    if (state->backup) {
+        hbitmap_free(state->backup);
+    }
+}
+
 static void abort_prepare(BlkTransactionState *common, Error **errp)
 {
     error_setg(errp, "Transaction aborted using Abort action");
@@ -1527,6 +1700,17 @@ static const BdrvActionOps actions[] = {
         .prepare  = internal_snapshot_prepare,
         .abort = internal_snapshot_abort,
     },
+    [TRANSACTION_ACTION_KIND_BLOCK_DIRTY_BITMAP_ADD] = {
+        .instance_size = sizeof(BlockDirtyBitmapState),
+        .prepare = block_dirty_bitmap_add_prepare,
+        .abort = block_dirty_bitmap_add_abort,
+    },
+    [TRANSACTION_ACTION_KIND_BLOCK_DIRTY_BITMAP_CLEAR] = {
+        .instance_size = sizeof(BlockDirtyBitmapState),
+        .prepare = block_dirty_bitmap_clear_prepare,
+        .abort = block_dirty_bitmap_clear_abort,
+        .clean = block_dirty_bitmap_clear_clean,
+    },
 };
 
 /*
@@ -1746,7 +1930,21 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
                                bool has_iops_wr_max,
                                int64_t iops_wr_max,
                                bool has_iops_size,
-                               int64_t iops_size, Error **errp)
+                               int64_t iops_size,
+                               bool has_bps_max_length,
+                               int64_t bps_max_length,
+                               bool has_bps_rd_max_length,
+                               int64_t bps_rd_max_length,
+                               bool has_bps_wr_max_length,
+                               int64_t bps_wr_max_length,
+                               bool has_iops_max_length,
+                               int64_t iops_max_length,
+                               bool has_iops_rd_max_length,
+                               int64_t iops_rd_max_length,
+                               bool has_iops_wr_max_length,
+                               int64_t iops_wr_max_length,
+                               bool has_group,
+                               const char *group, Error **errp)
 {
     ThrottleConfig cfg;
     BlockDriverState *bs;
@@ -1786,6 +1984,27 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
         cfg.buckets[THROTTLE_OPS_WRITE].max = iops_wr_max;
     }
 
+    if ((has_bps_max_length &&
+         !set_throttle_burst_length(&cfg, THROTTLE_BPS_TOTAL,
+                                    bps_max_length, errp)) ||
+        (has_bps_rd_max_length &&
+         !set_throttle_burst_length(&cfg, THROTTLE_BPS_READ,
+                                    bps_rd_max_length, errp)) ||
+        (has_bps_wr_max_length &&
+         !set_throttle_burst_length(&cfg, THROTTLE_BPS_WRITE,
+                                    bps_wr_max_length, errp)) ||
+        (has_iops_max_length &&
+         !set_throttle_burst_length(&cfg, THROTTLE_OPS_TOTAL,
+                                    iops_max_length, errp)) ||
+        (has_iops_rd_max_length &&
+         !set_throttle_burst_length(&cfg, THROTTLE_OPS_READ,
+                                    iops_rd_max_length, errp)) ||
+        (has_iops_wr_max_length &&
+         !set_throttle_burst_length(&cfg, THROTTLE_OPS_WRITE,
+                                    iops_wr_max_length, errp))) {
+        return;
+    }
+
     if (has_iops_size) {
         cfg.op_size = iops_size;
     }
@@ -1797,9 +2016,15 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
     aio_context = bdrv_get_aio_context(bs);
     aio_context_acquire(aio_context);
 
-    if (!bs->io_limits_enabled && throttle_enabled(&cfg)) {
-        bdrv_io_limits_enable(bs);
-    } else if (bs->io_limits_enabled && !throttle_enabled(&cfg)) {
+    if (throttle_enabled(&cfg)) {
+        /* Enable I/O limits if they're not enabled yet, otherwise
+         * just update the throttling group. */
+        if (!bs->io_limits_enabled) {
+            bdrv_io_limits_enable(bs, has_group ? group : device);
+        } else if (has_group) {
+            bdrv_io_limits_update_group(bs, group);
+        }
+    } else if (bs->io_limits_enabled) {
         bdrv_io_limits_disable(bs);
     }
 
@@ -1810,6 +2035,204 @@ void qmp_block_set_io_throttle(const char *device, int64_t bps, int64_t bps_rd,
     aio_context_release(aio_context);
 }
 
+void qmp_block_dirty_bitmap_add(const char *device, const char *name,
+                                bool has_granularity, uint32_t granularity,
+                                bool has_persistent, bool persistent,
+                                Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+    AioContext *aio_context;
+    BlockDriverInfo bdi;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+
+    if (has_granularity) {
+        if (granularity < 512 || (granularity & (granularity - 1))) {
+            error_set(errp, QERR_INVALID_PARAMETER_VALUE, "granularity",
+                      "a power of 2 of at least 512");
+            return;
+        }
+    } else {
+        granularity = 65536;
+        if (bdrv_get_info(bs, &bdi) >= 0 && bdi.cluster_size >= 512) {
+            granularity = bdi.cluster_size;
+        }
+    }
+
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+
+    if (has_persistent && persistent && !bdrv_can_store_dirty_bitmaps(bs)) {
+        error_setg(errp, "Device '%s' cannot store persistent dirty bitmaps",
+                   device);
+        goto out;
+    }
+
+    bitmap = bdrv_create_dirty_bitmap(bs, granularity, name, errp);
+    if (!bitmap) {
+        goto out;
+    }
+    bdrv_dirty_bitmap_set_persistent(bitmap, has_persistent && persistent);
+
+    /* Writes submitted by dataplane queue threads before the bitmap was
+     * added bypass it; wait for them so that they precede the bitmap.
+     */
+    bdrv_drain(bs);
+
+out:
+    aio_context_release(aio_context);
+}
+
+void qmp_block_dirty_bitmap_remove(const char *device, const char *name,
+                                   Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+    AioContext *aio_context;
+
+    bitmap = block_dirty_bitmap_lookup(device, name, &bs, errp);
+    if (!bitmap) {
+        return;
+    }
+
+    /* A read-only image keeps its stored bitmaps */
+    if (bdrv_dirty_bitmap_is_persistent(bitmap) && bs->read_only) {
+        error_setg(errp, "Cannot remove persistent dirty bitmap '%s' from "
+                   "read-only device '%s'", name, device);
+        return;
+    }
+
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+    bdrv_release_dirty_bitmap(bs, bitmap);
+    aio_context_release(aio_context);
+}
+
+void qmp_block_dirty_bitmap_clear(const char *device, const char *name,
+                                  Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+    AioContext *aio_context;
+
+    bitmap = block_dirty_bitmap_lookup(device, name, &bs, errp);
+    if (!bitmap) {
+        return;
+    }
+
+    aio_context = bdrv_get_aio_context(bs);
+    aio_context_acquire(aio_context);
+    bdrv_clear_dirty_bitmap(bs, bitmap, NULL);
+    aio_context_release(aio_context);
+}
+
+/* Convert @list to an array, checking that it is strictly ascending */
+static uint64_t *latency_boundaries_from_list(uint64List *list, int *n,
+                                              Error **errp)
+{
+    uint64_t *boundaries = NULL;
+    uint64List *l;
+    int i = 0;
+
+    for (l = list; l; l = l->next) {
+        if (i && l->value <= boundaries[i - 1]) {
+            error_setg(errp, "histogram boundaries must be strictly "
+                       "ascending");
+            g_free(boundaries);
+            return NULL;
+        }
+        boundaries = g_renew(uint64_t, boundaries, i + 1);
+        boundaries[i++] = l->value;
+    }
+    *n = i;
+    return boundaries;
+}
+
+void qmp_block_latency_histogram_set(const char *device,
+                                     bool has_boundaries,
+                                     uint64List *boundaries,
+                                     bool has_boundaries_read,
+                                     uint64List *boundaries_read,
+                                     bool has_boundaries_write,
+                                     uint64List *boundaries_write,
+                                     bool has_boundaries_flush,
+                                     uint64List *boundaries_flush,
+                                     Error **errp)
+{
+    BlockDriverState *bs;
+    uint64List *lists[BLOCK_MAX_IOTYPE];
+    uint64_t *arrays[BLOCK_MAX_IOTYPE] = { NULL };
+    int n[BLOCK_MAX_IOTYPE];
+    Error *local_err = NULL;
+    int i;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+
+    lists[BLOCK_ACCT_READ] = has_boundaries_read ? boundaries_read :
+                             has_boundaries ? boundaries : NULL;
+    lists[BLOCK_ACCT_WRITE] = has_boundaries_write ? boundaries_write :
+                              has_boundaries ? boundaries : NULL;
+    lists[BLOCK_ACCT_FLUSH] = has_boundaries_flush ? boundaries_flush :
+                              has_boundaries ? boundaries : NULL;
+
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        arrays[i] = latency_boundaries_from_list(lists[i], &n[i], &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            goto out;
+        }
+    }
+
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        block_acct_set_histogram(bdrv_get_stats(bs), i, arrays[i], n[i]);
+    }
+
+out:
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        g_free(arrays[i]);
+    }
+}
+
+void qmp_block_stats_intervals_set(const char *device, uint32List *intervals,
+                                   Error **errp)
+{
+    BlockDriverState *bs;
+    uint32_t array[BLOCK_ACCT_MAX_INTERVALS];
+    uint32List *l;
+    int n = 0;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+
+    for (l = intervals; l; l = l->next) {
+        if (n == BLOCK_ACCT_MAX_INTERVALS) {
+            error_setg(errp, "at most %d intervals are supported",
+                       BLOCK_ACCT_MAX_INTERVALS);
+            return;
+        }
+        if (l->value == 0) {
+            error_set(errp, QERR_INVALID_PARAMETER_VALUE, "intervals",
+                      "a positive number of seconds");
+            return;
+        }
+        array[n++] = l->value;
+    }
+
+    block_acct_set_intervals(bdrv_get_stats(bs), array, n);
+}
+
 int do_drive_del(Monitor *mon, const QDict *qdict, QObject **ret_data)
 {
     const char *id = qdict_get_str(qdict, "id");
@@ -2118,6 +2541,7 @@ out:
 void qmp_drive_backup(const char *device, const char *target,
                       bool has_format, const char *format,
                       enum MirrorSyncMode sync,
+                      bool has_bitmap, const char *bitmap,
                       bool has_mode, enum NewImageMode mode,
                       bool has_speed, int64_t speed,
                       bool has_on_source_error, BlockdevOnError on_source_error,
@@ -2127,6 +2551,7 @@ void qmp_drive_backup(const char *device, const char *target,
     BlockDriverState *bs;
     BlockDriverState *target_bs;
     BlockDriverState *source = NULL;
+    BdrvDirtyBitmap *sync_bitmap = NULL;
     AioContext *aio_context;
     BlockDriver *drv = NULL;
     Error *local_err = NULL;
@@ -2146,6 +2571,11 @@ void qmp_drive_backup(const char *device, const char *target,
     if (!has_mode) {
         mode = NEW_IMAGE_MODE_ABSOLUTE_PATHS;
     }
+    if (has_bitmap != (sync == MIRROR_SYNC_MODE_INCREMENTAL)) {
+        error_setg(errp, "a bitmap must be given if and only if sync is "
+                   "'incremental'");
+        return;
+    }
 
     bs = bdrv_find(device);
     if (!bs) {
@@ -2161,6 +2591,19 @@ void qmp_drive_backup(const char *device, const char *target,
         goto out;
     }
 
+    if (has_bitmap) {
+        sync_bitmap = bdrv_find_dirty_bitmap(bs, bitmap);
+        if (!sync_bitmap) {
+            error_setg(errp, "Dirty bitmap '%s' not found", bitmap);
+            goto out;
+        }
+        if (bdrv_dirty_bitmap_frozen(sync_bitmap)) {
+            error_setg(errp, "Dirty bitmap '%s' is in use by another backup",
+                       bitmap);
+            goto out;
+        }
+    }
+
     if (!has_format) {
         format = mode == NEW_IMAGE_MODE_EXISTING ? NULL : bs->drv->format_name;
     }
@@ -2186,7 +2629,10 @@ void qmp_drive_backup(const char *device, const char *target,
             sync = MIRROR_SYNC_MODE_FULL;
         }
     }
-    if (sync == MIRROR_SYNC_MODE_NONE) {
+    /* Like sync=none, an incremental backup only contains the clusters that
+     * it copies, on top of the previous backup in the chain.
+     */
+    if (sync == MIRROR_SYNC_MODE_NONE || sync == MIRROR_SYNC_MODE_INCREMENTAL) {
         source = bs;
     }
 
@@ -2222,7 +2668,8 @@ void qmp_drive_backup(const char *device, const char *target,
 
     bdrv_set_aio_context(target_bs, aio_context);
 
-    backup_start(bs, target_bs, speed, sync, on_source_error, on_target_error,
+    backup_start(bs, target_bs, speed, sync, sync_bitmap,
+                 on_source_error, on_target_error,
                  block_job_cb, bs, &local_err);
     if (local_err != NULL) {
         bdrv_unref(target_bs);
@@ -2252,6 +2699,7 @@ void qmp_drive_mirror(const char *device, const char *target,
                       bool has_buf_size, int64_t buf_size,
                       bool has_on_source_error, BlockdevOnError on_source_error,
                       bool has_on_target_error, BlockdevOnError on_target_error,
+                      bool has_copy_mode, MirrorCopyMode copy_mode,
                       Error **errp)
 {
     BlockDriverState *bs;
@@ -2292,6 +2740,11 @@ void qmp_drive_mirror(const char *device, const char *target,
         error_set(errp, QERR_INVALID_PARAMETER_VALUE, "granularity", "power of 2");
         return;
     }
+    if (sync == MIRROR_SYNC_MODE_INCREMENTAL) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "sync",
+                  "'top', 'full' or 'none'");
+        return;
+    }
 
     bs = bdrv_find(device);
     if (!bs) {
@@ -2419,6 +2872,7 @@ void qmp_drive_mirror(const char *device, const char *target,
     mirror_start(bs, target_bs,
                  has_replaces ? replaces : NULL,
                  speed, granularity, buf_size, sync,
+                 has_copy_mode ? copy_mode : MIRROR_COPY_MODE_BACKGROUND,
                  on_source_error, on_target_error,
                  block_job_cb, bs, &local_err);
     if (local_err != NULL) {
@@ -2728,7 +3182,7 @@ QemuOptsList qemu_common_drive_opts = {
         },{
             .name = "aio",
             .type = QEMU_OPT_STRING,
-            .help = "host AIO implementation (threads, native)",
+            .help = "host AIO implementation (threads, native, io_uring)",
         },{
             .name = "format",
             .type = QEMU_OPT_STRING,
@@ -2793,10 +3247,38 @@ QemuOptsList qemu_common_drive_opts = {
             .name = "throttling.bps-write-max",
             .type = QEMU_OPT_NUMBER,
             .help = "total bytes write burst",
+        },{
+            .name = "throttling.iops-total-max-length",
+            .type = QEMU_OPT_NUMBER,
+            .help = "length of the iops-total-max burst period, in seconds",
+        },{
+            .name = "throttling.iops-read-max-length",
+            .type = QEMU_OPT_NUMBER,
+            .help = "length of the iops-read-max burst period, in seconds",
+        },{
+            .name = "throttling.iops-write-max-length",
+            .type = QEMU_OPT_NUMBER,
+            .help = "length of the iops-write-max burst period, in seconds",
+        },{
+            .name = "throttling.bps-total-max-length",
+            .type = QEMU_OPT_NUMBER,
+            .help = "length of the bps-total-max burst period, in seconds",
+        },{
+            .name = "throttling.bps-read-max-length",
+            .type = QEMU_OPT_NUMBER,
+            .help = "length of the bps-read-max burst period, in seconds",
+        },{
+            .name = "throttling.bps-write-max-length",
+            .type = QEMU_OPT_NUMBER,
+            .help = "length of the bps-write-max burst period, in seconds",
         },{
             .name = "throttling.iops-size",
             .type = QEMU_OPT_NUMBER,
             .help = "when limiting by iops max size of an I/O in bytes",
+        },{
+            .name = "throttling.group",
+            .type = QEMU_OPT_STRING,
+            .help = "name of the block throttling group",
         },{
             .name = "copy-on-read",
             .type = QEMU_OPT_BOOL,
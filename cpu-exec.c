@@ -21,6 +21,7 @@
 #include "trace.h"
 #include "disas/disas.h"
 #include "tcg.h"
+#include "exec/helper-proto.h"
 #include "qemu/atomic.h"
 #include "sysemu/qtest.h"
 #include "qemu/timer.h"
@@ -219,82 +220,185 @@ static void cpu_exec_nocache(CPUArchState *env, int max_cycles,
     tb_free(tb);
 }
 
+struct tb_desc {
+    target_ulong pc;
+    target_ulong cs_base;
+    CPUArchState *env;
+    tb_page_addr_t phys_page1;
+    uint64_t flags;
+};
+
+static bool tb_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const struct tb_desc *desc = d;
+
+    if (tb->pc == desc->pc &&
+        tb->page_addr[0] == desc->phys_page1 &&
+        tb->cs_base == desc->cs_base &&
+        tb->flags == desc->flags) {
+        /* check next page if needed */
+        if (tb->page_addr[1] == -1) {
+            return true;
+        } else {
+            tb_page_addr_t phys_page2;
+            target_ulong virt_page2;
+
+            virt_page2 = (desc->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+            phys_page2 = get_page_addr_code(desc->env, virt_page2);
+            if (tb->page_addr[1] == phys_page2) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static TranslationBlock *tb_find_physical(CPUArchState *env,
+                                          target_ulong pc,
+                                          target_ulong cs_base,
+                                          uint64_t flags)
+{
+    tb_page_addr_t phys_pc;
+    struct tb_desc desc;
+    uint32_t h;
+
+    desc.env = env;
+    desc.cs_base = cs_base;
+    desc.flags = flags;
+    desc.pc = pc;
+    phys_pc = get_page_addr_code(env, pc);
+    desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    h = tb_hash_func(phys_pc, pc, flags);
+    return qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
+}
+
 static TranslationBlock *tb_find_slow(CPUArchState *env,
                                       target_ulong pc,
                                       target_ulong cs_base,
                                       uint64_t flags)
 {
     CPUState *cpu = ENV_GET_CPU(env);
-    TranslationBlock *tb, **ptb1;
+    TranslationBlock *tb;
     unsigned int h;
-    tb_page_addr_t phys_pc, phys_page1;
-    target_ulong virt_page2;
-
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
 
     /* find translated block using physical mappings */
-    phys_pc = get_page_addr_code(env, pc);
-    phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_phys_hash_func(phys_pc);
-    ptb1 = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    for(;;) {
-        tb = *ptb1;
-        if (!tb)
-            goto not_found;
-        if (tb->pc == pc &&
-            tb->page_addr[0] == phys_page1 &&
-            tb->cs_base == cs_base &&
-            tb->flags == flags) {
-            /* check next page if needed */
-            if (tb->page_addr[1] != -1) {
-                tb_page_addr_t phys_page2;
-
-                virt_page2 = (pc & TARGET_PAGE_MASK) +
-                    TARGET_PAGE_SIZE;
-                phys_page2 = get_page_addr_code(env, virt_page2);
-                if (tb->page_addr[1] == phys_page2)
-                    goto found;
-            } else {
-                goto found;
-            }
+    tb = tb_find_physical(env, pc, cs_base, flags);
+    if (!tb) {
+        tb_lock();
+        /* another thread may have translated it while we waited */
+        tb = tb_find_physical(env, pc, cs_base, flags);
+        if (!tb) {
+            /* if no translated code available, then translate it now */
+            tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
         }
-        ptb1 = &tb->phys_hash_next;
-    }
- not_found:
-   /* if no translated code available, then translate it now */
-    tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
-
- found:
-    /* Move the last found TB to the head of the list */
-    if (likely(*ptb1)) {
-        *ptb1 = tb->phys_hash_next;
-        tb->phys_hash_next = tcg_ctx.tb_ctx.tb_phys_hash[h];
-        tcg_ctx.tb_ctx.tb_phys_hash[h] = tb;
+        tb_unlock();
     }
+
     /* we add the TB in the virtual pc hash table */
-    cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
+    h = tb_jmp_cache_hash_func(pc);
+    cpu->tb_jmp_cache[h] = tb;
+    cpu->tb_jmp_cache_gen[h] = cpu->tb_jmp_cache_cur_gen;
     return tb;
 }
 
+/* A jump cache entry survived a tlb_flush(): check that its virtual pc
+   still maps to the physical pages the TB was translated from.  */
+static bool tb_jmp_cache_revalidate(CPUArchState *env, TranslationBlock *tb)
+{
+    tb_page_addr_t phys_pc;
+    target_ulong virt_page2;
+
+    phys_pc = get_page_addr_code(env, tb->pc);
+    if ((phys_pc & TARGET_PAGE_MASK) != tb->page_addr[0]) {
+        return false;
+    }
+    if (tb->page_addr[1] != -1) {
+        virt_page2 = (tb->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+        if (get_page_addr_code(env, virt_page2) != tb->page_addr[1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if !defined(CONFIG_USER_ONLY)
+/* Take the sample the guest profiler asked for, at the next TB's PC */
+static void cpu_profile_sample(CPUState *cpu, CPUArchState *env)
+{
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu->profile_sample = false;
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    guest_profile_sample(cpu, pc);
+}
+#endif
+
+/* Changes whenever translated code may have been thrown away, in which
+   case a TB returned by an earlier lookup must not be chained to.  */
+static inline int tb_code_gen(void)
+{
+    return atomic_read(&tcg_ctx.tb_ctx.tb_flush_count) +
+           atomic_read(&tcg_ctx.tb_ctx.tb_region_evict_count);
+}
+
 static inline TranslationBlock *tb_find_fast(CPUArchState *env)
 {
     CPUState *cpu = ENV_GET_CPU(env);
     TranslationBlock *tb;
     target_ulong cs_base, pc;
+    unsigned int h;
     int flags;
 
     /* we record a subset of the CPU state. It will
        always be the same before a given translated block
        is executed. */
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
-    tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    h = tb_jmp_cache_hash_func(pc);
+    tb = cpu->tb_jmp_cache[h];
     if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
                  tb->flags != flags)) {
-        tb = tb_find_slow(env, pc, cs_base, flags);
+        cpu->tb_jmp_cache_misses++;
+        return tb_find_slow(env, pc, cs_base, flags);
     }
+    if (unlikely(cpu->tb_jmp_cache_gen[h] != cpu->tb_jmp_cache_cur_gen)) {
+        if (!tb_jmp_cache_revalidate(env, tb)) {
+            cpu->tb_jmp_cache_misses++;
+            return tb_find_slow(env, pc, cs_base, flags);
+        }
+        cpu->tb_jmp_cache_gen[h] = cpu->tb_jmp_cache_cur_gen;
+        cpu->tb_jmp_cache_revalidations++;
+    }
+    cpu->tb_jmp_cache_hits++;
     return tb;
 }
 
+/* Called from generated code by tcg_gen_lookup_and_goto_ptr().  Only the
+   jump cache is consulted, since translating from here is not possible;
+   on a miss, if the entry needs revalidating or if its code must be
+   checked first (CF_SMC_CHECK), we go back to cpu_exec() through the
+   epilogue.  */
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    unsigned int h;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    h = tb_jmp_cache_hash_func(pc);
+    tb = cpu->tb_jmp_cache[h];
+    if (likely(tb && tb->pc == pc && tb->cs_base == cs_base &&
+               tb->flags == flags && !(tb->cflags & CF_SMC_CHECK) &&
+               cpu->tb_jmp_cache_gen[h] == cpu->tb_jmp_cache_cur_gen)) {
+        cpu->tb_jmp_cache_hits++;
+        return tb->tc_ptr;
+    }
+    return tcg_ctx.code_gen_epilogue;
+}
+
 static void cpu_handle_debug_exception(CPUArchState *env)
 {
     CPUState *cpu = ENV_GET_CPU(env);
@@ -325,11 +429,9 @@ int cpu_exec(CPUArchState *env)
     TranslationBlock *tb;
     uint8_t *tc_ptr;
     uintptr_t next_tb;
+    int tb_gen, last_tb_gen = 0;
     SyncClocks sc;
 
-    /* This must be volatile so it is not trashed by longjmp() */
-    volatile bool have_tb_lock = false;
-
     if (cpu->halted) {
         if (!cpu_has_work(cpu)) {
             return EXCP_HALTED;
@@ -443,17 +545,37 @@ int cpu_exec(CPUArchState *env)
                     cpu->exception_index = EXCP_INTERRUPT;
                     cpu_loop_exit(cpu);
                 }
-                spin_lock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = true;
+#if !defined(CONFIG_USER_ONLY)
+                if (unlikely(cpu->profile_sample)) {
+                    cpu_profile_sample(cpu, env);
+                }
+#endif
+                /* the lookup does not take tb_lock; tb_find_slow() takes
+                   it only when it has to translate */
+                tb_gen = tb_code_gen();
                 tb = tb_find_fast(env);
-                /* Note: we do it here to avoid a gcc bug on Mac OS X when
-                   doing it in tb_find_slow */
-                if (tcg_ctx.tb_ctx.tb_invalidated_flag) {
-                    /* as some TB could have been invalidated because
-                       of memory exceptions while generating the code, we
-                       must recompute the hash index here */
+#if defined(CONFIG_USER_ONLY)
+                if (unlikely(tb->cflags & CF_SMC_CHECK) && !tb_smc_check(tb)) {
+                    tb = tb_find_slow(env, tb->pc, tb->cs_base, tb->flags);
+                    next_tb = 0;
+                }
+#endif
+                if (unlikely(tb_is_hot(tb))) {
+                    unsigned int h;
+
+                    tb_lock();
+                    if (!tb->invalid) {
+                        tb = tb_gen_hot(cpu, tb);
+                        tb_unlock();
+                        h = tb_jmp_cache_hash_func(tb->pc);
+                        cpu->tb_jmp_cache[h] = tb;
+                        cpu->tb_jmp_cache_gen[h] = cpu->tb_jmp_cache_cur_gen;
+                    } else {
+                        /* another thread retranslated it first */
+                        tb_unlock();
+                        tb = tb_find_slow(env, tb->pc, tb->cs_base, tb->flags);
+                    }
                     next_tb = 0;
-                    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
                 }
                 if (qemu_loglevel_mask(CPU_LOG_EXEC)) {
                     qemu_log("Trace %p [" TARGET_FMT_lx "] %s\n",
@@ -461,13 +583,23 @@ int cpu_exec(CPUArchState *env)
                 }
                 /* see if we can patch the calling TB. When the TB
                    spans two pages, we cannot safely do a direct
-                   jump. */
-                if (next_tb != 0 && tb->page_addr[1] == -1) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
-                                next_tb & TB_EXIT_MASK, tb);
+                   jump.  Both TBs must still be valid: code may have
+                   been flushed or evicted (possibly by another thread)
+                   since the calling TB was looked up.  A CF_SMC_CHECK
+                   TB must always be entered from here.  */
+                if (next_tb != 0 && tb->page_addr[1] == -1 &&
+                    !(tb->cflags & CF_SMC_CHECK)) {
+                    TranslationBlock *last_tb;
+
+                    last_tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
+                    tb_lock();
+                    if (last_tb_gen == tb_code_gen() &&
+                        !last_tb->invalid && !tb->invalid) {
+                        tb_add_jump(last_tb, next_tb & TB_EXIT_MASK, tb);
+                    }
+                    tb_unlock();
                 }
-                have_tb_lock = false;
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+                last_tb_gen = tb_gen;
 
                 /* cpu_interrupt might be called while translating the
                    TB, but before it is linked into a potentially
@@ -540,10 +672,7 @@ int cpu_exec(CPUArchState *env)
 #ifdef TARGET_I386
             x86_cpu = X86_CPU(cpu);
 #endif
-            if (have_tb_lock) {
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = false;
-            }
+            tb_lock_reset();
         }
     } /* for(;;) */
 
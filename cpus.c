@@ -39,6 +39,9 @@
 #include "qemu/main-loop.h"
 #include "qemu/bitmap.h"
 #include "qemu/seqlock.h"
+#include "qemu/rcu.h"
+#include "hw/boards.h"
+#include "trace.h"
 #include "qapi-event.h"
 #include "hw/nmi.h"
 
@@ -784,6 +787,7 @@ static void qemu_tcg_init_cpu_signals(void)
 #endif /* _WIN32 */
 
 static QemuMutex qemu_global_mutex;
+static __thread bool iothread_locked;
 static QemuCond qemu_io_proceeded_cond;
 static bool iothread_requesting_mutex;
 
@@ -916,12 +920,67 @@ static void qemu_tcg_wait_io_event(void)
     }
 }
 
+/*
+ * Adaptive polling for KVM vCPUs that halt in userspace.  Before going to
+ * sleep, a halted vCPU spins without the iothread lock for up to
+ * cpu->halt_poll_ns, which is grown when halts end just after the window
+ * and shrunk when they outlast kvm_halt_poll_ns_max, the same heuristics
+ * that KVM uses for in-kernel halts.
+ */
+#define KVM_HALT_POLL_NS_START  10000
+
+static int64_t kvm_halt_poll_ns_max;
+
+static void qemu_kvm_halt_poll(CPUState *cpu, int64_t start)
+{
+    qemu_mutex_unlock_iothread();
+    /* Unlocked reads of the wakeup conditions are only a hint, they are
+     * checked again under the lock.
+     */
+    while (cpu_thread_is_idle(cpu) &&
+           get_clock() - start < cpu->halt_poll_ns) {
+        smp_mb();
+    }
+    qemu_mutex_lock_iothread();
+}
+
+static void qemu_kvm_halt_poll_adjust(CPUState *cpu, int64_t block_ns)
+{
+    int64_t poll_ns = cpu->halt_poll_ns;
+
+    if (block_ns <= poll_ns) {
+        /* Woken while polling */
+    } else if (block_ns > kvm_halt_poll_ns_max) {
+        poll_ns /= 2;
+    } else {
+        poll_ns = MAX(poll_ns * 2, KVM_HALT_POLL_NS_START);
+        poll_ns = MIN(poll_ns, kvm_halt_poll_ns_max);
+    }
+    trace_cpu_halt_poll(cpu->cpu_index, block_ns, poll_ns);
+    cpu->halt_poll_ns = poll_ns;
+}
+
 static void qemu_kvm_wait_io_event(CPUState *cpu)
 {
+    int64_t start = 0;
+
+    /* Only poll for halts, not while the VM or this vCPU is stopped */
+    if (kvm_halt_poll_ns_max && cpu->halted && !cpu->stop &&
+        !cpu_is_stopped(cpu) && cpu_thread_is_idle(cpu)) {
+        start = get_clock();
+        if (cpu->halt_poll_ns) {
+            qemu_kvm_halt_poll(cpu, start);
+        }
+    }
+
     while (cpu_thread_is_idle(cpu)) {
         qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
     }
 
+    if (start) {
+        qemu_kvm_halt_poll_adjust(cpu, get_clock() - start);
+    }
+
     qemu_kvm_eat_signals(cpu);
     qemu_wait_io_event_common(cpu);
 }
@@ -931,7 +990,8 @@ static void *qemu_kvm_cpu_thread_fn(void *arg)
     CPUState *cpu = arg;
     int r;
 
-    qemu_mutex_lock(&qemu_global_mutex);
+    qemu_mutex_lock_iothread();
+    rcu_register_thread();
     qemu_thread_get_self(cpu->thread);
     cpu->thread_id = qemu_get_thread_id();
     current_cpu = cpu;
@@ -972,6 +1032,7 @@ static void *qemu_dummy_cpu_thread_fn(void *arg)
     int r;
 
     qemu_mutex_lock_iothread();
+    rcu_register_thread();
     qemu_thread_get_self(cpu->thread);
     cpu->thread_id = qemu_get_thread_id();
 
@@ -1010,9 +1071,11 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     CPUState *cpu = arg;
 
     qemu_tcg_init_cpu_signals();
+    rcu_register_thread();
     qemu_thread_get_self(cpu->thread);
 
     qemu_mutex_lock(&qemu_global_mutex);
+    iothread_locked = true;
     CPU_FOREACH(cpu) {
         cpu->thread_id = qemu_get_thread_id();
         cpu->created = true;
@@ -1117,6 +1180,11 @@ static bool qemu_in_vcpu_thread(void)
     return current_cpu && qemu_cpu_is_self(current_cpu);
 }
 
+bool qemu_mutex_iothread_locked(void)
+{
+    return iothread_locked;
+}
+
 void qemu_mutex_lock_iothread(void)
 {
     if (!tcg_enabled()) {
@@ -1130,10 +1198,12 @@ void qemu_mutex_lock_iothread(void)
         iothread_requesting_mutex = false;
         qemu_cond_broadcast(&qemu_io_proceeded_cond);
     }
+    iothread_locked = true;
 }
 
 void qemu_mutex_unlock_iothread(void)
 {
+    iothread_locked = false;
     qemu_mutex_unlock(&qemu_global_mutex);
 }
 
@@ -1232,6 +1302,8 @@ static void qemu_kvm_start_vcpu(CPUState *cpu)
 {
     char thread_name[VCPU_THREAD_NAME_SIZE];
 
+    kvm_halt_poll_ns_max = current_machine->kvm_halt_poll_ns;
+
     cpu->thread = g_malloc0(sizeof(QemuThread));
     cpu->halt_cond = g_malloc0(sizeof(QemuCond));
     qemu_cond_init(cpu->halt_cond);
@@ -1467,6 +1539,34 @@ CpuInfoList *qmp_query_cpus(Error **errp)
     return head;
 }
 
+/*
+ * Unlike qmp_query_cpus(), this only reports what is already cached in
+ * CPUState, so it never kicks the vCPU threads out of the guest.
+ */
+CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
+{
+    CpuInfoFastList *head = NULL, *cur_item = NULL;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CpuInfoFastList *info = g_malloc0(sizeof(*info));
+
+        info->value = g_malloc0(sizeof(*info->value));
+        info->value->cpu_index = cpu->cpu_index;
+        info->value->halted = cpu->halted;
+        info->value->thread_id = cpu->thread_id;
+
+        if (!cur_item) {
+            head = cur_item = info;
+        } else {
+            cur_item->next = info;
+            cur_item = info;
+        }
+    }
+
+    return head;
+}
+
 void qmp_memsave(int64_t addr, int64_t size, const char *filename,
                  bool has_cpu, int64_t cpu_index, Error **errp)
 {
@@ -36,6 +36,17 @@
 /* statistics */
 int tlb_flush_count;
 
+/* Rather than clearing the whole jump cache, start a new generation:
+   entries from older ones are checked against the new mappings the
+   next time they are hit, so code whose mappings do not change (e.g.
+   the guest kernel across a context switch) stays cached.  */
+static void tlb_jmp_cache_new_gen(CPUState *cpu)
+{
+    if (++cpu->tb_jmp_cache_cur_gen == 0) {
+        memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    }
+}
+
 /* NOTE:
  * If flush_global is true (the usual case), flush all tlb entries.
  * If flush_global is false, flush (at least) all tlb entries not
@@ -51,6 +62,7 @@ int tlb_flush_count;
 void tlb_flush(CPUState *cpu, int flush_global)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -59,14 +71,23 @@ void tlb_flush(CPUState *cpu, int flush_global)
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
-    memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
-    memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    /* Only clear the MMU modes that were used since the last flush */
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (!(env->tlb_clean_mmu_mask & (1u << mmu_idx))) {
+            memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
+            memset(env->tlb_v_table[mmu_idx], -1,
+                   sizeof(env->tlb_v_table[0]));
+        }
+    }
+    env->tlb_clean_mmu_mask = -1;
+
+    tlb_jmp_cache_new_gen(cpu);
 
     env->vtlb_index = 0;
     env->tlb_flush_addr = -1;
     env->tlb_flush_mask = 0;
     tlb_flush_count++;
+    cpu->tlb_flush_count++;
 }
 
 static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
@@ -81,6 +102,49 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
     }
 }
 
+static inline void tlb_flush_entry_masked(CPUTLBEntry *tlb_entry,
+                                          target_ulong addr,
+                                          target_ulong mask)
+{
+    if (addr == (tlb_entry->addr_read & mask) ||
+        addr == (tlb_entry->addr_write & mask) ||
+        addr == (tlb_entry->addr_code & mask)) {
+        memset(tlb_entry, -1, sizeof(*tlb_entry));
+    }
+}
+
+/* Drop every entry that maps part of the area covered by large pages,
+   keeping the rest of the TLB.  */
+static void tlb_flush_large_pages(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong addr = env->tlb_flush_addr;
+    target_ulong mask = env->tlb_flush_mask;
+    int mmu_idx;
+    int k;
+
+    cpu->current_tb = NULL;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (env->tlb_clean_mmu_mask & (1u << mmu_idx)) {
+            continue;
+        }
+        for (k = 0; k < CPU_TLB_SIZE; k++) {
+            tlb_flush_entry_masked(&env->tlb_table[mmu_idx][k], addr, mask);
+        }
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_flush_entry_masked(&env->tlb_v_table[mmu_idx][k], addr, mask);
+        }
+    }
+
+    /* No large page is mapped any more */
+    env->tlb_flush_addr = -1;
+    env->tlb_flush_mask = 0;
+
+    tlb_jmp_cache_new_gen(cpu);
+    cpu->tlb_flush_large_count++;
+}
+
 void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -93,11 +157,11 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
     /* Check if we need to flush due to large pages.  */
     if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
 #if defined(DEBUG_TLB)
-        printf("tlb_flush_page: forced full flush ("
+        printf("tlb_flush_page: large page flush ("
                TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                env->tlb_flush_addr, env->tlb_flush_mask);
 #endif
-        tlb_flush(cpu, 1);
+        tlb_flush_large_pages(cpu);
         return;
     }
     /* must reset current TB so that interrupts cannot modify the
@@ -119,6 +183,7 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
     }
 
     tb_flush_jmp_cache(cpu, addr);
+    cpu->tlb_flush_page_count++;
 }
 
 /* update the TLBs so that writes to code in the virtual page 'addr'
@@ -220,7 +285,8 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+   large pages and drop all the entries inside it if any of them is
+   invalidated.  */
 static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
                                target_ulong size)
 {
@@ -291,6 +357,7 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
 
     index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     te = &env->tlb_table[mmu_idx][index];
+    env->tlb_clean_mmu_mask &= ~(1u << mmu_idx);
 
     /* do not discard the translation in te, evict it into a victim tlb */
     env->tlb_v_table[mmu_idx][vidx] = *te;
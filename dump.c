@@ -23,7 +23,10 @@
 #include "sysemu/memory_mapping.h"
 #include "sysemu/cpus.h"
 #include "qapi/error.h"
+#include "qapi-event.h"
 #include "qmp-commands.h"
+#include "qemu/atomic.h"
+#include "qemu/main-loop.h"
 
 #include <zlib.h>
 #ifdef CONFIG_LZO
@@ -69,13 +72,26 @@ uint64_t cpu_to_dump64(DumpState *s, uint64_t val)
     return val;
 }
 
+/* Pages handed to the compression threads at a time */
+#define DUMP_COMPRESS_BATCH         256
+#define DUMP_COMPRESS_THREADS_MAX   8
+
+/* The only dump that can be in progress at any time */
+static DumpState dump_state_global = { .status = DUMP_STATUS_NONE };
+
 static int dump_cleanup(DumpState *s)
 {
     guest_phys_blocks_free(&s->guest_phys_blocks);
     memory_mapping_list_free(&s->list);
     close(s->fd);
     if (s->resume) {
+        if (s->detached) {
+            qemu_mutex_lock_iothread();
+        }
         vm_start();
+        if (s->detached) {
+            qemu_mutex_unlock_iothread();
+        }
     }
 
     return 0;
@@ -353,6 +369,7 @@ static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
             error_propagate(errp, local_err);
             return;
         }
+        s->written_size += TARGET_PAGE_SIZE;
     }
 
     if ((size % TARGET_PAGE_SIZE) != 0) {
@@ -362,6 +379,7 @@ static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
             error_propagate(errp, local_err);
             return;
         }
+        s->written_size += size % TARGET_PAGE_SIZE;
     }
 }
 
@@ -1169,20 +1187,194 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/*
+ * kdump pages are compressed in batches of DUMP_COMPRESS_BATCH pages.  The
+ * dumping thread takes the first share of each batch and the compression
+ * threads the others; the pages are then written out in order.
+ */
+typedef struct DumpPage {
+    uint8_t *buf;               /* the guest page */
+    uint8_t *buf_out;           /* len_buf_out bytes for compressed data */
+    size_t size_out;            /* size of the page data, 0 for a zero page */
+    uint32_t flags;             /* DUMP_DH_COMPRESSED_* used, or 0 */
+} DumpPage;
+
+typedef struct DumpCompress DumpCompress;
+
+typedef struct DumpCompressWorker {
+    DumpCompress *dc;
+    int index;
+    QemuThread thread;
+    QemuSemaphore start;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+} DumpCompressWorker;
+
+struct DumpCompress {
+    DumpState *s;
+    size_t len_buf_out;
+    int nr_pages;
+    DumpPage pages[DUMP_COMPRESS_BATCH];
+
+    int nr_workers;             /* including the dumping thread */
+    bool quit;
+    QemuSemaphore done;
+    DumpCompressWorker *workers;
+};
+
+/*
+ * Compress one page with the format of s->flag_compress.  When compression
+ * fails to work, we fall back to save in plaintext.
+ */
+static void dump_compress_page(DumpCompress *dc, DumpCompressWorker *w,
+                               DumpPage *p)
+{
+    DumpState *s = dc->s;
+    size_t size_out = dc->len_buf_out;
+
+    if (is_zero_page(p->buf, TARGET_PAGE_SIZE)) {
+        p->size_out = 0;
+        p->flags = 0;
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+            (compress2(p->buf_out, (uLongf *)&size_out, p->buf,
+                       TARGET_PAGE_SIZE, Z_BEST_SPEED) == Z_OK) &&
+            (size_out < TARGET_PAGE_SIZE)) {
+        p->flags = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+            (lzo1x_1_compress(p->buf, TARGET_PAGE_SIZE, p->buf_out,
+            (lzo_uint *)&size_out, w->wrkmem) == LZO_E_OK) &&
+            (size_out < TARGET_PAGE_SIZE)) {
+        p->flags = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+            (snappy_compress((char *)p->buf, TARGET_PAGE_SIZE,
+            (char *)p->buf_out, &size_out) == SNAPPY_OK) &&
+            (size_out < TARGET_PAGE_SIZE)) {
+        p->flags = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+    } else {
+        p->flags = 0;
+        size_out = TARGET_PAGE_SIZE;
+    }
+    p->size_out = size_out;
+}
+
+static void dump_compress_share(DumpCompress *dc, DumpCompressWorker *w)
+{
+    int i;
+
+    for (i = w->index; i < dc->nr_pages; i += dc->nr_workers) {
+        dump_compress_page(dc, w, &dc->pages[i]);
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressWorker *w = opaque;
+    DumpCompress *dc = w->dc;
+
+    for (;;) {
+        qemu_sem_wait(&w->start);
+        if (dc->quit) {
+            break;
+        }
+        dump_compress_share(dc, w);
+        qemu_sem_post(&dc->done);
+    }
+    return NULL;
+}
+
+static DumpCompress *dump_compress_new(DumpState *s, size_t len_buf_out)
+{
+    DumpCompress *dc = g_new0(DumpCompress, 1);
+    int i;
+
+    dc->s = s;
+    dc->len_buf_out = len_buf_out;
+    for (i = 0; i < DUMP_COMPRESS_BATCH; i++) {
+        dc->pages[i].buf_out = g_malloc(len_buf_out);
+    }
+
+    dc->nr_workers = MAX(s->compress_threads, 1);
+    dc->workers = g_new0(DumpCompressWorker, dc->nr_workers);
+    qemu_sem_init(&dc->done, 0);
+    for (i = 0; i < dc->nr_workers; i++) {
+        DumpCompressWorker *w = &dc->workers[i];
+
+        w->dc = dc;
+        w->index = i;
+#ifdef CONFIG_LZO
+        w->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+        /* worker 0 is the dumping thread itself */
+        if (i > 0) {
+            qemu_sem_init(&w->start, 0);
+            qemu_thread_create(&w->thread, "dump_compress",
+                               dump_compress_thread, w,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+    return dc;
+}
+
+/* Compress the pages of the current batch. */
+static void dump_compress_batch(DumpCompress *dc)
+{
+    int i;
+
+    for (i = 1; i < dc->nr_workers; i++) {
+        qemu_sem_post(&dc->workers[i].start);
+    }
+    dump_compress_share(dc, &dc->workers[0]);
+    for (i = 1; i < dc->nr_workers; i++) {
+        qemu_sem_wait(&dc->done);
+    }
+}
+
+static void dump_compress_free(DumpCompress *dc)
+{
+    int i;
+
+    dc->quit = true;
+    for (i = 0; i < dc->nr_workers; i++) {
+        DumpCompressWorker *w = &dc->workers[i];
+
+        if (i > 0) {
+            qemu_sem_post(&w->start);
+            qemu_thread_join(&w->thread);
+            qemu_sem_destroy(&w->start);
+        }
+#ifdef CONFIG_LZO
+        g_free(w->wrkmem);
+#endif
+    }
+    qemu_sem_destroy(&dc->done);
+    g_free(dc->workers);
+    for (i = 0; i < DUMP_COMPRESS_BATCH; i++) {
+        g_free(dc->pages[i].buf_out);
+    }
+    g_free(dc);
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out;
+    DumpCompress *dc;
     off_t offset_desc, offset_data;
     PageDescriptor pd, pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
+    bool more_pages = true;
+    int i;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1191,15 +1383,11 @@ static void write_dump_pages(DumpState *s, Error **errp)
     prepare_data_cache(&page_desc, s, offset_desc);
     prepare_data_cache(&page_data, s, offset_data);
 
-    /* prepare buffer to store compressed data */
+    /* prepare buffers to store compressed data */
     len_buf_out = get_len_buf_out(TARGET_PAGE_SIZE, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    dc = dump_compress_new(s, len_buf_out);
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1223,88 +1411,53 @@ static void write_dump_pages(DumpState *s, Error **errp)
      * dump memory to vmcore page by page. zero page will all be resided in the
      * first page of page section
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, TARGET_PAGE_SIZE)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                dump_error(s, "dump: failed to write page desc", errp);
-                goto out;
+    while (more_pages) {
+        dc->nr_pages = 0;
+        while (dc->nr_pages < DUMP_COMPRESS_BATCH) {
+            more_pages = get_next_page(&block_iter, &pfn_iter, &buf, s);
+            if (!more_pages) {
+                break;
             }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               TARGET_PAGE_SIZE, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < TARGET_PAGE_SIZE)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    dump_error(s, "dump: failed to write page data", errp);
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, TARGET_PAGE_SIZE, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < TARGET_PAGE_SIZE)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    dump_error(s, "dump: failed to write page data", errp);
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, TARGET_PAGE_SIZE,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < TARGET_PAGE_SIZE)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    dump_error(s, "dump: failed to write page data", errp);
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned TARGET_PAGE_SIZE
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = TARGET_PAGE_SIZE;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf, TARGET_PAGE_SIZE, false);
+            dc->pages[dc->nr_pages++].buf = buf;
+        }
+
+        dump_compress_batch(dc);
+
+        for (i = 0; i < dc->nr_pages; i++) {
+            DumpPage *p = &dc->pages[i];
+
+            s->written_size += TARGET_PAGE_SIZE;
+
+            /* check zero page */
+            if (p->size_out == 0) {
+                ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
+                                  false);
                 if (ret < 0) {
-                    dump_error(s, "dump: failed to write page data", errp);
+                    dump_error(s, "dump: failed to write page desc", errp);
                     goto out;
                 }
+                continue;
+            }
+
+            /*
+             * not zero page, then:
+             * 1. write the (maybe compressed) page into the cache of page_data
+             * 2. get page desc of the page and write it into the cache of
+             *    page_desc
+             */
+            pd.flags = cpu_to_dump32(s, p->flags);
+            pd.size = cpu_to_dump32(s, p->size_out);
+            ret = write_cache(&page_data, p->flags ? p->buf_out : p->buf,
+                              p->size_out, false);
+            if (ret < 0) {
+                dump_error(s, "dump: failed to write page data", errp);
+                goto out;
             }
 
             /* get and write page desc here */
             pd.page_flags = cpu_to_dump64(s, 0);
             pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+            offset_data += p->size_out;
 
             ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
             if (ret < 0) {
@@ -1328,12 +1481,7 @@ static void write_dump_pages(DumpState *s, Error **errp)
 out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
+    dump_compress_free(dc);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1432,6 +1580,39 @@ static void get_max_mapnr(DumpState *s)
     s->max_mapnr = paddr_to_pfn(last_block->target_end);
 }
 
+/* Bytes of guest memory that the dump will contain */
+static int64_t dump_calculate_size(DumpState *s)
+{
+    GuestPhysBlock *block;
+    int64_t total = 0;
+
+    QTAILQ_FOREACH(block, &s->guest_phys_blocks.head, next) {
+        int64_t left = block->target_start;
+        int64_t right = block->target_end;
+
+        if (s->has_filter) {
+            left = MAX(left, s->begin);
+            right = MIN(right, s->begin + s->length);
+        }
+        if (right > left) {
+            total += right - left;
+        }
+    }
+    return total;
+}
+
+static int dump_get_compress_threads(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long host_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (host_cpus > 1) {
+        return MIN(host_cpus, DUMP_COMPRESS_THREADS_MAX);
+    }
+#endif
+    return 1;
+}
+
 static void dump_init(DumpState *s, int fd, bool has_format,
                       DumpGuestMemoryFormat format, bool paging, bool has_filter,
                       int64_t begin, int64_t length, Error **errp)
@@ -1507,6 +1688,8 @@ static void dump_init(DumpState *s, int fd, bool has_format,
     }
 
     s->nr_cpus = nr_cpus;
+    s->total_size = dump_calculate_size(s);
+    s->written_size = 0;
 
     get_max_mapnr(s);
 
@@ -1516,6 +1699,8 @@ static void dump_init(DumpState *s, int fd, bool has_format,
 
     /* init for kdump-compressed format */
     if (has_format && format != DUMP_GUEST_MEMORY_FORMAT_ELF) {
+        s->kdump = true;
+        s->compress_threads = dump_get_compress_threads();
         switch (format) {
         case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZLIB:
             s->flag_compress = DUMP_DH_COMPRESSED_ZLIB;
@@ -1594,16 +1779,90 @@ cleanup:
     dump_cleanup(s);
 }
 
+static DumpQueryResult *dump_query(DumpState *s)
+{
+    DumpQueryResult *result = g_new(DumpQueryResult, 1);
+
+    result->status = atomic_read(&s->status);
+    /* The sizes may be torn while the dump runs, but they are only
+     * a progress indication.
+     */
+    result->completed = s->written_size;
+    result->total = s->total_size;
+    return result;
+}
+
+/* Write the dump prepared by dump_init(); runs in the background thread
+ * if the dump is detached.
+ */
+static void dump_process(DumpState *s, Error **errp)
+{
+    Error *local_err = NULL;
+    DumpQueryResult *result;
+
+    if (s->kdump) {
+        create_kdump_vmcore(s, &local_err);
+    } else {
+        create_vmcore(s, &local_err);
+    }
+
+    atomic_set(&s->status,
+               local_err ? DUMP_STATUS_FAILED : DUMP_STATUS_COMPLETED);
+
+    if (s->detached) {
+        qemu_mutex_lock_iothread();
+    }
+    result = dump_query(s);
+    qapi_event_send_dump_completed(result, !!local_err,
+                                   local_err ? error_get_pretty(local_err)
+                                             : NULL,
+                                   &error_abort);
+    qapi_free_DumpQueryResult(result);
+    if (s->detached) {
+        qemu_mutex_unlock_iothread();
+    }
+
+    error_propagate(errp, local_err);
+}
+
+static void *dump_thread(void *data)
+{
+    DumpState *s = data;
+    Error *local_err = NULL;
+
+    /* The error has been reported by the DUMP_COMPLETED event */
+    dump_process(s, &local_err);
+    error_free(local_err);
+    return NULL;
+}
+
+bool dump_in_progress(void)
+{
+    return atomic_read(&dump_state_global.status) == DUMP_STATUS_ACTIVE;
+}
+
+DumpQueryResult *qmp_query_dump(Error **errp)
+{
+    return dump_query(&dump_state_global);
+}
+
 void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
                            int64_t begin, bool has_length,
                            int64_t length, bool has_format,
-                           DumpGuestMemoryFormat format, Error **errp)
+                           DumpGuestMemoryFormat format, bool has_detach,
+                           bool detach, Error **errp)
 {
     const char *p;
     int fd = -1;
-    DumpState *s;
+    DumpState *s = &dump_state_global;
     Error *local_err = NULL;
 
+    /* The guest memory is only guaranteed to be stable during one dump */
+    if (dump_in_progress()) {
+        error_setg(errp, "There is a dump in progress");
+        return;
+    }
+
     /*
      * kdump-compressed format need the whole memory dumped, so paging or
      * filter is not supported here.
@@ -1660,23 +1919,24 @@ void qmp_dump_guest_memory(bool paging, const char *file, bool has_begin,
         return;
     }
 
-    s = g_malloc0(sizeof(DumpState));
+    memset(s, 0, sizeof(*s));
+    atomic_set(&s->status, DUMP_STATUS_ACTIVE);
 
     dump_init(s, fd, has_format, format, paging, has_begin,
               begin, length, &local_err);
     if (local_err) {
-        g_free(s);
+        atomic_set(&s->status, DUMP_STATUS_FAILED);
         error_propagate(errp, local_err);
         return;
     }
 
-    if (has_format && format != DUMP_GUEST_MEMORY_FORMAT_ELF) {
-        create_kdump_vmcore(s, errp);
+    if (has_detach && detach) {
+        s->detached = true;
+        qemu_thread_create(&s->dump_thread, "dump_thread", dump_thread,
+                           s, QEMU_THREAD_DETACHED);
     } else {
-        create_vmcore(s, errp);
+        dump_process(s, errp);
     }
-
-    g_free(s);
 }
 
 DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
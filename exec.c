@@ -52,6 +52,8 @@
 #include "exec/ram_addr.h"
 
 #include "qemu/range.h"
+#include "qemu/rcu.h"
+#include "qemu/main-loop.h"
 
 //#define DEBUG_SUBPAGE
 
@@ -75,6 +77,12 @@ static MemoryRegion io_mem_unassigned;
 /* RAM is mmap-ed with MAP_SHARED */
 #define RAM_SHARED     (1 << 1)
 
+/* RAM is anonymous memory backed by hugetlb pages */
+#define RAM_HUGETLB    (1 << 2)
+
+/* RAM is a copy-on-write mapping of a ROM image file */
+#define RAM_ROM_FILE   (1 << 3)
+
 #endif
 
 struct CPUTailQ cpus = QTAILQ_HEAD_INITIALIZER(cpus);
@@ -119,6 +127,8 @@ typedef struct PhysPageMap {
 } PhysPageMap;
 
 struct AddressSpaceDispatch {
+    struct rcu_head rcu;
+
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -366,7 +376,8 @@ MemoryRegion *address_space_translate(AddressSpace *as, hwaddr addr,
     hwaddr len = *plen;
 
     for (;;) {
-        section = address_space_translate_internal(as->dispatch, addr, &addr, plen, true);
+        AddressSpaceDispatch *d = atomic_rcu_read(&as->dispatch);
+        section = address_space_translate_internal(d, addr, &addr, plen, true);
         mr = section->mr;
 
         if (!mr->iommu_ops) {
@@ -400,7 +411,9 @@ address_space_translate_for_iotlb(AddressSpace *as, hwaddr addr, hwaddr *xlat,
                                   hwaddr *plen)
 {
     MemoryRegionSection *section;
-    section = address_space_translate_internal(as->dispatch, addr, xlat, plen, false);
+    AddressSpaceDispatch *d = atomic_rcu_read(&as->dispatch);
+
+    section = address_space_translate_internal(d, addr, xlat, plen, false);
 
     assert(!section->mr->iommu_ops);
     return section;
@@ -882,7 +895,10 @@ hwaddr memory_region_section_get_iotlb(CPUState *cpu,
             iotlb |= PHYS_SECTION_ROM;
         }
     } else {
-        iotlb = section - section->address_space->dispatch->map.sections;
+        AddressSpaceDispatch *d;
+
+        d = atomic_rcu_read(&section->address_space->dispatch);
+        iotlb = section - d->map.sections;
         iotlb += xlat;
     }
 
@@ -1092,6 +1108,8 @@ static void *file_ram_alloc(RAMBlock *block,
     void *area = NULL;
     int fd;
     uint64_t hpagesize;
+    struct stat st;
+    bool image;
     Error *local_err = NULL;
 
     hpagesize = gethugepagesize(path, &local_err);
@@ -1100,6 +1118,7 @@ static void *file_ram_alloc(RAMBlock *block,
         goto error;
     }
     block->mr->align = hpagesize;
+    block->page_size = hpagesize;
 
     if (memory < hpagesize) {
         error_setg(errp, "memory size 0x" RAM_ADDR_FMT " must be equal to "
@@ -1114,37 +1133,58 @@ static void *file_ram_alloc(RAMBlock *block,
         goto error;
     }
 
-    /* Make name safe to use with mkstemp by replacing '/' with '_'. */
-    sanitized_name = g_strdup(memory_region_name(block->mr));
-    for (c = sanitized_name; *c != '\0'; c++) {
-        if (*c == '/')
-            *c = '_';
-    }
-
-    filename = g_strdup_printf("%s/qemu_back_mem.%s.XXXXXX", path,
-                               sanitized_name);
-    g_free(sanitized_name);
-
-    fd = mkstemp(filename);
-    if (fd < 0) {
-        error_setg_errno(errp, errno,
-                         "unable to create backing store for hugepages");
-        g_free(filename);
-        goto error;
-    }
-    unlink(filename);
-    g_free(filename);
-
     memory = (memory+hpagesize-1) & ~(hpagesize-1);
 
     /*
-     * ftruncate is not supported by hugetlbfs in older
-     * hosts, so don't bother bailing out on errors.
-     * If anything goes wrong with it under other filesystems,
-     * mmap will fail.
+     * A regular file is a RAM image, for example one written by
+     * memdev-save.  It is mapped as is; unless shared, guest writes are
+     * copy-on-write and pages are faulted in lazily, so that many guests
+     * started from the same image share its page cache.
      */
-    if (ftruncate(fd, memory)) {
-        perror("ftruncate");
+    image = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+    if (image) {
+        fd = open(path, block->flags & RAM_SHARED ? O_RDWR : O_RDONLY);
+        if (fd < 0) {
+            error_setg_errno(errp, errno, "unable to open RAM image %s", path);
+            goto error;
+        }
+        if (st.st_size < memory) {
+            error_setg(errp, "RAM image %s is smaller than 0x" RAM_ADDR_FMT
+                       " bytes", path, memory);
+            close(fd);
+            goto error;
+        }
+    } else {
+        /* Make name safe to use with mkstemp by replacing '/' with '_'. */
+        sanitized_name = g_strdup(memory_region_name(block->mr));
+        for (c = sanitized_name; *c != '\0'; c++) {
+            if (*c == '/')
+                *c = '_';
+        }
+
+        filename = g_strdup_printf("%s/qemu_back_mem.%s.XXXXXX", path,
+                                   sanitized_name);
+        g_free(sanitized_name);
+
+        fd = mkstemp(filename);
+        if (fd < 0) {
+            error_setg_errno(errp, errno,
+                             "unable to create backing store for hugepages");
+            g_free(filename);
+            goto error;
+        }
+        unlink(filename);
+        g_free(filename);
+
+        /*
+         * ftruncate is not supported by hugetlbfs in older
+         * hosts, so don't bother bailing out on errors.
+         * If anything goes wrong with it under other filesystems,
+         * mmap will fail.
+         */
+        if (ftruncate(fd, memory)) {
+            perror("ftruncate");
+        }
     }
 
     area = mmap(0, memory, PROT_READ | PROT_WRITE,
@@ -1157,8 +1197,9 @@ static void *file_ram_alloc(RAMBlock *block,
         goto error;
     }
 
-    if (mem_prealloc) {
-        os_mem_prealloc(fd, area, memory);
+    /* Preallocation writes to every page, which would clobber an image */
+    if (mem_prealloc && !image) {
+        os_mem_prealloc(fd, area, memory, smp_cpus);
     }
 
     block->fd = fd;
@@ -1296,6 +1337,68 @@ static int memory_try_enable_merging(void *addr, size_t len)
     return qemu_madvise(addr, len, QEMU_MADV_MERGEABLE);
 }
 
+/* Try to back @block with hugetlb pages; clears RAM_HUGETLB on failure so
+ * that the caller falls back to phys_mem_alloc.
+ */
+static void *ram_block_alloc_hugetlb(RAMBlock *block)
+{
+    size_t pagesize;
+    void *host = NULL;
+
+    if (phys_mem_alloc == qemu_anon_ram_alloc &&
+        qemu_opt_get_bool(qemu_get_machine_opts(), "mem-hugetlb", true) &&
+        !(kvm_enabled() && !kvm_has_sync_mmu())) {
+        host = qemu_anon_ram_alloc_hugetlb(block->length, &pagesize);
+    }
+    if (!host) {
+        block->flags &= ~RAM_HUGETLB;
+        return NULL;
+    }
+
+    block->page_size = pagesize;
+    block->mr->align = pagesize;
+    return host;
+}
+
+static NotifierList ram_block_notifiers =
+    NOTIFIER_LIST_INITIALIZER(ram_block_notifiers);
+
+void qemu_ram_add_block_notifier(Notifier *notifier)
+{
+    notifier_list_add(&ram_block_notifiers, notifier);
+}
+
+void qemu_ram_remove_block_notifier(Notifier *notifier)
+{
+    notifier_remove(notifier);
+}
+
+static void ram_block_notify(RAMBlock *block, bool added)
+{
+    RAMBlockNotification n = {
+        .host = block->host,
+        .length = block->length,
+        .added = added,
+    };
+
+    /* Xen maps guest RAM on demand, there is nothing to report */
+    if (block->host) {
+        notifier_list_notify(&ram_block_notifiers, &n);
+    }
+}
+
+static void ram_block_notify_free(ram_addr_t addr)
+{
+    RAMBlock *block;
+
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        if (addr == block->offset) {
+            ram_block_notify(block, false);
+            break;
+        }
+    }
+}
+
 static ram_addr_t ram_block_add(RAMBlock *new_block, Error **errp)
 {
     RAMBlock *block;
@@ -1309,8 +1412,12 @@ static ram_addr_t ram_block_add(RAMBlock *new_block, Error **errp)
 
     if (!new_block->host) {
         if (xen_enabled()) {
+            new_block->flags &= ~RAM_HUGETLB;
             xen_ram_alloc(new_block->offset, new_block->length, new_block->mr);
-        } else {
+        } else if (new_block->flags & RAM_HUGETLB) {
+            new_block->host = ram_block_alloc_hugetlb(new_block);
+        }
+        if (!new_block->host && !xen_enabled()) {
             new_block->host = phys_mem_alloc(new_block->length,
                                              &new_block->mr->align);
             if (!new_block->host) {
@@ -1323,6 +1430,9 @@ static ram_addr_t ram_block_add(RAMBlock *new_block, Error **errp)
             memory_try_enable_merging(new_block->host, new_block->length);
         }
     }
+    if (!new_block->page_size) {
+        new_block->page_size = qemu_real_host_page_size;
+    }
 
     /* Keep the list sorted from biggest to smallest block.  */
     QTAILQ_FOREACH(block, &ram_list.blocks, next) {
@@ -1353,12 +1463,15 @@ static ram_addr_t ram_block_add(RAMBlock *new_block, Error **errp)
     cpu_physical_memory_set_dirty_range(new_block->offset, new_block->length);
 
     qemu_ram_setup_dump(new_block->host, new_block->length);
-    qemu_madvise(new_block->host, new_block->length, QEMU_MADV_HUGEPAGE);
+    if (!(new_block->flags & (RAM_HUGETLB | RAM_ROM_FILE))) {
+        qemu_madvise(new_block->host, new_block->length, QEMU_MADV_HUGEPAGE);
+    }
     qemu_madvise(new_block->host, new_block->length, QEMU_MADV_DONTFORK);
 
     if (kvm_enabled()) {
         kvm_setup_guest_memory(new_block->host, new_block->length);
     }
+    ram_block_notify(new_block, true);
 
     return new_block->offset;
 }
@@ -1410,8 +1523,98 @@ ram_addr_t qemu_ram_alloc_from_file(ram_addr_t size, MemoryRegion *mr,
 }
 #endif
 
-ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
+#ifndef _WIN32
+/* Map @path copy-on-write over the start of a zeroed anonymous area of
+ * @size bytes, so that the part past the end of the file reads as zeroes
+ * instead of raising SIGBUS.
+ */
+static void *rom_file_ram_alloc(ram_addr_t size, const char *path,
+                                Error **errp)
+{
+    struct stat st;
+    void *area;
+    size_t file_size;
+    int fd;
+
+    fd = qemu_open(path, O_RDONLY);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, path);
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0) {
+        error_setg_errno(errp, errno, "cannot stat '%s'", path);
+        qemu_close(fd);
+        return NULL;
+    }
+    file_size = MIN(st.st_size, size);
+
+    area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        error_setg_errno(errp, errno, "cannot map '%s'", path);
+        qemu_close(fd);
+        return NULL;
+    }
+    if (file_size &&
+        mmap(area, file_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        error_setg_errno(errp, errno, "cannot map '%s'", path);
+        munmap(area, size);
+        qemu_close(fd);
+        return NULL;
+    }
+    qemu_close(fd);
+    return area;
+}
+#endif
+
+/* Back a RAM block with a private mapping of the ROM image @path.  Pages
+ * that neither QEMU nor the guest write stay shared with the host page
+ * cache, and thus with other QEMU processes using the same image.
+ */
+ram_addr_t qemu_ram_alloc_rom_file(ram_addr_t size, const char *path,
                                    MemoryRegion *mr, Error **errp)
+{
+#ifdef _WIN32
+    error_setg(errp, "ROM file mappings are not supported on this host");
+    return -1;
+#else
+    RAMBlock *new_block;
+    ram_addr_t addr;
+    Error *local_err = NULL;
+
+    if (xen_enabled() || phys_mem_alloc != qemu_anon_ram_alloc) {
+        error_setg(errp,
+                   "ROM file mappings not supported with this accelerator");
+        return -1;
+    }
+
+    size = TARGET_PAGE_ALIGN(size);
+    new_block = g_malloc0(sizeof(*new_block));
+    new_block->mr = mr;
+    new_block->length = size;
+    new_block->fd = -1;
+    new_block->flags = RAM_ROM_FILE;
+    new_block->host = rom_file_ram_alloc(size, path, errp);
+    if (!new_block->host) {
+        g_free(new_block);
+        return -1;
+    }
+
+    addr = ram_block_add(new_block, &local_err);
+    if (local_err) {
+        munmap(new_block->host, size);
+        g_free(new_block);
+        error_propagate(errp, local_err);
+        return -1;
+    }
+    return addr;
+#endif
+}
+
+static ram_addr_t qemu_ram_alloc_internal(ram_addr_t size, void *host,
+                                          uint32_t flags, MemoryRegion *mr,
+                                          Error **errp)
 {
     RAMBlock *new_block;
     ram_addr_t addr;
@@ -1423,6 +1626,7 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
     new_block->length = size;
     new_block->fd = -1;
     new_block->host = host;
+    new_block->flags = flags;
     if (host) {
         new_block->flags |= RAM_PREALLOC;
     }
@@ -1435,15 +1639,33 @@ ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
     return addr;
 }
 
+ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
+                                   MemoryRegion *mr, Error **errp)
+{
+    return qemu_ram_alloc_internal(size, host, 0, mr, errp);
+}
+
 ram_addr_t qemu_ram_alloc(ram_addr_t size, MemoryRegion *mr, Error **errp)
 {
-    return qemu_ram_alloc_from_ptr(size, NULL, mr, errp);
+    return qemu_ram_alloc_internal(size, NULL, 0, mr, errp);
+}
+
+/* Like qemu_ram_alloc, but back the block with the largest hugetlb pages
+ * the host has reserved, unless disabled with -machine mem-hugetlb=off.
+ * Falls back to normal (transparent huge page) memory.
+ */
+ram_addr_t qemu_ram_alloc_hugetlb(ram_addr_t size, MemoryRegion *mr,
+                                  Error **errp)
+{
+    return qemu_ram_alloc_internal(size, NULL, RAM_HUGETLB, mr, errp);
 }
 
 void qemu_ram_free_from_ptr(ram_addr_t addr)
 {
     RAMBlock *block;
 
+    ram_block_notify_free(addr);
+
     /* This assumes the iothread lock is taken here too.  */
     qemu_mutex_lock_ramlist();
     QTAILQ_FOREACH(block, &ram_list.blocks, next) {
@@ -1462,6 +1684,8 @@ void qemu_ram_free(ram_addr_t addr)
 {
     RAMBlock *block;
 
+    ram_block_notify_free(addr);
+
     /* This assumes the iothread lock is taken here too.  */
     qemu_mutex_lock_ramlist();
     QTAILQ_FOREACH(block, &ram_list.blocks, next) {
@@ -1477,6 +1701,8 @@ void qemu_ram_free(ram_addr_t addr)
             } else if (block->fd >= 0) {
                 munmap(block->host, block->length);
                 close(block->fd);
+            } else if (block->flags & RAM_ROM_FILE) {
+                munmap(block->host, block->length);
 #endif
             } else {
                 qemu_anon_ram_free(block->host, block->length);
@@ -1501,11 +1727,19 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
         offset = addr - block->offset;
         if (offset < block->length) {
             vaddr = block->host + offset;
-            if (block->flags & RAM_PREALLOC) {
+            if (block->flags & (RAM_PREALLOC | RAM_ROM_FILE)) {
                 ;
             } else if (xen_enabled()) {
                 abort();
             } else {
+                if (block->flags & RAM_HUGETLB) {
+                    /* Only whole huge pages can be unmapped */
+                    offset = QEMU_ALIGN_DOWN(offset, block->page_size);
+                    length = QEMU_ALIGN_UP(length, block->page_size);
+                    vaddr = block->host + offset;
+                }
+                /* Users that pinned the old pages must drop them */
+                ram_block_notify(block, false);
                 flags = MAP_FIXED;
                 munmap(vaddr, length);
                 if (block->fd >= 0) {
@@ -1522,6 +1756,12 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
                     assert(phys_mem_alloc == qemu_anon_ram_alloc);
 
                     flags |= MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+                    if (block->flags & RAM_HUGETLB) {
+                        flags |= MAP_HUGETLB |
+                                 (ctz64(block->page_size) << MAP_HUGE_SHIFT);
+                    }
+#endif
                     area = mmap(vaddr, length, PROT_READ | PROT_WRITE,
                                 flags, -1, 0);
                 }
@@ -1533,6 +1773,7 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
                 }
                 memory_try_enable_merging(vaddr, length);
                 qemu_ram_setup_dump(vaddr, length);
+                ram_block_notify(block, true);
             }
             return;
         }
@@ -1540,6 +1781,23 @@ void qemu_ram_remap(ram_addr_t addr, ram_addr_t length)
 }
 #endif /* !_WIN32 */
 
+void ram_block_dump(FILE *f, fprintf_function cpu_fprintf)
+{
+    RAMBlock *block;
+
+    cpu_fprintf(f, "%24s %18s %18s %10s\n",
+                "Block Name", "Offset", "Length", "Page Size");
+    qemu_mutex_lock_ramlist();
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        cpu_fprintf(f, "%24s 0x%016" PRIx64 " 0x%016" PRIx64 " %9zuk%s\n",
+                    block->idstr, (uint64_t)block->offset,
+                    (uint64_t)block->length, block->page_size >> 10,
+                    block->flags & RAM_HUGETLB ? " hugetlb" :
+                    block->fd >= 0 ? " file" : "");
+    }
+    qemu_mutex_unlock_ramlist();
+}
+
 int qemu_get_ram_fd(ram_addr_t addr)
 {
     RAMBlock *block = qemu_get_ram_block(addr);
@@ -1547,6 +1805,13 @@ int qemu_get_ram_fd(ram_addr_t addr)
     return block->fd;
 }
 
+size_t qemu_get_ram_page_size(ram_addr_t addr)
+{
+    RAMBlock *block = qemu_get_ram_block(addr);
+
+    return block->page_size;
+}
+
 void *qemu_get_ram_block_host_ptr(ram_addr_t addr)
 {
     RAMBlock *block = qemu_get_ram_block(addr);
@@ -1659,6 +1924,10 @@ static void notdirty_mem_write(void *opaque, hwaddr ram_addr,
     default:
         abort();
     }
+    if (!cpu_physical_memory_get_dirty_flag(ram_addr,
+                                            DIRTY_MEMORY_MIGRATION)) {
+        current_cpu->dirty_pages++;
+    }
     cpu_physical_memory_set_dirty_range_nocode(ram_addr, size);
     /* we remove the notdirty callback only if the code has been
        flushed */
@@ -1891,7 +2160,9 @@ static uint16_t dummy_section(PhysPageMap *map, AddressSpace *as,
 
 MemoryRegion *iotlb_to_region(AddressSpace *as, hwaddr index)
 {
-    return as->dispatch->map.sections[index & ~TARGET_PAGE_MASK].mr;
+    AddressSpaceDispatch *d = atomic_rcu_read(&as->dispatch);
+
+    return d->map.sections[index & ~TARGET_PAGE_MASK].mr;
 }
 
 static void io_mem_init(void)
@@ -1925,6 +2196,12 @@ static void mem_begin(MemoryListener *listener)
     as->next_dispatch = d;
 }
 
+static void address_space_dispatch_free(AddressSpaceDispatch *d)
+{
+    phys_sections_free(&d->map);
+    g_free(d);
+}
+
 static void mem_commit(MemoryListener *listener)
 {
     AddressSpace *as = container_of(listener, AddressSpace, dispatch_listener);
@@ -1933,11 +2210,9 @@ static void mem_commit(MemoryListener *listener)
 
     phys_page_compact_all(next, next->map.nodes_nb);
 
-    as->dispatch = next;
-
+    atomic_rcu_set(&as->dispatch, next);
     if (cur) {
-        phys_sections_free(&cur->map);
-        g_free(cur);
+        call_rcu(cur, address_space_dispatch_free, rcu);
     }
 }
 
@@ -1992,8 +2267,10 @@ void address_space_destroy_dispatch(AddressSpace *as)
     AddressSpaceDispatch *d = as->dispatch;
 
     memory_listener_unregister(&as->dispatch_listener);
-    g_free(d);
-    as->dispatch = NULL;
+    atomic_rcu_set(&as->dispatch, NULL);
+    if (d) {
+        call_rcu(d, address_space_dispatch_free, rcu);
+    }
 }
 
 static void memory_map_init(void)
@@ -2105,6 +2382,22 @@ static int memory_access_size(MemoryRegion *mr, unsigned l, hwaddr addr)
     return l;
 }
 
+/* Take the BQL for an MMIO access unless the caller already holds it or
+ * the region handles its own locking.  Returns true if the caller must
+ * release the BQL once the access is done.
+ */
+static bool prepare_mmio_access(MemoryRegion *mr)
+{
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
+    if (!mr->global_locking && !mr->flush_coalesced_mmio) {
+        return false;
+    }
+    qemu_mutex_lock_iothread();
+    return true;
+}
+
 bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
                       int len, bool is_write)
 {
@@ -2114,13 +2407,16 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
     hwaddr addr1;
     MemoryRegion *mr;
     bool error = false;
+    bool release_lock = false;
 
+    rcu_read_lock();
     while (len > 0) {
         l = len;
         mr = address_space_translate(as, addr, &addr1, &l, is_write);
 
         if (is_write) {
             if (!memory_access_is_direct(mr, is_write)) {
+                release_lock |= prepare_mmio_access(mr);
                 l = memory_access_size(mr, l, addr1);
                 /* XXX: could force current_cpu to NULL to avoid
                    potential bugs */
@@ -2158,6 +2454,7 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
         } else {
             if (!memory_access_is_direct(mr, is_write)) {
                 /* I/O case */
+                release_lock |= prepare_mmio_access(mr);
                 l = memory_access_size(mr, l, addr1);
                 switch (l) {
                 case 8:
@@ -2189,10 +2486,17 @@ bool address_space_rw(AddressSpace *as, hwaddr addr, uint8_t *buf,
                 memcpy(buf, ptr, l);
             }
         }
+
+        if (release_lock) {
+            qemu_mutex_unlock_iothread();
+            release_lock = false;
+        }
+
         len -= l;
         buf += l;
         addr += l;
     }
+    rcu_read_unlock();
 
     return error;
 }
@@ -2228,6 +2532,7 @@ static inline void cpu_physical_memory_write_rom_internal(AddressSpace *as,
     hwaddr addr1;
     MemoryRegion *mr;
 
+    rcu_read_lock();
     while (len > 0) {
         l = len;
         mr = address_space_translate(as, addr, &addr1, &l, true);
@@ -2253,6 +2558,7 @@ static inline void cpu_physical_memory_write_rom_internal(AddressSpace *as,
         buf += l;
         addr += l;
     }
+    rcu_read_unlock();
 }
 
 /* used for ROM loading : can write in RAM and ROM */
@@ -2330,12 +2636,14 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
     MemoryRegion *mr;
     hwaddr l, xlat;
 
+    rcu_read_lock();
     while (len > 0) {
         l = len;
         mr = address_space_translate(as, addr, &xlat, &l, is_write);
         if (!memory_access_is_direct(mr, is_write)) {
             l = memory_access_size(mr, l, addr);
             if (!memory_region_access_valid(mr, xlat, l, is_write)) {
+                rcu_read_unlock();
                 return false;
             }
         }
@@ -2343,6 +2651,7 @@ bool address_space_access_valid(AddressSpace *as, hwaddr addr, int len, bool is_
         len -= l;
         addr += l;
     }
+    rcu_read_unlock();
     return true;
 }
 
@@ -2369,9 +2678,11 @@ void *address_space_map(AddressSpace *as,
     }
 
     l = len;
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &xlat, &l, is_write);
     if (!memory_access_is_direct(mr, is_write)) {
         if (bounce.buffer) {
+            rcu_read_unlock();
             return NULL;
         }
         /* Avoid unbounded allocations */
@@ -2386,6 +2697,7 @@ void *address_space_map(AddressSpace *as,
             address_space_read(as, addr, bounce.buffer, l);
         }
 
+        rcu_read_unlock();
         *plen = l;
         return bounce.buffer;
     }
@@ -2409,6 +2721,7 @@ void *address_space_map(AddressSpace *as,
     }
 
     memory_region_ref(mr);
+    rcu_read_unlock();
     *plen = done;
     return qemu_ram_ptr_length(raddr + base, plen);
 }
@@ -2457,6 +2770,100 @@ void cpu_physical_memory_unmap(void *buffer, hwaddr len,
     return address_space_unmap(&address_space_memory, buffer, len, is_write, access_len);
 }
 
+void address_space_cache_init(MemoryRegionCache *cache, AddressSpace *as,
+                              hwaddr addr, hwaddr len, bool is_write)
+{
+    if (cache->as == as && cache->addr == addr && cache->len == len &&
+        cache->is_write == is_write) {
+        return;
+    }
+
+    address_space_cache_destroy(cache);
+    cache->as = as;
+    cache->addr = addr;
+    cache->len = len;
+    cache->is_write = is_write;
+}
+
+void address_space_cache_destroy(MemoryRegionCache *cache)
+{
+    if (cache->mr) {
+        memory_region_unref(cache->mr);
+    }
+    cache->mr = NULL;
+    cache->ptr = NULL;
+    cache->gen = 0;
+}
+
+/* Host pointer to the start of @cache's range, or NULL if it has to be
+ * accessed through the address space.  Translates the range again if the
+ * topology changed since the last time.
+ */
+static uint8_t *address_space_cache_ptr(MemoryRegionCache *cache)
+{
+    unsigned int gen = memory_region_topology_gen();
+    MemoryRegionSection section;
+
+    if (likely(cache->gen == gen)) {
+        return cache->ptr;
+    }
+
+    address_space_cache_destroy(cache);
+    cache->gen = gen;
+    if (!cache->len || xen_enabled()) {
+        return NULL;
+    }
+
+    /* The flat view has IOMMU regions as they are, so a range behind an
+     * IOMMU is never RAM here and is never cached.
+     */
+    section = memory_region_find(cache->as->root, cache->addr, cache->len);
+    if (!section.mr) {
+        return NULL;
+    }
+    if (int128_get64(section.size) < cache->len ||
+        !memory_region_is_ram(section.mr) ||
+        (cache->is_write && (section.readonly || section.mr->readonly))) {
+        memory_region_unref(section.mr);
+        return NULL;
+    }
+
+    cache->mr = section.mr;
+    cache->ram_addr = memory_region_get_ram_addr(section.mr) +
+                      section.offset_within_region;
+    cache->ptr = (uint8_t *)memory_region_get_ram_ptr(section.mr) +
+                 section.offset_within_region;
+    return cache->ptr;
+}
+
+void address_space_read_cached(MemoryRegionCache *cache, hwaddr offset,
+                               void *buf, int len)
+{
+    uint8_t *ptr = address_space_cache_ptr(cache);
+
+    if (likely(ptr && offset <= cache->len && len <= cache->len - offset)) {
+        memcpy(buf, ptr + offset, len);
+        return;
+    }
+    address_space_rw(cache->as, cache->addr + offset, buf, len, false);
+}
+
+void address_space_write_cached(MemoryRegionCache *cache, hwaddr offset,
+                                const void *buf, int len)
+{
+    uint8_t *ptr;
+
+    assert(cache->is_write);
+    ptr = address_space_cache_ptr(cache);
+    if (likely(ptr && offset <= cache->len && len <= cache->len - offset)) {
+        memcpy(ptr + offset, buf, len);
+        invalidate_and_set_dirty(cache->ram_addr + offset, len);
+        return;
+    }
+    address_space_rw(cache->as, cache->addr + offset, (uint8_t *)buf, len,
+                     true);
+}
+
 /* warning: addr must be aligned */
 static inline uint32_t ldl_phys_internal(AddressSpace *as, hwaddr addr,
                                          enum device_endian endian)
@@ -2466,10 +2873,13 @@ static inline uint32_t ldl_phys_internal(AddressSpace *as, hwaddr addr,
     MemoryRegion *mr;
     hwaddr l = 4;
     hwaddr addr1;
+    bool release_lock = false;
 
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &addr1, &l, false);
     if (l < 4 || !memory_access_is_direct(mr, false)) {
         /* I/O case */
+        release_lock |= prepare_mmio_access(mr);
         io_mem_read(mr, addr1, &val, 4);
 #if defined(TARGET_WORDS_BIGENDIAN)
         if (endian == DEVICE_LITTLE_ENDIAN) {
@@ -2497,6 +2907,10 @@ static inline uint32_t ldl_phys_internal(AddressSpace *as, hwaddr addr,
             break;
         }
     }
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_read_unlock();
     return val;
 }
 
@@ -2524,11 +2938,14 @@ static inline uint64_t ldq_phys_internal(AddressSpace *as, hwaddr addr,
     MemoryRegion *mr;
     hwaddr l = 8;
     hwaddr addr1;
+    bool release_lock = false;
 
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &addr1, &l,
                                  false);
     if (l < 8 || !memory_access_is_direct(mr, false)) {
         /* I/O case */
+        release_lock |= prepare_mmio_access(mr);
         io_mem_read(mr, addr1, &val, 8);
 #if defined(TARGET_WORDS_BIGENDIAN)
         if (endian == DEVICE_LITTLE_ENDIAN) {
@@ -2556,6 +2973,10 @@ static inline uint64_t ldq_phys_internal(AddressSpace *as, hwaddr addr,
             break;
         }
     }
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_read_unlock();
     return val;
 }
 
@@ -2591,11 +3012,14 @@ static inline uint32_t lduw_phys_internal(AddressSpace *as, hwaddr addr,
     MemoryRegion *mr;
     hwaddr l = 2;
     hwaddr addr1;
+    bool release_lock = false;
 
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &addr1, &l,
                                  false);
     if (l < 2 || !memory_access_is_direct(mr, false)) {
         /* I/O case */
+        release_lock |= prepare_mmio_access(mr);
         io_mem_read(mr, addr1, &val, 2);
 #if defined(TARGET_WORDS_BIGENDIAN)
         if (endian == DEVICE_LITTLE_ENDIAN) {
@@ -2623,6 +3047,10 @@ static inline uint32_t lduw_phys_internal(AddressSpace *as, hwaddr addr,
             break;
         }
     }
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_read_unlock();
     return val;
 }
 
@@ -2650,10 +3078,13 @@ void stl_phys_notdirty(AddressSpace *as, hwaddr addr, uint32_t val)
     MemoryRegion *mr;
     hwaddr l = 4;
     hwaddr addr1;
+    bool release_lock = false;
 
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &addr1, &l,
                                  true);
     if (l < 4 || !memory_access_is_direct(mr, true)) {
+        release_lock |= prepare_mmio_access(mr);
         io_mem_write(mr, addr1, val, 4);
     } else {
         addr1 += memory_region_get_ram_addr(mr) & TARGET_PAGE_MASK;
@@ -2669,6 +3100,10 @@ void stl_phys_notdirty(AddressSpace *as, hwaddr addr, uint32_t val)
             }
         }
     }
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_read_unlock();
 }
 
 /* warning: addr must be aligned */
@@ -2680,10 +3115,13 @@ static inline void stl_phys_internal(AddressSpace *as,
     MemoryRegion *mr;
     hwaddr l = 4;
     hwaddr addr1;
+    bool release_lock = false;
 
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &addr1, &l,
                                  true);
     if (l < 4 || !memory_access_is_direct(mr, true)) {
+        release_lock |= prepare_mmio_access(mr);
 #if defined(TARGET_WORDS_BIGENDIAN)
         if (endian == DEVICE_LITTLE_ENDIAN) {
             val = bswap32(val);
@@ -2711,6 +3149,10 @@ static inline void stl_phys_internal(AddressSpace *as,
         }
         invalidate_and_set_dirty(addr1, 4);
     }
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_read_unlock();
 }
 
 void stl_phys(AddressSpace *as, hwaddr addr, uint32_t val)
@@ -2744,9 +3186,12 @@ static inline void stw_phys_internal(AddressSpace *as,
     MemoryRegion *mr;
     hwaddr l = 2;
     hwaddr addr1;
+    bool release_lock = false;
 
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &addr1, &l, true);
     if (l < 2 || !memory_access_is_direct(mr, true)) {
+        release_lock |= prepare_mmio_access(mr);
 #if defined(TARGET_WORDS_BIGENDIAN)
         if (endian == DEVICE_LITTLE_ENDIAN) {
             val = bswap16(val);
@@ -2774,6 +3219,10 @@ static inline void stw_phys_internal(AddressSpace *as,
         }
         invalidate_and_set_dirty(addr1, 2);
     }
+    if (release_lock) {
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_read_unlock();
 }
 
 void stw_phys(AddressSpace *as, hwaddr addr, uint32_t val)
@@ -2860,12 +3309,15 @@ bool cpu_physical_memory_is_io(hwaddr phys_addr)
 {
     MemoryRegion*mr;
     hwaddr l = 1;
+    bool res;
 
+    rcu_read_lock();
     mr = address_space_translate(&address_space_memory,
                                  phys_addr, &phys_addr, &l, false);
 
-    return !(memory_region_is_ram(mr) ||
-             memory_region_is_romd(mr));
+    res = !(memory_region_is_ram(mr) || memory_region_is_romd(mr));
+    rcu_read_unlock();
+    return res;
 }
 
 void qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque)
@@ -44,6 +44,8 @@ these four paragraphs for those parts of this code that are retained.
 
 /* We only need stdlib for abort() */
 #include <stdlib.h>
+#include <float.h>
+#include <math.h>
 
 /*----------------------------------------------------------------------------
 | Primitive arithmetic functions, including multi-word arithmetic, and
@@ -2016,6 +2018,103 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path.  Once the inexact flag has been raised, and in the
+| default round-to-nearest-even mode, adding, subtracting, multiplying or
+| dividing zero or normal inputs, or taking the square root of a positive
+| normal input, gives exactly the same result as the code below and raises
+| no new flag, provided that the result is finite and above the smallest
+| normal number.  Such operations are done with host floating-point
+| arithmetic; NaNs, infinities, denormals and results that may overflow or
+| underflow still go through the software implementation.
+|
+| This needs a host that evaluates float and double expressions in their
+| own precision (not x87), and a compiler that keeps IEEE semantics.
+*----------------------------------------------------------------------------*/
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0 && \
+    !defined(__FAST_MATH__)
+#define USE_HOST_FPU 1
+#else
+#define USE_HOST_FPU 0
+#endif
+
+static inline flag host_fpu_usable(float_status *status)
+{
+    return USE_HOST_FPU &&
+           (STATUS(float_exception_flags) & float_flag_inexact) &&
+           STATUS(float_rounding_mode) == float_round_nearest_even;
+}
+
+static inline flag float32_host_fpu_ok(float32 a, float32 b STATUS_PARAM)
+{
+    int_fast16_t aExp = extractFloat32Exp(a);
+    int_fast16_t bExp = extractFloat32Exp(b);
+
+    return host_fpu_usable(status) &&
+           aExp != 0xFF && (aExp || !extractFloat32Frac(a)) &&
+           bExp != 0xFF && (bExp || !extractFloat32Frac(b));
+}
+
+static inline flag float64_host_fpu_ok(float64 a, float64 b STATUS_PARAM)
+{
+    int_fast16_t aExp = extractFloat64Exp(a);
+    int_fast16_t bExp = extractFloat64Exp(b);
+
+    return host_fpu_usable(status) &&
+           aExp != 0x7FF && (aExp || !extractFloat64Frac(a)) &&
+           bExp != 0x7FF && (bExp || !extractFloat64Frac(b));
+}
+
+static inline flag float32_host_result_ok(float r)
+{
+    return isfinite(r) && fabsf(r) > FLT_MIN;
+}
+
+static inline flag float64_host_result_ok(double r)
+{
+    return isfinite(r) && fabs(r) > DBL_MIN;
+}
+
+static inline float float32_to_host(float32 a)
+{
+    union {
+        uint32_t i;
+        float f;
+    } u = { .i = float32_val(a) };
+
+    return u.f;
+}
+
+static inline float32 float32_from_host(float f)
+{
+    union {
+        uint32_t i;
+        float f;
+    } u = { .f = f };
+
+    return make_float32(u.i);
+}
+
+static inline double float64_to_host(float64 a)
+{
+    union {
+        uint64_t i;
+        double f;
+    } u = { .i = float64_val(a) };
+
+    return u.f;
+}
+
+static inline float64 float64_from_host(double f)
+{
+    union {
+        uint64_t i;
+        double f;
+    } u = { .f = f };
+
+    return make_float64(u.i);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the single-precision floating-point values `a'
 | and `b'.  The operation is performed according to the IEC/IEEE Standard for
@@ -2025,6 +2124,15 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 float32 float32_add( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (float32_host_fpu_ok(a, b STATUS_VAR)) {
+        float r = float32_to_host(a) + float32_to_host(b);
+
+        if (float32_host_result_ok(r)) {
+            return float32_from_host(r);
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2048,6 +2156,15 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
 float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (float32_host_fpu_ok(a, b STATUS_VAR)) {
+        float r = float32_to_host(a) - float32_to_host(b);
+
+        if (float32_host_result_ok(r)) {
+            return float32_from_host(r);
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2076,6 +2193,14 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
     uint64_t zSig64;
     uint32_t zSig;
 
+    if (float32_host_fpu_ok(a, b STATUS_VAR)) {
+        float r = float32_to_host(a) * float32_to_host(b);
+
+        if (float32_host_result_ok(r)) {
+            return float32_from_host(r);
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2136,6 +2261,15 @@ float32 float32_div( float32 a, float32 b STATUS_PARAM )
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+
+    if (float32_host_fpu_ok(a, b STATUS_VAR)) {
+        float r = float32_to_host(a) / float32_to_host(b);
+
+        if (float32_host_result_ok(r)) {
+            return float32_from_host(r);
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2527,6 +2661,15 @@ float32 float32_sqrt( float32 a STATUS_PARAM )
     int_fast16_t aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+
+    if (float32_host_fpu_ok(a, a STATUS_VAR) && !extractFloat32Sign(a)) {
+        float r = sqrtf(float32_to_host(a));
+
+        if (float32_host_result_ok(r)) {
+            return float32_from_host(r);
+        }
+    }
+
     a = float32_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat32Frac( a );
@@ -3769,6 +3912,15 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 float64 float64_add( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (float64_host_fpu_ok(a, b STATUS_VAR)) {
+        double r = float64_to_host(a) + float64_to_host(b);
+
+        if (float64_host_result_ok(r)) {
+            return float64_from_host(r);
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3792,6 +3944,15 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
 float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+
+    if (float64_host_fpu_ok(a, b STATUS_VAR)) {
+        double r = float64_to_host(a) - float64_to_host(b);
+
+        if (float64_host_result_ok(r)) {
+            return float64_from_host(r);
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3818,6 +3979,14 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
     int_fast16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+    if (float64_host_fpu_ok(a, b STATUS_VAR)) {
+        double r = float64_to_host(a) * float64_to_host(b);
+
+        if (float64_host_result_ok(r)) {
+            return float64_from_host(r);
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3880,6 +4049,15 @@ float64 float64_div( float64 a, float64 b STATUS_PARAM )
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+
+    if (float64_host_fpu_ok(a, b STATUS_VAR)) {
+        double r = float64_to_host(a) / float64_to_host(b);
+
+        if (float64_host_result_ok(r)) {
+            return float64_from_host(r);
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -4283,6 +4461,15 @@ float64 float64_sqrt( float64 a STATUS_PARAM )
     int_fast16_t aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+
+    if (float64_host_fpu_ok(a, a STATUS_VAR) && !extractFloat64Sign(a)) {
+        double r = sqrt(float64_to_host(a));
+
+        if (float64_host_result_ok(r)) {
+            return float64_from_host(r);
+        }
+    }
+
     a = float64_squash_input_denormal(a STATUS_VAR);
 
     aSig = extractFloat64Frac( a );
@@ -0,0 +1,164 @@
+/*
+ * Sampling profiler for guest code under TCG
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "cpu.h"
+#include "disas/disas.h"
+#include "qemu/timer.h"
+#include "qom/cpu.h"
+
+/*
+ * A realtime timer asks every running vCPU for a sample.  The vCPU takes
+ * it in cpu_exec() the next time it is between TBs, which happens soon
+ * because the request also sets tcg_exit_req.  Samples are counted per
+ * guest PC in a hash table.
+ *
+ * TCG vCPUs run with the iothread mutex held, like the timer and the
+ * monitor commands, so that also protects the hash table.
+ */
+
+typedef struct GuestProfileEntry {
+    uint64_t pc;
+    uint64_t count;
+} GuestProfileEntry;
+
+static GHashTable *guest_profile_samples;
+static uint64_t guest_profile_total;
+static QEMUTimer *guest_profile_timer;
+static int64_t guest_profile_interval;
+
+static guint guest_profile_hash(gconstpointer key)
+{
+    uint64_t pc = *(const uint64_t *)key;
+
+    return (guint)(pc ^ (pc >> 32));
+}
+
+static gboolean guest_profile_equal(gconstpointer a, gconstpointer b)
+{
+    return *(const uint64_t *)a == *(const uint64_t *)b;
+}
+
+static void guest_profile_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (!cpu->halted) {
+            atomic_set(&cpu->profile_sample, true);
+            smp_wmb();
+            cpu->tcg_exit_req = 1;
+        }
+    }
+    timer_mod(guest_profile_timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + guest_profile_interval);
+}
+
+/* Called by the vCPU thread from cpu_exec() */
+void guest_profile_sample(CPUState *cpu, target_ulong pc)
+{
+    GuestProfileEntry *e;
+    uint64_t key = pc;
+
+    if (guest_profile_samples) {
+        e = g_hash_table_lookup(guest_profile_samples, &key);
+        if (!e) {
+            e = g_new0(GuestProfileEntry, 1);
+            e->pc = pc;
+            g_hash_table_insert(guest_profile_samples, &e->pc, e);
+        }
+        e->count++;
+        guest_profile_total++;
+    }
+}
+
+bool guest_profile_active(void)
+{
+    return guest_profile_timer != NULL;
+}
+
+/* Start sampling every @interval_ns, dropping the samples taken so far */
+void guest_profile_start(int64_t interval_ns)
+{
+    guest_profile_stop();
+
+    if (guest_profile_samples) {
+        g_hash_table_destroy(guest_profile_samples);
+    }
+    guest_profile_samples = g_hash_table_new_full(guest_profile_hash,
+                                                  guest_profile_equal,
+                                                  NULL, g_free);
+    guest_profile_total = 0;
+
+    guest_profile_interval = interval_ns;
+    guest_profile_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                       guest_profile_tick, NULL);
+    timer_mod(guest_profile_timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + guest_profile_interval);
+}
+
+/* Stop sampling; the samples stay around for guest_profile_dump() */
+void guest_profile_stop(void)
+{
+    if (guest_profile_timer) {
+        timer_del(guest_profile_timer);
+        timer_free(guest_profile_timer);
+        guest_profile_timer = NULL;
+    }
+}
+
+static int guest_profile_cmp(const void *a, const void *b)
+{
+    const GuestProfileEntry *ea = a;
+    const GuestProfileEntry *eb = b;
+
+    if (ea->count != eb->count) {
+        return ea->count > eb->count ? -1 : 1;
+    }
+    return ea->pc < eb->pc ? -1 : ea->pc > eb->pc;
+}
+
+static void guest_profile_collect(gpointer key, gpointer value,
+                                  gpointer opaque)
+{
+    GuestProfileEntry **next = opaque;
+
+    *(*next)++ = *(GuestProfileEntry *)value;
+}
+
+/* Print the @count guest addresses with the most samples */
+void guest_profile_dump(FILE *f, fprintf_function cpu_fprintf, int count)
+{
+    GuestProfileEntry *entries, *e;
+    uint64_t total;
+    guint i, n;
+
+    if (!guest_profile_samples) {
+        cpu_fprintf(f, "No guest profile; use guest_profile_start\n");
+        return;
+    }
+
+    n = g_hash_table_size(guest_profile_samples);
+    entries = g_new(GuestProfileEntry, n);
+    e = entries;
+    g_hash_table_foreach(guest_profile_samples, guest_profile_collect, &e);
+    total = guest_profile_total;
+
+    qsort(entries, n, sizeof(*entries), guest_profile_cmp);
+
+    cpu_fprintf(f, "%s, %" PRIu64 " samples at %" PRId64 " us, "
+                "%u addresses\n",
+                guest_profile_active() ? "Sampling" : "Stopped",
+                total, guest_profile_interval / SCALE_US, n);
+    for (i = 0; i < n && i < count; i++) {
+        e = &entries[i];
+        cpu_fprintf(f, "%10" PRIu64 " %5.1f%% " TARGET_FMT_lx " %s\n",
+                    e->count, e->count * 100.0 / total,
+                    (target_ulong)e->pc, lookup_symbol(e->pc));
+    }
+    g_free(entries);
+}
@@ -314,19 +314,27 @@ ETEXI
 
     {
         .name       = "savevm",
-        .args_type  = "name:s?",
-        .params     = "[tag|id]",
-        .help       = "save a VM snapshot. If no tag or id are provided, a new snapshot is created",
+        .args_type  = "live:-l,name:s?",
+        .params     = "[-l] [tag|id]",
+        .help       = "save a VM snapshot. If no tag or id are provided, a new snapshot is created.\n\t\t\t"
+                      "-l: save RAM while the guest is running",
         .mhandler.cmd = do_savevm,
     },
 
 STEXI
-@item savevm [@var{tag}|@var{id}]
+@item savevm [-l] [@var{tag}|@var{id}]
 @findex savevm
 Create a snapshot of the whole virtual machine. If @var{tag} is
 provided, it is used as human readable identifier. If there is already
 a snapshot with the same tag or ID, it is replaced. More info at
 @ref{vm_snapshots}.
+
+With @option{-l}, guest RAM is saved while the guest keeps running, the
+way live migration sends it, and the guest is only stopped to save what
+it changed in the meantime and the device state.  The snapshot is the
+state of the guest at the point where it was stopped; the pause is
+bounded by the maximum migration downtime (@code{migrate_set_downtime}),
+unless the guest keeps dirtying memory faster than it can be saved.
 ETEXI
 
     {
@@ -373,6 +381,38 @@ STEXI
 @findex singlestep
 Run the emulation in single step mode.
 If called with option off, the emulation returns to normal mode.
+ETEXI
+
+    {
+        .name       = "guest_profile_start",
+        .args_type  = "interval:i?",
+        .params     = "[interval]",
+        .help       = "sample the guest PC of each vCPU every 'interval' us",
+        .mhandler.cmd = do_guest_profile_start,
+    },
+
+STEXI
+@item guest_profile_start [@var{interval}]
+@findex guest_profile_start
+Sample the guest program counter of every running vCPU each @var{interval}
+microseconds (default 1000) and count the samples per address.  Samples from
+an earlier run are discarded.  Use @code{info guest-profile} to see the
+results.  Only available with TCG.
+ETEXI
+
+    {
+        .name       = "guest_profile_stop",
+        .args_type  = "",
+        .params     = "",
+        .help       = "stop sampling guest PCs",
+        .mhandler.cmd = do_guest_profile_stop,
+    },
+
+STEXI
+@item guest_profile_stop
+@findex guest_profile_stop
+Stop sampling; the samples taken so far stay available to
+@code{info guest-profile}.
 ETEXI
 
     {
@@ -919,6 +959,22 @@ STEXI
 @findex migrate_cancel
 Cancel the current VM migration.
 
+ETEXI
+
+    {
+        .name       = "migrate_start_postcopy",
+        .args_type  = "",
+        .params     = "",
+        .help       = "switch the current migration to postcopy mode",
+        .mhandler.cmd = hmp_migrate_start_postcopy,
+    },
+
+STEXI
+@item migrate_start_postcopy
+@findex migrate_start_postcopy
+Switch the current migration to postcopy mode: the destination starts
+running and fetches the pages it is still missing on demand.  The
+postcopy-ram capability must be enabled on both sides.
 ETEXI
 
     {
@@ -982,6 +1038,36 @@ STEXI
 @item migrate_set_capability @var{capability} @var{state}
 @findex migrate_set_capability
 Enable/Disable the usage of a capability @var{capability} for migration.
+ETEXI
+
+    {
+        .name       = "migrate_set_parameter",
+        .args_type  = "parameter:s,value:i",
+        .params     = "parameter value",
+        .help       = "Set the parameter for migration",
+        .mhandler.cmd = hmp_migrate_set_parameter,
+        .command_completion = migrate_set_parameter_completion,
+    },
+
+STEXI
+@item migrate_set_parameter @var{parameter} @var{value}
+@findex migrate_set_parameter
+Set the parameter @var{parameter} for migration.
+ETEXI
+
+    {
+        .name       = "calc_dirty_rate",
+        .args_type  = "second:i",
+        .params     = "second",
+        .help       = "measure the guest RAM dirty rate for 'second' seconds",
+        .mhandler.cmd = hmp_calc_dirty_rate,
+    },
+
+STEXI
+@item calc_dirty_rate @var{second}
+@findex calc_dirty_rate
+Measure the rate at which the guest dirties its RAM for @var{second}
+seconds, without migrating.  See @code{info dirty_rate} for the result.
 ETEXI
 
     {
@@ -1004,10 +1090,11 @@ ETEXI
 
     {
         .name       = "dump-guest-memory",
-        .args_type  = "paging:-p,zlib:-z,lzo:-l,snappy:-s,filename:F,begin:i?,length:i?",
-        .params     = "[-p] [-z|-l|-s] filename [begin length]",
+        .args_type  = "paging:-p,detach:-d,zlib:-z,lzo:-l,snappy:-s,filename:F,begin:i?,length:i?",
+        .params     = "[-p] [-d] [-z|-l|-s] filename [begin length]",
         .help       = "dump guest memory into file 'filename'.\n\t\t\t"
                       "-p: do paging to get guest's memory mapping.\n\t\t\t"
+                      "-d: return immediately (do not wait for completion).\n\t\t\t"
                       "-z: dump in kdump-compressed format, with zlib compression.\n\t\t\t"
                       "-l: dump in kdump-compressed format, with lzo compression.\n\t\t\t"
                       "-s: dump in kdump-compressed format, with snappy compression.\n\t\t\t"
@@ -1018,12 +1105,15 @@ ETEXI
 
 
 STEXI
-@item dump-guest-memory [-p] @var{filename} @var{begin} @var{length}
-@item dump-guest-memory [-z|-l|-s] @var{filename}
+@item dump-guest-memory [-p] [-d] @var{filename} @var{begin} @var{length}
+@item dump-guest-memory [-d] [-z|-l|-s] @var{filename}
 @findex dump-guest-memory
 Dump guest memory to @var{protocol}. The file can be processed with crash or
 gdb. Without -z|-l|-s, the dump format is ELF.
         -p: do paging to get guest's memory mapping.
+        -d: return immediately and dump in the background; the guest stays
+            stopped until the dump is done.  Use @code{info dump} to see the
+            progress.
         -z: dump in kdump-compressed format, with zlib compression.
         -l: dump in kdump-compressed format, with lzo compression.
         -s: dump in kdump-compressed format, with snappy compression.
@@ -1730,8 +1820,23 @@ show emulated PCI device info
 show virtual to physical memory mappings (i386, SH4, SPARC, PPC, and Xtensa only)
 @item info mem
 show the active virtual memory mappings (i386 only)
+@item info ramblock
+show RAM blocks and the host page size backing each of them
 @item info jit
 show dynamic compiler info
+@item info jit-stats
+show TB hash table, jump cache and TLB flush statistics for each vCPU
+@item info startup
+show the wall-clock time of each startup phase (command line, accelerator,
+backends, machine, devices, displays, ROMs, machine init done notifiers,
+reset, start) and the devices that took longest to realize
+@item info timers
+show the number of timer lists and pending timers of each clock
+@item info dump
+show the status and progress of the latest guest memory dump
+@item info guest-profile [@var{count}]
+show the @var{count} (default 20) guest addresses with the most samples
+taken by @code{guest_profile_start}
 @item info numa
 show NUMA information
 @item info kvm
@@ -1764,6 +1869,10 @@ show user network stack connection states
 show migration status
 @item info migrate_capabilities
 show current migration capabilities
+@item info migrate_parameters
+show current migration parameters
+@item info dirty_rate
+show the guest RAM dirty rate measurement
 @item info migrate_cache_size
 show current migration XBZRLE cache size
 @item info balloon
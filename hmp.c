@@ -197,6 +197,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "dirty pages rate: %" PRIu64 " pages\n",
                            info->ram->dirty_pages_rate);
         }
+        if (info->ram->has_postcopy_requests) {
+            monitor_printf(mon, "postcopy requests: %" PRIu64 "\n",
+                           info->ram->postcopy_requests);
+        }
     }
 
     if (info->has_disk) {
@@ -208,6 +212,17 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->disk->total >> 10);
     }
 
+    if (info->has_disk_devices) {
+        BlockMigrationDeviceInfoList *dev;
+
+        for (dev = info->disk_devices; dev; dev = dev->next) {
+            monitor_printf(mon, "disk %s: %" PRId64 " of %" PRId64
+                           " kbytes\n", dev->value->device,
+                           dev->value->transferred >> 10,
+                           dev->value->total >> 10);
+        }
+    }
+
     if (info->has_xbzrle_cache) {
         monitor_printf(mon, "cache size: %" PRIu64 " bytes\n",
                        info->xbzrle_cache->cache_size);
@@ -221,6 +236,37 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->cache_miss_rate);
         monitor_printf(mon, "xbzrle overflow : %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
+        if (info->xbzrle_cache->has_blocks) {
+            XBZRLEBlockStatsList *block;
+
+            for (block = info->xbzrle_cache->blocks; block;
+                 block = block->next) {
+                monitor_printf(mon, "xbzrle block %s: miss rate %0.2f, "
+                               "overflow rate %0.2f\n",
+                               block->value->id,
+                               block->value->cache_miss_rate,
+                               block->value->overflow_rate);
+            }
+        }
+    }
+
+    if (info->has_device_times) {
+        DeviceStateTimeList *dev;
+
+        for (dev = info->device_times; dev; dev = dev->next) {
+            monitor_printf(mon, "device %s/%" PRId64 " save time: %" PRId64
+                           " us\n", dev->value->id, dev->value->instance_id,
+                           dev->value->time);
+        }
+    }
+
+    if (info->has_cpu_throttle) {
+        CpuThrottleInfoList *cpu;
+
+        for (cpu = info->cpu_throttle; cpu; cpu = cpu->next) {
+            monitor_printf(mon, "cpu %" PRId64 " throttle: %" PRId64 " %%\n",
+                           cpu->value->cpu_index, cpu->value->percentage);
+        }
     }
 
     qapi_free_MigrationInfo(info);
@@ -246,6 +292,56 @@ void hmp_info_migrate_capabilities(Monitor *mon, const QDict *qdict)
     qapi_free_MigrationCapabilityStatusList(caps);
 }
 
+void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
+{
+    MigrationParameters *params;
+
+    params = qmp_query_migrate_parameters(NULL);
+
+    if (params) {
+        monitor_printf(mon, "parameters:");
+        monitor_printf(mon, " %s: %" PRId64,
+            MigrationParameter_lookup[MIGRATION_PARAMETER_COMPRESS_LEVEL],
+            params->compress_level);
+        monitor_printf(mon, " %s: %" PRId64,
+            MigrationParameter_lookup[MIGRATION_PARAMETER_COMPRESS_THREADS],
+            params->compress_threads);
+        monitor_printf(mon, " %s: %" PRId64,
+            MigrationParameter_lookup[MIGRATION_PARAMETER_DECOMPRESS_THREADS],
+            params->decompress_threads);
+        monitor_printf(mon, " %s: %" PRId64,
+            MigrationParameter_lookup[MIGRATION_PARAMETER_MULTIFD_CHANNELS],
+            params->multifd_channels);
+        monitor_printf(mon, "\n");
+    }
+
+    qapi_free_MigrationParameters(params);
+}
+
+void hmp_info_dirty_rate(Monitor *mon, const QDict *qdict)
+{
+    DirtyRateInfo *info;
+    RamBlockDirtyInfoList *block;
+
+    info = qmp_query_dirty_rate(NULL);
+
+    monitor_printf(mon, "status: %s\n", DirtyRateStatus_lookup[info->status]);
+    if (info->status == DIRTY_RATE_STATUS_MEASURING) {
+        monitor_printf(mon, "calc time: %" PRId64 " seconds\n",
+                       info->calc_time);
+    }
+    if (info->has_dirty_rate) {
+        monitor_printf(mon, "dirty rate: %" PRId64 " pages/s over %" PRId64
+                       " seconds\n", info->dirty_rate, info->calc_time);
+    }
+    for (block = info->blocks; block; block = block->next) {
+        monitor_printf(mon, "%s: %" PRId64 " pages/s\n",
+                       block->value->id, block->value->dirty_rate);
+    }
+
+    qapi_free_DirtyRateInfo(info);
+}
+
 void hmp_info_migrate_cache_size(Monitor *mon, const QDict *qdict)
 {
     monitor_printf(mon, "xbzrel cache size: %" PRId64 " kbytes\n",
@@ -365,7 +461,8 @@ void hmp_info_block(Monitor *mon, const QDict *qdict)
                             " iops_max=%" PRId64
                             " iops_rd_max=%" PRId64
                             " iops_wr_max=%" PRId64
-                            " iops_size=%" PRId64 "\n",
+                            " iops_size=%" PRId64
+                            " group=%s\n",
                             info->value->inserted->bps,
                             info->value->inserted->bps_rd,
                             info->value->inserted->bps_wr,
@@ -378,7 +475,8 @@ void hmp_info_block(Monitor *mon, const QDict *qdict)
                             info->value->inserted->iops_max,
                             info->value->inserted->iops_rd_max,
                             info->value->inserted->iops_wr_max,
-                            info->value->inserted->iops_size);
+                            info->value->inserted->iops_size,
+                            info->value->inserted->group);
         }
 
         if (verbose) {
@@ -419,6 +517,11 @@ void hmp_info_blockstats(Monitor *mon, const QDict *qdict)
                        " wr_total_time_ns=%" PRId64
                        " rd_total_time_ns=%" PRId64
                        " flush_total_time_ns=%" PRId64
+                       " failed_rd_operations=%" PRId64
+                       " failed_wr_operations=%" PRId64
+                       " failed_flush_operations=%" PRId64
+                       " invalid_rd_operations=%" PRId64
+                       " invalid_wr_operations=%" PRId64
                        "\n",
                        stats->value->stats->rd_bytes,
                        stats->value->stats->wr_bytes,
@@ -427,7 +530,12 @@ void hmp_info_blockstats(Monitor *mon, const QDict *qdict)
                        stats->value->stats->flush_operations,
                        stats->value->stats->wr_total_time_ns,
                        stats->value->stats->rd_total_time_ns,
-                       stats->value->stats->flush_total_time_ns);
+                       stats->value->stats->flush_total_time_ns,
+                       stats->value->stats->failed_rd_operations,
+                       stats->value->stats->failed_wr_operations,
+                       stats->value->stats->failed_flush_operations,
+                       stats->value->stats->invalid_rd_operations,
+                       stats->value->stats->invalid_wr_operations);
     }
 
     qapi_free_BlockStatsList(stats_list);
@@ -938,7 +1046,7 @@ void hmp_drive_mirror(Monitor *mon, const QDict *qdict)
                      false, NULL, false, NULL,
                      full ? MIRROR_SYNC_MODE_FULL : MIRROR_SYNC_MODE_TOP,
                      true, mode, false, 0, false, 0, false, 0,
-                     false, 0, false, 0, &err);
+                     false, 0, false, 0, false, 0, &err);
     hmp_handle_error(mon, &err);
 }
 
@@ -966,7 +1074,8 @@ void hmp_drive_backup(Monitor *mon, const QDict *qdict)
 
     qmp_drive_backup(device, filename, !!format, format,
                      full ? MIRROR_SYNC_MODE_FULL : MIRROR_SYNC_MODE_TOP,
-                     true, mode, false, 0, false, 0, false, 0, &err);
+                     false, NULL, true, mode, false, 0, false, 0, false, 0,
+                     &err);
     hmp_handle_error(mon, &err);
 }
 
@@ -1022,6 +1131,14 @@ void hmp_migrate_cancel(Monitor *mon, const QDict *qdict)
     qmp_migrate_cancel(NULL);
 }
 
+void hmp_migrate_start_postcopy(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_migrate_start_postcopy(&err);
+    hmp_handle_error(mon, &err);
+}
+
 void hmp_migrate_set_downtime(Monitor *mon, const QDict *qdict)
 {
     double value = qdict_get_double(qdict, "value");
@@ -1079,6 +1196,68 @@ void hmp_migrate_set_capability(Monitor *mon, const QDict *qdict)
     }
 }
 
+void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
+{
+    const char *param = qdict_get_str(qdict, "parameter");
+    int64_t value = qdict_get_int(qdict, "value");
+    Error *err = NULL;
+    bool has_compress_level = false;
+    bool has_compress_threads = false;
+    bool has_decompress_threads = false;
+    bool has_multifd_channels = false;
+    int i;
+
+    for (i = 0; i < MIGRATION_PARAMETER_MAX; i++) {
+        if (strcmp(param, MigrationParameter_lookup[i]) == 0) {
+            switch (i) {
+            case MIGRATION_PARAMETER_COMPRESS_LEVEL:
+                has_compress_level = true;
+                break;
+            case MIGRATION_PARAMETER_COMPRESS_THREADS:
+                has_compress_threads = true;
+                break;
+            case MIGRATION_PARAMETER_DECOMPRESS_THREADS:
+                has_decompress_threads = true;
+                break;
+            case MIGRATION_PARAMETER_MULTIFD_CHANNELS:
+                has_multifd_channels = true;
+                break;
+            }
+            qmp_migrate_set_parameters(has_compress_level, value,
+                                       has_compress_threads, value,
+                                       has_decompress_threads, value,
+                                       has_multifd_channels, value,
+                                       &err);
+            break;
+        }
+    }
+
+    if (i == MIGRATION_PARAMETER_MAX) {
+        error_set(&err, QERR_INVALID_PARAMETER, param);
+    }
+
+    if (err) {
+        monitor_printf(mon, "migrate_set_parameter: %s\n",
+                       error_get_pretty(err));
+        error_free(err);
+    }
+}
+
+void hmp_calc_dirty_rate(Monitor *mon, const QDict *qdict)
+{
+    int64_t sec = qdict_get_int(qdict, "second");
+    Error *err = NULL;
+
+    qmp_calc_dirty_rate(sec, &err);
+    if (err) {
+        monitor_printf(mon, "calc_dirty_rate: %s\n", error_get_pretty(err));
+        error_free(err);
+        return;
+    }
+    monitor_printf(mon, "Measuring for %" PRId64 " seconds, see "
+                   "'info dirty_rate'\n", sec);
+}
+
 void hmp_set_password(Monitor *mon, const QDict *qdict)
 {
     const char *protocol  = qdict_get_str(qdict, "protocol");
@@ -1167,7 +1346,21 @@ void hmp_block_set_io_throttle(Monitor *mon, const QDict *qdict)
                               false,
                               0,
                               false, /* No default I/O size */
-                              0, &err);
+                              0,
+                              false, /* no burst length via HMP */
+                              0,
+                              false,
+                              0,
+                              false,
+                              0,
+                              false,
+                              0,
+                              false,
+                              0,
+                              false,
+                              0,
+                              false,
+                              NULL, &err);
     hmp_handle_error(mon, &err);
 }
 
@@ -1327,6 +1520,7 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
     int zlib = qdict_get_try_bool(qdict, "zlib", 0);
     int lzo = qdict_get_try_bool(qdict, "lzo", 0);
     int snappy = qdict_get_try_bool(qdict, "snappy", 0);
+    int detach = qdict_get_try_bool(qdict, "detach", 0);
     const char *file = qdict_get_str(qdict, "filename");
     bool has_begin = qdict_haskey(qdict, "begin");
     bool has_length = qdict_haskey(qdict, "length");
@@ -1363,11 +1557,26 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
     prot = g_strconcat("file:", file, NULL);
 
     qmp_dump_guest_memory(paging, prot, has_begin, begin, has_length, length,
-                          true, dump_format, &err);
+                          true, dump_format, true, detach, &err);
     hmp_handle_error(mon, &err);
     g_free(prot);
 }
 
+void hmp_info_dump(Monitor *mon, const QDict *qdict)
+{
+    DumpQueryResult *result = qmp_query_dump(NULL);
+
+    monitor_printf(mon, "Status: %s\n", DumpStatus_lookup[result->status]);
+    if (result->status == DUMP_STATUS_ACTIVE) {
+        monitor_printf(mon, "Finished: %.1f %%\n",
+                       result->total ? 100.0 * result->completed /
+                                       result->total : 0.0);
+    }
+    monitor_printf(mon, "Written: %" PRId64 " of %" PRId64 " bytes\n",
+                   result->completed, result->total);
+    qapi_free_DumpQueryResult(result);
+}
+
 void hmp_netdev_add(Monitor *mon, const QDict *qdict)
 {
     Error *err = NULL;
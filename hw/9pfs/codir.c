@@ -39,6 +39,59 @@ int v9fs_co_readdir_r(V9fsPDU *pdu, V9fsFidState *fidp, struct dirent *dent,
     return err;
 }
 
+/*
+ * Read as many directory entries as fit in @max_count bytes of a Rreaddir
+ * reply, in a single trip to the worker thread.  The directory is left
+ * positioned after the last returned entry.  The caller owns the list.
+ */
+int v9fs_co_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
+                         V9fsDirEnt **entries, int32_t max_count)
+{
+    int err;
+    V9fsState *s = pdu->s;
+
+    *entries = NULL;
+    if (v9fs_request_cancelled(pdu)) {
+        return -EINTR;
+    }
+    v9fs_co_run_in_worker(
+        {
+            V9fsDirEnt **tail = entries;
+            struct dirent *dent, *result;
+            off_t saved_dir_pos;
+            int32_t size = 0;
+
+            err = 0;
+            saved_dir_pos = s->ops->telldir(&s->ctx, &fidp->fs);
+            if (saved_dir_pos < 0) {
+                err = -errno;
+            }
+            dent = g_malloc(sizeof(struct dirent));
+            while (saved_dir_pos >= 0) {
+                errno = 0;
+                s->ops->readdir_r(&s->ctx, &fidp->fs, dent, &result);
+                if (!result) {
+                    err = errno ? -errno : 0;
+                    break;
+                }
+                /* same as v9fs_readdir_data_size() */
+                size += 24 + strlen(dent->d_name);
+                if (size > max_count) {
+                    /* Out of buffer, leave this entry for the next call */
+                    s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
+                    break;
+                }
+                *tail = g_new0(V9fsDirEnt, 1);
+                (*tail)->dent = dent;
+                tail = &(*tail)->next;
+                saved_dir_pos = dent->d_off;
+                dent = g_malloc(sizeof(struct dirent));
+            }
+            g_free(dent);
+        });
+    return err;
+}
+
 off_t v9fs_co_telldir(V9fsPDU *pdu, V9fsFidState *fidp)
 {
     off_t err;
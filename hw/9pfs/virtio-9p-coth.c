@@ -55,13 +55,40 @@ static void v9fs_thread_routine(gpointer data, gpointer user_data)
     } while (len == -1 && errno == EINTR);
 }
 
-int v9fs_init_worker_threads(void)
+/*
+ * The pool is shared by all 9p devices.  A device asking for no limit
+ * (workers == 0) lifts the limit for everybody; otherwise the largest
+ * request wins.
+ */
+static void v9fs_set_max_threads(unsigned int workers)
+{
+    V9fsThPool *p = &v9fs_pool;
+
+    if (workers == 0) {
+        p->max_threads = -1;
+    } else if (p->max_threads != -1) {
+        p->max_threads = MAX(p->max_threads, (int)workers);
+    }
+    g_thread_pool_set_max_threads(p->pool, p->max_threads, NULL);
+    if (p->max_threads != -1) {
+        /* Keep idle workers around instead of respawning them */
+        g_thread_pool_set_max_unused_threads(p->max_threads);
+    }
+}
+
+int v9fs_init_worker_threads(unsigned int workers)
 {
     int ret = 0;
     int notifier_fds[2];
     V9fsThPool *p = &v9fs_pool;
     sigset_t set, oldset;
 
+    if (p->pool) {
+        /* Already set up by another device */
+        v9fs_set_max_threads(workers);
+        return 0;
+    }
+
     sigfillset(&set);
     /* Leave signal handling to the iothread.  */
     pthread_sigmask(SIG_SETMASK, &set, &oldset);
@@ -70,11 +97,14 @@ int v9fs_init_worker_threads(void)
         ret = -1;
         goto err_out;
     }
-    p->pool = g_thread_pool_new(v9fs_thread_routine, p, -1, FALSE, NULL);
+    p->max_threads = workers ? workers : -1;
+    p->pool = g_thread_pool_new(v9fs_thread_routine, p, p->max_threads,
+                                FALSE, NULL);
     if (!p->pool) {
         ret = -1;
         goto err_out;
     }
+    v9fs_set_max_threads(workers);
     p->completed = g_async_queue_new();
     if (!p->completed) {
         /*
@@ -99,13 +99,14 @@ static void virtio_9p_device_realize(DeviceState *dev, Error **errp)
     s->config_size = sizeof(struct virtio_9p_config) + len;
     s->fid_list = NULL;
     qemu_co_rwlock_init(&s->rename_lock);
+    s->stat_gen = 1;
 
     if (s->ops->init(&s->ctx) < 0) {
         error_setg(errp, "Virtio-9p Failed to initialize fs-driver with id:%s"
                    " and export path:%s", s->fsconf.fsdev_id, s->ctx.fs_root);
         goto out;
     }
-    if (v9fs_init_worker_threads() < 0) {
+    if (v9fs_init_worker_threads(s->fsconf.workers) < 0) {
         error_setg(errp, "worker thread initialization failed");
         goto out;
     }
@@ -14,6 +14,7 @@
 #include "hw/virtio/virtio.h"
 #include "hw/i386/pc.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
 #include "virtio-9p.h"
 #include "fsdev/qemu-fsdev.h"
 #include "virtio-9p-xattr.h"
@@ -587,6 +588,8 @@ static void free_pdu(V9fsState *s, V9fsPDU *pdu)
     }
 }
 
+static bool keeps_stat_cache(V9fsPDU *pdu);
+
 /*
  * We don't do error checking for pdu_marshal/unmarshal here
  * because we always expect to have enough space to encode
@@ -596,6 +599,11 @@ static void complete_pdu(V9fsState *s, V9fsPDU *pdu, ssize_t len)
 {
     int8_t id = pdu->id + 1; /* Response */
 
+    /* Invalidate again, lstat() may have raced with the modification */
+    if (!keeps_stat_cache(pdu)) {
+        s->stat_gen++;
+    }
+
     if (len < 0) {
         int err = -len;
         len = 7;
@@ -998,6 +1006,36 @@ out_nofid:
     v9fs_string_free(&aname);
 }
 
+/*
+ * Guests issue Tgetattr/Tstat storms on the same fid.  Serve them from the
+ * fid's lstat() cache as long as no request that may modify the export
+ * was seen since, and the entry is young enough that changes made on the
+ * host side show up quickly.
+ */
+#define V9FS_STAT_CACHE_NS 1000000000LL
+
+static int v9fs_fid_lstat(V9fsPDU *pdu, V9fsFidState *fidp,
+                          struct stat *stbuf)
+{
+    V9fsState *s = pdu->s;
+    uint64_t gen = s->stat_gen;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int err;
+
+    if (fidp->st_cache_gen == gen &&
+        now - fidp->st_cache_time < V9FS_STAT_CACHE_NS) {
+        *stbuf = fidp->st_cache;
+        return 0;
+    }
+    err = v9fs_co_lstat(pdu, &fidp->path, stbuf);
+    if (err == 0) {
+        fidp->st_cache = *stbuf;
+        fidp->st_cache_gen = gen;
+        fidp->st_cache_time = now;
+    }
+    return err;
+}
+
 static void v9fs_stat(void *opaque)
 {
     int32_t fid;
@@ -1020,7 +1058,7 @@ static void v9fs_stat(void *opaque)
         err = -ENOENT;
         goto out_nofid;
     }
-    err = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
+    err = v9fs_fid_lstat(pdu, fidp, &stbuf);
     if (err < 0) {
         goto out;
     }
@@ -1070,7 +1108,7 @@ static void v9fs_getattr(void *opaque)
      * Currently we only support BASIC fields in stat, so there is no
      * need to look at request_mask.
      */
-    retval = v9fs_co_lstat(pdu, &fidp->path, &stbuf);
+    retval = v9fs_fid_lstat(pdu, fidp, &stbuf);
     if (retval < 0) {
         goto out;
     }
@@ -1678,6 +1716,24 @@ static void v9fs_init_qiov_from_pdu(QEMUIOVector *qiov, V9fsPDU *pdu,
     qemu_iovec_concat(qiov, &elem, skip, size);
 }
 
+/*
+ * Return the part of @qiov_full that follows the first @done bytes.
+ *
+ * A complete transfer, the common case, does its preadv/pwritev straight on
+ * the guest's mapped scatter list.  Only after a short read or write is the
+ * remainder rebuilt, into @qiov.
+ */
+static QEMUIOVector *v9fs_qiov_remainder(QEMUIOVector *qiov_full,
+                                         QEMUIOVector *qiov, size_t done)
+{
+    if (done == 0) {
+        return qiov_full;
+    }
+    qemu_iovec_reset(qiov);
+    qemu_iovec_concat(qiov, qiov_full, done, qiov_full->size - done);
+    return qiov;
+}
+
 static void v9fs_read(void *opaque)
 {
     int32_t fid;
@@ -1719,35 +1775,35 @@ static void v9fs_read(void *opaque)
     } else if (fidp->fid_type == P9_FID_FILE) {
         QEMUIOVector qiov_full;
         QEMUIOVector qiov;
+        QEMUIOVector *cur;
         int32_t len;
 
         v9fs_init_qiov_from_pdu(&qiov_full, pdu, offset + 4, max_count, false);
-        qemu_iovec_init(&qiov, qiov_full.niov);
+        /* Only used after a short read, allocated on demand */
+        qemu_iovec_init(&qiov, 0);
         do {
-            qemu_iovec_reset(&qiov);
-            qemu_iovec_concat(&qiov, &qiov_full, count, qiov_full.size - count);
+            cur = v9fs_qiov_remainder(&qiov_full, &qiov, count);
             if (0) {
-                print_sg(qiov.iov, qiov.niov);
+                print_sg(cur->iov, cur->niov);
             }
             /* Loop in case of EINTR */
             do {
-                len = v9fs_co_preadv(pdu, fidp, qiov.iov, qiov.niov, off);
+                len = v9fs_co_preadv(pdu, fidp, cur->iov, cur->niov, off);
                 if (len >= 0) {
                     off   += len;
                     count += len;
                 }
             } while (len == -EINTR && !pdu->cancelled);
-            if (len < 0) {
-                /* IO error return the error */
-                err = len;
-                goto out;
-            }
         } while (count < max_count && len > 0);
-        err = pdu_marshal(pdu, offset, "d", count);
-        if (err < 0) {
-            goto out;
+        if (len < 0) {
+            /* IO error return the error */
+            err = len;
+        } else {
+            err = pdu_marshal(pdu, offset, "d", count);
+            if (err >= 0) {
+                err += offset + count;
+            }
         }
-        err += offset + count;
         qemu_iovec_destroy(&qiov);
         qemu_iovec_destroy(&qiov_full);
     } else if (fidp->fid_type == P9_FID_XATTR) {
@@ -1771,6 +1827,17 @@ static size_t v9fs_readdir_data_size(V9fsString *name)
     return 24 + v9fs_string_size(name);
 }
 
+static void v9fs_free_dirents(V9fsDirEnt *e)
+{
+    V9fsDirEnt *next;
+
+    for (; e; e = next) {
+        next = e->next;
+        g_free(e->dent);
+        g_free(e);
+    }
+}
+
 static int v9fs_do_readdir(V9fsPDU *pdu,
                            V9fsFidState *fidp, int32_t max_count)
 {
@@ -1779,31 +1846,16 @@ static int v9fs_do_readdir(V9fsPDU *pdu,
     V9fsString name;
     int len, err = 0;
     int32_t count = 0;
-    off_t saved_dir_pos;
-    struct dirent *dent, *result;
-
-    /* save the directory position */
-    saved_dir_pos = v9fs_co_telldir(pdu, fidp);
-    if (saved_dir_pos < 0) {
-        return saved_dir_pos;
-    }
+    struct dirent *dent;
+    V9fsDirEnt *entries, *e;
 
-    dent = g_malloc(sizeof(struct dirent));
+    /* Fetch all entries that fit in the reply with one worker hop */
+    err = v9fs_co_readdir_many(pdu, fidp, &entries, max_count);
 
-    while (1) {
-        err = v9fs_co_readdir_r(pdu, fidp, dent, &result);
-        if (err || !result) {
-            break;
-        }
+    for (e = entries; e; e = e->next) {
+        dent = e->dent;
         v9fs_string_init(&name);
         v9fs_string_sprintf(&name, "%s", dent->d_name);
-        if ((count + v9fs_readdir_data_size(&name)) > max_count) {
-            /* Ran out of buffer. Set dir back to old position and return */
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_string_free(&name);
-            g_free(dent);
-            return count;
-        }
         /*
          * Fill up just the path field of qid because the client uses
          * only that. To fill the entire qid structure we will have
@@ -1819,17 +1871,18 @@ static int v9fs_do_readdir(V9fsPDU *pdu,
         len = pdu_marshal(pdu, 11 + count, "Qqbs",
                           &qid, dent->d_off,
                           dent->d_type, &name);
+        v9fs_string_free(&name);
         if (len < 0) {
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_string_free(&name);
-            g_free(dent);
-            return len;
+            /*
+             * No need to rewind the directory, Treaddir carries the
+             * offset to continue from.
+             */
+            err = len;
+            break;
         }
         count += len;
-        v9fs_string_free(&name);
-        saved_dir_pos = dent->d_off;
     }
-    g_free(dent);
+    v9fs_free_dirents(entries);
     if (err < 0) {
         return err;
     }
@@ -1947,6 +2000,7 @@ static void v9fs_write(void *opaque)
     V9fsState *s = pdu->s;
     QEMUIOVector qiov_full;
     QEMUIOVector qiov;
+    QEMUIOVector *cur;
 
     err = pdu_unmarshal(pdu, offset, "dqd", &fid, &off, &count);
     if (err < 0) {
@@ -1977,16 +2031,16 @@ static void v9fs_write(void *opaque)
         err = -EINVAL;
         goto out;
     }
-    qemu_iovec_init(&qiov, qiov_full.niov);
+    /* Only used after a short write, allocated on demand */
+    qemu_iovec_init(&qiov, 0);
     do {
-        qemu_iovec_reset(&qiov);
-        qemu_iovec_concat(&qiov, &qiov_full, total, qiov_full.size - total);
+        cur = v9fs_qiov_remainder(&qiov_full, &qiov, total);
         if (0) {
-            print_sg(qiov.iov, qiov.niov);
+            print_sg(cur->iov, cur->niov);
         }
         /* Loop in case of EINTR */
         do {
-            len = v9fs_co_pwritev(pdu, fidp, qiov.iov, qiov.niov, off);
+            len = v9fs_co_pwritev(pdu, fidp, cur->iov, cur->niov, off);
             if (len >= 0) {
                 off   += len;
                 total += len;
@@ -3232,11 +3286,28 @@ static inline bool is_read_only_op(V9fsPDU *pdu)
     }
 }
 
+/* Requests that cannot change file attributes, see v9fs_fid_lstat() */
+static bool keeps_stat_cache(V9fsPDU *pdu)
+{
+    switch (pdu->id) {
+    case P9_TLOPEN:     /* O_TRUNC */
+    case P9_TOPEN:
+    case P9_TCLUNK:     /* xattr fids are written on clunk */
+        return false;
+    default:
+        return is_read_only_op(pdu);
+    }
+}
+
 static void submit_pdu(V9fsState *s, V9fsPDU *pdu)
 {
     Coroutine *co;
     CoroutineEntry *handler;
 
+    if (!keeps_stat_cache(pdu)) {
+        s->stat_gen++;
+    }
+
     if (pdu->id >= ARRAY_SIZE(pdu_co_handlers) ||
         (pdu_co_handlers[pdu->id] == NULL)) {
         handler = v9fs_op_not_supp;
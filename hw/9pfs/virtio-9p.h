@@ -201,8 +201,18 @@ struct V9fsFidState
     int clunked;
     V9fsFidState *next;
     V9fsFidState *rclm_lst;
+    /* lstat() cache, valid while st_cache_gen matches V9fsState.stat_gen */
+    struct stat st_cache;
+    uint64_t st_cache_gen;
+    int64_t st_cache_time;
 };
 
+/* Directory entries collected by one v9fs_co_readdir_many() call */
+typedef struct V9fsDirEnt {
+    struct dirent *dent;
+    struct V9fsDirEnt *next;
+} V9fsDirEnt;
+
 typedef struct V9fsState
 {
     VirtIODevice parent_obj;
@@ -225,6 +235,8 @@ typedef struct V9fsState
     int32_t root_fid;
     Error *migration_blocker;
     V9fsConf fsconf;
+    /* bumped whenever a request may modify the export */
+    uint64_t stat_gen;
 } V9fsState;
 
 typedef struct V9fsStatState {
@@ -407,6 +419,7 @@ extern int v9fs_name_to_path(V9fsState *s, V9fsPath *dirpath,
 
 #define DEFINE_VIRTIO_9P_PROPERTIES(_state, _field)             \
         DEFINE_PROP_STRING("mount_tag", _state, _field.tag),    \
-        DEFINE_PROP_STRING("fsdev", _state, _field.fsdev_id)
+        DEFINE_PROP_STRING("fsdev", _state, _field.fsdev_id),   \
+        DEFINE_PROP_UINT32("workers", _state, _field.workers, 0)
 
 #endif
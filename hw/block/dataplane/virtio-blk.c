@@ -24,15 +24,14 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qom/object_interfaces.h"
 
-struct VirtIOBlockDataPlane {
-    bool started;
-    bool starting;
-    bool stopping;
-    bool disabled;
-
-    VirtIOBlkConf *conf;
+typedef struct VirtIOBlockDataPlaneQueue {
+    VirtIOBlockDataPlane *s;
+    unsigned int index;
 
-    VirtIODevice *vdev;
+    /* Completions can be pushed from the home context while the queue's
+     * own context pops new requests, so all vring accesses take @lock.
+     */
+    QemuMutex lock;
     Vring vring;                    /* virtqueue vring */
     EventNotifier *guest_notifier;  /* irq */
     QEMUBH *bh;                     /* bh for guest notification */
@@ -42,10 +41,28 @@ struct VirtIOBlockDataPlane {
      * (because you don't own the file descriptor or handle; you just
      * use it).
      */
+    IOThread *iothread;             /* referenced only with "iothreads" */
+    AioContext *ctx;
+    bool attached;                  /* ctx added with blk_add_aio_queue() */
+    EventNotifier host_notifier;    /* doorbell */
+} VirtIOBlockDataPlaneQueue;
+
+struct VirtIOBlockDataPlane {
+    bool started;
+    bool starting;
+    bool stopping;
+    bool disabled;
+
+    VirtIOBlkConf *conf;
+
+    VirtIODevice *vdev;
+    unsigned int num_queues;
+    VirtIOBlockDataPlaneQueue *queues;
+
+    /* The BlockDriverState is bound to the AioContext of queue 0 */
     IOThread *iothread;
     IOThread internal_iothread_obj;
     AioContext *ctx;
-    EventNotifier host_notifier;    /* doorbell */
 
     /* Operation blocker on BDS */
     Error *blocker;
@@ -54,29 +71,36 @@ struct VirtIOBlockDataPlane {
 };
 
 /* Raise an interrupt to signal guest, if necessary */
-static void notify_guest(VirtIOBlockDataPlane *s)
+static void notify_guest(VirtIOBlockDataPlaneQueue *q)
 {
-    if (!vring_should_notify(s->vdev, &s->vring)) {
-        return;
-    }
+    bool notify;
+
+    qemu_mutex_lock(&q->lock);
+    notify = vring_should_notify(q->s->vdev, &q->vring);
+    qemu_mutex_unlock(&q->lock);
 
-    event_notifier_set(s->guest_notifier);
+    if (notify) {
+        event_notifier_set(q->guest_notifier);
+    }
 }
 
 static void notify_guest_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
+    VirtIOBlockDataPlaneQueue *q = opaque;
 
-    notify_guest(s);
+    notify_guest(q);
 }
 
 static void complete_request_vring(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlockDataPlane *s = req->dev->dataplane;
+    VirtIOBlockDataPlaneQueue *q = &s->queues[virtio_get_queue_index(req->vq)];
+
     stb_p(&req->in->status, status);
 
-    vring_push(&req->dev->dataplane->vring, &req->elem,
-               req->qiov.size + sizeof(*req->in));
+    qemu_mutex_lock(&q->lock);
+    vring_push(&q->vring, &req->elem, req->qiov.size + sizeof(*req->in));
+    qemu_mutex_unlock(&q->lock);
 
     /* Suppress notification to guest by BH and its scheduled
      * flag because requests are completed as a batch after io
@@ -84,30 +108,52 @@ static void complete_request_vring(VirtIOBlockReq *req, unsigned char status)
      * executed in dataplane aio context even after it is
      * stopped, so needn't worry about notification loss with BH.
      */
-    qemu_bh_schedule(s->bh);
+    qemu_bh_schedule(q->bh);
 }
 
-static void handle_notify(EventNotifier *e)
+static void process_queue(VirtIOBlockDataPlaneQueue *q)
 {
-    VirtIOBlockDataPlane *s = container_of(e, VirtIOBlockDataPlane,
-                                           host_notifier);
+    VirtIOBlockDataPlane *s = q->s;
     VirtIOBlock *vblk = VIRTIO_BLK(s->vdev);
+    BlockBackend *blk = s->conf->conf.blk;
+    VirtQueue *vq = virtio_get_queue(s->vdev, q->index);
+    AioContext *mq_ctx = NULL;
+    bool locked = false;
+
+    /* Queues running outside the home context submit reads and writes
+     * directly when the block layer allows it, and otherwise borrow the
+     * home context for the whole batch.
+     */
+    if (q->ctx != s->ctx) {
+        if (q->attached && blk_aio_mq_usable(blk)) {
+            mq_ctx = q->ctx;
+        } else {
+            aio_context_acquire(s->ctx);
+            locked = true;
+        }
+    }
 
-    event_notifier_test_and_clear(&s->host_notifier);
-    blk_io_plug(s->conf->conf.blk);
+    if (!mq_ctx) {
+        blk_io_plug(blk);
+    }
     for (;;) {
         MultiReqBuffer mrb = {
             .num_writes = 0,
         };
+        bool empty;
         int ret;
 
         /* Disable guest->host notifies to avoid unnecessary vmexits */
-        vring_disable_notification(s->vdev, &s->vring);
+        qemu_mutex_lock(&q->lock);
+        vring_disable_notification(s->vdev, &q->vring);
+        qemu_mutex_unlock(&q->lock);
 
         for (;;) {
-            VirtIOBlockReq *req = virtio_blk_alloc_request(vblk);
+            VirtIOBlockReq *req = virtio_blk_alloc_request(vblk, vq);
 
-            ret = vring_pop(s->vdev, &s->vring, &req->elem);
+            qemu_mutex_lock(&q->lock);
+            ret = vring_pop(s->vdev, &q->vring, &req->elem);
+            qemu_mutex_unlock(&q->lock);
             if (ret < 0) {
                 virtio_blk_free_request(req);
                 break; /* no more requests */
@@ -117,23 +163,99 @@ static void handle_notify(EventNotifier *e)
                                                         req->elem.in_num,
                                                         req->elem.index);
 
+            req->mq_ctx = mq_ctx;
             virtio_blk_handle_request(req, &mrb);
         }
 
-        virtio_submit_multiwrite(s->conf->conf.blk, &mrb);
+        virtio_submit_multiwrite(blk, &mrb);
 
         if (likely(ret == -EAGAIN)) { /* vring emptied */
             /* Re-enable guest->host notifies and stop processing the vring.
              * But if the guest has snuck in more descriptors, keep processing.
              */
-            if (vring_enable_notification(s->vdev, &s->vring)) {
+            qemu_mutex_lock(&q->lock);
+            empty = vring_enable_notification(s->vdev, &q->vring);
+            qemu_mutex_unlock(&q->lock);
+            if (empty) {
                 break;
             }
         } else { /* fatal error */
             break;
         }
     }
-    blk_io_unplug(s->conf->conf.blk);
+    if (!mq_ctx) {
+        blk_io_unplug(blk);
+    }
+    if (locked) {
+        aio_context_release(s->ctx);
+    }
+}
+
+static void handle_notify(EventNotifier *e)
+{
+    VirtIOBlockDataPlaneQueue *q = container_of(e, VirtIOBlockDataPlaneQueue,
+                                                host_notifier);
+
+    event_notifier_test_and_clear(&q->host_notifier);
+    process_queue(q);
+}
+
+/* Polling callback, picks up new requests without waiting for the guest's
+ * kick to arrive through the host notifier.
+ */
+static bool handle_notify_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    VirtIOBlockDataPlaneQueue *q = container_of(e, VirtIOBlockDataPlaneQueue,
+                                                host_notifier);
+    bool more;
+
+    qemu_mutex_lock(&q->lock);
+    more = vring_more_avail(&q->vring);
+    qemu_mutex_unlock(&q->lock);
+
+    if (!more) {
+        return false;
+    }
+    process_queue(q);
+    return true;
+}
+
+/* Context: QEMU global mutex held */
+static bool resolve_iothreads(VirtIOBlockDataPlane *s, VirtIOBlkConf *conf,
+                              Error **errp)
+{
+    gchar **ids = g_strsplit(conf->iothreads, ":", -1);
+    unsigned int n = g_strv_length(ids);
+    IOThread **iothreads;
+    unsigned int i;
+    bool ok = false;
+
+    if (n == 0) {
+        error_setg(errp, "iothreads property is empty");
+        goto out;
+    }
+
+    iothreads = g_new0(IOThread *, n);
+    for (i = 0; i < n; i++) {
+        iothreads[i] = iothread_find(ids[i]);
+        if (!iothreads[i]) {
+            error_setg(errp, "IOThread '%s' not found", ids[i]);
+            g_free(iothreads);
+            goto out;
+        }
+    }
+
+    /* Queues are spread round-robin over the listed IOThreads */
+    for (i = 0; i < s->num_queues; i++) {
+        s->queues[i].iothread = iothreads[i % n];
+        object_ref(OBJECT(s->queues[i].iothread));
+    }
+    g_free(iothreads);
+    ok = true;
+out:
+    g_strfreev(ids);
+    return ok;
 }
 
 /* Context: QEMU global mutex held */
@@ -145,10 +267,17 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     Error *local_err = NULL;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    bool mq = false;
+    unsigned int i;
 
     *dataplane = NULL;
 
-    if (!conf->data_plane && !conf->iothread) {
+    if (!conf->data_plane && !conf->iothread && !conf->iothreads) {
+        return;
+    }
+
+    if (conf->iothread && conf->iothreads) {
+        error_setg(errp, "iothread and iothreads are mutually exclusive");
         return;
     }
 
@@ -174,8 +303,18 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
-
-    if (conf->iothread) {
+    s->num_queues = conf->num_queues;
+    s->queues = g_new0(VirtIOBlockDataPlaneQueue, s->num_queues);
+
+    if (conf->iothreads) {
+        if (!resolve_iothreads(s, conf, errp)) {
+            g_free(s->queues);
+            g_free(s);
+            return;
+        }
+        s->iothread = s->queues[0].iothread;
+        object_ref(OBJECT(s->iothread));
+    } else if (conf->iothread) {
         s->iothread = conf->iothread;
         object_ref(OBJECT(s->iothread));
     } else {
@@ -190,17 +329,33 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
         s->iothread = &s->internal_iothread_obj;
     }
     s->ctx = iothread_get_aio_context(s->iothread);
-    s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
+
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockDataPlaneQueue *q = &s->queues[i];
+
+        q->s = s;
+        q->index = i;
+        q->ctx = q->iothread ? iothread_get_aio_context(q->iothread) : s->ctx;
+        q->bh = aio_bh_new(q->ctx, notify_guest_bh, q);
+        qemu_mutex_init(&q->lock);
+        mq |= q->ctx != s->ctx;
+    }
 
     error_setg(&s->blocker, "block device is in use by data plane");
     blk_op_block_all(conf->conf.blk, s->blocker);
     blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_RESIZE, s->blocker);
     blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_DRIVE_DEL, s->blocker);
-    blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_BACKUP_SOURCE, s->blocker);
-    blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_COMMIT, s->blocker);
-    blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_MIRROR, s->blocker);
-    blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_STREAM, s->blocker);
-    blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_REPLACE, s->blocker);
+    /* Writes from queue threads bypass dirty bitmaps, write notifiers
+     * and request serialisation, which block jobs rely on.
+     */
+    if (!mq) {
+        blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_BACKUP_SOURCE,
+                       s->blocker);
+        blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_COMMIT, s->blocker);
+        blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_MIRROR, s->blocker);
+        blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_STREAM, s->blocker);
+        blk_op_unblock(conf->conf.blk, BLOCK_OP_TYPE_REPLACE, s->blocker);
+    }
 
     *dataplane = s;
 }
@@ -208,6 +363,8 @@ void virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 /* Context: QEMU global mutex held */
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
+    unsigned int i;
+
     if (!s) {
         return;
     }
@@ -215,8 +372,17 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     virtio_blk_data_plane_stop(s);
     blk_op_unblock_all(s->conf->conf.blk, s->blocker);
     error_free(s->blocker);
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockDataPlaneQueue *q = &s->queues[i];
+
+        qemu_bh_delete(q->bh);
+        qemu_mutex_destroy(&q->lock);
+        if (q->iothread) {
+            object_unref(OBJECT(q->iothread));
+        }
+    }
     object_unref(OBJECT(s->iothread));
-    qemu_bh_delete(s->bh);
+    g_free(s->queues);
     g_free(s);
 }
 
@@ -226,7 +392,8 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     VirtIOBlock *vblk = VIRTIO_BLK(s->vdev);
-    VirtQueue *vq;
+    BlockBackend *blk = s->conf->conf.blk;
+    unsigned int i;
     int r;
 
     if (s->started || s->disabled) {
@@ -239,27 +406,33 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
 
     s->starting = true;
 
-    vq = virtio_get_queue(s->vdev, 0);
-    if (!vring_setup(&s->vring, s->vdev, 0)) {
-        goto fail_vring;
+    for (i = 0; i < s->num_queues; i++) {
+        if (!vring_setup(&s->queues[i].vring, s->vdev, i)) {
+            goto fail_vring;
+        }
     }
 
     /* Set up guest notifier (irq) */
-    r = k->set_guest_notifiers(qbus->parent, 1, true);
+    r = k->set_guest_notifiers(qbus->parent, s->num_queues, true);
     if (r != 0) {
         fprintf(stderr, "virtio-blk failed to set guest notifier (%d), "
                 "ensure -enable-kvm is set\n", r);
         goto fail_guest_notifiers;
     }
-    s->guest_notifier = virtio_queue_get_guest_notifier(vq);
 
     /* Set up virtqueue notify */
-    r = k->set_host_notifier(qbus->parent, 0, true);
-    if (r != 0) {
-        fprintf(stderr, "virtio-blk failed to set host notifier (%d)\n", r);
-        goto fail_host_notifier;
+    for (i = 0; i < s->num_queues; i++) {
+        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+
+        r = k->set_host_notifier(qbus->parent, i, true);
+        if (r != 0) {
+            fprintf(stderr, "virtio-blk failed to set host notifier (%d)\n",
+                    r);
+            goto fail_host_notifier;
+        }
+        s->queues[i].guest_notifier = virtio_queue_get_guest_notifier(vq);
+        s->queues[i].host_notifier = *virtio_queue_get_host_notifier(vq);
     }
-    s->host_notifier = *virtio_queue_get_host_notifier(vq);
 
     s->saved_complete_request = vblk->complete_request;
     vblk->complete_request = complete_request_vring;
@@ -268,23 +441,57 @@ void virtio_blk_data_plane_start(VirtIOBlockDataPlane *s)
     s->started = true;
     trace_virtio_blk_data_plane_start(s);
 
-    blk_set_aio_context(s->conf->conf.blk, s->ctx);
+    blk_set_aio_context(blk, s->ctx);
 
-    /* Kick right away to begin processing requests already in vring */
-    event_notifier_set(virtio_queue_get_host_notifier(vq));
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockDataPlaneQueue *q = &s->queues[i];
+        Error *local_err = NULL;
 
-    /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
-    aio_set_event_notifier(s->ctx, &s->host_notifier, handle_notify);
-    aio_context_release(s->ctx);
+        if (q->ctx == s->ctx) {
+            continue;
+        }
+
+        /* Lock order is queue context first, then home context */
+        aio_context_acquire(q->ctx);
+        aio_context_acquire(s->ctx);
+        q->attached = blk_add_aio_queue(blk, q->ctx, &local_err) == 0;
+        aio_context_release(s->ctx);
+        aio_context_release(q->ctx);
+        if (local_err) {
+            /* Not fatal, the queue submits through the home context */
+            error_report("virtio-blk queue %u: %s", i,
+                         error_get_pretty(local_err));
+            error_free(local_err);
+        }
+    }
+
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockDataPlaneQueue *q = &s->queues[i];
+
+        /* Kick right away to begin processing requests already in vring */
+        event_notifier_set(&q->host_notifier);
+
+        /* Get this show started by hooking up our callbacks */
+        aio_context_acquire(q->ctx);
+        aio_set_event_notifier(q->ctx, &q->host_notifier, handle_notify);
+        aio_set_event_notifier_poll(q->ctx, &q->host_notifier,
+                                    handle_notify_poll);
+        aio_context_release(q->ctx);
+    }
     return;
 
   fail_host_notifier:
-    k->set_guest_notifiers(qbus->parent, 1, false);
+    while (i-- > 0) {
+        k->set_host_notifier(qbus->parent, i, false);
+    }
+    k->set_guest_notifiers(qbus->parent, s->num_queues, false);
   fail_guest_notifiers:
-    vring_teardown(&s->vring, s->vdev, 0);
     s->disabled = true;
+    i = s->num_queues;
   fail_vring:
+    while (i-- > 0) {
+        vring_teardown(&s->queues[i].vring, s->vdev, i);
+    }
     s->starting = false;
 }
 
@@ -294,6 +501,8 @@ void virtio_blk_data_plane_stop(VirtIOBlockDataPlane *s)
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s->vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     VirtIOBlock *vblk = VIRTIO_BLK(s->vdev);
+    BlockBackend *blk = s->conf->conf.blk;
+    unsigned int i;
 
 
     /* Better luck next time. */
@@ -308,25 +517,44 @@ void virtio_blk_data_plane_stop(VirtIOBlockDataPlane *s)
     vblk->complete_request = s->saved_complete_request;
     trace_virtio_blk_data_plane_stop(s);
 
-    aio_context_acquire(s->ctx);
-
     /* Stop notifications for new requests from guest */
-    aio_set_event_notifier(s->ctx, &s->host_notifier, NULL);
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockDataPlaneQueue *q = &s->queues[i];
+
+        aio_context_acquire(q->ctx);
+        aio_set_event_notifier(q->ctx, &q->host_notifier, NULL);
+        aio_context_release(q->ctx);
+    }
+
+    aio_context_acquire(s->ctx);
 
     /* Drain and switch bs back to the QEMU main loop */
-    blk_set_aio_context(s->conf->conf.blk, qemu_get_aio_context());
+    blk_set_aio_context(blk, qemu_get_aio_context());
 
     aio_context_release(s->ctx);
 
+    /* Nothing is in flight any more, so the extra queues can go */
+    for (i = 0; i < s->num_queues; i++) {
+        VirtIOBlockDataPlaneQueue *q = &s->queues[i];
+
+        if (q->attached) {
+            aio_context_acquire(q->ctx);
+            blk_del_aio_queue(blk, q->ctx);
+            aio_context_release(q->ctx);
+            q->attached = false;
+        }
+    }
+
     /* Sync vring state back to virtqueue so that non-dataplane request
      * processing can continue when we disable the host notifier below.
      */
-    vring_teardown(&s->vring, s->vdev, 0);
-
-    k->set_host_notifier(qbus->parent, 0, false);
+    for (i = 0; i < s->num_queues; i++) {
+        vring_teardown(&s->queues[i].vring, s->vdev, i);
+        k->set_host_notifier(qbus->parent, i, false);
+    }
 
     /* Clean up guest notifier (irq) */
-    k->set_guest_notifiers(qbus->parent, 1, false);
+    k->set_guest_notifiers(qbus->parent, s->num_queues, false);
 
     s->started = false;
     s->stopping = false;
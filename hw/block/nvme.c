@@ -18,6 +18,13 @@
  * Usage: add options:
  *      -drive file=<file>,if=none,id=<drive_id>
  *      -device nvme,drive=<drive_id>,serial=<serial>,id=<id[optional]>
+ *
+ * Further drives can be exported as namespaces 2, 3, ... with:
+ *      -device nvme,...,drives=<drive_id2>:<drive_id3>
+ *
+ * To run the I/O queues in an IOThread, add:
+ *      -object iothread,id=<iothread_id>
+ *      -device nvme,...,iothread=<iothread_id>
  */
 
 #include <hw/block/block.h>
@@ -25,12 +32,16 @@
 #include <hw/pci/msix.h>
 #include <hw/pci/pci.h>
 #include "sysemu/sysemu.h"
+#include "sysemu/kvm.h"
+#include "sysemu/iothread.h"
 #include "qapi/visitor.h"
+#include "qemu/error-report.h"
 #include "sysemu/block-backend.h"
 
 #include "nvme.h"
 
 static void nvme_process_sq(void *opaque);
+static void nvme_process_admin_sq(void *opaque);
 
 static int nvme_check_sqid(NvmeCtrl *n, uint16_t sqid)
 {
@@ -66,7 +77,7 @@ static uint8_t nvme_sq_empty(NvmeSQueue *sq)
     return sq->head == sq->tail;
 }
 
-static void nvme_isr_notify(NvmeCtrl *n, NvmeCQueue *cq)
+static void nvme_raise_irq(NvmeCtrl *n, NvmeCQueue *cq)
 {
     if (cq->irq_enabled) {
         if (msix_enabled(&(n->parent_obj))) {
@@ -77,6 +88,70 @@ static void nvme_isr_notify(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+static void nvme_irq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, irq_notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        nvme_raise_irq(cq->ctrl, cq);
+    }
+}
+
+static void nvme_isr_notify(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    /* I/O completion queues are posted from the IOThread, which must not
+     * touch the interrupt state itself; let the main loop do it. */
+    if (n->iothread && cq->cqid) {
+        event_notifier_set(&cq->irq_notifier);
+    } else {
+        nvme_raise_irq(n, cq);
+    }
+}
+
+/*
+ * Shadow doorbells (Doorbell Buffer Config): the guest stores the SQ tail
+ * and CQ head doorbell values in memory, and only writes the MMIO doorbell
+ * when the new value crosses the event index we published for that queue.
+ */
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t tail;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &tail, sizeof(tail));
+    tail = le32_to_cpu(tail);
+    if (tail < sq->size) {
+        sq->tail = tail;
+    }
+}
+
+static void nvme_update_sq_eventidx(NvmeSQueue *sq)
+{
+    uint32_t ei = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &ei, sizeof(ei));
+    /* Order the event index write against the next read of the tail */
+    smp_mb();
+}
+
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    uint32_t head;
+
+    pci_dma_read(&cq->ctrl->parent_obj, cq->db_addr, &head, sizeof(head));
+    head = le32_to_cpu(head);
+    if (head < cq->size) {
+        cq->head = head;
+    }
+}
+
+static void nvme_update_cq_eventidx(NvmeCQueue *cq)
+{
+    uint32_t ei = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &ei, sizeof(ei));
+    smp_mb();
+}
+
 static uint16_t nvme_map_prp(QEMUSGList *qsg, uint64_t prp1, uint64_t prp2,
     uint32_t len, NvmeCtrl *n)
 {
@@ -157,6 +232,130 @@ static uint16_t nvme_dma_read_prp(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
     return NVME_SUCCESS;
 }
 
+/* Number of descriptors in the largest SGL segment we accept */
+#define NVME_SGL_SEGMENT_MAX    256
+
+static uint16_t nvme_map_sgl(QEMUSGList *qsg, NvmeSglDescriptor *sgl,
+    uint32_t len, NvmeCtrl *n)
+{
+    NvmeSglDescriptor segment[NVME_SGL_SEGMENT_MAX];
+    NvmeSglDescriptor desc = *sgl;
+    bool last = false;
+
+    pci_dma_sglist_init(qsg, &n->parent_obj, 1);
+
+    while (len) {
+        uint32_t seg_len, nsgld, i;
+        uint32_t mapped = 0;
+
+        switch (NVME_SGL_TYPE(desc.type)) {
+        case NVME_SGL_DESCR_TYPE_DATA_BLOCK:
+            /* A single data block directly in the command */
+            if (le32_to_cpu(desc.len) < len) {
+                goto unmap;
+            }
+            qemu_sglist_add(qsg, le64_to_cpu(desc.addr), len);
+            return NVME_SUCCESS;
+        case NVME_SGL_DESCR_TYPE_SEGMENT:
+        case NVME_SGL_DESCR_TYPE_LAST_SEGMENT:
+            break;
+        default:
+            goto unmap;
+        }
+
+        if (last) {
+            goto unmap;
+        }
+        last = NVME_SGL_TYPE(desc.type) == NVME_SGL_DESCR_TYPE_LAST_SEGMENT;
+
+        seg_len = le32_to_cpu(desc.len);
+        if (!seg_len || seg_len % sizeof(NvmeSglDescriptor) ||
+            seg_len > sizeof(segment)) {
+            goto unmap;
+        }
+        nsgld = seg_len / sizeof(NvmeSglDescriptor);
+        pci_dma_read(&n->parent_obj, le64_to_cpu(desc.addr), segment,
+                     seg_len);
+
+        for (i = 0; i < nsgld && len; i++) {
+            uint8_t type = NVME_SGL_TYPE(segment[i].type);
+            uint32_t trans_len;
+
+            if (type == NVME_SGL_DESCR_TYPE_SEGMENT ||
+                type == NVME_SGL_DESCR_TYPE_LAST_SEGMENT) {
+                /* Only the last descriptor may point to the next segment */
+                if (i != nsgld - 1) {
+                    goto unmap;
+                }
+                break;
+            }
+            if (type != NVME_SGL_DESCR_TYPE_DATA_BLOCK) {
+                goto unmap;
+            }
+
+            trans_len = MIN(len, le32_to_cpu(segment[i].len));
+            if (trans_len) {
+                qemu_sglist_add(qsg, le64_to_cpu(segment[i].addr), trans_len);
+                len -= trans_len;
+                mapped += trans_len;
+            }
+        }
+
+        if (!len) {
+            break;
+        }
+        /* Either the SGL ended early or a segment made no progress */
+        if (i == nsgld || !mapped) {
+            goto unmap;
+        }
+        desc = segment[i];
+    }
+    return NVME_SUCCESS;
+
+ unmap:
+    qemu_sglist_destroy(qsg);
+    return NVME_INVALID_FIELD | NVME_DNR;
+}
+
+/* Maps the data pointer of an I/O command, which holds either PRPs or an
+ * SGL descriptor */
+static uint16_t nvme_map(NvmeCtrl *n, NvmeCmd *cmd, QEMUSGList *qsg,
+    uint32_t len)
+{
+    NvmeSglDescriptor sgl;
+
+    switch (NVME_CMD_FLAGS_PSDT(cmd->fuse)) {
+    case NVME_PSDT_PRP:
+        return nvme_map_prp(qsg, le64_to_cpu(cmd->prp1),
+                            le64_to_cpu(cmd->prp2), len, n);
+    case NVME_PSDT_SGL_MPTR_CONTIG:
+    case NVME_PSDT_SGL_MPTR_SGL:
+        /* The SGL descriptor takes the place of PRP1 and PRP2 */
+        QEMU_BUILD_BUG_ON(offsetof(NvmeCmd, prp2) !=
+                          offsetof(NvmeCmd, prp1) + sizeof(uint64_t));
+        memcpy(&sgl, &cmd->prp1, sizeof(sgl));
+        return nvme_map_sgl(qsg, &sgl, len, n);
+    default:
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+}
+
+static uint16_t nvme_dma_write(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
+    NvmeCmd *cmd)
+{
+    QEMUSGList qsg;
+    uint16_t status = NVME_SUCCESS;
+
+    if (nvme_map(n, cmd, &qsg, len)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+    if (dma_buf_write(ptr, len, &qsg)) {
+        status = NVME_INVALID_FIELD | NVME_DNR;
+    }
+    qemu_sglist_destroy(&qsg);
+    return status;
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
@@ -167,6 +366,10 @@ static void nvme_post_cqes(void *opaque)
         NvmeSQueue *sq;
         hwaddr addr;
 
+        if (cq->db_addr) {
+            nvme_update_cq_eventidx(cq);
+            nvme_update_cq_head(cq);
+        }
         if (nvme_cq_full(cq)) {
             break;
         }
@@ -180,6 +383,11 @@ static void nvme_post_cqes(void *opaque)
         nvme_inc_cq_tail(cq);
         pci_dma_write(&n->parent_obj, addr, (void *)&req->cqe,
             sizeof(req->cqe));
+        if (QTAILQ_EMPTY(&sq->req_list)) {
+            /* The SQ stopped for lack of requests; with shadow doorbells
+             * the guest will not necessarily ring it again. */
+            timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        }
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
     }
     nvme_isr_notify(n, cq);
@@ -200,25 +408,141 @@ static void nvme_rw_cb(void *opaque, int ret)
     NvmeCtrl *n = sq->ctrl;
     NvmeCQueue *cq = n->cq[sq->cqid];
 
-    block_acct_done(blk_get_stats(n->conf.blk), &req->acct);
+    block_acct_done(blk_get_stats(req->ns->blk), &req->acct);
     if (!ret) {
         req->status = NVME_SUCCESS;
     } else {
         req->status = NVME_INTERNAL_DEV_ERROR;
     }
 
-    qemu_sglist_destroy(&req->qsg);
+    if (req->has_sg) {
+        qemu_sglist_destroy(&req->qsg);
+    }
     nvme_enqueue_req_completion(cq, req);
 }
 
+/* Largest discard we issue at once, so that it fits in an int */
+#define NVME_DSM_MAX_SECTORS    (1 << 22)
+
+static void nvme_dsm_cb(void *opaque, int ret)
+{
+    NvmeRequest *req = opaque;
+    NvmeSQueue *sq = req->sq;
+    NvmeCtrl *n = sq->ctrl;
+    NvmeNamespace *ns = req->ns;
+    uint8_t lba_index  = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
+
+    if (ret) {
+        req->status = NVME_INTERNAL_DEV_ERROR;
+        goto done;
+    }
+
+    while (!req->dsm_nb_sectors && req->dsm_idx < req->dsm_nr) {
+        NvmeDsmRange *range = &req->dsm_ranges[req->dsm_idx++];
+
+        req->dsm_sector = le64_to_cpu(range->slba) <<
+                          (data_shift - BDRV_SECTOR_BITS);
+        req->dsm_nb_sectors = (uint64_t)le32_to_cpu(range->nlb) <<
+                              (data_shift - BDRV_SECTOR_BITS);
+    }
+
+    if (req->dsm_nb_sectors) {
+        int nb_sectors = MIN(req->dsm_nb_sectors, NVME_DSM_MAX_SECTORS);
+        int64_t sector = req->dsm_sector;
+
+        req->dsm_sector += nb_sectors;
+        req->dsm_nb_sectors -= nb_sectors;
+        req->aiocb = blk_aio_discard(ns->blk, sector, nb_sectors,
+                                     nvme_dsm_cb, req);
+        return;
+    }
+    req->status = NVME_SUCCESS;
+
+done:
+    g_free(req->dsm_ranges);
+    req->dsm_ranges = NULL;
+    nvme_enqueue_req_completion(n->cq[sq->cqid], req);
+}
+
+static uint16_t nvme_dsm(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
+    NvmeRequest *req)
+{
+    NvmeDsmCmd *dsm = (NvmeDsmCmd *)cmd;
+    uint32_t nr = (le32_to_cpu(dsm->nr) & 0xff) + 1;
+    uint32_t attributes = le32_to_cpu(dsm->attributes);
+    uint64_t nsze = le64_to_cpu(ns->id_ns.nsze);
+    uint16_t status;
+    int i;
+
+    /* Integral dataset hints carry no obligation; only deallocate matters */
+    if (!(attributes & NVME_DSMGMT_AD)) {
+        return NVME_SUCCESS;
+    }
+
+    req->dsm_ranges = g_new(NvmeDsmRange, nr);
+    status = nvme_dma_write(n, (uint8_t *)req->dsm_ranges,
+                            nr * sizeof(NvmeDsmRange), cmd);
+    if (status) {
+        goto fail;
+    }
+    for (i = 0; i < nr; i++) {
+        uint64_t slba = le64_to_cpu(req->dsm_ranges[i].slba);
+        uint32_t nlb = le32_to_cpu(req->dsm_ranges[i].nlb);
+
+        if (slba + nlb > nsze || slba + nlb < slba) {
+            status = NVME_LBA_RANGE | NVME_DNR;
+            goto fail;
+        }
+    }
+
+    req->dsm_nr = nr;
+    req->dsm_idx = 0;
+    req->dsm_nb_sectors = 0;
+    nvme_dsm_cb(req, 0);
+    return NVME_NO_COMPLETE;
+
+fail:
+    g_free(req->dsm_ranges);
+    req->dsm_ranges = NULL;
+    return status;
+}
+
+static uint16_t nvme_write_zeroes(NvmeCtrl *n, NvmeNamespace *ns,
+    NvmeCmd *cmd, NvmeRequest *req)
+{
+    NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
+    uint32_t nlb  = le16_to_cpu(rw->nlb) + 1;
+    uint64_t slba = le64_to_cpu(rw->slba);
+    uint16_t control = le16_to_cpu(rw->control);
+
+    uint8_t lba_index  = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
+    uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
+    uint64_t aio_slba  = slba << (data_shift - BDRV_SECTOR_BITS);
+    uint32_t aio_nlb   = nlb << (data_shift - BDRV_SECTOR_BITS);
+    BdrvRequestFlags flags = 0;
+
+    if ((slba + nlb) > le64_to_cpu(ns->id_ns.nsze)) {
+        return NVME_LBA_RANGE | NVME_DNR;
+    }
+    if (control & NVME_RW_DEAC) {
+        flags |= BDRV_REQ_MAY_UNMAP;
+    }
+
+    block_acct_start(blk_get_stats(ns->blk), &req->acct,
+                     (uint64_t)nlb << data_shift, BLOCK_ACCT_WRITE);
+    req->aiocb = blk_aio_write_zeroes(ns->blk, aio_slba, aio_nlb, flags,
+                                      nvme_rw_cb, req);
+
+    return NVME_NO_COMPLETE;
+}
+
 static uint16_t nvme_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     NvmeRequest *req)
 {
     NvmeRwCmd *rw = (NvmeRwCmd *)cmd;
     uint32_t nlb  = le32_to_cpu(rw->nlb) + 1;
     uint64_t slba = le64_to_cpu(rw->slba);
-    uint64_t prp1 = le64_to_cpu(rw->prp1);
-    uint64_t prp2 = le64_to_cpu(rw->prp2);
 
     uint8_t lba_index  = NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas);
     uint8_t data_shift = ns->id_ns.lbaf[lba_index].ds;
@@ -229,16 +553,17 @@ static uint16_t nvme_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     if ((slba + nlb) > ns->id_ns.nsze) {
         return NVME_LBA_RANGE | NVME_DNR;
     }
-    if (nvme_map_prp(&req->qsg, prp1, prp2, data_size, n)) {
+    if (nvme_map(n, cmd, &req->qsg, data_size)) {
         return NVME_INVALID_FIELD | NVME_DNR;
     }
     assert((nlb << data_shift) == req->qsg.size);
+    req->has_sg = true;
 
-    dma_acct_start(n->conf.blk, &req->acct, &req->qsg,
+    dma_acct_start(ns->blk, &req->acct, &req->qsg,
                    is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
     req->aiocb = is_write ?
-        dma_blk_write(n->conf.blk, &req->qsg, aio_slba, nvme_rw_cb, req) :
-        dma_blk_read(n->conf.blk, &req->qsg, aio_slba, nvme_rw_cb, req);
+        dma_blk_write(ns->blk, &req->qsg, aio_slba, nvme_rw_cb, req) :
+        dma_blk_read(ns->blk, &req->qsg, aio_slba, nvme_rw_cb, req);
 
     return NVME_NO_COMPLETE;
 }
@@ -253,20 +578,62 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     }
 
     ns = &n->namespaces[nsid - 1];
+    req->ns = ns;
+    req->has_sg = false;
     switch (cmd->opcode) {
     case NVME_CMD_FLUSH:
         return NVME_SUCCESS;
     case NVME_CMD_WRITE:
     case NVME_CMD_READ:
         return nvme_rw(n, ns, cmd, req);
+    case NVME_CMD_WRITE_ZEROS:
+        return nvme_write_zeroes(n, ns, cmd, req);
+    case NVME_CMD_DSM:
+        return nvme_dsm(n, ns, cmd, req);
     default:
         return NVME_INVALID_OPCODE | NVME_DNR;
     }
 }
 
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    event_notifier_test_and_clear(e);
+    nvme_process_sq(sq);
+}
+
+/* With shadow doorbells the doorbell value need not be seen by the MMIO
+ * handler, so the doorbell write can be turned into an ioeventfd. */
+static void nvme_init_sq_ioeventfd(NvmeSQueue *sq, NvmeCtrl *n)
+{
+    if (sq->ioeventfd_enabled || !kvm_eventfds_enabled() ||
+        event_notifier_init(&sq->notifier, 0)) {
+        return;
+    }
+    memory_region_add_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                              false, 0, &sq->notifier);
+    aio_set_event_notifier(n->ctx, &sq->notifier, nvme_sq_notifier);
+    sq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_sq_dbbuf(NvmeSQueue *sq, NvmeCtrl *n)
+{
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+    nvme_init_sq_ioeventfd(sq, n);
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                  false, 0, &sq->notifier);
+        aio_set_event_notifier(n->ctx, &sq->notifier, NULL);
+        event_notifier_cleanup(&sq->notifier);
+        sq->ioeventfd_enabled = false;
+    }
     timer_del(sq->timer);
     timer_free(sq->timer);
     g_free(sq->io_req);
@@ -330,12 +697,22 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    if (sqid) {
+        sq->timer = aio_timer_new(n->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                  nvme_process_sq, sq);
+    } else {
+        sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_admin_sq,
+                                 sq);
+    }
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
+
+    if (sqid && n->dbbuf_enabled) {
+        nvme_init_sq_dbbuf(sq, n);
+    }
 }
 
 static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -369,9 +746,58 @@ static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
     return NVME_SUCCESS;
 }
 
+static void nvme_cq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, notifier);
+    NvmeSQueue *sq;
+    int start_sqs;
+
+    event_notifier_test_and_clear(e);
+
+    start_sqs = nvme_cq_full(cq) ? 1 : 0;
+    nvme_update_cq_head(cq);
+    if (start_sqs) {
+        QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+            nvme_process_sq(sq);
+        }
+    }
+    nvme_post_cqes(cq);
+}
+
+static void nvme_init_cq_ioeventfd(NvmeCQueue *cq, NvmeCtrl *n)
+{
+    if (cq->ioeventfd_enabled || !kvm_eventfds_enabled() ||
+        event_notifier_init(&cq->notifier, 0)) {
+        return;
+    }
+    memory_region_add_eventfd(&n->iomem, 0x1000 + (cq->cqid << 3) + (1 << 2),
+                              4, false, 0, &cq->notifier);
+    aio_set_event_notifier(n->ctx, &cq->notifier, nvme_cq_notifier);
+    cq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_cq_dbbuf(NvmeCQueue *cq, NvmeCtrl *n)
+{
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+    nvme_init_cq_ioeventfd(cq, n);
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
+    if (cq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem,
+                                  0x1000 + (cq->cqid << 3) + (1 << 2), 4,
+                                  false, 0, &cq->notifier);
+        aio_set_event_notifier(n->ctx, &cq->notifier, NULL);
+        event_notifier_cleanup(&cq->notifier);
+        cq->ioeventfd_enabled = false;
+    }
+    if (n->iothread && cq->cqid) {
+        event_notifier_set_handler(&cq->irq_notifier, NULL);
+        event_notifier_cleanup(&cq->irq_notifier);
+    }
     timer_del(cq->timer);
     timer_free(cq->timer);
     msix_vector_unuse(&n->parent_obj, cq->vector);
@@ -413,7 +839,19 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->sq_list);
     msix_vector_use(&n->parent_obj, cq->vector);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    if (cqid) {
+        cq->timer = aio_timer_new(n->ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                  nvme_post_cqes, cq);
+    } else {
+        cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    }
+
+    if (cqid && n->iothread) {
+        event_notifier_set_handler(&cq->irq_notifier, nvme_irq_notifier);
+    }
+    if (cqid && n->dbbuf_enabled) {
+        nvme_init_cq_dbbuf(cq, n);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -443,6 +881,10 @@ static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
     }
 
     cq = g_malloc0(sizeof(*cq));
+    if (n->iothread && event_notifier_init(&cq->irq_notifier, 0)) {
+        g_free(cq);
+        return NVME_INTERNAL_DEV_ERROR;
+    }
     nvme_init_cq(cq, n, prp1, cqid, vector, qsize + 1,
         NVME_CQ_FLAGS_IEN(qflags));
     return NVME_SUCCESS;
@@ -498,6 +940,33 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, NvmeCmd *cmd)
+{
+    uint64_t dbs_addr = le64_to_cpu(cmd->prp1);
+    uint64_t eis_addr = le64_to_cpu(cmd->prp2);
+    int i;
+
+    if (!dbs_addr || dbs_addr & (n->page_size - 1) ||
+        !eis_addr || eis_addr & (n->page_size - 1)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    /* The admin queue keeps using the MMIO doorbells */
+    for (i = 1; i < n->num_queues; i++) {
+        if (n->sq[i]) {
+            nvme_init_sq_dbbuf(n->sq[i], n);
+        }
+        if (n->cq[i]) {
+            nvme_init_cq_dbbuf(n->cq[i], n);
+        }
+    }
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
     switch (cmd->opcode) {
@@ -515,6 +984,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         return nvme_set_feature(n, cmd, req);
     case NVME_ADM_CMD_GET_FEATURES:
         return nvme_get_feature(n, cmd, req);
+    case NVME_ADM_CMD_DB_BUFFER_CFG:
+        return nvme_dbbuf_config(n, cmd);
     default:
         return NVME_INVALID_OPCODE | NVME_DNR;
     }
@@ -531,6 +1002,10 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
+
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         pci_dma_read(&n->parent_obj, addr, (void *)&cmd, sizeof(cmd));
@@ -548,9 +1023,26 @@ static void nvme_process_sq(void *opaque)
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
+
+        if (sq->db_addr) {
+            nvme_update_sq_eventidx(sq);
+            nvme_update_sq_tail(sq);
+        }
     }
 }
 
+static void nvme_process_admin_sq(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+    AioContext *ctx = sq->ctrl->ctx;
+
+    /* Admin commands create and delete the I/O queues, which belong to
+     * the IOThread's AioContext */
+    aio_context_acquire(ctx);
+    nvme_process_sq(sq);
+    aio_context_release(ctx);
+}
+
 static void nvme_clear_ctrl(NvmeCtrl *n)
 {
     int i;
@@ -566,8 +1058,12 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
         }
     }
 
-    blk_flush(n->conf.blk);
+    for (i = 0; i < n->num_namespaces; i++) {
+        blk_flush(n->namespaces[i].blk);
+    }
     n->bar.cc = 0;
+    n->dbbuf_dbs = n->dbbuf_eis = 0;
+    n->dbbuf_enabled = false;
 }
 
 static int nvme_start_ctrl(NvmeCtrl *n)
@@ -724,11 +1220,14 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
     unsigned size)
 {
     NvmeCtrl *n = (NvmeCtrl *)opaque;
+
+    aio_context_acquire(n->ctx);
     if (addr < sizeof(n->bar)) {
         nvme_write_bar(n, addr, data, size);
     } else if (addr >= 0x1000) {
         nvme_process_db(n, addr, data);
     }
+    aio_context_release(n->ctx);
 }
 
 static const MemoryRegionOps nvme_mmio_ops = {
@@ -741,41 +1240,117 @@ static const MemoryRegionOps nvme_mmio_ops = {
     },
 };
 
+static void nvme_free_namespaces(NvmeCtrl *n)
+{
+    int i;
+
+    /* Namespace 1 is the "drive" property, which qdev detaches itself */
+    for (i = 1; i < n->num_namespaces; i++) {
+        if (n->namespaces[i].blk) {
+            blk_detach_dev(n->namespaces[i].blk, DEVICE(n));
+        }
+    }
+    g_free(n->namespaces);
+    n->namespaces = NULL;
+}
+
+/* Namespace 1 is backed by the "drive" property, the following ones by the
+ * colon separated list of drive IDs in the "drives" property. */
+static int nvme_init_namespaces(NvmeCtrl *n)
+{
+    gchar **ids = n->drives ? g_strsplit(n->drives, ":", -1) : NULL;
+    int nr_ids = ids ? g_strv_length(ids) : 0;
+    int i;
+
+    n->num_namespaces = 1 + nr_ids;
+    n->namespaces = g_new0(NvmeNamespace, n->num_namespaces);
+    n->namespaces[0].blk = n->conf.blk;
+
+    for (i = 0; i < nr_ids; i++) {
+        BlockBackend *blk = blk_by_name(ids[i]);
+
+        if (!blk) {
+            error_report("nvme: drive '%s' not found", ids[i]);
+            goto fail;
+        }
+        if (blk_attach_dev(blk, DEVICE(n)) < 0) {
+            error_report("nvme: drive '%s' is already in use", ids[i]);
+            goto fail;
+        }
+        n->namespaces[i + 1].blk = blk;
+    }
+
+    for (i = 0; i < n->num_namespaces; i++) {
+        NvmeNamespace *ns = &n->namespaces[i];
+        NvmeIdNs *id_ns = &ns->id_ns;
+        int64_t bs_size = blk_getlength(ns->blk);
+
+        if (bs_size < 0) {
+            goto fail;
+        }
+
+        id_ns->nsfeat = 0;
+        id_ns->nlbaf = 0;
+        id_ns->flbas = 0;
+        id_ns->mc = 0;
+        id_ns->dpc = 0;
+        id_ns->dps = 0;
+        id_ns->lbaf[0].ds = BDRV_SECTOR_BITS;
+        id_ns->ncap  = id_ns->nuse = id_ns->nsze =
+            cpu_to_le64(bs_size >>
+                id_ns->lbaf[NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas)].ds);
+    }
+
+    g_strfreev(ids);
+    return 0;
+
+fail:
+    nvme_free_namespaces(n);
+    g_strfreev(ids);
+    return -1;
+}
+
 static int nvme_init(PCIDevice *pci_dev)
 {
     NvmeCtrl *n = NVME(pci_dev);
     NvmeIdCtrl *id = &n->id_ctrl;
 
     int i;
-    int64_t bs_size;
     uint8_t *pci_conf;
 
     if (!n->conf.blk) {
         return -1;
     }
 
-    bs_size = blk_getlength(n->conf.blk);
-    if (bs_size < 0) {
+    blkconf_serial(&n->conf, &n->serial);
+    if (!n->serial) {
         return -1;
     }
 
-    blkconf_serial(&n->conf, &n->serial);
-    if (!n->serial) {
+    if (nvme_init_namespaces(n) < 0) {
         return -1;
     }
 
+    if (n->iothread) {
+        n->ctx = iothread_get_aio_context(n->iothread);
+        aio_context_acquire(n->ctx);
+        for (i = 0; i < n->num_namespaces; i++) {
+            blk_set_aio_context(n->namespaces[i].blk, n->ctx);
+        }
+        aio_context_release(n->ctx);
+    } else {
+        n->ctx = qemu_get_aio_context();
+    }
+
     pci_conf = pci_dev->config;
     pci_conf[PCI_INTERRUPT_PIN] = 1;
     pci_config_set_prog_interface(pci_dev->config, 0x2);
     pci_config_set_class(pci_dev->config, PCI_CLASS_STORAGE_EXPRESS);
     pcie_endpoint_cap_init(&n->parent_obj, 0x80);
 
-    n->num_namespaces = 1;
     n->num_queues = 64;
     n->reg_size = 1 << qemu_fls(0x1004 + 2 * (n->num_queues + 1) * 4);
-    n->ns_size = bs_size / (uint64_t)n->num_namespaces;
 
-    n->namespaces = g_new0(NvmeNamespace, n->num_namespaces);
     n->sq = g_new0(NvmeSQueue *, n->num_queues);
     n->cq = g_new0(NvmeCQueue *, n->num_queues);
 
@@ -785,6 +1360,7 @@ static int nvme_init(PCIDevice *pci_dev)
         PCI_BASE_ADDRESS_SPACE_MEMORY | PCI_BASE_ADDRESS_MEM_TYPE_64,
         &n->iomem);
     msix_init_exclusive_bar(&n->parent_obj, n->num_queues, 4);
+    msix_enable_irqfds(&n->parent_obj);
 
     id->vid = cpu_to_le16(pci_get_word(pci_conf + PCI_VENDOR_ID));
     id->ssvid = cpu_to_le16(pci_get_word(pci_conf + PCI_SUBSYSTEM_VENDOR_ID));
@@ -795,12 +1371,14 @@ static int nvme_init(PCIDevice *pci_dev)
     id->ieee[0] = 0x00;
     id->ieee[1] = 0x02;
     id->ieee[2] = 0xb3;
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
     id->frmw = 7 << 1;
     id->lpa = 1 << 0;
     id->sqes = (0x6 << 4) | 0x6;
     id->cqes = (0x4 << 4) | 0x4;
     id->nn = cpu_to_le32(n->num_namespaces);
+    id->oncs = cpu_to_le16(NVME_ONCS_DSM | NVME_ONCS_WRITE_ZEROS);
+    id->sgls = cpu_to_le32(1);
     id->psd[0].mp = cpu_to_le16(0x9c4);
     id->psd[0].enlat = cpu_to_le32(0x10);
     id->psd[0].exlat = cpu_to_le32(0x4);
@@ -815,29 +1393,23 @@ static int nvme_init(PCIDevice *pci_dev)
     n->bar.vs = 0x00010001;
     n->bar.intmc = n->bar.intms = 0;
 
-    for (i = 0; i < n->num_namespaces; i++) {
-        NvmeNamespace *ns = &n->namespaces[i];
-        NvmeIdNs *id_ns = &ns->id_ns;
-        id_ns->nsfeat = 0;
-        id_ns->nlbaf = 0;
-        id_ns->flbas = 0;
-        id_ns->mc = 0;
-        id_ns->dpc = 0;
-        id_ns->dps = 0;
-        id_ns->lbaf[0].ds = BDRV_SECTOR_BITS;
-        id_ns->ncap  = id_ns->nuse = id_ns->nsze =
-            cpu_to_le64(n->ns_size >>
-                id_ns->lbaf[NVME_ID_NS_FLBAS_INDEX(ns->id_ns.flbas)].ds);
-    }
     return 0;
 }
 
 static void nvme_exit(PCIDevice *pci_dev)
 {
     NvmeCtrl *n = NVME(pci_dev);
+    int i;
 
+    aio_context_acquire(n->ctx);
     nvme_clear_ctrl(n);
-    g_free(n->namespaces);
+    if (n->iothread) {
+        for (i = 0; i < n->num_namespaces; i++) {
+            blk_set_aio_context(n->namespaces[i].blk, qemu_get_aio_context());
+        }
+    }
+    aio_context_release(n->ctx);
+    nvme_free_namespaces(n);
     g_free(n->cq);
     g_free(n->sq);
     msix_uninit_exclusive_bar(pci_dev);
@@ -846,6 +1418,7 @@ static void nvme_exit(PCIDevice *pci_dev)
 static Property nvme_props[] = {
     DEFINE_BLOCK_PROPERTIES(NvmeCtrl, conf),
     DEFINE_PROP_STRING("serial", NvmeCtrl, serial),
+    DEFINE_PROP_STRING("drives", NvmeCtrl, drives),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -908,6 +1481,12 @@ out:
 
 static void nvme_instance_init(Object *obj)
 {
+    NvmeCtrl *n = NVME(obj);
+
+    object_property_add_link(obj, "iothread", TYPE_IOTHREAD,
+                             (Object **)&n->iothread,
+                             qdev_prop_allow_set_link_before_realize,
+                             OBJ_PROP_LINK_UNREF_ON_RELEASE, NULL);
     object_property_add(obj, "bootindex", "int32",
                         nvme_get_bootindex,
                         nvme_set_bootindex, NULL, NULL, NULL);
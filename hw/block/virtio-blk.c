@@ -27,11 +27,15 @@
 #endif
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
+#include "qemu/atomic.h"
+#include "exec/cpu-common.h"
 
-VirtIOBlockReq *virtio_blk_alloc_request(VirtIOBlock *s)
+VirtIOBlockReq *virtio_blk_alloc_request(VirtIOBlock *s, VirtQueue *vq)
 {
     VirtIOBlockReq *req = g_slice_new(VirtIOBlockReq);
     req->dev = s;
+    req->vq = vq;
+    req->mq_ctx = NULL;
     req->qiov.size = 0;
     req->next = NULL;
     return req;
@@ -48,13 +52,46 @@ static void virtio_blk_complete_request(VirtIOBlockReq *req,
                                         unsigned char status)
 {
     VirtIOBlock *s = req->dev;
-    VirtIODevice *vdev = VIRTIO_DEVICE(s);
 
     trace_virtio_blk_req_complete(req, status);
 
     stb_p(&req->in->status, status);
-    virtqueue_push(s->vq, &req->elem, req->qiov.size + sizeof(*req->in));
-    virtio_notify(vdev, s->vq);
+    virtqueue_push(req->vq, &req->elem, req->qiov.size + sizeof(*req->in));
+    s->notify_pending[virtio_get_queue_index(req->vq)] = true;
+    qemu_bh_schedule(s->notify_bh);
+}
+
+/* One interrupt decision per queue for all completions since the last run */
+static void virtio_blk_notify_bh(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    unsigned int i;
+
+    for (i = 0; i < s->conf.num_queues; i++) {
+        if (s->notify_pending[i]) {
+            s->notify_pending[i] = false;
+            virtio_notify(vdev, s->vqs[i]);
+        }
+    }
+}
+
+/* Requests popped by a dataplane queue thread (req->mq_ctx != NULL) only
+ * submit reads and writes themselves; everything else runs with the
+ * home AioContext of the BlockBackend held.
+ */
+static void virtio_blk_home_acquire(VirtIOBlockReq *req)
+{
+    if (req->mq_ctx) {
+        aio_context_acquire(blk_get_aio_context(req->dev->blk));
+    }
+}
+
+static void virtio_blk_home_release(VirtIOBlockReq *req)
+{
+    if (req->mq_ctx) {
+        aio_context_release(blk_get_aio_context(req->dev->blk));
+    }
 }
 
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
@@ -70,11 +107,13 @@ static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
     VirtIOBlock *s = req->dev;
 
     if (action == BLOCK_ERROR_ACTION_STOP) {
-        req->next = s->rq;
-        s->rq = req;
+        /* several queue threads may fail requests at the same time */
+        do {
+            req->next = atomic_read(&s->rq);
+        } while (atomic_cmpxchg(&s->rq, req->next, req) != req->next);
     } else if (action == BLOCK_ERROR_ACTION_REPORT) {
         virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
-        block_acct_done(blk_get_stats(s->blk), &req->acct);
+        block_acct_failed(blk_get_stats(s->blk), &req->acct);
         virtio_blk_free_request(req);
     }
 
@@ -115,18 +154,6 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
     virtio_blk_free_request(req);
 }
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s)
-{
-    VirtIOBlockReq *req = virtio_blk_alloc_request(s);
-
-    if (!virtqueue_pop(s->vq, &req->elem)) {
-        virtio_blk_free_request(req);
-        return NULL;
-    }
-
-    return req;
-}
-
 int virtio_blk_handle_scsi_req(VirtIOBlock *blk,
                                VirtQueueElement *elem)
 {
@@ -252,7 +279,9 @@ static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
 {
     int status;
 
+    virtio_blk_home_acquire(req);
     status = virtio_blk_handle_scsi_req(req->dev, &req->elem);
+    virtio_blk_home_release(req);
     virtio_blk_req_complete(req, status);
     virtio_blk_free_request(req);
 }
@@ -286,7 +315,9 @@ static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
      * Make sure all outstanding writes are posted to the backing device.
      */
     virtio_submit_multiwrite(req->dev->blk, mrb);
+    virtio_blk_home_acquire(req);
     blk_aio_flush(req->dev->blk, virtio_blk_flush_complete, req);
+    virtio_blk_home_release(req);
 }
 
 static bool virtio_blk_sect_range_ok(VirtIOBlock *dev,
@@ -318,6 +349,7 @@ static void virtio_blk_handle_write(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     trace_virtio_blk_handle_write(req, sector, req->qiov.size / 512);
 
     if (!virtio_blk_sect_range_ok(req->dev, sector, req->qiov.size)) {
+        block_acct_invalid(blk_get_stats(req->dev->blk), BLOCK_ACCT_WRITE);
         virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
         virtio_blk_free_request(req);
         return;
@@ -326,6 +358,19 @@ static void virtio_blk_handle_write(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     block_acct_start(blk_get_stats(req->dev->blk), &req->acct, req->qiov.size,
                      BLOCK_ACCT_WRITE);
 
+    if (req->mq_ctx) {
+        if (!blk_aio_writev_mq(req->dev->blk, req->mq_ctx, sector, &req->qiov,
+                               req->qiov.size / BDRV_SECTOR_SIZE,
+                               virtio_blk_rw_complete, req)) {
+            virtio_blk_home_acquire(req);
+            blk_aio_writev(req->dev->blk, sector, &req->qiov,
+                           req->qiov.size / BDRV_SECTOR_SIZE,
+                           virtio_blk_rw_complete, req);
+            virtio_blk_home_release(req);
+        }
+        return;
+    }
+
     if (mrb->num_writes == 32) {
         virtio_submit_multiwrite(req->dev->blk, mrb);
     }
@@ -350,6 +395,7 @@ static void virtio_blk_handle_read(VirtIOBlockReq *req)
     trace_virtio_blk_handle_read(req, sector, req->qiov.size / 512);
 
     if (!virtio_blk_sect_range_ok(req->dev, sector, req->qiov.size)) {
+        block_acct_invalid(blk_get_stats(req->dev->blk), BLOCK_ACCT_READ);
         virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
         virtio_blk_free_request(req);
         return;
@@ -357,9 +403,17 @@ static void virtio_blk_handle_read(VirtIOBlockReq *req)
 
     block_acct_start(blk_get_stats(req->dev->blk), &req->acct, req->qiov.size,
                      BLOCK_ACCT_READ);
+    if (req->mq_ctx &&
+        blk_aio_readv_mq(req->dev->blk, req->mq_ctx, sector, &req->qiov,
+                         req->qiov.size / BDRV_SECTOR_SIZE,
+                         virtio_blk_rw_complete, req)) {
+        return;
+    }
+    virtio_blk_home_acquire(req);
     blk_aio_readv(req->dev->blk, sector, &req->qiov,
                   req->qiov.size / BDRV_SECTOR_SIZE,
                   virtio_blk_rw_complete, req);
+    virtio_blk_home_release(req);
 }
 
 void virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
@@ -430,7 +484,8 @@ void virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBlock *s = VIRTIO_BLK(vdev);
-    VirtIOBlockReq *req;
+    VirtQueueElement *elems[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, num;
     MultiReqBuffer mrb = {
         .num_writes = 0,
     };
@@ -443,9 +498,23 @@ static void virtio_blk_handle_output(VirtIODevice *vdev, VirtQueue *vq)
         return;
     }
 
-    while ((req = virtio_blk_get_request(s))) {
-        virtio_blk_handle_request(req, &mrb);
-    }
+    do {
+        for (i = 0; i < VIRTIO_BLK_POP_BATCH; i++) {
+            if (!s->pop_reqs[i]) {
+                s->pop_reqs[i] = virtio_blk_alloc_request(s, vq);
+            }
+            s->pop_reqs[i]->vq = vq;
+            elems[i] = &s->pop_reqs[i]->elem;
+        }
+
+        num = virtqueue_pop_batch(vq, elems, VIRTIO_BLK_POP_BATCH);
+        for (i = 0; i < num; i++) {
+            VirtIOBlockReq *req = s->pop_reqs[i];
+
+            s->pop_reqs[i] = NULL;
+            virtio_blk_handle_request(req, &mrb);
+        }
+    } while (num == VIRTIO_BLK_POP_BATCH);
 
     virtio_submit_multiwrite(s->blk, &mrb);
 
@@ -471,6 +540,7 @@ static void virtio_blk_dma_restart_bh(void *opaque)
 
     while (req) {
         VirtIOBlockReq *next = req->next;
+        req->mq_ctx = NULL;
         virtio_blk_handle_request(req, &mrb);
         req = next;
     }
@@ -507,6 +577,7 @@ static void virtio_blk_reset(VirtIODevice *vdev)
      * are per-device request lists.
      */
     blk_drain_all();
+    memset(s->notify_pending, 0, s->conf.num_queues * sizeof(bool));
     blk_set_enable_write_cache(s->blk, s->original_wce);
 }
 
@@ -549,7 +620,8 @@ static void virtio_blk_update_config(VirtIODevice *vdev, uint8_t *config)
     blkcfg.physical_block_exp = get_physical_block_exp(conf);
     blkcfg.alignment_offset = 0;
     blkcfg.wce = blk_enable_write_cache(s->blk);
-    memcpy(config, &blkcfg, sizeof(struct virtio_blk_config));
+    virtio_stw_p(vdev, &blkcfg.num_queues, s->conf.num_queues);
+    memcpy(config, &blkcfg, vdev->config_len);
 }
 
 static void virtio_blk_set_config(VirtIODevice *vdev, const uint8_t *config)
@@ -557,7 +629,7 @@ static void virtio_blk_set_config(VirtIODevice *vdev, const uint8_t *config)
     VirtIOBlock *s = VIRTIO_BLK(vdev);
     struct virtio_blk_config blkcfg;
 
-    memcpy(&blkcfg, config, sizeof(blkcfg));
+    memcpy(&blkcfg, config, vdev->config_len);
 
     aio_context_acquire(blk_get_aio_context(s->blk));
     blk_set_enable_write_cache(s->blk, blkcfg.wce != 0);
@@ -583,6 +655,9 @@ static uint32_t virtio_blk_get_features(VirtIODevice *vdev, uint32_t features)
     if (blk_is_read_only(s->blk)) {
         features |= 1 << VIRTIO_BLK_F_RO;
     }
+    if (s->conf.num_queues > 1) {
+        features |= 1 << VIRTIO_BLK_F_MQ;
+    }
 
     return features;
 }
@@ -630,6 +705,8 @@ static void virtio_blk_save(QEMUFile *f, void *opaque)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(opaque);
 
+    /* Raise deferred interrupts so that the saved ISR includes them */
+    virtio_blk_notify_bh(opaque);
     virtio_save(vdev, f);
 }
     
@@ -640,8 +717,10 @@ static void virtio_blk_save_device(VirtIODevice *vdev, QEMUFile *f)
 
     while (req) {
         qemu_put_sbyte(f, 1);
-        qemu_put_buffer(f, (unsigned char *)&req->elem,
-                        sizeof(VirtQueueElement));
+        if (s->conf.num_queues > 1) {
+            qemu_put_be32(f, virtio_get_queue_index(req->vq));
+        }
+        qemu_put_virtqueue_element(f, &req->elem);
         req = req->next;
     }
     qemu_put_sbyte(f, 0);
@@ -664,16 +743,21 @@ static int virtio_blk_load_device(VirtIODevice *vdev, QEMUFile *f,
     VirtIOBlock *s = VIRTIO_BLK(vdev);
 
     while (qemu_get_sbyte(f)) {
-        VirtIOBlockReq *req = virtio_blk_alloc_request(s);
-        qemu_get_buffer(f, (unsigned char *)&req->elem,
-                        sizeof(VirtQueueElement));
+        unsigned int nvq = 0;
+        VirtIOBlockReq *req;
+
+        if (s->conf.num_queues > 1) {
+            nvq = qemu_get_be32(f);
+            if (nvq >= s->conf.num_queues) {
+                error_report("Invalid virtqueue index %u in request", nvq);
+                return -EINVAL;
+            }
+        }
+
+        req = virtio_blk_alloc_request(s, s->vqs[nvq]);
+        qemu_get_virtqueue_element(f, req->vq, &req->elem);
         req->next = s->rq;
         s->rq = req;
-
-        virtqueue_map_sg(req->elem.in_sg, req->elem.in_addr,
-            req->elem.in_num, 1);
-        virtqueue_map_sg(req->elem.out_sg, req->elem.out_addr,
-            req->elem.out_num, 0);
     }
 
     return 0;
@@ -721,6 +805,44 @@ static void virtio_blk_migration_state_changed(Notifier *notifier, void *data)
     }
 }
 
+/* Requests point into guest RAM, so let the block layer map it ahead of
+ * time (e.g. as io_uring fixed buffers).  Blocks present at realize are
+ * registered directly; later hotplug, unplug and remap go through
+ * virtio_blk_ram_block_notify().
+ */
+static void virtio_blk_register_ram(void *host_addr, ram_addr_t offset,
+                                    ram_addr_t length, void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    blk_register_buf(s->blk, host_addr, length);
+}
+
+static void virtio_blk_unregister_ram(void *host_addr, ram_addr_t offset,
+                                      ram_addr_t length, void *opaque)
+{
+    VirtIOBlock *s = opaque;
+
+    blk_unregister_buf(s->blk, host_addr);
+}
+
+static void virtio_blk_ram_block_notify(Notifier *notifier, void *data)
+{
+    VirtIOBlock *s = container_of(notifier, VirtIOBlock, ram_block_notifier);
+    RAMBlockNotification *n = data;
+    AioContext *ctx = blk_get_aio_context(s->blk);
+
+    /* The buffer table may only change with no requests in flight */
+    aio_context_acquire(ctx);
+    blk_drain(s->blk);
+    if (n->added) {
+        blk_register_buf(s->blk, n->host, n->length);
+    } else {
+        blk_unregister_buf(s->blk, n->host);
+    }
+    aio_context_release(ctx);
+}
+
 static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -728,6 +850,8 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     VirtIOBlkConf *conf = &s->conf;
     Error *err = NULL;
     static int virtio_blk_id;
+    size_t config_size;
+    unsigned int i;
 
     if (!conf->conf.blk) {
         error_setg(errp, "drive property not set");
@@ -738,6 +862,12 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (!conf->num_queues || conf->num_queues > VIRTIO_PCI_QUEUE_MAX) {
+        error_setg(errp, "num-queues property must be between 1 and %d",
+                   VIRTIO_PCI_QUEUE_MAX);
+        return;
+    }
+
     blkconf_serial(&conf->conf, &conf->serial);
     s->original_wce = blk_enable_write_cache(conf->conf.blk);
     blkconf_geometry(&conf->conf, NULL, 65535, 255, 255, &err);
@@ -746,21 +876,29 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
-    virtio_init(vdev, "virtio-blk", VIRTIO_ID_BLOCK,
-                sizeof(struct virtio_blk_config));
+    /* Keep the config space of single-queue devices at its old size */
+    config_size = conf->num_queues > 1 ? sizeof(struct virtio_blk_config) :
+                  offsetof(struct virtio_blk_config, unused);
+    virtio_init(vdev, "virtio-blk", VIRTIO_ID_BLOCK, config_size);
 
     s->blk = conf->conf.blk;
     s->rq = NULL;
     s->sector_mask = (s->conf.conf.logical_block_size / BDRV_SECTOR_SIZE) - 1;
 
-    s->vq = virtio_add_queue(vdev, 128, virtio_blk_handle_output);
+    s->vqs = g_new0(VirtQueue *, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        s->vqs[i] = virtio_add_queue(vdev, 128, virtio_blk_handle_output);
+    }
     s->complete_request = virtio_blk_complete_request;
     virtio_blk_data_plane_create(vdev, conf, &s->dataplane, &err);
     if (err != NULL) {
         error_propagate(errp, err);
+        g_free(s->vqs);
         virtio_cleanup(vdev);
         return;
     }
+    s->notify_bh = qemu_bh_new(virtio_blk_notify_bh, s);
+    s->notify_pending = g_new0(bool, conf->num_queues);
     s->migration_state_notifier.notify = virtio_blk_migration_state_changed;
     add_migration_state_change_notifier(&s->migration_state_notifier);
 
@@ -771,19 +909,31 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     blk_set_guest_block_size(s->blk, s->conf.conf.logical_block_size);
 
     blk_iostatus_enable(s->blk);
+    qemu_ram_foreach_block(virtio_blk_register_ram, s);
+    s->ram_block_notifier.notify = virtio_blk_ram_block_notify;
+    qemu_ram_add_block_notifier(&s->ram_block_notifier);
 }
 
 static void virtio_blk_device_unrealize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBlock *s = VIRTIO_BLK(dev);
+    unsigned int i;
 
     remove_migration_state_change_notifier(&s->migration_state_notifier);
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
+    qemu_ram_remove_block_notifier(&s->ram_block_notifier);
+    qemu_ram_foreach_block(virtio_blk_unregister_ram, s);
     qemu_del_vm_change_state_handler(s->change);
     unregister_savevm(dev, "virtio-blk", s);
     blockdev_mark_auto_del(s->blk);
+    qemu_bh_delete(s->notify_bh);
+    g_free(s->notify_pending);
+    for (i = 0; i < VIRTIO_BLK_POP_BATCH; i++) {
+        virtio_blk_free_request(s->pop_reqs[i]);
+    }
+    g_free(s->vqs);
     virtio_cleanup(vdev);
 }
 
@@ -809,6 +959,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_BIT("scsi", VirtIOBlock, conf.scsi, 0, true),
 #endif
     DEFINE_PROP_BIT("x-data-plane", VirtIOBlock, conf.data_plane, 0, false),
+    DEFINE_PROP_UINT16("num-queues", VirtIOBlock, conf.num_queues, 1),
+    DEFINE_PROP_STRING("iothreads", VirtIOBlock, conf.iothreads),
     DEFINE_PROP_END_OF_LIST(),
 };
 
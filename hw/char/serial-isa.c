@@ -92,6 +92,7 @@ static Property serial_isa_properties[] = {
     DEFINE_PROP_UINT32("irq",    ISASerialState, isairq,  -1),
     DEFINE_PROP_CHR("chardev",   ISASerialState, state.chr),
     DEFINE_PROP_UINT32("wakeup", ISASerialState, state.wakeup, 0),
+    DEFINE_PROP_BOOL("fifo64",   ISASerialState, state.fifo64, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
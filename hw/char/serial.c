@@ -47,6 +47,7 @@
 #define UART_IIR_RLSI	0x06	/* Receiver line status interrupt */
 #define UART_IIR_CTI    0x0C    /* Character Timeout Indication */
 
+#define UART_IIR_64BYTE 0x20    /* 64-byte Fifo enabled (16750) */
 #define UART_IIR_FENF   0x80    /* Fifo enabled, but not functionning */
 #define UART_IIR_FE     0xC0    /* Fifo enabled */
 
@@ -88,6 +89,9 @@
 #define UART_FCR_ITL_3      0x80 /* 8 bytes ITL */
 #define UART_FCR_ITL_4      0xC0 /* 14 bytes ITL */
 
+/* With the 64-byte FIFO of the 16750 the ITLs are 1, 16, 32 and 56 bytes */
+
+#define UART_FCR_64BYTE     0x20    /* 64-byte FIFO enable, written with DLAB */
 #define UART_FCR_DMS        0x08    /* DMA Mode Select */
 #define UART_FCR_XFR        0x04    /* XMIT Fifo Reset */
 #define UART_FCR_RFR        0x02    /* RCVR Fifo Reset */
@@ -105,10 +109,16 @@ do {} while (0)
 
 static void serial_receive1(void *opaque, const uint8_t *buf, int size);
 
+/* The FIFOs are allocated for the largest mode; this is the size in use */
+static inline uint32_t serial_fifo_len(SerialState *s)
+{
+    return (s->fcr & UART_FCR_64BYTE) ? UART_FIFO64_LENGTH : UART_FIFO_LENGTH;
+}
+
 static inline void recv_fifo_put(SerialState *s, uint8_t chr)
 {
     /* Receive overruns do not overwrite FIFO contents. */
-    if (!fifo8_is_full(&s->recv_fifo)) {
+    if (s->recv_fifo.num < serial_fifo_len(s)) {
         fifo8_push(&s->recv_fifo, chr);
     } else {
         s->lsr |= UART_LSR_OE;
@@ -219,10 +229,43 @@ static void serial_update_msl(SerialState *s)
         timer_mod(s->modem_status_poll, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + get_ticks_per_sec() / 100);
 }
 
+/*
+ * Hand the whole xmit FIFO to the chardev in as few writes as possible
+ * (two when it wraps), instead of one write per byte.  Returns the number
+ * of bytes sent; whatever the chardev did not take stays in the FIFO.
+ */
+static uint32_t serial_xmit_fifo(SerialState *s)
+{
+    Fifo8 *fifo = &s->xmit_fifo;
+    uint32_t sent = 0, len, num;
+    int ret;
+
+    while (!fifo8_is_empty(fifo)) {
+        len = MIN(fifo->num, fifo->capacity - fifo->head);
+        ret = qemu_chr_fe_write(s->chr, &fifo->data[fifo->head], len);
+        if (ret <= 0) {
+            break;
+        }
+        fifo8_pop_buf(fifo, ret, &num);
+        sent += num;
+        if (num < len) {
+            break;
+        }
+    }
+    return sent;
+}
+
 static gboolean serial_xmit(GIOChannel *chan, GIOCondition cond, void *opaque)
 {
     SerialState *s = opaque;
 
+    if ((s->fcr & UART_FCR_FE) && s->tsr_retry <= 0 &&
+        !(s->mcr & UART_MCR_LOOP) && serial_xmit_fifo(s) &&
+        fifo8_is_empty(&s->xmit_fifo)) {
+        s->lsr |= UART_LSR_THRE;
+        goto done;
+    }
+
     do {
         if (s->tsr_retry <= 0) {
             if (s->fcr & UART_FCR_FE) {
@@ -260,6 +303,7 @@ static gboolean serial_xmit(GIOChannel *chan, GIOCondition cond, void *opaque)
            possible when FIFO is enabled and not empty. */
     } while ((s->fcr & UART_FCR_FE) && !fifo8_is_empty(&s->xmit_fifo));
 
+done:
     s->last_xmit_ts = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
 
     if (s->lsr & UART_LSR_THRE) {
@@ -277,29 +321,30 @@ static gboolean serial_xmit(GIOChannel *chan, GIOCondition cond, void *opaque)
    and interrupt should not be invoked */
 static void serial_write_fcr(SerialState *s, uint8_t val)
 {
+    static const uint8_t itl[2][4] = {
+        { 1, 4, 8, 14 },
+        { 1, 16, 32, 56 },
+    };
+
+    if (!s->fifo64) {
+        val &= ~UART_FCR_64BYTE;
+    }
     /* Set fcr - val only has the bits that are supposed to "stick" */
     s->fcr = val;
 
     if (val & UART_FCR_FE) {
         s->iir |= UART_IIR_FE;
         /* Set recv_fifo trigger Level */
-        switch (val & 0xC0) {
-        case UART_FCR_ITL_1:
-            s->recv_fifo_itl = 1;
-            break;
-        case UART_FCR_ITL_2:
-            s->recv_fifo_itl = 4;
-            break;
-        case UART_FCR_ITL_3:
-            s->recv_fifo_itl = 8;
-            break;
-        case UART_FCR_ITL_4:
-            s->recv_fifo_itl = 14;
-            break;
-        }
+        s->recv_fifo_itl = itl[!!(val & UART_FCR_64BYTE)][val >> 6];
     } else {
         s->iir &= ~UART_IIR_FE;
     }
+    if ((val & (UART_FCR_FE | UART_FCR_64BYTE)) ==
+        (UART_FCR_FE | UART_FCR_64BYTE)) {
+        s->iir |= UART_IIR_64BYTE;
+    } else {
+        s->iir &= ~UART_IIR_64BYTE;
+    }
 }
 
 static void serial_ioport_write(void *opaque, hwaddr addr, uint64_t val,
@@ -319,7 +364,7 @@ static void serial_ioport_write(void *opaque, hwaddr addr, uint64_t val,
             s->thr = (uint8_t) val;
             if(s->fcr & UART_FCR_FE) {
                 /* xmit overruns overwrite data, so make space if needed */
-                if (fifo8_is_full(&s->xmit_fifo)) {
+                if (s->xmit_fifo.num >= serial_fifo_len(s)) {
                     fifo8_pop(&s->xmit_fifo);
                 }
                 fifo8_push(&s->xmit_fifo, s->thr);
@@ -328,7 +373,18 @@ static void serial_ioport_write(void *opaque, hwaddr addr, uint64_t val,
             s->thr_ipending = 0;
             s->lsr &= ~UART_LSR_THRE;
             serial_update_irq(s);
-            if (s->tsr_retry <= 0) {
+            if (s->tsr_retry > 0) {
+                break;
+            }
+            /*
+             * Drivers fill the FIFO with back-to-back writes, so send it
+             * from a bottom half (or once it is full, or when the guest
+             * looks at LSR) rather than with one chardev write per byte.
+             */
+            if ((s->fcr & UART_FCR_FE) && !(s->mcr & UART_MCR_LOOP) &&
+                s->xmit_fifo.num < serial_fifo_len(s)) {
+                qemu_bh_schedule(s->xmit_bh);
+            } else {
                 serial_xmit(NULL, G_IO_OUT, s);
             }
         }
@@ -374,7 +430,11 @@ static void serial_ioport_write(void *opaque, hwaddr addr, uint64_t val,
             fifo8_reset(&s->xmit_fifo);
         }
 
-        serial_write_fcr(s, val & 0xC9);
+        /* The 64-byte FIFO bit can only be changed while DLAB is set */
+        if (!(s->lcr & UART_LCR_DLAB)) {
+            val = (val & ~UART_FCR_64BYTE) | (s->fcr & UART_FCR_64BYTE);
+        }
+        serial_write_fcr(s, val & 0xE9);
         serial_update_irq(s);
         break;
     case 3:
@@ -479,6 +539,10 @@ static uint64_t serial_ioport_read(void *opaque, hwaddr addr, unsigned size)
         ret = s->mcr;
         break;
     case 5:
+        /* A guest polling for THRE is waiting for the queued bytes */
+        if (!fifo8_is_empty(&s->xmit_fifo) && s->tsr_retry <= 0) {
+            serial_xmit(NULL, G_IO_OUT, s);
+        }
         ret = s->lsr;
         /* Clear break and overrun interrupts */
         if (s->lsr & (UART_LSR_BI|UART_LSR_OE)) {
@@ -515,10 +579,10 @@ static uint64_t serial_ioport_read(void *opaque, hwaddr addr, unsigned size)
 static int serial_can_receive(SerialState *s)
 {
     if(s->fcr & UART_FCR_FE) {
-        if (s->recv_fifo.num < UART_FIFO_LENGTH) {
+        if (s->recv_fifo.num < serial_fifo_len(s)) {
             /*
              * Advertise (fifo.itl - fifo.count) bytes when count < ITL, and 1
-             * if above. If UART_FIFO_LENGTH - fifo.count is advertised the
+             * if above. If the free FIFO space is advertised the
              * effect will be to almost always fill the fifo completely before
              * the guest has a chance to respond, effectively overriding the ITL
              * that the guest has set.
@@ -551,6 +615,15 @@ static void fifo_timeout_int (void *opaque) {
     }
 }
 
+static void serial_xmit_bh(void *opaque)
+{
+    SerialState *s = opaque;
+
+    if (!fifo8_is_empty(&s->xmit_fifo) && s->tsr_retry <= 0) {
+        serial_xmit(NULL, G_IO_OUT, s);
+    }
+}
+
 static int serial_can_receive1(void *opaque)
 {
     SerialState *s = opaque;
@@ -617,6 +690,9 @@ static int serial_post_load(void *opaque, int version_id)
     /* Initialize fcr via setter to perform essential side-effects */
     serial_write_fcr(s, s->fcr_vmstate);
     serial_update_parameters(s);
+    if (!fifo8_is_empty(&s->xmit_fifo) && s->tsr_retry <= 0) {
+        qemu_bh_schedule(s->xmit_bh);
+    }
     return 0;
 }
 
@@ -830,12 +906,15 @@ void serial_realize_core(SerialState *s, Error **errp)
     s->modem_status_poll = timer_new_ns(QEMU_CLOCK_VIRTUAL, (QEMUTimerCB *) serial_update_msl, s);
 
     s->fifo_timeout_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, (QEMUTimerCB *) fifo_timeout_int, s);
+    s->xmit_bh = qemu_bh_new(serial_xmit_bh, s);
     qemu_register_reset(serial_reset, s);
 
     qemu_chr_add_handlers(s->chr, serial_can_receive1, serial_receive1,
                           serial_event, s);
-    fifo8_create(&s->recv_fifo, UART_FIFO_LENGTH);
-    fifo8_create(&s->xmit_fifo, UART_FIFO_LENGTH);
+    fifo8_create(&s->recv_fifo,
+                 s->fifo64 ? UART_FIFO64_LENGTH : UART_FIFO_LENGTH);
+    fifo8_create(&s->xmit_fifo,
+                 s->fifo64 ? UART_FIFO64_LENGTH : UART_FIFO_LENGTH);
     serial_reset(s);
 }
 
@@ -843,6 +922,7 @@ void serial_exit_core(SerialState *s)
 {
     qemu_chr_add_handlers(s->chr, NULL, NULL, NULL, NULL);
     qemu_unregister_reset(serial_reset, s);
+    qemu_bh_delete(s->xmit_bh);
 }
 
 /* Change the main reference oscillator frequency. */
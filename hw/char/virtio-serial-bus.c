@@ -26,6 +26,10 @@
 #include "hw/virtio/virtio-serial.h"
 #include "hw/virtio/virtio-access.h"
 
+/* Upper bounds on how much guest output goes to a port in one call */
+#define VIRTIO_SERIAL_BATCH_SIZE    (64 * 1024)
+#define VIRTIO_SERIAL_BATCH_ELEMS   64
+
 struct VirtIOSerialDevices {
     QLIST_HEAD(, VirtIOSerial) devices;
 } vserdevices;
@@ -122,10 +126,48 @@ static void discard_vq_data(VirtQueue *vq, VirtIODevice *vdev)
     virtio_notify(vdev, vq);
 }
 
+/*
+ * Copy the data of @elem, starting at out_sg[*idx] + *off, into @buf
+ * until @size bytes have been copied; @buf may be NULL to only advance.
+ * Returns the number of bytes copied and updates *idx and *off.
+ */
+static size_t elem_copy_out(VirtQueueElement *elem, uint32_t *idx,
+                            uint64_t *off, uint8_t *buf, size_t size)
+{
+    size_t done = 0;
+
+    while (*idx < elem->out_num && done < size) {
+        struct iovec *sg = &elem->out_sg[*idx];
+        size_t len = MIN(sg->iov_len - *off, size - done);
+
+        if (buf) {
+            memcpy(buf + done, sg->iov_base + *off, len);
+        }
+        done += len;
+        *off += len;
+        if (*off == sg->iov_len) {
+            (*idx)++;
+            *off = 0;
+        }
+    }
+    return done;
+}
+
+/*
+ * Guest data is gathered from as many elements as fit into
+ * port->batch_buf and handed to the port in one have_data() call, so
+ * that a chardev backend sees one write per batch instead of one per
+ * descriptor.  Elements go back to the guest only once all of their
+ * data was consumed; if the port throttles mid-batch, the element it
+ * stopped in is kept in port->elem, as before, and the untouched ones
+ * after it are returned to the ring to be popped again later.
+ */
 static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
                                  VirtIODevice *vdev)
 {
     VirtIOSerialPortClass *vsc;
+    VirtQueueElement elems[VIRTIO_SERIAL_BATCH_ELEMS];
+    size_t starts[VIRTIO_SERIAL_BATCH_ELEMS + 1];
 
     assert(port);
     assert(virtio_queue_ready(vq));
@@ -133,40 +175,88 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
     vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
 
     while (!port->throttled) {
-        unsigned int i;
+        uint32_t first_idx = 0, idx;
+        uint64_t first_off = 0, off;
+        unsigned int i, n = 0;
+        bool last_partial = false;
+        size_t len = 0, consumed;
+        ssize_t ret;
+
+        /* Start with the elem we left off mid-way, if any */
+        if (port->elem.out_num) {
+            elems[n] = port->elem;
+            first_idx = port->iov_idx;
+            first_off = port->iov_offset;
+            port->elem.out_num = 0;
+            starts[n] = len;
+            idx = first_idx;
+            off = first_off;
+            len += elem_copy_out(&elems[n], &idx, &off, port->batch_buf,
+                                 VIRTIO_SERIAL_BATCH_SIZE);
+            last_partial = idx < elems[n].out_num;
+            n++;
+        }
+        while (!last_partial && n < VIRTIO_SERIAL_BATCH_ELEMS &&
+               len < VIRTIO_SERIAL_BATCH_SIZE &&
+               virtqueue_pop(vq, &elems[n])) {
+            starts[n] = len;
+            idx = 0;
+            off = 0;
+            len += elem_copy_out(&elems[n], &idx, &off,
+                                 port->batch_buf + len,
+                                 VIRTIO_SERIAL_BATCH_SIZE - len);
+            last_partial = idx < elems[n].out_num;
+            n++;
+        }
+        if (!n) {
+            break;
+        }
+        starts[n] = len;
+
+        ret = len ? vsc->have_data(port, port->batch_buf, len) : 0;
+        trace_virtio_serial_flush_batch(port->id, n, len, ret);
+
+        /*
+         * A port that isn't throttled has taken everything it is going
+         * to take; what it left (console ports don't throttle) is dropped.
+         */
+        consumed = len;
+        if (port->throttled) {
+            consumed = ret > 0 ? MIN(ret, len) : 0;
+        }
 
-        /* Pop an elem only if we haven't left off a previous one mid-way */
-        if (!port->elem.out_num) {
-            if (!virtqueue_pop(vq, &port->elem)) {
+        /* Elements whose data was consumed in full */
+        for (i = 0; i < n; i++) {
+            if (starts[i + 1] > consumed ||
+                (i == n - 1 && last_partial)) {
                 break;
             }
-            port->iov_idx = 0;
-            port->iov_offset = 0;
         }
 
-        for (i = port->iov_idx; i < port->elem.out_num; i++) {
-            size_t buf_size;
-            ssize_t ret;
-
-            buf_size = port->elem.out_sg[i].iov_len - port->iov_offset;
-            ret = vsc->have_data(port,
-                                  port->elem.out_sg[i].iov_base
-                                  + port->iov_offset,
-                                  buf_size);
-            if (port->throttled) {
-                port->iov_idx = i;
-                if (ret > 0) {
-                    port->iov_offset += ret;
-                }
-                break;
+        if (i < n) {
+            unsigned int j;
+
+            /* Give back the ones after it, most recently popped first */
+            for (j = n - 1; j > i; j--) {
+                virtqueue_discard(vq, &elems[j], 0);
             }
-            port->iov_offset = 0;
+
+            idx = i ? 0 : first_idx;
+            off = i ? 0 : first_off;
+            elem_copy_out(&elems[i], &idx, &off, NULL, consumed - starts[i]);
+            port->elem = elems[i];
+            port->iov_idx = idx;
+            port->iov_offset = off;
         }
-        if (port->throttled) {
-            break;
+
+        if (i) {
+            unsigned int j;
+
+            for (j = 0; j < i; j++) {
+                virtqueue_fill(vq, &elems[j], 0, j);
+            }
+            virtqueue_flush(vq, i);
         }
-        virtqueue_push(vq, &port->elem, 0);
-        port->elem.out_num = 0;
     }
     virtio_notify(vdev, vq);
 }
@@ -592,8 +682,7 @@ static void virtio_serial_save_device(VirtIODevice *vdev, QEMUFile *f)
             qemu_put_be32s(f, &port->iov_idx);
             qemu_put_be64s(f, &port->iov_offset);
 
-            qemu_put_buffer(f, (unsigned char *)&port->elem,
-                            sizeof(port->elem));
+            qemu_put_virtqueue_element(f, &port->elem);
         }
     }
 }
@@ -668,12 +757,7 @@ static int fetch_active_ports_list(QEMUFile *f, int version_id,
                 qemu_get_be32s(f, &port->iov_idx);
                 qemu_get_be64s(f, &port->iov_offset);
 
-                qemu_get_buffer(f, (unsigned char *)&port->elem,
-                                sizeof(port->elem));
-                virtqueue_map_sg(port->elem.in_sg, port->elem.in_addr,
-                                 port->elem.in_num, 1);
-                virtqueue_map_sg(port->elem.out_sg, port->elem.out_addr,
-                                 port->elem.out_num, 1);
+                qemu_get_virtqueue_element(f, port->ovq, &port->elem);
 
                 /*
                  *  Port was throttled on source machine.  Let's
@@ -904,6 +988,7 @@ static void virtser_port_device_realize(DeviceState *dev, Error **errp)
     }
 
     port->elem.out_num = 0;
+    port->batch_buf = g_malloc(VIRTIO_SERIAL_BATCH_SIZE);
 }
 
 static void virtser_port_device_plug(HotplugHandler *hotplug_dev,
@@ -931,6 +1016,7 @@ static void virtser_port_device_unrealize(DeviceState *dev, Error **errp)
     remove_port(port->vser, port->id);
 
     QTAILQ_REMOVE(&vser->ports, port, next);
+    g_free(port->batch_buf);
 
     if (vsc->unrealize) {
         vsc->unrealize(dev, errp);
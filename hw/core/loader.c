@@ -712,17 +712,51 @@ static void rom_insert(Rom *rom)
     QTAILQ_INSERT_TAIL(&roms, rom, next);
 }
 
+/*
+ * With -machine share-roms=on, initialize @mr as a copy-on-write mapping of
+ * the image @path, so that QEMU processes using the same firmware share its
+ * pages in the host page cache.  Returns false, leaving @mr uninitialized,
+ * if sharing is off or the file can't be mapped; the caller then allocates
+ * and fills the region itself.
+ */
+bool rom_init_ram_shared(MemoryRegion *mr, Object *owner, const char *name,
+                         uint64_t size, const char *path)
+{
+    Error *local_err = NULL;
+
+    if (!qemu_opt_get_bool(qemu_get_machine_opts(), "share-roms", false)) {
+        return false;
+    }
+
+    memory_region_init_ram_rom_file(mr, owner, name, size, path, &local_err);
+    if (local_err) {
+        error_report("not sharing %s: %s", path, error_get_pretty(local_err));
+        error_free(local_err);
+        object_unparent(OBJECT(mr));
+        return false;
+    }
+    return true;
+}
+
 static void *rom_set_mr(Rom *rom, Object *owner, const char *name)
 {
     void *data;
 
     rom->mr = g_malloc(sizeof(*rom->mr));
-    memory_region_init_ram(rom->mr, owner, name, rom->datasize, &error_abort);
+    if (rom->path &&
+        rom_init_ram_shared(rom->mr, owner, name, rom->datasize, rom->path)) {
+        /* Only the region is used from now on; drop the private copy */
+        g_free(rom->data);
+        rom->data = NULL;
+    } else {
+        memory_region_init_ram(rom->mr, owner, name, rom->datasize,
+                               &error_abort);
+        memcpy(memory_region_get_ram_ptr(rom->mr), rom->data, rom->datasize);
+    }
     memory_region_set_readonly(rom->mr, true);
     vmstate_register_ram_global(rom->mr);
 
     data = memory_region_get_ram_ptr(rom->mr);
-    memcpy(data, rom->data, rom->datasize);
 
     return data;
 }
@@ -15,6 +15,7 @@
 #include "hw/sysbus.h"
 #include "sysemu/sysemu.h"
 #include "qemu/error-report.h"
+#include "hw/xen/xen.h"
 
 static char *machine_get_accel(Object *obj, Error **errp)
 {
@@ -72,6 +73,91 @@ static void machine_set_kvm_shadow_mem(Object *obj, Visitor *v,
     ms->kvm_shadow_mem = value;
 }
 
+static void machine_get_kvm_dirty_ring_size(Object *obj, Visitor *v,
+                                            void *opaque, const char *name,
+                                            Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    uint32_t value = ms->kvm_dirty_ring_size;
+
+    visit_type_uint32(v, &value, name, errp);
+}
+
+static void machine_set_kvm_dirty_ring_size(Object *obj, Visitor *v,
+                                            void *opaque, const char *name,
+                                            Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, &value, name, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "kvm-dirty-ring-size must be a power of two");
+        return;
+    }
+
+    ms->kvm_dirty_ring_size = value;
+}
+
+static void machine_get_kvm_halt_poll_ns(Object *obj, Visitor *v,
+                                         void *opaque, const char *name,
+                                         Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    uint32_t value = ms->kvm_halt_poll_ns;
+
+    visit_type_uint32(v, &value, name, errp);
+}
+
+static void machine_set_kvm_halt_poll_ns(Object *obj, Visitor *v,
+                                         void *opaque, const char *name,
+                                         Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, &value, name, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+
+    ms->kvm_halt_poll_ns = value;
+}
+
+static void machine_get_xen_mapcache_cached(Object *obj, Visitor *v,
+                                            void *opaque, const char *name,
+                                            Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    uint32_t value = ms->xen_mapcache_cached;
+
+    visit_type_uint32(v, &value, name, errp);
+}
+
+static void machine_set_xen_mapcache_cached(Object *obj, Visitor *v,
+                                            void *opaque, const char *name,
+                                            Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, &value, name, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+
+    ms->xen_mapcache_cached = value;
+}
+
 static char *machine_get_kernel(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -217,6 +303,34 @@ static void machine_set_mem_merge(Object *obj, bool value, Error **errp)
     ms->mem_merge = value;
 }
 
+static bool machine_get_mem_hugetlb(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return ms->mem_hugetlb;
+}
+
+static void machine_set_mem_hugetlb(Object *obj, bool value, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    ms->mem_hugetlb = value;
+}
+
+static bool machine_get_share_roms(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return ms->share_roms;
+}
+
+static void machine_set_share_roms(Object *obj, bool value, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    ms->share_roms = value;
+}
+
 static bool machine_get_usb(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -299,6 +413,19 @@ static void machine_initfn(Object *obj)
                         machine_get_kvm_shadow_mem,
                         machine_set_kvm_shadow_mem,
                         NULL, NULL, NULL);
+    object_property_add(obj, "kvm-dirty-ring-size", "uint32",
+                        machine_get_kvm_dirty_ring_size,
+                        machine_set_kvm_dirty_ring_size,
+                        NULL, NULL, NULL);
+    object_property_add(obj, "kvm-halt-poll-ns", "uint32",
+                        machine_get_kvm_halt_poll_ns,
+                        machine_set_kvm_halt_poll_ns,
+                        NULL, NULL, NULL);
+    ms->xen_mapcache_cached = XEN_MAPCACHE_DEFAULT_CACHED;
+    object_property_add(obj, "xen-mapcache-cached", "uint32",
+                        machine_get_xen_mapcache_cached,
+                        machine_set_xen_mapcache_cached,
+                        NULL, NULL, NULL);
     object_property_add_str(obj, "kernel",
                             machine_get_kernel, machine_set_kernel, NULL);
     object_property_add_str(obj, "initrd",
@@ -324,6 +451,12 @@ static void machine_initfn(Object *obj)
     object_property_add_bool(obj, "mem-merge",
                              machine_get_mem_merge,
                              machine_set_mem_merge, NULL);
+    object_property_add_bool(obj, "mem-hugetlb",
+                             machine_get_mem_hugetlb,
+                             machine_set_mem_hugetlb, NULL);
+    object_property_add_bool(obj, "share-roms",
+                             machine_get_share_roms,
+                             machine_set_share_roms, NULL);
     object_property_add_bool(obj, "usb",
                              machine_get_usb,
                              machine_set_usb, NULL);
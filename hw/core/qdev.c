@@ -35,10 +35,12 @@
 #include "hw/hotplug.h"
 #include "hw/boards.h"
 #include "qapi-event.h"
+#include "trace.h"
 
 int qdev_hotplug = 0;
 static bool qdev_hot_added = false;
 static bool qdev_hot_removed = false;
+static unsigned qdev_topology_gen;
 
 const VMStateDescription *qdev_get_vmsd(DeviceState *dev)
 {
@@ -331,6 +333,71 @@ void qdev_init_nofail(DeviceState *dev)
     }
 }
 
+/* Realize times of the devices created with the machine, for the startup
+ * profile.  A device's time includes any devices it realizes itself.
+ */
+typedef struct DeviceRealizeTime {
+    char *name;
+    int64_t ns;
+} DeviceRealizeTime;
+
+#define REALIZE_TIMES_SHOWN 10
+
+static GArray *device_realize_times;
+
+static void qdev_record_realize_time(DeviceState *dev, int64_t ns)
+{
+    const char *type = object_get_typename(OBJECT(dev));
+    DeviceRealizeTime t;
+
+    trace_qdev_realize(dev, type, ns);
+    if (qdev_hotplug) {
+        return;
+    }
+
+    if (!device_realize_times) {
+        device_realize_times = g_array_new(false, false,
+                                           sizeof(DeviceRealizeTime));
+    }
+    if (dev->id) {
+        t.name = g_strdup_printf("%s (%s)", dev->id, type);
+    } else {
+        t.name = g_strdup(type);
+    }
+    t.ns = ns;
+    g_array_append_val(device_realize_times, t);
+}
+
+static gint device_realize_time_cmp(gconstpointer a, gconstpointer b)
+{
+    const DeviceRealizeTime *ta = a, *tb = b;
+
+    return ta->ns < tb->ns ? 1 : ta->ns > tb->ns ? -1 : 0;
+}
+
+void qdev_dump_realize_times(FILE *f, fprintf_function cpu_fprintf)
+{
+    DeviceRealizeTime *t;
+    int64_t total = 0;
+    guint i;
+
+    if (!device_realize_times) {
+        return;
+    }
+
+    g_array_sort(device_realize_times, device_realize_time_cmp);
+    for (i = 0; i < device_realize_times->len; i++) {
+        total += g_array_index(device_realize_times, DeviceRealizeTime, i).ns;
+    }
+    cpu_fprintf(f, "Device realize: %u devices, %" PRId64 " us "
+                "(nested devices counted twice)\n",
+                device_realize_times->len, total / 1000);
+    for (i = 0; i < MIN(device_realize_times->len, REALIZE_TIMES_SHOWN); i++) {
+        t = &g_array_index(device_realize_times, DeviceRealizeTime, i);
+        cpu_fprintf(f, "  %-40s %10" PRId64 " us\n", t->name, t->ns / 1000);
+    }
+}
+
 void qdev_machine_creation_done(void)
 {
     /*
@@ -345,6 +412,16 @@ bool qdev_machine_modified(void)
     return qdev_hot_added || qdev_hot_removed;
 }
 
+/*
+ * Incremented whenever a device is realized or unrealized after machine
+ * creation, so that derived state (e.g. firmware tables) can be cached
+ * until the set of devices changes.
+ */
+unsigned qdev_topology_generation(void)
+{
+    return qdev_topology_gen;
+}
+
 BusState *qdev_get_parent_bus(DeviceState *dev)
 {
     return dev->parent_bus;
@@ -969,6 +1046,7 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
     HotplugHandler *hotplug_ctrl;
     BusState *bus;
     Error *local_err = NULL;
+    int64_t realize_start = 0;
 
     if (dev->hotplugged && !dc->hotpluggable) {
         error_set(errp, QERR_DEVICE_NO_HOTPLUG, object_get_typename(obj));
@@ -986,6 +1064,7 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
             g_free(name);
         }
 
+        realize_start = get_clock();
         if (dc->realize) {
             dc->realize(dev, &local_err);
         }
@@ -1041,7 +1120,13 @@ static void device_set_realized(Object *obj, bool value, Error **errp)
         goto fail;
     }
 
+    if (qdev_hotplug && dev->realized != value) {
+        qdev_topology_gen++;
+    }
     dev->realized = value;
+    if (realize_start) {
+        qdev_record_realize_time(dev, get_clock() - realize_start);
+    }
     return;
 
 child_realize_fail:
@@ -1426,6 +1426,29 @@ void vga_dirty_log_stop(VGACommonState *s)
 /*
  * graphic modes
  */
+/*
+ * Can display listeners read this mode straight from vram?  Otherwise
+ * every dirty line goes through a vga_draw_line conversion.
+ */
+static bool vga_can_share_surface(VGACommonState *s, int depth, bool byteswap)
+{
+    /* pixman wants 32 bit aligned strides */
+    if (s->line_offset % sizeof(uint32_t)) {
+        return false;
+    }
+    switch (depth) {
+    case 32:
+    case 24:
+        return true;
+    case 16:
+    case 15:
+        /* pixman has no byteswapped 15/16 bit formats */
+        return !byteswap;
+    default:
+        return false;
+    }
+}
+
 static void vga_draw_graphic(VGACommonState *s, int full_update)
 {
     DisplaySurface *surface = qemu_console_surface(s->con);
@@ -1484,7 +1507,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         height != s->last_height ||
         s->last_depth != depth ||
         s->last_byteswap != byteswap) {
-        if (depth == 32 || (depth == 16 && !byteswap)) {
+        if (vga_can_share_surface(s, depth, byteswap)) {
             pixman_format_code_t format =
                 qemu_default_pixman_format(depth, !byteswap);
             surface = qemu_create_displaysurface_from(disp_width,
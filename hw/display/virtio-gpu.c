@@ -0,0 +1,929 @@
+/*
+ * Virtio GPU Device
+ *
+ * The guest renders into its own memory and sends explicit transfer and
+ * flush commands for the rectangles it changed.  Display cost is thus
+ * proportional to the damage, and unlike vga/qxl there is no video RAM
+ * whose dirty log has to be fetched from KVM on every refresh.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "qemu/iov.h"
+#include "ui/console.h"
+#include "trace.h"
+#include "hw/virtio/virtio.h"
+#include "hw/virtio/virtio-gpu.h"
+#include "hw/virtio/virtio-bus.h"
+#include "migration/migration.h"
+#include "qemu/error-report.h"
+
+/* Upper bound for the scatter list of one resource backing */
+#define VIRTIO_GPU_MAX_BACKING_ENTRIES 16384
+
+#define VIRTIO_GPU_FILL_CMD(out) do {                                   \
+        size_t s;                                                       \
+        s = iov_to_buf(cmd->elem.out_sg, cmd->elem.out_num, 0,          \
+                       &out, sizeof(out));                              \
+        if (s != sizeof(out)) {                                         \
+            error_report("%s: command size incorrect %zu vs %zu",       \
+                         __func__, s, sizeof(out));                     \
+            cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;                    \
+            return;                                                     \
+        }                                                               \
+    } while (0)
+
+struct virtio_gpu_ctrl_command {
+    VirtQueueElement elem;
+    VirtQueue *vq;
+    struct virtio_gpu_ctrl_hdr cmd_hdr;
+    uint32_t error;
+    bool finished;
+};
+
+static struct virtio_gpu_simple_resource *
+virtio_gpu_find_resource(VirtIOGPU *g, uint32_t resource_id)
+{
+    struct virtio_gpu_simple_resource *res;
+
+    QTAILQ_FOREACH(res, &g->reslist, next) {
+        if (res->resource_id == resource_id) {
+            return res;
+        }
+    }
+    return NULL;
+}
+
+static void virtio_gpu_ctrl_response(VirtIOGPU *g,
+                                     struct virtio_gpu_ctrl_command *cmd,
+                                     struct virtio_gpu_ctrl_hdr *resp,
+                                     size_t resp_len)
+{
+    size_t s;
+
+    if (cmd->cmd_hdr.flags & VIRTIO_GPU_FLAG_FENCE) {
+        /* commands complete synchronously, so the fence is signalled now */
+        resp->flags |= cpu_to_le32(VIRTIO_GPU_FLAG_FENCE);
+        resp->fence_id = cpu_to_le64(cmd->cmd_hdr.fence_id);
+        resp->ctx_id = cpu_to_le32(cmd->cmd_hdr.ctx_id);
+    }
+    s = iov_from_buf(cmd->elem.in_sg, cmd->elem.in_num, 0, resp, resp_len);
+    if (s != resp_len) {
+        error_report("%s: response size incorrect %zu vs %zu",
+                     __func__, s, resp_len);
+    }
+    virtqueue_push(cmd->vq, &cmd->elem, s);
+    virtio_notify(VIRTIO_DEVICE(g), cmd->vq);
+    cmd->finished = true;
+}
+
+static void virtio_gpu_ctrl_response_nodata(VirtIOGPU *g,
+                                            struct virtio_gpu_ctrl_command *cmd,
+                                            uint32_t type)
+{
+    struct virtio_gpu_ctrl_hdr resp;
+
+    memset(&resp, 0, sizeof(resp));
+    resp.type = cpu_to_le32(type);
+    virtio_gpu_ctrl_response(g, cmd, &resp, sizeof(resp));
+}
+
+static void virtio_gpu_get_display_info(VirtIOGPU *g,
+                                        struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_resp_display_info display_info;
+    int i;
+
+    trace_virtio_gpu_cmd_get_display_info();
+    memset(&display_info, 0, sizeof(display_info));
+    display_info.hdr.type = cpu_to_le32(VIRTIO_GPU_RESP_OK_DISPLAY_INFO);
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        if (g->enabled_output_bitmask & (1 << i)) {
+            display_info.pmodes[i].enabled = cpu_to_le32(1);
+            display_info.pmodes[i].r.width =
+                cpu_to_le32(g->req_state[i].width);
+            display_info.pmodes[i].r.height =
+                cpu_to_le32(g->req_state[i].height);
+        }
+    }
+    virtio_gpu_ctrl_response(g, cmd, &display_info.hdr,
+                             sizeof(display_info));
+}
+
+static pixman_format_code_t virtio_gpu_get_pixman_format(uint32_t format)
+{
+    switch (format) {
+#ifdef HOST_WORDS_BIGENDIAN
+    case VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM:
+        return PIXMAN_b8g8r8x8;
+    case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
+        return PIXMAN_b8g8r8a8;
+    case VIRTIO_GPU_FORMAT_X8R8G8B8_UNORM:
+        return PIXMAN_x8r8g8b8;
+    case VIRTIO_GPU_FORMAT_A8R8G8B8_UNORM:
+        return PIXMAN_a8r8g8b8;
+    case VIRTIO_GPU_FORMAT_X8B8G8R8_UNORM:
+        return PIXMAN_x8b8g8r8;
+    case VIRTIO_GPU_FORMAT_A8B8G8R8_UNORM:
+        return PIXMAN_a8b8g8r8;
+#if PIXMAN_VERSION >= PIXMAN_VERSION_ENCODE(0, 27, 2)
+    case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
+        return PIXMAN_r8g8b8x8;
+    case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
+        return PIXMAN_r8g8b8a8;
+#endif
+#else
+    case VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM:
+        return PIXMAN_x8r8g8b8;
+    case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
+        return PIXMAN_a8r8g8b8;
+    case VIRTIO_GPU_FORMAT_X8R8G8B8_UNORM:
+        return PIXMAN_b8g8r8x8;
+    case VIRTIO_GPU_FORMAT_A8R8G8B8_UNORM:
+        return PIXMAN_b8g8r8a8;
+    case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
+        return PIXMAN_x8b8g8r8;
+    case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
+        return PIXMAN_a8b8g8r8;
+#if PIXMAN_VERSION >= PIXMAN_VERSION_ENCODE(0, 27, 2)
+    case VIRTIO_GPU_FORMAT_X8B8G8R8_UNORM:
+        return PIXMAN_r8g8b8x8;
+    case VIRTIO_GPU_FORMAT_A8B8G8R8_UNORM:
+        return PIXMAN_r8g8b8a8;
+#endif
+#endif
+    default:
+        return 0;
+    }
+}
+
+static void virtio_gpu_resource_create_2d(VirtIOGPU *g,
+                                          struct virtio_gpu_ctrl_command *cmd)
+{
+    pixman_format_code_t pformat;
+    struct virtio_gpu_simple_resource *res;
+    struct virtio_gpu_resource_create_2d c2d;
+    uint64_t hostmem;
+
+    VIRTIO_GPU_FILL_CMD(c2d);
+    c2d.resource_id = le32_to_cpu(c2d.resource_id);
+    c2d.format = le32_to_cpu(c2d.format);
+    c2d.width = le32_to_cpu(c2d.width);
+    c2d.height = le32_to_cpu(c2d.height);
+    trace_virtio_gpu_cmd_res_create_2d(c2d.resource_id, c2d.format,
+                                       c2d.width, c2d.height);
+
+    if (c2d.resource_id == 0) {
+        error_report("%s: resource id 0 is not allowed", __func__);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    if (virtio_gpu_find_resource(g, c2d.resource_id)) {
+        error_report("%s: resource already exists %d",
+                     __func__, c2d.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    pformat = virtio_gpu_get_pixman_format(c2d.format);
+    if (!pformat) {
+        error_report("%s: host couldn't handle guest format %d",
+                     __func__, c2d.format);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
+    /* all supported formats are 32 bpp */
+    hostmem = (uint64_t)c2d.width * c2d.height * 4;
+    if (c2d.width == 0 || c2d.height == 0 ||
+        g->hostmem + hostmem > g->conf.max_hostmem) {
+        error_report("%s: can't create %dx%d resource, %" PRIu64
+                     " bytes of host memory in use", __func__,
+                     c2d.width, c2d.height, g->hostmem);
+        cmd->error = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
+        return;
+    }
+
+    res = g_new0(struct virtio_gpu_simple_resource, 1);
+    res->width = c2d.width;
+    res->height = c2d.height;
+    res->format = c2d.format;
+    res->resource_id = c2d.resource_id;
+    res->hostmem = hostmem;
+    res->image = pixman_image_create_bits(pformat, c2d.width, c2d.height,
+                                          NULL, 0);
+    if (!res->image) {
+        error_report("%s: resource creation failed %d %d %d",
+                     __func__, c2d.resource_id, c2d.width, c2d.height);
+        g_free(res);
+        cmd->error = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
+        return;
+    }
+
+    g->hostmem += res->hostmem;
+    QTAILQ_INSERT_HEAD(&g->reslist, res, next);
+}
+
+static DisplaySurface *virtio_gpu_blank_surface(struct virtio_gpu_scanout *s)
+{
+    return qemu_create_displaysurface(s->width ? s->width : 640,
+                                      s->height ? s->height : 480);
+}
+
+static void virtio_gpu_disable_scanout(VirtIOGPU *g, int scanout_id)
+{
+    struct virtio_gpu_scanout *scanout = &g->scanout[scanout_id];
+    struct virtio_gpu_simple_resource *res;
+
+    if (scanout->resource_id == 0) {
+        return;
+    }
+
+    res = virtio_gpu_find_resource(g, scanout->resource_id);
+    if (res) {
+        res->scanout_bitmask &= ~(1 << scanout_id);
+    }
+
+    /* the old surface points into the resource image, replace it */
+    scanout->ds = virtio_gpu_blank_surface(scanout);
+    dpy_gfx_replace_surface(scanout->con, scanout->ds);
+    scanout->resource_id = 0;
+    scanout->width = 0;
+    scanout->height = 0;
+}
+
+static void virtio_gpu_cleanup_mapping_iov(struct iovec *iov, unsigned int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        cpu_physical_memory_unmap(iov[i].iov_base, iov[i].iov_len, 0,
+                                  iov[i].iov_len);
+    }
+    g_free(iov);
+}
+
+static void virtio_gpu_cleanup_mapping(struct virtio_gpu_simple_resource *res)
+{
+    virtio_gpu_cleanup_mapping_iov(res->iov, res->iov_cnt);
+    res->iov = NULL;
+    res->iov_cnt = 0;
+}
+
+static void virtio_gpu_resource_destroy(VirtIOGPU *g,
+                                        struct virtio_gpu_simple_resource *res)
+{
+    int i;
+
+    if (res->scanout_bitmask) {
+        for (i = 0; i < g->conf.max_outputs; i++) {
+            if (res->scanout_bitmask & (1 << i)) {
+                virtio_gpu_disable_scanout(g, i);
+            }
+        }
+    }
+
+    pixman_image_unref(res->image);
+    virtio_gpu_cleanup_mapping(res);
+    QTAILQ_REMOVE(&g->reslist, res, next);
+    g->hostmem -= res->hostmem;
+    g_free(res);
+}
+
+static void virtio_gpu_resource_unref(VirtIOGPU *g,
+                                      struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_simple_resource *res;
+    struct virtio_gpu_resource_unref unref;
+
+    VIRTIO_GPU_FILL_CMD(unref);
+    unref.resource_id = le32_to_cpu(unref.resource_id);
+    trace_virtio_gpu_cmd_res_unref(unref.resource_id);
+
+    res = virtio_gpu_find_resource(g, unref.resource_id);
+    if (!res) {
+        error_report("%s: illegal resource specified %d",
+                     __func__, unref.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+    virtio_gpu_resource_destroy(g, res);
+}
+
+static bool virtio_gpu_rect_valid(struct virtio_gpu_rect *r,
+                                  uint32_t width, uint32_t height)
+{
+    return r->x <= width && r->y <= height &&
+           r->width <= width - r->x && r->height <= height - r->y;
+}
+
+static void virtio_gpu_rect_to_cpu(struct virtio_gpu_rect *r)
+{
+    r->x = le32_to_cpu(r->x);
+    r->y = le32_to_cpu(r->y);
+    r->width = le32_to_cpu(r->width);
+    r->height = le32_to_cpu(r->height);
+}
+
+static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
+                                           struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_simple_resource *res;
+    int h;
+    uint32_t src_offset, dst_offset, stride;
+    int bpp;
+    pixman_format_code_t format;
+    struct virtio_gpu_transfer_to_host_2d t2d;
+    uint8_t *img_data;
+
+    VIRTIO_GPU_FILL_CMD(t2d);
+    virtio_gpu_rect_to_cpu(&t2d.r);
+    t2d.offset = le64_to_cpu(t2d.offset);
+    t2d.resource_id = le32_to_cpu(t2d.resource_id);
+    trace_virtio_gpu_cmd_res_xfer_toh_2d(t2d.resource_id, t2d.r.x, t2d.r.y,
+                                         t2d.r.width, t2d.r.height);
+
+    res = virtio_gpu_find_resource(g, t2d.resource_id);
+    if (!res || !res->iov) {
+        error_report("%s: illegal resource specified %d",
+                     __func__, t2d.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    if (!virtio_gpu_rect_valid(&t2d.r, res->width, res->height)) {
+        error_report("%s: transfer bounds outside resource"
+                     " bounds for resource %d: %d %d %d %d vs %d %d",
+                     __func__, t2d.resource_id, t2d.r.x, t2d.r.y,
+                     t2d.r.width, t2d.r.height, res->width, res->height);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
+    format = pixman_image_get_format(res->image);
+    bpp = (PIXMAN_FORMAT_BPP(format) + 7) / 8;
+    stride = pixman_image_get_stride(res->image);
+    img_data = (uint8_t *)pixman_image_get_data(res->image);
+
+    if (t2d.offset || t2d.r.x || t2d.r.y ||
+        t2d.r.width != pixman_image_get_width(res->image)) {
+        for (h = 0; h < t2d.r.height; h++) {
+            src_offset = t2d.offset + stride * h;
+            dst_offset = (t2d.r.y + h) * stride + (t2d.r.x * bpp);
+
+            iov_to_buf(res->iov, res->iov_cnt, src_offset,
+                       img_data + dst_offset, t2d.r.width * bpp);
+        }
+    } else {
+        /* full-width rows from offset 0 are contiguous on both sides */
+        iov_to_buf(res->iov, res->iov_cnt, 0, img_data,
+                   stride * t2d.r.height);
+    }
+}
+
+static void virtio_gpu_resource_flush(VirtIOGPU *g,
+                                      struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_simple_resource *res;
+    struct virtio_gpu_resource_flush rf;
+    struct virtio_gpu_scanout *scanout;
+    int i, x1, y1, x2, y2;
+
+    VIRTIO_GPU_FILL_CMD(rf);
+    virtio_gpu_rect_to_cpu(&rf.r);
+    rf.resource_id = le32_to_cpu(rf.resource_id);
+    trace_virtio_gpu_cmd_res_flush(rf.resource_id,
+                                   rf.r.width, rf.r.height, rf.r.x, rf.r.y);
+
+    res = virtio_gpu_find_resource(g, rf.resource_id);
+    if (!res) {
+        error_report("%s: illegal resource specified %d",
+                     __func__, rf.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    if (!virtio_gpu_rect_valid(&rf.r, res->width, res->height)) {
+        error_report("%s: flush bounds outside resource"
+                     " bounds for resource %d: %d %d %d %d vs %d %d",
+                     __func__, rf.resource_id, rf.r.x, rf.r.y,
+                     rf.r.width, rf.r.height, res->width, res->height);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
+    /* only the part of the flushed area that a scanout shows is updated */
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        if (!(res->scanout_bitmask & (1 << i))) {
+            continue;
+        }
+        scanout = &g->scanout[i];
+        x1 = MAX((int)rf.r.x, scanout->x);
+        y1 = MAX((int)rf.r.y, scanout->y);
+        x2 = MIN((int)(rf.r.x + rf.r.width), scanout->x + scanout->width);
+        y2 = MIN((int)(rf.r.y + rf.r.height), scanout->y + scanout->height);
+        if (x1 >= x2 || y1 >= y2) {
+            continue;
+        }
+        dpy_gfx_update(scanout->con, x1 - scanout->x, y1 - scanout->y,
+                       x2 - x1, y2 - y1);
+    }
+}
+
+static void virtio_gpu_set_scanout(VirtIOGPU *g,
+                                   struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_simple_resource *res, *ores;
+    struct virtio_gpu_scanout *scanout;
+    pixman_format_code_t format;
+    uint32_t offset;
+    int bpp;
+    struct virtio_gpu_set_scanout ss;
+
+    VIRTIO_GPU_FILL_CMD(ss);
+    virtio_gpu_rect_to_cpu(&ss.r);
+    ss.scanout_id = le32_to_cpu(ss.scanout_id);
+    ss.resource_id = le32_to_cpu(ss.resource_id);
+    trace_virtio_gpu_cmd_set_scanout(ss.scanout_id, ss.resource_id,
+                                     ss.r.width, ss.r.height, ss.r.x, ss.r.y);
+
+    if (ss.scanout_id >= g->conf.max_outputs) {
+        error_report("%s: illegal scanout id specified %d",
+                     __func__, ss.scanout_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_SCANOUT_ID;
+        return;
+    }
+
+    if (ss.resource_id == 0) {
+        virtio_gpu_disable_scanout(g, ss.scanout_id);
+        return;
+    }
+
+    /* create a surface for this scanout */
+    res = virtio_gpu_find_resource(g, ss.resource_id);
+    if (!res) {
+        error_report("%s: illegal resource specified %d",
+                     __func__, ss.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    if (ss.r.width == 0 || ss.r.height == 0 ||
+        !virtio_gpu_rect_valid(&ss.r, res->width, res->height)) {
+        error_report("%s: illegal scanout %d bounds for"
+                     " resource %d, (%d,%d)+%d,%d vs %d %d",
+                     __func__, ss.scanout_id, ss.resource_id, ss.r.x, ss.r.y,
+                     ss.r.width, ss.r.height, res->width, res->height);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        return;
+    }
+
+    scanout = &g->scanout[ss.scanout_id];
+
+    format = pixman_image_get_format(res->image);
+    bpp = (PIXMAN_FORMAT_BPP(format) + 7) / 8;
+    offset = (ss.r.x * bpp) + ss.r.y * pixman_image_get_stride(res->image);
+    if (!scanout->ds || surface_data(scanout->ds)
+        != ((uint8_t *)pixman_image_get_data(res->image) + offset) ||
+        scanout->width != ss.r.width ||
+        scanout->height != ss.r.height) {
+        /* realloc the surface ptr */
+        scanout->ds = qemu_create_displaysurface_from
+            (ss.r.width, ss.r.height, format,
+             pixman_image_get_stride(res->image),
+             (uint8_t *)pixman_image_get_data(res->image) + offset);
+        dpy_gfx_replace_surface(scanout->con, scanout->ds);
+    }
+
+    ores = virtio_gpu_find_resource(g, scanout->resource_id);
+    if (ores) {
+        ores->scanout_bitmask &= ~(1 << ss.scanout_id);
+    }
+
+    res->scanout_bitmask |= (1 << ss.scanout_id);
+    scanout->resource_id = ss.resource_id;
+    scanout->x = ss.r.x;
+    scanout->y = ss.r.y;
+    scanout->width = ss.r.width;
+    scanout->height = ss.r.height;
+}
+
+static int virtio_gpu_create_mapping_iov(struct virtio_gpu_resource_attach_backing *ab,
+                                         struct virtio_gpu_ctrl_command *cmd,
+                                         struct iovec **iov)
+{
+    struct virtio_gpu_mem_entry *ents;
+    size_t esize, s;
+    int i;
+
+    if (ab->nr_entries > VIRTIO_GPU_MAX_BACKING_ENTRIES) {
+        error_report("%s: nr_entries is too big (%d > %d)",
+                     __func__, ab->nr_entries, VIRTIO_GPU_MAX_BACKING_ENTRIES);
+        return -1;
+    }
+
+    esize = sizeof(*ents) * ab->nr_entries;
+    ents = g_malloc(esize);
+    s = iov_to_buf(cmd->elem.out_sg, cmd->elem.out_num,
+                   sizeof(*ab), ents, esize);
+    if (s != esize) {
+        error_report("%s: command data size incorrect %zu vs %zu",
+                     __func__, s, esize);
+        g_free(ents);
+        return -1;
+    }
+
+    *iov = g_new0(struct iovec, ab->nr_entries);
+    for (i = 0; i < ab->nr_entries; i++) {
+        hwaddr a = le64_to_cpu(ents[i].addr);
+        hwaddr l = le32_to_cpu(ents[i].length);
+
+        (*iov)[i].iov_len = l;
+        (*iov)[i].iov_base = cpu_physical_memory_map(a, &l, 0);
+        if (!(*iov)[i].iov_base || l != (*iov)[i].iov_len) {
+            error_report("%s: failed to map MMIO memory for"
+                         " resource %d element %d",
+                         __func__, ab->resource_id, i);
+            if ((*iov)[i].iov_base) {
+                cpu_physical_memory_unmap((*iov)[i].iov_base, l, 0, 0);
+            }
+            virtio_gpu_cleanup_mapping_iov(*iov, i);
+            g_free(ents);
+            *iov = NULL;
+            return -1;
+        }
+    }
+    g_free(ents);
+    return 0;
+}
+
+static void virtio_gpu_resource_attach_backing(VirtIOGPU *g,
+                                               struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_simple_resource *res;
+    struct virtio_gpu_resource_attach_backing ab;
+    int ret;
+
+    VIRTIO_GPU_FILL_CMD(ab);
+    ab.resource_id = le32_to_cpu(ab.resource_id);
+    ab.nr_entries = le32_to_cpu(ab.nr_entries);
+    trace_virtio_gpu_cmd_res_back_attach(ab.resource_id);
+
+    res = virtio_gpu_find_resource(g, ab.resource_id);
+    if (!res) {
+        error_report("%s: illegal resource specified %d",
+                     __func__, ab.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+
+    if (res->iov) {
+        error_report("%s: resource %d already has backing",
+                     __func__, ab.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
+        return;
+    }
+
+    ret = virtio_gpu_create_mapping_iov(&ab, cmd, &res->iov);
+    if (ret != 0) {
+        cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
+        return;
+    }
+
+    res->iov_cnt = ab.nr_entries;
+}
+
+static void virtio_gpu_resource_detach_backing(VirtIOGPU *g,
+                                               struct virtio_gpu_ctrl_command *cmd)
+{
+    struct virtio_gpu_simple_resource *res;
+    struct virtio_gpu_resource_detach_backing detach;
+
+    VIRTIO_GPU_FILL_CMD(detach);
+    detach.resource_id = le32_to_cpu(detach.resource_id);
+    trace_virtio_gpu_cmd_res_back_detach(detach.resource_id);
+
+    res = virtio_gpu_find_resource(g, detach.resource_id);
+    if (!res || !res->iov) {
+        error_report("%s: illegal resource specified %d",
+                     __func__, detach.resource_id);
+        cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        return;
+    }
+    virtio_gpu_cleanup_mapping(res);
+}
+
+static void virtio_gpu_simple_process_cmd(VirtIOGPU *g,
+                                          struct virtio_gpu_ctrl_command *cmd)
+{
+    VIRTIO_GPU_FILL_CMD(cmd->cmd_hdr);
+    cmd->cmd_hdr.type = le32_to_cpu(cmd->cmd_hdr.type);
+    cmd->cmd_hdr.flags = le32_to_cpu(cmd->cmd_hdr.flags);
+    cmd->cmd_hdr.fence_id = le64_to_cpu(cmd->cmd_hdr.fence_id);
+    cmd->cmd_hdr.ctx_id = le32_to_cpu(cmd->cmd_hdr.ctx_id);
+
+    switch (cmd->cmd_hdr.type) {
+    case VIRTIO_GPU_CMD_GET_DISPLAY_INFO:
+        virtio_gpu_get_display_info(g, cmd);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_CREATE_2D:
+        virtio_gpu_resource_create_2d(g, cmd);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_UNREF:
+        virtio_gpu_resource_unref(g, cmd);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_FLUSH:
+        virtio_gpu_resource_flush(g, cmd);
+        break;
+    case VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D:
+        virtio_gpu_transfer_to_host_2d(g, cmd);
+        break;
+    case VIRTIO_GPU_CMD_SET_SCANOUT:
+        virtio_gpu_set_scanout(g, cmd);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING:
+        virtio_gpu_resource_attach_backing(g, cmd);
+        break;
+    case VIRTIO_GPU_CMD_RESOURCE_DETACH_BACKING:
+        virtio_gpu_resource_detach_backing(g, cmd);
+        break;
+    default:
+        cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
+        break;
+    }
+}
+
+static void virtio_gpu_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIOGPU *g = VIRTIO_GPU(vdev);
+    struct virtio_gpu_ctrl_command cmd;
+
+    for (;;) {
+        memset(&cmd, 0, sizeof(cmd));
+        if (!virtqueue_pop(vq, &cmd.elem)) {
+            break;
+        }
+        cmd.vq = vq;
+
+        virtio_gpu_simple_process_cmd(g, &cmd);
+        if (!cmd.finished) {
+            virtio_gpu_ctrl_response_nodata(g, &cmd, cmd.error ? cmd.error :
+                                            VIRTIO_GPU_RESP_OK_NODATA);
+        }
+    }
+}
+
+static void virtio_gpu_update_cursor(VirtIOGPU *g,
+                                     struct virtio_gpu_update_cursor *cursor)
+{
+    struct virtio_gpu_scanout *s;
+    struct virtio_gpu_simple_resource *res;
+    QEMUCursor *c;
+    uint32_t scanout_id = le32_to_cpu(cursor->pos.scanout_id);
+    uint32_t type = le32_to_cpu(cursor->hdr.type);
+    uint32_t resource_id = le32_to_cpu(cursor->resource_id);
+    int x = le32_to_cpu(cursor->pos.x);
+    int y = le32_to_cpu(cursor->pos.y);
+
+    if (scanout_id >= g->conf.max_outputs) {
+        return;
+    }
+    s = &g->scanout[scanout_id];
+
+    trace_virtio_gpu_update_cursor(scanout_id, x, y,
+                                   type == VIRTIO_GPU_CMD_MOVE_CURSOR ?
+                                   "move" : "update", resource_id);
+
+    if (type == VIRTIO_GPU_CMD_UPDATE_CURSOR && resource_id) {
+        res = virtio_gpu_find_resource(g, resource_id);
+        if (!res || !dpy_cursor_define_supported(s->con)) {
+            return;
+        }
+        /* the cursor image is kept in the resource as 32 bpp ARGB */
+        c = cursor_alloc(res->width, res->height);
+        c->hot_x = le32_to_cpu(cursor->hot_x);
+        c->hot_y = le32_to_cpu(cursor->hot_y);
+        memcpy(c->data, pixman_image_get_data(res->image),
+               res->width * res->height * sizeof(uint32_t));
+        dpy_cursor_define(s->con, c);
+        cursor_put(c);
+    }
+    dpy_mouse_set(s->con, x, y,
+                  type == VIRTIO_GPU_CMD_MOVE_CURSOR || resource_id);
+}
+
+static void virtio_gpu_handle_cursor(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIOGPU *g = VIRTIO_GPU(vdev);
+    VirtQueueElement elem;
+    size_t s;
+    struct virtio_gpu_update_cursor cursor_info;
+
+    while (virtqueue_pop(vq, &elem)) {
+        s = iov_to_buf(elem.out_sg, elem.out_num, 0,
+                       &cursor_info, sizeof(cursor_info));
+        if (s != sizeof(cursor_info)) {
+            error_report("%s: cursor size incorrect %zu vs %zu",
+                         __func__, s, sizeof(cursor_info));
+        } else {
+            virtio_gpu_update_cursor(g, &cursor_info);
+        }
+        virtqueue_push(vq, &elem, 0);
+    }
+    virtio_notify(vdev, vq);
+}
+
+static void virtio_gpu_invalidate_display(void *opaque)
+{
+    VirtIOGPU *g = opaque;
+    int i;
+
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        g->scanout[i].invalidate = true;
+    }
+}
+
+/*
+ * Called from the display refresh timer.  Content updates are pushed by
+ * RESOURCE_FLUSH, so there is nothing to poll; only full redraws asked
+ * for by the UI are handled here.
+ */
+static void virtio_gpu_update_display(void *opaque)
+{
+    VirtIOGPU *g = opaque;
+    struct virtio_gpu_scanout *s;
+    int i;
+
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        s = &g->scanout[i];
+        if (!s->invalidate) {
+            continue;
+        }
+        s->invalidate = false;
+        if (s->resource_id) {
+            dpy_gfx_update(s->con, 0, 0, s->width, s->height);
+        }
+    }
+}
+
+static int virtio_gpu_ui_info(void *opaque, uint32_t idx, QemuUIInfo *info)
+{
+    VirtIOGPU *g = opaque;
+
+    if (idx >= g->conf.max_outputs) {
+        return -1;
+    }
+
+    g->req_state[idx].x = info->xoff;
+    g->req_state[idx].y = info->yoff;
+    g->req_state[idx].width = info->width;
+    g->req_state[idx].height = info->height;
+
+    if (info->width && info->height) {
+        g->enabled_output_bitmask |= (1 << idx);
+    } else {
+        g->enabled_output_bitmask &= ~(1 << idx);
+    }
+
+    /* send event to guest */
+    g->virtio_config.events_read |= VIRTIO_GPU_EVENT_DISPLAY;
+    virtio_notify_config(VIRTIO_DEVICE(g));
+    return 0;
+}
+
+static const GraphicHwOps virtio_gpu_ops = {
+    .invalidate = virtio_gpu_invalidate_display,
+    .gfx_update = virtio_gpu_update_display,
+    .ui_info = virtio_gpu_ui_info,
+};
+
+static void virtio_gpu_get_config(VirtIODevice *vdev, uint8_t *config)
+{
+    VirtIOGPU *g = VIRTIO_GPU(vdev);
+    struct virtio_gpu_config vgconfig;
+
+    vgconfig.events_read = cpu_to_le32(g->virtio_config.events_read);
+    vgconfig.events_clear = cpu_to_le32(g->virtio_config.events_clear);
+    vgconfig.num_scanouts = cpu_to_le32(g->virtio_config.num_scanouts);
+    vgconfig.reserved = 0;
+    memcpy(config, &vgconfig, sizeof(vgconfig));
+}
+
+static void virtio_gpu_set_config(VirtIODevice *vdev, const uint8_t *config)
+{
+    VirtIOGPU *g = VIRTIO_GPU(vdev);
+    struct virtio_gpu_config vgconfig;
+
+    memcpy(&vgconfig, config, sizeof(vgconfig));
+    if (vgconfig.events_clear) {
+        g->virtio_config.events_read &= ~le32_to_cpu(vgconfig.events_clear);
+    }
+}
+
+static uint32_t virtio_gpu_get_features(VirtIODevice *vdev, uint32_t features)
+{
+    return features;
+}
+
+static void virtio_gpu_reset(VirtIODevice *vdev)
+{
+    VirtIOGPU *g = VIRTIO_GPU(vdev);
+    struct virtio_gpu_simple_resource *res, *tmp;
+    int i;
+
+    QTAILQ_FOREACH_SAFE(res, &g->reslist, next, tmp) {
+        virtio_gpu_resource_destroy(g, res);
+    }
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        g->scanout[i].resource_id = 0;
+        g->scanout[i].width = 0;
+        g->scanout[i].height = 0;
+        g->scanout[i].x = 0;
+        g->scanout[i].y = 0;
+    }
+    g->virtio_config.events_read = 0;
+}
+
+static void virtio_gpu_device_realize(DeviceState *qdev, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(qdev);
+    VirtIOGPU *g = VIRTIO_GPU(qdev);
+    int i;
+
+    if (g->conf.max_outputs == 0 ||
+        g->conf.max_outputs > VIRTIO_GPU_MAX_SCANOUTS) {
+        error_setg(errp, "'max_outputs' must be between 1 and %d",
+                   VIRTIO_GPU_MAX_SCANOUTS);
+        return;
+    }
+
+    virtio_init(vdev, "virtio-gpu", VIRTIO_ID_GPU,
+                sizeof(struct virtio_gpu_config));
+
+    g->virtio_config.num_scanouts = g->conf.max_outputs;
+    QTAILQ_INIT(&g->reslist);
+
+    g->ctrl_vq = virtio_add_queue(vdev, 256, virtio_gpu_handle_ctrl);
+    g->cursor_vq = virtio_add_queue(vdev, 16, virtio_gpu_handle_cursor);
+
+    g->enabled_output_bitmask = 1;
+    g->req_state[0].width = 1024;
+    g->req_state[0].height = 768;
+
+    for (i = 0; i < g->conf.max_outputs; i++) {
+        g->scanout[i].con = graphic_console_init(DEVICE(g), i,
+                                                 &virtio_gpu_ops, g);
+    }
+
+    /* resources live in host memory and aren't migrated yet */
+    error_setg(&g->migration_blocker, "virtio-gpu does not support migration");
+    migrate_add_blocker(g->migration_blocker);
+}
+
+static void virtio_gpu_device_unrealize(DeviceState *qdev, Error **errp)
+{
+    VirtIOGPU *g = VIRTIO_GPU(qdev);
+
+    migrate_del_blocker(g->migration_blocker);
+    error_free(g->migration_blocker);
+    virtio_cleanup(VIRTIO_DEVICE(qdev));
+}
+
+static Property virtio_gpu_properties[] = {
+    DEFINE_VIRTIO_GPU_PROPERTIES(VirtIOGPU, conf),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void virtio_gpu_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    VirtioDeviceClass *vdc = VIRTIO_DEVICE_CLASS(klass);
+
+    vdc->realize = virtio_gpu_device_realize;
+    vdc->unrealize = virtio_gpu_device_unrealize;
+    vdc->get_config = virtio_gpu_get_config;
+    vdc->set_config = virtio_gpu_set_config;
+    vdc->get_features = virtio_gpu_get_features;
+    vdc->reset = virtio_gpu_reset;
+
+    dc->props = virtio_gpu_properties;
+    set_bit(DEVICE_CATEGORY_DISPLAY, dc->categories);
+}
+
+static const TypeInfo virtio_gpu_info = {
+    .name = TYPE_VIRTIO_GPU,
+    .parent = TYPE_VIRTIO_DEVICE,
+    .instance_size = sizeof(VirtIOGPU),
+    .class_init = virtio_gpu_class_init,
+};
+
+static void virtio_register_types(void)
+{
+    type_register_static(&virtio_gpu_info);
+}
+
+type_init(virtio_register_types)
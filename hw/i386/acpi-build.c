@@ -57,6 +57,8 @@
 #include "qapi/qmp/qint.h"
 #include "qom/qom-qobject.h"
 #include "exec/ram_addr.h"
+#include "qemu/timer.h"
+#include "trace.h"
 
 /* These are used to size the ACPI tables for -M pc-i440fx-1.7 and
  * -M pc-i440fx-2.0.  Even if the actual amount of AML generated grows
@@ -1504,6 +1506,21 @@ static inline void acpi_build_tables_cleanup(AcpiBuildTables *tables, bool mfre)
     g_array_free(tables->tcpalog, mfre);
 }
 
+/*
+ * Everything acpi_build() reads from the machine that can change after
+ * acpi_setup(): hotplugged CPUs and devices, and PCI/MMCONFIG windows
+ * that the firmware programs.  The rest of its input is fixed at startup.
+ */
+typedef struct AcpiBuildInputs {
+    AcpiCpuInfo cpu;
+    AcpiPmInfo pm;
+    AcpiMiscInfo misc;
+    PcPciInfo pci;
+    AcpiMcfgInfo mcfg;
+    bool has_mcfg;
+    unsigned topology_generation;
+} AcpiBuildInputs;
+
 typedef
 struct AcpiBuildState {
     /* Copy of table in RAM (for patching). */
@@ -1512,6 +1529,9 @@ struct AcpiBuildState {
     /* Is table patched? */
     uint8_t patched;
     PcGuestInfo *guest_info;
+    /* Inputs the tables in table_ram were built from, if known */
+    AcpiBuildInputs inputs;
+    bool inputs_valid;
 } AcpiBuildState;
 
 static bool acpi_get_mcfg(AcpiMcfgInfo *mcfg)
@@ -1696,10 +1716,23 @@ void acpi_build(PcGuestInfo *guest_info, AcpiBuildTables *tables)
     g_array_free(table_offsets, true);
 }
 
+static void acpi_build_get_inputs(AcpiBuildInputs *inputs)
+{
+    memset(inputs, 0, sizeof *inputs);
+    acpi_get_cpu_info(&inputs->cpu);
+    acpi_get_pm_info(&inputs->pm);
+    acpi_get_misc_info(&inputs->misc);
+    acpi_get_pci_info(&inputs->pci);
+    inputs->has_mcfg = acpi_get_mcfg(&inputs->mcfg);
+    inputs->topology_generation = qdev_topology_generation();
+}
+
 static void acpi_build_update(void *build_opaque, uint32_t offset)
 {
     AcpiBuildState *build_state = build_opaque;
     AcpiBuildTables tables;
+    AcpiBuildInputs inputs;
+    int64_t start;
 
     /* No state to update or already patched? Nothing to do. */
     if (!build_state || build_state->patched) {
@@ -1707,6 +1740,19 @@ static void acpi_build_update(void *build_opaque, uint32_t offset)
     }
     build_state->patched = 1;
 
+    /*
+     * The tables in RAM survive reset, so after a reboot with no hotplug
+     * in between they are usually still up to date.  Regenerating the AML
+     * is expensive with many CPUs and PCI bridges; skip it in that case.
+     */
+    acpi_build_get_inputs(&inputs);
+    if (build_state->inputs_valid &&
+        !memcmp(&inputs, &build_state->inputs, sizeof inputs)) {
+        trace_acpi_build_cached(build_state->table_size);
+        return;
+    }
+
+    start = get_clock();
     acpi_build_tables_init(&tables);
 
     acpi_build(build_state->guest_info, &tables);
@@ -1719,6 +1765,10 @@ static void acpi_build_update(void *build_opaque, uint32_t offset)
                                                build_state->table_size);
 
     acpi_build_tables_cleanup(&tables, true);
+
+    build_state->inputs = inputs;
+    build_state->inputs_valid = true;
+    trace_acpi_build_done(build_state->table_size, get_clock() - start);
 }
 
 static void acpi_build_reset(void *build_opaque)
@@ -1734,10 +1784,20 @@ static ram_addr_t acpi_add_rom_blob(AcpiBuildState *build_state, GArray *blob,
                         acpi_build_update, build_state);
 }
 
+static int acpi_build_post_load(void *opaque, int version_id)
+{
+    AcpiBuildState *build_state = opaque;
+
+    /* table_ram now holds tables built by the source from its own state */
+    build_state->inputs_valid = false;
+    return 0;
+}
+
 static const VMStateDescription vmstate_acpi_build = {
     .name = "acpi_build",
     .version_id = 1,
     .minimum_version_id = 1,
+    .post_load = acpi_build_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_UINT8(patched, AcpiBuildState),
         VMSTATE_END_OF_LIST()
@@ -1748,6 +1808,7 @@ void acpi_setup(PcGuestInfo *guest_info)
 {
     AcpiBuildTables tables;
     AcpiBuildState *build_state;
+    int64_t start;
 
     if (!guest_info->fw_cfg) {
         ACPI_BUILD_DPRINTF(3, "No fw cfg. Bailing out.\n");
@@ -1770,6 +1831,9 @@ void acpi_setup(PcGuestInfo *guest_info)
 
     acpi_set_pci_info();
 
+    start = get_clock();
+    acpi_build_get_inputs(&build_state->inputs);
+    build_state->inputs_valid = true;
     acpi_build_tables_init(&tables);
     acpi_build(build_state->guest_info, &tables);
 
@@ -1778,6 +1842,7 @@ void acpi_setup(PcGuestInfo *guest_info)
                                                ACPI_BUILD_TABLE_FILE);
     assert(build_state->table_ram != RAM_ADDR_MAX);
     build_state->table_size = acpi_data_len(tables.table_data);
+    trace_acpi_build_done(build_state->table_size, get_clock() - start);
 
     acpi_add_rom_blob(NULL, tables.linker, "etc/table-loader");
 
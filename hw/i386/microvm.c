@@ -0,0 +1,438 @@
+/*
+ * Minimal x86 machine for fast direct Linux boot
+ *
+ * There is no firmware, PCI, ACPI or VGA: the board has CPUs, the
+ * PIC/IOAPIC pair, the PIT, serial ports and a row of virtio-mmio
+ * transports.  The Linux kernel is entered directly through its 32-bit
+ * boot protocol, with an MP table describing the CPUs and interrupts.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "hw/hw.h"
+#include "hw/loader.h"
+#include "hw/boards.h"
+#include "hw/i386/pc.h"
+#include "hw/i386/apic.h"
+#include "hw/i386/ioapic.h"
+#include "hw/char/serial.h"
+#include "hw/timer/i8254.h"
+#include "hw/kvm/clock.h"
+#include "hw/cpu/icc_bus.h"
+#include "hw/sysbus.h"
+#include "sysemu/sysemu.h"
+#include "sysemu/kvm.h"
+#include "exec/address-spaces.h"
+#include "qemu/error-report.h"
+#include "cpu.h"
+
+/* RAM above this is mapped above 4G */
+#define MICROVM_LOWMEM_MAX      0xc0000000ULL
+
+#define MICROVM_VIRTIO_BASE     0xfeb00000
+#define MICROVM_VIRTIO_SIZE     0x200
+#define MICROVM_VIRTIO_NUM      8
+#define MICROVM_VIRTIO_IRQ      5       /* ISA IRQs 5-12 */
+
+/* Low memory used by the direct boot */
+#define MICROVM_GDT_ADDR        0x500
+#define MICROVM_GDT_SIZE        32
+#define MICROVM_ZERO_PAGE_ADDR  0x7000
+#define MICROVM_ZERO_PAGE_SIZE  4096
+#define MICROVM_CMDLINE_ADDR    0x20000
+#define MICROVM_EBDA_ADDR       0x9fc00
+#define MICROVM_MPTABLE_ADDR    0xf0000
+#define MICROVM_KERNEL_ADDR     0x100000
+
+/* Selectors the Linux 32-bit boot protocol expects */
+#define MICROVM_BOOT_CS         0x10
+#define MICROVM_BOOT_DS         0x18
+
+/* struct boot_params offsets, see Linux's Documentation/x86/zero-page.txt */
+#define BP_E820_ENTRIES         0x1e8
+#define BP_HDR                  0x1f1
+#define BP_E820_MAP             0x2d0
+#define BP_E820_MAX             128
+
+static void microvm_e820_add(uint8_t *zero_page, uint64_t addr,
+                             uint64_t size, uint32_t type)
+{
+    int n = zero_page[BP_E820_ENTRIES];
+    uint8_t *e = zero_page + BP_E820_MAP + n * 20;
+
+    assert(n < BP_E820_MAX);
+    stq_p(e, addr);
+    stq_p(e + 8, size);
+    stl_p(e + 16, type);
+    zero_page[BP_E820_ENTRIES] = n + 1;
+}
+
+static void microvm_load_linux(MachineState *machine, uint8_t *zero_page,
+                               ram_addr_t below_4g_mem_size)
+{
+    uint8_t *kernel;
+    gsize kernel_size;
+    uint16_t protocol;
+    uint32_t setup_size, hdr_end, initrd_max;
+    int initrd_size;
+    hwaddr initrd_addr;
+    GString *cmdline;
+    int i;
+
+    if (!g_file_get_contents(machine->kernel_filename, (gchar **)&kernel,
+                             &kernel_size, NULL)) {
+        error_report("could not load kernel '%s'", machine->kernel_filename);
+        exit(1);
+    }
+
+    if (kernel_size < 0x250 || ldl_p(kernel + 0x202) != 0x53726448) {
+        error_report("'%s' is not a Linux bzImage", machine->kernel_filename);
+        exit(1);
+    }
+    protocol = lduw_p(kernel + 0x206);
+    if (protocol < 0x206 || !(kernel[0x211] & 0x01)) {
+        error_report("direct boot needs Linux boot protocol 2.06 or newer");
+        exit(1);
+    }
+
+    setup_size = kernel[0x1f1] ? kernel[0x1f1] : 4;
+    setup_size = (setup_size + 1) * 512;
+    hdr_end = 0x202 + kernel[0x201];
+    if (setup_size >= kernel_size || hdr_end > setup_size) {
+        error_report("'%s' has a bad setup header", machine->kernel_filename);
+        exit(1);
+    }
+
+    /* The real-mode setup code never runs; only its header is passed on */
+    memcpy(zero_page + BP_HDR, kernel + BP_HDR, hdr_end - BP_HDR);
+    zero_page[0x210] = 0xB0;            /* type_of_loader: QEMU */
+    zero_page[0x211] &= ~0x80;          /* no CAN_USE_HEAP */
+
+    rom_add_blob_fixed("linux", kernel + setup_size, kernel_size - setup_size,
+                       MICROVM_KERNEL_ADDR);
+
+    /* Tell the guest where the virtio-mmio transports are */
+    cmdline = g_string_new(machine->kernel_cmdline);
+    for (i = 0; i < MICROVM_VIRTIO_NUM; i++) {
+        g_string_append_printf(cmdline, " virtio_mmio.device=%d@0x%x:%d",
+                               MICROVM_VIRTIO_SIZE,
+                               MICROVM_VIRTIO_BASE + i * MICROVM_VIRTIO_SIZE,
+                               MICROVM_VIRTIO_IRQ + i);
+    }
+    if (cmdline->len > ldl_p(kernel + 0x238)) {
+        error_report("kernel command line too long (%zu bytes, max %u)",
+                     cmdline->len, ldl_p(kernel + 0x238));
+        exit(1);
+    }
+    rom_add_blob_fixed("cmdline", cmdline->str, cmdline->len + 1,
+                       MICROVM_CMDLINE_ADDR);
+    stl_p(zero_page + 0x228, MICROVM_CMDLINE_ADDR);
+    g_string_free(cmdline, true);
+
+    if (machine->initrd_filename) {
+        initrd_max = ldl_p(kernel + 0x22c);
+        if (initrd_max >= below_4g_mem_size) {
+            initrd_max = below_4g_mem_size - 1;
+        }
+
+        initrd_size = get_image_size(machine->initrd_filename);
+        if (initrd_size < 0) {
+            error_report("could not load initrd '%s'",
+                         machine->initrd_filename);
+            exit(1);
+        }
+        initrd_addr = (initrd_max - initrd_size) & ~4095;
+        if (initrd_size > initrd_max ||
+            initrd_addr < MICROVM_KERNEL_ADDR + kernel_size - setup_size) {
+            error_report("not enough memory for initrd '%s'",
+                         machine->initrd_filename);
+            exit(1);
+        }
+
+        load_image_targphys(machine->initrd_filename, initrd_addr,
+                            initrd_size);
+        stl_p(zero_page + 0x218, initrd_addr);
+        stl_p(zero_page + 0x21c, initrd_size);
+    }
+
+    g_free(kernel);
+}
+
+static uint8_t microvm_mptable_checksum(const uint8_t *p, int len)
+{
+    uint8_t sum = 0;
+
+    while (len--) {
+        sum += *p++;
+    }
+    return -sum;
+}
+
+/* Intel MultiProcessor Specification 1.4 tables: enough for Linux to find
+ * the CPUs and the IOAPIC without ACPI.
+ */
+static void microvm_build_mptable(void)
+{
+    CPUState *cs;
+    uint8_t *table, *hdr, *p;
+    int ncpus = 0, entries, len, i;
+
+    CPU_FOREACH(cs) {
+        ncpus++;
+    }
+    /* CPUs, bus, IOAPIC, ISA IRQs but the cascade, LINT0 and LINT1 */
+    entries = ncpus + 2 + (ISA_NUM_IRQS - 1) + 2;
+    len = 16 + 44 + ncpus * 20 + (entries - ncpus) * 8;
+    table = g_malloc0(len);
+
+    /* Floating pointer structure */
+    p = table;
+    memcpy(p, "_MP_", 4);
+    stl_p(p + 4, MICROVM_MPTABLE_ADDR + 16);
+    p[8] = 1;                           /* length in paragraphs */
+    p[9] = 4;                           /* version 1.4 */
+    p[10] = microvm_mptable_checksum(p, 16);
+
+    /* Configuration table header */
+    hdr = table + 16;
+    memcpy(hdr, "PCMP", 4);
+    stw_p(hdr + 4, len - 16);
+    hdr[6] = 4;
+    memcpy(hdr + 8, "QEMU    ", 8);
+    memcpy(hdr + 16, "MICROVM     ", 12);
+    stw_p(hdr + 34, entries);
+    stl_p(hdr + 36, APIC_DEFAULT_ADDRESS);
+    p = hdr + 44;
+
+    CPU_FOREACH(cs) {
+        X86CPU *cpu = X86_CPU(cs);
+
+        p[0] = 0;                       /* processor */
+        p[1] = cpu->env.cpuid_apic_id;
+        p[2] = 0x14;                    /* local APIC version */
+        p[3] = 0x01 | (cs == first_cpu ? 0x02 : 0); /* enabled, BSP */
+        stl_p(p + 4, cpu->env.cpuid_version);
+        stl_p(p + 8, cpu->env.features[FEAT_1_EDX]);
+        p += 20;
+    }
+
+    p[0] = 1;                           /* bus */
+    p[1] = 0;
+    memcpy(p + 2, "ISA   ", 6);
+    p += 8;
+
+    p[0] = 2;                           /* I/O APIC */
+    p[1] = 0;                           /* id */
+    p[2] = 0x11;                        /* version */
+    p[3] = 0x01;                        /* enabled */
+    stl_p(p + 4, IO_APIC_DEFAULT_ADDRESS);
+    p += 8;
+
+    /* ISA IRQs are wired 1:1 to IOAPIC pins, except that the PIT (IRQ 0)
+     * is on pin 2.
+     */
+    for (i = 0; i < ISA_NUM_IRQS; i++) {
+        if (i == 2) {
+            continue;
+        }
+        p[0] = 3;                       /* I/O interrupt */
+        p[1] = 0;                       /* INT */
+        p[4] = 0;                       /* source bus */
+        p[5] = i;
+        p[6] = 0;                       /* destination I/O APIC */
+        p[7] = i == 0 ? 2 : i;
+        p += 8;
+    }
+
+    for (i = 0; i < 2; i++) {
+        p[0] = 4;                       /* local interrupt */
+        p[1] = i == 0 ? 3 : 1;          /* ExtINT on LINT0, NMI on LINT1 */
+        p[6] = 0xff;                    /* all local APICs */
+        p[7] = i;
+        p += 8;
+    }
+    assert(p == table + len);
+
+    hdr[7] = microvm_mptable_checksum(hdr, len - 16);
+    rom_add_blob_fixed("mptable", table, len, MICROVM_MPTABLE_ADDR);
+    g_free(table);
+}
+
+/* Runs after the CPU's own reset handler and puts the boot CPU at the
+ * kernel's 32-bit entry point: flat segments, paging and interrupts off,
+ * %esi pointing at the zero page.
+ */
+static void microvm_cpu_reset(void *opaque)
+{
+    X86CPU *cpu = opaque;
+    CPUX86State *env = &cpu->env;
+    unsigned int code_flags = DESC_P_MASK | DESC_S_MASK | DESC_CS_MASK |
+                              DESC_R_MASK | DESC_A_MASK | DESC_G_MASK |
+                              DESC_B_MASK;
+    unsigned int data_flags = DESC_P_MASK | DESC_S_MASK | DESC_W_MASK |
+                              DESC_A_MASK | DESC_G_MASK | DESC_B_MASK;
+
+    env->gdt.base = MICROVM_GDT_ADDR;
+    env->gdt.limit = MICROVM_GDT_SIZE - 1;
+    cpu_x86_update_cr0(env, CR0_PE_MASK | CR0_ET_MASK);
+
+    cpu_x86_load_seg_cache(env, R_CS, MICROVM_BOOT_CS, 0, 0xffffffff,
+                           code_flags);
+    cpu_x86_load_seg_cache(env, R_DS, MICROVM_BOOT_DS, 0, 0xffffffff,
+                           data_flags);
+    cpu_x86_load_seg_cache(env, R_ES, MICROVM_BOOT_DS, 0, 0xffffffff,
+                           data_flags);
+    cpu_x86_load_seg_cache(env, R_SS, MICROVM_BOOT_DS, 0, 0xffffffff,
+                           data_flags);
+    cpu_x86_load_seg_cache(env, R_FS, MICROVM_BOOT_DS, 0, 0xffffffff,
+                           data_flags);
+    cpu_x86_load_seg_cache(env, R_GS, MICROVM_BOOT_DS, 0, 0xffffffff,
+                           data_flags);
+
+    env->eip = MICROVM_KERNEL_ADDR;
+    env->regs[R_EDX] = 0;
+    env->regs[R_ESI] = MICROVM_ZERO_PAGE_ADDR;
+}
+
+static void microvm_init(MachineState *machine)
+{
+    PCMachineState *pc_machine = PC_MACHINE(machine);
+    MemoryRegion *system_memory = get_system_memory();
+    MemoryRegion *ram, *ram_below_4g, *ram_above_4g;
+    ram_addr_t below_4g_mem_size, above_4g_mem_size, lowmem;
+    DeviceState *icc_bridge;
+    GSIState *gsi_state;
+    ISABus *isa_bus;
+    qemu_irq *cpu_irq;
+    qemu_irq *gsi;
+    qemu_irq *i8259;
+    uint8_t *zero_page;
+    uint8_t gdt[MICROVM_GDT_SIZE];
+    int i;
+
+    if (!machine->kernel_filename) {
+        error_report("the microvm machine has no firmware, use -kernel");
+        exit(1);
+    }
+
+    lowmem = MIN(MICROVM_LOWMEM_MAX, pc_machine->max_ram_below_4g);
+    if (machine->ram_size > lowmem) {
+        above_4g_mem_size = machine->ram_size - lowmem;
+        below_4g_mem_size = lowmem;
+    } else {
+        above_4g_mem_size = 0;
+        below_4g_mem_size = machine->ram_size;
+    }
+
+    icc_bridge = qdev_create(NULL, TYPE_ICC_BRIDGE);
+    object_property_add_child(qdev_get_machine(), "icc-bridge",
+                              OBJECT(icc_bridge), NULL);
+
+    pc_cpus_init(machine->cpu_model, icc_bridge);
+
+    kvmclock_create();
+
+    ram = g_new(MemoryRegion, 1);
+    memory_region_allocate_system_memory(ram, NULL, "microvm.ram",
+                                         machine->ram_size);
+    ram_below_4g = g_new(MemoryRegion, 1);
+    memory_region_init_alias(ram_below_4g, NULL, "ram-below-4g", ram,
+                             0, below_4g_mem_size);
+    memory_region_add_subregion(system_memory, 0, ram_below_4g);
+    if (above_4g_mem_size > 0) {
+        ram_above_4g = g_new(MemoryRegion, 1);
+        memory_region_init_alias(ram_above_4g, NULL, "ram-above-4g", ram,
+                                 below_4g_mem_size, above_4g_mem_size);
+        memory_region_add_subregion(system_memory, 0x100000000ULL,
+                                    ram_above_4g);
+    }
+
+    /* irq lines */
+    gsi_state = g_malloc0(sizeof(*gsi_state));
+    if (kvm_irqchip_in_kernel()) {
+        kvm_pc_setup_irq_routing(true);
+        gsi = qemu_allocate_irqs(kvm_pc_gsi_handler, gsi_state,
+                                 GSI_NUM_PINS);
+    } else {
+        gsi = qemu_allocate_irqs(gsi_handler, gsi_state, GSI_NUM_PINS);
+    }
+
+    isa_bus = isa_bus_new(NULL, get_system_io());
+    isa_bus_irqs(isa_bus, gsi);
+
+    if (kvm_irqchip_in_kernel()) {
+        i8259 = kvm_i8259_init(isa_bus);
+    } else {
+        cpu_irq = pc_allocate_cpu_irq();
+        i8259 = i8259_init(isa_bus, cpu_irq[0]);
+    }
+    for (i = 0; i < ISA_NUM_IRQS; i++) {
+        gsi_state->i8259_irq[i] = i8259[i];
+    }
+    ioapic_init_gsi(gsi_state, NULL);
+    qdev_init_nofail(icc_bridge);
+
+    if (kvm_irqchip_in_kernel()) {
+        kvm_pit_init(isa_bus, 0x40);
+    } else {
+        pit_init(isa_bus, 0x40, 0, NULL);
+    }
+
+    for (i = 0; i < MAX_SERIAL_PORTS; i++) {
+        if (serial_hds[i]) {
+            serial_isa_init(isa_bus, i, serial_hds[i]);
+        }
+    }
+
+    /* Created in address order, so that -device fills the lowest first */
+    for (i = 0; i < MICROVM_VIRTIO_NUM; i++) {
+        sysbus_create_simple("virtio-mmio",
+                             MICROVM_VIRTIO_BASE + i * MICROVM_VIRTIO_SIZE,
+                             gsi[MICROVM_VIRTIO_IRQ + i]);
+    }
+
+    zero_page = g_malloc0(MICROVM_ZERO_PAGE_SIZE);
+    microvm_load_linux(machine, zero_page, below_4g_mem_size);
+    microvm_e820_add(zero_page, 0, MICROVM_EBDA_ADDR, E820_RAM);
+    microvm_e820_add(zero_page, MICROVM_MPTABLE_ADDR,
+                     MICROVM_KERNEL_ADDR - MICROVM_MPTABLE_ADDR,
+                     E820_RESERVED);
+    microvm_e820_add(zero_page, MICROVM_KERNEL_ADDR,
+                     below_4g_mem_size - MICROVM_KERNEL_ADDR, E820_RAM);
+    if (above_4g_mem_size > 0) {
+        microvm_e820_add(zero_page, 0x100000000ULL, above_4g_mem_size,
+                         E820_RAM);
+    }
+    rom_add_blob_fixed("zero-page", zero_page, MICROVM_ZERO_PAGE_SIZE,
+                       MICROVM_ZERO_PAGE_ADDR);
+    g_free(zero_page);
+
+    /* Null descriptors, then flat 4G code and data at 0x10 and 0x18 */
+    memset(gdt, 0, sizeof(gdt));
+    stq_p(gdt + MICROVM_BOOT_CS, 0x00cf9b000000ffffULL);
+    stq_p(gdt + MICROVM_BOOT_DS, 0x00cf93000000ffffULL);
+    rom_add_blob_fixed("gdt", gdt, sizeof(gdt), MICROVM_GDT_ADDR);
+
+    microvm_build_mptable();
+
+    qemu_register_reset(microvm_cpu_reset, X86_CPU(first_cpu));
+}
+
+static QEMUMachine microvm_machine = {
+    .name = "microvm",
+    .desc = "Minimal x86 machine for direct Linux boot (virtio-mmio)",
+    .init = microvm_init,
+    .max_cpus = 255,
+    .no_parallel = 1,
+    .no_floppy = 1,
+    .no_cdrom = 1,
+    .no_sdcard = 1,
+};
+
+static void microvm_machine_init(void)
+{
+    qemu_register_pc_machine(&microvm_machine);
+}
+
+machine_init(microvm_machine_init);
@@ -176,6 +176,7 @@ static void old_pc_system_rom_init(MemoryRegion *rom_memory, bool isapc_ram_fw)
     char *filename;
     MemoryRegion *bios, *isa_bios;
     int bios_size, isa_bios_size;
+    bool shared;
     int ret;
 
     /* BIOS load */
@@ -193,12 +194,19 @@ static void old_pc_system_rom_init(MemoryRegion *rom_memory, bool isapc_ram_fw)
         goto bios_error;
     }
     bios = g_malloc(sizeof(*bios));
-    memory_region_init_ram(bios, NULL, "pc.bios", bios_size, &error_abort);
+    /* isapc's BIOS is writable and must be restored from the file on reset */
+    shared = !isapc_ram_fw &&
+             rom_init_ram_shared(bios, NULL, "pc.bios", bios_size, filename);
+    if (!shared) {
+        memory_region_init_ram(bios, NULL, "pc.bios", bios_size, &error_abort);
+    }
     vmstate_register_ram_global(bios);
     if (!isapc_ram_fw) {
         memory_region_set_readonly(bios, true);
     }
-    ret = rom_add_file_fixed(bios_name, (uint32_t)(-bios_size), -1);
+    /* A shared image is already in place; copying it again would unshare it */
+    ret = shared ? 0 : rom_add_file_fixed(bios_name, (uint32_t)(-bios_size),
+                                          -1);
     if (ret != 0) {
     bios_error:
         fprintf(stderr, "qemu: could not load PC BIOS '%s'\n", bios_name);
@@ -529,6 +529,7 @@ static void ahci_reset_port(AHCIState *s, int port)
         qemu_sglist_destroy(&ncq_tfs->sglist);
         ncq_tfs->used = 0;
     }
+    d->ncq_done = 0;
 
     s->dev[port].port_state = STATE_RUN;
     if (!ide_state->blk) {
@@ -822,6 +823,64 @@ out:
     return r;
 }
 
+/* Drop the tail of @sglist so that it describes exactly @len bytes */
+static void ahci_sglist_truncate(QEMUSGList *sglist, dma_addr_t len)
+{
+    dma_addr_t sum = 0;
+    int i;
+
+    for (i = 0; i < sglist->nsg && sum < len; i++) {
+        if (sglist->sg[i].len > len - sum) {
+            sglist->sg[i].len = len - sum;
+        }
+        sum += sglist->sg[i].len;
+    }
+    sglist->nsg = i;
+    sglist->size = sum;
+}
+
+/* Report all NCQ tags that completed since the last run in a single Set
+ * Device Bits FIS, so that a burst of parallel completions raises one
+ * interrupt rather than one per tag.
+ */
+static void ahci_ncq_bh(void *opaque)
+{
+    AHCIDevice *ad = opaque;
+    uint32_t done = ad->ncq_done;
+
+    if (!done) {
+        return;
+    }
+    ad->ncq_done = 0;
+
+    /* Clear bits for these tags in SActive */
+    ad->port_regs.scr_act &= ~done;
+    ahci_write_fis_sdb(ad->hba, ad->port_no, done);
+}
+
+static void ncq_finish(NCQTransferState *ncq_tfs)
+{
+    AHCIDevice *ad = ncq_tfs->drive;
+
+    ad->ncq_done |= (1 << ncq_tfs->tag);
+    qemu_bh_schedule(ad->ncq_bh);
+
+    DPRINTF(ad->port_no, "NCQ transfer tag %d finished\n", ncq_tfs->tag);
+
+    qemu_sglist_destroy(&ncq_tfs->sglist);
+    ncq_tfs->aiocb = NULL;
+    ncq_tfs->used = 0;
+}
+
+static void ncq_err(NCQTransferState *ncq_tfs)
+{
+    IDEState *ide_state = &ncq_tfs->drive->port.ifs[0];
+
+    ide_state->error = ABRT_ERR;
+    ide_state->status = READY_STAT | ERR_STAT;
+    ncq_tfs->drive->port_regs.scr_err |= (1 << ncq_tfs->tag);
+}
+
 static void ncq_cb(void *opaque, int ret)
 {
     NCQTransferState *ncq_tfs = (NCQTransferState *)opaque;
@@ -830,28 +889,17 @@ static void ncq_cb(void *opaque, int ret)
     if (ret == -ECANCELED) {
         return;
     }
-    /* Clear bit for this tag in SActive */
-    ncq_tfs->drive->port_regs.scr_act &= ~(1 << ncq_tfs->tag);
 
     if (ret < 0) {
         /* error */
-        ide_state->error = ABRT_ERR;
-        ide_state->status = READY_STAT | ERR_STAT;
-        ncq_tfs->drive->port_regs.scr_err |= (1 << ncq_tfs->tag);
+        ncq_err(ncq_tfs);
     } else {
         ide_state->status = READY_STAT | SEEK_STAT;
     }
 
-    ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs->drive->port_no,
-                       (1 << ncq_tfs->tag));
-
-    DPRINTF(ncq_tfs->drive->port_no, "NCQ transfer tag %d finished\n",
-            ncq_tfs->tag);
-
     block_acct_done(blk_get_stats(ncq_tfs->drive->port.ifs[0].blk),
                     &ncq_tfs->acct);
-    qemu_sglist_destroy(&ncq_tfs->sglist);
-    ncq_tfs->used = 0;
+    ncq_finish(ncq_tfs);
 }
 
 static int is_ncq(uint8_t ata_cmd)
@@ -892,18 +940,37 @@ static void process_ncq_command(AHCIState *s, int port, uint8_t *cmd_fis,
                    ((uint64_t)ncq_fis->lba1 << 8) |
                    (uint64_t)ncq_fis->lba0;
 
-    /* Note: We calculate the sector count, but don't currently rely on it.
-     * The total size of the DMA buffer tells us the transfer size instead. */
+    /* A sector count of zero means 65536 sectors (SATA 3.2 13.6.4.1) */
     ncq_tfs->sector_count = ((uint16_t)ncq_fis->sector_count_high << 8) |
                                 ncq_fis->sector_count_low;
+    if (!ncq_tfs->sector_count) {
+        ncq_tfs->sector_count = 0x10000;
+    }
+    ncq_tfs->tag = tag;
 
     DPRINTF(port, "NCQ transfer LBA from %"PRId64" to %"PRId64", "
             "drive max %"PRId64"\n",
-            ncq_tfs->lba, ncq_tfs->lba + ncq_tfs->sector_count - 2,
+            ncq_tfs->lba, ncq_tfs->lba + ncq_tfs->sector_count - 1,
             s->dev[port].port.ifs[0].nb_sectors - 1);
 
-    ahci_populate_sglist(&s->dev[port], &ncq_tfs->sglist, 0);
-    ncq_tfs->tag = tag;
+    if (ahci_populate_sglist(&s->dev[port], &ncq_tfs->sglist, 0) < 0) {
+        DPRINTF(port, "error: invalid PRDT for NCQ tag %d\n", tag);
+        ncq_err(ncq_tfs);
+        ncq_tfs->used = 0;
+        s->dev[port].ncq_done |= (1 << tag);
+        qemu_bh_schedule(s->dev[port].ncq_bh);
+        return;
+    }
+
+    /* The PRDT may describe more memory than the command transfers */
+    if (ncq_tfs->sglist.size < (uint64_t)ncq_tfs->sector_count * 512) {
+        DPRINTF(port, "error: PRDT too short for NCQ tag %d\n", tag);
+        ncq_err(ncq_tfs);
+        ncq_finish(ncq_tfs);
+        return;
+    }
+    ahci_sglist_truncate(&ncq_tfs->sglist,
+                         (uint64_t)ncq_tfs->sector_count * 512);
 
     switch(ncq_fis->command) {
         case READ_FPDMA_QUEUED:
@@ -942,7 +1009,8 @@ static void process_ncq_command(AHCIState *s, int port, uint8_t *cmd_fis,
                 DPRINTF(port,
                         "error: tried to process non-NCQ command as NCQ\n");
             }
-            qemu_sglist_destroy(&ncq_tfs->sglist);
+            ncq_err(ncq_tfs);
+            ncq_finish(ncq_tfs);
     }
 }
 
@@ -1296,11 +1364,17 @@ void ahci_init(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
         ad->port_no = i;
         ad->port.dma = &ad->dma;
         ad->port.dma->ops = &ahci_dma_ops;
+        ad->ncq_bh = qemu_bh_new(ahci_ncq_bh, ad);
     }
 }
 
 void ahci_uninit(AHCIState *s)
 {
+    int i;
+
+    for (i = 0; i < s->ports; i++) {
+        qemu_bh_delete(s->dev[i].ncq_bh);
+    }
     g_free(s->dev);
 }
 
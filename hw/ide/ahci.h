@@ -247,7 +247,7 @@ typedef struct NCQTransferState {
     BlockAIOCB *aiocb;
     QEMUSGList sglist;
     BlockAcctCookie acct;
-    uint16_t sector_count;
+    uint32_t sector_count;
     uint64_t lba;
     uint8_t tag;
     int slot;
@@ -270,6 +270,8 @@ struct AHCIDevice {
     bool init_d2h_sent;
     AHCICmdHdr *cur_cmd;
     NCQTransferState ncq_tfs[AHCI_MAX_CMDS];
+    uint32_t ncq_done;      /* completed tags not yet reported to the guest */
+    QEMUBH *ncq_bh;
 };
 
 typedef struct AHCIState {
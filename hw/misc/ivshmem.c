@@ -19,6 +19,7 @@
 #include "hw/hw.h"
 #include "hw/i386/pc.h"
 #include "hw/pci/pci.h"
+#include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "sysemu/kvm.h"
 #include "migration/migration.h"
@@ -26,6 +27,7 @@
 #include "qemu/event_notifier.h"
 #include "qemu/fifo8.h"
 #include "sysemu/char.h"
+#include "sysemu/hostmem.h"
 
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -64,6 +66,11 @@ typedef struct EventfdEntry {
     int vector;
 } EventfdEntry;
 
+/* KVM route of an MSI-X vector whose eventfd is wired up as an irqfd */
+typedef struct MSIVector {
+    int virq;
+} MSIVector;
+
 typedef struct IVShmemState {
     /*< private >*/
     PCIDevice parent_obj;
@@ -97,6 +104,8 @@ typedef struct IVShmemState {
     uint32_t vectors;
     uint32_t features;
     EventfdEntry *eventfd_table;
+    MSIVector *msi_vectors;
+    HostMemoryBackend *hostmem;
 
     Error *migration_blocker;
 
@@ -236,7 +245,7 @@ static uint64_t ivshmem_io_read(void *opaque, hwaddr addr,
 
         case IVPOSITION:
             /* return my VM ID if the memory is mapped */
-            if (s->shm_fd > 0) {
+            if (s->shm_fd > 0 || s->hostmem) {
                 ret = s->vm_id;
             } else {
                 ret = -1;
@@ -321,6 +330,96 @@ static CharDriverState* create_eventfd_chr_device(void * opaque, EventNotifier *
 
 }
 
+/*
+ * Deliver interrupts on our own eventfds straight from the kernel, rather
+ * than reading them in the main loop and calling msix_notify().  Together
+ * with ioeventfd on the sending side, a doorbell then never enters QEMU.
+ */
+static void ivshmem_add_kvm_msi_virq(IVShmemState *s, int vector)
+{
+    PCIDevice *pdev = PCI_DEVICE(s);
+    EventNotifier *n = &s->peers[s->vm_id].eventfds[vector];
+    MSIVector *v = &s->msi_vectors[vector];
+    int ret;
+
+    ret = kvm_irqchip_add_msi_route(kvm_state, msix_get_message(pdev, vector));
+    if (ret < 0) {
+        error_report("ivshmem: no MSI route for vector %d, relaying "
+                     "interrupts: %s", vector, strerror(-ret));
+        s->eventfd_chr[vector] = create_eventfd_chr_device(s, n, vector);
+        return;
+    }
+    v->virq = ret;
+
+    /* Otherwise ivshmem_vector_unmask() attaches it */
+    if (msix_enabled(pdev) && !msix_is_masked(pdev, vector)) {
+        ret = kvm_irqchip_add_irqfd_notifier(kvm_state, n, NULL, v->virq);
+        if (ret < 0) {
+            error_report("ivshmem: could not add irqfd for vector %d: %s",
+                         vector, strerror(-ret));
+        }
+    }
+}
+
+static int ivshmem_vector_unmask(PCIDevice *dev, unsigned vector,
+                                 MSIMessage msg)
+{
+    IVShmemState *s = IVSHMEM(dev);
+    MSIVector *v = &s->msi_vectors[vector];
+    int ret;
+
+    if (v->virq < 0) {
+        return 0;
+    }
+
+    ret = kvm_irqchip_update_msi_route(kvm_state, v->virq, msg);
+    if (ret < 0) {
+        return ret;
+    }
+    return kvm_irqchip_add_irqfd_notifier(kvm_state,
+                                          &s->peers[s->vm_id].eventfds[vector],
+                                          NULL, v->virq);
+}
+
+static void ivshmem_vector_mask(PCIDevice *dev, unsigned vector)
+{
+    IVShmemState *s = IVSHMEM(dev);
+    MSIVector *v = &s->msi_vectors[vector];
+    EventNotifier *n;
+    int ret;
+
+    if (v->virq < 0) {
+        return;
+    }
+
+    n = &s->peers[s->vm_id].eventfds[vector];
+    ret = kvm_irqchip_remove_irqfd_notifier(kvm_state, n, v->virq);
+    if (ret < 0) {
+        error_report("ivshmem: could not remove irqfd for vector %d: %s",
+                     vector, strerror(-ret));
+    }
+}
+
+static void ivshmem_vector_poll(PCIDevice *dev, unsigned int vector_start,
+                                unsigned int vector_end)
+{
+    IVShmemState *s = IVSHMEM(dev);
+    unsigned int vector;
+
+    vector_end = MIN(vector_end, s->vectors);
+    for (vector = vector_start; vector < vector_end; vector++) {
+        EventNotifier *n;
+
+        if (s->msi_vectors[vector].virq < 0 || !msix_is_masked(dev, vector)) {
+            continue;
+        }
+        n = &s->peers[s->vm_id].eventfds[vector];
+        if (event_notifier_test_and_clear(n)) {
+            msix_set_pending(dev, vector);
+        }
+    }
+}
+
 static int check_shm_size(IVShmemState *s, int fd) {
     /* check that the guest isn't going to try and map more memory than the
      * the object has allocated return -1 to indicate error */
@@ -521,6 +620,12 @@ static void ivshmem_read(void *opaque, const uint8_t *buf, int size)
 
         s->max_peer = 0;
 
+        if (s->hostmem) {
+            /* The memory comes from memdev; the server only does doorbells */
+            close(incoming_fd);
+            return;
+        }
+
         if (check_shm_size(s, incoming_fd) == -1) {
             exit(1);
         }
@@ -567,9 +672,13 @@ static void ivshmem_read(void *opaque, const uint8_t *buf, int size)
     }
 
     if (incoming_posn == s->vm_id) {
-        s->eventfd_chr[guest_max_eventfd] = create_eventfd_chr_device(s,
-                   &s->peers[s->vm_id].eventfds[guest_max_eventfd],
-                   guest_max_eventfd);
+        if (s->msi_vectors) {
+            ivshmem_add_kvm_msi_virq(s, guest_max_eventfd);
+        } else {
+            s->eventfd_chr[guest_max_eventfd] = create_eventfd_chr_device(s,
+                       &s->peers[s->vm_id].eventfds[guest_max_eventfd],
+                       guest_max_eventfd);
+        }
     }
 
     if (ivshmem_has_feature(s, IVSHMEM_IOEVENTFD)) {
@@ -641,9 +750,40 @@ static void ivshmem_setup_msi(IVShmemState * s)
     /* allocate QEMU char devices for receiving interrupts */
     s->eventfd_table = g_malloc0(s->vectors * sizeof(EventfdEntry));
 
+    if (ivshmem_has_feature(s, IVSHMEM_IOEVENTFD) &&
+        kvm_msi_via_irqfd_enabled()) {
+        int i;
+
+        s->msi_vectors = g_new(MSIVector, s->vectors);
+        for (i = 0; i < s->vectors; i++) {
+            s->msi_vectors[i].virq = -1;
+        }
+        if (msix_set_vector_notifiers(PCI_DEVICE(s), ivshmem_vector_unmask,
+                                      ivshmem_vector_mask,
+                                      ivshmem_vector_poll)) {
+            error_report("ivshmem: msix_set_vector_notifiers failed");
+            exit(1);
+        }
+    }
+
     ivshmem_use_msix(s);
 }
 
+static void ivshmem_check_memdev_is_busy(Object *obj, const char *name,
+                                         Object *val, Error **errp)
+{
+    MemoryRegion *mr;
+
+    mr = host_memory_backend_get_memory(MEMORY_BACKEND(val), errp);
+    if (mr && memory_region_is_mapped(mr)) {
+        char *path = object_get_canonical_path_component(val);
+        error_setg(errp, "can't use already busy memdev: %s", path);
+        g_free(path);
+    } else {
+        qdev_prop_allow_set_link_before_realize(obj, name, val, errp);
+    }
+}
+
 static void ivshmem_save(QEMUFile* f, void *opaque)
 {
     IVShmemState *proxy = opaque;
@@ -706,7 +846,20 @@ static int pci_ivshmem_init(PCIDevice *dev)
     IVShmemState *s = IVSHMEM(dev);
     uint8_t *pci_conf;
 
-    if (s->sizearg == NULL)
+    if (s->hostmem) {
+        MemoryRegion *mr = host_memory_backend_get_memory(s->hostmem,
+                                                          &error_abort);
+
+        if (s->shmobj || s->sizearg) {
+            error_report("'memdev' can't be used with 'shm' or 'size'");
+            exit(1);
+        }
+        s->ivshmem_size = memory_region_size(mr);
+        if (!is_power_of_two(s->ivshmem_size)) {
+            error_report("memdev size must be power of 2");
+            exit(1);
+        }
+    } else if (s->sizearg == NULL)
         s->ivshmem_size = 4 << 20; /* 4 MB default */
     else {
         s->ivshmem_size = ivshmem_get_size(s);
@@ -765,6 +918,17 @@ static int pci_ivshmem_init(PCIDevice *dev)
         s->ivshmem_attr |= PCI_BASE_ADDRESS_MEM_TYPE_64;
     }
 
+    if (s->hostmem) {
+        MemoryRegion *mr = host_memory_backend_get_memory(s->hostmem,
+                                                          &error_abort);
+
+        vmstate_register_ram(mr, DEVICE(s));
+        memory_region_add_subregion(&s->bar, 0, mr);
+        if (s->server_chr == NULL) {
+            pci_register_bar(dev, 2, s->ivshmem_attr, &s->bar);
+        }
+    }
+
     if ((s->server_chr != NULL) &&
                         (strncmp(s->server_chr->filename, "unix:", 5) == 0)) {
         /* if we get a UNIX socket as the parameter we will talk
@@ -795,12 +959,13 @@ static int pci_ivshmem_init(PCIDevice *dev)
 
         qemu_chr_add_handlers(s->server_chr, ivshmem_can_receive, ivshmem_read,
                      ivshmem_event, s);
-    } else {
+    } else if (!s->hostmem) {
         /* just map the file immediately, we're not using a server */
         int fd;
 
         if (s->shmobj == NULL) {
-            error_report("Must specify 'chardev' or 'shm' to ivshmem");
+            error_report("Must specify 'chardev', 'shm' or 'memdev' to "
+                         "ivshmem");
             exit(1);
         }
 
@@ -844,8 +1009,28 @@ static void pci_ivshmem_uninit(PCIDevice *dev)
         error_free(s->migration_blocker);
     }
 
-    memory_region_del_subregion(&s->bar, &s->ivshmem);
-    vmstate_unregister_ram(&s->ivshmem, DEVICE(dev));
+    if (s->msi_vectors) {
+        int i;
+
+        msix_unset_vector_notifiers(dev);
+        for (i = 0; i < s->vectors; i++) {
+            if (s->msi_vectors[i].virq >= 0) {
+                kvm_irqchip_release_virq(kvm_state, s->msi_vectors[i].virq);
+            }
+        }
+        g_free(s->msi_vectors);
+    }
+
+    if (s->hostmem) {
+        MemoryRegion *mr = host_memory_backend_get_memory(s->hostmem,
+                                                          &error_abort);
+
+        memory_region_del_subregion(&s->bar, mr);
+        vmstate_unregister_ram(mr, DEVICE(dev));
+    } else {
+        memory_region_del_subregion(&s->bar, &s->ivshmem);
+        vmstate_unregister_ram(&s->ivshmem, DEVICE(dev));
+    }
     unregister_savevm(DEVICE(dev), "ivshmem", s);
     fifo8_destroy(&s->incoming_fifo);
 }
@@ -877,10 +1062,22 @@ static void ivshmem_class_init(ObjectClass *klass, void *data)
     set_bit(DEVICE_CATEGORY_MISC, dc->categories);
 }
 
+static void ivshmem_instance_init(Object *obj)
+{
+    IVShmemState *s = IVSHMEM(obj);
+
+    object_property_add_link(obj, "memdev", TYPE_MEMORY_BACKEND,
+                             (Object **)&s->hostmem,
+                             ivshmem_check_memdev_is_busy,
+                             OBJ_PROP_LINK_UNREF_ON_RELEASE,
+                             &error_abort);
+}
+
 static const TypeInfo ivshmem_info = {
     .name          = TYPE_IVSHMEM,
     .parent        = TYPE_PCI_DEVICE,
     .instance_size = sizeof(IVShmemState),
+    .instance_init = ivshmem_instance_init,
     .class_init    = ivshmem_class_init,
 };
 
@@ -56,6 +56,9 @@
 #define VFIO_ALLOW_KVM_MSI 1
 #define VFIO_ALLOW_KVM_MSIX 1
 
+/* RAM sections at least this large are faulted in in parallel before mapping */
+#define VFIO_POPULATE_MIN_SIZE (256 * 1024 * 1024)
+
 struct VFIODevice;
 
 typedef struct VFIOQuirk {
@@ -934,6 +937,8 @@ static void vfio_enable_msi(VFIODevice *vdev)
 retry:
     vdev->msi_vectors = g_malloc0(vdev->nr_vectors * sizeof(VFIOMSIVector));
 
+    /* Nothing fires before vfio_enable_vectors(), so commit all routes once */
+    kvm_irqchip_begin_route_changes(kvm_state);
     for (i = 0; i < vdev->nr_vectors; i++) {
         VFIOMSIVector *vector = &vdev->msi_vectors[i];
         MSIMessage msg = msi_get_message(&vdev->pdev, i);
@@ -955,6 +960,7 @@ retry:
          */
         vfio_add_kvm_msi_virq(vector, &msg, false);
     }
+    kvm_irqchip_end_route_changes(kvm_state);
 
     /* Set interrupt type prior to possible interrupts */
     vdev->interrupt = VFIO_INT_MSI;
@@ -2616,6 +2622,16 @@ static void vfio_listener_region_add(MemoryListener *listener,
     DPRINTF("region_add [ram] %"HWADDR_PRIx" - %"HWADDR_PRIx" [%p]\n",
             iova, end - 1, vaddr);
 
+    /*
+     * The kernel faults in and pins each page of a mapping one at a time
+     * while holding the container lock, which takes seconds for a large
+     * guest.  Fault the pages in from several threads first so the pinning
+     * only has to look them up.
+     */
+    if (!section->readonly && end - iova >= VFIO_POPULATE_MIN_SIZE) {
+        os_mem_populate(vaddr, end - iova, smp_cpus);
+    }
+
     ret = vfio_dma_map(container, iova, end - iova, vaddr, section->readonly);
     if (ret) {
         error_report("vfio_dma_map(%p, 0x%"HWADDR_PRIx", "
@@ -4389,6 +4405,13 @@ static Property vfio_pci_dev_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
+/*
+ * Assigned devices can't be migrated: the host kernel offers no way to
+ * save and restore a device's internal state, and device DMA bypasses
+ * QEMU's dirty memory tracking.  The latter could be covered by marking
+ * every DMA-mapped RAM section dirty from a log_sync callback of
+ * vfio_memory_listener, but that is pointless until the former exists.
+ */
 static const VMStateDescription vfio_pci_vmstate = {
     .name = "vfio-pci",
     .unmigratable = 1,
@@ -29,6 +29,7 @@
 #include "hw/pci/pci.h"
 #include "net/net.h"
 #include "net/checksum.h"
+#include "net/tap.h"
 #include "hw/loader.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/dma.h"
@@ -131,11 +132,19 @@ typedef struct E1000State_st {
     bool mit_irq_level;        /* Tracks interrupt pin level. */
     uint32_t mit_ide;          /* Tracks E1000_TXD_CMD_IDE bit. */
 
+    bool has_vnet;             /* Peer exchanges virtio-net headers. */
+
+    /* Descriptor rings, retargeted whenever they are about to be used */
+    MemoryRegionCache tx_ring;
+    MemoryRegionCache rx_ring;
+
 /* Compatibility flags for migration to/from qemu 1.3.0 and older */
 #define E1000_FLAG_AUTONEG_BIT 0
 #define E1000_FLAG_MIT_BIT 1
+#define E1000_FLAG_TSO_BIT 2
 #define E1000_FLAG_AUTONEG (1 << E1000_FLAG_AUTONEG_BIT)
 #define E1000_FLAG_MIT (1 << E1000_FLAG_MIT_BIT)
+#define E1000_FLAG_TSO (1 << E1000_FLAG_TSO_BIT)
     uint32_t compat_flags;
 } E1000State;
 
@@ -595,17 +604,109 @@ fcs_len(E1000State *s)
     return (s->mac_reg[RCTL] & E1000_RCTL_SECRC) ? 0 : 4;
 }
 
+static ssize_t e1000_receive_frame(E1000State *s, const struct iovec *iov,
+                                   int iovcnt);
+
+static inline bool
+e1000_in_loopback(E1000State *s)
+{
+    return (s->phy_reg[PHY_CTRL] & MII_CR_LOOPBACK) != 0;
+}
+
 static void
 e1000_send_packet(E1000State *s, const uint8_t *buf, int size)
 {
     NetClientState *nc = qemu_get_queue(s->nic);
-    if (s->phy_reg[PHY_CTRL] & MII_CR_LOOPBACK) {
-        nc->info->receive(nc, buf, size);
+    struct virtio_net_hdr hdr = { .gso_type = VIRTIO_NET_HDR_GSO_NONE };
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (uint8_t *)buf, .iov_len = size },
+    };
+
+    if (e1000_in_loopback(s)) {
+        e1000_receive_frame(s, &iov[1], 1);
+    } else if (s->has_vnet) {
+        qemu_sendv_packet(nc, iov, 2);
     } else {
         qemu_send_packet(nc, buf, size);
     }
 }
 
+/* A TSO frame can go to the peer in one piece, with a virtio-net header
+ * asking the host to segment it, instead of being split in xmit_seg. */
+static inline bool
+e1000_tso_offload(E1000State *s)
+{
+    struct e1000_tx *tp = &s->tx;
+
+    return s->has_vnet && tp->tcp && tp->mss && !e1000_in_loopback(s) &&
+           tp->hdr_len + tp->paylen <= sizeof(tp->data);
+}
+
+static void
+xmit_gso(E1000State *s)
+{
+    struct e1000_tx *tp = &s->tx;
+    struct virtio_net_hdr hdr;
+    struct iovec iov[2];
+    unsigned int css = tp->ipcss, frames, n;
+    unsigned int shift = tp->vlan_needed ? 4 : 0;
+    uint16_t *sp;
+
+    /* IP lengths cover the whole frame; the host rewrites them per
+     * segment. */
+    if (tp->ip) {
+        stw_be_p(tp->data + css + 2, tp->size - css);
+    } else {
+        stw_be_p(tp->data + css + 4, tp->size - css - 40);
+    }
+    if (tp->sum_needed & E1000_TXD_POPTS_TXSM) {
+        unsigned int phsum;
+        /* the guest leaves the length out of the pseudo-header sum */
+        sp = (uint16_t *)(tp->data + tp->tucso);
+        phsum = be16_to_cpup(sp) + tp->size - tp->tucss;
+        phsum = (phsum >> 16) + (phsum & 0xffff);
+        stw_be_p(sp, phsum);
+    }
+    if (tp->sum_needed & E1000_TXD_POPTS_IXSM) {
+        putsum(tp->data, tp->size, tp->ipcso, tp->ipcss, tp->ipcse);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr.gso_type = tp->ip ? VIRTIO_NET_HDR_GSO_TCPV4 : VIRTIO_NET_HDR_GSO_TCPV6;
+    if (tp->data[tp->tucss + 13] & 0x80) {     /* CWR */
+        hdr.gso_type |= VIRTIO_NET_HDR_GSO_ECN;
+    }
+    hdr.gso_size = tp->mss;
+    hdr.hdr_len = tp->hdr_len + shift;
+    hdr.csum_start = tp->tucss + shift;
+    hdr.csum_offset = tp->tucso - tp->tucss;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    if (tp->vlan_needed) {
+        memmove(tp->vlan, tp->data, 4);
+        memmove(tp->data, tp->data + 4, 8);
+        memcpy(tp->data + 8, tp->vlan_header, 4);
+        iov[1].iov_base = tp->vlan;
+    } else {
+        iov[1].iov_base = tp->data;
+    }
+    iov[1].iov_len = tp->size + shift;
+    qemu_sendv_packet(qemu_get_queue(s->nic), iov, 2);
+
+    /* account for the segments the wire will see */
+    frames = DIV_ROUND_UP(tp->size - tp->hdr_len, tp->mss);
+    s->mac_reg[TPT] += frames;
+    s->mac_reg[GPTC] += frames;
+    n = s->mac_reg[TOTL];
+    s->mac_reg[TOTL] += tp->size + (frames - 1) * tp->hdr_len;
+    if (s->mac_reg[TOTL] < n) {
+        s->mac_reg[TOTH]++;
+    }
+}
+
 static void
 xmit_seg(E1000State *s)
 {
@@ -716,7 +817,12 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
     }
         
     addr = le64_to_cpu(dp->buffer_addr);
-    if (tp->tse && tp->cptse) {
+    if (tp->tse && tp->cptse && e1000_tso_offload(s)) {
+        /* gather the whole frame, xmit_gso hands it to the host */
+        split_size = MIN(sizeof(tp->data) - tp->size, split_size);
+        pci_dma_read(d, addr, tp->data + tp->size, split_size);
+        tp->size += split_size;
+    } else if (tp->tse && tp->cptse) {
         msh = tp->hdr_len + tp->mss;
         do {
             bytes = split_size;
@@ -748,7 +854,11 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
 
     if (!(txd_lower & E1000_TXD_CMD_EOP))
         return;
-    if (!(tp->tse && tp->cptse && tp->size < tp->hdr_len)) {
+    if (tp->tse && tp->cptse && e1000_tso_offload(s)) {
+        if (tp->size > tp->hdr_len) {
+            xmit_gso(s);
+        }
+    } else if (!(tp->tse && tp->cptse && tp->size < tp->hdr_len)) {
         xmit_seg(s);
     }
     tp->tso_frames = 0;
@@ -759,9 +869,8 @@ process_tx_desc(E1000State *s, struct e1000_tx_desc *dp)
 }
 
 static uint32_t
-txdesc_writeback(E1000State *s, dma_addr_t base, struct e1000_tx_desc *dp)
+txdesc_writeback(E1000State *s, dma_addr_t offset, struct e1000_tx_desc *dp)
 {
-    PCIDevice *d = PCI_DEVICE(s);
     uint32_t txd_upper, txd_lower = le32_to_cpu(dp->lower.data);
 
     if (!(txd_lower & (E1000_TXD_CMD_RS|E1000_TXD_CMD_RPS)))
@@ -769,8 +878,9 @@ txdesc_writeback(E1000State *s, dma_addr_t base, struct e1000_tx_desc *dp)
     txd_upper = (le32_to_cpu(dp->upper.data) | E1000_TXD_STAT_DD) &
                 ~(E1000_TXD_STAT_EC | E1000_TXD_STAT_LC | E1000_TXD_STAT_TU);
     dp->upper.data = cpu_to_le32(txd_upper);
-    pci_dma_write(d, base + ((char *)&dp->upper - (char *)dp),
-                  &dp->upper, sizeof(dp->upper));
+    pci_dma_write_cached(&s->tx_ring,
+                         offset + ((char *)&dp->upper - (char *)dp),
+                         &dp->upper, sizeof(dp->upper));
     return E1000_ICR_TXDW;
 }
 
@@ -786,7 +896,7 @@ static void
 start_xmit(E1000State *s)
 {
     PCIDevice *d = PCI_DEVICE(s);
-    dma_addr_t base;
+    dma_addr_t offset;
     struct e1000_tx_desc desc;
     uint32_t tdh_start = s->mac_reg[TDH], cause = E1000_ICS_TXQE;
 
@@ -795,17 +905,17 @@ start_xmit(E1000State *s)
         return;
     }
 
+    pci_dma_cache_init(d, &s->tx_ring, tx_desc_base(s), s->mac_reg[TDLEN]);
     while (s->mac_reg[TDH] != s->mac_reg[TDT]) {
-        base = tx_desc_base(s) +
-               sizeof(struct e1000_tx_desc) * s->mac_reg[TDH];
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        offset = sizeof(struct e1000_tx_desc) * s->mac_reg[TDH];
+        pci_dma_read_cached(&s->tx_ring, offset, &desc, sizeof(desc));
 
         DBGOUT(TX, "index %d: %p : %x %x\n", s->mac_reg[TDH],
                (void *)(intptr_t)desc.buffer_addr, desc.lower.data,
                desc.upper.data);
 
         process_tx_desc(s, &desc);
-        cause |= txdesc_writeback(s, base, &desc);
+        cause |= txdesc_writeback(s, offset, &desc);
 
         if (++s->mac_reg[TDH] * sizeof(desc) >= s->mac_reg[TDLEN])
             s->mac_reg[TDH] = 0;
@@ -935,12 +1045,11 @@ static uint64_t rx_desc_base(E1000State *s)
 }
 
 static ssize_t
-e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
+e1000_receive_frame(E1000State *s, const struct iovec *iov, int iovcnt)
 {
-    E1000State *s = qemu_get_nic_opaque(nc);
     PCIDevice *d = PCI_DEVICE(s);
     struct e1000_rx_desc desc;
-    dma_addr_t base;
+    dma_addr_t offset;
     unsigned int n, rdt;
     uint32_t rdh_start;
     uint16_t vlan_special = 0;
@@ -1012,13 +1121,14 @@ e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
             set_ics(s, 0, E1000_ICS_RXO);
             return -1;
     }
+    pci_dma_cache_init(d, &s->rx_ring, rx_desc_base(s), s->mac_reg[RDLEN]);
     do {
         desc_size = total_size - desc_offset;
         if (desc_size > s->rxbuf_size) {
             desc_size = s->rxbuf_size;
         }
-        base = rx_desc_base(s) + sizeof(desc) * s->mac_reg[RDH];
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        offset = sizeof(desc) * s->mac_reg[RDH];
+        pci_dma_read_cached(&s->rx_ring, offset, &desc, sizeof(desc));
         desc.special = vlan_special;
         desc.status |= (vlan_status | E1000_RXD_STAT_DD);
         if (desc.buffer_addr) {
@@ -1053,7 +1163,7 @@ e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
         } else { // as per intel docs; skip descriptors with null buf addr
             DBGOUT(RX, "Null RX descriptor!!\n");
         }
-        pci_dma_write(d, base, &desc, sizeof(desc));
+        pci_dma_write_cached(&s->rx_ring, offset, &desc, sizeof(desc));
 
         if (++s->mac_reg[RDH] * sizeof(desc) >= s->mac_reg[RDLEN])
             s->mac_reg[RDH] = 0;
@@ -1089,6 +1199,35 @@ e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
     return size;
 }
 
+static ssize_t
+e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
+{
+    E1000State *s = qemu_get_nic_opaque(nc);
+    size_t hdr_len = sizeof(struct virtio_net_hdr);
+    size_t size;
+    struct iovec *frame;
+    unsigned int cnt;
+    ssize_t ret;
+
+    if (!s->has_vnet) {
+        return e1000_receive_frame(s, iov, iovcnt);
+    }
+
+    /* Drop the virtio-net header the peer puts in front of each frame.
+     * The guest cannot take GSO or checksum-offloaded frames, and
+     * qemu_set_offload() asked the peer not to send any. */
+    size = iov_size(iov, iovcnt);
+    if (size < hdr_len) {
+        return size;
+    }
+    frame = g_new(struct iovec, iovcnt);
+    cnt = iov_copy(frame, iovcnt, iov, iovcnt, hdr_len, size - hdr_len);
+    ret = e1000_receive_frame(s, frame, cnt);
+    g_free(frame);
+
+    return ret <= 0 ? ret : ret + hdr_len;
+}
+
 static ssize_t
 e1000_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
@@ -1516,6 +1655,8 @@ pci_e1000_uninit(PCIDevice *dev)
     timer_free(d->autoneg_timer);
     timer_del(d->mit_timer);
     timer_free(d->mit_timer);
+    address_space_cache_destroy(&d->tx_ring);
+    address_space_cache_destroy(&d->rx_ring);
     qemu_del_nic(d->nic);
 }
 
@@ -1534,6 +1675,7 @@ static int pci_e1000_init(PCIDevice *pci_dev)
     DeviceState *dev = DEVICE(pci_dev);
     E1000State *d = E1000(pci_dev);
     PCIDeviceClass *pdc = PCI_DEVICE_GET_CLASS(pci_dev);
+    NetClientState *nc;
     uint8_t *pci_conf;
     uint16_t checksum = 0;
     int i;
@@ -1569,6 +1711,15 @@ static int pci_e1000_init(PCIDevice *pci_dev)
 
     qemu_format_nic_info_str(qemu_get_queue(d->nic), macaddr);
 
+    nc = qemu_get_queue(d->nic);
+    if ((d->compat_flags & E1000_FLAG_TSO) && nc->peer &&
+        qemu_has_vnet_hdr(nc->peer)) {
+        qemu_using_vnet_hdr(nc->peer, true);
+        qemu_set_vnet_hdr_len(nc->peer, sizeof(struct virtio_net_hdr));
+        qemu_set_offload(nc->peer, 0, 0, 0, 0, 0);
+        d->has_vnet = true;
+    }
+
     d->autoneg_timer = timer_new_ms(QEMU_CLOCK_VIRTUAL, e1000_autoneg_timer, d);
     d->mit_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, e1000_mit_timer, d);
 
@@ -1587,6 +1738,8 @@ static Property e1000_properties[] = {
                     compat_flags, E1000_FLAG_AUTONEG_BIT, true),
     DEFINE_PROP_BIT("mitigation", E1000State,
                     compat_flags, E1000_FLAG_MIT_BIT, true),
+    DEFINE_PROP_BIT("host_tso", E1000State,
+                    compat_flags, E1000_FLAG_TSO_BIT, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
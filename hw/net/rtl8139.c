@@ -79,6 +79,10 @@
 #define ETH_P_8021Q 0x8100      /* 802.1Q VLAN Extended Header  */
 #define ETH_MTU     1500
 
+/* C+ descriptor rings hold up to 64 16-byte descriptors; anything the
+ * guest places beyond that just takes the uncached path */
+#define RTL8139_CPLUS_RING_SIZE (64 * 16)
+
 #define VLAN_TCI_LEN 2
 #define VLAN_HLEN (ETHER_TYPE_LEN + VLAN_TCI_LEN)
 
@@ -488,6 +492,9 @@ typedef struct RTL8139State {
 
     uint32_t   currCPlusRxDesc;
     uint32_t   currCPlusTxDesc;
+    /* C+ mode descriptor rings, retargeted before each use */
+    MemoryRegionCache cplus_rx_ring;
+    MemoryRegionCache cplus_tx_ring;
 
     uint32_t   RxRingAddrLO;
     uint32_t   RxRingAddrHI;
@@ -974,10 +981,12 @@ static ssize_t rtl8139_do_receive(NetClientState *nc, const uint8_t *buf, size_t
 /* w3 high 32bit of Rx buffer ptr */
 
         int descriptor = s->currCPlusRxDesc;
-        dma_addr_t cplus_rx_ring_desc;
+        dma_addr_t cplus_rx_ring_desc, desc_ofs = 16 * descriptor;
 
         cplus_rx_ring_desc = rtl8139_addr64(s->RxRingAddrLO, s->RxRingAddrHI);
-        cplus_rx_ring_desc += 16 * descriptor;
+        pci_dma_cache_init(d, &s->cplus_rx_ring, cplus_rx_ring_desc,
+                           RTL8139_CPLUS_RING_SIZE);
+        cplus_rx_ring_desc += desc_ofs;
 
         DPRINTF("+++ C+ mode reading RX descriptor %d from host memory at "
             "%08x %08x = "DMA_ADDR_FMT"\n", descriptor, s->RxRingAddrHI,
@@ -985,13 +994,13 @@ static ssize_t rtl8139_do_receive(NetClientState *nc, const uint8_t *buf, size_t
 
         uint32_t val, rxdw0,rxdw1,rxbufLO,rxbufHI;
 
-        pci_dma_read(d, cplus_rx_ring_desc, &val, 4);
+        pci_dma_read_cached(&s->cplus_rx_ring, desc_ofs, &val, 4);
         rxdw0 = le32_to_cpu(val);
-        pci_dma_read(d, cplus_rx_ring_desc+4, &val, 4);
+        pci_dma_read_cached(&s->cplus_rx_ring, desc_ofs + 4, &val, 4);
         rxdw1 = le32_to_cpu(val);
-        pci_dma_read(d, cplus_rx_ring_desc+8, &val, 4);
+        pci_dma_read_cached(&s->cplus_rx_ring, desc_ofs + 8, &val, 4);
         rxbufLO = le32_to_cpu(val);
-        pci_dma_read(d, cplus_rx_ring_desc+12, &val, 4);
+        pci_dma_read_cached(&s->cplus_rx_ring, desc_ofs + 12, &val, 4);
         rxbufHI = le32_to_cpu(val);
 
         DPRINTF("+++ C+ mode RX descriptor %d %08x %08x %08x %08x\n",
@@ -1120,9 +1129,9 @@ static ssize_t rtl8139_do_receive(NetClientState *nc, const uint8_t *buf, size_t
 
         /* update ring data */
         val = cpu_to_le32(rxdw0);
-        pci_dma_write(d, cplus_rx_ring_desc, (uint8_t *)&val, 4);
+        pci_dma_write_cached(&s->cplus_rx_ring, desc_ofs, &val, 4);
         val = cpu_to_le32(rxdw1);
-        pci_dma_write(d, cplus_rx_ring_desc+4, (uint8_t *)&val, 4);
+        pci_dma_write_cached(&s->cplus_rx_ring, desc_ofs + 4, &val, 4);
 
         /* update tally counter */
         ++s->tally_counters.RxOk;
@@ -1972,9 +1981,12 @@ static int rtl8139_cplus_transmit_one(RTL8139State *s)
     int descriptor = s->currCPlusTxDesc;
 
     dma_addr_t cplus_tx_ring_desc = rtl8139_addr64(s->TxAddr[0], s->TxAddr[1]);
+    dma_addr_t desc_ofs = 16 * descriptor;
 
     /* Normal priority ring */
-    cplus_tx_ring_desc += 16 * descriptor;
+    pci_dma_cache_init(d, &s->cplus_tx_ring, cplus_tx_ring_desc,
+                       RTL8139_CPLUS_RING_SIZE);
+    cplus_tx_ring_desc += desc_ofs;
 
     DPRINTF("+++ C+ mode reading TX descriptor %d from host memory at "
         "%08x %08x = 0x"DMA_ADDR_FMT"\n", descriptor, s->TxAddr[1],
@@ -1982,13 +1994,13 @@ static int rtl8139_cplus_transmit_one(RTL8139State *s)
 
     uint32_t val, txdw0,txdw1,txbufLO,txbufHI;
 
-    pci_dma_read(d, cplus_tx_ring_desc,    (uint8_t *)&val, 4);
+    pci_dma_read_cached(&s->cplus_tx_ring, desc_ofs, &val, 4);
     txdw0 = le32_to_cpu(val);
-    pci_dma_read(d, cplus_tx_ring_desc+4,  (uint8_t *)&val, 4);
+    pci_dma_read_cached(&s->cplus_tx_ring, desc_ofs + 4, &val, 4);
     txdw1 = le32_to_cpu(val);
-    pci_dma_read(d, cplus_tx_ring_desc+8,  (uint8_t *)&val, 4);
+    pci_dma_read_cached(&s->cplus_tx_ring, desc_ofs + 8, &val, 4);
     txbufLO = le32_to_cpu(val);
-    pci_dma_read(d, cplus_tx_ring_desc+12, (uint8_t *)&val, 4);
+    pci_dma_read_cached(&s->cplus_tx_ring, desc_ofs + 12, &val, 4);
     txbufHI = le32_to_cpu(val);
 
     DPRINTF("+++ C+ mode TX descriptor %d %08x %08x %08x %08x\n", descriptor,
@@ -2123,7 +2135,7 @@ static int rtl8139_cplus_transmit_one(RTL8139State *s)
 
     /* update ring data */
     val = cpu_to_le32(txdw0);
-    pci_dma_write(d, cplus_tx_ring_desc, (uint8_t *)&val, 4);
+    pci_dma_write_cached(&s->cplus_tx_ring, desc_ofs, &val, 4);
 
     /* Now decide if descriptor being processed is holding the last segment of packet */
     if (txdw0 & CP_TX_LS)
@@ -3472,6 +3484,8 @@ static void pci_rtl8139_uninit(PCIDevice *dev)
     }
     timer_del(s->timer);
     timer_free(s->timer);
+    address_space_cache_destroy(&s->cplus_rx_ring);
+    address_space_cache_destroy(&s->cplus_tx_ring);
     qemu_del_nic(s->nic);
 }
 
@@ -44,8 +44,15 @@ struct vhost_net {
     struct vhost_virtqueue vqs[2];
     int backend;
     NetClientState *nc;
+    uint32_t poll_us;
+    bool zerocopy;
+    /* the device the queues run for, while started */
+    VirtIODevice *vdev;
 };
 
+#define VHOST_NET_ZEROCOPY_PARAM \
+    "/sys/module/vhost_net/parameters/experimental_zcopytx"
+
 /* Features supported by host kernel. */
 static const int kernel_feature_bits[] = {
     VIRTIO_F_NOTIFY_ON_EMPTY,
@@ -130,6 +137,44 @@ static int vhost_net_get_fd(NetClientState *backend)
     }
 }
 
+/* Zero-copy transmit is a module parameter of the host driver, so all that
+ * can be done per netdev is to check it.  Returns -1 if it can't be read.
+ */
+static int vhost_net_zerocopy_enabled(void)
+{
+    gchar *s = NULL;
+    int ret;
+
+    if (!g_file_get_contents(VHOST_NET_ZEROCOPY_PARAM, &s, NULL, NULL)) {
+        return -1;
+    }
+    ret = g_ascii_strtoull(s, NULL, 10) != 0;
+    g_free(s);
+    return ret;
+}
+
+static int vhost_net_set_poll_us(struct vhost_net *net, uint32_t poll_us)
+{
+    struct vhost_vring_state state = { .num = poll_us };
+    const VhostOps *vhost_ops = net->dev.vhost_ops;
+
+    for (state.index = 0; state.index < net->dev.nvqs; ++state.index) {
+        if (vhost_ops->vhost_call(&net->dev, VHOST_SET_VRING_BUSYLOOP_TIMEOUT,
+                                  &state) < 0) {
+            if (errno == ENOTTY || errno == EINVAL) {
+                error_report("vhost-net: host kernel does not support "
+                             "busy polling (poll-us)");
+            } else {
+                error_report("vhost-net: cannot set busy polling timeout: %s",
+                             strerror(errno));
+            }
+            return -1;
+        }
+    }
+    net->poll_us = poll_us;
+    return 0;
+}
+
 struct vhost_net *vhost_net_init(VhostNetOptions *options)
 {
     int r;
@@ -154,9 +199,13 @@ struct vhost_net *vhost_net_init(VhostNetOptions *options)
         net->backend = -1;
     }
     net->nc = options->net_backend;
+    net->poll_us = 0;
+    net->zerocopy = false;
+    net->vdev = NULL;
 
     net->dev.nvqs = 2;
     net->dev.vqs = net->vqs;
+    net->dev.vq_index = net->nc->queue_index * 2;
 
     r = vhost_dev_init(&net->dev, options->opaque,
                        options->backend_type, options->force);
@@ -175,6 +224,27 @@ struct vhost_net *vhost_net_init(VhostNetOptions *options)
             vhost_dev_cleanup(&net->dev);
             goto fail;
         }
+
+        r = vhost_net_zerocopy_enabled();
+        net->zerocopy = r > 0;
+        if (options->has_zerocopy && r != options->zerocopy) {
+            if (r < 0) {
+                error_report("vhost-net: cannot read %s",
+                             VHOST_NET_ZEROCOPY_PARAM);
+            } else {
+                error_report("vhost-net: zero-copy transmit is %s in the "
+                             "host, load vhost_net with "
+                             "experimental_zcopytx=%d",
+                             r ? "enabled" : "disabled", options->zerocopy);
+            }
+            vhost_dev_cleanup(&net->dev);
+            goto fail;
+        }
+
+        if (options->poll_us && vhost_net_set_poll_us(net, options->poll_us)) {
+            vhost_dev_cleanup(&net->dev);
+            goto fail;
+        }
     }
     /* Set sane init value. Override when guest acks. */
     vhost_net_ack_features(net, 0);
@@ -217,6 +287,8 @@ static int vhost_net_start_one(struct vhost_net *net,
         net->nc->info->poll(net->nc, false);
     }
 
+    net->vdev = dev;
+
     if (net->nc->info->type == NET_CLIENT_OPTIONS_KIND_TAP) {
         qemu_set_fd_handler(net->backend, NULL, NULL, NULL);
         file.fd = net->backend;
@@ -244,6 +316,7 @@ fail:
     if (net->nc->info->poll) {
         net->nc->info->poll(net->nc, true);
     }
+    net->vdev = NULL;
     vhost_dev_stop(&net->dev, dev);
 fail_start:
     vhost_dev_disable_notifiers(&net->dev, dev);
@@ -267,6 +340,7 @@ static void vhost_net_stop_one(struct vhost_net *net,
     if (net->nc->info->poll) {
         net->nc->info->poll(net->nc, true);
     }
+    net->vdev = NULL;
     vhost_dev_stop(&net->dev, dev);
     vhost_dev_disable_notifiers(&net->dev, dev);
 }
@@ -368,6 +442,27 @@ bool vhost_net_virtqueue_pending(VHostNetState *net, int idx)
     return vhost_virtqueue_pending(&net->dev, idx);
 }
 
+int vhost_net_set_vring_enable(VHostNetState *net, int enable)
+{
+    const VhostOps *vhost_ops = net->dev.vhost_ops;
+
+    if (vhost_ops->vhost_backend_set_vring_enable) {
+        return vhost_ops->vhost_backend_set_vring_enable(&net->dev, enable);
+    }
+
+    return 0;
+}
+
+uint64_t vhost_net_get_max_queues(VHostNetState *net)
+{
+    return net->dev.max_queues;
+}
+
+unsigned vhost_net_get_acked_features(VHostNetState *net)
+{
+    return net->dev.acked_features;
+}
+
 void vhost_net_virtqueue_mask(VHostNetState *net, VirtIODevice *dev,
                               int idx, bool mask)
 {
@@ -395,6 +490,51 @@ VHostNetState *get_vhost_net(NetClientState *nc)
 
     return vhost_net;
 }
+
+/* The kernel doesn't export notification counters, but the value of an
+ * eventfd that nobody reads is the number of times it was signalled.
+ */
+static int64_t vhost_net_eventfd_count(EventNotifier *e)
+{
+    gchar *path = g_strdup_printf("/proc/self/fdinfo/%d",
+                                  event_notifier_get_fd(e));
+    gchar *s = NULL;
+    char *p;
+    int64_t count = 0;
+
+    if (g_file_get_contents(path, &s, NULL, NULL)) {
+        p = strstr(s, "eventfd-count:");
+        if (p) {
+            count = g_ascii_strtoull(p + strlen("eventfd-count:"), NULL, 16);
+        }
+        g_free(s);
+    }
+    g_free(path);
+    return count;
+}
+
+void vhost_net_get_info(VHostNetState *net, VhostNetInfo *info)
+{
+    VirtQueue *rx, *tx;
+
+    info->started = net->vdev != NULL;
+    info->poll_us = net->poll_us;
+    info->zerocopy = net->zerocopy;
+    if (!net->vdev) {
+        return;
+    }
+
+    rx = virtio_get_queue(net->vdev, net->dev.vq_index);
+    tx = virtio_get_queue(net->vdev, net->dev.vq_index + 1);
+    info->rx_kicks =
+        vhost_net_eventfd_count(virtio_queue_get_host_notifier(rx));
+    info->rx_calls =
+        vhost_net_eventfd_count(virtio_queue_get_guest_notifier(rx));
+    info->tx_kicks =
+        vhost_net_eventfd_count(virtio_queue_get_host_notifier(tx));
+    info->tx_calls =
+        vhost_net_eventfd_count(virtio_queue_get_guest_notifier(tx));
+}
 #else
 struct vhost_net *vhost_net_init(VhostNetOptions *options)
 {
@@ -436,6 +576,21 @@ bool vhost_net_virtqueue_pending(VHostNetState *net, int idx)
     return false;
 }
 
+int vhost_net_set_vring_enable(VHostNetState *net, int enable)
+{
+    return 0;
+}
+
+uint64_t vhost_net_get_max_queues(VHostNetState *net)
+{
+    return 1;
+}
+
+unsigned vhost_net_get_acked_features(VHostNetState *net)
+{
+    return 0;
+}
+
 void vhost_net_virtqueue_mask(VHostNetState *net, VirtIODevice *dev,
                               int idx, bool mask)
 {
@@ -445,4 +600,8 @@ VHostNetState *get_vhost_net(NetClientState *nc)
 {
     return 0;
 }
+
+void vhost_net_get_info(VHostNetState *net, VhostNetInfo *info)
+{
+}
 #endif
@@ -110,6 +110,8 @@ static void virtio_net_announce_timer(void *opaque)
     virtio_notify_config(vdev);
 }
 
+static void virtio_net_set_queues(VirtIONet *n);
+
 static void virtio_net_vhost_status(VirtIONet *n, uint8_t status)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -148,6 +150,9 @@ static void virtio_net_vhost_status(VirtIONet *n, uint8_t status)
             error_report("unable to start vhost net: %d: "
                          "falling back on userspace virtio", -r);
             n->vhost_started = 0;
+        } else {
+            /* vhost-user rings start disabled, enable the active ones */
+            virtio_net_set_queues(n);
         }
     } else {
         vhost_net_stop(vdev, n->nic->ncs, queues);
@@ -401,6 +406,15 @@ static int peer_attach(VirtIONet *n, int index)
         return 0;
     }
 
+    if (nc->peer->info->type == NET_CLIENT_OPTIONS_KIND_VHOST_USER) {
+        /* A failure here means the backend is gone; its close event
+         * takes the link down. */
+        if (get_vhost_net(nc->peer)) {
+            vhost_net_set_vring_enable(get_vhost_net(nc->peer), 1);
+        }
+        return 0;
+    }
+
     if (nc->peer->info->type != NET_CLIENT_OPTIONS_KIND_TAP) {
         return 0;
     }
@@ -416,6 +430,13 @@ static int peer_detach(VirtIONet *n, int index)
         return 0;
     }
 
+    if (nc->peer->info->type == NET_CLIENT_OPTIONS_KIND_VHOST_USER) {
+        if (get_vhost_net(nc->peer)) {
+            vhost_net_set_vring_enable(get_vhost_net(nc->peer), 0);
+        }
+        return 0;
+    }
+
     if (nc->peer->info->type !=  NET_CLIENT_OPTIONS_KIND_TAP) {
         return 0;
     }
@@ -839,12 +860,58 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 
 /* RX */
 
+/* The RSS key from the Microsoft RSS verification suite */
+static const uint8_t virtio_net_rss_default_key[ETH_RSS_KEY_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+static bool virtio_net_rss_active(VirtIONet *n)
+{
+    return n->net_conf.rss && n->curr_queues > 1;
+}
+
+/*
+ * Pick the queue pair for a received frame from the Toeplitz hash of its
+ * flow, so that every flow lands on one queue whichever backend queue it
+ * arrived on.  Frames that can't be hashed stay where they are.
+ */
+static int virtio_net_rss_steer(VirtIONet *n, int queue_index,
+                                const uint8_t *buf, size_t size)
+{
+    uint8_t input[ETH_RSS_INPUT_MAX];
+    size_t input_len;
+
+    if (eth_get_rss_input(buf, size,
+                          ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_IPV4) |
+                          ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_TCP_IPV4) |
+                          ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_IPV6) |
+                          ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_TCP_IPV6),
+                          input, &input_len) == ETH_RSS_TYPE_NONE) {
+        return queue_index;
+    }
+
+    return eth_calc_rss_hash(n->rss_key, input, input_len) % n->curr_queues;
+}
+
 static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    int i;
 
-    qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
+    if (!virtio_net_rss_active(n)) {
+        qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
+        return;
+    }
+
+    /* Frames steered to this queue may be held on any backend queue */
+    for (i = 0; i < n->curr_queues; i++) {
+        qemu_flush_queued_packets(qemu_get_subqueue(n->nic, i));
+    }
 }
 
 static int virtio_net_can_receive(NetClientState *nc)
@@ -1007,6 +1074,16 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
     unsigned mhdr_cnt = 0;
     size_t offset, i, guest_offset;
 
+    if (virtio_net_rss_active(n) && size > n->host_hdr_len) {
+        int queue_index = virtio_net_rss_steer(n, nc->queue_index,
+                                               buf + n->host_hdr_len,
+                                               size - n->host_hdr_len);
+        /* A full target queue holds the frame back on this one; every
+         * rx kick flushes all queues, so it is retried in order. */
+        nc = qemu_get_subqueue(n->nic, queue_index);
+        q = &n->vqs[queue_index];
+    }
+
     if (!virtio_net_can_receive(nc)) {
         return -1;
     }
@@ -1024,7 +1101,7 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
     while (offset < size) {
         VirtQueueElement elem;
         int len, total;
-        const struct iovec *sg = elem.in_sg;
+        const struct iovec *sg;
 
         total = 0;
 
@@ -1043,6 +1120,7 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
             error_report("virtio-net receive queue contains no in buffers");
             exit(1);
         }
+        sg = elem.in_sg;
 
         if (i == 0) {
             assert(offset == 0);
@@ -1097,6 +1175,83 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf, size_t
     return size;
 }
 
+/* Enough for receive_filter() and for spotting a DHCP reply */
+#define RX_DIRECT_PEEK_LEN 64
+
+/*
+ * Direct receive: lend a whole rx buffer to the backend, which reads the
+ * packet, header included, into guest memory.  Only when the backend's
+ * header is what the guest expects and every packet needs one buffer.
+ */
+static int virtio_net_rx_buffer_get(NetClientState *nc, struct iovec *iov,
+                                    int iovcnt)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtQueueElement *elem = &q->rx_direct;
+
+    if (n->mergeable_rx_bufs || !n->has_vnet_hdr ||
+        n->host_hdr_len != n->guest_hdr_len || virtio_net_rss_active(n)) {
+        return 0;
+    }
+
+    if (!virtio_net_can_receive(nc) || !virtio_net_has_buffers(q, 0)) {
+        return 0;
+    }
+
+    if (!virtqueue_pop(q->rx_vq, elem)) {
+        return 0;
+    }
+
+    if (elem->in_num < 1 || elem->in_num > iovcnt) {
+        virtqueue_discard(q->rx_vq, elem, 0);
+        return 0;
+    }
+
+    memcpy(iov, elem->in_sg, elem->in_num * sizeof(*iov));
+    return elem->in_num;
+}
+
+static void virtio_net_rx_buffer_put(NetClientState *nc, ssize_t len)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtQueueElement *elem = &q->rx_direct;
+    uint8_t buf[sizeof(struct virtio_net_hdr_mrg_rxbuf) + 1500];
+    struct virtio_net_hdr *hdr = (struct virtio_net_hdr *)buf;
+    size_t copied;
+    uint8_t flags;
+
+    if (len <= (ssize_t)n->host_hdr_len) {
+        virtqueue_discard(q->rx_vq, elem, 0);
+        return;
+    }
+
+    copied = iov_to_buf(elem->in_sg, elem->in_num, 0, buf,
+                        MIN(len, n->host_hdr_len + RX_DIRECT_PEEK_LEN));
+    if (!receive_filter(n, buf, len)) {
+        virtqueue_discard(q->rx_vq, elem, 0);
+        return;
+    }
+
+    /* The dhclient fixup needs the whole (small) packet */
+    flags = hdr->flags;
+    if ((flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && (size_t)len <= sizeof(buf)) {
+        copied += iov_to_buf(elem->in_sg, elem->in_num, copied,
+                             buf + copied, len - copied);
+        work_around_broken_dhclient(hdr, buf + n->host_hdr_len,
+                                    len - n->host_hdr_len);
+    }
+    virtio_net_hdr_swap(vdev, hdr);
+    iov_from_buf(elem->in_sg, elem->in_num, 0, buf,
+                 hdr->flags != flags ? copied : sizeof(*hdr));
+
+    virtqueue_fill(q->rx_vq, elem, len, 0);
+    virtqueue_flush(q->rx_vq, 1);
+    virtio_notify(vdev, q->rx_vq);
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
@@ -1115,6 +1270,16 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Publish the first @count used entries filled by virtio_net_flush_tx */
+static void virtio_net_tx_push_used(VirtIONetQueue *q, unsigned int count)
+{
+    if (count) {
+        virtqueue_flush(q->tx_vq, count);
+        virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
@@ -1122,6 +1287,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
     VirtQueueElement elem;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -1131,6 +1297,9 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
+    /* Let the backend send the whole burst at once */
+    qemu_net_io_plug(nc->peer);
+
     while (virtqueue_pop(q->tx_vq, &elem)) {
         ssize_t ret, len;
         unsigned int out_num = elem.out_num;
@@ -1169,24 +1338,28 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 
         len = n->guest_hdr_len;
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        ret = qemu_sendv_packet_async(nc, out_sg, out_num,
+                                      virtio_net_tx_complete);
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
             q->async_tx.len  = len;
+            qemu_net_io_unplug(nc->peer);
+            virtio_net_tx_push_used(q, num_packets);
             return -EBUSY;
         }
 
         len += ret;
 
-        virtqueue_push(q->tx_vq, &elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        /* The used index and the interrupt are updated once per burst */
+        virtqueue_fill(q->tx_vq, &elem, 0, num_packets);
 
-        if (++num_packets >= n->tx_burst) {
+        if (++num_packets >= q->tx_burst) {
             break;
         }
     }
+    qemu_net_io_unplug(nc->peer);
+    virtio_net_tx_push_used(q, num_packets);
     return num_packets;
 }
 
@@ -1281,12 +1454,15 @@ static void virtio_net_tx_bh(void *opaque)
     }
 
     /* If we flush a full burst of packets, assume there are
-     * more coming and immediately reschedule */
-    if (ret >= n->tx_burst) {
+     * more coming and immediately reschedule, with a larger burst
+     * so that a busy queue is rescheduled less often */
+    if (ret >= q->tx_burst) {
+        q->tx_burst = MIN(q->tx_burst * 2, n->tx_burst * TX_BURST_GROW_MAX);
         qemu_bh_schedule(q->tx_bh);
         q->tx_waiting = 1;
         return;
     }
+    q->tx_burst = n->tx_burst;
 
     /* If less than a full burst, re-enable notification and flush
      * anything that may have come in while we weren't looking.  If
@@ -1537,6 +1713,8 @@ static NetClientInfo net_virtio_info = {
     .cleanup = virtio_net_cleanup,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
+    .rx_buffer_get = virtio_net_rx_buffer_get,
+    .rx_buffer_put = virtio_net_rx_buffer_put,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -1598,6 +1776,7 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     n->curr_queues = 1;
     n->vqs[0].n = n;
     n->tx_timeout = n->net_conf.txtimer;
+    memcpy(n->rss_key, virtio_net_rss_default_key, sizeof(n->rss_key));
 
     if (n->net_conf.tx && strcmp(n->net_conf.tx, "timer")
                        && strcmp(n->net_conf.tx, "bh")) {
@@ -1649,6 +1828,9 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     n->vqs[0].tx_waiting = 0;
     n->tx_burst = n->net_conf.txburst;
+    for (i = 0; i < n->max_queues; i++) {
+        n->vqs[i].tx_burst = n->tx_burst;
+    }
     virtio_net_set_mrg_rx_bufs(n, 0);
     n->promisc = 1; /* for compatibility */
 
@@ -1724,6 +1906,7 @@ static Property virtio_net_properties[] = {
                                                TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_BOOL("rss", VirtIONet, net_conf.rss, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
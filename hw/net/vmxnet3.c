@@ -313,6 +313,13 @@ typedef struct {
         MACAddr *mcast_list;
         uint32_t mcast_list_len;
         uint32_t mcast_list_buff_size; /* needed for live migration. */
+
+        /* RSS configuration, re-read from guest memory after migration */
+        bool rss_enabled;
+        uint16_t rss_hash_type;
+        uint16_t rss_ind_size;
+        uint8_t rss_key[ETH_RSS_KEY_SIZE];
+        uint8_t rss_ind[UPT1_RSS_MAX_IND_TABLE_SIZE];
 } VMXNET3State;
 
 /* Interrupt management */
@@ -792,23 +799,22 @@ vmxnet3_revert_rxc_descr(VMXNET3State *s, int qidx)
     vmxnet3_dec_rx_completion_counter(s, qidx);
 }
 
-#define RXQ_IDX      (0)
 #define RX_HEAD_BODY_RING (0)
 #define RX_BODY_ONLY_RING (1)
 
 static bool
-vmxnet3_get_next_head_rx_descr(VMXNET3State *s,
+vmxnet3_get_next_head_rx_descr(VMXNET3State *s, int qidx,
                                struct Vmxnet3_RxDesc *descr_buf,
                                uint32_t *descr_idx,
                                uint32_t *ridx)
 {
     for (;;) {
         uint32_t ring_gen;
-        vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_HEAD_BODY_RING,
+        vmxnet3_read_next_rx_descr(s, qidx, RX_HEAD_BODY_RING,
                                    descr_buf, descr_idx);
 
         /* If no more free descriptors - return */
-        ring_gen = vmxnet3_get_rx_ring_gen(s, RXQ_IDX, RX_HEAD_BODY_RING);
+        ring_gen = vmxnet3_get_rx_ring_gen(s, qidx, RX_HEAD_BODY_RING);
         if (descr_buf->gen != ring_gen) {
             return false;
         }
@@ -816,11 +822,11 @@ vmxnet3_get_next_head_rx_descr(VMXNET3State *s,
         /* Only read after generation field verification */
         smp_rmb();
         /* Re-read to be sure we got the latest version */
-        vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_HEAD_BODY_RING,
+        vmxnet3_read_next_rx_descr(s, qidx, RX_HEAD_BODY_RING,
                                    descr_buf, descr_idx);
 
         /* Mark current descriptor as used/skipped */
-        vmxnet3_inc_rx_consumption_counter(s, RXQ_IDX, RX_HEAD_BODY_RING);
+        vmxnet3_inc_rx_consumption_counter(s, qidx, RX_HEAD_BODY_RING);
 
         /* If this is what we are looking for - return */
         if (descr_buf->btype == VMXNET3_RXD_BTYPE_HEAD) {
@@ -831,21 +837,21 @@ vmxnet3_get_next_head_rx_descr(VMXNET3State *s,
 }
 
 static bool
-vmxnet3_get_next_body_rx_descr(VMXNET3State *s,
+vmxnet3_get_next_body_rx_descr(VMXNET3State *s, int qidx,
                                struct Vmxnet3_RxDesc *d,
                                uint32_t *didx,
                                uint32_t *ridx)
 {
-    vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_HEAD_BODY_RING, d, didx);
+    vmxnet3_read_next_rx_descr(s, qidx, RX_HEAD_BODY_RING, d, didx);
 
     /* Try to find corresponding descriptor in head/body ring */
-    if (d->gen == vmxnet3_get_rx_ring_gen(s, RXQ_IDX, RX_HEAD_BODY_RING)) {
+    if (d->gen == vmxnet3_get_rx_ring_gen(s, qidx, RX_HEAD_BODY_RING)) {
         /* Only read after generation field verification */
         smp_rmb();
         /* Re-read to be sure we got the latest version */
-        vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_HEAD_BODY_RING, d, didx);
+        vmxnet3_read_next_rx_descr(s, qidx, RX_HEAD_BODY_RING, d, didx);
         if (d->btype == VMXNET3_RXD_BTYPE_BODY) {
-            vmxnet3_inc_rx_consumption_counter(s, RXQ_IDX, RX_HEAD_BODY_RING);
+            vmxnet3_inc_rx_consumption_counter(s, qidx, RX_HEAD_BODY_RING);
             *ridx = RX_HEAD_BODY_RING;
             return true;
         }
@@ -855,17 +861,17 @@ vmxnet3_get_next_body_rx_descr(VMXNET3State *s,
      * If there is no free descriptors on head/body ring or next free
      * descriptor is a head descriptor switch to body only ring
      */
-    vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_BODY_ONLY_RING, d, didx);
+    vmxnet3_read_next_rx_descr(s, qidx, RX_BODY_ONLY_RING, d, didx);
 
     /* If no more free descriptors - return */
-    if (d->gen == vmxnet3_get_rx_ring_gen(s, RXQ_IDX, RX_BODY_ONLY_RING)) {
+    if (d->gen == vmxnet3_get_rx_ring_gen(s, qidx, RX_BODY_ONLY_RING)) {
         /* Only read after generation field verification */
         smp_rmb();
         /* Re-read to be sure we got the latest version */
-        vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_BODY_ONLY_RING, d, didx);
+        vmxnet3_read_next_rx_descr(s, qidx, RX_BODY_ONLY_RING, d, didx);
         assert(d->btype == VMXNET3_RXD_BTYPE_BODY);
         *ridx = RX_BODY_ONLY_RING;
-        vmxnet3_inc_rx_consumption_counter(s, RXQ_IDX, RX_BODY_ONLY_RING);
+        vmxnet3_inc_rx_consumption_counter(s, qidx, RX_BODY_ONLY_RING);
         return true;
     }
 
@@ -873,15 +879,17 @@ vmxnet3_get_next_body_rx_descr(VMXNET3State *s,
 }
 
 static inline bool
-vmxnet3_get_next_rx_descr(VMXNET3State *s, bool is_head,
+vmxnet3_get_next_rx_descr(VMXNET3State *s, int qidx, bool is_head,
                           struct Vmxnet3_RxDesc *descr_buf,
                           uint32_t *descr_idx,
                           uint32_t *ridx)
 {
     if (is_head || !s->rx_packets_compound) {
-        return vmxnet3_get_next_head_rx_descr(s, descr_buf, descr_idx, ridx);
+        return vmxnet3_get_next_head_rx_descr(s, qidx, descr_buf,
+                                              descr_idx, ridx);
     } else {
-        return vmxnet3_get_next_body_rx_descr(s, descr_buf, descr_idx, ridx);
+        return vmxnet3_get_next_body_rx_descr(s, qidx, descr_buf,
+                                              descr_idx, ridx);
     }
 }
 
@@ -967,7 +975,8 @@ vmxnet3_physical_memory_writev(const struct iovec *iov,
 }
 
 static bool
-vmxnet3_indicate_packet(VMXNET3State *s)
+vmxnet3_indicate_packet(VMXNET3State *s, int qidx,
+                        uint8_t rss_type, uint32_t rss_hash)
 {
     struct Vmxnet3_RxDesc rxd;
     bool is_head = true;
@@ -993,12 +1002,13 @@ vmxnet3_indicate_packet(VMXNET3State *s)
             break;
         }
 
-        new_rxcd_pa = vmxnet3_pop_rxc_descr(s, RXQ_IDX, &new_rxcd_gen);
+        new_rxcd_pa = vmxnet3_pop_rxc_descr(s, qidx, &new_rxcd_gen);
         if (!new_rxcd_pa) {
             break;
         }
 
-        if (!vmxnet3_get_next_rx_descr(s, is_head, &rxd, &rxd_idx, &rx_ridx)) {
+        if (!vmxnet3_get_next_rx_descr(s, qidx, is_head,
+                                       &rxd, &rxd_idx, &rx_ridx)) {
             break;
         }
 
@@ -1019,7 +1029,9 @@ vmxnet3_indicate_packet(VMXNET3State *s)
         rxcd.len = chunk_size;
         rxcd.sop = is_head;
         rxcd.gen = new_rxcd_gen;
-        rxcd.rqID = RXQ_IDX + rx_ridx * s->rxq_num;
+        rxcd.rqID = qidx + rx_ridx * s->rxq_num;
+        rxcd.rssType = rss_type;
+        rxcd.rssHash = cpu_to_le32(rss_hash);
 
         if (bytes_left == 0) {
             vmxnet3_rx_update_descr(s->rx_pkt, &rxcd);
@@ -1049,19 +1061,19 @@ vmxnet3_indicate_packet(VMXNET3State *s)
     }
 
     if (new_rxcd_pa != 0) {
-        vmxnet3_revert_rxc_descr(s, RXQ_IDX);
+        vmxnet3_revert_rxc_descr(s, qidx);
     }
 
-    vmxnet3_trigger_interrupt(s, s->rxq_descr[RXQ_IDX].intr_idx);
+    vmxnet3_trigger_interrupt(s, s->rxq_descr[qidx].intr_idx);
 
     if (bytes_left == 0) {
-        vmxnet3_on_rx_done_update_stats(s, RXQ_IDX, VMXNET3_PKT_STATUS_OK);
+        vmxnet3_on_rx_done_update_stats(s, qidx, VMXNET3_PKT_STATUS_OK);
         return true;
     } else if (num_frags == s->max_rx_frags) {
-        vmxnet3_on_rx_done_update_stats(s, RXQ_IDX, VMXNET3_PKT_STATUS_ERROR);
+        vmxnet3_on_rx_done_update_stats(s, qidx, VMXNET3_PKT_STATUS_ERROR);
         return false;
     } else {
-        vmxnet3_on_rx_done_update_stats(s, RXQ_IDX,
+        vmxnet3_on_rx_done_update_stats(s, qidx,
                                         VMXNET3_PKT_STATUS_OUT_OF_BUF);
         return false;
     }
@@ -1147,6 +1159,7 @@ static void vmxnet3_reset(VMXNET3State *s)
     vmxnet3_reset_interrupt_states(s);
     vmxnet_tx_pkt_reset(s->tx_pkt);
     s->drv_shmem = 0;
+    s->rss_enabled = false;
     s->tx_sop = true;
     s->skip_current_tx_pkt = false;
 }
@@ -1303,6 +1316,56 @@ static void vmxnet3_update_features(VMXNET3State *s)
     }
 }
 
+static void vmxnet3_setup_rss(VMXNET3State *s)
+{
+    struct UPT1_RSSConf conf;
+    uint32_t guest_features;
+    uint32_t conf_len;
+    uint64_t conf_pa;
+    uint16_t key_size;
+
+    s->rss_enabled = false;
+
+    guest_features = VMXNET3_READ_DRV_SHARED32(s->drv_shmem,
+                                               devRead.misc.uptFeatures);
+    if (!VMXNET_FLAG_IS_SET(guest_features, UPT1_F_RSS) || s->rxq_num < 2) {
+        return;
+    }
+
+    conf_len = VMXNET3_READ_DRV_SHARED32(s->drv_shmem,
+                                         devRead.rssConfDesc.confLen);
+    conf_pa = VMXNET3_READ_DRV_SHARED64(s->drv_shmem,
+                                        devRead.rssConfDesc.confPA);
+    if (conf_pa == 0 || conf_len < sizeof(conf)) {
+        VMW_WRPRN("RSS requested without a valid configuration");
+        return;
+    }
+
+    cpu_physical_memory_read(conf_pa, &conf, sizeof(conf));
+    if (le16_to_cpu(conf.hashFunc) != UPT1_RSS_HASH_FUNC_TOEPLITZ) {
+        VMW_WRPRN("Unsupported RSS hash function %u",
+                  le16_to_cpu(conf.hashFunc));
+        return;
+    }
+
+    key_size = MIN(le16_to_cpu(conf.hashKeySize), UPT1_RSS_MAX_KEY_SIZE);
+    s->rss_ind_size = MIN(le16_to_cpu(conf.indTableSize),
+                          UPT1_RSS_MAX_IND_TABLE_SIZE);
+    if (s->rss_ind_size == 0) {
+        VMW_WRPRN("RSS indirection table is empty");
+        return;
+    }
+
+    s->rss_hash_type = le16_to_cpu(conf.hashType);
+    memset(s->rss_key, 0, sizeof(s->rss_key));
+    memcpy(s->rss_key, conf.hashKey, key_size);
+    memcpy(s->rss_ind, conf.indTable, s->rss_ind_size);
+    s->rss_enabled = true;
+
+    VMW_CFPRN("RSS: hash types 0x%x, key %u bytes, table %u entries",
+              s->rss_hash_type, key_size, s->rss_ind_size);
+}
+
 static bool vmxnet3_verify_intx(VMXNET3State *s, int intx)
 {
     return s->msix_used || s->msi_used || (intx ==
@@ -1497,6 +1560,7 @@ static void vmxnet3_activate_device(VMXNET3State *s)
     }
 
     vmxnet3_validate_interrupts(s);
+    vmxnet3_setup_rss(s);
 
     /* Make sure everything is in place before device activation */
     smp_wmb();
@@ -1554,6 +1618,11 @@ static void vmxnet3_handle_command(VMXNET3State *s, uint64_t cmd)
         vmxnet3_update_pm_state(s);
         break;
 
+    case VMXNET3_CMD_UPDATE_RSSIDT:
+        VMW_CBPRN("Set: Update RSS indirection table");
+        vmxnet3_setup_rss(s);
+        break;
+
     case VMXNET3_CMD_GET_LINK:
         VMW_CBPRN("Set: Get link");
         break;
@@ -1867,12 +1936,69 @@ vmxnet3_rx_filter_may_indicate(VMXNET3State *s, const void *data,
     return true;
 }
 
+/*
+ * Pick the RX queue for a frame the way the guest asked in its RSS
+ * configuration. Returns the queue index and fills in the hash type and
+ * value the guest expects in the completion descriptor.
+ */
+static int
+vmxnet3_rss_get_queue(VMXNET3State *s, const uint8_t *buf, size_t size,
+                      uint8_t *rss_type, uint32_t *rss_hash)
+{
+    static const uint8_t rcd_rss_type[] = {
+        [ETH_RSS_TYPE_NONE]     = VMXNET3_RCD_RSS_TYPE_NONE,
+        [ETH_RSS_TYPE_IPV4]     = VMXNET3_RCD_RSS_TYPE_IPV4,
+        [ETH_RSS_TYPE_TCP_IPV4] = VMXNET3_RCD_RSS_TYPE_TCPIPV4,
+        [ETH_RSS_TYPE_IPV6]     = VMXNET3_RCD_RSS_TYPE_IPV6,
+        [ETH_RSS_TYPE_TCP_IPV6] = VMXNET3_RCD_RSS_TYPE_TCPIPV6,
+    };
+    uint8_t input[ETH_RSS_INPUT_MAX];
+    size_t input_len;
+    uint32_t types = 0;
+    eth_rss_types_e type;
+    uint8_t qidx;
+
+    *rss_type = VMXNET3_RCD_RSS_TYPE_NONE;
+    *rss_hash = 0;
+
+    if (!s->rss_enabled) {
+        return 0;
+    }
+
+    if (s->rss_hash_type & UPT1_RSS_HASH_TYPE_IPV4) {
+        types |= ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_IPV4);
+    }
+    if (s->rss_hash_type & UPT1_RSS_HASH_TYPE_TCP_IPV4) {
+        types |= ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_TCP_IPV4);
+    }
+    if (s->rss_hash_type & UPT1_RSS_HASH_TYPE_IPV6) {
+        types |= ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_IPV6);
+    }
+    if (s->rss_hash_type & UPT1_RSS_HASH_TYPE_TCP_IPV6) {
+        types |= ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_TCP_IPV6);
+    }
+
+    type = eth_get_rss_input(buf, size, types, input, &input_len);
+    if (type == ETH_RSS_TYPE_NONE) {
+        return 0;
+    }
+
+    *rss_type = rcd_rss_type[type];
+    *rss_hash = eth_calc_rss_hash(s->rss_key, input, input_len);
+    qidx = s->rss_ind[*rss_hash % s->rss_ind_size];
+
+    return qidx < s->rxq_num ? qidx : 0;
+}
+
 static ssize_t
 vmxnet3_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     VMXNET3State *s = qemu_get_nic_opaque(nc);
     size_t bytes_indicated;
     uint8_t min_buf[MIN_BUF_SIZE];
+    uint8_t rss_type;
+    uint32_t rss_hash;
+    int qidx;
 
     if (!vmxnet3_can_receive(nc)) {
         VMW_PKPRN("Cannot receive now");
@@ -1897,8 +2023,10 @@ vmxnet3_receive(NetClientState *nc, const uint8_t *buf, size_t size)
         get_eth_packet_type(PKT_GET_ETH_HDR(buf)));
 
     if (vmxnet3_rx_filter_may_indicate(s, buf, size)) {
+        qidx = vmxnet3_rss_get_queue(s, buf, size, &rss_type, &rss_hash);
         vmxnet_rx_pkt_attach_data(s->rx_pkt, buf, size, s->rx_vlan_stripping);
-        bytes_indicated = vmxnet3_indicate_packet(s) ? size : -1;
+        bytes_indicated = vmxnet3_indicate_packet(s, qidx, rss_type, rss_hash) ?
+                          size : -1;
         if (bytes_indicated < size) {
             VMW_PKPRN("RX: %lu of %lu bytes indicated", bytes_indicated, size);
         }
@@ -2049,6 +2177,7 @@ vmxnet3_init_msix(VMXNET3State *s)
             s->msix_used = false;
         } else {
             s->msix_used = true;
+            msix_enable_irqfds(d);
         }
     }
     return s->msix_used;
@@ -2403,6 +2532,9 @@ static int vmxnet3_post_load(void *opaque, int version_id)
 
     vmxnet3_validate_queues(s);
     vmxnet3_validate_interrupts(s);
+    if (s->device_active) {
+        vmxnet3_setup_rss(s);
+    }
 
     return 0;
 }
@@ -26,12 +26,15 @@
 #include "hw/isa/isa.h"
 #include "hw/nvram/fw_cfg.h"
 #include "hw/sysbus.h"
+#include "sysemu/dma.h"
+#include "exec/address-spaces.h"
 #include "trace.h"
 #include "qemu/error-report.h"
 #include "qemu/config-file.h"
 
 #define FW_CFG_SIZE 2
 #define FW_CFG_DATA_SIZE 1
+#define FW_CFG_DMA_SIZE 8
 #define TYPE_FW_CFG "fw_cfg"
 #define FW_CFG_NAME "fw_cfg"
 #define FW_CFG_PATH "/machine/" FW_CFG_NAME
@@ -50,8 +53,11 @@ struct FWCfgState {
     SysBusDevice parent_obj;
     /*< public >*/
 
-    MemoryRegion ctl_iomem, data_iomem, comb_iomem;
-    uint32_t ctl_iobase, data_iobase;
+    MemoryRegion ctl_iomem, data_iomem, comb_iomem, dma_iomem;
+    uint32_t ctl_iobase, data_iobase, dma_iobase;
+    bool dma_enabled;
+    AddressSpace *dma_as;
+    uint64_t dma_addr;
     FWCfgEntry entries[2][FW_CFG_MAX_ENTRY];
     FWCfgFiles *files;
     uint16_t cur_entry;
@@ -261,6 +267,113 @@ static uint8_t fw_cfg_read(FWCfgState *s)
     return ret;
 }
 
+/* Run the FWCfgDmaAccess at s->dma_addr: read or skip data from the
+ * selected item into guest memory, then write the control field back
+ * as 0 on success or FW_CFG_DMA_CTL_ERROR.
+ */
+static void fw_cfg_dma_transfer(FWCfgState *s)
+{
+    dma_addr_t dma_addr = s->dma_addr;
+    FWCfgDmaAccess dma;
+    FWCfgEntry *e;
+    dma_addr_t len;
+    bool read = false;
+    int arch;
+
+    /* The next access starts with a fresh address */
+    s->dma_addr = 0;
+
+    if (dma_memory_read(s->dma_as, dma_addr, &dma, sizeof(dma))) {
+        stl_be_dma(s->dma_as, dma_addr + offsetof(FWCfgDmaAccess, control),
+                   FW_CFG_DMA_CTL_ERROR);
+        return;
+    }
+
+    dma.address = be64_to_cpu(dma.address);
+    dma.length = be32_to_cpu(dma.length);
+    dma.control = be32_to_cpu(dma.control);
+
+    if (dma.control & FW_CFG_DMA_CTL_SELECT) {
+        fw_cfg_select(s, dma.control >> 16);
+    }
+
+    arch = !!(s->cur_entry & FW_CFG_ARCH_LOCAL);
+    e = &s->entries[arch][s->cur_entry & FW_CFG_ENTRY_MASK];
+
+    if (dma.control & FW_CFG_DMA_CTL_READ) {
+        read = true;
+    } else if (!(dma.control & FW_CFG_DMA_CTL_SKIP)) {
+        dma.length = 0;
+    }
+
+    trace_fw_cfg_dma_transfer(s, s->cur_entry, dma.address, dma.length,
+                              read);
+
+    dma.control = 0;
+    while (dma.length > 0 && !(dma.control & FW_CFG_DMA_CTL_ERROR)) {
+        if (s->cur_entry == FW_CFG_INVALID || !e->data ||
+            s->cur_offset >= e->len) {
+            /* Past the end of the item: reads return zeroes, like the
+             * data register does.
+             */
+            len = dma.length;
+            if (read && dma_memory_set(s->dma_as, dma.address, 0, len)) {
+                dma.control |= FW_CFG_DMA_CTL_ERROR;
+            }
+        } else {
+            len = MIN(dma.length, e->len - s->cur_offset);
+            if (e->read_callback) {
+                e->read_callback(e->callback_opaque, s->cur_offset);
+            }
+            if (read && dma_memory_write(s->dma_as, dma.address,
+                                         &e->data[s->cur_offset], len)) {
+                dma.control |= FW_CFG_DMA_CTL_ERROR;
+            }
+            s->cur_offset += len;
+        }
+        dma.address += len;
+        dma.length -= len;
+    }
+
+    stl_be_dma(s->dma_as, dma_addr + offsetof(FWCfgDmaAccess, control),
+               dma.control);
+}
+
+static uint64_t fw_cfg_dma_mem_read(void *opaque, hwaddr addr,
+                                    unsigned size)
+{
+    /* Reads return the signature so that firmware can probe for DMA */
+    return extract64(FW_CFG_DMA_SIGNATURE, (8 - addr - size) * 8, size * 8);
+}
+
+static void fw_cfg_dma_mem_write(void *opaque, hwaddr addr,
+                                 uint64_t value, unsigned size)
+{
+    FWCfgState *s = opaque;
+
+    /* The descriptor address is big-endian; writing its low half (or
+     * all of it at once) starts the transfer.
+     */
+    if (size == 4) {
+        if (addr == 0) {
+            s->dma_addr = value << 32;
+        } else if (addr == 4) {
+            s->dma_addr |= value;
+            fw_cfg_dma_transfer(s);
+        }
+    } else if (size == 8 && addr == 0) {
+        s->dma_addr = value;
+        fw_cfg_dma_transfer(s);
+    }
+}
+
+static bool fw_cfg_dma_mem_valid(void *opaque, hwaddr addr,
+                                 unsigned size, bool is_write)
+{
+    return !is_write || ((size == 4 && (addr == 0 || addr == 4)) ||
+                         (size == 8 && addr == 0));
+}
+
 static uint64_t fw_cfg_data_mem_read(void *opaque, hwaddr addr,
                                      unsigned size)
 {
@@ -333,6 +446,19 @@ static const MemoryRegionOps fw_cfg_comb_mem_ops = {
     .valid.accepts = fw_cfg_comb_valid,
 };
 
+static const MemoryRegionOps fw_cfg_dma_mem_ops = {
+    .read = fw_cfg_dma_mem_read,
+    .write = fw_cfg_dma_mem_write,
+    .endianness = DEVICE_BIG_ENDIAN,
+    .valid = {
+        .max_access_size = 8,
+        .accepts = fw_cfg_dma_mem_valid,
+    },
+    .impl = {
+        .max_access_size = 8,
+    },
+};
+
 static void fw_cfg_reset(DeviceState *d)
 {
     FWCfgState *s = FW_CFG(d);
@@ -373,6 +499,23 @@ static bool is_version_1(void *opaque, int version_id)
     return version_id == 1;
 }
 
+static bool fw_cfg_dma_needed(void *opaque)
+{
+    FWCfgState *s = opaque;
+
+    return s->dma_enabled;
+}
+
+static const VMStateDescription vmstate_fw_cfg_dma = {
+    .name = "fw_cfg/dma",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT64(dma_addr, FWCfgState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_fw_cfg = {
     .name = "fw_cfg",
     .version_id = 2,
@@ -382,6 +525,14 @@ static const VMStateDescription vmstate_fw_cfg = {
         VMSTATE_UINT16_HACK(cur_offset, FWCfgState, is_version_1),
         VMSTATE_UINT32_V(cur_offset, FWCfgState, 2),
         VMSTATE_END_OF_LIST()
+    },
+    .subsections = (VMStateSubsection[]) {
+        {
+            .vmsd = &vmstate_fw_cfg_dma,
+            .needed = fw_cfg_dma_needed,
+        } , {
+            /* empty */
+        }
     }
 };
 
@@ -560,19 +711,24 @@ static void fw_cfg_machine_ready(struct Notifier *n, void *data)
     qemu_register_reset(fw_cfg_machine_reset, s);
 }
 
-FWCfgState *fw_cfg_init(uint32_t ctl_port, uint32_t data_port,
-                        hwaddr ctl_addr, hwaddr data_addr)
+FWCfgState *fw_cfg_init_dma(uint32_t ctl_port, uint32_t data_port,
+                            uint32_t dma_port, hwaddr ctl_addr,
+                            hwaddr data_addr, hwaddr dma_addr,
+                            AddressSpace *dma_as)
 {
     DeviceState *dev;
     SysBusDevice *d;
     FWCfgState *s;
+    uint32_t version = FW_CFG_VERSION;
 
     dev = qdev_create(NULL, TYPE_FW_CFG);
     qdev_prop_set_uint32(dev, "ctl_iobase", ctl_port);
     qdev_prop_set_uint32(dev, "data_iobase", data_port);
+    qdev_prop_set_uint32(dev, "dma_iobase", dma_port);
     d = SYS_BUS_DEVICE(dev);
 
     s = FW_CFG(dev);
+    s->dma_as = dma_as;
 
     assert(!object_resolve_path(FW_CFG_PATH, NULL));
 
@@ -586,6 +742,14 @@ FWCfgState *fw_cfg_init(uint32_t ctl_port, uint32_t data_port,
     if (data_addr) {
         sysbus_mmio_map(d, 1, data_addr);
     }
+    if (s->dma_enabled) {
+        if (dma_addr) {
+            sysbus_mmio_map(d, 2, dma_addr);
+        }
+        /* FW_CFG_ID is left unset without DMA, as older QEMU did */
+        version |= FW_CFG_VERSION_DMA;
+        fw_cfg_add_i32(s, FW_CFG_ID, version);
+    }
     fw_cfg_add_bytes(s, FW_CFG_SIGNATURE, (char *)"QEMU", 4);
     fw_cfg_add_bytes(s, FW_CFG_UUID, qemu_uuid, 16);
     fw_cfg_add_i16(s, FW_CFG_NOGRAPHIC, (uint16_t)(display_type == DT_NOGRAPHIC));
@@ -600,6 +764,13 @@ FWCfgState *fw_cfg_init(uint32_t ctl_port, uint32_t data_port,
     return s;
 }
 
+FWCfgState *fw_cfg_init(uint32_t ctl_port, uint32_t data_port,
+                        hwaddr ctl_addr, hwaddr data_addr)
+{
+    return fw_cfg_init_dma(ctl_port, data_port, 0, ctl_addr, data_addr, 0,
+                           NULL);
+}
+
 static void fw_cfg_initfn(Object *obj)
 {
     SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
@@ -614,6 +785,8 @@ static void fw_cfg_initfn(Object *obj)
     /* In case ctl and data overlap: */
     memory_region_init_io(&s->comb_iomem, OBJECT(s), &fw_cfg_comb_mem_ops, s,
                           "fwcfg", FW_CFG_SIZE);
+    memory_region_init_io(&s->dma_iomem, OBJECT(s), &fw_cfg_dma_mem_ops, s,
+                          "fwcfg.dma", FW_CFG_DMA_SIZE);
 }
 
 static void fw_cfg_realize(DeviceState *dev, Error **errp)
@@ -632,11 +805,23 @@ static void fw_cfg_realize(DeviceState *dev, Error **errp)
             sysbus_add_io(sbd, s->data_iobase, &s->data_iomem);
         }
     }
+
+    if (s->dma_enabled) {
+        if (!s->dma_as) {
+            s->dma_as = &address_space_memory;
+        }
+        sysbus_init_mmio(sbd, &s->dma_iomem);
+        if (s->dma_iobase) {
+            sysbus_add_io(sbd, s->dma_iobase, &s->dma_iomem);
+        }
+    }
 }
 
 static Property fw_cfg_properties[] = {
     DEFINE_PROP_UINT32("ctl_iobase", FWCfgState, ctl_iobase, -1),
     DEFINE_PROP_UINT32("data_iobase", FWCfgState, data_iobase, -1),
+    DEFINE_PROP_UINT32("dma_iobase", FWCfgState, dma_iobase, 0),
+    DEFINE_PROP_BOOL("dma_enabled", FWCfgState, dma_enabled, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
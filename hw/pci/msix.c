@@ -19,6 +19,8 @@
 #include "hw/pci/msix.h"
 #include "hw/pci/pci.h"
 #include "qemu/range.h"
+#include "qemu/event_notifier.h"
+#include "sysemu/kvm.h"
 
 #define MSIX_CAP_LENGTH 12
 
@@ -27,6 +29,15 @@
 #define MSIX_ENABLE_MASK (PCI_MSIX_FLAGS_ENABLE >> 8)
 #define MSIX_MASKALL_MASK (PCI_MSIX_FLAGS_MASKALL >> 8)
 
+struct MSIXIrqfd {
+    EventNotifier notifier;
+    int virq;               /* KVM MSI route, or -1 */
+    MSIMessage msg;         /* message the route was set up with */
+    bool attached;          /* notifier is bound to virq as an irqfd */
+};
+
+static void msix_irqfd_update(PCIDevice *dev, unsigned int vector);
+
 MSIMessage msix_get_message(PCIDevice *dev, unsigned vector)
 {
     uint8_t *table_entry = dev->msix_table + vector * PCI_MSIX_ENTRY_SIZE;
@@ -48,6 +59,7 @@ void msix_set_message(PCIDevice *dev, int vector, struct MSIMessage msg)
     pci_set_quad(table_entry + PCI_MSIX_ENTRY_LOWER_ADDR, msg.address);
     pci_set_long(table_entry + PCI_MSIX_ENTRY_DATA, msg.data);
     table_entry[PCI_MSIX_ENTRY_VECTOR_CTRL] &= ~PCI_MSIX_ENTRY_CTRL_MASKBIT;
+    msix_irqfd_update(dev, vector);
 }
 
 static uint8_t msix_pending_mask(int vector)
@@ -104,10 +116,134 @@ static void msix_fire_vector_notifier(PCIDevice *dev,
     }
 }
 
+/*
+ * Devices that opt in with msix_enable_irqfds() get their MSI-X vectors
+ * delivered through a KVM irqfd and MSI route, so that msix_notify() is a
+ * single eventfd write instead of a write to the APIC through the memory
+ * API.  A vector is bound to its irqfd only while it is used and unmasked;
+ * when it is masked msix_notify() takes the normal path and sets the
+ * pending bit, which is delivered on unmask as usual.
+ */
+static void msix_irqfd_update(PCIDevice *dev, unsigned int vector)
+{
+    MSIXIrqfd *irqfd;
+    MSIMessage msg;
+    int ret;
+
+    if (!dev->msix_irqfds) {
+        return;
+    }
+    irqfd = &dev->msix_irqfds[vector];
+
+    if (!dev->msix_entry_used[vector] || msix_is_masked(dev, vector)) {
+        if (irqfd->attached) {
+            kvm_irqchip_remove_irqfd_notifier(kvm_state, &irqfd->notifier,
+                                              irqfd->virq);
+            irqfd->attached = false;
+        }
+        if (!dev->msix_entry_used[vector] && irqfd->virq >= 0) {
+            kvm_irqchip_release_virq(kvm_state, irqfd->virq);
+            irqfd->virq = -1;
+        }
+        return;
+    }
+
+    msg = msix_get_message(dev, vector);
+    if (irqfd->virq < 0) {
+        ret = kvm_irqchip_add_msi_route(kvm_state, msg);
+        if (ret < 0) {
+            return;
+        }
+        irqfd->virq = ret;
+        irqfd->msg = msg;
+    } else if (irqfd->msg.address != msg.address ||
+               irqfd->msg.data != msg.data) {
+        if (irqfd->attached) {
+            kvm_irqchip_remove_irqfd_notifier(kvm_state, &irqfd->notifier,
+                                              irqfd->virq);
+            irqfd->attached = false;
+        }
+        if (kvm_irqchip_update_msi_route(kvm_state, irqfd->virq, msg) < 0) {
+            return;
+        }
+        irqfd->msg = msg;
+    }
+
+    if (!irqfd->attached) {
+        ret = kvm_irqchip_add_irqfd_notifier(kvm_state, &irqfd->notifier,
+                                             NULL, irqfd->virq);
+        irqfd->attached = ret >= 0;
+    }
+}
+
+static void msix_irqfd_update_all(PCIDevice *dev)
+{
+    int vector;
+
+    for (vector = 0; vector < dev->msix_entries_nr; vector++) {
+        msix_irqfd_update(dev, vector);
+    }
+}
+
+/* Deliver this device's MSI-X vectors through KVM irqfds when possible.
+ * Returns -ENOTSUP if KVM can't do that; MSI-X then works as before.
+ */
+int msix_enable_irqfds(PCIDevice *dev)
+{
+    int vector;
+
+    if (!msix_present(dev) || !kvm_msi_via_irqfd_enabled()) {
+        return -ENOTSUP;
+    }
+    assert(!dev->msix_irqfds);
+
+    dev->msix_irqfds = g_new0(MSIXIrqfd, dev->msix_entries_nr);
+    for (vector = 0; vector < dev->msix_entries_nr; vector++) {
+        MSIXIrqfd *irqfd = &dev->msix_irqfds[vector];
+
+        irqfd->virq = -1;
+        if (event_notifier_init(&irqfd->notifier, 0) < 0) {
+            while (--vector >= 0) {
+                event_notifier_cleanup(&dev->msix_irqfds[vector].notifier);
+            }
+            g_free(dev->msix_irqfds);
+            dev->msix_irqfds = NULL;
+            return -ENOTSUP;
+        }
+    }
+    msix_irqfd_update_all(dev);
+    return 0;
+}
+
+static void msix_disable_irqfds(PCIDevice *dev)
+{
+    int vector;
+
+    if (!dev->msix_irqfds) {
+        return;
+    }
+    for (vector = 0; vector < dev->msix_entries_nr; vector++) {
+        MSIXIrqfd *irqfd = &dev->msix_irqfds[vector];
+
+        if (irqfd->attached) {
+            kvm_irqchip_remove_irqfd_notifier(kvm_state, &irqfd->notifier,
+                                              irqfd->virq);
+        }
+        if (irqfd->virq >= 0) {
+            kvm_irqchip_release_virq(kvm_state, irqfd->virq);
+        }
+        event_notifier_cleanup(&irqfd->notifier);
+    }
+    g_free(dev->msix_irqfds);
+    dev->msix_irqfds = NULL;
+}
+
 static void msix_handle_mask_update(PCIDevice *dev, int vector, bool was_masked)
 {
     bool is_masked = msix_is_masked(dev, vector);
 
+    msix_irqfd_update(dev, vector);
+
     if (is_masked == was_masked) {
         return;
     }
@@ -142,6 +278,7 @@ void msix_write_config(PCIDevice *dev, uint32_t addr,
     msix_update_function_masked(dev);
 
     if (!msix_enabled(dev)) {
+        msix_irqfd_update_all(dev);
         return;
     }
 
@@ -335,6 +472,7 @@ static void msix_free_irq_entries(PCIDevice *dev)
     for (vector = 0; vector < dev->msix_entries_nr; ++vector) {
         dev->msix_entry_used[vector] = 0;
         msix_clr_pending(dev, vector);
+        msix_irqfd_update(dev, vector);
     }
 }
 
@@ -353,6 +491,7 @@ void msix_uninit(PCIDevice *dev, MemoryRegion *table_bar, MemoryRegion *pba_bar)
     if (!msix_present(dev)) {
         return;
     }
+    msix_disable_irqfds(dev);
     pci_del_capability(dev, PCI_CAP_ID_MSIX, MSIX_CAP_LENGTH);
     dev->msix_cap = 0;
     msix_free_irq_entries(dev);
@@ -433,6 +572,11 @@ void msix_notify(PCIDevice *dev, unsigned vector)
         return;
     }
 
+    if (dev->msix_irqfds && dev->msix_irqfds[vector].attached) {
+        event_notifier_set(&dev->msix_irqfds[vector].notifier);
+        return;
+    }
+
     msg = msix_get_message(dev, vector);
 
     stl_le_phys(&dev->bus_master_as, msg.address, msg.data);
@@ -465,6 +609,7 @@ int msix_vector_use(PCIDevice *dev, unsigned vector)
     if (vector >= dev->msix_entries_nr)
         return -EINVAL;
     dev->msix_entry_used[vector]++;
+    msix_irqfd_update(dev, vector);
     return 0;
 }
 
@@ -478,6 +623,7 @@ void msix_vector_unuse(PCIDevice *dev, unsigned vector)
         return;
     }
     msix_clr_pending(dev, vector);
+    msix_irqfd_update(dev, vector);
 }
 
 void msix_unuse_all_vectors(PCIDevice *dev)
@@ -85,6 +85,11 @@ static void pci_bus_unrealize(BusState *qbus, Error **errp)
     PCIBus *bus = PCI_BUS(qbus);
 
     vmstate_unregister(NULL, &vmstate_pcibus, bus);
+    pci_bus_nr_cache_flush(bus);
+    if (pci_bus_is_root(bus)) {
+        g_free(bus->bus_nr_cache);
+        bus->bus_nr_cache = NULL;
+    }
 }
 
 static void pci_bus_class_init(ObjectClass *klass, void *data)
@@ -1670,6 +1675,40 @@ static bool pci_secondary_bus_in_range(PCIDevice *dev, int bus_num)
         bus_num <= dev->config[PCI_SUBORDINATE_BUS];
 }
 
+/*
+ * Every config space access looks up its bus number from the root, which
+ * walks all sibling bridges at each level.  Root buses cache the result.
+ * The cache is flushed when bridges are added, removed, reset or have
+ * their bus numbers written; a hit is also checked against the current
+ * bus numbers, which covers other changes such as incoming migration.
+ */
+void pci_bus_nr_cache_flush(PCIBus *bus)
+{
+    while (!pci_bus_is_root(bus)) {
+        bus = bus->parent_dev->bus;
+    }
+    if (bus->bus_nr_cache) {
+        memset(bus->bus_nr_cache, 0, PCI_BUS_MAX * sizeof(PCIBus *));
+    }
+}
+
+/* Is the secondary bus @bus still reached as @bus_num from the root? */
+static bool pci_bus_nr_cache_valid(PCIBus *bus, int bus_num)
+{
+    if (pci_bus_num(bus) != bus_num) {
+        return false;
+    }
+    for (bus = bus->parent_dev->bus; !pci_bus_is_root(bus);
+         bus = bus->parent_dev->bus) {
+        if (!pci_secondary_bus_in_range(bus->parent_dev, bus_num)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static PCIBus *pci_find_bus_nr_walk(PCIBus *bus, int bus_num);
+
 static PCIBus *pci_find_bus_nr(PCIBus *bus, int bus_num)
 {
     PCIBus *sec;
@@ -1682,6 +1721,25 @@ static PCIBus *pci_find_bus_nr(PCIBus *bus, int bus_num)
         return bus;
     }
 
+    if (!pci_bus_is_root(bus) || bus_num < 0 || bus_num >= PCI_BUS_MAX) {
+        return pci_find_bus_nr_walk(bus, bus_num);
+    }
+
+    if (!bus->bus_nr_cache) {
+        bus->bus_nr_cache = g_new0(PCIBus *, PCI_BUS_MAX);
+    }
+    sec = bus->bus_nr_cache[bus_num];
+    if (!sec || !pci_bus_nr_cache_valid(sec, bus_num)) {
+        sec = pci_find_bus_nr_walk(bus, bus_num);
+        bus->bus_nr_cache[bus_num] = sec;
+    }
+    return sec;
+}
+
+static PCIBus *pci_find_bus_nr_walk(PCIBus *bus, int bus_num)
+{
+    PCIBus *sec;
+
     /* Consider all bus numbers in range for the host pci bridge. */
     if (!pci_bus_is_root(bus) &&
         !pci_secondary_bus_in_range(bus->parent_dev, bus_num)) {
@@ -1988,10 +2046,13 @@ static int pci_add_option_rom(PCIDevice *pdev, bool is_default_rom)
         snprintf(name, sizeof(name), "%s.rom", object_get_typename(OBJECT(pdev)));
     }
     pdev->has_rom = true;
-    memory_region_init_ram(&pdev->rom, OBJECT(pdev), name, size, &error_abort);
+    if (!rom_init_ram_shared(&pdev->rom, OBJECT(pdev), name, size, path)) {
+        memory_region_init_ram(&pdev->rom, OBJECT(pdev), name, size,
+                               &error_abort);
+        load_image(path, memory_region_get_ram_ptr(&pdev->rom));
+    }
     vmstate_register_ram(&pdev->rom, &pdev->qdev);
     ptr = memory_region_get_ram_ptr(&pdev->rom);
-    load_image(path, ptr);
     g_free(path);
 
     if (is_default_rom) {
@@ -265,6 +265,10 @@ void pci_bridge_write_config(PCIDevice *d,
         pci_bridge_update_mappings(s);
     }
 
+    if (ranges_overlap(address, len, PCI_PRIMARY_BUS, 3)) {
+        pci_bus_nr_cache_flush(d->bus);
+    }
+
     newctl = pci_get_word(d->config + PCI_BRIDGE_CONTROL);
     if (~oldctl & newctl & PCI_BRIDGE_CTL_BUS_RESET) {
         /* Trigger hot reset on 0->1 transition. */
@@ -302,6 +306,7 @@ void pci_bridge_reset(DeviceState *qdev)
     conf[PCI_SECONDARY_BUS] = 0;
     conf[PCI_SUBORDINATE_BUS] = 0;
     conf[PCI_SEC_LATENCY_TIMER] = 0;
+    pci_bus_nr_cache_flush(dev->bus);
 
     /*
      * the default values for base/limit registers aren't specified
@@ -378,6 +383,7 @@ int pci_bridge_initfn(PCIDevice *dev, const char *typename)
     br->windows = pci_bridge_region_init(br);
     QLIST_INIT(&sec_bus->child);
     QLIST_INSERT_HEAD(&parent->child, sec_bus, sibling);
+    pci_bus_nr_cache_flush(parent);
     return 0;
 }
 
@@ -387,6 +393,7 @@ void pci_bridge_exitfn(PCIDevice *pci_dev)
     PCIBridge *s = PCI_BRIDGE(pci_dev);
     assert(QLIST_EMPTY(&s->sec_bus.child));
     QLIST_REMOVE(&s->sec_bus, sibling);
+    pci_bus_nr_cache_flush(pci_dev->bus);
     pci_bridge_region_del(s, s->windows);
     pci_bridge_region_cleanup(s, s->windows);
     /* object_unparent() is called automatically during device deletion */
@@ -878,6 +878,14 @@ static void balloon_ccw_stats_get_all(Object *obj, struct Visitor *v,
     object_property_get(OBJECT(&dev->vdev), v, "guest-stats", errp);
 }
 
+static void balloon_ccw_host_stats_get(Object *obj, struct Visitor *v,
+                                       void *opaque, const char *name,
+                                       Error **errp)
+{
+    VirtIOBalloonCcw *dev = opaque;
+    object_property_get(OBJECT(&dev->vdev), v, "host-stats", errp);
+}
+
 static void balloon_ccw_stats_get_poll_interval(Object *obj, struct Visitor *v,
                                                 void *opaque, const char *name,
                                                 Error **errp)
@@ -909,6 +917,13 @@ static void virtio_ccw_balloon_instance_init(Object *obj)
                         balloon_ccw_stats_get_poll_interval,
                         balloon_ccw_stats_set_poll_interval,
                         NULL, dev, NULL);
+
+    object_property_add(obj, "host-stats", "host statistics",
+                        balloon_ccw_host_stats_get, NULL, NULL, dev, NULL);
+    object_property_add_alias(obj, "free-page-hint", OBJECT(&dev->vdev),
+                              "free-page-hint", &error_abort);
+    object_property_add_alias(obj, "free-page-reporting", OBJECT(&dev->vdev),
+                              "free-page-reporting", &error_abort);
 }
 
 static int virtio_ccw_scsi_init(VirtioCcwDevice *ccw_dev)
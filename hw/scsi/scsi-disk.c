@@ -43,7 +43,7 @@ do { printf("scsi-disk: " fmt , ## __VA_ARGS__); } while (0)
 #endif
 
 #define SCSI_WRITE_SAME_MAX         524288
-#define SCSI_DMA_BUF_SIZE           131072
+#define SCSI_MAX_DMA_BUF_SIZE       (1 << 20)
 #define SCSI_MAX_INQUIRY_LEN        256
 #define SCSI_MAX_MODE_LEN           256
 
@@ -119,6 +119,15 @@ static uint32_t scsi_init_iovec(SCSIDiskReq *r, size_t size)
     return r->qiov.size / 512;
 }
 
+/* Size of the bounce buffer used when the HBA provides no scatter/gather
+ * list.  It covers the whole transfer, up to SCSI_MAX_DMA_BUF_SIZE, so that
+ * most requests are issued to the block layer in one piece.
+ */
+static size_t scsi_dma_buf_size(SCSIDiskReq *r)
+{
+    return MIN((uint64_t)r->sector_count * 512, SCSI_MAX_DMA_BUF_SIZE);
+}
+
 static void scsi_disk_save_request(QEMUFile *f, SCSIRequest *req)
 {
     SCSIDiskReq *r = DO_UPCAST(SCSIDiskReq, req, req);
@@ -336,7 +345,7 @@ static void scsi_do_read(void *opaque, int ret)
         r->req.aiocb = dma_blk_read(s->qdev.conf.blk, r->req.sg, r->sector,
                                     scsi_dma_complete, r);
     } else {
-        n = scsi_init_iovec(r, SCSI_DMA_BUF_SIZE);
+        n = scsi_init_iovec(r, scsi_dma_buf_size(r));
         block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
                          n * BDRV_SECTOR_SIZE, BLOCK_ACCT_READ);
         r->req.aiocb = blk_aio_readv(s->qdev.conf.blk, r->sector, &r->qiov, n,
@@ -456,7 +465,7 @@ static void scsi_write_complete(void * opaque, int ret)
         scsi_write_do_fua(r);
         return;
     } else {
-        scsi_init_iovec(r, SCSI_DMA_BUF_SIZE);
+        scsi_init_iovec(r, scsi_dma_buf_size(r));
         DPRINTF("Write complete tag=0x%x more=%zd\n", r->req.tag, r->qiov.size);
         scsi_req_data(&r->req, r->qiov.size);
     }
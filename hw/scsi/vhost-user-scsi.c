@@ -0,0 +1,170 @@
+/*
+ * vhost-user-scsi host device
+ *
+ * The request queues are handed to a vhost-user slave, typically a polling
+ * userspace target, that maps each of them to its own poller or thread.
+ * QEMU only sets up the rings and never sees a SCSI command.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "config.h"
+#include "qemu/error-report.h"
+#include "migration/migration.h"
+#include "hw/qdev-properties.h"
+#include "hw/virtio/vhost-user-scsi.h"
+#include "hw/virtio/vhost.h"
+#include "hw/virtio/virtio-scsi.h"
+
+/* Features that the slave may offer */
+static const int user_feature_bits[] = {
+    VIRTIO_F_NOTIFY_ON_EMPTY,
+    VIRTIO_RING_F_INDIRECT_DESC,
+    VIRTIO_RING_F_EVENT_IDX,
+    VIRTIO_SCSI_F_INOUT,
+    VIRTIO_SCSI_F_HOTPLUG,
+    VIRTIO_SCSI_F_CHANGE,
+    VHOST_INVALID_FEATURE_BIT
+};
+
+static void vhost_user_scsi_set_status(VirtIODevice *vdev, uint8_t val)
+{
+    VHostSCSICommon *vsc = VHOST_SCSI_COMMON(vdev);
+    bool start = (val & VIRTIO_CONFIG_S_DRIVER_OK);
+
+    if (vsc->dev.started == start) {
+        return;
+    }
+
+    if (start) {
+        int ret;
+
+        ret = vhost_scsi_common_start(vsc);
+        if (ret < 0) {
+            error_report("vhost-user-scsi: unable to start vhost: %s",
+                         strerror(-ret));
+
+            /* There is no userspace virtio-scsi fallback so exit */
+            exit(1);
+        }
+    } else {
+        vhost_scsi_common_stop(vsc);
+    }
+}
+
+static void vhost_dummy_handle_output(VirtIODevice *vdev, VirtQueue *vq)
+{
+}
+
+static void vhost_user_scsi_realize(DeviceState *dev, Error **errp)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(dev);
+    VHostUserSCSI *s = VHOST_USER_SCSI(dev);
+    VHostSCSICommon *vsc = VHOST_SCSI_COMMON(s);
+    Error *err = NULL;
+    int ret;
+
+    if (!s->chardev) {
+        error_setg(errp, "vhost-user-scsi: missing chardev");
+        return;
+    }
+
+    virtio_scsi_common_realize(dev, &err, vhost_dummy_handle_output,
+                               vhost_dummy_handle_output,
+                               vhost_dummy_handle_output);
+    if (err != NULL) {
+        error_propagate(errp, err);
+        return;
+    }
+
+    vsc->feature_bits = user_feature_bits;
+    vsc->dev.nvqs = VHOST_SCSI_VQ_NUM_FIXED + vs->conf.num_queues;
+    vsc->dev.vqs = g_new(struct vhost_virtqueue, vsc->dev.nvqs);
+    vsc->dev.vq_index = 0;
+    vsc->dev.backend_features = 0;
+
+    ret = vhost_dev_init(&vsc->dev, s->chardev, VHOST_BACKEND_TYPE_USER, true);
+    if (ret < 0) {
+        error_setg(errp, "vhost-user-scsi: vhost initialization failed: %s",
+                   strerror(-ret));
+        goto fail;
+    }
+
+    /* A slave that implements VHOST_USER_GET_QUEUE_NUM tells how many
+     * request queues it can serve; max_queues stays 1 for the others.
+     */
+    if (vsc->dev.max_queues > 1 && vs->conf.num_queues > vsc->dev.max_queues) {
+        error_setg(errp, "vhost-user-scsi: num_queues=%" PRIu32 " is more "
+                   "than the %" PRIu64 " request queues the slave supports",
+                   vs->conf.num_queues, vsc->dev.max_queues);
+        vhost_dev_cleanup(&vsc->dev);
+        goto fail;
+    }
+
+    error_setg(&vsc->migration_blocker,
+               "vhost-user-scsi does not support migration");
+    migrate_add_blocker(vsc->migration_blocker);
+    return;
+
+fail:
+    g_free(vsc->dev.vqs);
+    virtio_scsi_common_unrealize(dev, NULL);
+}
+
+static void vhost_user_scsi_unrealize(DeviceState *dev, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    VHostSCSICommon *vsc = VHOST_SCSI_COMMON(dev);
+
+    migrate_del_blocker(vsc->migration_blocker);
+    error_free(vsc->migration_blocker);
+
+    /* This will stop vhost backend. */
+    vhost_user_scsi_set_status(vdev, 0);
+
+    vhost_dev_cleanup(&vsc->dev);
+    g_free(vsc->dev.vqs);
+
+    virtio_scsi_common_unrealize(dev, errp);
+}
+
+static Property vhost_user_scsi_properties[] = {
+    DEFINE_PROP_CHR("chardev", VHostUserSCSI, chardev),
+    DEFINE_PROP_UINT32("num_queues", VHostUserSCSI,
+                       parent_obj.parent_obj.conf.num_queues, 1),
+    DEFINE_PROP_UINT32("max_sectors", VHostUserSCSI,
+                       parent_obj.parent_obj.conf.max_sectors, 0xFFFF),
+    DEFINE_PROP_UINT32("cmd_per_lun", VHostUserSCSI,
+                       parent_obj.parent_obj.conf.cmd_per_lun, 128),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void vhost_user_scsi_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    VirtioDeviceClass *vdc = VIRTIO_DEVICE_CLASS(klass);
+
+    dc->props = vhost_user_scsi_properties;
+    set_bit(DEVICE_CATEGORY_STORAGE, dc->categories);
+    vdc->realize = vhost_user_scsi_realize;
+    vdc->unrealize = vhost_user_scsi_unrealize;
+    vdc->get_features = vhost_scsi_common_get_features;
+    vdc->set_config = vhost_scsi_common_set_config;
+    vdc->set_status = vhost_user_scsi_set_status;
+}
+
+static const TypeInfo vhost_user_scsi_info = {
+    .name = TYPE_VHOST_USER_SCSI,
+    .parent = TYPE_VHOST_SCSI_COMMON,
+    .instance_size = sizeof(VHostUserSCSI),
+    .class_init = vhost_user_scsi_class_init,
+};
+
+static void virtio_register_types(void)
+{
+    type_register_static(&vhost_user_scsi_info);
+}
+
+type_init(virtio_register_types)
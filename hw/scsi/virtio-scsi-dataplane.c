@@ -21,14 +21,49 @@
 #include "stdio.h"
 
 /* Context: QEMU global mutex held */
-void virtio_scsi_set_iothread(VirtIOSCSI *s, IOThread *iothread)
+static bool virtio_scsi_resolve_iothreads(VirtIOSCSI *s, Error **errp)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    gchar **ids = g_strsplit(vs->conf.iothreads, ":", -1);
+    unsigned int n = g_strv_length(ids);
+    unsigned int i;
+    bool ok = false;
+
+    if (n == 0) {
+        error_setg(errp, "iothreads property is empty");
+        goto out;
+    }
+
+    s->iothreads = g_new0(IOThread *, n);
+    for (i = 0; i < n; i++) {
+        s->iothreads[i] = iothread_find(ids[i]);
+        if (!s->iothreads[i]) {
+            error_setg(errp, "IOThread '%s' not found", ids[i]);
+            goto out;
+        }
+        object_ref(OBJECT(s->iothreads[i]));
+        s->num_iothreads++;
+    }
+
+    /* Request queues are spread round-robin over the listed IOThreads */
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        s->cmd_ctxs[i] = iothread_get_aio_context(s->iothreads[i % n]);
+    }
+    ok = true;
+out:
+    g_strfreev(ids);
+    return ok;
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_set_iothread(VirtIOSCSI *s, Error **errp)
 {
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    unsigned int i;
 
     assert(!s->ctx);
-    s->ctx = iothread_get_aio_context(vs->conf.iothread);
 
     /* Don't try if transport does not support notifiers. */
     if (!k->set_guest_notifiers || !k->set_host_notifier) {
@@ -36,10 +71,61 @@ void virtio_scsi_set_iothread(VirtIOSCSI *s, IOThread *iothread)
                    "(transport does not support notifiers)");
         exit(1);
     }
+
+    s->cmd_ctxs = g_new0(AioContext *, vs->conf.num_queues);
+    if (vs->conf.iothreads) {
+        if (!virtio_scsi_resolve_iothreads(s, errp)) {
+            virtio_scsi_unset_iothread(s);
+            return;
+        }
+        /* The control and event queues, and all LUNs, live with queue 0 */
+        s->ctx = s->cmd_ctxs[0];
+    } else {
+        s->ctx = iothread_get_aio_context(vs->conf.iothread);
+        for (i = 0; i < vs->conf.num_queues; i++) {
+            s->cmd_ctxs[i] = s->ctx;
+        }
+    }
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_unset_iothread(VirtIOSCSI *s)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
+    s->iothreads = NULL;
+    s->num_iothreads = 0;
+    g_free(s->cmd_ctxs);
+    s->cmd_ctxs = NULL;
+    s->ctx = NULL;
+}
+
+static void virtio_scsi_vring_notify(VirtIOSCSIVring *vring)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(vring->parent);
+    bool notify;
+
+    qemu_mutex_lock(&vring->lock);
+    notify = vring_should_notify(vdev, &vring->vring);
+    qemu_mutex_unlock(&vring->lock);
+
+    if (notify) {
+        event_notifier_set(&vring->guest_notifier);
+    }
+}
+
+static void virtio_scsi_vring_notify_bh(void *opaque)
+{
+    virtio_scsi_vring_notify(opaque);
 }
 
 static VirtIOSCSIVring *virtio_scsi_vring_init(VirtIOSCSI *s,
                                                VirtQueue *vq,
+                                               AioContext *ctx,
                                                EventNotifierHandler *handler,
                                                int n)
 {
@@ -54,22 +140,29 @@ static VirtIOSCSIVring *virtio_scsi_vring_init(VirtIOSCSI *s,
         fprintf(stderr, "virtio-scsi: Failed to set host notifier (%d)\n",
                 rc);
         s->dataplane_fenced = true;
+        g_slice_free(VirtIOSCSIVring, r);
         return NULL;
     }
     r->host_notifier = *virtio_queue_get_host_notifier(vq);
     r->guest_notifier = *virtio_queue_get_guest_notifier(vq);
-    aio_set_event_notifier(s->ctx, &r->host_notifier, handler);
-
     r->parent = s;
+    r->ctx = ctx;
 
     if (!vring_setup(&r->vring, VIRTIO_DEVICE(s), n)) {
         fprintf(stderr, "virtio-scsi: VRing setup failed\n");
         goto fail_vring;
     }
+
+    qemu_mutex_init(&r->lock);
+    r->notify_bh = aio_bh_new(r->ctx, virtio_scsi_vring_notify_bh, r);
+
+    /* Hook up the handler last, it may run in another thread right away */
+    aio_context_acquire(r->ctx);
+    aio_set_event_notifier(r->ctx, &r->host_notifier, handler);
+    aio_context_release(r->ctx);
     return r;
 
 fail_vring:
-    aio_set_event_notifier(s->ctx, &r->host_notifier, NULL);
     k->set_host_notifier(qbus->parent, n, false);
     g_slice_free(VirtIOSCSIVring, r);
     return NULL;
@@ -82,7 +175,9 @@ VirtIOSCSIReq *virtio_scsi_pop_req_vring(VirtIOSCSI *s,
     int r;
 
     req->vring = vring;
+    qemu_mutex_lock(&vring->lock);
     r = vring_pop((VirtIODevice *)s, &vring->vring, &req->elem);
+    qemu_mutex_unlock(&vring->lock);
     if (r < 0) {
         virtio_scsi_free_req(req);
         req = NULL;
@@ -92,14 +187,15 @@ VirtIOSCSIReq *virtio_scsi_pop_req_vring(VirtIOSCSI *s,
 
 void virtio_scsi_vring_push_notify(VirtIOSCSIReq *req)
 {
-    VirtIODevice *vdev = VIRTIO_DEVICE(req->vring->parent);
+    VirtIOSCSIVring *vring = req->vring;
 
-    vring_push(&req->vring->vring, &req->elem,
+    qemu_mutex_lock(&vring->lock);
+    vring_push(&vring->vring, &req->elem,
                req->qsgl.size + req->resp_iov.size);
+    qemu_mutex_unlock(&vring->lock);
 
-    if (vring_should_notify(vdev, &req->vring->vring)) {
-        event_notifier_set(&req->vring->guest_notifier);
-    }
+    /* Requests complete in batches, so notify the guest once per batch */
+    qemu_bh_schedule(vring->notify_bh);
 }
 
 static void virtio_scsi_iothread_handle_ctrl(EventNotifier *notifier)
@@ -138,57 +234,109 @@ static void virtio_scsi_iothread_handle_cmd(EventNotifier *notifier)
     VirtIOSCSIVring *vring = container_of(notifier,
                                           VirtIOSCSIVring, host_notifier);
     VirtIOSCSI *s = (VirtIOSCSI *)vring->parent;
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
     VirtIOSCSIReq *req, *next;
-    QTAILQ_HEAD(, VirtIOSCSIReq) reqs = QTAILQ_HEAD_INITIALIZER(reqs);
+    bool locked = vring->ctx != s->ctx;
+    bool empty;
 
     event_notifier_test_and_clear(notifier);
-    while ((req = virtio_scsi_pop_req_vring(s, vring))) {
-        if (virtio_scsi_handle_cmd_req_prepare(s, req)) {
-            QTAILQ_INSERT_TAIL(&reqs, req, next);
-        }
+
+    /* The LUNs' BlockBackends live in the home context; a request queue
+     * running in its own IOThread borrows it for the whole batch.  Lock
+     * order is queue context first, then home context.
+     */
+    if (locked) {
+        aio_context_acquire(s->ctx);
     }
 
-    QTAILQ_FOREACH_SAFE(req, &reqs, next, next) {
-        virtio_scsi_handle_cmd_req_submit(s, req);
+    do {
+        QTAILQ_HEAD(, VirtIOSCSIReq) reqs = QTAILQ_HEAD_INITIALIZER(reqs);
+
+        /* Disable guest->host notifies to avoid unnecessary vmexits */
+        qemu_mutex_lock(&vring->lock);
+        vring_disable_notification(vdev, &vring->vring);
+        qemu_mutex_unlock(&vring->lock);
+
+        while ((req = virtio_scsi_pop_req_vring(s, vring))) {
+            if (virtio_scsi_handle_cmd_req_prepare(s, req)) {
+                QTAILQ_INSERT_TAIL(&reqs, req, next);
+            }
+        }
+
+        /* Each LUN stays plugged from prepare until its last submit */
+        QTAILQ_FOREACH_SAFE(req, &reqs, next, next) {
+            virtio_scsi_handle_cmd_req_submit(s, req);
+        }
+
+        /* If the guest has snuck in more descriptors, keep processing */
+        qemu_mutex_lock(&vring->lock);
+        empty = vring->vring.broken ||
+                vring_enable_notification(vdev, &vring->vring);
+        qemu_mutex_unlock(&vring->lock);
+    } while (!empty);
+
+    if (locked) {
+        aio_context_release(s->ctx);
     }
 }
 
-/* assumes s->ctx held */
+static void virtio_scsi_vring_clear_aio(VirtIOSCSIVring *vring)
+{
+    aio_context_acquire(vring->ctx);
+    aio_set_event_notifier(vring->ctx, &vring->host_notifier, NULL);
+    aio_context_release(vring->ctx);
+}
+
+/* Context: QEMU global mutex held, no AioContext held */
 static void virtio_scsi_clear_aio(VirtIOSCSI *s)
 {
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
     int i;
 
     if (s->ctrl_vring) {
-        aio_set_event_notifier(s->ctx, &s->ctrl_vring->host_notifier, NULL);
+        virtio_scsi_vring_clear_aio(s->ctrl_vring);
     }
     if (s->event_vring) {
-        aio_set_event_notifier(s->ctx, &s->event_vring->host_notifier, NULL);
+        virtio_scsi_vring_clear_aio(s->event_vring);
     }
     if (s->cmd_vrings) {
         for (i = 0; i < vs->conf.num_queues && s->cmd_vrings[i]; i++) {
-            aio_set_event_notifier(s->ctx, &s->cmd_vrings[i]->host_notifier, NULL);
+            virtio_scsi_vring_clear_aio(s->cmd_vrings[i]);
         }
     }
 }
 
+static void virtio_scsi_vring_free(VirtIOSCSIVring *vring, int n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(vring->parent);
+
+    /* Deliver a notification that may still be pending in the BH */
+    qemu_bh_delete(vring->notify_bh);
+    virtio_scsi_vring_notify(vring);
+
+    vring_teardown(&vring->vring, vdev, n);
+    qemu_mutex_destroy(&vring->lock);
+    g_slice_free(VirtIOSCSIVring, vring);
+}
+
 static void virtio_scsi_vring_teardown(VirtIOSCSI *s)
 {
-    VirtIODevice *vdev = VIRTIO_DEVICE(s);
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
     int i;
 
     if (s->ctrl_vring) {
-        vring_teardown(&s->ctrl_vring->vring, vdev, 0);
+        virtio_scsi_vring_free(s->ctrl_vring, 0);
+        s->ctrl_vring = NULL;
     }
     if (s->event_vring) {
-        vring_teardown(&s->event_vring->vring, vdev, 1);
+        virtio_scsi_vring_free(s->event_vring, 1);
+        s->event_vring = NULL;
     }
     if (s->cmd_vrings) {
         for (i = 0; i < vs->conf.num_queues && s->cmd_vrings[i]; i++) {
-            vring_teardown(&s->cmd_vrings[i]->vring, vdev, 2 + i);
+            virtio_scsi_vring_free(s->cmd_vrings[i], 2 + i);
         }
-        free(s->cmd_vrings);
+        g_free(s->cmd_vrings);
         s->cmd_vrings = NULL;
     }
 }
@@ -205,7 +353,7 @@ void virtio_scsi_dataplane_start(VirtIOSCSI *s)
     if (s->dataplane_started ||
         s->dataplane_starting ||
         s->dataplane_fenced ||
-        s->ctx != iothread_get_aio_context(vs->conf.iothread)) {
+        !s->ctx) {
         return;
     }
 
@@ -222,23 +370,26 @@ void virtio_scsi_dataplane_start(VirtIOSCSI *s)
         goto fail_guest_notifiers;
     }
 
-    aio_context_acquire(s->ctx);
-    s->ctrl_vring = virtio_scsi_vring_init(s, vs->ctrl_vq,
+    /* Each vring takes its own context while hooking up the handler.  No
+     * context may be held here, since request queue handlers take their
+     * own context and then the home context.
+     */
+    s->ctrl_vring = virtio_scsi_vring_init(s, vs->ctrl_vq, s->ctx,
                                            virtio_scsi_iothread_handle_ctrl,
                                            0);
     if (!s->ctrl_vring) {
         goto fail_vrings;
     }
-    s->event_vring = virtio_scsi_vring_init(s, vs->event_vq,
+    s->event_vring = virtio_scsi_vring_init(s, vs->event_vq, s->ctx,
                                             virtio_scsi_iothread_handle_event,
                                             1);
     if (!s->event_vring) {
         goto fail_vrings;
     }
-    s->cmd_vrings = g_new(VirtIOSCSIVring *, vs->conf.num_queues);
+    s->cmd_vrings = g_new0(VirtIOSCSIVring *, vs->conf.num_queues);
     for (i = 0; i < vs->conf.num_queues; i++) {
         s->cmd_vrings[i] =
-            virtio_scsi_vring_init(s, vs->cmd_vqs[i],
+            virtio_scsi_vring_init(s, vs->cmd_vqs[i], s->cmd_ctxs[i],
                                    virtio_scsi_iothread_handle_cmd,
                                    i + 2);
         if (!s->cmd_vrings[i]) {
@@ -248,12 +399,10 @@ void virtio_scsi_dataplane_start(VirtIOSCSI *s)
 
     s->dataplane_starting = false;
     s->dataplane_started = true;
-    aio_context_release(s->ctx);
     return;
 
 fail_vrings:
     virtio_scsi_clear_aio(s);
-    aio_context_release(s->ctx);
     virtio_scsi_vring_teardown(s);
     for (i = 0; i < vs->conf.num_queues + 2; i++) {
         k->set_host_notifier(qbus->parent, i, false);
@@ -282,15 +431,12 @@ void virtio_scsi_dataplane_stop(VirtIOSCSI *s)
     error_free(s->blocker);
     s->blocker = NULL;
     s->dataplane_stopping = true;
-    assert(s->ctx == iothread_get_aio_context(vs->conf.iothread));
+    assert(s->ctx);
 
-    aio_context_acquire(s->ctx);
+    /* Stop notifications for new requests from guest */
+    virtio_scsi_clear_aio(s);
 
-    aio_set_event_notifier(s->ctx, &s->ctrl_vring->host_notifier, NULL);
-    aio_set_event_notifier(s->ctx, &s->event_vring->host_notifier, NULL);
-    for (i = 0; i < vs->conf.num_queues; i++) {
-        aio_set_event_notifier(s->ctx, &s->cmd_vrings[i]->host_notifier, NULL);
-    }
+    aio_context_acquire(s->ctx);
 
     blk_drain_all(); /* ensure there are no in-flight requests */
 
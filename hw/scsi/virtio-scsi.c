@@ -187,7 +187,7 @@ static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 
     assert(n < vs->conf.num_queues);
     qemu_put_be32s(f, &n);
-    qemu_put_buffer(f, (unsigned char *)&req->elem, sizeof(req->elem));
+    qemu_put_virtqueue_element(f, &req->elem);
 }
 
 static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
@@ -201,7 +201,7 @@ static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
     qemu_get_be32s(f, &n);
     assert(n < vs->conf.num_queues);
     req = virtio_scsi_init_req(s, vs->cmd_vqs[n]);
-    qemu_get_buffer(f, (unsigned char *)&req->elem, sizeof(req->elem));
+    qemu_get_virtqueue_element(f, req->vq, &req->elem);
     /* TODO: add a way for SCSIBusInfo's load_request to fail,
      * and fail migration instead of asserting here.
      * When we do, we might be able to re-enable NDEBUG below.
@@ -209,8 +209,6 @@ static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
 #ifdef NDEBUG
 #error building with NDEBUG is not supported
 #endif
-    assert(req->elem.in_num <= ARRAY_SIZE(req->elem.in_sg));
-    assert(req->elem.out_num <= ARRAY_SIZE(req->elem.out_sg));
 
     if (virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
                               sizeof(VirtIOSCSICmdResp) + vs->sense_size) < 0) {
@@ -816,6 +814,7 @@ void virtio_scsi_common_realize(DeviceState *dev, Error **errp,
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOSCSICommon *s = VIRTIO_SCSI_COMMON(dev);
+    Error *err = NULL;
     int i;
 
     virtio_init(vdev, "virtio-scsi", VIRTIO_ID_SCSI,
@@ -842,9 +841,23 @@ void virtio_scsi_common_realize(DeviceState *dev, Error **errp,
                                          cmd);
     }
 
-    if (s->conf.iothread) {
-        virtio_scsi_set_iothread(VIRTIO_SCSI(s), s->conf.iothread);
+    if (s->conf.iothread && s->conf.iothreads) {
+        error_setg(errp, "iothread and iothreads are mutually exclusive");
+        goto fail;
+    }
+    if (s->conf.iothread || s->conf.iothreads) {
+        virtio_scsi_set_iothread(VIRTIO_SCSI(s), &err);
+        if (err) {
+            error_propagate(errp, err);
+            goto fail;
+        }
     }
+    return;
+
+fail:
+    g_free(s->cmd_vqs);
+    s->cmd_vqs = NULL;
+    virtio_cleanup(vdev);
 }
 
 /* Disable dataplane thread during live migration since it does not
@@ -931,12 +944,14 @@ static void virtio_scsi_device_unrealize(DeviceState *dev, Error **errp)
 
     unregister_savevm(dev, "virtio-scsi", s);
     remove_migration_state_change_notifier(&s->migration_state_notifier);
+    virtio_scsi_unset_iothread(s);
 
     virtio_scsi_common_unrealize(dev, errp);
 }
 
 static Property virtio_scsi_properties[] = {
     DEFINE_VIRTIO_SCSI_PROPERTIES(VirtIOSCSI, parent_obj.conf),
+    DEFINE_PROP_STRING("iothreads", VirtIOSCSI, parent_obj.conf.iothreads),
     DEFINE_PROP_END_OF_LIST(),
 };
 
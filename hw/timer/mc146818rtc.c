@@ -928,6 +928,10 @@ static void rtc_realizefn(DeviceState *dev, Error **errp)
 
     memory_region_init_io(&s->io, OBJECT(s), &cmos_ops, s, "rtc", 2);
     isa_register_ioport(isadev, &s->io, base);
+    /* Index writes only matter to the next data port access, which flushes
+     * them; this saves one exit per CMOS access.
+     */
+    memory_region_add_coalescing(&s->io, 0, 1);
 
     qdev_set_legacy_instance_id(dev, base, 3);
     qemu_register_reset(rtc_reset, s);
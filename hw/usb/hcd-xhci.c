@@ -135,9 +135,13 @@
 #define IMAN_IP         (1<<0)
 #define IMAN_IE         (1<<1)
 
+#define IMOD_IMODI_MASK 0xffff
+
 #define ERDP_EHB        (1<<3)
 
 #define TRB_SIZE 16
+/* TRBs read ahead from a transfer or command ring with one DMA access */
+#define TRB_PREFETCH 16
 typedef struct XHCITRB {
     uint64_t parameter;
     uint32_t status;
@@ -325,9 +329,19 @@ typedef enum EPType {
     ET_INTR_IN,
 } EPType;
 
+typedef struct XHCIRingTRB {
+    uint64_t parameter;
+    uint32_t status;
+    uint32_t control;
+} XHCIRingTRB;
+
 typedef struct XHCIRing {
     dma_addr_t dequeue;
     bool ccs;
+    /* read-ahead cache, see xhci_ring_read() */
+    dma_addr_t pf_base;
+    unsigned int pf_count;
+    XHCIRingTRB pf[TRB_PREFETCH];
 } XHCIRing;
 
 typedef struct XHCIPort {
@@ -439,6 +453,10 @@ typedef struct XHCIInterrupter {
     unsigned int ev_buffer_put;
     unsigned int ev_buffer_get;
 
+    /* interrupt moderation (IMODI), see xhci_intr_update() */
+    int64_t imod_next;
+    bool imod_pending;
+
 } XHCIInterrupter;
 
 struct XHCIState {
@@ -479,6 +497,7 @@ struct XHCIState {
     /* Runtime Registers */
     int64_t mfindex_start;
     QEMUTimer *mfwrap_timer;
+    QEMUTimer *imod_timer;
     XHCIInterrupter intr[MAXINTRS];
 
     XHCIRing cmd_ring;
@@ -782,14 +801,10 @@ static void xhci_msix_update(XHCIState *xhci, int v)
     }
 }
 
-static void xhci_intr_raise(XHCIState *xhci, int v)
+static void xhci_intr_deliver(XHCIState *xhci, int v)
 {
     PCIDevice *pci_dev = PCI_DEVICE(xhci);
 
-    xhci->intr[v].erdp_low |= ERDP_EHB;
-    xhci->intr[v].iman |= IMAN_IP;
-    xhci->usbsts |= USBSTS_EINT;
-
     if (!(xhci->intr[v].iman & IMAN_IE)) {
         return;
     }
@@ -816,6 +831,76 @@ static void xhci_intr_raise(XHCIState *xhci, int v)
     }
 }
 
+/*
+ * Deliver the interrupt unless the moderation interval (IMODI, in 250ns
+ * units) since the previous one is still running; in that case it is
+ * held back until the interval ends.
+ */
+static void xhci_intr_update(XHCIState *xhci, int v)
+{
+    XHCIInterrupter *intr = &xhci->intr[v];
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    if (now < intr->imod_next) {
+        intr->imod_pending = true;
+        timer_mod_anticipate_ns(xhci->imod_timer, intr->imod_next);
+        return;
+    }
+    intr->imod_pending = false;
+    intr->imod_next = now + (int64_t)(intr->imod & IMOD_IMODI_MASK) * 250;
+    xhci_intr_deliver(xhci, v);
+}
+
+static void xhci_imod_timer(void *opaque)
+{
+    XHCIState *xhci = opaque;
+    int v;
+
+    for (v = 0; v < xhci->numintrs; v++) {
+        if (xhci->intr[v].imod_pending) {
+            xhci_intr_update(xhci, v);
+        }
+    }
+}
+
+static void xhci_intr_raise(XHCIState *xhci, int v)
+{
+    bool pending = xhci->intr[v].erdp_low & ERDP_EHB;
+
+    xhci->intr[v].erdp_low |= ERDP_EHB;
+    xhci->intr[v].iman |= IMAN_IP;
+    xhci->usbsts |= USBSTS_EINT;
+
+    /*
+     * The guest has not yet acknowledged the previous interrupt by
+     * clearing EHB, so it will still see these events; xhci_intr_rearm()
+     * signals again if it leaves any behind.
+     */
+    if (pending) {
+        return;
+    }
+    xhci_intr_update(xhci, v);
+}
+
+/* Called after the guest moved ERDP; re-raise if events are still queued */
+static void xhci_intr_rearm(XHCIState *xhci, int v)
+{
+    XHCIInterrupter *intr = &xhci->intr[v];
+    dma_addr_t erdp;
+
+    if (intr->erdp_low & ERDP_EHB || !intr->er_size) {
+        return;
+    }
+    erdp = xhci_addr64(intr->erdp_low, intr->erdp_high);
+    if (erdp < intr->er_start ||
+        erdp >= (intr->er_start + TRB_SIZE*intr->er_size)) {
+        return;
+    }
+    if ((erdp - intr->er_start) / TRB_SIZE != intr->er_ep_idx) {
+        xhci_intr_raise(xhci, v);
+    }
+}
+
 static inline int xhci_running(XHCIState *xhci)
 {
     return !(xhci->usbsts & USBSTS_HCH) && !xhci->intr[0].er_full;
@@ -985,26 +1070,66 @@ static void xhci_event(XHCIState *xhci, XHCIEvent *event, int v)
     xhci_intr_raise(xhci, v);
 }
 
+static void xhci_ring_invalidate(XHCIRing *ring)
+{
+    ring->pf_count = 0;
+}
+
 static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
                            dma_addr_t base)
 {
     ring->dequeue = base;
     ring->ccs = 1;
+    xhci_ring_invalidate(ring);
 }
 
-static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
-                               dma_addr_t *addr)
+/*
+ * Read the TRB at @addr, expected to carry cycle bit @ccs.
+ *
+ * TRBs are read TRB_PREFETCH at a time, without crossing a 4k page so that
+ * nothing but RAM holding the ring segment is touched.  Cached TRBs that
+ * the guest had already handed over (cycle bit matches) stay valid, since
+ * software may not modify them until the endpoint is stopped; a cycle bit
+ * mismatch forces a fresh read, as the guest may have queued more work.
+ */
+static void xhci_ring_read(XHCIState *xhci, XHCIRing *ring, dma_addr_t addr,
+                           bool ccs, XHCITRB *trb)
 {
     PCIDevice *pci_dev = PCI_DEVICE(xhci);
+    XHCIRingTRB *raw;
+    unsigned int i, n;
 
+    i = (addr - ring->pf_base) / TRB_SIZE;
+    if (addr < ring->pf_base || (addr - ring->pf_base) % TRB_SIZE ||
+        i >= ring->pf_count ||
+        (ring->pf[i].control & TRB_C) != ccs) {
+        n = (4096 - (addr & 4095)) / TRB_SIZE;
+        n = MAX(MIN(n, TRB_PREFETCH), 1);
+        pci_dma_read(pci_dev, addr, ring->pf, n * TRB_SIZE);
+        for (i = 0; i < n; i++) {
+            le64_to_cpus(&ring->pf[i].parameter);
+            le32_to_cpus(&ring->pf[i].status);
+            le32_to_cpus(&ring->pf[i].control);
+        }
+        ring->pf_base = addr;
+        ring->pf_count = n;
+        i = 0;
+    }
+
+    raw = &ring->pf[i];
+    trb->parameter = raw->parameter;
+    trb->status = raw->status;
+    trb->control = raw->control;
+}
+
+static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
+                               dma_addr_t *addr)
+{
     while (1) {
         TRBType type;
-        pci_dma_read(pci_dev, ring->dequeue, trb, TRB_SIZE);
+        xhci_ring_read(xhci, ring, ring->dequeue, ring->ccs, trb);
         trb->addr = ring->dequeue;
         trb->ccs = ring->ccs;
-        le64_to_cpus(&trb->parameter);
-        le32_to_cpus(&trb->status);
-        le32_to_cpus(&trb->control);
 
         trace_usb_xhci_fetch_trb(ring->dequeue, trb_name(trb),
                                  trb->parameter, trb->status, trb->control);
@@ -1030,9 +1155,8 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
     }
 }
 
-static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
+static int xhci_ring_chain_length(XHCIState *xhci, XHCIRing *ring)
 {
-    PCIDevice *pci_dev = PCI_DEVICE(xhci);
     XHCITRB trb;
     int length = 0;
     dma_addr_t dequeue = ring->dequeue;
@@ -1042,10 +1166,7 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     while (1) {
         TRBType type;
-        pci_dma_read(pci_dev, dequeue, &trb, TRB_SIZE);
-        le64_to_cpus(&trb.parameter);
-        le32_to_cpus(&trb.status);
-        le32_to_cpus(&trb.control);
+        xhci_ring_read(xhci, ring, dequeue, ccs, &trb);
 
         if ((trb.control & TRB_C) != ccs) {
             return -length;
@@ -1330,6 +1451,10 @@ static void xhci_set_ep_state(XHCIState *xhci, XHCIEPContext *epctx,
         ring = &epctx->ring;
     }
     if (ring) {
+        if (state != EP_RUNNING) {
+            /* The guest may now rewrite TRBs it had handed over */
+            xhci_ring_invalidate(ring);
+        }
         ctx[2] = ring->dequeue | ring->ccs;
         ctx[3] = (ring->dequeue >> 16) >> 16;
 
@@ -2934,7 +3059,10 @@ static void xhci_reset(DeviceState *dev)
         xhci->intr[i].er_full = 0;
         xhci->intr[i].ev_buffer_put = 0;
         xhci->intr[i].ev_buffer_get = 0;
+        xhci->intr[i].imod_next = 0;
+        xhci->intr[i].imod_pending = false;
     }
+    timer_del(xhci->imod_timer);
 
     xhci->mfindex_start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
     xhci_mfwrap_update(xhci);
@@ -3309,10 +3437,12 @@ static void xhci_runtime_write(void *ptr, hwaddr reg,
             intr->erdp_low &= ~ERDP_EHB;
         }
         intr->erdp_low = (val & ~ERDP_EHB) | (intr->erdp_low & ERDP_EHB);
+        xhci_intr_rearm(xhci, v);
         break;
     case 0x1c: /* ERDP high */
         intr->erdp_high = val;
         xhci_events_update(xhci, v);
+        xhci_intr_rearm(xhci, v);
         break;
     default:
         trace_usb_xhci_unimplemented("oper write", reg);
@@ -3602,6 +3732,7 @@ static int usb_xhci_initfn(struct PCIDevice *dev)
     }
 
     xhci->mfwrap_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, xhci_mfwrap_timer, xhci);
+    xhci->imod_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, xhci_imod_timer, xhci);
 
     memory_region_init(&xhci->mem, OBJECT(xhci), "xhci", LEN_REGS);
     memory_region_init_io(&xhci->mem_cap, OBJECT(xhci), &xhci_cap_ops, xhci,
@@ -3667,6 +3798,12 @@ static void usb_xhci_exit(PCIDevice *dev)
         xhci->mfwrap_timer = NULL;
     }
 
+    if (xhci->imod_timer) {
+        timer_del(xhci->imod_timer);
+        timer_free(xhci->imod_timer);
+        xhci->imod_timer = NULL;
+    }
+
     memory_region_del_subregion(&xhci->mem, &xhci->mem_cap);
     memory_region_del_subregion(&xhci->mem, &xhci->mem_oper);
     memory_region_del_subregion(&xhci->mem, &xhci->mem_runtime);
@@ -3741,6 +3878,10 @@ static int usb_xhci_post_load(void *opaque, int version_id)
         } else {
             msix_vector_unuse(pci_dev, intr);
         }
+        /* A moderated interrupt may have been held back, signal it again */
+        if (xhci->intr[intr].iman & IMAN_IP) {
+            xhci_intr_update(xhci, intr);
+        }
     }
 
     return 0;
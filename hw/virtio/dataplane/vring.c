@@ -302,15 +302,26 @@ static void vring_unmap_element(VirtQueueElement *elem)
  * Stolen from linux/drivers/vhost/vhost.c.
  */
 int vring_pop(VirtIODevice *vdev, Vring *vring,
-              VirtQueueElement *elem)
+              VirtQueueElement *velem)
 {
     struct vring_desc desc;
     unsigned int i, head, found = 0, num = vring->vr.num;
     uint16_t avail_idx, last_avail_idx;
     int ret;
+    /* Descriptors are gathered here, velem gets arrays of the final size */
+    hwaddr in_addr[VIRTQUEUE_MAX_SIZE], out_addr[VIRTQUEUE_MAX_SIZE];
+    struct iovec in_sg[VIRTQUEUE_MAX_SIZE], out_sg[VIRTQUEUE_MAX_SIZE];
+    VirtQueueElement scratch = {
+        .in_addr = in_addr,
+        .out_addr = out_addr,
+        .in_sg = in_sg,
+        .out_sg = out_sg,
+    };
+    VirtQueueElement *elem = &scratch;
 
     /* Initialize elem so it can be safely unmapped */
-    elem->in_num = elem->out_num = 0;
+    velem->in_num = velem->out_num = 0;
+    velem->in_sg = velem->out_sg = NULL;
 
     /* If there was a fatal error then refuse operation */
     if (vring->broken) {
@@ -392,6 +403,12 @@ int vring_pop(VirtIODevice *vdev, Vring *vring,
         vring_avail_event(&vring->vr) = vring->last_avail_idx;
     }
 
+    virtqueue_element_alloc(NULL, velem, elem->out_num, elem->in_num);
+    velem->index = elem->index;
+    memcpy(velem->out_addr, out_addr, elem->out_num * sizeof(hwaddr));
+    memcpy(velem->out_sg, out_sg, elem->out_num * sizeof(struct iovec));
+    memcpy(velem->in_addr, in_addr, elem->in_num * sizeof(hwaddr));
+    memcpy(velem->in_sg, in_sg, elem->in_num * sizeof(struct iovec));
     return head;
 
 out:
@@ -414,6 +431,7 @@ void vring_push(Vring *vring, VirtQueueElement *elem, int len)
     uint16_t new;
 
     vring_unmap_element(elem);
+    virtqueue_element_release(NULL, elem);
 
     /* Don't touch vring if a fatal error occurred */
     if (vring->broken) {
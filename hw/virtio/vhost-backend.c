@@ -42,11 +42,37 @@ static int vhost_kernel_cleanup(struct vhost_dev *dev)
     return close(fd);
 }
 
+/* Older kernels have a fixed limit and no module parameter */
+#define VHOST_KERNEL_MEMSLOTS_DEFAULT 64
+
+static unsigned int vhost_kernel_memslots_limit(struct vhost_dev *dev)
+{
+    static unsigned int limit;
+    gchar *s = NULL;
+
+    if (limit) {
+        return limit;
+    }
+
+    limit = VHOST_KERNEL_MEMSLOTS_DEFAULT;
+    if (g_file_get_contents("/sys/module/vhost/parameters/max_mem_regions",
+                            &s, NULL, NULL)) {
+        uint64_t val = g_ascii_strtoull(s, NULL, 10);
+
+        if (val > 0 && val <= UINT_MAX) {
+            limit = val;
+        }
+        g_free(s);
+    }
+    return limit;
+}
+
 static const VhostOps kernel_ops = {
         .backend_type = VHOST_BACKEND_TYPE_KERNEL,
         .vhost_call = vhost_kernel_call,
         .vhost_backend_init = vhost_kernel_init,
-        .vhost_backend_cleanup = vhost_kernel_cleanup
+        .vhost_backend_cleanup = vhost_kernel_cleanup,
+        .vhost_backend_memslots_limit = vhost_kernel_memslots_limit,
 };
 
 int vhost_set_backend_type(struct vhost_dev *dev, VhostBackendType backend_type)
@@ -25,6 +25,12 @@
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
 
+/* Feature bit advertising that the slave understands protocol features */
+#define VHOST_USER_F_PROTOCOL_FEATURES 30
+
+#define VHOST_USER_PROTOCOL_F_MQ    0
+#define VHOST_USER_PROTOCOL_FEATURE_MASK (1ULL << VHOST_USER_PROTOCOL_F_MQ)
+
 typedef enum VhostUserRequest {
     VHOST_USER_NONE = 0,
     VHOST_USER_GET_FEATURES = 1,
@@ -41,6 +47,10 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_VRING_KICK = 12,
     VHOST_USER_SET_VRING_CALL = 13,
     VHOST_USER_SET_VRING_ERR = 14,
+    VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+    VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+    VHOST_USER_GET_QUEUE_NUM = 17,
+    VHOST_USER_SET_VRING_ENABLE = 18,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -104,7 +114,11 @@ static unsigned long int ioctl_to_vhost_user_request[VHOST_USER_MAX] = {
     VHOST_GET_VRING_BASE,   /* VHOST_USER_GET_VRING_BASE */
     VHOST_SET_VRING_KICK,   /* VHOST_USER_SET_VRING_KICK */
     VHOST_SET_VRING_CALL,   /* VHOST_USER_SET_VRING_CALL */
-    VHOST_SET_VRING_ERR     /* VHOST_USER_SET_VRING_ERR */
+    VHOST_SET_VRING_ERR,    /* VHOST_USER_SET_VRING_ERR */
+    -1,                     /* VHOST_USER_GET_PROTOCOL_FEATURES */
+    -1,                     /* VHOST_USER_SET_PROTOCOL_FEATURES */
+    -1,                     /* VHOST_USER_GET_QUEUE_NUM */
+    -1                      /* VHOST_USER_SET_VRING_ENABLE */
 };
 
 static VhostUserRequest vhost_user_request_translate(unsigned long int request)
@@ -198,6 +212,16 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
     msg.flags = VHOST_USER_VERSION;
     msg.size = 0;
 
+    /*
+     * All queue pairs share the connection: per-device requests are only
+     * sent for the first pair, ring indexes are made absolute.
+     */
+    if (dev->vq_index != 0 && (request == VHOST_SET_OWNER ||
+                               request == VHOST_RESET_OWNER ||
+                               request == VHOST_SET_MEM_TABLE)) {
+        return 0;
+    }
+
     switch (request) {
     case VHOST_GET_FEATURES:
         need_reply = 1;
@@ -253,17 +277,20 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
     case VHOST_SET_VRING_NUM:
     case VHOST_SET_VRING_BASE:
         memcpy(&msg.state, arg, sizeof(struct vhost_vring_state));
+        msg.state.index += dev->vq_index;
         msg.size = sizeof(m.state);
         break;
 
     case VHOST_GET_VRING_BASE:
         memcpy(&msg.state, arg, sizeof(struct vhost_vring_state));
+        msg.state.index += dev->vq_index;
         msg.size = sizeof(m.state);
         need_reply = 1;
         break;
 
     case VHOST_SET_VRING_ADDR:
         memcpy(&msg.addr, arg, sizeof(struct vhost_vring_addr));
+        msg.addr.index += dev->vq_index;
         msg.size = sizeof(m.addr);
         break;
 
@@ -271,7 +298,7 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
     case VHOST_SET_VRING_CALL:
     case VHOST_SET_VRING_ERR:
         file = arg;
-        msg.u64 = file->index & VHOST_USER_VRING_IDX_MASK;
+        msg.u64 = (file->index + dev->vq_index) & VHOST_USER_VRING_IDX_MASK;
         msg.size = sizeof(m.u64);
         if (ioeventfd_enabled() && file->fd > 0) {
             fds[fd_num++] = file->fd;
@@ -286,12 +313,12 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
     }
 
     if (vhost_user_write(dev, &msg, fds, fd_num) < 0) {
-        return 0;
+        return -1;
     }
 
     if (need_reply) {
         if (vhost_user_read(dev, &msg) < 0) {
-            return 0;
+            return -1;
         }
 
         if (msg_request != msg.request) {
@@ -313,6 +340,7 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
                 error_report("Received bad msg size.\n");
                 return -1;
             }
+            msg.state.index -= dev->vq_index;
             memcpy(arg, &msg.state, sizeof(struct vhost_vring_state));
             break;
         default:
@@ -325,15 +353,130 @@ static int vhost_user_call(struct vhost_dev *dev, unsigned long int request,
     return 0;
 }
 
+static int vhost_user_get_u64(struct vhost_dev *dev, VhostUserRequest request,
+                              uint64_t *u64)
+{
+    VhostUserMsg msg = {
+        .request = request,
+        .flags = VHOST_USER_VERSION,
+    };
+
+    if (vhost_user_write(dev, &msg, NULL, 0) < 0) {
+        return -1;
+    }
+
+    if (vhost_user_read(dev, &msg) < 0) {
+        return -1;
+    }
+
+    if (msg.request != request) {
+        error_report("Received unexpected msg type."
+                     " Expected %d received %d", request, msg.request);
+        return -1;
+    }
+
+    if (msg.size != sizeof(m.u64)) {
+        error_report("Received bad msg size.");
+        return -1;
+    }
+
+    *u64 = msg.u64;
+    return 0;
+}
+
+static int vhost_user_set_u64(struct vhost_dev *dev, VhostUserRequest request,
+                              uint64_t u64)
+{
+    VhostUserMsg msg = {
+        .request = request,
+        .flags = VHOST_USER_VERSION,
+        .u64 = u64,
+        .size = sizeof(m.u64),
+    };
+
+    return vhost_user_write(dev, &msg, NULL, 0);
+}
+
 static int vhost_user_init(struct vhost_dev *dev, void *opaque)
 {
+    uint64_t features;
+
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
 
     dev->opaque = opaque;
+    dev->protocol_features = 0;
+    dev->max_queues = 1;
+
+    if (vhost_user_get_u64(dev, VHOST_USER_GET_FEATURES, &features) < 0) {
+        return -1;
+    }
+
+    if (!(features & (1ULL << VHOST_USER_F_PROTOCOL_FEATURES))) {
+        return 0;
+    }
+
+    /* Acknowledged together with the guest features in SET_FEATURES */
+    dev->backend_features |= 1ULL << VHOST_USER_F_PROTOCOL_FEATURES;
+
+    if (vhost_user_get_u64(dev, VHOST_USER_GET_PROTOCOL_FEATURES,
+                           &features) < 0) {
+        return -1;
+    }
+
+    dev->protocol_features = features & VHOST_USER_PROTOCOL_FEATURE_MASK;
+    if (vhost_user_set_u64(dev, VHOST_USER_SET_PROTOCOL_FEATURES,
+                           dev->protocol_features) < 0) {
+        return -1;
+    }
+
+    if (dev->protocol_features & (1ULL << VHOST_USER_PROTOCOL_F_MQ)) {
+        if (vhost_user_get_u64(dev, VHOST_USER_GET_QUEUE_NUM,
+                               &dev->max_queues) < 0) {
+            return -1;
+        }
+        if (dev->max_queues == 0) {
+            dev->max_queues = 1;
+        }
+    }
+
+    return 0;
+}
+
+static int vhost_user_set_vring_enable(struct vhost_dev *dev, int enable)
+{
+    struct vhost_vring_state state = {
+        .num = enable,
+    };
+    VhostUserMsg msg = {
+        .request = VHOST_USER_SET_VRING_ENABLE,
+        .flags = VHOST_USER_VERSION,
+        .size = sizeof(m.state),
+    };
+    int i;
+
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
+
+    /* Without protocol features the slave runs every ring it was given */
+    if (!(dev->backend_features & (1ULL << VHOST_USER_F_PROTOCOL_FEATURES))) {
+        return 0;
+    }
+
+    for (i = 0; i < dev->nvqs; i++) {
+        state.index = dev->vq_index + i;
+        msg.state = state;
+        if (vhost_user_write(dev, &msg, NULL, 0) < 0) {
+            return -1;
+        }
+    }
 
     return 0;
 }
 
+static unsigned int vhost_user_memslots_limit(struct vhost_dev *dev)
+{
+    return VHOST_MEMORY_MAX_NREGIONS;
+}
+
 static int vhost_user_cleanup(struct vhost_dev *dev)
 {
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_USER);
@@ -347,5 +490,7 @@ const VhostOps user_ops = {
         .backend_type = VHOST_BACKEND_TYPE_USER,
         .vhost_call = vhost_user_call,
         .vhost_backend_init = vhost_user_init,
-        .vhost_backend_cleanup = vhost_user_cleanup
+        .vhost_backend_cleanup = vhost_user_cleanup,
+        .vhost_backend_set_vring_enable = vhost_user_set_vring_enable,
+        .vhost_backend_memslots_limit = vhost_user_memslots_limit,
         };
@@ -17,11 +17,15 @@
 #include "hw/hw.h"
 #include "qemu/atomic.h"
 #include "qemu/range.h"
+#include "qemu/error-report.h"
 #include <linux/vhost.h>
 #include "exec/address-spaces.h"
 #include "hw/virtio/virtio-bus.h"
 #include "migration/migration.h"
 
+static QLIST_HEAD(, vhost_dev) vhost_devices =
+    QLIST_HEAD_INITIALIZER(vhost_devices);
+
 static void vhost_dev_sync_region(struct vhost_dev *dev,
                                   MemoryRegionSection *section,
                                   uint64_t mfirst, uint64_t mlast,
@@ -330,6 +334,47 @@ static int vhost_verify_ring_mappings(struct vhost_dev *dev,
     return r;
 }
 
+static size_t vhost_memory_size(const struct vhost_memory *mem)
+{
+    return offsetof(struct vhost_memory, regions) +
+        mem->nregions * sizeof mem->regions[0];
+}
+
+/* The table is unordered: compare as sets of regions. */
+static bool vhost_memory_equal(const struct vhost_memory *a,
+                               const struct vhost_memory *b)
+{
+    int i, j;
+
+    if (!a || !b || a->nregions != b->nregions) {
+        return false;
+    }
+    for (i = 0; i < a->nregions; ++i) {
+        for (j = 0; j < b->nregions; ++j) {
+            if (!memcmp(a->regions + i, b->regions + j,
+                        sizeof a->regions[0])) {
+                break;
+            }
+        }
+        if (j == b->nregions) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int vhost_dev_set_mem_table(struct vhost_dev *dev)
+{
+    int r = dev->vhost_ops->vhost_call(dev, VHOST_SET_MEM_TABLE, dev->mem);
+
+    if (r < 0) {
+        return r;
+    }
+    g_free(dev->mem_committed);
+    dev->mem_committed = g_memdup(dev->mem, vhost_memory_size(dev->mem));
+    return r;
+}
+
 static struct vhost_memory_region *vhost_dev_find_reg(struct vhost_dev *dev,
 						      uint64_t start_addr,
 						      uint64_t size)
@@ -448,6 +493,15 @@ static void vhost_commit(MemoryListener *listener)
     if (dev->mem_changed_start_addr > dev->mem_changed_end_addr) {
         return;
     }
+    /*
+     * A section removed and added back within one transaction (BAR
+     * remapping, a DIMM plugged next to RAM that was re-split) often ends
+     * up with the table the backend already has.
+     */
+    if (vhost_memory_equal(dev->mem, dev->mem_committed)) {
+        dev->memory_changed = false;
+        return;
+    }
 
     if (dev->started) {
         start_addr = dev->mem_changed_start_addr;
@@ -458,7 +512,7 @@ static void vhost_commit(MemoryListener *listener)
     }
 
     if (!dev->log_enabled) {
-        r = dev->vhost_ops->vhost_call(dev, VHOST_SET_MEM_TABLE, dev->mem);
+        r = vhost_dev_set_mem_table(dev);
         assert(r >= 0);
         dev->memory_changed = false;
         return;
@@ -471,7 +525,7 @@ static void vhost_commit(MemoryListener *listener)
     if (dev->log_size < log_size) {
         vhost_dev_log_resize(dev, log_size + VHOST_LOG_BUFFER);
     }
-    r = dev->vhost_ops->vhost_call(dev, VHOST_SET_MEM_TABLE, dev->mem);
+    r = vhost_dev_set_mem_table(dev);
     assert(r >= 0);
     /* To log less, can only decrease log size after table update. */
     if (dev->log_size > log_size + VHOST_LOG_BUFFER) {
@@ -754,12 +808,13 @@ static void vhost_virtqueue_stop(struct vhost_dev *dev,
     assert(idx >= dev->vq_index && idx < dev->vq_index + dev->nvqs);
     r = dev->vhost_ops->vhost_call(dev, VHOST_GET_VRING_BASE, &state);
     if (r < 0) {
-        fprintf(stderr, "vhost VQ %d ring restore failed: %d\n", idx, r);
-        fflush(stderr);
+        /* The backend went away (vhost-user disconnect) */
+        error_report("vhost VQ %d ring restore failed: %d", idx, r);
+        virtio_queue_restore_last_avail_idx(vdev, idx);
+    } else {
+        virtio_queue_set_last_avail_idx(vdev, idx, state.num);
     }
-    virtio_queue_set_last_avail_idx(vdev, idx, state.num);
     virtio_queue_invalidate_signalled_used(vdev, idx);
-    assert (r >= 0);
     cpu_physical_memory_unmap(vq->ring, virtio_queue_get_ring_size(vdev, idx),
                               0, virtio_queue_get_ring_size(vdev, idx));
     cpu_physical_memory_unmap(vq->used, virtio_queue_get_used_size(vdev, idx),
@@ -868,6 +923,7 @@ int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
     hdev->mem = g_malloc0(offsetof(struct vhost_memory, regions));
     hdev->n_mem_sections = 0;
     hdev->mem_sections = NULL;
+    hdev->mem_committed = NULL;
     hdev->log = NULL;
     hdev->log_size = 0;
     hdev->log_enabled = false;
@@ -875,6 +931,7 @@ int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
     hdev->memory_changed = false;
     memory_listener_register(&hdev->memory_listener, &address_space_memory);
     hdev->force = force;
+    QLIST_INSERT_HEAD(&vhost_devices, hdev, entry);
     return 0;
 fail_vq:
     while (--i >= 0) {
@@ -897,11 +954,34 @@ void vhost_dev_cleanup(struct vhost_dev *hdev)
         migrate_del_blocker(hdev->migration_blocker);
         error_free(hdev->migration_blocker);
     }
+    QLIST_REMOVE(hdev, entry);
     g_free(hdev->mem);
+    g_free(hdev->mem_committed);
     g_free(hdev->mem_sections);
     hdev->vhost_ops->vhost_backend_cleanup(hdev);
 }
 
+static unsigned int vhost_dev_memslots_limit(struct vhost_dev *hdev)
+{
+    return hdev->vhost_ops->vhost_backend_memslots_limit(hdev);
+}
+
+/*
+ * All vhost devices map the same guest RAM, so the table of any of them
+ * tells how many slots a DIMM hotplug would add to.
+ */
+bool vhost_has_free_slot(void)
+{
+    struct vhost_dev *hdev;
+
+    QLIST_FOREACH(hdev, &vhost_devices, entry) {
+        if (hdev->mem->nregions >= vhost_dev_memslots_limit(hdev)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool vhost_dev_query(struct vhost_dev *hdev, VirtIODevice *vdev)
 {
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
@@ -1000,7 +1080,9 @@ void vhost_virtqueue_mask(struct vhost_dev *hdev, VirtIODevice *vdev, int n,
         file.fd = event_notifier_get_fd(virtio_queue_get_guest_notifier(vvq));
     }
     r = hdev->vhost_ops->vhost_call(hdev, VHOST_SET_VRING_CALL, &file);
-    assert(r >= 0);
+    if (r < 0) {
+        error_report("vhost VQ %d call fd update failed: %d", n, r);
+    }
 }
 
 unsigned vhost_get_features(struct vhost_dev *hdev, const int *feature_bits,
@@ -1035,13 +1117,19 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
 {
     int i, r;
 
+    if (hdev->mem->nregions > vhost_dev_memslots_limit(hdev)) {
+        error_report("vhost backend supports %u memory regions, guest has %u",
+                     vhost_dev_memslots_limit(hdev), hdev->mem->nregions);
+        return -E2BIG;
+    }
+
     hdev->started = true;
 
     r = vhost_dev_set_features(hdev, hdev->log_enabled);
     if (r < 0) {
         goto fail_features;
     }
-    r = hdev->vhost_ops->vhost_call(hdev, VHOST_SET_MEM_TABLE, hdev->mem);
+    r = vhost_dev_set_mem_table(hdev);
     if (r < 0) {
         r = -errno;
         goto fail_mem;
@@ -25,6 +25,8 @@
 #include "exec/address-spaces.h"
 #include "qapi/visitor.h"
 #include "qapi-event.h"
+#include "trace.h"
+#include "migration/migration.h"
 
 #if defined(__linux__)
 #include <sys/mman.h>
@@ -33,15 +35,151 @@
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
-static void balloon_page(void *addr, int deflate)
+#include "exec/ram_addr.h"
+#include "qemu/bitmap.h"
+
+#define BALLOON_PAGE_SIZE (1 << VIRTIO_BALLOON_PFN_SHIFT)
+
+/* A run of contiguous balloon pages within one RAM region */
+typedef struct BalloonRange {
+    MemoryRegion *mr;
+    ram_addr_t offset;
+    ram_addr_t size;
+} BalloonRange;
+
+static uint8_t *balloon_page_start(uint8_t *addr, size_t pagesize)
+{
+    return (uint8_t *)((uintptr_t)addr & ~(uintptr_t)(pagesize - 1));
+}
+
+static void balloon_discard(VirtIOBalloon *s, void *addr, size_t size)
 {
 #if defined(__linux__)
-    if (!kvm_enabled() || kvm_has_sync_mmu())
-        qemu_madvise(addr, TARGET_PAGE_SIZE,
-                deflate ? QEMU_MADV_WILLNEED : QEMU_MADV_DONTNEED);
+    if (!kvm_enabled() || kvm_has_sync_mmu()) {
+        qemu_madvise(addr, size, QEMU_MADV_DONTNEED);
+        s->discard_calls++;
+        s->discarded_bytes += size;
+    }
 #endif
 }
 
+/*
+ * Record that [addr, addr + size) of the host page at @page was inflated,
+ * and discard the page once all of it has been.
+ */
+static void balloon_inflate_partial(VirtIOBalloon *s, uint8_t *page,
+                                    size_t pagesize, uint8_t *addr,
+                                    size_t size)
+{
+    long nbits = pagesize / BALLOON_PAGE_SIZE;
+    unsigned long *bitmap = g_hash_table_lookup(s->partial_pages, page);
+
+    if (!bitmap) {
+        bitmap = bitmap_new(nbits);
+        g_hash_table_insert(s->partial_pages, page, bitmap);
+    }
+    bitmap_set(bitmap, (addr - page) / BALLOON_PAGE_SIZE,
+               size / BALLOON_PAGE_SIZE);
+    if (bitmap_full(bitmap, nbits)) {
+        g_hash_table_remove(s->partial_pages, page);
+        balloon_discard(s, page, pagesize);
+    }
+}
+
+static void balloon_deflate_partial(VirtIOBalloon *s, uint8_t *page,
+                                    size_t pagesize, uint8_t *addr,
+                                    size_t size)
+{
+    long nbits = pagesize / BALLOON_PAGE_SIZE;
+    unsigned long *bitmap = g_hash_table_lookup(s->partial_pages, page);
+
+    if (!bitmap) {
+        return;
+    }
+    bitmap_clear(bitmap, (addr - page) / BALLOON_PAGE_SIZE,
+                 size / BALLOON_PAGE_SIZE);
+    if (bitmap_empty(bitmap, nbits)) {
+        g_hash_table_remove(s->partial_pages, page);
+    }
+}
+
+/*
+ * Host pages wholly inside the range are discarded at once.  The balloon
+ * pages at either end that only cover part of a host page, as happens on
+ * huge page backed RAM, are tracked until the rest of the host page
+ * follows.
+ */
+static void balloon_inflate_range(VirtIOBalloon *s, uint8_t *host,
+                                  size_t size, size_t pagesize)
+{
+    uint8_t *end = host + size;
+    uint8_t *start_page = balloon_page_start(host, pagesize);
+    uint8_t *end_page = balloon_page_start(end, pagesize);
+
+    if (start_page == end_page) {
+        balloon_inflate_partial(s, start_page, pagesize, host, size);
+        return;
+    }
+    if (host != start_page) {
+        balloon_inflate_partial(s, start_page, pagesize, host,
+                                start_page + pagesize - host);
+        start_page += pagesize;
+    }
+    if (start_page < end_page) {
+        balloon_discard(s, start_page, end_page - start_page);
+    }
+    if (end != end_page) {
+        balloon_inflate_partial(s, end_page, pagesize, end_page,
+                                end - end_page);
+    }
+}
+
+static void balloon_deflate_range(VirtIOBalloon *s, uint8_t *host,
+                                  size_t size, size_t pagesize)
+{
+    uint8_t *end = host + size;
+    uint8_t *page;
+
+    if (pagesize == BALLOON_PAGE_SIZE) {
+#if defined(__linux__)
+        if (!kvm_enabled() || kvm_has_sync_mmu()) {
+            qemu_madvise(host, size, QEMU_MADV_WILLNEED);
+        }
+#endif
+        return;
+    }
+
+    for (page = balloon_page_start(host, pagesize); page < end;
+         page += pagesize) {
+        uint8_t *first = MAX(page, host);
+        uint8_t *last = MIN(page + pagesize, end);
+
+        balloon_deflate_partial(s, page, pagesize, first, last - first);
+    }
+}
+
+static void balloon_flush_range(VirtIOBalloon *s, BalloonRange *r,
+                                bool deflate)
+{
+    uint8_t *host;
+    size_t pagesize;
+
+    if (!r->mr) {
+        return;
+    }
+
+    host = memory_region_get_ram_ptr(r->mr) + r->offset;
+    pagesize = qemu_get_ram_page_size(memory_region_get_ram_addr(r->mr) +
+                                      r->offset);
+    if (deflate) {
+        balloon_deflate_range(s, host, r->size, pagesize);
+    } else {
+        balloon_inflate_range(s, host, r->size, pagesize);
+    }
+    memory_region_unref(r->mr);
+    r->mr = NULL;
+}
+
 static const char *balloon_stat_names[] = {
    [VIRTIO_BALLOON_S_SWAP_IN] = "stat-swap-in",
    [VIRTIO_BALLOON_S_SWAP_OUT] = "stat-swap-out",
@@ -143,6 +281,32 @@ out:
     error_propagate(errp, err);
 }
 
+static void balloon_host_stats_get(Object *obj, struct Visitor *v,
+                                   void *opaque, const char *name,
+                                   Error **errp)
+{
+    Error *err = NULL;
+    VirtIOBalloon *s = opaque;
+    uint64_t partial_pages = g_hash_table_size(s->partial_pages);
+
+    visit_start_struct(v, NULL, "host-stats", name, 0, &err);
+    if (err) {
+        goto out;
+    }
+    visit_type_uint64(v, &s->discard_calls, "discard-calls", &err);
+    if (!err) {
+        visit_type_uint64(v, &s->discarded_bytes, "discarded-bytes", &err);
+    }
+    if (!err) {
+        visit_type_uint64(v, &partial_pages, "partial-pages", &err);
+    }
+    error_propagate(errp, err);
+    err = NULL;
+    visit_end_struct(v, &err);
+out:
+    error_propagate(errp, err);
+}
+
 static void balloon_stats_get_poll_interval(Object *obj, struct Visitor *v,
                                             void *opaque, const char *name,
                                             Error **errp)
@@ -204,6 +368,9 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
     VirtQueueElement elem;
     MemoryRegionSection section;
+    BalloonRange range = { NULL };
+    bool deflate = vq == s->dvq;
+    bool notify = false;
 
     while (virtqueue_pop(vq, &elem)) {
         size_t offset = 0;
@@ -218,23 +385,175 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
             offset += 4;
 
             /* FIXME: remove get_system_memory(), but how? */
-            section = memory_region_find(get_system_memory(), pa, 1);
-            if (!int128_nz(section.size) || !memory_region_is_ram(section.mr))
+            section = memory_region_find(get_system_memory(), pa,
+                                         BALLOON_PAGE_SIZE);
+            if (int128_get64(section.size) != BALLOON_PAGE_SIZE ||
+                !memory_region_is_ram(section.mr)) {
+                if (int128_nz(section.size)) {
+                    memory_region_unref(section.mr);
+                }
                 continue;
+            }
 
             /* Using memory_region_get_ram_ptr is bending the rules a bit, but
-               should be OK because we only want a single page.  */
+               should be OK because we stay within the region.  Guests
+               usually inflate runs of contiguous pages, so merge them and
+               madvise each run once.  */
             addr = section.offset_within_region;
-            balloon_page(memory_region_get_ram_ptr(section.mr) + addr,
-                         !!(vq == s->dvq));
-            memory_region_unref(section.mr);
+            if (range.mr == section.mr &&
+                range.offset + range.size == addr) {
+                range.size += BALLOON_PAGE_SIZE;
+                memory_region_unref(section.mr);
+                continue;
+            }
+            balloon_flush_range(s, &range, deflate);
+            range.mr = section.mr;
+            range.offset = addr;
+            range.size = BALLOON_PAGE_SIZE;
         }
 
         virtqueue_push(vq, &elem, offset);
+        notify = true;
+    }
+    balloon_flush_range(s, &range, deflate);
+
+    if (notify) {
         virtio_notify(vdev, vq);
     }
 }
 
+/*
+ * The guest hands us free chunks of its memory as device-writable buffers,
+ * typically 2 MB or larger, and does not reuse them until they come back.
+ * Discard them so the host can reclaim the memory; the guest sees zeroes
+ * when it touches them again, and migration sends them as zero pages.
+ */
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtQueueElement elem;
+    size_t pagesize = getpagesize();
+    bool discard = !kvm_enabled() || kvm_has_sync_mmu();
+    bool notify = false;
+
+    while (virtqueue_pop(vq, &elem)) {
+        unsigned int i;
+
+        for (i = 0; discard && i < elem.in_num; i++) {
+            void *addr = elem.in_sg[i].iov_base;
+            size_t size = elem.in_sg[i].iov_len;
+            ram_addr_t ram_addr;
+
+            /* Bounce buffers for non-RAM regions are not guest memory */
+            if (!qemu_ram_addr_from_host(addr, &ram_addr)) {
+                continue;
+            }
+            if (((uintptr_t)addr | size) & (pagesize - 1)) {
+                continue;
+            }
+            trace_virtio_balloon_report(ram_addr, size);
+            qemu_madvise(addr, size, QEMU_MADV_DONTNEED);
+        }
+
+        virtqueue_push(vq, &elem, 0);
+        notify = true;
+    }
+
+    if (notify) {
+        virtio_notify(vdev, vq);
+    }
+}
+
+/*
+ * While a migration starts, the guest reports free memory here after the
+ * command id it was given, and keeps those pages until it sees
+ * VIRTIO_BALLOON_CMD_ID_DONE.  The migration code then leaves them out of
+ * its first pass.
+ */
+static void virtio_balloon_handle_free_page_vq(VirtIODevice *vdev,
+                                               VirtQueue *vq)
+{
+    VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
+    VirtQueueElement elem;
+    bool notify = false;
+
+    while (virtqueue_pop(vq, &elem)) {
+        unsigned int i;
+        uint32_t id;
+
+        if (iov_to_buf(elem.out_sg, elem.out_num, 0, &id, sizeof(id)) ==
+            sizeof(id)) {
+            id = virtio_ldl_p(vdev, &id);
+            if (s->free_page_hint_status == FREE_PAGE_HINT_S_REQUESTED &&
+                id == s->free_page_hint_cmd_id) {
+                s->free_page_hint_status = FREE_PAGE_HINT_S_START;
+            } else if (s->free_page_hint_status == FREE_PAGE_HINT_S_START) {
+                /* Ignore stale ids from an earlier request */
+                s->free_page_hint_status = FREE_PAGE_HINT_S_STOP;
+            }
+        }
+
+        if (s->free_page_hint_status == FREE_PAGE_HINT_S_START) {
+            for (i = 0; i < elem.in_num; i++) {
+                ram_free_page_hint(elem.in_sg[i].iov_base,
+                                   elem.in_sg[i].iov_len);
+            }
+        }
+
+        virtqueue_push(vq, &elem, 0);
+        notify = true;
+    }
+
+    if (notify) {
+        virtio_notify(vdev, vq);
+    }
+}
+
+static bool free_page_hint_enabled(VirtIOBalloon *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    return vdev->guest_features & (1 << VIRTIO_BALLOON_F_FREE_PAGE_HINT);
+}
+
+static void virtio_balloon_migration_state_changed(Notifier *notifier,
+                                                   void *data)
+{
+    VirtIOBalloon *s = container_of(notifier, VirtIOBalloon,
+                                    migration_state_notifier);
+    MigrationState *mig = data;
+
+    if (!free_page_hint_enabled(s)) {
+        return;
+    }
+
+    if (migration_in_setup(mig)) {
+        if (s->free_page_hint_cmd_id == UINT32_MAX ||
+            s->free_page_hint_cmd_id <
+            VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN) {
+            s->free_page_hint_cmd_id =
+                VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN;
+        } else {
+            s->free_page_hint_cmd_id++;
+        }
+        s->free_page_hint_status = FREE_PAGE_HINT_S_REQUESTED;
+        virtio_notify_config(VIRTIO_DEVICE(s));
+    } else if (migration_has_finished(mig) || migration_has_failed(mig)) {
+        s->free_page_hint_status = FREE_PAGE_HINT_S_DONE;
+        virtio_notify_config(VIRTIO_DEVICE(s));
+    }
+}
+
+static void virtio_balloon_vm_state_change(void *opaque, int running,
+                                           RunState state)
+{
+    VirtIOBalloon *s = opaque;
+
+    if (running && s->free_page_hint_done_pending) {
+        s->free_page_hint_done_pending = false;
+        virtio_notify_config(VIRTIO_DEVICE(s));
+    }
+}
+
 static void virtio_balloon_receive_stats(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
@@ -282,10 +601,24 @@ static void virtio_balloon_get_config(VirtIODevice *vdev, uint8_t *config_data)
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
     struct virtio_balloon_config config;
 
+    memset(&config, 0, sizeof(config));
     config.num_pages = cpu_to_le32(dev->num_pages);
     config.actual = cpu_to_le32(dev->actual);
 
-    memcpy(config_data, &config, sizeof(struct virtio_balloon_config));
+    switch (dev->free_page_hint_status) {
+    case FREE_PAGE_HINT_S_REQUESTED:
+    case FREE_PAGE_HINT_S_START:
+        config.free_page_hint_cmd_id = cpu_to_le32(dev->free_page_hint_cmd_id);
+        break;
+    case FREE_PAGE_HINT_S_STOP:
+        config.free_page_hint_cmd_id = cpu_to_le32(VIRTIO_BALLOON_CMD_ID_STOP);
+        break;
+    case FREE_PAGE_HINT_S_DONE:
+        config.free_page_hint_cmd_id = cpu_to_le32(VIRTIO_BALLOON_CMD_ID_DONE);
+        break;
+    }
+
+    memcpy(config_data, &config, vdev->config_len);
 }
 
 static void virtio_balloon_set_config(VirtIODevice *vdev,
@@ -294,7 +627,7 @@ static void virtio_balloon_set_config(VirtIODevice *vdev,
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
     struct virtio_balloon_config config;
     uint32_t oldactual = dev->actual;
-    memcpy(&config, config_data, sizeof(struct virtio_balloon_config));
+    memcpy(&config, config_data, MIN(vdev->config_len, sizeof(config)));
     dev->actual = le32_to_cpu(config.actual);
     if (dev->actual != oldactual) {
         qapi_event_send_balloon_change(ram_size -
@@ -305,7 +638,15 @@ static void virtio_balloon_set_config(VirtIODevice *vdev,
 
 static uint32_t virtio_balloon_get_features(VirtIODevice *vdev, uint32_t f)
 {
+    VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
+
     f |= (1 << VIRTIO_BALLOON_F_STATS_VQ);
+    if (s->free_page_hint) {
+        f |= (1 << VIRTIO_BALLOON_F_FREE_PAGE_HINT);
+    }
+    if (s->free_page_reporting) {
+        f |= (1 << VIRTIO_BALLOON_F_REPORTING);
+    }
     return f;
 }
 
@@ -341,6 +682,9 @@ static void virtio_balloon_save_device(VirtIODevice *vdev, QEMUFile *f)
 
     qemu_put_be32(f, s->num_pages);
     qemu_put_be32(f, s->actual);
+    if (s->free_page_hint) {
+        qemu_put_be32(f, s->free_page_hint_cmd_id);
+    }
 }
 
 static int virtio_balloon_load(QEMUFile *f, void *opaque, int version_id)
@@ -358,6 +702,14 @@ static int virtio_balloon_load_device(VirtIODevice *vdev, QEMUFile *f,
 
     s->num_pages = qemu_get_be32(f);
     s->actual = qemu_get_be32(f);
+    if (s->free_page_hint) {
+        /* Keep counting so the next migration's id is new to the guest */
+        s->free_page_hint_cmd_id = qemu_get_be32(f);
+        if (free_page_hint_enabled(s)) {
+            s->free_page_hint_status = FREE_PAGE_HINT_S_DONE;
+            s->free_page_hint_done_pending = true;
+        }
+    }
     return 0;
 }
 
@@ -368,7 +720,9 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     int ret;
 
     virtio_init(vdev, "virtio-balloon", VIRTIO_ID_BALLOON,
-                sizeof(struct virtio_balloon_config));
+                s->free_page_hint ? sizeof(struct virtio_balloon_config) :
+                offsetof(struct virtio_balloon_config,
+                         free_page_hint_cmd_id));
 
     ret = qemu_add_balloon_handler(virtio_balloon_to_target,
                                    virtio_balloon_stat, s);
@@ -382,8 +736,23 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     s->ivq = virtio_add_queue(vdev, 128, virtio_balloon_handle_output);
     s->dvq = virtio_add_queue(vdev, 128, virtio_balloon_handle_output);
     s->svq = virtio_add_queue(vdev, 128, virtio_balloon_receive_stats);
+    if (s->free_page_hint) {
+        s->free_page_vq = virtio_add_queue(vdev, 128,
+                                           virtio_balloon_handle_free_page_vq);
+        s->free_page_hint_status = FREE_PAGE_HINT_S_STOP;
+        s->migration_state_notifier.notify =
+            virtio_balloon_migration_state_changed;
+        add_migration_state_change_notifier(&s->migration_state_notifier);
+        s->change = qemu_add_vm_change_state_handler(
+            virtio_balloon_vm_state_change, s);
+    }
+    if (s->free_page_reporting) {
+        s->rvq = virtio_add_queue(vdev, 32, virtio_balloon_handle_report);
+    }
 
     reset_stats(s);
+    s->partial_pages = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                             NULL, g_free);
 
     register_savevm(dev, "virtio-balloon", -1, 1,
                     virtio_balloon_save, virtio_balloon_load, s);
@@ -395,6 +764,9 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
                         balloon_stats_get_poll_interval,
                         balloon_stats_set_poll_interval,
                         NULL, s, NULL);
+
+    object_property_add(OBJECT(dev), "host-stats", "host statistics",
+                        balloon_host_stats_get, NULL, NULL, s, NULL);
 }
 
 static void virtio_balloon_device_unrealize(DeviceState *dev, Error **errp)
@@ -405,10 +777,26 @@ static void virtio_balloon_device_unrealize(DeviceState *dev, Error **errp)
     balloon_stats_destroy_timer(s);
     qemu_remove_balloon_handler(s);
     unregister_savevm(dev, "virtio-balloon", s);
+    if (s->free_page_hint) {
+        remove_migration_state_change_notifier(&s->migration_state_notifier);
+        qemu_del_vm_change_state_handler(s->change);
+    }
+    g_hash_table_destroy(s->partial_pages);
     virtio_cleanup(vdev);
 }
 
+static void virtio_balloon_device_reset(VirtIODevice *vdev)
+{
+    VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
+
+    /* The guest driver starts over with an empty balloon */
+    g_hash_table_remove_all(s->partial_pages);
+}
+
 static Property virtio_balloon_properties[] = {
+    DEFINE_PROP_BOOL("free-page-hint", VirtIOBalloon, free_page_hint, false),
+    DEFINE_PROP_BOOL("free-page-reporting", VirtIOBalloon,
+                     free_page_reporting, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -421,6 +809,7 @@ static void virtio_balloon_class_init(ObjectClass *klass, void *data)
     set_bit(DEVICE_CATEGORY_MISC, dc->categories);
     vdc->realize = virtio_balloon_device_realize;
     vdc->unrealize = virtio_balloon_device_unrealize;
+    vdc->reset = virtio_balloon_device_reset;
     vdc->get_config = virtio_balloon_get_config;
     vdc->set_config = virtio_balloon_set_config;
     vdc->get_features = virtio_balloon_get_features;
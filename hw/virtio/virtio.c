@@ -66,9 +66,52 @@ typedef struct VRing
     hwaddr used;
 } VRing;
 
+/*
+ * Host mapping of one of the ring areas, so that accessing it doesn't
+ * take an address space lookup per field.  Redone lazily when the ring
+ * moves or the memory topology changes.
+ */
+typedef struct VRingMap {
+    MemoryRegion *mr;       /* reference held while mapped */
+    hwaddr offset;          /* of the area within mr */
+    void *ptr;              /* NULL if the area isn't in a single RAM region */
+    unsigned int gen;       /* vring_map_gen it is valid for, 0 if none */
+} VRingMap;
+
+/*
+ * Storage for the scatter/gather arrays of a VirtQueueElement, sized by
+ * its descriptor count.  out_sg[] and in_sg[] are consecutive in sg[],
+ * out_addr[] and in_addr[] in the hwaddr array that follows it, so the
+ * buffer is found again from elem->out_sg.
+ */
+typedef struct VirtQueueSg {
+    QSLIST_ENTRY(VirtQueueSg) next;
+    unsigned int size;      /* descriptors it has room for */
+    struct iovec sg[];
+} VirtQueueSg;
+
+/* Freed VirtQueueSg buffers kept per queue for the next pops */
+#define VIRTQUEUE_SG_POOL_MAX 16
+/* Buffer sizes are rounded up to this many descriptors to ease reuse */
+#define VIRTQUEUE_SG_ALIGN 8
+
+/* Layout VirtQueueElement had with fixed arrays; still the migration format */
+typedef struct VirtQueueElementOld {
+    unsigned int index;
+    unsigned int out_num;
+    unsigned int in_num;
+    hwaddr in_addr[VIRTQUEUE_MAX_SIZE];
+    hwaddr out_addr[VIRTQUEUE_MAX_SIZE];
+    struct iovec in_sg[VIRTQUEUE_MAX_SIZE];
+    struct iovec out_sg[VIRTQUEUE_MAX_SIZE];
+} VirtQueueElementOld;
+
 struct VirtQueue
 {
     VRing vring;
+    VRingMap desc_map;
+    VRingMap avail_map;
+    VRingMap used_map;
     hwaddr pa;
     uint16_t last_avail_idx;
     /* Last used index value we have signalled on */
@@ -89,68 +132,176 @@ struct VirtQueue
     VirtIODevice *vdev;
     EventNotifier guest_notifier;
     EventNotifier host_notifier;
+
+    QSLIST_HEAD(, VirtQueueSg) sg_pool;
+    unsigned int sg_pool_len;
 };
 
-/* virt queue functions */
-static void virtqueue_init(VirtQueue *vq)
+/* Bumped on every memory topology change, see VRingMap */
+static unsigned int vring_map_gen = 1;
+
+static void vring_map_commit(MemoryListener *listener)
 {
-    hwaddr pa = vq->pa;
+    vring_map_gen++;
+}
 
-    vq->vring.desc = pa;
-    vq->vring.avail = pa + vq->vring.num * sizeof(VRingDesc);
-    vq->vring.used = vring_align(vq->vring.avail +
-                                 offsetof(VRingAvail, ring[vq->vring.num]),
-                                 vq->vring.align);
+static MemoryListener vring_map_listener = {
+    .commit = vring_map_commit,
+};
+
+static void vring_unmap(VRingMap *map)
+{
+    if (map->mr) {
+        memory_region_unref(map->mr);
+    }
+    map->mr = NULL;
+    map->ptr = NULL;
+    map->gen = 0;
 }
 
-static inline uint64_t vring_desc_addr(VirtIODevice *vdev, hwaddr desc_pa,
-                                       int i)
+static void virtqueue_unmap(VirtQueue *vq)
 {
-    hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, addr);
-    return virtio_ldq_phys(vdev, pa);
+    vring_unmap(&vq->desc_map);
+    vring_unmap(&vq->avail_map);
+    vring_unmap(&vq->used_map);
 }
 
-static inline uint32_t vring_desc_len(VirtIODevice *vdev, hwaddr desc_pa, int i)
+/*
+ * Host pointer to the @len bytes at @pa that @map covers, or NULL if
+ * they must be accessed through the address space after all.
+ */
+static void *vring_map(VRingMap *map, hwaddr pa, hwaddr len, bool is_write)
 {
-    hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, len);
-    return virtio_ldl_phys(vdev, pa);
+    MemoryRegionSection section;
+
+    if (likely(map->gen == vring_map_gen)) {
+        return map->ptr;
+    }
+
+    vring_unmap(map);
+    map->gen = vring_map_gen;
+    if (!pa) {
+        return NULL;
+    }
+
+    section = memory_region_find(get_system_memory(), pa, len);
+    if (!section.mr) {
+        return NULL;
+    }
+    if (int128_get64(section.size) < len ||
+        !memory_region_is_ram(section.mr) ||
+        (is_write && section.readonly)) {
+        memory_region_unref(section.mr);
+        return NULL;
+    }
+
+    map->mr = section.mr;
+    map->offset = section.offset_within_region;
+    map->ptr = memory_region_get_ram_ptr(section.mr) + map->offset;
+    return map->ptr;
 }
 
-static inline uint16_t vring_desc_flags(VirtIODevice *vdev, hwaddr desc_pa,
-                                        int i)
+/* Only the ring's own descriptor table is mapped, not indirect ones */
+static inline VRingDesc *vring_desc_map(VirtQueue *vq, hwaddr desc_pa)
 {
-    hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, flags);
-    return virtio_lduw_phys(vdev, pa);
+    if (desc_pa != vq->vring.desc) {
+        return NULL;
+    }
+    return vring_map(&vq->desc_map, desc_pa,
+                     vq->vring.num * sizeof(VRingDesc), false);
 }
 
-static inline uint16_t vring_desc_next(VirtIODevice *vdev, hwaddr desc_pa,
-                                       int i)
+/* The avail ring, up to and including used_event */
+static inline VRingAvail *vring_avail_map(VirtQueue *vq)
 {
-    hwaddr pa;
-    pa = desc_pa + sizeof(VRingDesc) * i + offsetof(VRingDesc, next);
-    return virtio_lduw_phys(vdev, pa);
+    return vring_map(&vq->avail_map, vq->vring.avail,
+                     offsetof(VRingAvail, ring[vq->vring.num + 1]), false);
+}
+
+/* The used ring, up to and including avail_event */
+static inline VRingUsed *vring_used_map(VirtQueue *vq)
+{
+    return vring_map(&vq->used_map, vq->vring.used,
+                     offsetof(VRingUsed, ring[vq->vring.num]) +
+                     sizeof(uint16_t), true);
+}
+
+/* Stores through the used ring mapping must be tracked by hand */
+static inline void vring_used_set_dirty(VirtQueue *vq, hwaddr offset,
+                                        hwaddr len)
+{
+    memory_region_set_dirty(vq->used_map.mr, vq->used_map.offset + offset,
+                            len);
+}
+
+/* virt queue functions */
+static void virtqueue_init(VirtQueue *vq)
+{
+    hwaddr pa = vq->pa;
+
+    virtqueue_unmap(vq);
+
+    vq->vring.desc = pa;
+    vq->vring.avail = pa + vq->vring.num * sizeof(VRingDesc);
+    vq->vring.used = vring_align(vq->vring.avail +
+                                 offsetof(VRingAvail, ring[vq->vring.num]),
+                                 vq->vring.align);
+}
+
+/*
+ * Read descriptor @i of the table at @desc_pa in one go, rather than a
+ * field at a time, and in host byte order.
+ */
+static void vring_desc_read(VirtQueue *vq, VRingDesc *desc, hwaddr desc_pa,
+                            int i)
+{
+    VirtIODevice *vdev = vq->vdev;
+    VRingDesc *table = vring_desc_map(vq, desc_pa);
+
+    if (table) {
+        *desc = table[i];
+    } else {
+        cpu_physical_memory_read(desc_pa + sizeof(VRingDesc) * i, desc,
+                                 sizeof(*desc));
+    }
+    virtio_tswap64s(vdev, &desc->addr);
+    virtio_tswap32s(vdev, &desc->len);
+    virtio_tswap16s(vdev, &desc->flags);
+    virtio_tswap16s(vdev, &desc->next);
 }
 
 static inline uint16_t vring_avail_flags(VirtQueue *vq)
 {
+    VRingAvail *avail = vring_avail_map(vq);
     hwaddr pa;
+
+    if (avail) {
+        return virtio_lduw_p(vq->vdev, &avail->flags);
+    }
     pa = vq->vring.avail + offsetof(VRingAvail, flags);
     return virtio_lduw_phys(vq->vdev, pa);
 }
 
 static inline uint16_t vring_avail_idx(VirtQueue *vq)
 {
+    VRingAvail *avail = vring_avail_map(vq);
     hwaddr pa;
+
+    if (avail) {
+        return virtio_lduw_p(vq->vdev, &avail->idx);
+    }
     pa = vq->vring.avail + offsetof(VRingAvail, idx);
     return virtio_lduw_phys(vq->vdev, pa);
 }
 
 static inline uint16_t vring_avail_ring(VirtQueue *vq, int i)
 {
+    VRingAvail *avail = vring_avail_map(vq);
     hwaddr pa;
+
+    if (avail) {
+        return virtio_lduw_p(vq->vdev, &avail->ring[i]);
+    }
     pa = vq->vring.avail + offsetof(VRingAvail, ring[i]);
     return virtio_lduw_phys(vq->vdev, pa);
 }
@@ -160,30 +311,46 @@ static inline uint16_t vring_used_event(VirtQueue *vq)
     return vring_avail_ring(vq, vq->vring.num);
 }
 
-static inline void vring_used_ring_id(VirtQueue *vq, int i, uint32_t val)
+/* Write used ring element @i, id and len together */
+static inline void vring_used_write(VirtQueue *vq, VRingUsedElem *uelem,
+                                    int i)
 {
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, ring[i].id);
-    virtio_stl_phys(vq->vdev, pa, val);
-}
-
-static inline void vring_used_ring_len(VirtQueue *vq, int i, uint32_t val)
-{
-    hwaddr pa;
-    pa = vq->vring.used + offsetof(VRingUsed, ring[i].len);
-    virtio_stl_phys(vq->vdev, pa, val);
+    VirtIODevice *vdev = vq->vdev;
+    VRingUsed *used = vring_used_map(vq);
+    hwaddr offset = offsetof(VRingUsed, ring[i]);
+
+    virtio_tswap32s(vdev, &uelem->id);
+    virtio_tswap32s(vdev, &uelem->len);
+    if (used) {
+        used->ring[i] = *uelem;
+        vring_used_set_dirty(vq, offset, sizeof(*uelem));
+        return;
+    }
+    cpu_physical_memory_write(vq->vring.used + offset, uelem, sizeof(*uelem));
 }
 
 static uint16_t vring_used_idx(VirtQueue *vq)
 {
+    VRingUsed *used = vring_used_map(vq);
     hwaddr pa;
+
+    if (used) {
+        return virtio_lduw_p(vq->vdev, &used->idx);
+    }
     pa = vq->vring.used + offsetof(VRingUsed, idx);
     return virtio_lduw_phys(vq->vdev, pa);
 }
 
 static inline void vring_used_idx_set(VirtQueue *vq, uint16_t val)
 {
+    VRingUsed *used = vring_used_map(vq);
     hwaddr pa;
+
+    if (used) {
+        virtio_stw_p(vq->vdev, &used->idx, val);
+        vring_used_set_dirty(vq, offsetof(VRingUsed, idx), sizeof(val));
+        return;
+    }
     pa = vq->vring.used + offsetof(VRingUsed, idx);
     virtio_stw_phys(vq->vdev, pa, val);
 }
@@ -191,7 +358,16 @@ static inline void vring_used_idx_set(VirtQueue *vq, uint16_t val)
 static inline void vring_used_flags_set_bit(VirtQueue *vq, int mask)
 {
     VirtIODevice *vdev = vq->vdev;
+    VRingUsed *used = vring_used_map(vq);
     hwaddr pa;
+
+    if (used) {
+        virtio_stw_p(vdev, &used->flags,
+                     virtio_lduw_p(vdev, &used->flags) | mask);
+        vring_used_set_dirty(vq, offsetof(VRingUsed, flags),
+                             sizeof(used->flags));
+        return;
+    }
     pa = vq->vring.used + offsetof(VRingUsed, flags);
     virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) | mask);
 }
@@ -199,17 +375,34 @@ static inline void vring_used_flags_set_bit(VirtQueue *vq, int mask)
 static inline void vring_used_flags_unset_bit(VirtQueue *vq, int mask)
 {
     VirtIODevice *vdev = vq->vdev;
+    VRingUsed *used = vring_used_map(vq);
     hwaddr pa;
+
+    if (used) {
+        virtio_stw_p(vdev, &used->flags,
+                     virtio_lduw_p(vdev, &used->flags) & ~mask);
+        vring_used_set_dirty(vq, offsetof(VRingUsed, flags),
+                             sizeof(used->flags));
+        return;
+    }
     pa = vq->vring.used + offsetof(VRingUsed, flags);
     virtio_stw_phys(vdev, pa, virtio_lduw_phys(vdev, pa) & ~mask);
 }
 
 static inline void vring_avail_event(VirtQueue *vq, uint16_t val)
 {
+    VRingUsed *used;
     hwaddr pa;
     if (!vq->notification) {
         return;
     }
+    used = vring_used_map(vq);
+    if (used) {
+        virtio_stw_p(vq->vdev, &used->ring[vq->vring.num], val);
+        vring_used_set_dirty(vq, offsetof(VRingUsed, ring[vq->vring.num]),
+                             sizeof(val));
+        return;
+    }
     pa = vq->vring.used + offsetof(VRingUsed, ring[vq->vring.num]);
     virtio_stw_phys(vq->vdev, pa, val);
 }
@@ -240,14 +433,128 @@ int virtio_queue_empty(VirtQueue *vq)
     return vring_avail_idx(vq) == vq->last_avail_idx;
 }
 
-void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
-                    unsigned int len, unsigned int idx)
+/* Give @elem arrays for @out_num + @in_num descriptors, from the pool of
+ * @vq if possible.  @vq may be NULL for elements that don't go through a
+ * VirtQueue, such as those of dataplane vrings.
+ */
+void virtqueue_element_alloc(VirtQueue *vq, VirtQueueElement *elem,
+                             unsigned int out_num, unsigned int in_num)
+{
+    unsigned int num = out_num + in_num;
+    VirtQueueSg *buf = NULL;
+    hwaddr *addr;
+
+    if (vq && vq->sg_pool_len) {
+        buf = QSLIST_FIRST(&vq->sg_pool);
+        QSLIST_REMOVE_HEAD(&vq->sg_pool, next);
+        vq->sg_pool_len--;
+        if (buf->size < num) {
+            g_free(buf);
+            buf = NULL;
+        }
+    }
+    if (!buf) {
+        unsigned int size = QEMU_ALIGN_UP(MAX(num, 1), VIRTQUEUE_SG_ALIGN);
+
+        buf = g_malloc(sizeof(VirtQueueSg) +
+                       size * (sizeof(struct iovec) + sizeof(hwaddr)));
+        buf->size = size;
+    }
+
+    addr = (hwaddr *)&buf->sg[buf->size];
+    elem->out_num = out_num;
+    elem->in_num = in_num;
+    elem->out_sg = buf->sg;
+    elem->in_sg = buf->sg + out_num;
+    elem->out_addr = addr;
+    elem->in_addr = addr + out_num;
+}
+
+void virtqueue_element_release(VirtQueue *vq, VirtQueueElement *elem)
+{
+    VirtQueueSg *buf;
+
+    if (!elem->out_sg) {
+        return;
+    }
+
+    buf = container_of(elem->out_sg, VirtQueueSg, sg[0]);
+    if (vq && vq->sg_pool_len < VIRTQUEUE_SG_POOL_MAX) {
+        QSLIST_INSERT_HEAD(&vq->sg_pool, buf, next);
+        vq->sg_pool_len++;
+    } else {
+        g_free(buf);
+    }
+    elem->out_sg = elem->in_sg = NULL;
+    elem->out_addr = elem->in_addr = NULL;
+    elem->out_num = elem->in_num = 0;
+}
+
+static void virtqueue_sg_pool_free(VirtQueue *vq)
+{
+    VirtQueueSg *buf;
+
+    while ((buf = QSLIST_FIRST(&vq->sg_pool))) {
+        QSLIST_REMOVE_HEAD(&vq->sg_pool, next);
+        g_free(buf);
+    }
+    vq->sg_pool_len = 0;
+}
+
+void qemu_put_virtqueue_element(QEMUFile *f, VirtQueueElement *elem)
+{
+    VirtQueueElementOld *old = g_new0(VirtQueueElementOld, 1);
+    unsigned int i;
+
+    old->index = elem->index;
+    old->out_num = elem->out_num;
+    old->in_num = elem->in_num;
+    for (i = 0; i < elem->out_num; i++) {
+        old->out_addr[i] = elem->out_addr[i];
+        old->out_sg[i] = elem->out_sg[i];
+    }
+    for (i = 0; i < elem->in_num; i++) {
+        old->in_addr[i] = elem->in_addr[i];
+        old->in_sg[i] = elem->in_sg[i];
+    }
+    qemu_put_buffer(f, (unsigned char *)old, sizeof(*old));
+    g_free(old);
+}
+
+void qemu_get_virtqueue_element(QEMUFile *f, VirtQueue *vq,
+                                VirtQueueElement *elem)
+{
+    VirtQueueElementOld *old = g_new(VirtQueueElementOld, 1);
+    unsigned int i;
+
+    qemu_get_buffer(f, (unsigned char *)old, sizeof(*old));
+    if (old->out_num > VIRTQUEUE_MAX_SIZE || old->in_num > VIRTQUEUE_MAX_SIZE) {
+        error_report("virtio: invalid element in migration stream: "
+                     "out_num %u in_num %u", old->out_num, old->in_num);
+        exit(1);
+    }
+
+    virtqueue_element_alloc(vq, elem, old->out_num, old->in_num);
+    elem->index = old->index;
+    for (i = 0; i < elem->out_num; i++) {
+        elem->out_addr[i] = old->out_addr[i];
+        elem->out_sg[i].iov_len = old->out_sg[i].iov_len;
+    }
+    for (i = 0; i < elem->in_num; i++) {
+        elem->in_addr[i] = old->in_addr[i];
+        elem->in_sg[i].iov_len = old->in_sg[i].iov_len;
+    }
+    g_free(old);
+
+    virtqueue_map_sg(elem->in_sg, elem->in_addr, elem->in_num, 1);
+    virtqueue_map_sg(elem->out_sg, elem->out_addr, elem->out_num, 0);
+}
+
+static void virtqueue_unmap_sg(VirtQueueElement *elem, unsigned int len)
 {
     unsigned int offset;
     int i;
 
-    trace_virtqueue_fill(vq, elem, len, idx);
-
     offset = 0;
     for (i = 0; i < elem->in_num; i++) {
         size_t size = MIN(len - offset, elem->in_sg[i].iov_len);
@@ -263,12 +570,35 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
         cpu_physical_memory_unmap(elem->out_sg[i].iov_base,
                                   elem->out_sg[i].iov_len,
                                   0, elem->out_sg[i].iov_len);
+}
+
+/* Give back the element returned by the last virtqueue_pop(), unused. */
+void virtqueue_discard(VirtQueue *vq, VirtQueueElement *elem,
+                       unsigned int len)
+{
+    vq->last_avail_idx--;
+    vq->inuse--;
+    virtqueue_unmap_sg(elem, len);
+    virtqueue_element_release(vq, elem);
+}
+
+void virtqueue_fill(VirtQueue *vq, VirtQueueElement *elem,
+                    unsigned int len, unsigned int idx)
+{
+    VRingUsedElem uelem;
+
+    trace_virtqueue_fill(vq, elem, len, idx);
+
+    virtqueue_unmap_sg(elem, len);
 
     idx = (idx + vring_used_idx(vq)) % vq->vring.num;
 
     /* Get a pointer to the next entry in the used ring. */
-    vring_used_ring_id(vq, idx, elem->index);
-    vring_used_ring_len(vq, idx, len);
+    uelem.id = elem->index;
+    uelem.len = len;
+    vring_used_write(vq, &uelem, idx);
+
+    virtqueue_element_release(vq, elem);
 }
 
 void virtqueue_flush(VirtQueue *vq, unsigned int count)
@@ -285,13 +615,32 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         vq->signalled_used_valid = false;
 }
 
-void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
+void virtqueue_push(VirtQueue *vq, VirtQueueElement *elem,
                     unsigned int len)
 {
     virtqueue_fill(vq, elem, len, 0);
     virtqueue_flush(vq, 1);
 }
 
+/* Return @count elements with one used index update and at most one
+ * interrupt.  @lens may be NULL when nothing was written to the guest.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement **elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+    }
+    virtqueue_flush(vq, count);
+    virtio_notify(vq->vdev, vq);
+}
+
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
     uint16_t num_heads = vring_avail_idx(vq) - idx;
@@ -328,18 +677,17 @@ static unsigned int virtqueue_get_head(VirtQueue *vq, unsigned int idx)
     return head;
 }
 
-static unsigned virtqueue_next_desc(VirtIODevice *vdev, hwaddr desc_pa,
-                                    unsigned int i, unsigned int max)
+static unsigned virtqueue_next_desc(VRingDesc *desc, unsigned int max)
 {
     unsigned int next;
 
     /* If this descriptor says it doesn't chain, we're done. */
-    if (!(vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_NEXT)) {
+    if (!(desc->flags & VRING_DESC_F_NEXT)) {
         return max;
     }
 
     /* Check they're not leading us off end of descriptors. */
-    next = vring_desc_next(vdev, desc_pa, i);
+    next = desc->next;
     /* Make sure compiler knows to grab that: we don't want it changing! */
     smp_wmb();
 
@@ -362,8 +710,8 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
     total_bufs = in_total = out_total = 0;
     while (virtqueue_num_heads(vq, idx)) {
-        VirtIODevice *vdev = vq->vdev;
         unsigned int max, num_bufs, indirect = 0;
+        VRingDesc desc;
         hwaddr desc_pa;
         int i;
 
@@ -371,9 +719,10 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
         num_bufs = total_bufs;
         i = virtqueue_get_head(vq, idx++);
         desc_pa = vq->vring.desc;
+        vring_desc_read(vq, &desc, desc_pa, i);
 
-        if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_INDIRECT) {
-            if (vring_desc_len(vdev, desc_pa, i) % sizeof(VRingDesc)) {
+        if (desc.flags & VRING_DESC_F_INDIRECT) {
+            if (desc.len % sizeof(VRingDesc)) {
                 error_report("Invalid size for indirect buffer table");
                 exit(1);
             }
@@ -386,9 +735,10 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
 
             /* loop over the indirect descriptor table */
             indirect = 1;
-            max = vring_desc_len(vdev, desc_pa, i) / sizeof(VRingDesc);
-            desc_pa = vring_desc_addr(vdev, desc_pa, i);
+            max = desc.len / sizeof(VRingDesc);
+            desc_pa = desc.addr;
             num_bufs = i = 0;
+            vring_desc_read(vq, &desc, desc_pa, i);
         }
 
         do {
@@ -398,15 +748,20 @@ void virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
                 exit(1);
             }
 
-            if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_WRITE) {
-                in_total += vring_desc_len(vdev, desc_pa, i);
+            if (desc.flags & VRING_DESC_F_WRITE) {
+                in_total += desc.len;
             } else {
-                out_total += vring_desc_len(vdev, desc_pa, i);
+                out_total += desc.len;
             }
             if (in_total >= max_in_bytes && out_total >= max_out_bytes) {
                 goto done;
             }
-        } while ((i = virtqueue_next_desc(vdev, desc_pa, i, max)) != max);
+
+            i = virtqueue_next_desc(&desc, max);
+            if (i != max) {
+                vring_desc_read(vq, &desc, desc_pa, i);
+            }
+        } while (i != max);
 
         if (!indirect)
             total_bufs = num_bufs;
@@ -453,65 +808,76 @@ void virtqueue_map_sg(struct iovec *sg, hwaddr *addr,
     }
 }
 
-int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
+/* Pop the element at last_avail_idx; the caller has already checked
+ * that the avail ring holds it.  The avail event is left to the caller.
+ */
+static int virtqueue_pop_one(VirtQueue *vq, VirtQueueElement *elem)
 {
     unsigned int i, head, max;
+    unsigned int in_num = 0, out_num = 0;
     hwaddr desc_pa = vq->vring.desc;
-    VirtIODevice *vdev = vq->vdev;
-
-    if (!virtqueue_num_heads(vq, vq->last_avail_idx))
-        return 0;
-
-    /* When we start there are none of either input nor output. */
-    elem->out_num = elem->in_num = 0;
+    VRingDesc desc;
+    /* Collected here first, the element gets arrays of the final size */
+    hwaddr in_addr[VIRTQUEUE_MAX_SIZE], out_addr[VIRTQUEUE_MAX_SIZE];
+    uint32_t in_len[VIRTQUEUE_MAX_SIZE], out_len[VIRTQUEUE_MAX_SIZE];
 
     max = vq->vring.num;
 
     i = head = virtqueue_get_head(vq, vq->last_avail_idx++);
-    if (vdev->guest_features & (1 << VIRTIO_RING_F_EVENT_IDX)) {
-        vring_avail_event(vq, vq->last_avail_idx);
-    }
 
-    if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_INDIRECT) {
-        if (vring_desc_len(vdev, desc_pa, i) % sizeof(VRingDesc)) {
+    vring_desc_read(vq, &desc, desc_pa, i);
+    if (desc.flags & VRING_DESC_F_INDIRECT) {
+        if (desc.len % sizeof(VRingDesc)) {
             error_report("Invalid size for indirect buffer table");
             exit(1);
         }
 
         /* loop over the indirect descriptor table */
-        max = vring_desc_len(vdev, desc_pa, i) / sizeof(VRingDesc);
-        desc_pa = vring_desc_addr(vdev, desc_pa, i);
+        max = desc.len / sizeof(VRingDesc);
+        desc_pa = desc.addr;
         i = 0;
+        vring_desc_read(vq, &desc, desc_pa, i);
     }
 
     /* Collect all the descriptors */
     do {
-        struct iovec *sg;
-
-        if (vring_desc_flags(vdev, desc_pa, i) & VRING_DESC_F_WRITE) {
-            if (elem->in_num >= ARRAY_SIZE(elem->in_sg)) {
+        if (desc.flags & VRING_DESC_F_WRITE) {
+            if (in_num >= ARRAY_SIZE(in_addr)) {
                 error_report("Too many write descriptors in indirect table");
                 exit(1);
             }
-            elem->in_addr[elem->in_num] = vring_desc_addr(vdev, desc_pa, i);
-            sg = &elem->in_sg[elem->in_num++];
+            in_addr[in_num] = desc.addr;
+            in_len[in_num++] = desc.len;
         } else {
-            if (elem->out_num >= ARRAY_SIZE(elem->out_sg)) {
+            if (out_num >= ARRAY_SIZE(out_addr)) {
                 error_report("Too many read descriptors in indirect table");
                 exit(1);
             }
-            elem->out_addr[elem->out_num] = vring_desc_addr(vdev, desc_pa, i);
-            sg = &elem->out_sg[elem->out_num++];
+            out_addr[out_num] = desc.addr;
+            out_len[out_num++] = desc.len;
         }
 
-        sg->iov_len = vring_desc_len(vdev, desc_pa, i);
-
         /* If we've got too many, that implies a descriptor loop. */
-        if ((elem->in_num + elem->out_num) > max) {
+        if ((in_num + out_num) > max) {
             error_report("Looped descriptor");
             exit(1);
         }
-    } while ((i = virtqueue_next_desc(vdev, desc_pa, i, max)) != max);
+
+        i = virtqueue_next_desc(&desc, max);
+        if (i != max) {
+            vring_desc_read(vq, &desc, desc_pa, i);
+        }
+    } while (i != max);
+
+    virtqueue_element_alloc(vq, elem, out_num, in_num);
+    for (i = 0; i < out_num; i++) {
+        elem->out_addr[i] = out_addr[i];
+        elem->out_sg[i].iov_len = out_len[i];
+    }
+    for (i = 0; i < in_num; i++) {
+        elem->in_addr[i] = in_addr[i];
+        elem->in_sg[i].iov_len = in_len[i];
+    }
 
     /* Now map what we have collected */
     virtqueue_map_sg(elem->in_sg, elem->in_addr, elem->in_num, 1);
@@ -525,6 +891,43 @@ int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
     return elem->in_num + elem->out_num;
 }
 
+int virtqueue_pop(VirtQueue *vq, VirtQueueElement *elem)
+{
+    int ret;
+
+    if (!virtqueue_num_heads(vq, vq->last_avail_idx))
+        return 0;
+
+    ret = virtqueue_pop_one(vq, elem);
+    if (vq->vdev->guest_features & (1 << VIRTIO_RING_F_EVENT_IDX)) {
+        vring_avail_event(vq, vq->last_avail_idx);
+    }
+    return ret;
+}
+
+/* Pop up to @max elements into @elems, reading the avail index and
+ * publishing the avail event only once.  Returns the number popped.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, VirtQueueElement **elems,
+                                 unsigned int max)
+{
+    unsigned int i, num;
+
+    num = MIN(virtqueue_num_heads(vq, vq->last_avail_idx), max);
+    if (!num) {
+        return 0;
+    }
+
+    for (i = 0; i < num; i++) {
+        virtqueue_pop_one(vq, elems[i]);
+    }
+    if (vq->vdev->guest_features & (1 << VIRTIO_RING_F_EVENT_IDX)) {
+        vring_avail_event(vq, vq->last_avail_idx);
+    }
+    trace_virtqueue_pop_batch(vq, num, max);
+    return num;
+}
+
 /* virtio device */
 static void virtio_notify_vector(VirtIODevice *vdev, uint16_t vector)
 {
@@ -600,6 +1003,7 @@ void virtio_reset(void *opaque)
     virtio_notify_vector(vdev, vdev->config_vector);
 
     for(i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+        virtqueue_unmap(&vdev->vq[i]);
         vdev->vq[i].vring.desc = 0;
         vdev->vq[i].vring.avail = 0;
         vdev->vq[i].vring.used = 0;
@@ -810,6 +1214,8 @@ void virtio_del_queue(VirtIODevice *vdev, int n)
     }
 
     vdev->vq[n].vring.num = 0;
+    virtqueue_unmap(&vdev->vq[n]);
+    virtqueue_sg_pool_free(&vdev->vq[n]);
 }
 
 void virtio_irq(VirtQueue *vq)
@@ -1033,6 +1439,7 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
     }
 
     for (i = 0; i < num; i++) {
+        virtqueue_unmap(&vdev->vq[i]);
         vdev->vq[i].vring.num = qemu_get_be32(f);
         if (k->has_variable_vring_alignment) {
             vdev->vq[i].vring.align = qemu_get_be32(f);
@@ -1097,6 +1504,12 @@ int virtio_load(VirtIODevice *vdev, QEMUFile *f, int version_id)
 
 void virtio_cleanup(VirtIODevice *vdev)
 {
+    int i;
+
+    for (i = 0; i < VIRTIO_PCI_QUEUE_MAX; i++) {
+        virtqueue_unmap(&vdev->vq[i]);
+        virtqueue_sg_pool_free(&vdev->vq[i]);
+    }
     qemu_del_vm_change_state_handler(vdev->vmstate);
     g_free(vdev->config);
     g_free(vdev->vq);
@@ -1137,7 +1550,14 @@ void virtio_instance_init_common(Object *proxy_obj, void *data,
 void virtio_init(VirtIODevice *vdev, const char *name,
                  uint16_t device_id, size_t config_size)
 {
+    static bool vring_map_listening;
     int i;
+
+    if (!vring_map_listening) {
+        memory_listener_register(&vring_map_listener, &address_space_memory);
+        vring_map_listening = true;
+    }
+
     vdev->device_id = device_id;
     vdev->status = 0;
     vdev->isr = 0;
@@ -1216,6 +1636,20 @@ void virtio_queue_set_last_avail_idx(VirtIODevice *vdev, int n, uint16_t idx)
     vdev->vq[n].last_avail_idx = idx;
 }
 
+/*
+ * Used when the backend that owned the ring is gone and can't report its
+ * position: resume from what it last completed.  Buffers it had taken but
+ * not returned are lost.
+ */
+void virtio_queue_restore_last_avail_idx(VirtIODevice *vdev, int n)
+{
+    VirtQueue *vq = &vdev->vq[n];
+
+    if (vq->vring.desc) {
+        vq->last_avail_idx = vring_used_idx(vq);
+    }
+}
+
 void virtio_queue_invalidate_signalled_used(VirtIODevice *vdev, int n)
 {
     vdev->vq[n].signalled_used_valid = false;
@@ -25,8 +25,10 @@
 #define BLOCK_ACCOUNTING_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "qemu/typedefs.h"
+#include "qemu/thread.h"
 
 enum BlockAcctType {
     BLOCK_ACCT_READ,
@@ -35,11 +37,58 @@ enum BlockAcctType {
     BLOCK_MAX_IOTYPE,
 };
 
+#define BLOCK_ACCT_MAX_INTERVALS 4
+
+/* Latency histogram: bins[i] counts requests with
+ * boundaries[i - 1] <= latency < boundaries[i], where the first and last
+ * bins are open-ended.  Replaced as a whole when reconfigured.
+ */
+typedef struct BlockLatencyHistogram {
+    int nbins;
+    uint64_t *boundaries;       /* nbins - 1 entries, in ns, ascending */
+    uint64_t *bins;             /* nbins entries */
+    uint64_t data[];
+} BlockLatencyHistogram;
+
+/* One period of a BlockAcctTimedStats.  min_ns == 0 means no request
+ * completed yet.
+ */
+typedef struct BlockAcctWindow {
+    int64_t epoch;
+    uint64_t nr_ops[BLOCK_MAX_IOTYPE];
+    uint64_t total_ns[BLOCK_MAX_IOTYPE];
+    uint64_t min_ns[BLOCK_MAX_IOTYPE];
+    uint64_t max_ns[BLOCK_MAX_IOTYPE];
+} BlockAcctWindow;
+
+/* Latency statistics over fixed-length periods.  Two windows alternate:
+ * one fills up while the other holds the last complete period.
+ */
+typedef struct BlockAcctTimedStats {
+    int64_t interval_ns;
+    BlockAcctWindow windows[2];
+} BlockAcctTimedStats;
+
+typedef struct BlockAcctIntervals {
+    int n;
+    BlockAcctTimedStats stats[BLOCK_ACCT_MAX_INTERVALS];
+} BlockAcctIntervals;
+
+/* Requests may complete in several queue threads at once, and 64-bit
+ * atomics are not available on every 32-bit host, so everything below
+ * @lock is protected by it.
+ */
 typedef struct BlockAcctStats {
+    QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
     uint64_t nr_ops[BLOCK_MAX_IOTYPE];
+    uint64_t failed_ops[BLOCK_MAX_IOTYPE];
+    uint64_t invalid_ops[BLOCK_MAX_IOTYPE];
     uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
     uint64_t wr_highest_sector;
+    int64_t last_access_time_ns;
+    BlockLatencyHistogram *histogram[BLOCK_MAX_IOTYPE];
+    BlockAcctIntervals *intervals;
 } BlockAcctStats;
 
 typedef struct BlockAcctCookie {
@@ -48,10 +97,21 @@ typedef struct BlockAcctCookie {
     enum BlockAcctType type;
 } BlockAcctCookie;
 
+void block_acct_init(BlockAcctStats *stats);
 void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
                       int64_t bytes, enum BlockAcctType type);
 void block_acct_done(BlockAcctStats *stats, BlockAcctCookie *cookie);
+void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie);
+void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type);
 void block_acct_highest_sector(BlockAcctStats *stats, int64_t sector_num,
                                unsigned int nb_sectors);
 
+void block_acct_set_histogram(BlockAcctStats *stats, enum BlockAcctType type,
+                              const uint64_t *boundaries, int n);
+void block_acct_set_intervals(BlockAcctStats *stats,
+                              const uint32_t *intervals_sec, int n);
+void block_acct_cleanup(BlockAcctStats *stats);
+int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
+void block_acct_timed_stats_get(BlockAcctTimedStats *ts, BlockAcctWindow *w);
+
 #endif
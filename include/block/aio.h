@@ -47,6 +47,31 @@ void qemu_aio_ref(void *p);
 typedef struct AioHandler AioHandler;
 typedef void QEMUBHFunc(void *opaque);
 typedef void IOHandler(void *opaque);
+typedef bool AioPollFn(void *opaque);
+
+/* Latency histogram bins: < 1 us, < 10 us, < 100 us, < 1 ms, < 10 ms,
+ * < 100 ms and longer.
+ */
+#define AIO_STATS_BINS 7
+
+typedef struct AioLatencyStats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t hist[AIO_STATS_BINS];
+} AioLatencyStats;
+
+/* Cumulative event loop statistics.  Only the thread running the
+ * AioContext updates them; readers in other threads may see a snapshot
+ * that is slightly inconsistent.
+ */
+typedef struct AioContextStats {
+    uint64_t polls;             /* aio_poll() calls */
+    uint64_t wakeups;           /* wakeups with file descriptors ready */
+    uint64_t bhs;               /* bottom halves run */
+    AioLatencyStats dispatch;   /* whole BH, fd handler and timer passes */
+    AioLatencyStats handlers;   /* individual fd handler callbacks */
+} AioContextStats;
 
 struct AioContext {
     GSource source;
@@ -82,6 +107,17 @@ struct AioContext {
     /* Used for aio_notify.  */
     EventNotifier notifier;
 
+    /* Set by aio_notify() until the notifier is read, so that busy
+     * polling sees wakeups without reading the eventfd.
+     */
+    bool notified;
+
+    /* Adaptive polling, see aio_context_set_poll_params() */
+    int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
+    int64_t poll_ns;        /* current polling time in nanoseconds */
+    int64_t poll_grow;      /* polling time growth factor */
+    int64_t poll_shrink;    /* polling time shrink factor */
+
     /* GPollFDs for aio_poll() */
     GArray *pollfds;
 
@@ -90,8 +126,16 @@ struct AioContext {
 
     /* TimerLists for calling timers - one per clock type */
     QEMUTimerListGroup tlg;
+
+    /* Latency instrumentation, see query-iothreads */
+    AioContextStats stats;
 };
 
+/* Account one call of @ns nanoseconds to @stats.  Called by the thread
+ * running the AioContext.
+ */
+void aio_latency_account(AioLatencyStats *stats, int64_t ns);
+
 /* Used internally to synchronize aio_poll against qemu_bh_schedule.  */
 void aio_set_dispatching(AioContext *ctx, bool dispatching);
 
@@ -266,6 +310,34 @@ void aio_set_event_notifier(AioContext *ctx,
                             EventNotifier *notifier,
                             EventNotifierHandler *io_read);
 
+/* Attach a polling callback to an fd or event notifier already registered
+ * with aio_set_fd_handler() or aio_set_event_notifier(); it goes away with
+ * the handler.  @io_poll gets the handler's opaque pointer and returns true
+ * if it made progress, or if it found work that aio_poll() will dispatch.
+ *
+ * While polling is enabled, a blocking aio_poll() calls the polling
+ * callbacks in a loop for a while before it sleeps in ppoll().
+ */
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll);
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll);
+
+/**
+ * aio_context_set_poll_params:
+ * @ctx: the aio context
+ * @max_ns: how long to busy poll for, in nanoseconds, or 0 to disable
+ * @grow: how much to grow the polling time by, 0 for the default of 2
+ * @shrink: how much to shrink the polling time by, 0 to reset it
+ *
+ * The polling time adapts between 0 and @max_ns: it grows when an event
+ * arrives shortly after blocking, and shrinks when the context blocks
+ * for longer than @max_ns.
+ */
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink,
+                                 Error **errp);
+
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
  */
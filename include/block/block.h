@@ -76,6 +76,7 @@ typedef enum {
 #define BDRV_O_PROTOCOL    0x8000  /* if no block driver is explicitly given:
                                       select an appropriate protocol driver,
                                       ignoring the format layer */
+#define BDRV_O_IO_URING    0x10000 /* use io_uring instead of the thread pool */
 
 #define BDRV_O_CACHE_MASK  (BDRV_O_NOCACHE | BDRV_O_CACHE_WB | BDRV_O_NO_FLUSH)
 
@@ -158,8 +159,9 @@ void bdrv_stats_print(Monitor *mon, const QObject *data);
 void bdrv_info_stats(Monitor *mon, QObject **ret_data);
 
 /* disk I/O throttling */
-void bdrv_io_limits_enable(BlockDriverState *bs);
+void bdrv_io_limits_enable(BlockDriverState *bs, const char *group);
 void bdrv_io_limits_disable(BlockDriverState *bs);
+void bdrv_io_limits_update_group(BlockDriverState *bs, const char *group);
 
 void bdrv_init(void);
 void bdrv_init_with_whitelist(void);
@@ -268,7 +270,12 @@ typedef enum {
     BDRV_FIX_ERRORS   = 2,
 } BdrvCheckMode;
 
-int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix);
+/* The units of offset and total_work_size may be chosen arbitrarily by the
+ * block driver, as for BlockDriverAmendStatusCB */
+typedef void BlockDriverCheckStatusCB(BlockDriverState *bs, int64_t offset,
+                                      int64_t total_work_size);
+int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix,
+               BlockDriverCheckStatusCB *status_cb);
 
 /* The units of offset and total_work_size may be chosen arbitrarily by the
  * block driver; total_work_size may change during the course of the amendment
@@ -347,6 +354,10 @@ bool bdrv_unallocated_blocks_are_zero(BlockDriverState *bs);
 bool bdrv_can_write_zeroes_with_unmap(BlockDriverState *bs);
 int64_t bdrv_get_block_status(BlockDriverState *bs, int64_t sector_num,
                               int nb_sectors, int *pnum);
+int64_t bdrv_get_block_status_above(BlockDriverState *bs,
+                                    BlockDriverState *base,
+                                    int64_t sector_num,
+                                    int nb_sectors, int *pnum);
 int bdrv_is_allocated(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
                       int *pnum);
 int bdrv_is_allocated_above(BlockDriverState *top, BlockDriverState *base,
@@ -385,8 +396,10 @@ const char *bdrv_get_device_name(const BlockDriverState *bs);
 int bdrv_get_flags(BlockDriverState *bs);
 int bdrv_write_compressed(BlockDriverState *bs, int64_t sector_num,
                           const uint8_t *buf, int nb_sectors);
+bool bdrv_can_write_compressed_parallel(BlockDriverState *bs);
 int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi);
 ImageInfoSpecific *bdrv_get_specific_info(BlockDriverState *bs);
+BlockStatsSpecific *bdrv_get_specific_stats(BlockDriverState *bs);
 void bdrv_round_to_clusters(BlockDriverState *bs,
                             int64_t sector_num, int nb_sectors,
                             int64_t *cluster_sector_num,
@@ -427,14 +440,47 @@ void *qemu_try_blockalign0(BlockDriverState *bs, size_t size);
 bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov);
 
 struct HBitmapIter;
+struct HBitmap;
 typedef struct BdrvDirtyBitmap BdrvDirtyBitmap;
 BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs, int granularity,
-                                          Error **errp);
+                                          const char *name, Error **errp);
+BdrvDirtyBitmap *bdrv_find_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name);
 void bdrv_release_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap);
+BdrvDirtyBitmap *bdrv_dirty_bitmap_next(BlockDriverState *bs,
+                                        BdrvDirtyBitmap *bitmap);
+const char *bdrv_dirty_bitmap_name(BdrvDirtyBitmap *bitmap);
+uint32_t bdrv_dirty_bitmap_granularity(BdrvDirtyBitmap *bitmap);
+bool bdrv_dirty_bitmap_is_persistent(BdrvDirtyBitmap *bitmap);
+void bdrv_dirty_bitmap_set_persistent(BdrvDirtyBitmap *bitmap,
+                                      bool persistent);
+bool bdrv_dirty_bitmap_frozen(BdrvDirtyBitmap *bitmap);
+bool bdrv_can_store_dirty_bitmaps(BlockDriverState *bs);
+void bdrv_clear_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                             struct HBitmap **out);
+void bdrv_undo_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap,
+                                  struct HBitmap *backup);
+struct HBitmap *bdrv_dirty_bitmap_freeze(BlockDriverState *bs,
+                                         BdrvDirtyBitmap *bitmap);
+void bdrv_dirty_bitmap_thaw(BdrvDirtyBitmap *bitmap, struct HBitmap *contents,
+                            bool merge);
+uint64_t bdrv_dirty_bitmap_serialization_size(BdrvDirtyBitmap *bitmap);
+void bdrv_dirty_bitmap_serialize(BdrvDirtyBitmap *bitmap, uint8_t *buf);
+void bdrv_dirty_bitmap_deserialize(BdrvDirtyBitmap *bitmap,
+                                   const uint8_t *buf);
+uint64_t bdrv_dirty_bitmap_serialization_size_part(BdrvDirtyBitmap *bitmap,
+                                                   int64_t sector,
+                                                   int64_t nr_sectors);
+void bdrv_dirty_bitmap_serialize_part(BdrvDirtyBitmap *bitmap, uint8_t *buf,
+                                      int64_t sector, int64_t nr_sectors);
+void bdrv_dirty_bitmap_set_contents(BdrvDirtyBitmap *bitmap,
+                                    struct HBitmap *contents);
 BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs);
 int bdrv_get_dirty(BlockDriverState *bs, BdrvDirtyBitmap *bitmap, int64_t sector);
 void bdrv_set_dirty(BlockDriverState *bs, int64_t cur_sector, int nr_sectors);
 void bdrv_reset_dirty(BlockDriverState *bs, int64_t cur_sector, int nr_sectors);
+void bdrv_reset_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                             int64_t cur_sector, int nr_sectors);
 void bdrv_dirty_iter_init(BlockDriverState *bs,
                           BdrvDirtyBitmap *bitmap, struct HBitmapIter *hbi);
 int64_t bdrv_get_dirty_count(BlockDriverState *bs, BdrvDirtyBitmap *bitmap);
@@ -543,6 +589,54 @@ void bdrv_io_plug(BlockDriverState *bs);
 void bdrv_io_unplug(BlockDriverState *bs);
 void bdrv_flush_io_queue(BlockDriverState *bs);
 
+/**
+ * bdrv_register_buf:
+ *
+ * Tell the protocol drivers under @bs that I/O buffers will often lie in
+ * @host..@host+@size, e.g. guest RAM, so that they can map it once
+ * instead of on every request.  This is only a hint; drivers that cannot
+ * use it ignore it.  The buffer must stay allocated until it is passed to
+ * bdrv_unregister_buf().
+ *
+ * Must be called with no requests in flight.
+ */
+void bdrv_register_buf(BlockDriverState *bs, void *host, size_t size);
+void bdrv_unregister_buf(BlockDriverState *bs, void *host);
+
+/**
+ * bdrv_add_aio_queue:
+ *
+ * Allow reads and writes to be submitted to @bs from @ctx, in parallel
+ * with the #AioContext that @bs is bound to, using bdrv_aio_readv_mq()
+ * and bdrv_aio_writev_mq().  The protocol driver keeps separate
+ * submission state (for example a linux-aio io_context) for @ctx.
+ *
+ * Must be called with no requests in flight.
+ */
+int bdrv_add_aio_queue(BlockDriverState *bs, AioContext *ctx, Error **errp);
+void bdrv_del_aio_queue(BlockDriverState *bs, AioContext *ctx);
+
+/**
+ * bdrv_aio_mq_usable:
+ *
+ * Returns: true if bdrv_aio_readv_mq() and bdrv_aio_writev_mq() may be used
+ * from a queue context.  Features that need the request tracking of the
+ * BDS's own context (I/O throttling, copy-on-read, dirty bitmaps, write
+ * notifiers, writethrough emulation) make this false; requests must then
+ * be submitted from bdrv_get_aio_context(@bs).  bdrv_aio_readv_mq() and
+ * bdrv_aio_writev_mq() return NULL, without calling the callback, when
+ * the request has to be resubmitted that way.
+ */
+bool bdrv_aio_mq_usable(BlockDriverState *bs);
+BlockAIOCB *bdrv_aio_readv_mq(BlockDriverState *bs, AioContext *ctx,
+                              int64_t sector_num, QEMUIOVector *qiov,
+                              int nb_sectors, BlockCompletionFunc *cb,
+                              void *opaque);
+BlockAIOCB *bdrv_aio_writev_mq(BlockDriverState *bs, AioContext *ctx,
+                               int64_t sector_num, QEMUIOVector *qiov,
+                               int nb_sectors, BlockCompletionFunc *cb,
+                               void *opaque);
+
 BlockAcctStats *bdrv_get_stats(BlockDriverState *bs);
 
 #endif
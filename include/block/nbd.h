@@ -44,6 +44,8 @@ struct nbd_reply {
 #define NBD_FLAG_SEND_FUA       (1 << 3)        /* Send FUA (Force Unit Access) */
 #define NBD_FLAG_ROTATIONAL     (1 << 4)        /* Use elevator algorithm - rotational media */
 #define NBD_FLAG_SEND_TRIM      (1 << 5)        /* Send TRIM (discard) */
+#define NBD_FLAG_SEND_DF        (1 << 7)        /* Send DF (don't fragment) */
+#define NBD_FLAG_CAN_MULTI_CONN (1 << 8)        /* Multiple connections OK */
 
 /* New-style global flags. */
 #define NBD_FLAG_FIXED_NEWSTYLE     (1 << 0)    /* Fixed newstyle protocol. */
@@ -54,18 +56,37 @@ struct nbd_reply {
 /* Reply types. */
 #define NBD_REP_ACK             (1)             /* Data sending finished. */
 #define NBD_REP_SERVER          (2)             /* Export description. */
+#define NBD_REP_META_CONTEXT    (4)             /* Metadata context. */
 #define NBD_REP_ERR_UNSUP       ((1 << 31) | 1) /* Unknown option. */
 #define NBD_REP_ERR_INVALID     ((1 << 31) | 3) /* Invalid length. */
+#define NBD_REP_ERR_UNKNOWN     ((1 << 31) | 6) /* Export unknown. */
 
 #define NBD_CMD_MASK_COMMAND	0x0000ffff
 #define NBD_CMD_FLAG_FUA	(1 << 16)
+#define NBD_CMD_FLAG_DF		(1 << 18)	/* Single data chunk. */
+#define NBD_CMD_FLAG_REQ_ONE	(1 << 19)	/* Single extent. */
+
+/* Structured reply chunk types. */
+#define NBD_REPLY_TYPE_NONE         (0)
+#define NBD_REPLY_TYPE_OFFSET_DATA  (1)
+#define NBD_REPLY_TYPE_OFFSET_HOLE  (2)
+#define NBD_REPLY_TYPE_BLOCK_STATUS (5)
+#define NBD_REPLY_TYPE_ERROR        ((1 << 15) | 1)
+
+/* Structured reply chunk flags. */
+#define NBD_REPLY_FLAG_DONE         (1 << 0)    /* Last chunk of the reply. */
+
+/* Extent flags for the "base:allocation" metadata context. */
+#define NBD_STATE_HOLE              (1 << 0)    /* Unallocated. */
+#define NBD_STATE_ZERO              (1 << 1)    /* Reads as zeroes. */
 
 enum {
     NBD_CMD_READ = 0,
     NBD_CMD_WRITE = 1,
     NBD_CMD_DISC = 2,
     NBD_CMD_FLUSH = 3,
-    NBD_CMD_TRIM = 4
+    NBD_CMD_TRIM = 4,
+    NBD_CMD_BLOCK_STATUS = 7
 };
 
 #define NBD_DEFAULT_PORT	10809
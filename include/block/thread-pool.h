@@ -27,6 +27,16 @@ typedef struct ThreadPool ThreadPool;
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
 
+/* Keep between @min_threads and @max_threads worker threads.  */
+void thread_pool_set_params(ThreadPool *pool, int64_t min_threads,
+                            int64_t max_threads, Error **errp);
+
+/* Run the workers on the @nbits-bit set of host CPUs @host_cpus, or
+ * let them inherit the affinity of their creator if @host_cpus is NULL.
+ */
+void thread_pool_set_host_cpus(ThreadPool *pool, const unsigned long *host_cpus,
+                               unsigned long nbits);
+
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
         BlockCompletionFunc *cb, void *opaque);
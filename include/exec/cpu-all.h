@@ -305,12 +305,22 @@ typedef struct RAMBlock {
     ram_addr_t offset;
     ram_addr_t length;
     uint32_t flags;
+    /* Host page size backing the block */
+    size_t page_size;
     char idstr[256];
     /* Reads can take either the iothread or the ramlist lock.
      * Writes must take both locks.
      */
     QTAILQ_ENTRY(RAMBlock) next;
     int fd;
+    /* XBZRLE cache statistics of the last migration, see arch_init.c */
+    uint64_t xbzrle_lookups;
+    uint64_t xbzrle_cache_miss;
+    uint64_t xbzrle_overflows;
+    /* mapped-ram layout in the migration file, see arch_init.c */
+    unsigned long *file_bmap;
+    uint64_t bitmap_offset;
+    uint64_t pages_offset;
 } RAMBlock;
 
 typedef struct RAMList {
@@ -334,12 +344,22 @@ extern RAMList ram_list;
 /* Set if TLB entry is an IO callback.  */
 #define TLB_MMIO        (1 << 5)
 
-void dump_exec_info(FILE *f, fprintf_function cpu_fprintf);
+void ram_block_dump(FILE *f, fprintf_function cpu_fprintf);
+void dump_jit_stats(FILE *f, fprintf_function cpu_fprintf);
+
+/* guest-profile.c */
+void guest_profile_start(int64_t interval_ns);
+void guest_profile_stop(void);
+bool guest_profile_active(void);
+void guest_profile_sample(CPUState *cpu, target_ulong pc);
+void guest_profile_dump(FILE *f, fprintf_function cpu_fprintf, int count);
 ram_addr_t last_ram_offset(void);
 void qemu_mutex_lock_ramlist(void);
 void qemu_mutex_unlock_ramlist(void);
 #endif /* !CONFIG_USER_ONLY */
 
+void dump_exec_info(FILE *f, fprintf_function cpu_fprintf);
+
 int cpu_memory_rw_debug(CPUState *cpu, target_ulong addr,
                         uint8_t *buf, int len, int is_write);
 
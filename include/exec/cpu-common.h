@@ -13,6 +13,7 @@
 
 #include "qemu/bswap.h"
 #include "qemu/queue.h"
+#include "qemu/notify.h"
 
 /**
  * CPUListState:
@@ -129,6 +130,19 @@ typedef void (RAMBlockIterFunc)(void *host_addr,
 
 void qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque);
 
+/* Passed as @data to RAM block notifiers.  A block is reported removed
+ * while its memory is still mapped, and a block whose pages are replaced
+ * by qemu_ram_remap() is reported removed and then added again.
+ */
+typedef struct RAMBlockNotification {
+    void *host;
+    ram_addr_t length;
+    bool added;
+} RAMBlockNotification;
+
+void qemu_ram_add_block_notifier(Notifier *notifier);
+void qemu_ram_remove_block_notifier(Notifier *notifier);
+
 #endif
 
 #endif /* !CPU_COMMON_H */
@@ -111,6 +111,9 @@ QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;                                        \
     target_ulong vtlb_index;                                            \
+    /* MMU modes known not to hold any valid entry.  Zero, i.e. nothing \
+       is known, after the CPU state has been cleared.  */              \
+    uint32_t tlb_clean_mmu_mask;                                        \
 
 #else
 
@@ -116,8 +116,9 @@ static inline void tlb_flush(CPUState *cpu, int flush_global)
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
-#define CODE_GEN_PHYS_HASH_BITS     15
-#define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
+/* initial size of the TB hash table, which grows on demand */
+#define CODE_GEN_HTABLE_BITS     15
+#define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
 /* estimated block size for TB allocation */
 /* XXX: use a per code average code fragment size and modulate it
@@ -142,13 +143,15 @@ struct TranslationBlock {
     uint64_t flags; /* flags defining in which context the code was generated */
     uint16_t size;      /* size of target code for this block (1 <=
                            size <= TARGET_PAGE_SIZE) */
-    uint16_t cflags;    /* compile flags */
+    uint32_t cflags;    /* compile flags */
 #define CF_COUNT_MASK  0x7fff
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
+#define CF_HOT         0x10000 /* Retranslated after tcg_tb_hot_threshold
+                                  executions, may span several blocks.  */
+#define CF_SMC_CHECK   0x20000 /* Page left writable, guest code checked
+                                  against smc_copy before each entry.  */
 
     void *tc_ptr;    /* pointer to the translated code */
-    /* next matching tb for physical address. */
-    struct TranslationBlock *phys_hash_next;
     /* first and second physical page containing code. The lower bit
        of the pointer tells the index in page_next[] */
     struct TranslationBlock *page_next[2];
@@ -169,27 +172,48 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    uint32_t exec_count; /* bumped by the TB itself while profiling */
+    bool invalid;  /* set once tb_phys_invalidate() has unlinked the TB */
+    void *smc_copy; /* CF_SMC_CHECK: guest code when it was translated */
 };
 
 #include "exec/spinlock.h"
+#include "qemu/qht.h"
 
 typedef struct TBContext TBContext;
 
 struct TBContext {
 
     TranslationBlock *tbs;
-    TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+    /* TBs indexed by tb_hash_func(), lookups do not take any lock */
+    struct qht htable;
     int nb_tbs;
-    /* any access to the tbs or the page table must use this lock */
+    /* any access to the tbs or the page table must use this lock,
+       through tb_lock()/tb_unlock() */
     spinlock_t tb_lock;
 
     /* statistics */
     int tb_flush_count;
+    int tb_region_evict_count;
+    int tb_hot_count;
     int tb_phys_invalidate_count;
-
-    int tb_invalidated_flag;
+    int tb_smc_check_count;
+    int tb_smc_modified_count;
+    /* updated with tb_lock held */
+    uint64_t tb_gen_count;
+    int64_t tb_gen_time_ns;
+    uint64_t tb_lock_count;
+    uint64_t tb_lock_contended;
+    int64_t tb_lock_wait_ns;
 };
 
+void tb_lock(void);
+void tb_unlock(void);
+void tb_lock_reset(void);
+#if defined(CONFIG_USER_ONLY)
+bool tb_smc_check(TranslationBlock *tb);
+#endif
+
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
     target_ulong tmp;
@@ -205,14 +229,32 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 	    | (tmp & TB_JMP_ADDR_MASK));
 }
 
-static inline unsigned int tb_phys_hash_func(tb_page_addr_t pc)
+static inline uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc,
+                                    uint64_t flags)
 {
-    return (pc >> 2) & (CODE_GEN_PHYS_HASH_SIZE - 1);
+    uint64_t h;
+
+    h = (uint64_t)phys_pc ^ ((uint64_t)pc << 17) ^
+        (flags * 0x9e3779b97f4a7c15ULL);
+    /* final mix, so that every input bit affects the bucket index */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
 }
 
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUArchState *env);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+TranslationBlock *tb_gen_hot(CPUState *cpu, TranslationBlock *tb);
+
+static inline bool tb_is_hot(TranslationBlock *tb)
+{
+    return tcg_tb_hot_threshold && !(tb->cflags & CF_HOT)
+        && tb->exec_count >= tcg_tb_hot_threshold;
+}
 
 #if defined(USE_DIRECT_JUMP)
 
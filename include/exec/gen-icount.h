@@ -9,7 +9,7 @@ static TCGArg *icount_arg;
 static int icount_label;
 static int exitreq_label;
 
-static inline void gen_tb_start(void)
+static inline void gen_tb_start(TranslationBlock *tb)
 {
     TCGv_i32 count;
     TCGv_i32 flag;
@@ -19,6 +19,19 @@ static inline void gen_tb_start(void)
     tcg_gen_ld_i32(flag, cpu_env,
                    offsetof(CPUState, tcg_exit_req) - ENV_OFFSET);
     tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
+
+    /* Profile ordinary TBs; once hot, leave through the exit-request
+       path so that cpu_exec() can retranslate before running it.  */
+    if (tcg_tb_hot_threshold && !(tb->cflags & (CF_HOT | CF_COUNT_MASK))) {
+        TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+
+        tcg_gen_ld_i32(flag, ptr, 0);
+        tcg_gen_addi_i32(flag, flag, 1);
+        tcg_gen_st_i32(flag, ptr, 0);
+        tcg_gen_brcondi_i32(TCG_COND_GEU, flag, tcg_tb_hot_threshold,
+                            exitreq_label);
+        tcg_temp_free_ptr(ptr);
+    }
     tcg_temp_free_i32(flag);
 
     if (!use_icount)
@@ -157,6 +157,7 @@ struct MemoryRegion {
     bool rom_device;
     bool warning_printed; /* For reservations */
     bool flush_coalesced_mmio;
+    bool global_locking;
     MemoryRegion *alias;
     hwaddr alias_offset;
     int32_t priority;
@@ -321,6 +322,49 @@ void memory_region_init_ram(MemoryRegion *mr,
                             uint64_t size,
                             Error **errp);
 
+/**
+ * memory_region_init_ram_hugetlb:  Initialize RAM memory region, backed by
+ *                                  hugetlb pages if the host has reserved
+ *                                  them.
+ *
+ * Used for the main guest RAM; falls back to memory_region_init_ram()
+ * behaviour if no hugetlb pages are available or -machine mem-hugetlb=off.
+ *
+ * @mr: the #MemoryRegion to be initialized.
+ * @owner: the object that tracks the region's reference count
+ * @name: the name of the region.
+ * @size: size of the region.
+ * @errp: pointer to Error*, to store an error if it happens.
+ */
+void memory_region_init_ram_hugetlb(MemoryRegion *mr,
+                                    struct Object *owner,
+                                    const char *name,
+                                    uint64_t size,
+                                    Error **errp);
+
+/**
+ * memory_region_init_ram_rom_file:  Initialize RAM memory region with a
+ *                                   copy-on-write mapping of a ROM image.
+ *
+ * The first @size bytes of @path are mapped MAP_PRIVATE; if the file is
+ * shorter, the rest of the region reads as zeroes.  Pages that are never
+ * written stay shared with the host page cache.  The file must not be
+ * modified in place while the region exists.
+ *
+ * @mr: the #MemoryRegion to be initialized.
+ * @owner: the object that tracks the region's reference count
+ * @name: the name of the region.
+ * @size: size of the region.
+ * @path: the ROM image to map.
+ * @errp: pointer to Error*, to store an error if it happens.
+ */
+void memory_region_init_ram_rom_file(MemoryRegion *mr,
+                                     struct Object *owner,
+                                     const char *name,
+                                     uint64_t size,
+                                     const char *path,
+                                     Error **errp);
+
 #ifdef __linux__
 /**
  * memory_region_init_ram_from_file:  Initialize RAM memory region with a
@@ -692,6 +736,10 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode);
  * Enabled writes to a region to be queued for later processing. MMIO ->write
  * callbacks may be delayed until a non-coalesced MMIO is issued.
  * Only useful for IO regions.  Roughly similar to write-combining hardware.
+ * Works for both MMIO and port I/O regions, and keeps working if the region
+ * is mapped, moved or unmapped afterwards.  Any access to the region flushes
+ * the writes queued so far, so coalescing write-only registers (index
+ * registers, doorbells) is safe even if the device has readable registers.
  *
  * @mr: the memory region to be write coalesced
  */
@@ -748,6 +796,32 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_set_global_locking: Declares the access processing requires
+ *                                   QEMU's global lock.
+ *
+ * When this is invoked, accesses to the memory region will be processed while
+ * holding the global lock of QEMU.  This is the default behavior of memory
+ * regions.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_set_global_locking(MemoryRegion *mr);
+
+/**
+ * memory_region_clear_global_locking: Declares that access processing does
+ *                                     not depend on the QEMU global lock.
+ *
+ * By clearing this property, accesses to the memory region will be processed
+ * outside of QEMU's global lock (unless the lock is held on when issuing the
+ * access request).  In this case, the device model implementing the access
+ * handlers is responsible for synchronization of concurrency.  Regions that
+ * flush coalesced MMIO still take the global lock.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_clear_global_locking(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -1055,6 +1129,10 @@ bool address_space_read(AddressSpace *as, hwaddr addr, uint8_t *buf, int len);
 /* address_space_translate: translate an address range into an address space
  * into a MemoryRegion and an address range into that section
  *
+ * The caller must be in an RCU read-side critical section (or hold the
+ * iothread mutex, which RCU reclamation also takes) for as long as the
+ * returned MemoryRegion is used.
+ *
  * @as: #AddressSpace to be accessed
  * @addr: address within that address space
  * @xlat: pointer to address within the returned memory region section's
@@ -1113,6 +1191,80 @@ void *address_space_map(AddressSpace *as, hwaddr addr,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len);
 
+/**
+ * MemoryRegionCache: a guest memory range translated once
+ *
+ * Devices that keep accessing the same descriptor ring or table can point
+ * a cache at it and then read and write it by offset.  While the range
+ * sits in one RAM region, accesses are a memcpy to or from a host pointer.
+ * The translation is redone on the next access after any memory topology
+ * change.  Ranges that need an IOMMU translation, that are not in a single
+ * RAM region, and accesses past the end of the range go through
+ * address_space_rw() instead, so the result is always the same as without
+ * the cache.
+ *
+ * The cache holds a reference to its memory region.  Callers must hold the
+ * BQL, and should zero-initialize the cache before first use.
+ */
+typedef struct MemoryRegionCache {
+    AddressSpace *as;
+    hwaddr addr;
+    hwaddr len;
+    bool is_write;
+    unsigned int gen;       /* topology generation it was translated in */
+    MemoryRegion *mr;       /* reference held while translated */
+    ram_addr_t ram_addr;    /* of the start of the range */
+    uint8_t *ptr;           /* NULL if accesses go through the slow path */
+} MemoryRegionCache;
+
+/* address_space_cache_init: point a cache at a guest memory range
+ *
+ * Cheap when nothing changed, so that devices can call it before each
+ * batch of accesses with the current ring base and length.  The range is
+ * translated lazily, on the first access.
+ *
+ * @cache: #MemoryRegionCache to be initialized
+ * @as: #AddressSpace to be accessed
+ * @addr: address within that address space
+ * @len: length of the range
+ * @is_write: whether the range will be written to
+ */
+void address_space_cache_init(MemoryRegionCache *cache, AddressSpace *as,
+                              hwaddr addr, hwaddr len, bool is_write);
+
+/* address_space_cache_destroy: drop the translation and the reference
+ *
+ * @cache: #MemoryRegionCache to be destroyed
+ */
+void address_space_cache_destroy(MemoryRegionCache *cache);
+
+/* address_space_read_cached: read from a cached range
+ *
+ * @cache: #MemoryRegionCache to be accessed
+ * @offset: offset of the data within the range
+ * @buf: buffer the data is copied to
+ * @len: length of the data
+ */
+void address_space_read_cached(MemoryRegionCache *cache, hwaddr offset,
+                               void *buf, int len);
+
+/* address_space_write_cached: write to a cached range
+ *
+ * The cache must have been initialized with @is_write true.
+ *
+ * @cache: #MemoryRegionCache to be accessed
+ * @offset: offset of the data within the range
+ * @buf: buffer the data is copied from
+ * @len: length of the data
+ */
+void address_space_write_cached(MemoryRegionCache *cache, hwaddr offset,
+                                const void *buf, int len);
+
+/* memory_region_topology_gen: incremented by every memory topology change
+ * that may move guest memory in some address space.
+ */
+unsigned int memory_region_topology_gen(void);
+
 
 #endif
 
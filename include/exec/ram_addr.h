@@ -28,7 +28,12 @@ ram_addr_t qemu_ram_alloc_from_file(ram_addr_t size, MemoryRegion *mr,
 ram_addr_t qemu_ram_alloc_from_ptr(ram_addr_t size, void *host,
                                    MemoryRegion *mr, Error **errp);
 ram_addr_t qemu_ram_alloc(ram_addr_t size, MemoryRegion *mr, Error **errp);
+ram_addr_t qemu_ram_alloc_hugetlb(ram_addr_t size, MemoryRegion *mr,
+                                  Error **errp);
+ram_addr_t qemu_ram_alloc_rom_file(ram_addr_t size, const char *path,
+                                   MemoryRegion *mr, Error **errp);
 int qemu_get_ram_fd(ram_addr_t addr);
+size_t qemu_get_ram_page_size(ram_addr_t addr);
 void *qemu_get_ram_block_host_ptr(ram_addr_t addr);
 void *qemu_get_ram_ptr(ram_addr_t addr);
 void qemu_ram_free(ram_addr_t addr);
@@ -139,14 +144,17 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
         long k;
         long nr = BITS_TO_LONGS(pages);
 
-        for (k = 0; k < nr; k++) {
-            if (bitmap[k]) {
-                unsigned long temp = leul_to_cpu(bitmap[k]);
-
-                ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION][page + k] |= temp;
-                ram_list.dirty_memory[DIRTY_MEMORY_VGA][page + k] |= temp;
-                ram_list.dirty_memory[DIRTY_MEMORY_CODE][page + k] |= temp;
-            }
+        /* find_next_bit skips clean stretches a vector at a time; only
+         * which word it stops in matters, so byte order does not */
+        for (k = find_next_bit(bitmap, nr * BITS_PER_LONG, 0) / BITS_PER_LONG;
+             k < nr;
+             k = find_next_bit(bitmap, nr * BITS_PER_LONG,
+                               (k + 1) * BITS_PER_LONG) / BITS_PER_LONG) {
+            unsigned long temp = leul_to_cpu(bitmap[k]);
+
+            ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION][page + k] |= temp;
+            ram_list.dirty_memory[DIRTY_MEMORY_VGA][page + k] |= temp;
+            ram_list.dirty_memory[DIRTY_MEMORY_CODE][page + k] |= temp;
         }
         xen_modified_memory(start, pages);
     } else {
@@ -154,19 +162,20 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
          * bitmap-traveling is faster than memory-traveling (for addr...)
          * especially when most of the memory is not dirty.
          */
-        for (i = 0; i < len; i++) {
-            if (bitmap[i] != 0) {
-                c = leul_to_cpu(bitmap[i]);
-                do {
-                    j = ctzl(c);
-                    c &= ~(1ul << j);
-                    page_number = (i * HOST_LONG_BITS + j) * hpratio;
-                    addr = page_number * TARGET_PAGE_SIZE;
-                    ram_addr = start + addr;
-                    cpu_physical_memory_set_dirty_range(ram_addr,
-                                       TARGET_PAGE_SIZE * hpratio);
-                } while (c != 0);
-            }
+        for (i = find_next_bit(bitmap, len * BITS_PER_LONG, 0) / BITS_PER_LONG;
+             i < len;
+             i = find_next_bit(bitmap, len * BITS_PER_LONG,
+                               (i + 1) * BITS_PER_LONG) / BITS_PER_LONG) {
+            c = leul_to_cpu(bitmap[i]);
+            do {
+                j = ctzl(c);
+                c &= ~(1ul << j);
+                page_number = (i * HOST_LONG_BITS + j) * hpratio;
+                addr = page_number * TARGET_PAGE_SIZE;
+                ram_addr = start + addr;
+                cpu_physical_memory_set_dirty_range(ram_addr,
+                                   TARGET_PAGE_SIZE * hpratio);
+            } while (c != 0);
         }
     }
 }
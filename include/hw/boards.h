@@ -124,12 +124,17 @@ struct MachineState {
     char *accel;
     bool kernel_irqchip;
     int kvm_shadow_mem;
+    uint32_t kvm_dirty_ring_size;
+    uint32_t kvm_halt_poll_ns;
+    uint32_t xen_mapcache_cached;
     char *dtb;
     char *dumpdtb;
     int phandle_start;
     char *dt_compatible;
     bool dump_guest_core;
     bool mem_merge;
+    bool mem_hugetlb;
+    bool share_roms;
     bool usb;
     char *firmware;
     bool iommu;
@@ -31,6 +31,7 @@
 #include "qemu/fifo8.h"
 
 #define UART_FIFO_LENGTH    16      /* 16550A Fifo Length */
+#define UART_FIFO64_LENGTH  64      /* 16750 Fifo Length */
 
 struct SerialState {
     uint16_t divider;
@@ -57,6 +58,7 @@ struct SerialState {
     int baudbase;
     int tsr_retry;
     uint32_t wakeup;
+    bool fifo64;                    /* 16750: FCR can select a 64-byte FIFO */
 
     /* Time when the last byte was successfully sent out of the tsr */
     uint64_t last_xmit_ts;
@@ -67,6 +69,7 @@ struct SerialState {
 
     QEMUTimer *fifo_timeout_timer;
     int timeout_ipending;           /* timeout interrupt pending state */
+    QEMUBH *xmit_bh;                /* sends what the guest put in xmit_fifo */
 
     uint64_t char_transmit_time;    /* time to transmit a char in ticks */
     int poll_msl;
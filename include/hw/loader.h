@@ -56,6 +56,8 @@ void pstrcpy_targphys(const char *name,
 extern bool option_rom_has_mr;
 extern bool rom_file_has_mr;
 
+bool rom_init_ram_shared(MemoryRegion *mr, struct Object *owner,
+                         const char *name, uint64_t size, const char *path);
 int rom_add_file(const char *file, const char *fw_dir,
                  hwaddr addr, int32_t bootindex,
                  bool option_rom);
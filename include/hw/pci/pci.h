@@ -19,6 +19,7 @@
 #define PCI_SLOT(devfn)         (((devfn) >> 3) & 0x1f)
 #define PCI_FUNC(devfn)         ((devfn) & 0x07)
 #define PCI_SLOT_MAX            32
+#define PCI_BUS_MAX             256
 #define PCI_FUNC_MAX            8
 
 /* Class, Vendor and Device IDs from Linux's pci_ids.h */
@@ -81,6 +82,7 @@
 #define PCI_DEVICE_ID_VIRTIO_SCSI        0x1004
 #define PCI_DEVICE_ID_VIRTIO_RNG         0x1005
 #define PCI_DEVICE_ID_VIRTIO_9P          0x1009
+#define PCI_DEVICE_ID_VIRTIO_GPU         0x1010
 
 #define PCI_VENDOR_ID_REDHAT             0x1b36
 #define PCI_DEVICE_ID_REDHAT_BRIDGE      0x0001
@@ -216,6 +218,7 @@ typedef void (*MSIVectorReleaseNotifier)(PCIDevice *dev, unsigned int vector);
 typedef void (*MSIVectorPollNotifier)(PCIDevice *dev,
                                       unsigned int vector_start,
                                       unsigned int vector_end);
+typedef struct MSIXIrqfd MSIXIrqfd;
 
 struct PCIDevice {
     DeviceState qdev;
@@ -301,6 +304,9 @@ struct PCIDevice {
     MSIVectorUseNotifier msix_vector_use_notifier;
     MSIVectorReleaseNotifier msix_vector_release_notifier;
     MSIVectorPollNotifier msix_vector_poll_notifier;
+
+    /* MSI-X vectors delivered through KVM irqfds, see msix_enable_irqfds() */
+    MSIXIrqfd *msix_irqfds;
 };
 
 void pci_register_bar(PCIDevice *pci_dev, int region_num,
@@ -399,6 +405,7 @@ PCIBus *pci_find_primary_bus(void);
 PCIBus *pci_device_root_bus(const PCIDevice *d);
 const char *pci_root_bus_path(PCIDevice *dev);
 PCIDevice *pci_find_device(PCIBus *bus, int bus_num, uint8_t devfn);
+void pci_bus_nr_cache_flush(PCIBus *bus);
 int pci_qdev_find_device(const char *id, PCIDevice **pdev);
 PCIBus *pci_get_bus_devfn(int *devfnp, PCIBus *root, const char *devaddr);
 void pci_bus_get_w64_range(PCIBus *bus, Range *range);
@@ -694,6 +701,33 @@ static inline int pci_dma_write(PCIDevice *dev, dma_addr_t addr,
     return pci_dma_rw(dev, addr, (void *) buf, len, DMA_DIRECTION_FROM_DEVICE);
 }
 
+/* Descriptor rings and tables that a device keeps going back to can be
+ * accessed through a #MemoryRegionCache instead, see address_space_cache_init.
+ * Like pci_dma_read/pci_dma_write these order the access against the vCPUs.
+ */
+static inline void pci_dma_cache_init(PCIDevice *dev, MemoryRegionCache *cache,
+                                      dma_addr_t addr, dma_addr_t len)
+{
+    address_space_cache_init(cache, pci_get_address_space(dev), addr, len,
+                             true);
+}
+
+static inline void pci_dma_read_cached(MemoryRegionCache *cache,
+                                       dma_addr_t offset, void *buf,
+                                       dma_addr_t len)
+{
+    dma_barrier(cache->as, DMA_DIRECTION_TO_DEVICE);
+    address_space_read_cached(cache, offset, buf, len);
+}
+
+static inline void pci_dma_write_cached(MemoryRegionCache *cache,
+                                        dma_addr_t offset, const void *buf,
+                                        dma_addr_t len)
+{
+    dma_barrier(cache->as, DMA_DIRECTION_FROM_DEVICE);
+    address_space_write_cached(cache, offset, buf, len);
+}
+
 #define PCI_DMA_DEFINE_LDST(_l, _s, _bits)                              \
     static inline uint##_bits##_t ld##_l##_pci_dma(PCIDevice *dev,      \
                                                    dma_addr_t addr)     \
@@ -25,6 +25,9 @@ struct PCIBus {
     QLIST_HEAD(, PCIBus) child; /* this will be replaced by qdev later */
     QLIST_ENTRY(PCIBus) sibling;/* this will be replaced by qdev later */
 
+    /* Root bus only: secondary buses found by number, PCI_BUS_MAX entries */
+    PCIBus **bus_nr_cache;
+
     /* The bus IRQ state is the logical OR of the connected devices.
        Keep a count of the number of devices with raised IRQs.  */
     int nirq;
@@ -18,6 +18,7 @@
 #include "hw/qdev.h"
 #include "hw/virtio/virtio-scsi.h"
 #include "hw/virtio/vhost.h"
+#include "hw/virtio/vhost-scsi-common.h"
 
 /*
  * Used by QEMU userspace to ensure a consistent vhost-scsi ABI.
@@ -39,12 +40,6 @@ struct vhost_scsi_target {
     unsigned short reserved;
 };
 
-enum vhost_scsi_vq_list {
-    VHOST_SCSI_VQ_CONTROL = 0,
-    VHOST_SCSI_VQ_EVENT = 1,
-    VHOST_SCSI_VQ_NUM_FIXED = 2,
-};
-
 #define VHOST_VIRTIO 0xAF
 #define VHOST_SCSI_SET_ENDPOINT _IOW(VHOST_VIRTIO, 0x40, struct vhost_scsi_target)
 #define VHOST_SCSI_CLEAR_ENDPOINT _IOW(VHOST_VIRTIO, 0x41, struct vhost_scsi_target)
@@ -55,11 +50,7 @@ enum vhost_scsi_vq_list {
         OBJECT_CHECK(VHostSCSI, (obj), TYPE_VHOST_SCSI)
 
 typedef struct VHostSCSI {
-    VirtIOSCSICommon parent_obj;
-
-    Error *migration_blocker;
-
-    struct vhost_dev dev;
+    VHostSCSICommon parent_obj;
 } VHostSCSI;
 
 #define DEFINE_VHOST_SCSI_PROPERTIES(_state, _conf_field) \
@@ -32,6 +32,8 @@ struct vhost_memory;
 struct vhost_dev {
     MemoryListener memory_listener;
     struct vhost_memory *mem;
+    /* table last accepted by the backend */
+    struct vhost_memory *mem_committed;
     int n_mem_sections;
     MemoryRegionSection *mem_sections;
     struct vhost_virtqueue *vqs;
@@ -41,6 +43,9 @@ struct vhost_dev {
     unsigned long long features;
     unsigned long long acked_features;
     unsigned long long backend_features;
+    /* backend protocol features and queue pairs, vhost-user only */
+    uint64_t protocol_features;
+    uint64_t max_queues;
     bool started;
     bool log_enabled;
     vhost_log_chunk_t *log;
@@ -52,11 +57,13 @@ struct vhost_dev {
     hwaddr mem_changed_end_addr;
     const VhostOps *vhost_ops;
     void *opaque;
+    QLIST_ENTRY(vhost_dev) entry;
 };
 
 int vhost_dev_init(struct vhost_dev *hdev, void *opaque,
                    VhostBackendType backend_type, bool force);
 void vhost_dev_cleanup(struct vhost_dev *hdev);
+bool vhost_has_free_slot(void);
 bool vhost_dev_query(struct vhost_dev *hdev, VirtIODevice *vdev);
 int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev);
 void vhost_dev_stop(struct vhost_dev *hdev, VirtIODevice *vdev);
@@ -19,6 +19,8 @@ typedef struct V9fsConf
     /* tag name for the device */
     char *tag;
     char *fsdev_id;
+    /* maximum number of worker threads, 0 for no limit */
+    uint32_t workers;
 } V9fsConf;
 
 #endif
@@ -30,16 +30,25 @@
 /* The feature bitmap for virtio balloon */
 #define VIRTIO_BALLOON_F_MUST_TELL_HOST 0 /* Tell before reclaiming pages */
 #define VIRTIO_BALLOON_F_STATS_VQ 1       /* Memory stats virtqueue */
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT 3 /* Free page hint virtqueue */
+#define VIRTIO_BALLOON_F_REPORTING 5      /* Page reporting virtqueue */
 
 /* Size of a PFN in the balloon interface. */
 #define VIRTIO_BALLOON_PFN_SHIFT 12
 
+/* free_page_hint_cmd_id values that are not a request for hints */
+#define VIRTIO_BALLOON_CMD_ID_STOP 0
+#define VIRTIO_BALLOON_CMD_ID_DONE 1
+
 struct virtio_balloon_config
 {
     /* Number of pages host wants Guest to give up. */
     uint32_t num_pages;
     /* Number of pages we've actually got in balloon. */
     uint32_t actual;
+    /* Free page hint command id, if VIRTIO_BALLOON_F_FREE_PAGE_HINT */
+    uint32_t free_page_hint_cmd_id;
+    uint32_t poison_val;
 };
 
 /* Memory Statistics */
@@ -56,9 +65,19 @@ typedef struct VirtIOBalloonStat {
     uint64_t val;
 } QEMU_PACKED VirtIOBalloonStat;
 
+/* QEMU's own command ids start here, clear of the reserved ones */
+#define VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN 0x80000000
+
+typedef enum FreePageHintStatus {
+    FREE_PAGE_HINT_S_STOP,
+    FREE_PAGE_HINT_S_REQUESTED,
+    FREE_PAGE_HINT_S_START,
+    FREE_PAGE_HINT_S_DONE,
+} FreePageHintStatus;
+
 typedef struct VirtIOBalloon {
     VirtIODevice parent_obj;
-    VirtQueue *ivq, *dvq, *svq;
+    VirtQueue *ivq, *dvq, *svq, *free_page_vq, *rvq;
     uint32_t num_pages;
     uint32_t actual;
     uint64_t stats[VIRTIO_BALLOON_S_NR];
@@ -67,6 +86,20 @@ typedef struct VirtIOBalloon {
     QEMUTimer *stats_timer;
     int64_t stats_last_update;
     int64_t stats_poll_interval;
+    bool free_page_reporting;
+    bool free_page_hint;
+    uint32_t free_page_hint_cmd_id;
+    FreePageHintStatus free_page_hint_status;
+    /* Tell the guest to release its hinted pages once we run here */
+    bool free_page_hint_done_pending;
+    Notifier migration_state_notifier;
+    VMChangeStateEntry *change;
+    /* Host pages larger than a balloon page that are partly inflated,
+     * keyed by host address, with a bitmap of the inflated subpages.
+     */
+    GHashTable *partial_pages;
+    uint64_t discard_calls;
+    uint64_t discarded_bytes;
 } VirtIOBalloon;
 
 #endif
@@ -40,6 +40,7 @@
 #define VIRTIO_BLK_F_WCE        9       /* write cache enabled */
 #define VIRTIO_BLK_F_TOPOLOGY   10      /* Topology information is available */
 #define VIRTIO_BLK_F_CONFIG_WCE 11      /* write cache configurable */
+#define VIRTIO_BLK_F_MQ         12      /* support more than one vq */
 
 #define VIRTIO_BLK_ID_BYTES     20      /* ID string length */
 
@@ -57,6 +58,8 @@ struct virtio_blk_config
     uint16_t min_io_size;
     uint32_t opt_io_size;
     uint8_t wce;
+    uint8_t unused;
+    uint16_t num_queues;                /* only with VIRTIO_BLK_F_MQ */
 } QEMU_PACKED;
 
 /* These two define direction. */
@@ -113,15 +116,20 @@ struct VirtIOBlkConf
     uint32_t scsi;
     uint32_t config_wce;
     uint32_t data_plane;
+    uint16_t num_queues;
+    char *iothreads;            /* colon-separated IOThread ids, per queue */
 };
 
 struct VirtIOBlockDataPlane;
 
+/* Requests popped from a virtqueue per avail index read */
+#define VIRTIO_BLK_POP_BATCH 16
+
 struct VirtIOBlockReq;
 typedef struct VirtIOBlock {
     VirtIODevice parent_obj;
     BlockBackend *blk;
-    VirtQueue *vq;
+    VirtQueue **vqs;
     void *rq;
     QEMUBH *bh;
     VirtIOBlkConf conf;
@@ -130,7 +138,13 @@ typedef struct VirtIOBlock {
     VMChangeStateEntry *change;
     /* Function to push to vq and notify guest */
     void (*complete_request)(struct VirtIOBlockReq *req, unsigned char status);
+    /* Completions push at once but interrupt once per main loop pass */
+    QEMUBH *notify_bh;
+    bool *notify_pending;       /* per queue */
+    /* Preallocated requests for the next virtqueue_pop_batch() */
+    struct VirtIOBlockReq *pop_reqs[VIRTIO_BLK_POP_BATCH];
     Notifier migration_state_notifier;
+    Notifier ram_block_notifier;
     struct VirtIOBlockDataPlane *dataplane;
 } VirtIOBlock;
 
@@ -141,6 +155,8 @@ typedef struct MultiReqBuffer {
 
 typedef struct VirtIOBlockReq {
     VirtIOBlock *dev;
+    VirtQueue *vq;
+    AioContext *mq_ctx;         /* queue context for blk_aio_*_mq(), or NULL */
     VirtQueueElement elem;
     struct virtio_blk_inhdr *in;
     struct virtio_blk_outhdr out;
@@ -149,7 +165,7 @@ typedef struct VirtIOBlockReq {
     BlockAcctCookie acct;
 } VirtIOBlockReq;
 
-VirtIOBlockReq *virtio_blk_alloc_request(VirtIOBlock *s);
+VirtIOBlockReq *virtio_blk_alloc_request(VirtIOBlock *s, VirtQueue *vq);
 
 void virtio_blk_free_request(VirtIOBlockReq *req);
 
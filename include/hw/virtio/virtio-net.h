@@ -16,6 +16,7 @@
 
 #include "hw/virtio/virtio.h"
 #include "hw/pci/pci.h"
+#include "net/eth.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 #define VIRTIO_NET(obj) \
@@ -67,11 +68,16 @@
  * and latency. */
 #define TX_BURST 256
 
+/* A queue that keeps filling whole bursts may grow its own limit up to
+ * this multiple of tx_burst; it falls back once a flush drains the ring. */
+#define TX_BURST_GROW_MAX 4
+
 typedef struct virtio_net_conf
 {
     uint32_t txtimer;
     int32_t txburst;
     char *tx;
+    bool rss;
 } virtio_net_conf;
 
 /* Maximum packet size we can receive from tap device: header + 64k */
@@ -149,10 +155,12 @@ typedef struct VirtIONetQueue {
     QEMUTimer *tx_timer;
     QEMUBH *tx_bh;
     int tx_waiting;
+    int32_t tx_burst;       /* current limit, adapted by virtio_net_tx_bh */
     struct {
         VirtQueueElement elem;
         ssize_t len;
     } async_tx;
+    VirtQueueElement rx_direct; /* buffer lent to the backend */
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -197,6 +205,7 @@ typedef struct VirtIONet {
     uint64_t curr_guest_offloads;
     QEMUTimer *announce_timer;
     int announce_counter;
+    uint8_t rss_key[ETH_RSS_KEY_SIZE];
 } VirtIONet;
 
 #define VIRTIO_NET_CTRL_MAC    1
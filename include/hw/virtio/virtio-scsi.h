@@ -154,13 +154,21 @@ struct VirtIOSCSIConf {
     char *vhostfd;
     char *wwpn;
     IOThread *iothread;
+    char *iothreads;    /* colon-separated IOThread ids, per request queue */
 };
 
 struct VirtIOSCSI;
 
 typedef struct {
     struct VirtIOSCSI *parent;
+    AioContext *ctx;                /* context the host notifier runs in */
+
+    /* Request queues pop in their own context while completions are
+     * pushed from the device's home context, so vring accesses take @lock.
+     */
+    QemuMutex lock;
     Vring vring;
+    QEMUBH *notify_bh;              /* batches guest notifications */
     EventNotifier host_notifier;
     EventNotifier guest_notifier;
 } VirtIOSCSIVring;
@@ -184,7 +192,10 @@ typedef struct VirtIOSCSI {
     bool events_dropped;
 
     /* Fields for dataplane below */
-    AioContext *ctx; /* one iothread per virtio-scsi-pci for now */
+    AioContext *ctx;        /* home context, where the LUNs' I/O runs */
+    AioContext **cmd_ctxs;  /* context of each request queue */
+    IOThread **iothreads;   /* referenced only with "iothreads" */
+    unsigned int num_iothreads;
 
     /* Vring is used instead of vq in dataplane code, because of the underlying
      * memory layer thread safety */
@@ -275,7 +286,8 @@ void virtio_scsi_free_req(VirtIOSCSIReq *req);
 void virtio_scsi_push_event(VirtIOSCSI *s, SCSIDevice *dev,
                             uint32_t event, uint32_t reason);
 
-void virtio_scsi_set_iothread(VirtIOSCSI *s, IOThread *iothread);
+void virtio_scsi_set_iothread(VirtIOSCSI *s, Error **errp);
+void virtio_scsi_unset_iothread(VirtIOSCSI *s);
 void virtio_scsi_dataplane_start(VirtIOSCSI *s);
 void virtio_scsi_dataplane_stop(VirtIOSCSI *s);
 void virtio_scsi_vring_push_notify(VirtIOSCSIReq *req);
@@ -158,6 +158,12 @@ struct VirtIOSerialPort {
     uint32_t iov_idx;
     uint64_t iov_offset;
 
+    /*
+     * Guest data from several elems is gathered here so that it reaches
+     * have_data() in one call.  It is empty between flushes.
+     */
+    uint8_t *batch_buf;
+
     /*
      * When unthrottling we use a bottom-half to call flush_queued_data.
      */
@@ -23,6 +23,9 @@ extern enum xen_mode xen_mode;
 
 extern bool xen_allowed;
 
+/* Unlocked mapcache mappings kept for reuse, beyond one per bucket */
+#define XEN_MAPCACHE_DEFAULT_CACHED 64
+
 static inline bool xen_enabled(void)
 {
     return xen_allowed;
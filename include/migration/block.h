@@ -14,10 +14,13 @@
 #ifndef BLOCK_MIGRATION_H
 #define BLOCK_MIGRATION_H
 
+#include "qapi-types.h"
+
 void blk_mig_init(void);
 int blk_mig_active(void);
 uint64_t blk_mig_bytes_transferred(void);
 uint64_t blk_mig_bytes_remaining(void);
 uint64_t blk_mig_bytes_total(void);
+BlockMigrationDeviceInfoList *blk_mig_device_info(void);
 
 #endif /* BLOCK_MIGRATION_H */
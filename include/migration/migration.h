@@ -33,6 +33,57 @@
 #define QEMU_VM_SECTION_END          0x03
 #define QEMU_VM_SECTION_FULL         0x04
 #define QEMU_VM_SUBSECTION           0x05
+#define QEMU_VM_COMMAND              0x08
+
+/* Commands carried by a QEMU_VM_COMMAND section: be16 cmd, be16 len, data */
+enum qemu_vm_cmd {
+    MIG_CMD_INVALID = 0,
+    MIG_CMD_POSTCOPY_ADVISE,      /* be64 target page size */
+    MIG_CMD_POSTCOPY_RAM_DISCARD, /* u8 len, idstr, (be64 start, be64 len)* */
+    MIG_CMD_POSTCOPY_LISTEN,      /* start serving page faults */
+    MIG_CMD_POSTCOPY_RUN,         /* start the guest */
+    MIG_CMD_PACKAGED,             /* be32 len, then a nested stream */
+    MIG_CMD_MAX
+};
+
+/* Messages from the destination on the return path: be16 type, be16 len */
+enum mig_rp_message_type {
+    MIG_RP_MSG_INVALID = 0,
+    MIG_RP_MSG_SHUT,              /* be32: 0 if the destination succeeded */
+    MIG_RP_MSG_REQ_PAGES,         /* be64 start, be32 len, u8 len, idstr */
+    MIG_RP_MSG_MAX
+};
+
+/* Discard ranges sent in one MIG_CMD_POSTCOPY_RAM_DISCARD */
+#define MAX_DISCARDS_PER_COMMAND 12
+
+typedef enum {
+    POSTCOPY_INCOMING_NONE = 0,
+    POSTCOPY_INCOMING_ADVISE,
+    POSTCOPY_INCOMING_DISCARD,
+    POSTCOPY_INCOMING_LISTENING,
+    POSTCOPY_INCOMING_RUNNING,
+    POSTCOPY_INCOMING_END
+} PostcopyState;
+
+/* State of the incoming migration */
+typedef struct MigrationIncomingState {
+    QEMUFile *from_src_file;
+
+    /* Return path to the source, only opened for postcopy */
+    QEMUFile *to_src_file;
+    QemuMutex rp_mutex;           /* serializes writers of to_src_file */
+
+    PostcopyState postcopy_state;
+    QemuThread listen_thread;     /* reads the stream once the guest runs */
+    QemuThread fault_thread;      /* turns userfaults into page requests */
+    bool have_fault_thread;
+    int userfault_fd;
+    int userfault_quit_fd;        /* eventfd to stop the fault thread */
+    void *postcopy_tmp_page;
+} MigrationIncomingState;
+
+MigrationIncomingState *migration_incoming_get_current(void);
 
 struct MigrationParams {
     bool blk;
@@ -59,9 +110,21 @@ struct MigrationState
     int64_t dirty_pages_rate;
     int64_t dirty_bytes_rate;
     bool enabled_capabilities[MIGRATION_CAPABILITY_MAX];
+    int parameters[MIGRATION_PARAMETER_MAX];
     int64_t xbzrle_cache_size;
     int64_t setup_time;
     int64_t dirty_sync_count;
+
+    /* Set by migrate-start-postcopy, read by the migration thread */
+    bool start_postcopy;
+
+    /* Messages from the destination, only opened for postcopy */
+    struct {
+        QEMUFile *from_dst_file;
+        QemuThread thread;
+        bool thread_running;
+        bool error;
+    } rp_state;
 };
 
 void process_incoming_migration(QEMUFile *f);
@@ -90,6 +153,10 @@ void fd_start_incoming_migration(const char *path, Error **errp);
 
 void fd_start_outgoing_migration(MigrationState *s, const char *fdname, Error **errp);
 
+void file_start_incoming_migration(const char *filename, Error **errp);
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename, Error **errp);
+
 void rdma_start_outgoing_migration(void *opaque, const char *host_port, Error **errp);
 
 void rdma_start_incoming_migration(const char *host_port, Error **errp);
@@ -105,12 +172,26 @@ void remove_migration_state_change_notifier(Notifier *notify);
 bool migration_in_setup(MigrationState *);
 bool migration_has_finished(MigrationState *);
 bool migration_has_failed(MigrationState *);
+bool migration_in_postcopy(MigrationState *);
+bool migration_is_active(MigrationState *);
 MigrationState *migrate_get_current(void);
 
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_transferred(void);
 uint64_t ram_bytes_total(void);
 void free_xbzrle_decoded_buf(void);
+uint64_t ram_postcopy_requests(void);
+
+int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len);
+void ram_free_page_hint(void *host, size_t len);
+int ram_postcopy_send_discard_bitmap(MigrationState *ms);
+int ram_discard_range(MigrationIncomingState *mis, const char *block_name,
+                      uint64_t start, uint64_t length);
+const char *ram_block_name_from_host(void *host, ram_addr_t *offset);
+
+void migrate_send_rp_shut(MigrationIncomingState *mis, uint32_t value);
+void migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
+                               ram_addr_t start, size_t len);
 
 void acct_update_position(QEMUFile *f, size_t size, bool zero);
 
@@ -125,6 +206,9 @@ uint64_t xbzrle_mig_pages_transferred(void);
 uint64_t xbzrle_mig_pages_overflow(void);
 uint64_t xbzrle_mig_pages_cache_miss(void);
 double xbzrle_mig_cache_miss_rate(void);
+XBZRLEBlockStatsList *xbzrle_mig_block_stats(void);
+CpuThrottleInfoList *migration_cpu_throttle_info(void);
+bool dirty_rate_measuring(void);
 
 void ram_handle_compressed(void *host, uint8_t ch, uint64_t size);
 
@@ -146,12 +230,30 @@ bool migrate_rdma_pin_all(void);
 bool migrate_zero_blocks(void);
 
 bool migrate_auto_converge(void);
+bool migrate_postcopy_ram(void);
 
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen);
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
 int migrate_use_xbzrle(void);
+bool migrate_use_compression(void);
+int migrate_compress_level(void);
+int migrate_compress_threads(void);
+int migrate_decompress_threads(void);
+void migrate_decompress_threads_create(void);
+void migrate_decompress_threads_join(void);
+bool migrate_use_multifd(void);
+int migrate_multifd_channels(void);
+bool migrate_use_zero_copy(void);
+bool migrate_skip_memdev_ram(void);
+bool migrate_use_mapped_ram(void);
+bool migrate_dirty_bitmaps(void);
+void multifd_save_setup(const int *fds, int count);
+void multifd_save_shutdown(void);
+void multifd_save_cleanup(void);
+int multifd_load_add_channel(int fd, uint32_t id);
+void multifd_load_cleanup(void);
 int64_t migrate_xbzrle_cache_size(void);
 
 int64_t xbzrle_cache_resize(int64_t new_size);
@@ -39,12 +39,13 @@ void cache_fini(PageCache *cache);
 /**
  * cache_is_cached: Checks to see if the page is cached
  *
- * Returns %true if page is cached
+ * Returns %true if page is cached.  A hit counts as a use of the page,
+ * which keeps it from being evicted.
  *
  * @cache pointer to the PageCache struct
  * @addr: page addr
  */
-bool cache_is_cached(const PageCache *cache, uint64_t addr);
+bool cache_is_cached(PageCache *cache, uint64_t addr);
 
 /**
  * get_cached_data: Get the data cached for an addr
@@ -58,7 +59,8 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 
 /**
  * cache_insert: insert the page into the cache. the page cache
- * will dup the data on insert. the previous value will be overwritten
+ * will dup the data on insert. the previous value will be overwritten,
+ * or, if the page isn't cached, the least valuable page of its set
  *
  * Returns -1 on error
  *
@@ -0,0 +1,44 @@
+/*
+ * Postcopy migration for RAM
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_POSTCOPY_RAM_H
+#define QEMU_POSTCOPY_RAM_H
+
+#include "migration/migration.h"
+
+/* Return true if the host supports everything we need to do postcopy-ram */
+bool postcopy_ram_supported_by_host(void);
+
+/*
+ * Make all of RAM sensitive to accesses to areas that haven't yet been
+ * written and start the thread that asks the source for them.
+ */
+int postcopy_ram_enable_notify(MigrationIncomingState *mis);
+
+/* Undo postcopy_ram_enable_notify(), once all of RAM has arrived */
+int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis);
+
+/*
+ * Drop the pages in [start, start + length) so that the next access
+ * faults them in from the source.
+ */
+int postcopy_ram_discard_range(MigrationIncomingState *mis, uint8_t *start,
+                               size_t length);
+
+/*
+ * Atomically copy a page from @from into the guest at @host and wake up
+ * any thread waiting for it.  A page that is already present is left
+ * alone.
+ */
+int postcopy_place_page(MigrationIncomingState *mis, void *host, void *from);
+
+/* Like postcopy_place_page(), for a page of zeroes */
+int postcopy_place_page_zero(MigrationIncomingState *mis, void *host);
+
+/* Page-sized, page-aligned scratch buffer for postcopy_place_page() */
+void *postcopy_get_tmp_page(MigrationIncomingState *mis);
+
+#endif
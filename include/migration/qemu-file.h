@@ -60,6 +60,27 @@ typedef int (QEMUFileGetFD)(void *opaque);
 typedef ssize_t (QEMUFileWritevBufferFunc)(void *opaque, struct iovec *iov,
                                            int iovcnt, int64_t pos);
 
+/*
+ * Turn on zero copy writes (enable_zerocopy), or wait until the memory
+ * handed to all zero copy writes so far may be modified again
+ * (zerocopy_flush).
+ * Returns 0 on success, -err on error
+ */
+typedef int (QEMUFileZerocopyFunc)(void *opaque);
+
+/*
+ * Return a QEMUFile for comms in the opposite direction
+ */
+typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
+
+/*
+ * Stop any read or write (depending on flags) on the underlying
+ * transport on the QEMUFile.
+ * Existing blocking reads/writes must be woken
+ * Returns 0 on success, -err on error
+ */
+typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr);
+
 /*
  * This function provides hooks around different
  * stages of RAM migration.
@@ -94,6 +115,11 @@ typedef struct QEMUFileOps {
     QEMURamHookFunc *after_ram_iterate;
     QEMURamHookFunc *hook_ram_load;
     QEMURamSaveFunc *save_page;
+    QEMURetPathFunc *get_return_path;
+    QEMUFileShutdownFunc *shut_down;
+    QEMUFileZerocopyFunc *enable_zerocopy;
+    QEMUFileWritevBufferFunc *writev_zerocopy;
+    QEMUFileZerocopyFunc *zerocopy_flush;
 } QEMUFileOps;
 
 struct QEMUSizedBuffer {
@@ -110,6 +136,8 @@ QEMUFile *qemu_fopen_socket(int fd, const char *mode);
 QEMUFile *qemu_popen_cmd(const char *command, const char *mode);
 QEMUFile *qemu_bufopen(const char *mode, QEMUSizedBuffer *input);
 int qemu_get_fd(QEMUFile *f);
+QEMUFile *qemu_file_get_return_path(QEMUFile *f);
+int qemu_file_shutdown(QEMUFile *f);
 int qemu_fclose(QEMUFile *f);
 int64_t qemu_ftell(QEMUFile *f);
 void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, int size);
@@ -159,6 +187,8 @@ int qemu_peek_byte(QEMUFile *f, int offset);
 int qemu_get_byte(QEMUFile *f);
 void qemu_file_skip(QEMUFile *f, int size);
 void qemu_update_position(QEMUFile *f, size_t size);
+int64_t qemu_file_fd_tell(QEMUFile *f);
+int qemu_file_fd_seek(QEMUFile *f, int64_t offset);
 
 static inline unsigned int qemu_get_ubyte(QEMUFile *f)
 {
@@ -173,11 +203,14 @@ uint64_t qemu_get_be64(QEMUFile *f);
 
 int qemu_file_rate_limit(QEMUFile *f);
 void qemu_file_reset_rate_limit(QEMUFile *f);
+void qemu_file_credit_transfer(QEMUFile *f, size_t size);
 void qemu_file_set_rate_limit(QEMUFile *f, int64_t new_rate);
 int64_t qemu_file_get_rate_limit(QEMUFile *f);
 int qemu_file_get_error(QEMUFile *f);
 void qemu_file_set_error(QEMUFile *f, int ret);
 void qemu_fflush(QEMUFile *f);
+int qemu_file_enable_zerocopy(QEMUFile *f);
+void qemu_file_zerocopy_flush(QEMUFile *f);
 
 static inline void qemu_put_be64s(QEMUFile *f, const uint64_t *pv)
 {
@@ -43,6 +43,11 @@ typedef struct SaveVMHandlers {
 
     /* This runs both outside and inside the iothread lock.  */
     bool (*is_active)(void *opaque);
+    /* True if the section can keep iterating after the destination has
+     * started running; such sections are completed at the very end of a
+     * postcopy migration.
+     */
+    bool (*can_postcopy)(void *opaque);
 
     /* This runs outside the iothread lock in the migration case, and
      * within the lock in the savevm case.  The callback had better only
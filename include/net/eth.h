@@ -344,4 +344,25 @@ eth_parse_ipv6_hdr(struct iovec *pkt, int pkt_frags,
                    size_t ip6hdr_off, uint8_t *l4proto,
                    size_t *full_hdr_len);
 
+/* Receive-side scaling */
+#define ETH_RSS_KEY_SIZE    (40)
+#define ETH_RSS_INPUT_MAX   (36)    /* addresses and ports of TCP/IPv6 */
+
+typedef enum {
+    ETH_RSS_TYPE_NONE,
+    ETH_RSS_TYPE_IPV4,
+    ETH_RSS_TYPE_TCP_IPV4,
+    ETH_RSS_TYPE_IPV6,
+    ETH_RSS_TYPE_TCP_IPV6,
+} eth_rss_types_e;
+
+#define ETH_RSS_TYPE_BIT(t) (1 << (t))
+
+eth_rss_types_e
+eth_get_rss_input(const uint8_t *pkt, size_t size, uint32_t types,
+                  uint8_t *input, size_t *input_len);
+
+uint32_t
+eth_calc_rss_hash(const uint8_t *key, const uint8_t *input, size_t len);
+
 #endif
@@ -11,6 +11,9 @@
 
 #define MAX_QUEUE_NUM 1024
 
+/* Largest scatter list a backend offers for a direct receive buffer */
+#define NET_RX_BUFFER_MAX_IOV 64
+
 /* Maximum GSO packet size (64k) plus plenty of room for
  * the ethernet and virtio_net headers
  */
@@ -55,6 +58,9 @@ typedef bool (HasVnetHdrLen)(NetClientState *, int);
 typedef void (UsingVnetHdr)(NetClientState *, bool);
 typedef void (SetOffload)(NetClientState *, int, int, int, int, int);
 typedef void (SetVnetHdrLen)(NetClientState *, int);
+typedef void (NetIOPlug)(NetClientState *);
+typedef int (NetRxBufferGet)(NetClientState *, struct iovec *, int);
+typedef void (NetRxBufferPut)(NetClientState *, ssize_t);
 
 typedef struct NetClientInfo {
     NetClientOptionsKind type;
@@ -73,6 +79,10 @@ typedef struct NetClientInfo {
     UsingVnetHdr *using_vnet_hdr;
     SetOffload *set_offload;
     SetVnetHdrLen *set_vnet_hdr_len;
+    NetIOPlug *io_plug;
+    NetIOPlug *io_unplug;
+    NetRxBufferGet *rx_buffer_get;
+    NetRxBufferPut *rx_buffer_put;
 } NetClientInfo;
 
 struct NetClientState {
@@ -138,6 +148,10 @@ void qemu_using_vnet_hdr(NetClientState *nc, bool enable);
 void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
                       int ecn, int ufo);
 void qemu_set_vnet_hdr_len(NetClientState *nc, int len);
+void qemu_net_io_plug(NetClientState *nc);
+void qemu_net_io_unplug(NetClientState *nc);
+int qemu_peer_get_rx_buffer(NetClientState *nc, struct iovec *iov, int iovcnt);
+void qemu_peer_put_rx_buffer(NetClientState *nc, ssize_t len);
 void qemu_macaddr_default_if_unset(MACAddr *macaddr);
 int qemu_show_nic_models(const char *arg, const char *const *models);
 void qemu_check_nic_model(NICInfo *nd, const char *model);
@@ -34,6 +34,12 @@ typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
 
+typedef struct NetQueueStats {
+    uint32_t length;    /* packets waiting now */
+    uint64_t queued;    /* packets ever queued */
+    uint64_t dropped;   /* dropped: queue full, or purged */
+} NetQueueStats;
+
 NetQueue *qemu_new_net_queue(void *opaque);
 
 void qemu_del_net_queue(NetQueue *queue);
@@ -53,6 +59,8 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 NetPacketSent *sent_cb);
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats);
+bool qemu_net_queue_empty(NetQueue *queue);
 bool qemu_net_queue_flush(NetQueue *queue);
 
 #endif /* QEMU_NET_QUEUE_H */
@@ -12,6 +12,10 @@ typedef struct VhostNetOptions {
     NetClientState *net_backend;
     void *opaque;
     bool force;
+    /* kernel backend only */
+    uint32_t poll_us;
+    bool has_zerocopy;
+    bool zerocopy;
 } VhostNetOptions;
 
 struct vhost_net *vhost_net_init(VhostNetOptions *options);
@@ -24,9 +28,15 @@ void vhost_net_cleanup(VHostNetState *net);
 
 unsigned vhost_net_get_features(VHostNetState *net, unsigned features);
 void vhost_net_ack_features(VHostNetState *net, unsigned features);
+unsigned vhost_net_get_acked_features(VHostNetState *net);
+
+int vhost_net_set_vring_enable(VHostNetState *net, int enable);
+uint64_t vhost_net_get_max_queues(VHostNetState *net);
 
 bool vhost_net_virtqueue_pending(VHostNetState *net, int n);
 void vhost_net_virtqueue_mask(VHostNetState *net, VirtIODevice *dev,
                               int idx, bool mask);
 VHostNetState *get_vhost_net(NetClientState *nc);
+
+void vhost_net_get_info(VHostNetState *net, VhostNetInfo *info);
 #endif
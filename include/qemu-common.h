@@ -116,6 +116,15 @@ extern int64_t max_delay;
 extern int64_t max_advance;
 void dump_drift_info(FILE *f, fprintf_function cpu_fprintf);
 
+/* Number of executions after which a TB is retranslated as a hot
+   superblock; 0 disables the profiling tier.  */
+extern unsigned int tcg_tb_hot_threshold;
+
+/* Write /tmp/perf-<pid>.map entries for translated code.  */
+extern bool tcg_perf_map;
+/* Write /tmp/jit-<pid>.dump records for translated code.  */
+extern bool tcg_jitdump;
+
 #include "qemu/osdep.h"
 #include "qemu/bswap.h"
 
@@ -451,6 +460,13 @@ void qemu_hexdump(const char *buf, FILE *fp, const char *prefix, size_t size);
 #define VECTYPE        __m128i
 #define SPLAT(p)       _mm_set1_epi8(*(p))
 #define ALL_EQ(v1, v2) (_mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2)) == 0xFFFF)
+#elif defined __aarch64__
+#include <arm_neon.h>
+#define VECTYPE        uint64x2_t
+#define SPLAT(p)       vreinterpretq_u64_u8(vld1q_dup_u8(p))
+#define ALL_EQ(v1, v2) \
+    (vgetq_lane_u64(v1, 0) == vgetq_lane_u64(v2, 0) && \
+     vgetq_lane_u64(v1, 1) == vgetq_lane_u64(v2, 1))
 #else
 #define VECTYPE        unsigned long
 #define SPLAT(p)       (*(p) * (~0UL / 255))
@@ -467,6 +483,14 @@ can_use_buffer_find_nonzero_offset(const void *buf, size_t len)
 }
 size_t buffer_find_nonzero_offset(const void *buf, size_t len);
 
+#ifdef CONFIG_CPUID_H
+/* x86 host features, for code that picks an implementation at run time */
+bool qemu_cpu_has_avx2(void);
+bool qemu_cpu_has_sse42(void);
+bool qemu_cpu_has_aes(void);
+bool qemu_cpu_has_pclmul(void);
+#endif
+
 /*
  * helper to parse debug environment variables
  */
@@ -60,7 +60,8 @@ struct HBitmapIter {
  * in, and then affect the entire set; iteration will only visit the first
  * bit of each group.
  *
- * Allocate a new HBitmap.
+ * Allocate a new HBitmap.  Memory for the bits themselves is only allocated
+ * as they are set, in chunks that are freed again when they are reset.
  */
 HBitmap *hbitmap_alloc(uint64_t size, int granularity);
 
@@ -125,6 +126,70 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item);
  */
 void hbitmap_free(HBitmap *hb);
 
+/**
+ * hbitmap_serialization_size:
+ * @hb: HBitmap to operate on.
+ *
+ * Return the number of bytes hbitmap_serialize needs for @hb: one bit per
+ * group of 2^granularity bits, rounded up to a whole byte.
+ */
+uint64_t hbitmap_serialization_size(const HBitmap *hb);
+
+/**
+ * hbitmap_serialize:
+ * @hb: HBitmap to operate on.
+ * @buf: Buffer of hbitmap_serialization_size(@hb) bytes.
+ *
+ * Store the bottom level of @hb in @buf, least significant bit first.
+ * The format does not depend on the host's endianness or word size.
+ */
+void hbitmap_serialize(const HBitmap *hb, uint8_t *buf);
+
+/**
+ * hbitmap_deserialize:
+ * @hb: Empty HBitmap of the same size and granularity as the serialized one.
+ * @buf: Data written by hbitmap_serialize.
+ *
+ * Set the bits of @hb from @buf.
+ */
+void hbitmap_deserialize(HBitmap *hb, const uint8_t *buf);
+
+/**
+ * hbitmap_serialization_size_part:
+ * @hb: HBitmap to operate on.
+ * @start: First bit of the range (0-based).
+ * @count: Number of bits in the range.
+ *
+ * Return the number of bytes hbitmap_serialize_part needs for the range.
+ */
+uint64_t hbitmap_serialization_size_part(const HBitmap *hb,
+                                         uint64_t start, uint64_t count);
+
+/**
+ * hbitmap_serialize_part:
+ * @hb: HBitmap to operate on.
+ * @buf: Buffer of hbitmap_serialization_size_part bytes.
+ * @start: First bit to store; a multiple of 8 groups.
+ * @count: Number of bits to store; a multiple of 8 groups, unless the range
+ * ends at the end of the bitmap.
+ *
+ * Like hbitmap_serialize, for part of the bitmap.
+ */
+void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
+                            uint64_t start, uint64_t count);
+
+/**
+ * hbitmap_deserialize_part:
+ * @hb: HBitmap to operate on.
+ * @buf: Data written by hbitmap_serialize_part for the same range.
+ * @start: First bit of the range, as passed to hbitmap_serialize_part.
+ * @count: Number of bits in the range, as passed to hbitmap_serialize_part.
+ *
+ * Replace the bits of @hb in the range with those stored in @buf.
+ */
+void hbitmap_deserialize_part(HBitmap *hb, const uint8_t *buf,
+                              uint64_t start, uint64_t count);
+
 /**
  * hbitmap_iter_init:
  * @hbi: HBitmapIter to initialize.
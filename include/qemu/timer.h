@@ -59,8 +59,12 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
     int scale;
+
+    /* Position in the timer list's heap, valid while the timer is pending */
+    unsigned heap_index;
+    /* Insertion order, so that timers with equal expiry fire FIFO */
+    uint64_t seq;
 };
 
 extern QEMUTimerListGroup main_loop_tlg;
@@ -614,6 +618,15 @@ bool timer_expired(QEMUTimer *timer_head, int64_t current_time);
  */
 uint64_t timer_expire_time_ns(QEMUTimer *ts);
 
+/**
+ * dump_timers_info:
+ * @f: the stream to print to
+ * @cpu_fprintf: the function used to print
+ *
+ * Print the number of timer lists and pending timers of each clock.
+ */
+void dump_timers_info(FILE *f, fprintf_function cpu_fprintf);
+
 /**
  * timer_get:
  * @f: the file
@@ -189,6 +189,7 @@ typedef struct CPUWatchpoint {
 
 struct KVMState;
 struct kvm_run;
+struct kvm_dirty_gfn;
 
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
@@ -216,6 +217,18 @@ struct kvm_run;
  * @can_do_io: Nonzero if memory-mapped IO is safe.
  * @env_ptr: Pointer to subclass-specific CPUArchState field.
  * @current_tb: Currently executing TB.
+ * @tb_jmp_cache: Recently executed TBs, indexed by virtual PC.
+ * @tb_jmp_cache_gen: tlb_flush() generation each @tb_jmp_cache entry was
+ * last validated in; older entries are checked against the TLB when hit.
+ * @tb_jmp_cache_cur_gen: Current tlb_flush() generation.
+ * @tb_jmp_cache_hits: Lookups served by @tb_jmp_cache.
+ * @tb_jmp_cache_misses: Lookups that had to search the TB hash table.
+ * @tb_jmp_cache_revalidations: Hits on entries from an older generation.
+ * @tlb_flush_count: Number of full TLB flushes of this CPU.
+ * @tlb_flush_page_count: Number of single-page TLB flushes of this CPU.
+ * @tlb_flush_large_count: Number of flushes of the area mapped by large pages.
+ * @profile_sample: Set by the guest profiler to have cpu_exec() record the
+ *           guest PC before looking up the next TB.
  * @gdb_regs: Additional GDB registers.
  * @gdb_num_regs: Number of total registers accessible to GDB.
  * @gdb_num_g_regs: Number of registers in GDB 'g' packets.
@@ -224,6 +237,19 @@ struct kvm_run;
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @mem_io_vaddr: Target virtual address at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @kvm_dirty_gfns: This vCPU's dirty ring, if KVM dirty rings are in use.
+ * @kvm_fetch_index: Free-running index of the next dirty ring entry to
+ * collect.
+ * @halt_poll_ns: How long this vCPU currently polls when it halts in
+ * userspace, adapted to the length of its recent halts.
+ * @dirty_pages: Pages this CPU dirtied for migration in the current
+ * auto-converge period (TCG only).
+ * @throttle_cpu_time: CPU time of this CPU's thread when the current
+ * auto-converge period started (KVM only).
+ * @throttle_percentage: Percentage of its time auto-converge keeps this
+ * CPU out of the guest.
+ * @throttle_pending: An auto-converge sleep is queued on this CPU.
+ * @throttle_woken: When this CPU last came back from such a sleep.
  *
  * State of one CPU core or thread.
  */
@@ -261,6 +287,15 @@ struct CPUState {
     void *env_ptr; /* CPUArchState */
     struct TranslationBlock *current_tb;
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    uint32_t tb_jmp_cache_gen[TB_JMP_CACHE_SIZE];
+    uint32_t tb_jmp_cache_cur_gen;
+    uint64_t tb_jmp_cache_hits;
+    uint64_t tb_jmp_cache_misses;
+    uint64_t tb_jmp_cache_revalidations;
+    unsigned int tlb_flush_count;
+    unsigned int tlb_flush_page_count;
+    unsigned int tlb_flush_large_count;
+    bool profile_sample;
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
     int gdb_num_g_regs;
@@ -284,6 +319,15 @@ struct CPUState {
     bool kvm_vcpu_dirty;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
+    int64_t halt_poll_ns;
+
+    uint64_t dirty_pages;
+    int64_t throttle_cpu_time;
+    int throttle_percentage;
+    bool throttle_pending;
+    int64_t throttle_woken;
 
     /* TODO Move common fields from CPUArchState here. */
     int cpu_index; /* used by alpha TCG */
@@ -97,6 +97,17 @@ BlockAIOCB *blk_aio_readv(BlockBackend *blk, int64_t sector_num,
 BlockAIOCB *blk_aio_writev(BlockBackend *blk, int64_t sector_num,
                            QEMUIOVector *iov, int nb_sectors,
                            BlockCompletionFunc *cb, void *opaque);
+int blk_add_aio_queue(BlockBackend *blk, AioContext *ctx, Error **errp);
+void blk_del_aio_queue(BlockBackend *blk, AioContext *ctx);
+bool blk_aio_mq_usable(BlockBackend *blk);
+BlockAIOCB *blk_aio_readv_mq(BlockBackend *blk, AioContext *ctx,
+                             int64_t sector_num, QEMUIOVector *iov,
+                             int nb_sectors, BlockCompletionFunc *cb,
+                             void *opaque);
+BlockAIOCB *blk_aio_writev_mq(BlockBackend *blk, AioContext *ctx,
+                              int64_t sector_num, QEMUIOVector *iov,
+                              int nb_sectors, BlockCompletionFunc *cb,
+                              void *opaque);
 BlockAIOCB *blk_aio_flush(BlockBackend *blk,
                           BlockCompletionFunc *cb, void *opaque);
 BlockAIOCB *blk_aio_discard(BlockBackend *blk,
@@ -110,6 +121,7 @@ BlockAIOCB *blk_aio_ioctl(BlockBackend *blk, unsigned long int req, void *buf,
                           BlockCompletionFunc *cb, void *opaque);
 int blk_flush(BlockBackend *blk);
 int blk_flush_all(void);
+void blk_drain(BlockBackend *blk);
 void blk_drain_all(void);
 BlockdevOnError blk_get_on_error(BlockBackend *blk, bool is_read);
 BlockErrorAction blk_get_error_action(BlockBackend *blk, bool is_read,
@@ -134,6 +146,8 @@ AioContext *blk_get_aio_context(BlockBackend *blk);
 void blk_set_aio_context(BlockBackend *blk, AioContext *new_context);
 void blk_io_plug(BlockBackend *blk);
 void blk_io_unplug(BlockBackend *blk);
+void blk_register_buf(BlockBackend *blk, void *host, size_t size);
+void blk_unregister_buf(BlockBackend *blk, void *host);
 BlockAcctStats *blk_get_stats(BlockBackend *blk);
 
 void *blk_aio_get(const AIOCBInfo *aiocb_info, BlockBackend *blk,
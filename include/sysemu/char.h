@@ -84,6 +84,7 @@ struct CharDriverState {
     int avail_connections;
     int is_mux;
     guint fd_in_tag;
+    GMainContext *gcontext;     /* NULL for the default main context */
     QemuOpts *opts;
     QTAILQ_ENTRY(CharDriverState) next;
 };
@@ -286,6 +287,18 @@ int qemu_chr_fe_claim(CharDriverState *s);
  */
 void qemu_chr_fe_claim_no_fail(CharDriverState *s);
 
+/**
+ * @qemu_chr_set_gcontext:
+ *
+ * Service the backend from @context instead of the default main context:
+ * its read and accept callbacks, and watches added with
+ * qemu_chr_fe_add_watch(), then run in the thread that iterates @context.
+ * Only socket backends support this.
+ *
+ * Returns: 0 on success, -ENOTSUP if the backend does not support it.
+ */
+int qemu_chr_set_gcontext(CharDriverState *s, GMainContext *context);
+
 /**
  * @qemu_chr_fe_claim:
  *
@@ -14,6 +14,9 @@
 #ifndef DUMP_H
 #define DUMP_H
 
+#include "qemu/thread.h"
+#include "qapi-types.h"
+
 #define MAKEDUMPFILE_SIGNATURE      "makedumpfile"
 #define MAX_SIZE_MDF_HEADER         (4096) /* max size of makedumpfile_header */
 #define TYPE_FLAT_HEADER            (1)    /* type of flattened format */
@@ -183,6 +186,14 @@ typedef struct DumpState {
     off_t offset_page;          /* offset of page part in vmcore */
     size_t num_dumpable;        /* number of page that can be dumped */
     uint32_t flag_compress;     /* indicate the compression format */
+    bool kdump;                 /* kdump-compressed rather than ELF */
+    int compress_threads;       /* threads compressing kdump pages */
+
+    bool detached;              /* dumping from a background thread */
+    QemuThread dump_thread;     /* the background thread, if detached */
+    DumpStatus status;          /* accessed atomically */
+    int64_t total_size;         /* bytes of guest memory to be written */
+    int64_t written_size;       /* bytes of guest memory written so far */
 } DumpState;
 
 uint16_t cpu_to_dump16(DumpState *s, uint16_t val);
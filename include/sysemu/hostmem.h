@@ -56,6 +56,7 @@ struct HostMemoryBackend {
     uint64_t size;
     bool merge, dump;
     bool prealloc, force_prealloc;
+    uint32_t prealloc_threads;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
@@ -64,5 +65,7 @@ struct HostMemoryBackend {
 
 MemoryRegion *host_memory_backend_get_memory(HostMemoryBackend *backend,
                                              Error **errp);
+void host_memory_backend_bind_host_node(HostMemoryBackend *backend,
+                                        unsigned int host_node, Error **errp);
 
 #endif
@@ -28,6 +28,19 @@ typedef struct {
     QemuCond init_done_cond;    /* is thread initialization done? */
     bool stopping;
     int thread_id;
+
+    /* AioContext poll parameters */
+    int64_t poll_max_ns;
+    int64_t poll_grow;
+    int64_t poll_shrink;
+
+    /* Worker threads of the AioContext's thread pool */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+
+    /* Host CPU placement: explicit CPUs, or those of a guest NUMA node */
+    unsigned long *host_cpus;
+    int64_t numa_node;
 } IOThread;
 
 #define IOTHREAD(obj) \
@@ -36,5 +49,7 @@ typedef struct {
 IOThread *iothread_find(const char *id);
 char *iothread_get_id(IOThread *iothread);
 AioContext *iothread_get_aio_context(IOThread *iothread);
+void iothread_set_host_cpus(IOThread *iothread, unsigned long *host_cpus,
+                            Error **errp);
 
 #endif /* IOTHREAD_H */
@@ -55,6 +55,12 @@
 # define EWOULDBLOCK  WSAEWOULDBLOCK
 #endif
 
+#ifndef SHUT_RDWR
+# define SHUT_RD      SD_RECEIVE
+# define SHUT_WR      SD_SEND
+# define SHUT_RDWR    SD_BOTH
+#endif
+
 #if defined(_WIN64)
 /* On w64, setjmp is implemented by _setjmp which needs a second parameter.
  * If this parameter is NULL, longjump does no stack unwinding.
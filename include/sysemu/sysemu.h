@@ -43,6 +43,13 @@ void vm_start(void);
 int vm_stop(RunState state);
 int vm_stop_force_state(RunState state);
 
+/* True while a detached dump-guest-memory is writing guest memory */
+bool dump_in_progress(void);
+
+/* Time spent in each startup phase and in realizing each device */
+void dump_startup_profile(FILE *f, fprintf_function cpu_fprintf);
+void qdev_dump_realize_times(FILE *f, fprintf_function cpu_fprintf);
+
 typedef enum WakeupReason {
     /* Always keep QEMU_WAKEUP_REASON_NONE = 0 */
     QEMU_WAKEUP_REASON_NONE = 0,
@@ -84,11 +91,19 @@ void qemu_announce_self(void);
 bool qemu_savevm_state_blocked(Error **errp);
 void qemu_savevm_state_begin(QEMUFile *f,
                              const MigrationParams *params);
-int qemu_savevm_state_iterate(QEMUFile *f);
+int qemu_savevm_state_iterate(QEMUFile *f, bool postcopy);
 void qemu_savevm_state_complete(QEMUFile *f);
+int qemu_savevm_state_postcopy_package(QEMUFile *f);
+void qemu_savevm_state_postcopy_complete(QEMUFile *f);
 void qemu_savevm_state_cancel(void);
-uint64_t qemu_savevm_state_pending(QEMUFile *f, uint64_t max_size);
+uint64_t qemu_savevm_state_pending(QEMUFile *f, uint64_t max_size,
+                                   bool postcopy);
+void qemu_savevm_send_postcopy_advise(QEMUFile *f);
+void qemu_savevm_send_postcopy_ram_discard(QEMUFile *f, const char *name,
+                                           uint16_t len, uint64_t *start_list,
+                                           uint64_t *length_list);
 int qemu_loadvm_state(QEMUFile *f);
+DeviceStateTimeList *qemu_savevm_device_times(void);
 
 /* SLIRP */
 void do_info_slirp(Monitor *mon);
@@ -147,6 +162,9 @@ extern int mem_prealloc;
  */
 #define MAX_CPUMASK_BITS 255
 
+/* Host CPUs that NUMA placement can pin threads to */
+#define MAX_HOST_CPUS 1024
+
 extern int nb_numa_nodes;   /* Number of NUMA nodes */
 extern int max_numa_nodeid; /* Highest specified NUMA node ID, plus one.
                              * For all nodes, nodeid < max_numa_nodeid
@@ -157,6 +175,10 @@ typedef struct node_info {
     DECLARE_BITMAP(node_cpu, MAX_CPUMASK_BITS);
     struct HostMemoryBackend *node_memdev;
     bool present;
+    bool has_host_node;
+    uint16_t host_node;
+    /* vCPUs and IOThreads of this node run here, if not empty */
+    DECLARE_BITMAP(host_cpus, MAX_HOST_CPUS);
 } NodeInfo;
 extern NodeInfo numa_info[MAX_NODES];
 void set_numa_nodes(void);
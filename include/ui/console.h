@@ -177,6 +177,7 @@ typedef struct DisplayChangeListenerOps {
 
 struct DisplayChangeListener {
     uint64_t update_interval;
+    bool idle;          /* nothing to refresh for, e.g. no vnc client */
     const DisplayChangeListenerOps *ops;
     DisplayState *ds;
     QemuConsole *con;
@@ -216,6 +217,7 @@ static inline int is_buffer_shared(DisplaySurface *surface)
 void register_displaychangelistener(DisplayChangeListener *dcl);
 void update_displaychangelistener(DisplayChangeListener *dcl,
                                   uint64_t interval);
+void displaychangelistener_set_idle(DisplayChangeListener *dcl, bool idle);
 void unregister_displaychangelistener(DisplayChangeListener *dcl);
 
 int dpy_set_ui_info(QemuConsole *con, QemuUIInfo *info);
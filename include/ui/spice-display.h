@@ -94,6 +94,12 @@ struct SimpleSpiceDisplay {
     QemuMutex lock;
     QTAILQ_HEAD(, SimpleSpiceUpdate) updates;
 
+    /* update creation in an iothread (-spice iothread=<id>) */
+    QEMUBH *render_bh;
+    QXLRect render_dirty;
+    bool render_pending;
+    QemuCond render_cond;
+
     /* cursor (without qxl): displaychangelistener -> spice server */
     SimpleSpiceCursor *ptr_define;
     SimpleSpiceCursor *ptr_move;
@@ -18,9 +18,23 @@
 #include "sysemu/iothread.h"
 #include "qmp-commands.h"
 #include "qemu/error-report.h"
+#include "qemu/rcu.h"
+#include "qemu/main-loop.h"
+#include "qapi/visitor.h"
+#include "qapi-visit.h"
+#include "sysemu/sysemu.h"
+#include "block/thread-pool.h"
 
 #define IOTHREADS_PATH "/objects"
 
+/* Completions from fast NVMe drives usually arrive within a few tens of
+ * microseconds, so polling that long avoids most ppoll() wakeups while
+ * costing little CPU time when the IOThread is idle.
+ */
+#define IOTHREAD_POLL_MAX_NS_DEFAULT 32768ULL
+
+#define IOTHREAD_THREAD_POOL_MAX_DEFAULT 64
+
 typedef ObjectClass IOThreadClass;
 
 #define IOTHREAD_GET_CLASS(obj) \
@@ -33,6 +47,8 @@ static void *iothread_run(void *opaque)
     IOThread *iothread = opaque;
     bool blocking;
 
+    rcu_register_thread();
+
     qemu_mutex_lock(&iothread->init_done_lock);
     iothread->thread_id = qemu_get_thread_id();
     qemu_cond_signal(&iothread->init_done_cond);
@@ -47,6 +63,8 @@ static void *iothread_run(void *opaque)
         }
         aio_context_release(iothread->ctx);
     }
+
+    rcu_unregister_thread();
     return NULL;
 }
 
@@ -63,6 +81,7 @@ static void iothread_instance_finalize(Object *obj)
     qemu_cond_destroy(&iothread->init_done_cond);
     qemu_mutex_destroy(&iothread->init_done_lock);
     aio_context_unref(iothread->ctx);
+    g_free(iothread->host_cpus);
 }
 
 static void iothread_complete(UserCreatable *obj, Error **errp)
@@ -78,11 +97,31 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    aio_context_set_poll_params(iothread->ctx, iothread->poll_max_ns,
+                                iothread->poll_grow, iothread->poll_shrink,
+                                &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
+    thread_pool_set_params(aio_get_thread_pool(iothread->ctx),
+                           iothread->thread_pool_min,
+                           iothread->thread_pool_max, &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
     qemu_mutex_init(&iothread->init_done_lock);
     qemu_cond_init(&iothread->init_done_cond);
 
-    /* This assumes we are called from a thread with useful CPU affinity for us
-     * to inherit.
+    /* Unless host-cpus is set, this assumes we are called from a thread with
+     * useful CPU affinity for us to inherit.
      */
     qemu_thread_create(&iothread->thread, "iothread", iothread_run,
                        iothread, QEMU_THREAD_JOINABLE);
@@ -94,6 +133,245 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
                        &iothread->init_done_lock);
     }
     qemu_mutex_unlock(&iothread->init_done_lock);
+
+    if (iothread->host_cpus) {
+        iothread_set_host_cpus(iothread, iothread->host_cpus, errp);
+    }
+}
+
+/* Run @iothread and its thread pool workers on the MAX_HOST_CPUS-bit set
+ * of host CPUs @host_cpus
+ */
+void iothread_set_host_cpus(IOThread *iothread, unsigned long *host_cpus,
+                            Error **errp)
+{
+    int ret;
+
+    ret = qemu_thread_set_affinity(&iothread->thread, host_cpus,
+                                   MAX_HOST_CPUS);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "cannot set IOThread CPU affinity");
+        return;
+    }
+    thread_pool_set_host_cpus(aio_get_thread_pool(iothread->ctx), host_cpus,
+                              MAX_HOST_CPUS);
+}
+
+static void iothread_get_host_cpus(Object *obj, Visitor *v, void *opaque,
+                                   const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    uint16List *host_cpus = NULL;
+    uint16List **node = &host_cpus;
+    unsigned long value;
+
+    if (iothread->host_cpus) {
+        for (value = find_first_bit(iothread->host_cpus, MAX_HOST_CPUS);
+             value < MAX_HOST_CPUS;
+             value = find_next_bit(iothread->host_cpus, MAX_HOST_CPUS,
+                                   value + 1)) {
+            *node = g_malloc0(sizeof(**node));
+            (*node)->value = value;
+            node = &(*node)->next;
+        }
+    }
+
+    visit_type_uint16List(v, &host_cpus, name, errp);
+    qapi_free_uint16List(host_cpus);
+}
+
+static void iothread_set_host_cpus_prop(Object *obj, Visitor *v, void *opaque,
+                                        const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    uint16List *host_cpus = NULL, *l;
+    unsigned long *bitmap;
+
+    visit_type_uint16List(v, &host_cpus, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    bitmap = bitmap_new(MAX_HOST_CPUS);
+    for (l = host_cpus; l; l = l->next) {
+        if (l->value >= MAX_HOST_CPUS) {
+            error_setg(&local_err, "host CPU %" PRIu16 " is bigger than %d",
+                       l->value, MAX_HOST_CPUS - 1);
+            g_free(bitmap);
+            goto out;
+        }
+        set_bit(l->value, bitmap);
+    }
+
+    g_free(iothread->host_cpus);
+    iothread->host_cpus = bitmap;
+    if (iothread->ctx) {
+        iothread_set_host_cpus(iothread, bitmap, &local_err);
+    }
+
+out:
+    qapi_free_uint16List(host_cpus);
+    error_propagate(errp, local_err);
+}
+
+static void iothread_get_numa_node(Object *obj, Visitor *v, void *opaque,
+                                   const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_int64(v, &iothread->numa_node, name, errp);
+}
+
+static void iothread_set_numa_node(Object *obj, Visitor *v, void *opaque,
+                                   const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    int64_t value;
+
+    visit_type_int64(v, &value, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    if (value < 0 || value >= MAX_NODES) {
+        error_setg(&local_err, "numa-node must be in range [0, %d]",
+                   MAX_NODES - 1);
+        goto out;
+    }
+    iothread->numa_node = value;
+
+out:
+    error_propagate(errp, local_err);
+}
+
+typedef struct {
+    const char *name;
+    ptrdiff_t offset; /* field's byte offset in IOThread struct */
+} PollParamInfo;
+
+static PollParamInfo poll_max_ns_info = {
+    "poll-max-ns", offsetof(IOThread, poll_max_ns),
+};
+static PollParamInfo poll_grow_info = {
+    "poll-grow", offsetof(IOThread, poll_grow),
+};
+static PollParamInfo poll_shrink_info = {
+    "poll-shrink", offsetof(IOThread, poll_shrink),
+};
+
+static void iothread_get_poll_param(Object *obj, Visitor *v, void *opaque,
+                                    const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    PollParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+
+    visit_type_int64(v, field, name, errp);
+}
+
+static void iothread_set_poll_param(Object *obj, Visitor *v, void *opaque,
+                                    const char *name, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    PollParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value;
+
+    visit_type_int64(v, &value, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    if (value < 0) {
+        error_setg(&local_err, "%s value must be in range [0, %"PRId64"]",
+                   info->name, INT64_MAX);
+        goto out;
+    }
+
+    *field = value;
+
+    if (iothread->ctx) {
+        aio_context_set_poll_params(iothread->ctx, iothread->poll_max_ns,
+                                    iothread->poll_grow, iothread->poll_shrink,
+                                    &local_err);
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static PollParamInfo thread_pool_min_info = {
+    "thread-pool-min", offsetof(IOThread, thread_pool_min),
+};
+static PollParamInfo thread_pool_max_info = {
+    "thread-pool-max", offsetof(IOThread, thread_pool_max),
+};
+
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+                                           void *opaque, const char *name,
+                                           Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    PollParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value, old;
+
+    visit_type_int64(v, &value, name, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    old = *field;
+    *field = value;
+
+    if (iothread->ctx) {
+        thread_pool_set_params(aio_get_thread_pool(iothread->ctx),
+                               iothread->thread_pool_min,
+                               iothread->thread_pool_max, &local_err);
+        if (local_err) {
+            *field = old;
+        }
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static void iothread_instance_init(Object *obj)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->numa_node = -1;
+    iothread->thread_pool_max = IOTHREAD_THREAD_POOL_MAX_DEFAULT;
+
+    object_property_add(obj, "poll-max-ns", "int",
+                        iothread_get_poll_param, iothread_set_poll_param,
+                        NULL, &poll_max_ns_info, &error_abort);
+    object_property_add(obj, "poll-grow", "int",
+                        iothread_get_poll_param, iothread_set_poll_param,
+                        NULL, &poll_grow_info, &error_abort);
+    object_property_add(obj, "poll-shrink", "int",
+                        iothread_get_poll_param, iothread_set_poll_param,
+                        NULL, &poll_shrink_info, &error_abort);
+    object_property_add(obj, "thread-pool-min", "int",
+                        iothread_get_poll_param,
+                        iothread_set_thread_pool_param,
+                        NULL, &thread_pool_min_info, &error_abort);
+    object_property_add(obj, "thread-pool-max", "int",
+                        iothread_get_poll_param,
+                        iothread_set_thread_pool_param,
+                        NULL, &thread_pool_max_info, &error_abort);
+    object_property_add(obj, "host-cpus", "uint16List",
+                        iothread_get_host_cpus, iothread_set_host_cpus_prop,
+                        NULL, NULL, &error_abort);
+    object_property_add(obj, "numa-node", "int",
+                        iothread_get_numa_node, iothread_set_numa_node,
+                        NULL, NULL, &error_abort);
 }
 
 static void iothread_class_init(ObjectClass *klass, void *class_data)
@@ -107,6 +385,7 @@ static const TypeInfo iothread_info = {
     .parent = TYPE_OBJECT,
     .class_init = iothread_class_init,
     .instance_size = sizeof(IOThread),
+    .instance_init = iothread_instance_init,
     .instance_finalize = iothread_instance_finalize,
     .interfaces = (InterfaceInfo[]) {
         {TYPE_USER_CREATABLE},
@@ -143,6 +422,36 @@ AioContext *iothread_get_aio_context(IOThread *iothread)
     return iothread->ctx;
 }
 
+static AioLatencyStatsInfo *aio_latency_stats_info(AioLatencyStats *stats)
+{
+    AioLatencyStatsInfo *info = g_new0(AioLatencyStatsInfo, 1);
+    intList **next = &info->histogram;
+    int i;
+
+    info->count = stats->count;
+    info->total_ns = stats->total_ns;
+    info->max_ns = stats->max_ns;
+    for (i = 0; i < AIO_STATS_BINS; i++) {
+        *next = g_new0(intList, 1);
+        (*next)->value = stats->hist[i];
+        next = &(*next)->next;
+    }
+    return info;
+}
+
+static AioContextStatsInfo *aio_context_stats_info(AioContext *ctx)
+{
+    AioContextStats *stats = &ctx->stats;
+    AioContextStatsInfo *info = g_new0(AioContextStatsInfo, 1);
+
+    info->polls = stats->polls;
+    info->wakeups = stats->wakeups;
+    info->bottom_halves = stats->bhs;
+    info->dispatch = aio_latency_stats_info(&stats->dispatch);
+    info->handlers = aio_latency_stats_info(&stats->handlers);
+    return info;
+}
+
 static int query_one_iothread(Object *object, void *opaque)
 {
     IOThreadInfoList ***prev = opaque;
@@ -158,6 +467,7 @@ static int query_one_iothread(Object *object, void *opaque)
     info = g_new0(IOThreadInfo, 1);
     info->id = iothread_get_id(iothread);
     info->thread_id = iothread->thread_id;
+    info->stats = aio_context_stats_info(iothread->ctx);
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
@@ -177,3 +487,8 @@ IOThreadInfoList *qmp_query_iothreads(Error **errp)
     object_child_foreach(container, query_one_iothread, &prev);
     return head;
 }
+
+AioContextStatsInfo *qmp_query_main_loop_stats(Error **errp)
+{
+    return aio_context_stats_info(qemu_get_aio_context());
+}
@@ -22,6 +22,7 @@
 
 #include "qemu-common.h"
 #include "qemu/atomic.h"
+#include "qemu/thread.h"
 #include "qemu/option.h"
 #include "qemu/config-file.h"
 #include "sysemu/sysemu.h"
@@ -59,12 +60,15 @@
 #endif
 
 #define KVM_MSI_HASHTAB_SIZE    256
+/* Most routes kept for kvm_irqchip_send_msi() without KVM_CAP_SIGNAL_MSI */
+#define KVM_MSI_ROUTE_CACHE_SIZE 256
 
 typedef struct KVMSlot
 {
     hwaddr start_addr;
     ram_addr_t memory_size;
     void *ram;
+    ram_addr_t ram_offset;
     int slot;
     int flags;
 } KVMSlot;
@@ -80,6 +84,7 @@ struct KVMState
     int fd;
     int vmfd;
     int coalesced_mmio;
+    bool coalesced_pio;
     struct kvm_coalesced_mmio_ring *coalesced_mmio_ring;
     bool coalesced_flush_in_progress;
     int broken_set_mem_region;
@@ -94,6 +99,10 @@ struct KVMState
     int xsave, xcrs;
     int many_ioeventfds;
     int intx_set_mask;
+    bool manual_dirty_log_protect;
+    /* Entries in each vCPU's dirty ring, 0 if dirty bitmaps are used */
+    uint32_t dirty_ring_size;
+    QemuThread dirty_ring_reaper;
     /* The man page (and posix) say ioctl numbers are signed int, but
      * they're not.  Linux, glibc and *BSD all treat ioctl numbers as
      * unsigned, and treating them as signed here can break things */
@@ -105,8 +114,13 @@ struct KVMState
     uint32_t *used_gsi_bitmap;
     unsigned int gsi_count;
     QTAILQ_HEAD(msi_hashtab, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
+    /* Dynamic MSI routes, least recently used first */
+    QTAILQ_HEAD(msi_lru, KVMMSIRoute) msi_lru;
+    unsigned int nr_msi_routes;
     bool direct_msi;
 #endif
+    int irq_routes_batch;
+    bool irq_routes_changed;
 };
 
 #define TYPE_KVM_ACCEL ACCEL_CLASS_NAME("kvm")
@@ -284,6 +298,20 @@ int kvm_init_vcpu(CPUState *cpu)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+    if (s->dirty_ring_size) {
+        cpu->kvm_dirty_gfns = mmap(NULL,
+                                   s->dirty_ring_size *
+                                   sizeof(struct kvm_dirty_gfn),
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   getpagesize() * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            ret = -errno;
+            DPRINTF("mmap'ing vcpu dirty ring failed\n");
+            goto err;
+        }
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
 err:
     return ret;
@@ -390,15 +418,145 @@ static int kvm_set_migration_log(int enable)
     return 0;
 }
 
-/* get kvm's dirty pages bitmap and update qemu's */
+/* Dirty bitmaps are processed, and with manual dirty log protection
+ * re-protected, in chunks of this many pages.  Must be a multiple of 64.
+ */
+#define KVM_DIRTY_LOG_CHUNK_PAGES  (1UL << 18)
+
+/* get kvm's dirty pages bitmap and update qemu's, one chunk at a time.
+ * Chunks without dirty pages are skipped after a scan of the bitmap words,
+ * and with manual protection only chunks that were dirty are cleared (and
+ * thus write-protected again) in the kernel.
+ */
 static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
+                                         KVMSlot *mem,
                                          unsigned long *bitmap)
 {
+    KVMState *s = kvm_state;
     ram_addr_t start = section->offset_within_region + section->mr->ram_addr;
     ram_addr_t pages = int128_get64(section->size) / getpagesize();
+    ram_addr_t first, n;
+    int ret = 0;
 
-    cpu_physical_memory_set_dirty_lebitmap(bitmap, start, pages);
-    return 0;
+    for (first = 0; first < pages; first += n) {
+        unsigned long *chunk = bitmap + first / BITS_PER_LONG;
+
+        n = MIN(KVM_DIRTY_LOG_CHUNK_PAGES, pages - first);
+        if (find_next_bit(bitmap, first + n, first) >= first + n) {
+            continue;
+        }
+
+        cpu_physical_memory_set_dirty_lebitmap(chunk,
+                                               start + first * getpagesize(),
+                                               n);
+
+        if (s->manual_dirty_log_protect) {
+            struct kvm_clear_dirty_log d = {
+                .slot = mem->slot,
+                .num_pages = n,
+                .first_page = first,
+                .dirty_bitmap = chunk,
+            };
+
+            if (kvm_vm_ioctl(s, KVM_CLEAR_DIRTY_LOG, &d) < 0) {
+                DPRINTF("KVM_CLEAR_DIRTY_LOG failed %d\n", errno);
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+/*
+ * Dirty rings: instead of a bitmap per slot, KVM pushes the address of
+ * every page a vCPU dirties to a ring shared with that vCPU's thread.
+ * Collecting them costs one entry per dirtied page, however big the
+ * guest is.  Rings are collected with the iothread lock held, which
+ * also keeps the slot table stable.
+ */
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t slot_id,
+                                     uint64_t offset)
+{
+    KVMSlot *mem;
+
+    /* Only address space 0 (bits 16 and up of slot_id) is used */
+    if (slot_id >= s->nr_slots) {
+        return;
+    }
+    mem = &s->slots[slot_id];
+    if (offset >= mem->memory_size / getpagesize()) {
+        return;
+    }
+    cpu_physical_memory_set_dirty_range(mem->ram_offset +
+                                        offset * getpagesize(),
+                                        getpagesize());
+}
+
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *gfn;
+    uint32_t fetch = cpu->kvm_fetch_index;
+    uint32_t count = 0;
+
+    for (;;) {
+        gfn = &cpu->kvm_dirty_gfns[fetch & (s->dirty_ring_size - 1)];
+        if (atomic_mb_read(&gfn->flags) != KVM_DIRTY_GFN_F_DIRTY) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, gfn->slot, gfn->offset);
+        atomic_mb_set(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
+        fetch++;
+        count++;
+    }
+    cpu->kvm_fetch_index = fetch;
+    return count;
+}
+
+/* Collect the dirty rings of @cpu, or of all vCPUs if @cpu is NULL, and
+ * let KVM reuse the collected entries.  Needs the iothread lock.
+ */
+static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
+{
+    uint64_t total = 0;
+    int ret;
+
+    if (cpu) {
+        total = kvm_dirty_ring_reap_one(s, cpu);
+    } else {
+        CPU_FOREACH(cpu) {
+            if (cpu->kvm_dirty_gfns) {
+                total += kvm_dirty_ring_reap_one(s, cpu);
+            }
+        }
+    }
+
+    if (total) {
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        if (ret < 0) {
+            fprintf(stderr, "KVM_RESET_DIRTY_RINGS failed: %s\n",
+                    strerror(-ret));
+            abort();
+        }
+    }
+    trace_kvm_dirty_ring_reap(total);
+    return total;
+}
+
+/* Empty the rings in the background, so that vCPUs seldom fill them up
+ * and exit to userspace, and so that a dirty log sync finds little left.
+ */
+static void *kvm_dirty_ring_reaper_thread(void *opaque)
+{
+    KVMState *s = opaque;
+
+    for (;;) {
+        g_usleep(G_USEC_PER_SEC);
+
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s, NULL);
+        qemu_mutex_unlock_iothread();
+    }
+    return NULL;
 }
 
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
@@ -459,7 +617,9 @@ static int kvm_physical_sync_dirty_bitmap(MemoryRegionSection *section)
             break;
         }
 
-        kvm_get_dirty_pages_log_range(section, d.dirty_bitmap);
+        if (kvm_get_dirty_pages_log_range(section, mem, d.dirty_bitmap) < 0) {
+            ret = -1;
+        }
         start_addr = mem->start_addr + mem->memory_size;
     }
     g_free(d.dirty_bitmap);
@@ -501,6 +661,43 @@ static void kvm_uncoalesce_mmio_region(MemoryListener *listener,
     }
 }
 
+/* PIO writes to coalesced port ranges go to the same ring as MMIO ones,
+ * tagged with pio = 1, and are replayed in order with them.
+ */
+static void kvm_coalesce_pio_add(MemoryListener *listener,
+                                 MemoryRegionSection *section,
+                                 hwaddr start, hwaddr size)
+{
+    KVMState *s = kvm_state;
+
+    if (s->coalesced_pio) {
+        struct kvm_coalesced_mmio_zone zone;
+
+        zone.addr = start;
+        zone.size = size;
+        zone.pio = 1;
+
+        (void)kvm_vm_ioctl(s, KVM_REGISTER_COALESCED_MMIO, &zone);
+    }
+}
+
+static void kvm_coalesce_pio_del(MemoryListener *listener,
+                                 MemoryRegionSection *section,
+                                 hwaddr start, hwaddr size)
+{
+    KVMState *s = kvm_state;
+
+    if (s->coalesced_pio) {
+        struct kvm_coalesced_mmio_zone zone;
+
+        zone.addr = start;
+        zone.size = size;
+        zone.pio = 1;
+
+        (void)kvm_vm_ioctl(s, KVM_UNREGISTER_COALESCED_MMIO, &zone);
+    }
+}
+
 int kvm_check_extension(KVMState *s, unsigned int extension)
 {
     int ret;
@@ -647,6 +844,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
     hwaddr start_addr = section->offset_within_address_space;
     ram_addr_t size = int128_get64(section->size);
     void *ram = NULL;
+    ram_addr_t ram_offset;
     unsigned delta;
 
     /* kvm works in page size chunks, but the function may be called
@@ -675,6 +873,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
     }
 
     ram = memory_region_get_ram_ptr(mr) + section->offset_within_region + delta;
+    ram_offset = mr->ram_addr + section->offset_within_region + delta;
 
     while (1) {
         mem = kvm_lookup_overlapping_slot(s, start_addr, start_addr + size);
@@ -694,7 +893,11 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
         old = *mem;
 
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_physical_sync_dirty_bitmap(section);
+            if (s->dirty_ring_size) {
+                kvm_dirty_ring_reap(s, NULL);
+            } else {
+                kvm_physical_sync_dirty_bitmap(section);
+            }
         }
 
         /* unregister the overlapping slot */
@@ -720,6 +923,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             mem->memory_size = old.memory_size;
             mem->start_addr = old.start_addr;
             mem->ram = old.ram;
+            mem->ram_offset = old.ram_offset;
             mem->flags = kvm_mem_flags(s, log_dirty, readonly_flag);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -731,6 +935,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
 
             start_addr += old.memory_size;
             ram += old.memory_size;
+            ram_offset += old.memory_size;
             size -= old.memory_size;
             continue;
         }
@@ -741,6 +946,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             mem->memory_size = start_addr - old.start_addr;
             mem->start_addr = old.start_addr;
             mem->ram = old.ram;
+            mem->ram_offset = old.ram_offset;
             mem->flags =  kvm_mem_flags(s, log_dirty, readonly_flag);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -765,6 +971,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
             size_delta = mem->start_addr - old.start_addr;
             mem->memory_size = old.memory_size - size_delta;
             mem->ram = old.ram + size_delta;
+            mem->ram_offset = old.ram_offset + size_delta;
             mem->flags = kvm_mem_flags(s, log_dirty, readonly_flag);
 
             err = kvm_set_user_memory_region(s, mem);
@@ -787,6 +994,7 @@ static void kvm_set_phys_mem(MemoryRegionSection *section, bool add)
     mem->memory_size = size;
     mem->start_addr = start_addr;
     mem->ram = ram;
+    mem->ram_offset = ram_offset;
     mem->flags = kvm_mem_flags(s, log_dirty, readonly_flag);
 
     err = kvm_set_user_memory_region(s, mem);
@@ -816,6 +1024,14 @@ static void kvm_log_sync(MemoryListener *listener,
 {
     int r;
 
+    /* Rings are not per section; collecting all of them is cheap when
+     * they are empty, as they will be for every section but the first.
+     */
+    if (kvm_state->dirty_ring_size) {
+        kvm_dirty_ring_reap(kvm_state, NULL);
+        return;
+    }
+
     r = kvm_physical_sync_dirty_bitmap(section);
     if (r < 0) {
         abort();
@@ -925,6 +1141,8 @@ static MemoryListener kvm_memory_listener = {
 static MemoryListener kvm_io_listener = {
     .eventfd_add = kvm_io_ioeventfd_add,
     .eventfd_del = kvm_io_ioeventfd_del,
+    .coalesced_mmio_add = kvm_coalesce_pio_add,
+    .coalesced_mmio_del = kvm_coalesce_pio_del,
     .priority = 10,
 };
 
@@ -959,6 +1177,7 @@ int kvm_set_irq(KVMState *s, int irq, int level)
 typedef struct KVMMSIRoute {
     struct kvm_irq_routing_entry kroute;
     QTAILQ_ENTRY(KVMMSIRoute) entry;
+    QTAILQ_ENTRY(KVMMSIRoute) lru;
 } KVMMSIRoute;
 
 static void set_gsi(KVMState *s, unsigned int gsi)
@@ -997,6 +1216,7 @@ void kvm_init_irq_routing(KVMState *s)
         for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
             QTAILQ_INIT(&s->msi_hashtab[i]);
         }
+        QTAILQ_INIT(&s->msi_lru);
     }
 
     kvm_arch_init_irq_routing(s);
@@ -1009,6 +1229,42 @@ void kvm_irqchip_commit_routes(KVMState *s)
     s->irq_routes->flags = 0;
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_routes_changed = false;
+}
+
+/*
+ * KVM_SET_GSI_ROUTING rewrites the whole routing table.  Between
+ * kvm_irqchip_begin_route_changes() and kvm_irqchip_end_route_changes(),
+ * routes added or updated with kvm_irqchip_add_msi_route() and
+ * kvm_irqchip_update_msi_route() are committed once at the end instead of
+ * one by one.  They must not be used for injection until then.
+ */
+void kvm_irqchip_begin_route_changes(KVMState *s)
+{
+    if (!kvm_gsi_routing_enabled()) {
+        return;
+    }
+    s->irq_routes_batch++;
+}
+
+void kvm_irqchip_end_route_changes(KVMState *s)
+{
+    if (!kvm_gsi_routing_enabled()) {
+        return;
+    }
+    assert(s->irq_routes_batch > 0);
+    if (--s->irq_routes_batch == 0 && s->irq_routes_changed) {
+        kvm_irqchip_commit_routes(s);
+    }
+}
+
+static void kvm_irqchip_routes_changed(KVMState *s)
+{
+    if (s->irq_routes_batch) {
+        s->irq_routes_changed = true;
+    } else {
+        kvm_irqchip_commit_routes(s);
+    }
 }
 
 static void kvm_add_routing_entry(KVMState *s,
@@ -1053,7 +1309,7 @@ static int kvm_update_routing_entry(KVMState *s,
 
         *entry = *new_entry;
 
-        kvm_irqchip_commit_routes(s);
+        kvm_irqchip_routes_changed(s);
 
         return 0;
     }
@@ -1101,18 +1357,25 @@ static unsigned int kvm_hash_msi(uint32_t data)
     return data & 0xff;
 }
 
-static void kvm_flush_dynamic_msi_routes(KVMState *s)
+/* Drop the least recently used dynamic MSI route and free its GSI.  The
+ * caller commits the routing table, usually together with the route that
+ * takes the GSI over.
+ */
+static bool kvm_evict_msi_route(KVMState *s)
 {
-    KVMMSIRoute *route, *next;
+    KVMMSIRoute *route = QTAILQ_FIRST(&s->msi_lru);
     unsigned int hash;
 
-    for (hash = 0; hash < KVM_MSI_HASHTAB_SIZE; hash++) {
-        QTAILQ_FOREACH_SAFE(route, &s->msi_hashtab[hash], entry, next) {
-            kvm_irqchip_release_virq(s, route->kroute.gsi);
-            QTAILQ_REMOVE(&s->msi_hashtab[hash], route, entry);
-            g_free(route);
-        }
+    if (!route) {
+        return false;
     }
+    kvm_irqchip_release_virq(s, route->kroute.gsi);
+    hash = kvm_hash_msi(cpu_to_le32(route->kroute.u.msi.data));
+    QTAILQ_REMOVE(&s->msi_hashtab[hash], route, entry);
+    QTAILQ_REMOVE(&s->msi_lru, route, lru);
+    s->nr_msi_routes--;
+    g_free(route);
+    return true;
 }
 
 static int kvm_irqchip_get_virq(KVMState *s)
@@ -1120,7 +1383,6 @@ static int kvm_irqchip_get_virq(KVMState *s)
     uint32_t *word = s->used_gsi_bitmap;
     int max_words = ALIGN(s->gsi_count, 32) / 32;
     int i, bit;
-    bool retry = true;
 
 again:
     /* Return the lowest unused GSI in the bitmap */
@@ -1132,9 +1394,7 @@ again:
 
         return bit - 1 + i * 32;
     }
-    if (!s->direct_msi && retry) {
-        retry = false;
-        kvm_flush_dynamic_msi_routes(s);
+    if (!s->direct_msi && kvm_evict_msi_route(s)) {
         goto again;
     }
     return -ENOSPC;
@@ -1172,9 +1432,14 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
     }
 
     route = kvm_lookup_msi_route(s, msg);
-    if (!route) {
+    if (route) {
+        QTAILQ_REMOVE(&s->msi_lru, route, lru);
+    } else {
         int virq;
 
+        if (s->nr_msi_routes >= KVM_MSI_ROUTE_CACHE_SIZE) {
+            kvm_evict_msi_route(s);
+        }
         virq = kvm_irqchip_get_virq(s);
         if (virq < 0) {
             return virq;
@@ -1193,7 +1458,9 @@ int kvm_irqchip_send_msi(KVMState *s, MSIMessage msg)
 
         QTAILQ_INSERT_TAIL(&s->msi_hashtab[kvm_hash_msi(msg.data)], route,
                            entry);
+        s->nr_msi_routes++;
     }
+    QTAILQ_INSERT_TAIL(&s->msi_lru, route, lru);
 
     assert(route->kroute.type == KVM_IRQ_ROUTING_MSI);
 
@@ -1226,7 +1493,7 @@ int kvm_irqchip_add_msi_route(KVMState *s, MSIMessage msg)
     kroute.u.msi.data = le32_to_cpu(msg.data);
 
     kvm_add_routing_entry(s, &kroute);
-    kvm_irqchip_commit_routes(s);
+    kvm_irqchip_routes_changed(s);
 
     return virq;
 }
@@ -1337,6 +1604,14 @@ int kvm_irqchip_update_msi_route(KVMState *s, int virq, MSIMessage msg)
 {
     return -ENOSYS;
 }
+
+void kvm_irqchip_begin_route_changes(KVMState *s)
+{
+}
+
+void kvm_irqchip_end_route_changes(KVMState *s)
+{
+}
 #endif /* !KVM_CAP_IRQ_ROUTING */
 
 int kvm_irqchip_add_irqfd_notifier(KVMState *s, EventNotifier *n,
@@ -1535,6 +1810,8 @@ static int kvm_init(MachineState *ms)
     }
 
     s->coalesced_mmio = kvm_check_extension(s, KVM_CAP_COALESCED_MMIO);
+    s->coalesced_pio = s->coalesced_mmio &&
+                       kvm_check_extension(s, KVM_CAP_COALESCED_PIO) > 0;
 
     s->broken_set_mem_region = 1;
     ret = kvm_check_extension(s, KVM_CAP_JOIN_MEMORY_REGIONS_WORKS);
@@ -1584,6 +1861,44 @@ static int kvm_init(MachineState *ms)
     kvm_eventfds_allowed =
         (kvm_check_extension(s, KVM_CAP_IOEVENTFD) > 0);
 
+    /* Dirty rings must be enabled before any vCPU is created */
+    if (ms->kvm_dirty_ring_size) {
+        uint64_t ring_bytes = (uint64_t)ms->kvm_dirty_ring_size *
+                              sizeof(struct kvm_dirty_gfn);
+        int max_bytes = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+
+        if (max_bytes <= 0) {
+            fprintf(stderr, "KVM dirty ring not supported by the host kernel, "
+                    "using dirty bitmaps\n");
+        } else if (ring_bytes < getpagesize() || ring_bytes > max_bytes) {
+            fprintf(stderr, "kvm-dirty-ring-size must be between %zu and %zu\n",
+                    getpagesize() / sizeof(struct kvm_dirty_gfn),
+                    max_bytes / sizeof(struct kvm_dirty_gfn));
+            ret = -EINVAL;
+            goto err;
+        } else {
+            ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+            if (ret < 0) {
+                fprintf(stderr, "Enabling the KVM dirty ring failed: %s\n",
+                        strerror(-ret));
+                goto err;
+            }
+            s->dirty_ring_size = ms->kvm_dirty_ring_size;
+        }
+    }
+
+    /* With manual protection KVM_GET_DIRTY_LOG neither clears the bitmap
+     * nor write-protects the whole slot; kvm_get_dirty_pages_log_range
+     * does that for the chunks that were actually dirty.
+     */
+    if (!s->dirty_ring_size &&
+        (kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2) &
+         KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE)) {
+        s->manual_dirty_log_protect =
+            kvm_vm_enable_cap(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2, 0,
+                              KVM_DIRTY_LOG_MANUAL_PROTECT_ENABLE) == 0;
+    }
+
     ret = kvm_arch_init(s);
     if (ret < 0) {
         goto err;
@@ -1600,6 +1915,12 @@ static int kvm_init(MachineState *ms)
 
     s->many_ioeventfds = kvm_check_many_ioeventfds();
 
+    if (s->dirty_ring_size) {
+        qemu_thread_create(&s->dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     cpu_interrupt_handler = kvm_handle_interrupt;
 
     return 0;
@@ -1678,7 +1999,12 @@ void kvm_flush_coalesced_mmio_buffer(void)
 
             ent = &ring->coalesced_mmio[ring->first];
 
-            cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
+            if (ent->pio == 1) {
+                address_space_rw(&address_space_io, ent->phys_addr,
+                                 ent->data, ent->len, true);
+            } else {
+                cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
+            }
             smp_wmb();
             ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
         }
@@ -1739,6 +2065,7 @@ int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
     int ret, run_ret;
+    bool unlocked;
 
     DPRINTF("kvm_cpu_exec()\n");
 
@@ -1767,9 +2094,18 @@ int kvm_cpu_exec(CPUState *cpu)
 
         run_ret = kvm_vcpu_ioctl(cpu, KVM_RUN, 0);
 
-        qemu_mutex_lock_iothread();
         kvm_arch_post_run(cpu, run);
 
+        /* PIO and MMIO exits are dispatched without the BQL; address_space_rw
+         * takes it for the regions that still need it.  Everything else is
+         * handled under the BQL.
+         */
+        unlocked = run_ret >= 0 && (run->exit_reason == KVM_EXIT_IO ||
+                                    run->exit_reason == KVM_EXIT_MMIO);
+        if (!unlocked) {
+            qemu_mutex_lock_iothread();
+        }
+
         if (run_ret < 0) {
             if (run_ret == -EINTR || run_ret == -EAGAIN) {
                 DPRINTF("io window exit\n");
@@ -1805,6 +2141,14 @@ int kvm_cpu_exec(CPUState *cpu)
             DPRINTF("irq_window_open\n");
             ret = EXCP_INTERRUPT;
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /* KVM stops the vCPU a little before the ring is really full;
+             * collect it and go back in.
+             */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            kvm_dirty_ring_reap(cpu->kvm_state, cpu);
+            ret = 0;
+            break;
         case KVM_EXIT_SHUTDOWN:
             DPRINTF("shutdown\n");
             qemu_system_reset_request();
@@ -1839,6 +2183,10 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = kvm_arch_handle_exit(cpu, run);
             break;
         }
+
+        if (unlocked) {
+            qemu_mutex_lock_iothread();
+        }
     } while (ret == 0);
 
     if (ret < 0) {
@@ -3626,6 +3626,21 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_hot_threshold(const char *arg)
+{
+    tcg_tb_hot_threshold = strtoul(arg, NULL, 0);
+}
+
+static void handle_arg_perfmap(const char *arg)
+{
+    tcg_perf_map = true;
+}
+
+static void handle_arg_jitdump(const char *arg)
+{
+    tcg_jitdump = true;
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3681,6 +3696,12 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"hot",        "QEMU_TCG_HOT",     true,  handle_arg_hot_threshold,
+     "count",      "retranslate blocks as superblocks after 'count' runs"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "write /tmp/perf-<pid>.map for translated code"},
+    {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
+     "",           "write /tmp/jit-<pid>.dump for translated code"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_randseed,
@@ -1883,6 +1883,7 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
 static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
                          int count, int copy)
 {
+#ifdef DEBUG_REMAP
     struct target_iovec *target_vec;
     int i;
 
@@ -1899,7 +1900,9 @@ static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
         }
         unlock_user(target_vec, target_addr, 0);
     }
-
+#endif
+    /* Otherwise lock_iovec() pointed straight into guest memory and
+       there is nothing to write back.  */
     free(vec);
 }
 
@@ -5494,6 +5497,15 @@ static target_timer_t get_timer_id(abi_long arg)
     return timerid;
 }
 
+/* -d tb_stats: report how the translation cache and tb_lock fared */
+static void log_tb_stats(void)
+{
+    if (qemu_loglevel_mask(CPU_LOG_TB_STATS)) {
+        dump_exec_info(qemu_logfile, fprintf);
+        qemu_log_flush();
+    }
+}
+
 /* do_syscall() should always have a single exit point at the end so
    that actions, such as logging of syscall results, can be performed.
    All errnos that do_syscall() returns must be -TARGET_<errcode>. */
@@ -5543,6 +5555,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_GPROF
         _mcleanup();
 #endif
+        log_tb_stats();
         gdb_exit(cpu_env, arg1);
         _exit(arg1);
         ret = 0; /* avoid warning */
@@ -7404,6 +7417,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 #ifdef TARGET_GPROF
         _mcleanup();
 #endif
+        log_tb_stats();
         gdb_exit(cpu_env, arg1);
         ret = get_errno(exit_group(arg1));
         break;
@@ -18,6 +18,7 @@
 #include "exec/ioport.h"
 #include "qapi/visitor.h"
 #include "qemu/bitops.h"
+#include "qemu/rcu.h"
 #include "qom/object.h"
 #include "trace.h"
 #include <assert.h>
@@ -32,15 +33,8 @@ static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
 static bool global_dirty_log = false;
-
-/* flat_view_mutex is taken around reading as->current_map; the critical
- * section is extremely short, so I'm using a single mutex for every AS.
- * We could also RCU for the read-side.
- *
- * The BQL is taken around transaction commits, hence both locks are taken
- * while writing to as->current_map (with the BQL taken outside).
- */
-static QemuMutex flat_view_mutex;
+/* See memory_region_topology_gen(); 0 is never a valid generation */
+static unsigned int topology_gen = 1;
 
 static QTAILQ_HEAD(memory_listeners, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
@@ -48,11 +42,6 @@ static QTAILQ_HEAD(memory_listeners, MemoryListener) memory_listeners
 static QTAILQ_HEAD(, AddressSpace) address_spaces
     = QTAILQ_HEAD_INITIALIZER(address_spaces);
 
-static void memory_init(void)
-{
-    qemu_mutex_init(&flat_view_mutex);
-}
-
 typedef struct AddrRange AddrRange;
 
 /*
@@ -239,9 +228,12 @@ struct FlatRange {
 };
 
 /* Flattened global view of current active memory hierarchy.  Kept in sorted
- * order.
+ * order.  A view can be shared by several address spaces that render to the
+ * same root.  as->current_map is read under rcu_read_lock(); the view is
+ * freed a grace period after its last reference goes away.
  */
 struct FlatView {
+    struct rcu_head rcu;
     unsigned ref;
     FlatRange *ranges;
     unsigned nr;
@@ -303,11 +295,42 @@ static void flatview_ref(FlatView *view)
     atomic_inc(&view->ref);
 }
 
+/* Like flatview_ref, but fails if the view is already on its way out. */
+static bool flatview_tryref(FlatView *view)
+{
+    unsigned ref = atomic_read(&view->ref);
+
+    while (ref) {
+        unsigned old = atomic_cmpxchg(&view->ref, ref, ref + 1);
+        if (old == ref) {
+            return true;
+        }
+        ref = old;
+    }
+    return false;
+}
+
 static void flatview_unref(FlatView *view)
 {
     if (atomic_fetch_dec(&view->ref) == 1) {
-        flatview_destroy(view);
+        call_rcu(view, flatview_destroy, rcu);
+    }
+}
+
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i])
+            || a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
     }
+    return true;
 }
 
 static bool can_merge(FlatRange *r1, FlatRange *r2)
@@ -584,6 +607,24 @@ static void render_memory_region(FlatView *view,
     }
 }
 
+/* An enabled alias that maps the whole of its target at the same address
+ * renders exactly like the target.  Per-device address spaces (for example
+ * PCI bus master address spaces) are rooted at such aliases; skipping them
+ * lets all those address spaces share one FlatView.
+ */
+static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
+{
+    while (mr && mr->enabled && mr->alias
+           && !mr->alias_offset
+           && !mr->readonly
+           && mr->addr == mr->alias->addr
+           && int128_ge(mr->size, mr->alias->size)
+           && QTAILQ_EMPTY(&mr->subregions)) {
+        mr = mr->alias;
+    }
+    return mr;
+}
+
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
@@ -654,10 +695,11 @@ static FlatView *address_space_get_flatview(AddressSpace *as)
 {
     FlatView *view;
 
-    qemu_mutex_lock(&flat_view_mutex);
-    view = as->current_map;
-    flatview_ref(view);
-    qemu_mutex_unlock(&flat_view_mutex);
+    rcu_read_lock();
+    do {
+        view = atomic_rcu_read(&as->current_map);
+    } while (!flatview_tryref(view));
+    rcu_read_unlock();
     return view;
 }
 
@@ -695,6 +737,47 @@ static void address_space_update_ioeventfds(AddressSpace *as)
     flatview_unref(view);
 }
 
+static void flat_range_coalesced_io_del(FlatRange *fr, AddressSpace *as)
+{
+    MemoryRegionSection section = {
+        .mr = fr->mr,
+        .address_space = as,
+        .offset_within_region = fr->offset_in_region,
+        .offset_within_address_space = int128_get64(fr->addr.start),
+        .size = fr->addr.size,
+    };
+
+    MEMORY_LISTENER_CALL(coalesced_mmio_del, Reverse, &section,
+                         int128_get64(fr->addr.start),
+                         int128_get64(fr->addr.size));
+}
+
+static void flat_range_coalesced_io_add(FlatRange *fr, AddressSpace *as)
+{
+    MemoryRegionSection section = {
+        .mr = fr->mr,
+        .address_space = as,
+        .offset_within_region = fr->offset_in_region,
+        .offset_within_address_space = int128_get64(fr->addr.start),
+        .size = fr->addr.size,
+    };
+    CoalescedMemoryRange *cmr;
+    AddrRange tmp;
+
+    QTAILQ_FOREACH(cmr, &fr->mr->coalesced, link) {
+        tmp = addrrange_shift(cmr->addr,
+                              int128_sub(fr->addr.start,
+                                         int128_make64(fr->offset_in_region)));
+        if (!addrrange_intersects(tmp, fr->addr)) {
+            continue;
+        }
+        tmp = addrrange_intersection(tmp, fr->addr);
+        MEMORY_LISTENER_CALL(coalesced_mmio_add, Forward, &section,
+                             int128_get64(tmp.start),
+                             int128_get64(tmp.size));
+    }
+}
+
 static void address_space_update_topology_pass(AddressSpace *as,
                                                const FlatView *old_view,
                                                const FlatView *new_view,
@@ -727,6 +810,9 @@ static void address_space_update_topology_pass(AddressSpace *as,
             /* In old but not in new, or in both but attributes changed. */
 
             if (!adding) {
+                if (!QTAILQ_EMPTY(&frold->mr->coalesced)) {
+                    flat_range_coalesced_io_del(frold, as);
+                }
                 MEMORY_LISTENER_UPDATE_REGION(frold, as, Reverse, region_del);
             }
 
@@ -750,6 +836,7 @@ static void address_space_update_topology_pass(AddressSpace *as,
 
             if (adding) {
                 MEMORY_LISTENER_UPDATE_REGION(frnew, as, Forward, region_add);
+                flat_range_coalesced_io_add(frnew, as);
             }
 
             ++inew;
@@ -758,18 +845,40 @@ static void address_space_update_topology_pass(AddressSpace *as,
 }
 
 
-static void address_space_update_topology(AddressSpace *as)
+/* @views caches the FlatViews rendered during this commit, keyed by root,
+ * so that address spaces with the same root are rendered only once.
+ */
+static void address_space_update_topology(AddressSpace *as, GHashTable *views)
 {
+    MemoryRegion *root = memory_region_get_flatview_root(as->root);
     FlatView *old_view = address_space_get_flatview(as);
-    FlatView *new_view = generate_memory_topology(as->root);
+    FlatView *new_view = g_hash_table_lookup(views, root);
+    bool changed;
+
+    if (!new_view) {
+        new_view = generate_memory_topology(root);
+        g_hash_table_insert(views, root, new_view);
+    }
+
+    /* Keep the old view if nothing changed, so that address spaces that
+     * already share it keep doing so and readers see no update at all.
+     */
+    changed = !flatview_equal(old_view, new_view);
+    if (!changed) {
+        new_view = old_view;
+    }
 
     address_space_update_topology_pass(as, old_view, new_view, false);
     address_space_update_topology_pass(as, old_view, new_view, true);
 
-    qemu_mutex_lock(&flat_view_mutex);
-    flatview_unref(as->current_map);
-    as->current_map = new_view;
-    qemu_mutex_unlock(&flat_view_mutex);
+    if (changed) {
+        /* Writes are protected by the BQL.  Readers that still use the old
+         * view hold a reference or are inside an RCU critical section.
+         */
+        flatview_ref(new_view);
+        atomic_rcu_set(&as->current_map, new_view);
+        flatview_unref(old_view);
+    }
 
     /* Note that all the old MemoryRegions are still alive up to this
      * point.  This relieves most MemoryListeners from the need to
@@ -779,7 +888,9 @@ static void address_space_update_topology(AddressSpace *as)
      */
     flatview_unref(old_view);
 
-    address_space_update_ioeventfds(as);
+    if (changed || ioeventfd_update_pending) {
+        address_space_update_ioeventfds(as);
+    }
 }
 
 void memory_region_transaction_begin(void)
@@ -794,6 +905,11 @@ static void memory_region_clear_pending(void)
     ioeventfd_update_pending = false;
 }
 
+unsigned int memory_region_topology_gen(void)
+{
+    return atomic_read(&topology_gen);
+}
+
 void memory_region_transaction_commit(void)
 {
     AddressSpace *as;
@@ -802,13 +918,19 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            GHashTable *views;
+
+            views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                          (GDestroyNotify)flatview_unref);
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_update_topology(as);
+                address_space_update_topology(as, views);
             }
 
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+            g_hash_table_destroy(views);
+            atomic_inc(&topology_gen);
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -967,6 +1089,7 @@ static void memory_region_initfn(Object *obj)
     mr->ops = &unassigned_mem_ops;
     mr->enabled = true;
     mr->romd_mode = true;
+    mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
@@ -1152,6 +1275,33 @@ void memory_region_init_ram(MemoryRegion *mr,
     mr->ram_addr = qemu_ram_alloc(size, mr, errp);
 }
 
+void memory_region_init_ram_hugetlb(MemoryRegion *mr,
+                                    Object *owner,
+                                    const char *name,
+                                    uint64_t size,
+                                    Error **errp)
+{
+    memory_region_init(mr, owner, name, size);
+    mr->ram = true;
+    mr->terminates = true;
+    mr->destructor = memory_region_destructor_ram;
+    mr->ram_addr = qemu_ram_alloc_hugetlb(size, mr, errp);
+}
+
+void memory_region_init_ram_rom_file(MemoryRegion *mr,
+                                     Object *owner,
+                                     const char *name,
+                                     uint64_t size,
+                                     const char *path,
+                                     Error **errp)
+{
+    memory_region_init(mr, owner, name, size);
+    mr->ram = true;
+    mr->terminates = true;
+    mr->destructor = memory_region_destructor_ram;
+    mr->ram_addr = qemu_ram_alloc_rom_file(size, path, mr, errp);
+}
+
 #ifdef __linux__
 void memory_region_init_ram_from_file(MemoryRegion *mr,
                                       struct Object *owner,
@@ -1454,34 +1604,12 @@ static void memory_region_update_coalesced_range_as(MemoryRegion *mr, AddressSpa
 {
     FlatView *view;
     FlatRange *fr;
-    CoalescedMemoryRange *cmr;
-    AddrRange tmp;
-    MemoryRegionSection section;
 
     view = address_space_get_flatview(as);
     FOR_EACH_FLAT_RANGE(fr, view) {
         if (fr->mr == mr) {
-            section = (MemoryRegionSection) {
-                .address_space = as,
-                .offset_within_address_space = int128_get64(fr->addr.start),
-                .size = fr->addr.size,
-            };
-
-            MEMORY_LISTENER_CALL(coalesced_mmio_del, Reverse, &section,
-                                 int128_get64(fr->addr.start),
-                                 int128_get64(fr->addr.size));
-            QTAILQ_FOREACH(cmr, &mr->coalesced, link) {
-                tmp = addrrange_shift(cmr->addr,
-                                      int128_sub(fr->addr.start,
-                                                 int128_make64(fr->offset_in_region)));
-                if (!addrrange_intersects(tmp, fr->addr)) {
-                    continue;
-                }
-                tmp = addrrange_intersection(tmp, fr->addr);
-                MEMORY_LISTENER_CALL(coalesced_mmio_add, Forward, &section,
-                                     int128_get64(tmp.start),
-                                     int128_get64(tmp.size));
-            }
+            flat_range_coalesced_io_del(fr, as);
+            flat_range_coalesced_io_add(fr, as);
         }
     }
     flatview_unref(view);
@@ -1547,6 +1675,16 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_set_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = true;
+}
+
+void memory_region_clear_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = false;
+}
+
 void memory_region_add_eventfd(MemoryRegion *mr,
                                hwaddr addr,
                                unsigned size,
@@ -1925,10 +2063,6 @@ void memory_listener_unregister(MemoryListener *listener)
 
 void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 {
-    if (QTAILQ_EMPTY(&address_spaces)) {
-        memory_init();
-    }
-
     memory_region_transaction_begin();
     as->root = root;
     as->current_map = g_new(FlatView, 1);
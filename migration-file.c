@@ -0,0 +1,52 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * Unlike exec:cat and fd: pipes, the file is seekable, which lets
+ * migration lay out RAM at fixed offsets (the mapped-ram capability).
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "qemu/main-loop.h"
+#include "migration/migration.h"
+#include "migration/qemu-file.h"
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    int fd;
+
+    fd = qemu_open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, filename);
+        return;
+    }
+    s->file = qemu_fdopen(fd, "wb");
+
+    migrate_fd_connect(s);
+}
+
+static void file_accept_incoming_migration(void *opaque)
+{
+    QEMUFile *f = opaque;
+
+    qemu_set_fd_handler2(qemu_get_fd(f), NULL, NULL, NULL, NULL);
+    process_incoming_migration(f);
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    int fd;
+    QEMUFile *f;
+
+    fd = qemu_open(filename, O_RDONLY);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, filename);
+        return;
+    }
+    f = qemu_fdopen(fd, "rb");
+
+    qemu_set_fd_handler2(fd, NULL, file_accept_incoming_migration, NULL, f);
+}
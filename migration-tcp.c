@@ -33,24 +33,115 @@
     do { } while (0)
 #endif
 
+/* First bytes of a multifd connection: magic and channel number */
+#define MULTIFD_MAGIC 0x4d554c54 /* "MULT" */
+
+typedef struct TCPOutgoingArgs {
+    MigrationState *s;
+    char *host_port;
+} TCPOutgoingArgs;
+
+/* Main stream waiting for its multifd channels to connect */
+static QEMUFile *tcp_incoming_file;
+static int tcp_incoming_channels;
+
+/* Open the multifd channels once the main connection is up */
+static int tcp_connect_multifd_channels(const char *host_port, Error **errp)
+{
+    int count = migrate_multifd_channels();
+    int *fds = g_new(int, count);
+    int i, j;
+
+    for (i = 0; i < count; i++) {
+        uint32_t hdr[2] = { cpu_to_be32(MULTIFD_MAGIC), cpu_to_be32(i) };
+
+        fds[i] = inet_connect(host_port, errp);
+        if (fds[i] < 0) {
+            goto fail;
+        }
+        if (qemu_send_full(fds[i], hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+            error_setg_errno(errp, errno, "Failed to set up multifd channel");
+            closesocket(fds[i]);
+            goto fail;
+        }
+        DPRINTF("multifd channel %d connected\n", i);
+    }
+
+    multifd_save_setup(fds, count);
+    g_free(fds);
+    return 0;
+
+fail:
+    for (j = 0; j < i; j++) {
+        closesocket(fds[j]);
+    }
+    g_free(fds);
+    return -1;
+}
+
 static void tcp_wait_for_connect(int fd, Error *err, void *opaque)
 {
-    MigrationState *s = opaque;
+    TCPOutgoingArgs *args = opaque;
+    MigrationState *s = args->s;
+    Error *local_err = NULL;
 
     if (fd < 0) {
         DPRINTF("migrate connect error: %s\n", error_get_pretty(err));
         s->file = NULL;
         migrate_fd_error(s);
+    } else if (migrate_use_multifd() &&
+               tcp_connect_multifd_channels(args->host_port, &local_err) < 0) {
+        error_report("%s", error_get_pretty(local_err));
+        error_free(local_err);
+        closesocket(fd);
+        s->file = NULL;
+        migrate_fd_error(s);
     } else {
         DPRINTF("migrate connect success\n");
         s->file = qemu_fopen_socket(fd, "wb");
         migrate_fd_connect(s);
     }
+
+    g_free(args->host_port);
+    g_free(args);
 }
 
 void tcp_start_outgoing_migration(MigrationState *s, const char *host_port, Error **errp)
 {
-    inet_nonblocking_connect(host_port, tcp_wait_for_connect, s, errp);
+    TCPOutgoingArgs *args = g_new0(TCPOutgoingArgs, 1);
+
+    args->s = s;
+    args->host_port = g_strdup(host_port);
+    if (inet_nonblocking_connect(host_port, tcp_wait_for_connect, args,
+                                 errp) < 0) {
+        g_free(args->host_port);
+        g_free(args);
+    }
+}
+
+static int tcp_accept_multifd_channel(int c)
+{
+    uint32_t hdr[2];
+
+    qemu_set_block(c);
+    if (qemu_recv_full(c, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        be32_to_cpu(hdr[0]) != MULTIFD_MAGIC) {
+        error_report("invalid multifd channel header");
+        return -1;
+    }
+    if (multifd_load_add_channel(c, be32_to_cpu(hdr[1])) < 0) {
+        error_report("unexpected multifd channel %u", be32_to_cpu(hdr[1]));
+        return -1;
+    }
+
+    DPRINTF("accepted multifd channel %u\n", be32_to_cpu(hdr[1]));
+    return 0;
+}
+
+static void tcp_stop_listening(int s)
+{
+    qemu_set_fd_handler2(s, NULL, NULL, NULL, NULL);
+    closesocket(s);
 }
 
 static void tcp_accept_incoming_migration(void *opaque)
@@ -65,28 +156,56 @@ static void tcp_accept_incoming_migration(void *opaque)
         c = qemu_accept(s, (struct sockaddr *)&addr, &addrlen);
         err = socket_error();
     } while (c < 0 && err == EINTR);
-    qemu_set_fd_handler2(s, NULL, NULL, NULL, NULL);
-    closesocket(s);
-
-    DPRINTF("accepted migration\n");
 
     if (c < 0) {
         error_report("could not accept migration connection (%s)",
                      strerror(err));
+        goto fail;
+    }
+
+    if (tcp_incoming_file) {
+        if (tcp_accept_multifd_channel(c) < 0) {
+            closesocket(c);
+            goto fail;
+        }
+        if (--tcp_incoming_channels) {
+            return;
+        }
+        /* All channels are in, the stream may start */
+        tcp_stop_listening(s);
+        f = tcp_incoming_file;
+        tcp_incoming_file = NULL;
+        process_incoming_migration(f);
         return;
     }
 
+    DPRINTF("accepted migration\n");
+
     f = qemu_fopen_socket(c, "rb");
     if (f == NULL) {
         error_report("could not qemu_fopen socket");
-        goto out;
+        closesocket(c);
+        goto fail;
     }
 
+    if (migrate_use_multifd()) {
+        /* Keep listening for the channels, which follow right away */
+        tcp_incoming_file = f;
+        tcp_incoming_channels = migrate_multifd_channels();
+        return;
+    }
+
+    tcp_stop_listening(s);
     process_incoming_migration(f);
     return;
 
-out:
-    closesocket(c);
+fail:
+    tcp_stop_listening(s);
+    if (tcp_incoming_file) {
+        qemu_fclose(tcp_incoming_file);
+        tcp_incoming_file = NULL;
+        multifd_load_cleanup();
+    }
 }
 
 void tcp_start_incoming_migration(const char *host_port, Error **errp)
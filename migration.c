@@ -23,6 +23,7 @@
 #include "qemu/sockets.h"
 #include "migration/block.h"
 #include "qemu/thread.h"
+#include "qemu/error-report.h"
 #include "qmp-commands.h"
 #include "trace.h"
 
@@ -33,6 +34,7 @@ enum {
     MIG_STATE_CANCELLING,
     MIG_STATE_CANCELLED,
     MIG_STATE_ACTIVE,
+    MIG_STATE_POSTCOPY_ACTIVE,
     MIG_STATE_COMPLETED,
 };
 
@@ -46,6 +48,15 @@ enum {
 /* Migration XBZRLE default cache size */
 #define DEFAULT_MIGRATE_CACHE_SIZE (64 * 1024 * 1024)
 
+/* Default compression parameters: favour speed, leave CPUs to the guest */
+#define DEFAULT_MIGRATE_COMPRESS_LEVEL 1
+#define DEFAULT_MIGRATE_COMPRESS_THREAD_COUNT 8
+#define DEFAULT_MIGRATE_DECOMPRESS_THREAD_COUNT 2
+#define MAX_MIGRATE_COMPRESS_THREAD_COUNT 255
+
+#define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
+#define MAX_MIGRATE_MULTIFD_CHANNELS 255
+
 static NotifierList migration_state_notifiers =
     NOTIFIER_LIST_INITIALIZER(migration_state_notifiers);
 
@@ -60,11 +71,31 @@ MigrationState *migrate_get_current(void)
         .bandwidth_limit = MAX_THROTTLE,
         .xbzrle_cache_size = DEFAULT_MIGRATE_CACHE_SIZE,
         .mbps = -1,
+        .parameters[MIGRATION_PARAMETER_COMPRESS_LEVEL] =
+                DEFAULT_MIGRATE_COMPRESS_LEVEL,
+        .parameters[MIGRATION_PARAMETER_COMPRESS_THREADS] =
+                DEFAULT_MIGRATE_COMPRESS_THREAD_COUNT,
+        .parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS] =
+                DEFAULT_MIGRATE_DECOMPRESS_THREAD_COUNT,
+        .parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS] =
+                DEFAULT_MIGRATE_MULTIFD_CHANNELS,
     };
 
     return &current_migration;
 }
 
+MigrationIncomingState *migration_incoming_get_current(void)
+{
+    static MigrationIncomingState mis_current;
+    static bool once;
+
+    if (!once) {
+        qemu_mutex_init(&mis_current.rp_mutex);
+        once = true;
+    }
+    return &mis_current;
+}
+
 void qemu_start_incoming_migration(const char *uri, Error **errp)
 {
     const char *p;
@@ -82,6 +113,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         unix_start_incoming_migration(p, errp);
     else if (strstart(uri, "fd:", &p))
         fd_start_incoming_migration(p, errp);
+    else if (strstart(uri, "file:", &p))
+        file_start_incoming_migration(p, errp);
 #endif
     else {
         error_setg(errp, "unknown migration protocol: %s", uri);
@@ -91,11 +124,32 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
 static void process_incoming_migration_co(void *opaque)
 {
     QEMUFile *f = opaque;
+    MigrationIncomingState *mis = migration_incoming_get_current();
     Error *local_err = NULL;
     int ret;
 
+    mis->from_src_file = f;
+    mis->postcopy_state = POSTCOPY_INCOMING_NONE;
+    migrate_decompress_threads_create();
     ret = qemu_loadvm_state(f);
+    migrate_decompress_threads_join();
+    multifd_load_cleanup();
+    if (mis->postcopy_state >= POSTCOPY_INCOMING_LISTENING) {
+        /* The listen thread owns the stream now, and there is no way back */
+        if (ret < 0) {
+            error_report("load of postcopy migration failed: %s",
+                         strerror(-ret));
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    if (mis->to_src_file) {
+        qemu_fclose(mis->to_src_file);
+        mis->to_src_file = NULL;
+    }
     qemu_fclose(f);
+    mis->from_src_file = NULL;
     free_xbzrle_decoded_buf();
     if (ret < 0) {
         error_report("load of migration failed: %s", strerror(-ret));
@@ -128,6 +182,47 @@ void process_incoming_migration(QEMUFile *f)
     qemu_coroutine_enter(co, f);
 }
 
+/*
+ * Send a message on the return path towards the source.  Called from the
+ * fault thread and the listen thread.
+ */
+static void migrate_send_rp_message(MigrationIncomingState *mis,
+                                    enum mig_rp_message_type message_type,
+                                    uint16_t len, void *data)
+{
+    qemu_mutex_lock(&mis->rp_mutex);
+    qemu_put_be16(mis->to_src_file, (unsigned int)message_type);
+    qemu_put_be16(mis->to_src_file, len);
+    qemu_put_buffer(mis->to_src_file, data, len);
+    qemu_fflush(mis->to_src_file);
+    qemu_mutex_unlock(&mis->rp_mutex);
+}
+
+/* Tell the source we are done, @value is 0 on success */
+void migrate_send_rp_shut(MigrationIncomingState *mis, uint32_t value)
+{
+    uint32_t buf;
+
+    buf = cpu_to_be32(value);
+    migrate_send_rp_message(mis, MIG_RP_MSG_SHUT, sizeof(buf), &buf);
+}
+
+/* Ask the source for @len bytes at @start in RAMBlock @rbname */
+void migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
+                               ram_addr_t start, size_t len)
+{
+    uint8_t bufc[8 + 4 + 1 + 256];
+    size_t name_len = strlen(rbname);
+
+    assert(name_len < 256);
+    stq_be_p(bufc, start);
+    stl_be_p(bufc + 8, len);
+    bufc[12] = name_len;
+    memcpy(bufc + 13, rbname, name_len);
+
+    migrate_send_rp_message(mis, MIG_RP_MSG_REQ_PAGES, 13 + name_len, bufc);
+}
+
 /* amount of nanoseconds we are willing to wait for migration to be down.
  * the choice of nanoseconds is because it is the maximum resolution that
  * get_clock() can achieve. It is an internal measure. All user-visible
@@ -164,6 +259,23 @@ MigrationCapabilityStatusList *qmp_query_migrate_capabilities(Error **errp)
     return head;
 }
 
+MigrationParameters *qmp_query_migrate_parameters(Error **errp)
+{
+    MigrationParameters *params;
+    MigrationState *s = migrate_get_current();
+
+    params = g_malloc0(sizeof(*params));
+    params->compress_level = s->parameters[MIGRATION_PARAMETER_COMPRESS_LEVEL];
+    params->compress_threads =
+            s->parameters[MIGRATION_PARAMETER_COMPRESS_THREADS];
+    params->decompress_threads =
+            s->parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS];
+    params->multifd_channels =
+            s->parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS];
+
+    return params;
+}
+
 static void get_xbzrle_cache_stats(MigrationInfo *info)
 {
     if (migrate_use_xbzrle()) {
@@ -175,6 +287,8 @@ static void get_xbzrle_cache_stats(MigrationInfo *info)
         info->xbzrle_cache->cache_miss = xbzrle_mig_pages_cache_miss();
         info->xbzrle_cache->cache_miss_rate = xbzrle_mig_cache_miss_rate();
         info->xbzrle_cache->overflow = xbzrle_mig_pages_overflow();
+        info->xbzrle_cache->blocks = xbzrle_mig_block_stats();
+        info->xbzrle_cache->has_blocks = info->xbzrle_cache->blocks != NULL;
     }
 }
 
@@ -194,8 +308,10 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         break;
     case MIG_STATE_ACTIVE:
     case MIG_STATE_CANCELLING:
+    case MIG_STATE_POSTCOPY_ACTIVE:
         info->has_status = true;
-        info->status = g_strdup("active");
+        info->status = g_strdup(s->state == MIG_STATE_POSTCOPY_ACTIVE ?
+                                "postcopy-active" : "active");
         info->has_total_time = true;
         info->total_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME)
             - s->total_time;
@@ -216,6 +332,13 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         info->ram->dirty_pages_rate = s->dirty_pages_rate;
         info->ram->mbps = s->mbps;
         info->ram->dirty_sync_count = s->dirty_sync_count;
+        if (migrate_postcopy_ram()) {
+            info->ram->has_postcopy_requests = true;
+            info->ram->postcopy_requests = ram_postcopy_requests();
+        }
+
+        info->cpu_throttle = migration_cpu_throttle_info();
+        info->has_cpu_throttle = info->cpu_throttle != NULL;
 
         if (blk_mig_active()) {
             info->has_disk = true;
@@ -223,6 +346,8 @@ MigrationInfo *qmp_query_migrate(Error **errp)
             info->disk->transferred = blk_mig_bytes_transferred();
             info->disk->remaining = blk_mig_bytes_remaining();
             info->disk->total = blk_mig_bytes_total();
+            info->disk_devices = blk_mig_device_info();
+            info->has_disk_devices = info->disk_devices != NULL;
         }
 
         get_xbzrle_cache_stats(info);
@@ -238,6 +363,8 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         info->downtime = s->downtime;
         info->has_setup_time = true;
         info->setup_time = s->setup_time;
+        info->device_times = qemu_savevm_device_times();
+        info->has_device_times = info->device_times != NULL;
 
         info->has_ram = true;
         info->ram = g_malloc0(sizeof(*info->ram));
@@ -250,6 +377,10 @@ MigrationInfo *qmp_query_migrate(Error **errp)
         info->ram->normal_bytes = norm_mig_bytes_transferred();
         info->ram->mbps = s->mbps;
         info->ram->dirty_sync_count = s->dirty_sync_count;
+        if (migrate_postcopy_ram()) {
+            info->ram->has_postcopy_requests = true;
+            info->ram->postcopy_requests = ram_postcopy_requests();
+        }
         break;
     case MIG_STATE_ERROR:
         info->has_status = true;
@@ -270,7 +401,8 @@ void qmp_migrate_set_capabilities(MigrationCapabilityStatusList *params,
     MigrationState *s = migrate_get_current();
     MigrationCapabilityStatusList *cap;
 
-    if (s->state == MIG_STATE_ACTIVE || s->state == MIG_STATE_SETUP) {
+    if (s->state == MIG_STATE_ACTIVE || s->state == MIG_STATE_SETUP ||
+        s->state == MIG_STATE_POSTCOPY_ACTIVE) {
         error_set(errp, QERR_MIGRATION_ACTIVE);
         return;
     }
@@ -280,6 +412,59 @@ void qmp_migrate_set_capabilities(MigrationCapabilityStatusList *params,
     }
 }
 
+void qmp_migrate_set_parameters(bool has_compress_level,
+                                int64_t compress_level,
+                                bool has_compress_threads,
+                                int64_t compress_threads,
+                                bool has_decompress_threads,
+                                int64_t decompress_threads,
+                                bool has_multifd_channels,
+                                int64_t multifd_channels, Error **errp)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (has_compress_level && (compress_level < 0 || compress_level > 9)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "compress_level",
+                  "is invalid, it should be in the range of 0 to 9");
+        return;
+    }
+    if (has_compress_threads &&
+            (compress_threads < 1 ||
+             compress_threads > MAX_MIGRATE_COMPRESS_THREAD_COUNT)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "compress_threads",
+                  "is invalid, it should be in the range of 1 to 255");
+        return;
+    }
+    if (has_decompress_threads &&
+            (decompress_threads < 1 ||
+             decompress_threads > MAX_MIGRATE_COMPRESS_THREAD_COUNT)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "decompress_threads",
+                  "is invalid, it should be in the range of 1 to 255");
+        return;
+    }
+    if (has_multifd_channels &&
+            (multifd_channels < 1 ||
+             multifd_channels > MAX_MIGRATE_MULTIFD_CHANNELS)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_channels",
+                  "is invalid, it should be in the range of 1 to 255");
+        return;
+    }
+
+    if (has_compress_level) {
+        s->parameters[MIGRATION_PARAMETER_COMPRESS_LEVEL] = compress_level;
+    }
+    if (has_compress_threads) {
+        s->parameters[MIGRATION_PARAMETER_COMPRESS_THREADS] = compress_threads;
+    }
+    if (has_decompress_threads) {
+        s->parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS] =
+                                                    decompress_threads;
+    }
+    if (has_multifd_channels) {
+        s->parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS] = multifd_channels;
+    }
+}
+
 /* shared migration helpers */
 
 static void migrate_set_state(MigrationState *s, int old_state, int new_state)
@@ -305,8 +490,10 @@ static void migrate_fd_cleanup(void *opaque)
         qemu_fclose(s->file);
         s->file = NULL;
     }
+    multifd_save_cleanup();
 
     assert(s->state != MIG_STATE_ACTIVE);
+    assert(s->state != MIG_STATE_POSTCOPY_ACTIVE);
 
     if (s->state != MIG_STATE_COMPLETED) {
         qemu_savevm_state_cancel();
@@ -339,6 +526,11 @@ static void migrate_fd_cancel(MigrationState *s)
         }
         migrate_set_state(s, old_state, MIG_STATE_CANCELLING);
     } while (s->state != MIG_STATE_CANCELLING);
+
+    /* Don't leave the migration thread waiting on a stuck channel */
+    if (s->state == MIG_STATE_CANCELLING) {
+        multifd_save_shutdown();
+    }
 }
 
 void add_migration_state_change_notifier(Notifier *notify)
@@ -356,6 +548,13 @@ bool migration_in_setup(MigrationState *s)
     return s->state == MIG_STATE_SETUP;
 }
 
+bool migration_is_active(MigrationState *s)
+{
+    return s->state == MIG_STATE_ACTIVE || s->state == MIG_STATE_SETUP ||
+           s->state == MIG_STATE_CANCELLING ||
+           s->state == MIG_STATE_POSTCOPY_ACTIVE;
+}
+
 bool migration_has_finished(MigrationState *s)
 {
     return s->state == MIG_STATE_COMPLETED;
@@ -367,20 +566,28 @@ bool migration_has_failed(MigrationState *s)
             s->state == MIG_STATE_ERROR);
 }
 
+bool migration_in_postcopy(MigrationState *s)
+{
+    return s->state == MIG_STATE_POSTCOPY_ACTIVE;
+}
+
 static MigrationState *migrate_init(const MigrationParams *params)
 {
     MigrationState *s = migrate_get_current();
     int64_t bandwidth_limit = s->bandwidth_limit;
     bool enabled_capabilities[MIGRATION_CAPABILITY_MAX];
+    int parameters[MIGRATION_PARAMETER_MAX];
     int64_t xbzrle_cache_size = s->xbzrle_cache_size;
 
     memcpy(enabled_capabilities, s->enabled_capabilities,
            sizeof(enabled_capabilities));
+    memcpy(parameters, s->parameters, sizeof(parameters));
 
     memset(s, 0, sizeof(*s));
     s->params = *params;
     memcpy(s->enabled_capabilities, enabled_capabilities,
            sizeof(enabled_capabilities));
+    memcpy(s->parameters, parameters, sizeof(parameters));
     s->xbzrle_cache_size = xbzrle_cache_size;
 
     s->bandwidth_limit = bandwidth_limit;
@@ -415,12 +622,16 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
     params.blk = has_blk && blk;
     params.shared = has_inc && inc;
 
-    if (s->state == MIG_STATE_ACTIVE || s->state == MIG_STATE_SETUP ||
-        s->state == MIG_STATE_CANCELLING) {
+    if (migration_is_active(s)) {
         error_set(errp, QERR_MIGRATION_ACTIVE);
         return;
     }
 
+    if (dirty_rate_measuring()) {
+        error_setg(errp, "A dirty rate measurement is in progress");
+        return;
+    }
+
     if (runstate_check(RUN_STATE_INMIGRATE)) {
         error_setg(errp, "Guest is waiting for an incoming migration");
         return;
@@ -450,6 +661,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
 #endif
     } else {
         error_set(errp, QERR_INVALID_PARAMETER_VALUE, "uri", "a valid migration protocol");
@@ -469,6 +682,26 @@ void qmp_migrate_cancel(Error **errp)
     migrate_fd_cancel(migrate_get_current());
 }
 
+void qmp_migrate_start_postcopy(Error **errp)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (!migrate_postcopy_ram()) {
+        error_setg(errp, "Enable postcopy with migrate_set_capability before"
+                         " the start of migration");
+        return;
+    }
+
+    if (s->state != MIG_STATE_SETUP && s->state != MIG_STATE_ACTIVE) {
+        error_setg(errp, "Postcopy must be started after migration has been"
+                         " started");
+        return;
+    }
+
+    /* Picked up by the migration thread at the end of the current pass */
+    atomic_mb_set(&s->start_postcopy, true);
+}
+
 void qmp_migrate_set_cache_size(int64_t value, Error **errp)
 {
     MigrationState *s = migrate_get_current();
@@ -546,6 +779,15 @@ bool migrate_auto_converge(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_AUTO_CONVERGE];
 }
 
+bool migrate_postcopy_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
+}
+
 bool migrate_zero_blocks(void)
 {
     MigrationState *s;
@@ -564,6 +806,96 @@ int migrate_use_xbzrle(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_XBZRLE];
 }
 
+bool migrate_use_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_COMPRESS];
+}
+
+int migrate_compress_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters[MIGRATION_PARAMETER_COMPRESS_LEVEL];
+}
+
+int migrate_compress_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters[MIGRATION_PARAMETER_COMPRESS_THREADS];
+}
+
+int migrate_decompress_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters[MIGRATION_PARAMETER_DECOMPRESS_THREADS];
+}
+
+bool migrate_use_multifd(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
+}
+
+bool migrate_use_zero_copy(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY];
+}
+
+bool migrate_skip_memdev_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_SKIP_MEMDEV_RAM];
+}
+
+bool migrate_use_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_dirty_bitmaps(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_BITMAPS];
+}
+
+int migrate_multifd_channels(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters[MIGRATION_PARAMETER_MULTIFD_CHANNELS];
+}
+
 int64_t migrate_xbzrle_cache_size(void)
 {
     MigrationState *s;
@@ -575,6 +907,161 @@ int64_t migrate_xbzrle_cache_size(void)
 
 /* migration thread support */
 
+/*
+ * Handles messages sent by the destination on the return path.  Only
+ * opened for postcopy, ends when the destination says it is done or on
+ * error.
+ */
+static void *source_return_path_thread(void *opaque)
+{
+    MigrationState *ms = opaque;
+    QEMUFile *rp = ms->rp_state.from_dst_file;
+    uint16_t header_len, header_type;
+    uint8_t buf[512];
+    const char *rbname;
+    uint32_t tmp32;
+    ram_addr_t start;
+    size_t len;
+
+    trace_source_return_path_thread_entry();
+    for (;;) {
+        header_type = qemu_get_be16(rp);
+        header_len = qemu_get_be16(rp);
+        if (qemu_file_get_error(rp)) {
+            break;
+        }
+
+        if (header_len > sizeof(buf) - 1 ||
+            qemu_get_buffer(rp, buf, header_len) != header_len) {
+            error_report("RP: Bad message 0x%04x length 0x%04x",
+                         header_type, header_len);
+            goto err;
+        }
+
+        switch (header_type) {
+        case MIG_RP_MSG_SHUT:
+            if (header_len != 4) {
+                goto bad_len;
+            }
+            tmp32 = ldl_be_p(buf);
+            trace_source_return_path_thread_shut(tmp32);
+            if (tmp32) {
+                error_report("RP: Destination failed (%" PRIu32 ")", tmp32);
+                goto err;
+            }
+            trace_source_return_path_thread_end();
+            return NULL;
+
+        case MIG_RP_MSG_REQ_PAGES:
+            if (header_len < 13 || header_len != 13 + buf[12]) {
+                goto bad_len;
+            }
+            start = ldq_be_p(buf);
+            len = ldl_be_p(buf + 8);
+            buf[header_len] = '\0';
+            rbname = (char *)buf + 13;
+            trace_migrate_handle_rp_req_pages(rbname, start, len);
+            if (ram_save_queue_pages(rbname, start, len)) {
+                goto err;
+            }
+            break;
+
+        default:
+            goto bad_len;
+        }
+    }
+
+    error_report("RP: Error reading from the destination");
+    goto err;
+
+bad_len:
+    error_report("RP: Invalid message 0x%04x length 0x%04x",
+                 header_type, header_len);
+err:
+    ms->rp_state.error = true;
+    trace_source_return_path_thread_end();
+    return NULL;
+}
+
+static int open_return_path_on_source(MigrationState *ms)
+{
+    ms->rp_state.from_dst_file = qemu_file_get_return_path(ms->file);
+    if (!ms->rp_state.from_dst_file) {
+        return -1;
+    }
+
+    qemu_thread_create(&ms->rp_state.thread, "return path",
+                       source_return_path_thread, ms, QEMU_THREAD_JOINABLE);
+    ms->rp_state.thread_running = true;
+    return 0;
+}
+
+/*
+ * Wait for the return path thread to end; @kick wakes it up first, unless
+ * the destination is expected to close it (at the end of postcopy).
+ *
+ * Returns 0 if nothing went wrong on the return path.
+ */
+static int await_return_path_close_on_source(MigrationState *ms, bool kick)
+{
+    if (kick) {
+        qemu_file_shutdown(ms->rp_state.from_dst_file);
+    }
+    qemu_thread_join(&ms->rp_state.thread);
+    ms->rp_state.thread_running = false;
+    qemu_fclose(ms->rp_state.from_dst_file);
+    ms->rp_state.from_dst_file = NULL;
+
+    return ms->rp_state.error ? -1 : 0;
+}
+
+/*
+ * Switch the destination to running: stop here, tell the destination
+ * which pages it must drop and send it the device state.  RAM keeps
+ * flowing afterwards, pages the destination faults on first.
+ *
+ * Returns 0 once the switch is made, even if sending the device state
+ * then fails: the source must not run the guest again.  Negative if the
+ * switch didn't happen.
+ */
+static int postcopy_start(MigrationState *ms, bool *old_vm_running)
+{
+    int ret;
+
+    trace_postcopy_start();
+    qemu_mutex_lock_iothread();
+    qemu_system_wakeup_request(QEMU_WAKEUP_REASON_OTHER);
+    *old_vm_running = runstate_is_running();
+
+    ret = vm_stop_force_state(RUN_STATE_FINISH_MIGRATE);
+    if (ret < 0) {
+        migrate_set_state(ms, MIG_STATE_ACTIVE, MIG_STATE_ERROR);
+        qemu_mutex_unlock_iothread();
+        return ret;
+    }
+
+    /* From here on the guest can only run on the destination */
+    migrate_set_state(ms, MIG_STATE_ACTIVE, MIG_STATE_POSTCOPY_ACTIVE);
+    if (ms->state != MIG_STATE_POSTCOPY_ACTIVE) {
+        qemu_mutex_unlock_iothread();
+        return -ECANCELED;
+    }
+
+    /* Pages the guest is waiting for must not sit behind the rate limit */
+    qemu_file_set_rate_limit(ms->file, INT64_MAX);
+
+    ret = ram_postcopy_send_discard_bitmap(ms);
+    if (ret == 0) {
+        ret = qemu_savevm_state_postcopy_package(ms->file);
+    }
+    if (ret < 0) {
+        migrate_set_state(ms, MIG_STATE_POSTCOPY_ACTIVE, MIG_STATE_ERROR);
+    }
+    qemu_mutex_unlock_iothread();
+
+    return 0;
+}
+
 static void *migration_thread(void *opaque)
 {
     MigrationState *s = opaque;
@@ -584,21 +1071,56 @@ static void *migration_thread(void *opaque)
     int64_t max_size = 0;
     int64_t start_time = initial_time;
     bool old_vm_running = false;
+    bool entered_postcopy = false;
 
     qemu_savevm_state_begin(s->file, &s->params);
 
+    if (migrate_postcopy_ram()) {
+        if (open_return_path_on_source(s)) {
+            error_report("Unable to open return-path for postcopy");
+            qemu_file_set_error(s->file, -EINVAL);
+        } else {
+            qemu_savevm_send_postcopy_advise(s->file);
+        }
+    }
+
     s->setup_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) - setup_start;
     migrate_set_state(s, MIG_STATE_SETUP, MIG_STATE_ACTIVE);
 
-    while (s->state == MIG_STATE_ACTIVE) {
+    while (s->state == MIG_STATE_ACTIVE ||
+           s->state == MIG_STATE_POSTCOPY_ACTIVE) {
         int64_t current_time;
         uint64_t pending_size;
+        bool in_postcopy = s->state == MIG_STATE_POSTCOPY_ACTIVE;
 
         if (!qemu_file_rate_limit(s->file)) {
-            pending_size = qemu_savevm_state_pending(s->file, max_size);
+            pending_size = qemu_savevm_state_pending(s->file, max_size,
+                                                     in_postcopy);
             trace_migrate_pending(pending_size, max_size);
             if (pending_size && pending_size >= max_size) {
-                qemu_savevm_state_iterate(s->file);
+                if (!in_postcopy && atomic_mb_read(&s->start_postcopy)) {
+                    start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+                    if (postcopy_start(s, &old_vm_running) == 0) {
+                        entered_postcopy = true;
+                        s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                                      start_time;
+                    }
+                    continue;
+                }
+                qemu_savevm_state_iterate(s->file, in_postcopy);
+            } else if (in_postcopy) {
+                qemu_savevm_state_postcopy_complete(s->file);
+
+                /* The destination says when it has everything */
+                if (await_return_path_close_on_source(s, false) == 0 &&
+                    !qemu_file_get_error(s->file)) {
+                    migrate_set_state(s, MIG_STATE_POSTCOPY_ACTIVE,
+                                      MIG_STATE_COMPLETED);
+                } else {
+                    migrate_set_state(s, MIG_STATE_POSTCOPY_ACTIVE,
+                                      MIG_STATE_ERROR);
+                }
+                break;
             } else {
                 int ret;
 
@@ -626,8 +1148,10 @@ static void *migration_thread(void *opaque)
             }
         }
 
-        if (qemu_file_get_error(s->file)) {
-            migrate_set_state(s, MIG_STATE_ACTIVE, MIG_STATE_ERROR);
+        if (qemu_file_get_error(s->file) || s->rp_state.error) {
+            migrate_set_state(s, in_postcopy ? MIG_STATE_POSTCOPY_ACTIVE :
+                                               MIG_STATE_ACTIVE,
+                              MIG_STATE_ERROR);
             break;
         }
         current_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
@@ -658,19 +1182,26 @@ static void *migration_thread(void *opaque)
         }
     }
 
+    if (s->rp_state.thread_running) {
+        await_return_path_close_on_source(s, true);
+    }
+
     qemu_mutex_lock_iothread();
     if (s->state == MIG_STATE_COMPLETED) {
         int64_t end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
         uint64_t transferred_bytes = qemu_ftell(s->file);
         s->total_time = end_time - s->total_time;
-        s->downtime = end_time - start_time;
+        if (!entered_postcopy) {
+            s->downtime = end_time - start_time;
+        }
         if (s->total_time) {
             s->mbps = (((double) transferred_bytes * 8.0) /
                        ((double) s->total_time)) / 1000;
         }
         runstate_set(RUN_STATE_POSTMIGRATE);
     } else {
-        if (old_vm_running) {
+        /* Once in postcopy the guest may already run on the destination */
+        if (old_vm_running && !entered_postcopy) {
             vm_start();
         }
     }
@@ -682,6 +1213,8 @@ static void *migration_thread(void *opaque)
 
 void migrate_fd_connect(MigrationState *s)
 {
+    int ret;
+
     s->state = MIG_STATE_SETUP;
     trace_migrate_set_state(MIG_STATE_SETUP);
 
@@ -692,6 +1225,14 @@ void migrate_fd_connect(MigrationState *s)
     qemu_file_set_rate_limit(s->file,
                              s->bandwidth_limit / XFER_LIMIT_RATIO);
 
+    if (migrate_use_zero_copy()) {
+        ret = qemu_file_enable_zerocopy(s->file);
+        if (ret < 0) {
+            error_report("Zero copy migration unavailable, copying pages: %s",
+                         strerror(-ret));
+        }
+    }
+
     /* Notify before starting migration thread */
     notifier_list_notify(&migration_state_notifiers, s);
 
@@ -169,12 +169,43 @@ struct MonFdset {
     QLIST_ENTRY(MonFdset) next;
 };
 
+/* A QMP request (or chardev event) waiting for the main loop */
+typedef struct QMPRequest {
+    QObject *req;           /* parsed request, NULL if it did not parse */
+    int event;              /* CHR_EVENT_* to handle instead, or -1 */
+    int64_t start_ns;       /* QEMU_CLOCK_REALTIME when it was read */
+    QSIMPLEQ_ENTRY(QMPRequest) entry;
+} QMPRequest;
+
+/* More requests than this stop an out-of-band monitor from reading */
+#define QMP_REQ_QUEUE_MAX   64
+
 typedef struct MonitorControl {
+    Monitor *mon;
     QObject *id;
     JSONMessageParser parser;
     int command_mode;
+
+    /*
+     * Set by qmp_capabilities when the client enables "oob", cleared when
+     * it connects.  Read by the monitor thread, without the BQL.
+     */
+    bool oob_enabled;
+
+    /* Out-of-band monitors only: requests for the main loop, in order */
+    QemuMutex req_lock;
+    QSIMPLEQ_HEAD(, QMPRequest) reqs;
+    int nr_reqs;
+    QEMUBH *req_bh;
 } MonitorControl;
 
+/* Time spent on each QMP command, indexed like qmp_cmds */
+typedef struct QMPCommandStats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} QMPCommandStats;
+
 /*
  * To prevent flooding clients, events can be throttled. The
  * throttling is calculated globally, rather than per-Monitor
@@ -186,6 +217,12 @@ typedef struct MonitorQAPIEventState {
     int64_t last;       /* QEMU_CLOCK_REALTIME value at last emission */
     QEMUTimer *timer;   /* Timer for handling delayed events */
     QObject *data;      /* Event pending delayed dispatch */
+    /*
+     * If non-NULL, events that name a device are throttled separately
+     * for each device: this maps the name to its own state, and the
+     * state above is only used for events that do not name one.
+     */
+    GHashTable *sources;
 } MonitorQAPIEventState;
 
 struct Monitor {
@@ -211,14 +248,27 @@ struct Monitor {
     QError *error;
     QLIST_HEAD(,mon_fd_t) fds;
     QLIST_ENTRY(Monitor) entry;
+
+    /*
+     * An out-of-band monitor's chardev is serviced by its own thread,
+     * which also runs MONITOR_CMD_OOB commands sent with "exec-oob" right
+     * away; everything else is queued for the main loop.  Only that thread
+     * writes to the chardev, out_flush_pending is protected by out_lock.
+     */
+    GMainContext *oob_ctx;
+    GMainLoop *oob_loop;
+    QemuThread oob_thread;
+    bool out_flush_pending;
 };
 
 /* QMP checker flags */
 #define QMP_ACCEPT_UNKNOWNS 1
 
-/* Protects mon_list, monitor_event_state.  */
+/* Protects mon_list, monitor_event_state, qmp_cmd_stats.  */
 static QemuMutex monitor_lock;
 
+static QMPCommandStats *qmp_cmd_stats;
+
 static QLIST_HEAD(mon_list, Monitor) mon_list;
 static QLIST_HEAD(mon_fdsets, MonFdset) mon_fdsets;
 static int mon_refcount;
@@ -279,6 +329,17 @@ int monitor_read_password(Monitor *mon, ReadLineFunc *readline_func,
 
 static void monitor_flush_locked(Monitor *mon);
 
+static gboolean monitor_oob_flush(gpointer opaque)
+{
+    Monitor *mon = opaque;
+
+    qemu_mutex_lock(&mon->out_lock);
+    mon->out_flush_pending = false;
+    monitor_flush_locked(mon);
+    qemu_mutex_unlock(&mon->out_lock);
+    return FALSE;
+}
+
 static gboolean monitor_unblocked(GIOChannel *chan, GIOCondition cond,
                                   void *opaque)
 {
@@ -302,6 +363,19 @@ static void monitor_flush_locked(Monitor *mon)
         return;
     }
 
+    /* Hand output from other threads to the monitor thread */
+    if (mon->oob_ctx && !qemu_thread_is_self(&mon->oob_thread)) {
+        if (!mon->out_flush_pending) {
+            GSource *src = g_idle_source_new();
+
+            mon->out_flush_pending = true;
+            g_source_set_callback(src, monitor_oob_flush, mon, NULL);
+            g_source_attach(src, mon->oob_ctx);
+            g_source_unref(src);
+        }
+        return;
+    }
+
     buf = qstring_get_str(mon->outbuf);
     len = qstring_get_length(mon->outbuf);
 
@@ -481,6 +555,68 @@ static void monitor_qapi_event_emit(QAPIEvent event, QObject *data)
     }
 }
 
+static void monitor_qapi_event_handler(void *opaque);
+
+/* The device, port or node an event is about, if any */
+static const char *monitor_qapi_event_source(QDict *qdict)
+{
+    static const char *const keys[] = { "device", "id", "node-name" };
+    QDict *data = qdict_get_qdict(qdict, "data");
+    const char *source;
+    int i;
+
+    for (i = 0; data && i < ARRAY_SIZE(keys); i++) {
+        source = qdict_get_try_str(data, keys[i]);
+        if (source) {
+            return source;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Return the state that throttles @data, for an event throttled per
+ * source.  Called with monitor_lock held.
+ */
+static MonitorQAPIEventState *
+monitor_qapi_event_source_state(MonitorQAPIEventState *evstate, QDict *data)
+{
+    MonitorQAPIEventState *srcstate;
+    const char *source = monitor_qapi_event_source(data);
+
+    if (!source) {
+        return evstate;
+    }
+
+    srcstate = g_hash_table_lookup(evstate->sources, source);
+    if (!srcstate) {
+        srcstate = g_new0(MonitorQAPIEventState, 1);
+        srcstate->event = evstate->event;
+        srcstate->rate = evstate->rate;
+        srcstate->timer = timer_new(QEMU_CLOCK_REALTIME, SCALE_MS,
+                                    monitor_qapi_event_handler, srcstate);
+        g_hash_table_insert(evstate->sources, g_strdup(source), srcstate);
+    }
+    return srcstate;
+}
+
+/*
+ * Hash table value destructor: send what is pending right away, since
+ * nothing would send it later.  Called with monitor_lock held.
+ */
+static void monitor_qapi_event_source_free(gpointer opaque)
+{
+    MonitorQAPIEventState *srcstate = opaque;
+
+    if (srcstate->data) {
+        monitor_qapi_event_emit(srcstate->event, srcstate->data);
+        qobject_decref(srcstate->data);
+    }
+    timer_del(srcstate->timer);
+    timer_free(srcstate->timer);
+    g_free(srcstate);
+}
+
 /*
  * Queue a new event for emission to Monitor instances,
  * applying any rate limiting if required.
@@ -493,6 +629,10 @@ monitor_qapi_event_queue(QAPIEvent event, QDict *data, Error **errp)
     int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     evstate = &(monitor_qapi_event_state[event]);
+    qemu_mutex_lock(&monitor_lock);
+    if (evstate->sources) {
+        evstate = monitor_qapi_event_source_state(evstate, data);
+    }
     trace_monitor_protocol_event_queue(event,
                                        data,
                                        evstate->rate,
@@ -500,7 +640,6 @@ monitor_qapi_event_queue(QAPIEvent event, QDict *data, Error **errp)
                                        now);
 
     /* Rate limit of 0 indicates no throttling */
-    qemu_mutex_lock(&monitor_lock);
     if (!evstate->rate) {
         monitor_qapi_event_emit(event, QOBJECT(data));
         evstate->last = now;
@@ -554,15 +693,19 @@ static void monitor_qapi_event_handler(void *opaque)
 /*
  * @event: the event ID to be limited
  * @rate: the rate limit in milliseconds
+ * @per_source: whether to limit each device separately
  *
  * Sets a rate limit on a particular event, so no
  * more than 1 event will be emitted within @rate
- * milliseconds
+ * milliseconds (per device named in the event data,
+ * if @per_source is set).  A rate of 0 disables throttling.
+ * Called with monitor_lock held.
  */
 static void
-monitor_qapi_event_throttle(QAPIEvent event, int64_t rate)
+monitor_qapi_event_throttle(QAPIEvent event, int64_t rate, bool per_source)
 {
-    MonitorQAPIEventState *evstate;
+    MonitorQAPIEventState *evstate, *srcstate;
+    GHashTableIter iter;
     assert(event < QAPI_EVENT_MAX);
 
     evstate = &(monitor_qapi_event_state[event]);
@@ -571,33 +714,131 @@ monitor_qapi_event_throttle(QAPIEvent event, int64_t rate)
     evstate->event = event;
     assert(rate * SCALE_MS <= INT64_MAX);
     evstate->rate = rate * SCALE_MS;
-    evstate->last = 0;
-    evstate->data = NULL;
-    evstate->timer = timer_new(QEMU_CLOCK_REALTIME,
-                               SCALE_MS,
-                               monitor_qapi_event_handler,
-                               evstate);
+    if (!evstate->timer) {
+        evstate->timer = timer_new(QEMU_CLOCK_REALTIME,
+                                   SCALE_MS,
+                                   monitor_qapi_event_handler,
+                                   evstate);
+    }
+
+    if (per_source && !evstate->sources) {
+        evstate->sources =
+            g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                  monitor_qapi_event_source_free);
+    } else if (!per_source && evstate->sources) {
+        g_hash_table_destroy(evstate->sources);
+        evstate->sources = NULL;
+    }
+    if (evstate->sources) {
+        g_hash_table_iter_init(&iter, evstate->sources);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&srcstate)) {
+            srcstate->rate = evstate->rate;
+        }
+    }
 }
 
 static void monitor_qapi_event_init(void)
 {
     /* Limit guest-triggerable events to 1 per second */
-    monitor_qapi_event_throttle(QAPI_EVENT_RTC_CHANGE, 1000);
-    monitor_qapi_event_throttle(QAPI_EVENT_WATCHDOG, 1000);
-    monitor_qapi_event_throttle(QAPI_EVENT_BALLOON_CHANGE, 1000);
-    monitor_qapi_event_throttle(QAPI_EVENT_QUORUM_REPORT_BAD, 1000);
-    monitor_qapi_event_throttle(QAPI_EVENT_QUORUM_FAILURE, 1000);
-    monitor_qapi_event_throttle(QAPI_EVENT_VSERPORT_CHANGE, 1000);
+    qemu_mutex_lock(&monitor_lock);
+    monitor_qapi_event_throttle(QAPI_EVENT_RTC_CHANGE, 1000, false);
+    monitor_qapi_event_throttle(QAPI_EVENT_WATCHDOG, 1000, false);
+    monitor_qapi_event_throttle(QAPI_EVENT_BALLOON_CHANGE, 1000, false);
+    monitor_qapi_event_throttle(QAPI_EVENT_QUORUM_REPORT_BAD, 1000, true);
+    monitor_qapi_event_throttle(QAPI_EVENT_QUORUM_FAILURE, 1000, false);
+    monitor_qapi_event_throttle(QAPI_EVENT_VSERPORT_CHANGE, 1000, true);
+    qemu_mutex_unlock(&monitor_lock);
 
     qmp_event_set_func_emit(monitor_qapi_event_queue);
 }
 
+void qmp_set_event_throttle(const char *event, int64_t rate,
+                            bool has_per_source, bool per_source,
+                            Error **errp)
+{
+    MonitorQAPIEventState *evstate;
+    QAPIEvent e;
+
+    for (e = 0; e < QAPI_EVENT_MAX; e++) {
+        if (!strcmp(QAPIEvent_lookup[e], event)) {
+            break;
+        }
+    }
+    if (e == QAPI_EVENT_MAX) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "event",
+                  "a QMP event name");
+        return;
+    }
+    if (rate < 0 || rate > INT64_MAX / SCALE_MS) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "rate",
+                  "a non-negative number of milliseconds");
+        return;
+    }
+
+    qemu_mutex_lock(&monitor_lock);
+    evstate = &monitor_qapi_event_state[e];
+    if (!has_per_source) {
+        per_source = evstate->sources != NULL;
+    }
+    monitor_qapi_event_throttle(e, rate, per_source);
+    qemu_mutex_unlock(&monitor_lock);
+}
+
+EventThrottleInfoList *qmp_query_event_throttle(Error **errp)
+{
+    EventThrottleInfoList *info, *list = NULL;
+    QAPIEvent e;
+
+    qemu_mutex_lock(&monitor_lock);
+    for (e = 0; e < QAPI_EVENT_MAX; e++) {
+        MonitorQAPIEventState *evstate = &monitor_qapi_event_state[e];
+
+        if (!evstate->rate) {
+            continue;
+        }
+        info = g_malloc0(sizeof(*info));
+        info->value = g_malloc0(sizeof(*info->value));
+        info->value->event = g_strdup(QAPIEvent_lookup[e]);
+        info->value->rate = evstate->rate / SCALE_MS;
+        info->value->per_source = evstate->sources != NULL;
+
+        info->next = list;
+        list = info;
+    }
+    qemu_mutex_unlock(&monitor_lock);
+
+    return list;
+}
+
 static int do_qmp_capabilities(Monitor *mon, const QDict *params,
                                QObject **ret_data)
 {
-    /* Will setup QMP capabilities in the future */
+    QObject *enable = qdict_get(params, "enable");
+    const QListEntry *entry;
+    bool oob = false;
+
+    if (enable) {
+        if (qobject_type(enable) != QTYPE_QLIST) {
+            qerror_report(QERR_INVALID_PARAMETER_TYPE, "enable", "array");
+            return -1;
+        }
+        QLIST_FOREACH_ENTRY(qobject_to_qlist(enable), entry) {
+            QString *cap = qobject_to_qstring(qlist_entry_obj(entry));
+
+            /* "oob" is the only capability, and only some monitors offer it */
+            if (!cap || strcmp(qstring_get_str(cap), "oob") || !mon->oob_ctx) {
+                qerror_report(QERR_INVALID_PARAMETER_VALUE, "enable",
+                              "a capability offered in the greeting");
+                return -1;
+            }
+            oob = true;
+        }
+    }
+
     if (monitor_ctrl_mode(mon)) {
         mon->mc->command_mode = 1;
+        /* Visible to the monitor thread before the response is */
+        atomic_set(&mon->mc->oob_enabled, oob);
     }
 
     return 0;
@@ -1042,6 +1283,33 @@ static void do_info_jit(Monitor *mon, const QDict *qdict)
     dump_drift_info((FILE *)mon, monitor_fprintf);
 }
 
+static void do_info_jit_stats(Monitor *mon, const QDict *qdict)
+{
+    dump_jit_stats((FILE *)mon, monitor_fprintf);
+}
+
+static void do_info_startup(Monitor *mon, const QDict *qdict)
+{
+    dump_startup_profile((FILE *)mon, monitor_fprintf);
+}
+
+static void do_info_timers(Monitor *mon, const QDict *qdict)
+{
+    dump_timers_info((FILE *)mon, monitor_fprintf);
+}
+
+static void do_info_guest_profile(Monitor *mon, const QDict *qdict)
+{
+    int count = qdict_get_try_int(qdict, "count", 20);
+
+    guest_profile_dump((FILE *)mon, monitor_fprintf, count);
+}
+
+static void do_info_ramblock(Monitor *mon, const QDict *qdict)
+{
+    ram_block_dump((FILE *)mon, monitor_fprintf);
+}
+
 static void do_info_history(Monitor *mon, const QDict *qdict)
 {
     int i;
@@ -1150,6 +1418,26 @@ static void do_singlestep(Monitor *mon, const QDict *qdict)
     }
 }
 
+static void do_guest_profile_start(Monitor *mon, const QDict *qdict)
+{
+    int64_t interval = qdict_get_try_int(qdict, "interval", 1000);
+
+    if (!tcg_enabled()) {
+        monitor_printf(mon, "guest profiling needs TCG\n");
+        return;
+    }
+    if (interval <= 0) {
+        monitor_printf(mon, "interval must be positive\n");
+        return;
+    }
+    guest_profile_start(interval * SCALE_US);
+}
+
+static void do_guest_profile_stop(Monitor *mon, const QDict *qdict)
+{
+    guest_profile_stop();
+}
+
 static void do_gdbserver(Monitor *mon, const QDict *qdict)
 {
     const char *device = qdict_get_try_str(qdict, "device");
@@ -2731,6 +3019,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show memory tree",
         .mhandler.cmd = do_info_mtree,
     },
+    {
+        .name       = "ramblock",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show RAM blocks and the host page size backing them",
+        .mhandler.cmd = do_info_ramblock,
+    },
     {
         .name       = "jit",
         .args_type  = "",
@@ -2738,6 +3033,42 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show dynamic compiler info",
         .mhandler.cmd = do_info_jit,
     },
+    {
+        .name       = "jit-stats",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show TB lookup and flush statistics",
+        .mhandler.cmd = do_info_jit_stats,
+    },
+    {
+        .name       = "startup",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show time spent in each startup phase and the "
+                      "slowest device realizes",
+        .mhandler.cmd = do_info_startup,
+    },
+    {
+        .name       = "dump",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the status of the latest guest memory dump",
+        .mhandler.cmd = hmp_info_dump,
+    },
+    {
+        .name       = "timers",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the number of pending timers of each clock",
+        .mhandler.cmd = do_info_timers,
+    },
+    {
+        .name       = "guest-profile",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show the guest addresses with the most profile samples",
+        .mhandler.cmd = do_info_guest_profile,
+    },
     {
         .name       = "kvm",
         .args_type  = "",
@@ -2861,6 +3192,20 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show current migration capabilities",
         .mhandler.cmd = hmp_info_migrate_capabilities,
     },
+    {
+        .name       = "migrate_parameters",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show current migration parameters",
+        .mhandler.cmd = hmp_info_migrate_parameters,
+    },
+    {
+        .name       = "dirty_rate",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the guest RAM dirty rate measurement",
+        .mhandler.cmd = hmp_info_dirty_rate,
+    },
     {
         .name       = "migrate_cache_size",
         .args_type  = "",
@@ -4544,6 +4889,24 @@ void migrate_set_capability_completion(ReadLineState *rs, int nb_args,
     }
 }
 
+void migrate_set_parameter_completion(ReadLineState *rs, int nb_args,
+                                      const char *str)
+{
+    size_t len;
+
+    len = strlen(str);
+    readline_set_completion_index(rs, len);
+    if (nb_args == 2) {
+        int i;
+        for (i = 0; i < MIGRATION_PARAMETER_MAX; i++) {
+            const char *name = MigrationParameter_lookup[i];
+            if (!strncmp(str, name, len)) {
+                readline_add_completion(rs, name);
+            }
+        }
+    }
+}
+
 void host_net_add_completion(ReadLineState *rs, int nb_args, const char *str)
 {
     int i;
@@ -4769,6 +5132,9 @@ static int monitor_can_read(void *opaque)
 {
     Monitor *mon = opaque;
 
+    if (mon->oob_ctx && mon->mc->nr_reqs >= QMP_REQ_QUEUE_MAX) {
+        return 0;
+    }
     return (mon->suspend_cnt == 0) ? 1 : 0;
 }
 
@@ -4975,8 +5341,8 @@ out:
  * Input object checking rules
  *
  * 1. Input object must be a dict
- * 2. The "execute" key must exist
- * 3. The "execute" key must be a string
+ * 2. Exactly one of the "execute" and "exec-oob" keys must exist
+ * 3. That key must be a string
  * 4. If the "arguments" key exists, it must be a dict
  * 5. If the "id" key exists, it can be anything (ie. json-value)
  * 6. Any argument not listed above is considered invalid
@@ -4998,12 +5364,16 @@ static QDict *qmp_check_input_obj(QObject *input_obj)
         const char *arg_name = qdict_entry_key(ent);
         const QObject *arg_obj = qdict_entry_value(ent);
 
-        if (!strcmp(arg_name, "execute")) {
+        if (!strcmp(arg_name, "execute") || !strcmp(arg_name, "exec-oob")) {
             if (qobject_type(arg_obj) != QTYPE_QSTRING) {
-                qerror_report(QERR_QMP_BAD_INPUT_OBJECT_MEMBER, "execute",
+                qerror_report(QERR_QMP_BAD_INPUT_OBJECT_MEMBER, arg_name,
                               "string");
                 return NULL;
             }
+            if (has_exec_key) {
+                qerror_report(QERR_QMP_EXTRA_MEMBER, arg_name);
+                return NULL;
+            }
             has_exec_key = 1;
         } else if (!strcmp(arg_name, "arguments")) {
             if (qobject_type(arg_obj) != QTYPE_QDICT) {
@@ -5027,6 +5397,46 @@ static QDict *qmp_check_input_obj(QObject *input_obj)
     return input_dict;
 }
 
+static void qmp_cmd_account(const mon_cmd_t *cmd, int64_t start_ns)
+{
+    QMPCommandStats *st = &qmp_cmd_stats[cmd - qmp_cmds];
+    uint64_t ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
+
+    qemu_mutex_lock(&monitor_lock);
+    st->count++;
+    st->total_ns += ns;
+    st->max_ns = MAX(st->max_ns, ns);
+    qemu_mutex_unlock(&monitor_lock);
+}
+
+QmpCommandStatsList *qmp_query_qmp_stats(Error **errp)
+{
+    QmpCommandStatsList *info, *list = NULL;
+    const mon_cmd_t *cmd;
+
+    qemu_mutex_lock(&monitor_lock);
+    for (cmd = qmp_cmds; cmd->name != NULL; cmd++) {
+        QMPCommandStats *st = &qmp_cmd_stats[cmd - qmp_cmds];
+
+        if (!st->count) {
+            continue;
+        }
+        info = g_malloc0(sizeof(*info));
+        info->value = g_malloc0(sizeof(*info->value));
+        info->value->name = g_strdup(cmd->name);
+        info->value->count = st->count;
+        info->value->total_ns = st->total_ns;
+        info->value->max_ns = st->max_ns;
+        info->value->oob = !!(cmd->flags & MONITOR_CMD_OOB);
+
+        info->next = list;
+        list = info;
+    }
+    qemu_mutex_unlock(&monitor_lock);
+
+    return list;
+}
+
 static void qmp_call_cmd(Monitor *mon, const mon_cmd_t *cmd,
                          const QDict *params)
 {
@@ -5039,18 +5449,96 @@ static void qmp_call_cmd(Monitor *mon, const mon_cmd_t *cmd,
     qobject_decref(data);
 }
 
-static void handle_qmp_command(JSONMessageParser *parser, QList *tokens)
+/*
+ * Run a request in the monitor thread of an out-of-band monitor, if the
+ * client enabled the "oob" capability, sent it with "exec-oob", it names
+ * a MONITOR_CMD_OOB command and it is well-formed.  Returns false if the
+ * request must go to the main loop instead, which also takes care of
+ * reporting errors: those commands take no arguments and never fail,
+ * so nothing here needs cur_mon.
+ */
+static bool qmp_dispatch_oob(Monitor *mon, QObject *obj, int64_t start_ns)
+{
+    QDict *input, *args, *rsp;
+    QObject *data = NULL, *id;
+    const mon_cmd_t *cmd;
+    const char *cmd_name;
+    int nr_keys = 1;
+
+    if (!obj || qobject_type(obj) != QTYPE_QDICT) {
+        return false;
+    }
+    input = qobject_to_qdict(obj);
+    cmd_name = qdict_get_try_str(input, "exec-oob");
+    if (!cmd_name || !atomic_read(&mon->mc->oob_enabled)) {
+        return false;
+    }
+    cmd = qmp_find_cmd(cmd_name);
+    if (!cmd || !(cmd->flags & MONITOR_CMD_OOB)) {
+        return false;
+    }
+    if (qdict_haskey(input, "arguments")) {
+        args = qdict_get_qdict(input, "arguments");
+        if (!args || qdict_size(args)) {
+            return false;
+        }
+        nr_keys++;
+    }
+    id = qdict_get(input, "id");
+    if (id) {
+        nr_keys++;
+    }
+    if (qdict_size(input) != nr_keys) {
+        return false;
+    }
+
+    trace_handle_qmp_command(mon, cmd_name);
+    args = qdict_new();
+    cmd->mhandler.cmd_new(mon, args, &data);
+    QDECREF(args);
+
+    rsp = qdict_new();
+    qdict_put_obj(rsp, "return", data ? data : QOBJECT(qdict_new()));
+    if (id) {
+        qobject_incref(id);
+        qdict_put_obj(rsp, "id", id);
+    }
+    monitor_json_emitter(mon, QOBJECT(rsp));
+    QDECREF(rsp);
+
+    qmp_cmd_account(cmd, start_ns);
+    return true;
+}
+
+/* Called from the monitor thread; the main loop takes over @obj */
+static void monitor_qmp_queue(Monitor *mon, QObject *obj, int event,
+                              int64_t start_ns)
+{
+    MonitorControl *mc = mon->mc;
+    QMPRequest *req = g_new0(QMPRequest, 1);
+
+    req->req = obj;
+    req->event = event;
+    req->start_ns = start_ns;
+
+    qemu_mutex_lock(&mc->req_lock);
+    QSIMPLEQ_INSERT_TAIL(&mc->reqs, req, entry);
+    mc->nr_reqs++;
+    qemu_mutex_unlock(&mc->req_lock);
+    qemu_bh_schedule(mc->req_bh);
+}
+
+/* Takes ownership of @obj, which is NULL if the request did not parse */
+static void qmp_handle_request(Monitor *mon, QObject *obj, int64_t start_ns)
 {
     int err;
-    QObject *obj;
     QDict *input, *args;
     const mon_cmd_t *cmd;
     const char *cmd_name;
-    Monitor *mon = cur_mon;
+    bool oob;
 
     args = input = NULL;
 
-    obj = json_parser_parse(tokens, NULL);
     if (!obj) {
         // FIXME: should be triggered in json_parser_parse()
         qerror_report(QERR_JSON_PARSING);
@@ -5066,7 +5554,11 @@ static void handle_qmp_command(JSONMessageParser *parser, QList *tokens)
     mon->mc->id = qdict_get(input, "id");
     qobject_incref(mon->mc->id);
 
-    cmd_name = qdict_get_str(input, "execute");
+    cmd_name = qdict_get_try_str(input, "execute");
+    oob = !cmd_name;
+    if (oob) {
+        cmd_name = qdict_get_str(input, "exec-oob");
+    }
     trace_handle_qmp_command(mon, cmd_name);
     if (invalid_qmp_mode(mon, cmd_name)) {
         qerror_report(QERR_COMMAND_NOT_FOUND, cmd_name);
@@ -5079,6 +5571,22 @@ static void handle_qmp_command(JSONMessageParser *parser, QList *tokens)
         goto err_out;
     }
 
+    /*
+     * qmp_dispatch_oob() turned the request down.  A request that gets
+     * past this and the argument checks saw "oob" being enabled just too
+     * late, and simply runs in order.
+     */
+    if (oob && !(atomic_read(&mon->mc->oob_enabled) &&
+                 (cmd->flags & MONITOR_CMD_OOB))) {
+        if (!atomic_read(&mon->mc->oob_enabled)) {
+            qerror_report(QERR_QMP_EXTRA_MEMBER, "exec-oob");
+        } else {
+            qerror_report(ERROR_CLASS_GENERIC_ERROR,
+                          "Command '%s' cannot run out-of-band", cmd_name);
+        }
+        goto err_out;
+    }
+
     obj = qdict_get(input, "arguments");
     if (!obj) {
         args = qdict_new();
@@ -5101,6 +5609,7 @@ static void handle_qmp_command(JSONMessageParser *parser, QList *tokens)
     } else {
         qmp_call_cmd(mon, cmd, args);
     }
+    qmp_cmd_account(cmd, start_ns);
 
     goto out;
 
@@ -5111,14 +5620,77 @@ out:
     QDECREF(args);
 }
 
+static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
+{
+    MonitorControl *mc = container_of(parser, MonitorControl, parser);
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    QObject *obj;
+
+    obj = json_parser_parse(tokens, NULL);
+
+    if (mc->mon->oob_ctx) {
+        if (qmp_dispatch_oob(mc->mon, obj, start_ns)) {
+            qobject_decref(obj);
+        } else {
+            monitor_qmp_queue(mc->mon, obj, -1, start_ns);
+        }
+        return;
+    }
+
+    qmp_handle_request(mc->mon, obj, start_ns);
+}
+
+static void monitor_qmp_event(Monitor *mon, int event);
+
+/* Main loop side of an out-of-band monitor */
+static void monitor_qmp_bh(void *opaque)
+{
+    Monitor *mon = opaque;
+    MonitorControl *mc = mon->mc;
+    Monitor *old_mon = cur_mon;
+    QMPRequest *req;
+
+    cur_mon = mon;
+    for (;;) {
+        qemu_mutex_lock(&mc->req_lock);
+        req = QSIMPLEQ_FIRST(&mc->reqs);
+        if (req) {
+            QSIMPLEQ_REMOVE_HEAD(&mc->reqs, entry);
+            mc->nr_reqs--;
+        }
+        qemu_mutex_unlock(&mc->req_lock);
+        if (!req) {
+            break;
+        }
+
+        if (req->event >= 0) {
+            monitor_qmp_event(mon, req->event);
+        } else {
+            qmp_handle_request(mon, req->req, req->start_ns);
+        }
+        g_free(req);
+    }
+    cur_mon = old_mon;
+
+    /* The monitor thread may have stopped reading on a full queue */
+    g_main_context_wakeup(mon->oob_ctx);
+}
+
 /**
  * monitor_control_read(): Read and handle QMP input
  */
 static void monitor_control_read(void *opaque, const uint8_t *buf, int size)
 {
     Monitor *old_mon = cur_mon;
+    Monitor *mon = opaque;
 
-    cur_mon = opaque;
+    /* cur_mon belongs to the main loop, see monitor_qmp_bh() */
+    if (mon->oob_ctx) {
+        json_message_parser_feed(&mon->mc->parser, (const char *) buf, size);
+        return;
+    }
+
+    cur_mon = mon;
 
     json_message_parser_feed(&cur_mon->mc->parser, (const char *) buf, size);
 
@@ -5171,14 +5743,34 @@ void monitor_resume(Monitor *mon)
         readline_show_prompt(mon->rs);
 }
 
-static QObject *get_qmp_greeting(void)
+static QObject *get_qmp_greeting(Monitor *mon)
 {
     QObject *ver = NULL;
 
     qmp_marshal_input_query_version(NULL, NULL, &ver);
+    if (mon->oob_ctx) {
+        return qobject_from_jsonf("{'QMP':{'version': %p,"
+                                  "'capabilities': ['oob']}}", ver);
+    }
     return qobject_from_jsonf("{'QMP':{'version': %p,'capabilities': []}}",ver);
 }
 
+/* The part of monitor_control_event() that needs the BQL */
+static void monitor_qmp_event(Monitor *mon, int event)
+{
+    switch (event) {
+    case CHR_EVENT_OPENED:
+        /* in order with the requests of an out-of-band monitor */
+        mon->mc->command_mode = 0;
+        mon_refcount++;
+        break;
+    case CHR_EVENT_CLOSED:
+        mon_refcount--;
+        monitor_fdsets_cleanup();
+        break;
+    }
+}
+
 /**
  * monitor_control_event(): Print QMP gretting
  */
@@ -5189,18 +5781,23 @@ static void monitor_control_event(void *opaque, int event)
 
     switch (event) {
     case CHR_EVENT_OPENED:
-        mon->mc->command_mode = 0;
-        data = get_qmp_greeting();
+        atomic_set(&mon->mc->oob_enabled, false);
+        data = get_qmp_greeting(mon);
         monitor_json_emitter(mon, data);
         qobject_decref(data);
-        mon_refcount++;
         break;
     case CHR_EVENT_CLOSED:
         json_message_parser_destroy(&mon->mc->parser);
         json_message_parser_init(&mon->mc->parser, handle_qmp_command);
-        mon_refcount--;
-        monitor_fdsets_cleanup();
         break;
+    default:
+        return;
+    }
+
+    if (mon->oob_ctx) {
+        monitor_qmp_queue(mon, NULL, event, 0);
+    } else {
+        monitor_qmp_event(mon, event);
     }
 }
 
@@ -5305,6 +5902,37 @@ static void __attribute__((constructor)) monitor_lock_init(void)
     qemu_mutex_init(&monitor_lock);
 }
 
+static void *monitor_oob_thread(void *opaque)
+{
+    Monitor *mon = opaque;
+
+    g_main_loop_run(mon->oob_loop);
+    return NULL;
+}
+
+/* Give a QMP monitor its own thread; only socket chardevs can do this */
+static void monitor_oob_init(Monitor *mon)
+{
+    GMainContext *ctx = g_main_context_new();
+
+    if (qemu_chr_set_gcontext(mon->chr, ctx) < 0) {
+        error_report("monitor on chardev '%s': out-of-band execution needs "
+                     "a socket chardev, using the main loop",
+                     mon->chr->label);
+        g_main_context_unref(ctx);
+        return;
+    }
+
+    qemu_mutex_init(&mon->mc->req_lock);
+    QSIMPLEQ_INIT(&mon->mc->reqs);
+    mon->mc->req_bh = qemu_bh_new(monitor_qmp_bh, mon);
+
+    mon->oob_ctx = ctx;
+    mon->oob_loop = g_main_loop_new(ctx, FALSE);
+    qemu_thread_create(&mon->oob_thread, "monitor_oob", monitor_oob_thread,
+                       mon, QEMU_THREAD_DETACHED);
+}
+
 void monitor_init(CharDriverState *chr, int flags)
 {
     static int is_first_init = 1;
@@ -5313,6 +5941,7 @@ void monitor_init(CharDriverState *chr, int flags)
     if (is_first_init) {
         monitor_qapi_event_init();
         sortcmdlist();
+        qmp_cmd_stats = g_new0(QMPCommandStats, ARRAY_SIZE(qmp_cmds));
         is_first_init = 0;
     }
 
@@ -5331,6 +5960,10 @@ void monitor_init(CharDriverState *chr, int flags)
 
     if (monitor_ctrl_mode(mon)) {
         mon->mc = g_malloc0(sizeof(MonitorControl));
+        mon->mc->mon = mon;
+        if (flags & MONITOR_USE_OOB) {
+            monitor_oob_init(mon);
+        }
         /* Control mode requires special handlers */
         qemu_chr_add_handlers(chr, monitor_can_read, monitor_control_read,
                               monitor_control_event, mon);
@@ -5436,6 +6069,9 @@ QemuOptsList qemu_mon_opts = {
         },{
             .name = "pretty",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "oob",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
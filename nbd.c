@@ -67,6 +67,8 @@
 #define NBD_REPLY_SIZE          (4 + 4 + 8)
 #define NBD_REQUEST_MAGIC       0x25609513
 #define NBD_REPLY_MAGIC         0x67446698
+#define NBD_STRUCTURED_REPLY_MAGIC 0x668e33ef
+#define NBD_CHUNK_HEADER_SIZE   (4 + 2 + 2 + 8 + 4)
 #define NBD_OPTS_MAGIC          0x49484156454F5054LL
 #define NBD_CLIENT_MAGIC        0x0000420281861253LL
 #define NBD_REP_MAGIC           0x3e889045565a9LL
@@ -86,6 +88,18 @@
 #define NBD_OPT_EXPORT_NAME     (1)
 #define NBD_OPT_ABORT           (2)
 #define NBD_OPT_LIST            (3)
+#define NBD_OPT_STRUCTURED_REPLY (8)
+#define NBD_OPT_LIST_META_CONTEXT (9)
+#define NBD_OPT_SET_META_CONTEXT (10)
+
+/* Longest option payload the server parses; larger ones are rejected.  */
+#define NBD_MAX_OPT_LENGTH      4096
+
+/* The only metadata context the server knows; its id is always 0.  */
+#define NBD_META_BASE_ALLOCATION "base:allocation"
+
+/* Maximum number of extents sent in one NBD_CMD_BLOCK_STATUS reply.  */
+#define NBD_MAX_EXTENTS         (128 * 1024)
 
 /* Definitions for opaque data types */
 
@@ -131,6 +145,9 @@ struct NBDClient {
     QTAILQ_ENTRY(NBDClient) next;
     int nb_requests;
     bool closing;
+
+    bool structured_reply;      /* NBD_OPT_STRUCTURED_REPLY negotiated */
+    bool block_status;          /* "base:allocation" context selected */
 };
 
 /* That's all folks */
@@ -231,10 +248,10 @@ static ssize_t write_sync(int fd, void *buffer, size_t size)
 
 */
 
-static int nbd_send_rep(int csock, uint32_t type, uint32_t opt)
+static int nbd_send_rep_len(int csock, uint32_t type, uint32_t opt,
+                            uint32_t len)
 {
     uint64_t magic;
-    uint32_t len;
 
     magic = cpu_to_be64(NBD_REP_MAGIC);
     if (write_sync(csock, &magic, sizeof(magic)) != sizeof(magic)) {
@@ -251,7 +268,7 @@ static int nbd_send_rep(int csock, uint32_t type, uint32_t opt)
         LOG("write failed (rep type)");
         return -EINVAL;
     }
-    len = cpu_to_be32(0);
+    len = cpu_to_be32(len);
     if (write_sync(csock, &len, sizeof(len)) != sizeof(len)) {
         LOG("write failed (rep data length)");
         return -EINVAL;
@@ -259,6 +276,28 @@ static int nbd_send_rep(int csock, uint32_t type, uint32_t opt)
     return 0;
 }
 
+static int nbd_send_rep(int csock, uint32_t type, uint32_t opt)
+{
+    return nbd_send_rep_len(csock, type, opt, 0);
+}
+
+/* Discard the payload of an option that is rejected without parsing it.  */
+static int nbd_drop(int csock, uint32_t length)
+{
+    char buf[512];
+    uint32_t len;
+
+    while (length) {
+        len = MIN(length, sizeof(buf));
+        if (read_sync(csock, buf, len) != len) {
+            LOG("read failed");
+            return -EINVAL;
+        }
+        length -= len;
+    }
+    return 0;
+}
+
 static int nbd_send_rep_list(int csock, NBDExport *exp)
 {
     uint64_t magic, name_len;
@@ -349,6 +388,140 @@ fail:
     return rc;
 }
 
+static int nbd_handle_structured_reply(NBDClient *client, uint32_t length)
+{
+    int csock = client->sock;
+
+    if (length) {
+        if (nbd_drop(csock, length) < 0) {
+            return -EINVAL;
+        }
+        return nbd_send_rep(csock, NBD_REP_ERR_INVALID,
+                            NBD_OPT_STRUCTURED_REPLY);
+    }
+
+    client->structured_reply = true;
+    return nbd_send_rep(csock, NBD_REP_ACK, NBD_OPT_STRUCTURED_REPLY);
+}
+
+static int nbd_send_rep_meta_context(int csock, uint32_t opt)
+{
+    const char *name = NBD_META_BASE_ALLOCATION;
+    uint32_t len = strlen(name);
+    uint32_t id = cpu_to_be32(0);
+
+    if (nbd_send_rep_len(csock, NBD_REP_META_CONTEXT, opt,
+                         sizeof(id) + len) < 0) {
+        return -EINVAL;
+    }
+    if (write_sync(csock, &id, sizeof(id)) != sizeof(id) ||
+        write_sync(csock, (void *)name, len) != len) {
+        LOG("write failed (meta context)");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Read a 32-bit length-prefixed string from an option payload.  */
+static char *nbd_opt_string(const uint8_t **p, const uint8_t *end)
+{
+    uint32_t len;
+    char *str;
+
+    if (end - *p < 4) {
+        return NULL;
+    }
+    len = ldl_be_p(*p);
+    *p += 4;
+    if (len > end - *p) {
+        return NULL;
+    }
+    str = g_strndup((const char *)*p, len);
+    *p += len;
+    return str;
+}
+
+static int nbd_handle_meta_context(NBDClient *client, uint32_t opt,
+                                   uint32_t length)
+{
+    int csock = client->sock;
+    uint8_t *buf;
+    const uint8_t *p, *end;
+    char *name, *query;
+    uint32_t nb_queries, i;
+    bool match = false;
+    int rc;
+
+    /* Client sends:
+        [20 ..  23]   export name length
+        [24 ..  xx]   export name
+        [xx ..  xx]   number of queries
+        ...           queries (length and string each)
+     */
+    if (length > NBD_MAX_OPT_LENGTH ||
+        (opt == NBD_OPT_SET_META_CONTEXT && !client->structured_reply)) {
+        if (nbd_drop(csock, length) < 0) {
+            return -EINVAL;
+        }
+        return nbd_send_rep(csock, NBD_REP_ERR_INVALID, opt);
+    }
+
+    buf = g_malloc(length);
+    if (read_sync(csock, buf, length) != length) {
+        LOG("read failed");
+        g_free(buf);
+        return -EINVAL;
+    }
+    p = buf;
+    end = buf + length;
+
+    name = nbd_opt_string(&p, end);
+    if (!name || end - p < 4) {
+        g_free(name);
+        g_free(buf);
+        return nbd_send_rep(csock, NBD_REP_ERR_INVALID, opt);
+    }
+    if (!nbd_export_find(name)) {
+        LOG("export not found");
+        g_free(name);
+        g_free(buf);
+        return nbd_send_rep(csock, NBD_REP_ERR_UNKNOWN, opt);
+    }
+    g_free(name);
+
+    nb_queries = ldl_be_p(p);
+    p += 4;
+
+    /* Listing with no queries returns every context the server has.  */
+    if (opt == NBD_OPT_LIST_META_CONTEXT && nb_queries == 0) {
+        match = true;
+    }
+    for (i = 0; i < nb_queries; i++) {
+        query = nbd_opt_string(&p, end);
+        if (!query) {
+            g_free(buf);
+            return nbd_send_rep(csock, NBD_REP_ERR_INVALID, opt);
+        }
+        if (!strcmp(query, NBD_META_BASE_ALLOCATION) ||
+            (opt == NBD_OPT_LIST_META_CONTEXT && !strcmp(query, "base:"))) {
+            match = true;
+        }
+        g_free(query);
+    }
+    g_free(buf);
+
+    if (opt == NBD_OPT_SET_META_CONTEXT) {
+        client->block_status = match;
+    }
+    if (match) {
+        rc = nbd_send_rep_meta_context(csock, opt);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return nbd_send_rep(csock, NBD_REP_ACK, opt);
+}
+
 static int nbd_receive_options(NBDClient *client)
 {
     while (1) {
@@ -410,6 +583,20 @@ static int nbd_receive_options(NBDClient *client)
         case NBD_OPT_EXPORT_NAME:
             return nbd_handle_export_name(client, length);
 
+        case NBD_OPT_STRUCTURED_REPLY:
+            if (nbd_handle_structured_reply(client, length) < 0) {
+                return -EINVAL;
+            }
+            break;
+
+        case NBD_OPT_LIST_META_CONTEXT:
+        case NBD_OPT_SET_META_CONTEXT:
+            if (nbd_handle_meta_context(client, be32_to_cpu(tmp),
+                                        length) < 0) {
+                return -EINVAL;
+            }
+            break;
+
         default:
             tmp = be32_to_cpu(tmp);
             LOG("Unsupported option 0x%x", tmp);
@@ -424,8 +611,12 @@ static int nbd_send_negotiate(NBDClient *client)
     int csock = client->sock;
     char buf[8 + 8 + 8 + 128];
     int rc;
-    const int myflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_TRIM |
-                         NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA);
+    /* All connections to an export share one BlockDriverState, so a flush
+     * on any of them covers writes completed on the others.
+     */
+    int myflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_TRIM |
+                   NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA |
+                   NBD_FLAG_CAN_MULTI_CONN);
 
     /* Negotiation header without options:
         [ 0 ..   7]   passwd       ("NBDMAGIC")
@@ -478,6 +669,9 @@ static int nbd_send_negotiate(NBDClient *client)
             goto fail;
         }
 
+        if (client->structured_reply) {
+            myflags |= NBD_FLAG_SEND_DF;
+        }
         assert ((client->exp->nbdflags & ~65535) == 0);
         cpu_to_be64w((uint64_t*)(buf + 18), client->exp->size);
         cpu_to_be16w((uint16_t*)(buf + 26), client->exp->nbdflags | myflags);
@@ -1101,6 +1295,194 @@ static ssize_t nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
     return rc;
 }
 
+static ssize_t nbd_co_send_chunk(NBDRequest *req, uint64_t handle,
+                                 uint16_t flags, uint16_t type,
+                                 void *payload, size_t payload_len,
+                                 void *data, size_t data_len)
+{
+    NBDClient *client = req->client;
+    int csock = client->sock;
+    uint8_t buf[NBD_CHUNK_HEADER_SIZE];
+    ssize_t rc = 0;
+
+    /* Structured reply chunk:
+       [ 0 ..  3]    magic   (NBD_STRUCTURED_REPLY_MAGIC)
+       [ 4 ..  5]    flags
+       [ 6 ..  7]    type
+       [ 8 .. 15]    handle
+       [16 .. 19]    length  (payload and data)
+       [20 .. xx]    payload, then data
+     */
+    stl_be_p(buf, NBD_STRUCTURED_REPLY_MAGIC);
+    stw_be_p(buf + 4, flags);
+    stw_be_p(buf + 6, type);
+    stq_be_p(buf + 8, handle);
+    stl_be_p(buf + 16, payload_len + data_len);
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+    nbd_set_handlers(client);
+
+    socket_set_cork(csock, 1);
+    if (write_sync(csock, buf, sizeof(buf)) != sizeof(buf) ||
+        write_sync(csock, payload, payload_len) != payload_len ||
+        write_sync(csock, data, data_len) != data_len) {
+        LOG("write failed (structured reply chunk)");
+        rc = -EIO;
+    }
+    socket_set_cork(csock, 0);
+
+    client->send_coroutine = NULL;
+    nbd_set_handlers(client);
+    qemu_co_mutex_unlock(&client->send_lock);
+    return rc;
+}
+
+static ssize_t nbd_co_send_error_chunk(NBDRequest *req, uint64_t handle,
+                                       uint32_t error)
+{
+    uint8_t payload[4 + 2];
+
+    /* Error chunk payload: error value, then an empty message */
+    stl_be_p(payload, error);
+    stw_be_p(payload + 4, 0);
+    return nbd_co_send_chunk(req, handle, NBD_REPLY_FLAG_DONE,
+                             NBD_REPLY_TYPE_ERROR, payload, sizeof(payload),
+                             NULL, 0);
+}
+
+/* Answer NBD_CMD_READ with one chunk per extent, so that ranges which read
+ * as zeroes go on the wire as a hole descriptor instead of data.  I/O
+ * errors are reported to the client in an error chunk; a negative return
+ * value means the connection is lost.
+ */
+static ssize_t nbd_co_send_sparse_read(NBDRequest *req,
+                                       struct nbd_request *request)
+{
+    NBDExport *exp = req->client->exp;
+    uint8_t payload[8 + 4];
+    uint32_t done = 0, len;
+    uint16_t flags;
+    int64_t ret;
+    int pnum;
+
+    if (request->len == 0) {
+        return nbd_co_send_chunk(req, request->handle, NBD_REPLY_FLAG_DONE,
+                                 NBD_REPLY_TYPE_NONE, NULL, 0, NULL, 0);
+    }
+
+    while (done < request->len) {
+        int64_t sector_num = (request->from + exp->dev_offset + done) /
+                             BDRV_SECTOR_SIZE;
+        int nb_sectors = (request->len - done) / BDRV_SECTOR_SIZE;
+
+        if (request->type & NBD_CMD_FLAG_DF) {
+            /* The client wants the whole read in a single data chunk */
+            ret = 0;
+            pnum = nb_sectors;
+        } else {
+            ret = bdrv_get_block_status_above(exp->bs, NULL, sector_num,
+                                              nb_sectors, &pnum);
+            if (ret < 0 || pnum == 0) {
+                ret = 0;
+                pnum = nb_sectors;
+            }
+        }
+        len = pnum * BDRV_SECTOR_SIZE;
+        flags = done + len == request->len ? NBD_REPLY_FLAG_DONE : 0;
+        stq_be_p(payload, request->from + done);
+
+        if (ret & BDRV_BLOCK_ZERO) {
+            stl_be_p(payload + 8, len);
+            ret = nbd_co_send_chunk(req, request->handle, flags,
+                                    NBD_REPLY_TYPE_OFFSET_HOLE,
+                                    payload, sizeof(payload), NULL, 0);
+        } else {
+            ret = bdrv_read(exp->bs, sector_num, req->data + done, pnum);
+            if (ret < 0) {
+                LOG("reading from file failed");
+                return nbd_co_send_error_chunk(req, request->handle, -ret);
+            }
+            ret = nbd_co_send_chunk(req, request->handle, flags,
+                                    NBD_REPLY_TYPE_OFFSET_DATA,
+                                    payload, 8, req->data + done, len);
+        }
+        if (ret < 0) {
+            return -EIO;
+        }
+        done += len;
+    }
+
+    TRACE("Read %u byte(s)", request->len);
+    return 0;
+}
+
+/* Describe the allocation status of the requested range in the
+ * "base:allocation" context.  Adjacent extents with the same flags are
+ * merged, and the reply may cover less than the request.
+ */
+static ssize_t nbd_co_send_block_status(NBDRequest *req,
+                                        struct nbd_request *request)
+{
+    NBDExport *exp = req->client->exp;
+    uint32_t max_extents, nb_extents = 0, done = 0;
+    uint32_t *extents;
+    int64_t ret;
+    int pnum;
+
+    max_extents = request->type & NBD_CMD_FLAG_REQ_ONE ? 1 : NBD_MAX_EXTENTS;
+
+    /* Payload: context id, then (length, flags) pairs */
+    extents = g_new(uint32_t, 1 + 2 * MIN(max_extents,
+                    request->len / BDRV_SECTOR_SIZE + 1));
+    extents[0] = cpu_to_be32(0);
+
+    while (done < request->len) {
+        uint32_t len, state = 0;
+
+        ret = bdrv_get_block_status_above(exp->bs, NULL,
+                                          (request->from + exp->dev_offset +
+                                           done) / BDRV_SECTOR_SIZE,
+                                          (request->len - done) /
+                                          BDRV_SECTOR_SIZE, &pnum);
+        if (ret < 0) {
+            LOG("block status failed");
+            g_free(extents);
+            return nbd_co_send_error_chunk(req, request->handle, -ret);
+        }
+        if (pnum == 0) {
+            break;
+        }
+        len = pnum * BDRV_SECTOR_SIZE;
+        if (!(ret & BDRV_BLOCK_ALLOCATED)) {
+            state |= NBD_STATE_HOLE;
+        }
+        if (ret & BDRV_BLOCK_ZERO) {
+            state |= NBD_STATE_ZERO;
+        }
+
+        if (nb_extents &&
+            be32_to_cpu(extents[2 * nb_extents]) == state) {
+            extents[2 * nb_extents - 1] =
+                cpu_to_be32(be32_to_cpu(extents[2 * nb_extents - 1]) + len);
+        } else if (nb_extents < max_extents) {
+            nb_extents++;
+            extents[2 * nb_extents - 1] = cpu_to_be32(len);
+            extents[2 * nb_extents] = cpu_to_be32(state);
+        } else {
+            break;
+        }
+        done += len;
+    }
+
+    ret = nbd_co_send_chunk(req, request->handle, NBD_REPLY_FLAG_DONE,
+                            NBD_REPLY_TYPE_BLOCK_STATUS, extents,
+                            (1 + 2 * nb_extents) * sizeof(uint32_t),
+                            NULL, 0);
+    g_free(extents);
+    return ret;
+}
+
 static ssize_t nbd_co_receive_request(NBDRequest *req, struct nbd_request *request)
 {
     NBDClient *client = req->client;
@@ -1119,7 +1501,10 @@ static ssize_t nbd_co_receive_request(NBDRequest *req, struct nbd_request *reque
         goto out;
     }
 
-    if (request->len > NBD_MAX_BUFFER_SIZE) {
+    command = request->type & NBD_CMD_MASK_COMMAND;
+    /* BLOCK_STATUS transfers no data, so it may span the whole export.  */
+    if (command != NBD_CMD_BLOCK_STATUS &&
+        request->len > NBD_MAX_BUFFER_SIZE) {
         LOG("len (%u) is larger than max len (%u)",
             request->len, NBD_MAX_BUFFER_SIZE);
         rc = -EINVAL;
@@ -1135,7 +1520,6 @@ static ssize_t nbd_co_receive_request(NBDRequest *req, struct nbd_request *reque
 
     TRACE("Decoding type");
 
-    command = request->type & NBD_CMD_MASK_COMMAND;
     if (command == NBD_CMD_READ || command == NBD_CMD_WRITE) {
         req->data = qemu_blockalign(client->exp->bs, request->len);
     }
@@ -1183,12 +1567,12 @@ static void nbd_trip(void *opaque)
 
     reply.handle = request.handle;
     reply.error = 0;
+    command = request.type & NBD_CMD_MASK_COMMAND;
 
     if (ret < 0) {
         reply.error = -ret;
         goto error_reply;
     }
-    command = request.type & NBD_CMD_MASK_COMMAND;
     if (command != NBD_CMD_DISC && (request.from + request.len) > exp->size) {
             LOG("From: %" PRIu64 ", Len: %u, Size: %" PRIu64
             ", Offset: %" PRIu64 "\n",
@@ -1211,6 +1595,13 @@ static void nbd_trip(void *opaque)
             }
         }
 
+        if (client->structured_reply) {
+            if (nbd_co_send_sparse_read(req, &request) < 0) {
+                goto out;
+            }
+            break;
+        }
+
         ret = bdrv_read(exp->bs, (request.from + exp->dev_offset) / 512,
                         req->data, request.len / 512);
         if (ret < 0) {
@@ -1283,12 +1674,31 @@ static void nbd_trip(void *opaque)
             goto out;
         }
         break;
+    case NBD_CMD_BLOCK_STATUS:
+        TRACE("Request type is BLOCK_STATUS");
+        if (!client->block_status) {
+            LOG("no metadata context was negotiated");
+            goto invalid_request;
+        }
+        if (nbd_co_send_block_status(req, &request) < 0) {
+            goto out;
+        }
+        break;
     default:
         LOG("invalid request type (%u) received", request.type);
     invalid_request:
         reply.error = -EINVAL;
     error_reply:
-        if (nbd_co_send_reply(req, &reply, 0) < 0) {
+        /* Replies to commands that use structured replies must be
+         * structured too, even when they only carry an error.
+         */
+        if (client->structured_reply &&
+            (command == NBD_CMD_READ || command == NBD_CMD_BLOCK_STATUS)) {
+            ret = nbd_co_send_error_chunk(req, reply.handle, reply.error);
+        } else {
+            ret = nbd_co_send_reply(req, &reply, 0);
+        }
+        if (ret < 0) {
             goto out;
         }
         break;
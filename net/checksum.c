@@ -21,19 +21,60 @@
 #define PROTO_TCP  6
 #define PROTO_UDP 17
 
+/*
+ * The ones' complement sum doesn't care about byte order (RFC 1071): sum
+ * the buffer in host-order words and byte-swap the folded result.  The
+ * 32-bit loads go into a 64-bit accumulator, so no carries are lost for
+ * any len that fits in an int, and the compiler is free to vectorize the
+ * main loop.
+ *
+ * The returned partial sum is folded to 16 bits; callers may still add
+ * several of them before net_checksum_finish().
+ */
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum = 0;
-    int i;
+    uint64_t sum = 0;
+    uint32_t w32;
+    uint16_t w16;
 
-    for (i = seq; i < seq + len; i++) {
-        if (i & 1) {
-            sum += (uint32_t)buf[i - seq];
-        } else {
-            sum += (uint32_t)buf[i - seq] << 8;
-        }
+    while (len >= 16) {
+        uint32_t w[4];
+
+        memcpy(w, buf, sizeof(w));
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        buf += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        memcpy(&w32, buf, 4);
+        sum += w32;
+        buf += 4;
+        len -= 4;
     }
-    return sum;
+    if (len >= 2) {
+        memcpy(&w16, buf, 2);
+        sum += w16;
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        /* a trailing byte is the high-order half of a word */
+        uint8_t tail[2] = { buf[0], 0 };
+
+        memcpy(&w16, tail, 2);
+        sum += w16;
+    }
+
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    /* now in host order; the sum is defined over big-endian words */
+    w16 = be16_to_cpu((uint16_t)sum);
+
+    /* starting on an odd byte swaps the roles of the two halves */
+    return (seq & 1) ? bswap16(w16) : w16;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -215,3 +215,104 @@ bool eth_parse_ipv6_hdr(struct iovec *pkt, int pkt_frags,
     *l4proto = ext_hdr.ip6r_nxt;
     return true;
 }
+
+/*
+ * Collect the RSS hash input of an Ethernet frame: source and destination
+ * addresses, followed by the TCP ports for unfragmented TCP. @types is a
+ * mask of ETH_RSS_TYPE_BIT() values the caller may hash on; the one used
+ * is returned, or ETH_RSS_TYPE_NONE if the frame doesn't qualify.
+ */
+eth_rss_types_e
+eth_get_rss_input(const uint8_t *pkt, size_t size, uint32_t types,
+                  uint8_t *input, size_t *input_len)
+{
+    size_t l2hdr_len;
+
+    if (size < ETH_MAX_L2_HDR_LEN) {
+        return ETH_RSS_TYPE_NONE;
+    }
+
+    l2hdr_len = eth_get_l2_hdr_length(pkt);
+    switch (eth_get_l3_proto(pkt, l2hdr_len)) {
+    case ETH_P_IP: {
+        struct ip_header *iphdr = (struct ip_header *)(pkt + l2hdr_len);
+        size_t l3hdr_len;
+        bool is_frag;
+
+        if (size < l2hdr_len + sizeof(*iphdr) ||
+            IP_HEADER_VERSION(iphdr) != IP_HEADER_VERSION_4) {
+            return ETH_RSS_TYPE_NONE;
+        }
+        l3hdr_len = IP_HDR_GET_LEN(iphdr);
+        is_frag = be16_to_cpu(iphdr->ip_off) & (IP_MF | IP_OFFMASK);
+
+        memcpy(input, &iphdr->ip_src, 8);
+        if ((types & ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_TCP_IPV4)) &&
+            iphdr->ip_p == IP_PROTO_TCP && !is_frag &&
+            size >= l2hdr_len + l3hdr_len + 4) {
+            memcpy(input + 8, pkt + l2hdr_len + l3hdr_len, 4);
+            *input_len = 12;
+            return ETH_RSS_TYPE_TCP_IPV4;
+        }
+        if (types & ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_IPV4)) {
+            *input_len = 8;
+            return ETH_RSS_TYPE_IPV4;
+        }
+        return ETH_RSS_TYPE_NONE;
+    }
+    case ETH_P_IPV6: {
+        struct iovec hdr_vec = {
+            .iov_base = (void *)pkt,
+            .iov_len = size
+        };
+        size_t l3hdr_len;
+        uint8_t l4proto;
+
+        if (size < l2hdr_len + sizeof(struct ip6_header) ||
+            !eth_parse_ipv6_hdr(&hdr_vec, 1, l2hdr_len,
+                                &l4proto, &l3hdr_len)) {
+            return ETH_RSS_TYPE_NONE;
+        }
+
+        memcpy(input, pkt + l2hdr_len +
+               offsetof(struct ip6_header, ip6_src), 32);
+        if ((types & ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_TCP_IPV6)) &&
+            l4proto == IP_PROTO_TCP &&
+            size >= l2hdr_len + l3hdr_len + 4) {
+            memcpy(input + 32, pkt + l2hdr_len + l3hdr_len, 4);
+            *input_len = 36;
+            return ETH_RSS_TYPE_TCP_IPV6;
+        }
+        if (types & ETH_RSS_TYPE_BIT(ETH_RSS_TYPE_IPV6)) {
+            *input_len = 32;
+            return ETH_RSS_TYPE_IPV6;
+        }
+        return ETH_RSS_TYPE_NONE;
+    }
+    default:
+        return ETH_RSS_TYPE_NONE;
+    }
+}
+
+/* Toeplitz hash of @len bytes of @input, @key is ETH_RSS_KEY_SIZE bytes */
+uint32_t
+eth_calc_rss_hash(const uint8_t *key, const uint8_t *input, size_t len)
+{
+    uint32_t hash = 0;
+    uint32_t v = ldl_be_p(key);
+    size_t i;
+    int b;
+
+    assert(len <= ETH_RSS_INPUT_MAX);
+
+    for (i = 0; i < len; i++) {
+        for (b = 7; b >= 0; b--) {
+            if (input[i] & (1 << b)) {
+                hash ^= v;
+            }
+            v = (v << 1) | ((key[i + 4] >> b) & 1);
+        }
+    }
+
+    return hash;
+}
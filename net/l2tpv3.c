@@ -47,6 +47,8 @@
 #define IOVSIZE 2
 #define MAX_L2TPV3_MSGCNT 64
 #define MAX_L2TPV3_IOVCNT (MAX_L2TPV3_MSGCNT * IOVSIZE)
+/* batch= limit, the kernel's UIO_MAXIOV cap on recvmmsg()/sendmmsg() */
+#define MAX_L2TPV3_BATCH 1024
 
 /* Header set to 0x30000 signifies a data packet */
 
@@ -71,10 +73,25 @@ typedef struct NetL2TPV3State {
     struct iovec *vec;
 
     /*
-     * these are used for receive - try to "eat" up to 32 packets at a time
+     * these are used for receive - try to "eat" up to batch packets at a time
      */
 
     struct mmsghdr *msgvec;
+    unsigned int batch;
+
+#ifdef CONFIG_SENDMMSG
+    /*
+     * transmit batch, filled while the peer is plugged; slots
+     * [tx_head, tx_len) have not been sent yet
+     */
+
+    int plugged;
+    unsigned int tx_head;
+    unsigned int tx_len;
+    struct mmsghdr *tx_msgvec;
+    struct iovec *tx_vec;       /* IOVSIZE per slot: header, data copy */
+    uint8_t *tx_header_buf;     /* offset bytes per slot */
+#endif
 
     /*
      * peer address
@@ -162,10 +179,20 @@ static void l2tpv3_write_poll(NetL2TPV3State *s, bool enable)
     }
 }
 
+#ifdef CONFIG_SENDMMSG
+static void l2tpv3_flush_batch(NetL2TPV3State *s);
+#endif
+
 static void l2tpv3_writable(void *opaque)
 {
     NetL2TPV3State *s = opaque;
     l2tpv3_write_poll(s, false);
+#ifdef CONFIG_SENDMMSG
+    l2tpv3_flush_batch(s);
+    if (s->tx_len) {
+        return;
+    }
+#endif
     qemu_flush_queued_packets(&s->nc);
 }
 
@@ -223,6 +250,111 @@ static void l2tpv3_form_header(NetL2TPV3State *s)
     }
 }
 
+#ifdef CONFIG_SENDMMSG
+static void l2tpv3_flush_batch(NetL2TPV3State *s)
+{
+    unsigned int i;
+    int ret;
+
+    while (s->tx_head < s->tx_len) {
+        ret = sendmmsg(s->fd, s->tx_msgvec + s->tx_head,
+                       s->tx_len - s->tx_head, 0);
+        if ((ret == -1) && (errno == EINTR)) {
+            continue;
+        }
+        if ((ret == -1) && ((errno == EAGAIN) || (errno == ENOBUFS))) {
+            l2tpv3_write_poll(s, true);
+            return;
+        }
+        if (ret == -1) {
+            /* as with sendmsg(), a packet that fails is dropped */
+            ret = 1;
+        }
+        for (i = s->tx_head; i < s->tx_head + ret; i++) {
+            g_free(s->tx_vec[i * IOVSIZE + 1].iov_base);
+            s->tx_vec[i * IOVSIZE + 1].iov_base = NULL;
+        }
+        s->tx_head += ret;
+    }
+    s->tx_head = s->tx_len = 0;
+}
+
+/* Returns false if the batch is full and could not be flushed */
+static bool l2tpv3_batch_add(NetL2TPV3State *s,
+                    const struct iovec *iov,
+                    int iovcnt)
+{
+    struct mmsghdr *msgvec;
+    struct iovec *vec;
+    size_t size;
+    unsigned int i;
+
+    if (s->tx_len == s->batch) {
+        l2tpv3_flush_batch(s);
+        if (s->tx_len == s->batch) {
+            return false;
+        }
+    }
+
+    if (!s->tx_msgvec) {
+        s->tx_msgvec = g_new0(struct mmsghdr, s->batch);
+        s->tx_vec = g_new0(struct iovec, s->batch * IOVSIZE);
+        s->tx_header_buf = g_malloc(s->batch * s->offset);
+    }
+
+    i = s->tx_len++;
+    l2tpv3_form_header(s);
+    vec = s->tx_vec + i * IOVSIZE;
+    vec->iov_base = s->tx_header_buf + i * s->offset;
+    vec->iov_len = s->offset;
+    memcpy(vec->iov_base, s->header_buf, s->offset);
+    vec++;
+    /* the data has to outlive the caller's buffer until the flush */
+    size = iov_size(iov, iovcnt);
+    vec->iov_base = g_malloc(size);
+    vec->iov_len = size;
+    iov_to_buf(iov, iovcnt, 0, vec->iov_base, size);
+
+    msgvec = s->tx_msgvec + i;
+    memset(msgvec, 0, sizeof(*msgvec));
+    msgvec->msg_hdr.msg_name = s->dgram_dst;
+    msgvec->msg_hdr.msg_namelen = s->dst_size;
+    msgvec->msg_hdr.msg_iov = s->tx_vec + i * IOVSIZE;
+    msgvec->msg_hdr.msg_iovlen = IOVSIZE;
+    return true;
+}
+
+static ssize_t l2tpv3_batch_send(NetL2TPV3State *s,
+                    const struct iovec *iov,
+                    int iovcnt)
+{
+    if (!l2tpv3_batch_add(s, iov, iovcnt)) {
+        return 0;
+    }
+    if (!s->plugged) {
+        l2tpv3_flush_batch(s);
+    }
+    return iov_size(iov, iovcnt);
+}
+
+static void l2tpv3_io_plug(NetClientState *nc)
+{
+    NetL2TPV3State *s = DO_UPCAST(NetL2TPV3State, nc, nc);
+
+    s->plugged++;
+}
+
+static void l2tpv3_io_unplug(NetClientState *nc)
+{
+    NetL2TPV3State *s = DO_UPCAST(NetL2TPV3State, nc, nc);
+
+    assert(s->plugged > 0);
+    if (--s->plugged == 0) {
+        l2tpv3_flush_batch(s);
+    }
+}
+#endif
+
 static ssize_t net_l2tpv3_receive_dgram_iov(NetClientState *nc,
                     const struct iovec *iov,
                     int iovcnt)
@@ -232,6 +364,12 @@ static ssize_t net_l2tpv3_receive_dgram_iov(NetClientState *nc,
     struct msghdr message;
     int ret;
 
+#ifdef CONFIG_SENDMMSG
+    /* keep ordering behind packets still waiting in the batch */
+    if (s->plugged || s->tx_len) {
+        return l2tpv3_batch_send(s, iov, iovcnt);
+    }
+#endif
     if (iovcnt > MAX_L2TPV3_IOVCNT - 1) {
         error_report(
             "iovec too long %d > %d, change l2tpv3.h",
@@ -281,6 +419,16 @@ static ssize_t net_l2tpv3_receive_dgram(NetClientState *nc,
     struct msghdr message;
     ssize_t ret = 0;
 
+#ifdef CONFIG_SENDMMSG
+    if (s->plugged || s->tx_len) {
+        struct iovec iov = {
+            .iov_base = (void *) buf,
+            .iov_len = size,
+        };
+        return l2tpv3_batch_send(s, &iov, 1);
+    }
+#endif
+
     l2tpv3_form_header(s);
     vec = s->vec;
     vec->iov_base = s->header_buf;
@@ -397,7 +545,7 @@ static void net_l2tpv3_process_queue(NetL2TPV3State *s)
             } else {
                 bad_read = true;
             }
-            s->queue_tail = (s->queue_tail + 1) % MAX_L2TPV3_MSGCNT;
+            s->queue_tail = (s->queue_tail + 1) % s->batch;
             s->queue_depth--;
         } while (
                 (s->queue_depth > 0) &&
@@ -421,14 +569,14 @@ static void net_l2tpv3_send(void *opaque)
          * count of how much we can read varies - adjust accordingly
          */
 
-        target_count = MAX_L2TPV3_MSGCNT - s->queue_depth;
+        target_count = s->batch - s->queue_depth;
 
         /* Ensure we do not overrun the ring when we have
          * a lot of enqueued packets
          */
 
-        if (s->queue_head + target_count > MAX_L2TPV3_MSGCNT) {
-            target_count = MAX_L2TPV3_MSGCNT - s->queue_head;
+        if (s->queue_head + target_count > s->batch) {
+            target_count = s->batch - s->queue_head;
         }
     } else {
 
@@ -439,7 +587,7 @@ static void net_l2tpv3_send(void *opaque)
 
         s->queue_head = 0;
         s->queue_tail = 0;
-        target_count = MAX_L2TPV3_MSGCNT;
+        target_count = s->batch;
     }
 
     msgvec = s->msgvec + s->queue_head;
@@ -456,7 +604,7 @@ static void net_l2tpv3_send(void *opaque)
              */
             count = 0;
         }
-        s->queue_head = (s->queue_head + count) % MAX_L2TPV3_MSGCNT;
+        s->queue_head = (s->queue_head + count) % s->batch;
         s->queue_depth += count;
     }
     net_l2tpv3_process_queue(s);
@@ -519,7 +667,15 @@ static void net_l2tpv3_cleanup(NetClientState *nc)
     if (s->fd >= 0) {
         close(s->fd);
     }
-    destroy_vector(s->msgvec, MAX_L2TPV3_MSGCNT, IOVSIZE);
+    destroy_vector(s->msgvec, s->batch, IOVSIZE);
+#ifdef CONFIG_SENDMMSG
+    while (s->tx_head < s->tx_len) {
+        g_free(s->tx_vec[s->tx_head++ * IOVSIZE + 1].iov_base);
+    }
+    g_free(s->tx_msgvec);
+    g_free(s->tx_vec);
+    g_free(s->tx_header_buf);
+#endif
     g_free(s->vec);
     g_free(s->header_buf);
     g_free(s->dgram_dst);
@@ -532,6 +688,10 @@ static NetClientInfo net_l2tpv3_info = {
     .receive_iov = net_l2tpv3_receive_dgram_iov,
     .poll = l2tpv3_poll,
     .cleanup = net_l2tpv3_cleanup,
+#ifdef CONFIG_SENDMMSG
+    .io_plug = l2tpv3_io_plug,
+    .io_unplug = l2tpv3_io_unplug,
+#endif
 };
 
 int net_init_l2tpv3(const NetClientOptions *opts,
@@ -555,10 +715,20 @@ int net_init_l2tpv3(const NetClientOptions *opts,
     s->queue_head = 0;
     s->queue_tail = 0;
     s->header_mismatch = false;
+    s->batch = MAX_L2TPV3_MSGCNT;
 
     assert(opts->kind == NET_CLIENT_OPTIONS_KIND_L2TPV3);
     l2tpv3 = opts->l2tpv3;
 
+    if (l2tpv3->has_batch) {
+        if (l2tpv3->batch < 1 || l2tpv3->batch > MAX_L2TPV3_BATCH) {
+            error_report("l2tpv3_open : batch must be between 1 and %d",
+                         MAX_L2TPV3_BATCH);
+            goto outerr;
+        }
+        s->batch = l2tpv3->batch;
+    }
+
     if (l2tpv3->has_ipv6 && l2tpv3->ipv6) {
         s->ipv6 = l2tpv3->ipv6;
     } else {
@@ -729,7 +899,7 @@ int net_init_l2tpv3(const NetClientOptions *opts,
         s->header_size = s->offset + sizeof(struct iphdr);
     }
 
-    s->msgvec = build_l2tpv3_vector(s, MAX_L2TPV3_MSGCNT);
+    s->msgvec = build_l2tpv3_vector(s, s->batch);
     s->vec = g_malloc(sizeof(struct iovec) * MAX_L2TPV3_IOVCNT);
     s->header_buf = g_malloc(s->header_size);
 
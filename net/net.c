@@ -28,6 +28,7 @@
 #include "hub.h"
 #include "net/slirp.h"
 #include "net/eth.h"
+#include "net/vhost_net.h"
 #include "util.h"
 
 #include "monitor/monitor.h"
@@ -452,6 +453,52 @@ void qemu_set_vnet_hdr_len(NetClientState *nc, int len)
     nc->info->set_vnet_hdr_len(nc, len);
 }
 
+/* A burst of packets is about to be sent to @nc.  Backends that can
+ * transmit several packets with one system call hold them back until
+ * the matching qemu_net_io_unplug().  Calls nest.
+ */
+void qemu_net_io_plug(NetClientState *nc)
+{
+    if (!nc || !nc->info->io_plug) {
+        return;
+    }
+
+    nc->info->io_plug(nc);
+}
+
+void qemu_net_io_unplug(NetClientState *nc)
+{
+    if (!nc || !nc->info->io_unplug) {
+        return;
+    }
+
+    nc->info->io_unplug(nc);
+}
+
+/* Direct receive: a backend that can read a packet straight into memory
+ * asks its peer for a receive buffer, reads into it and hands it back with
+ * the packet length, or a negative value to return the buffer unused.  At
+ * most one buffer is outstanding.  Returns the number of iovecs, or 0 when
+ * the backend has to fall back to qemu_send_packet().
+ */
+int qemu_peer_get_rx_buffer(NetClientState *nc, struct iovec *iov, int iovcnt)
+{
+    NetClientState *peer = nc->peer;
+
+    if (!peer || !peer->info->rx_buffer_get ||
+        nc->link_down || peer->receive_disabled ||
+        !qemu_net_queue_empty(peer->incoming_queue)) {
+        return 0;
+    }
+
+    return peer->info->rx_buffer_get(peer, iov, iovcnt);
+}
+
+void qemu_peer_put_rx_buffer(NetClientState *nc, ssize_t len)
+{
+    nc->peer->info->rx_buffer_put(nc->peer, len);
+}
+
 int qemu_can_send_packet(NetClientState *sender)
 {
     int vm_running = runstate_is_running();
@@ -1115,6 +1162,94 @@ RxFilterInfoList *qmp_query_rx_filter(bool has_name, const char *name,
     return filter_list;
 }
 
+NetQueueInfoList *qmp_query_net_queues(bool has_name, const char *name,
+                                       Error **errp)
+{
+    NetClientState *nc;
+    NetQueueInfoList *list = NULL, *last_entry = NULL;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        NetQueueInfoList *entry;
+        NetQueueInfo *info;
+        NetQueueStats stats;
+
+        if (has_name && strcmp(nc->name, name) != 0) {
+            continue;
+        }
+
+        qemu_net_queue_get_stats(nc->incoming_queue, &stats);
+        info = g_malloc0(sizeof(*info));
+        info->name = g_strdup(nc->name);
+        info->length = stats.length;
+        info->queued = stats.queued;
+        info->dropped = stats.dropped;
+
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = info;
+        if (!list) {
+            list = entry;
+        } else {
+            last_entry->next = entry;
+        }
+        last_entry = entry;
+    }
+
+    if (list == NULL && has_name) {
+        error_setg(errp, "invalid net client name: %s", name);
+    }
+
+    return list;
+}
+
+VhostNetInfoList *qmp_query_vhost_net(bool has_name, const char *name,
+                                      Error **errp)
+{
+    NetClientState *nc;
+    VhostNetInfoList *list = NULL, *last_entry = NULL;
+    bool found = false;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        VhostNetInfoList *entry;
+        VhostNetInfo *info;
+        VHostNetState *net;
+
+        if (has_name && strcmp(nc->name, name) != 0) {
+            continue;
+        }
+        found = true;
+
+        if (nc->info->type != NET_CLIENT_OPTIONS_KIND_TAP) {
+            continue;
+        }
+        net = get_vhost_net(nc);
+        if (!net) {
+            continue;
+        }
+
+        info = g_malloc0(sizeof(*info));
+        info->name = g_strdup(nc->name);
+        info->queue = nc->queue_index;
+        vhost_net_get_info(net, info);
+
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = info;
+        if (!list) {
+            list = entry;
+        } else {
+            last_entry->next = entry;
+        }
+        last_entry = entry;
+    }
+
+    if (has_name && !found) {
+        error_setg(errp, "invalid net client name: %s", name);
+    } else if (has_name && list == NULL) {
+        error_setg(errp, "net client(%s) doesn't use vhost-net", name);
+    }
+
+    return list;
+}
+
 void do_info_network(Monitor *mon, const QDict *qdict)
 {
     NetClientState *nc, *peer;
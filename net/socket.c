@@ -33,6 +33,12 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 
+/* Datagrams moved by one recvmmsg()/sendmmsg() unless batch= says otherwise.
+ * Every slot holds a full NET_BUFSIZE frame, hence the low maximum.
+ */
+#define NET_SOCKET_BATCH 32
+#define NET_SOCKET_BATCH_MAX 256
+
 typedef struct NetSocketState {
     NetClientState nc;
     int listen_fd;
@@ -46,6 +52,22 @@ typedef struct NetSocketState {
     IOHandler *send_fn;           /* differs between SOCK_STREAM/SOCK_DGRAM */
     bool read_poll;               /* waiting to receive data? */
     bool write_poll;              /* waiting to transmit data? */
+#ifdef CONFIG_SENDMMSG
+    unsigned int batch;           /* slots in each of the batches below */
+    int plugged;
+    /* Slots [batch_head, batch_len) hold datagrams not sent yet */
+    unsigned int batch_head;
+    unsigned int batch_len;
+    uint8_t *batch_buf;           /* batch * NET_BUFSIZE */
+    struct iovec *batch_iov;
+    struct mmsghdr *batch_msg;
+    /* Slots [rx_head, rx_len) hold datagrams not delivered to the peer yet */
+    unsigned int rx_head;
+    unsigned int rx_len;
+    uint8_t *rx_buf;              /* batch * NET_BUFSIZE */
+    struct iovec *rx_iov;
+    struct mmsghdr *rx_msg;
+#endif
 } NetSocketState;
 
 static void net_socket_accept(void *opaque);
@@ -80,12 +102,91 @@ static void net_socket_write_poll(NetSocketState *s, bool enable)
     net_socket_update_fd_handler(s);
 }
 
+#ifdef CONFIG_SENDMMSG
+static void net_socket_flush_batch(NetSocketState *s)
+{
+    int ret;
+
+    while (s->batch_head < s->batch_len) {
+        ret = sendmmsg(s->fd, &s->batch_msg[s->batch_head],
+                       s->batch_len - s->batch_head, 0);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1 && errno == EAGAIN) {
+            net_socket_write_poll(s, true);
+            return;
+        }
+        if (ret == -1) {
+            /* As with sendto(), a datagram that fails is dropped */
+            ret = 1;
+        }
+        s->batch_head += ret;
+    }
+    s->batch_head = s->batch_len = 0;
+}
+
+/* Returns false if the batch is full and couldn't be flushed */
+static bool net_socket_batch_add(NetSocketState *s, const uint8_t *buf,
+                                 size_t size)
+{
+    unsigned int i;
+
+    if (s->batch_len == s->batch) {
+        net_socket_flush_batch(s);
+        if (s->batch_len == s->batch) {
+            return false;
+        }
+    }
+
+    if (!s->batch_buf) {
+        s->batch_buf = g_malloc(s->batch * NET_BUFSIZE);
+        s->batch_iov = g_new(struct iovec, s->batch);
+        s->batch_msg = g_new(struct mmsghdr, s->batch);
+    }
+
+    i = s->batch_len++;
+    s->batch_iov[i].iov_base = s->batch_buf + i * NET_BUFSIZE;
+    s->batch_iov[i].iov_len = size;
+    memcpy(s->batch_iov[i].iov_base, buf, size);
+    memset(&s->batch_msg[i], 0, sizeof(s->batch_msg[i]));
+    s->batch_msg[i].msg_hdr.msg_name = &s->dgram_dst;
+    s->batch_msg[i].msg_hdr.msg_namelen = sizeof(s->dgram_dst);
+    s->batch_msg[i].msg_hdr.msg_iov = &s->batch_iov[i];
+    s->batch_msg[i].msg_hdr.msg_iovlen = 1;
+    return true;
+}
+
+static void net_socket_io_plug(NetClientState *nc)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    s->plugged++;
+}
+
+static void net_socket_io_unplug(NetClientState *nc)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    assert(s->plugged > 0);
+    if (--s->plugged == 0) {
+        net_socket_flush_batch(s);
+    }
+}
+#endif
+
 static void net_socket_writable(void *opaque)
 {
     NetSocketState *s = opaque;
 
     net_socket_write_poll(s, false);
 
+#ifdef CONFIG_SENDMMSG
+    net_socket_flush_batch(s);
+    if (s->batch_len) {
+        return;
+    }
+#endif
     qemu_flush_queued_packets(&s->nc);
 }
 
@@ -129,6 +230,19 @@ static ssize_t net_socket_receive_dgram(NetClientState *nc, const uint8_t *buf,
     NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
     ssize_t ret;
 
+#ifdef CONFIG_SENDMMSG
+    /* Keep ordering behind datagrams still waiting in the batch */
+    if (s->plugged || s->batch_len) {
+        if (!net_socket_batch_add(s, buf, size)) {
+            return 0;
+        }
+        if (!s->plugged) {
+            net_socket_flush_batch(s);
+        }
+        return size;
+    }
+#endif
+
     do {
         ret = qemu_sendto(s->fd, buf, size, 0,
                           (struct sockaddr *)&s->dgram_dst,
@@ -220,11 +334,84 @@ static void net_socket_send(void *opaque)
     }
 }
 
+#ifdef CONFIG_SENDMMSG
+static void net_socket_send_completed(NetClientState *nc, ssize_t len);
+
+/* Returns false if the peer queued a datagram; reading from the socket
+ * stays off until net_socket_send_completed() has delivered the rest.
+ */
+static bool net_socket_deliver_batch(NetSocketState *s)
+{
+    struct mmsghdr *msg;
+    ssize_t ret;
+
+    while (s->rx_head < s->rx_len) {
+        msg = &s->rx_msg[s->rx_head++];
+        if (msg->msg_len == 0) {
+            continue;
+        }
+        ret = qemu_send_packet_async(&s->nc, msg->msg_hdr.msg_iov->iov_base,
+                                     msg->msg_len, net_socket_send_completed);
+        if (ret == 0) {
+            net_socket_read_poll(s, false);
+            return false;
+        }
+    }
+    s->rx_head = s->rx_len = 0;
+    return true;
+}
+
+static void net_socket_send_completed(NetClientState *nc, ssize_t len)
+{
+    NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
+
+    if (net_socket_deliver_batch(s)) {
+        net_socket_read_poll(s, true);
+    }
+}
+
+static void net_socket_send_dgram_batch(NetSocketState *s)
+{
+    unsigned int i;
+    int ret;
+
+    if (!s->rx_buf) {
+        s->rx_buf = g_malloc(s->batch * NET_BUFSIZE);
+        s->rx_iov = g_new(struct iovec, s->batch);
+        s->rx_msg = g_new0(struct mmsghdr, s->batch);
+        for (i = 0; i < s->batch; i++) {
+            s->rx_iov[i].iov_base = s->rx_buf + i * NET_BUFSIZE;
+            s->rx_iov[i].iov_len = NET_BUFSIZE;
+            s->rx_msg[i].msg_hdr.msg_iov = &s->rx_iov[i];
+            s->rx_msg[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    do {
+        ret = recvmmsg(s->fd, s->rx_msg, s->batch, MSG_DONTWAIT, NULL);
+    } while (ret == -1 && errno == EINTR);
+    if (ret <= 0) {
+        return;
+    }
+
+    s->rx_head = 0;
+    s->rx_len = ret;
+    net_socket_deliver_batch(s);
+}
+#endif
+
 static void net_socket_send_dgram(void *opaque)
 {
     NetSocketState *s = opaque;
     int size;
 
+#ifdef CONFIG_SENDMMSG
+    if (s->batch > 1) {
+        net_socket_send_dgram_batch(s);
+        return;
+    }
+#endif
+
     size = qemu_recv(s->fd, s->buf, sizeof(s->buf), 0);
     if (size < 0)
         return;
@@ -336,6 +523,22 @@ static void net_socket_cleanup(NetClientState *nc)
         closesocket(s->listen_fd);
         s->listen_fd = -1;
     }
+#ifdef CONFIG_SENDMMSG
+    g_free(s->batch_buf);
+    g_free(s->batch_iov);
+    g_free(s->batch_msg);
+    s->batch_buf = NULL;
+    s->batch_iov = NULL;
+    s->batch_msg = NULL;
+    s->batch_head = s->batch_len = 0;
+    g_free(s->rx_buf);
+    g_free(s->rx_iov);
+    g_free(s->rx_msg);
+    s->rx_buf = NULL;
+    s->rx_iov = NULL;
+    s->rx_msg = NULL;
+    s->rx_head = s->rx_len = 0;
+#endif
 }
 
 static NetClientInfo net_dgram_socket_info = {
@@ -343,6 +546,10 @@ static NetClientInfo net_dgram_socket_info = {
     .size = sizeof(NetSocketState),
     .receive = net_socket_receive_dgram,
     .cleanup = net_socket_cleanup,
+#ifdef CONFIG_SENDMMSG
+    .io_plug = net_socket_io_plug,
+    .io_unplug = net_socket_io_unplug,
+#endif
 };
 
 static NetSocketState *net_socket_fd_init_dgram(NetClientState *peer,
@@ -394,6 +601,9 @@ static NetSocketState *net_socket_fd_init_dgram(NetClientState *peer,
     s->fd = fd;
     s->listen_fd = -1;
     s->send_fn = net_socket_send_dgram;
+#ifdef CONFIG_SENDMMSG
+    s->batch = NET_SOCKET_BATCH;
+#endif
     net_socket_read_poll(s, true);
 
     /* mcast: save bound address as dst */
@@ -414,6 +624,17 @@ err:
     return NULL;
 }
 
+/* A batch of 1 reads and writes one datagram per system call */
+static void net_socket_dgram_set_batch(NetSocketState *s, unsigned int batch)
+{
+#ifdef CONFIG_SENDMMSG
+    if (s->send_fn == net_socket_send_dgram) {
+        assert(!s->batch_buf && !s->rx_buf);
+        s->batch = batch;
+    }
+#endif
+}
+
 static void net_socket_connect(void *opaque)
 {
     NetSocketState *s = opaque;
@@ -607,7 +828,8 @@ static int net_socket_mcast_init(NetClientState *peer,
                                  const char *model,
                                  const char *name,
                                  const char *host_str,
-                                 const char *localaddr_str)
+                                 const char *localaddr_str,
+                                 unsigned int batch)
 {
     NetSocketState *s;
     int fd;
@@ -634,6 +856,7 @@ static int net_socket_mcast_init(NetClientState *peer,
         return -1;
 
     s->dgram_dst = saddr;
+    net_socket_dgram_set_batch(s, batch);
 
     snprintf(s->nc.info_str, sizeof(s->nc.info_str),
              "socket: mcast=%s:%d",
@@ -646,7 +869,8 @@ static int net_socket_udp_init(NetClientState *peer,
                                  const char *model,
                                  const char *name,
                                  const char *rhost,
-                                 const char *lhost)
+                                 const char *lhost,
+                                 unsigned int batch)
 {
     NetSocketState *s;
     int fd, ret;
@@ -685,6 +909,7 @@ static int net_socket_udp_init(NetClientState *peer,
     }
 
     s->dgram_dst = raddr;
+    net_socket_dgram_set_batch(s, batch);
 
     snprintf(s->nc.info_str, sizeof(s->nc.info_str),
              "socket: udp=%s:%d",
@@ -696,6 +921,7 @@ int net_init_socket(const NetClientOptions *opts, const char *name,
                     NetClientState *peer)
 {
     const NetdevSocketOptions *sock;
+    unsigned int batch;
 
     assert(opts->kind == NET_CLIENT_OPTIONS_KIND_SOCKET);
     sock = opts->socket;
@@ -712,7 +938,18 @@ int net_init_socket(const NetClientOptions *opts, const char *name,
         return -1;
     }
 
+    if (sock->has_batch && (sock->has_listen || sock->has_connect)) {
+        error_report("batch= is only valid with fd=, mcast= or udp=");
+        return -1;
+    }
+    batch = sock->has_batch ? sock->batch : NET_SOCKET_BATCH;
+    if (batch < 1 || batch > NET_SOCKET_BATCH_MAX) {
+        error_report("batch= must be between 1 and %d", NET_SOCKET_BATCH_MAX);
+        return -1;
+    }
+
     if (sock->has_fd) {
+        NetSocketState *s;
         int fd;
 
         fd = monitor_handle_fd_param(cur_mon, sock->fd);
@@ -720,9 +957,11 @@ int net_init_socket(const NetClientOptions *opts, const char *name,
             return -1;
         }
         qemu_set_nonblock(fd);
-        if (!net_socket_fd_init(peer, "socket", name, fd, 1)) {
+        s = net_socket_fd_init(peer, "socket", name, fd, 1);
+        if (!s) {
             return -1;
         }
+        net_socket_dgram_set_batch(s, batch);
         return 0;
     }
 
@@ -745,7 +984,7 @@ int net_init_socket(const NetClientOptions *opts, const char *name,
         /* if sock->localaddr is missing, it has been initialized to "all bits
          * zero" */
         if (net_socket_mcast_init(peer, "socket", name, sock->mcast,
-            sock->localaddr) == -1) {
+            sock->localaddr, batch) == -1) {
             return -1;
         }
         return 0;
@@ -756,8 +995,8 @@ int net_init_socket(const NetClientOptions *opts, const char *name,
         error_report("localaddr= is mandatory with udp=");
         return -1;
     }
-    if (net_socket_udp_init(peer, "socket", name, sock->udp, sock->localaddr) ==
-        -1) {
+    if (net_socket_udp_init(peer, "socket", name, sock->udp, sock->localaddr,
+                            batch) == -1) {
         return -1;
     }
     return 0;
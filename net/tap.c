@@ -39,6 +39,7 @@
 #include "sysemu/sysemu.h"
 #include "qemu-common.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 
 #include "net/tap.h"
 
@@ -185,6 +186,53 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
+#ifndef __sun__
+/* Read the next packet straight into a receive buffer of the peer.
+ * Returns 0 if the peer has none to lend, so the caller copies instead.
+ */
+static ssize_t tap_read_direct(TAPState *s)
+{
+    struct iovec iov[NET_RX_BUFFER_MAX_IOV + 1];
+    uint8_t overflow;
+    size_t size;
+    ssize_t len;
+    int cnt;
+
+    /* The peer gets the packet with the header exactly as read */
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        return 0;
+    }
+
+    cnt = qemu_peer_get_rx_buffer(&s->nc, iov, NET_RX_BUFFER_MAX_IOV);
+    if (cnt <= 0) {
+        return 0;
+    }
+
+    /* One extra byte tells a packet that didn't fit from one that did */
+    size = iov_size(iov, cnt);
+    iov[cnt].iov_base = &overflow;
+    iov[cnt].iov_len = sizeof(overflow);
+
+    do {
+        len = readv(s->fd, iov, cnt + 1);
+    } while (len == -1 && errno == EINTR);
+
+    if (len <= 0) {
+        qemu_peer_put_rx_buffer(&s->nc, -1);
+        return -1;
+    }
+
+    /* Too big for the buffer: dropped, as the copying path would */
+    qemu_peer_put_rx_buffer(&s->nc, (size_t)len > size ? -1 : len);
+    return len;
+}
+#else
+static ssize_t tap_read_direct(TAPState *s)
+{
+    return 0;
+}
+#endif
+
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
@@ -192,6 +240,13 @@ static void tap_send(void *opaque)
 
     while (qemu_can_send_packet(&s->nc)) {
         uint8_t *buf = s->buf;
+        ssize_t len = tap_read_direct(s);
+
+        if (len > 0) {
+            continue;
+        } else if (len < 0) {
+            break;
+        }
 
         size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
         if (size <= 0) {
@@ -629,6 +684,9 @@ static int net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         options.backend_type = VHOST_BACKEND_TYPE_KERNEL;
         options.net_backend = &s->nc;
         options.force = tap->has_vhostforce && tap->vhostforce;
+        options.poll_us = tap->has_poll_us ? tap->poll_us : 0;
+        options.has_zerocopy = tap->has_zerocopy;
+        options.zerocopy = tap->has_zerocopy && tap->zerocopy;
 
         if (tap->has_vhostfd || tap->has_vhostfds) {
             vhostfd = monitor_handle_fd_param(cur_mon, vhostfdname);
@@ -653,6 +711,9 @@ static int net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
     } else if (tap->has_vhostfd || tap->has_vhostfds) {
         error_report("vhostfd= is not valid without vhost");
         return -1;
+    } else if (tap->has_poll_us || tap->has_zerocopy) {
+        error_report("poll-us= and zerocopy= are not valid without vhost");
+        return -1;
     }
 
     return 0;
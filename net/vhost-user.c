@@ -14,12 +14,15 @@
 #include "sysemu/char.h"
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
+#include "qmp-commands.h"
 
 typedef struct VhostUserState {
     NetClientState nc;
     CharDriverState *chr;
     bool vhostforce;
     VHostNetState *vhost_net;
+    /* guest features, kept across a backend reconnect */
+    unsigned acked_features;
 } VhostUserState;
 
 typedef struct VhostUserChardevProps {
@@ -52,15 +55,25 @@ static int vhost_user_start(VhostUserState *s)
     options.net_backend = &s->nc;
     options.opaque = s->chr;
     options.force = s->vhostforce;
+    options.poll_us = 0;
+    options.has_zerocopy = false;
 
     s->vhost_net = vhost_net_init(&options);
+    if (!vhost_user_running(s)) {
+        return -1;
+    }
 
-    return vhost_user_running(s) ? 0 : -1;
+    if (s->acked_features) {
+        vhost_net_ack_features(s->vhost_net, s->acked_features);
+    }
+
+    return 0;
 }
 
 static void vhost_user_stop(VhostUserState *s)
 {
     if (vhost_user_running(s)) {
+        s->acked_features = vhost_net_get_acked_features(s->vhost_net);
         vhost_net_cleanup(s->vhost_net);
     }
 
@@ -97,61 +110,100 @@ static NetClientInfo net_vhost_user_info = {
         .has_ufo = vhost_user_has_ufo,
 };
 
-static void net_vhost_link_down(VhostUserState *s, bool link_down)
+static int vhost_user_start_all(NetClientState **ncs, int queues)
 {
-    s->nc.link_down = link_down;
-
-    if (s->nc.peer) {
-        s->nc.peer->link_down = link_down;
+    VhostUserState *s;
+    int i;
+
+    for (i = 0; i < queues; i++) {
+        s = DO_UPCAST(VhostUserState, nc, ncs[i]);
+        if (vhost_user_start(s) < 0) {
+            goto err;
+        }
+        if (vhost_net_get_max_queues(s->vhost_net) < queues) {
+            error_report("vhost-user backend on \"%s\" supports %" PRIu64
+                         " queues, %d requested", s->chr->label,
+                         vhost_net_get_max_queues(s->vhost_net), queues);
+            i++;
+            goto err;
+        }
     }
 
-    if (s->nc.info->link_status_changed) {
-        s->nc.info->link_status_changed(&s->nc);
-    }
+    return 0;
 
-    if (s->nc.peer && s->nc.peer->info->link_status_changed) {
-        s->nc.peer->info->link_status_changed(s->nc.peer);
+err:
+    while (i-- > 0) {
+        vhost_user_stop(DO_UPCAST(VhostUserState, nc, ncs[i]));
     }
+    return -1;
 }
 
 static void net_vhost_user_event(void *opaque, int event)
 {
     VhostUserState *s = opaque;
+    const char *name = s->nc.name;
+    NetClientState *ncs[MAX_QUEUE_NUM];
+    Error *err = NULL;
+    int queues, i;
+
+    queues = qemu_find_net_clients_except(name, ncs,
+                                          NET_CLIENT_OPTIONS_KIND_NIC,
+                                          MAX_QUEUE_NUM);
 
     switch (event) {
     case CHR_EVENT_OPENED:
-        vhost_user_start(s);
-        net_vhost_link_down(s, false);
-        error_report("chardev \"%s\" went up\n", s->chr->label);
+        if (vhost_user_start_all(ncs, queues) < 0) {
+            break;
+        }
+        /* The guest side restarts vhost with the saved ring state */
+        qmp_set_link(name, true, &err);
+        error_report("chardev \"%s\" went up", s->chr->label);
         break;
     case CHR_EVENT_CLOSED:
-        net_vhost_link_down(s, true);
-        vhost_user_stop(s);
-        error_report("chardev \"%s\" went down\n", s->chr->label);
+        /*
+         * Link down first, so the guest side stops vhost while the state
+         * it needs is still there.
+         */
+        qmp_set_link(name, false, &err);
+        for (i = 0; i < queues; i++) {
+            vhost_user_stop(DO_UPCAST(VhostUserState, nc, ncs[i]));
+        }
+        error_report("chardev \"%s\" went down", s->chr->label);
         break;
     }
+
+    if (err) {
+        error_report("%s", error_get_pretty(err));
+        error_free(err);
+    }
 }
 
 static int net_vhost_user_init(NetClientState *peer, const char *device,
                                const char *name, CharDriverState *chr,
-                               bool vhostforce)
+                               bool vhostforce, int queues)
 {
     NetClientState *nc;
-    VhostUserState *s;
+    VhostUserState *s = NULL;
+    int i;
 
-    nc = qemu_new_net_client(&net_vhost_user_info, peer, device, name);
+    for (i = 0; i < queues; i++) {
+        nc = qemu_new_net_client(&net_vhost_user_info, peer, device, name);
 
-    snprintf(nc->info_str, sizeof(nc->info_str), "vhost-user to %s",
-             chr->label);
+        snprintf(nc->info_str, sizeof(nc->info_str), "vhost-user%d to %s",
+                 i, chr->label);
 
-    s = DO_UPCAST(VhostUserState, nc, nc);
+        nc->queue_index = i;
 
-    /* We don't provide a receive callback */
-    s->nc.receive_disabled = 1;
-    s->chr = chr;
-    s->vhostforce = vhostforce;
+        s = DO_UPCAST(VhostUserState, nc, nc);
 
-    qemu_chr_add_handlers(s->chr, NULL, NULL, net_vhost_user_event, s);
+        /* We don't provide a receive callback */
+        s->nc.receive_disabled = 1;
+        s->chr = chr;
+        s->vhostforce = vhostforce;
+    }
+
+    /* One connection serves all queues, the last one stands in for them */
+    qemu_chr_add_handlers(chr, NULL, NULL, net_vhost_user_event, s);
 
     return 0;
 }
@@ -167,6 +219,8 @@ static int net_vhost_chardev_opts(const char *name, const char *value,
         props->is_unix = true;
     } else if (strcmp(name, "server") == 0) {
         props->is_server = true;
+    } else if (strcmp(name, "reconnect") == 0) {
+        /* client mode: reconnect to a restarted backend */
     } else {
         error_report("vhost-user does not support a chardev"
                      " with the following option:\n %s = %s",
@@ -231,6 +285,7 @@ int net_init_vhost_user(const NetClientOptions *opts, const char *name,
     const NetdevVhostUserOptions *vhost_user_opts;
     CharDriverState *chr;
     bool vhostforce;
+    int queues;
 
     assert(opts->kind == NET_CLIENT_OPTIONS_KIND_VHOST_USER);
     vhost_user_opts = opts->vhost_user;
@@ -254,5 +309,12 @@ int net_init_vhost_user(const NetClientOptions *opts, const char *name,
         vhostforce = false;
     }
 
-    return net_vhost_user_init(peer, "vhost_user", name, chr, vhostforce);
+    queues = vhost_user_opts->has_queues ? vhost_user_opts->queues : 1;
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_report("vhost-user: invalid number of queues %d", queues);
+        return -1;
+    }
+
+    return net_vhost_user_init(peer, "vhost_user", name, chr, vhostforce,
+                               queues);
 }
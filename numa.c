@@ -36,6 +36,8 @@
 #include "sysemu/hostmem.h"
 #include "qmp-commands.h"
 #include "hw/mem/pc-dimm.h"
+#include "sysemu/cpus.h"
+#include "sysemu/iothread.h"
 
 QemuOptsList qemu_numa_opts = {
     .name = "numa",
@@ -46,10 +48,50 @@ QemuOptsList qemu_numa_opts = {
 
 static int have_memdevs = -1;
 
+/* Fill @cpus with the host CPUs of host NUMA node @node, as listed in sysfs */
+static void numa_get_host_node_cpus(unsigned int node, unsigned long *cpus,
+                                    Error **errp)
+{
+#ifdef __linux__
+    gchar *path, *contents = NULL;
+    char *p, *end;
+    unsigned long first, last;
+
+    path = g_strdup_printf("/sys/devices/system/node/node%u/cpulist", node);
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        error_setg(errp, "cannot read %s", path);
+        goto out;
+    }
+
+    for (p = contents; *p && *p != '\n'; p = end) {
+        first = strtoul(p, &end, 10);
+        last = first;
+        if (*end == '-') {
+            last = strtoul(end + 1, &end, 10);
+        }
+        if (end == p || last < first || last >= MAX_HOST_CPUS) {
+            error_setg(errp, "cannot parse host CPU list in %s", path);
+            goto out;
+        }
+        bitmap_set(cpus, first, last - first + 1);
+        if (*end == ',') {
+            end++;
+        }
+    }
+
+out:
+    g_free(contents);
+    g_free(path);
+#else
+    error_setg(errp, "host-node is not supported on this host");
+#endif
+}
+
 static void numa_node_parse(NumaNodeOptions *node, QemuOpts *opts, Error **errp)
 {
     uint16_t nodenr;
     uint16List *cpus = NULL;
+    Error *local_err = NULL;
 
     if (node->has_nodeid) {
         nodenr = node->nodeid;
@@ -77,6 +119,28 @@ static void numa_node_parse(NumaNodeOptions *node, QemuOpts *opts, Error **errp)
         bitmap_set(numa_info[nodenr].node_cpu, cpus->value, 1);
     }
 
+    for (cpus = node->host_cpus; cpus; cpus = cpus->next) {
+        if (cpus->value >= MAX_HOST_CPUS) {
+            error_setg(errp, "host CPU number %" PRIu16 " is bigger than %d",
+                       cpus->value, MAX_HOST_CPUS - 1);
+            return;
+        }
+        set_bit(cpus->value, numa_info[nodenr].host_cpus);
+    }
+
+    if (node->has_host_node) {
+        numa_info[nodenr].has_host_node = true;
+        numa_info[nodenr].host_node = node->host_node;
+        if (!node->host_cpus) {
+            numa_get_host_node_cpus(node->host_node,
+                                    numa_info[nodenr].host_cpus, &local_err);
+            if (local_err) {
+                error_propagate(errp, local_err);
+                return;
+            }
+        }
+    }
+
     if (node->has_mem && node->has_memdev) {
         error_setg(errp, "qemu: cannot specify both mem= and memdev=\n");
         return;
@@ -111,6 +175,14 @@ static void numa_node_parse(NumaNodeOptions *node, QemuOpts *opts, Error **errp)
         object_ref(o);
         numa_info[nodenr].node_mem = object_property_get_int(o, "size", NULL);
         numa_info[nodenr].node_memdev = MEMORY_BACKEND(o);
+        if (node->has_host_node) {
+            host_memory_backend_bind_host_node(MEMORY_BACKEND(o),
+                                               node->host_node, &local_err);
+            if (local_err) {
+                error_propagate(errp, local_err);
+                return;
+            }
+        }
     }
     numa_info[nodenr].present = true;
     max_numa_nodeid = MAX(max_numa_nodeid, nodenr + 1);
@@ -234,10 +306,42 @@ void set_numa_nodes(void)
     }
 }
 
+static int numa_place_iothread(Object *child, void *opaque)
+{
+    IOThread *iothread;
+    Error *err = NULL;
+
+    if (!object_dynamic_cast(child, TYPE_IOTHREAD)) {
+        return 0;
+    }
+
+    iothread = IOTHREAD(child);
+    if (iothread->numa_node < 0 || iothread->host_cpus) {
+        return 0;
+    }
+    if (iothread->numa_node >= nb_numa_nodes) {
+        error_report("numa: IOThread numa-node %" PRId64 " does not exist",
+                     iothread->numa_node);
+        exit(1);
+    }
+
+    if (bitmap_empty(numa_info[iothread->numa_node].host_cpus,
+                     MAX_HOST_CPUS)) {
+        return 0;
+    }
+    iothread_set_host_cpus(iothread, numa_info[iothread->numa_node].host_cpus,
+                           &err);
+    if (err) {
+        error_report("numa: %s", error_get_pretty(err));
+        exit(1);
+    }
+    return 0;
+}
+
 void set_numa_modes(void)
 {
     CPUState *cpu;
-    int i;
+    int i, ret;
 
     CPU_FOREACH(cpu) {
         for (i = 0; i < nb_numa_nodes; i++) {
@@ -246,6 +350,33 @@ void set_numa_modes(void)
             }
         }
     }
+
+    if (nb_numa_nodes == 0) {
+        return;
+    }
+
+    /* Pin each vCPU thread to the host CPUs of its node.  TCG runs every
+     * vCPU in one thread, so there is nothing to pin.
+     */
+    if (!tcg_enabled()) {
+        CPU_FOREACH(cpu) {
+            unsigned long *host_cpus = numa_info[cpu->numa_node].host_cpus;
+
+            if (bitmap_empty(host_cpus, MAX_HOST_CPUS)) {
+                continue;
+            }
+            ret = qemu_thread_set_affinity(cpu->thread, host_cpus,
+                                           MAX_HOST_CPUS);
+            if (ret < 0) {
+                error_report("numa: cannot pin CPU %d to host CPUs: %s",
+                             cpu->cpu_index, strerror(-ret));
+                exit(1);
+            }
+        }
+    }
+
+    object_child_foreach(container_get(object_get_root(), "/objects"),
+                         numa_place_iothread, NULL);
 }
 
 static void allocate_system_memory_nonnuma(MemoryRegion *mr, Object *owner,
@@ -271,7 +402,8 @@ static void allocate_system_memory_nonnuma(MemoryRegion *mr, Object *owner,
         exit(1);
 #endif
     } else {
-        memory_region_init_ram(mr, owner, name, ram_size, &error_abort);
+        memory_region_init_ram_hugetlb(mr, owner, name, ram_size,
+                                       &error_abort);
     }
     vmstate_register_ram_global(mr);
 }
@@ -414,6 +546,59 @@ error:
     return -1;
 }
 
+void qmp_memdev_save(const char *id, const char *filename, Error **errp)
+{
+    Object *obj;
+    MemoryRegion *mr;
+    uint8_t *ptr;
+    uint64_t size, offset;
+    int fd;
+
+    if (runstate_is_running()) {
+        error_setg(errp, "the VM must be stopped to save a memory backend");
+        return;
+    }
+
+    obj = object_resolve_path_component(
+        container_get(object_get_root(), "/objects"), id);
+    if (!obj || !object_dynamic_cast(obj, TYPE_MEMORY_BACKEND)) {
+        error_setg(errp, "'%s' is not a memory backend", id);
+        return;
+    }
+    mr = host_memory_backend_get_memory(MEMORY_BACKEND(obj), errp);
+    if (!mr) {
+        return;
+    }
+    ptr = memory_region_get_ram_ptr(mr);
+    size = memory_region_size(mr);
+
+    fd = qemu_open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, filename);
+        return;
+    }
+
+    for (offset = 0; offset < size; offset += TARGET_PAGE_SIZE) {
+        if (buffer_is_zero(ptr + offset, TARGET_PAGE_SIZE)) {
+            continue;
+        }
+        if (lseek(fd, offset, SEEK_SET) < 0 ||
+            qemu_write_full(fd, ptr + offset, TARGET_PAGE_SIZE) !=
+            TARGET_PAGE_SIZE) {
+            goto fail;
+        }
+    }
+    if (ftruncate(fd, size) < 0) {
+        goto fail;
+    }
+    qemu_close(fd);
+    return;
+
+fail:
+    error_setg_errno(errp, errno, "cannot write RAM image %s", filename);
+    qemu_close(fd);
+}
+
 MemdevList *qmp_query_memdev(Error **errp)
 {
     Object *obj;
@@ -42,12 +42,14 @@
 
 #ifdef CONFIG_LINUX
 #include <sys/prctl.h>
+#include <sched.h>
 #endif
 
 static struct passwd *user_pwd;
 static const char *chroot_dir;
 static int daemonize;
 static int daemon_pipe;
+static bool async_teardown;
 
 void os_setup_early_signal_handling(void)
 {
@@ -159,6 +161,9 @@ void os_parse_cmd_args(int index, const char *optarg)
     case QEMU_OPTION_enablefips:
         fips_set_state(true);
         break;
+    case QEMU_OPTION_async_teardown:
+        async_teardown = true;
+        break;
 #endif
     }
 }
@@ -250,6 +255,69 @@ void os_daemonize(void)
     }
 }
 
+#ifdef CONFIG_LINUX
+#define ASYNC_TEARDOWN_STACK_SIZE   (64 * 1024)
+
+/*
+ * Body of the teardown helper.  It shares the address space with QEMU but
+ * nothing else, and only waits for QEMU to exit.  When it does, the helper
+ * holds the last reference to the address space, so unmapping guest RAM
+ * happens when the helper exits instead of holding up QEMU's own exit.
+ * Only async-signal-safe calls are allowed here.
+ */
+static int async_teardown_fn(void *opaque)
+{
+    pid_t parent = (pid_t)(uintptr_t)opaque;
+    sigset_t set;
+    int fd, max_fd;
+    int sig;
+
+    /* Do not keep images, sockets or the monitor open after QEMU exits */
+    max_fd = sysconf(_SC_OPEN_MAX);
+    for (fd = 0; fd < max_fd; fd++) {
+        close(fd);
+    }
+
+    sigfillset(&set);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+    prctl(PR_SET_NAME, (unsigned long)"qemu-teardown", 0, 0, 0);
+    prctl(PR_SET_PDEATHSIG, SIGHUP, 0, 0, 0);
+
+    /* QEMU may already be gone, in which case no signal will come */
+    if (getppid() == parent) {
+        sigemptyset(&set);
+        sigaddset(&set, SIGHUP);
+        sigwait(&set, &sig);
+    }
+    _exit(0);
+}
+
+static void os_setup_async_teardown(void)
+{
+    void *stack;
+    pid_t pid;
+
+    stack = mmap(NULL, ASYNC_TEARDOWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED) {
+        perror("async teardown: mmap");
+        exit(1);
+    }
+
+    /*
+     * CLONE_VM only: the helper gets its own copy of the file table (which
+     * it closes) and its own signal handlers.  The stack is never freed,
+     * it belongs to the helper for as long as the address space lives.
+     */
+    pid = clone(async_teardown_fn, (char *)stack + ASYNC_TEARDOWN_STACK_SIZE,
+                CLONE_VM, (void *)(uintptr_t)getpid());
+    if (pid < 0) {
+        perror("async teardown: clone");
+        exit(1);
+    }
+}
+#endif
+
 void os_setup_post(void)
 {
     int fd = 0;
@@ -285,6 +353,13 @@ void os_setup_post(void)
             exit(1);
         }
     }
+
+#ifdef CONFIG_LINUX
+    /* After daemonizing, so that the helper's parent is the final process */
+    if (async_teardown) {
+        os_setup_async_teardown();
+    }
+#endif
 }
 
 void os_set_line_buffering(void)
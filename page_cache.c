@@ -33,11 +33,21 @@
     do { } while (0)
 #endif
 
+/*
+ * The cache is set-associative: a page may be kept in any of the
+ * CACHE_WAYS entries of the set its address hashes to.  When the set is
+ * full, the entry with the fewest hits goes, the least recently used one
+ * among equals; each eviction halves the hit counts of the set, so pages
+ * that stopped being hot lose their standing.
+ */
+#define CACHE_WAYS 4
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
     uint64_t it_addr;
     uint64_t it_age;
+    uint32_t it_hits;
     uint8_t *it_data;
 };
 
@@ -45,6 +55,8 @@ struct PageCache {
     CacheItem *page_cache;
     unsigned int page_size;
     int64_t max_num_items;
+    int64_t num_sets;
+    unsigned int num_ways;
     uint64_t max_item_age;
     int64_t num_items;
 };
@@ -75,8 +87,11 @@ PageCache *cache_init(int64_t num_pages, unsigned int page_size)
     cache->num_items = 0;
     cache->max_item_age = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
 
-    DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
+    DPRINTF("Setting cache buckets to %" PRId64 " in sets of %u\n",
+            cache->max_num_items, cache->num_ways);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
@@ -90,6 +105,7 @@ PageCache *cache_init(int64_t num_pages, unsigned int page_size)
     for (i = 0; i < cache->max_num_items; i++) {
         cache->page_cache[i].it_data = NULL;
         cache->page_cache[i].it_age = 0;
+        cache->page_cache[i].it_hits = 0;
         cache->page_cache[i].it_addr = -1;
     }
 
@@ -112,43 +128,74 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+/* First entry of the set @address belongs to */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    size_t pos;
+    size_t set;
 
-    g_assert(cache->max_num_items);
-    pos = (address / cache->page_size) & (cache->max_num_items - 1);
-    return pos;
+    g_assert(cache->num_sets);
+    set = (address / cache->page_size) & (cache->num_sets - 1);
+    return &cache->page_cache[set * cache->num_ways];
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr)
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
 {
-    size_t pos;
+    CacheItem *set;
+    unsigned int i;
 
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    pos = cache_get_cache_pos(cache, addr);
+    set = cache_get_set(cache, addr);
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
 
-    return (cache->page_cache[pos].it_addr == addr);
+    return NULL;
 }
 
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+/* The entry of @set to replace: a free one, else the least valuable */
+static CacheItem *cache_get_victim(const PageCache *cache, CacheItem *set)
 {
-    size_t pos;
+    CacheItem *victim = &set[0];
+    unsigned int i;
 
-    g_assert(cache);
-    g_assert(cache->page_cache);
+    for (i = 0; i < cache->num_ways; i++) {
+        if (!set[i].it_data) {
+            return &set[i];
+        }
+        if (set[i].it_hits < victim->it_hits ||
+            (set[i].it_hits == victim->it_hits &&
+             set[i].it_age < victim->it_age)) {
+            victim = &set[i];
+        }
+    }
 
-    pos = cache_get_cache_pos(cache, addr);
+    return victim;
+}
+
+bool cache_is_cached(PageCache *cache, uint64_t addr)
+{
+    CacheItem *it = cache_get_by_addr(cache, addr);
 
-    return &cache->page_cache[pos];
+    if (!it) {
+        return false;
+    }
+
+    if (it->it_hits < UINT32_MAX) {
+        it->it_hits++;
+    }
+    it->it_age = ++cache->max_item_age;
+    return true;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata)
@@ -161,6 +208,20 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata)
 
     /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
+    if (!it) {
+        CacheItem *set = cache_get_set(cache, addr);
+        unsigned int i;
+
+        it = cache_get_victim(cache, set);
+        if (it->it_data) {
+            /* age the set */
+            for (i = 0; i < cache->num_ways; i++) {
+                set[i].it_hits >>= 1;
+            }
+        }
+        it->it_addr = -1;
+        it->it_hits = 0;
+    }
 
     /* allocate page */
     if (!it->it_data) {
@@ -209,19 +270,21 @@ int64_t cache_resize(PageCache *cache, int64_t new_num_pages)
     for (i = 0; i < cache->max_num_items; i++) {
         old_it = &cache->page_cache[i];
         if (old_it->it_addr != -1) {
-            /* check for collision, if there is, keep MRU page */
-            new_it = cache_get_by_addr(new_cache, old_it->it_addr);
-            if (new_it->it_data && new_it->it_age >= old_it->it_age) {
-                /* keep the MRU page */
+            /* if the set is full, keep the more valuable page */
+            new_it = cache_get_victim(new_cache,
+                                      cache_get_set(new_cache,
+                                                    old_it->it_addr));
+            if (new_it->it_data &&
+                (new_it->it_hits > old_it->it_hits ||
+                 (new_it->it_hits == old_it->it_hits &&
+                  new_it->it_age >= old_it->it_age))) {
                 g_free(old_it->it_data);
             } else {
                 if (!new_it->it_data) {
                     new_cache->num_items++;
                 }
                 g_free(new_it->it_data);
-                new_it->it_data = old_it->it_data;
-                new_it->it_age = old_it->it_age;
-                new_it->it_addr = old_it->it_addr;
+                *new_it = *old_it;
             }
         }
     }
@@ -229,6 +292,8 @@ int64_t cache_resize(PageCache *cache, int64_t new_num_pages)
     g_free(cache->page_cache);
     cache->page_cache = new_cache->page_cache;
     cache->max_num_items = new_cache->max_num_items;
+    cache->num_sets = new_cache->num_sets;
+    cache->num_ways = new_cache->num_ways;
     cache->num_items = new_cache->num_items;
 
     g_free(new_cache);
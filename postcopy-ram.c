@@ -0,0 +1,357 @@
+/*
+ * Postcopy migration for RAM
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Postcopy is a migration technique where the execution flips from the
+ * source to the destination before all the data has been copied.  Pages
+ * the guest touches on the destination before they have arrived are
+ * trapped with userfaultfd: the fault thread asks the source for them over
+ * the return path, and the thread reading the migration stream places them
+ * atomically with UFFDIO_COPY, which also wakes up the faulting vCPU.
+ */
+
+#include <poll.h>
+
+#include "qemu-common.h"
+#include "migration/migration.h"
+#include "migration/postcopy-ram.h"
+#include "exec/cpu-common.h"
+#include "qemu/error-report.h"
+#include "trace.h"
+
+#ifdef CONFIG_USERFAULTFD
+
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+
+static int userfaultfd_open(int flags)
+{
+    struct uffdio_api api_struct;
+    int ufd;
+
+    ufd = syscall(__NR_userfaultfd, flags);
+    if (ufd == -1) {
+        error_report("%s: userfaultfd not available: %s", __func__,
+                     strerror(errno));
+        return -1;
+    }
+
+    api_struct.api = UFFD_API;
+    api_struct.features = 0;
+    if (ioctl(ufd, UFFDIO_API, &api_struct)) {
+        error_report("%s: UFFDIO_API failed: %s", __func__, strerror(errno));
+        close(ufd);
+        return -1;
+    }
+
+    if ((api_struct.ioctls & ((1ULL << _UFFDIO_REGISTER) |
+                              (1ULL << _UFFDIO_UNREGISTER))) !=
+        ((1ULL << _UFFDIO_REGISTER) | (1ULL << _UFFDIO_UNREGISTER))) {
+        error_report("%s: missing userfault features: %" PRIx64, __func__,
+                     (uint64_t)api_struct.ioctls);
+        close(ufd);
+        return -1;
+    }
+
+    return ufd;
+}
+
+bool postcopy_ram_supported_by_host(void)
+{
+    int ufd;
+
+    ufd = userfaultfd_open(O_CLOEXEC);
+    if (ufd == -1) {
+        return false;
+    }
+    close(ufd);
+    return true;
+}
+
+typedef struct PostcopyRangeState {
+    MigrationIncomingState *mis;
+    int ret;
+} PostcopyRangeState;
+
+static void ram_block_enable_notify(void *host_addr, ram_addr_t offset,
+                                    ram_addr_t length, void *opaque)
+{
+    PostcopyRangeState *state = opaque;
+    struct uffdio_register reg_struct;
+
+    if (state->ret) {
+        return;
+    }
+
+    reg_struct.range.start = (uintptr_t)host_addr;
+    reg_struct.range.len = length;
+    reg_struct.mode = UFFDIO_REGISTER_MODE_MISSING;
+
+    if (ioctl(state->mis->userfault_fd, UFFDIO_REGISTER, &reg_struct)) {
+        error_report("%s: userfault register: %s", __func__, strerror(errno));
+        state->ret = -errno;
+        return;
+    }
+    if (!(reg_struct.ioctls & (1ULL << _UFFDIO_COPY))) {
+        error_report("%s: userfault doesn't support UFFDIO_COPY", __func__);
+        state->ret = -ENOTSUP;
+    }
+}
+
+static void ram_block_disable_notify(void *host_addr, ram_addr_t offset,
+                                     ram_addr_t length, void *opaque)
+{
+    PostcopyRangeState *state = opaque;
+    struct uffdio_range range_struct;
+
+    range_struct.start = (uintptr_t)host_addr;
+    range_struct.len = length;
+
+    if (ioctl(state->mis->userfault_fd, UFFDIO_UNREGISTER, &range_struct)) {
+        error_report("%s: userfault unregister: %s", __func__,
+                     strerror(errno));
+        state->ret = -errno;
+    }
+}
+
+static void *postcopy_ram_fault_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    size_t pagesize = getpagesize();
+    struct uffd_msg msg;
+    struct pollfd pfd[2];
+    ssize_t ret;
+
+    trace_postcopy_ram_fault_thread_entry();
+    for (;;) {
+        const char *rbname;
+        ram_addr_t rb_offset;
+        void *host;
+
+        pfd[0].fd = mis->userfault_fd;
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd = mis->userfault_quit_fd;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+
+        if (poll(pfd, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("%s: userfault poll: %s", __func__, strerror(errno));
+            break;
+        }
+
+        if (pfd[1].revents) {
+            break;
+        }
+
+        ret = read(mis->userfault_fd, &msg, sizeof(msg));
+        if (ret != sizeof(msg)) {
+            if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+            error_report("%s: failed to read full userfault message: %s",
+                         __func__, ret < 0 ? strerror(errno) : "short read");
+            break;
+        }
+
+        if (msg.event != UFFD_EVENT_PAGEFAULT) {
+            error_report("%s: unexpected userfault event %d", __func__,
+                         msg.event);
+            continue;
+        }
+
+        host = (void *)(uintptr_t)(msg.arg.pagefault.address &
+                                   ~(uint64_t)(pagesize - 1));
+        rbname = ram_block_name_from_host(host, &rb_offset);
+        if (!rbname) {
+            error_report("%s: fault on unknown address %p", __func__, host);
+            break;
+        }
+
+        trace_postcopy_ram_fault_thread_request(msg.arg.pagefault.address,
+                                                rbname, rb_offset);
+        migrate_send_rp_req_pages(mis, rbname, rb_offset, pagesize);
+    }
+    trace_postcopy_ram_fault_thread_exit();
+
+    return NULL;
+}
+
+int postcopy_ram_enable_notify(MigrationIncomingState *mis)
+{
+    PostcopyRangeState state = { .mis = mis };
+    size_t pagesize = getpagesize();
+
+    mis->userfault_fd = userfaultfd_open(O_CLOEXEC | O_NONBLOCK);
+    if (mis->userfault_fd == -1) {
+        return -1;
+    }
+
+    mis->userfault_quit_fd = eventfd(0, EFD_CLOEXEC);
+    if (mis->userfault_quit_fd == -1) {
+        error_report("%s: opening quit eventfd: %s", __func__,
+                     strerror(errno));
+        close(mis->userfault_fd);
+        return -1;
+    }
+
+    qemu_ram_foreach_block(ram_block_enable_notify, &state);
+    if (state.ret) {
+        close(mis->userfault_quit_fd);
+        close(mis->userfault_fd);
+        return state.ret;
+    }
+
+    mis->postcopy_tmp_page = qemu_memalign(pagesize, pagesize);
+
+    qemu_thread_create(&mis->fault_thread, "postcopy/fault",
+                       postcopy_ram_fault_thread, mis, QEMU_THREAD_JOINABLE);
+    mis->have_fault_thread = true;
+
+    return 0;
+}
+
+int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
+{
+    PostcopyRangeState state = { .mis = mis };
+
+    trace_postcopy_ram_incoming_cleanup();
+    if (mis->have_fault_thread) {
+        uint64_t tmp64 = 1;
+
+        if (write(mis->userfault_quit_fd, &tmp64, sizeof(tmp64)) !=
+            sizeof(tmp64)) {
+            error_report("%s: incrementing userfault_quit_fd: %s", __func__,
+                         strerror(errno));
+            return -1;
+        }
+        qemu_thread_join(&mis->fault_thread);
+        mis->have_fault_thread = false;
+
+        qemu_ram_foreach_block(ram_block_disable_notify, &state);
+        close(mis->userfault_fd);
+        close(mis->userfault_quit_fd);
+    }
+
+    qemu_vfree(mis->postcopy_tmp_page);
+    mis->postcopy_tmp_page = NULL;
+
+    return state.ret;
+}
+
+int postcopy_ram_discard_range(MigrationIncomingState *mis, uint8_t *start,
+                               size_t length)
+{
+    trace_postcopy_ram_discard_range(start, length);
+    if (qemu_madvise(start, length, QEMU_MADV_DONTNEED)) {
+        error_report("%s: MADV_DONTNEED failed: %s", __func__,
+                     strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int postcopy_place_page(MigrationIncomingState *mis, void *host, void *from)
+{
+    struct uffdio_copy copy_struct;
+
+    copy_struct.dst = (uintptr_t)host;
+    copy_struct.src = (uintptr_t)from;
+    copy_struct.len = getpagesize();
+    copy_struct.mode = 0;
+
+    /* EEXIST: the page arrived both as a request and in the background */
+    if (ioctl(mis->userfault_fd, UFFDIO_COPY, &copy_struct) &&
+        errno != EEXIST) {
+        int e = errno;
+
+        error_report("%s: %s copy host: %p from: %p", __func__,
+                     strerror(e), host, from);
+        return -e;
+    }
+
+    trace_postcopy_place_page(host);
+    return 0;
+}
+
+int postcopy_place_page_zero(MigrationIncomingState *mis, void *host)
+{
+    struct uffdio_zeropage zero_struct;
+
+    zero_struct.range.start = (uintptr_t)host;
+    zero_struct.range.len = getpagesize();
+    zero_struct.mode = 0;
+
+    if (ioctl(mis->userfault_fd, UFFDIO_ZEROPAGE, &zero_struct) &&
+        errno != EEXIST) {
+        int e = errno;
+
+        error_report("%s: %s zero host: %p", __func__, strerror(e), host);
+        return -e;
+    }
+
+    trace_postcopy_place_page_zero(host);
+    return 0;
+}
+
+void *postcopy_get_tmp_page(MigrationIncomingState *mis)
+{
+    return mis->postcopy_tmp_page;
+}
+
+#else
+/* No userfaultfd on this host: postcopy is refused at the advise stage */
+bool postcopy_ram_supported_by_host(void)
+{
+    error_report("%s: No OS support", __func__);
+    return false;
+}
+
+int postcopy_ram_enable_notify(MigrationIncomingState *mis)
+{
+    assert(0);
+    return -1;
+}
+
+int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
+{
+    assert(0);
+    return -1;
+}
+
+int postcopy_ram_discard_range(MigrationIncomingState *mis, uint8_t *start,
+                               size_t length)
+{
+    assert(0);
+    return -1;
+}
+
+int postcopy_place_page(MigrationIncomingState *mis, void *host, void *from)
+{
+    assert(0);
+    return -1;
+}
+
+int postcopy_place_page_zero(MigrationIncomingState *mis, void *host)
+{
+    assert(0);
+    return -1;
+}
+
+void *postcopy_get_tmp_page(MigrationIncomingState *mis)
+{
+    assert(0);
+    return NULL;
+}
+#endif
@@ -852,7 +852,8 @@ static GSourceFuncs io_watch_poll_funcs = {
 };
 
 /* Can only be used for read */
-static guint io_add_watch_poll(GIOChannel *channel,
+static guint io_add_watch_poll(CharDriverState *chr,
+                               GIOChannel *channel,
                                IOCanReadHandler *fd_can_read,
                                GIOFunc fd_read,
                                gpointer user_data)
@@ -867,19 +868,19 @@ static guint io_add_watch_poll(GIOChannel *channel,
     iwp->fd_read = (GSourceFunc) fd_read;
     iwp->src = NULL;
 
-    tag = g_source_attach(&iwp->parent, NULL);
+    tag = g_source_attach(&iwp->parent, chr->gcontext);
     g_source_unref(&iwp->parent);
     return tag;
 }
 
-static void io_remove_watch_poll(guint tag)
+static void io_remove_watch_poll(CharDriverState *chr, guint tag)
 {
     GSource *source;
     IOWatchPoll *iwp;
 
     g_return_if_fail (tag > 0);
 
-    source = g_main_context_find_source_by_id(NULL, tag);
+    source = g_main_context_find_source_by_id(chr->gcontext, tag);
     g_return_if_fail (source != NULL);
 
     iwp = io_watch_poll_from_source(source);
@@ -894,11 +895,35 @@ static void io_remove_watch_poll(guint tag)
 static void remove_fd_in_watch(CharDriverState *chr)
 {
     if (chr->fd_in_tag) {
-        io_remove_watch_poll(chr->fd_in_tag);
+        io_remove_watch_poll(chr, chr->fd_in_tag);
         chr->fd_in_tag = 0;
     }
 }
 
+/* Like g_io_add_watch(), but in the context the chardev is serviced from */
+static guint chr_io_add_watch(CharDriverState *chr, GIOChannel *channel,
+                              GIOCondition cond, GIOFunc func,
+                              gpointer user_data)
+{
+    GSource *src;
+    guint tag;
+
+    src = g_io_create_watch(channel, cond);
+    g_source_set_callback(src, (GSourceFunc)func, user_data, NULL);
+    tag = g_source_attach(src, chr->gcontext);
+    g_source_unref(src);
+    return tag;
+}
+
+static void chr_source_remove(CharDriverState *chr, guint tag)
+{
+    GSource *src = g_main_context_find_source_by_id(chr->gcontext, tag);
+
+    if (src) {
+        g_source_destroy(src);
+    }
+}
+
 #ifndef _WIN32
 static GIOChannel *io_channel_from_fd(int fd)
 {
@@ -1036,7 +1061,7 @@ static void fd_chr_update_read_handler(CharDriverState *chr)
 
     remove_fd_in_watch(chr);
     if (s->fd_in) {
-        chr->fd_in_tag = io_add_watch_poll(s->fd_in, fd_chr_read_poll,
+        chr->fd_in_tag = io_add_watch_poll(chr, s->fd_in, fd_chr_read_poll,
                                            fd_chr_read, chr);
     }
 }
@@ -1348,7 +1373,7 @@ static void pty_chr_state(CharDriverState *chr, int connected)
             s->open_tag = g_idle_add(qemu_chr_be_generic_open_func, chr);
         }
         if (!chr->fd_in_tag) {
-            chr->fd_in_tag = io_add_watch_poll(s->fd, pty_chr_read_poll,
+            chr->fd_in_tag = io_add_watch_poll(chr, s->fd, pty_chr_read_poll,
                                                pty_chr_read, chr);
         }
     }
@@ -2447,7 +2472,7 @@ static void udp_chr_update_read_handler(CharDriverState *chr)
 
     remove_fd_in_watch(chr);
     if (s->chan) {
-        chr->fd_in_tag = io_add_watch_poll(s->chan, udp_chr_read_poll,
+        chr->fd_in_tag = io_add_watch_poll(chr, s->chan, udp_chr_read_poll,
                                            udp_chr_read, chr);
     }
 }
@@ -2808,8 +2833,8 @@ static void tcp_chr_disconnect(CharDriverState *chr)
 
     s->connected = 0;
     if (s->listen_chan) {
-        s->listen_tag = g_io_add_watch(s->listen_chan, G_IO_IN,
-                                       tcp_chr_accept, chr);
+        s->listen_tag = chr_io_add_watch(chr, s->listen_chan, G_IO_IN,
+                                         tcp_chr_accept, chr);
     }
     remove_fd_in_watch(chr);
     g_io_channel_unref(s->chan);
@@ -2910,7 +2935,7 @@ static void tcp_chr_connect(void *opaque)
 
     s->connected = 1;
     if (s->chan) {
-        chr->fd_in_tag = io_add_watch_poll(s->chan, tcp_chr_read_poll,
+        chr->fd_in_tag = io_add_watch_poll(chr, s->chan, tcp_chr_read_poll,
                                            tcp_chr_read, chr);
     }
     qemu_chr_be_generic_open(chr);
@@ -2922,7 +2947,7 @@ static void tcp_chr_update_read_handler(CharDriverState *chr)
 
     remove_fd_in_watch(chr);
     if (s->chan) {
-        chr->fd_in_tag = io_add_watch_poll(s->chan, tcp_chr_read_poll,
+        chr->fd_in_tag = io_add_watch_poll(chr, s->chan, tcp_chr_read_poll,
                                            tcp_chr_read, chr);
     }
 }
@@ -2954,7 +2979,7 @@ static int tcp_chr_add_client(CharDriverState *chr, int fd)
     s->fd = fd;
     s->chan = io_channel_from_socket(fd);
     if (s->listen_tag) {
-        g_source_remove(s->listen_tag);
+        chr_source_remove(chr, s->listen_tag);
         s->listen_tag = 0;
     }
     tcp_chr_connect(chr);
@@ -3020,7 +3045,7 @@ static void tcp_chr_close(CharDriverState *chr)
     }
     if (s->listen_fd >= 0) {
         if (s->listen_tag) {
-            g_source_remove(s->listen_tag);
+            chr_source_remove(chr, s->listen_tag);
             s->listen_tag = 0;
         }
         if (s->listen_chan) {
@@ -3048,8 +3073,8 @@ static void qemu_chr_finish_socket_connection(CharDriverState *chr, int fd)
     if (s->is_listen) {
         s->listen_fd = fd;
         s->listen_chan = io_channel_from_socket(s->listen_fd);
-        s->listen_tag = g_io_add_watch(s->listen_chan, G_IO_IN,
-                                       tcp_chr_accept, chr);
+        s->listen_tag = chr_io_add_watch(chr, s->listen_chan, G_IO_IN,
+                                         tcp_chr_accept, chr);
     } else {
         s->connected = 1;
         s->fd = fd;
@@ -3788,7 +3813,7 @@ int qemu_chr_fe_add_watch(CharDriverState *s, GIOCondition cond,
     }
 
     g_source_set_callback(src, (GSourceFunc)func, user_data, NULL);
-    tag = g_source_attach(src, NULL);
+    tag = g_source_attach(src, s->gcontext);
     g_source_unref(src);
 
     return tag;
@@ -3817,6 +3842,35 @@ void qemu_chr_fe_release(CharDriverState *s)
     s->avail_connections++;
 }
 
+int qemu_chr_set_gcontext(CharDriverState *s, GMainContext *context)
+{
+    TCPCharDriver *tcp;
+    bool reading;
+
+    if (s->chr_write != tcp_chr_write) {
+        return -ENOTSUP;
+    }
+    tcp = s->opaque;
+
+    /* Move the current watches over to @context */
+    reading = s->fd_in_tag != 0;
+    remove_fd_in_watch(s);
+    if (tcp->listen_tag) {
+        chr_source_remove(s, tcp->listen_tag);
+    }
+
+    s->gcontext = context;
+
+    if (tcp->listen_tag) {
+        tcp->listen_tag = chr_io_add_watch(s, tcp->listen_chan, G_IO_IN,
+                                           tcp_chr_accept, s);
+    }
+    if (reading) {
+        tcp_chr_update_read_handler(s);
+    }
+    return 0;
+}
+
 void qemu_chr_delete(CharDriverState *chr)
 {
     QTAILQ_REMOVE(&chardevs, chr, next);
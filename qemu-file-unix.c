@@ -26,10 +26,21 @@
 #include "qemu/sockets.h"
 #include "block/coroutine.h"
 #include "migration/qemu-file.h"
+#include "trace.h"
+
+#if defined(CONFIG_LINUX) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <poll.h>
+#include <linux/errqueue.h>
+#define QEMU_FILE_ZEROCOPY
+#endif
 
 typedef struct QEMUFileSocket {
     int fd;
     QEMUFile *file;
+    /* MSG_ZEROCOPY sendmsg() calls made, completed, and copied anyway */
+    uint64_t zerocopy_sent;
+    uint64_t zerocopy_done;
+    uint64_t zerocopy_copied;
 } QEMUFileSocket;
 
 static ssize_t socket_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
@@ -46,6 +57,152 @@ static ssize_t socket_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
     return len;
 }
 
+#ifdef QEMU_FILE_ZEROCOPY
+/*
+ * Collect the MSG_ZEROCOPY completions the kernel has queued on the
+ * socket error queue.  If @wait, keep at it until every send has
+ * completed.
+ */
+static int socket_zerocopy_reap(QEMUFileSocket *s, bool wait)
+{
+    while (s->zerocopy_done < s->zerocopy_sent) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        struct sock_extended_err *serr;
+        struct cmsghdr *cm;
+        struct pollfd pfd;
+
+        if (recvmsg(s->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                return -errno;
+            }
+            if (!wait) {
+                break;
+            }
+
+            /* POLLERR is how the error queue says it has something */
+            pfd.fd = s->fd;
+            pfd.events = 0;
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+                return -errno;
+            }
+            if ((pfd.revents & (POLLHUP | POLLNVAL)) &&
+                !(pfd.revents & POLLERR)) {
+                return -EPIPE;
+            }
+            continue;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (serr->ee_errno) {
+                return -serr->ee_errno;
+            }
+            /* ee_info..ee_data is the range of sends that completed */
+            s->zerocopy_done += serr->ee_data - serr->ee_info + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                s->zerocopy_copied += serr->ee_data - serr->ee_info + 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int socket_enable_zerocopy(void *opaque)
+{
+    QEMUFileSocket *s = opaque;
+    int one = 1;
+
+    if (setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+static ssize_t socket_writev_zerocopy(void *opaque, struct iovec *iov,
+                                      int iovcnt, int64_t pos)
+{
+    QEMUFileSocket *s = opaque;
+    ssize_t len, offset;
+    ssize_t size = iov_size(iov, iovcnt);
+    ssize_t total = 0;
+    struct msghdr msg = { 0 };
+    struct pollfd pfd;
+    int ret;
+
+    assert(iovcnt > 0);
+    offset = 0;
+    while (size > 0) {
+        /* Same partial write dance as unix_writev_buffer() */
+        while (offset >= iov[0].iov_len) {
+            offset -= iov[0].iov_len;
+            iov++, iovcnt--;
+        }
+
+        assert(iovcnt > 0);
+        iov[0].iov_base += offset;
+        iov[0].iov_len -= offset;
+
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        len = sendmsg(s->fd, &msg, MSG_ZEROCOPY);
+
+        iov[0].iov_base -= offset;
+        iov[0].iov_len += offset;
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == ENOBUFS) {
+                /* Too many completions pending, the kernel wants them read */
+                ret = socket_zerocopy_reap(s, true);
+                if (ret < 0) {
+                    return ret;
+                }
+                continue;
+            } else if (errno == EAGAIN) {
+                pfd.fd = s->fd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -errno;
+        }
+
+        s->zerocopy_sent++;
+        offset += len;
+        total += len;
+        size -= len;
+    }
+
+    /* Don't let completions pile up on the error queue */
+    ret = socket_zerocopy_reap(s, false);
+    if (ret < 0) {
+        return ret;
+    }
+    return total;
+}
+
+static int socket_zerocopy_flush(void *opaque)
+{
+    QEMUFileSocket *s = opaque;
+    int ret;
+
+    ret = socket_zerocopy_reap(s, true);
+    trace_qemu_file_zerocopy_flush(s->zerocopy_sent, s->zerocopy_copied);
+    return ret;
+}
+#endif
+
 static int socket_get_fd(void *opaque)
 {
     QEMUFileSocket *s = opaque;
@@ -84,6 +241,16 @@ static int socket_close(void *opaque)
     return 0;
 }
 
+static int socket_shutdown(void *opaque, bool rd, bool wr)
+{
+    QEMUFileSocket *s = opaque;
+
+    if (shutdown(s->fd, rd ? (wr ? SHUT_RDWR : SHUT_RD) : SHUT_WR)) {
+        return -socket_error();
+    }
+    return 0;
+}
+
 static ssize_t unix_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
                                   int64_t pos)
 {
@@ -191,18 +358,59 @@ QEMUFile *qemu_fdopen(int fd, const char *mode)
     return s->file;
 }
 
+static QEMUFile *socket_get_return_path(void *opaque);
+
 static const QEMUFileOps socket_read_ops = {
     .get_fd =     socket_get_fd,
     .get_buffer = socket_get_buffer,
-    .close =      socket_close
+    .close =      socket_close,
+    .shut_down =  socket_shutdown,
+    .get_return_path = socket_get_return_path
 };
 
 static const QEMUFileOps socket_write_ops = {
     .get_fd =     socket_get_fd,
     .writev_buffer = socket_writev_buffer,
-    .close =      socket_close
+    .close =      socket_close,
+    .shut_down =  socket_shutdown,
+    .get_return_path = socket_get_return_path,
+#ifdef QEMU_FILE_ZEROCOPY
+    .enable_zerocopy = socket_enable_zerocopy,
+    .writev_zerocopy = socket_writev_zerocopy,
+    .zerocopy_flush = socket_zerocopy_flush,
+#endif
 };
 
+/*
+ * Give a QEMUFile* off the same socket but data in the opposite
+ * direction.  The blocking mode of the socket is shared and left alone.
+ */
+static QEMUFile *socket_get_return_path(void *opaque)
+{
+    QEMUFileSocket *forward = opaque;
+    QEMUFileSocket *reverse;
+    int fd;
+
+    if (qemu_file_get_error(forward->file)) {
+        /* If the forward file is in error, don't try and open a return */
+        return NULL;
+    }
+
+    fd = dup(forward->fd);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    reverse = g_malloc0(sizeof(QEMUFileSocket));
+    reverse->fd = fd;
+    if (qemu_file_is_writable(forward->file)) {
+        reverse->file = qemu_fopen_ops(reverse, &socket_read_ops);
+    } else {
+        reverse->file = qemu_fopen_ops(reverse, &socket_write_ops);
+    }
+    return reverse->file;
+}
+
 QEMUFile *qemu_fopen_socket(int fd, const char *mode)
 {
     QEMUFileSocket *s;
@@ -46,8 +46,11 @@ struct QEMUFile {
     uint8_t buf[IO_BUF_SIZE];
 
     struct iovec iov[MAX_IOV_SIZE];
+    bool iov_zerocopy[MAX_IOV_SIZE];
     unsigned int iovcnt;
 
+    bool zerocopy; /* send qemu_put_buffer_async() data with writev_zerocopy */
+
     int last_error;
 };
 
@@ -98,6 +101,36 @@ bool qemu_file_is_writable(QEMUFile *f)
     return f->ops->writev_buffer || f->ops->put_buffer;
 }
 
+/*
+ * Write the iovec, handing the runs of entries queued by
+ * qemu_put_buffer_async() to writev_zerocopy, and the rest (which point
+ * into f->buf, reused as soon as we return) to writev_buffer.
+ */
+static ssize_t qemu_writev_zerocopy(QEMUFile *f)
+{
+    unsigned int start = 0, i;
+    ssize_t ret, done = 0;
+
+    for (i = 1; i <= f->iovcnt; i++) {
+        if (i < f->iovcnt && f->iov_zerocopy[i] == f->iov_zerocopy[start]) {
+            continue;
+        }
+        if (f->iov_zerocopy[start]) {
+            ret = f->ops->writev_zerocopy(f->opaque, f->iov + start,
+                                          i - start, f->pos + done);
+        } else {
+            ret = f->ops->writev_buffer(f->opaque, f->iov + start,
+                                        i - start, f->pos + done);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        done += ret;
+        start = i;
+    }
+    return done;
+}
+
 /**
  * Flushes QEMUFile buffer
  *
@@ -114,7 +147,12 @@ void qemu_fflush(QEMUFile *f)
 
     if (f->ops->writev_buffer) {
         if (f->iovcnt > 0) {
-            ret = f->ops->writev_buffer(f->opaque, f->iov, f->iovcnt, f->pos);
+            if (f->zerocopy) {
+                ret = qemu_writev_zerocopy(f);
+            } else {
+                ret = f->ops->writev_buffer(f->opaque, f->iov, f->iovcnt,
+                                            f->pos);
+            }
         }
     } else {
         if (f->buf_index > 0) {
@@ -131,6 +169,48 @@ void qemu_fflush(QEMUFile *f)
     }
 }
 
+/*
+ * Send the memory given to qemu_put_buffer_async() without copying it,
+ * where the transport can.  That memory must then not change until
+ * qemu_file_zerocopy_flush(), or the new contents may get sent instead;
+ * guest RAM pages, which get resent when dirtied, are fine.
+ *
+ * Returns 0 on success, -errno if the transport can't do it.
+ */
+int qemu_file_enable_zerocopy(QEMUFile *f)
+{
+    int ret;
+
+    if (!f->ops->enable_zerocopy || !f->ops->writev_buffer) {
+        return -ENOTSUP;
+    }
+
+    ret = f->ops->enable_zerocopy(f->opaque);
+    if (ret == 0) {
+        f->zerocopy = true;
+    }
+    return ret;
+}
+
+/*
+ * Flush @f, and wait until the transport is done with all the memory
+ * sent from without copying so far.
+ */
+void qemu_file_zerocopy_flush(QEMUFile *f)
+{
+    int ret;
+
+    if (!f->zerocopy) {
+        return;
+    }
+
+    qemu_fflush(f);
+    ret = f->ops->zerocopy_flush(f->opaque);
+    if (ret < 0) {
+        qemu_file_set_error(f, ret);
+    }
+}
+
 void ram_control_before_iterate(QEMUFile *f, uint64_t flags)
 {
     int ret = 0;
@@ -234,11 +314,84 @@ int qemu_get_fd(QEMUFile *f)
     return -1;
 }
 
+/*
+ * Result: QEMUFile* for a 'return path' for comms in the opposite direction
+ *         NULL if not available
+ */
+QEMUFile *qemu_file_get_return_path(QEMUFile *f)
+{
+    if (!f->ops->get_return_path) {
+        return NULL;
+    }
+    return f->ops->get_return_path(f->opaque);
+}
+
+/*
+ * Stop a file from being read/written - not all backing files can do this
+ * typically only sockets can.
+ */
+int qemu_file_shutdown(QEMUFile *f)
+{
+    if (!f->ops->shut_down) {
+        return -ENOSYS;
+    }
+    return f->ops->shut_down(f->opaque, true, true);
+}
+
 void qemu_update_position(QEMUFile *f, size_t size)
 {
     f->pos += size;
 }
 
+/*
+ * For files on a seekable file descriptor: the file offset that the next
+ * byte of the stream is written to or read from.
+ */
+int64_t qemu_file_fd_tell(QEMUFile *f)
+{
+    int fd = qemu_get_fd(f);
+    off_t offset;
+
+    if (fd < 0) {
+        return -ENOTSUP;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    }
+    offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0) {
+        return -errno;
+    }
+    if (!qemu_file_is_writable(f)) {
+        offset -= f->buf_size - f->buf_index;
+    }
+    return offset;
+}
+
+/*
+ * Continue the stream at file offset @offset, dropping anything read
+ * ahead.  Lets the stream step over regions of the file that are accessed
+ * out of band, with pread/pwrite on qemu_get_fd().
+ */
+int qemu_file_fd_seek(QEMUFile *f, int64_t offset)
+{
+    int fd = qemu_get_fd(f);
+
+    if (fd < 0) {
+        return -ENOTSUP;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+    if (lseek(fd, offset, SEEK_SET) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
 /** Closes the file
  *
  * Returns negative error value if any error happened on previous operations or
@@ -270,14 +423,17 @@ int qemu_fclose(QEMUFile *f)
     return ret;
 }
 
-static void add_to_iovec(QEMUFile *f, const uint8_t *buf, int size)
+static void add_to_iovec(QEMUFile *f, const uint8_t *buf, int size,
+                         bool zerocopy)
 {
     /* check for adjacent buffer and coalesce them */
     if (f->iovcnt > 0 && buf == f->iov[f->iovcnt - 1].iov_base +
-        f->iov[f->iovcnt - 1].iov_len) {
+        f->iov[f->iovcnt - 1].iov_len &&
+        f->iov_zerocopy[f->iovcnt - 1] == zerocopy) {
         f->iov[f->iovcnt - 1].iov_len += size;
     } else {
         f->iov[f->iovcnt].iov_base = (uint8_t *)buf;
+        f->iov_zerocopy[f->iovcnt] = zerocopy;
         f->iov[f->iovcnt++].iov_len = size;
     }
 
@@ -298,7 +454,7 @@ void qemu_put_buffer_async(QEMUFile *f, const uint8_t *buf, int size)
     }
 
     f->bytes_xfer += size;
-    add_to_iovec(f, buf, size);
+    add_to_iovec(f, buf, size, f->zerocopy);
 }
 
 void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, int size)
@@ -317,7 +473,7 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, int size)
         memcpy(f->buf + f->buf_index, buf, l);
         f->bytes_xfer += l;
         if (f->ops->writev_buffer) {
-            add_to_iovec(f, f->buf + f->buf_index, l);
+            add_to_iovec(f, f->buf + f->buf_index, l, false);
         }
         f->buf_index += l;
         if (f->buf_index == IO_BUF_SIZE) {
@@ -340,7 +496,7 @@ void qemu_put_byte(QEMUFile *f, int v)
     f->buf[f->buf_index] = v;
     f->bytes_xfer++;
     if (f->ops->writev_buffer) {
-        add_to_iovec(f, f->buf + f->buf_index, 1);
+        add_to_iovec(f, f->buf + f->buf_index, 1, false);
     }
     f->buf_index++;
     if (f->buf_index == IO_BUF_SIZE) {
@@ -493,6 +649,16 @@ void qemu_file_reset_rate_limit(QEMUFile *f)
     f->bytes_xfer = 0;
 }
 
+/*
+ * Account for @size bytes sent on behalf of @f over another connection,
+ * so that they count against its rate limit and position.
+ */
+void qemu_file_credit_transfer(QEMUFile *f, size_t size)
+{
+    f->pos += size;
+    f->bytes_xfer += size;
+}
+
 void qemu_put_be16(QEMUFile *f, unsigned int v)
 {
     qemu_put_byte(f, v >> 8);
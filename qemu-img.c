@@ -46,6 +46,8 @@ typedef struct img_cmd_t {
 enum {
     OPTION_OUTPUT = 256,
     OPTION_BACKING_CHAIN = 257,
+    OPTION_PATTERN = 258,
+    OPTION_WRITE_RATIO = 259,
 };
 
 typedef enum OutputFormat {
@@ -129,12 +131,28 @@ static void QEMU_NORETURN help(void)
            "  '-n' skips the target volume creation (useful if the volume is created\n"
            "       prior to running qemu-img)\n"
            "\n"
+           "Parameters to convert subcommand:\n"
+           "  '-m' specifies how many coroutines work in parallel during the convert\n"
+           "       process (defaults to 8)\n"
+           "  '-W' allow to write to the target out of order rather than sequential\n"
+           "\n"
            "Parameters to check subcommand:\n"
            "  '-r' tries to repair any inconsistencies that are found during the check.\n"
            "       '-r leaks' repairs only cluster leaks, whereas '-r all' fixes all\n"
            "       kinds of errors, with a higher risk of choosing the wrong fix or\n"
            "       hiding corruption that has already occurred.\n"
            "\n"
+           "Parameters to bench subcommand:\n"
+           "  '-c' number of requests to send (defaults to 75000)\n"
+           "  '-d' number of requests in flight at the same time (defaults to 64)\n"
+           "  '-n' use native AIO\n"
+           "  '-o' offset of the first request in bytes (defaults to 0)\n"
+           "  '-s' size of each request in bytes (defaults to 4k)\n"
+           "  '-S' distance between sequential requests (defaults to the request size)\n"
+           "  '-w' send write requests only (destroys the image contents)\n"
+           "  '--pattern' 'sequential' (default) or 'random' request offsets\n"
+           "  '--write-ratio' percentage of write requests (defaults to 0)\n"
+           "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
            "  '-a' applies a snapshot (revert disk to saved state)\n"
@@ -523,16 +541,23 @@ static void dump_human_image_check(ImageCheck *check, bool quiet)
     }
 }
 
+static void check_status_cb(BlockDriverState *bs,
+                            int64_t offset, int64_t total_work_size)
+{
+    qemu_progress_print(100.f * offset / total_work_size, 0);
+}
+
 static int collect_image_check(BlockDriverState *bs,
                    ImageCheck *check,
                    const char *filename,
                    const char *fmt,
-                   int fix)
+                   int fix,
+                   BlockDriverCheckStatusCB *status_cb)
 {
     int ret;
     BdrvCheckResult result;
 
-    ret = bdrv_check(bs, &result, fix);
+    ret = bdrv_check(bs, &result, fix, status_cb);
     if (ret < 0) {
         return ret;
     }
@@ -581,7 +606,7 @@ static int img_check(int argc, char **argv)
     int fix = 0;
     int flags = BDRV_O_FLAGS | BDRV_O_CHECK;
     ImageCheck *check;
-    bool quiet = false;
+    bool quiet = false, progress = false;
 
     fmt = NULL;
     output = NULL;
@@ -595,7 +620,7 @@ static int img_check(int argc, char **argv)
             {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, "hf:r:T:q",
+        c = getopt_long(argc, argv, "hf:r:T:pq",
                         long_options, &option_index);
         if (c == -1) {
             break;
@@ -626,6 +651,9 @@ static int img_check(int argc, char **argv)
         case 'T':
             cache = optarg;
             break;
+        case 'p':
+            progress = true;
+            break;
         case 'q':
             quiet = true;
             break;
@@ -645,6 +673,12 @@ static int img_check(int argc, char **argv)
         return 1;
     }
 
+    /* The progress indicator would garble JSON output */
+    if (quiet || output_format == OFORMAT_JSON) {
+        progress = false;
+    }
+    qemu_progress_init(progress, 1.0);
+
     ret = bdrv_parse_cache_flags(cache, &flags);
     if (ret < 0) {
         error_report("Invalid source cache option: %s", cache);
@@ -658,7 +692,13 @@ static int img_check(int argc, char **argv)
     bs = blk_bs(blk);
 
     check = g_new0(ImageCheck, 1);
-    ret = collect_image_check(bs, check, filename, fmt, fix);
+
+    /* In case the driver does not call check_status_cb() */
+    qemu_progress_print(0.f, 0);
+    ret = collect_image_check(bs, check, filename, fmt, fix,
+                              &check_status_cb);
+    qemu_progress_print(100.f, 0);
+    qemu_progress_end();
 
     if (ret == -ENOTSUP) {
         error_report("This image format does not support checks");
@@ -682,7 +722,7 @@ static int img_check(int argc, char **argv)
                     check->corruptions_fixed);
         }
 
-        ret = collect_image_check(bs, check, filename, fmt, 0);
+        ret = collect_image_check(bs, check, filename, fmt, 0, NULL);
 
         check->leaks_fixed          = leaks_fixed;
         check->corruptions_fixed    = corruptions_fixed;
@@ -915,6 +955,11 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum)
         return 0;
     }
     is_zero = buffer_is_zero(buf, 512);
+    /* Mostly empty buffers are common; check them in one go */
+    if (is_zero && n > 1 && buffer_is_zero(buf, n * 512)) {
+        *pnum = n;
+        return 0;
+    }
     for(i = 1; i < n; i++) {
         buf += 512;
         if (is_zero != buffer_is_zero(buf, 512)) {
@@ -1005,9 +1050,13 @@ static int64_t sectors_to_bytes(int64_t sectors)
     return sectors << BDRV_SECTOR_BITS;
 }
 
-static int64_t sectors_to_process(int64_t total, int64_t from)
+/*
+ * Returns the number of sectors to query the block status of, starting at
+ * @from; the status query may well cover more than a single I/O buffer.
+ */
+static int64_t extent_to_process(int64_t total, int64_t from)
 {
-    return MIN(total - from, IO_BUF_SIZE >> BDRV_SECTOR_BITS);
+    return MIN(total - from, INT_MAX >> BDRV_SECTOR_BITS);
 }
 
 /*
@@ -1165,65 +1214,78 @@ static int img_compare(int argc, char **argv)
         goto out;
     }
 
+    /* Walk both images by block status extents; only ranges that may hold
+     * data are read, in chunks of at most IO_BUF_SIZE */
     for (;;) {
-        nb_sectors = sectors_to_process(total_sectors, sector_num);
+        int64_t status1, status2;
+        bool zero1, zero2;
+
+        nb_sectors = extent_to_process(total_sectors, sector_num);
         if (nb_sectors <= 0) {
             break;
         }
-        allocated1 = bdrv_is_allocated_above(bs1, NULL, sector_num, nb_sectors,
-                                             &pnum1);
-        if (allocated1 < 0) {
+        status1 = bdrv_get_block_status_above(bs1, NULL, sector_num,
+                                              nb_sectors, &pnum1);
+        if (status1 < 0) {
             ret = 3;
             error_report("Sector allocation test failed for %s", filename1);
             goto out;
         }
+        allocated1 = !!(status1 & BDRV_BLOCK_ALLOCATED);
+        zero1 = !allocated1 || (status1 & BDRV_BLOCK_ZERO);
 
-        allocated2 = bdrv_is_allocated_above(bs2, NULL, sector_num, nb_sectors,
-                                             &pnum2);
-        if (allocated2 < 0) {
+        status2 = bdrv_get_block_status_above(bs2, NULL, sector_num,
+                                              nb_sectors, &pnum2);
+        if (status2 < 0) {
             ret = 3;
             error_report("Sector allocation test failed for %s", filename2);
             goto out;
         }
+        allocated2 = !!(status2 & BDRV_BLOCK_ALLOCATED);
+        zero2 = !allocated2 || (status2 & BDRV_BLOCK_ZERO);
+
         nb_sectors = MIN(pnum1, pnum2);
 
-        if (allocated1 == allocated2) {
-            if (allocated1) {
-                ret = bdrv_read(bs1, sector_num, buf1, nb_sectors);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64 " of %s:"
-                                 " %s", sectors_to_bytes(sector_num), filename1,
-                                 strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = bdrv_read(bs2, sector_num, buf2, nb_sectors);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s", sectors_to_bytes(sector_num),
-                                 filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_sectors(buf1, buf2, nb_sectors, &pnum);
-                if (ret || pnum != nb_sectors) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            sectors_to_bytes(
-                                ret ? sector_num : sector_num + pnum));
-                    ret = 1;
-                    goto out;
-                }
+        if (allocated1 != allocated2 && strict) {
+            ret = 1;
+            qprintf(quiet, "Strict mode: Offset %" PRId64
+                    " allocation mismatch!\n",
+                    sectors_to_bytes(sector_num));
+            goto out;
+        }
+
+        if (zero1 && zero2) {
+            /* Both sides read as zeroes, nothing to compare */
+        } else if (!zero1 && !zero2) {
+            nb_sectors = MIN(nb_sectors, IO_BUF_SIZE >> BDRV_SECTOR_BITS);
+            ret = bdrv_read(bs1, sector_num, buf1, nb_sectors);
+            if (ret < 0) {
+                error_report("Error while reading offset %" PRId64 " of %s:"
+                             " %s", sectors_to_bytes(sector_num), filename1,
+                             strerror(-ret));
+                ret = 4;
+                goto out;
             }
-        } else {
-            if (strict) {
+            ret = bdrv_read(bs2, sector_num, buf2, nb_sectors);
+            if (ret < 0) {
+                error_report("Error while reading offset %" PRId64
+                             " of %s: %s", sectors_to_bytes(sector_num),
+                             filename2, strerror(-ret));
+                ret = 4;
+                goto out;
+            }
+            ret = compare_sectors(buf1, buf2, nb_sectors, &pnum);
+            if (ret || pnum != nb_sectors) {
+                qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
+                        sectors_to_bytes(
+                            ret ? sector_num : sector_num + pnum));
                 ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " allocation mismatch!\n",
-                        sectors_to_bytes(sector_num));
                 goto out;
             }
-
-            if (allocated1) {
+        } else {
+            /* Only one side may hold data; it must read as zeroes */
+            nb_sectors = MIN(nb_sectors, IO_BUF_SIZE >> BDRV_SECTOR_BITS);
+            if (!zero1) {
                 ret = check_empty_sectors(bs1, sector_num, nb_sectors,
                                           filename1, buf1, quiet);
             } else {
@@ -1260,13 +1322,15 @@ static int img_compare(int argc, char **argv)
         }
 
         for (;;) {
-            nb_sectors = sectors_to_process(total_sectors_over, sector_num);
+            int64_t status;
+
+            nb_sectors = extent_to_process(total_sectors_over, sector_num);
             if (nb_sectors <= 0) {
                 break;
             }
-            ret = bdrv_is_allocated_above(bs_over, NULL, sector_num,
-                                          nb_sectors, &pnum);
-            if (ret < 0) {
+            status = bdrv_get_block_status_above(bs_over, NULL, sector_num,
+                                                 nb_sectors, &pnum);
+            if (status < 0) {
                 ret = 3;
                 error_report("Sector allocation test failed for %s",
                              filename_over);
@@ -1274,7 +1338,9 @@ static int img_compare(int argc, char **argv)
 
             }
             nb_sectors = pnum;
-            if (ret) {
+            if ((status & BDRV_BLOCK_ALLOCATED) &&
+                !(status & BDRV_BLOCK_ZERO)) {
+                nb_sectors = MIN(nb_sectors, IO_BUF_SIZE >> BDRV_SECTOR_BITS);
                 ret = check_empty_sectors(bs_over, sector_num, nb_sectors,
                                           filename_over, buf1, quiet);
                 if (ret) {
@@ -1306,20 +1372,464 @@ out3:
     return ret;
 }
 
+#define MAX_CONVERT_COROUTINES 16
+#define DEFAULT_CONVERT_COROUTINES 8
+
+/* Zero chunks are not read into a buffer, so they can be much larger */
+#define MAX_CONVERT_ZERO_SECTORS (1 << 21)
+
+typedef enum ImgConvertBlockStatus {
+    BLK_DATA,
+    BLK_ZERO,
+    BLK_BACKING_FILE,
+} ImgConvertBlockStatus;
+
+typedef struct ImgConvertState {
+    BlockDriverState **src;
+    int64_t *src_sectors;
+    int src_num;
+    int64_t total_sectors;
+    BlockDriverState *target;
+    bool compressed;
+    bool has_zero_init;
+    bool target_has_backing;
+    int min_sparse;
+    int cluster_sectors;
+    size_t buf_sectors;
+
+    /* Position of the next chunk to be copied, see convert_next_chunk() */
+    CoMutex lock;
+    int64_t sector_num;
+    int64_t sector_num_next_status;
+    ImgConvertBlockStatus status;
+    int src_cur;
+    int64_t src_cur_offset;
+    int64_t sectors_read;
+
+    int64_t sectors_done;
+    int64_t sectors_to_read;
+
+    int num_coroutines;
+    int running_coroutines;
+    Coroutine *co[MAX_CONVERT_COROUTINES];
+
+    /* With in-order writes, chunks are written in the order in which they
+     * were handed out; a coroutine waiting for its turn has its chunk's
+     * sequence number in wait_seq[], -1 otherwise */
+    bool wr_in_order;
+    int64_t next_seq;
+    int64_t wr_seq;
+    int64_t wait_seq[MAX_CONVERT_COROUTINES];
+
+    int ret;
+} ImgConvertState;
+
+/*
+ * Finds the next chunk of the input that needs to be copied, starting at
+ * s->sector_num, and advances s->sector_num past it.
+ *
+ * Returns the length of the chunk in sectors and stores its position in
+ * *sector_num and whether it has to be read (BLK_DATA) or reads as zeroes
+ * (BLK_ZERO) in *status. Returns 0 at the end of the input, or -errno.
+ *
+ * The input is walked by block status extents: ranges that the target
+ * already has (zeroes on a zero-initialised target, or unallocated input
+ * sectors when the target has a backing file) are skipped without being
+ * read.
+ *
+ * For compressed output, chunks are whole clusters (except at the end of
+ * the input) and may span several source images.
+ */
+static int convert_next_chunk(ImgConvertState *s, int64_t *sector_num,
+                              ImgConvertBlockStatus *status)
+{
+    int64_t nb_sectors;
+    int n, n1;
+    int ret;
+
+    if (s->compressed) {
+        nb_sectors = s->total_sectors - s->sector_num;
+        if (nb_sectors <= 0) {
+            return 0;
+        }
+        n = MIN(nb_sectors, s->cluster_sectors);
+        *status = BLK_DATA;
+        goto out;
+    }
+
+    for (;;) {
+        nb_sectors = s->total_sectors - s->sector_num;
+        if (nb_sectors <= 0) {
+            return 0;
+        }
+
+        while (s->sector_num - s->src_cur_offset >=
+               s->src_sectors[s->src_cur]) {
+            s->src_cur_offset += s->src_sectors[s->src_cur];
+            s->src_cur++;
+            assert(s->src_cur < s->src_num);
+        }
+
+        if (s->sector_num >= s->sector_num_next_status) {
+            BlockDriverState *src = s->src[s->src_cur];
+            int64_t src_sector = s->sector_num - s->src_cur_offset;
+
+            n = MIN(nb_sectors, s->src_sectors[s->src_cur] - src_sector);
+            n = MIN(n, INT_MAX);
+
+            /* If the output image is being created as a copy on write
+             * image, only the top layer of the input matters: sectors that
+             * are unallocated there are assumed to be present in both the
+             * output's and input's base images.  Otherwise the whole chain
+             * is looked at, so that zeroes in a backing file aren't read. */
+            if (s->target_has_backing) {
+                ret = bdrv_get_block_status(src, src_sector, n, &n1);
+            } else {
+                ret = bdrv_get_block_status_above(src, NULL, src_sector, n,
+                                                  &n1);
+            }
+            if (ret < 0) {
+                error_report("error while reading block status of sector %"
+                             PRId64 ": %s", src_sector, strerror(-ret));
+                return ret;
+            }
+
+            if (ret & BDRV_BLOCK_ZERO) {
+                /* With -S 0 the output must be fully allocated, so the
+                 * zeroes have to be written as data */
+                s->status = s->min_sparse ? BLK_ZERO : BLK_DATA;
+            } else if ((ret & BDRV_BLOCK_DATA) || !s->target_has_backing) {
+                s->status = BLK_DATA;
+            } else {
+                s->status = BLK_BACKING_FILE;
+            }
+
+            /* avoid redundant callouts to get_block_status */
+            s->sector_num_next_status = s->sector_num + n1;
+        }
+
+        /* If the output image is zero initialized and we are not working
+         * on a shared base, zeroes in the input need not be written */
+        if (s->status == BLK_BACKING_FILE ||
+            (s->status == BLK_ZERO && s->has_zero_init &&
+             !s->target_has_backing))
+        {
+            s->sector_num = s->sector_num_next_status;
+            continue;
+        }
+
+        /* The next sectors up to sector_num_next_status have the same
+         * allocation status; copy only those, as they may be followed by
+         * unallocated sectors. */
+        nb_sectors = MIN(nb_sectors,
+                         s->sector_num_next_status - s->sector_num);
+        break;
+    }
+
+    *status = s->status;
+    n = MIN(nb_sectors, s->status == BLK_ZERO ? MAX_CONVERT_ZERO_SECTORS
+                                              : s->buf_sectors);
+
+    /* round down request length to an aligned sector, but
+     * do not bother doing this on short requests. They happen
+     * when we found an all-zero area, and the next sector to
+     * write will not be sector_num + n. */
+    if (s->cluster_sectors > 0 && n >= s->cluster_sectors) {
+        int64_t next_aligned_sector = (s->sector_num + n);
+        next_aligned_sector -= next_aligned_sector % s->cluster_sectors;
+        if (s->sector_num + n > next_aligned_sector) {
+            n = next_aligned_sector - s->sector_num;
+        }
+    }
+
+    n = MIN(n, s->src_sectors[s->src_cur] -
+               (s->sector_num - s->src_cur_offset));
+
+out:
+    *sector_num = s->sector_num;
+    s->sector_num += n;
+    s->sectors_read += n;
+    return n;
+}
+
+static void convert_reset_position(ImgConvertState *s)
+{
+    s->sector_num = 0;
+    s->sector_num_next_status = 0;
+    s->status = BLK_DATA;
+    s->src_cur = 0;
+    s->src_cur_offset = 0;
+    s->sectors_read = 0;
+}
+
+/* Reads @n sectors of the concatenated input, starting at @sector_num */
+static int coroutine_fn convert_co_read(ImgConvertState *s,
+                                        int64_t sector_num, int n,
+                                        uint8_t *buf)
+{
+    int64_t src_offset = 0;
+    int src_cur = 0;
+    int ret;
+
+    while (n > 0) {
+        int64_t src_sector;
+        int n1;
+
+        while (sector_num - src_offset >= s->src_sectors[src_cur]) {
+            src_offset += s->src_sectors[src_cur];
+            src_cur++;
+            assert(src_cur < s->src_num);
+        }
+
+        src_sector = sector_num - src_offset;
+        n1 = MIN(n, s->src_sectors[src_cur] - src_sector);
+
+        ret = bdrv_read(s->src[src_cur], src_sector, buf, n1);
+        if (ret < 0) {
+            error_report("error while reading sector %" PRId64 ": %s",
+                         src_sector, strerror(-ret));
+            return ret;
+        }
+
+        sector_num += n1;
+        n -= n1;
+        buf += n1 * BDRV_SECTOR_SIZE;
+    }
+
+    return 0;
+}
+
+/* Enters the coroutine waiting to write chunk @seq, if there is one */
+static void convert_wake_writer(ImgConvertState *s, int64_t seq)
+{
+    int i;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] && s->wait_seq[i] == seq) {
+            qemu_coroutine_enter(s->co[i], NULL);
+            break;
+        }
+    }
+}
+
+/* After an error, makes all coroutines waiting for their turn give up */
+static void convert_wake_all_writers(ImgConvertState *s)
+{
+    int i;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] && s->wait_seq[i] != -1) {
+            qemu_coroutine_enter(s->co[i], NULL);
+        }
+    }
+}
+
+static int coroutine_fn convert_co_write(ImgConvertState *s,
+                                         int64_t sector_num, int n,
+                                         uint8_t *buf,
+                                         ImgConvertBlockStatus status)
+{
+    int n1 = n;
+    int ret;
+
+    if (status == BLK_ZERO) {
+        ret = bdrv_co_write_zeroes(s->target, sector_num, n, 0);
+        if (ret < 0) {
+            error_report("error while writing sector %" PRId64
+                         ": %s", sector_num, strerror(-ret));
+        }
+        return ret;
+    }
+
+    if (s->compressed) {
+        if (buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)) {
+            return 0;
+        }
+        ret = bdrv_write_compressed(s->target, sector_num, buf, n);
+        if (ret < 0) {
+            error_report("error while compressing sector %" PRId64
+                         ": %s", sector_num, strerror(-ret));
+        }
+        return ret;
+    }
+
+    /* NOTE: at the same time we convert, we do not write zero
+       sectors to have a chance to compress the image. Ideally, we
+       should add a specific call to have the info to go faster */
+    while (n > 0) {
+        if (!s->has_zero_init ||
+            is_allocated_sectors_min(buf, n, &n1, s->min_sparse)) {
+            ret = bdrv_write(s->target, sector_num, buf, n1);
+            if (ret < 0) {
+                error_report("error while writing sector %" PRId64
+                             ": %s", sector_num, strerror(-ret));
+                return ret;
+            }
+        }
+        sector_num += n1;
+        n -= n1;
+        buf += n1 * 512;
+    }
+
+    return 0;
+}
+
+static void coroutine_fn convert_co_do_copy(void *opaque)
+{
+    ImgConvertState *s = opaque;
+    uint8_t *buf;
+    int index = -1;
+    int i;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] == qemu_coroutine_self()) {
+            index = i;
+            break;
+        }
+    }
+    assert(index >= 0);
+
+    buf = qemu_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+
+    while (s->ret == 0) {
+        ImgConvertBlockStatus status;
+        int64_t sector_num, seq;
+        int n, ret;
+
+        qemu_co_mutex_lock(&s->lock);
+        n = convert_next_chunk(s, &sector_num, &status);
+        seq = s->next_seq;
+        if (n > 0) {
+            s->next_seq++;
+        }
+        qemu_co_mutex_unlock(&s->lock);
+
+        if (n <= 0) {
+            ret = n;
+            goto done;
+        }
+
+        if (status == BLK_DATA) {
+            ret = convert_co_read(s, sector_num, n, buf);
+            if (ret < 0) {
+                goto done;
+            }
+        }
+
+        if (s->wr_in_order) {
+            while (s->wr_seq != seq && s->ret == 0) {
+                s->wait_seq[index] = seq;
+                qemu_coroutine_yield();
+            }
+            s->wait_seq[index] = -1;
+            if (s->ret) {
+                break;
+            }
+        }
+
+        ret = convert_co_write(s, sector_num, n, buf, status);
+        if (ret < 0) {
+            goto done;
+        }
+
+        if (s->wr_in_order) {
+            s->wr_seq++;
+            convert_wake_writer(s, s->wr_seq);
+        }
+
+        s->sectors_done += n;
+        qemu_progress_print(100.0 * s->sectors_done / s->sectors_to_read, 0);
+        continue;
+
+done:
+        if (ret < 0 && s->ret == 0) {
+            s->ret = ret;
+            convert_wake_all_writers(s);
+        }
+        break;
+    }
+
+    qemu_vfree(buf);
+    s->co[index] = NULL;
+    s->running_coroutines--;
+}
+
+static int convert_do_copy(ImgConvertState *s, bool progress)
+{
+    int i;
+    int ret;
+
+    if (!s->compressed) {
+        s->has_zero_init = s->min_sparse ? bdrv_has_zero_init(s->target) : 0;
+        if (!s->has_zero_init && bdrv_can_write_zeroes_with_unmap(s->target)) {
+            ret = bdrv_make_zero(s->target, BDRV_REQ_MAY_UNMAP);
+            if (ret < 0) {
+                return ret;
+            }
+            s->has_zero_init = true;
+        }
+    } else if (!bdrv_can_write_compressed_parallel(s->target)) {
+        /* The driver can't handle concurrent compressed writes */
+        s->num_coroutines = 1;
+    }
+
+    qemu_co_mutex_init(&s->lock);
+    s->sectors_to_read = s->total_sectors;
+
+    /* Find out how much data is actually going to be copied so that the
+     * progress is accurate */
+    if (progress && (s->target_has_backing || s->has_zero_init)) {
+        ImgConvertBlockStatus status;
+        int64_t sector_num;
+
+        do {
+            ret = convert_next_chunk(s, &sector_num, &status);
+        } while (ret > 0);
+        if (ret < 0) {
+            return ret;
+        }
+        s->sectors_to_read = MAX(s->sectors_read, 1);
+        convert_reset_position(s);
+    }
+
+    /* Copy up to num_coroutines chunks in parallel */
+    for (i = 0; i < s->num_coroutines; i++) {
+        s->co[i] = qemu_coroutine_create(convert_co_do_copy);
+        s->wait_seq[i] = -1;
+    }
+    s->running_coroutines = s->num_coroutines;
+    for (i = 0; i < s->num_coroutines; i++) {
+        qemu_coroutine_enter(s->co[i], s);
+    }
+
+    while (s->running_coroutines) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+
+    if (s->ret < 0) {
+        return s->ret;
+    }
+
+    if (s->compressed) {
+        /* signal EOF to align */
+        bdrv_write_compressed(s->target, 0, NULL, 0);
+    }
+
+    return 0;
+}
+
 static int img_convert(int argc, char **argv)
 {
-    int c, n, n1, bs_n, bs_i, compress, cluster_sectors, skip_create;
+    int c, bs_n, bs_i, compress, cluster_sectors, skip_create;
     int64_t ret = 0;
     int progress = 0, flags, src_flags;
     const char *fmt, *out_fmt, *cache, *src_cache, *out_baseimg, *out_filename;
     BlockDriver *drv, *proto_drv;
     BlockBackend **blk = NULL, *out_blk = NULL;
     BlockDriverState **bs = NULL, *out_bs = NULL;
-    int64_t total_sectors, nb_sectors, sector_num, bs_offset;
+    int64_t total_sectors;
     int64_t *bs_sectors = NULL;
-    uint8_t * buf = NULL;
     size_t bufsectors = IO_BUF_SIZE / BDRV_SECTOR_SIZE;
-    const uint8_t *buf1;
     BlockDriverInfo bdi;
     QemuOpts *opts = NULL;
     QemuOptsList *create_opts = NULL;
@@ -1330,6 +1840,9 @@ static int img_convert(int argc, char **argv)
     bool quiet = false;
     Error *local_err = NULL;
     QemuOpts *sn_opts = NULL;
+    int num_coroutines = DEFAULT_CONVERT_COROUTINES;
+    bool wr_in_order = true;
+    ImgConvertState state;
 
     fmt = NULL;
     out_fmt = "raw";
@@ -1339,7 +1852,7 @@ static int img_convert(int argc, char **argv)
     compress = 0;
     skip_create = 0;
     for(;;) {
-        c = getopt(argc, argv, "hf:O:B:ce6o:s:l:S:pt:T:qn");
+        c = getopt(argc, argv, "hf:O:B:ce6o:s:l:S:pt:T:qnm:W");
         if (c == -1) {
             break;
         }
@@ -1429,9 +1942,33 @@ static int img_convert(int argc, char **argv)
         case 'n':
             skip_create = 1;
             break;
+        case 'm':
+        {
+            unsigned long long val;
+
+            if (parse_uint_full(optarg, &val, 10) < 0 ||
+                val < 1 || val > MAX_CONVERT_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d",
+                             MAX_CONVERT_COROUTINES);
+                ret = -1;
+                goto fail_getopt;
+            }
+            num_coroutines = val;
+            break;
+        }
+        case 'W':
+            wr_in_order = false;
+            break;
         }
     }
 
+    if (!wr_in_order && compress) {
+        error_report("Out of order write and compress are mutually exclusive");
+        ret = -1;
+        goto fail_getopt;
+    }
+
     /* Initialize before goto out */
     if (quiet) {
         progress = 0;
@@ -1560,7 +2097,7 @@ static int img_convert(int argc, char **argv)
         const char *preallocation =
             qemu_opt_get(opts, BLOCK_OPT_PREALLOC);
 
-        if (!drv->bdrv_write_compressed) {
+        if (!drv->bdrv_write_compressed && !drv->bdrv_co_write_compressed) {
             error_report("Compression not supported for this file format");
             ret = -1;
             goto out;
@@ -1608,9 +2145,6 @@ static int img_convert(int argc, char **argv)
     }
     out_bs = blk_bs(out_blk);
 
-    bs_i = 0;
-    bs_offset = 0;
-
     /* increase bufsectors from the default 4096 (2M) if opt_transfer_length
      * or discard_alignment of the out_bs is greater. Limit to 32768 (16MB)
      * as maximum. */
@@ -1619,8 +2153,6 @@ static int img_convert(int argc, char **argv)
                                          out_bs->bl.discard_alignment))
                     );
 
-    buf = qemu_blockalign(out_bs, bufsectors * BDRV_SECTOR_SIZE);
-
     if (skip_create) {
         int64_t output_sectors = bdrv_nb_sectors(out_bs);
         if (output_sectors < 0) {
@@ -1653,197 +2185,24 @@ static int img_convert(int argc, char **argv)
             ret = -1;
             goto out;
         }
-        sector_num = 0;
-
-        nb_sectors = total_sectors;
-
-        for(;;) {
-            int64_t bs_num;
-            int remainder;
-            uint8_t *buf2;
-
-            nb_sectors = total_sectors - sector_num;
-            if (nb_sectors <= 0)
-                break;
-            if (nb_sectors >= cluster_sectors)
-                n = cluster_sectors;
-            else
-                n = nb_sectors;
-
-            bs_num = sector_num - bs_offset;
-            assert (bs_num >= 0);
-            remainder = n;
-            buf2 = buf;
-            while (remainder > 0) {
-                int nlow;
-                while (bs_num == bs_sectors[bs_i]) {
-                    bs_offset += bs_sectors[bs_i];
-                    bs_i++;
-                    assert (bs_i < bs_n);
-                    bs_num = 0;
-                    /* printf("changing part: sector_num=%" PRId64 ", "
-                       "bs_i=%d, bs_offset=%" PRId64 ", bs_sectors=%" PRId64
-                       "\n", sector_num, bs_i, bs_offset, bs_sectors[bs_i]); */
-                }
-                assert (bs_num < bs_sectors[bs_i]);
-
-                nlow = remainder > bs_sectors[bs_i] - bs_num
-                    ? bs_sectors[bs_i] - bs_num : remainder;
-
-                ret = bdrv_read(bs[bs_i], bs_num, buf2, nlow);
-                if (ret < 0) {
-                    error_report("error while reading sector %" PRId64 ": %s",
-                                 bs_num, strerror(-ret));
-                    goto out;
-                }
-
-                buf2 += nlow * 512;
-                bs_num += nlow;
-
-                remainder -= nlow;
-            }
-            assert (remainder == 0);
-
-            if (!buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)) {
-                ret = bdrv_write_compressed(out_bs, sector_num, buf, n);
-                if (ret != 0) {
-                    error_report("error while compressing sector %" PRId64
-                                 ": %s", sector_num, strerror(-ret));
-                    goto out;
-                }
-            }
-            sector_num += n;
-            qemu_progress_print(100.0 * sector_num / total_sectors, 0);
-        }
-        /* signal EOF to align */
-        bdrv_write_compressed(out_bs, 0, NULL, 0);
-    } else {
-        int64_t sectors_to_read, sectors_read, sector_num_next_status;
-        bool count_allocated_sectors;
-        int has_zero_init = min_sparse ? bdrv_has_zero_init(out_bs) : 0;
-
-        if (!has_zero_init && bdrv_can_write_zeroes_with_unmap(out_bs)) {
-            ret = bdrv_make_zero(out_bs, BDRV_REQ_MAY_UNMAP);
-            if (ret < 0) {
-                goto out;
-            }
-            has_zero_init = 1;
-        }
-
-        sectors_to_read = total_sectors;
-        count_allocated_sectors = progress && (out_baseimg || has_zero_init);
-restart:
-        sector_num = 0; // total number of sectors converted so far
-        sectors_read = 0;
-        sector_num_next_status = 0;
-
-        for(;;) {
-            nb_sectors = total_sectors - sector_num;
-            if (nb_sectors <= 0) {
-                if (count_allocated_sectors) {
-                    sectors_to_read = sectors_read;
-                    count_allocated_sectors = false;
-                    goto restart;
-                }
-                ret = 0;
-                break;
-            }
-
-            while (sector_num - bs_offset >= bs_sectors[bs_i]) {
-                bs_offset += bs_sectors[bs_i];
-                bs_i ++;
-                assert (bs_i < bs_n);
-                /* printf("changing part: sector_num=%" PRId64 ", bs_i=%d, "
-                  "bs_offset=%" PRId64 ", bs_sectors=%" PRId64 "\n",
-                   sector_num, bs_i, bs_offset, bs_sectors[bs_i]); */
-            }
-
-            if ((out_baseimg || has_zero_init) &&
-                sector_num >= sector_num_next_status) {
-                n = nb_sectors > INT_MAX ? INT_MAX : nb_sectors;
-                ret = bdrv_get_block_status(bs[bs_i], sector_num - bs_offset,
-                                            n, &n1);
-                if (ret < 0) {
-                    error_report("error while reading block status of sector %"
-                                 PRId64 ": %s", sector_num - bs_offset,
-                                 strerror(-ret));
-                    goto out;
-                }
-                /* If the output image is zero initialized, we are not working
-                 * on a shared base and the input is zero we can skip the next
-                 * n1 sectors */
-                if (has_zero_init && !out_baseimg && (ret & BDRV_BLOCK_ZERO)) {
-                    sector_num += n1;
-                    continue;
-                }
-                /* If the output image is being created as a copy on write
-                 * image, assume that sectors which are unallocated in the
-                 * input image are present in both the output's and input's
-                 * base images (no need to copy them). */
-                if (out_baseimg) {
-                    if (!(ret & BDRV_BLOCK_DATA)) {
-                        sector_num += n1;
-                        continue;
-                    }
-                    /* The next 'n1' sectors are allocated in the input image.
-                     * Copy only those as they may be followed by unallocated
-                     * sectors. */
-                    nb_sectors = n1;
-                }
-                /* avoid redundant callouts to get_block_status */
-                sector_num_next_status = sector_num + n1;
-            }
-
-            n = MIN(nb_sectors, bufsectors);
-
-            /* round down request length to an aligned sector, but
-             * do not bother doing this on short requests. They happen
-             * when we found an all-zero area, and the next sector to
-             * write will not be sector_num + n. */
-            if (cluster_sectors > 0 && n >= cluster_sectors) {
-                int64_t next_aligned_sector = (sector_num + n);
-                next_aligned_sector -= next_aligned_sector % cluster_sectors;
-                if (sector_num + n > next_aligned_sector) {
-                    n = next_aligned_sector - sector_num;
-                }
-            }
-
-            n = MIN(n, bs_sectors[bs_i] - (sector_num - bs_offset));
+    }
 
-            sectors_read += n;
-            if (count_allocated_sectors) {
-                sector_num += n;
-                continue;
-            }
+    state = (ImgConvertState) {
+        .src                = bs,
+        .src_sectors        = bs_sectors,
+        .src_num            = bs_n,
+        .total_sectors      = total_sectors,
+        .target             = out_bs,
+        .compressed         = compress,
+        .target_has_backing = !compress && out_baseimg,
+        .min_sparse         = min_sparse,
+        .cluster_sectors    = cluster_sectors,
+        .buf_sectors        = bufsectors,
+        .num_coroutines     = num_coroutines,
+        .wr_in_order        = wr_in_order,
+    };
+    ret = convert_do_copy(&state, progress);
 
-            n1 = n;
-            ret = bdrv_read(bs[bs_i], sector_num - bs_offset, buf, n);
-            if (ret < 0) {
-                error_report("error while reading sector %" PRId64 ": %s",
-                             sector_num - bs_offset, strerror(-ret));
-                goto out;
-            }
-            /* NOTE: at the same time we convert, we do not write zero
-               sectors to have a chance to compress the image. Ideally, we
-               should add a specific call to have the info to go faster */
-            buf1 = buf;
-            while (n > 0) {
-                if (!has_zero_init ||
-                    is_allocated_sectors_min(buf1, n, &n1, min_sparse)) {
-                    ret = bdrv_write(out_bs, sector_num, buf1, n1);
-                    if (ret < 0) {
-                        error_report("error while writing sector %" PRId64
-                                     ": %s", sector_num, strerror(-ret));
-                        goto out;
-                    }
-                }
-                sector_num += n1;
-                n -= n1;
-                buf1 += n1 * 512;
-            }
-            qemu_progress_print(100.0 * sectors_read / sectors_to_read, 0);
-        }
-    }
 out:
     if (!ret) {
         qemu_progress_print(100, 0);
@@ -1851,7 +2210,6 @@ out:
     qemu_progress_end();
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
-    qemu_vfree(buf);
     qemu_opts_del(sn_opts);
     blk_unref(out_blk);
     g_free(bs);
@@ -3003,6 +3361,374 @@ out:
     return 0;
 }
 
+#define MAX_BENCH_DEPTH 1024
+
+typedef struct BenchData {
+    BlockDriverState *bs;
+    uint64_t image_size;
+    bool random;
+    int write_pct;
+    int bufsize;
+    int step;
+    uint64_t start_offset;
+    GRand *rand;
+
+    /* Position of the next sequential request */
+    uint64_t offset;
+
+    int count;
+    int issued;
+    int failed;
+    int running_coroutines;
+
+    /* Completion latency of each request in nanoseconds */
+    int64_t *latencies;
+    int nb_latencies;
+} BenchData;
+
+/* Picks the position and direction of the next request */
+static void bench_next_request(BenchData *b, uint64_t *offset, bool *is_write)
+{
+    if (b->random) {
+        uint64_t nb_blocks = (b->image_size - b->start_offset) / b->bufsize;
+        uint64_t block = g_rand_double(b->rand) * nb_blocks;
+
+        *offset = b->start_offset + MIN(block, nb_blocks - 1) * b->bufsize;
+    } else {
+        *offset = b->offset;
+        b->offset += b->step;
+        if (b->offset + b->bufsize > b->image_size) {
+            b->offset = b->start_offset;
+        }
+    }
+
+    *is_write = b->write_pct == 100 ||
+                (b->write_pct > 0 && g_rand_int_range(b->rand, 0, 100) <
+                                     b->write_pct);
+}
+
+static void coroutine_fn bench_co_worker(void *opaque)
+{
+    BenchData *b = opaque;
+    QEMUIOVector qiov;
+    struct iovec iov;
+    uint8_t *buf;
+
+    buf = qemu_blockalign0(b->bs, b->bufsize);
+    iov.iov_base = buf;
+    iov.iov_len = b->bufsize;
+    qemu_iovec_init_external(&qiov, &iov, 1);
+
+    while (b->issued < b->count && !b->failed) {
+        uint64_t offset;
+        bool is_write;
+        int64_t start;
+        int ret;
+
+        bench_next_request(b, &offset, &is_write);
+        b->issued++;
+
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (is_write) {
+            ret = bdrv_co_writev(b->bs, offset >> BDRV_SECTOR_BITS,
+                                 b->bufsize >> BDRV_SECTOR_BITS, &qiov);
+        } else {
+            ret = bdrv_co_readv(b->bs, offset >> BDRV_SECTOR_BITS,
+                                b->bufsize >> BDRV_SECTOR_BITS, &qiov);
+        }
+        if (ret < 0) {
+            error_report("Failed request at offset %" PRIu64 ": %s",
+                         offset, strerror(-ret));
+            b->failed = ret;
+            break;
+        }
+        b->latencies[b->nb_latencies++] =
+            qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+    }
+
+    qemu_vfree(buf);
+    b->running_coroutines--;
+}
+
+static int bench_compare_latency(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Returns the @pct percentile of the sorted latencies, in microseconds */
+static double bench_percentile(BenchData *b, double pct)
+{
+    int i = (int)(pct / 100 * b->nb_latencies + 0.999999) - 1;
+
+    i = MAX(0, MIN(i, b->nb_latencies - 1));
+    return b->latencies[i] / 1000.0;
+}
+
+static int img_bench(int argc, char **argv)
+{
+    int c, ret = 0;
+    const char *fmt = NULL, *filename;
+    const char *cache = BDRV_DEFAULT_CACHE;
+    bool quiet = false;
+    int flags = BDRV_O_FLAGS;
+    int count = 75000;
+    int depth = 64;
+    int64_t offset = 0;
+    int64_t bufsize = 4096;
+    int64_t step = 0;
+    int write_pct = 0;
+    bool random_pattern = false;
+    BlockBackend *blk = NULL;
+    BenchData data = {0};
+    int64_t image_size, t_start, t_end;
+    double duration, total_us;
+    int i;
+
+    for (;;) {
+        int option_index = 0;
+        static const struct option long_options[] = {
+            {"help", no_argument, 0, 'h'},
+            {"pattern", required_argument, 0, OPTION_PATTERN},
+            {"write-ratio", required_argument, 0, OPTION_WRITE_RATIO},
+            {0, 0, 0, 0}
+        };
+        c = getopt_long(argc, argv, "hc:d:f:no:qs:S:t:w",
+                        long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+        case 'h':
+        case '?':
+            help();
+            break;
+        case 'c':
+        {
+            unsigned long long val;
+
+            if (parse_uint_full(optarg, &val, 10) < 0 ||
+                val < 1 || val > INT_MAX) {
+                error_report("Invalid request count specified");
+                return 1;
+            }
+            count = val;
+            break;
+        }
+        case 'd':
+        {
+            unsigned long long val;
+
+            if (parse_uint_full(optarg, &val, 10) < 0 ||
+                val < 1 || val > MAX_BENCH_DEPTH) {
+                error_report("Invalid queue depth specified. Allowed queue "
+                             "depth is between 1 and %d", MAX_BENCH_DEPTH);
+                return 1;
+            }
+            depth = val;
+            break;
+        }
+        case 'f':
+            fmt = optarg;
+            break;
+        case 'n':
+            flags |= BDRV_O_NATIVE_AIO;
+            break;
+        case 'o':
+        {
+            char *end;
+
+            offset = strtosz_suffix(optarg, &end, STRTOSZ_DEFSUFFIX_B);
+            if (offset < 0 || *end || offset % BDRV_SECTOR_SIZE) {
+                error_report("Invalid offset specified");
+                return 1;
+            }
+            break;
+        }
+        case 'q':
+            quiet = true;
+            break;
+        case 's':
+        {
+            char *end;
+
+            bufsize = strtosz_suffix(optarg, &end, STRTOSZ_DEFSUFFIX_B);
+            if (bufsize <= 0 || *end || bufsize > INT_MAX ||
+                bufsize % BDRV_SECTOR_SIZE) {
+                error_report("Invalid buffer size specified");
+                return 1;
+            }
+            break;
+        }
+        case 'S':
+        {
+            char *end;
+
+            step = strtosz_suffix(optarg, &end, STRTOSZ_DEFSUFFIX_B);
+            if (step < 0 || *end || step > INT_MAX ||
+                step % BDRV_SECTOR_SIZE) {
+                error_report("Invalid step size specified");
+                return 1;
+            }
+            break;
+        }
+        case 't':
+            cache = optarg;
+            break;
+        case 'w':
+            write_pct = 100;
+            break;
+        case OPTION_PATTERN:
+            if (!strcmp(optarg, "sequential")) {
+                random_pattern = false;
+            } else if (!strcmp(optarg, "random")) {
+                random_pattern = true;
+            } else {
+                error_report("Invalid pattern (expecting 'sequential' or "
+                             "'random'): %s", optarg);
+                return 1;
+            }
+            break;
+        case OPTION_WRITE_RATIO:
+        {
+            unsigned long long val;
+
+            if (parse_uint_full(optarg, &val, 10) < 0 || val > 100) {
+                error_report("Invalid write ratio specified (expecting a "
+                             "percentage between 0 and 100)");
+                return 1;
+            }
+            write_pct = val;
+            break;
+        }
+        }
+    }
+
+    if (optind != argc - 1) {
+        error_exit("Expecting one image file name");
+    }
+    filename = argv[argc - 1];
+
+    if (!step) {
+        step = bufsize;
+    }
+
+    if (write_pct) {
+        flags |= BDRV_O_RDWR;
+    }
+
+    ret = bdrv_parse_cache_flags(cache, &flags);
+    if (ret < 0) {
+        error_report("Invalid cache mode: %s", cache);
+        return 1;
+    }
+
+    blk = img_open("image", filename, fmt, flags, true, quiet);
+    if (!blk) {
+        return 1;
+    }
+
+    image_size = blk_getlength(blk);
+    if (image_size < 0) {
+        error_report("Could not get image size: %s", strerror(-image_size));
+        ret = -1;
+        goto out;
+    }
+    if (offset + bufsize > image_size) {
+        error_report("Requests starting at offset %" PRId64 " with a size "
+                     "of %" PRId64 " bytes exceed the image size",
+                     offset, bufsize);
+        ret = -1;
+        goto out;
+    }
+
+    data = (BenchData) {
+        .bs             = blk_bs(blk),
+        .image_size     = image_size,
+        .random         = random_pattern,
+        .write_pct      = write_pct,
+        .bufsize        = bufsize,
+        .step           = step,
+        .start_offset   = offset,
+        .offset         = offset,
+        .count          = count,
+        /* Fixed seed, so that runs are reproducible */
+        .rand           = g_rand_new_with_seed(0),
+        .latencies      = g_try_new(int64_t, count),
+    };
+    if (!data.latencies) {
+        error_report("Could not allocate latency buffer for %d requests",
+                     count);
+        ret = -1;
+        goto out;
+    }
+
+    qprintf(quiet, "Sending %d %s requests, %" PRId64 " bytes each, "
+            "%d in parallel (starting at offset %" PRId64 ", %s",
+            count, write_pct == 0 ? "read" :
+                   write_pct == 100 ? "write" : "mixed",
+            bufsize, depth, offset,
+            random_pattern ? "random" : "sequential");
+    if (!random_pattern) {
+        qprintf(quiet, ", step size %" PRId64, step);
+    }
+    if (write_pct && write_pct < 100) {
+        qprintf(quiet, ", %d%% writes", write_pct);
+    }
+    qprintf(quiet, ")\n");
+
+    t_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    data.running_coroutines = MIN(depth, count);
+    for (i = 0; i < MIN(depth, count); i++) {
+        Coroutine *co = qemu_coroutine_create(bench_co_worker);
+        qemu_coroutine_enter(co, &data);
+    }
+
+    while (data.running_coroutines) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+
+    t_end = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (data.failed) {
+        ret = data.failed;
+        goto out;
+    }
+
+    duration = (t_end - t_start) / 1e9;
+    total_us = 0;
+    for (i = 0; i < data.nb_latencies; i++) {
+        total_us += data.latencies[i] / 1000.0;
+    }
+    qsort(data.latencies, data.nb_latencies, sizeof(data.latencies[0]),
+          bench_compare_latency);
+
+    qprintf(quiet, "Run completed in %3.3f seconds: %.0f IOPS, %.2f MiB/s\n",
+            duration, count / duration,
+            (double)count * bufsize / duration / (1024 * 1024));
+    qprintf(quiet, "Latency (us): avg %.1f, p50 %.1f, p90 %.1f, p99 %.1f, "
+            "p99.9 %.1f, max %.1f\n",
+            total_us / data.nb_latencies,
+            bench_percentile(&data, 50), bench_percentile(&data, 90),
+            bench_percentile(&data, 99), bench_percentile(&data, 99.9),
+            bench_percentile(&data, 100));
+
+out:
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
+    g_free(data.latencies);
+    blk_unref(blk);
+
+    if (ret) {
+        return 1;
+    }
+    return 0;
+}
+
 static const img_cmd_t img_cmds[] = {
 #define DEF(option, callback, arg_string)        \
     { option, callback },
@@ -114,6 +114,8 @@ const QEMULogItem qemu_log_items[] = {
       "x86 only: show CPU state before CPU resets" },
     { CPU_LOG_IOPORT, "ioport",
       "show all i/o ports accesses" },
+    { CPU_LOG_TB_STATS, "tb_stats",
+      "show translation cache and tb_lock statistics at exit (user mode)" },
     { LOG_UNIMP, "unimp",
       "log unimplemented functionality" },
     { LOG_GUEST_ERROR, "guest_errors",
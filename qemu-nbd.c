@@ -23,6 +23,8 @@
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
 #include "qemu/error-report.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
 #include "block/snapshot.h"
 #include "qapi/util.h"
 
@@ -44,16 +46,25 @@
 #define QEMU_NBD_OPT_AIO           2
 #define QEMU_NBD_OPT_DISCARD       3
 #define QEMU_NBD_OPT_DETECT_ZEROES 4
+#define QEMU_NBD_OPT_IOTHREAD      5
 
 static NBDExport *exp;
 static int verbose;
 static char *srcpath;
 static char *sockpath;
+static const char *export_name;
 static int persistent = 0;
 static enum { RUNNING, TERMINATE, TERMINATING, TERMINATED } state;
 static int shared = 1;
 static int nb_fds;
 
+/* With --iothread, requests are processed in a separate thread that runs
+ * the export's AioContext; the main loop only accepts connections.
+ */
+static AioContext *export_ctx;
+static QemuThread iothread;
+static bool iothread_stopping;
+
 static void usage(const char *name)
 {
     (printf) (
@@ -69,8 +80,11 @@ static void usage(const char *name)
 "  -k, --socket=PATH         path to the unix socket\n"
 "                            (default '"SOCKET_PATH"')\n"
 "  -e, --shared=NUM          device can be shared by NUM clients (default '1')\n"
+"  -x, --export-name=NAME    use newstyle negotiation and export as NAME; this\n"
+"                            enables structured replies and block status\n"
 "  -t, --persistent          don't exit on the last connection\n"
 "  -v, --verbose             display extra debugging information\n"
+"      --iothread            process requests in a separate I/O thread\n"
 "\n"
 "Exposing part of the image:\n"
 "  -o, --offset=OFFSET       offset into the image\n"
@@ -96,8 +110,8 @@ static void usage(const char *name)
 "                            '[ID_OR_NAME]'\n"
 "  -n, --nocache             disable host cache\n"
 "      --cache=MODE          set cache mode (none, writeback, ...)\n"
-#ifdef CONFIG_LINUX_AIO
-"      --aio=MODE            set AIO mode (native or threads)\n"
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
+"      --aio=MODE            set AIO mode (native, io_uring or threads)\n"
 #endif
 "      --discard=MODE        set discard mode (ignore, unmap)\n"
 "      --detect-zeroes=MODE  set detect-zeroes mode (off, on, discard)\n"
@@ -290,7 +304,7 @@ static void *nbd_client_thread(void *arg)
         goto out;
     }
 
-    ret = nbd_receive_negotiate(sock, NULL, &nbdflags,
+    ret = nbd_receive_negotiate(sock, export_name, &nbdflags,
                                 &size, &blocksize);
     if (ret < 0) {
         goto out_socket;
@@ -336,6 +350,27 @@ out:
     return (void *) EXIT_FAILURE;
 }
 
+static void *nbd_iothread_run(void *opaque)
+{
+    bool blocking;
+
+    rcu_register_thread();
+
+    while (!atomic_read(&iothread_stopping)) {
+        aio_context_acquire(export_ctx);
+        blocking = true;
+        while (!atomic_read(&iothread_stopping) &&
+               aio_poll(export_ctx, blocking)) {
+            /* Progress was made, keep going */
+            blocking = false;
+        }
+        aio_context_release(export_ctx);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
 static int nbd_can_accept(void *opaque)
 {
     return nb_fds < shared;
@@ -374,12 +409,15 @@ static void nbd_accept(void *opaque)
         return;
     }
 
-    if (nbd_client_new(exp, fd, nbd_client_closed)) {
+    /* A named export is looked up by the client during negotiation */
+    aio_context_acquire(export_ctx);
+    if (nbd_client_new(export_name ? NULL : exp, fd, nbd_client_closed)) {
         nb_fds++;
     } else {
         shutdown(fd, 2);
         close(fd);
     }
+    aio_context_release(export_ctx);
 }
 
 int main(int argc, char **argv)
@@ -396,7 +434,7 @@ int main(int argc, char **argv)
     off_t fd_size;
     QemuOpts *sn_opts = NULL;
     const char *sn_id_or_name = NULL;
-    const char *sopt = "hVb:o:p:rsnP:c:dvk:e:f:tl:";
+    const char *sopt = "hVb:o:p:rsnP:c:dvk:e:f:tl:x:";
     struct option lopt[] = {
         { "help", 0, NULL, 'h' },
         { "version", 0, NULL, 'V' },
@@ -412,12 +450,14 @@ int main(int argc, char **argv)
         { "load-snapshot", 1, NULL, 'l' },
         { "nocache", 0, NULL, 'n' },
         { "cache", 1, NULL, QEMU_NBD_OPT_CACHE },
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
         { "aio", 1, NULL, QEMU_NBD_OPT_AIO },
 #endif
         { "discard", 1, NULL, QEMU_NBD_OPT_DISCARD },
         { "detect-zeroes", 1, NULL, QEMU_NBD_OPT_DETECT_ZEROES },
+        { "iothread", 0, NULL, QEMU_NBD_OPT_IOTHREAD },
         { "shared", 1, NULL, 'e' },
+        { "export-name", 1, NULL, 'x' },
         { "format", 1, NULL, 'f' },
         { "persistent", 0, NULL, 't' },
         { "verbose", 0, NULL, 'v' },
@@ -433,7 +473,8 @@ int main(int argc, char **argv)
     int fd;
     bool seen_cache = false;
     bool seen_discard = false;
-#ifdef CONFIG_LINUX_AIO
+    bool use_iothread = false;
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     bool seen_aio = false;
 #endif
     pthread_t client_thread;
@@ -467,16 +508,22 @@ int main(int argc, char **argv)
                 errx(EXIT_FAILURE, "Invalid cache mode `%s'", optarg);
             }
             break;
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
         case QEMU_NBD_OPT_AIO:
             if (seen_aio) {
                 errx(EXIT_FAILURE, "--aio can only be specified once");
             }
             seen_aio = true;
-            if (!strcmp(optarg, "native")) {
-                flags |= BDRV_O_NATIVE_AIO;
-            } else if (!strcmp(optarg, "threads")) {
+            if (!strcmp(optarg, "threads")) {
                 /* this is the default */
+#ifdef CONFIG_LINUX_AIO
+            } else if (!strcmp(optarg, "native")) {
+                flags |= BDRV_O_NATIVE_AIO;
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+            } else if (!strcmp(optarg, "io_uring")) {
+                flags |= BDRV_O_IO_URING;
+#endif
             } else {
                errx(EXIT_FAILURE, "invalid aio mode `%s'", optarg);
             }
@@ -575,6 +622,12 @@ int main(int argc, char **argv)
                 errx(EXIT_FAILURE, "Shared device number must be greater than 0\n");
             }
             break;
+        case 'x':
+            export_name = optarg;
+            break;
+        case QEMU_NBD_OPT_IOTHREAD:
+            use_iothread = true;
+            break;
         case 'f':
             fmt = optarg;
             break;
@@ -730,7 +783,21 @@ int main(int argc, char **argv)
         }
     }
 
+    if (use_iothread) {
+        export_ctx = aio_context_new(&local_err);
+        if (!export_ctx) {
+            errx(EXIT_FAILURE, "Failed to create I/O thread context: %s",
+                 error_get_pretty(local_err));
+        }
+        bdrv_set_aio_context(bs, export_ctx);
+    } else {
+        export_ctx = qemu_get_aio_context();
+    }
+
     exp = nbd_export_new(bs, dev_offset, fd_size, nbdflags, nbd_export_closed);
+    if (export_name) {
+        nbd_export_set_name(exp, export_name);
+    }
 
     if (sockpath) {
         fd = unix_socket_incoming(sockpath);
@@ -755,6 +822,11 @@ int main(int argc, char **argv)
         memset(&client_thread, 0, sizeof(client_thread));
     }
 
+    if (use_iothread) {
+        qemu_thread_create(&iothread, "nbd-iothread", nbd_iothread_run,
+                           NULL, QEMU_THREAD_JOINABLE);
+    }
+
     qemu_set_fd_handler2(fd, nbd_can_accept, nbd_accept, NULL,
                          (void *)(uintptr_t)fd);
 
@@ -769,12 +841,22 @@ int main(int argc, char **argv)
         main_loop_wait(false);
         if (state == TERMINATE) {
             state = TERMINATING;
+            aio_context_acquire(export_ctx);
             nbd_export_close(exp);
             nbd_export_put(exp);
             exp = NULL;
+            aio_context_release(export_ctx);
         }
     } while (state != TERMINATED);
 
+    if (use_iothread) {
+        atomic_set(&iothread_stopping, true);
+        aio_notify(export_ctx);
+        qemu_thread_join(&iothread);
+        bdrv_set_aio_context(bs, qemu_get_aio_context());
+        aio_context_unref(export_ctx);
+    }
+
     blk_unref(blk);
     if (sockpath) {
         unlink(sockpath);
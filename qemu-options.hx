@@ -35,8 +35,13 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off controls accelerated irqchip support\n"
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU\n"
+    "                kvm-dirty-ring-size=n track dirty pages with per-vCPU rings of n entries\n"
+    "                kvm-halt-poll-ns=ns poll halted vCPUs for up to ns before sleeping\n"
+    "                xen-mapcache-cached=n keep up to n unlocked Xen mapcache mappings (default: 64)\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
+    "                mem-hugetlb=on|off back guest RAM with hugetlb pages if reserved (default: on)\n"
+    "                share-roms=on|off map firmware images from their files copy-on-write (default: off)\n"
     "                iommu=on|off controls emulated Intel IOMMU (VT-d) support (default=off)\n",
     QEMU_ARCH_ALL)
 STEXI
@@ -58,12 +63,46 @@ value based on accel. For accel=xen the default is off otherwise the default
 is on.
 @item kvm_shadow_mem=size
 Defines the size of the KVM shadow MMU.
+@item kvm-dirty-ring-size=@var{n}
+Track guest dirty pages with a KVM dirty ring of @var{n} entries per vCPU,
+instead of the per-slot dirty bitmap.  The cost of a dirty log sync then
+depends on the number of pages that were dirtied, not on the size of guest
+memory.  @var{n} must be a power of two; 4096 is a good start.  The default
+is 0, which uses the bitmap.  If the host kernel lacks dirty ring support,
+QEMU warns and falls back to the bitmap.
+@item kvm-halt-poll-ns=@var{ns}
+When KVM vCPUs halt in userspace, that is without an in-kernel irqchip, poll
+for up to @var{ns} nanoseconds for a wakeup before going to sleep.  Each vCPU
+adapts its polling window to how long its recent halts lasted, so vCPUs that
+are woken quickly (for example by IPIs) avoid the wakeup latency, and idle
+ones do not burn host CPU.  The default is 0, which disables polling.
+@item xen-mapcache-cached=@var{n}
+With accel=xen, keep up to @var{n} mappings of guest memory that are no
+longer used by any device mapped in the mapcache, in addition to one per
+bucket, and unmap the least recently used one when there are more.  Larger
+values save calls into Xen to map guest memory for DMA, at the cost of
+virtual address space (1 MB per mapping on 64-bit hosts).  0 unmaps them as
+soon as they are released.  The default is 64.
 @item dump-guest-core=on|off
 Include guest memory in a core dump. The default is on.
 @item mem-merge=on|off
 Enables or disables memory merge support. This feature, when supported by
 the host, de-duplicates identical memory pages among VMs instances
 (enabled by default).
+@item mem-hugetlb=on|off
+Back the main guest RAM with anonymous hugetlb pages if the host has
+reserved enough of them, trying 1 GiB pages and then 2 MiB pages; otherwise
+use normal memory with transparent huge pages.  Hugetlb memory cannot be
+merged.  @code{info ramblock} shows the page size actually used.  This
+does not affect memory configured with @option{-mem-path} or memory
+backends.  The default is on.
+@item share-roms=on|off
+Map the PC BIOS, PCI option ROM BARs and option ROMs passed through fw_cfg
+copy-on-write from their image files instead of copying them into private
+memory.  Pages that are never written then stay shared in the host page
+cache, and thus among all QEMU processes using the same images.  The image
+files must not be modified in place (replacing them is fine) while QEMU is
+running.  The default is off.
 @item iommu=on|off
 Enables or disables emulated Intel IOMMU (VT-d) support. The default is off.
 @end table
@@ -103,11 +142,11 @@ specifies the maximum number of hotpluggable CPUs.
 ETEXI
 
 DEF("numa", HAS_ARG, QEMU_OPTION_numa,
-    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node]\n"
-    "-numa node[,memdev=id][,cpus=cpu[-cpu]][,nodeid=node]\n", QEMU_ARCH_ALL)
+    "-numa node[,mem=size][,cpus=cpu[-cpu]][,nodeid=node][,host-node=node][,host-cpus=cpu[-cpu]]\n"
+    "-numa node[,memdev=id][,cpus=cpu[-cpu]][,nodeid=node][,host-node=node][,host-cpus=cpu[-cpu]]\n", QEMU_ARCH_ALL)
 STEXI
-@item -numa node[,mem=@var{size}][,cpus=@var{cpu[-cpu]}][,nodeid=@var{node}]
-@item -numa node[,memdev=@var{id}][,cpus=@var{cpu[-cpu]}][,nodeid=@var{node}]
+@item -numa node[,mem=@var{size}][,cpus=@var{cpu[-cpu]}][,nodeid=@var{node}][,host-node=@var{node}][,host-cpus=@var{cpu[-cpu]}]
+@item -numa node[,memdev=@var{id}][,cpus=@var{cpu[-cpu]}][,nodeid=@var{node}][,host-node=@var{node}][,host-cpus=@var{cpu[-cpu]}]
 @findex -numa
 Simulate a multi node NUMA system. If @samp{mem}, @samp{memdev}
 and @samp{cpus} are omitted, resources are split equally. Also, note
@@ -119,6 +158,14 @@ to specify the memory backend for the @samp{memdev} suboption.
 
 @samp{mem} and @samp{memdev} are mutually exclusive.  Furthermore, if one
 node uses @samp{memdev}, all of them have to use it.
+
+@samp{host-node} and @samp{host-cpus} place the guest node on the host.
+The VCPU threads of the node are pinned to @samp{host-cpus}, or to the
+CPUs of host node @samp{host-node} if @samp{host-cpus} is omitted, and
+the node's @samp{memdev} is bound to @samp{host-node} unless the backend
+already has a @samp{host-nodes} policy.  An iothread object created with
+@samp{numa-node=@var{node}} runs on the same host CPUs as guest node
+@var{node}; its @samp{host-cpus} property pins it explicitly instead.
 ETEXI
 
 DEF("add-fd", HAS_ARG, QEMU_OPTION_add_fd,
@@ -259,7 +306,11 @@ DEF("mem-prealloc", 0, QEMU_OPTION_mem_prealloc,
 STEXI
 @item -mem-prealloc
 @findex -mem-prealloc
-Preallocate memory when using -mem-path.
+Preallocate memory when using -mem-path.  The pages are touched by one
+thread per vCPU, up to the number of host CPUs and at most 16 threads.
+Memory backends created with @option{-object} take the thread count from
+their @option{prealloc-threads} property, which defaults to the number of
+vCPUs as well.
 ETEXI
 
 DEF("k", HAS_ARG, QEMU_OPTION_k,
@@ -434,7 +485,7 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -442,6 +493,9 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [[,bps_max=bm]|[[,bps_rd_max=rm][,bps_wr_max=wm]]]\n"
     "       [[,iops_max=im]|[[,iops_rd_max=irm][,iops_wr_max=iwm]]]\n"
     "       [[,iops_size=is]]\n"
+    "       [[,bps_max_length=bl]|[[,bps_rd_max_length=rl][,bps_wr_max_length=wl]]]\n"
+    "       [[,iops_max_length=il]|[[,iops_rd_max_length=irl][,iops_wr_max_length=iwl]]]\n"
+    "       [[,throttling.group=g]]\n"
     "                use 'file' as a drive image\n", QEMU_ARCH_ALL)
 STEXI
 @item -drive @var{option}[,@var{option}[,@var{option}[,...]]]
@@ -476,7 +530,7 @@ These options have the same definition as they have in @option{-hdachs}.
 @item cache=@var{cache}
 @var{cache} is "none", "writeback", "unsafe", "directsync" or "writethrough" and controls how the host cache is used to access block data.
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread based disk I/O, native Linux AIO and Linux io_uring.  Native Linux AIO is only used together with @option{cache=none} or @option{cache=directsync}; io_uring also works with the host page cache.  With io_uring, the @option{file.fixed-buffers=on} option registers guest RAM with the kernel once instead of mapping it on every request; note that this pins all of guest RAM in host memory.
 @item discard=@var{discard}
 @var{discard} is one of "ignore" (or "off") or "unmap" (or "on") and controls whether @dfn{discard} (also known as @dfn{trim} or @dfn{unmap}) requests are ignored or passed to the filesystem.  Some machine types may not support discard requests.
 @item format=@var{format}
@@ -503,6 +557,23 @@ file sectors into the image file.
 conversion of plain zero writes by the OS to driver specific optimized
 zero write commands. You may even choose "unmap" if @var{discard} is set
 to "unmap" to allow a zero write to be converted to an UNMAP operation.
+@item bps_max_length=@var{bl},iops_max_length=@var{il}
+Let bursts last up to @var{bl} (respectively @var{il}) seconds.  With a
+length greater than one, @option{bps_max} and @option{iops_max} are
+rates: the drive may do I/O at that rate for the given number of
+seconds, after which it falls back to @option{bps} and @option{iops}
+until it has been idle long enough to earn the burst again.  For
+example, @option{iops=100,iops_max=1000,iops_max_length=60} allows
+1000 IOPS during the first minute after boot.  The read and write
+variants (@option{bps_rd_max_length} and so on) work the same way.
+@item throttling.group=@var{g}
+Put the drive in throttling group @var{g}.  All drives in a group share
+the I/O limits given with @option{bps}, @option{iops} and friends, so
+that the limits cap the combined I/O of the group rather than that of
+each drive; the available bandwidth is distributed among the drives of
+the group in round-robin fashion.  The limits of a group are the ones
+set most recently for any of its members.  By default every throttled
+drive is in a group of its own, named after the drive.
 @end table
 
 By default, the @option{cache=writeback} mode is used. It will report data
@@ -964,6 +1035,7 @@ DEF("spice", HAS_ARG, QEMU_OPTION_spice,
     "       [,streaming-video=[off|all|filter]][,disable-copy-paste]\n"
     "       [,disable-agent-file-xfer][,agent-mouse=[on|off]]\n"
     "       [,playback-compression=[on|off]][,seamless-migration=[on|off]]\n"
+    "       [,iothread=id]\n"
     "   enable spice\n"
     "   at least one of {port, tls-port} is mandatory\n",
     QEMU_ARCH_ALL)
@@ -1054,6 +1126,11 @@ Enable/disable audio stream compression (using celt 0.5.1).  Default is on.
 @item seamless-migration=[on|off]
 Enable/disable spice seamless migration. Default is off.
 
+@item iothread=@var{id}
+Build the display updates for non-qxl graphic cards in the given
+IOThread (see @code{-object iothread}) instead of the main loop, so that
+busy screens don't hold the global mutex.
+
 @end table
 ETEXI
 
@@ -1278,6 +1355,12 @@ This can be really helpful to save bandwidth when playing videos. Disabling
 adaptive encodings restores the original static behavior of encodings
 like Tight.
 
+@item workers=@var{n}
+
+Encode framebuffer updates in @var{n} threads (at most 64, default 1).
+Updates for different clients are encoded in parallel, the updates of one
+client are always encoded in order by one thread at a time.
+
 @item share=[allow-exclusive|force-shared|ignore]
 
 Set display sharing policy.  'allow-exclusive' allows clients to ask
@@ -1417,7 +1500,7 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "-net tap[,vlan=n][,name=str],ifname=name\n"
     "                connect the host TAP network interface to VLAN 'n'\n"
 #else
-    "-net tap[,vlan=n][,name=str][,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off][,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n]\n"
+    "-net tap[,vlan=n][,name=str][,fd=h][,fds=x:y:...:z][,ifname=name][,script=file][,downscript=dfile][,helper=helper][,sndbuf=nbytes][,vnet_hdr=on|off][,vhost=on|off][,vhostfd=h][,vhostfds=x:y:...:z][,vhostforce=on|off][,queues=n][,poll-us=n][,zerocopy=on|off]\n"
     "                connect the host TAP network interface to VLAN 'n'\n"
     "                use network scripts 'file' (default=" DEFAULT_NETWORK_SCRIPT ")\n"
     "                to configure it and 'dfile' (default=" DEFAULT_NETWORK_DOWN_SCRIPT ")\n"
@@ -1437,13 +1520,16 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                use 'vhostfd=h' to connect to an already opened vhost net device\n"
     "                use 'vhostfds=x:y:...:z to connect to multiple already opened vhost net devices\n"
     "                use 'queues=n' to specify the number of queues to be created for multiqueue TAP\n"
+    "                use 'poll-us=n' to let vhost busy poll for up to n microseconds before\n"
+    "                waiting for a notification\n"
+    "                use zerocopy=on|off to require the host vhost-net zero-copy transmit setting\n"
     "-net bridge[,vlan=n][,name=str][,br=bridge][,helper=helper]\n"
     "                connects a host TAP network interface to a host bridge device 'br'\n"
     "                (default=" DEFAULT_BRIDGE_INTERFACE ") using the program 'helper'\n"
     "                (default=" DEFAULT_BRIDGE_HELPER ")\n"
 #endif
 #ifdef __linux__
-    "-net l2tpv3[,vlan=n][,name=str],src=srcaddr,dst=dstaddr[,srcport=srcport][,dstport=dstport],txsession=txsession[,rxsession=rxsession][,ipv6=on/off][,udp=on/off][,cookie64=on/off][,counter][,pincounter][,txcookie=txcookie][,rxcookie=rxcookie][,offset=offset]\n"
+    "-net l2tpv3[,vlan=n][,name=str],src=srcaddr,dst=dstaddr[,srcport=srcport][,dstport=dstport],txsession=txsession[,rxsession=rxsession][,ipv6=on/off][,udp=on/off][,cookie64=on/off][,counter][,pincounter][,txcookie=txcookie][,rxcookie=rxcookie][,offset=offset][,batch=n]\n"
     "                connect the VLAN to an Ethernet over L2TPv3 pseudowire\n"
     "                Linux kernel 3.3+ as well as most routers can talk\n"
     "                L2TPv3. This transport allows connecting a VM to a VM,\n"
@@ -1464,14 +1550,16 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "                use 'counter=off' to force a 'cut-down' L2TPv3 with no counter\n"
     "                use 'pincounter=on' to work around broken counter handling in peer\n"
     "                use 'offset=X' to add an extra offset between header and data\n"
+    "                use 'batch=n' to read and write up to n packets per system call\n"
 #endif
     "-net socket[,vlan=n][,name=str][,fd=h][,listen=[host]:port][,connect=host:port]\n"
     "                connect the vlan 'n' to another VLAN using a socket connection\n"
-    "-net socket[,vlan=n][,name=str][,fd=h][,mcast=maddr:port[,localaddr=addr]]\n"
+    "-net socket[,vlan=n][,name=str][,fd=h][,mcast=maddr:port[,localaddr=addr]][,batch=n]\n"
     "                connect the vlan 'n' to multicast maddr and port\n"
     "                use 'localaddr=addr' to specify the host address to send packets from\n"
-    "-net socket[,vlan=n][,name=str][,fd=h][,udp=host:port][,localaddr=host:port]\n"
+    "-net socket[,vlan=n][,name=str][,fd=h][,udp=host:port][,localaddr=host:port][,batch=n]\n"
     "                connect the vlan 'n' to another VLAN using an UDP tunnel\n"
+    "                use 'batch=n' to read and write up to n datagrams per system call\n"
 #ifdef CONFIG_VDE
     "-net vde[,vlan=n][,name=str][,sock=socketpath][,port=n][,group=groupname][,mode=octalmode]\n"
     "                connect the vlan 'n' to port 'n' of a vde switch running\n"
@@ -1690,6 +1778,16 @@ helper executable is @file{/path/to/qemu-bridge-helper}.
 @option{fd}=@var{h} can be used to specify the handle of an already
 opened host TAP interface.
 
+With @option{vhost=on}, @option{poll-us}=@var{n} makes the vhost-net
+worker keep polling the virtqueues and the TAP device for up to @var{n}
+microseconds after it runs out of work, instead of waiting for the next
+guest notification.  This trades host CPU time for latency and needs host
+kernel support.  @option{zerocopy=on|off} fails unless zero-copy transmit
+is respectively enabled or disabled in the host; it is set host-wide with
+the @code{experimental_zcopytx} parameter of the vhost_net module.  Use the
+@code{query-vhost-net} QMP command to see the settings in effect and how
+many notifications each queue received.
+
 Examples:
 
 @example
@@ -1758,8 +1856,8 @@ qemu-system-i386 linux.img \
                  -net socket,connect=127.0.0.1:1234
 @end example
 
-@item -netdev socket,id=@var{id}[,fd=@var{h}][,mcast=@var{maddr}:@var{port}[,localaddr=@var{addr}]]
-@item -net socket[,vlan=@var{n}][,name=@var{name}][,fd=@var{h}][,mcast=@var{maddr}:@var{port}[,localaddr=@var{addr}]]
+@item -netdev socket,id=@var{id}[,fd=@var{h}][,mcast=@var{maddr}:@var{port}[,localaddr=@var{addr}]][,batch=@var{n}]
+@item -net socket[,vlan=@var{n}][,name=@var{name}][,fd=@var{h}][,mcast=@var{maddr}:@var{port}[,localaddr=@var{addr}]][,batch=@var{n}]
 
 Create a VLAN @var{n} shared with another QEMU virtual
 machines using a UDP multicast socket, effectively making a bus for
@@ -1774,6 +1872,11 @@ mcast support is compatible with User Mode Linux (argument @option{eth@var{N}=mc
 @url{http://user-mode-linux.sf.net}.
 @item
 Use @option{fd=h} to specify an already opened UDP multicast socket.
+@item
+Use @option{batch=n} to read and write up to @var{n} datagrams with one
+system call (1 to 256, default 32) on hosts with @code{recvmmsg} and
+@code{sendmmsg}.  Batched transmission only kicks in while the guest
+device hands over several frames at once.
 @end enumerate
 
 Example:
@@ -1810,8 +1913,8 @@ qemu-system-i386 linux.img \
                  -net socket,mcast=239.192.168.1:1102,localaddr=1.2.3.4
 @end example
 
-@item -netdev l2tpv3,id=@var{id},src=@var{srcaddr},dst=@var{dstaddr}[,srcport=@var{srcport}][,dstport=@var{dstport}],txsession=@var{txsession}[,rxsession=@var{rxsession}][,ipv6][,udp][,cookie64][,counter][,pincounter][,txcookie=@var{txcookie}][,rxcookie=@var{rxcookie}][,offset=@var{offset}]
-@item -net l2tpv3[,vlan=@var{n}][,name=@var{name}],src=@var{srcaddr},dst=@var{dstaddr}[,srcport=@var{srcport}][,dstport=@var{dstport}],txsession=@var{txsession}[,rxsession=@var{rxsession}][,ipv6][,udp][,cookie64][,counter][,pincounter][,txcookie=@var{txcookie}][,rxcookie=@var{rxcookie}][,offset=@var{offset}]
+@item -netdev l2tpv3,id=@var{id},src=@var{srcaddr},dst=@var{dstaddr}[,srcport=@var{srcport}][,dstport=@var{dstport}],txsession=@var{txsession}[,rxsession=@var{rxsession}][,ipv6][,udp][,cookie64][,counter][,pincounter][,txcookie=@var{txcookie}][,rxcookie=@var{rxcookie}][,offset=@var{offset}][,batch=@var{n}]
+@item -net l2tpv3[,vlan=@var{n}][,name=@var{name}],src=@var{srcaddr},dst=@var{dstaddr}[,srcport=@var{srcport}][,dstport=@var{dstport}],txsession=@var{txsession}[,rxsession=@var{rxsession}][,ipv6][,udp][,cookie64][,counter][,pincounter][,txcookie=@var{txcookie}][,rxcookie=@var{rxcookie}][,offset=@var{offset}][,batch=@var{n}]
 Connect VLAN @var{n} to L2TPv3 pseudowire. L2TPv3 (RFC3391) is a popular
 protocol to transport Ethernet (and other Layer 2) data frames between
 two systems. It is present in routers, firewalls and the Linux kernel
@@ -1846,6 +1949,10 @@ draft-mkonstan-l2tpext-keyed-ipv6-tunnel-00
 networks which have packet reorder.
 @item offset=@var{offset}
     Add an extra offset between header and data
+@item batch=@var{n}
+    Read up to @var{n} packets with one @code{recvmmsg} call, and write
+up to @var{n} with one @code{sendmmsg} call while the guest device hands
+over several frames at once (1 to 1024, default 64)
 
 For example, to attach a VM running on host 4.3.2.1 via L2TPv3 to the bridge br-lan
 on the remote Linux host 1.2.3.4:
@@ -1893,13 +2000,19 @@ The hubport netdev lets you connect a NIC to a QEMU "vlan" instead of a single
 netdev.  @code{-net} and @code{-device} with parameter @option{vlan} create the
 required hub automatically.
 
-@item -netdev vhost-user,chardev=@var{id}[,vhostforce=on|off]
+@item -netdev vhost-user,chardev=@var{id}[,vhostforce=on|off][,queues=n]
 
 Establish a vhost-user netdev, backed by a chardev @var{id}. The chardev should
 be a unix domain socket backed one. The vhost-user uses a specifically defined
 protocol to pass vhost ioctl replacement messages to an application on the other
 end of the socket. On non-MSIX guests, the feature can be forced with
-@var{vhostforce}.
+@var{vhostforce}. Use @var{queues=n} to create @var{n} queue pairs over the
+same socket; the application must support multiple queues.
+
+If the application exits, the link goes down and the guest keeps its rings.
+When an application connects again (for a client chardev, add
+@option{reconnect=@var{seconds}}), the ring state is handed over and the link
+comes back up.
 
 Example:
 @example
@@ -2361,6 +2474,13 @@ This value may optionally have the suffix 'T', 'G', 'M', 'K', 'k' or 'b'. If it
 does not have a suffix, it will be assumed to be in bytes. The value must be a
 multiple of 512 bytes. It defaults to 256k.
 
+@item readahead-max
+While the guest reads the image sequentially, the readahead is doubled with
+each range request up to this size; any other access resets it to
+@option{readahead}. The value must be a multiple of 512 bytes and at least
+@option{readahead}. It defaults to 4M, or to @option{readahead} if that is
+larger. Set it to the same value as @option{readahead} to disable this.
+
 @item sslverify
 Whether to verify the remote server's certificate when connecting over SSL. It
 can have the value 'on' or 'off'. It defaults to 'on'.
@@ -2792,11 +2912,16 @@ Like -monitor but opens in 'control' mode.
 ETEXI
 
 DEF("mon", HAS_ARG, QEMU_OPTION_mon, \
-    "-mon [chardev=]name[,mode=readline|control][,default]\n", QEMU_ARCH_ALL)
+    "-mon [chardev=]name[,mode=readline|control][,default][,oob=on|off]\n",
+    QEMU_ARCH_ALL)
 STEXI
-@item -mon [chardev=]name[,mode=readline|control][,default]
+@item -mon [chardev=]name[,mode=readline|control][,default][,oob=on|off]
 @findex -mon
-Setup monitor on chardev @var{name}.
+Setup monitor on chardev @var{name}.  With @option{oob=on}, a QMP monitor
+(@option{mode=control}) on a socket chardev gets its own thread and offers
+the @code{oob} QMP capability.  A client that enables it can send commands
+such as @code{query-status} with @code{exec-oob}, and they are answered right
+away even while the main loop is busy with another command.
 ETEXI
 
 DEF("debugcon", HAS_ARG, QEMU_OPTION_debugcon, \
@@ -3159,6 +3284,47 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tcg-hot-threshold", HAS_ARG, QEMU_OPTION_tcg_hot_threshold, \
+    "-tcg-hot-threshold n\n"
+    "                retranslate a TB as a superblock after n executions\n"
+    "                (0, the default, disables it)\n", QEMU_ARCH_ALL)
+STEXI
+@item -tcg-hot-threshold @var{n}
+@findex -tcg-hot-threshold
+Count the executions of each translated block and, once a block has run
+@var{n} times, translate it again as a hot block.  Hot blocks are allowed
+to follow direct forward branches into a single larger superblock, which
+saves the block-chaining overhead in tight code.  Profiling adds a counter
+update to every block, so small values of @var{n} are not useful.
+ETEXI
+
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        write /tmp/perf-<pid>.map for translated code\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -perfmap
+@findex -perfmap
+Append an entry to @file{/tmp/perf-@var{pid}.map} for every block TCG
+translates, giving its host address, its size and the guest address (and
+symbol, if known) it was translated from.  Linux @command{perf} reads this
+file to attribute samples that hit the code buffer.  Code buffer space is
+reused after a flush, so entries written before a flush can go stale.
+ETEXI
+
+DEF("jitdump", 0, QEMU_OPTION_jitdump, \
+    "-jitdump        write /tmp/jit-<pid>.dump for translated code\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -jitdump
+@findex -jitdump
+Write a record in perf's jitdump format to @file{/tmp/jit-@var{pid}.dump}
+for every block TCG translates: its guest address and symbol, its host
+address and a copy of the host code.  Unlike @option{-perfmap}, the records
+are timestamped, so code buffer reuse is handled correctly.  Record with
+@code{perf record -k 1}, then run @code{perf inject --jit} on the result
+before @code{perf report}.  Linux hosts only.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming p     prepare for incoming migration, listen on port p\n",
     QEMU_ARCH_ALL)
@@ -3320,6 +3486,23 @@ STEXI
 Enable FIPS 140-2 compliance mode.
 ETEXI
 
+#ifdef __linux__
+DEF("async-teardown", 0, QEMU_OPTION_async_teardown,
+    "-async-teardown enable asynchronous teardown of guest memory\n",
+    QEMU_ARCH_ALL)
+#endif
+STEXI
+@item -async-teardown
+@findex -async-teardown
+Release guest memory in a separate helper process when QEMU exits.
+Images, sockets and other files are still closed by QEMU itself before it
+exits, but unmapping guest RAM, which can take tens of seconds for guests
+with terabytes of memory, happens in the helper.  The QEMU process therefore
+goes away as soon as its devices and block devices are shut down.  The helper
+shows up as @code{qemu-teardown} and exits once the memory is released; it
+is accounted to the same user and cgroup as QEMU.
+ETEXI
+
 HXCOMM Deprecated by -machine accel=tcg property
 DEF("no-kvm", 0, QEMU_OPTION_no_kvm, "", QEMU_ARCH_I386)
 
@@ -164,6 +164,43 @@ Example:
 -> { "execute": "screendump", "arguments": { "filename": "/tmp/image" } }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "query-console-refresh",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_console_refresh,
+    },
+
+SQMP
+query-console-refresh
+---------------------
+
+Show how often the display device behind each console is polled.
+
+Returns a json-array with one entry per console, each containing:
+
+- "index": console index (json-int)
+- "active": true for the console shown by default (json-bool)
+- "interval": refresh interval in milliseconds, 0 while no display
+  client needs refreshing (json-int)
+- "refreshes": times the display device was polled (json-int)
+- "updates": screen updates reported by the display device (json-int)
+
+Example:
+
+-> { "execute": "query-console-refresh" }
+<- { "return": [
+        {
+            "index": 0,
+            "active": true,
+            "interval": 0,
+            "refreshes": 3120,
+            "updates": 41
+        }
+      ]
+   }
+
 EQMP
 
     {
@@ -606,6 +643,38 @@ Example:
      "arguments": { "enable": true } }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "query-xen-mapcache",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_xen_mapcache,
+    },
+
+SQMP
+query-xen-mapcache
+------------------
+
+Show the statistics of the Xen mapcache, which maps guest memory into QEMU.
+
+Return a json-object with the following information:
+
+- "buckets": number of buckets, each holding one mapping (json-int)
+- "bucket-size": guest memory covered by a bucket, in bytes (json-int)
+- "cached": unlocked mappings kept for reuse beyond one per bucket (json-int)
+- "max-cached": limit on "cached" (json-int)
+- "locked": mappings currently locked by devices (json-int)
+- "hits": lookups served by an existing mapping (json-int)
+- "misses": lookups that had to map guest memory (json-int)
+- "evictions": cached mappings unmapped because of the limit (json-int)
+
+Example:
+
+-> { "execute": "query-xen-mapcache" }
+<- { "return": { "buckets": 32768, "bucket-size": 1048576, "cached": 12,
+                 "max-cached": 64, "locked": 3, "hits": 812338,
+                 "misses": 2104, "evictions": 0 } }
+
 EQMP
 
     {
@@ -638,6 +707,9 @@ Notes:
 (2) All boolean arguments default to false
 (3) The user Monitor's "detach" argument is invalid in QMP and should not
     be used
+(4) With a "file:<path>" URI the stream is written to a regular file, that
+    "-incoming file:<path>" reads back.  Enable the "mapped-ram" capability
+    on both sides to store RAM at fixed offsets of the file
 
 EQMP
 
@@ -660,6 +732,28 @@ Example:
 -> { "execute": "migrate_cancel" }
 <- { "return": {} }
 
+EQMP
+{
+        .name       = "migrate-start-postcopy",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_migrate_start_postcopy,
+    },
+
+SQMP
+migrate-start-postcopy
+----------------------
+
+Switch the current migration to postcopy mode.  The source stops, the
+destination starts running and fetches the pages it is still missing on
+demand.  Requires the postcopy-ram capability on both sides.
+
+Arguments: None.
+
+Example:
+
+-> { "execute": "migrate-start-postcopy" }
+<- { "return": {} }
+
 EQMP
 {
         .name       = "migrate-set-cache-size",
@@ -790,8 +884,8 @@ EQMP
 
     {
         .name       = "dump-guest-memory",
-        .args_type  = "paging:b,protocol:s,begin:i?,end:i?,format:s?",
-        .params     = "-p protocol [begin] [length] [format]",
+        .args_type  = "paging:b,protocol:s,begin:i?,end:i?,format:s?,detach:b?",
+        .params     = "-p protocol [begin] [length] [format] [detach]",
         .help       = "dump guest memory to file",
         .user_print = monitor_user_noop,
         .mhandler.cmd_new = qmp_marshal_input_dump_guest_memory,
@@ -815,6 +909,9 @@ Arguments:
 - "format": the format of guest memory dump. It's optional, and can be
             elf|kdump-zlib|kdump-lzo|kdump-snappy, but non-elf formats will
             conflict with paging and filter, ie. begin and length (json-string)
+- "detach": if true, write the dump from a background thread and return
+            immediately; progress is reported by query-dump and the end by
+            the DUMP_COMPLETED event (json-bool)
 
 Example:
 
@@ -825,6 +922,34 @@ Notes:
 
 (1) All boolean arguments default to false
 
+EQMP
+
+    {
+        .name       = "query-dump",
+        .args_type  = "",
+        .params     = "",
+        .help       = "query background dump status",
+        .mhandler.cmd_new = qmp_marshal_input_query_dump,
+    },
+
+SQMP
+query-dump
+----------
+
+Query the status and progress of the latest dump-guest-memory.
+
+Return a json-object with the following information:
+
+- "status": the dump status: none, active, completed or failed (json-string)
+- "completed": bytes of guest memory written so far (json-int)
+- "total": total bytes of guest memory to be written (json-int)
+
+Example:
+
+-> { "execute": "query-dump" }
+<- { "return": { "status": "active", "completed": 1024000,
+                 "total": 2048000 } }
+
 EQMP
 
     {
@@ -1048,7 +1173,7 @@ EQMP
     {
         .name       = "drive-backup",
         .args_type  = "sync:s,device:B,target:s,speed:i?,mode:s?,format:s?,"
-                      "on-source-error:s?,on-target-error:s?",
+                      "bitmap:s?,on-source-error:s?,on-target-error:s?",
         .mhandler.cmd_new = qmp_marshal_input_drive_backup,
     },
 
@@ -1075,8 +1200,11 @@ Arguments:
             (json-string, optional)
 - "sync": what parts of the disk image should be copied to the destination;
   possibilities include "full" for all the disk, "top" for only the sectors
-  allocated in the topmost image, or "none" to only replicate new I/O
-  (MirrorSyncMode).
+  allocated in the topmost image, "none" to only replicate new I/O, or
+  "incremental" for the sectors marked in "bitmap" (MirrorSyncMode).
+- "bitmap": the dirty bitmap to use with sync "incremental".  It is cleared
+            when the backup starts, and its old contents are merged back if
+            the backup fails or is cancelled (json-string, optional)
 - "mode": whether and how QEMU should create a new image
           (NewImageMode, optional, default 'absolute-paths')
 - "speed": the maximum speed, in bytes per second (json-int, optional)
@@ -1094,6 +1222,89 @@ Example:
                                                "sync": "full",
                                                "target": "backup.img" } }
 <- { "return": {} }
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-add",
+        .args_type  = "device:B,name:s,granularity:i?,persistent:b?",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_add,
+    },
+
+SQMP
+block-dirty-bitmap-add
+----------------------
+
+Create a named dirty bitmap that tracks writes to a block device, for use
+with drive-backup sync "incremental".
+
+Arguments:
+
+- "device": the name of the block device (json-string)
+- "name": the name of the dirty bitmap (json-string)
+- "granularity": the bitmap granularity in bytes, a power of two of at
+                 least 512; default is the cluster size of the image
+                 (json-int, optional)
+- "persistent": store the bitmap in the image when it is closed and load
+                it when it is opened again; qcow2 version 3 images only
+                (json-bool, optional, default false)
+
+Example:
+
+-> { "execute": "block-dirty-bitmap-add",
+     "arguments": { "device": "drive0", "name": "nightly",
+                    "persistent": true } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-remove",
+        .args_type  = "device:B,name:s",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_remove,
+    },
+
+SQMP
+block-dirty-bitmap-remove
+-------------------------
+
+Delete a named dirty bitmap.  Bitmaps in use by a backup cannot be removed.
+
+Arguments:
+
+- "device": the name of the block device (json-string)
+- "name": the name of the dirty bitmap (json-string)
+
+Example:
+
+-> { "execute": "block-dirty-bitmap-remove",
+     "arguments": { "device": "drive0", "name": "nightly" } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-clear",
+        .args_type  = "device:B,name:s",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_clear,
+    },
+
+SQMP
+block-dirty-bitmap-clear
+------------------------
+
+Reset a named dirty bitmap, e.g. after a full backup taken outside of QEMU.
+
+Arguments:
+
+- "device": the name of the block device (json-string)
+- "name": the name of the dirty bitmap (json-string)
+
+Example:
+
+-> { "execute": "block-dirty-bitmap-clear",
+     "arguments": { "device": "drive0", "name": "nightly" } }
+<- { "return": {} }
+
 EQMP
 
     {
@@ -1133,7 +1344,8 @@ transaction
 -----------
 
 Atomically operate on one or more block devices.  The only supported operations
-for now are drive-backup, internal and external snapshotting.  A list of
+for now are drive-backup, internal and external snapshotting, and adding and
+clearing dirty bitmaps.  A list of
 dictionaries is accepted, that contains the actions to be performed.
 If there is any failure performing any of the operations, all operations
 for the group are abandoned.
@@ -1160,6 +1372,10 @@ On failure, qemu will try delete the newly created internal snapshot in the
 transaction.  When an I/O error occurs during deletion, the user needs to fix
 it later with qemu-img or other command.
 
+Clearing a dirty bitmap together with a drive-backup of the same device makes
+the backup the base for later incremental backups that use the bitmap.  On
+failure, the bitmap gets its old contents back.
+
 Arguments:
 
 actions array:
@@ -1177,6 +1393,14 @@ actions array:
       When "type" is "blockdev-snapshot-internal-sync":
       - "device": device name to snapshot (json-string)
       - "name": name of the new snapshot (json-string)
+      When "type" is "block-dirty-bitmap-add":
+      - "device": device name to add the bitmap to (json-string)
+      - "name": name of the new bitmap (json-string)
+      - "granularity": granularity in bytes (json-int, optional)
+      - "persistent": store the bitmap in the image (json-bool, optional)
+      When "type" is "block-dirty-bitmap-clear":
+      - "device": device name (json-string)
+      - "name": name of the bitmap to clear (json-string)
 
 Example:
 
@@ -1199,6 +1423,15 @@ Example:
                                          "name": "snapshot0" } } ] } }
 <- { "return": {} }
 
+-> { "execute": "transaction",
+     "arguments": { "actions": [
+         { "type": "block-dirty-bitmap-clear", "data" : { "device": "drive0",
+                                         "name": "bitmap0" } },
+         { "type": "drive-backup", "data" : { "device": "drive0",
+                                         "target": "/backup/full.qcow2",
+                                         "sync": "full" } } ] } }
+<- { "return": {} }
+
 EQMP
 
     {
@@ -1312,7 +1545,7 @@ EQMP
         .args_type  = "sync:s,device:B,target:s,speed:i?,mode:s?,format:s?,"
                       "node-name:s?,replaces:s?,"
                       "on-source-error:s?,on-target-error:s?,"
-                      "granularity:i?,buf-size:i?",
+                      "granularity:i?,buf-size:i?,copy-mode:s?",
         .mhandler.cmd_new = qmp_marshal_input_drive_mirror,
     },
 
@@ -1351,6 +1584,9 @@ Arguments:
   (BlockdevOnError, default 'report')
 - "on-target-error": the action to take on an error on the target
   (BlockdevOnError, default 'report')
+- "copy-mode": "write-blocking" to also write guest writes to the target
+  before they complete once the job is ready, so that the job converges
+  even when the guest keeps writing (MirrorCopyMode, default 'background')
 
 The default value of the granularity is the image cluster size clamped
 between 4096 and 65536, if the image format defines one.  If the format
@@ -1662,7 +1898,7 @@ EQMP
 
     {
         .name       = "block_set_io_throttle",
-        .args_type  = "device:B,bps:l,bps_rd:l,bps_wr:l,iops:l,iops_rd:l,iops_wr:l,bps_max:l?,bps_rd_max:l?,bps_wr_max:l?,iops_max:l?,iops_rd_max:l?,iops_wr_max:l?,iops_size:l?",
+        .args_type  = "device:B,bps:l,bps_rd:l,bps_wr:l,iops:l,iops_rd:l,iops_wr:l,bps_max:l?,bps_rd_max:l?,bps_wr_max:l?,iops_max:l?,iops_rd_max:l?,iops_wr_max:l?,iops_size:l?,bps_max_length:l?,bps_rd_max_length:l?,bps_wr_max_length:l?,iops_max_length:l?,iops_rd_max_length:l?,iops_wr_max_length:l?,group:s?",
         .mhandler.cmd_new = qmp_marshal_input_block_set_io_throttle,
     },
 
@@ -1688,6 +1924,19 @@ Arguments:
 - "iops_rd_max":  read I/O operations max (json-int)
 - "iops_wr_max":  write I/O operations max (json-int)
 - "iops_size":  I/O size in bytes when limiting (json-int)
+- "bps_max_length":  maximum length of the bps_max burst period, in seconds
+                     (json-int, optional)
+- "bps_rd_max_length":  maximum length of the bps_rd_max burst period
+                        (json-int, optional)
+- "bps_wr_max_length":  maximum length of the bps_wr_max burst period
+                        (json-int, optional)
+- "iops_max_length":  maximum length of the iops_max burst period
+                      (json-int, optional)
+- "iops_rd_max_length":  maximum length of the iops_rd_max burst period
+                         (json-int, optional)
+- "iops_wr_max_length":  maximum length of the iops_wr_max burst period
+                         (json-int, optional)
+- "group": throttle group name (json-string, optional)
 
 Example:
 
@@ -1707,6 +1956,68 @@ Example:
                                                "iops_size": 0 } }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "block-latency-histogram-set",
+        .args_type  = "device:B,boundaries:q?,boundaries-read:q?,"
+                      "boundaries-write:q?,boundaries-flush:q?",
+        .mhandler.cmd_new = qmp_marshal_input_block_latency_histogram_set,
+    },
+
+SQMP
+block-latency-histogram-set
+---------------------------
+
+Set up latency histograms for a block device, replacing and resetting the
+current ones.  With N boundaries there are N + 1 bins: bin 0 counts
+latencies below the first boundary, the last bin those of at least the
+last boundary.  Request types without boundaries have their histogram
+removed.
+
+Arguments:
+
+- "device": device name (json-string)
+- "boundaries": bin boundaries in nano-seconds for all request types,
+                strictly ascending (json-array of json-int, optional)
+- "boundaries-read": boundaries for reads (json-array, optional)
+- "boundaries-write": boundaries for writes (json-array, optional)
+- "boundaries-flush": boundaries for flushes (json-array, optional)
+
+Example:
+
+-> { "execute": "block-latency-histogram-set",
+     "arguments": { "device": "virtio0",
+                    "boundaries": [ 100000, 1000000, 10000000 ] } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-stats-intervals-set",
+        .args_type  = "device:B,intervals:q",
+        .mhandler.cmd_new = qmp_marshal_input_block_stats_intervals_set,
+    },
+
+SQMP
+block-stats-intervals-set
+-------------------------
+
+Set the intervals over which query-blockstats reports minimum, maximum and
+average latencies of a block device.
+
+Arguments:
+
+- "device": device name (json-string)
+- "intervals": up to 4 interval lengths in seconds; an empty array
+               disables the timed statistics (json-array of json-int)
+
+Example:
+
+-> { "execute": "block-stats-intervals-set",
+     "arguments": { "device": "virtio0", "intervals": [ 1, 60 ] } }
+<- { "return": {} }
+
 EQMP
 
     {
@@ -1788,7 +2099,7 @@ Example:
 EQMP
     {
         .name       = "qmp_capabilities",
-        .args_type  = "",
+        .args_type  = "enable:q?",
         .params     = "",
         .help       = "enable QMP capabilities",
         .user_print = monitor_user_noop,
@@ -1801,13 +2112,23 @@ qmp_capabilities
 
 Enable QMP capabilities.
 
-Arguments: None.
+Arguments:
+
+- "enable": capabilities to enable, out of those listed in the greeting
+            (json-array of json-string, optional)
+
+The only capability is "oob", offered by monitors started with
+"-mon chardev=...,mode=control,oob=on".  It lets the client send requests
+with "exec-oob" instead of "execute" (see query-qmp-stats).
 
 Example:
 
 -> { "execute": "qmp_capabilities" }
 <- { "return": {} }
 
+-> { "execute": "qmp_capabilities", "arguments": { "enable": [ "oob" ] } }
+<- { "return": {} }
+
 Note: This command must be issued before issuing any other command.
 
 EQMP
@@ -1895,6 +2216,7 @@ EQMP
         .name       = "query-version",
         .args_type  = "",
         .mhandler.cmd_new = qmp_marshal_input_query_version,
+        .flags      = MONITOR_CMD_OOB,
     },
 
 SQMP
@@ -1932,6 +2254,56 @@ EQMP
         .name       = "query-commands",
         .args_type  = "",
         .mhandler.cmd_new = qmp_marshal_input_query_commands,
+        .flags      = MONITOR_CMD_OOB,
+    },
+
+SQMP
+query-qmp-stats
+---------------
+
+Show how much time was spent on each QMP command executed so far, summed
+over all monitors.  The time is measured from reading a request to sending
+its response (for asynchronous commands, to starting them), so it includes
+time the request waited for the main loop.
+
+Return a json-array with one json-object for each command executed at
+least once:
+
+- "name": command name (json-string)
+- "count": number of times the command was executed (json-int)
+- "total-ns": total time in nanoseconds (json-int)
+- "max-ns": longest time in nanoseconds (json-int)
+- "oob": true if the command can run out-of-band (json-bool)
+
+Commands marked "oob" take no arguments.  On a monitor started with
+"-mon chardev=...,mode=control,oob=on" (socket chardevs only), once the
+client enabled the "oob" capability, they can be sent with "exec-oob"
+instead of "execute".  They are then run as soon as they are read, by a
+thread dedicated to that monitor, even while the main loop is busy with
+another command; their responses can therefore overtake those of earlier
+commands, and clients should match them by "id".  Requests sent with
+"execute" are always run in order.
+
+-> { "exec-oob": "query-status", "id": 1 }
+<- { "return": { "status": "running", "singlestep": false, "running": true },
+     "id": 1 }
+
+Example:
+
+-> { "execute": "query-qmp-stats" }
+<- { "return": [
+       { "name": "query-status", "count": 120, "total-ns": 1510000,
+         "max-ns": 48000, "oob": true },
+       { "name": "query-block", "count": 2, "total-ns": 5230000000,
+         "max-ns": 5200000000, "oob": false } ] }
+
+EQMP
+
+    {
+        .name       = "query-qmp-stats",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_qmp_stats,
+        .flags      = MONITOR_CMD_OOB,
     },
 
 SQMP
@@ -1971,6 +2343,72 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_events,
     },
 
+SQMP
+set-event-throttle
+------------------
+
+Rate limit a QMP event: at most one is sent every "rate" milliseconds, and
+of those that arrive in between only the last one is sent, at the end of
+the period.  With "per-source", the limit applies separately to each
+device, port or node named by the event's "device", "id" or "node-name"
+member, so that e.g. a BLOCK_IO_ERROR storm on one disk does not hide
+errors on another.
+
+By default RTC_CHANGE, WATCHDOG, BALLOON_CHANGE and QUORUM_FAILURE are
+limited to one per second, and QUORUM_REPORT_BAD and VSERPORT_CHANGE to
+one per second per node or port.
+
+Arguments:
+
+- "event": event name (json-string)
+- "rate": minimum time between two events in milliseconds, 0 to send every
+          event (json-int)
+- "per-source": limit each source separately (json-bool, optional,
+                default: unchanged)
+
+Example:
+
+-> { "execute": "set-event-throttle",
+     "arguments": { "event": "BLOCK_IO_ERROR", "rate": 1000,
+                    "per-source": true } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "set-event-throttle",
+        .args_type  = "event:s,rate:i,per-source:b?",
+        .mhandler.cmd_new = qmp_marshal_input_set_event_throttle,
+    },
+
+SQMP
+query-event-throttle
+--------------------
+
+List the rate limited QMP events.
+
+Return a json-array with one json-object for each event with a non-zero
+rate:
+
+- "event": event name (json-string)
+- "rate": minimum time between two events in milliseconds (json-int)
+- "per-source": true if each source is limited separately (json-bool)
+
+Example:
+
+-> { "execute": "query-event-throttle" }
+<- { "return": [
+       { "event": "VSERPORT_CHANGE", "rate": 1000, "per-source": true },
+       { "event": "RTC_CHANGE", "rate": 1000, "per-source": false } ] }
+
+EQMP
+
+    {
+        .name       = "query-event-throttle",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_event_throttle,
+    },
+
 SQMP
 query-chardev
 -------------
@@ -2102,6 +2540,12 @@ Each json-object contain the following:
          - "iops_rd_max":  read I/O operations max (json-int)
          - "iops_wr_max":  write I/O operations max (json-int)
          - "iops_size": I/O size when limiting by iops (json-int)
+         - "bps_max_length" ... "iops_wr_max_length": burst lengths in
+             seconds, if longer than one second (json-int, optional)
+         - "throttle_levels": current throttling bucket levels
+             (json-object, optional) with "bps", "bps_rd", "bps_wr",
+             "iops", "iops_rd" and "iops_wr" (json-number)
+         - "group": throttle group name (json-string, optional)
          - "detect_zeroes": detect and optimize zero writing (json-string)
              - Possible values: "off", "on", "unmap"
          - "image": the detail of the image, it is a json-object containing
@@ -2261,6 +2705,34 @@ Each json-object contain the following:
     - "flush_total_time_ns": total time spend on cache flushes in nano-seconds (json-int)
     - "wr_highest_offset": Highest offset of a sector written since the
                            BlockDriverState has been opened (json-int)
+    - "failed_rd_operations": failed read operations (json-int)
+    - "failed_wr_operations": failed write operations (json-int)
+    - "failed_flush_operations": failed cache flush operations (json-int)
+    - "invalid_rd_operations": invalid read operations (json-int)
+    - "invalid_wr_operations": invalid write operations (json-int)
+    - "invalid_flush_operations": invalid cache flush operations (json-int)
+    - "idle_time_ns": time since the last I/O operation completed, in
+                      nano-seconds (json-int, optional)
+    - "timed_stats": A json-array with one json-object per interval set
+                     with block-stats-intervals-set, each with
+                     "interval_length" in seconds, the number of
+                     "rd_operations", "wr_operations" and "flush_operations"
+                     and the "min_", "max_" and "avg_" + "rd_latency_ns",
+                     "wr_latency_ns" and "flush_latency_ns" of the last
+                     complete interval (json-array)
+    - "rd_latency_histogram", "wr_latency_histogram",
+      "flush_latency_histogram": latency histograms set with
+                      block-latency-histogram-set, each with "boundaries"
+                      and "bins" (json-object, optional)
+- "driver-specific": Statistics specific to the image format, present for
+                     qcow2 images (json-object, optional). For qcow2 it has
+                     "type": "qcow2" and "data" containing "l2-cache" and
+                     "refcount-cache" objects, each with:
+    - "size": number of cache entries (json-int)
+    - "entry-size": size of a cache entry in bytes (json-int)
+    - "hits": lookups served from the cache (json-int)
+    - "misses": lookups that had to load the table (json-int)
+    - "evictions": cached tables replaced by another one (json-int)
 - "parent": Contains recursively the statistics of the underlying
             protocol (e.g. the host file for a qcow2 image). If there is
             no underlying protocol, this field is omitted
@@ -2399,6 +2871,83 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_cpus,
     },
 
+SQMP
+query-cpus-fast
+---------------
+
+Show CPU information without interrupting the virtual CPUs.
+
+Unlike query-cpus, the register state of the CPUs is not synchronized, so
+no program counter is reported and "halted" may be stale when using KVM.
+
+Return a json-array. Each CPU is represented by a json-object, which contains:
+
+- "cpu-index": CPU index (json-int)
+- "halted": true if the cpu was last seen halted, false otherwise (json-bool)
+- "thread-id": ID of the underlying host thread (json-int)
+
+Example:
+
+-> { "execute": "query-cpus-fast" }
+<- {
+      "return":[
+         {
+            "cpu-index":0,
+            "halted":false,
+            "thread-id":3134
+         },
+         {
+            "cpu-index":1,
+            "halted":true,
+            "thread-id":3135
+         }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-cpus-fast",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_cpus_fast,
+    },
+
+SQMP
+query-jit
+---------
+
+Show cumulative statistics about the code translated by TCG.
+
+Return a json-object with the following information:
+
+- "translations": translation blocks generated (json-int)
+- "translation-time-ns": time spent generating them (json-int)
+- "guest-insns": guest instructions translated (json-int)
+- "max-tb-insns": most guest instructions in one block (json-int)
+- "guest-bytes": guest code bytes translated (json-int)
+- "host-bytes": host code bytes generated (json-int)
+- "ops": TCG ops produced by the front end (json-int)
+- "ops-optimized": TCG ops left after optimization (json-int)
+- "spills": registers evicted by the register allocator (json-int)
+- "helper-calls": helper calls in the generated code (json-int)
+
+Example:
+
+-> { "execute": "query-jit" }
+<- { "return": { "translations": 10452, "translation-time-ns": 183022187,
+                 "guest-insns": 61870, "max-tb-insns": 512,
+                 "guest-bytes": 192334, "host-bytes": 2219808,
+                 "ops": 723140, "ops-optimized": 505322, "spills": 381,
+                 "helper-calls": 21871 } }
+
+EQMP
+
+    {
+        .name       = "query-jit",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_jit,
+    },
+
 SQMP
 query-iothreads
 ---------------
@@ -2413,6 +2962,21 @@ Return a json-array. Each iothread is represented by a json-object, which contai
 
 - "id": name of iothread (json-str)
 - "thread-id": ID of the underlying host thread (json-int)
+- "stats": event loop statistics, a json-object containing:
+    - "polls": number of aio_poll() calls (json-int)
+    - "wakeups": number of wakeups with events ready (json-int)
+    - "bottom-halves": number of bottom halves run (json-int)
+    - "dispatch": time spent in each pass over bottom halves, fd handlers
+                  and timers (json-object, see below)
+    - "handlers": time spent in each fd handler (json-object, see below)
+
+"dispatch" and "handlers" contain:
+
+- "count": number of calls (json-int)
+- "total-ns": total time in nanoseconds (json-int)
+- "max-ns": longest call in nanoseconds (json-int)
+- "histogram": number of calls that took less than 1us, 10us, 100us, 1ms,
+               10ms, 100ms and longer (json-array of 7 json-int)
 
 Example:
 
@@ -2421,11 +2985,24 @@ Example:
       "return":[
          {
             "id":"iothread0",
-            "thread-id":3134
-         },
-         {
-            "id":"iothread1",
-            "thread-id":3135
+            "thread-id":3134,
+            "stats":{
+               "polls":120311,
+               "wakeups":60210,
+               "bottom-halves":60048,
+               "dispatch":{
+                  "count":120311,
+                  "total-ns":301874112,
+                  "max-ns":2210342,
+                  "histogram":[ 60101, 59820, 366, 23, 1, 0, 0 ]
+               },
+               "handlers":{
+                  "count":60210,
+                  "total-ns":98227310,
+                  "max-ns":2208120,
+                  "histogram":[ 59201, 992, 16, 0, 1, 0, 0 ]
+               }
+            }
          }
       ]
    }
@@ -2438,6 +3015,45 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_iothreads,
     },
 
+SQMP
+query-main-loop-stats
+---------------------
+
+Return event loop statistics for the QEMU main loop.  The returned
+json-object has the same members as the "stats" member of query-iothreads.
+The main loop waits for events through glib, so "polls" only counts nested
+event loops.
+
+Example:
+
+-> { "execute": "query-main-loop-stats" }
+<- { "return":{
+        "polls":12,
+        "wakeups":2061,
+        "bottom-halves":1480,
+        "dispatch":{
+           "count":2073,
+           "total-ns":15734421,
+           "max-ns":903117,
+           "histogram":[ 1210, 802, 58, 3, 0, 0, 0 ]
+        },
+        "handlers":{
+           "count":590,
+           "total-ns":4120991,
+           "max-ns":410092,
+           "histogram":[ 301, 277, 11, 1, 0, 0, 0 ]
+        }
+     }
+   }
+
+EQMP
+
+    {
+        .name       = "query-main-loop-stats",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_main_loop_stats,
+    },
+
 SQMP
 query-pci
 ---------
@@ -2717,6 +3333,7 @@ EQMP
         .name       = "query-status",
         .args_type  = "",
         .mhandler.cmd_new = qmp_marshal_input_query_status,
+        .flags      = MONITOR_CMD_OOB,
     },
 
 SQMP
@@ -2925,6 +3542,7 @@ EQMP
         .name       = "query-name",
         .args_type  = "",
         .mhandler.cmd_new = qmp_marshal_input_query_name,
+        .flags      = MONITOR_CMD_OOB,
     },
 
 SQMP
@@ -2948,6 +3566,7 @@ EQMP
         .name       = "query-uuid",
         .args_type  = "",
         .mhandler.cmd_new = qmp_marshal_input_query_uuid,
+        .flags      = MONITOR_CMD_OOB,
     },
 
 SQMP
@@ -3012,7 +3631,8 @@ block migration status.
 The main json-object contains the following:
 
 - "status": migration status (json-string)
-     - Possible values: "setup", "active", "completed", "failed", "cancelled"
+     - Possible values: "setup", "active", "postcopy-active", "completed",
+       "failed", "cancelled"
 - "total-time": total amount of ms since migration started.  If
                 migration has ended, it returns the total migration
                 time (json-int)
@@ -3043,11 +3663,16 @@ The main json-object contains the following:
             but this way upper levels don't need to care about page
             size (json-int)
          - "dirty-sync-count": times that dirty ram was synchronized (json-int)
+         - "postcopy-requests": only present in postcopy mode, number of
+            page requests received from the destination (json-int)
 - "disk": only present if "status" is "active" and it is a block migration,
   it is a json-object with the following disk information:
          - "transferred": amount transferred in bytes (json-int)
          - "remaining": amount remaining to transfer in bytes json-int)
          - "total": total disk size in bytes (json-int)
+- "disk-devices": only present along with "disk", a json-array of objects
+  with "device", "transferred" (bytes of that device covered by the bulk
+  copy so far) and "total" (its size in bytes)
 - "xbzrle-cache": only present if XBZRLE is active.
   It is a json-object with the following XBZRLE information:
          - "cache-size": XBZRLE cache size in bytes
@@ -3059,6 +3684,16 @@ The main json-object contains the following:
            that the XBZRLE encoding was bigger than just sent the
            whole page, and then we sent the whole page instead (as as
            normal page).
+         - "blocks": per RAM block statistics, a json-array of objects
+           with "id", "cache-lookups", "cache-miss", "cache-miss-rate",
+           "overflow" and "overflow-rate" (optional)
+- "cpu-throttle": only present if "status" is "active" and auto-converge
+  is throttling some vCPUs, a json-array of objects with "cpu-index" and
+  "percentage", the percentage of its time that vCPU is kept out of the
+  guest (json-int)
+- "device-times": only present if "status" is "completed", a json-array
+  of objects with "id" and "instance-id" naming a device section, and
+  "time", the microseconds it took to save (json-int)
 
 Examples:
 
@@ -3164,7 +3799,17 @@ Examples:
             "pages":2444343,
             "cache-miss":2244,
             "cache-miss-rate":0.123,
-            "overflow":34434
+            "overflow":34434,
+            "blocks":[
+               {
+                  "id":"pc.ram",
+                  "cache-lookups":2480000,
+                  "cache-miss":2244,
+                  "cache-miss-rate":0.0009,
+                  "overflow":34434,
+                  "overflow-rate":0.0139
+               }
+            ]
          }
       }
    }
@@ -3224,6 +3869,130 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_query_migrate_capabilities,
     },
 
+SQMP
+migrate-set-parameters
+----------------------
+
+Set migration parameters
+
+- "compress-level": compression level, 0-9 (json-int)
+- "compress-threads": compression thread count, 1-255 (json-int)
+- "decompress-threads": decompression thread count, 1-255 (json-int)
+- "multifd-channels": number of multifd connections, 1-255 (json-int)
+
+Arguments:
+
+Example:
+
+-> { "execute": "migrate-set-parameters" , "arguments":
+      { "compress-level": 1 } }
+
+EQMP
+
+    {
+        .name       = "migrate-set-parameters",
+        .args_type  =
+            "compress-level:i?,compress-threads:i?,decompress-threads:i?,"
+            "multifd-channels:i?",
+        .mhandler.cmd_new = qmp_marshal_input_migrate_set_parameters,
+    },
+
+SQMP
+query-migrate-parameters
+------------------------
+
+Query current migration parameters
+
+- "parameters": migration parameters value
+         - "compress-level" : compression level value (json-int)
+         - "compress-threads" : compression thread count value (json-int)
+         - "decompress-threads" : decompression thread count value (json-int)
+         - "multifd-channels" : number of multifd connections (json-int)
+
+Arguments:
+
+Example:
+
+-> { "execute": "query-migrate-parameters" }
+<- {
+      "return": {
+         "multifd-channels": 2,
+         "decompress-threads": 2,
+         "compress-threads": 8,
+         "compress-level": 1
+      }
+   }
+
+EQMP
+
+    {
+        .name       = "query-migrate-parameters",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_migrate_parameters,
+    },
+
+SQMP
+calc-dirty-rate
+---------------
+
+Start measuring the guest's RAM dirty rate, without migrating.  Returns at
+once; the results are available from query-dirty-rate.
+
+Arguments:
+
+- "calc-time": length of the measurement in seconds, 1-60 (json-int)
+
+Example:
+
+-> { "execute": "calc-dirty-rate", "arguments": { "calc-time": 1 } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "calc-dirty-rate",
+        .args_type  = "calc-time:i",
+        .mhandler.cmd_new = qmp_marshal_input_calc_dirty_rate,
+    },
+
+SQMP
+query-dirty-rate
+----------------
+
+Query the dirty rate measurement.
+
+- "status": "unstarted", "measuring" or "measured" (json-string)
+- "start-time": when the measurement started, in ms (json-int, optional)
+- "calc-time": length of the measurement in seconds (json-int)
+- "dirty-rate": pages dirtied per second (json-int, optional)
+- "blocks": per RAM block results (json-array, optional), of objects with
+         - "id": name of the RAM block (json-string)
+         - "dirty-pages": pages dirtied during the measurement (json-int)
+         - "dirty-rate": pages dirtied per second (json-int)
+
+Example:
+
+-> { "execute": "query-dirty-rate" }
+<- { "return": {
+        "status": "measured",
+        "start-time": 1427366245000,
+        "calc-time": 1,
+        "dirty-rate": 2580,
+        "blocks": [
+           { "id": "pc.ram", "dirty-pages": 2580, "dirty-rate": 2580 },
+           { "id": "vga.vram", "dirty-pages": 0, "dirty-rate": 0 }
+        ]
+     }
+   }
+
+EQMP
+
+    {
+        .name       = "query-dirty-rate",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_dirty_rate,
+    },
+
 SQMP
 query-balloon
 -------------
@@ -3527,6 +4296,95 @@ Example:
       ]
    }
 
+EQMP
+
+    {
+        .name       = "query-net-queues",
+        .args_type  = "name:s?",
+        .mhandler.cmd_new = qmp_marshal_input_query_net_queues,
+    },
+
+SQMP
+query-net-queues
+----------------
+
+Show receive queue statistics.
+
+Returns a json-array with the queue of every net client (or of the given
+one), returning an error if the given net client doesn't exist.
+
+Each array entry contains the following:
+
+- "name": net client name (json-string)
+- "length": packets waiting in the queue now (json-int)
+- "queued": packets queued since the client was created (json-int)
+- "dropped": packets dropped because the queue was full or discarded
+  without delivery (json-int)
+
+Example:
+
+-> { "execute": "query-net-queues", "arguments": { "name": "net0" } }
+<- { "return": [
+        {
+            "name": "net0",
+            "length": 0,
+            "queued": 1532,
+            "dropped": 12
+        }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-vhost-net",
+        .args_type  = "name:s?",
+        .mhandler.cmd_new = qmp_marshal_input_query_vhost_net,
+    },
+
+SQMP
+query-vhost-net
+---------------
+
+Show vhost-net settings and notification counters.
+
+Returns a json-array with one entry per queue pair of every tap net client
+that uses vhost-net (or of the given one), returning an error if the given
+net client doesn't exist or doesn't use vhost-net.
+
+Each array entry contains the following:
+
+- "name": net client name (json-string)
+- "queue": queue pair index (json-int)
+- "started": whether the in-kernel worker is running the queues (json-bool)
+- "poll-us": busy polling timeout in microseconds, 0 if disabled (json-int)
+- "zerocopy": whether the host transmits with zero copy (json-bool)
+- "rx-kicks": guest notifications of new receive buffers (json-int)
+- "rx-calls": interrupts signalled for the receive queue (json-int)
+- "tx-kicks": guest notifications of packets to transmit (json-int)
+- "tx-calls": interrupts signalled for the transmit queue (json-int)
+
+The counters restart at zero whenever the queues are started; the calls
+are only counted when KVM irqfds deliver the interrupts.
+
+Example:
+
+-> { "execute": "query-vhost-net", "arguments": { "name": "net0" } }
+<- { "return": [
+        {
+            "name": "net0",
+            "queue": 0,
+            "started": true,
+            "poll-us": 50,
+            "zerocopy": false,
+            "rx-kicks": 312,
+            "rx-calls": 20480,
+            "tx-kicks": 1877,
+            "tx-calls": 96
+        }
+      ]
+   }
+
 EQMP
 
     {
@@ -3681,6 +4539,37 @@ Example (1):
      ]
    }
 
+EQMP
+
+    {
+        .name       = "memdev-save",
+        .args_type  = "id:s,filename:F",
+        .mhandler.cmd_new = qmp_marshal_input_memdev_save,
+    },
+
+SQMP
+memdev-save
+-----------
+
+Write the contents of a memory backend to a raw, page-aligned image file.
+Zero pages are left as holes.  The VM must be stopped.
+
+Arguments:
+
+- "id": the memory backend id (json-string)
+- "filename": file path (json-string)
+
+The image can be mapped copy-on-write by other guests with
+-object memory-backend-file,mem-path=<filename>,share=off.  Together with
+the "skip-memdev-ram" migration capability, this gives a snapshot that
+many guests can start from without copying their RAM.
+
+Example:
+
+-> { "execute": "memdev-save",
+     "arguments": { "id": "mem0", "filename": "/var/lib/vm/mem0.img" } }
+<- { "return": {} }
+
 EQMP
 
     {
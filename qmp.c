@@ -155,6 +155,10 @@ void qmp_cont(Error **errp)
     if (runstate_needs_reset()) {
         error_setg(errp, "Resetting the Virtual Machine is required");
         return;
+    } else if (dump_in_progress()) {
+        error_setg(errp, "The guest memory is being dumped, wait for "
+                   "the DUMP_COMPLETED event");
+        return;
     } else if (runstate_check(RUN_STATE_SUSPENDED)) {
         return;
     }
@@ -448,6 +448,37 @@ Object *object_dynamic_cast(Object *obj, const char *typename)
     return NULL;
 }
 
+#ifdef CONFIG_QOM_CAST_DEBUG
+/* The cast caches are keyed by the typename pointer, and only ever hold
+ * typenames that are known to be good casts for the class.  They are
+ * read and updated without a lock by whatever thread does the cast (vCPU
+ * threads in MMIO handlers, for example), so a race can at worst drop an
+ * entry or store it twice; atomic accesses keep each entry whole.
+ */
+static bool object_cast_cache_lookup(const char **cache, const char *typename)
+{
+    int i;
+
+    for (i = 0; i < OBJECT_CLASS_CAST_CACHE; i++) {
+        if (atomic_read(&cache[i]) == typename) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Insert @typename as the most recent entry, evicting the oldest one */
+static void object_cast_cache_insert(const char **cache, const char *typename)
+{
+    int i;
+
+    for (i = 1; i < OBJECT_CLASS_CAST_CACHE; i++) {
+        atomic_set(&cache[i - 1], atomic_read(&cache[i]));
+    }
+    atomic_set(&cache[i - 1], typename);
+}
+#endif
+
 Object *object_dynamic_cast_assert(Object *obj, const char *typename,
                                    const char *file, int line, const char *func)
 {
@@ -455,13 +486,11 @@ Object *object_dynamic_cast_assert(Object *obj, const char *typename,
                                      typename, file, line, func);
 
 #ifdef CONFIG_QOM_CAST_DEBUG
-    int i;
     Object *inst;
 
-    for (i = 0; obj && i < OBJECT_CLASS_CAST_CACHE; i++) {
-        if (obj->class->object_cast_cache[i] == typename) {
-            goto out;
-        }
+    if (obj && object_cast_cache_lookup(obj->class->object_cast_cache,
+                                        typename)) {
+        goto out;
     }
 
     inst = object_dynamic_cast(obj, typename);
@@ -475,11 +504,7 @@ Object *object_dynamic_cast_assert(Object *obj, const char *typename,
     assert(obj == inst);
 
     if (obj && obj == inst) {
-        for (i = 1; i < OBJECT_CLASS_CAST_CACHE; i++) {
-            obj->class->object_cast_cache[i - 1] =
-                    obj->class->object_cast_cache[i];
-        }
-        obj->class->object_cast_cache[i - 1] = typename;
+        object_cast_cache_insert(obj->class->object_cast_cache, typename);
     }
 
 out:
@@ -546,13 +571,10 @@ ObjectClass *object_class_dynamic_cast_assert(ObjectClass *class,
                                            typename, file, line, func);
 
 #ifdef CONFIG_QOM_CAST_DEBUG
-    int i;
-
-    for (i = 0; class && i < OBJECT_CLASS_CAST_CACHE; i++) {
-        if (class->class_cast_cache[i] == typename) {
-            ret = class;
-            goto out;
-        }
+    if (class && object_cast_cache_lookup(class->class_cast_cache,
+                                          typename)) {
+        ret = class;
+        goto out;
     }
 #else
     if (!class || !class->interfaces) {
@@ -569,10 +591,7 @@ ObjectClass *object_class_dynamic_cast_assert(ObjectClass *class,
 
 #ifdef CONFIG_QOM_CAST_DEBUG
     if (class && ret == class) {
-        for (i = 1; i < OBJECT_CLASS_CAST_CACHE; i++) {
-            class->class_cast_cache[i - 1] = class->class_cast_cache[i];
-        }
-        class->class_cast_cache[i - 1] = typename;
+        object_cast_cache_insert(class->class_cast_cache, typename);
     }
 out:
 #endif
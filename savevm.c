@@ -33,6 +33,7 @@
 #include "qemu/timer.h"
 #include "audio/audio.h"
 #include "migration/migration.h"
+#include "migration/postcopy-ram.h"
 #include "qemu/sockets.h"
 #include "qemu/queue.h"
 #include "sysemu/cpus.h"
@@ -42,6 +43,8 @@
 #include "qemu/iov.h"
 #include "block/snapshot.h"
 #include "block/qapi.h"
+#include "block/block.h"
+#include "qemu/error-report.h"
 
 
 #ifndef ETH_P_RARP
@@ -115,26 +118,81 @@ void qemu_announce_self(void)
 /***********************************************************/
 /* savevm/loadvm support */
 
+/* The VM state is written sequentially, but QEMUFile flushes it in pieces
+ * of at most IO_BUF_SIZE or a few dozen iovecs that start at arbitrary
+ * offsets, so each of them costs a read-modify-write of its first and last
+ * sector in the image.  Stage it instead and write it out in large chunks
+ * at aligned offsets.
+ */
+#define VMSTATE_CHUNK_SIZE (8 * 1024 * 1024)
+
+typedef struct BlockVMStateWriter {
+    BlockDriverState *bs;
+    uint8_t *buf;
+    int64_t buf_pos;            /* VM state offset of buf[0] */
+    size_t buf_len;
+} BlockVMStateWriter;
+
+static int block_vmstate_flush(BlockVMStateWriter *w)
+{
+    int ret = 0;
+
+    if (w->buf_len) {
+        ret = bdrv_save_vmstate(w->bs, w->buf, w->buf_pos, w->buf_len);
+    }
+    w->buf_pos += w->buf_len;
+    w->buf_len = 0;
+    return ret < 0 ? ret : 0;
+}
+
 static ssize_t block_writev_buffer(void *opaque, struct iovec *iov, int iovcnt,
                                    int64_t pos)
 {
-    int ret;
-    QEMUIOVector qiov;
+    BlockVMStateWriter *w = opaque;
+    ssize_t done = 0;
+    int i, ret;
 
-    qemu_iovec_init_external(&qiov, iov, iovcnt);
-    ret = bdrv_writev_vmstate(opaque, &qiov, pos);
-    if (ret < 0) {
-        return ret;
+    if (pos != w->buf_pos + w->buf_len) {
+        ret = block_vmstate_flush(w);
+        if (ret < 0) {
+            return ret;
+        }
+        w->buf_pos = pos;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        const uint8_t *base = iov[i].iov_base;
+        size_t off = 0;
+
+        while (off < iov[i].iov_len) {
+            size_t n = MIN(iov[i].iov_len - off,
+                           VMSTATE_CHUNK_SIZE - w->buf_len);
+
+            memcpy(w->buf + w->buf_len, base + off, n);
+            w->buf_len += n;
+            off += n;
+            if (w->buf_len == VMSTATE_CHUNK_SIZE) {
+                ret = block_vmstate_flush(w);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+        }
+        done += iov[i].iov_len;
     }
 
-    return qiov.size;
+    return done;
 }
 
 static int block_put_buffer(void *opaque, const uint8_t *buf,
                            int64_t pos, int size)
 {
-    bdrv_save_vmstate(opaque, buf, pos, size);
-    return size;
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return block_writev_buffer(opaque, &iov, 1, pos);
 }
 
 static int block_get_buffer(void *opaque, uint8_t *buf, int64_t pos, int size)
@@ -147,6 +205,19 @@ static int bdrv_fclose(void *opaque)
     return bdrv_flush(opaque);
 }
 
+static int block_vmstate_fclose(void *opaque)
+{
+    BlockVMStateWriter *w = opaque;
+    int ret, ret2;
+
+    ret = block_vmstate_flush(w);
+    ret2 = bdrv_flush(w->bs);
+    qemu_vfree(w->buf);
+    g_free(w);
+
+    return ret < 0 ? ret : ret2;
+}
+
 static const QEMUFileOps bdrv_read_ops = {
     .get_buffer = block_get_buffer,
     .close =      bdrv_fclose
@@ -155,13 +226,17 @@ static const QEMUFileOps bdrv_read_ops = {
 static const QEMUFileOps bdrv_write_ops = {
     .put_buffer     = block_put_buffer,
     .writev_buffer  = block_writev_buffer,
-    .close          = bdrv_fclose
+    .close          = block_vmstate_fclose
 };
 
 static QEMUFile *qemu_fopen_bdrv(BlockDriverState *bs, int is_writable)
 {
     if (is_writable) {
-        return qemu_fopen_ops(bs, &bdrv_write_ops);
+        BlockVMStateWriter *w = g_new0(BlockVMStateWriter, 1);
+
+        w->bs = bs;
+        w->buf = qemu_blockalign(bs, VMSTATE_CHUNK_SIZE);
+        return qemu_fopen_ops(w, &bdrv_write_ops);
     }
     return qemu_fopen_ops(bs, &bdrv_read_ops);
 }
@@ -233,6 +308,7 @@ typedef struct SaveStateEntry {
     void *opaque;
     CompatEntry *compat;
     int is_ram;
+    int64_t save_time;  /* us taken by the last full save of the section */
 } SaveStateEntry;
 
 
@@ -644,13 +720,21 @@ void qemu_savevm_state_begin(QEMUFile *f,
     }
 }
 
+static bool savevm_section_can_postcopy(SaveStateEntry *se)
+{
+    return se->ops->can_postcopy && se->ops->can_postcopy(se->opaque);
+}
+
 /*
  * this function has three return values:
  *   negative: there was one error, and we have -errno.
  *   0 : We haven't finished, caller have to go again
  *   1 : We have finished, we can go to complete phase
+ *
+ * In @postcopy mode only the sections that can postcopy are iterated, the
+ * others have already been completed.
  */
-int qemu_savevm_state_iterate(QEMUFile *f)
+int qemu_savevm_state_iterate(QEMUFile *f, bool postcopy)
 {
     SaveStateEntry *se;
     int ret = 1;
@@ -665,6 +749,9 @@ int qemu_savevm_state_iterate(QEMUFile *f)
                 continue;
             }
         }
+        if (postcopy && !savevm_section_can_postcopy(se)) {
+            continue;
+        }
         if (qemu_file_rate_limit(f)) {
             return 0;
         }
@@ -690,15 +777,15 @@ int qemu_savevm_state_iterate(QEMUFile *f)
     return ret;
 }
 
-void qemu_savevm_state_complete(QEMUFile *f)
+/*
+ * Complete the live sections.  With @postcopy, the sections that can
+ * postcopy are skipped, see qemu_savevm_state_postcopy_complete().
+ */
+static int savevm_state_complete_live(QEMUFile *f, bool postcopy)
 {
     SaveStateEntry *se;
     int ret;
 
-    trace_savevm_state_complete();
-
-    cpu_synchronize_all_states();
-
     QTAILQ_FOREACH(se, &savevm_handlers, entry) {
         if (!se->ops || !se->ops->save_live_complete) {
             continue;
@@ -708,6 +795,9 @@ void qemu_savevm_state_complete(QEMUFile *f)
                 continue;
             }
         }
+        if (postcopy && savevm_section_can_postcopy(se)) {
+            continue;
+        }
         trace_savevm_section_start(se->idstr, se->section_id);
         /* Section type */
         qemu_put_byte(f, QEMU_VM_SECTION_END);
@@ -717,11 +807,18 @@ void qemu_savevm_state_complete(QEMUFile *f)
         trace_savevm_section_end(se->idstr, se->section_id);
         if (ret < 0) {
             qemu_file_set_error(f, ret);
-            return;
+            return ret;
         }
     }
+    return 0;
+}
+
+static void savevm_state_complete_devices(QEMUFile *f)
+{
+    SaveStateEntry *se;
 
     QTAILQ_FOREACH(se, &savevm_handlers, entry) {
+        int64_t start;
         int len;
 
         if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
@@ -740,15 +837,188 @@ void qemu_savevm_state_complete(QEMUFile *f)
         qemu_put_be32(f, se->instance_id);
         qemu_put_be32(f, se->version_id);
 
+        start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         vmstate_save(f, se);
+        se->save_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start;
         trace_savevm_section_end(se->idstr, se->section_id);
+        trace_savevm_section_time(se->idstr, se->instance_id, se->save_time);
     }
+}
+
+/* How long each device took to save, in the last migration */
+DeviceStateTimeList *qemu_savevm_device_times(void)
+{
+    DeviceStateTimeList *head = NULL, **tail = &head;
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_handlers, entry) {
+        DeviceStateTimeList *entry;
+
+        if ((!se->ops || !se->ops->save_state) && !se->vmsd) {
+            continue;
+        }
+
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->id = g_strdup(se->idstr);
+        entry->value->instance_id = se->instance_id;
+        entry->value->time = se->save_time;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
+
+void qemu_savevm_state_complete(QEMUFile *f)
+{
+    trace_savevm_state_complete();
+
+    cpu_synchronize_all_states();
+
+    if (savevm_state_complete_live(f, false) < 0) {
+        return;
+    }
+    savevm_state_complete_devices(f);
 
     qemu_put_byte(f, QEMU_VM_EOF);
     qemu_fflush(f);
 }
 
-uint64_t qemu_savevm_state_pending(QEMUFile *f, uint64_t max_size)
+static void qemu_savevm_send_command(QEMUFile *f, enum qemu_vm_cmd command,
+                                     uint16_t len, uint8_t *data)
+{
+    trace_savevm_send_command(command, len);
+    qemu_put_byte(f, QEMU_VM_COMMAND);
+    qemu_put_be16(f, (uint16_t)command);
+    qemu_put_be16(f, len);
+    if (len) {
+        qemu_put_buffer(f, data, len);
+    }
+}
+
+/* Tell the destination we may switch to postcopy and want a return path */
+void qemu_savevm_send_postcopy_advise(QEMUFile *f)
+{
+    uint64_t page_size = cpu_to_be64(TARGET_PAGE_SIZE);
+
+    qemu_savevm_send_command(f, MIG_CMD_POSTCOPY_ADVISE, sizeof(page_size),
+                             (uint8_t *)&page_size);
+}
+
+/*
+ * Send a list of page ranges of the RAMBlock @name that the destination
+ * must drop; offsets and lengths are in bytes within the block.
+ */
+void qemu_savevm_send_postcopy_ram_discard(QEMUFile *f, const char *name,
+                                           uint16_t len, uint64_t *start_list,
+                                           uint64_t *length_list)
+{
+    uint8_t buf[1 + 255 + MAX_DISCARDS_PER_COMMAND * 16];
+    size_t name_len = strlen(name);
+    size_t offset;
+    int i;
+
+    assert(name_len < 256 && len <= MAX_DISCARDS_PER_COMMAND);
+    buf[0] = name_len;
+    memcpy(buf + 1, name, name_len);
+    offset = 1 + name_len;
+
+    for (i = 0; i < len; i++) {
+        stq_be_p(buf + offset, start_list[i]);
+        stq_be_p(buf + offset + 8, length_list[i]);
+        offset += 16;
+    }
+
+    qemu_savevm_send_command(f, MIG_CMD_POSTCOPY_RAM_DISCARD, offset, buf);
+}
+
+/*
+ * Switch to postcopy: send the device state, bracketed by the commands
+ * that make the destination start serving page faults and then run the
+ * guest.  Everything is sent as a single package because loading devices
+ * can touch guest memory, and the pages it needs can only be read from the
+ * stream once the whole device state is off it.
+ */
+int qemu_savevm_state_postcopy_package(QEMUFile *f)
+{
+    const QEMUSizedBuffer *qsb;
+    QEMUFile *fb;
+    uint8_t *buf;
+    uint32_t length;
+    int ret;
+
+    trace_savevm_state_complete();
+
+    cpu_synchronize_all_states();
+
+    /* Non-postcopiable live sections must be done before the guest runs */
+    ret = savevm_state_complete_live(f, true);
+    if (ret < 0) {
+        return ret;
+    }
+
+    fb = qemu_bufopen("w", NULL);
+    if (!fb) {
+        return -ENOMEM;
+    }
+
+    qemu_savevm_send_command(fb, MIG_CMD_POSTCOPY_LISTEN, 0, NULL);
+    savevm_state_complete_devices(fb);
+    qemu_savevm_send_command(fb, MIG_CMD_POSTCOPY_RUN, 0, NULL);
+    qemu_put_byte(fb, QEMU_VM_EOF);
+    qemu_fflush(fb);
+
+    qsb = qemu_buf_get(fb);
+    length = qsb_get_length(qsb);
+    buf = g_malloc(length);
+    qsb_get_buffer(qsb, 0, length, buf);
+    qemu_fclose(fb);
+
+    qemu_put_byte(f, QEMU_VM_COMMAND);
+    qemu_put_be16(f, MIG_CMD_PACKAGED);
+    qemu_put_be16(f, sizeof(length));
+    qemu_put_be32(f, length);
+    qemu_put_buffer(f, buf, length);
+    qemu_fflush(f);
+    g_free(buf);
+
+    return qemu_file_get_error(f);
+}
+
+/* Complete the sections that kept going after the switch to postcopy */
+void qemu_savevm_state_postcopy_complete(QEMUFile *f)
+{
+    SaveStateEntry *se;
+    int ret;
+
+    QTAILQ_FOREACH(se, &savevm_handlers, entry) {
+        if (!se->ops || !se->ops->save_live_complete ||
+            !savevm_section_can_postcopy(se)) {
+            continue;
+        }
+        if (se->ops->is_active && !se->ops->is_active(se->opaque)) {
+            continue;
+        }
+        trace_savevm_section_start(se->idstr, se->section_id);
+        qemu_put_byte(f, QEMU_VM_SECTION_END);
+        qemu_put_be32(f, se->section_id);
+
+        ret = se->ops->save_live_complete(f, se->opaque);
+        trace_savevm_section_end(se->idstr, se->section_id);
+        if (ret < 0) {
+            qemu_file_set_error(f, ret);
+            return;
+        }
+    }
+
+    qemu_put_byte(f, QEMU_VM_EOF);
+    qemu_fflush(f);
+}
+
+/* In @postcopy mode only the sections that can postcopy are counted */
+uint64_t qemu_savevm_state_pending(QEMUFile *f, uint64_t max_size,
+                                   bool postcopy)
 {
     SaveStateEntry *se;
     uint64_t ret = 0;
@@ -762,6 +1032,9 @@ uint64_t qemu_savevm_state_pending(QEMUFile *f, uint64_t max_size)
                 continue;
             }
         }
+        if (postcopy && !savevm_section_can_postcopy(se)) {
+            continue;
+        }
         ret += se->ops->save_live_pending(f, se->opaque, max_size);
     }
     return ret;
@@ -779,9 +1052,10 @@ void qemu_savevm_state_cancel(void)
     }
 }
 
+static int qemu_savevm_state_finish(QEMUFile *f);
+
 static int qemu_savevm_state(QEMUFile *f)
 {
-    int ret;
     MigrationParams params = {
         .blk = 0,
         .shared = 0
@@ -795,8 +1069,18 @@ static int qemu_savevm_state(QEMUFile *f)
     qemu_savevm_state_begin(f, &params);
     qemu_mutex_lock_iothread();
 
+    return qemu_savevm_state_finish(f);
+}
+
+/* Write the VM state, the sections begun with qemu_savevm_state_begin()
+ * included, with the VM stopped.
+ */
+static int qemu_savevm_state_finish(QEMUFile *f)
+{
+    int ret;
+
     while (qemu_file_get_error(f) == 0) {
-        if (qemu_savevm_state_iterate(f) > 0) {
+        if (qemu_savevm_state_iterate(f, false) > 0) {
             break;
         }
     }
@@ -812,6 +1096,61 @@ static int qemu_savevm_state(QEMUFile *f)
     return ret;
 }
 
+#define SAVEVM_LIVE_MAX_ROUNDS 30
+
+/* Start saving the VM state while the guest keeps running, the way live
+ * migration does: RAM is written out and pages dirtied in the meantime are
+ * written again, until the remainder could be written within the maximum
+ * migration downtime or the guest keeps dirtying memory faster than it can
+ * be saved.  The caller then stops the VM and calls
+ * qemu_savevm_state_finish(), so the snapshot is the state at that point.
+ */
+static int qemu_savevm_state_precopy(QEMUFile *f)
+{
+    MigrationParams params = {
+        .blk = 0,
+        .shared = 0
+    };
+    uint64_t pending, max_size = 0;
+    int64_t start_time, start_pos, elapsed;
+    int rounds;
+
+    if (qemu_savevm_state_blocked(NULL)) {
+        return -EINVAL;
+    }
+
+    qemu_mutex_unlock_iothread();
+    qemu_savevm_state_begin(f, &params);
+    qemu_mutex_lock_iothread();
+
+    for (rounds = 0; rounds < SAVEVM_LIVE_MAX_ROUNDS; rounds++) {
+        if (qemu_file_get_error(f)) {
+            break;
+        }
+        pending = qemu_savevm_state_pending(f, max_size, false);
+        trace_savevm_state_precopy(rounds, pending, max_size);
+        if (!pending || pending < max_size) {
+            break;
+        }
+
+        start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        start_pos = qemu_ftell(f);
+        qemu_savevm_state_iterate(f, false);
+        qemu_fflush(f);
+        elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
+        if (elapsed > 0) {
+            max_size = (double)(qemu_ftell(f) - start_pos) / elapsed *
+                       migrate_max_downtime();
+        }
+
+        /* let the vCPUs in between iterations */
+        qemu_mutex_unlock_iothread();
+        qemu_mutex_lock_iothread();
+    }
+
+    return qemu_file_get_error(f);
+}
+
 static int qemu_save_device_state(QEMUFile *f)
 {
     SaveStateEntry *se;
@@ -878,33 +1217,303 @@ typedef struct LoadStateEntry {
     int version_id;
 } LoadStateEntry;
 
-int qemu_loadvm_state(QEMUFile *f)
+/* Sections seen so far; outlives qemu_loadvm_state() in postcopy */
+static QLIST_HEAD(, LoadStateEntry) loadvm_handlers =
+    QLIST_HEAD_INITIALIZER(loadvm_handlers);
+
+/* Returned by qemu_loadvm_state_main() when the rest of the stream is
+ * handed over to the postcopy listen thread */
+#define LOADVM_QUIT     1
+
+static int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis);
+
+static void loadvm_free_handlers(void)
 {
-    QLIST_HEAD(, LoadStateEntry) loadvm_handlers =
-        QLIST_HEAD_INITIALIZER(loadvm_handlers);
     LoadStateEntry *le, *new_le;
-    uint8_t section_type;
-    unsigned int v;
+
+    QLIST_FOREACH_SAFE(le, &loadvm_handlers, entry, new_le) {
+        QLIST_REMOVE(le, entry);
+        g_free(le);
+    }
+}
+
+/* The source may switch to postcopy: check we can, and open a return path */
+static int loadvm_postcopy_handle_advise(MigrationIncomingState *mis,
+                                         uint64_t remote_page_size)
+{
+    if (mis->postcopy_state != POSTCOPY_INCOMING_NONE) {
+        error_report("CMD_POSTCOPY_ADVISE in wrong postcopy state (%d)",
+                     mis->postcopy_state);
+        return -1;
+    }
+
+    if (!postcopy_ram_supported_by_host()) {
+        return -1;
+    }
+
+    if (remote_page_size != TARGET_PAGE_SIZE ||
+        getpagesize() != TARGET_PAGE_SIZE) {
+        error_report("Postcopy needs matching host and target page sizes "
+                     "(source %" PRIu64 ", target %d, host %d)",
+                     remote_page_size, TARGET_PAGE_SIZE, getpagesize());
+        return -1;
+    }
+
+    mis->to_src_file = qemu_file_get_return_path(mis->from_src_file);
+    if (!mis->to_src_file) {
+        error_report("Postcopy needs a migration channel with a return path");
+        return -1;
+    }
+
+    mis->postcopy_state = POSTCOPY_INCOMING_ADVISE;
+    return 0;
+}
+
+static int loadvm_postcopy_ram_handle_discard(MigrationIncomingState *mis,
+                                              QEMUFile *f, uint16_t len)
+{
+    char ramid[256];
+    uint8_t id_len;
     int ret;
 
-    if (qemu_savevm_state_blocked(NULL)) {
+    if (mis->postcopy_state != POSTCOPY_INCOMING_ADVISE &&
+        mis->postcopy_state != POSTCOPY_INCOMING_DISCARD) {
+        error_report("CMD_POSTCOPY_RAM_DISCARD in wrong postcopy state (%d)",
+                     mis->postcopy_state);
+        return -1;
+    }
+    mis->postcopy_state = POSTCOPY_INCOMING_DISCARD;
+
+    if (len < 1) {
+        error_report("CMD_POSTCOPY_RAM_DISCARD invalid length (%d)", len);
         return -EINVAL;
     }
+    id_len = qemu_get_byte(f);
+    len--;
+    if (id_len > len || (len - id_len) % 16) {
+        error_report("CMD_POSTCOPY_RAM_DISCARD invalid length (%d)", len);
+        return -EINVAL;
+    }
+    qemu_get_buffer(f, (uint8_t *)ramid, id_len);
+    ramid[id_len] = 0;
+    len -= id_len;
 
-    v = qemu_get_be32(f);
-    if (v != QEMU_VM_FILE_MAGIC) {
+    while (len) {
+        uint64_t start_addr = qemu_get_be64(f);
+        uint64_t block_length = qemu_get_be64(f);
+
+        len -= 16;
+        ret = ram_discard_range(mis, ramid, start_addr, block_length);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return qemu_file_get_error(f);
+}
+
+/*
+ * From here on the guest may fault on pages that aren't there yet, so the
+ * rest of the stream must be read by a thread that never waits for the
+ * guest.
+ */
+static void *postcopy_ram_listen_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    QEMUFile *f = mis->from_src_file;
+    int ret;
+
+    ret = qemu_loadvm_state_main(f, mis);
+    if (ret == 0) {
+        ret = qemu_file_get_error(f);
+    }
+    trace_postcopy_ram_listen_thread_exit(ret);
+    if (ret < 0) {
+        /* The guest is running here and the source has stopped; there is
+         * no way back. */
+        error_report("load of postcopy migration failed: %s",
+                     strerror(-ret));
+        migrate_send_rp_shut(mis, 1);
+        exit(EXIT_FAILURE);
+    }
+
+    if (postcopy_ram_incoming_cleanup(mis) < 0) {
+        error_report("postcopy: cleanup of the page fault handler failed");
+    }
+    migrate_send_rp_shut(mis, 0);
+    mis->postcopy_state = POSTCOPY_INCOMING_END;
+
+    qemu_mutex_lock_iothread();
+    loadvm_free_handlers();
+    qemu_fclose(mis->to_src_file);
+    mis->to_src_file = NULL;
+    qemu_fclose(f);
+    mis->from_src_file = NULL;
+    free_xbzrle_decoded_buf();
+    qemu_mutex_unlock_iothread();
+
+    return NULL;
+}
+
+static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
+{
+    trace_loadvm_postcopy_handle_listen();
+    if (mis->postcopy_state != POSTCOPY_INCOMING_ADVISE &&
+        mis->postcopy_state != POSTCOPY_INCOMING_DISCARD) {
+        error_report("CMD_POSTCOPY_LISTEN in wrong postcopy state (%d)",
+                     mis->postcopy_state);
+        return -1;
+    }
+
+    /* The listen thread and the fault thread don't run in coroutines */
+    qemu_set_block(qemu_get_fd(mis->from_src_file));
+
+    if (postcopy_ram_enable_notify(mis)) {
+        return -1;
+    }
+    mis->postcopy_state = POSTCOPY_INCOMING_LISTENING;
+
+    qemu_thread_create(&mis->listen_thread, "postcopy/listen",
+                       postcopy_ram_listen_thread, mis, QEMU_THREAD_DETACHED);
+    return 0;
+}
+
+static int loadvm_postcopy_handle_run(MigrationIncomingState *mis)
+{
+    Error *local_err = NULL;
+
+    trace_loadvm_postcopy_handle_run();
+    if (mis->postcopy_state != POSTCOPY_INCOMING_LISTENING) {
+        error_report("CMD_POSTCOPY_RUN in wrong postcopy state (%d)",
+                     mis->postcopy_state);
+        return -1;
+    }
+    mis->postcopy_state = POSTCOPY_INCOMING_RUNNING;
+
+    cpu_synchronize_all_post_init();
+    qemu_announce_self();
+
+    /* Make sure all file formats flush their mutable metadata */
+    bdrv_invalidate_cache_all(&local_err);
+    if (local_err) {
+        qerror_report_err(local_err);
+        error_free(local_err);
+        return -1;
+    }
+
+    if (autostart) {
+        vm_start();
+    } else {
+        runstate_set(RUN_STATE_PAUSED);
+    }
+    return 0;
+}
+
+/* A nested stream, loaded from memory; see qemu_savevm_state_postcopy_package */
+static int loadvm_handle_cmd_packaged(MigrationIncomingState *mis,
+                                      QEMUFile *f)
+{
+    QEMUSizedBuffer *qsb;
+    QEMUFile *packf;
+    uint32_t length;
+    uint8_t *buf;
+    int ret;
+
+    length = qemu_get_be32(f);
+    trace_loadvm_handle_cmd_packaged(length);
+    if (length > INT_MAX) {
+        error_report("Unreasonably large packaged state: %u", length);
+        return -1;
+    }
+
+    buf = g_malloc(length);
+    if (qemu_get_buffer(f, buf, length) != (int)length) {
+        g_free(buf);
         return -EINVAL;
     }
 
-    v = qemu_get_be32(f);
-    if (v == QEMU_VM_FILE_VERSION_COMPAT) {
-        fprintf(stderr, "SaveVM v2 format is obsolete and don't work anymore\n");
-        return -ENOTSUP;
+    qsb = qsb_create(buf, length);
+    g_free(buf);
+    if (!qsb) {
+        return -ENOMEM;
     }
-    if (v != QEMU_VM_FILE_VERSION) {
-        return -ENOTSUP;
+    /* packf owns qsb from here */
+    packf = qemu_bufopen("r", qsb);
+    if (!packf) {
+        qsb_free(qsb);
+        return -ENOMEM;
+    }
+
+    ret = qemu_loadvm_state_main(packf, mis);
+    qemu_fclose(packf);
+
+    if (ret == 0 && mis->postcopy_state == POSTCOPY_INCOMING_RUNNING) {
+        /* The listen thread has taken over the rest of the stream */
+        return LOADVM_QUIT;
+    }
+    return ret;
+}
+
+static int loadvm_process_command(QEMUFile *f, MigrationIncomingState *mis)
+{
+    uint16_t cmd;
+    uint16_t len;
+
+    cmd = qemu_get_be16(f);
+    len = qemu_get_be16(f);
+
+    trace_loadvm_process_command(cmd, len);
+    if (cmd >= MIG_CMD_MAX || cmd == MIG_CMD_INVALID) {
+        error_report("MIG_CMD 0x%x unknown (len 0x%x)", cmd, len);
+        return -EINVAL;
     }
 
+    switch (cmd) {
+    case MIG_CMD_POSTCOPY_ADVISE:
+        if (len != 8) {
+            break;
+        }
+        return loadvm_postcopy_handle_advise(mis, qemu_get_be64(f));
+
+    case MIG_CMD_POSTCOPY_RAM_DISCARD:
+        return loadvm_postcopy_ram_handle_discard(mis, f, len);
+
+    case MIG_CMD_POSTCOPY_LISTEN:
+        if (len != 0) {
+            break;
+        }
+        return loadvm_postcopy_handle_listen(mis);
+
+    case MIG_CMD_POSTCOPY_RUN:
+        if (len != 0) {
+            break;
+        }
+        return loadvm_postcopy_handle_run(mis);
+
+    case MIG_CMD_PACKAGED:
+        if (len != 4) {
+            break;
+        }
+        return loadvm_handle_cmd_packaged(mis, f);
+    }
+
+    error_report("MIG_CMD 0x%x has bad length 0x%x", cmd, len);
+    return -EINVAL;
+}
+
+/*
+ * Load sections until QEMU_VM_EOF.
+ *
+ * Returns 0 on EOF, negative on error, or LOADVM_QUIT if the rest of the
+ * stream now belongs to the postcopy listen thread.
+ */
+static int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
+{
+    LoadStateEntry *le;
+    uint8_t section_type;
+    int64_t start;
+    int ret;
+
     while ((section_type = qemu_get_byte(f)) != QEMU_VM_EOF) {
         uint32_t instance_id, version_id, section_id;
         SaveStateEntry *se;
@@ -926,16 +1535,14 @@ int qemu_loadvm_state(QEMUFile *f)
             se = find_se(idstr, instance_id);
             if (se == NULL) {
                 fprintf(stderr, "Unknown savevm section or instance '%s' %d\n", idstr, instance_id);
-                ret = -EINVAL;
-                goto out;
+                return -EINVAL;
             }
 
             /* Validate version */
             if (version_id > se->version_id) {
                 fprintf(stderr, "savevm: unsupported version %d for '%s' v%d\n",
                         version_id, idstr, se->version_id);
-                ret = -EINVAL;
-                goto out;
+                return -EINVAL;
             }
 
             /* Add entry */
@@ -946,11 +1553,16 @@ int qemu_loadvm_state(QEMUFile *f)
             le->version_id = version_id;
             QLIST_INSERT_HEAD(&loadvm_handlers, le, entry);
 
+            start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
             ret = vmstate_load(f, le->se, le->version_id);
+            if (section_type == QEMU_VM_SECTION_FULL) {
+                trace_loadvm_section_time(idstr, instance_id,
+                    qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start);
+            }
             if (ret < 0) {
                 fprintf(stderr, "qemu: warning: error while loading state for instance 0x%x of device '%s'\n",
                         instance_id, idstr);
-                goto out;
+                return ret;
             }
             break;
         case QEMU_VM_SECTION_PART:
@@ -964,34 +1576,67 @@ int qemu_loadvm_state(QEMUFile *f)
             }
             if (le == NULL) {
                 fprintf(stderr, "Unknown savevm section %d\n", section_id);
-                ret = -EINVAL;
-                goto out;
+                return -EINVAL;
             }
 
             ret = vmstate_load(f, le->se, le->version_id);
             if (ret < 0) {
                 fprintf(stderr, "qemu: warning: error while loading state section id %d\n",
                         section_id);
-                goto out;
+                return ret;
+            }
+            break;
+        case QEMU_VM_COMMAND:
+            ret = loadvm_process_command(f, mis);
+            if (ret) {
+                return ret;
             }
             break;
         default:
             fprintf(stderr, "Unknown savevm section type %d\n", section_type);
-            ret = -EINVAL;
-            goto out;
+            return -EINVAL;
         }
     }
 
-    cpu_synchronize_all_post_init();
+    return 0;
+}
+
+int qemu_loadvm_state(QEMUFile *f)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    unsigned int v;
+    int ret;
 
-    ret = 0;
+    if (qemu_savevm_state_blocked(NULL)) {
+        return -EINVAL;
+    }
 
-out:
-    QLIST_FOREACH_SAFE(le, &loadvm_handlers, entry, new_le) {
-        QLIST_REMOVE(le, entry);
-        g_free(le);
+    v = qemu_get_be32(f);
+    if (v != QEMU_VM_FILE_MAGIC) {
+        return -EINVAL;
     }
 
+    v = qemu_get_be32(f);
+    if (v == QEMU_VM_FILE_VERSION_COMPAT) {
+        fprintf(stderr, "SaveVM v2 format is obsolete and don't work anymore\n");
+        return -ENOTSUP;
+    }
+    if (v != QEMU_VM_FILE_VERSION) {
+        return -ENOTSUP;
+    }
+
+    ret = qemu_loadvm_state_main(f, mis);
+    if (ret == LOADVM_QUIT) {
+        /* Postcopy: the listen thread finishes the job */
+        return 0;
+    }
+
+    if (ret == 0) {
+        cpu_synchronize_all_post_init();
+    }
+
+    loadvm_free_handlers();
+
     if (ret == 0) {
         ret = qemu_file_get_error(f);
     }
@@ -1043,13 +1688,14 @@ void do_savevm(Monitor *mon, const QDict *qdict)
 {
     BlockDriverState *bs, *bs1;
     QEMUSnapshotInfo sn1, *sn = &sn1, old_sn1, *old_sn = &old_sn1;
-    int ret;
-    QEMUFile *f;
+    int ret, ret2;
+    QEMUFile *f = NULL;
     int saved_vm_running;
     uint64_t vm_state_size;
     qemu_timeval tv;
     struct tm tm;
     const char *name = qdict_get_try_str(qdict, "name");
+    bool live = qdict_get_try_bool(qdict, "live", false);
 
     /* Verify if there is a device that doesn't support snapshots and is writable */
     bs = NULL;
@@ -1073,6 +1719,22 @@ void do_savevm(Monitor *mon, const QDict *qdict)
     }
 
     saved_vm_running = runstate_is_running();
+
+    if (live && saved_vm_running) {
+        f = qemu_fopen_bdrv(bs, 1);
+        if (!f) {
+            monitor_printf(mon, "Could not open VM state file\n");
+            return;
+        }
+        ret = qemu_savevm_state_precopy(f);
+        if (ret < 0) {
+            monitor_printf(mon, "Error %d while writing VM\n", ret);
+            qemu_savevm_state_cancel();
+            qemu_fclose(f);
+            return;
+        }
+    }
+
     vm_stop(RUN_STATE_SAVE_VM);
 
     memset(sn, 0, sizeof(*sn));
@@ -1099,18 +1761,30 @@ void do_savevm(Monitor *mon, const QDict *qdict)
 
     /* Delete old snapshots of the same name */
     if (name && del_existing_snapshots(mon, name) < 0) {
+        if (f) {
+            qemu_savevm_state_cancel();
+            qemu_fclose(f);
+        }
         goto the_end;
     }
 
     /* save the VM state */
-    f = qemu_fopen_bdrv(bs, 1);
-    if (!f) {
-        monitor_printf(mon, "Could not open VM state file\n");
-        goto the_end;
+    if (f) {
+        ret = qemu_savevm_state_finish(f);
+    } else {
+        f = qemu_fopen_bdrv(bs, 1);
+        if (!f) {
+            monitor_printf(mon, "Could not open VM state file\n");
+            goto the_end;
+        }
+        ret = qemu_savevm_state(f);
     }
-    ret = qemu_savevm_state(f);
     vm_state_size = qemu_ftell(f);
-    qemu_fclose(f);
+    /* the last chunk of VM state is only written out on close */
+    ret2 = qemu_fclose(f);
+    if (ret >= 0) {
+        ret = ret2;
+    }
     if (ret < 0) {
         monitor_printf(mon, "Error %d while writing VM\n", ret);
         goto the_end;
@@ -28,6 +28,9 @@ def is_string(arg):
 
 
 def generate_h_begin(events):
+    out('#include "trace/control.h"',
+        '')
+
     for event in events:
         out('void _simple_%(api)s(%(args)s);',
             api=event.api(),
@@ -36,7 +39,11 @@ def generate_h_begin(events):
 
 
 def generate_h(event):
-    out('    _simple_%(api)s(%(args)s);',
+    # check inline, so a disabled event does not cost a call
+    out('    if (trace_event_get_state(%(event_id)s)) {',
+        '        _simple_%(api)s(%(args)s);',
+        '    }',
+        event_id='TRACE_' + event.name.upper(),
         api=event.api(),
         args=", ".join(event.args.names()))
 
@@ -69,10 +76,6 @@ def generate_c(event):
 
 
     out('',
-        '    if (!trace_event_get_state(%(event_id)s)) {',
-        '        return;',
-        '    }',
-        '',
         '    if (trace_record_start(&rec, %(event_id)s, %(size_str)s)) {',
         '        return; /* Trace Buffer Full, Event Dropped ! */',
         '    }',
@@ -41,7 +41,7 @@
 #include <slirp.h>
 
 /* patchable/settable parameters for tcp */
-/* Don't do rfc1323 performance enhancements */
+/* Don't do rfc1323 timestamps; window scaling is always requested */
 #define TCP_DO_RFC1323 0
 
 /*
@@ -191,7 +191,7 @@ tcp_newtcpcb(struct socket *so)
 	tp->seg_next = tp->seg_prev = (struct tcpiphdr*)tp;
 	tp->t_maxseg = TCP_MSS;
 
-	tp->t_flags = TCP_DO_RFC1323 ? (TF_REQ_SCALE|TF_REQ_TSTMP) : 0;
+	tp->t_flags = TF_REQ_SCALE | (TCP_DO_RFC1323 ? TF_REQ_TSTMP : 0);
 	tp->t_socket = so;
 
 	/*
@@ -165,6 +165,12 @@ typedef struct CPUARMState {
     uint32_t VF; /* V is the bit 31. All other bits are undefined */
     uint32_t NF; /* N is bit 31. All other bits are undefined.  */
     uint32_t ZF; /* Z set if zero.  */
+    /* CF and VF are only valid when CC_OP is ARM_CC_OP_FLAGS.  Otherwise
+     * NF holds the 32 bit result of the last flag-setting add or sub and
+     * CC_SRC its second operand; use arm_cc_get() to read them.
+     */
+    uint32_t CC_OP;
+    uint32_t CC_SRC;
     uint32_t QF; /* 0 or 1 */
     uint32_t GE; /* cpsr[19:16] */
     uint32_t thumb; /* cpsr[5]. 0 = arm mode, 1 = thumb mode. */
@@ -515,17 +521,63 @@ static inline unsigned int aarch64_pstate_mode(unsigned int el, bool handler)
     return (el << 2) | handler;
 }
 
+/* Lazily evaluated carry and overflow flags, see env->CC_OP.  Zero must
+ * stay ARM_CC_OP_FLAGS so that a cleared CPU state is consistent.
+ */
+enum {
+    ARM_CC_OP_FLAGS = 0,    /* CF and VF are up to date */
+    ARM_CC_OP_ADD,          /* NF = x + CC_SRC */
+    ARM_CC_OP_SUB,          /* NF = x - CC_SRC */
+    ARM_CC_OP_DYNAMIC,      /* translator only: look at env->CC_OP */
+};
+
+/* Return the carry flag (0 or 1) and the overflow flag (in bit 31)
+ * without changing the lazy state.
+ */
+static inline void arm_cc_get(CPUARMState *env, uint32_t *cf, uint32_t *vf)
+{
+    uint32_t res = env->NF;
+    uint32_t src = env->CC_SRC;
+    uint32_t x;
+
+    switch (env->CC_OP) {
+    case ARM_CC_OP_ADD:
+        x = res - src;
+        *cf = res < src;
+        *vf = (res ^ x) & ~(x ^ src);
+        break;
+    case ARM_CC_OP_SUB:
+        x = res + src;
+        *cf = x >= src;
+        *vf = (res ^ x) & (x ^ src);
+        break;
+    default:
+        *cf = env->CF;
+        *vf = env->VF;
+        break;
+    }
+}
+
+/* Fold the lazy state back into env->CF and env->VF.  */
+static inline void arm_cc_compute(CPUARMState *env)
+{
+    arm_cc_get(env, &env->CF, &env->VF);
+    env->CC_OP = ARM_CC_OP_FLAGS;
+}
+
 /* Return the current PSTATE value. For the moment we don't support 32<->64 bit
  * interprocessing, so we don't attempt to sync with the cpsr state used by
  * the 32 bit decoder.
  */
 static inline uint32_t pstate_read(CPUARMState *env)
 {
+    uint32_t CF, VF;
     int ZF;
 
+    arm_cc_get(env, &CF, &VF);
     ZF = (env->ZF == 0);
     return (env->NF & 0x80000000) | (ZF << 30)
-        | (env->CF << 29) | ((env->VF & 0x80000000) >> 3)
+        | (CF << 29) | ((VF & 0x80000000) >> 3)
         | env->pstate | env->daif;
 }
 
@@ -535,6 +587,7 @@ static inline void pstate_write(CPUARMState *env, uint32_t val)
     env->NF = val;
     env->CF = (val >> 29) & 1;
     env->VF = (val << 3) & 0x80000000;
+    env->CC_OP = ARM_CC_OP_FLAGS;
     env->daif = val & PSTATE_DAIF;
     env->pstate = val & ~CACHED_PSTATE_BITS;
 }
@@ -547,10 +600,13 @@ void cpsr_write(CPUARMState *env, uint32_t val, uint32_t mask);
 /* Return the current xPSR value.  */
 static inline uint32_t xpsr_read(CPUARMState *env)
 {
+    uint32_t CF, VF;
     int ZF;
+
+    arm_cc_get(env, &CF, &VF);
     ZF = (env->ZF == 0);
     return (env->NF & 0x80000000) | (ZF << 30)
-        | (env->CF << 29) | ((env->VF & 0x80000000) >> 3) | (env->QF << 27)
+        | (CF << 29) | ((VF & 0x80000000) >> 3) | (env->QF << 27)
         | (env->thumb << 24) | ((env->condexec_bits & 3) << 25)
         | ((env->condexec_bits & 0xfc) << 8)
         | env->v7m.exception;
@@ -564,6 +620,7 @@ static inline void xpsr_write(CPUARMState *env, uint32_t val, uint32_t mask)
         env->NF = val;
         env->CF = (val >> 29) & 1;
         env->VF = (val << 3) & 0x80000000;
+        env->CC_OP = ARM_CC_OP_FLAGS;
     }
     if (mask & CPSR_Q)
         env->QF = ((val & CPSR_Q) != 0);
@@ -22,6 +22,44 @@ union CRYPTO_STATE {
     uint64_t   l[2];
 };
 
+#ifdef CONFIG_AESNI_OPT
+#pragma GCC push_options
+#pragma GCC target("aes")
+#include <wmmintrin.h>
+
+/*
+ * The AES rounds with AES-NI on an x86 host, which stores the state bytes
+ * in the same order.  AESENCLAST/AESDECLAST with a zero round key are
+ * ShiftRows and SubBytes (or their inverses) alone; the x86 instructions
+ * have no MixColumns on its own, but it is what AESENC adds to what
+ * AESDECLAST undoes.
+ */
+static void host_aese(union CRYPTO_STATE *st, union CRYPTO_STATE *rk,
+                      uint32_t decrypt)
+{
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((__m128i *)st->bytes),
+                              _mm_loadu_si128((__m128i *)rk->bytes));
+    __m128i zero = _mm_setzero_si128();
+
+    x = decrypt ? _mm_aesdeclast_si128(x, zero) : _mm_aesenclast_si128(x, zero);
+    _mm_storeu_si128((__m128i *)st->bytes, x);
+}
+
+static void host_aesmc(union CRYPTO_STATE *st, uint32_t decrypt)
+{
+    __m128i x = _mm_loadu_si128((__m128i *)st->bytes);
+    __m128i zero = _mm_setzero_si128();
+
+    if (decrypt) {
+        x = _mm_aesimc_si128(x);
+    } else {
+        x = _mm_aesenc_si128(_mm_aesdeclast_si128(x, zero), zero);
+    }
+    _mm_storeu_si128((__m128i *)st->bytes, x);
+}
+#pragma GCC pop_options
+#endif
+
 void HELPER(crypto_aese)(CPUARMState *env, uint32_t rd, uint32_t rm,
                          uint32_t decrypt)
 {
@@ -40,6 +78,13 @@ void HELPER(crypto_aese)(CPUARMState *env, uint32_t rd, uint32_t rm,
 
     assert(decrypt < 2);
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_aes()) {
+        host_aese(&st, &rk, decrypt);
+        goto done;
+    }
+#endif
+
     /* xor state vector with round key */
     rk.l[0] ^= st.l[0];
     rk.l[1] ^= st.l[1];
@@ -49,6 +94,9 @@ void HELPER(crypto_aese)(CPUARMState *env, uint32_t rd, uint32_t rm,
         st.bytes[i] = sbox[decrypt][rk.bytes[shift[decrypt][i]]];
     }
 
+#ifdef CONFIG_AESNI_OPT
+done:
+#endif
     env->vfp.regs[rd] = make_float64(st.l[0]);
     env->vfp.regs[rd + 1] = make_float64(st.l[1]);
 }
@@ -197,6 +245,13 @@ void HELPER(crypto_aesmc)(CPUARMState *env, uint32_t rd, uint32_t rm,
 
     assert(decrypt < 2);
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_aes()) {
+        host_aesmc(&st, decrypt);
+        goto done;
+    }
+#endif
+
     for (i = 0; i < 16; i += 4) {
         st.words[i >> 2] = cpu_to_le32(
             mc[decrypt][st.bytes[i]] ^
@@ -205,6 +260,9 @@ void HELPER(crypto_aesmc)(CPUARMState *env, uint32_t rd, uint32_t rm,
             rol32(mc[decrypt][st.bytes[i + 3]], 24));
     }
 
+#ifdef CONFIG_AESNI_OPT
+done:
+#endif
     env->vfp.regs[rd] = make_float64(st.l[0]);
     env->vfp.regs[rd + 1] = make_float64(st.l[1]);
 }
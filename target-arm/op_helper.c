@@ -261,6 +261,11 @@ uint32_t HELPER(cpsr_read)(CPUARMState *env)
     return cpsr_read(env) & ~(CPSR_EXEC | CPSR_RESERVED);
 }
 
+void HELPER(cc_compute)(CPUARMState *env)
+{
+    arm_cc_compute(env);
+}
+
 void HELPER(cpsr_write)(CPUARMState *env, uint32_t val, uint32_t mask)
 {
     cpsr_write(env, val, mask);
@@ -39,7 +39,6 @@
 
 static TCGv_i64 cpu_X[32];
 static TCGv_i64 cpu_pc;
-static TCGv_i32 cpu_NF, cpu_ZF, cpu_CF, cpu_VF;
 
 /* Load/store exclusive handling */
 static TCGv_i64 cpu_exclusive_addr;
@@ -104,11 +103,6 @@ void a64_translate_init(void)
                                           regnames[i]);
     }
 
-    cpu_NF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, NF), "NF");
-    cpu_ZF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, ZF), "ZF");
-    cpu_CF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, CF), "CF");
-    cpu_VF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, VF), "VF");
-
     cpu_exclusive_addr = tcg_global_mem_new_i64(TCG_AREG0,
         offsetof(CPUARMState, exclusive_addr), "exclusive_addr");
     cpu_exclusive_val = tcg_global_mem_new_i64(TCG_AREG0,
@@ -513,7 +507,7 @@ static inline void gen_set_NZ64(TCGv_i64 result)
 }
 
 /* Set NZCV as for a logical operation: NZ as per result, CV cleared. */
-static inline void gen_logic_CC(int sf, TCGv_i64 result)
+static inline void gen_logic_CC(DisasContext *s, int sf, TCGv_i64 result)
 {
     if (sf) {
         gen_set_NZ64(result);
@@ -523,10 +517,14 @@ static inline void gen_logic_CC(int sf, TCGv_i64 result)
     }
     tcg_gen_movi_i32(cpu_CF, 0);
     tcg_gen_movi_i32(cpu_VF, 0);
+    arm_gen_set_cc_op(s, ARM_CC_OP_FLAGS);
 }
 
-/* dest = T0 + T1; compute C, N, V and Z flags */
-static void gen_add_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
+/* dest = T0 + T1; compute C, N, V and Z flags.  In the 32 bit case only
+ * N and Z are computed, C and V are left to arm_gen_compute_cc().
+ */
+static void gen_add_CC(DisasContext *s, int sf, TCGv_i64 dest,
+                       TCGv_i64 t0, TCGv_i64 t1)
 {
     if (sf) {
         TCGv_i64 result, flag, tmp;
@@ -551,30 +549,27 @@ static void gen_add_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
         tcg_gen_mov_i64(dest, result);
         tcg_temp_free_i64(result);
         tcg_temp_free_i64(flag);
+        arm_gen_set_cc_op(s, ARM_CC_OP_FLAGS);
     } else {
         /* 32 bit arithmetic */
         TCGv_i32 t0_32 = tcg_temp_new_i32();
-        TCGv_i32 t1_32 = tcg_temp_new_i32();
-        TCGv_i32 tmp = tcg_temp_new_i32();
 
-        tcg_gen_movi_i32(tmp, 0);
         tcg_gen_trunc_i64_i32(t0_32, t0);
-        tcg_gen_trunc_i64_i32(t1_32, t1);
-        tcg_gen_add2_i32(cpu_NF, cpu_CF, t0_32, tmp, t1_32, tmp);
+        tcg_gen_trunc_i64_i32(cpu_CC_SRC, t1);
+        tcg_gen_add_i32(cpu_NF, t0_32, cpu_CC_SRC);
         tcg_gen_mov_i32(cpu_ZF, cpu_NF);
-        tcg_gen_xor_i32(cpu_VF, cpu_NF, t0_32);
-        tcg_gen_xor_i32(tmp, t0_32, t1_32);
-        tcg_gen_andc_i32(cpu_VF, cpu_VF, tmp);
+        arm_gen_set_cc_op(s, ARM_CC_OP_ADD);
         tcg_gen_extu_i32_i64(dest, cpu_NF);
 
-        tcg_temp_free_i32(tmp);
         tcg_temp_free_i32(t0_32);
-        tcg_temp_free_i32(t1_32);
     }
 }
 
-/* dest = T0 - T1; compute C, N, V and Z flags */
-static void gen_sub_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
+/* dest = T0 - T1; compute C, N, V and Z flags.  In the 32 bit case only
+ * N and Z are computed, C and V are left to arm_gen_compute_cc().
+ */
+static void gen_sub_CC(DisasContext *s, int sf, TCGv_i64 dest,
+                       TCGv_i64 t0, TCGv_i64 t1)
 {
     if (sf) {
         /* 64 bit arithmetic */
@@ -599,32 +594,29 @@ static void gen_sub_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
         tcg_gen_mov_i64(dest, result);
         tcg_temp_free_i64(flag);
         tcg_temp_free_i64(result);
+        arm_gen_set_cc_op(s, ARM_CC_OP_FLAGS);
     } else {
         /* 32 bit arithmetic */
         TCGv_i32 t0_32 = tcg_temp_new_i32();
-        TCGv_i32 t1_32 = tcg_temp_new_i32();
-        TCGv_i32 tmp;
 
         tcg_gen_trunc_i64_i32(t0_32, t0);
-        tcg_gen_trunc_i64_i32(t1_32, t1);
-        tcg_gen_sub_i32(cpu_NF, t0_32, t1_32);
+        tcg_gen_trunc_i64_i32(cpu_CC_SRC, t1);
+        tcg_gen_sub_i32(cpu_NF, t0_32, cpu_CC_SRC);
         tcg_gen_mov_i32(cpu_ZF, cpu_NF);
-        tcg_gen_setcond_i32(TCG_COND_GEU, cpu_CF, t0_32, t1_32);
-        tcg_gen_xor_i32(cpu_VF, cpu_NF, t0_32);
-        tmp = tcg_temp_new_i32();
-        tcg_gen_xor_i32(tmp, t0_32, t1_32);
-        tcg_temp_free_i32(t0_32);
-        tcg_temp_free_i32(t1_32);
-        tcg_gen_and_i32(cpu_VF, cpu_VF, tmp);
-        tcg_temp_free_i32(tmp);
+        arm_gen_set_cc_op(s, ARM_CC_OP_SUB);
         tcg_gen_extu_i32_i64(dest, cpu_NF);
+
+        tcg_temp_free_i32(t0_32);
     }
 }
 
 /* dest = T0 + T1 + CF; do not compute flags. */
-static void gen_adc(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
+static void gen_adc(DisasContext *s, int sf, TCGv_i64 dest,
+                    TCGv_i64 t0, TCGv_i64 t1)
 {
     TCGv_i64 flag = tcg_temp_new_i64();
+
+    arm_gen_compute_cc(s);
     tcg_gen_extu_i32_i64(flag, cpu_CF);
     tcg_gen_add_i64(dest, t0, t1);
     tcg_gen_add_i64(dest, dest, flag);
@@ -636,8 +628,10 @@ static void gen_adc(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
 }
 
 /* dest = T0 + T1 + CF; compute C, N, V and Z flags. */
-static void gen_adc_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
+static void gen_adc_CC(DisasContext *s, int sf, TCGv_i64 dest,
+                       TCGv_i64 t0, TCGv_i64 t1)
 {
+    arm_gen_compute_cc(s);
     if (sf) {
         TCGv_i64 result, cf_64, vf_64, tmp;
         result = tcg_temp_new_i64();
@@ -1148,7 +1142,7 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
     if (cond < 0x0e) {
         /* genuinely conditional branches */
         int label_match = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        arm_gen_test_cc(s, cond, label_match);
         gen_goto_tb(s, 0, s->pc);
         gen_set_label(label_match);
         gen_goto_tb(s, 1, addr);
@@ -1248,11 +1242,13 @@ static void handle_msr_i(DisasContext *s, uint32_t insn,
     }
 }
 
-static void gen_get_nzcv(TCGv_i64 tcg_rt)
+static void gen_get_nzcv(DisasContext *s, TCGv_i64 tcg_rt)
 {
     TCGv_i32 tmp = tcg_temp_new_i32();
     TCGv_i32 nzcv = tcg_temp_new_i32();
 
+    arm_gen_compute_cc(s);
+
     /* build bit 31, N */
     tcg_gen_andi_i32(nzcv, cpu_NF, (1 << 31));
     /* build bit 30, Z */
@@ -1270,7 +1266,7 @@ static void gen_get_nzcv(TCGv_i64 tcg_rt)
     tcg_temp_free_i32(tmp);
 }
 
-static void gen_set_nzcv(TCGv_i64 tcg_rt)
+static void gen_set_nzcv(DisasContext *s, TCGv_i64 tcg_rt)
 
 {
     TCGv_i32 nzcv = tcg_temp_new_i32();
@@ -1290,6 +1286,7 @@ static void gen_set_nzcv(TCGv_i64 tcg_rt)
     tcg_gen_andi_i32(cpu_VF, nzcv, (1 << 28));
     tcg_gen_shli_i32(cpu_VF, cpu_VF, 3);
     tcg_temp_free_i32(nzcv);
+    arm_gen_set_cc_op(s, ARM_CC_OP_FLAGS);
 }
 
 /* C5.6.129 MRS - move from system register
@@ -1351,9 +1348,9 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
     case ARM_CP_NZCV:
         tcg_rt = cpu_reg(s, rt);
         if (isread) {
-            gen_get_nzcv(tcg_rt);
+            gen_get_nzcv(s, tcg_rt);
         } else {
-            gen_set_nzcv(tcg_rt);
+            gen_set_nzcv(s, tcg_rt);
         }
         return;
     case ARM_CP_CURRENTEL:
@@ -2710,9 +2707,9 @@ static void disas_add_sub_imm(DisasContext *s, uint32_t insn)
     } else {
         TCGv_i64 tcg_imm = tcg_const_i64(imm);
         if (sub_op) {
-            gen_sub_CC(is_64bit, tcg_result, tcg_rn, tcg_imm);
+            gen_sub_CC(s, is_64bit, tcg_result, tcg_rn, tcg_imm);
         } else {
-            gen_add_CC(is_64bit, tcg_result, tcg_rn, tcg_imm);
+            gen_add_CC(s, is_64bit, tcg_result, tcg_rn, tcg_imm);
         }
         tcg_temp_free_i64(tcg_imm);
     }
@@ -2878,7 +2875,7 @@ static void disas_logic_imm(DisasContext *s, uint32_t insn)
     }
 
     if (opc == 3) { /* ANDS */
-        gen_logic_CC(sf, tcg_rd);
+        gen_logic_CC(s, sf, tcg_rd);
     }
 }
 
@@ -3224,7 +3221,7 @@ static void disas_logic_reg(DisasContext *s, uint32_t insn)
     }
 
     if (opc == 3) {
-        gen_logic_CC(sf, tcg_rd);
+        gen_logic_CC(s, sf, tcg_rd);
     }
 }
 
@@ -3286,9 +3283,9 @@ static void disas_add_sub_ext_reg(DisasContext *s, uint32_t insn)
         }
     } else {
         if (sub_op) {
-            gen_sub_CC(sf, tcg_result, tcg_rn, tcg_rm);
+            gen_sub_CC(s, sf, tcg_result, tcg_rn, tcg_rm);
         } else {
-            gen_add_CC(sf, tcg_result, tcg_rn, tcg_rm);
+            gen_add_CC(s, sf, tcg_result, tcg_rn, tcg_rm);
         }
     }
 
@@ -3350,9 +3347,9 @@ static void disas_add_sub_reg(DisasContext *s, uint32_t insn)
         }
     } else {
         if (sub_op) {
-            gen_sub_CC(sf, tcg_result, tcg_rn, tcg_rm);
+            gen_sub_CC(s, sf, tcg_result, tcg_rn, tcg_rm);
         } else {
-            gen_add_CC(sf, tcg_result, tcg_rn, tcg_rm);
+            gen_add_CC(s, sf, tcg_result, tcg_rn, tcg_rm);
         }
     }
 
@@ -3500,9 +3497,9 @@ static void disas_adc_sbc(DisasContext *s, uint32_t insn)
     }
 
     if (setflags) {
-        gen_adc_CC(sf, tcg_rd, tcg_rn, tcg_y);
+        gen_adc_CC(s, sf, tcg_rd, tcg_rn, tcg_y);
     } else {
-        gen_adc(sf, tcg_rd, tcg_rn, tcg_y);
+        gen_adc(s, sf, tcg_rd, tcg_rn, tcg_y);
     }
 }
 
@@ -3537,15 +3534,19 @@ static void disas_cc(DisasContext *s, uint32_t insn)
 
     if (cond < 0x0e) { /* not always */
         int label_match = gen_new_label();
+        int match_cc_op;
+
         label_continue = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        arm_gen_test_cc(s, cond, label_match);
+        match_cc_op = s->cc_op;
         /* nomatch: */
         tcg_tmp = tcg_temp_new_i64();
         tcg_gen_movi_i64(tcg_tmp, nzcv << 28);
-        gen_set_nzcv(tcg_tmp);
+        gen_set_nzcv(s, tcg_tmp);
         tcg_temp_free_i64(tcg_tmp);
         tcg_gen_br(label_continue);
         gen_set_label(label_match);
+        s->cc_op = match_cc_op;
     }
     /* match, or condition is always */
     if (is_imm) {
@@ -3558,13 +3559,15 @@ static void disas_cc(DisasContext *s, uint32_t insn)
 
     tcg_tmp = tcg_temp_new_i64();
     if (op) {
-        gen_sub_CC(sf, tcg_tmp, tcg_rn, tcg_y);
+        gen_sub_CC(s, sf, tcg_tmp, tcg_rn, tcg_y);
     } else {
-        gen_add_CC(sf, tcg_tmp, tcg_rn, tcg_y);
+        gen_add_CC(s, sf, tcg_tmp, tcg_rn, tcg_y);
     }
     tcg_temp_free_i64(tcg_tmp);
 
     if (cond < 0x0e) { /* continue */
+        /* join with the nomatch path, where the flags are known */
+        arm_gen_compute_cc(s);
         gen_set_label(label_continue);
     }
 }
@@ -3612,7 +3615,7 @@ static void disas_cond_select(DisasContext *s, uint32_t insn)
         int label_match = gen_new_label();
         int label_continue = gen_new_label();
 
-        arm_gen_test_cc(cond, label_match);
+        arm_gen_test_cc(s, cond, label_match);
         /* nomatch: */
         tcg_src = cpu_reg(s, rm);
 
@@ -4038,7 +4041,7 @@ static void handle_fp_compare(DisasContext *s, bool is_double,
 
     tcg_temp_free_ptr(fpst);
 
-    gen_set_nzcv(tcg_flags);
+    gen_set_nzcv(s, tcg_flags);
 
     tcg_temp_free_i64(tcg_flags);
 }
@@ -4104,16 +4107,21 @@ static void disas_fp_ccomp(DisasContext *s, uint32_t insn)
 
     if (cond < 0x0e) { /* not always */
         int label_match = gen_new_label();
+        int match_cc_op;
+
         label_continue = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        arm_gen_test_cc(s, cond, label_match);
+        match_cc_op = s->cc_op;
         /* nomatch: */
         tcg_flags = tcg_const_i64(nzcv << 28);
-        gen_set_nzcv(tcg_flags);
+        gen_set_nzcv(s, tcg_flags);
         tcg_temp_free_i64(tcg_flags);
         tcg_gen_br(label_continue);
         gen_set_label(label_match);
+        s->cc_op = match_cc_op;
     }
 
+    /* sets all of NZCV, so both paths join with ARM_CC_OP_FLAGS */
     handle_fp_compare(s, type, rn, rm, false, op);
 
     if (cond < 0x0e) {
@@ -4165,7 +4173,7 @@ static void disas_fp_csel(DisasContext *s, uint32_t insn)
     if (cond < 0x0e) { /* not always */
         int label_match = gen_new_label();
         label_continue = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        arm_gen_test_cc(s, cond, label_match);
         /* nomatch: */
         gen_mov_fp2fp(s, type, rd, rm);
         tcg_gen_br(label_continue);
@@ -10916,6 +10924,7 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
     dc->pc = pc_start;
     dc->singlestep_enabled = cs->singlestep_enabled;
     dc->condjmp = 0;
+    dc->cc_op = ARM_CC_OP_DYNAMIC;
 
     dc->aarch64 = 1;
     dc->thumb = 0;
@@ -10962,7 +10971,7 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
         max_insns = CF_COUNT_MASK;
     }
 
-    gen_tb_start();
+    gen_tb_start(tb);
 
     tcg_clear_temp_count();
 
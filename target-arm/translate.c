@@ -28,6 +28,7 @@
 #include "internals.h"
 #include "disas/disas.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "qemu/log.h"
 #include "qemu/bitops.h"
 #include "arm_ldst.h"
@@ -64,7 +65,8 @@ TCGv_ptr cpu_env;
 /* We reuse the same 64-bit temporaries for efficiency.  */
 static TCGv_i64 cpu_V0, cpu_V1, cpu_M0;
 static TCGv_i32 cpu_R[16];
-static TCGv_i32 cpu_CF, cpu_NF, cpu_VF, cpu_ZF;
+TCGv_i32 cpu_CF, cpu_NF, cpu_VF, cpu_ZF;
+TCGv_i32 cpu_CC_OP, cpu_CC_SRC;
 static TCGv_i64 cpu_exclusive_addr;
 static TCGv_i64 cpu_exclusive_val;
 #ifdef CONFIG_USER_ONLY
@@ -98,6 +100,10 @@ void arm_translate_init(void)
     cpu_NF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, NF), "NF");
     cpu_VF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, VF), "VF");
     cpu_ZF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, ZF), "ZF");
+    cpu_CC_OP = tcg_global_mem_new_i32(TCG_AREG0,
+        offsetof(CPUARMState, CC_OP), "CC_OP");
+    cpu_CC_SRC = tcg_global_mem_new_i32(TCG_AREG0,
+        offsetof(CPUARMState, CC_SRC), "CC_SRC");
 
     cpu_exclusive_addr = tcg_global_mem_new_i64(TCG_AREG0,
         offsetof(CPUARMState, exclusive_addr), "exclusive_addr");
@@ -177,14 +183,67 @@ static void store_reg(DisasContext *s, int reg, TCGv_i32 var)
 #define gen_uxtb16(var) gen_helper_uxtb16(var, var)
 
 
-static inline void gen_set_cpsr(TCGv_i32 var, uint32_t mask)
+/* Record that the carry and overflow flags are now described by op.
+ * CC_OP only needs storing when the state known at translation time
+ * changes.
+ */
+void arm_gen_set_cc_op(DisasContext *s, int op)
+{
+    if (s->cc_op != op) {
+        s->cc_op = op;
+        tcg_gen_movi_i32(cpu_CC_OP, op);
+    }
+}
+
+/* Bring CF and VF up to date before they are read, or before NF or
+ * only one of CF and VF is overwritten.
+ */
+void arm_gen_compute_cc(DisasContext *s)
+{
+    TCGv_i32 tmp;
+
+    switch (s->cc_op) {
+    case ARM_CC_OP_FLAGS:
+        return;
+    case ARM_CC_OP_ADD:
+        tmp = tcg_temp_new_i32();
+        tcg_gen_sub_i32(tmp, cpu_NF, cpu_CC_SRC);
+        tcg_gen_setcond_i32(TCG_COND_LTU, cpu_CF, cpu_NF, cpu_CC_SRC);
+        tcg_gen_xor_i32(cpu_VF, cpu_NF, tmp);
+        tcg_gen_xor_i32(tmp, tmp, cpu_CC_SRC);
+        tcg_gen_andc_i32(cpu_VF, cpu_VF, tmp);
+        tcg_temp_free_i32(tmp);
+        break;
+    case ARM_CC_OP_SUB:
+        tmp = tcg_temp_new_i32();
+        tcg_gen_add_i32(tmp, cpu_NF, cpu_CC_SRC);
+        tcg_gen_setcond_i32(TCG_COND_GEU, cpu_CF, tmp, cpu_CC_SRC);
+        tcg_gen_xor_i32(cpu_VF, cpu_NF, tmp);
+        tcg_gen_xor_i32(tmp, tmp, cpu_CC_SRC);
+        tcg_gen_and_i32(cpu_VF, cpu_VF, tmp);
+        tcg_temp_free_i32(tmp);
+        break;
+    default:
+        /* The helper leaves env->CC_OP at ARM_CC_OP_FLAGS.  */
+        gen_helper_cc_compute(cpu_env);
+        s->cc_op = ARM_CC_OP_FLAGS;
+        return;
+    }
+    arm_gen_set_cc_op(s, ARM_CC_OP_FLAGS);
+}
+
+static inline void gen_set_cpsr(DisasContext *s, TCGv_i32 var, uint32_t mask)
 {
     TCGv_i32 tmp_mask = tcg_const_i32(mask);
     gen_helper_cpsr_write(cpu_env, var, tmp_mask);
     tcg_temp_free_i32(tmp_mask);
+    if (mask & CPSR_NZCV) {
+        /* cpsr_write() has reset env->CC_OP.  */
+        s->cc_op = ARM_CC_OP_FLAGS;
+    }
 }
 /* Set NZCV flags from the high 4 bits of var.  */
-#define gen_set_nzcv(var) gen_set_cpsr(var, CPSR_NZCV)
+#define gen_set_nzcv(s, var) gen_set_cpsr(s, var, CPSR_NZCV)
 
 static void gen_exception_internal(int excp)
 {
@@ -386,58 +445,67 @@ static void gen_add16(TCGv_i32 t0, TCGv_i32 t1)
 }
 
 /* Set CF to the top bit of var.  */
-static void gen_set_CF_bit31(TCGv_i32 var)
+static void gen_set_CF_bit31(DisasContext *s, TCGv_i32 var)
 {
+    arm_gen_compute_cc(s);
     tcg_gen_shri_i32(cpu_CF, var, 31);
 }
 
 /* Set N and Z flags from var.  */
-static inline void gen_logic_CC(TCGv_i32 var)
+static inline void gen_logic_CC(DisasContext *s, TCGv_i32 var)
 {
+    arm_gen_compute_cc(s);
     tcg_gen_mov_i32(cpu_NF, var);
     tcg_gen_mov_i32(cpu_ZF, var);
 }
 
 /* T0 += T1 + CF.  */
-static void gen_adc(TCGv_i32 t0, TCGv_i32 t1)
+static void gen_adc(DisasContext *s, TCGv_i32 t0, TCGv_i32 t1)
 {
+    arm_gen_compute_cc(s);
     tcg_gen_add_i32(t0, t0, t1);
     tcg_gen_add_i32(t0, t0, cpu_CF);
 }
 
 /* dest = T0 + T1 + CF. */
-static void gen_add_carry(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_add_carry(DisasContext *s, TCGv_i32 dest,
+                          TCGv_i32 t0, TCGv_i32 t1)
 {
+    arm_gen_compute_cc(s);
     tcg_gen_add_i32(dest, t0, t1);
     tcg_gen_add_i32(dest, dest, cpu_CF);
 }
 
 /* dest = T0 - T1 + CF - 1.  */
-static void gen_sub_carry(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_sub_carry(DisasContext *s, TCGv_i32 dest,
+                          TCGv_i32 t0, TCGv_i32 t1)
 {
+    arm_gen_compute_cc(s);
     tcg_gen_sub_i32(dest, t0, t1);
     tcg_gen_add_i32(dest, dest, cpu_CF);
     tcg_gen_subi_i32(dest, dest, 1);
 }
 
-/* dest = T0 + T1. Compute C, N, V and Z flags */
-static void gen_add_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+/* dest = T0 + T1.  Compute N and Z flags, C and V are left to
+ * arm_gen_compute_cc().
+ */
+static void gen_add_CC(DisasContext *s, TCGv_i32 dest,
+                       TCGv_i32 t0, TCGv_i32 t1)
 {
-    TCGv_i32 tmp = tcg_temp_new_i32();
-    tcg_gen_movi_i32(tmp, 0);
-    tcg_gen_add2_i32(cpu_NF, cpu_CF, t0, tmp, t1, tmp);
+    tcg_gen_mov_i32(cpu_CC_SRC, t1);
+    tcg_gen_add_i32(cpu_NF, t0, t1);
     tcg_gen_mov_i32(cpu_ZF, cpu_NF);
-    tcg_gen_xor_i32(cpu_VF, cpu_NF, t0);
-    tcg_gen_xor_i32(tmp, t0, t1);
-    tcg_gen_andc_i32(cpu_VF, cpu_VF, tmp);
-    tcg_temp_free_i32(tmp);
+    arm_gen_set_cc_op(s, ARM_CC_OP_ADD);
     tcg_gen_mov_i32(dest, cpu_NF);
 }
 
 /* dest = T0 + T1 + CF.  Compute C, N, V and Z flags */
-static void gen_adc_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_adc_CC(DisasContext *s, TCGv_i32 dest,
+                       TCGv_i32 t0, TCGv_i32 t1)
 {
     TCGv_i32 tmp = tcg_temp_new_i32();
+
+    arm_gen_compute_cc(s);
     if (TCG_TARGET_HAS_add2_i32) {
         tcg_gen_movi_i32(tmp, 0);
         tcg_gen_add2_i32(cpu_NF, cpu_CF, t0, tmp, cpu_CF, tmp);
@@ -462,27 +530,26 @@ static void gen_adc_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
     tcg_gen_mov_i32(dest, cpu_NF);
 }
 
-/* dest = T0 - T1. Compute C, N, V and Z flags */
-static void gen_sub_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+/* dest = T0 - T1.  Compute N and Z flags, C and V are left to
+ * arm_gen_compute_cc().
+ */
+static void gen_sub_CC(DisasContext *s, TCGv_i32 dest,
+                       TCGv_i32 t0, TCGv_i32 t1)
 {
-    TCGv_i32 tmp;
+    tcg_gen_mov_i32(cpu_CC_SRC, t1);
     tcg_gen_sub_i32(cpu_NF, t0, t1);
     tcg_gen_mov_i32(cpu_ZF, cpu_NF);
-    tcg_gen_setcond_i32(TCG_COND_GEU, cpu_CF, t0, t1);
-    tcg_gen_xor_i32(cpu_VF, cpu_NF, t0);
-    tmp = tcg_temp_new_i32();
-    tcg_gen_xor_i32(tmp, t0, t1);
-    tcg_gen_and_i32(cpu_VF, cpu_VF, tmp);
-    tcg_temp_free_i32(tmp);
+    arm_gen_set_cc_op(s, ARM_CC_OP_SUB);
     tcg_gen_mov_i32(dest, cpu_NF);
 }
 
 /* dest = T0 + ~T1 + CF.  Compute C, N, V and Z flags */
-static void gen_sbc_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_sbc_CC(DisasContext *s, TCGv_i32 dest,
+                       TCGv_i32 t0, TCGv_i32 t1)
 {
     TCGv_i32 tmp = tcg_temp_new_i32();
     tcg_gen_not_i32(tmp, t1);
-    gen_adc_CC(dest, t0, tmp);
+    gen_adc_CC(s, dest, t0, tmp);
     tcg_temp_free_i32(tmp);
 }
 
@@ -527,8 +594,9 @@ static void tcg_gen_abs_i32(TCGv_i32 dest, TCGv_i32 src)
     tcg_temp_free_i32(tmp);
 }
 
-static void shifter_out_im(TCGv_i32 var, int shift)
+static void shifter_out_im(DisasContext *s, TCGv_i32 var, int shift)
 {
+    arm_gen_compute_cc(s);
     if (shift == 0) {
         tcg_gen_andi_i32(cpu_CF, var, 1);
     } else {
@@ -540,26 +608,27 @@ static void shifter_out_im(TCGv_i32 var, int shift)
 }
 
 /* Shift by immediate.  Includes special handling for shift == 0.  */
-static inline void gen_arm_shift_im(TCGv_i32 var, int shiftop,
+static inline void gen_arm_shift_im(DisasContext *s, TCGv_i32 var, int shiftop,
                                     int shift, int flags)
 {
     switch (shiftop) {
     case 0: /* LSL */
         if (shift != 0) {
             if (flags)
-                shifter_out_im(var, 32 - shift);
+                shifter_out_im(s, var, 32 - shift);
             tcg_gen_shli_i32(var, var, shift);
         }
         break;
     case 1: /* LSR */
         if (shift == 0) {
             if (flags) {
+                arm_gen_compute_cc(s);
                 tcg_gen_shri_i32(cpu_CF, var, 31);
             }
             tcg_gen_movi_i32(var, 0);
         } else {
             if (flags)
-                shifter_out_im(var, shift - 1);
+                shifter_out_im(s, var, shift - 1);
             tcg_gen_shri_i32(var, var, shift);
         }
         break;
@@ -567,7 +636,7 @@ static inline void gen_arm_shift_im(TCGv_i32 var, int shiftop,
         if (shift == 0)
             shift = 32;
         if (flags)
-            shifter_out_im(var, shift - 1);
+            shifter_out_im(s, var, shift - 1);
         if (shift == 32)
           shift = 31;
         tcg_gen_sari_i32(var, var, shift);
@@ -575,13 +644,14 @@ static inline void gen_arm_shift_im(TCGv_i32 var, int shiftop,
     case 3: /* ROR/RRX */
         if (shift != 0) {
             if (flags)
-                shifter_out_im(var, shift - 1);
+                shifter_out_im(s, var, shift - 1);
             tcg_gen_rotri_i32(var, var, shift); break;
         } else {
             TCGv_i32 tmp = tcg_temp_new_i32();
+            arm_gen_compute_cc(s);
             tcg_gen_shli_i32(tmp, cpu_CF, 31);
             if (flags)
-                shifter_out_im(var, 0);
+                shifter_out_im(s, var, 0);
             tcg_gen_shri_i32(var, var, 1);
             tcg_gen_or_i32(var, var, tmp);
             tcg_temp_free_i32(tmp);
@@ -589,10 +659,12 @@ static inline void gen_arm_shift_im(TCGv_i32 var, int shiftop,
     }
 };
 
-static inline void gen_arm_shift_reg(TCGv_i32 var, int shiftop,
+static inline void gen_arm_shift_reg(DisasContext *s, TCGv_i32 var, int shiftop,
                                      TCGv_i32 shift, int flags)
 {
     if (flags) {
+        /* The helpers update env->CF, so V must be valid as well.  */
+        arm_gen_compute_cc(s);
         switch (shiftop) {
         case 0: gen_helper_shl_cc(var, cpu_env, var, shift); break;
         case 1: gen_helper_shr_cc(var, cpu_env, var, shift); break;
@@ -714,11 +786,15 @@ static void gen_thumb2_parallel_addsub(int op1, int op2, TCGv_i32 a, TCGv_i32 b)
  * generate a conditional branch based on ARM condition code cc.
  * This is common between ARM and Aarch64 targets.
  */
-void arm_gen_test_cc(int cc, int label)
+void arm_gen_test_cc(DisasContext *s, int cc, int label)
 {
     TCGv_i32 tmp;
     int inv;
 
+    /* eq, ne, mi and pl only look at Z and N.  */
+    if (cc != 0 && cc != 1 && cc != 4 && cc != 5) {
+        arm_gen_compute_cc(s);
+    }
     switch (cc) {
     case 0: /* eq: Z */
         tcg_gen_brcondi_i32(TCG_COND_EQ, cpu_ZF, 0, label);
@@ -825,7 +901,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 /* Set PC and Thumb state from var.  var is marked as dead.  */
 static inline void gen_bx(DisasContext *s, TCGv_i32 var)
 {
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     tcg_gen_andi_i32(cpu_R[15], var, ~1);
     tcg_gen_andi_i32(var, var, 1);
     store_cpu_field(var, thumb);
@@ -1025,7 +1101,7 @@ static inline void gen_add_data_offset(DisasContext *s, unsigned int insn,
         shift = (insn >> 7) & 0x1f;
         shiftop = (insn >> 5) & 3;
         offset = load_reg(s, rm);
-        gen_arm_shift_im(offset, shiftop, shift, 0);
+        gen_arm_shift_im(s, offset, shiftop, shift, 0);
         if (!(insn & (1 << 23)))
             tcg_gen_sub_i32(var, var, offset);
         else
@@ -1957,7 +2033,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
             break;
         }
         tcg_gen_shli_i32(tmp, tmp, 28);
-        gen_set_nzcv(tmp);
+        gen_set_nzcv(s, tmp);
         tcg_temp_free_i32(tmp);
         break;
     case 0x401: case 0x405: case 0x409: case 0x40d:	/* TBCST */
@@ -2005,7 +2081,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
             tcg_gen_and_i32(tmp, tmp, tmp2);
             break;
         }
-        gen_set_nzcv(tmp);
+        gen_set_nzcv(s, tmp);
         tcg_temp_free_i32(tmp2);
         tcg_temp_free_i32(tmp);
         break;
@@ -2053,7 +2129,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
             tcg_gen_or_i32(tmp, tmp, tmp2);
             break;
         }
-        gen_set_nzcv(tmp);
+        gen_set_nzcv(s, tmp);
         tcg_temp_free_i32(tmp2);
         tcg_temp_free_i32(tmp);
         break;
@@ -2983,6 +3059,7 @@ static int disas_vfp_v8_insn(DisasContext *s, uint32_t insn)
     }
 
     if ((insn & 0x0f800e50) == 0x0e000a00) {
+        arm_gen_compute_cc(s);
         return handle_vsel(insn, rd, rn, rm, dp);
     } else if ((insn & 0x0fb00e10) == 0x0e800a00) {
         return handle_vminmaxnm(insn, rd, rn, rm, dp);
@@ -3201,7 +3278,7 @@ static int disas_vfp_insn(DisasContext *s, uint32_t insn)
                     }
                     if (rd == 15) {
                         /* Set the 4 flag bits in the CPSR.  */
-                        gen_set_nzcv(tmp);
+                        gen_set_nzcv(s, tmp);
                         tcg_temp_free_i32(tmp);
                     } else {
                         store_reg(s, rd, tmp);
@@ -3929,7 +4006,7 @@ static inline void gen_goto_tb(DisasContext *s, int n, target_ulong dest)
         tcg_gen_exit_tb((uintptr_t)tb + n);
     } else {
         gen_set_pc_im(s, dest);
-        tcg_gen_exit_tb(0);
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
     }
 }
 
@@ -3940,6 +4017,13 @@ static inline void gen_jmp (DisasContext *s, uint32_t dest)
         if (s->thumb)
             dest |= 1;
         gen_bx_im(s, dest);
+    } else if ((s->tb->cflags & CF_HOT) && !s->thumb && !s->condjmp &&
+               dest > s->pc &&
+               (dest & TARGET_PAGE_MASK) == (s->tb->pc & TARGET_PAGE_MASK)) {
+        /* Hot TB: keep translating at the destination to form a
+           superblock.  Only forward jumps within the first page are
+           followed, so the TB still covers a single contiguous range.  */
+        s->pc = dest;
     } else {
         gen_goto_tb(s, 0, dest);
         s->is_jmp = DISAS_TB_JUMP;
@@ -4013,7 +4097,7 @@ static int gen_set_psr(DisasContext *s, uint32_t mask, int spsr, TCGv_i32 t0)
         tcg_gen_or_i32(tmp, tmp, t0);
         store_cpu_field(tmp, spsr);
     } else {
-        gen_set_cpsr(t0, mask);
+        gen_set_cpsr(s, t0, mask);
     }
     tcg_temp_free_i32(t0);
     gen_lookup_tb(s);
@@ -4035,7 +4119,7 @@ static void gen_exception_return(DisasContext *s, TCGv_i32 pc)
     TCGv_i32 tmp;
     store_reg(s, 15, pc);
     tmp = load_cpu_field(spsr);
-    gen_set_cpsr(tmp, CPSR_ERET_MASK);
+    gen_set_cpsr(s, tmp, CPSR_ERET_MASK);
     tcg_temp_free_i32(tmp);
     s->is_jmp = DISAS_UPDATE;
 }
@@ -4043,7 +4127,7 @@ static void gen_exception_return(DisasContext *s, TCGv_i32 pc)
 /* Generate a v6 exception return.  Marks both values as dead.  */
 static void gen_rfe(DisasContext *s, TCGv_i32 pc, TCGv_i32 cpsr)
 {
-    gen_set_cpsr(cpsr, CPSR_ERET_MASK);
+    gen_set_cpsr(s, cpsr, CPSR_ERET_MASK);
     tcg_temp_free_i32(cpsr);
     store_reg(s, 15, pc);
     s->is_jmp = DISAS_UPDATE;
@@ -5142,6 +5226,19 @@ static int disas_neon_data_insn(DisasContext *s, uint32_t insn)
             tcg_temp_free_i32(tmp3);
             return 0;
         }
+        if (op == NEON_3R_VADD_VSUB) {
+            /* Whole-register integer add/sub, expanded inline.  */
+            if (!u) {
+                tcg_gen_gvec_add(cpu_env, size, vfp_reg_offset(1, rd),
+                                 vfp_reg_offset(1, rn), vfp_reg_offset(1, rm),
+                                 q ? 16 : 8);
+            } else {
+                tcg_gen_gvec_sub(cpu_env, size, vfp_reg_offset(1, rd),
+                                 vfp_reg_offset(1, rn), vfp_reg_offset(1, rm),
+                                 q ? 16 : 8);
+            }
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -7216,7 +7313,7 @@ static int disas_coproc_insn(DisasContext *s, uint32_t insn)
                     /* Destination register of r15 for 32 bit loads sets
                      * the condition codes from the high 4 bits of the value
                      */
-                    gen_set_nzcv(tmp);
+                    gen_set_nzcv(s, tmp);
                     tcg_temp_free_i32(tmp);
                 } else {
                     store_reg(s, rt, tmp);
@@ -7340,8 +7437,9 @@ static void gen_addq(DisasContext *s, TCGv_i64 val, int rlow, int rhigh)
 }
 
 /* Set N and Z flags from hi|lo.  */
-static void gen_logicq_cc(TCGv_i32 lo, TCGv_i32 hi)
+static void gen_logicq_cc(DisasContext *s, TCGv_i32 lo, TCGv_i32 hi)
 {
+    arm_gen_compute_cc(s);
     tcg_gen_mov_i32(cpu_NF, hi);
     tcg_gen_or_i32(cpu_ZF, lo, hi);
 }
@@ -7772,8 +7870,9 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
         /* if not always execute, we generate a conditional jump to
            next instruction */
         s->condlabel = gen_new_label();
-        arm_gen_test_cc(cond ^ 1, s->condlabel);
+        arm_gen_test_cc(s, cond ^ 1, s->condlabel);
         s->condjmp = 1;
+        s->condlabel_cc_op = s->cc_op;
     }
     if ((insn & 0x0f900000) == 0x03000000) {
         if ((insn & (1 << 21)) == 0) {
@@ -8030,7 +8129,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             tmp2 = tcg_temp_new_i32();
             tcg_gen_movi_i32(tmp2, val);
             if (logic_cc && shift) {
-                gen_set_CF_bit31(tmp2);
+                gen_set_CF_bit31(s, tmp2);
             }
         } else {
             /* register */
@@ -8039,11 +8138,11 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             shiftop = (insn >> 5) & 3;
             if (!(insn & (1 << 4))) {
                 shift = (insn >> 7) & 0x1f;
-                gen_arm_shift_im(tmp2, shiftop, shift, logic_cc);
+                gen_arm_shift_im(s, tmp2, shiftop, shift, logic_cc);
             } else {
                 rs = (insn >> 8) & 0xf;
                 tmp = load_reg(s, rs);
-                gen_arm_shift_reg(tmp2, shiftop, tmp, logic_cc);
+                gen_arm_shift_reg(s, tmp2, shiftop, tmp, logic_cc);
             }
         }
         if (op1 != 0x0f && op1 != 0x0d) {
@@ -8057,14 +8156,14 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
         case 0x00:
             tcg_gen_and_i32(tmp, tmp, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             store_reg_bx(s, rd, tmp);
             break;
         case 0x01:
             tcg_gen_xor_i32(tmp, tmp, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             store_reg_bx(s, rd, tmp);
             break;
@@ -8074,11 +8173,11 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                 if (IS_USER(s)) {
                     goto illegal_op;
                 }
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
                 gen_exception_return(s, tmp);
             } else {
                 if (set_cc) {
-                    gen_sub_CC(tmp, tmp, tmp2);
+                    gen_sub_CC(s, tmp, tmp, tmp2);
                 } else {
                     tcg_gen_sub_i32(tmp, tmp, tmp2);
                 }
@@ -8087,7 +8186,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             break;
         case 0x03:
             if (set_cc) {
-                gen_sub_CC(tmp, tmp2, tmp);
+                gen_sub_CC(s, tmp, tmp2, tmp);
             } else {
                 tcg_gen_sub_i32(tmp, tmp2, tmp);
             }
@@ -8095,7 +8194,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             break;
         case 0x04:
             if (set_cc) {
-                gen_add_CC(tmp, tmp, tmp2);
+                gen_add_CC(s, tmp, tmp, tmp2);
             } else {
                 tcg_gen_add_i32(tmp, tmp, tmp2);
             }
@@ -8103,58 +8202,58 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             break;
         case 0x05:
             if (set_cc) {
-                gen_adc_CC(tmp, tmp, tmp2);
+                gen_adc_CC(s, tmp, tmp, tmp2);
             } else {
-                gen_add_carry(tmp, tmp, tmp2);
+                gen_add_carry(s, tmp, tmp, tmp2);
             }
             store_reg_bx(s, rd, tmp);
             break;
         case 0x06:
             if (set_cc) {
-                gen_sbc_CC(tmp, tmp, tmp2);
+                gen_sbc_CC(s, tmp, tmp, tmp2);
             } else {
-                gen_sub_carry(tmp, tmp, tmp2);
+                gen_sub_carry(s, tmp, tmp, tmp2);
             }
             store_reg_bx(s, rd, tmp);
             break;
         case 0x07:
             if (set_cc) {
-                gen_sbc_CC(tmp, tmp2, tmp);
+                gen_sbc_CC(s, tmp, tmp2, tmp);
             } else {
-                gen_sub_carry(tmp, tmp2, tmp);
+                gen_sub_carry(s, tmp, tmp2, tmp);
             }
             store_reg_bx(s, rd, tmp);
             break;
         case 0x08:
             if (set_cc) {
                 tcg_gen_and_i32(tmp, tmp, tmp2);
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             tcg_temp_free_i32(tmp);
             break;
         case 0x09:
             if (set_cc) {
                 tcg_gen_xor_i32(tmp, tmp, tmp2);
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             tcg_temp_free_i32(tmp);
             break;
         case 0x0a:
             if (set_cc) {
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
             }
             tcg_temp_free_i32(tmp);
             break;
         case 0x0b:
             if (set_cc) {
-                gen_add_CC(tmp, tmp, tmp2);
+                gen_add_CC(s, tmp, tmp, tmp2);
             }
             tcg_temp_free_i32(tmp);
             break;
         case 0x0c:
             tcg_gen_or_i32(tmp, tmp, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             store_reg_bx(s, rd, tmp);
             break;
@@ -8167,7 +8266,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                 gen_exception_return(s, tmp2);
             } else {
                 if (logic_cc) {
-                    gen_logic_CC(tmp2);
+                    gen_logic_CC(s, tmp2);
                 }
                 store_reg_bx(s, rd, tmp2);
             }
@@ -8175,7 +8274,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
         case 0x0e:
             tcg_gen_andc_i32(tmp, tmp, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             store_reg_bx(s, rd, tmp);
             break;
@@ -8183,7 +8282,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
         case 0x0f:
             tcg_gen_not_i32(tmp2, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             store_reg_bx(s, rd, tmp2);
             break;
@@ -8226,7 +8325,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                             tcg_temp_free_i32(tmp2);
                         }
                         if (insn & (1 << 20))
-                            gen_logic_CC(tmp);
+                            gen_logic_CC(s, tmp);
                         store_reg(s, rd, tmp);
                         break;
                     case 4:
@@ -8258,7 +8357,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                             tcg_temp_free_i32(ah);
                         }
                         if (insn & (1 << 20)) {
-                            gen_logicq_cc(tmp, tmp2);
+                            gen_logicq_cc(s, tmp, tmp2);
                         }
                         store_reg(s, rn, tmp);
                         store_reg(s, rd, tmp2);
@@ -8941,7 +9040,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                 if ((insn & (1 << 22)) && !user) {
                     /* Restore CPSR from SPSR.  */
                     tmp = load_cpu_field(spsr);
-                    gen_set_cpsr(tmp, CPSR_ERET_MASK);
+                    gen_set_cpsr(s, tmp, CPSR_ERET_MASK);
                     tcg_temp_free_i32(tmp);
                     s->is_jmp = DISAS_UPDATE;
                 }
@@ -9034,32 +9133,32 @@ gen_thumb2_data_op(DisasContext *s, int op, int conds, uint32_t shifter_out,
         break;
     case 8: /* add */
         if (conds)
-            gen_add_CC(t0, t0, t1);
+            gen_add_CC(s, t0, t0, t1);
         else
             tcg_gen_add_i32(t0, t0, t1);
         break;
     case 10: /* adc */
         if (conds)
-            gen_adc_CC(t0, t0, t1);
+            gen_adc_CC(s, t0, t0, t1);
         else
-            gen_adc(t0, t1);
+            gen_adc(s, t0, t1);
         break;
     case 11: /* sbc */
         if (conds) {
-            gen_sbc_CC(t0, t0, t1);
+            gen_sbc_CC(s, t0, t0, t1);
         } else {
-            gen_sub_carry(t0, t0, t1);
+            gen_sub_carry(s, t0, t0, t1);
         }
         break;
     case 13: /* sub */
         if (conds)
-            gen_sub_CC(t0, t0, t1);
+            gen_sub_CC(s, t0, t0, t1);
         else
             tcg_gen_sub_i32(t0, t0, t1);
         break;
     case 14: /* rsb */
         if (conds)
-            gen_sub_CC(t0, t1, t0);
+            gen_sub_CC(s, t0, t1, t0);
         else
             tcg_gen_sub_i32(t0, t1, t0);
         break;
@@ -9067,9 +9166,9 @@ gen_thumb2_data_op(DisasContext *s, int op, int conds, uint32_t shifter_out,
         return 1;
     }
     if (logic_cc) {
-        gen_logic_CC(t0);
+        gen_logic_CC(s, t0);
         if (shifter_out)
-            gen_set_CF_bit31(t1);
+            gen_set_CF_bit31(s, t1);
     }
     return 0;
 }
@@ -9427,7 +9526,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             shift = ((insn >> 6) & 3) | ((insn >> 10) & 0x1c);
             conds = (insn & (1 << 20)) != 0;
             logic_cc = (conds && thumb2_logic_op(op));
-            gen_arm_shift_im(tmp2, shiftop, shift, logic_cc);
+            gen_arm_shift_im(s, tmp2, shiftop, shift, logic_cc);
             if (gen_thumb2_data_op(s, op, conds, 0, tmp, tmp2))
                 goto illegal_op;
             tcg_temp_free_i32(tmp2);
@@ -9450,9 +9549,9 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                 goto illegal_op;
             op = (insn >> 21) & 3;
             logic_cc = (insn & (1 << 20)) != 0;
-            gen_arm_shift_reg(tmp, op, tmp2, logic_cc);
+            gen_arm_shift_reg(s, tmp, op, tmp2, logic_cc);
             if (logic_cc)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             store_reg_bx(s, rd, tmp);
             break;
         case 1: /* Sign/zero extend.  */
@@ -9912,8 +10011,9 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                 op = (insn >> 22) & 0xf;
                 /* Generate a conditional jump to next instruction.  */
                 s->condlabel = gen_new_label();
-                arm_gen_test_cc(op ^ 1, s->condlabel);
+                arm_gen_test_cc(s, op ^ 1, s->condlabel);
                 s->condjmp = 1;
+                s->condlabel_cc_op = s->cc_op;
 
                 /* offset[11:1] = insn[10:0] */
                 offset = (insn & 0x7ff) << 1;
@@ -10270,8 +10370,9 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         cond = s->condexec_cond;
         if (cond != 0x0e) {     /* Skip conditional when condition is AL. */
           s->condlabel = gen_new_label();
-          arm_gen_test_cc(cond ^ 1, s->condlabel);
+          arm_gen_test_cc(s, cond ^ 1, s->condlabel);
           s->condjmp = 1;
+          s->condlabel_cc_op = s->cc_op;
         }
     }
 
@@ -10300,12 +10401,12 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                 if (s->condexec_mask)
                     tcg_gen_sub_i32(tmp, tmp, tmp2);
                 else
-                    gen_sub_CC(tmp, tmp, tmp2);
+                    gen_sub_CC(s, tmp, tmp, tmp2);
             } else {
                 if (s->condexec_mask)
                     tcg_gen_add_i32(tmp, tmp, tmp2);
                 else
-                    gen_add_CC(tmp, tmp, tmp2);
+                    gen_add_CC(s, tmp, tmp, tmp2);
             }
             tcg_temp_free_i32(tmp2);
             store_reg(s, rd, tmp);
@@ -10314,9 +10415,9 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             rm = (insn >> 3) & 7;
             shift = (insn >> 6) & 0x1f;
             tmp = load_reg(s, rm);
-            gen_arm_shift_im(tmp, op, shift, s->condexec_mask == 0);
+            gen_arm_shift_im(s, tmp, op, shift, s->condexec_mask == 0);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             store_reg(s, rd, tmp);
         }
         break;
@@ -10328,7 +10429,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = tcg_temp_new_i32();
             tcg_gen_movi_i32(tmp, insn & 0xff);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             store_reg(s, rd, tmp);
         } else {
             tmp = load_reg(s, rd);
@@ -10336,7 +10437,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tcg_gen_movi_i32(tmp2, insn & 0xff);
             switch (op) {
             case 1: /* cmp */
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
                 tcg_temp_free_i32(tmp);
                 tcg_temp_free_i32(tmp2);
                 break;
@@ -10344,7 +10445,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                 if (s->condexec_mask)
                     tcg_gen_add_i32(tmp, tmp, tmp2);
                 else
-                    gen_add_CC(tmp, tmp, tmp2);
+                    gen_add_CC(s, tmp, tmp, tmp2);
                 tcg_temp_free_i32(tmp2);
                 store_reg(s, rd, tmp);
                 break;
@@ -10352,7 +10453,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                 if (s->condexec_mask)
                     tcg_gen_sub_i32(tmp, tmp, tmp2);
                 else
-                    gen_sub_CC(tmp, tmp, tmp2);
+                    gen_sub_CC(s, tmp, tmp, tmp2);
                 tcg_temp_free_i32(tmp2);
                 store_reg(s, rd, tmp);
                 break;
@@ -10389,7 +10490,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             case 1: /* cmp */
                 tmp = load_reg(s, rd);
                 tmp2 = load_reg(s, rm);
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
                 tcg_temp_free_i32(tmp2);
                 tcg_temp_free_i32(tmp);
                 break;
@@ -10441,49 +10542,53 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 0x0: /* and */
             tcg_gen_and_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0x1: /* eor */
             tcg_gen_xor_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0x2: /* lsl */
             if (s->condexec_mask) {
                 gen_shl(tmp2, tmp2, tmp);
             } else {
+                /* A zero shift leaves CF alone, so it must be valid */
+                arm_gen_compute_cc(s);
                 gen_helper_shl_cc(tmp2, cpu_env, tmp2, tmp);
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             break;
         case 0x3: /* lsr */
             if (s->condexec_mask) {
                 gen_shr(tmp2, tmp2, tmp);
             } else {
+                arm_gen_compute_cc(s);
                 gen_helper_shr_cc(tmp2, cpu_env, tmp2, tmp);
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             break;
         case 0x4: /* asr */
             if (s->condexec_mask) {
                 gen_sar(tmp2, tmp2, tmp);
             } else {
+                arm_gen_compute_cc(s);
                 gen_helper_sar_cc(tmp2, cpu_env, tmp2, tmp);
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             break;
         case 0x5: /* adc */
             if (s->condexec_mask) {
-                gen_adc(tmp, tmp2);
+                gen_adc(s, tmp, tmp2);
             } else {
-                gen_adc_CC(tmp, tmp, tmp2);
+                gen_adc_CC(s, tmp, tmp, tmp2);
             }
             break;
         case 0x6: /* sbc */
             if (s->condexec_mask) {
-                gen_sub_carry(tmp, tmp, tmp2);
+                gen_sub_carry(s, tmp, tmp, tmp2);
             } else {
-                gen_sbc_CC(tmp, tmp, tmp2);
+                gen_sbc_CC(s, tmp, tmp, tmp2);
             }
             break;
         case 0x7: /* ror */
@@ -10491,48 +10596,49 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                 tcg_gen_andi_i32(tmp, tmp, 0x1f);
                 tcg_gen_rotr_i32(tmp2, tmp2, tmp);
             } else {
+                arm_gen_compute_cc(s);
                 gen_helper_ror_cc(tmp2, cpu_env, tmp2, tmp);
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             break;
         case 0x8: /* tst */
             tcg_gen_and_i32(tmp, tmp, tmp2);
-            gen_logic_CC(tmp);
+            gen_logic_CC(s, tmp);
             rd = 16;
             break;
         case 0x9: /* neg */
             if (s->condexec_mask)
                 tcg_gen_neg_i32(tmp, tmp2);
             else
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
             break;
         case 0xa: /* cmp */
-            gen_sub_CC(tmp, tmp, tmp2);
+            gen_sub_CC(s, tmp, tmp, tmp2);
             rd = 16;
             break;
         case 0xb: /* cmn */
-            gen_add_CC(tmp, tmp, tmp2);
+            gen_add_CC(s, tmp, tmp, tmp2);
             rd = 16;
             break;
         case 0xc: /* orr */
             tcg_gen_or_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0xd: /* mul */
             tcg_gen_mul_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0xe: /* bic */
             tcg_gen_andc_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0xf: /* mvn */
             tcg_gen_not_i32(tmp2, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             val = 1;
             rm = rd;
             break;
@@ -10796,6 +10902,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = load_reg(s, rm);
             s->condlabel = gen_new_label();
             s->condjmp = 1;
+            s->condlabel_cc_op = s->cc_op;
             if (insn & (1 << 11))
                 tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, s->condlabel);
             else
@@ -10947,8 +11054,9 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         }
         /* generate a conditional jump to next instruction */
         s->condlabel = gen_new_label();
-        arm_gen_test_cc(cond ^ 1, s->condlabel);
+        arm_gen_test_cc(s, cond ^ 1, s->condlabel);
         s->condjmp = 1;
+        s->condlabel_cc_op = s->cc_op;
 
         /* jump to the offset */
         val = (uint32_t)s->pc + 2;
@@ -11022,6 +11130,7 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
     dc->pc = pc_start;
     dc->singlestep_enabled = cs->singlestep_enabled;
     dc->condjmp = 0;
+    dc->cc_op = ARM_CC_OP_DYNAMIC;
 
     dc->aarch64 = 0;
     dc->thumb = ARM_TBFLAG_THUMB(tb->flags);
@@ -11075,7 +11184,7 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
     if (max_insns == 0)
         max_insns = CF_COUNT_MASK;
 
-    gen_tb_start();
+    gen_tb_start(tb);
 
     tcg_clear_temp_count();
 
@@ -11204,6 +11313,10 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
         if (dc->condjmp && !dc->is_jmp) {
             gen_set_label(dc->condlabel);
             dc->condjmp = 0;
+            if (dc->cc_op != dc->condlabel_cc_op) {
+                /* Only one of the two paths changed the flag state.  */
+                dc->cc_op = ARM_CC_OP_DYNAMIC;
+            }
         }
 
         if (tcg_check_temp_count()) {
@@ -11290,8 +11403,11 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
-        default:
         case DISAS_JUMP:
+            /* find the next TB from generated code, if possible */
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
+            break;
+        default:
         case DISAS_UPDATE:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
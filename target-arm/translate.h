@@ -10,9 +10,13 @@ typedef struct DisasContext {
     int condjmp;
     /* The label that will be jumped to when the instruction is skipped.  */
     int condlabel;
+    /* cc_op at condlabel, to merge the two paths of a conditional insn.  */
+    int condlabel_cc_op;
     /* Thumb-2 conditional execution bits.  */
     int condexec_mask;
     int condexec_cond;
+    /* ARM_CC_OP_* state of CF and VF, as known at translation time.  */
+    int cc_op;
     struct TranslationBlock *tb;
     int singlestep_enabled;
     int thumb;
@@ -60,6 +64,8 @@ typedef struct DisasContext {
 } DisasContext;
 
 extern TCGv_ptr cpu_env;
+extern TCGv_i32 cpu_NF, cpu_ZF, cpu_CF, cpu_VF;
+extern TCGv_i32 cpu_CC_OP, cpu_CC_SRC;
 
 static inline int arm_dc_feature(DisasContext *dc, int feature)
 {
@@ -117,6 +123,8 @@ static inline void aarch64_cpu_dump_state(CPUState *cs, FILE *f,
 }
 #endif
 
-void arm_gen_test_cc(int cc, int label);
+void arm_gen_test_cc(DisasContext *s, int cc, int label);
+void arm_gen_set_cc_op(DisasContext *s, int op);
+void arm_gen_compute_cc(DisasContext *s);
 
 #endif /* TARGET_ARM_TRANSLATE_H */
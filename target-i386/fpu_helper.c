@@ -1287,6 +1287,16 @@ void helper_movq(CPUX86State *env, void *d, void *s)
     *(uint64_t *)d = *(uint64_t *)s;
 }
 
+/* The intrinsics used by ops_sse.h's AES-NI and PCLMULQDQ helpers.  Older
+ * compilers only allow including this with the target features enabled.
+ */
+#ifdef CONFIG_AESNI_OPT
+#pragma GCC push_options
+#pragma GCC target("aes,pclmul")
+#include <wmmintrin.h>
+#pragma GCC pop_options
+#endif
+
 #define SHIFT 0
 #include "ops_sse.h"
 
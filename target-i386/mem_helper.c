@@ -106,6 +106,124 @@ void helper_boundl(CPUX86State *env, target_ulong a0, int v)
     }
 }
 
+/* REP MOVS/STOS fast path.  These are called with the linear address(es)
+   of the next element, before the generic code runs that iteration.  The
+   iterations after it that stay within the current page of each operand
+   are done here with host memory operations, provided the TLB maps those
+   pages to RAM without any watchpoint or dirty tracking.  At least one
+   iteration is left to the generic code, which takes care of faults and
+   of ECX reaching zero.  Only DF = 0 is handled.  */
+
+static void *rep_host_addr(CPUX86State *env, target_ulong addr, int is_write)
+{
+#if defined(CONFIG_USER_ONLY)
+    return NULL;
+#else
+    return tlb_vaddr_to_host(env, addr, is_write, cpu_mmu_index(env));
+#endif
+}
+
+/* Number of whole elements, at most max, from addr to the end of its page
+   without the register holding its offset wrapping around.  */
+static target_ulong rep_block_count(target_ulong addr, target_ulong reg,
+                                    target_ulong amask, int size,
+                                    target_ulong max)
+{
+    target_ulong room = TARGET_PAGE_SIZE - (addr & ~TARGET_PAGE_MASK);
+
+    if (amask != (target_ulong)-1 && room > amask - (reg & amask) + 1) {
+        room = amask - (reg & amask) + 1;
+    }
+    return MIN(room / size, max);
+}
+
+static void rep_add_reg(CPUX86State *env, int reg, target_ulong amask,
+                        target_ulong v)
+{
+    if (amask == 0xffff) {
+        env->regs[reg] = (env->regs[reg] & ~amask) |
+                         ((env->regs[reg] + v) & amask);
+    } else {
+        /* 32-bit results are zero-extended, as in gen_op_mov_reg_v() */
+        env->regs[reg] = (env->regs[reg] + v) & amask;
+    }
+}
+
+void helper_rep_movs(CPUX86State *env, target_ulong src, target_ulong dst,
+                     int ot, target_ulong amask)
+{
+    target_ulong count = env->regs[R_ECX] & amask;
+    target_ulong n, len;
+    uint8_t *hs, *hd;
+
+    if (env->df != 1 || count < 2) {
+        return;
+    }
+    n = rep_block_count(src, env->regs[R_ESI], amask, 1 << ot, count - 1);
+    n = rep_block_count(dst, env->regs[R_EDI], amask, 1 << ot, n);
+    if (n == 0) {
+        return;
+    }
+    hs = rep_host_addr(env, src, 0);
+    hd = rep_host_addr(env, dst, 1);
+    if (!hs || !hd) {
+        return;
+    }
+    len = n << ot;
+    if (hd > hs && hd < hs + len) {
+        /* an element by element copy would replicate the start of the
+           source, which memmove does not do */
+        return;
+    }
+    memmove(hd, hs, len);
+    rep_add_reg(env, R_ESI, amask, len);
+    rep_add_reg(env, R_EDI, amask, len);
+    rep_add_reg(env, R_ECX, amask, -n);
+}
+
+void helper_rep_stos(CPUX86State *env, target_ulong dst, int ot,
+                     target_ulong amask)
+{
+    target_ulong count = env->regs[R_ECX] & amask;
+    target_ulong val = env->regs[R_EAX];
+    target_ulong n, i;
+    uint8_t *hd;
+
+    if (env->df != 1 || count < 2) {
+        return;
+    }
+    n = rep_block_count(dst, env->regs[R_EDI], amask, 1 << ot, count - 1);
+    if (n == 0) {
+        return;
+    }
+    hd = rep_host_addr(env, dst, 1);
+    if (!hd) {
+        return;
+    }
+    switch (ot) {
+    case 0:
+        memset(hd, val, n);
+        break;
+    case 1:
+        for (i = 0; i < n; i++) {
+            stw_le_p(hd + 2 * i, val);
+        }
+        break;
+    case 2:
+        for (i = 0; i < n; i++) {
+            stl_le_p(hd + 4 * i, val);
+        }
+        break;
+    default:
+        for (i = 0; i < n; i++) {
+            stq_le_p(hd + 8 * i, val);
+        }
+        break;
+    }
+    rep_add_reg(env, R_EDI, amask, n << ot);
+    rep_add_reg(env, R_ECX, amask, -n);
+}
+
 #if !defined(CONFIG_USER_ONLY)
 /* try to fill the TLB and return an exception if error. If retaddr is
  * NULL, it means that the function was called in C code (i.e. not
@@ -19,6 +19,7 @@
  */
 
 #include "qemu/aes.h"
+#include "qemu/crc32c.h"
 
 #if SHIFT == 0
 #define Reg MMXReg
@@ -2143,18 +2144,14 @@ void glue(helper_pcmpistrm, SUFFIX)(CPUX86State *env, Reg *d, Reg *s,
     }
 }
 
-#define CRCPOLY        0x1edc6f41
-#define CRCPOLY_BITREV 0x82f63b78
 target_ulong helper_crc32(uint32_t crc1, target_ulong msg, uint32_t len)
 {
-    target_ulong crc = (msg & ((target_ulong) -1 >>
-                               (TARGET_LONG_BITS - len))) ^ crc1;
+    uint8_t buf[8];
 
-    while (len--) {
-        crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_BITREV : 0);
-    }
-
-    return crc;
+    /* crc32c() is the same CRC, table driven or with the host's CRC32
+     * instruction, but inverts its result */
+    stq_le_p(buf, msg);
+    return crc32c(crc1, buf, len / 8) ^ 0xffffffff;
 }
 
 #define POPMASK(i)     ((target_ulong) -1 / ((1LL << (1 << i)) + 1))
@@ -2183,11 +2180,76 @@ target_ulong helper_popcnt(CPUX86State *env, target_ulong n, uint32_t type)
 #endif
 }
 
+#ifdef CONFIG_AESNI_OPT
+#pragma GCC push_options
+#pragma GCC target("aes,pclmul")
+
+/*
+ * With AES-NI and PCLMULQDQ on the host, the helpers below just run the
+ * guest instruction; an x86 host lays out XMMReg like the guest register.
+ */
+#define HOST_XMM(r) _mm_loadu_si128((__m128i *)(r))
+
+static void host_pclmulqdq(Reg *d, Reg *s, uint32_t ctrl)
+{
+    __m128i a = _mm_set_epi64x(0, d->Q((ctrl & 1) != 0));
+    __m128i b = _mm_set_epi64x(0, s->Q((ctrl & 16) != 0));
+
+    _mm_storeu_si128((__m128i *)d, _mm_clmulepi64_si128(a, b, 0));
+}
+
+static void host_aesdec(Reg *d, Reg *s)
+{
+    _mm_storeu_si128((__m128i *)d, _mm_aesdec_si128(HOST_XMM(d), HOST_XMM(s)));
+}
+
+static void host_aesdeclast(Reg *d, Reg *s)
+{
+    _mm_storeu_si128((__m128i *)d,
+                     _mm_aesdeclast_si128(HOST_XMM(d), HOST_XMM(s)));
+}
+
+static void host_aesenc(Reg *d, Reg *s)
+{
+    _mm_storeu_si128((__m128i *)d, _mm_aesenc_si128(HOST_XMM(d), HOST_XMM(s)));
+}
+
+static void host_aesenclast(Reg *d, Reg *s)
+{
+    _mm_storeu_si128((__m128i *)d,
+                     _mm_aesenclast_si128(HOST_XMM(d), HOST_XMM(s)));
+}
+
+static void host_aesimc(Reg *d, Reg *s)
+{
+    _mm_storeu_si128((__m128i *)d, _mm_aesimc_si128(HOST_XMM(s)));
+}
+
+/* The round constant must be an immediate, so xor it in afterwards */
+static void host_aeskeygenassist(Reg *d, Reg *s, uint32_t ctrl)
+{
+    __m128i r = _mm_aeskeygenassist_si128(HOST_XMM(s), 0);
+
+    _mm_storeu_si128((__m128i *)d,
+                     _mm_xor_si128(r, _mm_set_epi32(ctrl, 0, ctrl, 0)));
+}
+
+#undef HOST_XMM
+#pragma GCC pop_options
+#endif
+
 void glue(helper_pclmulqdq, SUFFIX)(CPUX86State *env, Reg *d, Reg *s,
                                     uint32_t ctrl)
 {
     uint64_t ah, al, b, resh, resl;
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_pclmul()) {
+        host_pclmulqdq(d, s, ctrl);
+        return;
+    }
+#endif
+
     ah = 0;
     al = d->Q((ctrl & 1) != 0);
     b = s->Q((ctrl & 16) != 0);
@@ -2213,6 +2275,13 @@ void glue(helper_aesdec, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     Reg st = *d;
     Reg rk = *s;
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_aes()) {
+        host_aesdec(d, s);
+        return;
+    }
+#endif
+
     for (i = 0 ; i < 4 ; i++) {
         d->L(i) = rk.L(i) ^ bswap32(AES_Td0[st.B(AES_ishifts[4*i+0])] ^
                                     AES_Td1[st.B(AES_ishifts[4*i+1])] ^
@@ -2227,6 +2296,13 @@ void glue(helper_aesdeclast, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     Reg st = *d;
     Reg rk = *s;
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_aes()) {
+        host_aesdeclast(d, s);
+        return;
+    }
+#endif
+
     for (i = 0; i < 16; i++) {
         d->B(i) = rk.B(i) ^ (AES_Td4[st.B(AES_ishifts[i])] & 0xff);
     }
@@ -2238,6 +2314,13 @@ void glue(helper_aesenc, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     Reg st = *d;
     Reg rk = *s;
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_aes()) {
+        host_aesenc(d, s);
+        return;
+    }
+#endif
+
     for (i = 0 ; i < 4 ; i++) {
         d->L(i) = rk.L(i) ^ bswap32(AES_Te0[st.B(AES_shifts[4*i+0])] ^
                                     AES_Te1[st.B(AES_shifts[4*i+1])] ^
@@ -2252,6 +2335,13 @@ void glue(helper_aesenclast, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     Reg st = *d;
     Reg rk = *s;
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_aes()) {
+        host_aesenclast(d, s);
+        return;
+    }
+#endif
+
     for (i = 0; i < 16; i++) {
         d->B(i) = rk.B(i) ^ (AES_Te4[st.B(AES_shifts[i])] & 0xff);
     }
@@ -2263,6 +2353,13 @@ void glue(helper_aesimc, SUFFIX)(CPUX86State *env, Reg *d, Reg *s)
     int i;
     Reg tmp = *s;
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_aes()) {
+        host_aesimc(d, s);
+        return;
+    }
+#endif
+
     for (i = 0 ; i < 4 ; i++) {
         d->L(i) = bswap32(AES_Td0[AES_Te4[tmp.B(4*i+0)] & 0xff] ^
                           AES_Td1[AES_Te4[tmp.B(4*i+1)] & 0xff] ^
@@ -2277,6 +2374,13 @@ void glue(helper_aeskeygenassist, SUFFIX)(CPUX86State *env, Reg *d, Reg *s,
     int i;
     Reg tmp = *s;
 
+#ifdef CONFIG_AESNI_OPT
+    if (qemu_cpu_has_aes()) {
+        host_aeskeygenassist(d, s, ctrl);
+        return;
+    }
+#endif
+
     for (i = 0 ; i < 4 ; i++) {
         d->B(i) = AES_Te4[tmp.B(i + 4)] & 0xff;
         d->B(i + 8) = AES_Te4[tmp.B(i + 12)] & 0xff;
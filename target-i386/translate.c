@@ -27,6 +27,7 @@
 #include "cpu.h"
 #include "disas/disas.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 
 #include "exec/helper-proto.h"
@@ -128,6 +129,7 @@ typedef struct DisasContext {
 } DisasContext;
 
 static void gen_eob(DisasContext *s);
+static void gen_jr(DisasContext *s);
 static void gen_jmp(DisasContext *s, target_ulong eip);
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num);
 static void gen_op(DisasContext *s1, int op, TCGMemOp ot, int d);
@@ -1202,6 +1204,44 @@ static inline void gen_outs(DisasContext *s, TCGMemOp ot)
         gen_io_end();
 }
 
+static inline TCGv gen_rep_addr_mask(DisasContext *s)
+{
+    switch (s->aflag) {
+    case MO_16:
+        return tcg_const_tl(0xffff);
+    case MO_32:
+        return tcg_const_tl(0xffffffff);
+    default:
+        return tcg_const_tl(-1);
+    }
+}
+
+static inline void gen_rep_block_movs(DisasContext *s, TCGMemOp ot)
+{
+#ifndef CONFIG_USER_ONLY
+    TCGv src = tcg_temp_new();
+    TCGv amask = gen_rep_addr_mask(s);
+
+    gen_string_movl_A0_ESI(s);
+    tcg_gen_mov_tl(src, cpu_A0);
+    gen_string_movl_A0_EDI(s);
+    gen_helper_rep_movs(cpu_env, src, cpu_A0, tcg_const_i32(ot), amask);
+    tcg_temp_free(amask);
+    tcg_temp_free(src);
+#endif
+}
+
+static inline void gen_rep_block_stos(DisasContext *s, TCGMemOp ot)
+{
+#ifndef CONFIG_USER_ONLY
+    TCGv amask = gen_rep_addr_mask(s);
+
+    gen_string_movl_A0_EDI(s);
+    gen_helper_rep_stos(cpu_env, cpu_A0, tcg_const_i32(ot), amask);
+    tcg_temp_free(amask);
+#endif
+}
+
 /* same method as Valgrind : we generate jumps to current or next
    instruction */
 #define GEN_REPZ(op)                                                          \
@@ -1220,6 +1260,28 @@ static inline void gen_repz_ ## op(DisasContext *s, TCGMemOp ot,              \
     gen_jmp(s, cur_eip);                                                      \
 }
 
+/* Same, but first let a helper run the iterations that stay within the
+   current page(s) with host memory operations.  Single-stepping needs a
+   trap after each iteration, so it keeps the plain loop.  */
+#define GEN_REPZ_BLOCK(op)                                                    \
+static inline void gen_repz_ ## op(DisasContext *s, TCGMemOp ot,              \
+                                 target_ulong cur_eip, target_ulong next_eip) \
+{                                                                             \
+    int l2;\
+    gen_update_cc_op(s);                                                      \
+    l2 = gen_jz_ecx_string(s, next_eip);                                      \
+    if (s->jmp_opt) {                                                         \
+        gen_rep_block_ ## op(s, ot);                                          \
+    }                                                                         \
+    gen_ ## op(s, ot);                                                        \
+    gen_op_add_reg_im(s->aflag, R_ECX, -1);                                   \
+    /* a loop would cause two single step exceptions if ECX = 1               \
+       before rep string_insn */                                              \
+    if (!s->jmp_opt)                                                          \
+        gen_op_jz_ecx(s->aflag, l2);                                          \
+    gen_jmp(s, cur_eip);                                                      \
+}
+
 #define GEN_REPZ2(op)                                                         \
 static inline void gen_repz_ ## op(DisasContext *s, TCGMemOp ot,              \
                                    target_ulong cur_eip,                      \
@@ -1238,8 +1300,8 @@ static inline void gen_repz_ ## op(DisasContext *s, TCGMemOp ot,              \
     gen_jmp(s, cur_eip);                                                      \
 }
 
-GEN_REPZ(movs)
-GEN_REPZ(stos)
+GEN_REPZ_BLOCK(movs)
+GEN_REPZ_BLOCK(stos)
 GEN_REPZ(lods)
 GEN_REPZ(ins)
 GEN_REPZ(outs)
@@ -2213,9 +2275,9 @@ static inline void gen_goto_tb(DisasContext *s, int tb_num, target_ulong eip)
         gen_jmp_im(eip);
         tcg_gen_exit_tb((uintptr_t)tb + tb_num);
     } else {
-        /* jump to another page: currently not optimized */
+        /* jump to another page: look the TB up from generated code */
         gen_jmp_im(eip);
-        gen_eob(s);
+        gen_jr(s);
     }
 }
 
@@ -2543,11 +2605,16 @@ static void gen_debug(DisasContext *s, target_ulong cur_eip)
 
 /* generate a generic end of block. Trace exception is also generated
    if needed */
-static void gen_eob(DisasContext *s)
+/* End of block.  If JR, try to chain to the next TB from generated code
+   through the jump cache instead of going back to the main loop.  That is
+   not done after an interrupt shadow, so that pending interrupts are taken
+   as soon as it ends.  */
+static void do_gen_eob_worker(DisasContext *s, bool jr)
 {
     gen_update_cc_op(s);
     if (s->tb->flags & HF_INHIBIT_IRQ_MASK) {
         gen_helper_reset_inhibit_irq(cpu_env);
+        jr = false;
     }
     if (s->tb->flags & HF_RF_MASK) {
         gen_helper_reset_rf(cpu_env);
@@ -2556,12 +2623,25 @@ static void gen_eob(DisasContext *s)
         gen_helper_debug(cpu_env);
     } else if (s->tf) {
         gen_helper_single_step(cpu_env);
+    } else if (jr) {
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
     } else {
         tcg_gen_exit_tb(0);
     }
     s->is_jmp = DISAS_TB_JUMP;
 }
 
+static void gen_eob(DisasContext *s)
+{
+    do_gen_eob_worker(s, false);
+}
+
+/* End of block, jumping to the eip previously stored in env */
+static void gen_jr(DisasContext *s)
+{
+    do_gen_eob_worker(s, true);
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -2970,6 +3050,49 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* Expand the simple integer vector ops inline rather than calling their
+   helper.  Returns false if B is not one of them.  */
+static bool gen_sse_gvec(int b, uint32_t oprsz, int op1_offset, int op2_offset)
+{
+    switch (b) {
+    case 0x54: /* andps, andpd */
+    case 0xdb: /* pand */
+        tcg_gen_gvec_and(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        return true;
+    case 0x55: /* andnps, andnpd */
+    case 0xdf: /* pandn */
+        tcg_gen_gvec_andc(cpu_env, op1_offset, op2_offset, op1_offset, oprsz);
+        return true;
+    case 0x56: /* orps, orpd */
+    case 0xeb: /* por */
+        tcg_gen_gvec_or(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        return true;
+    case 0x57: /* xorps, xorpd */
+    case 0xef: /* pxor */
+        tcg_gen_gvec_xor(cpu_env, op1_offset, op1_offset, op2_offset, oprsz);
+        return true;
+    case 0xfc: /* paddb */
+    case 0xfd: /* paddw */
+    case 0xfe: /* paddl */
+        tcg_gen_gvec_add(cpu_env, b - 0xfc, op1_offset, op1_offset,
+                         op2_offset, oprsz);
+        return true;
+    case 0xd4: /* paddq */
+        tcg_gen_gvec_add(cpu_env, MO_64, op1_offset, op1_offset,
+                         op2_offset, oprsz);
+        return true;
+    case 0xf8: /* psubb */
+    case 0xf9: /* psubw */
+    case 0xfa: /* psubl */
+    case 0xfb: /* psubq */
+        tcg_gen_gvec_sub(cpu_env, b - 0xf8, op1_offset, op1_offset,
+                         op2_offset, oprsz);
+        return true;
+    default:
+        return false;
+    }
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4385,6 +4508,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_gvec(b, is_xmm ? 16 : 8, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4940,7 +5066,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             tcg_gen_movi_tl(cpu_T[1], next_eip);
             gen_push_v(s, cpu_T[1]);
             gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -4967,7 +5093,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
                 tcg_gen_ext16u_tl(cpu_T[0], cpu_T[0]);
             }
             gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -6381,14 +6507,14 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         gen_stack_update(s, val + (1 << ot));
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
         gen_pop_update(s, ot);
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xca: /* lret im */
         val = cpu_ldsw_code(env, s->pc);
@@ -7980,7 +8106,7 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
     if (max_insns == 0)
         max_insns = CF_COUNT_MASK;
 
-    gen_tb_start();
+    gen_tb_start(tb);
     for(;;) {
         if (unlikely(!QTAILQ_EMPTY(&cs->breakpoints))) {
             QTAILQ_FOREACH(bp, &cs->breakpoints, entry) {
@@ -477,6 +477,38 @@ void helper_vaddcuw(ppc_avr_t *r, ppc_avr_t *a, ppc_avr_t *b)
     }
 }
 
+/* With GCC/clang generic vectors, element-wise operations on a whole
+ * register compile to host SIMD instructions where the host has them.
+ * The element order within ppc_avr_t does not matter for these.
+ */
+#if QEMU_GNUC_PREREQ(4, 7) || defined(__clang__)
+#define HAVE_AVR_VECTOR
+typedef uint8_t avr_vec_u8 __attribute__((vector_size(16)));
+typedef int8_t avr_vec_s8 __attribute__((vector_size(16)));
+typedef uint16_t avr_vec_u16 __attribute__((vector_size(16)));
+typedef int16_t avr_vec_s16 __attribute__((vector_size(16)));
+typedef uint32_t avr_vec_u32 __attribute__((vector_size(16)));
+typedef int32_t avr_vec_s32 __attribute__((vector_size(16)));
+typedef uint64_t avr_vec_u64 __attribute__((vector_size(16)));
+typedef int64_t avr_vec_s64 __attribute__((vector_size(16)));
+
+/* ppc_avr_t is only 8-byte aligned */
+#define AVR_VEC_LOAD(v, avr)    memcpy(&(v), (avr), sizeof(v))
+#define AVR_VEC_STORE(avr, v)   memcpy((avr), &(v), sizeof(v))
+#endif
+
+#ifdef HAVE_AVR_VECTOR
+#define VARITH_DO(name, op, element)                                    \
+    void helper_v##name(ppc_avr_t *r, ppc_avr_t *a, ppc_avr_t *b)       \
+    {                                                                   \
+        avr_vec_##element va, vb;                                       \
+                                                                        \
+        AVR_VEC_LOAD(va, a);                                            \
+        AVR_VEC_LOAD(vb, b);                                            \
+        va = va op vb;                                                  \
+        AVR_VEC_STORE(r, va);                                           \
+    }
+#else
 #define VARITH_DO(name, op, element)                                    \
     void helper_v##name(ppc_avr_t *r, ppc_avr_t *a, ppc_avr_t *b)       \
     {                                                                   \
@@ -486,13 +518,13 @@ void helper_vaddcuw(ppc_avr_t *r, ppc_avr_t *a, ppc_avr_t *b)
             r->element[i] = a->element[i] op b->element[i];             \
         }                                                               \
     }
+#endif
 #define VARITH(suffix, element)                 \
     VARITH_DO(add##suffix, +, element)          \
     VARITH_DO(sub##suffix, -, element)
 VARITH(ubm, u8)
 VARITH(uhm, u16)
 VARITH(uwm, u32)
-VARITH(udm, u64)
 VARITH_DO(muluwm, *, u32)
 #undef VARITH_DO
 #undef VARITH
@@ -574,6 +606,19 @@ VARITHSAT_UNSIGNED(w, u32, uint64_t, cvtsduw)
 #undef VARITHSAT_SIGNED
 #undef VARITHSAT_UNSIGNED
 
+#ifdef HAVE_AVR_VECTOR
+/* (a + b + 1) >> 1 without widening: a + b == 2 * (a | b) - (a ^ b) */
+#define VAVG_DO(name, element, etype)                                   \
+    void helper_v##name(ppc_avr_t *r, ppc_avr_t *a, ppc_avr_t *b)       \
+    {                                                                   \
+        avr_vec_##element va, vb;                                       \
+                                                                        \
+        AVR_VEC_LOAD(va, a);                                            \
+        AVR_VEC_LOAD(vb, b);                                            \
+        va = (va | vb) - ((va ^ vb) >> 1);                              \
+        AVR_VEC_STORE(r, va);                                           \
+    }
+#else
 #define VAVG_DO(name, element, etype)                                   \
     void helper_v##name(ppc_avr_t *r, ppc_avr_t *a, ppc_avr_t *b)       \
     {                                                                   \
@@ -584,6 +629,7 @@ VARITHSAT_UNSIGNED(w, u32, uint64_t, cvtsduw)
             r->element[i] = x >> 1;                                     \
         }                                                               \
     }
+#endif
 
 #define VAVG(type, signed_element, signed_type, unsigned_element,       \
              unsigned_type)                                             \
@@ -799,6 +845,19 @@ void helper_vmhraddshs(CPUPPCState *env, ppc_avr_t *r, ppc_avr_t *a,
     }
 }
 
+#ifdef HAVE_AVR_VECTOR
+#define VMINMAX_DO(name, compare, element)                              \
+    void helper_v##name(ppc_avr_t *r, ppc_avr_t *a, ppc_avr_t *b)       \
+    {                                                                   \
+        avr_vec_##element va, vb, m;                                    \
+                                                                        \
+        AVR_VEC_LOAD(va, a);                                            \
+        AVR_VEC_LOAD(vb, b);                                            \
+        m = (avr_vec_##element)(va compare vb);                         \
+        va = (vb & m) | (va & ~m);                                      \
+        AVR_VEC_STORE(r, va);                                           \
+    }
+#else
 #define VMINMAX_DO(name, compare, element)                              \
     void helper_v##name(ppc_avr_t *r, ppc_avr_t *a, ppc_avr_t *b)       \
     {                                                                   \
@@ -812,6 +871,7 @@ void helper_vmhraddshs(CPUPPCState *env, ppc_avr_t *r, ppc_avr_t *a,
             }                                                           \
         }                                                               \
     }
+#endif
 #define VMINMAX(suffix, element)                \
     VMINMAX_DO(min##suffix, >, element)         \
     VMINMAX_DO(max##suffix, <, element)
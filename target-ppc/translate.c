@@ -179,6 +179,21 @@ void ppc_translate_init(void)
     cpu_access_type = tcg_global_mem_new_i32(TCG_AREG0,
                                              offsetof(CPUPPCState, access_type), "access_type");
 
+    /* These helpers only update XER bits and never raise exceptions, so
+       the GPRs and CR fields can stay in host registers across them.  */
+    tcg_helper_writes_global_tl(helper_sraw, cpu_ca);
+    tcg_helper_writes_global_tl(helper_divweu, cpu_so);
+    tcg_helper_writes_global_tl(helper_divweu, cpu_ov);
+    tcg_helper_writes_global_tl(helper_divwe, cpu_so);
+    tcg_helper_writes_global_tl(helper_divwe, cpu_ov);
+#if defined(TARGET_PPC64)
+    tcg_helper_writes_global_tl(helper_srad, cpu_ca);
+    tcg_helper_writes_global_i64(helper_divdeu, cpu_so);
+    tcg_helper_writes_global_i64(helper_divdeu, cpu_ov);
+    tcg_helper_writes_global_i64(helper_divde, cpu_so);
+    tcg_helper_writes_global_i64(helper_divde, cpu_ov);
+#endif
+
     done_init = 1;
 }
 
@@ -6950,11 +6965,12 @@ static void glue(gen_, name0##_##name1)(DisasContext *ctx)             \
 GEN_VXFORM(vaddubm, 0, 0);
 GEN_VXFORM(vadduhm, 0, 1);
 GEN_VXFORM(vadduwm, 0, 2);
-GEN_VXFORM(vaddudm, 0, 3);
+/* doubleword modular arithmetic works on the 64-bit halves directly */
+GEN_VX_LOGICAL(vaddudm, tcg_gen_add_i64, 0, 3);
 GEN_VXFORM(vsububm, 0, 16);
 GEN_VXFORM(vsubuhm, 0, 17);
 GEN_VXFORM(vsubuwm, 0, 18);
-GEN_VXFORM(vsubudm, 0, 19);
+GEN_VX_LOGICAL(vsubudm, tcg_gen_sub_i64, 0, 19);
 GEN_VXFORM(vmaxub, 1, 0);
 GEN_VXFORM(vmaxuh, 1, 1);
 GEN_VXFORM(vmaxuw, 1, 2);
@@ -11329,7 +11345,7 @@ static inline void gen_intermediate_code_internal(PowerPCCPU *cpu,
     if (max_insns == 0)
         max_insns = CF_COUNT_MASK;
 
-    gen_tb_start();
+    gen_tb_start(tb);
     tcg_clear_temp_count();
     /* Set env in case of segfault during code fetch */
     while (ctx.exception == POWERPC_EXCP_NONE
@@ -51,6 +51,74 @@ struct tcg_temp_info {
 
 static struct tcg_temp_info temps[TCG_MAX_TEMPS];
 
+/* Recent loads from host memory (normally env fields), so that loading
+   the same location again within a basic block becomes a move.  Any
+   store, call or guest memory access forgets everything.  */
+#define LD_CACHE_SIZE 8
+
+struct tcg_ld_info {
+    TCGOpcode op;
+    TCGArg dst;
+    TCGArg base;
+    TCGArg ofs;
+};
+
+static struct tcg_ld_info ld_cache[LD_CACHE_SIZE];
+static int ld_cache_nb;
+static int ld_cache_next;
+
+static void ld_cache_reset(void)
+{
+    ld_cache_nb = 0;
+    ld_cache_next = 0;
+}
+
+/* TEMP is being written: forget the loads it was the result or the base
+   address of.  */
+static void ld_cache_reset_temp(TCGArg temp)
+{
+    int i = 0;
+
+    while (i < ld_cache_nb) {
+        if (ld_cache[i].dst == temp || ld_cache[i].base == temp) {
+            ld_cache[i] = ld_cache[--ld_cache_nb];
+        } else {
+            i++;
+        }
+    }
+    ld_cache_next = ld_cache_nb;
+}
+
+static void ld_cache_add(TCGOpcode op, TCGArg dst, TCGArg base, TCGArg ofs)
+{
+    struct tcg_ld_info *ld;
+
+    if (ld_cache_nb < LD_CACHE_SIZE) {
+        ld = &ld_cache[ld_cache_nb++];
+    } else {
+        ld = &ld_cache[ld_cache_next++ % LD_CACHE_SIZE];
+    }
+    ld->op = op;
+    ld->dst = dst;
+    ld->base = base;
+    ld->ofs = ofs;
+}
+
+/* Return the temp holding the result of an identical earlier load,
+   or -1.  */
+static TCGArg ld_cache_find(TCGOpcode op, TCGArg base, TCGArg ofs)
+{
+    int i;
+
+    for (i = 0; i < ld_cache_nb; i++) {
+        if (ld_cache[i].op == op && ld_cache[i].base == base &&
+            ld_cache[i].ofs == ofs) {
+            return ld_cache[i].dst;
+        }
+    }
+    return -1;
+}
+
 /* Reset TEMP's state to TCG_TEMP_UNDEF.  If TEMP only had one copy, remove
    the copy flag from the left temp.  */
 static void reset_temp(TCGArg temp)
@@ -77,6 +145,33 @@ static void reset_all_temps(int nb_temps)
     }
 }
 
+/* Reset the temporaries that do not survive the end of a basic block.
+   On the fall-through path of a conditional branch, globals and local
+   temps still hold the same values, so what is known about them (constant
+   value, copies, known-zero bits) stays valid.  */
+static void reset_bb_temps(TCGContext *s, int nb_temps)
+{
+    int i;
+
+    for (i = s->nb_globals; i < nb_temps; i++) {
+        if (!s->temps[i].temp_local) {
+            reset_temp(i);
+        }
+    }
+}
+
+static bool op_is_cond_branch(TCGOpcode op)
+{
+    switch (op) {
+    case INDEX_op_brcond_i32:
+    case INDEX_op_brcond_i64:
+    case INDEX_op_brcond2_i32:
+        return true;
+    default:
+        return false;
+    }
+}
+
 static int op_bits(TCGOpcode op)
 {
     const TCGOpDef *def = &tcg_op_defs[op];
@@ -547,6 +642,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
     nb_temps = s->nb_temps;
     nb_globals = s->nb_globals;
     reset_all_temps(nb_temps);
+    ld_cache_reset();
 
     nb_ops = tcg_opc_ptr - s->gen_opc_buf;
     gen_args = args;
@@ -575,6 +671,31 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             }
         }
 
+        /* Forget the loads this op can invalidate */
+        switch (op) {
+        CASE_OP_32_64(st8):
+        CASE_OP_32_64(st16):
+        case INDEX_op_st_i32:
+        case INDEX_op_st32_i64:
+        case INDEX_op_st_i64:
+        case INDEX_op_call:
+        case INDEX_op_qemu_ld_i32:
+        case INDEX_op_qemu_ld_i64:
+        case INDEX_op_qemu_st_i32:
+        case INDEX_op_qemu_st_i64:
+            ld_cache_reset();
+            break;
+        default:
+            if (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS)) {
+                ld_cache_reset();
+            } else {
+                for (i = 0; i < nb_oargs; i++) {
+                    ld_cache_reset_temp(args[i]);
+                }
+            }
+            break;
+        }
+
         /* For commutative operations make constant second argument */
         switch (op) {
         CASE_OP_32_64(add):
@@ -1220,7 +1341,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                 /* Simplify LT/GE comparisons vs zero to a single compare
                    vs the high word of the input.  */
             do_brcond_high:
-                reset_all_temps(nb_temps);
+                reset_bb_temps(s, nb_temps);
                 s->gen_opc_buf[op_index] = INDEX_op_brcond_i32;
                 gen_args[0] = args[1];
                 gen_args[1] = args[3];
@@ -1245,7 +1366,7 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
                     goto do_default;
                 }
             do_brcond_low:
-                reset_all_temps(nb_temps);
+                reset_bb_temps(s, nb_temps);
                 s->gen_opc_buf[op_index] = INDEX_op_brcond_i32;
                 gen_args[0] = args[0];
                 gen_args[1] = args[2];
@@ -1348,6 +1469,30 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             args += 6;
             break;
 
+        CASE_OP_32_64(ld8u):
+        CASE_OP_32_64(ld8s):
+        CASE_OP_32_64(ld16u):
+        CASE_OP_32_64(ld16s):
+        case INDEX_op_ld_i32:
+        case INDEX_op_ld32u_i64:
+        case INDEX_op_ld32s_i64:
+        case INDEX_op_ld_i64:
+            tmp = ld_cache_find(op, args[1], args[2]);
+            if (tmp != (TCGArg)-1) {
+                if (temps_are_copies(args[0], tmp)) {
+                    s->gen_opc_buf[op_index] = INDEX_op_nop;
+                } else {
+                    tcg_opt_gen_mov(s, op_index, gen_args, op, args[0], tmp);
+                    gen_args += 2;
+                }
+                args += 3;
+                break;
+            }
+            if (args[0] != args[1]) {
+                ld_cache_add(op, args[0], args[1], args[2]);
+            }
+            goto do_default;
+
         case INDEX_op_call:
             if (!(args[nb_oargs + nb_iargs + 1]
                   & (TCG_CALL_NO_READ_GLOBALS | TCG_CALL_NO_WRITE_GLOBALS))) {
@@ -1362,9 +1507,12 @@ static TCGArg *tcg_constant_folding(TCGContext *s, uint16_t *tcg_opc_ptr,
             /* Default case: we know nothing about operation (or were unable
                to compute the operation result) so no propagation is done.
                We trash everything if the operation is the end of a basic
-               block, otherwise we only trash the output args.  "mask" is
-               the non-zero bits mask for the first output arg.  */
-            if (def->flags & TCG_OPF_BB_END) {
+               block, except what still holds after a conditional branch
+               is not taken; otherwise we only trash the output args.
+               "mask" is the non-zero bits mask for the first output arg.  */
+            if (op_is_cond_branch(op)) {
+                reset_bb_temps(s, nb_temps);
+            } else if (def->flags & TCG_OPF_BB_END) {
                 reset_all_temps(nb_temps);
             } else {
         do_reset_output:
@@ -0,0 +1,169 @@
+/*
+ * Generic vector operation expansion
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "config.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "tcg.h"
+#include "tcg-op.h"
+#include "tcg-op-gvec.h"
+
+typedef void GVecGen3Fn(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m);
+
+/* Expand a three-operand operation as a loop over 64-bit chunks.  @m is
+   passed through to @fn, as the lane mask for add and sub.  */
+static void expand_3_i64(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                         uint32_t bofs, uint32_t oprsz, uint64_t m,
+                         GVecGen3Fn *fn)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    uint32_t i;
+
+    tcg_debug_assert(oprsz % 8 == 0);
+    for (i = 0; i < oprsz; i += 8) {
+        tcg_gen_ld_i64(t0, env, aofs + i);
+        tcg_gen_ld_i64(t1, env, bofs + i);
+        fn(t0, t0, t1, m);
+        tcg_gen_st_i64(t0, env, dofs + i);
+    }
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t0);
+}
+
+static void gen_and_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    tcg_gen_and_i64(d, a, b);
+}
+
+static void gen_or_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    tcg_gen_or_i64(d, a, b);
+}
+
+static void gen_xor_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    tcg_gen_xor_i64(d, a, b);
+}
+
+static void gen_andc_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    tcg_gen_andc_i64(d, a, b);
+}
+
+static void gen_add_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    tcg_gen_add_i64(d, a, b);
+}
+
+static void gen_sub_i64(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    tcg_gen_sub_i64(d, a, b);
+}
+
+/* Add all lanes at once, keeping carries from crossing lane boundaries:
+   the top bit of each lane is summed separately, with xor.  @m has the
+   top bit of every lane set.  */
+static void gen_addv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_andi_i64(t1, a, ~m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+/* Likewise for subtraction: setting the top bit of each lane of the
+   minuend and clearing it in the subtrahend stops borrows from crossing
+   lane boundaries.  */
+static void gen_subv_mask(TCGv_i64 d, TCGv_i64 a, TCGv_i64 b, uint64_t m)
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+    TCGv_i64 t3 = tcg_temp_new_i64();
+
+    tcg_gen_ori_i64(t1, a, m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+/* The top bit of every lane of size @vece */
+static uint64_t lane_top_bits(unsigned vece)
+{
+    switch (vece) {
+    case MO_8:
+        return 0x8080808080808080ull;
+    case MO_16:
+        return 0x8000800080008000ull;
+    case MO_32:
+        return 0x8000000080000000ull;
+    default:
+        tcg_abort();
+    }
+}
+
+void tcg_gen_gvec_and(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz)
+{
+    expand_3_i64(env, dofs, aofs, bofs, oprsz, 0, gen_and_i64);
+}
+
+void tcg_gen_gvec_or(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                     uint32_t bofs, uint32_t oprsz)
+{
+    expand_3_i64(env, dofs, aofs, bofs, oprsz, 0, gen_or_i64);
+}
+
+void tcg_gen_gvec_xor(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz)
+{
+    expand_3_i64(env, dofs, aofs, bofs, oprsz, 0, gen_xor_i64);
+}
+
+void tcg_gen_gvec_andc(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                       uint32_t bofs, uint32_t oprsz)
+{
+    expand_3_i64(env, dofs, aofs, bofs, oprsz, 0, gen_andc_i64);
+}
+
+void tcg_gen_gvec_add(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    if (vece == MO_64) {
+        expand_3_i64(env, dofs, aofs, bofs, oprsz, 0, gen_add_i64);
+    } else {
+        expand_3_i64(env, dofs, aofs, bofs, oprsz, lane_top_bits(vece),
+                     gen_addv_mask);
+    }
+}
+
+void tcg_gen_gvec_sub(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    if (vece == MO_64) {
+        expand_3_i64(env, dofs, aofs, bofs, oprsz, 0, gen_sub_i64);
+    } else {
+        expand_3_i64(env, dofs, aofs, bofs, oprsz, lane_top_bits(vece),
+                     gen_subv_mask);
+    }
+}
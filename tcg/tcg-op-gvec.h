@@ -0,0 +1,37 @@
+/*
+ * Generic vector operation expansion
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef TCG_OP_GVEC_H
+#define TCG_OP_GVEC_H 1
+
+/*
+ * "Generic" vectors: guest vector registers that live in CPUArchState,
+ * operated upon inline with 64-bit TCG operations instead of calling an
+ * out of line helper for each instruction.  Lanes narrower than 64 bits
+ * are handled with SIMD-within-a-register arithmetic.
+ *
+ * @dofs, @aofs and @bofs are offsets from @env of the destination and of
+ * the two sources; they may overlap exactly but not partially.  @oprsz
+ * is the size of the vector in bytes and must be a multiple of 8.  @vece
+ * is the lane size, as a MO_8 ... MO_64 value.
+ */
+
+void tcg_gen_gvec_and(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_or(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                     uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_xor(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz);
+/* d = a & ~b */
+void tcg_gen_gvec_andc(TCGv_ptr env, uint32_t dofs, uint32_t aofs,
+                       uint32_t bofs, uint32_t oprsz);
+
+void tcg_gen_gvec_add(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_sub(TCGv_ptr env, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+
+#endif
@@ -2476,6 +2476,8 @@ static inline void tcg_gen_muls2_i64(TCGv_i64 rl, TCGv_i64 rh,
 #define tcg_add_param_tl tcg_add_param_i32
 #define tcg_gen_qemu_ld_tl tcg_gen_qemu_ld_i32
 #define tcg_gen_qemu_st_tl tcg_gen_qemu_st_i32
+#define tcg_helper_reads_global_tl tcg_helper_reads_global_i32
+#define tcg_helper_writes_global_tl tcg_helper_writes_global_i32
 #else
 #define TCGv TCGv_i64
 #define tcg_temp_new() tcg_temp_new_i64()
@@ -2489,6 +2491,8 @@ static inline void tcg_gen_muls2_i64(TCGv_i64 rl, TCGv_i64 rh,
 #define tcg_add_param_tl tcg_add_param_i64
 #define tcg_gen_qemu_ld_tl tcg_gen_qemu_ld_i64
 #define tcg_gen_qemu_st_tl tcg_gen_qemu_st_i64
+#define tcg_helper_reads_global_tl tcg_helper_reads_global_i64
+#define tcg_helper_writes_global_tl tcg_helper_writes_global_i64
 #endif
 
 /* debug info: write the PC of the corresponding QEMU CPU instruction */
@@ -2520,6 +2524,22 @@ static inline void tcg_gen_goto_tb(unsigned idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+/**
+ * tcg_gen_lookup_and_goto_ptr() - look up the next TB and jump to it
+ * @env: the frontend's cpu_env
+ *
+ * Ends the TB like tcg_gen_exit_tb(0), but first looks up the TB for the
+ * current CPU state in the vCPU's tb_jmp_cache and, on a hit, jumps to it
+ * straight from generated code.  The pc and every other piece of state
+ * cpu_get_tb_cpu_state() looks at must already be stored in @env.
+ *
+ * Unlike goto_tb, the destination need not be known at translation time
+ * nor lie on the same guest page: tb_jmp_cache is indexed by virtual pc
+ * and cleared whenever the TLB mapping of a page changes, so a hit is
+ * always valid.  Falls back to exit_tb(0) on hosts without goto_ptr.
+ */
+void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env);
+
 
 void tcg_gen_qemu_ld_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_st_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
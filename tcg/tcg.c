@@ -316,16 +316,22 @@ void tcg_pool_reset(TCGContext *s)
     s->pool_current = NULL;
 }
 
+typedef struct TCGHelperGlobals {
+    TCGTempSet read;    /* synced to memory before the call */
+    TCGTempSet write;   /* also reloaded from memory after the call */
+} TCGHelperGlobals;
+
 typedef struct TCGHelperInfo {
     void *func;
     const char *name;
     unsigned flags;
     unsigned sizemask;
+    TCGHelperGlobals *globals;
 } TCGHelperInfo;
 
 #include "exec/helper-proto.h"
 
-static const TCGHelperInfo all_helpers[] = {
+static TCGHelperInfo all_helpers[] = {
 #include "exec/helper-tcg.h"
 };
 
@@ -536,6 +542,54 @@ TCGv_i32 tcg_global_mem_new_i32(int reg, intptr_t offset, const char *name)
     return MAKE_TCGV_I32(idx);
 }
 
+static void tcg_helper_access_global(void *func, int idx, bool write)
+{
+    TCGContext *s = &tcg_ctx;
+    TCGHelperInfo *info = g_hash_table_lookup(s->helpers, func);
+
+    assert(info != NULL && idx < s->nb_globals);
+    if (!info->globals) {
+        info->globals = g_new0(TCGHelperGlobals, 1);
+    }
+    set_bit(idx, info->globals->read.l);
+    if (write) {
+        set_bit(idx, info->globals->write.l);
+    }
+}
+
+void tcg_helper_reads_global_i32(void *func, TCGv_i32 arg)
+{
+    tcg_helper_access_global(func, GET_TCGV_I32(arg), false);
+}
+
+void tcg_helper_writes_global_i32(void *func, TCGv_i32 arg)
+{
+    tcg_helper_access_global(func, GET_TCGV_I32(arg), true);
+}
+
+void tcg_helper_reads_global_i64(void *func, TCGv_i64 arg)
+{
+    tcg_helper_access_global(func, GET_TCGV_I64(arg), false);
+#if TCG_TARGET_REG_BITS == 32
+    tcg_helper_access_global(func, GET_TCGV_I64(arg) + 1, false);
+#endif
+}
+
+void tcg_helper_writes_global_i64(void *func, TCGv_i64 arg)
+{
+    tcg_helper_access_global(func, GET_TCGV_I64(arg), true);
+#if TCG_TARGET_REG_BITS == 32
+    tcg_helper_access_global(func, GET_TCGV_I64(arg) + 1, true);
+#endif
+}
+
+static const TCGHelperGlobals *tcg_call_globals(TCGContext *s, void *func)
+{
+    TCGHelperInfo *info = g_hash_table_lookup(s->helpers, func);
+
+    return info->globals;
+}
+
 TCGv_i64 tcg_global_mem_new_i64(int reg, intptr_t offset, const char *name)
 {
     int idx = tcg_global_mem_new_internal(TCG_TYPE_I64, reg, offset, name);
@@ -711,6 +765,9 @@ void tcg_gen_callN(TCGContext *s, void *func, TCGArg ret,
     info = g_hash_table_lookup(s->helpers, (gpointer)func);
     flags = info->flags;
     sizemask = info->sizemask;
+    if (info->globals && !(flags & TCG_CALL_NO_READ_GLOBALS)) {
+        flags |= TCG_CALL_GLOBAL_SETS;
+    }
 
 #if defined(__sparc__) && !defined(__arch64__) \
     && !defined(CONFIG_TCG_INTERPRETER)
@@ -1007,6 +1064,21 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     *tcg_ctx.gen_opparam_ptr++ = idx;
 }
 
+void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env)
+{
+    if (TCG_TARGET_HAS_goto_ptr) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        TCGArg args[1] = { GET_TCGV_PTR(env) };
+
+        tcg_gen_callN(&tcg_ctx, helper_lookup_tb_ptr,
+                      GET_TCGV_PTR(ptr), 1, args);
+        tcg_gen_op1i(INDEX_op_goto_ptr, GET_TCGV_PTR(ptr));
+        tcg_temp_free_ptr(ptr);
+    } else {
+        tcg_gen_exit_tb(0);
+    }
+}
+
 static void tcg_reg_alloc_start(TCGContext *s)
 {
     int i;
@@ -1490,14 +1562,29 @@ static void tcg_liveness_analysis(TCGContext *s)
                         mem_temps[arg] = 0;
                     }
 
-                    if (!(call_flags & TCG_CALL_NO_READ_GLOBALS)) {
-                        /* globals should be synced to memory */
-                        memset(mem_temps, 1, s->nb_globals);
-                    }
-                    if (!(call_flags & (TCG_CALL_NO_WRITE_GLOBALS |
-                                        TCG_CALL_NO_READ_GLOBALS))) {
-                        /* globals should go back to memory */
-                        memset(dead_temps, 1, s->nb_globals);
+                    if (call_flags & TCG_CALL_GLOBAL_SETS) {
+                        /* only the globals the helper declared */
+                        const TCGHelperGlobals *g = tcg_call_globals(s,
+                            (void *)(uintptr_t)args[nb_oargs + nb_iargs]);
+
+                        for (i = 0; i < s->nb_globals; i++) {
+                            if (test_bit(i, g->read.l)) {
+                                mem_temps[i] = 1;
+                            }
+                            if (test_bit(i, g->write.l)) {
+                                dead_temps[i] = 1;
+                            }
+                        }
+                    } else {
+                        if (!(call_flags & TCG_CALL_NO_READ_GLOBALS)) {
+                            /* globals should be synced to memory */
+                            memset(mem_temps, 1, s->nb_globals);
+                        }
+                        if (!(call_flags & (TCG_CALL_NO_WRITE_GLOBALS |
+                                            TCG_CALL_NO_READ_GLOBALS))) {
+                            /* globals should go back to memory */
+                            memset(dead_temps, 1, s->nb_globals);
+                        }
                     }
 
                     /* input args are live */
@@ -1840,6 +1927,7 @@ static int tcg_reg_alloc(TCGContext *s, TCGRegSet reg1, TCGRegSet reg2)
     for(i = 0; i < ARRAY_SIZE(tcg_target_reg_alloc_order); i++) {
         reg = tcg_target_reg_alloc_order[i];
         if (tcg_regset_test_reg(reg_ct, reg)) {
+            s->cur_spills++;
             tcg_reg_free(s, reg);
             return reg;
         }
@@ -1938,6 +2026,27 @@ static void sync_globals(TCGContext *s, TCGRegSet allocated_regs)
     }
 }
 
+/* save or sync only the globals that a helper declared it writes or
+   reads, see tcg_helper_reads_global_i32() */
+static void save_global_sets(TCGContext *s, const TCGHelperGlobals *g,
+                             TCGRegSet allocated_regs)
+{
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        if (test_bit(i, g->write.l)) {
+            temp_save(s, i, allocated_regs);
+        } else if (test_bit(i, g->read.l)) {
+#ifdef USE_LIVENESS_ANALYSIS
+            assert(s->temps[i].val_type != TEMP_VAL_REG ||
+                   s->temps[i].fixed_reg || s->temps[i].mem_coherent);
+#else
+            temp_sync(s, i, allocated_regs);
+#endif
+        }
+    }
+}
+
 /* at the end of a basic block, we assume all temporaries are dead and
    all globals are stored at their canonical location. */
 static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
@@ -2358,6 +2467,8 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
        they might be read. */
     if (flags & TCG_CALL_NO_READ_GLOBALS) {
         /* Nothing to do */
+    } else if (flags & TCG_CALL_GLOBAL_SETS) {
+        save_global_sets(s, tcg_call_globals(s, func_addr), allocated_regs);
     } else if (flags & TCG_CALL_NO_WRITE_GLOBALS) {
         sync_globals(s, allocated_regs);
     } else {
@@ -2458,6 +2569,9 @@ static inline int tcg_gen_code_common(TCGContext *s,
 #endif
 
     tcg_reg_alloc_start(s);
+    s->cur_ops = 0;
+    s->cur_spills = 0;
+    s->cur_helper_calls = 0;
 
     s->code_buf = gen_code_buf;
     s->code_ptr = gen_code_buf;
@@ -2481,11 +2595,13 @@ static inline int tcg_gen_code_common(TCGContext *s,
         switch(opc) {
         case INDEX_op_mov_i32:
         case INDEX_op_mov_i64:
+            s->cur_ops++;
             tcg_reg_alloc_mov(s, def, args, s->op_dead_args[op_index],
                               s->op_sync_args[op_index]);
             break;
         case INDEX_op_movi_i32:
         case INDEX_op_movi_i64:
+            s->cur_ops++;
             tcg_reg_alloc_movi(s, args, s->op_dead_args[op_index],
                                s->op_sync_args[op_index]);
             break;
@@ -2508,6 +2624,8 @@ static inline int tcg_gen_code_common(TCGContext *s,
             tcg_out_label(s, args[0], s->code_ptr);
             break;
         case INDEX_op_call:
+            s->cur_ops++;
+            s->cur_helper_calls++;
             args += tcg_reg_alloc_call(s, def, opc, args,
                                        s->op_dead_args[op_index],
                                        s->op_sync_args[op_index]);
@@ -2522,6 +2640,7 @@ static inline int tcg_gen_code_common(TCGContext *s,
             /* Note: in order to speed up the code, it would be much
                faster to have specialized register allocator functions for
                some common argument patterns */
+            s->cur_ops++;
             tcg_reg_alloc_op(s, def, opc, args, s->op_dead_args[op_index],
                              s->op_sync_args[op_index]);
             break;
@@ -2557,8 +2676,12 @@ int tcg_gen_code(TCGContext *s, tcg_insn_unit *gen_code_buf)
             s->temp_count_max = s->nb_temps;
     }
 #endif
+    s->stats.ops += s->gen_opc_ptr - s->gen_opc_buf;
 
     tcg_gen_code_common(s, gen_code_buf, -1);
+    s->stats.ops_opt += s->cur_ops;
+    s->stats.spills += s->cur_spills;
+    s->stats.helper_calls += s->cur_helper_calls;
 
     /* flush instruction cache */
     flush_icache_range((uintptr_t)s->code_buf, (uintptr_t)s->code_ptr);
@@ -343,6 +343,9 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
 #define TCG_CALL_NO_WRITE_GLOBALS   0x0020
 /* Helper can be safely suppressed if the return value is not used. */
 #define TCG_CALL_NO_SIDE_EFFECTS    0x0040
+/* Helper only accesses the globals declared with tcg_helper_reads_global_*
+   and tcg_helper_writes_global_*.  Set by tcg_gen_callN(), not by frontends. */
+#define TCG_CALL_GLOBAL_SETS        0x0080
 
 /* convenience version of most used call flags */
 #define TCG_CALL_NO_RWG         TCG_CALL_NO_READ_GLOBALS
@@ -448,6 +451,19 @@ typedef struct TCGTempSet {
     unsigned long l[BITS_TO_LONGS(TCG_MAX_TEMPS)];
 } TCGTempSet;
 
+/* Always-on code quality counters, updated with tb_lock held.  Unlike
+   the CONFIG_PROFILER counters they cost a few increments per TB.  */
+typedef struct TCGStats {
+    uint64_t guest_insns;
+    uint64_t guest_bytes;
+    uint64_t host_bytes;
+    uint64_t ops;           /* before tcg_optimize() */
+    uint64_t ops_opt;       /* after optimization and liveness analysis */
+    uint64_t spills;        /* live registers evicted to make room */
+    uint64_t helper_calls;
+    int max_tb_insns;
+} TCGStats;
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -484,6 +500,13 @@ struct TCGContext {
 
     GHashTable *helpers;
 
+    TCGStats stats;
+    /* counts for the code being generated, folded into stats by
+       tcg_gen_code() but not by tcg_gen_code_search_pc() */
+    int cur_ops;
+    int cur_spills;
+    int cur_helper_calls;
+
 #ifdef CONFIG_PROFILER
     /* profiling info */
     int64_t tb_count1;
@@ -523,6 +546,7 @@ struct TCGContext {
        extension that allows arithmetic on void*.  */
     int code_gen_max_blocks;
     void *code_gen_prologue;
+    void *code_gen_epilogue;    /* returns 0 to cpu_exec(), for goto_ptr */
     void *code_gen_buffer;
     size_t code_gen_buffer_size;
     /* threshold to flush the translated code buffer */
@@ -596,6 +620,17 @@ static inline TCGv_i64 tcg_temp_local_new_i64(void)
 void tcg_temp_free_i64(TCGv_i64 arg);
 char *tcg_get_arg_str_i64(TCGContext *s, char *buf, int buf_size, TCGv_i64 arg);
 
+/* Restrict the globals that calls to the helper 'func' must put back in
+   memory.  Once any is declared, only the declared globals are synced
+   before the call (reads) or synced and reloaded after it (writes); the
+   others may stay in host registers across the call.  This includes the
+   helper's exception paths, so helpers that can longjmp out of the TB
+   must not use this.  Call after creating the globals.  */
+void tcg_helper_reads_global_i32(void *func, TCGv_i32 arg);
+void tcg_helper_writes_global_i32(void *func, TCGv_i32 arg);
+void tcg_helper_reads_global_i64(void *func, TCGv_i64 arg);
+void tcg_helper_writes_global_i64(void *func, TCGv_i64 arg);
+
 #if defined(CONFIG_DEBUG_TCG)
 /* If you call tcg_clear_temp_count() at the start of a section of
  * code which is not supposed to leak any TCG temporaries, then
@@ -0,0 +1,159 @@
+/*
+ * TCG microbenchmarks
+ *
+ * Each kernel stresses one kind of guest code: tight integer loops,
+ * floating point, memcpy, indirect branches and vectorizable loops.
+ * Run under linux-user with "-d tb_stats" so that QEMU also reports how
+ * many blocks it translated and how long that took; see tcg-bench.sh.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#define BUF_SIZE    (64 * 1024)
+
+static volatile uint32_t sink;
+
+static void bench_int(unsigned long iters)
+{
+    uint32_t a = 1, b = 2, c = 3;
+    unsigned long i;
+
+    for (i = 0; i < iters * 1000; i++) {
+        a += b ^ (c << 3);
+        b = (b * 2654435761u) + a;
+        c ^= a >> 7;
+        if (a & 1) {
+            c++;
+        }
+    }
+    sink = a + b + c;
+}
+
+static void bench_fp(unsigned long iters)
+{
+    double x = 1.0, y = 0.5, z = 0.0;
+    unsigned long i;
+
+    for (i = 0; i < iters * 1000; i++) {
+        z += x * y;
+        x = x * 1.0000001 + 0.25;
+        y = z / (x + 1.0);
+    }
+    sink = (uint32_t)z;
+}
+
+static void bench_memcpy(unsigned long iters)
+{
+    static char src[BUF_SIZE], dst[BUF_SIZE];
+    unsigned long i;
+
+    memset(src, 0x5a, sizeof(src));
+    for (i = 0; i < iters; i++) {
+        memcpy(dst, src, sizeof(src));
+        src[i % BUF_SIZE] = dst[(i * 7) % BUF_SIZE];
+    }
+    sink = dst[0];
+}
+
+typedef uint32_t (*op_fn)(uint32_t);
+
+static uint32_t op0(uint32_t x) { return x + 1; }
+static uint32_t op1(uint32_t x) { return x ^ 0x55; }
+static uint32_t op2(uint32_t x) { return x * 3; }
+static uint32_t op3(uint32_t x) { return x >> 1; }
+static uint32_t op4(uint32_t x) { return x - 7; }
+static uint32_t op5(uint32_t x) { return x | 0x100; }
+static uint32_t op6(uint32_t x) { return x & 0xfffff; }
+static uint32_t op7(uint32_t x) { return x << 2; }
+
+static op_fn ops[8] = { op0, op1, op2, op3, op4, op5, op6, op7 };
+
+static void bench_indirect(unsigned long iters)
+{
+    uint32_t x = 1, seed = 12345;
+    unsigned long i;
+
+    for (i = 0; i < iters * 1000; i++) {
+        seed = seed * 1103515245 + 12345;
+        x = ops[(seed >> 16) & 7](x);
+    }
+    sink = x;
+}
+
+typedef int32_t v4si __attribute__((vector_size(16)));
+
+static void bench_simd(unsigned long iters)
+{
+    static v4si a[BUF_SIZE / 16], b[BUF_SIZE / 16];
+    v4si acc = { 0, 0, 0, 0 };
+    unsigned long i, j;
+
+    for (j = 0; j < BUF_SIZE / 16; j++) {
+        v4si v = { j, j + 1, j + 2, j + 3 };
+        a[j] = v;
+        b[j] = v + v;
+    }
+    for (i = 0; i < iters; i++) {
+        for (j = 0; j < BUF_SIZE / 16; j++) {
+            acc += (a[j] * b[j]) ^ acc;
+        }
+    }
+    sink = acc[0] + acc[1] + acc[2] + acc[3];
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(unsigned long iters);
+} kernels[] = {
+    { "int", bench_int },
+    { "fp", bench_fp },
+    { "memcpy", bench_memcpy },
+    { "indirect", bench_indirect },
+    { "simd", bench_simd },
+};
+
+static int64_t now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iters = 10000;
+    int64_t start;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s kernel [iterations]\nkernels:", argv[0]);
+        for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+            fprintf(stderr, " %s", kernels[i].name);
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    if (argc > 2) {
+        iters = strtoul(argv[2], NULL, 0);
+    }
+
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (!strcmp(argv[1], kernels[i].name)) {
+            start = now_us();
+            kernels[i].fn(iters);
+            printf("%s: %lld us\n", kernels[i].name,
+                   (long long)(now_us() - start));
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "unknown kernel %s\n", argv[1]);
+    return 1;
+}
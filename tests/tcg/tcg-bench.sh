@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Run the tcg-bench kernels under a linux-user QEMU and print one line per
+# kernel: guest-measured run time, blocks translated and translation time.
+# Execution time is roughly the run time minus the translation time (the
+# latter also counts blocks translated while the C library starts up).
+#
+# usage: tcg-bench.sh qemu-binary tcg-bench-binary [iterations]
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+qemu="$1"
+bench="$2"
+iters="${3:-10000}"
+log="${TMPDIR:-/tmp}/tcg-bench.$$.log"
+
+if [ ! -x "$qemu" ] || [ ! -f "$bench" ]; then
+    echo "usage: $0 qemu-binary tcg-bench-binary [iterations]" >&2
+    exit 1
+fi
+
+printf "%-10s %12s %10s %12s %12s\n" kernel total-us TBs xlate-us exec-us
+for kernel in int fp memcpy indirect simd; do
+    total=$("$qemu" -d tb_stats -D "$log" "$bench" $kernel $iters |
+            sed -n 's/^.*: \([0-9]*\) us$/\1/p')
+    set -- $(sed -n 's/^TB translations *\([0-9]*\) (\([0-9]*\) us)$/\1 \2/p' \
+             "$log") 0 0
+    printf "%-10s %12s %10s %12s %12s\n" $kernel "$total" "$1" "$2" \
+           $((${total:-0} - $2))
+done
+rm -f "$log"
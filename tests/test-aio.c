@@ -179,6 +179,22 @@ static void test_bh_schedule(void)
     qemu_bh_delete(data.bh);
 }
 
+static void test_bh_stats(void)
+{
+    BHTestData data = { .n = 0, .max = 3 };
+    uint64_t polls = ctx->stats.polls;
+    uint64_t bhs = ctx->stats.bhs;
+
+    data.bh = aio_bh_new(ctx, bh_test_cb, &data);
+    qemu_bh_schedule(data.bh);
+    while (data.n < 3) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(ctx->stats.bhs - bhs, ==, 3);
+    g_assert_cmpint(ctx->stats.polls - polls, >=, 3);
+    qemu_bh_delete(data.bh);
+}
+
 static void test_bh_schedule10(void)
 {
     BHTestData data = { .n = 0, .max = 10 };
@@ -425,6 +441,60 @@ static void test_wait_event_notifier_noflush(void)
     event_notifier_cleanup(&data.e);
 }
 
+#ifndef _WIN32
+/* aio_set_event_notifier_poll() is a no-op on Windows */
+static bool event_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    EventNotifierTestData *data = container_of(e, EventNotifierTestData, e);
+
+    if (!data->active) {
+        return false;
+    }
+    data->active--;
+    data->n++;
+    return true;
+}
+
+static void test_poll_event_notifier(void)
+{
+    EventNotifierTestData data = { .n = 0, .active = 0 };
+
+    aio_context_set_poll_params(ctx, 1000000000LL, 0, 0, &error_abort);
+    event_notifier_init(&data.e, false);
+    aio_set_event_notifier(ctx, &data.e, event_ready_cb);
+    aio_set_event_notifier_poll(ctx, &data.e, event_poll_cb);
+
+    /* A short blocking wait enables polling... */
+    event_notifier_set(&data.e);
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert_cmpint(ctx->poll_ns, >, 0);
+
+    /* ... which now finds work without the notifier being set */
+    data.active = 1;
+    g_assert(aio_poll(ctx, true));
+    g_assert_cmpint(data.n, ==, 2);
+    g_assert_cmpint(data.active, ==, 0);
+    g_assert(!aio_poll(ctx, false));
+
+    aio_set_event_notifier(ctx, &data.e, NULL);
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    g_assert(!aio_poll(ctx, false));
+    event_notifier_cleanup(&data.e);
+}
+#endif
+
+static void test_poll_params(void)
+{
+    Error *local_err = NULL;
+
+    aio_context_set_poll_params(ctx, -1, 0, 0, &local_err);
+    g_assert(local_err);
+    error_free(local_err);
+    g_assert_cmpint(ctx->poll_max_ns, ==, 0);
+}
+
 static void test_timer_schedule(void)
 {
     TimerTestData data = { .n = 0, .ctx = ctx, .ns = SCALE_MS * 750LL,
@@ -839,10 +909,15 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/bh/callback-delete/one",  test_bh_delete_from_cb);
     g_test_add_func("/aio/bh/callback-delete/many", test_bh_delete_from_cb_many);
     g_test_add_func("/aio/bh/flush",                test_bh_flush);
+    g_test_add_func("/aio/bh/stats",                test_bh_stats);
     g_test_add_func("/aio/event/add-remove",        test_set_event_notifier);
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
+#ifndef _WIN32
+    g_test_add_func("/aio/event/poll",              test_poll_event_notifier);
+#endif
+    g_test_add_func("/aio/poll-params",             test_poll_params);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
 
     g_test_add_func("/aio-gsource/notify",                  test_source_notify);
@@ -0,0 +1,211 @@
+/*
+ * Test bitmap routines
+ *
+ * The binary operations and scans work a vector at a time where they can,
+ * so they are checked against one-word-at-a-time results on sizes and
+ * alignments around the vector boundaries.  With "-m perf" the large-bitmap
+ * cases are also timed.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <stdint.h>
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/bitmap.h"
+
+/* up to 1 KiB of words of slack, so that any alignment can be tested */
+#define SLACK       128
+#define MAX_BITS    (4096 + 3 * BITS_PER_LONG)
+
+#define BENCH_BITS   (1L << 30)  /* 4 TiB of guest memory in 4 KiB pages */
+#define BENCH_STRIDE 16384
+
+static unsigned long *bitmap_random(long words, double density)
+{
+    unsigned long *map = g_new0(unsigned long, words);
+    long i;
+
+    for (i = 0; i < words * BITS_PER_LONG; i++) {
+        if (g_test_rand_double() < density) {
+            set_bit(i, map);
+        }
+    }
+    return map;
+}
+
+static void test_bitmap_ops(void)
+{
+    unsigned long *a = bitmap_random(MAX_BITS / BITS_PER_LONG + SLACK, 0.5);
+    unsigned long *b = bitmap_random(MAX_BITS / BITS_PER_LONG + SLACK, 0.5);
+    unsigned long *dst = g_new0(unsigned long, MAX_BITS / BITS_PER_LONG + 1);
+    long bits, off, k;
+    int ret;
+
+    for (bits = BITS_PER_LONG + 1; bits < MAX_BITS; bits += 37) {
+        for (off = 0; off < 4; off++) {
+            const unsigned long *a1 = a + off, *b1 = b + SLACK - off;
+            long nr = BITS_TO_LONGS(bits);
+            bool nonzero = false;
+
+            bitmap_and(dst, a1, b1, bits);
+            for (k = 0; k < nr; k++) {
+                g_assert_cmphex(dst[k], ==, a1[k] & b1[k]);
+            }
+            bitmap_or(dst, a1, b1, bits);
+            for (k = 0; k < nr; k++) {
+                g_assert_cmphex(dst[k], ==, a1[k] | b1[k]);
+            }
+            bitmap_xor(dst, a1, b1, bits);
+            for (k = 0; k < nr; k++) {
+                g_assert_cmphex(dst[k], ==, a1[k] ^ b1[k]);
+            }
+            ret = bitmap_andnot(dst, a1, b1, bits);
+            for (k = 0; k < nr; k++) {
+                g_assert_cmphex(dst[k], ==, a1[k] & ~b1[k]);
+                nonzero |= dst[k] != 0;
+            }
+            g_assert_cmpint(ret, ==, nonzero);
+
+            /* a bitmap and'ed with its complement is empty */
+            bitmap_complement(dst, a1, bits);
+            g_assert_cmpint(bitmap_and(dst, dst, a1, bits), ==, 0);
+            g_assert(bitmap_empty(dst, bits));
+        }
+    }
+
+    g_free(a);
+    g_free(b);
+    g_free(dst);
+}
+
+static void test_bitmap_empty(void)
+{
+    unsigned long *map = g_new0(unsigned long, MAX_BITS / BITS_PER_LONG + 1);
+    long bits, bit;
+
+    for (bits = BITS_PER_LONG + 1; bits < MAX_BITS; bits += 101) {
+        g_assert(bitmap_empty(map, bits));
+        for (bit = 0; bit < bits; bit += 13) {
+            set_bit(bit, map);
+            g_assert(!bitmap_empty(map, bits));
+            clear_bit(bit, map);
+        }
+        /* bits past the end do not count */
+        set_bit(bits, map);
+        g_assert(bitmap_empty(map, bits));
+        clear_bit(bits, map);
+    }
+
+    g_free(map);
+}
+
+static void test_find_next_bit(void)
+{
+    long words = MAX_BITS / BITS_PER_LONG + SLACK;
+    unsigned long *map = bitmap_random(words, 0.001);
+    long size, off, bit, expect;
+
+    for (off = 0; off < 4; off++) {
+        const unsigned long *p = map + off;
+
+        for (size = MAX_BITS - 100; size < MAX_BITS; size += 7) {
+            for (bit = 0; bit < size; bit = expect + 1) {
+                for (expect = bit; expect < size; expect++) {
+                    if (test_bit(expect, p)) {
+                        break;
+                    }
+                }
+                g_assert_cmpint(find_next_bit(p, size, bit), ==, expect);
+            }
+        }
+    }
+
+    /* a bit near the end of a long run of zeroes */
+    memset(map, 0, words * sizeof(unsigned long));
+    for (bit = 0; bit < words * BITS_PER_LONG; bit += 61) {
+        set_bit(bit, map);
+        g_assert_cmpint(find_next_bit(map, words * BITS_PER_LONG, 0), ==, bit);
+        g_assert_cmpint(find_next_bit(map, bit, 0), ==, bit);
+        clear_bit(bit, map);
+    }
+
+    g_free(map);
+}
+
+static void bench_report(const char *name, double duration)
+{
+    double gbs = BENCH_BITS / BITS_PER_BYTE / duration / (1 << 30);
+
+    g_test_message("%s: %f s for %ld bits", name, duration, BENCH_BITS);
+    g_test_maximized_result(gbs, "%s: %.2f GiB/s", name, gbs);
+}
+
+static void bench_bitmap_and(void)
+{
+    unsigned long *a = bitmap_new(BENCH_BITS);
+    unsigned long *b = bitmap_new(BENCH_BITS);
+
+    bitmap_set(a, 0, BENCH_BITS);
+    bitmap_set(b, BENCH_BITS / 2, BENCH_BITS / 2);
+
+    g_test_timer_start();
+    bitmap_and(a, a, b, BENCH_BITS);
+    bench_report("bitmap_and", g_test_timer_elapsed());
+
+    g_free(a);
+    g_free(b);
+}
+
+static void bench_bitmap_empty(void)
+{
+    unsigned long *map = bitmap_new(BENCH_BITS);
+
+    bitmap_zero(map, BENCH_BITS);
+    g_test_timer_start();
+    g_assert(bitmap_empty(map, BENCH_BITS));
+    bench_report("bitmap_empty", g_test_timer_elapsed());
+
+    g_free(map);
+}
+
+/* A mostly clean dirty log, one dirty page per 64 MiB, as find_next_bit
+ * sees it when syncing or sending it */
+static void bench_find_next_bit(void)
+{
+    unsigned long *map = bitmap_new(BENCH_BITS);
+    unsigned long bit, n = 0;
+
+    bitmap_zero(map, BENCH_BITS);
+    for (bit = BENCH_STRIDE - 1; bit < BENCH_BITS; bit += BENCH_STRIDE) {
+        set_bit(bit, map);
+    }
+
+    g_test_timer_start();
+    for (bit = find_next_bit(map, BENCH_BITS, 0); bit < BENCH_BITS;
+         bit = find_next_bit(map, BENCH_BITS, bit + 1)) {
+        n++;
+    }
+    bench_report("find_next_bit", g_test_timer_elapsed());
+    g_assert_cmpint(n, ==, BENCH_BITS / BENCH_STRIDE);
+
+    g_free(map);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bitmap/ops", test_bitmap_ops);
+    g_test_add_func("/bitmap/empty", test_bitmap_empty);
+    g_test_add_func("/bitmap/find-next-bit", test_find_next_bit);
+
+    if (g_test_perf()) {
+        g_test_add_func("/bitmap/bench/and", bench_bitmap_and);
+        g_test_add_func("/bitmap/bench/empty", bench_bitmap_empty);
+        g_test_add_func("/bitmap/bench/find-next-bit", bench_find_next_bit);
+    }
+
+    return g_test_run();
+}
@@ -369,6 +369,67 @@ static void test_hbitmap_iter_granularity(TestHBitmapData *data,
     g_assert_cmpint(hbitmap_iter_next(&hbi), <, 0);
 }
 
+static void test_hbitmap_serialize(TestHBitmapData *data,
+                                   const void *unused)
+{
+    HBitmap *hb;
+    uint8_t *buf;
+    uint64_t len, i;
+
+    hbitmap_test_init(data, L3 * 2 + 3, 0);
+    hbitmap_test_set(data, 1, L1 + 2);
+    hbitmap_test_set(data, L3 - 1, L2);
+    hbitmap_test_set(data, L3 * 2, 3);
+    hbitmap_test_reset(data, L3, L1);
+
+    len = hbitmap_serialization_size(data->hb);
+    g_assert_cmpint(len, ==, (L3 * 2 + 3 + 7) / 8);
+    buf = g_malloc(len);
+    hbitmap_serialize(data->hb, buf);
+    for (i = 0; i < data->size; i++) {
+        bool set = data->bits[i / BITS_PER_LONG] & (1UL << (i % BITS_PER_LONG));
+
+        g_assert_cmpint(!!(buf[i / 8] & (1 << (i % 8))), ==, set);
+    }
+
+    /* Replace the bitmap with one loaded from buf */
+    hb = hbitmap_alloc(data->size, 0);
+    hbitmap_deserialize(hb, buf);
+    hbitmap_free(data->hb);
+    data->hb = hb;
+    hbitmap_test_check(data, 0);
+    g_free(buf);
+}
+
+static void test_hbitmap_serialize_part(TestHBitmapData *data,
+                                        const void *unused)
+{
+    HBitmap *hb;
+    uint8_t *buf;
+    uint64_t start, count, len;
+
+    hbitmap_test_init(data, L3 * 2 + 3, 0);
+    hbitmap_test_set(data, 1, L1 + 2);
+    hbitmap_test_set(data, L3 - 1, L2);
+    hbitmap_test_set(data, L3 * 2, 3);
+
+    /* Copy the bitmap part by part over one that is all ones */
+    hb = hbitmap_alloc(data->size, 0);
+    hbitmap_set(hb, 0, data->size);
+    for (start = 0; start < data->size; start += count) {
+        count = MIN(L2, data->size - start);
+        len = hbitmap_serialization_size_part(data->hb, start, count);
+        g_assert_cmpint(len, ==, (count + 7) / 8);
+        buf = g_malloc(len);
+        hbitmap_serialize_part(data->hb, buf, start, count);
+        hbitmap_deserialize_part(hb, buf, start, count);
+        g_free(buf);
+    }
+    hbitmap_free(data->hb);
+    data->hb = hb;
+    hbitmap_test_check(data, 0);
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -395,6 +456,8 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
+    hbitmap_test_add("/hbitmap/serialize", test_hbitmap_serialize);
+    hbitmap_test_add("/hbitmap/serialize/part", test_hbitmap_serialize_part);
     g_test_run();
 
     return 0;
@@ -0,0 +1,266 @@
+/*
+ * qtest benchmark for the virtio-blk, virtio-net and virtio-scsi request paths
+ *
+ * Each device is backed by a null backend, so what is measured is the cost
+ * of popping, dispatching and completing requests in QEMU (plus the qtest
+ * protocol round trips needed to drive the rings).  Numbers are only
+ * meaningful when compared against another run on the same host.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "libqtest.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "libqos/pci-pc.h"
+#include "libqos/malloc.h"
+#include "libqos/malloc-pc.h"
+
+#define QVIRTIO_SCSI_DEVICE_ID      0x8
+
+#define BENCH_DEFAULT_SECONDS       2
+#define BENCH_TIMEOUT_US            (30 * 1000 * 1000)
+#define BENCH_DESC_SIZE             16
+
+#define BLK_T_IN                    0
+#define BLK_DEPTH                   32
+#define BLK_DATA_SIZE               4096
+
+#define NET_TX_QUEUE                1
+#define NET_DEPTH                   128
+#define NET_HDR_SIZE                10
+#define NET_PACKET_SIZE             64
+
+#define SCSI_REQUEST_QUEUE          2
+#define SCSI_DEPTH                  32
+#define SCSI_CMD_SIZE               51
+#define SCSI_RESP_SIZE              108
+#define SCSI_DATA_SIZE              4096
+
+typedef struct VirtioBench {
+    QPCIBus *bus;
+    QVirtioPCIDevice *dev;
+    QGuestAllocator *alloc;
+    QVirtQueue *vq;
+    unsigned depth;
+    unsigned descs;
+    uint16_t avail_idx;
+} VirtioBench;
+
+static double bench_seconds(void)
+{
+    const char *s = getenv("QTEST_BENCH_SECONDS");
+
+    return s ? atof(s) : BENCH_DEFAULT_SECONDS;
+}
+
+static void bench_start(VirtioBench *b, const char *cmdline,
+                        uint16_t device_type, uint16_t queue,
+                        unsigned depth, unsigned descs)
+{
+    qtest_start(cmdline);
+    b->bus = qpci_init_pc();
+
+    b->dev = qvirtio_pci_device_find(b->bus, device_type);
+    g_assert(b->dev != NULL);
+    qvirtio_pci_device_enable(b->dev);
+    qvirtio_reset(&qvirtio_pci, &b->dev->vdev);
+    qvirtio_set_acknowledge(&qvirtio_pci, &b->dev->vdev);
+    qvirtio_set_driver(&qvirtio_pci, &b->dev->vdev);
+
+    /* No features: legacy header layouts, no indirect or event index */
+    qvirtio_set_features(&qvirtio_pci, &b->dev->vdev, 0);
+
+    b->alloc = pc_alloc_init();
+    b->vq = qvirtqueue_setup(&qvirtio_pci, &b->dev->vdev, b->alloc, queue);
+    g_assert_cmpuint(depth * descs, <=, b->vq->size);
+    b->depth = depth;
+    b->descs = descs;
+    b->avail_idx = 0;
+
+    qvirtio_set_driver_ok(&qvirtio_pci, &b->dev->vdev);
+}
+
+static void bench_end(VirtioBench *b)
+{
+    guest_free(b->alloc, b->vq->desc);
+    g_free(b->vq);
+    pc_alloc_uninit(b->alloc);
+    qvirtio_pci_device_disable(b->dev);
+    g_free(b->dev);
+    qpci_free_pc(b->bus);
+    qtest_end();
+}
+
+/* Descriptor @n of the chain for request slot @slot */
+static void bench_set_desc(VirtioBench *b, unsigned slot, unsigned n,
+                           uint64_t addr, uint32_t len, bool write)
+{
+    unsigned idx = slot * b->descs + n;
+    uint64_t desc = b->vq->desc + idx * BENCH_DESC_SIZE;
+    uint16_t flags = write ? QVRING_DESC_F_WRITE : 0;
+
+    if (n + 1 < b->descs) {
+        flags |= QVRING_DESC_F_NEXT;
+    }
+    writeq(desc, addr);
+    writel(desc + 8, len);
+    writew(desc + 12, flags);
+    writew(desc + 14, idx + 1);
+}
+
+/*
+ * The descriptor chains never change, so a batch is just b->depth avail
+ * entries, one index update and one kick; then wait for the device to
+ * complete all of them.
+ */
+static void bench_batch(VirtioBench *b)
+{
+    gint64 start_time = g_get_monotonic_time();
+    unsigned i;
+
+    for (i = 0; i < b->depth; i++) {
+        writew(b->vq->avail + 4 + 2 * ((b->avail_idx + i) % b->vq->size),
+               i * b->descs);
+    }
+    b->avail_idx += b->depth;
+    writew(b->vq->avail + 2, b->avail_idx);
+    qvirtio_pci.virtqueue_kick(&b->dev->vdev, b->vq);
+
+    /* vq->used->idx */
+    while (readw(b->vq->used + 2) != b->avail_idx) {
+        g_assert(g_get_monotonic_time() - start_time <= BENCH_TIMEOUT_US);
+    }
+}
+
+static void bench_run(VirtioBench *b, const char *name)
+{
+    double limit = bench_seconds();
+    double duration;
+    uint64_t ops = 0;
+
+    g_test_timer_start();
+    do {
+        bench_batch(b);
+        ops += b->depth;
+        duration = g_test_timer_elapsed();
+    } while (duration < limit);
+
+    g_test_message("%s: %" PRIu64 " requests in %f s, queue depth %u",
+                   name, ops, duration, b->depth);
+    g_test_maximized_result(ops / duration, "%s: %.0f requests/s",
+                            name, ops / duration);
+}
+
+static void bench_blk(void)
+{
+    VirtioBench b;
+    uint64_t hdr, data, status;
+    unsigned i;
+
+    bench_start(&b, "-drive if=none,id=drive0,driver=null-co "
+                "-device virtio-blk-pci,drive=drive0",
+                QVIRTIO_BLK_DEVICE_ID, 0, BLK_DEPTH, 3);
+
+    /* Every request reads sector 0 into the same buffer */
+    hdr = guest_alloc(b.alloc, 16);
+    writel(hdr, BLK_T_IN);
+    writel(hdr + 4, 0);
+    writeq(hdr + 8, 0);
+    data = guest_alloc(b.alloc, BLK_DATA_SIZE);
+    status = guest_alloc(b.alloc, 1);
+
+    for (i = 0; i < b.depth; i++) {
+        bench_set_desc(&b, i, 0, hdr, 16, false);
+        bench_set_desc(&b, i, 1, data, BLK_DATA_SIZE, true);
+        bench_set_desc(&b, i, 2, status, 1, true);
+    }
+
+    bench_run(&b, "virtio-blk read 4k");
+
+    guest_free(b.alloc, status);
+    guest_free(b.alloc, data);
+    guest_free(b.alloc, hdr);
+    bench_end(&b);
+}
+
+static void bench_net_tx(void)
+{
+    VirtioBench b;
+    uint8_t packet[NET_HDR_SIZE + NET_PACKET_SIZE] = { 0 };
+    uint64_t buf;
+    unsigned i;
+
+    /* A hub port with no other ports: transmitted packets are dropped */
+    bench_start(&b, "-netdev hubport,id=hp0,hubid=0 "
+                "-device virtio-net-pci,netdev=hp0",
+                QVIRTIO_NET_DEVICE_ID, NET_TX_QUEUE, NET_DEPTH, 1);
+
+    buf = guest_alloc(b.alloc, sizeof(packet));
+    memwrite(buf, packet, sizeof(packet));
+
+    for (i = 0; i < b.depth; i++) {
+        bench_set_desc(&b, i, 0, buf, sizeof(packet), false);
+    }
+
+    bench_run(&b, "virtio-net tx 64b");
+
+    guest_free(b.alloc, buf);
+    bench_end(&b);
+}
+
+static void bench_scsi(void)
+{
+    VirtioBench b;
+    uint8_t cmd[SCSI_CMD_SIZE] = { 0 };
+    uint64_t req, resp, data;
+    unsigned i;
+
+    bench_start(&b, "-drive if=none,id=drive0,driver=null-co "
+                "-device virtio-scsi-pci,id=scsi0 "
+                "-device scsi-hd,bus=scsi0.0,drive=drive0,scsi-id=0,lun=0",
+                QVIRTIO_SCSI_DEVICE_ID, SCSI_REQUEST_QUEUE, SCSI_DEPTH, 3);
+
+    /* Target 0, LUN 0 */
+    cmd[0] = 1;
+    cmd[2] = 0x40;
+    /* READ(10) of 8 512-byte blocks at LBA 0; the CDB starts at byte 19 */
+    cmd[19] = 0x28;
+    cmd[19 + 8] = SCSI_DATA_SIZE / 512;
+
+    req = guest_alloc(b.alloc, SCSI_CMD_SIZE);
+    memwrite(req, cmd, sizeof(cmd));
+    resp = guest_alloc(b.alloc, SCSI_RESP_SIZE);
+    data = guest_alloc(b.alloc, SCSI_DATA_SIZE);
+
+    for (i = 0; i < b.depth; i++) {
+        bench_set_desc(&b, i, 0, req, SCSI_CMD_SIZE, false);
+        bench_set_desc(&b, i, 1, resp, SCSI_RESP_SIZE, true);
+        bench_set_desc(&b, i, 2, data, SCSI_DATA_SIZE, true);
+    }
+
+    bench_run(&b, "virtio-scsi read 4k");
+
+    guest_free(b.alloc, data);
+    guest_free(b.alloc, resp);
+    guest_free(b.alloc, req);
+    bench_end(&b);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (g_test_perf()) {
+        g_test_add_func("/virtio/bench/blk", bench_blk);
+        g_test_add_func("/virtio/bench/net-tx", bench_net_tx);
+        g_test_add_func("/virtio/bench/scsi", bench_scsi);
+    }
+
+    return g_test_run();
+}
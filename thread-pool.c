@@ -22,6 +22,10 @@
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
+#include "qemu/bitmap.h"
+#include "qapi/error.h"
+
+#define THREAD_POOL_MAX_THREADS_DEFAULT 64
 
 static void do_spawn_thread(ThreadPool *pool);
 
@@ -49,6 +53,12 @@ struct ThreadPoolElement {
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
+    /* Pushed atomically by the thread that completes or cancels the
+     * request, then moved to the pool's done list by the completion BH.
+     */
+    QSLIST_ENTRY(ThreadPoolElement) completed;
+    QSIMPLEQ_ENTRY(ThreadPoolElement) done;
+
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
@@ -59,14 +69,22 @@ struct ThreadPool {
     QemuMutex lock;
     QemuCond worker_stopped;
     QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
+    /* Finished requests, pushed lock-free by any thread. */
+    QSLIST_HEAD(, ThreadPoolElement) completed;
+
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) done;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int min_threads;
+    int max_threads;
+    unsigned long *host_cpus;  /* worker affinity, NULL to inherit */
+    unsigned long host_cpus_nbits;
+    unsigned host_cpus_gen;    /* bumped whenever host_cpus changes */
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
@@ -74,25 +92,58 @@ struct ThreadPool {
     bool stopping;
 };
 
+/* Hand a finished request over to the completion BH.  Can be called
+ * from any thread, without holding lock.
+ */
+static void thread_pool_complete_req(ThreadPool *pool, ThreadPoolElement *req)
+{
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->completed, req, completed);
+    qemu_bh_schedule(pool->completion_bh);
+}
+
+/* Runs with lock taken.  */
+static void worker_update_affinity(ThreadPool *pool, unsigned *gen)
+{
+    QemuThread self;
+
+    if (*gen == pool->host_cpus_gen) {
+        return;
+    }
+    *gen = pool->host_cpus_gen;
+    if (pool->host_cpus) {
+        qemu_thread_get_self(&self);
+        qemu_thread_set_affinity(&self, pool->host_cpus,
+                                 pool->host_cpus_nbits);
+    }
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    unsigned host_cpus_gen = 0;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
     do_spawn_thread(pool);
 
-    while (!pool->stopping) {
+    while (!pool->stopping && pool->cur_threads <= pool->max_threads) {
         ThreadPoolElement *req;
         int ret;
 
+        worker_update_affinity(pool, &host_cpus_gen);
+
+        /* Idle workers go away after 10 seconds, but keep min_threads
+         * around so that bursts do not pay for thread creation.
+         */
         do {
             pool->idle_threads++;
             qemu_mutex_unlock(&pool->lock);
             ret = qemu_sem_timedwait(&pool->sem, 10000);
             qemu_mutex_lock(&pool->lock);
             pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
+        } while (ret == -1 && !pool->stopping &&
+                 (!QTAILQ_EMPTY(&pool->request_list) ||
+                  pool->cur_threads <= pool->min_threads));
         if (ret == -1 || pool->stopping) {
             break;
         }
@@ -109,9 +160,9 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
+        thread_pool_complete_req(pool, req);
 
-        qemu_bh_schedule(pool->completion_bh);
+        qemu_mutex_lock(&pool->lock);
     }
 
     pool->cur_threads--;
@@ -163,35 +214,40 @@ static void spawn_thread(ThreadPool *pool)
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
+    QSLIST_HEAD(, ThreadPoolElement) completed;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) batch;
 
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
-        }
-        if (elem->state == THREAD_DONE) {
-            trace_thread_pool_complete(pool, elem, elem->common.opaque,
-                                       elem->ret);
-        }
-        if (elem->state == THREAD_DONE && elem->common.cb) {
-            QLIST_REMOVE(elem, all);
-            /* Read state before ret.  */
-            smp_rmb();
+    /* Grab everything that completed since the last run.  The atomic
+     * list is LIFO, so reverse it to complete requests in order.
+     */
+    QSLIST_MOVE_ATOMIC(&completed, &pool->completed);
+    QSIMPLEQ_INIT(&batch);
+    while ((elem = QSLIST_FIRST(&completed)) != NULL) {
+        QSLIST_REMOVE_HEAD(&completed, completed);
+        QSIMPLEQ_INSERT_HEAD(&batch, elem, done);
+    }
+    QSIMPLEQ_CONCAT(&pool->done, &batch);
 
+    while ((elem = QSIMPLEQ_FIRST(&pool->done)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&pool->done, done);
+        QLIST_REMOVE(elem, all);
+        /* Read state before ret.  */
+        smp_rmb();
+
+        trace_thread_pool_complete(pool, elem, elem->common.opaque,
+                                   elem->ret);
+        if (elem->common.cb) {
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
              */
-            qemu_bh_schedule(pool->completion_bh);
+            if (!QSIMPLEQ_EMPTY(&pool->done)) {
+                qemu_bh_schedule(pool->completion_bh);
+            }
 
             elem->common.cb(elem->common.opaque, elem->ret);
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            /* remove the request */
-            QLIST_REMOVE(elem, all);
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
 }
 
@@ -211,10 +267,10 @@ static void thread_pool_cancel(BlockAIOCB *acb)
          */
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        thread_pool_complete_req(pool, elem);
     }
 
     qemu_mutex_unlock(&pool->lock);
@@ -299,10 +355,13 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
     qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
+    pool->min_threads = 0;
+    pool->max_threads = THREAD_POOL_MAX_THREADS_DEFAULT;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
+    QSLIST_INIT(&pool->completed);
     QLIST_INIT(&pool->head);
+    QSIMPLEQ_INIT(&pool->done);
     QTAILQ_INIT(&pool->request_list);
 }
 
@@ -313,6 +372,44 @@ ThreadPool *thread_pool_new(AioContext *ctx)
     return pool;
 }
 
+void thread_pool_set_params(ThreadPool *pool, int64_t min_threads,
+                            int64_t max_threads, Error **errp)
+{
+    if (min_threads < 0 || max_threads < 1 || min_threads > max_threads ||
+        max_threads > INT_MAX) {
+        error_setg(errp, "thread pool size must satisfy "
+                   "0 <= min <= max and max >= 1");
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    pool->min_threads = min_threads;
+    pool->max_threads = max_threads;
+
+    /* Surplus workers exit once they are done with their current request
+     * or idle; missing ones are started right away.
+     */
+    while (pool->cur_threads < pool->min_threads) {
+        spawn_thread(pool);
+    }
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_set_host_cpus(ThreadPool *pool, const unsigned long *host_cpus,
+                               unsigned long nbits)
+{
+    qemu_mutex_lock(&pool->lock);
+    g_free(pool->host_cpus);
+    pool->host_cpus = NULL;
+    if (host_cpus) {
+        pool->host_cpus = bitmap_new(nbits);
+        bitmap_copy(pool->host_cpus, host_cpus, nbits);
+    }
+    pool->host_cpus_nbits = nbits;
+    pool->host_cpus_gen++;
+    qemu_mutex_unlock(&pool->lock);
+}
+
 void thread_pool_free(ThreadPool *pool)
 {
     if (!pool) {
@@ -341,5 +438,6 @@ void thread_pool_free(ThreadPool *pool)
     qemu_sem_destroy(&pool->sem);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
+    g_free(pool->host_cpus);
     g_free(pool);
 }
@@ -14,6 +14,7 @@
 
 
 extern TraceEvent trace_events[];
+extern bool trace_events_dstate[];
 
 
 static inline TraceEventID trace_event_count(void)
@@ -51,17 +52,22 @@ static inline bool trace_event_get_state_static(TraceEvent *ev)
     return ev->sstate;
 }
 
+static inline bool trace_event_get_state_dynamic_by_id(TraceEventID id)
+{
+    return unlikely(trace_events_dstate[id]);
+}
+
 static inline bool trace_event_get_state_dynamic(TraceEvent *ev)
 {
     assert(ev != NULL);
-    return ev->dstate;
+    return trace_event_get_state_dynamic_by_id(ev->id);
 }
 
 static inline void trace_event_set_state_dynamic(TraceEvent *ev, bool state)
 {
     assert(ev != NULL);
     assert(trace_event_get_state_static(ev));
-    ev->dstate = state;
+    trace_events_dstate[ev->id] = state;
 }
 
 #endif  /* TRACE__CONTROL_INTERNAL_H */
@@ -18,15 +18,16 @@
  * @id: Unique event identifier.
  * @name: Event name.
  * @sstate: Static tracing state.
- * @dstate: Dynamic tracing state.
  *
  * Opaque generic description of a tracing event.
+ *
+ * The dynamic tracing state lives apart, in trace_events_dstate[], so that
+ * the states checked on every trace point are packed one byte per event.
  */
 typedef struct TraceEvent {
     TraceEventID id;
     const char * name;
     const bool sstate;
-    bool dstate;
 } TraceEvent;
 
 
@@ -48,14 +48,34 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 32,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/*
+ * Each thread that traces gets a ring of its own, so recording an event
+ * never contends with other threads.  The owning thread is the only one
+ * that advances write_idx and dropped; the writeout thread is the only
+ * one that advances read_idx and dropped_seen.  Buffers are never freed:
+ * when a thread exits its buffer is released for reuse by a later thread,
+ * which keeps memory bounded by the number of threads alive at once.
+ */
+typedef struct TraceThreadBuf {
+    struct TraceThreadBuf *next;  /* on trace_thread_bufs */
+    int in_use;                   /* owned by a live thread */
+    unsigned int write_idx;       /* free running, owner only */
+    unsigned int read_idx;        /* free running, writeout thread only */
+    unsigned int dropped;         /* events lost to a full buffer */
+    unsigned int dropped_seen;    /* part of dropped already written out */
+    uint8_t buf[TRACE_BUF_LEN];
+} TraceThreadBuf;
+
+static TraceThreadBuf *trace_thread_bufs;
+static __thread TraceThreadBuf *trace_thread_buf;
+#ifndef _WIN32
+static pthread_key_t trace_thread_key;
+#endif
+static uint64_t dropped_events;   /* total, writeout thread only */
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
@@ -76,52 +96,77 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceThreadBuf *tbuf, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceThreadBuf *tbuf, unsigned int idx,
+                                    void *dataptr, size_t size);
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static void clear_buffer_range(TraceThreadBuf *tbuf, unsigned int idx,
+                               size_t len)
 {
     uint32_t num = 0;
     while (num < len) {
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        trace_buf[idx++] = 0;
+        tbuf->buf[idx++] = 0;
         num++;
     }
 }
+
 /**
- * Read a trace record from the trace buffer
+ * Look at the oldest record of a thread's buffer without consuming it
+ *
+ * @tbuf        Thread buffer
+ * @record      Record header to fill
  *
- * @idx         Trace buffer index
+ * Returns false if the record is not valid (not yet finished, or none).
+ */
+static bool peek_trace_record(TraceThreadBuf *tbuf, TraceRecord *record)
+{
+    unsigned int idx = tbuf->read_idx % TRACE_BUF_LEN;
+    uint64_t event_flag = 0;
+
+    /* read the event flag to see if its a valid record */
+    read_from_buffer(tbuf, idx, &event_flag, sizeof(event_flag));
+    if (!(event_flag & TRACE_RECORD_VALID)) {
+        return false;
+    }
+
+    smp_rmb(); /* read memory barrier before accessing record */
+    read_from_buffer(tbuf, idx, record, sizeof(TraceRecord));
+    return true;
+}
+
+/**
+ * Consume the oldest record of a thread's buffer
+ *
+ * @tbuf        Thread buffer
  * @record      Trace record to fill
  *
  * Returns false if the record is not valid.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static bool get_trace_record(TraceThreadBuf *tbuf, TraceRecord **recordptr)
 {
-    uint64_t event_flag = 0;
+    unsigned int idx = tbuf->read_idx % TRACE_BUF_LEN;
     TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
 
-    if (!(record.event & TRACE_RECORD_VALID)) {
+    if (!peek_trace_record(tbuf, &record)) {
         return false;
     }
 
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
     *recordptr = malloc(record.length); /* dont use g_malloc, can deadlock when traced */
     /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
+    read_from_buffer(tbuf, idx, *recordptr, record.length);
     smp_rmb(); /* memory barrier before clearing valid flag */
     (*recordptr)->event &= ~TRACE_RECORD_VALID;
     /* clear the trace buffer range for consumed record otherwise any byte
      * with its MSB set may be considered as a valid event id when the writer
      * thread crosses this range of buffer again.
      */
-    clear_buffer_range(idx, record.length);
+    clear_buffer_range(tbuf, idx, record.length);
+    smp_wmb(); /* cleared before the owner may reuse the space */
+    atomic_set(&tbuf->read_idx, tbuf->read_idx + record.length);
     return true;
 }
 
@@ -154,38 +199,70 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
+/* Returns the number of events dropped since the last call */
+static uint64_t collect_dropped_events(void)
+{
+    TraceThreadBuf *tbuf;
+    unsigned int dropped;
+    uint64_t count = 0;
+
+    for (tbuf = atomic_rcu_read(&trace_thread_bufs); tbuf;
+         tbuf = atomic_rcu_read(&tbuf->next)) {
+        dropped = atomic_read(&tbuf->dropped);
+        count += dropped - tbuf->dropped_seen;
+        tbuf->dropped_seen = dropped;
+    }
+    dropped_events += count;
+    return count;
+}
+
+/* The thread buffer whose oldest record is the earliest, or NULL */
+static TraceThreadBuf *next_trace_buffer(void)
+{
+    TraceThreadBuf *tbuf, *oldest = NULL;
+    TraceRecord record;
+    uint64_t oldest_ns = 0;
+
+    for (tbuf = atomic_rcu_read(&trace_thread_bufs); tbuf;
+         tbuf = atomic_rcu_read(&tbuf->next)) {
+        if (peek_trace_record(tbuf, &record) &&
+            (!oldest || record.timestamp_ns < oldest_ns)) {
+            oldest = tbuf;
+            oldest_ns = record.timestamp_ns;
+        }
+    }
+    return oldest;
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
     TraceRecord *recordptr;
+    TraceThreadBuf *tbuf;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
+    uint64_t dropped_count;
     size_t unused __attribute__ ((unused));
 
     for (;;) {
         wait_for_trace_records_available();
 
-        if (g_atomic_int_get(&dropped_events)) {
+        dropped_count = collect_dropped_events();
+        if (dropped_count) {
             dropped.rec.event = DROPPED_EVENT_ID,
             dropped.rec.timestamp_ns = get_clock();
             dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t),
             dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
             dropped.rec.arguments[0] = dropped_count;
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
+        /* merge the per-thread buffers in timestamp order */
+        while ((tbuf = next_trace_buffer()) != NULL &&
+               get_trace_record(tbuf, &recordptr)) {
             unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
             free(recordptr); /* dont use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
         }
 
         fflush(trace_fp);
@@ -193,52 +270,114 @@ static gpointer writeout_thread(gpointer opaque)
     return NULL;
 }
 
+#ifndef _WIN32
+static void trace_thread_exit(void *opaque)
+{
+    TraceThreadBuf *tbuf = opaque;
+
+    atomic_mb_set(&tbuf->in_use, 0);
+}
+
+static void __attribute__((constructor)) trace_thread_key_init(void)
+{
+    if (pthread_key_create(&trace_thread_key, trace_thread_exit) != 0) {
+        fprintf(stderr, "unable to create trace thread key\n");
+        abort();
+    }
+}
+#endif
+
+/* The calling thread's buffer, claimed or allocated on first use */
+static TraceThreadBuf *get_trace_thread_buf(void)
+{
+    TraceThreadBuf *tbuf = trace_thread_buf;
+
+    if (likely(tbuf)) {
+        return tbuf;
+    }
+
+    /* reuse the buffer of a thread that has exited... */
+    for (tbuf = atomic_rcu_read(&trace_thread_bufs); tbuf;
+         tbuf = atomic_rcu_read(&tbuf->next)) {
+        if (!atomic_read(&tbuf->in_use) &&
+            atomic_cmpxchg(&tbuf->in_use, 0, 1) == 0) {
+            break;
+        }
+    }
+
+    /* ...or add a new one */
+    if (!tbuf) {
+        tbuf = calloc(1, sizeof(*tbuf)); /* dont use g_malloc, can deadlock when traced */
+        if (!tbuf) {
+            return NULL;
+        }
+        tbuf->in_use = 1;
+        do {
+            tbuf->next = atomic_read(&trace_thread_bufs);
+        } while (atomic_cmpxchg(&trace_thread_bufs, tbuf->next, tbuf) !=
+                 tbuf->next);
+    }
+
+#ifndef _WIN32
+    pthread_setspecific(trace_thread_key, tbuf);
+#endif
+    trace_thread_buf = tbuf;
+    return tbuf;
+}
+
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, &val,
+                                   sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, &slen,
+                                   sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->tbuf, rec->rec_off, (void*)s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, TraceEventID event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuf *tbuf = get_trace_thread_buf();
+    unsigned int idx, rec_off;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
     uint64_t event_u64 = event;
     uint64_t timestamp_ns = get_clock();
 
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
+    if (!tbuf) {
+        return -ENOMEM;
+    }
 
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    if (tbuf->write_idx + rec_len - atomic_read(&tbuf->read_idx) >
+        TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        atomic_set(&tbuf->dropped, tbuf->dropped + 1);
+        return -ENOSPC;
+    }
+    smp_rmb(); /* read_idx before overwriting the space it released */
 
-    idx = old_idx % TRACE_BUF_LEN;
+    idx = tbuf->write_idx % TRACE_BUF_LEN;
+    tbuf->write_idx += rec_len;
 
     rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    rec_off = write_to_buffer(tbuf, rec_off, &event_u64, sizeof(event_u64));
+    rec_off = write_to_buffer(tbuf, rec_off, &timestamp_ns,
+                              sizeof(timestamp_ns));
+    rec_off = write_to_buffer(tbuf, rec_off, &rec_len, sizeof(rec_len));
+    rec_off = write_to_buffer(tbuf, rec_off, &trace_pid, sizeof(trace_pid));
 
+    rec->tbuf = tbuf;
     rec->tbuf_idx = idx;
     rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceThreadBuf *tbuf, unsigned int idx,
+                             void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
@@ -246,11 +385,12 @@ static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        data_ptr[x++] = trace_buf[idx++];
+        data_ptr[x++] = tbuf->buf[idx++];
     }
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceThreadBuf *tbuf, unsigned int idx,
+                                    void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
@@ -258,20 +398,21 @@ static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        trace_buf[idx++] = data_ptr[x++];
+        tbuf->buf[idx++] = data_ptr[x++];
     }
     return idx; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
+    TraceThreadBuf *tbuf = rec->tbuf;
     TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    read_from_buffer(tbuf, rec->tbuf_idx, &record, sizeof(TraceRecord));
     smp_wmb(); /* write barrier before marking as valid */
     record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    write_to_buffer(tbuf, rec->tbuf_idx, &record, sizeof(TraceRecord));
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
+    if (tbuf->write_idx - atomic_read(&tbuf->read_idx)
         > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
@@ -342,6 +483,10 @@ void st_print_trace_file_status(FILE *stream, int (*stream_printf)(FILE *stream,
 {
     stream_printf(stream, "Trace file \"%s\" %s.\n",
                   trace_file_name, trace_fp ? "on" : "off");
+    if (dropped_events) {
+        stream_printf(stream, "%" PRIu64 " events dropped (buffer full).\n",
+                      dropped_events);
+    }
 }
 
 void st_flush_trace_buffer(void)
@@ -25,6 +25,7 @@ bool st_init(const char *file);
 void st_flush_trace_buffer(void);
 
 typedef struct {
+    struct TraceThreadBuf *tbuf;  /* the recording thread's buffer */
     unsigned int tbuf_idx;
     unsigned int rec_off;
 } TraceBufferRecord;
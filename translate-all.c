@@ -59,7 +59,10 @@
 
 #include "exec/cputlb.h"
 #include "translate-all.h"
+#include "elf.h"
 #include "qemu/timer.h"
+#include "qemu/rcu.h"
+#include "qmp-commands.h"
 
 //#define DEBUG_TB_INVALIDATE
 //#define DEBUG_FLUSH
@@ -82,9 +85,19 @@ typedef struct PageDesc {
     uint8_t *code_bitmap;
 #if defined(CONFIG_USER_ONLY)
     unsigned long flags;
+    /* write faults taken because of translated code, up to
+       SMC_CHECK_THRESHOLD */
+    unsigned int smc_faults;
 #endif
 } PageDesc;
 
+#if defined(CONFIG_USER_ONLY) && !defined(TARGET_HAS_PRECISE_SMC)
+/* Once a page has been made writable again this many times (a guest JIT
+   writing next to the code it runs), new TBs from it are translated with
+   CF_SMC_CHECK instead of write-protecting the page.  */
+#define SMC_CHECK_THRESHOLD 4
+#endif
+
 /* In system mode we want L1_MAP to be based on ram offsets,
    while in user mode we want it to be based on virtual addresses.  */
 #if !defined(CONFIG_USER_ONLY)
@@ -126,10 +139,215 @@ static void *l1_map[V_L1_SIZE];
 /* code generation context */
 TCGContext tcg_ctx;
 
+unsigned int tcg_tb_hot_threshold;
+
+/* Write /tmp/perf-<pid>.map, which lets perf attribute samples in the
+   code buffer to the guest code each TB was translated from.  */
+bool tcg_perf_map;
+static FILE *tb_perf_map_file;
+
+/* Write /tmp/jit-<pid>.dump in perf's jitdump format, which also carries
+   a copy of the generated code so that "perf inject --jit" can annotate
+   it.  */
+bool tcg_jitdump;
+#ifdef __linux__
+static FILE *tb_jitdump_file;
+static uint64_t tb_jitdump_index;
+
+#define JITDUMP_MAGIC        0x4A695444
+#define JITDUMP_VERSION      1
+#define JITDUMP_CODE_LOAD    0
+
+typedef struct JitdumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} JitdumpHeader;
+
+typedef struct JitdumpCodeLoad {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    /* followed by the NUL-terminated name and the code */
+} JitdumpCodeLoad;
+#endif
+
+/* The code buffer is split into regions that are filled in order.  Once
+   the last one is full, the oldest region is evicted and reused, so only
+   the TBs that lived in it need to be retranslated instead of the whole
+   buffer being flushed.  Buffers too small to be split use one region,
+   which degrades to the usual tb_flush().  */
+#define TB_MAX_REGIONS       8
+#define TB_REGION_MIN_SIZE   (4u * 1024 * 1024)
+
+typedef struct TBRegion {
+    void *start;            /* first byte of generated code */
+    void *end;              /* no new TB may start past this point */
+    void *ptr;              /* end of the generated code, when not current */
+    TranslationBlock *tbs;  /* descriptors of the TBs generated in here */
+    int nb_tbs;
+} TBRegion;
+
+static struct {
+    TBRegion r[TB_MAX_REGIONS];
+    size_t n;
+    size_t size;
+    size_t current;
+    int max_blocks;         /* per region */
+} tb_regions;
+
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2);
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
 
+static void tb_perf_map_add(TranslationBlock *tb, int gen_code_size)
+{
+    const char *sym;
+
+    if (!tb_perf_map_file) {
+        char *name = g_strdup_printf("/tmp/perf-%d.map", getpid());
+
+        tb_perf_map_file = fopen(name, "w");
+        if (!tb_perf_map_file) {
+            fprintf(stderr, "qemu: cannot open %s: %s\n", name,
+                    strerror(errno));
+            tcg_perf_map = false;
+            g_free(name);
+            return;
+        }
+        g_free(name);
+        /* perf may read the map while we run; don't hold back entries */
+        setvbuf(tb_perf_map_file, NULL, _IOLBF, 0);
+    }
+
+    sym = lookup_symbol(tb->pc);
+    fprintf(tb_perf_map_file, "%" PRIxPTR " %x guest:" TARGET_FMT_lx "%s%s\n",
+            (uintptr_t)tb->tc_ptr, gen_code_size, tb->pc,
+            *sym ? " " : "", sym);
+}
+
+#ifdef __linux__
+/* perf matches the records against CLOCK_MONOTONIC (perf record -k 1) */
+static uint64_t tb_jitdump_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t tb_jitdump_elf_mach(void)
+{
+#if defined(__x86_64__)
+    return EM_X86_64;
+#elif defined(__i386__)
+    return EM_386;
+#elif defined(__aarch64__)
+    return EM_AARCH64;
+#elif defined(__arm__)
+    return EM_ARM;
+#elif defined(__powerpc64__)
+    return EM_PPC64;
+#elif defined(__powerpc__)
+    return EM_PPC;
+#elif defined(__s390__)
+    return EM_S390;
+#elif defined(__sparc__)
+    return EM_SPARCV9;
+#elif defined(__mips__)
+    return EM_MIPS;
+#else
+    return EM_NONE;
+#endif
+}
+
+static bool tb_jitdump_open(void)
+{
+    char *name = g_strdup_printf("/tmp/jit-%d.dump", getpid());
+    JitdumpHeader header = {
+        .magic = JITDUMP_MAGIC,
+        .version = JITDUMP_VERSION,
+        .total_size = sizeof(header),
+        .elf_mach = tb_jitdump_elf_mach(),
+        .pid = getpid(),
+        .timestamp = tb_jitdump_timestamp(),
+    };
+    void *marker;
+
+    tb_jitdump_file = fopen(name, "w+");
+    if (!tb_jitdump_file) {
+        fprintf(stderr, "qemu: cannot open %s: %s\n", name, strerror(errno));
+        g_free(name);
+        return false;
+    }
+    g_free(name);
+
+    /* perf record finds the file through this executable mapping */
+    marker = mmap(NULL, getpagesize(), PROT_READ | PROT_EXEC, MAP_PRIVATE,
+                  fileno(tb_jitdump_file), 0);
+    if (marker == MAP_FAILED) {
+        fprintf(stderr, "qemu: cannot map jitdump file: %s\n",
+                strerror(errno));
+        fclose(tb_jitdump_file);
+        tb_jitdump_file = NULL;
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, tb_jitdump_file);
+    fflush(tb_jitdump_file);
+    return true;
+}
+
+static void tb_jitdump_add(TranslationBlock *tb, int gen_code_size)
+{
+    JitdumpCodeLoad rec;
+    char *name;
+    const char *sym;
+
+    if (!tb_jitdump_file && !tb_jitdump_open()) {
+        tcg_jitdump = false;
+        return;
+    }
+
+    sym = lookup_symbol(tb->pc);
+    name = g_strdup_printf("guest:" TARGET_FMT_lx "%s%s", tb->pc,
+                           *sym ? " " : "", sym);
+
+    rec.id = JITDUMP_CODE_LOAD;
+    rec.total_size = sizeof(rec) + strlen(name) + 1 + gen_code_size;
+    rec.timestamp = tb_jitdump_timestamp();
+    rec.pid = getpid();
+    rec.tid = qemu_get_thread_id();
+    rec.vma = (uintptr_t)tb->tc_ptr;
+    rec.code_addr = (uintptr_t)tb->tc_ptr;
+    rec.code_size = gen_code_size;
+    rec.code_index = tb_jitdump_index++;
+
+    fwrite(&rec, sizeof(rec), 1, tb_jitdump_file);
+    fwrite(name, strlen(name) + 1, 1, tb_jitdump_file);
+    fwrite(tb->tc_ptr, gen_code_size, 1, tb_jitdump_file);
+    fflush(tb_jitdump_file);
+    g_free(name);
+}
+#else
+static void tb_jitdump_add(TranslationBlock *tb, int gen_code_size)
+{
+    fprintf(stderr, "qemu: jitdump is only supported on Linux hosts\n");
+    tcg_jitdump = false;
+}
+#endif
+
 void cpu_gen_init(void)
 {
     tcg_context_init(&tcg_ctx); 
@@ -181,6 +399,18 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #endif
     gen_code_size = tcg_gen_code(s, gen_code_buf);
     *gen_code_size_ptr = gen_code_size;
+    s->stats.guest_insns += tb->icount;
+    s->stats.guest_bytes += tb->size;
+    s->stats.host_bytes += gen_code_size;
+    if (tb->icount > s->stats.max_tb_insns) {
+        s->stats.max_tb_insns = tb->icount;
+    }
+    if (tcg_perf_map) {
+        tb_perf_map_add(tb, gen_code_size);
+    }
+    if (tcg_jitdump) {
+        tb_jitdump_add(tb, gen_code_size);
+    }
 #ifdef CONFIG_PROFILER
     s->code_time += profile_getclock();
     s->code_in_len += tb->size;
@@ -652,6 +882,31 @@ static inline void *alloc_code_gen_buffer(void)
 }
 #endif /* USE_STATIC_CODE_GEN_BUFFER, USE_MMAP */
 
+static void tb_regions_init(void)
+{
+    size_t i;
+
+    tb_regions.n = tcg_ctx.code_gen_buffer_size / TB_REGION_MIN_SIZE;
+    tb_regions.n = MAX(tb_regions.n, 1);
+    tb_regions.n = MIN(tb_regions.n, TB_MAX_REGIONS);
+    tb_regions.size = (tcg_ctx.code_gen_buffer_size / tb_regions.n) &
+                      ~(size_t)(CODE_GEN_ALIGN - 1);
+    tb_regions.max_blocks = tcg_ctx.code_gen_max_blocks / tb_regions.n;
+    tb_regions.current = 0;
+
+    for (i = 0; i < tb_regions.n; i++) {
+        TBRegion *r = &tb_regions.r[i];
+
+        r->start = tcg_ctx.code_gen_buffer + i * tb_regions.size;
+        r->end = i == tb_regions.n - 1 ?
+                 tcg_ctx.code_gen_buffer + tcg_ctx.code_gen_buffer_max_size :
+                 r->start + tb_regions.size - (TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
+        r->ptr = r->start;
+        r->tbs = tcg_ctx.tb_ctx.tbs + i * tb_regions.max_blocks;
+        r->nb_tbs = 0;
+    }
+}
+
 static inline void code_gen_alloc(size_t tb_size)
 {
     tcg_ctx.code_gen_buffer_size = size_code_gen_buffer(tb_size);
@@ -679,6 +934,14 @@ static inline void code_gen_alloc(size_t tb_size)
             CODE_GEN_AVG_BLOCK_SIZE;
     tcg_ctx.tb_ctx.tbs =
             g_malloc(tcg_ctx.code_gen_max_blocks * sizeof(TranslationBlock));
+    tb_regions_init();
+}
+
+static void tb_htable_init(void)
+{
+    unsigned int mode = QHT_MODE_AUTO_RESIZE;
+
+    qht_init(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE, mode);
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -688,6 +951,7 @@ void tcg_exec_init(unsigned long tb_size)
 {
     cpu_gen_init();
     code_gen_alloc(tb_size);
+    tb_htable_init();
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
     tcg_register_jit(tcg_ctx.code_gen_buffer, tcg_ctx.code_gen_buffer_size);
     page_init();
@@ -707,31 +971,74 @@ bool tcg_enabled(void)
    too many translation blocks or too much generated code. */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBRegion *r = &tb_regions.r[tb_regions.current];
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks ||
-        (tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
-         tcg_ctx.code_gen_buffer_max_size) {
+    if (r->nb_tbs >= tb_regions.max_blocks ||
+        tcg_ctx.code_gen_ptr >= r->end) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &r->tbs[r->nb_tbs++];
+    tcg_ctx.tb_ctx.nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
+    tb->invalid = false;
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    TBRegion *r = &tb_regions.r[tb_regions.current];
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
+        r->nb_tbs--;
         tcg_ctx.tb_ctx.nb_tbs--;
     }
 }
 
+/* Invalidate every TB that still lives in region @r */
+static void tb_region_evict(TBRegion *r)
+{
+    int i;
+
+    for (i = 0; i < r->nb_tbs; i++) {
+        TranslationBlock *tb = &r->tbs[i];
+
+        if (!tb->invalid) {
+            tb_phys_invalidate(tb, -1);
+        }
+    }
+    tcg_ctx.tb_ctx.nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    r->ptr = r->start;
+}
+
+/* The current region is full: continue in the next one, evicting the
+   oldest translations if it is in use.  */
+static void tb_region_advance(CPUArchState *env)
+{
+    TBRegion *r;
+
+    if (tb_regions.n == 1) {
+        tb_flush(env);
+        return;
+    }
+
+    tb_regions.r[tb_regions.current].ptr = tcg_ctx.code_gen_ptr;
+    tb_regions.current = (tb_regions.current + 1) % tb_regions.n;
+    r = &tb_regions.r[tb_regions.current];
+    if (r->nb_tbs) {
+        tb_region_evict(r);
+        tcg_ctx.tb_ctx.tb_region_evict_count++;
+    }
+    tcg_ctx.code_gen_ptr = r->start;
+}
+
 static inline void invalidate_page_bitmap(PageDesc *p)
 {
     if (p->code_bitmap) {
@@ -774,11 +1081,51 @@ static void page_flush_tb(void)
     }
 }
 
+/* Set while this thread holds tb_lock, so that cpu_exec() can drop the
+   lock after a longjmp out of code that was translating.  */
+static __thread bool have_tb_lock;
+
+/* Serialize translation, TB chaining and the region allocator.  Lookups
+   go through the jump cache and the TB hash table and need no lock, so
+   in user mode only threads that are translating or chaining contend.  */
+void tb_lock(void)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+
+    assert(!have_tb_lock);
+#ifdef CONFIG_USER_ONLY
+    if (pthread_mutex_trylock(&tb_ctx->tb_lock)) {
+        int64_t t = get_clock();
+
+        pthread_mutex_lock(&tb_ctx->tb_lock);
+        tb_ctx->tb_lock_contended++;
+        tb_ctx->tb_lock_wait_ns += get_clock() - t;
+    }
+#endif
+    tb_ctx->tb_lock_count++;
+    have_tb_lock = true;
+}
+
+void tb_unlock(void)
+{
+    assert(have_tb_lock);
+    have_tb_lock = false;
+    spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+}
+
+void tb_lock_reset(void)
+{
+    if (have_tb_lock) {
+        tb_unlock();
+    }
+}
+
 /* flush all the translation blocks */
 /* XXX: tb_flush is currently not thread safe */
 void tb_flush(CPUArchState *env1)
 {
     CPUState *cpu = ENV_GET_CPU(env1);
+    size_t i;
 
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
@@ -792,12 +1139,17 @@ void tb_flush(CPUArchState *env1)
         cpu_abort(cpu, "Internal error: code buffer overflow\n");
     }
     tcg_ctx.tb_ctx.nb_tbs = 0;
+    for (i = 0; i < tb_regions.n; i++) {
+        tb_regions.r[i].nb_tbs = 0;
+        tb_regions.r[i].ptr = tb_regions.r[i].start;
+    }
+    tb_regions.current = 0;
 
     CPU_FOREACH(cpu) {
         memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
     }
 
-    memset(tcg_ctx.tb_ctx.tb_phys_hash, 0, sizeof(tcg_ctx.tb_ctx.tb_phys_hash));
+    qht_reset(&tcg_ctx.tb_ctx.htable);
     page_flush_tb();
 
     tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
@@ -808,59 +1160,46 @@ void tb_flush(CPUArchState *env1)
 
 #ifdef DEBUG_TB_CHECK
 
-static void tb_invalidate_check(target_ulong address)
+static void
+do_tb_invalidate_check(struct qht *ht, void *p, uint32_t hash, void *userp)
 {
-    TranslationBlock *tb;
-    int i;
+    TranslationBlock *tb = p;
+    target_ulong addr = *(target_ulong *)userp;
 
-    address &= TARGET_PAGE_MASK;
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tb_ctx.tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
-            if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
-                  address >= tb->pc + tb->size)) {
-                printf("ERROR invalidate: address=" TARGET_FMT_lx
-                       " PC=%08lx size=%04x\n",
-                       address, (long)tb->pc, tb->size);
-            }
-        }
+    if (!(addr + TARGET_PAGE_SIZE <= tb->pc || addr >= tb->pc + tb->size)) {
+        printf("ERROR invalidate: address=" TARGET_FMT_lx
+               " PC=%08lx size=%04x\n", addr, (long)tb->pc, tb->size);
     }
 }
 
-/* verify that all the pages have correct rights for code */
-static void tb_page_check(void)
+static void tb_invalidate_check(target_ulong address)
 {
-    TranslationBlock *tb;
-    int i, flags1, flags2;
-
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
-                tb = tb->phys_hash_next) {
-            flags1 = page_get_flags(tb->pc);
-            flags2 = page_get_flags(tb->pc + tb->size - 1);
-            if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
-                printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
-                       (long)tb->pc, tb->size, flags1, flags2);
-            }
-        }
-    }
+    address &= TARGET_PAGE_MASK;
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_invalidate_check, &address);
 }
 
-#endif
-
-static inline void tb_hash_remove(TranslationBlock **ptb, TranslationBlock *tb)
+static void
+do_tb_page_check(struct qht *ht, void *p, uint32_t hash, void *userp)
 {
-    TranslationBlock *tb1;
+    TranslationBlock *tb = p;
+    int flags1, flags2;
 
-    for (;;) {
-        tb1 = *ptb;
-        if (tb1 == tb) {
-            *ptb = tb1->phys_hash_next;
-            break;
-        }
-        ptb = &tb1->phys_hash_next;
+    flags1 = page_get_flags(tb->pc);
+    flags2 = page_get_flags(tb->pc + tb->size - 1);
+    if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
+        printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
+               (long)tb->pc, tb->size, flags1, flags2);
     }
 }
 
+/* verify that all the pages have correct rights for code */
+static void tb_page_check(void)
+{
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_page_check, NULL);
+}
+
+#endif
+
 static inline void tb_page_remove(TranslationBlock **ptb, TranslationBlock *tb)
 {
     TranslationBlock *tb1;
@@ -925,8 +1264,8 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
-    tb_hash_remove(&tcg_ctx.tb_ctx.tb_phys_hash[h], tb);
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags);
+    qht_remove(&tcg_ctx.tb_ctx.htable, tb, h);
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -940,8 +1279,6 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
         invalidate_page_bitmap(p);
     }
 
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
-
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
     CPU_FOREACH(cpu) {
@@ -969,6 +1306,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
     tb->jmp_first = (TranslationBlock *)((uintptr_t)tb | 2); /* fail safe */
 
+    tb->invalid = true;
     tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
 }
 
@@ -1028,6 +1366,53 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
+#ifdef SMC_CHECK_THRESHOLD
+static bool tb_page_write_hot(tb_page_addr_t page_addr)
+{
+    PageDesc *p = page_find(page_addr >> TARGET_PAGE_BITS);
+
+    return p && p->smc_faults >= SMC_CHECK_THRESHOLD;
+}
+
+/* Keep a copy of the guest code of a TB from a write-hot page right after
+   its host code, and leave the page writable.  If the region has no room
+   left for the copy, the page is protected as usual.  */
+static void tb_smc_copy(TranslationBlock *tb)
+{
+    TBRegion *r = &tb_regions.r[tb_regions.current];
+    uint8_t *ptr = tcg_ctx.code_gen_ptr;
+
+    if (ptr + tb->size > (uint8_t *)r->start + tb_regions.size) {
+        return;
+    }
+    memcpy(ptr, g2h(tb->pc), tb->size);
+    tb->smc_copy = ptr;
+    tb->cflags |= CF_SMC_CHECK;
+    tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)ptr + tb->size +
+            CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
+    tcg_ctx.tb_ctx.tb_smc_check_count++;
+}
+#endif
+
+#if defined(CONFIG_USER_ONLY)
+/* Called by cpu_exec() before entering a CF_SMC_CHECK TB, which is never
+   chained to.  Returns false, after invalidating the TB, if the guest has
+   modified its code since it was translated.  */
+bool tb_smc_check(TranslationBlock *tb)
+{
+    if (likely(!memcmp(tb->smc_copy, g2h(tb->pc), tb->size))) {
+        return true;
+    }
+    tb_lock();
+    if (!tb->invalid) {
+        tb_phys_invalidate(tb, -1);
+        tcg_ctx.tb_ctx.tb_smc_modified_count++;
+    }
+    tb_unlock();
+    return false;
+}
+#endif
+
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               int flags, int cflags)
@@ -1037,16 +1422,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     int code_gen_size;
+    int64_t ti = get_clock();
 
     phys_pc = get_page_addr_code(env, pc);
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+        /* recycle the oldest region, or flush everything */
+        tb_region_advance(env);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
-        /* Don't forget to invalidate previous TB info.  */
-        tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
     }
     tb->tc_ptr = tcg_ctx.code_gen_ptr;
     tb->cs_base = cs_base;
@@ -1055,6 +1439,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     cpu_gen_code(env, tb, &code_gen_size);
     tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
             code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
+    tb->smc_copy = NULL;
 
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
@@ -1062,10 +1447,33 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if ((pc & TARGET_PAGE_MASK) != virt_page2) {
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
+#ifdef SMC_CHECK_THRESHOLD
+    if (tb_page_write_hot(phys_pc) ||
+        (phys_page2 != -1 && tb_page_write_hot(phys_page2))) {
+        tb_smc_copy(tb);
+    }
+#endif
     tb_link_page(tb, phys_pc, phys_page2);
+    tcg_ctx.tb_ctx.tb_gen_count++;
+    tcg_ctx.tb_ctx.tb_gen_time_ns += get_clock() - ti;
     return tb;
 }
 
+/* Replace a TB that crossed tcg_tb_hot_threshold with a CF_HOT
+   translation of the same code.  The frontend may then follow direct
+   branches and build a superblock.  Must be called with tb_lock held.  */
+TranslationBlock *tb_gen_hot(CPUState *cpu, TranslationBlock *tb)
+{
+    target_ulong pc = tb->pc;
+    target_ulong cs_base = tb->cs_base;
+    int flags = tb->flags;
+    int cflags = (tb->cflags & ~(CF_COUNT_MASK | CF_SMC_CHECK)) | CF_HOT;
+
+    tb_phys_invalidate(tb, -1);
+    tcg_ctx.tb_ctx.tb_hot_count++;
+    return tb_gen_code(cpu, pc, cs_base, flags, cflags);
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -1328,7 +1736,7 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 #if defined(TARGET_HAS_SMC) || 1
 
 #if defined(CONFIG_USER_ONLY)
-    if (p->flags & PAGE_WRITE) {
+    if ((p->flags & PAGE_WRITE) && !(tb->cflags & CF_SMC_CHECK)) {
         target_ulong addr;
         PageDesc *p2;
         int prot;
@@ -1371,17 +1779,11 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
 {
-    unsigned int h;
-    TranslationBlock **ptb;
+    uint32_t h;
 
     /* Grab the mmap lock to stop another thread invalidating this TB
        before we are done.  */
     mmap_lock();
-    /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
-    ptb = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tb->phys_hash_next = *ptb;
-    *ptb = tb;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1403,6 +1805,11 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
         tb_reset_jump(tb, 1);
     }
 
+    /* add in the hash table last, so that lookups only ever see a TB
+       that is fully linked */
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags);
+    qht_insert(&tcg_ctx.tb_ctx.htable, tb, h);
+
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
@@ -1416,20 +1823,28 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
     int m_min, m_max, m;
     uintptr_t v;
     TranslationBlock *tb;
+    TBRegion *r;
+    size_t i;
+    void *end;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    i = (tc_ptr - (uintptr_t)tcg_ctx.code_gen_buffer) / tb_regions.size;
+    if (i >= tb_regions.n) {
+        i = tb_regions.n - 1;
+    }
+    r = &tb_regions.r[i];
+    end = i == tb_regions.current ? tcg_ctx.code_gen_ptr : r->ptr;
+    if (r->nb_tbs <= 0 || tc_ptr >= (uintptr_t)end) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1439,7 +1854,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 #if defined(TARGET_HAS_ICE) && !defined(CONFIG_USER_ONLY)
@@ -1449,14 +1864,17 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
     MemoryRegion *mr;
     hwaddr l = 1;
 
+    rcu_read_lock();
     mr = address_space_translate(as, addr, &addr, &l, false);
     if (!(memory_region_is_ram(mr)
           || memory_region_is_romd(mr))) {
+        rcu_read_unlock();
         return;
     }
     ram_addr = (memory_region_get_ram_addr(mr) & TARGET_PAGE_MASK)
         + addr;
     tb_invalidate_phys_page_range(ram_addr, ram_addr + 1, 0);
+    rcu_read_unlock();
 }
 #endif /* TARGET_HAS_ICE && !defined(CONFIG_USER_ONLY) */
 
@@ -1581,39 +1999,53 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
     memset(&cpu->tb_jmp_cache[i], 0,
            TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
 }
+#endif /* !CONFIG_USER_ONLY */
 
+/* Also used by linux-user for -d tb_stats */
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
+    TCGStats *st = &tcg_ctx.stats;
+    uint64_t nb_gen = tcg_ctx.tb_ctx.tb_gen_count;
     int i, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    ptrdiff_t gen_code_size;
     TranslationBlock *tb;
+    size_t j;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    gen_code_size = 0;
+    for (j = 0; j < tb_regions.n; j++) {
+        TBRegion *r = &tb_regions.r[j];
+
+        gen_code_size += (j == tb_regions.current ? tcg_ctx.code_gen_ptr
+                                                  : r->ptr) - r->start;
+        for (i = 0; i < r->nb_tbs; i++) {
+            tb = &r->tbs[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_buffer_max_size);
+                gen_code_size, tcg_ctx.code_gen_buffer_max_size);
+    cpu_fprintf(f, "TB regions          %zd x %zd bytes (current %zd)\n",
+                tb_regions.n, tb_regions.size, tb_regions.current);
     cpu_fprintf(f, "TB count            %d/%d\n",
             tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
@@ -1621,12 +2053,8 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                     tcg_ctx.tb_ctx.nb_tbs : 0,
             max_target_code_size);
     cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+            tcg_ctx.tb_ctx.nb_tbs ? gen_code_size / tcg_ctx.tb_ctx.nb_tbs : 0,
+            target_code_size ? (double) gen_code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1638,13 +2066,115 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
                         tcg_ctx.tb_ctx.nb_tbs : 0);
     cpu_fprintf(f, "\nStatistics:\n");
+    cpu_fprintf(f, "TB translations     %" PRIu64 " (%" PRId64 " us)\n",
+            tcg_ctx.tb_ctx.tb_gen_count,
+            tcg_ctx.tb_ctx.tb_gen_time_ns / 1000);
+    cpu_fprintf(f, "guest insns         %" PRIu64 " (avg %0.1f/TB max=%d)\n",
+            st->guest_insns,
+            nb_gen ? (double)st->guest_insns / nb_gen : 0,
+            st->max_tb_insns);
+    cpu_fprintf(f, "host bytes/insn     %0.1f (%0.1f per guest byte)\n",
+            st->guest_insns ? (double)st->host_bytes / st->guest_insns : 0,
+            st->guest_bytes ? (double)st->host_bytes / st->guest_bytes : 0);
+    cpu_fprintf(f, "TCG ops/insn        %0.1f (%0.1f after optimization)\n",
+            st->guest_insns ? (double)st->ops / st->guest_insns : 0,
+            st->guest_insns ? (double)st->ops_opt / st->guest_insns : 0);
+    cpu_fprintf(f, "spills/TB           %0.2f\n",
+            nb_gen ? (double)st->spills / nb_gen : 0);
+    cpu_fprintf(f, "helper calls/insn   %0.2f\n",
+            st->guest_insns ? (double)st->helper_calls / st->guest_insns : 0);
     cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d\n",
+            tcg_ctx.tb_ctx.tb_region_evict_count);
+    cpu_fprintf(f, "TB hot retranslations %d\n",
+            tcg_ctx.tb_ctx.tb_hot_count);
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+#if defined(CONFIG_USER_ONLY)
+    cpu_fprintf(f, "SMC checked TBs     %d (%d found modified)\n",
+            tcg_ctx.tb_ctx.tb_smc_check_count,
+            tcg_ctx.tb_ctx.tb_smc_modified_count);
+#endif
+    cpu_fprintf(f, "TB lock count       %" PRIu64 " (%" PRIu64 " contended, "
+            "avg wait %" PRId64 " ns)\n",
+            tcg_ctx.tb_ctx.tb_lock_count, tcg_ctx.tb_ctx.tb_lock_contended,
+            tcg_ctx.tb_ctx.tb_lock_contended ?
+            tcg_ctx.tb_ctx.tb_lock_wait_ns /
+                    (int64_t)tcg_ctx.tb_ctx.tb_lock_contended : 0);
+#if !defined(CONFIG_USER_ONLY)
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+#endif
     tcg_dump_info(f, cpu_fprintf);
 }
 
+#ifndef CONFIG_USER_ONLY
+JitInfo *qmp_query_jit(Error **errp)
+{
+    TCGStats *st = &tcg_ctx.stats;
+    JitInfo *info = g_new0(JitInfo, 1);
+
+    info->translations = tcg_ctx.tb_ctx.tb_gen_count;
+    info->translation_time_ns = tcg_ctx.tb_ctx.tb_gen_time_ns;
+    info->guest_insns = st->guest_insns;
+    info->max_tb_insns = st->max_tb_insns;
+    info->guest_bytes = st->guest_bytes;
+    info->host_bytes = st->host_bytes;
+    info->ops = st->ops;
+    info->ops_optimized = st->ops_opt;
+    info->spills = st->spills;
+    info->helper_calls = st->helper_calls;
+    return info;
+}
+
+void dump_jit_stats(FILE *f, fprintf_function cpu_fprintf)
+{
+    struct qht_stats hst;
+    CPUState *cpu;
+
+    qht_statistics_init(&tcg_ctx.tb_ctx.htable, &hst);
+
+    cpu_fprintf(f, "TB count            %d\n", tcg_ctx.tb_ctx.nb_tbs);
+    cpu_fprintf(f, "TB translations     %" PRIu64 " (%" PRId64 " us)\n",
+            tcg_ctx.tb_ctx.tb_gen_count,
+            tcg_ctx.tb_ctx.tb_gen_time_ns / 1000);
+    cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d\n",
+            tcg_ctx.tb_ctx.tb_region_evict_count);
+    cpu_fprintf(f, "TB hot retranslations %d\n",
+            tcg_ctx.tb_ctx.tb_hot_count);
+    cpu_fprintf(f, "TB invalidate count %d\n",
+            tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+    cpu_fprintf(f, "TB lock count       %" PRIu64 " (%" PRIu64 " contended, "
+            "avg wait %" PRId64 " ns)\n",
+            tcg_ctx.tb_ctx.tb_lock_count, tcg_ctx.tb_ctx.tb_lock_contended,
+            tcg_ctx.tb_ctx.tb_lock_contended ?
+            tcg_ctx.tb_ctx.tb_lock_wait_ns /
+                    (int64_t)tcg_ctx.tb_ctx.tb_lock_contended : 0);
+    cpu_fprintf(f, "TB hash buckets     %zu/%zu (%0.2f%% head buckets used)\n",
+            hst.used_head_buckets, hst.head_buckets,
+            hst.head_buckets ?
+            (double)hst.used_head_buckets / hst.head_buckets * 100 : 0);
+    cpu_fprintf(f, "TB hash occupancy   %zu entries\n", hst.entries);
+    cpu_fprintf(f, "TB hash chain       avg %0.2f buckets, max %zu\n",
+            hst.avg_chain, hst.max_chain);
+
+    CPU_FOREACH(cpu) {
+        uint64_t lookups = cpu->tb_jmp_cache_hits + cpu->tb_jmp_cache_misses;
+
+        cpu_fprintf(f, "\nCPU#%d:\n", cpu->cpu_index);
+        cpu_fprintf(f, "jmp cache hits      %" PRIu64 " (%0.2f%%)\n",
+                cpu->tb_jmp_cache_hits,
+                lookups ? (double)cpu->tb_jmp_cache_hits / lookups * 100 : 0);
+        cpu_fprintf(f, "jmp cache misses    %" PRIu64 "\n",
+                cpu->tb_jmp_cache_misses);
+        cpu_fprintf(f, "jmp cache revalid.  %" PRIu64 "\n",
+                cpu->tb_jmp_cache_revalidations);
+        cpu_fprintf(f, "TLB flush count     %u (page flushes %u, "
+                "large page flushes %u)\n", cpu->tlb_flush_count,
+                cpu->tlb_flush_page_count, cpu->tlb_flush_large_count);
+    }
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
@@ -1839,12 +2369,20 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     end = TARGET_PAGE_ALIGN(start + len);
     start = start & TARGET_PAGE_MASK;
 
+    p = NULL;
     for (addr = start, len = end - start;
          len != 0;
          len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
+        /* Consecutive pages share a leaf of l1_map, so only walk the
+           table again when crossing into the next leaf.  Syscalls on
+           large buffers check every page through here.  */
+        if (p && ((addr >> TARGET_PAGE_BITS) & (V_L2_SIZE - 1))) {
+            p++;
+        } else {
+            p = page_find(addr >> TARGET_PAGE_BITS);
+            if (!p) {
+                return -1;
+            }
         }
         if (!(p->flags & PAGE_VALID)) {
             return -1;
@@ -1899,6 +2437,11 @@ int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
             p = page_find(addr >> TARGET_PAGE_BITS);
             p->flags |= PAGE_WRITE;
             prot |= p->flags;
+#ifdef SMC_CHECK_THRESHOLD
+            if (p->smc_faults < SMC_CHECK_THRESHOLD) {
+                p->smc_faults++;
+            }
+#endif
 
             /* and since the content will be modified, we must invalidate
                the corresponding translated code. */
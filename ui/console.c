@@ -128,6 +128,8 @@ struct QemuConsole {
     QemuUIInfo ui_info;
     const GraphicHwOps *hw_ops;
     void *hw;
+    uint64_t refreshes;     /* hw_ops->gfx_update calls */
+    uint64_t updates;       /* dpy_gfx_update calls */
 
     /* Text console state */
     int width;
@@ -196,6 +198,11 @@ static void gui_update(void *opaque)
     dpy_refresh(ds);
     ds->refreshing = false;
 
+    if (ds->gui_timer == NULL) {
+        /* every listener went idle during the refresh */
+        return;
+    }
+
     QLIST_FOREACH(dcl, &ds->listeners, next) {
         dcl_interval = dcl->update_interval ?
             dcl->update_interval : GUI_REFRESH_INTERVAL_DEFAULT;
@@ -224,7 +231,7 @@ static void gui_setup_refresh(DisplayState *ds)
     bool have_text = false;
 
     QLIST_FOREACH(dcl, &ds->listeners, next) {
-        if (dcl->ops->dpy_refresh != NULL) {
+        if (dcl->ops->dpy_refresh != NULL && !dcl->idle) {
             need_timer = true;
         }
         if (dcl->ops->dpy_gfx_update != NULL) {
@@ -243,6 +250,7 @@ static void gui_setup_refresh(DisplayState *ds)
         timer_del(ds->gui_timer);
         timer_free(ds->gui_timer);
         ds->gui_timer = NULL;
+        trace_console_refresh(0);
     }
 
     ds->have_gfx = have_gfx;
@@ -255,6 +263,7 @@ void graphic_hw_update(QemuConsole *con)
         con = active_console;
     }
     if (con && con->hw_ops->gfx_update) {
+        con->refreshes++;
         con->hw_ops->gfx_update(con->hw);
     }
 }
@@ -332,6 +341,31 @@ void qmp_screendump(const char *filename, Error **errp)
     ppm_save(filename, surface, errp);
 }
 
+ConsoleRefreshInfoList *qmp_query_console_refresh(Error **errp)
+{
+    ConsoleRefreshInfoList *head = NULL, *entry;
+    ConsoleRefreshInfo *info;
+    QemuConsole *con;
+    int i;
+
+    for (i = nb_consoles - 1; i >= 0; i--) {
+        con = consoles[i];
+        info = g_new0(ConsoleRefreshInfo, 1);
+        info->index = con->index;
+        info->active = con == active_console;
+        info->interval = con->ds && con->ds->gui_timer ?
+            con->ds->update_interval : 0;
+        info->refreshes = con->refreshes;
+        info->updates = con->updates;
+
+        entry = g_new0(ConsoleRefreshInfoList, 1);
+        entry->value = info;
+        entry->next = head;
+        head = entry;
+    }
+    return head;
+}
+
 void graphic_hw_text_update(QemuConsole *con, console_ch_t *chardata)
 {
     if (!con) {
@@ -1367,11 +1401,25 @@ void update_displaychangelistener(DisplayChangeListener *dcl,
     DisplayState *ds = dcl->ds;
 
     dcl->update_interval = interval;
-    if (!ds->refreshing && ds->update_interval > interval) {
+    if (!ds->refreshing && ds->gui_timer && ds->update_interval > interval) {
         timer_mod(ds->gui_timer, ds->last_update + interval);
     }
 }
 
+/*
+ * An idle listener doesn't need dpy_refresh calls; once all of them are
+ * idle the refresh timer is stopped and the display devices are no longer
+ * polled at all.
+ */
+void displaychangelistener_set_idle(DisplayChangeListener *dcl, bool idle)
+{
+    if (dcl->idle == idle) {
+        return;
+    }
+    dcl->idle = idle;
+    gui_setup_refresh(dcl->ds);
+}
+
 void unregister_displaychangelistener(DisplayChangeListener *dcl)
 {
     DisplayState *ds = dcl->ds;
@@ -1410,6 +1458,7 @@ void dpy_gfx_update(QemuConsole *con, int x, int y, int w, int h)
     if (!qemu_console_is_visible(con)) {
         return;
     }
+    con->updates++;
     QLIST_FOREACH(dcl, &s->listeners, next) {
         if (con != (dcl->con ? dcl->con : active_console)) {
             continue;
@@ -503,6 +503,9 @@ static QemuOptsList qemu_spice_opts = {
         }, {
             .name = "seamless-migration",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "iothread",
+            .type = QEMU_OPT_STRING,
         },
         { /* end of list */ }
     },
@@ -22,6 +22,9 @@
 #include "monitor/monitor.h"
 #include "ui/console.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/iothread.h"
+#include "qemu/config-file.h"
+#include "qemu/error-report.h"
 #include "trace.h"
 
 #include "ui/spice-display.h"
@@ -194,7 +197,7 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
     QTAILQ_INSERT_TAIL(&ssd->updates, update, next);
 }
 
-static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
+static void qemu_spice_create_update(SimpleSpiceDisplay *ssd, QXLRect *dirty)
 {
     static const int blksize = 32;
     int blocks = (surface_width(ssd->ds) + blksize - 1) / blksize;
@@ -203,7 +206,7 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
     int bpp = surface_bytes_per_pixel(ssd->ds);
     uint8_t *guest, *mirror;
 
-    if (qemu_spice_rect_is_empty(&ssd->dirty)) {
+    if (qemu_spice_rect_is_empty(dirty)) {
         return;
     };
 
@@ -219,12 +222,12 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
 
     guest = surface_data(ssd->ds);
     mirror = (void *)pixman_image_get_data(ssd->mirror);
-    for (y = ssd->dirty.top; y < ssd->dirty.bottom; y++) {
+    for (y = dirty->top; y < dirty->bottom; y++) {
         yoff = y * surface_stride(ssd->ds);
-        for (x = ssd->dirty.left; x < ssd->dirty.right; x += blksize) {
+        for (x = dirty->left; x < dirty->right; x += blksize) {
             xoff = x * bpp;
             blk = x / blksize;
-            bw = MIN(blksize, ssd->dirty.right - x);
+            bw = MIN(blksize, dirty->right - x);
             if (memcmp(guest + yoff + xoff,
                        mirror + yoff + xoff,
                        bw * bpp) == 0) {
@@ -246,13 +249,13 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
         }
     }
 
-    for (x = ssd->dirty.left; x < ssd->dirty.right; x += blksize) {
+    for (x = dirty->left; x < dirty->right; x += blksize) {
         blk = x / blksize;
-        bw = MIN(blksize, ssd->dirty.right - x);
+        bw = MIN(blksize, dirty->right - x);
         if (dirty_top[blk] != -1) {
             QXLRect update = {
                 .top    = dirty_top[blk],
-                .bottom = ssd->dirty.bottom,
+                .bottom = dirty->bottom,
                 .left   = x,
                 .right  = x + bw,
             };
@@ -261,7 +264,7 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
         }
     }
 
-    memset(&ssd->dirty, 0, sizeof(ssd->dirty));
+    memset(dirty, 0, sizeof(*dirty));
 }
 
 static SimpleSpiceCursor*
@@ -375,6 +378,7 @@ void qemu_spice_destroy_host_primary(SimpleSpiceDisplay *ssd)
 void qemu_spice_display_init_common(SimpleSpiceDisplay *ssd)
 {
     qemu_mutex_init(&ssd->lock);
+    qemu_cond_init(&ssd->render_cond);
     QTAILQ_INIT(&ssd->updates);
     ssd->mouse_x = -1;
     ssd->mouse_y = -1;
@@ -411,6 +415,13 @@ void qemu_spice_display_switch(SimpleSpiceDisplay *ssd,
 
     dprint(1, "%s/%d:\n", __func__, ssd->qxl.id);
 
+    /* the iothread may still be reading the old surface and mirror */
+    qemu_mutex_lock(&ssd->lock);
+    while (ssd->render_pending) {
+        qemu_cond_wait(&ssd->render_cond, &ssd->lock);
+    }
+    qemu_mutex_unlock(&ssd->lock);
+
     memset(&ssd->dirty, 0, sizeof(ssd->dirty));
     if (ssd->surface) {
         pixman_image_unref(ssd->surface);
@@ -460,8 +471,20 @@ void qemu_spice_display_refresh(SimpleSpiceDisplay *ssd)
     graphic_hw_update(ssd->dcl.con);
 
     qemu_mutex_lock(&ssd->lock);
-    if (QTAILQ_EMPTY(&ssd->updates) && ssd->ds) {
-        qemu_spice_create_update(ssd);
+    if (ssd->render_bh) {
+        /*
+         * Diffing against the mirror and copying the changed blocks is
+         * the expensive part; hand it to the iothread so it doesn't run
+         * under the global mutex.  It wakes up the spice server itself.
+         */
+        if (!ssd->render_pending && QTAILQ_EMPTY(&ssd->updates) && ssd->ds) {
+            ssd->render_dirty = ssd->dirty;
+            memset(&ssd->dirty, 0, sizeof(ssd->dirty));
+            ssd->render_pending = true;
+            qemu_bh_schedule(ssd->render_bh);
+        }
+    } else if (QTAILQ_EMPTY(&ssd->updates) && ssd->ds) {
+        qemu_spice_create_update(ssd, &ssd->dirty);
         ssd->notify++;
     }
     qemu_spice_cursor_refresh_unlocked(ssd);
@@ -474,6 +497,20 @@ void qemu_spice_display_refresh(SimpleSpiceDisplay *ssd)
     }
 }
 
+/* Runs in the iothread given with -spice iothread=<id> */
+static void qemu_spice_render_bh(void *opaque)
+{
+    SimpleSpiceDisplay *ssd = opaque;
+
+    qemu_mutex_lock(&ssd->lock);
+    qemu_spice_create_update(ssd, &ssd->render_dirty);
+    ssd->render_pending = false;
+    qemu_cond_broadcast(&ssd->render_cond);
+    qemu_mutex_unlock(&ssd->lock);
+
+    qemu_spice_wakeup(ssd);
+}
+
 /* spice display interface callbacks */
 
 static void interface_attach_worker(QXLInstance *sin, QXLWorker *qxl_worker)
@@ -741,11 +778,15 @@ static const DisplayChangeListenerOps display_listener_ops = {
     .dpy_cursor_define = display_mouse_define,
 };
 
-static void qemu_spice_display_init_one(QemuConsole *con)
+static void qemu_spice_display_init_one(QemuConsole *con, IOThread *iothread)
 {
     SimpleSpiceDisplay *ssd = g_new0(SimpleSpiceDisplay, 1);
 
     qemu_spice_display_init_common(ssd);
+    if (iothread) {
+        ssd->render_bh = aio_bh_new(iothread_get_aio_context(iothread),
+                                    qemu_spice_render_bh, ssd);
+    }
 
     ssd->qxl.base.sif = &dpy_interface.base;
     qemu_spice_add_display_interface(&ssd->qxl, con);
@@ -760,9 +801,20 @@ static void qemu_spice_display_init_one(QemuConsole *con)
 
 void qemu_spice_display_init(void)
 {
+    QemuOpts *opts = QTAILQ_FIRST(&qemu_find_opts("spice")->head);
+    const char *iothread_id = opts ? qemu_opt_get(opts, "iothread") : NULL;
+    IOThread *iothread = NULL;
     QemuConsole *con;
     int i;
 
+    if (iothread_id) {
+        iothread = iothread_find(iothread_id);
+        if (!iothread) {
+            error_report("spice: iothread '%s' not found", iothread_id);
+            exit(1);
+        }
+    }
+
     for (i = 0;; i++) {
         con = qemu_console_lookup_by_index(i);
         if (!con || !qemu_console_is_graphic(con)) {
@@ -771,6 +823,6 @@ void qemu_spice_display_init(void)
         if (qemu_spice_have_display_interface(con)) {
             continue;
         }
-        qemu_spice_display_init_one(con);
+        qemu_spice_display_init_one(con, iothread);
     }
 }
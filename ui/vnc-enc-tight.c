@@ -1422,17 +1422,34 @@ static int send_sub_rect_nojpeg(VncState *vs, int x, int y, int w, int h,
 }
 
 #ifdef CONFIG_VNC_JPEG
+/*
+ * Regions that keep changing (video, animations) are sent as JPEG no
+ * matter what; drop one quality level for every doubling of the update
+ * rate above the threshold.  Nobody can see the artifacts of a frame
+ * that is replaced a few milliseconds later, and the lossless refresh
+ * done by vnc_refresh_lossy_rect() fixes them once the region settles.
+ */
+static int tight_motion_jpeg_quality(VncState *vs, double freq)
+{
+    int level = vs->tight.quality;
+    double threshold = tight_jpeg_conf[level].jpeg_freq_threshold;
+
+    while (level > 0 && freq >= threshold * 2) {
+        level--;
+        freq /= 2;
+    }
+    return tight_conf[level].jpeg_quality;
+}
+
 static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
                               int bg, int fg, int colors,
-                              VncPalette *palette, bool force)
+                              VncPalette *palette, bool force, int quality)
 {
     int ret;
 
     if (colors == 0) {
         if (force || (tight_jpeg_conf[vs->tight.quality].jpeg_full &&
                       tight_detect_smooth_image(vs, w, h))) {
-            int quality = tight_conf[vs->tight.quality].jpeg_quality;
-
             ret = send_jpeg_rect(vs, x, y, w, h, quality);
         } else {
             ret = send_full_color_rect(vs, x, y, w, h);
@@ -1445,8 +1462,6 @@ static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
         if (force || (colors > 96 &&
                       tight_jpeg_conf[vs->tight.quality].jpeg_idx &&
                       tight_detect_smooth_image(vs, w, h))) {
-            int quality = tight_conf[vs->tight.quality].jpeg_quality;
-
             ret = send_jpeg_rect(vs, x, y, w, h, quality);
         } else {
             ret = send_palette_rect(vs, x, y, w, h, palette);
@@ -1467,6 +1482,7 @@ static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
 #ifdef CONFIG_VNC_JPEG
     bool force_jpeg = false;
     bool allow_jpeg = true;
+    int quality = 0;
 #endif
 
     vnc_framebuffer_update(vs, x, y, w, h, vs->tight.type);
@@ -1476,6 +1492,9 @@ static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
     vnc_tight_stop(vs);
 
 #ifdef CONFIG_VNC_JPEG
+    if (vs->tight.quality != (uint8_t)-1) {
+        quality = tight_conf[vs->tight.quality].jpeg_quality;
+    }
     if (!vs->vd->non_adaptive && vs->tight.quality != (uint8_t)-1) {
         double freq = vnc_update_freq(vs, x, y, w, h);
 
@@ -1484,6 +1503,7 @@ static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
         }
         if (freq >= tight_jpeg_conf[vs->tight.quality].jpeg_freq_threshold) {
             force_jpeg = true;
+            quality = tight_motion_jpeg_quality(vs, freq);
             vnc_sent_lossy_rect(vs, x, y, w, h);
         }
     }
@@ -1494,7 +1514,7 @@ static int send_sub_rect(VncState *vs, int x, int y, int w, int h)
 #ifdef CONFIG_VNC_JPEG
     if (allow_jpeg && vs->tight.quality != (uint8_t)-1) {
         ret = send_sub_rect_jpeg(vs, x, y, w, h, bg, fg, colors, palette,
-                                 force_jpeg);
+                                 force_jpeg, quality);
     } else {
         ret = send_sub_rect_nojpeg(vs, x, y, w, h, bg, fg, colors, palette);
     }
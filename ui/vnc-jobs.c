@@ -41,29 +41,38 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
- * its own output buffer.
+ * While a VNC worker thread is working, it holds the VncDisplay global lock
+ * shared with the other workers, to avoid screen corruption (this does not
+ * block vnc_refresh() because it uses trylock()) but the output lock is not
+ * held because the thread works on its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Several workers can serve the queue.  Encoder state (zlib streams, tight
+ * palettes) belongs to the client, so the jobs of one client run one at a
+ * time, in order; jobs of different clients run in parallel.
  */
 
+#define VNC_WORKERS_MAX 64
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
-    Buffer buffer;
     bool exit;
+    int nworkers;       /* threads started */
+    int nrunning;       /* threads that haven't exited yet */
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
-/*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
- */
+typedef struct VncWorker {
+    QemuThread thread;
+    Buffer buffer;      /* output buffer, reused across jobs */
+    VncJobQueue *queue;
+} VncWorker;
+
+/* A single global queue, served by one or more worker threads */
 static VncJobQueue *queue;
 
 static void vnc_lock_queue(VncJobQueue *queue)
@@ -142,7 +151,8 @@ void vnc_jobs_clear(VncState *vs)
 
     vnc_lock_queue(queue);
     QTAILQ_FOREACH_SAFE(job, &queue->jobs, next, tmp) {
-        if (job->vs == vs || !vs) {
+        /* A running job is removed by its worker */
+        if ((job->vs == vs || !vs) && !job->running) {
             QTAILQ_REMOVE(&queue->jobs, job, next);
         }
     }
@@ -179,7 +189,8 @@ void vnc_jobs_consume_buffer(VncState *vs)
 /*
  * Copy data for local use
  */
-static void vnc_async_encoding_start(VncState *orig, VncState *local)
+static void vnc_async_encoding_start(VncWorker *worker, VncState *orig,
+                                     VncState *local)
 {
     local->vnc_encoding = orig->vnc_encoding;
     local->features = orig->features;
@@ -192,13 +203,14 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->zlib = orig->zlib;
     local->hextile = orig->hextile;
     local->zrle = orig->zrle;
-    local->output =  queue->buffer;
+    local->output = worker->buffer;
     local->csock = -1; /* Don't do any network work on this thread */
 
     buffer_reset(&local->output);
 }
 
-static void vnc_async_encoding_end(VncState *orig, VncState *local)
+static void vnc_async_encoding_end(VncWorker *worker, VncState *orig,
+                                   VncState *local)
 {
     orig->tight = local->tight;
     orig->zlib = local->zlib;
@@ -206,11 +218,34 @@ static void vnc_async_encoding_end(VncState *orig, VncState *local)
     orig->zrle = local->zrle;
     orig->lossy_rect = local->lossy_rect;
 
-    queue->buffer = local->output;
+    worker->buffer = local->output;
 }
 
-static int vnc_worker_thread_loop(VncJobQueue *queue)
+/* The oldest job whose client has no earlier job queued or running */
+static VncJob *vnc_queue_next_job(VncJobQueue *queue)
 {
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->running) {
+            continue;
+        }
+        for (prev = QTAILQ_FIRST(&queue->jobs); prev != job;
+             prev = QTAILQ_NEXT(prev, next)) {
+            if (prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (prev == job) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static int vnc_worker_thread_loop(VncWorker *worker)
+{
+    VncJobQueue *queue = worker->queue;
     VncJob *job;
     VncRectEntry *entry, *tmp;
     VncState vs;
@@ -218,16 +253,15 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     int saved_offset;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    while (!queue->exit && !(job = vnc_queue_next_job(queue))) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
-    /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-
     if (queue->exit) {
+        vnc_unlock_queue(queue);
         return -1;
     }
+    job->running = true;
+    vnc_unlock_queue(queue);
 
     vnc_lock_output(job->vs);
     if (job->vs->csock == -1 || job->vs->abort == true) {
@@ -237,7 +271,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     vnc_unlock_output(job->vs);
 
     /* Make a local copy of vs and switch output buffers */
-    vnc_async_encoding_start(job->vs, &vs);
+    vnc_async_encoding_start(worker, job->vs, &vs);
 
     /* Start sending rectangles */
     n_rectangles = 0;
@@ -246,14 +280,14 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
+    vnc_lock_display_shared(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->csock == -1) {
-            vnc_unlock_display(job->vs->vd);
+            vnc_unlock_display_shared(job->vs->vd);
             /* Copy persistent encoding data */
-            vnc_async_encoding_end(job->vs, &vs);
+            vnc_async_encoding_end(worker, job->vs, &vs);
             goto disconnected;
         }
 
@@ -265,7 +299,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         }
         g_free(entry);
     }
-    vnc_unlock_display(job->vs->vd);
+    vnc_unlock_display_shared(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -277,12 +311,12 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         buffer_append(&job->vs->jobs_buffer, vs.output.buffer,
                       vs.output.offset);
         /* Copy persistent encoding data */
-        vnc_async_encoding_end(job->vs, &vs);
+        vnc_async_encoding_end(worker, job->vs, &vs);
 
 	qemu_bh_schedule(job->vs->bh);
     }  else {
         /* Copy persistent encoding data */
-        vnc_async_encoding_end(job->vs, &vs);
+        vnc_async_encoding_end(worker, job->vs, &vs);
     }
     vnc_unlock_output(job->vs);
 
@@ -309,19 +343,29 @@ static void vnc_queue_clear(VncJobQueue *q)
 {
     qemu_cond_destroy(&queue->cond);
     qemu_mutex_destroy(&queue->mutex);
-    buffer_free(&queue->buffer);
     g_free(q);
     queue = NULL; /* Unset global queue */
 }
 
 static void *vnc_worker_thread(void *arg)
 {
-    VncJobQueue *queue = arg;
+    VncWorker *worker = arg;
+    VncJobQueue *queue = worker->queue;
+    bool last;
+
+    qemu_thread_get_self(&worker->thread);
 
-    qemu_thread_get_self(&queue->thread);
+    while (!vnc_worker_thread_loop(worker)) ;
 
-    while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+    buffer_free(&worker->buffer);
+    g_free(worker);
+
+    vnc_lock_queue(queue);
+    last = --queue->nrunning == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
@@ -330,6 +374,17 @@ static bool vnc_worker_thread_running(void)
     return queue; /* Check global queue */
 }
 
+static void vnc_add_worker_thread(VncJobQueue *q)
+{
+    VncWorker *worker = g_malloc0(sizeof(VncWorker));
+
+    worker->queue = q;
+    q->nworkers++;
+    q->nrunning++;
+    qemu_thread_create(&worker->thread, "vnc_worker", vnc_worker_thread,
+                       worker, QEMU_THREAD_DETACHED);
+}
+
 void vnc_start_worker_thread(void)
 {
     VncJobQueue *q;
@@ -338,11 +393,27 @@ void vnc_start_worker_thread(void)
         return ;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
+    vnc_lock_queue(q);
+    vnc_add_worker_thread(q);
+    vnc_unlock_queue(q);
     queue = q; /* Set global queue */
 }
 
+/* Grow the pool to @n threads; it never shrinks */
+void vnc_set_worker_threads(int n)
+{
+    if (!vnc_worker_thread_running()) {
+        return;
+    }
+
+    n = MIN(n, VNC_WORKERS_MAX);
+    vnc_lock_queue(queue);
+    while (queue->nworkers < n && !queue->exit) {
+        vnc_add_worker_thread(queue);
+    }
+    vnc_unlock_queue(queue);
+}
+
 void vnc_stop_worker_thread(void)
 {
     if (!vnc_worker_thread_running())
@@ -2683,6 +2683,30 @@ static void vnc_rect_updated(VncDisplay *vd, int x, int y, struct timeval * tv)
     rect->updated = true;
 }
 
+/* Compare one dirty chunk, VNC_DIRTY_PIXELS_PER_BIT server pixels wide */
+static inline bool vnc_chunk_equal(const uint8_t *a, const uint8_t *b,
+                                   int len)
+{
+    const int chunk = VNC_DIRTY_PIXELS_PER_BIT * VNC_SERVER_FB_BYTES;
+    const VECTYPE zero = (VECTYPE){0};
+    VECTYPE va, vb, diff = zero;
+    int i;
+
+    QEMU_BUILD_BUG_ON(chunk % sizeof(VECTYPE));
+
+    if (len != chunk) {
+        return !memcmp(a, b, len);
+    }
+
+    /* Rows have no particular alignment; memcpy makes unaligned loads */
+    for (i = 0; i < chunk; i += sizeof(VECTYPE)) {
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        diff |= va ^ vb;
+    }
+    return ALL_EQ(diff, zero);
+}
+
 static int vnc_refresh_server_surface(VncDisplay *vd)
 {
     int width = MIN(pixman_image_get_width(vd->guest.fb),
@@ -2721,7 +2745,8 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
     min_stride = MIN(server_stride, guest_stride);
 
     for (;;) {
-        int x;
+        int x, xend, xmax;
+        size_t run_bytes;
         uint8_t *guest_ptr, *server_ptr;
         unsigned long offset = find_next_bit((unsigned long *) &vd->guest.dirty,
                                              height * VNC_DIRTY_BPL(&vd->guest),
@@ -2743,7 +2768,22 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
         }
         guest_ptr += x * cmp_bytes;
 
-        for (; x < DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+        /*
+         * Compare each run of dirty chunks as a whole first: an idle
+         * guest keeps redrawing identical pixels, and one long compare
+         * beats many short ones.  Skipped for converted rows, which
+         * would otherwise be refilled once per run.
+         */
+        xmax = DIV_ROUND_UP(width, VNC_DIRTY_PIXELS_PER_BIT);
+        xend = find_next_zero_bit(vd->guest.dirty[y], xmax, x);
+        run_bytes = MIN(xend * cmp_bytes, min_stride) - x * cmp_bytes;
+        if (vd->guest.format == VNC_SERVER_FB_FORMAT &&
+            memcmp(server_ptr, guest_ptr, run_bytes) == 0) {
+            bitmap_clear(vd->guest.dirty[y], x, xend - x);
+            continue;
+        }
+
+        for (; x < xmax;
              x++, guest_ptr += cmp_bytes, server_ptr += cmp_bytes) {
             int _cmp_bytes = cmp_bytes;
             if (!test_and_clear_bit(x, vd->guest.dirty[y])) {
@@ -2752,7 +2792,7 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
             if ((x + 1) * cmp_bytes > min_stride) {
                 _cmp_bytes = min_stride - x * cmp_bytes;
             }
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            if (vnc_chunk_equal(server_ptr, guest_ptr, _cmp_bytes)) {
                 continue;
             }
             memcpy(server_ptr, guest_ptr, _cmp_bytes);
@@ -2779,7 +2819,8 @@ static void vnc_refresh(DisplayChangeListener *dcl)
     int has_dirty, rects = 0;
 
     if (QTAILQ_EMPTY(&vd->clients)) {
-        update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_MAX);
+        /* vnc_connect() wakes us up again */
+        displaychangelistener_set_idle(&vd->dcl, true);
         return;
     }
 
@@ -2804,7 +2845,12 @@ static void vnc_refresh(DisplayChangeListener *dcl)
             vd->dcl.update_interval = VNC_REFRESH_INTERVAL_BASE;
         }
     } else {
-        vd->dcl.update_interval += VNC_REFRESH_INTERVAL_INC;
+        /*
+         * Back off by half the current interval, so a screen that stays
+         * unchanged reaches the maximum interval within a few seconds.
+         */
+        vd->dcl.update_interval += MAX(VNC_REFRESH_INTERVAL_INC,
+                                       vd->dcl.update_interval / 2);
         if (vd->dcl.update_interval > VNC_REFRESH_INTERVAL_MAX) {
             vd->dcl.update_interval = VNC_REFRESH_INTERVAL_MAX;
         }
@@ -2837,6 +2883,7 @@ static void vnc_connect(VncDisplay *vd, int csock,
     }
 
     VNC_DEBUG("New client on socket %d\n", csock);
+    displaychangelistener_set_idle(&vd->dcl, false);
     update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_BASE);
     qemu_set_nonblock(vs->csock);
 #ifdef CONFIG_VNC_WS
@@ -3168,6 +3215,15 @@ void vnc_display_open(DisplayState *ds, const char *display, Error **errp)
 #endif
         } else if (strncmp(options, "non-adaptive", 12) == 0) {
             vs->non_adaptive = true;
+        } else if (strncmp(options, "workers=", 8) == 0) {
+            char *end;
+            long n = strtol(options + 8, &end, 10);
+
+            if (end == options + 8 || (*end && *end != ',') || n < 1) {
+                error_setg(errp, "invalid vnc workers= option");
+                goto fail;
+            }
+            vnc_set_worker_threads(n);
         } else if (strncmp(options, "share=", 6) == 0) {
             if (strncmp(options+6, "ignore", 6) == 0) {
                 vs->share_policy = VNC_SHARE_POLICY_IGNORE;
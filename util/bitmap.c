@@ -9,6 +9,7 @@
  * Version 2.
  */
 
+#include "qemu-common.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 
@@ -38,9 +39,19 @@
 
 int slow_bitmap_empty(const unsigned long *bitmap, long bits)
 {
-    long k, lim = bits/BITS_PER_LONG;
+    long k = 0, lim = bits/BITS_PER_LONG;
+    size_t len = lim * sizeof(unsigned long);
 
-    for (k = 0; k < lim; ++k) {
+    /* scan whole blocks of zero words a vector at a time */
+    len -= len % (BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR * sizeof(VECTYPE));
+    if (len && can_use_buffer_find_nonzero_offset(bitmap, len)) {
+        if (buffer_find_nonzero_offset(bitmap, len) < len) {
+            return 0;
+        }
+        k = len / sizeof(unsigned long);
+    }
+
+    for (; k < lim; ++k) {
         if (bitmap[k]) {
             return 0;
         }
@@ -107,6 +118,117 @@ void slow_bitmap_complement(unsigned long *dst, const unsigned long *src,
     }
 }
 
+/*
+ * The binary operations below first go through the bitmaps a vector at a
+ * time.  bitmap_op() returns how many words it did, always a multiple of
+ * the vector size, and sets *@nonzero if any word of the result is nonzero;
+ * the caller does the remaining words one at a time.
+ */
+typedef enum BitmapOp {
+    BITMAP_OP_AND,
+    BITMAP_OP_OR,
+    BITMAP_OP_XOR,
+    BITMAP_OP_ANDNOT,
+} BitmapOp;
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+#define AVX2_LONGS ((long)(sizeof(__m256i) / sizeof(unsigned long)))
+
+static long bitmap_op_avx2(unsigned long *dst, const unsigned long *bitmap1,
+                           const unsigned long *bitmap2, long nr,
+                           BitmapOp op, unsigned long *nonzero)
+{
+    __m256i acc = _mm256_setzero_si256();
+    long k;
+
+    for (k = 0; k + AVX2_LONGS <= nr; k += AVX2_LONGS) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(bitmap1 + k));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(bitmap2 + k));
+        __m256i r;
+
+        switch (op) {
+        case BITMAP_OP_AND:
+            r = _mm256_and_si256(a, b);
+            break;
+        case BITMAP_OP_OR:
+            r = _mm256_or_si256(a, b);
+            break;
+        case BITMAP_OP_XOR:
+            r = _mm256_xor_si256(a, b);
+            break;
+        default:
+            r = _mm256_andnot_si256(b, a);
+            break;
+        }
+        _mm256_storeu_si256((__m256i *)(dst + k), r);
+        acc = _mm256_or_si256(acc, r);
+    }
+
+    *nonzero |= !_mm256_testz_si256(acc, acc);
+    return k;
+}
+#pragma GCC pop_options
+#endif
+
+/* Same with the compile-time vector type (SSE2, Altivec or NEON), which
+ * needs aligned bitmaps. */
+static long bitmap_op_vector(unsigned long *dst, const unsigned long *bitmap1,
+                             const unsigned long *bitmap2, long nr,
+                             BitmapOp op, unsigned long *nonzero)
+{
+    const long n = sizeof(VECTYPE) / sizeof(unsigned long);
+    const VECTYPE zero = (VECTYPE){0};
+    VECTYPE acc = zero;
+    long k;
+
+    if (((uintptr_t)dst | (uintptr_t)bitmap1 | (uintptr_t)bitmap2) %
+        sizeof(VECTYPE)) {
+        return 0;
+    }
+
+    for (k = 0; k + n <= nr; k += n) {
+        VECTYPE a = *(const VECTYPE *)(bitmap1 + k);
+        VECTYPE b = *(const VECTYPE *)(bitmap2 + k);
+        VECTYPE r;
+
+        switch (op) {
+        case BITMAP_OP_AND:
+            r = a & b;
+            break;
+        case BITMAP_OP_OR:
+            r = a | b;
+            break;
+        case BITMAP_OP_XOR:
+            r = a ^ b;
+            break;
+        default:
+            r = a & ~b;
+            break;
+        }
+        *(VECTYPE *)(dst + k) = r;
+        acc |= r;
+    }
+
+    *nonzero |= !ALL_EQ(acc, zero);
+    return k;
+}
+
+static long bitmap_op(unsigned long *dst, const unsigned long *bitmap1,
+                      const unsigned long *bitmap2, long nr,
+                      BitmapOp op, unsigned long *nonzero)
+{
+#ifdef CONFIG_AVX2_OPT
+    if (qemu_cpu_has_avx2()) {
+        return bitmap_op_avx2(dst, bitmap1, bitmap2, nr, op, nonzero);
+    }
+#endif
+    return bitmap_op_vector(dst, bitmap1, bitmap2, nr, op, nonzero);
+}
+
 int slow_bitmap_and(unsigned long *dst, const unsigned long *bitmap1,
                     const unsigned long *bitmap2, long bits)
 {
@@ -114,7 +236,8 @@ int slow_bitmap_and(unsigned long *dst, const unsigned long *bitmap1,
     long nr = BITS_TO_LONGS(bits);
     unsigned long result = 0;
 
-    for (k = 0; k < nr; k++) {
+    k = bitmap_op(dst, bitmap1, bitmap2, nr, BITMAP_OP_AND, &result);
+    for (; k < nr; k++) {
         result |= (dst[k] = bitmap1[k] & bitmap2[k]);
     }
     return result != 0;
@@ -125,8 +248,10 @@ void slow_bitmap_or(unsigned long *dst, const unsigned long *bitmap1,
 {
     long k;
     long nr = BITS_TO_LONGS(bits);
+    unsigned long result = 0;
 
-    for (k = 0; k < nr; k++) {
+    k = bitmap_op(dst, bitmap1, bitmap2, nr, BITMAP_OP_OR, &result);
+    for (; k < nr; k++) {
         dst[k] = bitmap1[k] | bitmap2[k];
     }
 }
@@ -136,8 +261,10 @@ void slow_bitmap_xor(unsigned long *dst, const unsigned long *bitmap1,
 {
     long k;
     long nr = BITS_TO_LONGS(bits);
+    unsigned long result = 0;
 
-    for (k = 0; k < nr; k++) {
+    k = bitmap_op(dst, bitmap1, bitmap2, nr, BITMAP_OP_XOR, &result);
+    for (; k < nr; k++) {
         dst[k] = bitmap1[k] ^ bitmap2[k];
     }
 }
@@ -149,7 +276,8 @@ int slow_bitmap_andnot(unsigned long *dst, const unsigned long *bitmap1,
     long nr = BITS_TO_LONGS(bits);
     unsigned long result = 0;
 
-    for (k = 0; k < nr; k++) {
+    k = bitmap_op(dst, bitmap1, bitmap2, nr, BITMAP_OP_ANDNOT, &result);
+    for (; k < nr; k++) {
         result |= (dst[k] = bitmap1[k] & ~bitmap2[k]);
     }
     return result != 0;
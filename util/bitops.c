@@ -11,10 +11,41 @@
  * 2 of the License, or (at your option) any later version.
  */
 
+#include "qemu-common.h"
 #include "qemu/bitops.h"
 
 #define BITOP_WORD(nr)		((nr) / BITS_PER_LONG)
 
+/*
+ * find_next_bit switches to scanning a vector at a time after this many
+ * zero words, if at least FIND_BIT_VECTOR_MIN_BITS are left.
+ */
+#define FIND_BIT_SCALAR_WORDS   16
+#define FIND_BIT_VECTOR_MIN_BITS \
+    (4 * BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR * sizeof(VECTYPE) * \
+     BITS_PER_BYTE)
+
+/*
+ * Skip the zero words at @p, of which there are at most @size bits.
+ * Returns the first word that may be nonzero.
+ */
+static const unsigned long *skip_zero_words(const unsigned long *p,
+                                            unsigned long size)
+{
+    size_t len;
+
+    while ((uintptr_t)p % sizeof(VECTYPE)) {
+        if (*p) {
+            return p;
+        }
+        p++;
+        size -= BITS_PER_LONG;
+    }
+    len = (size / BITS_PER_LONG) * sizeof(unsigned long);
+    len -= len % (BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR * sizeof(VECTYPE));
+    return p + buffer_find_nonzero_offset(p, len) / sizeof(unsigned long);
+}
+
 /*
  * Find the next set bit in a memory region.
  */
@@ -22,8 +53,10 @@ unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
 			    unsigned long offset)
 {
     const unsigned long *p = addr + BITOP_WORD(offset);
+    const unsigned long *q;
     unsigned long result = offset & ~(BITS_PER_LONG-1);
     unsigned long tmp;
+    int zero_words = 0;
 
     if (offset >= size) {
         return size;
@@ -57,6 +90,15 @@ unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
         p += 4;
         result += 4*BITS_PER_LONG;
         size -= 4*BITS_PER_LONG;
+        zero_words += 4;
+        if (zero_words == FIND_BIT_SCALAR_WORDS &&
+            size >= FIND_BIT_VECTOR_MIN_BITS) {
+            /* a long run of zeroes, go through it a vector at a time */
+            q = skip_zero_words(p, size);
+            result += (q - p) * BITS_PER_LONG;
+            size -= (q - p) * BITS_PER_LONG;
+            p = q;
+        }
     }
     while (size >= BITS_PER_LONG) {
         if ((tmp = *(p++))) {
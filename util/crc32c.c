@@ -105,8 +105,43 @@ static const uint32_t crc32c_table[256] = {
 };
 
 
+#ifdef CONFIG_SSE42_OPT
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#include <nmmintrin.h>
+
+/* The SSE4.2 CRC32 instruction computes CRC-32C, eight bytes at a time */
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data,
+                             unsigned int length)
+{
+    while (length && ((uintptr_t)data & 7)) {
+        crc = _mm_crc32_u8(crc, *data++);
+        length--;
+    }
+#ifdef __x86_64__
+    for (; length >= 8; length -= 8, data += 8) {
+        crc = _mm_crc32_u64(crc, *(const uint64_t *)data);
+    }
+#endif
+    for (; length >= 4; length -= 4, data += 4) {
+        crc = _mm_crc32_u32(crc, *(const uint32_t *)data);
+    }
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#pragma GCC pop_options
+#endif
+
 uint32_t crc32c(uint32_t crc, const uint8_t *data, unsigned int length)
 {
+#ifdef CONFIG_SSE42_OPT
+    if (qemu_cpu_has_sse42()) {
+        return crc32c_sse42(crc, data, length) ^ 0xffffffff;
+    }
+#endif
+
     while (length--) {
         crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
     }
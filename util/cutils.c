@@ -166,6 +166,95 @@ int qemu_fdatasync(int fd)
 #endif
 }
 
+#ifdef CONFIG_CPUID_H
+#include <cpuid.h>
+
+static bool cpu_has_avx2;
+static bool cpu_has_sse42;
+static bool cpu_has_aes;
+static bool cpu_has_pclmul;
+
+static void __attribute__((constructor)) init_cpu_features(void)
+{
+    unsigned a, b, c, d;
+    uint32_t xcr0_lo, xcr0_hi;
+    int max = __get_cpuid_max(0, 0);
+
+    if (max < 1) {
+        return;
+    }
+
+    __cpuid(1, a, b, c, d);
+    cpu_has_sse42 = (c & bit_SSE4_2) != 0;
+    cpu_has_aes = (c & bit_AES) != 0;
+    cpu_has_pclmul = (c & bit_PCLMUL) != 0;
+
+    if (max < 7) {
+        return;
+    }
+
+    /* The OS must save the YMM registers on context switches */
+    if (!(c & bit_OSXSAVE)) {
+        return;
+    }
+    asm("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 6) != 6) {
+        return;
+    }
+
+    __cpuid_count(7, 0, a, b, c, d);
+    cpu_has_avx2 = (b & bit_AVX2) != 0;
+}
+
+bool qemu_cpu_has_avx2(void)
+{
+    return cpu_has_avx2;
+}
+
+bool qemu_cpu_has_sse42(void)
+{
+    return cpu_has_sse42;
+}
+
+bool qemu_cpu_has_aes(void)
+{
+    return cpu_has_aes;
+}
+
+bool qemu_cpu_has_pclmul(void)
+{
+    return cpu_has_pclmul;
+}
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* buffer_find_nonzero_offset() for hosts with AVX2, 32 bytes at a time */
+static size_t buffer_find_nonzero_offset_avx2(const void *buf, size_t len)
+{
+    const __m256i *p = buf;
+    size_t i;
+
+    for (i = 0; i < len / sizeof(__m256i); i += 4) {
+        __m256i tmp0 = _mm256_or_si256(_mm256_loadu_si256(p + i),
+                                       _mm256_loadu_si256(p + i + 1));
+        __m256i tmp1 = _mm256_or_si256(_mm256_loadu_si256(p + i + 2),
+                                       _mm256_loadu_si256(p + i + 3));
+        __m256i tmp = _mm256_or_si256(tmp0, tmp1);
+
+        if (!_mm256_testz_si256(tmp, tmp)) {
+            break;
+        }
+    }
+
+    return i * sizeof(__m256i);
+}
+#pragma GCC pop_options
+#endif
+
 /*
  * Searches for an area with non-zero content in a buffer
  *
@@ -181,7 +270,8 @@ int qemu_fdatasync(int fd)
  * down to a multiple of sizeof(VECTYPE) for the first
  * BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR chunks and down to
  * BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR * sizeof(VECTYPE)
- * afterwards.
+ * afterwards.  On hosts with AVX2 it is rounded down to a multiple
+ * of 128 bytes throughout.
  *
  * If the buffer is all zero the return value is equal to len.
  */
@@ -198,6 +288,12 @@ size_t buffer_find_nonzero_offset(const void *buf, size_t len)
         return 0;
     }
 
+#ifdef CONFIG_AVX2_OPT
+    if (cpu_has_avx2 && len % (4 * 32) == 0) {
+        return buffer_find_nonzero_offset_avx2(buf, len);
+    }
+#endif
+
     for (i = 0; i < BUFFER_FIND_NONZERO_OFFSET_UNROLL_FACTOR; i++) {
         if (!ALL_EQ(p[i], zero)) {
             return i * sizeof(VECTYPE);
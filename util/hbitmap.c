@@ -52,8 +52,19 @@
  * extremely sparse, this is also O(m + m/W + m/W^2 + ...), so the amortized
  * cost of advancing from one bit to the next is usually constant (worst case
  * O(logB n) as in the non-amortized complexity).
+ *
+ * The last level is by far the largest, and dirty bitmaps for big disks are
+ * usually very sparse.  So it is split into chunks of HB_CHUNK_WORDS words,
+ * which are allocated the first time a bit is set in them and freed when a
+ * reset clears them entirely.  A chunk is allocated iff one of its words is
+ * nonzero, i.e. iff one of the corresponding bits in the 2nd-last level is
+ * set, so iteration never reaches an unallocated chunk.
  */
 
+/* 4 KiB per chunk on 64-bit hosts */
+#define HB_CHUNK_SHIFT         9
+#define HB_CHUNK_WORDS         (1UL << HB_CHUNK_SHIFT)
+
 struct HBitmap {
     /* Number of total bits in the bottom level.  */
     uint64_t size;
@@ -87,11 +98,75 @@ struct HBitmap {
      * actual bitmap.
      *
      * Note that all bitmaps have the same number of levels.  Even a 1-bit
-     * bitmap will still allocate HBITMAP_LEVELS arrays.
+     * bitmap will still allocate HBITMAP_LEVELS arrays.  The last level is
+     * not in levels[], see chunks below.
+     */
+    unsigned long *levels[HBITMAP_LEVELS - 1];
+
+    /* The last level: @words words in chunks of HB_CHUNK_WORDS, NULL
+     * while all of their words are zero.
      */
-    unsigned long *levels[HBITMAP_LEVELS];
+    unsigned long **chunks;
+    size_t words;
 };
 
+static inline size_t hb_chunk_words(const HBitmap *hb, size_t chunk)
+{
+    return MIN(HB_CHUNK_WORDS, hb->words - (chunk << HB_CHUNK_SHIFT));
+}
+
+/* Return word @pos of @level, reading zero from unallocated chunks */
+static inline unsigned long hb_word(const HBitmap *hb, int level, size_t pos)
+{
+    const unsigned long *chunk;
+
+    if (level < HBITMAP_LEVELS - 1) {
+        return hb->levels[level][pos];
+    }
+    chunk = hb->chunks[pos >> HB_CHUNK_SHIFT];
+    return chunk ? chunk[pos & (HB_CHUNK_WORDS - 1)] : 0;
+}
+
+/* Return a pointer to word @pos of @level, allocating its chunk if needed */
+static unsigned long *hb_elem(HBitmap *hb, int level, size_t pos)
+{
+    size_t chunk = pos >> HB_CHUNK_SHIFT;
+
+    if (level < HBITMAP_LEVELS - 1) {
+        return &hb->levels[level][pos];
+    }
+    if (!hb->chunks[chunk]) {
+        hb->chunks[chunk] = g_new0(unsigned long, hb_chunk_words(hb, chunk));
+    }
+    return &hb->chunks[chunk][pos & (HB_CHUNK_WORDS - 1)];
+}
+
+/* Free the chunks between words @pos and @lastpos of the last level whose
+ * bits in the level above are all clear.
+ */
+static void hb_free_chunks(HBitmap *hb, size_t pos, size_t lastpos)
+{
+    size_t chunk, i, n;
+    const unsigned long *above;
+
+    for (chunk = pos >> HB_CHUNK_SHIFT;
+         chunk <= lastpos >> HB_CHUNK_SHIFT; chunk++) {
+        if (!hb->chunks[chunk]) {
+            continue;
+        }
+        above = &hb->levels[HBITMAP_LEVELS - 2][chunk << (HB_CHUNK_SHIFT -
+                                                          BITS_PER_LEVEL)];
+        n = DIV_ROUND_UP(hb_chunk_words(hb, chunk), BITS_PER_LONG);
+        for (i = 0; i < n && !above[i]; i++) {
+            /* nothing */
+        }
+        if (i == n) {
+            g_free(hb->chunks[chunk]);
+            hb->chunks[chunk] = NULL;
+        }
+    }
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -126,7 +201,7 @@ unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
         hbi->cur[i] = cur & (cur - 1);
 
         /* Set up next level for iteration.  */
-        cur = hb->levels[i + 1][pos];
+        cur = hb_word(hb, i + 1, pos);
     }
 
     hbi->pos = pos;
@@ -152,7 +227,7 @@ void hbitmap_iter_init(HBitmapIter *hbi, const HBitmap *hb, uint64_t first)
         pos >>= BITS_PER_LEVEL;
 
         /* Drop bits representing items before first.  */
-        hbi->cur[i] = hb->levels[i][pos] & ~((1UL << bit) - 1);
+        hbi->cur[i] = hb_word(hb, i, pos) & ~((1UL << bit) - 1);
 
         /* We have already added level i+1, so the lowest set bit has
          * been processed.  Clear it.
@@ -237,18 +312,21 @@ static void hb_set_between(HBitmap *hb, int level, uint64_t start, uint64_t last
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
+        changed |= hb_set_elem(hb_elem(hb, level, i), start, next - 1);
         for (;;) {
+            unsigned long *elem;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+            elem = hb_elem(hb, level, i);
+            changed |= (*elem == 0);
+            *elem = ~0UL;
         }
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_elem(hb_elem(hb, level, i), start, last);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
@@ -275,7 +353,7 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
 }
 
 /* Resetting works the other way round: propagate up if the new
- * value is zero.
+ * value is zero.  @elem is NULL for a word in an unallocated chunk.
  */
 static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t last)
 {
@@ -285,6 +363,10 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     assert((last >> BITS_PER_LEVEL) == (start >> BITS_PER_LEVEL));
     assert(start <= last);
 
+    if (!elem) {
+        return false;
+    }
+
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
@@ -292,6 +374,16 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     return blanked;
 }
 
+/* Like hb_elem, but return NULL instead of allocating a chunk */
+static inline unsigned long *hb_elem_noalloc(HBitmap *hb, int level,
+                                             size_t pos)
+{
+    if (level == HBITMAP_LEVELS - 1 && !hb->chunks[pos >> HB_CHUNK_SHIFT]) {
+        return NULL;
+    }
+    return hb_elem(hb, level, pos);
+}
+
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)... */
 static void hb_reset_between(HBitmap *hb, int level, uint64_t start, uint64_t last)
 {
@@ -309,25 +401,30 @@ static void hb_reset_between(HBitmap *hb, int level, uint64_t start, uint64_t la
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        if (hb_reset_elem(hb_elem_noalloc(hb, level, i), start, next - 1)) {
             changed = true;
         } else {
             pos++;
         }
 
         for (;;) {
+            unsigned long *elem;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+            elem = hb_elem_noalloc(hb, level, i);
+            if (elem) {
+                changed |= (*elem != 0);
+                *elem = 0UL;
+            }
         }
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_elem(hb_elem_noalloc(hb, level, i), start, last)) {
         changed = true;
     } else {
         lastpos--;
@@ -351,6 +448,7 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
 
     hb->count -= hb_count_between(hb, start, last);
     hb_reset_between(hb, HBITMAP_LEVELS - 1, start, last);
+    hb_free_chunks(hb, start >> BITS_PER_LEVEL, last >> BITS_PER_LEVEL);
 }
 
 bool hbitmap_get(const HBitmap *hb, uint64_t item)
@@ -359,18 +457,145 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item)
     uint64_t pos = item >> hb->granularity;
     unsigned long bit = 1UL << (pos & (BITS_PER_LONG - 1));
 
-    return (hb->levels[HBITMAP_LEVELS - 1][pos >> BITS_PER_LEVEL] & bit) != 0;
+    return (hb_word(hb, HBITMAP_LEVELS - 1, pos >> BITS_PER_LEVEL) & bit) != 0;
 }
 
 void hbitmap_free(HBitmap *hb)
 {
-    unsigned i;
-    for (i = HBITMAP_LEVELS; i-- > 0; ) {
+    size_t i;
+
+    for (i = 0; i < DIV_ROUND_UP(hb->words, HB_CHUNK_WORDS); i++) {
+        g_free(hb->chunks[i]);
+    }
+    g_free(hb->chunks);
+    for (i = HBITMAP_LEVELS - 1; i-- > 0; ) {
         g_free(hb->levels[i]);
     }
     g_free(hb);
 }
 
+uint64_t hbitmap_serialization_size(const HBitmap *hb)
+{
+    return DIV_ROUND_UP(hb->size, 8);
+}
+
+void hbitmap_serialize(const HBitmap *hb, uint8_t *buf)
+{
+    uint64_t len = hbitmap_serialization_size(hb);
+    size_t chunk, i;
+
+    /* Unallocated chunks are runs of zeroes; copy the others a word at a
+     * time, in little-endian order.
+     */
+    memset(buf, 0, len);
+    for (chunk = 0; chunk < DIV_ROUND_UP(hb->words, HB_CHUNK_WORDS); chunk++) {
+        const unsigned long *words = hb->chunks[chunk];
+        uint64_t pos = (uint64_t)chunk << HB_CHUNK_SHIFT;
+
+        if (!words) {
+            continue;
+        }
+        for (i = 0; i < hb_chunk_words(hb, chunk); i++) {
+            uint64_t ofs = (pos + i) * sizeof(unsigned long);
+            unsigned long word = words[i];
+            unsigned j;
+
+            for (j = 0; word && ofs + j < len; j++) {
+                buf[ofs + j] = word;
+                word >>= 8;
+            }
+        }
+    }
+}
+
+/* Set the @n bits from bit @first that are set in @buf, which holds them
+ * from its first byte on; @first is a multiple of 8.
+ */
+static void hb_deserialize_bits(HBitmap *hb, const uint8_t *buf,
+                                uint64_t first, uint64_t n)
+{
+    uint64_t i, start = 0;
+    bool in_run = false;
+
+    /* Set runs of consecutive bits with a single hbitmap_set call */
+    for (i = 0; i <= n; i++) {
+        bool set;
+
+        if (!in_run && i % 8 == 0 && i + 8 <= n && !buf[i / 8]) {
+            i += 7;
+            continue;
+        }
+        set = i < n && (buf[i / 8] & (1 << (i % 8)));
+
+        if (set && !in_run) {
+            start = i;
+            in_run = true;
+        } else if (!set && in_run) {
+            hbitmap_set(hb, (first + start) << hb->granularity,
+                        (i - start) << hb->granularity);
+            in_run = false;
+        }
+    }
+}
+
+void hbitmap_deserialize(HBitmap *hb, const uint8_t *buf)
+{
+    assert(hb->count == 0);
+    hb_deserialize_bits(hb, buf, 0, hb->size);
+}
+
+/* Convert a range of items to a range of bits in the last level, checking
+ * that it is a whole number of bytes of serialized data.
+ */
+static uint64_t hb_serialization_range(const HBitmap *hb, uint64_t start,
+                                       uint64_t count, uint64_t *first)
+{
+    uint64_t last = (start + count - 1) >> hb->granularity;
+
+    *first = start >> hb->granularity;
+    assert(*first % 8 == 0 && *first < hb->size);
+    assert(start % (1ULL << hb->granularity) == 0);
+    if (last >= hb->size - 1) {
+        return hb->size - *first;
+    }
+    assert((last + 1) % 8 == 0);
+    return last + 1 - *first;
+}
+
+uint64_t hbitmap_serialization_size_part(const HBitmap *hb,
+                                         uint64_t start, uint64_t count)
+{
+    uint64_t first;
+
+    return DIV_ROUND_UP(hb_serialization_range(hb, start, count, &first), 8);
+}
+
+void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
+                            uint64_t start, uint64_t count)
+{
+    uint64_t first, len, i;
+
+    len = DIV_ROUND_UP(hb_serialization_range(hb, start, count, &first), 8);
+    first /= 8;
+    for (i = 0; i < len; i++) {
+        uint64_t ofs = first + i;
+        unsigned long word = hb_word(hb, HBITMAP_LEVELS - 1,
+                                     ofs / sizeof(unsigned long));
+
+        buf[i] = word >> (8 * (ofs % sizeof(unsigned long)));
+    }
+}
+
+void hbitmap_deserialize_part(HBitmap *hb, const uint8_t *buf,
+                              uint64_t start, uint64_t count)
+{
+    uint64_t first, n;
+
+    n = hb_serialization_range(hb, start, count, &first);
+    hbitmap_reset(hb, first << hb->granularity, n << hb->granularity);
+    hb_deserialize_bits(hb, buf, first, n);
+}
+
 HBitmap *hbitmap_alloc(uint64_t size, int granularity)
 {
     HBitmap *hb = g_malloc0(sizeof (struct HBitmap));
@@ -384,7 +609,13 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     hb->granularity = granularity;
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
-        hb->levels[i] = g_malloc0(size * sizeof(unsigned long));
+        if (i == HBITMAP_LEVELS - 1) {
+            hb->words = size;
+            hb->chunks = g_new0(unsigned long *,
+                                DIV_ROUND_UP(size, HB_CHUNK_WORDS));
+        } else {
+            hb->levels[i] = g_malloc0(size * sizeof(unsigned long));
+        }
     }
 
     /* We necessarily have free bits in level 0 due to the definition
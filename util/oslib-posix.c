@@ -57,6 +57,8 @@ extern int daemon(int, int);
 #include "sysemu/sysemu.h"
 #include "trace.h"
 #include "qemu/sockets.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
 #include <sys/mman.h>
 #include <libgen.h>
 #include <setjmp.h>
@@ -160,6 +162,35 @@ void *qemu_anon_ram_alloc(size_t size, uint64_t *alignment)
     return ptr;
 }
 
+/* alloc private memory backed by hugetlb pages, trying 1G then 2M pages;
+ * returns NULL if the host has no suitable pages reserved
+ */
+void *qemu_anon_ram_alloc_hugetlb(size_t size, size_t *pagesize)
+{
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    static const int shifts[] = { 30, 21 };
+    size_t psize;
+    void *ptr;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(shifts); i++) {
+        psize = (size_t)1 << shifts[i];
+        if (size < psize || size % psize) {
+            continue;
+        }
+        ptr = mmap(0, size, PROT_READ | PROT_WRITE,
+                   MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB |
+                   (shifts[i] << MAP_HUGE_SHIFT), -1, 0);
+        if (ptr != MAP_FAILED) {
+            *pagesize = psize;
+            trace_qemu_anon_ram_alloc_hugetlb(size, psize, ptr);
+            return ptr;
+        }
+    }
+#endif
+    return NULL;
+}
+
 void qemu_vfree(void *ptr)
 {
     trace_qemu_vfree(ptr);
@@ -351,11 +382,25 @@ char *qemu_get_exec_dir(void)
     return g_strdup(exec_dir);
 }
 
-static sigjmp_buf sigjump;
+#define MAX_MEM_PREALLOC_THREADS 16
+
+typedef struct MemsetThread {
+    QemuThread thread;
+    char *addr;
+    size_t numpages;
+    size_t hpagesize;
+    sigjmp_buf env;
+} MemsetThread;
+
+static __thread MemsetThread *memset_self;
+static bool memset_thread_failed;
 
 static void sigbus_handler(int signal)
 {
-    siglongjmp(sigjump, 1);
+    if (!memset_self) {
+        abort();
+    }
+    siglongjmp(memset_self->env, 1);
 }
 
 static size_t fd_getpagesize(int fd)
@@ -378,11 +423,46 @@ static size_t fd_getpagesize(int fd)
     return getpagesize();
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory)
+static void *do_touch_pages(void *arg)
 {
-    int ret;
+    MemsetThread *t = arg;
+    sigset_t set;
+    size_t i;
+
+    /* qemu_thread_create blocks all signals, but a SIGBUS raised while
+     * touching a page is how we learn that the host ran out of pages.
+     */
+    sigemptyset(&set);
+    sigaddset(&set, SIGBUS);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    memset_self = t;
+    if (sigsetjmp(t->env, 1)) {
+        memset_thread_failed = true;
+    } else {
+        for (i = 0; i < t->numpages; i++) {
+            memset(t->addr + t->hpagesize * i, 0, 1);
+        }
+    }
+    memset_self = NULL;
+    return NULL;
+}
+
+/* Touch every page of @area, splitting the work among up to @max_threads
+ * threads.  Faulting in huge pages is dominated by the kernel zeroing them,
+ * which scales with the number of CPUs doing it.  Any NUMA policy must be
+ * applied to @area beforehand; it decides where the pages are allocated no
+ * matter which thread touches them.
+ */
+void os_mem_prealloc(int fd, char *area, size_t memory, int max_threads)
+{
+    int ret, i, num_threads;
     struct sigaction act, oldact;
-    sigset_t set, oldset;
+    size_t hpagesize = fd_getpagesize(fd);
+    size_t numpages, numpages_per_thread, leftover;
+    long host_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    MemsetThread *threads;
+    char *addr = area;
 
     memset(&act, 0, sizeof(act));
     act.sa_handler = &sigbus_handler;
@@ -394,31 +474,102 @@ void os_mem_prealloc(int fd, char *area, size_t memory)
         exit(1);
     }
 
-    /* unblock SIGBUS */
-    sigemptyset(&set);
-    sigaddset(&set, SIGBUS);
-    pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
+    /* MAP_POPULATE silently ignores failures */
+    memory = (memory + hpagesize - 1) & -hpagesize;
+    numpages = memory / hpagesize;
 
-    if (sigsetjmp(sigjump, 1)) {
+    num_threads = MIN(max_threads, MAX_MEM_PREALLOC_THREADS);
+    if (host_cpus > 0) {
+        num_threads = MIN(num_threads, host_cpus);
+    }
+    num_threads = MAX(MIN(num_threads, numpages), 1);
+
+    numpages_per_thread = numpages / num_threads;
+    leftover = numpages % num_threads;
+    memset_thread_failed = false;
+    threads = g_new0(MemsetThread, num_threads);
+    for (i = 0; i < num_threads; i++) {
+        threads[i].addr = addr;
+        threads[i].numpages = numpages_per_thread + (i < leftover);
+        threads[i].hpagesize = hpagesize;
+        qemu_thread_create(&threads[i].thread, "touch_pages",
+                           do_touch_pages, &threads[i],
+                           QEMU_THREAD_JOINABLE);
+        addr += threads[i].numpages * hpagesize;
+    }
+    for (i = 0; i < num_threads; i++) {
+        qemu_thread_join(&threads[i].thread);
+    }
+    g_free(threads);
+
+    ret = sigaction(SIGBUS, &oldact, NULL);
+    if (ret) {
+        perror("os_mem_prealloc: failed to reinstall signal handler");
+        exit(1);
+    }
+
+    if (memset_thread_failed) {
         fprintf(stderr, "os_mem_prealloc: Insufficient free host memory "
                         "pages available to allocate guest RAM\n");
         exit(1);
-    } else {
-        int i;
-        size_t hpagesize = fd_getpagesize(fd);
+    }
+}
 
-        /* MAP_POPULATE silently ignores failures */
-        memory = (memory + hpagesize - 1) & -hpagesize;
-        for (i = 0; i < (memory / hpagesize); i++) {
-            memset(area + (hpagesize * i), 0, 1);
-        }
+typedef struct PopulateThread {
+    QemuThread thread;
+    char *addr;
+    size_t numpages;
+} PopulateThread;
 
-        ret = sigaction(SIGBUS, &oldact, NULL);
-        if (ret) {
-            perror("os_mem_prealloc: failed to reinstall signal handler");
-            exit(1);
-        }
+static void *do_populate_pages(void *arg)
+{
+    PopulateThread *t = arg;
+    size_t pagesize = getpagesize();
+    size_t i;
+
+    for (i = 0; i < t->numpages; i++) {
+        atomic_fetch_add(t->addr + pagesize * i, 0);
+    }
+    return NULL;
+}
 
-        pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+/* Fault in every page of @area for writing without changing its contents,
+ * splitting the work among up to @max_threads threads.  Unlike
+ * os_mem_prealloc this is safe on memory that is already in use, e.g. guest
+ * RAM while vCPUs run, because each page is touched with an atomic no-op.
+ * @area must already be backed, as a fault that cannot be satisfied kills
+ * the process.
+ */
+void os_mem_populate(char *area, size_t memory, int max_threads)
+{
+    int i, num_threads;
+    size_t pagesize = getpagesize();
+    size_t numpages, numpages_per_thread, leftover;
+    long host_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    PopulateThread *threads;
+    char *addr = area;
+
+    numpages = (memory + pagesize - 1) / pagesize;
+
+    num_threads = MIN(max_threads, MAX_MEM_PREALLOC_THREADS);
+    if (host_cpus > 0) {
+        num_threads = MIN(num_threads, host_cpus);
+    }
+    num_threads = MAX(MIN(num_threads, numpages), 1);
+
+    numpages_per_thread = numpages / num_threads;
+    leftover = numpages % num_threads;
+    threads = g_new0(PopulateThread, num_threads);
+    for (i = 0; i < num_threads; i++) {
+        threads[i].addr = addr;
+        threads[i].numpages = numpages_per_thread + (i < leftover);
+        qemu_thread_create(&threads[i].thread, "populate_pages",
+                           do_populate_pages, &threads[i],
+                           QEMU_THREAD_JOINABLE);
+        addr += threads[i].numpages * pagesize;
+    }
+    for (i = 0; i < num_threads; i++) {
+        qemu_thread_join(&threads[i].thread);
     }
+    g_free(threads);
 }
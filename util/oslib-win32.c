@@ -37,6 +37,7 @@
 #include "qemu/main-loop.h"
 #include "trace.h"
 #include "qemu/sockets.h"
+#include "qemu/atomic.h"
 
 /* this must come after including "trace.h" */
 #include <shlobj.h>
@@ -79,6 +80,11 @@ void *qemu_anon_ram_alloc(size_t size, uint64_t *align)
     return ptr;
 }
 
+void *qemu_anon_ram_alloc_hugetlb(size_t size, size_t *pagesize)
+{
+    return NULL;
+}
+
 void qemu_vfree(void *ptr)
 {
     trace_qemu_vfree(ptr);
@@ -460,7 +466,7 @@ size_t getpagesize(void)
     return system_info.dwPageSize;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory)
+void os_mem_prealloc(int fd, char *area, size_t memory, int max_threads)
 {
     int i;
     size_t pagesize = getpagesize();
@@ -470,3 +476,13 @@ void os_mem_prealloc(int fd, char *area, size_t memory)
         memset(area + pagesize * i, 0, 1);
     }
 }
+
+void os_mem_populate(char *area, size_t memory, int max_threads)
+{
+    size_t i;
+    size_t pagesize = getpagesize();
+
+    for (i = 0; i < memory; i += pagesize) {
+        atomic_fetch_add(area + i, 0);
+    }
+}
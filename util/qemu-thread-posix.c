@@ -23,9 +23,11 @@
 #ifdef __linux__
 #include <sys/syscall.h>
 #include <linux/futex.h>
+#include <sched.h>
 #endif
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
+#include "qemu/bitops.h"
 
 static bool name_threads;
 
@@ -451,11 +453,88 @@ void qemu_thread_get_self(QemuThread *thread)
     thread->thread = pthread_self();
 }
 
+/* Restrict @thread to the host CPUs set in the @nbits-bit bitmap @host_cpus.
+ * Returns 0 or a negative errno value.
+ */
+int qemu_thread_set_affinity(QemuThread *thread, unsigned long *host_cpus,
+                             unsigned long nbits)
+{
+#ifdef __linux__
+    cpu_set_t *cpuset;
+    size_t setsize = CPU_ALLOC_SIZE(nbits);
+    unsigned long cpu;
+    int err;
+
+    cpuset = CPU_ALLOC(nbits);
+    if (!cpuset) {
+        return -ENOMEM;
+    }
+    CPU_ZERO_S(setsize, cpuset);
+    for (cpu = find_first_bit(host_cpus, nbits); cpu < nbits;
+         cpu = find_next_bit(host_cpus, nbits, cpu + 1)) {
+        CPU_SET_S(cpu, setsize, cpuset);
+    }
+    err = pthread_setaffinity_np(thread->thread, setsize, cpuset);
+    CPU_FREE(cpuset);
+    return -err;
+#else
+    return -ENOSYS;
+#endif
+}
+
+/* CPU time @thread consumed so far, or a negative errno */
+int64_t qemu_thread_get_cpu_time_ns(QemuThread *thread)
+{
+#ifdef __linux__
+    clockid_t clock;
+    struct timespec ts;
+    int err;
+
+    err = pthread_getcpuclockid(thread->thread, &clock);
+    if (err) {
+        return -err;
+    }
+    if (clock_gettime(clock, &ts) < 0) {
+        return -errno;
+    }
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#else
+    return -ENOSYS;
+#endif
+}
+
 bool qemu_thread_is_self(QemuThread *thread)
 {
    return pthread_equal(pthread_self(), thread->thread);
 }
 
+static __thread NotifierList thread_exit;
+static pthread_key_t exit_key;
+
+void qemu_thread_atexit_add(Notifier *notifier)
+{
+    notifier_list_add(&thread_exit, notifier);
+    /* Only non-NULL keys get their destructor run.  */
+    pthread_setspecific(exit_key, &thread_exit);
+}
+
+void qemu_thread_atexit_remove(Notifier *notifier)
+{
+    notifier_remove(notifier);
+}
+
+static void qemu_thread_atexit_run(void *arg)
+{
+    NotifierList *list = arg;
+
+    notifier_list_notify(list, NULL);
+}
+
+static void __attribute__((constructor)) qemu_thread_atexit_init(void)
+{
+    pthread_key_create(&exit_key, qemu_thread_atexit_run);
+}
+
 void qemu_thread_exit(void *retval)
 {
     pthread_exit(retval);
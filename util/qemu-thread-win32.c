@@ -276,6 +276,17 @@ struct QemuThreadData {
 };
 
 static __thread QemuThreadData *qemu_thread_data;
+static __thread NotifierList thread_exit;
+
+void qemu_thread_atexit_add(Notifier *notifier)
+{
+    notifier_list_add(&thread_exit, notifier);
+}
+
+void qemu_thread_atexit_remove(Notifier *notifier)
+{
+    notifier_remove(notifier);
+}
 
 static unsigned __stdcall win32_start_routine(void *arg)
 {
@@ -296,6 +307,7 @@ void qemu_thread_exit(void *arg)
 {
     QemuThreadData *data = qemu_thread_data;
 
+    notifier_list_notify(&thread_exit, NULL);
     if (data) {
         assert(data->mode != QEMU_THREAD_DETACHED);
         data->ret = arg;
@@ -393,3 +405,14 @@ bool qemu_thread_is_self(QemuThread *thread)
 {
     return GetCurrentThreadId() == thread->tid;
 }
+
+int qemu_thread_set_affinity(QemuThread *thread, unsigned long *host_cpus,
+                             unsigned long nbits)
+{
+    return -ENOSYS;
+}
+
+int64_t qemu_thread_get_cpu_time_ns(QemuThread *thread)
+{
+    return -ENOSYS;
+}
@@ -0,0 +1,542 @@
+/*
+ * qht.c - QEMU Hash Table, designed to scale for read-mostly workloads.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ * Assumptions:
+ * - NULL cannot be inserted/removed as a pointer value.
+ * - Trying to insert an already-existing hash-pointer pair is OK. However,
+ *   it is not OK to insert into the same hash table different hash-pointer
+ *   pairs that have the same pointer value, but not the hashes.
+ * - Lookups are performed under the guarantee that the objects stored in
+ *   the table are not freed while a lookup is in progress.
+ *
+ * Features:
+ * - Reads (i.e. lookups and iterators) can be concurrent with other reads.
+ *   Lookups that are concurrent with writes to the same bucket will retry
+ *   via a seqlock; iterators serialize against writers.
+ * - Writes (i.e. insertions/removals) are serialized by a table-wide lock.
+ * - Optional auto-resizing: the hash table resizes up if the load surpasses
+ *   a certain threshold.  Resizing is done concurrently with readers.
+ *
+ * The key structure is the bucket, which is cacheline-sized.  Buckets
+ * contain a few hash values and pointers; the u32 hash values are stored in
+ * full so that resizing is fast.  Having this structure instead of directly
+ * chaining items has two advantages:
+ * - Failed lookups fail fast, and touch a minimum number of cache lines.
+ * - Resizing the hash table with concurrent lookups is easy.
+ *
+ * Entries in a bucket chain are kept compact: removing an entry moves the
+ * last entry of the chain into the hole, so the first empty slot marks the
+ * end of the chain.  Overflow buckets are never freed while the map is
+ * live, since a concurrent reader may be walking them.
+ */
+#include <assert.h>
+#include <string.h>
+#include <glib.h>
+
+#include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qemu/seqlock.h"
+#include "qemu/qht.h"
+
+#define QHT_BUCKET_ALIGN 64
+
+/* define these to keep sizeof(qht_bucket) within QHT_BUCKET_ALIGN */
+#if HOST_LONG_BITS == 32
+#define QHT_BUCKET_ENTRIES 6
+#else /* 64-bit */
+#define QHT_BUCKET_ENTRIES 3
+#endif
+
+/*
+ * Note: reading partially-updated pointers in @pointers could lead to
+ * segfaults.  We thus access them with atomic_read/set; this guarantees
+ * that the compiler makes all those accesses atomic.  We also need
+ * atomic_read for @hashes since they are read by lookups concurrently
+ * with writers.
+ */
+struct qht_bucket {
+    QemuSeqLock sequence;
+    uint32_t hashes[QHT_BUCKET_ENTRIES];
+    void *pointers[QHT_BUCKET_ENTRIES];
+    struct qht_bucket *next;
+} __attribute__((aligned(QHT_BUCKET_ALIGN)));
+
+/*
+ * Grow the table once the number of overflow buckets exceeds
+ * n_buckets / QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV.
+ */
+#define QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV 8
+
+struct qht_map {
+    struct qht_bucket *buckets;
+    size_t n_buckets;
+    size_t n_added_buckets;
+    size_t n_added_buckets_threshold;
+    struct qht_map *next_retired;
+};
+
+static inline size_t qht_elems_to_buckets(size_t n_elems)
+{
+    size_t n = DIV_ROUND_UP(n_elems, QHT_BUCKET_ENTRIES);
+    size_t ret = 1;
+
+    while (ret < n) {
+        ret <<= 1;
+    }
+    return ret;
+}
+
+static inline struct qht_bucket *qht_map_to_bucket(struct qht_map *map,
+                                                   uint32_t hash)
+{
+    return &map->buckets[hash & (map->n_buckets - 1)];
+}
+
+static void qht_bucket_init(struct qht_bucket *b)
+{
+    memset(b, 0, sizeof(*b));
+    seqlock_init(&b->sequence, NULL);
+}
+
+static struct qht_map *qht_map_create(size_t n_buckets)
+{
+    struct qht_map *map;
+    size_t i;
+
+    QEMU_BUILD_BUG_ON(sizeof(struct qht_bucket) > QHT_BUCKET_ALIGN);
+
+    map = g_new0(struct qht_map, 1);
+    map->n_buckets = n_buckets;
+    map->n_added_buckets_threshold = n_buckets /
+        QHT_NR_ADDED_BUCKETS_THRESHOLD_DIV;
+    /* let tiny hash tables to at least add one non-head bucket */
+    if (unlikely(map->n_added_buckets_threshold == 0)) {
+        map->n_added_buckets_threshold = 1;
+    }
+    map->buckets = qemu_memalign(QHT_BUCKET_ALIGN,
+                                 sizeof(*map->buckets) * n_buckets);
+    for (i = 0; i < n_buckets; i++) {
+        qht_bucket_init(&map->buckets[i]);
+    }
+    return map;
+}
+
+static void qht_map_destroy(struct qht_map *map)
+{
+    size_t i;
+
+    for (i = 0; i < map->n_buckets; i++) {
+        struct qht_bucket *b = map->buckets[i].next;
+
+        while (b) {
+            struct qht_bucket *next = b->next;
+
+            qemu_vfree(b);
+            b = next;
+        }
+    }
+    qemu_vfree(map->buckets);
+    g_free(map);
+}
+
+void qht_init(struct qht *ht, size_t n_elems, unsigned int mode)
+{
+    size_t n_buckets = qht_elems_to_buckets(n_elems);
+
+    ht->mode = mode;
+    ht->retired = NULL;
+    qemu_mutex_init(&ht->lock);
+    ht->map = qht_map_create(n_buckets);
+}
+
+void qht_destroy(struct qht *ht)
+{
+    struct qht_map *map = ht->retired;
+
+    while (map) {
+        struct qht_map *next = map->next_retired;
+
+        qht_map_destroy(map);
+        map = next;
+    }
+    qht_map_destroy(ht->map);
+    qemu_mutex_destroy(&ht->lock);
+    memset(ht, 0, sizeof(*ht));
+}
+
+/* call with ht->lock held */
+static void qht_bucket_reset__locked(struct qht_bucket *head)
+{
+    struct qht_bucket *b = head;
+    int i;
+
+    seqlock_write_lock(&head->sequence);
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i] == NULL) {
+                goto done;
+            }
+            atomic_set(&b->hashes[i], 0);
+            atomic_set(&b->pointers[i], NULL);
+        }
+        b = b->next;
+    } while (b);
+ done:
+    seqlock_write_unlock(&head->sequence);
+}
+
+void qht_reset(struct qht *ht)
+{
+    struct qht_map *map;
+    size_t i;
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    for (i = 0; i < map->n_buckets; i++) {
+        qht_bucket_reset__locked(&map->buckets[i]);
+    }
+    qemu_mutex_unlock(&ht->lock);
+}
+
+static void *qht_do_lookup(struct qht_bucket *head, qht_lookup_func_t func,
+                           const void *userp, uint32_t hash)
+{
+    struct qht_bucket *b = head;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (atomic_read(&b->hashes[i]) == hash) {
+                void *p = atomic_read(&b->pointers[i]);
+
+                if (likely(p) && likely(func(p, userp))) {
+                    return p;
+                }
+            }
+        }
+        b = atomic_read(&b->next);
+        smp_read_barrier_depends();
+    } while (b);
+
+    return NULL;
+}
+
+void *qht_lookup(struct qht *ht, qht_lookup_func_t func, const void *userp,
+                 uint32_t hash)
+{
+    struct qht_map *map;
+    struct qht_bucket *b;
+    unsigned int version;
+    void *ret;
+
+    map = atomic_read(&ht->map);
+    for (;;) {
+        smp_read_barrier_depends();
+        b = qht_map_to_bucket(map, hash);
+
+        do {
+            version = seqlock_read_begin(&b->sequence);
+            ret = qht_do_lookup(b, func, userp, hash);
+        } while (seqlock_read_retry(&b->sequence, version));
+
+        /*
+         * A resize may have published a new map while we were walking this
+         * one.  Removals only go to the current map, so an entry found in a
+         * retired map may have been removed since; look again in the new map.
+         */
+        smp_rmb();
+        if (likely(atomic_read(&ht->map) == map)) {
+            return ret;
+        }
+        map = atomic_read(&ht->map);
+    }
+}
+
+/* call with ht->lock held, or on a map that is not visible to readers yet */
+static bool qht_insert__locked(struct qht_map *map, struct qht_bucket *head,
+                               void *p, uint32_t hash, bool *needs_resize)
+{
+    struct qht_bucket *b = head;
+    struct qht_bucket *prev = NULL;
+    struct qht_bucket *new = NULL;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i]) {
+                if (unlikely(b->pointers[i] == p)) {
+                    return false;
+                }
+            } else {
+                goto found;
+            }
+        }
+        prev = b;
+        b = b->next;
+    } while (b);
+
+    b = qemu_memalign(QHT_BUCKET_ALIGN, sizeof(*b));
+    qht_bucket_init(b);
+    new = b;
+    i = 0;
+    map->n_added_buckets++;
+    if (unlikely(map->n_added_buckets > map->n_added_buckets_threshold)) {
+        *needs_resize = true;
+    }
+
+ found:
+    /* found an empty key: acquire the seqlock and write */
+    seqlock_write_lock(&head->sequence);
+    if (new) {
+        atomic_set(&prev->next, b);
+    }
+    atomic_set(&b->hashes[i], hash);
+    atomic_set(&b->pointers[i], p);
+    seqlock_write_unlock(&head->sequence);
+    return true;
+}
+
+/* call with ht->lock held */
+static void qht_map_iter__locked(struct qht *ht, struct qht_map *map,
+                                 qht_iter_func_t func, void *userp)
+{
+    size_t i;
+
+    for (i = 0; i < map->n_buckets; i++) {
+        struct qht_bucket *b = &map->buckets[i];
+        int j;
+
+        do {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (b->pointers[j] == NULL) {
+                    goto next_head;
+                }
+                func(ht, b->pointers[j], b->hashes[j], userp);
+            }
+            b = b->next;
+        } while (b);
+    next_head:
+        ;
+    }
+}
+
+static void qht_map_copy(struct qht *ht, void *p, uint32_t hash, void *userp)
+{
+    struct qht_map *new = userp;
+    bool dummy = false;
+
+    qht_insert__locked(new, qht_map_to_bucket(new, hash), p, hash, &dummy);
+}
+
+/*
+ * Replace ht->map with a map of @n_buckets buckets.  The old map is kept
+ * on the retired list because lookups may still be walking it.
+ *
+ * Call with ht->lock held.
+ */
+static void qht_do_resize(struct qht *ht, size_t n_buckets)
+{
+    struct qht_map *old = ht->map;
+    struct qht_map *new;
+
+    new = qht_map_create(n_buckets);
+    qht_map_iter__locked(ht, old, qht_map_copy, new);
+
+    /* make the new map's contents visible before publishing it */
+    smp_wmb();
+    atomic_set(&ht->map, new);
+
+    old->next_retired = ht->retired;
+    ht->retired = old;
+}
+
+bool qht_resize(struct qht *ht, size_t n_elems)
+{
+    size_t n_buckets = qht_elems_to_buckets(n_elems);
+    bool ret = false;
+
+    qemu_mutex_lock(&ht->lock);
+    if (n_buckets != ht->map->n_buckets) {
+        qht_do_resize(ht, n_buckets);
+        ret = true;
+    }
+    qemu_mutex_unlock(&ht->lock);
+    return ret;
+}
+
+bool qht_insert(struct qht *ht, void *p, uint32_t hash)
+{
+    struct qht_map *map;
+    bool needs_resize = false;
+    bool ret;
+
+    /* NULL pointers are not supported */
+    assert(p);
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    ret = qht_insert__locked(map, qht_map_to_bucket(map, hash), p, hash,
+                             &needs_resize);
+    if (unlikely(needs_resize) && (ht->mode & QHT_MODE_AUTO_RESIZE)) {
+        qht_do_resize(ht, map->n_buckets * 2);
+    }
+    qemu_mutex_unlock(&ht->lock);
+    return ret;
+}
+
+static inline bool qht_entry_is_last(struct qht_bucket *b, int pos)
+{
+    if (pos == QHT_BUCKET_ENTRIES - 1) {
+        if (b->next == NULL) {
+            return true;
+        }
+        return b->next->pointers[0] == NULL;
+    }
+    return b->pointers[pos + 1] == NULL;
+}
+
+static void qht_entry_move(struct qht_bucket *to, int i,
+                           struct qht_bucket *from, int j)
+{
+    assert(!(to == from && i == j));
+    assert(to->pointers[i]);
+    assert(from->pointers[j]);
+
+    atomic_set(&to->hashes[i], from->hashes[j]);
+    atomic_set(&to->pointers[i], from->pointers[j]);
+
+    atomic_set(&from->hashes[j], 0);
+    atomic_set(&from->pointers[j], NULL);
+}
+
+/*
+ * Find the last valid entry in @orig, and swap it with @orig[pos], which has
+ * just been invalidated.
+ */
+static void qht_bucket_remove_entry(struct qht_bucket *orig, int pos)
+{
+    struct qht_bucket *b = orig;
+    struct qht_bucket *prev = NULL;
+    int i;
+
+    if (qht_entry_is_last(orig, pos)) {
+        atomic_set(&orig->hashes[pos], 0);
+        atomic_set(&orig->pointers[pos], NULL);
+        return;
+    }
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i]) {
+                continue;
+            }
+            if (i > 0) {
+                qht_entry_move(orig, pos, b, i - 1);
+                return;
+            }
+            assert(prev);
+            qht_entry_move(orig, pos, prev, QHT_BUCKET_ENTRIES - 1);
+            return;
+        }
+        prev = b;
+        b = b->next;
+    } while (b);
+    /* no free entries other than orig[pos], so swap it with the last one */
+    qht_entry_move(orig, pos, prev, QHT_BUCKET_ENTRIES - 1);
+}
+
+/* call with ht->lock held */
+static bool qht_remove__locked(struct qht_bucket *head, const void *p,
+                               uint32_t hash)
+{
+    struct qht_bucket *b = head;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            void *q = b->pointers[i];
+
+            if (unlikely(q == NULL)) {
+                return false;
+            }
+            if (q == p) {
+                assert(b->hashes[i] == hash);
+                seqlock_write_lock(&head->sequence);
+                qht_bucket_remove_entry(b, i);
+                seqlock_write_unlock(&head->sequence);
+                return true;
+            }
+        }
+        b = b->next;
+    } while (b);
+    return false;
+}
+
+bool qht_remove(struct qht *ht, const void *p, uint32_t hash)
+{
+    struct qht_map *map;
+    bool ret;
+
+    /* NULL pointers are not supported */
+    assert(p);
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    ret = qht_remove__locked(qht_map_to_bucket(map, hash), p, hash);
+    qemu_mutex_unlock(&ht->lock);
+    return ret;
+}
+
+void qht_iter(struct qht *ht, qht_iter_func_t func, void *userp)
+{
+    qemu_mutex_lock(&ht->lock);
+    qht_map_iter__locked(ht, ht->map, func, userp);
+    qemu_mutex_unlock(&ht->lock);
+}
+
+void qht_statistics_init(struct qht *ht, struct qht_stats *stats)
+{
+    struct qht_map *map;
+    size_t total_chain = 0;
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    stats->head_buckets = map->n_buckets;
+    for (i = 0; i < map->n_buckets; i++) {
+        struct qht_bucket *b = &map->buckets[i];
+        size_t chain = 0;
+        int j;
+
+        if (b->pointers[0] == NULL) {
+            continue;
+        }
+        stats->used_head_buckets++;
+        do {
+            if (b->pointers[0] == NULL) {
+                break;
+            }
+            chain++;
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (b->pointers[j] == NULL) {
+                    break;
+                }
+                stats->entries++;
+            }
+            b = b->next;
+        } while (b);
+        total_chain += chain;
+        if (chain > stats->max_chain) {
+            stats->max_chain = chain;
+        }
+    }
+    qemu_mutex_unlock(&ht->lock);
+
+    if (stats->used_head_buckets) {
+        stats->avg_chain = (double)total_chain / stats->used_head_buckets;
+    }
+}
@@ -327,6 +327,18 @@ static QemuOptsList qemu_machine_opts = {
             .name = "kvm_shadow_mem",
             .type = QEMU_OPT_SIZE,
             .help = "KVM shadow MMU size",
+        }, {
+            .name = "kvm-dirty-ring-size",
+            .type = QEMU_OPT_NUMBER,
+            .help = "entries in each vCPU's KVM dirty ring (0 = dirty bitmap)",
+        }, {
+            .name = "kvm-halt-poll-ns",
+            .type = QEMU_OPT_NUMBER,
+            .help = "longest a halted KVM vCPU polls before sleeping",
+        }, {
+            .name = "xen-mapcache-cached",
+            .type = QEMU_OPT_NUMBER,
+            .help = "unlocked Xen mapcache mappings kept for reuse",
         }, {
             .name = "kernel",
             .type = QEMU_OPT_STRING,
@@ -363,6 +375,14 @@ static QemuOptsList qemu_machine_opts = {
             .name = "mem-merge",
             .type = QEMU_OPT_BOOL,
             .help = "enable/disable memory merge support",
+        },{
+            .name = "mem-hugetlb",
+            .type = QEMU_OPT_BOOL,
+            .help = "back guest RAM with hugetlb pages when available",
+        },{
+            .name = "share-roms",
+            .type = QEMU_OPT_BOOL,
+            .help = "map firmware images copy-on-write from their files",
         },{
             .name = "usb",
             .type = QEMU_OPT_BOOL,
@@ -2269,6 +2289,14 @@ static int mon_init_func(QemuOpts *opts, void *opaque)
     if (qemu_opt_get_bool(opts, "pretty", 0))
         flags |= MONITOR_USE_PRETTY;
 
+    if (qemu_opt_get_bool(opts, "oob", false)) {
+        if (!(flags & MONITOR_USE_CONTROL)) {
+            fprintf(stderr, "out-of-band execution needs mode=control\n");
+            exit(1);
+        }
+        flags |= MONITOR_USE_OOB;
+    }
+
     if (qemu_opt_get_bool(opts, "default", 0))
         flags |= MONITOR_IS_DEFAULT;
 
@@ -2583,6 +2611,48 @@ void qemu_add_machine_init_done_notifier(Notifier *notify)
     notifier_list_add(&machine_init_done_notifiers, notify);
 }
 
+/* Wall-clock time spent in each phase of main() up to the main loop,
+ * shown by "info startup".
+ */
+typedef struct StartupPhase {
+    const char *name;
+    int64_t ns;
+} StartupPhase;
+
+#define STARTUP_PHASES_MAX 16
+
+static StartupPhase startup_phases[STARTUP_PHASES_MAX];
+static int startup_nb_phases;
+static int64_t startup_phase_start;
+
+static void startup_phase_done(const char *name)
+{
+    int64_t now = get_clock();
+    StartupPhase *phase;
+
+    assert(startup_nb_phases < STARTUP_PHASES_MAX);
+    phase = &startup_phases[startup_nb_phases++];
+    phase->name = name;
+    phase->ns = now - startup_phase_start;
+    trace_vl_startup_phase(name, phase->ns);
+    startup_phase_start = now;
+}
+
+void dump_startup_profile(FILE *f, fprintf_function cpu_fprintf)
+{
+    int64_t total = 0;
+    int i;
+
+    cpu_fprintf(f, "Startup phases:\n");
+    for (i = 0; i < startup_nb_phases; i++) {
+        cpu_fprintf(f, "  %-24s %10" PRId64 " us\n",
+                    startup_phases[i].name, startup_phases[i].ns / 1000);
+        total += startup_phases[i].ns;
+    }
+    cpu_fprintf(f, "  %-24s %10" PRId64 " us\n", "total", total / 1000);
+    qdev_dump_realize_times(f, cpu_fprintf);
+}
+
 static void qemu_run_machine_init_done_notifiers(void)
 {
     notifier_list_notify(&machine_init_done_notifiers, NULL);
@@ -2777,6 +2847,7 @@ int main(int argc, char **argv, char **envp)
     FILE *vmstate_dump_file = NULL;
     Error *main_loop_err = NULL;
 
+    startup_phase_start = get_clock();
     atexit(qemu_run_exit_notifiers);
     error_set_progname(argv[0]);
     qemu_init_exec_dir(argv[0]);
@@ -3661,6 +3732,15 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_tcg_hot_threshold:
+                tcg_tb_hot_threshold = strtoul(optarg, NULL, 0);
+                break;
+            case QEMU_OPTION_perfmap:
+                tcg_perf_map = true;
+                break;
+            case QEMU_OPTION_jitdump:
+                tcg_jitdump = true;
+                break;
             case QEMU_OPTION_icount:
                 icount_opts = qemu_opts_parse(qemu_find_opts("icount"),
                                               optarg, 1);
@@ -4073,7 +4153,9 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    startup_phase_done("command line");
     configure_accelerator(current_machine);
+    startup_phase_done("accelerator");
 
     if (qtest_chrdev) {
         Error *local_err = NULL;
@@ -4261,7 +4343,9 @@ int main(int argc, char **argv, char **envp)
     current_machine->boot_order = boot_order;
     current_machine->cpu_model = cpu_model;
 
+    startup_phase_done("backends");
     machine_class->init(current_machine);
+    startup_phase_done("machine");
 
     realtime_init();
 
@@ -4280,6 +4364,7 @@ int main(int argc, char **argv, char **envp)
     /* init generic devices */
     if (qemu_opts_foreach(qemu_find_opts("device"), device_init_func, NULL, 1) != 0)
         exit(1);
+    startup_phase_done("devices");
 
     /* Did we create any drives that we failed to create a device for? */
     drive_check_orphaned();
@@ -4347,12 +4432,15 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    startup_phase_done("displays");
+
     qdev_machine_creation_done();
 
     if (rom_load_all() != 0) {
         fprintf(stderr, "rom loading failed\n");
         exit(1);
     }
+    startup_phase_done("roms");
 
     /* TODO: once all bus devices are qdevified, this should be done
      * when bus is created by qdev.c */
@@ -4361,8 +4449,10 @@ int main(int argc, char **argv, char **envp)
 
     /* Done notifiers can load ROMs */
     rom_load_done();
+    startup_phase_done("machine init done");
 
     qemu_system_reset(VMRESET_SILENT);
+    startup_phase_done("reset");
     if (loadvm) {
         if (load_vmstate(loadvm) < 0) {
             autostart = 0;
@@ -4396,6 +4486,7 @@ int main(int argc, char **argv, char **envp)
             exit(1);
         }
     }
+    startup_phase_done("start");
 
     main_loop();
     bdrv_close_all();
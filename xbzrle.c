@@ -11,8 +11,93 @@
  *
  */
 #include "qemu-common.h"
+#include "qemu/host-utils.h"
 #include "include/migration/migration.h"
 
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* Length of the run of equal (or, if !@eq, differing) bytes at the start */
+static inline uint32_t xbzrle_run_len_avx2(const uint8_t *old_buf,
+                                           const uint8_t *new_buf,
+                                           int len, bool eq)
+{
+    int i = 0;
+
+    while (i + 32 <= len) {
+        __m256i o = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i n = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+
+        if (eq) {
+            mask = ~mask;
+        }
+        if (mask) {
+            return i + ctz32(mask);
+        }
+        i += 32;
+    }
+
+    while (i < len && (old_buf[i] == new_buf[i]) == eq) {
+        i++;
+    }
+    return i;
+}
+
+/* Same encoding as the generic version, 32 bytes at a time */
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        zrun_len = xbzrle_run_len_avx2(old_buf + i, new_buf + i, slen - i,
+                                       true);
+        i += zrun_len;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        nzrun_len = xbzrle_run_len_avx2(old_buf + i, new_buf + i, slen - i,
+                                        false);
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + i, nzrun_len);
+        d += nzrun_len;
+        i += nzrun_len;
+    }
+
+    return d;
+}
+#pragma GCC pop_options
+#endif
+
 /*
   page = zrun nzrun
        | zrun nzrun page
@@ -34,6 +119,12 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
                sizeof(long)));
 
+#ifdef CONFIG_AVX2_OPT
+    if (qemu_cpu_has_avx2()) {
+        return xbzrle_encode_buffer_avx2(old_buf, new_buf, slen, dst, dlen);
+    }
+#endif
+
     while (i < slen) {
         /* overflow */
         if (d + 2 > dlen) {
@@ -12,6 +12,7 @@
 #include "hw/xen/xen.h"
 #include "exec/memory.h"
 #include "qmp-commands.h"
+#include "qapi/qmp/qerror.h"
 
 int xen_pci_slot_get_pirq(PCIDevice *pci_dev, int irq_num)
 {
@@ -60,3 +61,9 @@ int xen_hvm_init(ram_addr_t *below_4g_mem_size, ram_addr_t *above_4g_mem_size,
 void qmp_xen_set_global_dirty_log(bool enable, Error **errp)
 {
 }
+
+XenMapCacheInfo *qmp_query_xen_mapcache(Error **errp)
+{
+    error_set(errp, QERR_FEATURE_DISABLED, "xen");
+    return NULL;
+}
@@ -1153,7 +1153,8 @@ int xen_hvm_init(ram_addr_t *below_4g_mem_size, ram_addr_t *above_4g_mem_size,
     state->bufioreq_local_port = rc;
 
     /* Init RAM management */
-    xen_map_cache_init(xen_phys_offset_to_gaddr, state);
+    xen_map_cache_init(xen_phys_offset_to_gaddr, state,
+                       current_machine->xen_mapcache_cached);
     xen_ram_init(below_4g_mem_size, above_4g_mem_size, ram_size, ram_memory);
 
     qemu_add_vm_change_state_handler(xen_hvm_change_state_handler, state);
@@ -20,6 +20,8 @@
 #include <sys/mman.h>
 
 #include "sysemu/xen-mapcache.h"
+#include "qmp-commands.h"
+#include "qapi/qmp/qerror.h"
 #include "trace.h"
 
 
@@ -52,19 +54,28 @@
 #define mapcache_lock()   ((void)0)
 #define mapcache_unlock() ((void)0)
 
+/*
+ * Each bucket is the head of a chain.  Chained entries are created when the
+ * mappings already in the chain are locked; once their last lock goes away
+ * they are kept mapped on an LRU list, so that the next request for the same
+ * guest memory does not have to go through xc_map_foreign_bulk again.  At
+ * most max_cached of them are kept; the least recently used one is unmapped
+ * when the list grows past that.
+ */
 typedef struct MapCacheEntry {
     hwaddr paddr_index;
     uint8_t *vaddr_base;
     unsigned long *valid_mapping;
-    uint8_t lock;
+    unsigned int lock;
     hwaddr size;
     struct MapCacheEntry *next;
+    QTAILQ_ENTRY(MapCacheEntry) lru;
 } MapCacheEntry;
 
 typedef struct MapCacheRev {
     uint8_t *vaddr_req;
     hwaddr paddr_index;
-    hwaddr size;
+    MapCacheEntry *entry;
     QTAILQ_ENTRY(MapCacheRev) next;
 } MapCacheRev;
 
@@ -73,11 +84,20 @@ typedef struct MapCache {
     unsigned long nr_buckets;
     QTAILQ_HEAD(map_cache_head, MapCacheRev) locked_entries;
 
+    /* Unlocked chained entries, most recently used first */
+    QTAILQ_HEAD(map_cache_lru, MapCacheEntry) lru;
+    unsigned long nr_cached;
+    unsigned long max_cached;
+
     /* For most cases (>99.9%), the page address is the same. */
     MapCacheEntry *last_entry;
     unsigned long max_mcache_size;
     unsigned int mcache_bucket_shift;
 
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
     phys_offset_to_gaddr_t phys_offset_to_gaddr;
     void *opaque;
 } MapCache;
@@ -93,7 +113,61 @@ static inline int test_bits(int nr, int size, const unsigned long *addr)
         return 0;
 }
 
-void xen_map_cache_init(phys_offset_to_gaddr_t f, void *opaque)
+static inline bool entry_is_bucket(MapCacheEntry *entry)
+{
+    return entry >= mapcache->entry &&
+           entry < mapcache->entry + mapcache->nr_buckets;
+}
+
+static void xen_unmap_entry(MapCacheEntry *entry)
+{
+    MapCacheEntry *pentry;
+
+    pentry = &mapcache->entry[entry->paddr_index % mapcache->nr_buckets];
+    while (pentry->next != entry) {
+        pentry = pentry->next;
+    }
+    pentry->next = entry->next;
+
+    if (mapcache->last_entry == entry) {
+        mapcache->last_entry = NULL;
+    }
+    if (munmap(entry->vaddr_base, entry->size) != 0) {
+        perror("unmap fails");
+        exit(-1);
+    }
+    g_free(entry->valid_mapping);
+    g_free(entry);
+}
+
+/* Make an unlocked chained entry the most recently used one */
+static void xen_map_cache_lru_insert(MapCacheEntry *entry)
+{
+    QTAILQ_INSERT_HEAD(&mapcache->lru, entry, lru);
+    mapcache->nr_cached++;
+}
+
+static void xen_map_cache_lru_remove(MapCacheEntry *entry)
+{
+    QTAILQ_REMOVE(&mapcache->lru, entry, lru);
+    mapcache->nr_cached--;
+}
+
+static void xen_map_cache_lru_trim(void)
+{
+    MapCacheEntry *entry;
+
+    while (mapcache->nr_cached > mapcache->max_cached) {
+        entry = QTAILQ_LAST(&mapcache->lru, map_cache_lru);
+        trace_xen_map_cache_evict(entry->paddr_index, entry->size);
+        xen_map_cache_lru_remove(entry);
+        xen_unmap_entry(entry);
+        mapcache->evictions++;
+    }
+}
+
+void xen_map_cache_init(phys_offset_to_gaddr_t f, void *opaque,
+                        unsigned long max_cached)
 {
     unsigned long size;
     struct rlimit rlimit_as;
@@ -102,8 +176,10 @@ void xen_map_cache_init(phys_offset_to_gaddr_t f, void *opaque)
 
     mapcache->phys_offset_to_gaddr = f;
     mapcache->opaque = opaque;
+    mapcache->max_cached = max_cached;
 
     QTAILQ_INIT(&mapcache->locked_entries);
+    QTAILQ_INIT(&mapcache->lru);
 
     if (geteuid() == 0) {
         rlimit_as.rlim_cur = RLIM_INFINITY;
@@ -196,7 +272,7 @@ static void xen_remap_bucket(MapCacheEntry *entry,
 uint8_t *xen_map_cache(hwaddr phys_addr, hwaddr size,
                        uint8_t lock)
 {
-    MapCacheEntry *entry, *pentry = NULL;
+    MapCacheEntry *entry, *pentry = NULL, *free_entry;
     hwaddr address_index;
     hwaddr address_offset;
     hwaddr __size = size;
@@ -226,6 +302,7 @@ tryagain:
         test_bits(address_offset >> XC_PAGE_SHIFT,
                   __test_bit_size >> XC_PAGE_SHIFT,
                   mapcache->last_entry->valid_mapping)) {
+        mapcache->hits++;
         trace_xen_map_cache_return(mapcache->last_entry->vaddr_base + address_offset);
         return mapcache->last_entry->vaddr_base + address_offset;
     }
@@ -240,28 +317,39 @@ tryagain:
         __size = MCACHE_BUCKET_SIZE;
     }
 
+    /*
+     * Any mapping of this index that is at least as large as the request
+     * will do, locked or not.  Otherwise remap the first unlocked entry of
+     * the chain, or add a new one if they are all locked.
+     */
     entry = &mapcache->entry[address_index % mapcache->nr_buckets];
-
-    while (entry && entry->lock && entry->vaddr_base &&
-            (entry->paddr_index != address_index || entry->size != __size ||
-             !test_bits(address_offset >> XC_PAGE_SHIFT,
-                 __test_bit_size >> XC_PAGE_SHIFT,
-                 entry->valid_mapping))) {
+    free_entry = NULL;
+    while (entry) {
+        if (entry->vaddr_base && entry->paddr_index == address_index &&
+            entry->size >= __size &&
+            test_bits(address_offset >> XC_PAGE_SHIFT,
+                      __test_bit_size >> XC_PAGE_SHIFT,
+                      entry->valid_mapping)) {
+            break;
+        }
+        if (!entry->lock && !free_entry) {
+            free_entry = entry;
+        }
         pentry = entry;
         entry = entry->next;
     }
-    if (!entry) {
-        entry = g_malloc0(sizeof (MapCacheEntry));
-        pentry->next = entry;
-        xen_remap_bucket(entry, __size, address_index);
-    } else if (!entry->lock) {
-        if (!entry->vaddr_base || entry->paddr_index != address_index ||
-                entry->size != __size ||
-                !test_bits(address_offset >> XC_PAGE_SHIFT,
-                    __test_bit_size >> XC_PAGE_SHIFT,
-                    entry->valid_mapping)) {
-            xen_remap_bucket(entry, __size, address_index);
+    if (entry) {
+        mapcache->hits++;
+    } else {
+        mapcache->misses++;
+        if (free_entry) {
+            entry = free_entry;
+        } else {
+            entry = g_malloc0(sizeof (MapCacheEntry));
+            pentry->next = entry;
+            xen_map_cache_lru_insert(entry);
         }
+        xen_remap_bucket(entry, __size, address_index);
     }
 
     if(!test_bits(address_offset >> XC_PAGE_SHIFT,
@@ -278,12 +366,18 @@ tryagain:
     }
 
     mapcache->last_entry = entry;
+    if (!entry_is_bucket(entry) && !entry->lock) {
+        xen_map_cache_lru_remove(entry);
+        if (!lock) {
+            xen_map_cache_lru_insert(entry);
+        }
+    }
     if (lock) {
         MapCacheRev *reventry = g_malloc0(sizeof(MapCacheRev));
         entry->lock++;
         reventry->vaddr_req = mapcache->last_entry->vaddr_base + address_offset;
         reventry->paddr_index = mapcache->last_entry->paddr_index;
-        reventry->size = entry->size;
+        reventry->entry = entry;
         QTAILQ_INSERT_HEAD(&mapcache->locked_entries, reventry, next);
     }
 
@@ -293,16 +387,12 @@ tryagain:
 
 ram_addr_t xen_ram_addr_from_mapcache(void *ptr)
 {
-    MapCacheEntry *entry = NULL;
+    MapCacheEntry *entry;
     MapCacheRev *reventry;
-    hwaddr paddr_index;
-    hwaddr size;
     int found = 0;
 
     QTAILQ_FOREACH(reventry, &mapcache->locked_entries, next) {
         if (reventry->vaddr_req == ptr) {
-            paddr_index = reventry->paddr_index;
-            size = reventry->size;
             found = 1;
             break;
         }
@@ -317,30 +407,19 @@ ram_addr_t xen_ram_addr_from_mapcache(void *ptr)
         return 0;
     }
 
-    entry = &mapcache->entry[paddr_index % mapcache->nr_buckets];
-    while (entry && (entry->paddr_index != paddr_index || entry->size != size)) {
-        entry = entry->next;
-    }
-    if (!entry) {
-        DPRINTF("Trying to find address %p that is not in the mapcache!\n", ptr);
-        return 0;
-    }
+    entry = reventry->entry;
     return (reventry->paddr_index << MCACHE_BUCKET_SHIFT) +
         ((unsigned long) ptr - (unsigned long) entry->vaddr_base);
 }
 
 void xen_invalidate_map_cache_entry(uint8_t *buffer)
 {
-    MapCacheEntry *entry = NULL, *pentry = NULL;
+    MapCacheEntry *entry;
     MapCacheRev *reventry;
-    hwaddr paddr_index;
-    hwaddr size;
     int found = 0;
 
     QTAILQ_FOREACH(reventry, &mapcache->locked_entries, next) {
         if (reventry->vaddr_req == buffer) {
-            paddr_index = reventry->paddr_index;
-            size = reventry->size;
             found = 1;
             break;
         }
@@ -352,35 +431,18 @@ void xen_invalidate_map_cache_entry(uint8_t *buffer)
         }
         return;
     }
+    entry = reventry->entry;
     QTAILQ_REMOVE(&mapcache->locked_entries, reventry, next);
     g_free(reventry);
 
-    if (mapcache->last_entry != NULL &&
-        mapcache->last_entry->paddr_index == paddr_index) {
-        mapcache->last_entry = NULL;
-    }
-
-    entry = &mapcache->entry[paddr_index % mapcache->nr_buckets];
-    while (entry && (entry->paddr_index != paddr_index || entry->size != size)) {
-        pentry = entry;
-        entry = entry->next;
-    }
-    if (!entry) {
-        DPRINTF("Trying to unmap address %p that is not in the mapcache!\n", buffer);
-        return;
-    }
     entry->lock--;
-    if (entry->lock > 0 || pentry == NULL) {
+    if (entry->lock > 0 || entry_is_bucket(entry)) {
         return;
     }
 
-    pentry->next = entry->next;
-    if (munmap(entry->vaddr_base, entry->size) != 0) {
-        perror("unmap fails");
-        exit(-1);
-    }
-    g_free(entry->valid_mapping);
-    g_free(entry);
+    /* Keep the mapping around for the next request; see MapCacheEntry */
+    xen_map_cache_lru_insert(entry);
+    xen_map_cache_lru_trim();
 }
 
 void xen_invalidate_map_cache(void)
@@ -399,6 +461,13 @@ void xen_invalidate_map_cache(void)
 
     mapcache_lock();
 
+    while (!QTAILQ_EMPTY(&mapcache->lru)) {
+        MapCacheEntry *entry = QTAILQ_FIRST(&mapcache->lru);
+
+        xen_map_cache_lru_remove(entry);
+        xen_unmap_entry(entry);
+    }
+
     for (i = 0; i < mapcache->nr_buckets; i++) {
         MapCacheEntry *entry = &mapcache->entry[i];
 
@@ -425,3 +494,27 @@ void xen_invalidate_map_cache(void)
 
     mapcache_unlock();
 }
+
+XenMapCacheInfo *qmp_query_xen_mapcache(Error **errp)
+{
+    XenMapCacheInfo *info;
+    MapCacheRev *reventry;
+
+    if (!mapcache) {
+        error_set(errp, QERR_FEATURE_DISABLED, "xen");
+        return NULL;
+    }
+
+    info = g_malloc0(sizeof(*info));
+    info->buckets = mapcache->nr_buckets;
+    info->bucket_size = MCACHE_BUCKET_SIZE;
+    info->cached = mapcache->nr_cached;
+    info->max_cached = mapcache->max_cached;
+    QTAILQ_FOREACH(reventry, &mapcache->locked_entries, next) {
+        info->locked++;
+    }
+    info->hits = mapcache->hits;
+    info->misses = mapcache->misses;
+    info->evictions = mapcache->evictions;
+    return info;
+}